@@ -4,6 +4,7 @@
 #include <map>
 #include <unordered_map>
 #include <optional>
+#include <span>
 #include <variant>
 
 #include <arch/mem_space.hpp>
@@ -32,7 +33,9 @@ namespace drm_core {
 struct Event {
 	uint64_t cookie;
 	uint32_t crtcId;
-	uint64_t timestamp;
+	uint64_t sequence = 0;
+	// Set to the time of posting if zero.
+	uint64_t timestamp = 0;
 };
 
 /**
@@ -98,11 +101,12 @@ struct File {
 	}
 
 private:
-	async::detached pageFlipEvent(std::unique_ptr<drm_core::Configuration> config,
-		drm_core::File *self, uint64_t cookie, uint32_t crtc_id);
-	async::detached pageFlipEvent(std::unique_ptr<drm_core::Configuration> config,
-		drm_core::File *self, uint64_t cookie, std::vector<uint32_t> crtc_id);
-	void _retirePageFlip(uint64_t cookie, uint32_t crtc_id);
+	// Waits until a committed configuration is scanned out, i.e., for the vblank
+	// after its completion, and retires the page flip if an event was requested.
+	static async::result<void> finishCommit(std::unique_ptr<drm_core::Configuration> config,
+		drm_core::File *self, std::vector<std::shared_ptr<Crtc>> crtcs,
+		std::optional<uint64_t> cookie);
+	void _retirePageFlip(uint64_t cookie, uint32_t crtc_id, Crtc::Vblank vblank);
 
 	std::shared_ptr<Device> _device;
 
@@ -197,7 +201,18 @@ drm_mode_modeinfo makeModeInfo(const char *name, uint32_t type,
 void addDmtModes(std::vector<drm_mode_modeinfo> &supported_modes,
 		unsigned int max_width, unsigned max_height);
 
+// Clips damage rectangles to a framebuffer of the given size and drops empty ones.
+// An empty list of clips (as passed by DIRTYFB) damages the whole framebuffer.
+std::vector<drm_mode_rect> clipDamage(std::span<const drm_mode_rect> clips,
+		uint32_t width, uint32_t height);
+
+// Returns a write-combining view of (the first size bytes of) memory, e.g., of a BAR.
+// Linear framebuffers should be mapped through such views.
+helix::UniqueDescriptor createWriteCombiningView(helix::BorrowedDescriptor memory, size_t size);
+
 // Copies 16-byte aligned buffers. Expected to be faster than plain memcpy().
+// Uses non-temporal stores since the destination is usually (write-combining)
+// framebuffer memory that is not read back.
 #if defined(__x86_64__) || defined(__aarch64__)
 	extern "C" void fastCopy16(void *, const void *, size_t);
 #else
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <async/result.hpp>
 #include <core/id-allocator.hpp>
 #include <helix/ipc.hpp>
 #include <map>
@@ -37,6 +38,19 @@ public:
 	//returns name, desc, date
 	virtual std::tuple<std::string, std::string, std::string> driverInfo() = 0;
 
+	/**
+	 * Wraps memory that was not allocated by this device (e.g., a BO exported by another
+	 * DRM device) into a BufferObject, without copying it.
+	 *
+	 * Returns nullptr if the device cannot scan out of foreign memory.
+	 */
+	virtual std::shared_ptr<BufferObject> importMemory(helix::UniqueDescriptor memory,
+			size_t size) {
+		(void)memory;
+		(void)size;
+		return nullptr;
+	}
+
 	void setupCrtc(Crtc *crtc);
 	void setupEncoder(Encoder *encoder);
 	void attachConnector(Connector *connector);
@@ -107,12 +121,16 @@ private:
 	std::shared_ptr<Property> _crtcWProperty;
 	std::shared_ptr<Property> _crtcHProperty;
 	std::shared_ptr<Property> _inFormatsProperty;
+	std::shared_ptr<Property> _fbDamageClipsProperty;
 
 	std::map<helix_ng::Credentials, std::shared_ptr<drm_core::BufferObject>> _exportedBufferObjects;
 
 public:
 	void registerBufferObject(std::shared_ptr<drm_core::BufferObject> obj, helix_ng::Credentials creds);
 	std::shared_ptr<drm_core::BufferObject> findBufferObject(helix_ng::Credentials creds);
+	// Imports a PRIME fd that was not exported by this device, see importMemory().
+	async::result<std::shared_ptr<drm_core::BufferObject>>
+	importForeignBufferObject(helix_ng::Credentials creds);
 
 	id_allocator<uint32_t> allocator;
 
@@ -151,6 +169,7 @@ public:
 	Property *crtcWProperty();
 	Property *crtcHProperty();
 	Property *inFormatsProperty();
+	Property *fbDamageClipsProperty();
 };
 
 } //namespace drm_core
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <async/recurring-event.hpp>
+#include <async/result.hpp>
 #include <core/id-allocator.hpp>
 #include <libdrm/drm_fourcc.h>
 
@@ -132,10 +134,49 @@ public:
 
 	std::vector<drm_core::Assignment> getAssignments(std::shared_ptr<Device> dev);
 
+	struct Vblank {
+		uint64_t sequence;
+		uint64_t timestamp;
+	};
+
+	/**
+	 * Called by drivers that receive vblank interrupts, @p timestamp is in nanoseconds.
+	 *
+	 * Once a driver calls this, vblanks are no longer emulated by a software timer
+	 * running at the refresh rate of the current mode.
+	 */
+	void handleVblank(uint64_t timestamp);
+
+	// Completes on the next vblank.
+	async::result<Vblank> nextVblank();
+
+	Vblank lastVblank() {
+		return {_vblankSequence, _vblankTimestamp};
+	}
+
+	/**
+	 * Commits to a CRTC are queued: atomic commits, including non-blocking ones, wait
+	 * for the previous commit to take effect (i.e., for the vblank after it completed),
+	 * such that userspace cannot get ahead of the display.
+	 */
+	async::result<void> waitForCommits();
+	void beginCommit();
+	void endCommit();
+
 	int index;
 
 private:
+	uint64_t _vblankPeriod();
+
 	std::shared_ptr<CrtcState> _drmState;
+
+	bool _hardwareVblank = false;
+	uint64_t _vblankSequence = 0;
+	uint64_t _vblankTimestamp = 0;
+	async::recurring_event _vblankEvent;
+
+	unsigned int _pendingCommits = 0;
+	async::recurring_event _commitEvent;
 };
 
 /**
@@ -247,7 +288,8 @@ public:
 	uint32_t format();
 	void setFormat(uint32_t format);
 
-	virtual void notifyDirty() = 0;
+	// Called on DIRTYFB with the damaged regions, already clipped to the framebuffer.
+	virtual void notifyDirty(std::vector<drm_mode_rect> damage) = 0;
 	virtual uint32_t getWidth() = 0;
 	virtual uint32_t getHeight() = 0;
 	virtual uint32_t getModifier() = 0;
@@ -307,6 +349,20 @@ struct PlaneState {
 	uint32_t src_h = 0;
 
 	std::shared_ptr<Blob> in_formats;
+
+	// Damaged regions (struct drm_mode_rect) of fb in this commit, if userspace passed any.
+	std::shared_ptr<Blob> fb_damage_clips;
+	// Whether this commit attached a different framebuffer.
+	bool fb_changed = false;
+
+	/**
+	 * Returns the damaged regions of the framebuffer in this commit, clipped to its size.
+	 *
+	 * Without damage clips, the whole framebuffer is damaged. Drivers that keep a
+	 * copy of each framebuffer on the device (rather than of the scanout) set
+	 * @p per_buffer, as the clips are relative to the previously displayed framebuffer.
+	 */
+	std::vector<drm_mode_rect> damage(bool per_buffer = false);
 };
 
 } //namespace drm_core
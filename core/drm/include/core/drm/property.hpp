@@ -49,6 +49,7 @@ enum PropertyId {
 	crtcW,
 	crtcH,
 	inFormats,
+	fbDamageClips,
 };
 
 struct Property {
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <assert.h>
 #include <stdio.h>
 #include <deque>
@@ -122,7 +123,8 @@ drm_core::File::importBufferObject(helix_ng::Credentials creds) {
 }
 
 void drm_core::File::postEvent(drm_core::Event event) {
-	HEL_CHECK(helGetClock(&event.timestamp));
+	if(!event.timestamp)
+		HEL_CHECK(helGetClock(&event.timestamp));
 
 	if(_pendingEvents.empty()) {
 		++_eventSequence;
@@ -144,12 +146,12 @@ drm_core::File::read(void *object, helix_ng::CredentialsView,
 
 	auto ev = &self->_pendingEvents.front();
 
-	// TODO: Support sequence number and CRTC id.
 	drm_event_vblank out;
 	memset(&out, 0, sizeof(drm_event_vblank));
 	out.base.type = DRM_EVENT_FLIP_COMPLETE;
 	out.base.length = sizeof(drm_event_vblank);
 	out.user_data = ev->cookie;
+	out.sequence = ev->sequence;
 	out.crtc_id = ev->crtcId;
 	out.tv_sec = ev->timestamp / 1000000000;
 	out.tv_usec = (ev->timestamp % 1000000000) / 1000;
@@ -199,10 +201,12 @@ drm_core::File::pollStatus(void *object) {
 	co_return protocols::fs::PollStatusResult{self->_eventSequence, s};
 }
 
-void drm_core::File::_retirePageFlip(uint64_t cookie, uint32_t crtc_id) {
+void drm_core::File::_retirePageFlip(uint64_t cookie, uint32_t crtc_id, Crtc::Vblank vblank) {
 	Event event;
 	event.cookie = cookie;
 	event.crtcId = crtc_id;
+	event.sequence = vblank.sequence;
+	event.timestamp = vblank.timestamp;
 	postEvent(event);
 }
 
@@ -291,7 +295,8 @@ async::detached serveDrmDevice(std::shared_ptr<drm_core::Device> device,
 
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::SUCCESS);
-			resp.set_caps(managarm::fs::FileCaps::FC_STATUS_PAGE | managarm::fs::FileCaps::FC_POSIX_LANE);
+			resp.set_caps(managarm::fs::FileCaps::FC_STATUS_PAGE | managarm::fs::FileCaps::FC_POSIX_LANE
+					| managarm::fs::FileCaps::FC_POPULATE_MAPPINGS);
 
 			auto [send_resp, push_pt, push_page] = co_await helix_ng::exchangeMsgs(conversation,
 				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
@@ -742,3 +747,47 @@ void drm_core::addDmtModes(std::vector<drm_mode_modeinfo> &supported_modes,
 	}
 }
 
+helix::UniqueDescriptor drm_core::createWriteCombiningView(helix::BorrowedDescriptor memory,
+		size_t size) {
+	HelHandle handle;
+	HEL_CHECK(helCreateSliceView(memory.getHandle(), 0, (size + 0xFFF) & ~size_t{0xFFF},
+			kHelSliceCacheWriteCombine, &handle));
+	return helix::UniqueDescriptor{handle};
+}
+
+#if defined(__x86_64__)
+
+extern "C" void fastCopy16Sse2(void *, const void *, size_t);
+extern "C" void fastCopy16Avx2(void *, const void *, size_t);
+
+void drm_core::fastCopy16(void *dst, const void *src, size_t size) {
+	static auto copy = [] {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? &fastCopy16Avx2 : &fastCopy16Sse2;
+	}();
+	copy(dst, src, size);
+}
+
+#endif
+
+std::vector<drm_mode_rect> drm_core::clipDamage(std::span<const drm_mode_rect> clips,
+		uint32_t width, uint32_t height) {
+	auto w = static_cast<int32_t>(width);
+	auto h = static_cast<int32_t>(height);
+
+	if(clips.empty())
+		return {drm_mode_rect{0, 0, w, h}};
+
+	std::vector<drm_mode_rect> rects;
+	for(auto clip : clips) {
+		drm_mode_rect rect{
+			std::max(clip.x1, 0),
+			std::max(clip.y1, 0),
+			std::min(clip.x2, w),
+			std::min(clip.y2, h)
+		};
+		if(rect.x1 < rect.x2 && rect.y1 < rect.y2)
+			rects.push_back(rect);
+	}
+	return rects;
+}
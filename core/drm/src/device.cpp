@@ -2,6 +2,7 @@
 #include "core/drm/device.hpp"
 #include "core/drm/debug.hpp"
 #include "core/drm/property.hpp"
+#include "posix.bragi.hpp"
 
 // ----------------------------------------------------------------
 // Device
@@ -90,6 +91,50 @@ std::shared_ptr<drm_core::BufferObject> drm_core::Device::findBufferObject(helix
 	return it->second;
 }
 
+/**
+ * Asks POSIX for the memory behind a PRIME fd, given the credentials of its lane, and
+ * lets the driver wrap it into a BufferObject. Like our own exports, the BufferObject is
+ * registered with the credentials such that subsequent imports resolve to it.
+ */
+async::result<std::shared_ptr<drm_core::BufferObject>>
+drm_core::Device::importForeignBufferObject(helix_ng::Credentials creds) {
+	managarm::posix::CntRequest req;
+	req.set_request_type(managarm::posix::CntReqType::FD_ACCESS_MEMORY);
+	req.set_passthrough_credentials(creds);
+
+	auto ser = req.SerializeAsString();
+	auto [offer, send_req, recv_resp] = co_await helix_ng::exchangeMsgs(
+		_posixLane,
+		helix_ng::offer(
+			helix_ng::sendBuffer(ser.data(), ser.size()),
+			helix_ng::recvInline())
+	);
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::posix::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	recv_resp.reset();
+	if(resp.error() != managarm::posix::Errors::SUCCESS)
+		co_return nullptr;
+
+	auto [pull_memory] = co_await helix_ng::exchangeMsgs(
+		offer.descriptor(),
+		helix_ng::pullDescriptor()
+	);
+	HEL_CHECK(pull_memory.error());
+	auto memory = pull_memory.descriptor();
+
+	size_t size;
+	HEL_CHECK(helMemoryInfo(memory.getHandle(), &size));
+
+	auto bo = importMemory(std::move(memory), size);
+	if(bo)
+		registerBufferObject(bo, creds);
+	co_return bo;
+}
+
 uint64_t drm_core::Device::installMapping(drm_core::BufferObject *bo) {
 	assert(bo->getSize() < (UINT64_C(1) << 32));
 	return static_cast<uint64_t>(_memorySlotAllocator.allocate()) << 32;
@@ -198,6 +243,10 @@ drm_core::Property *drm_core::Device::inFormatsProperty() {
 	return _inFormatsProperty.get();
 }
 
+drm_core::Property *drm_core::Device::fbDamageClipsProperty() {
+	return _fbDamageClipsProperty.get();
+}
+
 void drm_core::Device::registerProperty(std::shared_ptr<drm_core::Property> p) {
 	_properties.insert({p->id(), p});
 }
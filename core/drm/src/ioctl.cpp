@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <libdrm/drm_fourcc.h>
 
 #include <bragi/helpers-std.hpp>
@@ -47,17 +48,16 @@ async::result<void> initOstrace() {
 
 }
 
-async::detached drm_core::File::pageFlipEvent(std::unique_ptr<drm_core::Configuration> config,
-		drm_core::File *self, uint64_t cookie, uint32_t crtc_id) {
+async::result<void> drm_core::File::finishCommit(std::unique_ptr<drm_core::Configuration> config,
+		drm_core::File *self, std::vector<std::shared_ptr<drm_core::Crtc>> crtcs,
+		std::optional<uint64_t> cookie) {
 	co_await config->waitForCompletion();
-	self->_retirePageFlip(cookie, crtc_id);
-}
-
-async::detached drm_core::File::pageFlipEvent(std::unique_ptr<drm_core::Configuration> config,
-		drm_core::File *self, uint64_t cookie, std::vector<uint32_t> crtc_ids) {
-	co_await config->waitForCompletion();
-	for(auto id : crtc_ids)
-		self->_retirePageFlip(cookie, id);
+	for(auto &crtc : crtcs) {
+		auto vblank = co_await crtc->nextVblank();
+		if(cookie)
+			self->_retirePageFlip(*cookie, crtc->id(), vblank);
+		crtc->endCommit();
+	}
 }
 
 async::result<void>
@@ -640,14 +640,22 @@ drm_core::File::ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg,
 			assignments.push_back(Assignment::withModeObj(crtc->primaryPlane()->sharedModeObject(), self->_device->fbIdProperty(), fb));
 			assignments.push_back(Assignment::withModeObj(crtc->primaryPlane()->sharedModeObject(), self->_device->crtcIdProperty(), crtc->sharedModeObject()));
 
+			// Like Linux, we do not allow more than one pending flip per CRTC;
+			// instead of failing with EBUSY, wait for the previous one to retire.
+			co_await crtc->waitForCommits();
+
 			auto config = self->_device->createConfiguration();
 			auto state = self->_device->atomicState();
 			auto valid = config->capture(assignments, state);
 			assert(valid);
+			crtc->beginCommit();
 			config->commit(std::move(state));
 
+			std::optional<uint64_t> cookie;
 			if(req->drm_flags() & DRM_MODE_PAGE_FLIP_EVENT)
-				self->pageFlipEvent(std::move(config), self, req->drm_cookie(), crtc->id());
+				cookie = req->drm_cookie();
+			async::detach(finishCommit(std::move(config), self,
+					{std::static_pointer_cast<drm_core::Crtc>(obj)}, cookie));
 
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 
@@ -670,7 +678,11 @@ drm_core::File::ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg,
 			} else {
 				auto fb = obj->asFrameBuffer();
 				assert(fb);
-				fb->notifyDirty();
+
+				std::vector<drm_mode_rect> clips;
+				for(auto &clip : req->drm_clips())
+					clips.push_back({clip.x1(), clip.y1(), clip.x2(), clip.y2()});
+				fb->notifyDirty(clipDamage(clips, fb->getWidth(), fb->getHeight()));
 			}
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
@@ -1092,7 +1104,11 @@ drm_core::File::ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg,
 			size_t prop_count = 0;
 			std::vector<drm_core::Assignment> assignments;
 
-			std::vector<uint32_t> crtc_ids;
+			std::vector<std::shared_ptr<drm_core::Crtc>> crtcs;
+			auto addCrtc = [&] (std::shared_ptr<drm_core::Crtc> crtc) {
+				if(crtc && std::ranges::find(crtcs, crtc) == crtcs.end())
+					crtcs.push_back(std::move(crtc));
+			};
 
 			auto config = self->_device->createConfiguration();
 			auto state = self->_device->atomicState();
@@ -1127,7 +1143,7 @@ drm_core::File::ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg,
 				}
 
 				if(mode_obj->type() == ObjectType::crtc) {
-					crtc_ids.push_back(mode_obj->id());
+					addCrtc(std::static_pointer_cast<drm_core::Crtc>(mode_obj));
 				}
 
 				for(size_t j = 0; j < req->drm_prop_counts(i); j++) {
@@ -1169,15 +1185,35 @@ drm_core::File::ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg,
 			}
 
 			if(!(req->drm_flags() & DRM_MODE_ATOMIC_TEST_ONLY)) {
+				// Planes flip on the CRTC that they are (or were) bound to.
+				for(size_t i = 0; i < req->drm_obj_ids_size(); i++) {
+					auto mode_obj = self->_device->findObject(req->drm_obj_ids(i));
+					if(mode_obj->type() != ObjectType::plane)
+						continue;
+					addCrtc(mode_obj->asPlane()->drmState()->crtc);
+					addCrtc(state->plane(mode_obj->id())->crtc);
+				}
+
+				// Commits to a CRTC are serialized: a commit only starts once the
+				// previous one was scanned out. Unlike Linux, we wait instead of
+				// failing non-blocking commits with EBUSY.
+				for(auto &crtc : crtcs)
+					co_await crtc->waitForCommits();
+
 				if(logDrmRequests)
 					std::cout << "\tCommitting configuration ..." << std::endl;
+				for(auto &crtc : crtcs)
+					crtc->beginCommit();
 				config->commit(std::move(state));
-				if(!(req->drm_flags() & DRM_MODE_ATOMIC_NONBLOCK))
-					co_await config->waitForCompletion();
-			}
 
-			if(req->drm_flags() & DRM_MODE_PAGE_FLIP_EVENT) {
-				self->pageFlipEvent(std::move(config), self, req->drm_cookie(), std::move(crtc_ids));
+				std::optional<uint64_t> cookie;
+				if(req->drm_flags() & DRM_MODE_PAGE_FLIP_EVENT)
+					cookie = req->drm_cookie();
+				if(req->drm_flags() & DRM_MODE_ATOMIC_NONBLOCK) {
+					async::detach(finishCommit(std::move(config), self, std::move(crtcs), cookie));
+				}else{
+					co_await finishCommit(std::move(config), self, std::move(crtcs), cookie);
+				}
 			}
 
 			resp.set_error(managarm::fs::Errors::SUCCESS);
@@ -1269,6 +1305,10 @@ drm_core::File::ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg,
 			helix_ng::Credentials credentials = creds.credentials();
 			auto [bo, handle] = self->importBufferObject(credentials);
 
+			// The fd was exported by another device (or is some other file that provides memory).
+			if(!bo && co_await self->_device->importForeignBufferObject(credentials))
+				std::tie(bo, handle) = self->importBufferObject(credentials);
+
 			if(bo) {
 				resp.set_error(managarm::fs::Errors::SUCCESS);
 				resp.set_drm_prime_handle(handle);
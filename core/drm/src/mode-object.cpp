@@ -1,6 +1,8 @@
+#include <string.h>
 #include <sys/epoll.h>
 
 #include <helix/memory.hpp>
+#include <helix/timer.hpp>
 #include <libdrm/drm_fourcc.h>
 
 #include "core/drm/mode-object.hpp"
@@ -160,6 +162,74 @@ std::vector<drm_core::Assignment> drm_core::Crtc::getAssignments(std::shared_ptr
 	return assignments;
 }
 
+void drm_core::Crtc::handleVblank(uint64_t timestamp) {
+	_hardwareVblank = true;
+	_vblankSequence++;
+	_vblankTimestamp = timestamp;
+	_vblankEvent.raise();
+}
+
+async::result<drm_core::Crtc::Vblank> drm_core::Crtc::nextVblank() {
+	if(_hardwareVblank) {
+		auto sequence = _vblankSequence;
+		while(_vblankSequence == sequence)
+			co_await _vblankEvent.async_wait();
+		co_return lastVblank();
+	}
+
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	if(!_vblankTimestamp)
+		_vblankTimestamp = now;
+
+	// Emulated vblanks happen at multiples of the refresh period after the last one that
+	// was observed. This keeps the sequence number accurate without a periodic timer.
+	auto period = _vblankPeriod();
+	auto elapsed = (now - _vblankTimestamp) / period + 1;
+	Vblank next{_vblankSequence + elapsed, _vblankTimestamp + elapsed * period};
+
+	co_await helix::sleepUntil(next.timestamp, {});
+
+	if(next.sequence > _vblankSequence) {
+		_vblankSequence = next.sequence;
+		_vblankTimestamp = next.timestamp;
+	}
+	co_return next;
+}
+
+uint64_t drm_core::Crtc::_vblankPeriod() {
+	// Default to 60 Hz if there is no mode.
+	uint64_t period = 1'000'000'000 / 60;
+
+	auto mode = drmState()->mode;
+	if(mode && mode->size() == sizeof(drm_mode_modeinfo)) {
+		drm_mode_modeinfo info;
+		memcpy(&info, mode->data(), sizeof(drm_mode_modeinfo));
+		// The pixel clock is in kHz.
+		if(info.clock && info.htotal && info.vtotal)
+			period = uint64_t{info.htotal} * info.vtotal * 1'000'000 / info.clock;
+		else if(info.vrefresh)
+			period = 1'000'000'000 / info.vrefresh;
+	}
+
+	return period;
+}
+
+async::result<void> drm_core::Crtc::waitForCommits() {
+	while(_pendingCommits)
+		co_await _commitEvent.async_wait();
+}
+
+void drm_core::Crtc::beginCommit() {
+	_pendingCommits++;
+}
+
+void drm_core::Crtc::endCommit() {
+	assert(_pendingCommits);
+	if(!--_pendingCommits)
+		_commitEvent.raise();
+}
+
 drm_core::CrtcState::CrtcState(std::weak_ptr<Crtc> crtc)
 	: _crtc(crtc) {
 
@@ -253,6 +323,7 @@ std::vector<drm_core::Assignment> drm_core::Plane::getAssignments(std::shared_pt
 	assignments.push_back(drm_core::Assignment::withInt(this->sharedModeObject(), dev->crtcYProperty(), drmState()->crtc_y));
 	assignments.push_back(drm_core::Assignment::withModeObj(this->sharedModeObject(), dev->fbIdProperty(), drmState()->fb));
 	assignments.push_back(drm_core::Assignment::withBlob(this->sharedModeObject(), dev->inFormatsProperty(), drmState()->in_formats));
+	assignments.push_back(drm_core::Assignment::withBlob(this->sharedModeObject(), dev->fbDamageClipsProperty(), drmState()->fb_damage_clips));
 
 	return assignments;
 }
@@ -261,6 +332,18 @@ drm_core::Plane::PlaneType drm_core::PlaneState::type(void) {
 	return plane->type();
 }
 
+std::vector<drm_mode_rect> drm_core::PlaneState::damage(bool per_buffer) {
+	if(!fb)
+		return {};
+
+	std::span<const drm_mode_rect> clips;
+	if(fb_damage_clips && !(per_buffer && fb_changed))
+		clips = {reinterpret_cast<const drm_mode_rect *>(fb_damage_clips->data()),
+				fb_damage_clips->size() / sizeof(drm_mode_rect)};
+
+	return clipDamage(clips, fb->getWidth(), fb->getHeight());
+}
+
 // ----------------------------------------------------------------
 // Connector
 // ----------------------------------------------------------------
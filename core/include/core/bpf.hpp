@@ -1,48 +1,39 @@
 #pragma once
 
 #include <arch/dma_pool.hpp>
-#include <cassert>
 #include <cstdint>
-#include <cstdio>
 #include <linux/filter.h>
+#include <optional>
 #include <span>
+#include <vector>
 
 constexpr bool logBpfOps = false;
 
+// Classic BPF socket filter. Programs are validated and decoded once when they are
+// attached; run() then dispatches directly through the pre-decoded instructions.
 struct Bpf {
-	enum class Op : uint16_t {
-		ALU_ADD_X = BPF_ALU | BPF_ADD | BPF_X,
-		ALU_AND_K = BPF_ALU | BPF_AND | BPF_K,
-		ALU_MUL_K = BPF_ALU | BPF_MUL | BPF_K,
-		JMP_JEQ_K = BPF_JMP | BPF_JEQ | BPF_K,
-		JMP_JSET_K = BPF_JMP | BPF_JSET | BPF_K,
-		LDX_W_IMM = BPF_LDX | BPF_W | BPF_IMM,
-		LD_B_IND = BPF_LD | BPF_B | BPF_IND,
-		LD_H_ABS = BPF_LD | BPF_H | BPF_ABS,
-		LD_H_IND = BPF_LD | BPF_H | BPF_IND,
-		LD_W_ABS = BPF_LD | BPF_W | BPF_ABS,
-		LD_W_IND = BPF_LD | BPF_W | BPF_IND,
-		MISC_TAX = BPF_MISC | BPF_TAX,
-		RET_A = BPF_RET | BPF_A,
-		RET_K = BPF_RET | BPF_K,
-	};
+	// Returns std::nullopt if the program is rejected (unknown instruction, out-of-range
+	// jump or scratch memory index, division by a zero constant or no final return).
+	static std::optional<Bpf> compile(std::span<const char> fprog);
 
-	Bpf(std::span<char> fprog)
-		: prog_{
-			reinterpret_cast<struct sock_filter *>(fprog.data()),
-			fprog.size() / sizeof(struct sock_filter)
-		} {
+	// Returns the number of bytes of the packet to accept; zero drops the packet.
+	// Loads beyond the end of the packet drop the packet, as on Linux.
+	uint32_t run(arch::dma_buffer_view buffer) const;
 
+	size_t size() const {
+		return insns_.size();
 	}
 
-	bool validate();
-
-	uint32_t run(arch::dma_buffer_view buffer);
 private:
-	std::span<struct sock_filter> prog_;
+	// Jump targets are absolute instruction indices.
+	struct Insn {
+		uint8_t handler;
+		uint32_t k;
+		uint32_t jt;
+		uint32_t jf;
+	};
+
+	Bpf() = default;
 
-	// accumulator register
-	uint32_t A = 0;
-	// index register
-	uint32_t X = 0;
+	std::vector<Insn> insns_;
 };
@@ -380,7 +380,7 @@ inline std::optional<NetlinkAttrs<struct genlmsghdr>> netlinkAttr(struct nlmsghd
 inline void sendDone(NetlinkFile *f, struct nlmsghdr *hdr, struct sockaddr_nl *sa = nullptr) {
 	NetlinkBuilder b;
 
-	b.header(NLMSG_DONE, 0, hdr->nlmsg_seq, (sa != nullptr) ? sa->nl_pid : 0);
+	b.header(NLMSG_DONE, NLM_F_MULTI, hdr->nlmsg_seq, (sa != nullptr) ? sa->nl_pid : 0);
 	b.message<uint32_t>(0);
 
 	f->deliver(b.packet());
@@ -1,137 +1,281 @@
 #include <arch/bit.hpp>
 #include <core/bpf.hpp>
+#include <cstdio>
+#include <cstring>
 
-bool Bpf::validate() {
-	for(size_t pc = 0; pc < prog_.size(); pc++) {
-		auto inst = prog_[pc];
-
-		switch(Op(inst.code)) {
-			case Op::JMP_JEQ_K:
-			// case Op::JMP_JEQ_X:
-			// case Op::JMP_JGE_K:
-			// case Op::JMP_JGE_X:
-			// case Op::JMP_JGT_K:
-			// case Op::JMP_JGT_X:
-			case Op::JMP_JSET_K:
-			// case Op::JMP_JSET_X:
-				if(pc + inst.jt + 1 >= prog_.size() || pc + inst.jf + 1 >= prog_.size())
-					return false;
-				break;
-			default:
-				break;
-		}
-	}
+// Handlers of the pre-decoded instructions. The order defines the dispatch table in run().
+#define BPF_HANDLERS(X) \
+	X(ldAbsW) X(ldAbsH) X(ldAbsB) X(ldIndW) X(ldIndH) X(ldIndB) \
+	X(ldLen) X(ldImm) X(ldMem) \
+	X(ldxImm) X(ldxLen) X(ldxMem) X(ldxMsh) X(st) X(stx) \
+	X(addK) X(addX) X(subK) X(subX) X(mulK) X(mulX) X(divK) X(divX) X(modK) X(modX) \
+	X(andK) X(andX) X(orK) X(orX) X(xorK) X(xorX) X(lshK) X(lshX) X(rshK) X(rshX) X(neg) \
+	X(ja) X(jeqK) X(jeqX) X(jgtK) X(jgtX) X(jgeK) X(jgeX) X(jsetK) X(jsetX) \
+	X(tax) X(txa) X(retK) X(retA)
 
-	Op last = Op(prog_.back().code);
-	if(last != Op::RET_K && last != Op::RET_A)
-		return false;
+namespace {
+
+enum Handler : uint8_t {
+#define BPF_ENUM(name) name,
+	BPF_HANDLERS(BPF_ENUM)
+#undef BPF_ENUM
+	numHandlers
+};
 
+template<typename T>
+bool load(arch::dma_buffer_view buffer, uint64_t offset, uint32_t &out) {
+	if(offset + sizeof(T) > buffer.size())
+		return false;
+	T val;
+	memcpy(&val, reinterpret_cast<const char *>(buffer.data()) + offset, sizeof(T));
+	out = arch::convert_endian<arch::endian::big>(val);
 	return true;
 }
 
-uint32_t Bpf::run(arch::dma_buffer_view buffer) {
-	size_t pc = 0;
+std::optional<uint8_t> decode(const sock_filter &inst) {
+	switch(inst.code) {
+		case BPF_LD | BPF_W | BPF_ABS: return ldAbsW;
+		case BPF_LD | BPF_H | BPF_ABS: return ldAbsH;
+		case BPF_LD | BPF_B | BPF_ABS: return ldAbsB;
+		case BPF_LD | BPF_W | BPF_IND: return ldIndW;
+		case BPF_LD | BPF_H | BPF_IND: return ldIndH;
+		case BPF_LD | BPF_B | BPF_IND: return ldIndB;
+		case BPF_LD | BPF_W | BPF_LEN: return ldLen;
+		case BPF_LD | BPF_IMM: return ldImm;
+		case BPF_LD | BPF_MEM: return ldMem;
+		case BPF_LDX | BPF_W | BPF_IMM: return ldxImm;
+		case BPF_LDX | BPF_W | BPF_LEN: return ldxLen;
+		case BPF_LDX | BPF_W | BPF_MEM: return ldxMem;
+		case BPF_LDX | BPF_B | BPF_MSH: return ldxMsh;
+		case BPF_ST: return st;
+		case BPF_STX: return stx;
+		case BPF_ALU | BPF_ADD | BPF_K: return addK;
+		case BPF_ALU | BPF_ADD | BPF_X: return addX;
+		case BPF_ALU | BPF_SUB | BPF_K: return subK;
+		case BPF_ALU | BPF_SUB | BPF_X: return subX;
+		case BPF_ALU | BPF_MUL | BPF_K: return mulK;
+		case BPF_ALU | BPF_MUL | BPF_X: return mulX;
+		case BPF_ALU | BPF_DIV | BPF_K: return divK;
+		case BPF_ALU | BPF_DIV | BPF_X: return divX;
+		case BPF_ALU | BPF_MOD | BPF_K: return modK;
+		case BPF_ALU | BPF_MOD | BPF_X: return modX;
+		case BPF_ALU | BPF_AND | BPF_K: return andK;
+		case BPF_ALU | BPF_AND | BPF_X: return andX;
+		case BPF_ALU | BPF_OR | BPF_K: return orK;
+		case BPF_ALU | BPF_OR | BPF_X: return orX;
+		case BPF_ALU | BPF_XOR | BPF_K: return xorK;
+		case BPF_ALU | BPF_XOR | BPF_X: return xorX;
+		case BPF_ALU | BPF_LSH | BPF_K: return lshK;
+		case BPF_ALU | BPF_LSH | BPF_X: return lshX;
+		case BPF_ALU | BPF_RSH | BPF_K: return rshK;
+		case BPF_ALU | BPF_RSH | BPF_X: return rshX;
+		case BPF_ALU | BPF_NEG: return neg;
+		case BPF_JMP | BPF_JA: return ja;
+		case BPF_JMP | BPF_JEQ | BPF_K: return jeqK;
+		case BPF_JMP | BPF_JEQ | BPF_X: return jeqX;
+		case BPF_JMP | BPF_JGT | BPF_K: return jgtK;
+		case BPF_JMP | BPF_JGT | BPF_X: return jgtX;
+		case BPF_JMP | BPF_JGE | BPF_K: return jgeK;
+		case BPF_JMP | BPF_JGE | BPF_X: return jgeX;
+		case BPF_JMP | BPF_JSET | BPF_K: return jsetK;
+		case BPF_JMP | BPF_JSET | BPF_X: return jsetX;
+		case BPF_MISC | BPF_TAX: return tax;
+		case BPF_MISC | BPF_TXA: return txa;
+		case BPF_RET | BPF_K: return retK;
+		case BPF_RET | BPF_A: return retA;
+		default: return std::nullopt;
+	}
+}
+
+} // anonymous namespace
 
-	auto bpf_log_op = [&pc, this](const char *format, auto ...args) {
-		if(logBpfOps) {
-			printf("\t[%.2zu/%.2zu] ", pc, prog_.size() - 1);
-			printf(format, args...);
-			puts("");
-		}
+std::optional<Bpf> Bpf::compile(std::span<const char> fprog) {
+	std::span<const sock_filter> prog{
+		reinterpret_cast<const sock_filter *>(fprog.data()),
+		fprog.size() / sizeof(sock_filter)
 	};
 
-	for(pc = 0; pc < prog_.size(); pc++) {
-		auto inst = prog_[pc];
-
-		auto load = [&buffer]<typename T>(size_t offset) -> T {
-			if(!(offset + sizeof(T) <= buffer.size())) {
-				printf("core/bpf: read of size 0x%zx at offset 0x%zx would be out of bounds (buffer size 0x%zx)",
-					sizeof(T), offset, buffer.size());
-				assert(offset + sizeof(T) <= buffer.size());
-			}
-			return arch::convert_endian<arch::endian::big>(*reinterpret_cast<T *>(buffer.subview(offset, sizeof(T)).data()));
-		};
-
-		switch(Op(inst.code)) {
-			case Op::ALU_ADD_X: {
-				bpf_log_op("A (0x%x) += X (0x%x) = 0x%x", A, X, A * X);
-				A += X;
-				break;
-			}
-			case Op::ALU_AND_K: {
-				bpf_log_op("A (0x%x) &= k (0x%x) = 0x%x", A, inst.k, A & inst.k);
-				A &= inst.k;
-				break;
-			}
-			case Op::ALU_MUL_K: {
-				bpf_log_op("A (0x%x) *= k (0x%x) = 0x%x", A, inst.k, A * inst.k);
-				A *= inst.k;
-				break;
-			}
-			case Op::JMP_JEQ_K: {
-				bpf_log_op("PC += 0x%02x if A == K (0x%x == 0x%x) else 0x%02x (0x%02x)", inst.jt, A, inst.k, inst.jf, (A == inst.k) ? inst.jt : inst.jf);
-				pc += (A == inst.k) ? inst.jt : inst.jf;
-				break;
-			}
-			case Op::JMP_JSET_K: {
-				bpf_log_op("PC += 0x%02x if A & k (0x%x & 0x%x) else 0x%02x (0x%02x)", inst.jt, A, inst.k, inst.jf, (A & inst.k) ? inst.jt : inst.jf);
-				pc += (A & inst.k) ? inst.jt : inst.jf;
-				break;
-			}
-			case Op::LDX_W_IMM: {
-				bpf_log_op("X <- k (0x%02x)", inst.k);
-				X = inst.k;
-				break;
-			}
-			case Op::LD_B_IND: {
-				auto val = load.template operator()<uint8_t>(X + inst.k);
-				bpf_log_op("A <- P[X+k:1 (0x%02x + 0x%02x)] (0x%hx)", X, inst.k, val);
-				A = val;
-				break;
-			}
-			case Op::LD_H_ABS: {
-				auto val = load.template operator()<uint16_t>(inst.k);
-				bpf_log_op("A <- P[k:2 (0x%02x)] = 0x%hx", inst.k, val);
-				A = val;
+	auto reject = [] (const char *reason, size_t pc) -> std::optional<Bpf> {
+		if(logBpfOps)
+			printf("core/bpf: rejecting filter at instruction %zu: %s\n", pc, reason);
+		return std::nullopt;
+	};
+
+	if(prog.empty() || prog.size() > BPF_MAXINSNS)
+		return reject("invalid program length", 0);
+
+	Bpf bpf;
+	bpf.insns_.reserve(prog.size());
+
+	for(size_t pc = 0; pc < prog.size(); pc++) {
+		auto &inst = prog[pc];
+
+		auto handler = decode(inst);
+		if(!handler)
+			return reject("unknown instruction", pc);
+
+		Insn insn{*handler, inst.k, 0, 0};
+		switch(*handler) {
+			case ldMem: case ldxMem: case st: case stx:
+				if(inst.k >= BPF_MEMWORDS)
+					return reject("scratch memory index out of range", pc);
 				break;
-			}
-			case Op::LD_H_IND: {
-				auto val = load.template operator()<uint16_t>(X + inst.k);
-				bpf_log_op("A <- P[X+k:2 (0x%02x + 0x%02x)] (0x%hx)", X, inst.k, val);
-				A = val;
+			case divK: case modK:
+				if(!inst.k)
+					return reject("division by zero", pc);
 				break;
-			}
-			case Op::LD_W_ABS: {
-				auto val = load.template operator()<uint32_t>(inst.k);
-				bpf_log_op("A <- P[k:4 (0x%04x)] = 0x%x", inst.k, val);
-				A = val;
+			case lshK: case rshK:
+				if(inst.k >= 32)
+					return reject("shift out of range", pc);
 				break;
-			}
-			case Op::LD_W_IND: {
-				auto val = load.template operator()<uint32_t>(X + inst.k);
-				bpf_log_op("A <- P[X+k:4 (0x%02x + 0x%02x)] (0x%hx)", X, inst.k, val);
-				A = val;
+			case ja:
+				// Jumps are always forward, hence programs terminate.
+				if(inst.k >= prog.size() - pc - 1)
+					return reject("jump out of range", pc);
+				insn.jt = pc + 1 + inst.k;
 				break;
-			}
-			case Op::MISC_TAX: {
-				bpf_log_op("X <- A (0x%02x)", A);
-				X = A;
+			case jeqK: case jeqX: case jgtK: case jgtX:
+			case jgeK: case jgeX: case jsetK: case jsetX:
+				if(pc + inst.jt + 1 >= prog.size() || pc + inst.jf + 1 >= prog.size())
+					return reject("jump out of range", pc);
+				insn.jt = pc + 1 + inst.jt;
+				insn.jf = pc + 1 + inst.jf;
 				break;
-			}
-			case Op::RET_K: {
-				bpf_log_op("RET k (0x%02x)", inst.k);
-				return inst.k;
-			}
 			default:
-				// TODO: for now, an unknown BPF instruction is a hard failure as our coverage of
-				// the instruction set is quite incomplete. In the future, once that doesn't hold
-				// any more, we should do proper error handling here instead (e.g. return EINVAL).
-				printf("core: unhandled BPF instruction 0x%02x\n", inst.code);
-				bpf_log_op("{ 0x%02x, %.2u, %.2u, 0x%08x }\n", inst.code, inst.jt, inst.jf, inst.k);
-				assert(!"unhandled BPF instruction");
+				break;
 		}
-
+		bpf.insns_.push_back(insn);
 	}
 
-	assert(!"invalid BPF filter with no return!");
+	// Together with the jump checks, this guarantees that run() never leaves the program.
+	auto last = bpf.insns_.back().handler;
+	if(last != retK && last != retA)
+		return reject("program does not end in a return", prog.size() - 1);
+
+	return bpf;
+}
+
+uint32_t Bpf::run(arch::dma_buffer_view buffer) const {
+	static const void *const dispatch[] = {
+#define BPF_LABEL(name) &&do_##name,
+		BPF_HANDLERS(BPF_LABEL)
+#undef BPF_LABEL
+	};
+	static_assert(sizeof(dispatch) / sizeof(*dispatch) == numHandlers);
+
+	const Insn *base = insns_.data();
+	const Insn *insn = base;
+	uint32_t A = 0;
+	uint32_t X = 0;
+	uint32_t M[BPF_MEMWORDS] = {};
+
+#define NEXT() goto *dispatch[(++insn)->handler]
+#define JUMP(cond) do { insn = base + ((cond) ? insn->jt : insn->jf); \
+		goto *dispatch[insn->handler]; } while(0)
+
+	goto *dispatch[insn->handler];
+
+do_ldAbsW:
+	if(!load<uint32_t>(buffer, insn->k, A))
+		return 0;
+	NEXT();
+do_ldAbsH:
+	if(!load<uint16_t>(buffer, insn->k, A))
+		return 0;
+	NEXT();
+do_ldAbsB:
+	if(!load<uint8_t>(buffer, insn->k, A))
+		return 0;
+	NEXT();
+do_ldIndW:
+	if(!load<uint32_t>(buffer, uint64_t{X} + insn->k, A))
+		return 0;
+	NEXT();
+do_ldIndH:
+	if(!load<uint16_t>(buffer, uint64_t{X} + insn->k, A))
+		return 0;
+	NEXT();
+do_ldIndB:
+	if(!load<uint8_t>(buffer, uint64_t{X} + insn->k, A))
+		return 0;
+	NEXT();
+do_ldLen:
+	A = buffer.size();
+	NEXT();
+do_ldImm:
+	A = insn->k;
+	NEXT();
+do_ldMem:
+	A = M[insn->k];
+	NEXT();
+do_ldxImm:
+	X = insn->k;
+	NEXT();
+do_ldxLen:
+	X = buffer.size();
+	NEXT();
+do_ldxMem:
+	X = M[insn->k];
+	NEXT();
+do_ldxMsh:
+	// X <- 4 * (P[k] & 0xf), i.e., the IPv4 header length.
+	if(!load<uint8_t>(buffer, insn->k, X))
+		return 0;
+	X = (X & 0xF) << 2;
+	NEXT();
+do_st:
+	M[insn->k] = A;
+	NEXT();
+do_stx:
+	M[insn->k] = X;
+	NEXT();
+do_addK: A += insn->k; NEXT();
+do_addX: A += X; NEXT();
+do_subK: A -= insn->k; NEXT();
+do_subX: A -= X; NEXT();
+do_mulK: A *= insn->k; NEXT();
+do_mulX: A *= X; NEXT();
+do_divK: A /= insn->k; NEXT();
+do_divX:
+	if(!X)
+		return 0;
+	A /= X;
+	NEXT();
+do_modK: A %= insn->k; NEXT();
+do_modX:
+	if(!X)
+		return 0;
+	A %= X;
+	NEXT();
+do_andK: A &= insn->k; NEXT();
+do_andX: A &= X; NEXT();
+do_orK: A |= insn->k; NEXT();
+do_orX: A |= X; NEXT();
+do_xorK: A ^= insn->k; NEXT();
+do_xorX: A ^= X; NEXT();
+do_lshK: A <<= insn->k; NEXT();
+do_lshX: A = (X < 32) ? (A << X) : 0; NEXT();
+do_rshK: A >>= insn->k; NEXT();
+do_rshX: A = (X < 32) ? (A >> X) : 0; NEXT();
+do_neg: A = -A; NEXT();
+do_ja:
+	insn = base + insn->jt;
+	goto *dispatch[insn->handler];
+do_jeqK: JUMP(A == insn->k);
+do_jeqX: JUMP(A == X);
+do_jgtK: JUMP(A > insn->k);
+do_jgtX: JUMP(A > X);
+do_jgeK: JUMP(A >= insn->k);
+do_jgeX: JUMP(A >= X);
+do_jsetK: JUMP(A & insn->k);
+do_jsetX: JUMP(A & X);
+do_tax: X = A; NEXT();
+do_txa: A = X; NEXT();
+do_retK:
+	return insn->k;
+do_retA:
+	return A;
+
+#undef JUMP
+#undef NEXT
 }
@@ -4,6 +4,7 @@
 #include <protocols/clock/defs.hpp>
 #include <protocols/mbus/client.hpp>
 #include <bragi/helpers-std.hpp>
+#include <hel-syscalls.h>
 
 #include <core/clock.hpp>
 #include <clock.bragi.hpp>
@@ -42,6 +43,16 @@ async::result<void> fetchTrackerPage() {
 	trackerPageMapping = helix::Mapping{globalTrackerPageMemory, 0, 0x1000};
 }
 
+const HelClockPage *accessClockPage() {
+	static const HelClockPage *page = [] {
+		void *window;
+		HEL_CHECK(helMapMemory(kHelClockMemory, kHelNullHandle, nullptr,
+				0, 0x1000, kHelMapProtRead, &window));
+		return reinterpret_cast<const HelClockPage *>(window);
+	}();
+	return page;
+}
+
 } // anonymous namespace
 
 helix::BorrowedDescriptor trackerPageMemory() {
@@ -63,25 +74,13 @@ async::result<void> enumerateTracker() {
 }
 
 int64_t getRealtimeNanos() {
-	auto page = reinterpret_cast<TrackerPage *>(trackerPageMapping.get());
-
-	// Start the seqlock read.
-	auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
-	assert(!(seqlock & 1));
-
-	// Perform the actual loads.
-	auto ref = __atomic_load_n(&page->refClock, __ATOMIC_RELAXED);
-	auto base = __atomic_load_n(&page->baseRealtime, __ATOMIC_RELAXED);
-
-	// Finish the seqlock read.
-	__atomic_thread_fence(__ATOMIC_ACQUIRE);
-	assert(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) == seqlock);
+	// The kernel's clock page carries the offset that clocktracker publishes.
+	auto page = accessClockPage();
 
-	// Calculate the current time.
 	uint64_t now;
-	HEL_CHECK(helGetClock(&now));
+	HEL_CHECK(helGetClockFromPage(page, &now));
 
-	return base + (now - ref);
+	return now + helGetRealtimeOffsetFromPage(page);
 }
 
 struct timespec getRealtime() {
@@ -94,7 +93,7 @@ struct timespec getRealtime() {
 
 struct timespec getTimeSinceBoot() {
 	uint64_t now;
-	HEL_CHECK(helGetClock(&now));
+	HEL_CHECK(helGetClockFromPage(accessClockPage(), &now));
 
 	struct timespec result;
 	result.tv_sec = now / 1'000'000'000;
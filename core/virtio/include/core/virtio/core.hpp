@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <memory>
+#include <span>
 #include <vector>
 
 #include <arch/dma_structs.hpp>
@@ -72,9 +73,26 @@ enum {
 	// Bits of the spec::Descriptor::flags field.
 	VIRTQ_DESC_F_NEXT = 1, // descriptor is part of a chain
 	VIRTQ_DESC_F_WRITE = 2, // buffer is written by device
+	VIRTQ_DESC_F_INDIRECT = 4, // buffer contains a table of descriptors
+
+	// Additional bits of the spec::PackedDescriptor::flags field.
+	VIRTQ_DESC_F_AVAIL = 1 << 7,
+	VIRTQ_DESC_F_USED = 1 << 15,
 
 	// Bits of the spec::UsedRing::flags field.
-	VIRTQ_USED_F_NO_NOTIFY = 1 // no need to notify the device
+	VIRTQ_USED_F_NO_NOTIFY = 1, // no need to notify the device
+
+	// Values of the spec::EventSuppression::flags field.
+	RING_EVENT_FLAGS_ENABLE = 0,
+	RING_EVENT_FLAGS_DISABLE = 1,
+	RING_EVENT_FLAGS_DESC = 2
+};
+
+// Device-independent feature bits.
+enum {
+	VIRTIO_RING_F_INDIRECT_DESC = 28,
+	VIRTIO_RING_F_EVENT_IDX = 29,
+	VIRTIO_F_RING_PACKED = 34
 };
 
 namespace spec {
@@ -122,6 +140,23 @@ namespace spec {
 
 		arch::scalar_variable<uint16_t> eventIndex;
 	};
+
+	// Descriptor of a packed virtq (VIRTIO_F_RING_PACKED). The ring consists of these
+	// descriptors only; the device overwrites them with used descriptors.
+	struct PackedDescriptor {
+		arch::scalar_variable<uint64_t> address;
+		arch::scalar_variable<uint32_t> length;
+		arch::scalar_variable<uint16_t> id;
+		arch::scalar_variable<uint16_t> flags;
+	};
+	static_assert(sizeof(PackedDescriptor) == 16);
+
+	// Driver and device event suppression areas of a packed virtq.
+	struct EventSuppression {
+		arch::scalar_variable<uint16_t> offsetWrap;
+		arch::scalar_variable<uint16_t> flags;
+	};
+	static_assert(sizeof(EventSuppression) == 4);
 };
 
 struct DeviceSpace;
@@ -183,7 +218,7 @@ struct DeviceSpace {
 		} else {
 			static_assert(sizeof(typename RT::rep_type) == 4,
 					"Unsupported size for DeviceSpace::load()");
-			auto v = _transport->loadConfig16(r.offset());
+			auto v = _transport->loadConfig32(r.offset());
 			return static_cast<typename RT::rep_type>(v);
 		}
 	}
@@ -216,6 +251,33 @@ struct DeviceToHostType { };
 inline constexpr HostToDeviceType hostToDevice;
 inline constexpr DeviceToHostType deviceToHost;
 
+// Table of indirect descriptors (VIRTIO_RING_F_INDIRECT_DESC) that a single
+// virtq descriptor can point to. The table occupies a page, hence it is physically contiguous.
+struct IndirectTable {
+	friend struct Handle;
+
+	static constexpr size_t maxDescriptors = 0x1000 / sizeof(spec::Descriptor);
+
+	size_t size() {
+		return _size;
+	}
+
+	// Appends a descriptor and links it to the previous one.
+	// As for Handle::setupBuffer(), the buffer must be physically contiguous.
+	void append(HostToDeviceType, arch::dma_buffer_view view);
+	void append(DeviceToHostType, arch::dma_buffer_view view);
+
+private:
+	spec::Descriptor *_append(arch::dma_buffer_view view);
+
+	struct alignas(0x1000) Storage {
+		spec::Descriptor descriptors[maxDescriptors];
+	};
+
+	std::unique_ptr<Storage> _storage = std::make_unique<Storage>();
+	size_t _size = 0;
+};
+
 // Handle to a virtq descriptor.
 struct Handle {
 	Handle()
@@ -238,6 +300,11 @@ struct Handle {
 
 	void setupLink(Handle other);
 
+	// Makes the descriptor refer to an indirect table. The table must stay alive
+	// until the device returns the descriptor. No descriptors may be appended
+	// to the table afterwards.
+	void setupIndirect(IndirectTable &table);
+
 private:
 	Queue *_queue;
 	size_t _tableIndex;
@@ -290,12 +357,28 @@ struct Request {
 	size_t len = 0;
 };
 
+// Element of Queue::submitBatch().
+struct Submission {
+	Handle descriptor;
+	Request *request;
+	void (*complete)(Request *);
+};
+
 // Represents a single virtq.
+// Both split and packed virtqs are supported. For packed virtqs, descriptors are
+// set up in a software table and only copied to the ring by postDescriptor().
 struct Queue {
 	friend struct Handle;
 
+	// Constructs a split virtq.
+	// event_index must be true iff VIRTIO_RING_F_EVENT_IDX was negotiated.
 	Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *table,
-			spec::AvailableRing *available, spec::UsedRing *used);
+			spec::AvailableRing *available, spec::UsedRing *used, bool event_index);
+
+	// Constructs a packed virtq.
+	Queue(unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+			spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+			bool event_index);
 protected:
 	~Queue() = default;
 
@@ -309,17 +392,34 @@ public:
 		return _queueSize;
 	}
 
+	bool isPacked() {
+		return _packed;
+	}
+
+	// Number of times that processInterrupt() re-checks the used ring before
+	// it re-enables interrupts. This trades CPU time for fewer interrupts under load.
+	void setUsedPolling(unsigned int iterations) {
+		_pollIterations = iterations;
+	}
+
 	// Allocates a single descriptor.
 	// The descriptor is automatically freed when the device returns it.
+	// If no descriptor is free, descriptors that were posted but not notified
+	// are handed to the device before waiting.
 	async::result<Handle> obtainDescriptor();
 
 	// Posts a descriptor to the virtq's available ring.
+	// Descriptors can be posted in batches followed by a single call to notify().
 	void postDescriptor(Handle descriptor, Request *request,
 			void (*complete)(Request *));
 
 	// Notifies the device that new descriptors have been posted.
+	// With VIRTIO_RING_F_EVENT_IDX, the device is only notified if it asked for it.
 	void notify();
 
+	// Posts multiple descriptors and notifies the device once.
+	void submitBatch(std::span<const Submission> batch);
+
 	async::result<size_t> submitDescriptor(Handle descriptor) {
 		struct OneshotRequest : Request {
 			async::oneshot_event event;
@@ -344,18 +444,58 @@ protected:
 	virtual void notifyTransport() = 0;
 
 private:
+	void _postPacked(Handle descriptor);
+
+	// Retires a single used descriptor chain. Returns false if there is none.
+	bool _processUsed();
+
+	// Returns true if the device has returned descriptors that are not yet processed.
+	bool _hasUsed();
+
+	// Asks the device to interrupt once it uses the next descriptor.
+	void _enableInterrupts();
+
+	// Frees the descriptor chain and calls the completion handler of its request.
+	void _retire(size_t table_index, size_t written);
+
 	// Index of this queue as part of its owning device.
 	unsigned int _queueIndex;
 
 	// Number of descriptors in this queue.
 	size_t _queueSize;
 
+	bool _packed;
+
+	// Whether VIRTIO_RING_F_EVENT_IDX was negotiated.
+	bool _eventIndex;
+
+	unsigned int _pollIterations = 0;
+
+	// Number of ring entries that have been made available since the last notification.
+	uint16_t _numAdded = 0;
+
 	// Pointers to different data structures of this virtq.
+	// For packed virtqs, _table points to _shadowTable.
 	spec::Descriptor *_table;
-	spec::AvailableRing *_availableRing;
-	spec::UsedRing *_usedRing;
-	spec::AvailableExtra *_availableExtra;
-	spec::UsedExtra *_usedExtra;
+	spec::AvailableRing *_availableRing = nullptr;
+	spec::UsedRing *_usedRing = nullptr;
+	spec::AvailableExtra *_availableExtra = nullptr;
+	spec::UsedExtra *_usedExtra = nullptr;
+
+	// Data structures of packed virtqs.
+	spec::PackedDescriptor *_packedRing = nullptr;
+	spec::EventSuppression *_driverEvent = nullptr;
+	spec::EventSuppression *_deviceEvent = nullptr;
+	std::vector<spec::Descriptor> _shadowTable;
+
+	// Number of ring entries that each posted chain occupies (indexed by buffer ID).
+	std::vector<uint16_t> _chainLengths;
+
+	// Next ring entry that is made available (or checked for use) and the wrap counters.
+	uint16_t _availableIndex = 0;
+	bool _availableWrap = true;
+	uint16_t _usedIndex = 0;
+	bool _usedWrap = true;
 
 	// Keeps track of unused descriptor indices.
 	std::vector<uint16_t> _descriptorStack;
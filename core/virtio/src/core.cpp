@@ -1,5 +1,6 @@
 
 #include <assert.h>
+#include <atomic>
 #include <iostream>
 #include <unordered_map>
 #include <optional>
@@ -107,6 +108,9 @@ private:
 	arch::io_space _legacySpace;
 	helix::UniqueDescriptor _irq;
 
+	// Whether VIRTIO_RING_F_EVENT_IDX was negotiated.
+	bool _eventIndex = false;
+
 	std::vector<std::unique_ptr<LegacyPciQueue>> _queues;
 };
 
@@ -155,7 +159,11 @@ void LegacyPciTransport::acknowledgeDriverFeature(unsigned int feature) {
 }
 
 void LegacyPciTransport::finalizeFeatures() {
-	// Does nothing for now.
+	// Event indices are transparent to drivers, hence we always use them if available.
+	if(checkDeviceFeature(VIRTIO_RING_F_EVENT_IDX)) {
+		acknowledgeDriverFeature(VIRTIO_RING_F_EVENT_IDX);
+		_eventIndex = true;
+	}
 }
 
 void LegacyPciTransport::claimQueues(unsigned int max_index) {
@@ -245,14 +253,16 @@ async::detached LegacyPciTransport::_processIrqs() {
 		}
 		if(isr & 1)
 			for(auto &queue : _queues)
-				queue->processInterrupt();
+				if(queue)
+					queue->processInterrupt();
 	}
 }
 
 LegacyPciQueue::LegacyPciQueue(LegacyPciTransport *transport,
 		unsigned int queue_index, size_t queue_size,
 		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used)
-: Queue{queue_index, queue_size, table, available, used}, _transport{transport} { }
+: Queue{queue_index, queue_size, table, available, used, transport->_eventIndex},
+		_transport{transport} { }
 
 void LegacyPciQueue::notifyTransport() {
 	_transport->_legacySpace.store(PCI_L_QUEUE_NOTIFY, queueIndex());
@@ -303,6 +313,9 @@ private:
 	arch::mem_space _isrSpace() { return arch::mem_space{_isrMapping.get()}; }
 	arch::mem_space _deviceSpace() { return arch::mem_space{_deviceMapping.get()}; }
 
+	Queue *_setupPackedQueue(unsigned int queue_index, size_t queue_size,
+			uint16_t notify_index);
+
 	async::detached _processIrqs();
 	async::detached _processQueueMsi();
 
@@ -316,6 +329,9 @@ private:
 	helix::UniqueDescriptor _irq;
 	helix::UniqueDescriptor _queueMsi;
 
+	// Whether VIRTIO_F_RING_PACKED and VIRTIO_RING_F_EVENT_IDX were negotiated.
+	bool _packed = false;
+	bool _eventIndex = false;
 
 	std::vector<std::unique_ptr<StandardPciQueue>> _queues;
 };
@@ -326,6 +342,11 @@ struct StandardPciQueue final : Queue {
 			spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
 			arch::scalar_register<uint16_t> notify_register);
 
+	StandardPciQueue(StandardPciTransport *transport,
+			unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+			spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+			arch::scalar_register<uint16_t> notify_register);
+
 protected:
 	void notifyTransport() override;
 
@@ -375,6 +396,17 @@ void StandardPciTransport::finalizeFeatures() {
 	assert(checkDeviceFeature(32));
 	acknowledgeDriverFeature(32);
 
+	// Packed virtqs and event indices are transparent to drivers,
+	// hence we always use them if available.
+	if(checkDeviceFeature(VIRTIO_F_RING_PACKED)) {
+		acknowledgeDriverFeature(VIRTIO_F_RING_PACKED);
+		_packed = true;
+	}
+	if(checkDeviceFeature(VIRTIO_RING_F_EVENT_IDX)) {
+		acknowledgeDriverFeature(VIRTIO_RING_F_EVENT_IDX);
+		_eventIndex = true;
+	}
+
 	_commonSpace().store(PCI_DEVICE_STATUS, _commonSpace().load(PCI_DEVICE_STATUS) | FEATURES_OK);
 	auto confirm = _commonSpace().load(PCI_DEVICE_STATUS);
 	assert(confirm & FEATURES_OK);
@@ -393,6 +425,9 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 	auto notify_index = _commonSpace().load(PCI_QUEUE_NOTIFY);
 	assert(queue_size);
 
+	if(_packed)
+		return _setupPackedQueue(queue_index, queue_size, notify_index);
+
 	// TODO: Ensure that the queue size is indeed a power of 2.
 
 	// Determine the queue size in bytes.
@@ -450,6 +485,58 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 	return _queues[queue_index].get();
 }
 
+Queue *StandardPciTransport::_setupPackedQueue(unsigned int queue_index,
+		size_t queue_size, uint16_t notify_index) {
+	// The device and driver event suppression areas follow the descriptor ring.
+	auto ring_size = queue_size * sizeof(spec::PackedDescriptor);
+	auto driver_event_offset = ring_size;
+	auto device_event_offset = driver_event_offset + sizeof(spec::EventSuppression);
+	auto region_size = device_event_offset + sizeof(spec::EventSuppression);
+
+	// Allocate physical memory for the virtq structs.
+	assert(region_size < 0x4000); // FIXME: do not hardcode 0x4000
+	HelHandle memory;
+	void *window;
+	HEL_CHECK(helAllocateMemory(0x4000, kHelAllocContinuous, nullptr, &memory));
+	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
+			0, 0x4000, kHelMapProtRead | kHelMapProtWrite, &window));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, memory));
+
+	// Setup the memory region.
+	auto ring = reinterpret_cast<spec::PackedDescriptor *>((char *)window);
+	auto driver_event = reinterpret_cast<spec::EventSuppression *>(
+			(char *)window + driver_event_offset);
+	auto device_event = reinterpret_cast<spec::EventSuppression *>(
+			(char *)window + device_event_offset);
+	_queues[queue_index] = std::make_unique<StandardPciQueue>(this, queue_index, queue_size,
+			ring, driver_event, device_event,
+			arch::scalar_register<uint16_t>{_notifyMultiplier * notify_index});
+
+	// Hand the queue to the device.
+	// For packed virtqs, the available and used registers hold the driver and device areas.
+	uintptr_t ring_physical, driver_physical, device_physical;
+	HEL_CHECK(helPointerPhysical(ring, &ring_physical));
+	HEL_CHECK(helPointerPhysical(driver_event, &driver_physical));
+	HEL_CHECK(helPointerPhysical(device_event, &device_physical));
+	_commonSpace().store(PCI_QUEUE_TABLE[0], ring_physical);
+	_commonSpace().store(PCI_QUEUE_TABLE[1], ring_physical >> 32);
+	_commonSpace().store(PCI_QUEUE_AVAILABLE[0], driver_physical);
+	_commonSpace().store(PCI_QUEUE_AVAILABLE[1], driver_physical >> 32);
+	_commonSpace().store(PCI_QUEUE_USED[0], device_physical);
+	_commonSpace().store(PCI_QUEUE_USED[1], device_physical >> 32);
+
+	// Setup MSI-X.
+	if(_useMsi) {
+		_commonSpace().store(PCI_QUEUE_MSIX_VECTOR, 0);
+		if(_commonSpace().load(PCI_QUEUE_MSIX_VECTOR) != 0)
+			throw std::runtime_error("Device failed to allocate MSI-X interrupt");
+	}
+
+	_commonSpace().store(PCI_QUEUE_ENABLE, 1);
+
+	return _queues[queue_index].get();
+}
+
 void StandardPciTransport::runDevice() {
 	// Finally set the DRIVER_OK bit to finish the configuration.
 	_commonSpace().store(PCI_DEVICE_STATUS, _commonSpace().load(PCI_DEVICE_STATUS) | DRIVER_OK);
@@ -526,7 +613,8 @@ async::detached StandardPciTransport::_processIrqs() {
 
 		if(await.bitset() & 1)
 			for(auto &queue : _queues)
-				queue->processInterrupt();
+				if(queue)
+					queue->processInterrupt();
 	}
 #else
 	co_await _hwDevice.enableBusIrq();
@@ -558,7 +646,8 @@ async::detached StandardPciTransport::_processIrqs() {
 
 		if(isr & 1)
 			for(auto &queue : _queues)
-				queue->processInterrupt();
+				if(queue)
+					queue->processInterrupt();
 	}
 #endif
 }
@@ -573,7 +662,8 @@ async::detached StandardPciTransport::_processQueueMsi() {
 		HEL_CHECK(helAcknowledgeIrq(_queueMsi.getHandle(), kHelAckAcknowledge, sequence));
 
 		for(auto &queue : _queues)
-			queue->processInterrupt();
+			if(queue)
+				queue->processInterrupt();
 	}
 }
 
@@ -581,7 +671,15 @@ StandardPciQueue::StandardPciQueue(StandardPciTransport *transport,
 		unsigned int queue_index, size_t queue_size,
 		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
 		arch::scalar_register<uint16_t> notify_register)
-: Queue{queue_index, queue_size, table, available, used},
+: Queue{queue_index, queue_size, table, available, used, transport->_eventIndex},
+		_transport{transport}, _notifyRegister{notify_register} { }
+
+StandardPciQueue::StandardPciQueue(StandardPciTransport *transport,
+		unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+		spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+		arch::scalar_register<uint16_t> notify_register)
+: Queue{queue_index, queue_size, ring, driver_event, device_event,
+			transport->_eventIndex},
 		_transport{transport}, _notifyRegister{notify_register} { }
 
 void StandardPciQueue::notifyTransport() {
@@ -746,12 +844,70 @@ void Handle::setupBuffer(DeviceToHostType, arch::dma_buffer_view view) {
 	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_WRITE);
 }
 
+void Handle::setupIndirect(IndirectTable &table) {
+	assert(table.size());
+
+	uintptr_t physical;
+	HEL_CHECK(helPointerPhysical(table._storage->descriptors, &physical));
+
+	// Packed virtqs use the packed descriptor format within indirect tables, too.
+	// Entries of such tables are consumed in order and do not use VIRTQ_DESC_F_NEXT.
+	if(_queue->_packed) {
+		for(size_t i = 0; i < table.size(); i++) {
+			auto split = &table._storage->descriptors[i];
+			auto flags = split->flags.load() & VIRTQ_DESC_F_WRITE;
+			auto packed = reinterpret_cast<spec::PackedDescriptor *>(split);
+			packed->id.store(0);
+			packed->flags.store(flags);
+		}
+	}
+
+	auto descriptor = _queue->_table + _tableIndex;
+	descriptor->address.store(physical);
+	descriptor->length.store(table.size() * sizeof(spec::Descriptor));
+	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_INDIRECT);
+}
+
 void Handle::setupLink(Handle other) {
 	auto descriptor = _queue->_table + _tableIndex;
 	descriptor->next.store(other._tableIndex);
 	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_NEXT);
 }
 
+// --------------------------------------------------------
+// IndirectTable
+// --------------------------------------------------------
+
+spec::Descriptor *IndirectTable::_append(arch::dma_buffer_view view) {
+	assert(view.size());
+	assert(_size < maxDescriptors);
+
+	uintptr_t physical;
+	HEL_CHECK(helPointerPhysical(view.data(), &physical));
+
+	if(_size) {
+		auto previous = &_storage->descriptors[_size - 1];
+		previous->next.store(_size);
+		previous->flags.store(previous->flags.load() | VIRTQ_DESC_F_NEXT);
+	}
+
+	auto descriptor = &_storage->descriptors[_size++];
+	descriptor->address.store(physical);
+	descriptor->length.store(view.size());
+	descriptor->flags.store(0);
+	descriptor->next.store(0);
+	return descriptor;
+}
+
+void IndirectTable::append(HostToDeviceType, arch::dma_buffer_view view) {
+	_append(view);
+}
+
+void IndirectTable::append(DeviceToHostType, arch::dma_buffer_view view) {
+	auto descriptor = _append(view);
+	descriptor->flags.store(VIRTQ_DESC_F_WRITE);
+}
+
 async::result<void> scatterGather(HostToDeviceType, Chain &chain, Queue *queue,
 		arch::dma_buffer_view view) {
 	constexpr size_t page_size = 0x1000;
@@ -782,9 +938,26 @@ async::result<void> scatterGather(DeviceToHostType, Chain &chain, Queue *queue,
 // Queue
 // --------------------------------------------------------
 
+namespace {
+
+// True if the event index lies in the range (old_index, new_index].
+bool needsEvent(uint16_t event_index, uint16_t new_index, uint16_t old_index) {
+	return static_cast<uint16_t>(new_index - event_index - 1)
+			< static_cast<uint16_t>(new_index - old_index);
+}
+
+// Orders stores to the ring before loads of the other side's event index.
+// A compiler barrier is not sufficient here as x86 reorders stores after loads.
+void fullBarrier() {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+} // anonymous namespace
+
 Queue::Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *table,
-		spec::AvailableRing *available, spec::UsedRing *used)
-: _queueIndex{queue_index}, _queueSize{queue_size}, _progressHead{0} {
+		spec::AvailableRing *available, spec::UsedRing *used, bool event_index)
+: _queueIndex{queue_index}, _queueSize{queue_size}, _packed{false},
+		_eventIndex{event_index}, _progressHead{0} {
 	// Construct the hardware state.
 	_table = new (table) spec::Descriptor[_queueSize];
 	_availableRing = new (available) spec::AvailableRing;
@@ -813,9 +986,48 @@ Queue::Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *tabl
 	_activeRequests.resize(_queueSize);
 }
 
+Queue::Queue(unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+		spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+		bool event_index)
+: _queueIndex{queue_index}, _queueSize{queue_size}, _packed{true},
+		_eventIndex{event_index}, _progressHead{0} {
+	// Construct the hardware state.
+	// All descriptors start out with AVAIL == USED == 0, i.e., they are neither
+	// available nor used in the first pass (where both wrap counters are 1).
+	_packedRing = new (ring) spec::PackedDescriptor[_queueSize];
+	_driverEvent = new (driver_event) spec::EventSuppression;
+	_deviceEvent = new (device_event) spec::EventSuppression;
+
+	for(size_t i = 0; i < _queueSize; i++) {
+		_packedRing[i].address.store(0);
+		_packedRing[i].length.store(0);
+		_packedRing[i].id.store(0);
+		_packedRing[i].flags.store(0);
+	}
+	if(_eventIndex) {
+		// Interrupt once the first descriptor is used (in the first pass).
+		_driverEvent->offsetWrap.store(uint16_t{1} << 15);
+		_driverEvent->flags.store(RING_EVENT_FLAGS_DESC);
+	}else{
+		_driverEvent->offsetWrap.store(0);
+		_driverEvent->flags.store(RING_EVENT_FLAGS_ENABLE);
+	}
+
+	// Construct the software state.
+	_shadowTable.resize(_queueSize);
+	_table = _shadowTable.data();
+	for(size_t i = 0; i < _queueSize; i++)
+		_descriptorStack.push_back(i);
+	_activeRequests.resize(_queueSize);
+	_chainLengths.resize(_queueSize);
+}
+
 async::result<Handle> Queue::obtainDescriptor() {
 	while(true) {
 		if(_descriptorStack.empty()) {
+			// Otherwise, we could wait for descriptors that the device never sees.
+			if(_numAdded)
+				notify();
 			co_await _descriptorDoorbell.async_wait();
 			continue;
 		}
@@ -840,55 +1052,229 @@ void Queue::postDescriptor(Handle handle, Request *request,
 	assert(!_activeRequests[handle.tableIndex()]);
 	_activeRequests[handle.tableIndex()] = request;
 
+	if(_packed) {
+		_postPacked(handle);
+		return;
+	}
+
 	auto enqueue_head = _availableRing->headIndex.load();
 	auto ring_index = enqueue_head & (_queueSize - 1);
 	_availableRing->elements[ring_index].tableIndex.store(handle.tableIndex());
 
 	asm volatile ( "" : : : "memory" );
 	_availableRing->headIndex.store(enqueue_head + 1);
+	_numAdded++;
+}
+
+void Queue::submitBatch(std::span<const Submission> batch) {
+	if(_packed) {
+		// Each chain is made available individually; only the notification is batched.
+		for(auto &submission : batch)
+			postDescriptor(submission.descriptor, submission.request, submission.complete);
+		notify();
+		return;
+	}
+
+	// Fill the available ring first and publish all entries with a single store.
+	auto enqueue_head = _availableRing->headIndex.load();
+	for(size_t i = 0; i < batch.size(); i++) {
+		auto &submission = batch[i];
+		auto table_index = submission.descriptor.tableIndex();
+		assert(submission.request);
+		submission.request->complete = submission.complete;
+		assert(!_activeRequests[table_index]);
+		_activeRequests[table_index] = submission.request;
+
+		auto ring_index = (enqueue_head + i) & (_queueSize - 1);
+		_availableRing->elements[ring_index].tableIndex.store(table_index);
+	}
+
+	asm volatile ( "" : : : "memory" );
+	_availableRing->headIndex.store(enqueue_head + batch.size());
+	_numAdded += batch.size();
+	notify();
+}
+
+// Copies the chain from the software table to consecutive ring entries.
+// The chain's head ID identifies the buffer when the device returns it.
+void Queue::_postPacked(Handle handle) {
+	auto head_index = _availableIndex;
+	uint16_t head_flags = 0;
+	uint16_t length = 0;
+
+	auto chain_index = handle.tableIndex();
+	while(true) {
+		auto descriptor = &_table[chain_index];
+		auto chain_flags = descriptor->flags.load();
+
+		uint16_t flags = chain_flags
+				& (VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE | VIRTQ_DESC_F_INDIRECT);
+		if(_availableWrap) {
+			flags |= VIRTQ_DESC_F_AVAIL;
+		}else{
+			flags |= VIRTQ_DESC_F_USED;
+		}
+
+		auto entry = &_packedRing[_availableIndex];
+		entry->address.store(descriptor->address.load());
+		entry->length.store(descriptor->length.load());
+		entry->id.store(handle.tableIndex());
+		// The head is made available last, such that the device never sees a partial chain.
+		if(length) {
+			entry->flags.store(flags);
+		}else{
+			head_flags = flags;
+		}
+		length++;
+
+		if(++_availableIndex == _queueSize) {
+			_availableIndex = 0;
+			_availableWrap = !_availableWrap;
+		}
+
+		if(!(chain_flags & VIRTQ_DESC_F_NEXT))
+			break;
+		chain_index = descriptor->next.load();
+	}
+	_chainLengths[handle.tableIndex()] = length;
+	_numAdded += length;
+
+	asm volatile ( "" : : : "memory" );
+	_packedRing[head_index].flags.store(head_flags);
 }
 
 void Queue::notify() {
+	if(!_numAdded)
+		return;
+	auto num_added = _numAdded;
+	_numAdded = 0;
+
+	if(_packed) {
+		fullBarrier();
+		auto flags = _deviceEvent->flags.load();
+		if(flags == RING_EVENT_FLAGS_DISABLE)
+			return;
+		if(flags == RING_EVENT_FLAGS_DESC) {
+			// The event refers to a ring entry and the wrap counter of the pass.
+			auto offset_wrap = _deviceEvent->offsetWrap.load();
+			uint16_t event_index = offset_wrap & 0x7FFF;
+			bool event_wrap = offset_wrap >> 15;
+			if(event_wrap != _availableWrap)
+				event_index -= _queueSize;
+			if(!needsEvent(event_index, _availableIndex, _availableIndex - num_added))
+				return;
+		}
+		notifyTransport();
+		return;
+	}
+
+	if(_eventIndex) {
+		fullBarrier();
+		auto new_head = _availableRing->headIndex.load();
+		if(needsEvent(_usedExtra->eventIndex.load(), new_head, new_head - num_added))
+			notifyTransport();
+		return;
+	}
+
 	asm volatile ( "" : : : "memory" );
 	if(!(_usedRing->flags.load() & VIRTQ_USED_F_NO_NOTIFY))
 		notifyTransport();
 }
 
-void Queue::processInterrupt() {
-	while(true) {
-		auto used_head = _usedRing->headIndex.load();
+bool Queue::_hasUsed() {
+	if(_packed) {
+		// Used descriptors have AVAIL == USED == the driver's used wrap counter.
+		auto flags = _packedRing[_usedIndex].flags.load();
+		bool available = flags & VIRTQ_DESC_F_AVAIL;
+		bool used = flags & VIRTQ_DESC_F_USED;
+		return available == used && used == _usedWrap;
+	}
 
-		if((_progressHead & 0xFFFF) == used_head)
-			break;
+	return (_progressHead & 0xFFFF) != _usedRing->headIndex.load();
+}
 
-		asm volatile ( "" : : : "memory" );
+bool Queue::_processUsed() {
+	if(!_hasUsed())
+		return false;
+
+	asm volatile ( "" : : : "memory" );
 
-		auto ring_index = _progressHead & (_queueSize - 1);
-		auto table_index = _usedRing->elements[ring_index].tableIndex.load();
+	if(_packed) {
+		auto entry = &_packedRing[_usedIndex];
+		auto table_index = entry->id.load();
 		assert(table_index < _queueSize);
 
-		// Dequeue the Request object.
-		auto request = _activeRequests[table_index];
-		assert(request);
-		request->len = _usedRing->elements[ring_index].written.load();
-		_activeRequests[table_index] = nullptr;
-
-		// Free all descriptors in the descriptor chain.
-		auto chain_index = table_index;
-		while(_table[chain_index].flags.load() & VIRTQ_DESC_F_NEXT) {
-			auto successor = _table[chain_index].next.load();
-			_descriptorStack.push_back(chain_index);
-			chain_index = successor;
+		// The device skips over the remaining entries of the chain.
+		_usedIndex += _chainLengths[table_index];
+		if(_usedIndex >= _queueSize) {
+			_usedIndex -= _queueSize;
+			_usedWrap = !_usedWrap;
 		}
+
+		_retire(table_index, entry->length.load());
+		return true;
+	}
+
+	auto ring_index = _progressHead & (_queueSize - 1);
+	auto table_index = _usedRing->elements[ring_index].tableIndex.load();
+	assert(table_index < _queueSize);
+
+	_retire(table_index, _usedRing->elements[ring_index].written.load());
+
+	_progressHead++;
+	return true;
+}
+
+void Queue::_enableInterrupts() {
+	if(!_eventIndex)
+		return;
+
+	if(_packed) {
+		_driverEvent->offsetWrap.store(_usedIndex | (uint16_t{_usedWrap} << 15));
+	}else{
+		_availableExtra->eventIndex.store(_progressHead);
+	}
+}
+
+void Queue::_retire(size_t table_index, size_t written) {
+	// Dequeue the Request object.
+	auto request = _activeRequests[table_index];
+	assert(request);
+	request->len = written;
+	_activeRequests[table_index] = nullptr;
+
+	// Free all descriptors in the descriptor chain.
+	auto chain_index = table_index;
+	while(_table[chain_index].flags.load() & VIRTQ_DESC_F_NEXT) {
+		auto successor = _table[chain_index].next.load();
 		_descriptorStack.push_back(chain_index);
-		_descriptorDoorbell.raise();
+		chain_index = successor;
+	}
+	_descriptorStack.push_back(chain_index);
+	_descriptorDoorbell.raise();
+
+	// Call the completion handler.
+	request->complete(request);
+}
 
-		// Call the completion handler.
-		request->complete(request);
+void Queue::processInterrupt() {
+	while(true) {
+		while(_processUsed())
+			;
 
-		_progressHead++;
+		// Optionally poll for more descriptors before taking the next interrupt.
+		for(unsigned int i = 0; i < _pollIterations && !_hasUsed(); i++)
+			asm volatile ( "" : : : "memory" );
+		if(_hasUsed())
+			continue;
+
+		// Re-check after re-enabling interrupts: with VIRTIO_RING_F_EVENT_IDX, the device
+		// does not interrupt for descriptors that it used before it saw the new event index.
+		_enableInterrupts();
+		fullBarrier();
+		if(!_hasUsed())
+			break;
 	}
 }
 
 } // namespace virtio_core
-
@@ -7,29 +7,33 @@
 
 #include "command.hpp"
 
-Command::Command(uint64_t sector, size_t numSectors, size_t numBytes, void *buffer,
-		CommandType type) : sector_{sector}, numSectors_{numSectors}, numBytes_{numBytes},
-	buffer_{buffer}, type_{type}, event_{} {
+Command::Command(uint64_t sector, size_t numSectors, std::vector<DataSegment> segments,
+		CommandType type) : sector_{sector}, numSectors_{numSectors}, numBytes_{0},
+	segments_{std::move(segments)}, type_{type}, event_{} {
+	assert(!segments_.empty());
+	for (auto &segment : segments_)
+		numBytes_ += segment.numBytes;
 
-	// TODO: Requests larger than 64k need to be split
-	assert(numBytes < 65536);
+	// Port::transfer_() splits larger requests.
+	assert(numBytes_ < 65536);
 
 	if (logCommands) {
-		printf("block/ahci: queueing %zu byte %s to %p at sector %" PRIu64 "\n",
-			numBytes, cmdTypeToString(type_),
-			reinterpret_cast<void *>(buffer), sector);
+		printf("block/ahci: queueing %zu byte %s to %p (%zu segments) at sector %" PRIu64 "\n",
+			numBytes_, cmdTypeToString(type_), segments_.front().buffer,
+			segments_.size(), sector);
 	}
 }
 
 void Command::notifyCompletion() {
 	if (logCommands) {
-		printf("block/ahci: completed %s to %p\n", cmdTypeToString(type_), buffer_);
+		printf("block/ahci: completed %s to %p\n", cmdTypeToString(type_),
+				segments_.front().buffer);
 	}
 
 	event_.raise();
 }
 
-void Command::prepare(commandTable& table, commandHeader& header) {
+void Command::prepare(commandTable& table, commandHeader& header, int ncqTag) {
 	auto tablePhys = helix::ptrToPhysical(&table);
 	assert((tablePhys & 0x7F) == 0 && tablePhys < std::numeric_limits<uint32_t>::max());
 	assert(numSectors_ < std::numeric_limits<uint16_t>::max());
@@ -57,30 +61,48 @@ void Command::prepare(commandTable& table, commandHeader& header) {
 	header.ctBase = static_cast<uint32_t>(helix::ptrToPhysical(&table));
 	header.ctBaseUpper = 0;
 
+	if (ncqTag >= 0) {
+		assert(isQueueable() && ncqTag < 32);
+		// FPDMA QUEUED takes the count in the features field and the tag in the count field.
+		table.commandFis.features = numSectors_ & 0xFF;
+		table.commandFis.featuresUpper = (numSectors_ >> 8) & 0xFF;
+		table.commandFis.sectorCount = static_cast<uint16_t>(ncqTag << 3);
+	}
+
 	switch (type_) {
 		case CommandType::read:
-			table.commandFis.command = 0x25; // READ DMA EXT
+			// READ FPDMA QUEUED or READ DMA EXT
+			table.commandFis.command = (ncqTag >= 0) ? 0x60 : 0x25;
 			break;
 		case CommandType::write:
-			table.commandFis.command = 0x35; // WRITE DMA EXT
+			// WRITE FPDMA QUEUED or WRITE DMA EXT
+			table.commandFis.command = (ncqTag >= 0) ? 0x61 : 0x35;
 			header.configBytes[0] |= 1 << 6; // Indicates we are writing
 			break;
 		case CommandType::identify:
 			table.commandFis.command = 0xEC; // IDENTIFY DEVICE
 			break;
+		case CommandType::trim:
+			table.commandFis.command = 0x06; // DATA SET MANAGEMENT
+			table.commandFis.features = 1; // TRIM
+			header.configBytes[0] |= 1 << 6; // The range entries are written
+			break;
+		case CommandType::readLog:
+			table.commandFis.command = 0x2F; // READ LOG EXT
+			break;
 		default:
 			assert(!"unknown command type");
 	}
 
 	if (logCommands) {
 		printf("block/ahci: submitting %zu byte %s to %p at sector %" PRIu64 "\n",
-				numBytes_, cmdTypeToString(type_), buffer_, sector_);
+				numBytes_, cmdTypeToString(type_), segments_.front().buffer, sector_);
 	}
 }
 
 /* Returns the number of PRDT entries written.
  *
- * Note on buffer_: libblockfs guarantees us that buffer_ is locked into memory,
+ * Note on segments_: libblockfs guarantees us that the buffers are locked into memory,
  * and calling helPointerPhysical ensures that the pages are allocated and present
  * in the page tables. Hence, we know the buffer remains in memory during the DMA.
  */
@@ -101,28 +123,30 @@ size_t Command::writeScatterGather_(commandTable& table) {
 		};
 	};
 
-	uintptr_t virtStart = reinterpret_cast<uintptr_t>(buffer_);
-	uintptr_t virtEnd = virtStart + numBytes_;
-	assert(virtEnd > virtStart);
-
-	// As virtStart may not be aligned to pageSize, we split off the initial
-	// unaligned part, then work with pageSize aligned chunks.
-	if (virtStart % pageSize > 0) {
-		auto nextAlignedAddr = (virtStart + pageSize) & ~(pageSize - 1);
-		auto bytesUntilAligned = nextAlignedAddr - virtStart;
-		auto bytesToWrite = std::min(numBytes_, bytesUntilAligned);
-		addEntry(helix::addressToPhysical(virtStart), bytesToWrite);
-
-		virtStart = nextAlignedAddr;
-	}
-
-	// Insert every page in the buffer into the scatter-gather list.
-	for (uintptr_t virt = virtStart; virt < virtEnd; virt += pageSize) {
-		uintptr_t phys = helix::addressToPhysical(virt);
-		
-		// TODO: As a small optimisation, we could accumulate into the previous entry if they
-		// happen to be physically contiguous.
-		addEntry(phys, virtEnd - virt);
+	for (auto &segment : segments_) {
+		uintptr_t virtStart = reinterpret_cast<uintptr_t>(segment.buffer);
+		uintptr_t virtEnd = virtStart + segment.numBytes;
+		assert(virtEnd > virtStart);
+
+		// As virtStart may not be aligned to pageSize, we split off the initial
+		// unaligned part, then work with pageSize aligned chunks.
+		if (virtStart % pageSize > 0) {
+			auto nextAlignedAddr = (virtStart + pageSize) & ~(pageSize - 1);
+			auto bytesUntilAligned = nextAlignedAddr - virtStart;
+			auto bytesToWrite = std::min(segment.numBytes, bytesUntilAligned);
+			addEntry(helix::addressToPhysical(virtStart), bytesToWrite);
+
+			virtStart = nextAlignedAddr;
+		}
+
+		// Insert every page in the buffer into the scatter-gather list.
+		for (uintptr_t virt = virtStart; virt < virtEnd; virt += pageSize) {
+			uintptr_t phys = helix::addressToPhysical(virt);
+
+			// TODO: As a small optimisation, we could accumulate into the previous entry if they
+			// happen to be physically contiguous.
+			addEntry(phys, virtEnd - virt);
+		}
 	}
 
 	return prdtIndex;
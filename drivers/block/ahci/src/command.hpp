@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include <async/oneshot-event.hpp>
 
 #include "spec.hpp"
@@ -7,12 +9,26 @@
 enum class CommandType {
 	read,
 	write,
-	identify
+	identify,
+	// DATA SET MANAGEMENT with the TRIM bit; the buffer holds LBA range entries.
+	trim,
+	// READ LOG EXT; the sector is the log address.
+	readLog
+};
+
+// Virtually contiguous part of the data buffer of a command.
+struct DataSegment {
+	void *buffer;
+	size_t numBytes;
 };
 
 struct Command {
 public:
-	Command(uint64_t sector, size_t numSectors, size_t numBytes, void *buffer, CommandType type);
+	Command(uint64_t sector, size_t numSectors, std::vector<DataSegment> segments,
+			CommandType type);
+
+	Command(uint64_t sector, size_t numSectors, size_t numBytes, void *buffer, CommandType type)
+		: Command(sector, numSectors, {DataSegment{buffer, numBytes}}, type) { }
 	Command() = delete;
 	Command(Command&) = delete;
 	Command& operator=(Command &) = delete;
@@ -22,22 +38,40 @@ public:
 		assert(type == CommandType::identify);
 	}
 
-	void prepare(commandTable& table, commandHeader& header);
+	// If ncqTag is non-negative, read and writes are issued as FPDMA QUEUED with that tag.
+	void prepare(commandTable& table, commandHeader& header, int ncqTag = -1);
 	void notifyCompletion(); 
 
+	// Whether the command can be issued as an NCQ command.
+	bool isQueueable() const {
+		return type_ == CommandType::read || type_ == CommandType::write;
+	}
+
+	// Returns false if the command already failed too often.
+	bool retry() {
+		return ++retries_ <= maxRetries;
+	}
+
+	CommandType type() const {
+		return type_;
+	}
+
 	auto getFuture() {
 		return event_.wait();
 	}
 
 private:
+	static constexpr int maxRetries = 3;
+
 	size_t writeScatterGather_(commandTable& table);
 
 private:
 	uint64_t sector_;
 	size_t numSectors_;
 	size_t numBytes_;
-	void *buffer_;
+	std::vector<DataSegment> segments_;
 	CommandType type_;
+	int retries_ = 0;
 	async::oneshot_event event_;
 };
 
@@ -49,6 +83,10 @@ constexpr const char *cmdTypeToString(CommandType type) {
 			return "write";
 		case CommandType::identify:
 			return "identify";
+		case CommandType::trim:
+			return "trim";
+		case CommandType::readLog:
+			return "read log";
 		default:
 			assert(!"unknown command type");
 	}
@@ -15,7 +15,7 @@ public:
 	async::detached run();
 
 private:
-	async::result<bool> initPorts_(size_t numCommandSlots, bool staggeredSpinUp);
+	async::result<bool> initPorts_(size_t numCommandSlots, bool staggeredSpinUp, bool ncq);
 	async::detached handleIrqs_();
 	void dumpState_();
 
@@ -1,4 +1,9 @@
+#include <algorithm>
 #include <inttypes.h>
+#include <memory>
+#include <optional>
+#include <string.h>
+#include <unistd.h>
 
 #include <helix/memory.hpp>
 #include <helix/timer.hpp>
@@ -36,6 +41,7 @@ namespace flags {
 		constexpr int hostDataError   = 1 << 28;
 		constexpr int ifFatalError    = 1 << 27;
 		constexpr int ifNonFatalError = 1 << 26;
+		constexpr int setDeviceBits   = 1 << 3;
 		constexpr int d2hFis          = 1;
 	}
 
@@ -50,10 +56,11 @@ namespace {
 }
 
 // TODO: We can use a more appropriate block size, but this breaks other parts of the OS.
-Port::Port(int64_t parentId, int portIndex, size_t numCommandSlots, bool staggeredSpinUp, arch::mem_space regs)
+Port::Port(int64_t parentId, int portIndex, size_t numCommandSlots, bool staggeredSpinUp,
+		bool hbaSupportsNcq, arch::mem_space regs)
 	: BlockDevice{::sectorSize, parentId},  regs_{regs}, deviceSize_{0},
-	numCommandSlots_{numCommandSlots}, commandsInFlight_{0}, portIndex_{portIndex}, 
-	staggeredSpinUp_{staggeredSpinUp}
+	numCommandSlots_{numCommandSlots}, commandsInFlight_{0}, ncq_{hbaSupportsNcq},
+	portIndex_{portIndex}, staggeredSpinUp_{staggeredSpinUp}
 {
 }
 
@@ -122,7 +129,7 @@ void Port::dumpState() {
 	printf("  PxSACT: %#x\n", regs_.load(regs::sataActive));
 	printf("  PxIS: %#x\n", regs_.load(regs::interruptStatus));
 	printf("  PxIE: %#x\n", regs_.load(regs::interruptEnable));
-	printf("  commandsInFlight: %zu\n", commandsInFlight_);
+	printf("  commandsInFlight: %zu%s\n", commandsInFlight_, queuedInFlight_ ? " (NCQ)" : "");
 	printf("  submittedCmds slots used: %zu\n", std::count_if(submittedCmds_.begin(), submittedCmds_.end(), [](auto &p){ return p != nullptr; }));
 }
 
@@ -172,18 +179,9 @@ async::result<bool> Port::run() {
 	cas = regs_.load(regs::commandAndStatus);
 	regs_.store(regs::commandAndStatus, cas | flags::cmd::start);
 
-	size_t slot = co_await findFreeSlot_();
-
 	arch::dma_object<identifyDevice> identify{&dmaPool_};
 	Command cmd = Command(identify.data(), CommandType::identify);
-	cmd.prepare(commandTables_[slot], commandList_->slots[slot]);
-
-	regs_.store(regs::commandIssue, 1 << slot);
-
-	// For simplicity, poll for completion (500ms)
-	success = co_await helix::kindaBusyWait(500'000'000,
-			[&](){ return !(regs_.load(regs::commandIssue) & (1 << slot)); });
-	if (!success) {
+	if (!(co_await pollCommand_(cmd))) {
 		printf("\e[31mblock/ahci: Port %d identify failed\n", portIndex_);
 		dumpState();
 		co_return false;
@@ -194,10 +192,19 @@ async::result<bool> Port::run() {
 	auto sectorCount = identify->maxLBA48;
 	auto model = identify->getModel();
 	deviceSize_ = logicalSize * sectorCount;
-
-	printf("block/ahci: Started port %d, model %s, size %.1fGiB (sectors: logical %zu, physical %zu, count %" PRIu64 ")\n",
+	rotational = identify->isRotational();
+	supportsDiscard = identify->supportsTrim();
+	// Zero means that the limit is not reported. Larger TRIMs cover gigabytes anyway.
+	trimBlocks_ = std::clamp<size_t>(identify->maxDsmBlocks, 1, 8);
+	// NCQ tags are command slots, so the device's queue depth limits the usable slots.
+	ncq_ = ncq_ && identify->supportsNcq();
+	if (ncq_)
+		numCommandSlots_ = std::min(numCommandSlots_, identify->ncqDepth());
+	maxQueueDepth = numCommandSlots_;
+
+	printf("block/ahci: Started port %d, model %s, size %.1fGiB (sectors: logical %zu, physical %zu, count %" PRIu64 "), NCQ %s (%zu slots)\n",
 			portIndex_, model.c_str(), static_cast<float>(deviceSize_ / (1 << 30)),
-			logicalSize, physicalSize, sectorCount);
+			logicalSize, physicalSize, sectorCount, ncq_ ? "yes" : "no", numCommandSlots_);
 	assert(logicalSize == 512 && "block/ahci: logical sector size > 512 is not supported");
 
 	// Clear and enable interrupts on this port
@@ -206,6 +213,7 @@ async::result<bool> Port::run() {
 	auto ie = regs_.load(regs::interruptEnable);
 	regs_.store(regs::interruptEnable, ie
 			| flags::is::d2hFis
+			| flags::is::setDeviceBits
 			| flags::is::taskFileError
 			| flags::is::hostDataError
 			| flags::is::hostFatalError
@@ -244,19 +252,11 @@ async::result<size_t> Port::findFreeSlot_() {
 void Port::checkErrors() {
 	auto is = regs_.load(regs::interruptStatus);
 
-	// TODO: Make this more robust (try to recover)
-	if (is & (flags::is::hostFatalError | flags::is::ifFatalError) || regs_.load(regs::tfd) & 0x1) {
+	// TODO: Recover from these by resetting the port (AHCI 10.4.2).
+	if (is & (flags::is::hostFatalError | flags::is::ifFatalError)) {
 		printf("\e[31mblock/ahci: Port %d encountered error\e[39m\n", portIndex_);
 		dumpState();
 		abort();
-	} else if (is & flags::is::ifNonFatalError) {
-		printf("\e[31mblock/ahci: Port %d encountered non-fatal error\e[39m\n", portIndex_);
-		dumpState();
-		abort();
-	} else if (regs_.load(regs::tfd) & 1) {
-		printf("\e[31mblock/ahci: Port %d encountered task file error\e[39m\n", portIndex_);
-		dumpState();
-		abort();
 	}
 }
 
@@ -264,17 +264,32 @@ void Port::handleIrq() {
 	auto is = regs_.load(regs::interruptStatus);
 
 	if (logCommands) {
-		printf("block/ahci: Port %d handling IRQ: PxIS %#x, PxIE %#x, PxTFD %#x, PxCI %#x, PxCAS %#x\n",
+		printf("block/ahci: Port %d handling IRQ: PxIS %#x, PxIE %#x, PxTFD %#x, PxCI %#x, PxSACT %#x, PxCAS %#x\n",
 				portIndex_, is, regs_.load(regs::interruptEnable), regs_.load(regs::tfd),
-				regs_.load(regs::commandIssue), regs_.load(regs::commandAndStatus));
+				regs_.load(regs::commandIssue), regs_.load(regs::sataActive),
+				regs_.load(regs::commandAndStatus));
 	}
 
 	checkErrors();
 
+	// recover_() polls for its own commands.
+	if (recovering_) {
+		regs_.store(regs::interruptStatus, is);
+		return;
+	}
+
+	if (is & (flags::is::taskFileError | flags::is::ifNonFatalError)
+			|| regs_.load(regs::tfd) & 1) {
+		recovering_ = true;
+		recover_();
+		return;
+	}
+
 	std::vector<Command *> completed;
 
-	// Notify all completed commands
-	auto cmdActiveMask = regs_.load(regs::commandIssue);
+	// Notify all completed commands; NCQ commands stay active in PxSACT until the
+	// device reports their completion via a Set Device Bits FIS.
+	auto cmdActiveMask = regs_.load(regs::commandIssue) | regs_.load(regs::sataActive);
 	for (size_t i = 0; i < numCommandSlots_; i++) {
 		if (submittedCmds_[i] && !(cmdActiveMask & (1 << i))) {
 			completed.push_back(std::exchange(submittedCmds_[i], nullptr));
@@ -288,14 +303,97 @@ void Port::handleIrq() {
 		cmd->notifyCompletion();
 	}
 
-	// If the buffer has gone from full to not full, wake the tasks waiting for a free slot.
-	// TODO: If we have a lot of waiters, this will cause many spurious wakeups. Ideally, we only
-	// notify a certain number of tasks, and the rest can stay asleep.
-	if (commandsInFlight_ + completed.size() == numCommandSlots_ && completed.size() > 0) {
+	// Wake the submission loop, which may wait for a free slot or for the port to drain.
+	if (completed.size() > 0) {
 		freeSlotDoorbell_.raise();
 	}
 }
 
+async::result<bool> Port::pollCommand_(Command &cmd) {
+	assert(!commandsInFlight_);
+	size_t slot = 0;
+	cmd.prepare(commandTables_[slot], commandList_->slots[slot]);
+
+	regs_.store(regs::commandIssue, 1 << slot);
+
+	// For simplicity, poll for completion (500ms)
+	co_return co_await helix::kindaBusyWait(500'000'000,
+			[&](){ return !(regs_.load(regs::commandIssue) & (1 << slot)); });
+}
+
+async::detached Port::recover_() {
+	auto is = regs_.load(regs::interruptStatus);
+	auto tfd = regs_.load(regs::tfd);
+	auto activeMask = regs_.load(regs::sataActive);
+	printf("\e[31mblock/ahci: Port %d encountered error (PxIS %#x, PxTFD %#x, PxSACT %#x), recovering\e[39m\n",
+			portIndex_, is, tfd, activeMask);
+
+	// The device aborts all outstanding commands on an error, so take them all back.
+	std::array<Command *, limits::maxCmdSlots> aborted{};
+	std::swap(aborted, submittedCmds_);
+	bool wasQueued = queuedInFlight_;
+	commandsInFlight_ = 0;
+	queuedInFlight_ = false;
+
+	// Stop the port; this clears PxCI and PxSACT.
+	auto cas = regs_.load(regs::commandAndStatus);
+	auto currentSlot = (cas >> 8) & 0x1F;
+	regs_.store(regs::commandAndStatus, cas & ~flags::cmd::start);
+	auto success = co_await helix::kindaBusyWait(500'000'000, [&](){
+		return !(regs_.load(regs::commandAndStatus) & flags::cmd::cmdListRunning); });
+
+	regs_.store(regs::sErr, regs_.load(regs::sErr));
+	regs_.store(regs::interruptStatus, regs_.load(regs::interruptStatus));
+
+	// TODO: Perform a COMRESET instead of giving up.
+	if (!success || regs_.load(regs::tfd) & (flags::tfd::bsy | flags::tfd::drq)) {
+		printf("\e[31mblock/ahci: Port %d did not recover\e[39m\n", portIndex_);
+		dumpState();
+		abort();
+	}
+
+	cas = regs_.load(regs::commandAndStatus);
+	regs_.store(regs::commandAndStatus, cas | flags::cmd::start);
+
+	// Non-queued commands are processed in order; PxCMD.CCS points to the failing one.
+	std::optional<size_t> failedSlot;
+	if (wasQueued) {
+		// Reading the NCQ error log also takes the device out of its error state.
+		arch::dma_object<ncqErrorLog> log{&dmaPool_};
+		Command logCmd{ncqErrorLog::logAddress, 1, sizeof(ncqErrorLog), log.data(), CommandType::readLog};
+		if (!(co_await pollCommand_(logCmd))) {
+			printf("\e[31mblock/ahci: Port %d failed to read NCQ error log\e[39m\n", portIndex_);
+			dumpState();
+			abort();
+		}
+		regs_.store(regs::interruptStatus, regs_.load(regs::interruptStatus));
+
+		if (!log->nonQueued()) {
+			failedSlot = log->tag();
+			printf("block/ahci: Port %d: NCQ command %zu failed with status %#x, error %#x\n",
+					portIndex_, *failedSlot, log->status, log->error);
+		}
+	} else {
+		failedSlot = currentSlot;
+	}
+
+	if (failedSlot && aborted[*failedSlot] && !aborted[*failedSlot]->retry()) {
+		// TODO: BlockDevice has no way to report I/O errors.
+		printf("\e[31mblock/ahci: Port %d: %s to slot %zu failed repeatedly\e[39m\n",
+				portIndex_, cmdTypeToString(aborted[*failedSlot]->type()), *failedSlot);
+		dumpState();
+		abort();
+	}
+
+	recovering_ = false;
+
+	for (auto cmd : aborted) {
+		if (cmd)
+			pendingCmdQueue_.put(cmd);
+	}
+	freeSlotDoorbell_.raise();
+}
+
 async::detached Port::submitPendingLoop_() {
 	while (true) {
 		auto cmd = co_await pendingCmdQueue_.async_get();
@@ -305,37 +403,132 @@ async::detached Port::submitPendingLoop_() {
 }
 
 async::result<void> Port::submitCommand_(Command *cmd) {
+	bool queued = ncq_ && cmd->isQueueable();
+
+	// Queued and non-queued commands cannot be outstanding at the same time.
+	while (recovering_ || (commandsInFlight_ && queued != queuedInFlight_))
+		co_await freeSlotDoorbell_.async_wait();
+
 	auto slot = co_await findFreeSlot_();
 	assert(!(regs_.load(regs::commandIssue) & (1 << slot)));
 	assert(!submittedCmds_[slot]);
 
-	// Setup command table and FIS
-	cmd->prepare(commandTables_[slot], commandList_->slots[slot]);
+	// Setup command table and FIS; NCQ tags equal command slots.
+	cmd->prepare(commandTables_[slot], commandList_->slots[slot],
+			queued ? static_cast<int>(slot) : -1);
 
 	// Issue command
 	submittedCmds_[slot] = cmd;
 	commandsInFlight_++;
+	queuedInFlight_ = queued;
 
 	// Wait until not busy
 	while (regs_.load(regs::tfd) & (flags::tfd::bsy | flags::tfd::drq))
 		;
 
+	// PxSACT must be set before PxCI for NCQ commands.
+	if (queued)
+		regs_.store(regs::sataActive, 1 << slot);
 	regs_.store(regs::commandIssue, 1 << slot);
 	co_return;
 }
 
 async::result<void> Port::readSectors(uint64_t sector, void *buffer, size_t numSectors) {
-	Command cmd{sector, numSectors, numSectors * sectorSize,
-			buffer, CommandType::read};
-	pendingCmdQueue_.put(&cmd);
-	co_await cmd.getFuture();
+	blockfs::Segment segment{buffer, numSectors};
+	co_await transfer_(sector, {&segment, 1}, CommandType::read);
 }
 
 async::result<void> Port::writeSectors(uint64_t sector, const void *buffer, size_t numSectors) {
-	Command cmd{sector, numSectors, numSectors * sectorSize,
-			const_cast<void *>(buffer), CommandType::write};
-	pendingCmdQueue_.put(&cmd);
-	co_await cmd.getFuture();
+	blockfs::Segment segment{const_cast<void *>(buffer), numSectors};
+	co_await transfer_(sector, {&segment, 1}, CommandType::write);
+}
+
+async::result<void> Port::readSectorsV(uint64_t sector,
+		std::span<const blockfs::Segment> segments) {
+	co_await transfer_(sector, segments, CommandType::read);
+}
+
+async::result<void> Port::writeSectorsV(uint64_t sector,
+		std::span<const blockfs::Segment> segments) {
+	co_await transfer_(sector, segments, CommandType::write);
+}
+
+async::result<void> Port::transfer_(uint64_t sector, std::span<const blockfs::Segment> segments,
+		CommandType type) {
+	size_t pageSize = getpagesize();
+	// Command requires transfers to be smaller than 64 KiB.
+	size_t maxBytes = 65536 - sectorSize;
+
+	std::vector<std::unique_ptr<Command>> cmds;
+	std::vector<DataSegment> pieces;
+	size_t numBytes = 0;
+	size_t numEntries = 0;
+
+	auto flush = [&] {
+		auto numSectors = numBytes / sectorSize;
+		cmds.push_back(std::make_unique<Command>(sector, numSectors, std::move(pieces), type));
+		pendingCmdQueue_.put(cmds.back().get());
+		sector += numSectors;
+		pieces.clear();
+		numBytes = 0;
+		numEntries = 0;
+	};
+
+	for (auto &segment : segments) {
+		auto virt = reinterpret_cast<uintptr_t>(segment.buffer);
+		auto virtEnd = virt + segment.numSectors * sectorSize;
+		// Sector alignment ensures that we only split commands at sector boundaries.
+		assert(!(virt % sectorSize));
+
+		// Each page that we touch takes up one PRDT entry, see Command::writeScatterGather_().
+		while (virt < virtEnd) {
+			auto chunk = std::min(pageSize - virt % pageSize, virtEnd - virt);
+			if (numEntries == commandTable::prdtEntries || numBytes + chunk > maxBytes)
+				flush();
+
+			if (!pieces.empty() && reinterpret_cast<uintptr_t>(pieces.back().buffer)
+					+ pieces.back().numBytes == virt) {
+				pieces.back().numBytes += chunk;
+			} else {
+				pieces.push_back({reinterpret_cast<void *>(virt), chunk});
+			}
+			numBytes += chunk;
+			numEntries++;
+			virt += chunk;
+		}
+	}
+	if (numBytes)
+		flush();
+
+	for (auto &cmd : cmds)
+		co_await cmd->getFuture();
+}
+
+async::result<void> Port::discard(uint64_t sector, size_t numSectors) {
+	if (!supportsDiscard)
+		co_return;
+
+	// Each entry encodes a 48-bit LBA and a 16-bit length; zero-length entries are ignored.
+	constexpr size_t entriesPerBlock = 512 / sizeof(uint64_t);
+	constexpr size_t maxEntryLength = 0xFFFF;
+
+	while (numSectors) {
+		arch::dma_array<uint64_t> entries{&dmaPool_, trimBlocks_ * entriesPerBlock};
+		memset(entries.data(), 0, trimBlocks_ * 512);
+
+		size_t numEntries = 0;
+		while (numSectors && numEntries < trimBlocks_ * entriesPerBlock) {
+			auto length = std::min(numSectors, maxEntryLength);
+			entries[numEntries++] = sector | (static_cast<uint64_t>(length) << 48);
+			sector += length;
+			numSectors -= length;
+		}
+
+		auto numBlocks = (numEntries + entriesPerBlock - 1) / entriesPerBlock;
+		Command cmd{0, numBlocks, numBlocks * 512, entries.data(), CommandType::trim};
+		pendingCmdQueue_.put(&cmd);
+		co_await cmd.getFuture();
+	}
 }
 
 async::result<size_t> Port::getSize() {
@@ -17,7 +17,7 @@
 class Port : public blockfs::BlockDevice {
 public:
 	Port(int64_t parentId, int index, size_t numCommandSlots, bool staggeredSpinUp,
-			arch::mem_space regs);
+			bool hbaSupportsNcq, arch::mem_space regs);
 
 public:
 	async::result<bool> init();
@@ -28,6 +28,11 @@ public:
 
 	async::result<void> readSectors(uint64_t sector, void *buf, size_t numSectors) override;
 	async::result<void> writeSectors(uint64_t sector, const void *buf, size_t numSectors) override;
+	async::result<void> readSectorsV(uint64_t sector,
+			std::span<const blockfs::Segment> segments) override;
+	async::result<void> writeSectorsV(uint64_t sector,
+			std::span<const blockfs::Segment> segments) override;
+	async::result<void> discard(uint64_t sector, size_t numSectors) override;
 	async::result<size_t> getSize() override;
 
 	int getIndex() const { return portIndex_; }
@@ -36,6 +41,14 @@ private:
 	async::result<size_t> findFreeSlot_();
 	async::detached submitPendingLoop_();
 	async::result<void> submitCommand_(Command *cmd);
+	// Issues a command while the port is idle and polls for its completion.
+	async::result<bool> pollCommand_(Command &cmd);
+	// Error recovery after a task file error (AHCI 6.2.2): restarts the port, finds the
+	// failing command via the NCQ error log and resubmits all commands that were aborted.
+	async::detached recover_();
+	// Splits the transfer into commands that fit into a command table and waits for all of them.
+	async::result<void> transfer_(uint64_t sector, std::span<const blockfs::Segment> segments,
+			CommandType type);
 	void start_();
 	void stop_();
 
@@ -64,8 +77,15 @@ private:
 	async::recurring_event freeSlotDoorbell_;
 
 	uint64_t deviceSize_;
+	// Number of 512-byte blocks of range entries per TRIM command.
+	size_t trimBlocks_ = 1;
 	size_t numCommandSlots_;
 	size_t commandsInFlight_;
+	// Set if both the HBA and the device support NCQ.
+	bool ncq_;
+	// Whether the commands in flight are NCQ commands.
+	bool queuedInFlight_ = false;
+	bool recovering_ = false;
 	int portIndex_;
 	bool staggeredSpinUp_;
 };
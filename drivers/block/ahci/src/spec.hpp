@@ -90,15 +90,25 @@ static_assert(alignof(commandTable) >= 128);
 struct identifyDevice {
 	uint16_t _junkA[27];
 	uint16_t model[20];
-	uint16_t _junkB[36];
+	uint16_t _junkB[28];
+	// Maximal NCQ queue depth minus one in bits 4:0.
+	uint16_t queueDepth;
+	uint16_t sataCapabilities;
+	uint16_t _junkI[6];
 	uint16_t capabilities;
 	uint16_t _junkC[16];
 	uint64_t maxLBA48;
-	uint16_t _junkD[2];
+	uint16_t _junkD;
+	// Maximal number of 512-byte blocks of LBA range entries per DATA SET MANAGEMENT.
+	uint16_t maxDsmBlocks;
 	uint16_t sectorSizeInfo;
 	uint16_t _junkE[9];
 	uint16_t logicalSectorSize;
-	uint16_t _junkF[139];
+	uint16_t _junkF[52];
+	uint16_t dataSetManagement;
+	uint16_t _junkH[47];
+	uint16_t rotationRate;
+	uint16_t _junkG[38];
 
 	std::string getModel() const {
 		char modelNative[41];
@@ -143,5 +153,43 @@ struct identifyDevice {
 	bool supportsLba48() const {
 		return capabilities & (1 << 10);
 	}
+
+	bool supportsNcq() const {
+		return sataCapabilities & (1 << 8);
+	}
+
+	size_t ncqDepth() const {
+		return (queueDepth & 0x1F) + 1;
+	}
+
+	bool supportsTrim() const {
+		return dataSetManagement & 1;
+	}
+
+	// A rotation rate of 1 identifies solid state devices; zero means that it is not reported.
+	bool isRotational() const {
+		return rotationRate != 1;
+	}
 };
 static_assert(sizeof(identifyDevice) == 512);
+
+// NCQ Command Error log (log address 10h), read by READ LOG EXT after an NCQ error.
+struct ncqErrorLog {
+	// Bit 7 (NQ) is set if a non-queued command failed; otherwise, bits 4:0 hold its tag.
+	uint8_t flags;
+	uint8_t _reservedA;
+	uint8_t status;
+	uint8_t error;
+	uint8_t _reservedB[508];
+
+	static constexpr uint8_t logAddress = 0x10;
+
+	bool nonQueued() const {
+		return flags & (1 << 7);
+	}
+
+	size_t tag() const {
+		return flags & 0x1F;
+	}
+};
+static_assert(sizeof(ncqErrorLog) == 512);
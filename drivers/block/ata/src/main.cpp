@@ -4,6 +4,7 @@
 #include <iostream>
 #include <queue>
 #include <memory>
+#include <optional>
 
 #include <async/result.hpp>
 #include <async/recurring-event.hpp>
@@ -11,6 +12,7 @@
 #include <arch/io_space.hpp>
 #include <arch/register.hpp>
 #include <helix/ipc.hpp>
+#include <helix/memory.hpp>
 #include <helix/timer.hpp>
 #include <protocols/hw/client.hpp>
 #include <protocols/mbus/client.hpp>
@@ -42,6 +44,22 @@ namespace alt_regs {
 	inline constexpr arch::scalar_register<uint8_t> inStatus{0};
 }
 
+// Bus-master registers of the PCI IDE controller (relative to the channel's part of BAR 4).
+namespace bm_regs {
+	inline constexpr arch::scalar_register<uint8_t> command{0};
+	inline constexpr arch::scalar_register<uint8_t> status{2};
+	inline constexpr arch::scalar_register<uint32_t> prdtAddress{4};
+}
+
+// Physical region descriptor, i.e., an entry of the bus-master scatter-gather table.
+struct Prd {
+	uint32_t address;
+	// Zero means 64 KiB.
+	uint16_t byteCount;
+	uint16_t flags;
+};
+static_assert(sizeof(Prd) == 8, "Bad sizeof(Prd)");
+
 class Controller : public blockfs::BlockDevice {
 	enum class IoResult {
 		none,
@@ -59,10 +77,15 @@ public:
 public:
 	async::detached run();
 
+	// Switches to bus-master DMA. offset refers to the bus-master registers of this channel.
+	// Requests fall back to PIO until this is called or if the drive does not support DMA.
+	void attachBusMaster(uint16_t offset, helix::UniqueDescriptor bar);
+
 private:
 	async::detached _doRequestLoop();
 	async::result<IoResult> _pollForBsy();
 	async::result<IoResult> _waitForBsyIrq();
+	async::result<IoResult> _waitForDmaIrq();
 
 public:
 	async::result<void> readSectors(uint64_t sector, void *buffer,
@@ -77,11 +100,19 @@ private:
 	enum Commands {
 		kCommandReadSectors = 0x20,
 		kCommandReadSectorsExt = 0x24,
+		kCommandReadDmaExt = 0x25,
 		kCommandWriteSectors = 0x30,
 		kCommandWriteSectorsExt = 0x34,
+		kCommandWriteDmaExt = 0x35,
+		kCommandReadDma = 0xC8,
+		kCommandWriteDma = 0xCA,
 		kCommandIdentify = 0xEC,
 	};
 
+	// Size of the DMA bounce buffer; this also limits the size of DMA requests.
+	static constexpr size_t bounceSize = 128 * 1024;
+	static constexpr size_t maxPrds = 0x1000 / sizeof(Prd);
+
 	enum Flags {
 		kStatusErr = 0x01,
 		kStatusDrq = 0x08,
@@ -90,7 +121,17 @@ private:
 		kStatusBsy = 0x80,
 
 		kDeviceSlave = 0x10,
-		kDeviceLba = 0x40
+		kDeviceLba = 0x40,
+
+		kBmCommandStart = 0x01,
+		// Set for transfers from the device to memory.
+		kBmCommandRead = 0x08,
+
+		kBmStatusActive = 0x01,
+		kBmStatusError = 0x02,
+		kBmStatusIrq = 0x04,
+
+		kPrdEndOfTable = 0x8000
 	};
 
 	struct Request {
@@ -101,10 +142,19 @@ private:
 		async::oneshot_event event;
 	};
 
+	async::result<void> _transfer(bool isWrite, uint64_t sector, void *buffer, size_t numSectors);
+
 	async::result<void> _performRequest(Request *request);
+	async::result<void> _performPioRequest(Request *request);
+	async::result<void> _performDmaRequest(Request *request);
+	void _issueCommand(Request *request, uint8_t command);
 
 	async::result<bool> _detectDevice();
 
+	bool _useDma() {
+		return _bmSpace && _supportsDma;
+	}
+
 	std::queue<Request *> _requestQueue;
 	async::recurring_event _doorbell;
 
@@ -113,17 +163,47 @@ private:
 	arch::io_space _altSpace;
 
 	bool _supportsLBA48;
+	bool _supportsDma;
 
 	uint64_t _irqSequence;
+
+	helix::UniqueDescriptor _bmBar;
+	std::optional<arch::io_space> _bmSpace;
+
+	// Bus-master DMA only reaches the low 4 GiB. Hence, transfers go through a bounce buffer.
+	Prd *_prdTable = nullptr;
+	uintptr_t _prdTablePhysical = 0;
+	uint8_t *_bounceBuffer = nullptr;
+	uintptr_t _bouncePhysical = 0;
 };
 
+namespace {
+	// Allocates physically contiguous memory below 4 GiB.
+	void *allocateDma32(size_t size, uintptr_t &physical) {
+		HelAllocRestrictions restrictions{.addressBits = 32, .numaNode = 0};
+		HelHandle memory;
+		void *window;
+		HEL_CHECK(helAllocateMemory(size, kHelAllocContinuous, &restrictions, &memory));
+		HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
+				0, size, kHelMapProtRead | kHelMapProtWrite, &window));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, memory));
+		physical = helix::ptrToPhysical(window);
+		assert(physical + size <= (uintptr_t{1} << 32));
+		return window;
+	}
+}
+
 Controller::Controller(int64_t parentId, uint16_t mainOffset, uint16_t altOffset,
 		helix::UniqueDescriptor mainBar, helix::UniqueDescriptor altBar,
 		helix::UniqueDescriptor irq)
 : BlockDevice{512, parentId}, _irq{std::move(irq)},
-		_ioSpace{mainOffset}, _altSpace{altOffset}, _supportsLBA48{false} {
+		_ioSpace{mainOffset}, _altSpace{altOffset}, _supportsLBA48{false}, _supportsDma{false} {
 	HEL_CHECK(helEnableIo(mainBar.getHandle()));
 	HEL_CHECK(helEnableIo(altBar.getHandle()));
+
+	// Requests are performed one at a time; sort them for (usually rotational) IDE disks.
+	rotational = true;
+	maxQueueDepth = 1;
 }
 
 async::detached Controller::run() {
@@ -141,6 +221,22 @@ async::detached Controller::run() {
 	blockfs::runDevice(this);
 }
 
+void Controller::attachBusMaster(uint16_t offset, helix::UniqueDescriptor bar) {
+	HEL_CHECK(helEnableIo(bar.getHandle()));
+	_bmBar = std::move(bar);
+	_bmSpace = arch::io_space{offset};
+
+	_prdTable = static_cast<Prd *>(allocateDma32(0x1000, _prdTablePhysical));
+	_bounceBuffer = static_cast<uint8_t *>(allocateDma32(bounceSize, _bouncePhysical));
+
+	// Make sure that no stale transfer is running.
+	_bmSpace->store(bm_regs::command, 0);
+	_bmSpace->store(bm_regs::status, kBmStatusError | kBmStatusIrq);
+
+	std::cout << "block/ata: Using bus-master DMA at port 0x"
+			<< std::hex << offset << std::dec << std::endl;
+}
+
 async::detached Controller::_doRequestLoop() {
 	while(true) {
 		if(_requestQueue.empty()) {
@@ -211,32 +307,79 @@ auto Controller::_waitForBsyIrq() -> async::result<IoResult> {
 	}
 }
 
-async::result<void> Controller::readSectors(uint64_t sector,
-		void *buffer, size_t numSectors) {
-	Request request{};
-	request.isWrite = false;
-	request.sector = sector;
-	request.numSectors = numSectors;
-	request.buffer = buffer;
+auto Controller::_waitForDmaIrq() -> async::result<IoResult> {
+	while(true) {
+		if(logIrqs)
+			std::cout << "block/ata: Awaiting DMA IRQ." << std::endl;
+		auto await = co_await helix_ng::awaitEvent(_irq, _irqSequence);
+		HEL_CHECK(await.error());
+		_irqSequence = await.sequence();
+
+		// Unlike the task file, the bus-master status tells us whether the IRQ is ours.
+		auto bmStatus = _bmSpace->load(bm_regs::status);
+		if(!(bmStatus & kBmStatusIrq)) {
+			HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckNack, _irqSequence));
+			continue;
+		}
+		if(logIrqs)
+			std::cout << "block/ata: DMA IRQ fired." << std::endl;
+
+		// Stop the bus master, then clear the IRQ in the drive and in the bus master.
+		// The error and IRQ bits are write-1-to-clear.
+		_bmSpace->store(bm_regs::command, 0);
+		auto status = _ioSpace.load(regs::inStatus);
+		_bmSpace->store(bm_regs::status, bmStatus | kBmStatusError | kBmStatusIrq);
+		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, _irqSequence));
 
-	_requestQueue.push(&request);
-	_doorbell.raise();
+		// TODO: Report those errors to the caller.
+		assert(!(bmStatus & kBmStatusError));
+		if(status & kStatusBsy)
+			co_return IoResult::timeout; // TODO: properly implement the timeout!
+		if(!(status & kStatusRdy)) // Device was disconnected?
+			co_return IoResult::notReady;
+		assert(!(status & kStatusErr));
+		assert(!(status & kStatusDf));
+		co_return ((status & kStatusDrq) ? IoResult::withData : IoResult::noData);
+	}
+}
 
-	co_await request.event.wait();
+async::result<void> Controller::readSectors(uint64_t sector,
+		void *buffer, size_t numSectors) {
+	co_await _transfer(false, sector, buffer, numSectors);
 }
 
 async::result<void> Controller::writeSectors(uint64_t sector,
 		const void *buffer, size_t numSectors) {
-	Request request{};
-	request.isWrite = true;
-	request.sector = sector;
-	request.numSectors = numSectors;
-	request.buffer = const_cast<void *>(buffer);
-
-	_requestQueue.push(&request);
-	_doorbell.raise();
+	co_await _transfer(true, sector, const_cast<void *>(buffer), numSectors);
+}
 
-	co_await request.event.wait();
+async::result<void> Controller::_transfer(bool isWrite, uint64_t sector,
+		void *buffer, size_t numSectors) {
+	while(numSectors) {
+		// A single command transfers up to 256 sectors (LBA28) or 65536 sectors (LBA48).
+		// DMA requests are bounded by the bounce buffer, PIO requests by the
+		// sector count that the 8-bit register can express in LBA28 mode.
+		size_t maxSectors = 255;
+		if(_useDma())
+			maxSectors = bounceSize / 512;
+		else if(_supportsLBA48)
+			maxSectors = 65535;
+
+		Request request{};
+		request.isWrite = isWrite;
+		request.sector = sector;
+		request.numSectors = std::min(numSectors, maxSectors);
+		request.buffer = buffer;
+
+		_requestQueue.push(&request);
+		_doorbell.raise();
+
+		co_await request.event.wait();
+
+		sector += request.numSectors;
+		buffer = static_cast<uint8_t *>(buffer) + request.numSectors * 512;
+		numSectors -= request.numSectors;
+	}
 }
 
 async::result<size_t> Controller::getSize() {
@@ -297,8 +440,12 @@ async::result<bool> Controller::_detectDevice() {
 
 	_supportsLBA48 = (ident_data[167] & (1 << 2))
 			&& (ident_data[173] & (1 << 2));
+	// Word 49, bit 8.
+	_supportsDma = ident_data[99] & 1;
 
-	printf("block/ata: detected device, model: '%s', %s 48-bit LBA\n", model, _supportsLBA48 ? "supports" : "doesn't support");
+	printf("block/ata: detected device, model: '%s', %s 48-bit LBA, %s DMA\n", model,
+			_supportsLBA48 ? "supports" : "doesn't support",
+			_supportsDma ? "supports" : "doesn't support");
 
 	co_return true;
 }
@@ -306,12 +453,32 @@ async::result<bool> Controller::_detectDevice() {
 async::result<void> Controller::_performRequest(Request *request) {
 	if(logRequests)
 		std::cout << "block/ata: Reading/writing " << request->numSectors
-				<< " sectors from " << request->sector << std::endl;
+				<< " sectors from " << request->sector
+				<< (_useDma() ? " using DMA" : "") << std::endl;
 
-	assert(!(request->sector & ~((size_t(1) << 48) - 1)));
-	assert(request->numSectors <= 255);
+	// The request might predate attachBusMaster() and exceed the bounce buffer.
+	if(_useDma() && request->numSectors * 512 <= bounceSize) {
+		co_await _performDmaRequest(request);
+	}else{
+		co_await _performPioRequest(request);
+	}
 
-	_ioSpace.store(regs::outDevice, kDeviceLba);
+	if(logRequests)
+		std::cout << "block/ata: Reading/writing from " << request->sector
+				<< " complete" << std::endl;
+}
+
+void Controller::_issueCommand(Request *request, uint8_t command) {
+	if(_supportsLBA48) {
+		assert(!(request->sector & ~((size_t(1) << 48) - 1)));
+		assert(request->numSectors && request->numSectors <= 0x10000);
+	}else{
+		assert(!(request->sector & ~((size_t(1) << 28) - 1)));
+		assert(request->numSectors && request->numSectors <= 0x100);
+	}
+
+	_ioSpace.store(regs::outDevice, kDeviceLba
+			| (_supportsLBA48 ? 0 : ((request->sector >> 24) & 0x0F)));
 	// TODO: There should be a 400ns delay after drive selection.
 
 	if (_supportsLBA48) {
@@ -326,11 +493,53 @@ async::result<void> Controller::_performRequest(Request *request) {
 	_ioSpace.store(regs::outLba2, (request->sector >> 8) & 0xFF);
 	_ioSpace.store(regs::outLba3, (request->sector >> 16) & 0xFF);
 
+	_ioSpace.store(regs::outCommand, command);
+}
+
+async::result<void> Controller::_performDmaRequest(Request *request) {
+	size_t size = request->numSectors * 512;
+	assert(size <= bounceSize);
+
+	if(request->isWrite)
+		memcpy(_bounceBuffer, request->buffer, size);
+
+	// PRD regions must not cross a 64 KiB boundary.
+	size_t numPrds = 0;
+	for(size_t offset = 0; offset < size; ) {
+		auto address = _bouncePhysical + offset;
+		auto chunk = std::min(size - offset, 0x10000 - (address & 0xFFFF));
+		assert(numPrds < maxPrds);
+		_prdTable[numPrds].address = address;
+		_prdTable[numPrds].byteCount = chunk & 0xFFFF;
+		_prdTable[numPrds].flags = 0;
+		numPrds++;
+		offset += chunk;
+	}
+	_prdTable[numPrds - 1].flags = kPrdEndOfTable;
+
+	_bmSpace->store(bm_regs::prdtAddress, _prdTablePhysical);
+	_bmSpace->store(bm_regs::command, request->isWrite ? 0 : kBmCommandRead);
+	_bmSpace->store(bm_regs::status, _bmSpace->load(bm_regs::status)
+			| kBmStatusError | kBmStatusIrq);
+
+	if(request->isWrite) {
+		_issueCommand(request, _supportsLBA48 ? kCommandWriteDmaExt : kCommandWriteDma);
+	}else{
+		_issueCommand(request, _supportsLBA48 ? kCommandReadDmaExt : kCommandReadDma);
+	}
+	_bmSpace->store(bm_regs::command, (request->isWrite ? 0 : kBmCommandRead) | kBmCommandStart);
+
+	// The drive raises a single IRQ once the whole transfer is done.
+	auto ioRes = co_await _waitForDmaIrq();
+	assert(ioRes == IoResult::noData);
+
+	if(!request->isWrite)
+		memcpy(request->buffer, _bounceBuffer, size);
+}
+
+async::result<void> Controller::_performPioRequest(Request *request) {
 	if(!request->isWrite) {
-		if (_supportsLBA48)
-			_ioSpace.store(regs::outCommand, kCommandReadSectorsExt);
-		else
-			_ioSpace.store(regs::outCommand, kCommandReadSectors);
+		_issueCommand(request, _supportsLBA48 ? kCommandReadSectorsExt : kCommandReadSectors);
 
 		// Receive the result for each sector.
 		for(size_t k = 0; k < request->numSectors; k++) {
@@ -345,10 +554,7 @@ async::result<void> Controller::_performRequest(Request *request) {
 			_ioSpace.load_iterative(regs::ioData, reinterpret_cast<uint16_t *>(chunk), 256);
 		}
 	}else{
-		if (_supportsLBA48)
-			_ioSpace.store(regs::outCommand, kCommandWriteSectorsExt);
-		else
-			_ioSpace.store(regs::outCommand, kCommandWriteSectors);
+		_issueCommand(request, _supportsLBA48 ? kCommandWriteSectorsExt : kCommandWriteSectors);
 
 		// Write requests do not generate an IRQ for the first sector.
 		auto ioRes = co_await _pollForBsy();
@@ -372,14 +578,18 @@ async::result<void> Controller::_performRequest(Request *request) {
 			}
 		}
 	}
-
-	if(logRequests)
-		std::cout << "block/ata: Reading/writing from " << request->sector
-				<< " complete" << std::endl;
 }
 
 std::vector<std::shared_ptr<Controller>> globalControllers;
 
+// Bus-master registers of the primary channel, if found before the legacy controller.
+struct BusMaster {
+	uint16_t offset;
+	helix::UniqueDescriptor bar;
+};
+std::optional<BusMaster> pendingBusMaster;
+bool foundBusMaster = false;
+
 // ------------------------------------------------------------------------
 // Freestanding discovery functions.
 // ------------------------------------------------------------------------
@@ -397,10 +607,51 @@ async::detached bindController(mbus_ng::Entity hwEntity) {
 			info.barInfo[0].address, info.barInfo[1].address,
 			std::move(mainBar), std::move(altBar),
 			std::move(irq));
+	if(pendingBusMaster) {
+		controller->attachBusMaster(pendingBusMaster->offset, std::move(pendingBusMaster->bar));
+		pendingBusMaster.reset();
+	}
 	controller->run();
 	globalControllers.push_back(std::move(controller));
 }
 
+// The legacy controller only covers the I/O ports of the primary channel.
+// If a PCI IDE controller decodes this channel in compatibility mode,
+// we can still use its bus-master registers.
+async::detached bindIdeController(mbus_ng::Entity hwEntity) {
+	protocols::hw::Device device((co_await hwEntity.getRemoteLane()).unwrap());
+	auto info = co_await device.getPciInfo();
+
+	// Bit 0: primary channel in native mode, bit 7: bus-master capable.
+	auto progIf = co_await device.loadPciSpace(0x09, 1);
+	if(progIf & 1) {
+		std::cout << "block/ata: Primary channel is in native mode, ignoring controller"
+				<< std::endl;
+		co_return;
+	}
+	if(!(progIf & 0x80) || info.barInfo[4].ioType != protocols::hw::IoType::kIoTypePort) {
+		std::cout << "block/ata: Controller does not support bus-master DMA" << std::endl;
+		co_return;
+	}
+	// Only a single controller can decode the legacy ports.
+	if(foundBusMaster) {
+		std::cout << "block/ata: Ignoring additional IDE controller" << std::endl;
+		co_return;
+	}
+	foundBusMaster = true;
+
+	auto bar = co_await device.accessBar(4);
+	co_await device.enableBusmaster();
+
+	// The primary channel's registers come first in BAR 4.
+	auto offset = info.barInfo[4].address;
+	if(globalControllers.empty()) {
+		pendingBusMaster = BusMaster{static_cast<uint16_t>(offset), std::move(bar)};
+	}else{
+		globalControllers.front()->attachBusMaster(offset, std::move(bar));
+	}
+}
+
 async::detached observeControllers() {
 	auto filter = mbus_ng::Conjunction{{
 		mbus_ng::EqualsFilter{"legacy", "ata"}
@@ -421,6 +672,27 @@ async::detached observeControllers() {
 	}
 }
 
+async::detached observeIdeControllers() {
+	auto filter = mbus_ng::Conjunction{{
+		mbus_ng::EqualsFilter{"pci-class", "01"},
+		mbus_ng::EqualsFilter{"pci-subclass", "01"}
+	}};
+
+	auto enumerator = mbus_ng::Instance::global().enumerate(filter);
+	while (true) {
+		auto [_, events] = (co_await enumerator.nextEvents()).unwrap();
+
+		for (auto &event : events) {
+			if (event.type != mbus_ng::EnumerationEvent::Type::created)
+				continue;
+
+			auto entity = co_await mbus_ng::Instance::global().getEntity(event.id);
+			std::cout << "block/ata: Detected PCI IDE controller" << std::endl;
+			bindIdeController(std::move(entity));
+		}
+	}
+}
+
 // --------------------------------------------------------
 // main() function
 // --------------------------------------------------------
@@ -429,5 +701,6 @@ int main() {
 	printf("block/ata: Starting driver\n");
 
 	observeControllers();
+	observeIdeControllers();
 	async::run_forever(helix::currentDispatcher);
 }
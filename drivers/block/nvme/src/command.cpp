@@ -1,93 +1,157 @@
+#include <algorithm>
 #include <arch/bit.hpp>
+#include <assert.h>
 #include <helix/memory.hpp>
 #include <unistd.h>
 
 #include "command.hpp"
 
+namespace {
+
+size_t pageSize() {
+	static size_t size = getpagesize();
+	return size;
+}
+
+} // namespace
+
+bool Command::prpMergeable(const void *end, const void *next) {
+	return !(reinterpret_cast<uintptr_t>(end) & (pageSize() - 1))
+		&& !(reinterpret_cast<uintptr_t>(next) & (pageSize() - 1));
+}
+
 void Command::setupBuffer(arch::dma_buffer_view view, spec::DataTransfer policy) {
+	setupBuffers({&view, 1}, policy);
+}
+
+void Command::setupBuffers(std::span<const arch::dma_buffer_view> views, spec::DataTransfer policy) {
 	using arch::convert_endian;
 	using arch::endian;
 
-	view_ = view;
-
-	if(policy == spec::DataTransfer::PRP) {
-		static size_t pageSize = getpagesize();
-
-		uintptr_t virtStart = reinterpret_cast<uintptr_t>(view.data());
-		auto offset = virtStart % pageSize;
+	auto le64 = [] (uint64_t v) {
+		return convert_endian<endian::little, endian::native>(v);
+	};
 
-		if (offset + view.size() <= pageSize * 2) {
-			// Inline
-			command_.common.dataPtr.prp.prp1 = convert_endian<endian::little, endian::native>(
-				helix::ptrToPhysical(view.data()));
+	if(views.size() == 1)
+		view_ = views[0];
 
-			auto firstPrpLen = pageSize - offset;
-			if (view.size() > firstPrpLen) {
-				command_.common.dataPtr.prp.prp2 = convert_endian<endian::little, endian::native>(
-					helix::ptrToPhysical(view.subview(firstPrpLen).data()));
+	if(policy == spec::DataTransfer::PRP) {
+		// Collect one entry per page; only the first one may have an offset into its page.
+		std::vector<uint64_t> entries;
+		for(size_t i = 0; i < views.size(); i++) {
+			auto &view = views[i];
+			assert(!i || prpMergeable(views[i - 1].byte_data() + views[i - 1].size(), view.data()));
+
+			for(auto &range : helix::physicalRanges(view.data(), view.size())) {
+				auto phys = range.physical;
+				auto end = phys + range.length;
+				while(phys < end) {
+					entries.push_back(phys);
+					phys = (phys + pageSize()) & ~(pageSize() - 1);
+				}
 			}
-
-			return;
 		}
 
-		uintptr_t prp1, prp2;
-		auto size = view.size();
-
-		prp1 = helix::addressToPhysical(virtStart);
+		auto &prp = command_.common.dataPtr.prp;
+		prp.prp1 = entries.empty() ? 0 : le64(entries[0]);
+		prp.prp2 = 0;
+		if(entries.size() <= 1)
+			return;
 
-		if (offset + view.size() <= pageSize) {
-			command_.readWrite.dataPtr.prp.prp1 = convert_endian<endian::little, endian::native>(prp1);
-			command_.readWrite.dataPtr.prp.prp2 = 0;
+		std::span<const uint64_t> rest{entries.begin() + 1, entries.end()};
+		if(rest.size() == 1) {
+			prp.prp2 = le64(rest[0]);
 			return;
 		}
-		size -= pageSize - offset;
-		virtStart += pageSize - offset;
 
-		if (size <= pageSize) {
-			command_.readWrite.dataPtr.prp.prp1 = convert_endian<endian::little, endian::native>(prp1);
-			command_.readWrite.dataPtr.prp.prp2 = convert_endian<endian::little, endian::native>(
-				helix::addressToPhysical(virtStart));
-			return;
+		// Build the PRP list. Each list occupies a page; if more entries follow,
+		// the last slot of a list points to the next list.
+		auto perList = pageSize() >> 3;
+		uint64_t *slot = &prp.prp2;
+		while(!rest.empty()) {
+			auto prpObj = arch::dma_array<uint64_t>{nullptr, perList};
+			*slot = le64(helix::ptrToPhysical(prpObj.data()));
+
+			auto n = (rest.size() <= perList) ? rest.size() : perList - 1;
+			for(size_t i = 0; i < n; i++)
+				prpObj[i] = le64(rest[i]);
+			rest = rest.subspan(n);
+
+			slot = &prpObj[perList - 1];
+			prpLists.push_back(std::move(prpObj));
+		}
+	} else if(policy == spec::DataTransfer::HostSGL) {
+		// Collect one data block descriptor per physically contiguous range.
+		std::vector<spec::SglDataBlock> blocks;
+		for(auto &view : views) {
+			for(auto &range : helix::physicalRanges(view.data(), view.size())) {
+				auto phys = range.physical;
+				auto end = phys + range.length;
+				while(phys < end) {
+					auto length = std::min<uint64_t>(end - phys, UINT32_MAX);
+
+					if(!blocks.empty() && blocks.back().address + blocks.back().length == phys
+							&& blocks.back().length + length <= UINT32_MAX) {
+						blocks.back().length += length;
+					} else {
+						blocks.push_back({});
+						blocks.back().address = phys;
+						blocks.back().length = length;
+					}
+					phys += length;
+				}
+			}
 		}
 
-		auto prpObj = arch::dma_array<uint64_t>{nullptr, pageSize >> 3};
-		auto *prpList = prpObj.data();
+		auto toLittle = [&] (spec::SglDataBlock &desc, uint8_t type) {
+			desc.address = le64(desc.address);
+			desc.length = convert_endian<endian::little, endian::native>(desc.length);
+			desc.sglDescriptorType = type;
+			desc.sglSubType = 0;
+		};
 
-		prp2 = helix::ptrToPhysical(prpList);
-		prpLists.push_back(std::move(prpObj));
+		// PSDT = 01: SGLs are used for the data transfer.
+		command_.common.flags = (command_.common.flags & ~0xC0) | 0x40;
 
-		int i = 0;
-		for (;;) {
-			if (i == pageSize >> 3) {
-				auto *oldPrpList = prpList;
-				prpObj = arch::dma_array<uint64_t>{nullptr, pageSize >> 3};
-				prpList = prpObj.data();
-				prpLists.push_back(std::move(prpObj));
+		auto &sgl1 = command_.common.dataPtr.sgl.dataBlock;
+		if(blocks.size() <= 1) {
+			sgl1 = blocks.empty() ? spec::SglDataBlock{} : blocks[0];
+			toLittle(sgl1, spec::kSglDataBlock);
+			return;
+		}
 
-				prpList[0] = oldPrpList[i - 1];
-				oldPrpList[i - 1] = convert_endian<endian::little, endian::native>(
-					helix::ptrToPhysical(prpList));
-				i = 1;
+		// Each segment occupies a page. If more descriptors follow,
+		// the last descriptor of a segment points to the next segment.
+		auto perSegment = pageSize() / sizeof(spec::Sgl);
+		std::span<spec::SglDataBlock> rest{blocks};
+		spec::SglDataBlock *link = &sgl1;
+		while(!rest.empty()) {
+			auto n = (rest.size() <= perSegment) ? rest.size() : perSegment - 1;
+
+			auto segObj = arch::dma_array<spec::Sgl>{nullptr, perSegment};
+			link->address = helix::ptrToPhysical(segObj.data());
+			link->length = (n + (rest.size() > n ? 1 : 0)) * sizeof(spec::Sgl);
+			toLittle(*link, (rest.size() > n) ? spec::kSglSegment : spec::kSglLastSegment);
+
+			for(size_t i = 0; i < n; i++) {
+				segObj[i].dataBlock = rest[i];
+				toLittle(segObj[i].dataBlock, spec::kSglDataBlock);
 			}
-			prpList[i++] = convert_endian<endian::little, endian::native>(
-				helix::addressToPhysical(virtStart));
-			virtStart += pageSize;
+			rest = rest.subspan(n);
 
-			if (size <= pageSize)
-				break;
-			size -= pageSize;
+			link = &segObj[perSegment - 1].dataBlock;
+			sglSegments.push_back(std::move(segObj));
 		}
-
-		command_.readWrite.dataPtr.prp.prp1 = convert_endian<endian::little, endian::native>(prp1);
-		command_.readWrite.dataPtr.prp.prp2 = convert_endian<endian::little, endian::native>(prp2);
 	} else {
-		// TODO(no92): this heavily assumes NVMe-over-fabrics; we might want to support SGL on
-		// PCIe bindings, too. Conveniently, qemu's emulation supports the most basic tier of SGLs.
+		assert(views.size() <= 1);
+		auto size = views.empty() ? 0 : views[0].size();
+
+		// Transport SGLs (NVMe over Fabrics): the data itself is moved by the transport.
 		command_.common.flags &= ~0xB0;
 		command_.common.flags |= 0x40;
-		command_.common.dataPtr.sgl.dataBlock.length = view.size();
+		command_.common.dataPtr.sgl.dataBlock.length = size;
 
-		if(view.size() && (command_.common.opcode & 1)) {
+		if(size && (command_.common.opcode & 1)) {
 			command_.common.dataPtr.sgl.generic.sglDescriptorType = 0;
 			command_.common.dataPtr.sgl.generic.sglSubType = 1;
 		} else {
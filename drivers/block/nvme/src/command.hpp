@@ -7,6 +7,7 @@
 
 #include "spec.hpp"
 
+#include <span>
 #include <vector>
 
 struct Command {
@@ -17,6 +18,14 @@ struct Command {
 	}
 
 	void setupBuffer(arch::dma_buffer_view view, spec::DataTransfer policy);
+	// Describes a buffer that consists of multiple virtually contiguous parts.
+	// For PRPs, all parts but the first must start on a page boundary and
+	// all parts but the last must end on one (see prpMergeable()).
+	// Transport SGLs only support a single part.
+	void setupBuffers(std::span<const arch::dma_buffer_view> views, spec::DataTransfer policy);
+
+	// Whether a part that starts at next can follow one that ends at end in a PRP list.
+	static bool prpMergeable(const void *end, const void *next);
 
 	async::future<Result, frg::stl_allocator> getFuture() {
 		return promise_.get_future();
@@ -34,5 +43,6 @@ private:
 	spec::Command command_;
 	async::promise<Result, frg::stl_allocator> promise_;
 	std::vector<arch::dma_array<uint64_t>> prpLists;
+	std::vector<arch::dma_array<spec::Sgl>> sglSegments;
 	arch::dma_buffer_view view_;
 };
@@ -1,6 +1,9 @@
+#include <algorithm>
 #include <arch/bit.hpp>
+#include <fafnir/dsl.hpp>
 #include <format>
 #include <helix/timer.hpp>
+#include <protocols/kernlet/compiler.hpp>
 #include <protocols/mbus/client.hpp>
 
 #include "controller.hpp"
@@ -21,6 +24,7 @@ namespace flags {
 	namespace cap {
 		constexpr arch::field<uint64_t, uint16_t> mqes{0, 16};
 		constexpr arch::field<uint64_t, uint8_t> dstrd{32, 4};
+		constexpr arch::field<uint64_t, uint8_t> mpsmin{48, 4};
 	} // namespace cap
 
 	namespace vs {
@@ -40,9 +44,19 @@ namespace flags {
 	} // namespace csts
 } // namespace flags
 
-PciExpressController::PciExpressController(int64_t parentId, protocols::hw::Device hwDevice, std::string location, helix::Mapping regsMapping)
+namespace {
+	// kernletcc only emits x86_64 code, hence other architectures ack IRQs from user space.
+#ifdef __x86_64__
+	constexpr bool useIrqKernlet = true;
+#else
+	constexpr bool useIrqKernlet = false;
+#endif
+} // namespace
+
+PciExpressController::PciExpressController(int64_t parentId, protocols::hw::Device hwDevice, std::string location,
+		helix::UniqueDescriptor regsBar, helix::Mapping regsMapping)
 	: Controller(parentId, location, ControllerType::PciExpress), hwDevice_{std::move(hwDevice)},
-		regsMapping_{std::move(regsMapping)}, regs_{regsMapping_.get()} {
+		regsBar_{std::move(regsBar)}, regsMapping_{std::move(regsMapping)}, regs_{regsMapping_.get()} {
 }
 
 async::detached PciExpressController::run(mbus_ng::EntityId subsystem) {
@@ -67,9 +81,68 @@ async::detached PciExpressController::run(mbus_ng::EntityId subsystem) {
 		ns->run();
 }
 
+async::result<helix::UniqueDescriptor> PciExpressController::setupIrqKernlet(helix::BorrowedDescriptor irq) {
+	co_await connectKernletCompiler();
+
+	// NVMe has no interrupt status register. Instead, the kernlet masks the interrupt
+	// through INTMS, which deasserts the IRQ until the queues are drained.
+	std::vector<uint8_t> kernletProgram;
+	fnr::emit_to(std::back_inserter(kernletProgram),
+		fnr::intrin{"__mmio_write32", 3, 0} (
+			fnr::binding{0}, // BAR0 (bound to slot 0).
+			fnr::binding{1} // Offset of the registers within BAR0 (bound to slot 1).
+				+ fnr::literal{regs::intms.offset()},
+			fnr::literal{1}
+		),
+		// Trigger the bitset event (bound to slot 2).
+		fnr::intrin{"__trigger_bitset", 2, 0} (
+			fnr::binding{2},
+			fnr::literal{1}
+		),
+		fnr::literal{1}
+	);
+
+	auto kernletObject = co_await compile(kernletProgram.data(),
+			kernletProgram.size(), {BindType::memoryView, BindType::offset,
+			BindType::bitsetEvent});
+
+	HelHandle eventHandle;
+	HEL_CHECK(helCreateBitsetEvent(&eventHandle));
+	helix::UniqueDescriptor event{eventHandle};
+
+	HelKernletData data[3];
+	data[0].handle = regsBar_.getHandle();
+	data[1].handle = regsMapping_.offset();
+	data[2].handle = event.getHandle();
+	HelHandle boundHandle;
+	HEL_CHECK(helBindKernlet(kernletObject.getHandle(), data, 3, &boundHandle));
+	HEL_CHECK(helAutomateIrq(irq.getHandle(), 0, boundHandle));
+
+	co_return std::move(event);
+}
+
 async::detached PciExpressController::handleIrqs(helix::UniqueDescriptor irq) {
 	irqSequence_ = 0;
 
+	if (useIrqKernlet) {
+		auto event = co_await setupIrqKernlet(irq);
+
+		// Clear the IRQ in case it was pending while we attached the kernlet.
+		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckKick | kHelAckClear, 0));
+
+		while (true) {
+			auto awaitResult = co_await helix_ng::awaitEvent(event, irqSequence_);
+			HEL_CHECK(awaitResult.error());
+			irqSequence_ = awaitResult.sequence();
+
+			for (auto &q : activeQueues_)
+				static_cast<PciExpressQueue *>(q.get())->handleIrq();
+
+			// Completions that arrive from here on raise a new IRQ.
+			regs_.store(regs::intmc, 1);
+		}
+	}
+
 	while (true) {
 		auto awaitResult = co_await helix_ng::awaitEvent(irq, irqSequence_);
 
@@ -94,10 +167,11 @@ async::detached PciExpressController::handleIrqs(helix::UniqueDescriptor irq) {
 }
 
 async::detached PciExpressController::handleMsis(helix::UniqueDescriptor irq, size_t queueId, bool isMsiX) {
-	irqSequence_ = 0;
+	// Each vector has its own handler, hence the sequence is tracked per handler.
+	uint64_t sequence = 0;
 
 	while (true) {
-		auto awaitResult = co_await helix_ng::awaitEvent(irq, irqSequence_);
+		auto awaitResult = co_await helix_ng::awaitEvent(irq, sequence);
 
 		auto q = std::ranges::find_if(activeQueues_, [queueId](auto &q) {
 			return q->getQueueId() == queueId;
@@ -112,14 +186,14 @@ async::detached PciExpressController::handleMsis(helix::UniqueDescriptor irq, si
 			regs_.store(regs::intms, 1 << queueId);
 
 		HEL_CHECK(awaitResult.error());
-		irqSequence_ = awaitResult.sequence();
+		sequence = awaitResult.sequence();
 
 		static_cast<PciExpressQueue *>(q->get())->handleIrq();
 
 		if(!isMsiX)
 			regs_.store(regs::intmc, 1 << queueId);
 
-		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, irqSequence_));
+		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, sequence));
 	}
 }
 
@@ -146,9 +220,9 @@ async::result<void> PciExpressController::disable() {
 	co_await waitStatus(false);
 }
 
-async::result<void> PciExpressController::setupIOQueueInterrupts(size_t queueId, size_t vector) {
+async::result<void> PciExpressController::setupIOQueueInterrupts(size_t queueId, size_t vector, int cpu) {
 	if(irqMode_ == InterruptMode::Msi || irqMode_ == InterruptMode::MsiX) {
-		auto irq = co_await hwDevice_.installMsi(vector);
+		auto irq = co_await hwDevice_.installMsi(vector, cpu);
 		handleMsis(std::move(irq), queueId, irqMode_ == InterruptMode::MsiX);
 	}
 }
@@ -159,6 +233,7 @@ async::result<void> PciExpressController::reset() {
 
 	queueDepth_ = std::min((cap & flags::cap::mqes) + 1, IO_QUEUE_DEPTH);
 	dbStride_ = 1 << (cap & flags::cap::dstrd);
+	minPageSize_ = size_t{0x1000} << (cap & flags::cap::mpsmin);
 
 	version_ = regs_.load(regs::vs);
 
@@ -190,17 +265,62 @@ async::result<void> PciExpressController::reset() {
 
 	co_await enable();
 
-	requestIoQueues(1, 1);
+	// Vector 0 belongs to the admin queue, each I/O queue gets one of the remaining vectors.
+	// With a legacy IRQ (or a single MSI) all queues would share one interrupt,
+	// so there is no point in using more than one I/O queue.
+	unsigned int wantedQueues = 1;
+	if(info.numMsis > 1)
+		wantedQueues = std::min({info.numCpus, info.numMsis - 1, MAX_IO_QUEUES});
+
+	// Polled queues do not need a vector, so they are requested on top.
+	auto featRes = co_await requestIoQueues(wantedQueues + POLLED_IO_QUEUES,
+			wantedQueues + POLLED_IO_QUEUES);
+	unsigned int numQueues = 1;
+	unsigned int numPolled = 0;
+	if(featRes.first.successful()) {
+		// The controller reports the number of allocated SQs and CQs (0's based).
+		auto allocated = featRes.second.u32;
+		auto numAllocated = std::min((allocated & 0xFFFF) + 1, (allocated >> 16) + 1);
+		numQueues = std::min(wantedQueues, numAllocated);
+		numPolled = std::min(POLLED_IO_QUEUES, numAllocated - numQueues);
+	}
+
+	for(unsigned int i = 1; i <= numQueues; i++) {
+		size_t vector = (irqMode_ == InterruptMode::LegacyIrq) ? 0 : i;
+
+		co_await setupIOQueueInterrupts(i, vector, static_cast<int>(i - 1));
+		auto ioQ = std::make_unique<PciExpressQueue>(i, queueDepth_,
+				regs_.subspace(doorbellsOffset + i * 8 * dbStride_), vector);
+		co_await ioQ->init();
 
-	co_await setupIOQueueInterrupts(1, 1);
-	auto ioQ = std::make_unique<PciExpressQueue>(1, queueDepth_, regs_.subspace(doorbellsOffset + 1 * 8 * dbStride_), 1);
-	co_await ioQ->init();
+		if (!(co_await setupIoQueue(ioQ.get()))) {
+			numPolled = 0;
+			break;
+		}
 
-	if (co_await setupIoQueue(ioQ.get())) {
 		ioQ->run();
 		activeQueues_.push_back(std::move(ioQ));
 	}
 
+	for(unsigned int i = numQueues + 1; i <= numQueues + numPolled; i++) {
+		auto ioQ = std::make_unique<PciExpressQueue>(i, queueDepth_,
+				regs_.subspace(doorbellsOffset + i * 8 * dbStride_), 0, true);
+		co_await ioQ->init();
+
+		if (!(co_await setupIoQueue(ioQ.get())))
+			break;
+
+		ioQ->run();
+		activeQueues_.push_back(std::move(ioQ));
+		numPolledQueues_++;
+	}
+
+	// Polled commands bypass the request queue, hence only interrupt-driven queues count.
+	auto numIrqQueues = activeQueues_.size() - 1 - numPolledQueues_;
+	maxIoRequests_ = numIrqQueues * (queueDepth_ - 1);
+	std::cout << std::format("block/nvme: Using {} I/O queue(s) and {} polled queue(s) of depth {}",
+			numIrqQueues, numPolledQueues_, queueDepth_) << std::endl;
+
 	assert(activeQueues_.size() >= 2 && "At least need one IO queue");
 }
 
@@ -236,7 +356,9 @@ async::result<Command::Result> PciExpressController::createCQ(PciExpressQueue *q
 	auto cmd = std::make_unique<Command>();
 	auto &cmdBuf = cmd->getCommandBuffer().createCQ;
 
-	uint16_t flags = spec::kQueuePhysContig | spec::kCQIrqEnabled;
+	uint16_t flags = spec::kQueuePhysContig;
+	if (!q->polled())
+		flags |= spec::kCQIrqEnabled;
 
 	cmdBuf.opcode = static_cast<uint8_t>(spec::AdminOpcode::CreateCQ);
 	cmdBuf.prp1 = convert_endian<endian::little, endian::native>((uint64_t)q->getCqPhysAddr());
@@ -341,6 +463,17 @@ async::result<void> Controller::scanNamespaces() {
 	}
 
 	nn = convert_endian<endian::little>(idCtrl.nn);
+	oncs_ = convert_endian<endian::little>(idCtrl.oncs);
+	volatileWriteCache_ = idCtrl.vwc & spec::kVwcPresent;
+
+	if(idCtrl.mdts)
+		maxTransferSize_ = minPageSize_ << idCtrl.mdts;
+
+	ioDataTransfer_ = preferredDataTransfer_;
+	auto sgls = convert_endian<endian::little>(idCtrl.sgls);
+	if(preferredDataTransfer_ == spec::DataTransfer::PRP
+			&& (sgls & (spec::kSglSupported | spec::kSglSupportedDwordAligned)))
+		ioDataTransfer_ = spec::DataTransfer::HostSGL;
 
 	model = std::string{idCtrl.mn, sizeof(idCtrl.mn)};
 	serial = std::string{idCtrl.sn, sizeof(idCtrl.sn)};
@@ -389,7 +522,9 @@ async::result<void> Controller::createNamespace(unsigned int nsid) {
 	if (!lbaShift)
 		lbaShift = 9;
 
-	auto ns = std::make_unique<Namespace>(this, nsid, lbaShift, id.nsze);
+	auto ns = std::make_unique<Namespace>(this, nsid, lbaShift, id.nsze, oncs_,
+			volatileWriteCache_);
+	ns->maxQueueDepth = maxIoRequests_;
 	activeNamespaces_.push_back(std::move(ns));
 }
 
@@ -399,8 +534,21 @@ async::result<Command::Result> PciExpressController::submitAdminCommand(std::uni
 	return q->submitCommand(std::move(cmd));
 }
 
-async::result<Command::Result> PciExpressController::submitIoCommand(std::unique_ptr<Command> cmd) {
-	auto &ioQ = activeQueues_.back();
+async::result<Command::Result> PciExpressController::submitIoCommand(std::unique_ptr<Command> cmd,
+		bool polled) {
+	int cpu;
+	HEL_CHECK(helGetCurrentCpu(&cpu));
+
+	// activeQueues_[0] is the admin queue, the polled queues come last.
+	auto numIrqQueues = activeQueues_.size() - 1 - numPolledQueues_;
+	if (polled && numPolledQueues_) {
+		auto &pollQ = activeQueues_[1 + numIrqQueues
+				+ static_cast<size_t>(cpu) % numPolledQueues_];
+		return pollQ->submitCommand(std::move(cmd));
+	}
+
+	// Prefer the queue whose completion interrupt is routed to the current CPU.
+	auto &ioQ = activeQueues_[1 + static_cast<size_t>(cpu) % numIrqQueues];
 
 	return ioQ->submitCommand(std::move(cmd));
 }
@@ -29,7 +29,9 @@ struct Controller {
 	virtual async::detached run(mbus_ng::EntityId subsystem) = 0;
 
 	virtual async::result<Command::Result> submitAdminCommand(std::unique_ptr<Command> cmd) = 0;
-	virtual async::result<Command::Result> submitIoCommand(std::unique_ptr<Command> cmd) = 0;
+	// If polled is set, the command is completed by polling if the controller supports that.
+	virtual async::result<Command::Result> submitIoCommand(std::unique_ptr<Command> cmd,
+			bool polled = false) = 0;
 
 	inline int64_t getParentId() const {
 		return parentId_;
@@ -56,8 +58,23 @@ struct Controller {
 		return preferredDataTransfer_;
 	}
 
+	// Policy for I/O commands; on PCIe, only these may use SGLs.
+	spec::DataTransfer ioDataTransferPolicy() const {
+		return ioDataTransfer_;
+	}
+
+	// Maximal number of bytes per data transfer, or 0 if unlimited.
+	size_t maxTransferSize() const {
+		return maxTransferSize_;
+	}
+
 protected:
 	spec::DataTransfer preferredDataTransfer_ = spec::DataTransfer::PRP;
+	spec::DataTransfer ioDataTransfer_ = spec::DataTransfer::PRP;
+
+	// Minimum memory page size of the controller, the unit of MDTS.
+	size_t minPageSize_ = 0x1000;
+	size_t maxTransferSize_ = 0;
 
 	int64_t parentId_;
 	std::unique_ptr<mbus_ng::EntityManager> mbusEntity_;
@@ -68,30 +85,47 @@ protected:
 	std::string serial;
 	std::string model;
 	std::string fw_rev;
+	// Optional NVM commands that the controller supports, see spec::OncsFlags.
+	uint16_t oncs_ = 0;
+	// Whether the controller has a volatile write cache that needs to be flushed.
+	bool volatileWriteCache_ = false;
+
+	// Number of I/O commands that the controller can have in flight,
+	// used as the request queue depth of the namespaces.
+	size_t maxIoRequests_ = 32;
 
 	std::vector<std::unique_ptr<Queue>> activeQueues_;
 	std::vector<std::unique_ptr<Namespace>> activeNamespaces_;
 };
 
 struct PciExpressController final : public Controller {
-	PciExpressController(int64_t parentId, protocols::hw::Device hwDevice, std::string location, helix::Mapping regsMapping);
+	PciExpressController(int64_t parentId, protocols::hw::Device hwDevice, std::string location,
+			helix::UniqueDescriptor regsBar, helix::Mapping regsMapping);
 
 	async::detached run(mbus_ng::EntityId subsystem) override;
 
 	async::result<Command::Result> submitAdminCommand(std::unique_ptr<Command> cmd) override;
-	async::result<Command::Result> submitIoCommand(std::unique_ptr<Command> cmd) override;
+	async::result<Command::Result> submitIoCommand(std::unique_ptr<Command> cmd,
+			bool polled = false) override;
 private:
-	async::result<void> setupIOQueueInterrupts(size_t queueId, size_t vector);
+	async::result<void> setupIOQueueInterrupts(size_t queueId, size_t vector, int cpu = -1);
 
 	static constexpr int IO_QUEUE_DEPTH = 1024;
+	static constexpr unsigned int MAX_IO_QUEUES = 64;
+	// Number of I/O queues without interrupts that serve polled commands.
+	static constexpr unsigned int POLLED_IO_QUEUES = 1;
 
 	protocols::hw::Device hwDevice_;
 	std::string location_;
+	// The BAR stays open since the IRQ kernlet binds it.
+	helix::UniqueDescriptor regsBar_;
 	helix::Mapping regsMapping_;
 	arch::mem_space regs_;
 
 	unsigned int queueDepth_;
 	uint32_t dbStride_;
+	// Polled queues follow the interrupt-driven I/O queues in activeQueues_.
+	size_t numPolledQueues_ = 0;
 
 	uint64_t irqSequence_;
 	InterruptMode irqMode_;
@@ -107,6 +141,8 @@ private:
 	async::result<Command::Result> createCQ(PciExpressQueue *q);
 	async::result<Command::Result> createSQ(PciExpressQueue *q);
 
+	// Attaches a kernlet that masks the legacy IRQ; returns the bitset event that it raises.
+	async::result<helix::UniqueDescriptor> setupIrqKernlet(helix::BorrowedDescriptor irq);
 	async::detached handleIrqs(helix::UniqueDescriptor irq);
 	async::detached handleMsis(helix::UniqueDescriptor irq, size_t queueId, bool isMsiX);
 };
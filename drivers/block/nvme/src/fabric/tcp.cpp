@@ -1,7 +1,10 @@
+#include <algorithm>
+#include <arch/bit.hpp>
 #include <format>
 #include <helix/timer.hpp>
 #include <protocols/fs/client.hpp>
 #include <sys/epoll.h>
+#include <thread>
 
 #include "../controller.hpp"
 #include "tcp.hpp"
@@ -9,7 +12,43 @@
 namespace nvme::fabric {
 
 TcpQueue::TcpQueue(uint16_t cid, unsigned int index, unsigned int depth, in_addr addr, in_port_t port, helix::BorrowedLane lane, std::span<uint8_t, 16> uuid)
-: Queue(index, depth), addr_{addr}, port_{port}, lane_{std::move(lane)}, controllerId_{cid}, uuid_{uuid} {
+: Queue(index, depth), addr_{addr}, port_{port}, lane_{std::move(lane)}, controllerId_{cid}, uuid_{uuid},
+	buf_(sizeof(spec::tcp::CapsuleCmd) + sizeof(spec::Command)) {
+}
+
+async::result<bool> TcpQueue::sendAll(const void *buffer, size_t length) {
+	size_t sent = 0;
+	while(sent < length) {
+		auto send_err = co_await file_->sendto(static_cast<const std::byte *>(buffer) + sent,
+				length - sent, 0, nullptr, 0);
+		if(!send_err)
+			co_return false;
+		sent += send_err.value();
+	}
+	co_return true;
+}
+
+async::result<bool> TcpQueue::recvAll(void *buffer, size_t length) {
+	size_t received = 0;
+	while(received < length) {
+		auto recv_err = co_await file_->recvfrom(static_cast<std::byte *>(buffer) + received,
+				length - received, 0, nullptr, 0);
+		if(!recv_err || !recv_err.value())
+			co_return false;
+		received += recv_err.value();
+	}
+	co_return true;
+}
+
+async::result<bool> TcpQueue::skipBytes(size_t length) {
+	std::byte scratch[512];
+	while(length) {
+		auto chunk = std::min(length, sizeof(scratch));
+		if(!(co_await recvAll(scratch, chunk)))
+			co_return false;
+		length -= chunk;
+	}
+	co_return true;
 }
 
 async::result<protocols::fs::Error> TcpQueue::connect() {
@@ -47,6 +86,9 @@ async::result<protocols::fs::Error> TcpQueue::connect() {
 	if(resp.ch.pduType != spec::tcp::PduType::ICResp)
 		co_return protocols::fs::Error::addressNotAvailable;
 
+	if(resp.maxh2cdata)
+		maxH2CData_ = resp.maxh2cdata;
+
 	connectedEvent_.raise();
 
 	co_return protocols::fs::Error::none;
@@ -133,35 +175,37 @@ async::detached TcpQueue::run() {
 	if(qid_ == 0)
 		keepAlive();
 
-	auto recvbuf = std::vector<std::byte>(65536);
+	auto recvbuf = std::vector<std::byte>(256);
 
 	while(true) {
-		size_t received = 0;
-
-		while(received < sizeof(spec::tcp::PduCommonHeader)) {
-			auto recv_err = co_await file_->recvfrom(recvbuf.data() + received, sizeof(spec::tcp::PduCommonHeader) - received, 0, nullptr, 0);
-			if(!recv_err) {
-				std::cout << "block/nvme: error on receive for queue " << qid_ << std::endl;
-				co_return;
-			}
-			received += recv_err.value();
+		if(!(co_await recvAll(recvbuf.data(), sizeof(spec::tcp::PduCommonHeader)))) {
+			std::cout << "block/nvme: error on receive for queue " << qid_ << std::endl;
+			co_return;
 		}
 
 		auto ch = reinterpret_cast<spec::tcp::PduCommonHeader *>(recvbuf.data());
 
-		if(ch->pduLength > recvbuf.size())
-			recvbuf.resize(ch->pduLength);
+		// Data is received straight into the buffer of the command, so only read up to the data here.
+		size_t headerSize = ch->pduLength;
+		if(ch->pduType == spec::tcp::PduType::C2HData && ch->pduDataOffset)
+			headerSize = ch->pduDataOffset;
 
-		while(received < ch->pduLength) {
-			auto recv_err = co_await file_->recvfrom(recvbuf.data() + received, ch->pduLength - received, 0, nullptr, 0);
-			if(!recv_err) {
-				std::cout << "block/nvme: error on receive for queue " << qid_ << std::endl;
-				co_return;
-			}
-			received += recv_err.value();
+		if(headerSize < sizeof(spec::tcp::PduCommonHeader) || headerSize > ch->pduLength) {
+			std::cout << std::format("block/nvme: malformed NVMe-oF PDU on queue {}", qid_) << std::endl;
+			co_return;
+		}
+
+		if(headerSize > recvbuf.size())
+			recvbuf.resize(headerSize);
+
+		if(!(co_await recvAll(recvbuf.data() + sizeof(spec::tcp::PduCommonHeader),
+				headerSize - sizeof(spec::tcp::PduCommonHeader)))) {
+			std::cout << "block/nvme: error on receive for queue " << qid_ << std::endl;
+			co_return;
 		}
 
 		ch = reinterpret_cast<spec::tcp::PduCommonHeader *>(recvbuf.data());
+		size_t trailing = ch->pduLength - headerSize;
 
 		switch(ch->pduType) {
 			case spec::tcp::PduType::CapsuleResp: {
@@ -177,19 +221,31 @@ async::detached TcpQueue::run() {
 			}
 			case spec::tcp::PduType::C2HData: {
 				auto resp = reinterpret_cast<spec::tcp::C2HData *>(recvbuf.data());
+				auto slot = resp->commandCapsuleId;
+
+				std::byte *dest = nullptr;
+				if(resp->ch.pduDataOffset && resp->dataLength <= trailing
+						&& slot < queuedCmds_.size() && queuedCmds_[slot]) {
+					auto &view = queuedCmds_[slot]->view();
+					if(view.byte_data() && view.size() >= resp->dataOffset + resp->dataLength)
+						dest = view.byte_data() + resp->dataOffset;
+				}
 
-				if(resp->ch.pduDataOffset + resp->dataLength > resp->ch.pduLength) {
+				if(!dest) {
 					std::cout << std::format("block/nvme: NVMe-oF packet requests out-of-bound read, dropping") << std::endl;
-					continue;
+					break;
 				}
 
-				auto &cmd = queuedCmds_.at(resp->commandCapsuleId);
-				if(cmd->view().byte_data() && cmd->view().size() >= resp->dataOffset + resp->dataLength) {
-					memcpy(cmd->view().byte_data() + resp->dataOffset, recvbuf.data() + resp->ch.pduDataOffset, resp->dataLength);
-				} else {
-					std::cout << std::format("block/nvme: NVMe-oF packet requests out-of-bound read, dropping") << std::endl;
-					continue;
+				if(!(co_await recvAll(dest, resp->dataLength))) {
+					std::cout << "block/nvme: error on receive for queue " << qid_ << std::endl;
+					co_return;
 				}
+				trailing -= resp->dataLength;
+				break;
+			}
+			case spec::tcp::PduType::R2T: {
+				auto r2t = reinterpret_cast<spec::tcp::R2T *>(recvbuf.data());
+				sendData(r2t->commandCapsuleId, r2t->transferTag, r2t->r2tOffset, r2t->r2tLength);
 				break;
 			}
 			default: {
@@ -197,9 +253,57 @@ async::detached TcpQueue::run() {
 				co_return;
 			}
 		}
+
+		// Skip whatever we did not consume (e.g., dropped data or digests).
+		if(!(co_await skipBytes(trailing))) {
+			std::cout << "block/nvme: error on receive for queue " << qid_ << std::endl;
+			co_return;
+		}
 	}
 }
 
+async::detached TcpQueue::sendData(uint16_t slot, uint16_t transferTag, uint32_t offset, uint32_t length) {
+	if(slot >= queuedCmds_.size() || !queuedCmds_[slot]) {
+		std::cout << std::format("block/nvme: R2T for unknown command {} on queue {}", slot, qid_) << std::endl;
+		co_return;
+	}
+
+	auto view = queuedCmds_[slot]->view();
+	if(!view.byte_data() || view.size() < size_t{offset} + length) {
+		std::cout << std::format("block/nvme: NVMe-oF R2T requests out-of-bound write, dropping") << std::endl;
+		co_return;
+	}
+
+	co_await sendMutex.async_lock();
+	while(length) {
+		auto chunk = std::min(length, maxH2CData_);
+		spec::tcp::H2CData pdu{
+			.ch = {
+				.pduType = spec::tcp::PduType::H2CData,
+				.flags = (chunk == length) ? spec::tcp::kPduFlagLast : uint8_t{0},
+				.headerLength = sizeof(spec::tcp::H2CData),
+				.pduDataOffset = sizeof(spec::tcp::H2CData),
+				.pduLength = static_cast<uint32_t>(sizeof(spec::tcp::H2CData) + chunk),
+			},
+			.commandCapsuleId = slot,
+			.transferTag = transferTag,
+			.dataOffset = offset,
+			.dataLength = chunk,
+		};
+
+		// The data is sent directly from the caller's buffer.
+		if(!(co_await sendAll(&pdu, sizeof(pdu)))
+				|| !(co_await sendAll(view.byte_data() + offset, chunk))) {
+			std::cout << "block/nvme: error on send for queue " << qid_ << std::endl;
+			break;
+		}
+
+		offset += chunk;
+		length -= chunk;
+	}
+	sendMutex.unlock();
+}
+
 async::detached TcpQueue::submitPendingLoop() {
 	while (true) {
 		auto cmd = co_await pendingCmdQueue_.async_get();
@@ -212,48 +316,51 @@ async::result<void> TcpQueue::submitCommandToDevice(std::unique_ptr<Command> cmd
 	auto slot = co_await findFreeSlot();
 
 	// we can safely reuse the buffer as we are (implicitly) serialized by `submitPendingLoop`
-	new (buf_.data()) spec::tcp::CapsuleCmd({
+	auto capsuleCmd = new (buf_.data()) spec::tcp::CapsuleCmd({
 		.ch = {
 			.pduType = spec::tcp::PduType::CapsuleCmd,
 			.flags = 0,
 			.headerLength = sizeof(spec::tcp::CapsuleCmd) + sizeof(cmd->getCommandBuffer()),
 			.pduDataOffset = 0,
-			.pduLength = sizeof(spec::tcp::CapsuleCmd),
+			.pduLength = sizeof(spec::tcp::CapsuleCmd) + sizeof(cmd->getCommandBuffer()),
 		}
 	});
 
-	auto capsuleCmd = reinterpret_cast<spec::tcp::CapsuleCmd *>(buf_.data());
-	auto data_len = cmd->view().size();
-	capsuleCmd->ch.pduLength += sizeof(cmd->getCommandBuffer());
-
 	memcpy(&buf_[sizeof(spec::tcp::CapsuleCmd)], &cmd->getCommandBuffer(), sizeof(cmd->getCommandBuffer()));
 
 	auto genericCommand = reinterpret_cast<spec::Command *>(&buf_[sizeof(spec::tcp::CapsuleCmd)]);
 	genericCommand->common.commandId = slot;
 	auto opcode = cmd->getCommandBuffer().common.opcode;
 
-	if(data_len && opcode & 1) {
-		if(data_len > capsuleCmd->ch.pduDataOffset + buf_.size())
-			buf_.resize(capsuleCmd->ch.pduDataOffset + buf_.size());
-
-		capsuleCmd->ch.pduDataOffset = sizeof(spec::tcp::CapsuleCmd) + sizeof(cmd->getCommandBuffer());
-		memcpy(&buf_[capsuleCmd->ch.pduDataOffset], reinterpret_cast<void *>(cmd->view().byte_data()), data_len);
-		capsuleCmd->ch.pduLength += data_len;
+	// Small writes are sent in-capsule, larger ones are fetched by the controller via R2T.
+	// Connect commands always carry their data in-capsule.
+	auto view = cmd->view();
+	bool inCapsule = false;
+	if(view.size() && (opcode & 1)) {
+		inCapsule = view.size() <= inCapsuleSize_
+			|| opcode == static_cast<uint8_t>(spec::AdminOpcode::Fabrics);
+
+		if(inCapsule) {
+			capsuleCmd->ch.pduDataOffset = capsuleCmd->ch.headerLength;
+			capsuleCmd->ch.pduLength += view.size();
+		} else {
+			genericCommand->common.dataPtr.sgl.generic.sglDescriptorType = 0x05;
+			genericCommand->common.dataPtr.sgl.generic.sglSubType = 0x0A;
+		}
 	}
 
 	queuedCmds_[slot] = std::move(cmd);
 	commandsInFlight_++;
 
-	size_t sent = 0;
+	co_await sendMutex.async_lock();
+	// In-capsule data is sent directly from the caller's buffer.
+	bool success = co_await sendAll(buf_.data(), capsuleCmd->ch.headerLength);
+	if(success && inCapsule)
+		success = co_await sendAll(view.byte_data(), view.size());
+	sendMutex.unlock();
 
-	while(sent < capsuleCmd->ch.pduLength) {
-		auto send_err = co_await file_->sendto(buf_.data() + sent, capsuleCmd->ch.pduLength - sent, 0, nullptr, 0);
-		if(!send_err) {
-			std::cout << "block/nvme: error on send for queue " << qid_ << std::endl;
-			co_return;
-		}
-		sent += send_err.value();
-	}
+	if(!success)
+		std::cout << "block/nvme: error on send for queue " << qid_ << std::endl;
 }
 
 async::result<Command::Result> TcpQueue::submitCommand(std::unique_ptr<Command> cmd) {
@@ -320,14 +427,38 @@ async::detached Tcp::run(mbus_ng::EntityId subsystem) {
 	setFeature.data[0] = 0x07;
 	setFeature.data[1] = 0;
 
+	// Use one I/O queue (i.e., one connection) per CPU.
+	unsigned int wantedQueues = std::min(std::max(std::thread::hardware_concurrency(), 1u), MAX_IO_QUEUES);
+	setFeature.data[1] = ((wantedQueues - 1) << 16) | (wantedQueues - 1);
+
 	cmd->setupBuffer(arch::dma_buffer_view{}, preferredDataTransfer_);
-	co_await activeQueues_.front()->submitCommand(std::move(cmd));
+	auto featRes = co_await activeQueues_.front()->submitCommand(std::move(cmd));
+	unsigned int numQueues = 1;
+	if(featRes.first.successful()) {
+		// The controller reports the number of allocated SQs and CQs (0's based).
+		auto allocated = featRes.second.u32;
+		numQueues = std::min({wantedQueues, (allocated & 0xFFFF) + 1, (allocated >> 16) + 1});
+	}
 
-	// // setup I/O queue
-	auto ioq = std::make_unique<TcpQueue>(cid, 1, 128, serverAddr_, serverPort_, netserverLane_, std::span<uint8_t, 16>{uuid});
-	ioq->run();
-	co_await ioq->init();
-	activeQueues_.push_back(std::move(ioq));
+	// IOCCSZ includes the submission queue entry.
+	size_t ioInCapsuleSize = 0;
+	spec::IdentifyController idCtrl;
+	if((co_await identifyController(idCtrl)).first.successful()) {
+		size_t ioccsz = arch::convert_endian<arch::endian::little>(idCtrl.ioccsz) * 16;
+		if(ioccsz > sizeof(spec::Command))
+			ioInCapsuleSize = ioccsz - sizeof(spec::Command);
+	}
+
+	for(unsigned int i = 1; i <= numQueues; i++) {
+		auto ioq = std::make_unique<TcpQueue>(cid, i, IO_QUEUE_DEPTH, serverAddr_, serverPort_, netserverLane_, std::span<uint8_t, 16>{uuid});
+		ioq->setInCapsuleSize(ioInCapsuleSize);
+		ioq->run();
+		co_await ioq->init();
+		activeQueues_.push_back(std::move(ioq));
+	}
+	maxIoRequests_ = numQueues * (IO_QUEUE_DEPTH - 1);
+
+	std::cout << std::format("block/nvme: Using {} I/O connection(s)", numQueues) << std::endl;
 
 	co_await scanNamespaces();
 
@@ -339,8 +470,14 @@ async::result<Command::Result> Tcp::submitAdminCommand(std::unique_ptr<Command>
 	co_return co_await activeQueues_.at(0)->submitCommand(std::move(cmd));
 }
 
-async::result<Command::Result> Tcp::submitIoCommand(std::unique_ptr<Command> cmd) {
-	co_return co_await activeQueues_.at(1)->submitCommand(std::move(cmd));
+async::result<Command::Result> Tcp::submitIoCommand(std::unique_ptr<Command> cmd, bool) {
+	// Completions arrive over the socket anyway, hence there is nothing to poll.
+	// activeQueues_[0] is the admin queue.
+	int cpu;
+	HEL_CHECK(helGetCurrentCpu(&cpu));
+	auto &ioq = activeQueues_.at(1 + static_cast<size_t>(cpu) % (activeQueues_.size() - 1));
+
+	co_return co_await ioq->submitCommand(std::move(cmd));
 }
 
 async::result<frg::expected<spec::CompletionStatus, uint64_t>> Tcp::fabricGetProperty(uint32_t propertyOffset, size_t size) {
@@ -21,11 +21,23 @@ struct TcpQueue final : public Queue {
 	uint16_t controllerId() {
 		return controllerId_;
 	}
+
+	// Write data up to this size is sent within the command capsule;
+	// the controller requests larger writes via R2T.
+	void setInCapsuleSize(size_t size) {
+		inCapsuleSize_ = size;
+	}
 private:
 	async::result<protocols::fs::Error> connect();
 	async::detached keepAlive();
 	async::detached submitPendingLoop();
 	async::result<void> submitCommandToDevice(std::unique_ptr<Command> cmd);
+	// Answers an R2T by sending H2CData PDUs from the command's buffer.
+	async::detached sendData(uint16_t slot, uint16_t transferTag, uint32_t offset, uint32_t length);
+
+	async::result<bool> sendAll(const void *buffer, size_t length);
+	async::result<bool> recvAll(void *buffer, size_t length);
+	async::result<bool> skipBytes(size_t length);
 
 	in_addr addr_;
 	in_port_t port_;
@@ -35,7 +47,12 @@ private:
 	size_t keepAliveTimeout_ = 10'000;
 	std::span<uint8_t, 16> uuid_;
 
-	std::vector<std::byte> buf_{8256};
+	size_t inCapsuleSize_ = spec::tcp::adminInCapsuleSize;
+	// Maximal data per H2CData PDU, as reported in the ICResp.
+	uint32_t maxH2CData_ = 4096;
+
+	// Holds the PDU header of the command that is being sent.
+	std::vector<std::byte> buf_;
 
 	async::oneshot_event connectedEvent_;
 
@@ -49,9 +66,13 @@ struct Tcp final : public Controller {
 
 	async::detached run(mbus_ng::EntityId subsystem) override;
 	async::result<Command::Result> submitAdminCommand(std::unique_ptr<Command> cmd) override;
-	async::result<Command::Result> submitIoCommand(std::unique_ptr<Command> cmd) override;
+	async::result<Command::Result> submitIoCommand(std::unique_ptr<Command> cmd,
+			bool polled = false) override;
 
 private:
+	static constexpr unsigned int MAX_IO_QUEUES = 16;
+	static constexpr unsigned int IO_QUEUE_DEPTH = 128;
+
 	async::result<frg::expected<spec::CompletionStatus, uint64_t>> fabricGetProperty(uint32_t propertyOffset, size_t size);
 	async::result<frg::expected<spec::CompletionStatus, uint64_t>> fabricSetProperty(uint32_t propertyOffset, uint64_t value, size_t size);
 
@@ -95,7 +95,8 @@ async::result<protocols::svrctl::Error> bindDevice(int64_t base_id) {
 
 		auto nvme_subsystem = std::make_unique<nvme::Subsystem>();
 		co_await nvme_subsystem->run();
-		auto controller = std::make_unique<PciExpressController>(base_id, std::move(device), loc, std::move(mapping));
+		auto controller = std::make_unique<PciExpressController>(base_id, std::move(device), loc,
+			std::move(bar0), std::move(mapping));
 		controller->run(nvme_subsystem->id());
 		nvme_subsystem->addController(base_id, std::move(controller));
 		globalSubsystems.insert({nvme_subsystem->id(), std::move(nvme_subsystem)});
@@ -1,14 +1,27 @@
+#include <algorithm>
 #include <arch/bit.hpp>
 #include <asm/ioctl.h>
 #include <format>
+#include <iostream>
 #include <linux/nvme_ioctl.h>
 
 #include "namespace.hpp"
 #include "controller.hpp"
 
-Namespace::Namespace(Controller *controller, unsigned int nsid, int lbaShift, size_t lbaCount)
+Namespace::Namespace(Controller *controller, unsigned int nsid, int lbaShift, size_t lbaCount,
+		uint16_t oncs, bool volatileWriteCache)
 	: BlockDevice{(size_t)1 << lbaShift, -1}, controller_(controller), nsid_(nsid),
-	  lbaShift_(lbaShift), lbaCount_{lbaCount} {
+	  lbaShift_(lbaShift), lbaCount_{lbaCount},
+	  supportsWriteZeroes_{static_cast<bool>(oncs & spec::kOncsWriteZeroes)},
+	  volatileWriteCache_{volatileWriteCache} {
+	supportsDiscard = oncs & spec::kOncsDatasetManagement;
+	// The length field of read and write commands is 16 bits wide and zero-based.
+	maxTransferSectors_ = 0x10000;
+	if(controller->maxTransferSize())
+		maxTransferSectors_ = std::clamp(controller->maxTransferSize() >> lbaShift,
+				size_t{1}, maxTransferSectors_);
+	// We split requests at the transfer limit, so let the request queue merge large requests.
+	maxMergeBytes = 4 << 20;
 	diskNamePrefix = "nvme";
 	diskNameSuffix = std::format("n{}", nsid);
 	partNameSuffix = std::format("n{}p", nsid);
@@ -31,35 +44,174 @@ async::detached Namespace::run() {
 }
 
 async::result<void> Namespace::readSectors(uint64_t sector, void *buffer, size_t numSectors) {
+	blockfs::Segment segment{buffer, numSectors};
+	co_await transfer(spec::kRead, sector, {&segment, 1});
+}
+
+async::result<void> Namespace::writeSectors(uint64_t sector, const void *buffer, size_t numSectors) {
+	blockfs::Segment segment{const_cast<void *>(buffer), numSectors};
+	co_await transfer(spec::kWrite, sector, {&segment, 1});
+}
+
+async::result<void> Namespace::readSectorsV(uint64_t sector, std::span<const blockfs::Segment> segments) {
+	co_await transfer(spec::kRead, sector, segments);
+}
+
+async::result<void> Namespace::writeSectorsV(uint64_t sector, std::span<const blockfs::Segment> segments) {
+	co_await transfer(spec::kWrite, sector, segments);
+}
+
+async::result<void> Namespace::readSectorsPolled(uint64_t sector, void *buffer, size_t numSectors) {
+	blockfs::Segment segment{buffer, numSectors};
+	co_await transfer(spec::kRead, sector, {&segment, 1}, true);
+}
+
+async::result<void> Namespace::writeSectorsPolled(uint64_t sector, const void *buffer, size_t numSectors) {
+	blockfs::Segment segment{const_cast<void *>(buffer), numSectors};
+	co_await transfer(spec::kWrite, sector, {&segment, 1}, true);
+}
+
+async::result<void> Namespace::transfer(uint8_t opcode, uint64_t sector,
+		std::span<const blockfs::Segment> segments, bool polled) {
 	using arch::convert_endian;
 	using arch::endian;
 
-	auto cmd = std::make_unique<Command>();
-	auto &cmdBuf = cmd->getCommandBuffer().readWrite;
+	auto policy = controller_->ioDataTransferPolicy();
+
+	struct Chunk {
+		uint64_t sector;
+		size_t numSectors;
+		std::vector<arch::dma_buffer_view> views;
+	};
+
+	// Pack as many segments into each command as the data pointer can describe.
+	std::vector<Chunk> chunks;
+	for(auto &segment : segments) {
+		auto ptr = static_cast<std::byte *>(segment.buffer);
+		auto left = segment.numSectors;
+		while(left) {
+			bool fits = !chunks.empty() && chunks.back().numSectors < maxTransferSectors_;
+			if(fits) {
+				auto &last = chunks.back().views.back();
+				if(policy == spec::DataTransfer::PRP)
+					fits = Command::prpMergeable(last.byte_data() + last.size(), ptr);
+				else if(policy != spec::DataTransfer::HostSGL)
+					fits = false;
+			}
+			if(!fits) {
+				auto next = chunks.empty() ? sector : chunks.back().sector + chunks.back().numSectors;
+				chunks.push_back(Chunk{next, 0, {}});
+			}
+
+			auto &chunk = chunks.back();
+			auto n = std::min(left, maxTransferSectors_ - chunk.numSectors);
+			chunk.views.push_back(arch::dma_buffer_view{nullptr, ptr, n << lbaShift_});
+			chunk.numSectors += n;
+			ptr += n << lbaShift_;
+			left -= n;
+		}
+	}
+
+	for(auto &chunk : chunks) {
+		auto cmd = std::make_unique<Command>();
+		auto &cmdBuf = cmd->getCommandBuffer().readWrite;
 
-	cmdBuf.opcode = spec::kRead;
-	cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
-	cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector);
-	cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)numSectors - 1);
-	cmd->setupBuffer(arch::dma_buffer_view{nullptr, buffer, numSectors << lbaShift_}, controller_->dataTransferPolicy());
+		cmdBuf.opcode = opcode;
+		cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
+		cmdBuf.startLba = convert_endian<endian::little, endian::native>(chunk.sector);
+		cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)(chunk.numSectors - 1));
+		cmd->setupBuffers(chunk.views, policy);
 
-	co_await controller_->submitIoCommand(std::move(cmd));
+		co_await controller_->submitIoCommand(std::move(cmd), polled);
+	}
 }
 
-async::result<void> Namespace::writeSectors(uint64_t sector, const void *buffer, size_t numSectors) {
+async::result<void> Namespace::discard(uint64_t sector, size_t numSectors) {
+	using arch::convert_endian;
+	using arch::endian;
+
+	if(!supportsDiscard)
+		co_return;
+
+	while(numSectors) {
+		arch::dma_array<spec::DsmRange> ranges{nullptr, spec::maxDsmRanges};
+		size_t numRanges = 0;
+		while(numSectors && numRanges < spec::maxDsmRanges) {
+			auto length = std::min(numSectors, size_t{UINT32_MAX});
+			ranges[numRanges].attributes = 0;
+			ranges[numRanges].length = convert_endian<endian::little, endian::native>(
+					static_cast<uint32_t>(length));
+			ranges[numRanges].startLba = convert_endian<endian::little, endian::native>(sector);
+			sector += length;
+			numSectors -= length;
+			numRanges++;
+		}
+
+		auto cmd = std::make_unique<Command>();
+		auto &cmdBuf = cmd->getCommandBuffer().common;
+
+		cmdBuf.opcode = spec::kDatasetManagement;
+		cmdBuf.namespaceId = convert_endian<endian::little, endian::native>(nsid_);
+		cmdBuf.cdw10 = convert_endian<endian::little, endian::native>(
+				static_cast<uint32_t>(numRanges - 1));
+		cmdBuf.cdw11 = convert_endian<endian::little, endian::native>(
+				static_cast<uint32_t>(spec::kDsmDeallocate));
+		cmd->setupBuffer(arch::dma_buffer_view{nullptr, ranges.data(),
+				numRanges * sizeof(spec::DsmRange)}, controller_->dataTransferPolicy());
+
+		// Deallocation is advisory, so failures only cost performance.
+		auto res = co_await controller_->submitIoCommand(std::move(cmd));
+		if(!res.first.successful())
+			std::cout << std::format("block/nvme: Dataset Management failed with status {:#x}",
+					res.first.status) << std::endl;
+	}
+}
+
+async::result<void> Namespace::writeZeroes(uint64_t sector, size_t numSectors) {
+	using arch::convert_endian;
+	using arch::endian;
+
+	if(!supportsWriteZeroes_) {
+		co_await BlockDevice::writeZeroes(sector, numSectors);
+		co_return;
+	}
+
+	while(numSectors) {
+		// The length field is 16 bits wide and zero-based.
+		auto length = std::min(numSectors, size_t{0x10000});
+
+		auto cmd = std::make_unique<Command>();
+		auto &cmdBuf = cmd->getCommandBuffer().readWrite;
+
+		cmdBuf.opcode = spec::kWriteZeroes;
+		cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
+		cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector);
+		cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)(length - 1));
+
+		co_await controller_->submitIoCommand(std::move(cmd));
+		sector += length;
+		numSectors -= length;
+	}
+}
+
+async::result<void> Namespace::flush() {
 	using arch::convert_endian;
 	using arch::endian;
 
+	// Without a volatile write cache, completed writes are already durable.
+	if(!volatileWriteCache_)
+		co_return;
+
 	auto cmd = std::make_unique<Command>();
-	auto &cmdBuf = cmd->getCommandBuffer().readWrite;
+	auto &cmdBuf = cmd->getCommandBuffer().common;
 
-	cmdBuf.opcode = spec::kWrite;
-	cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
-	cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector);
-	cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)numSectors - 1);
-	cmd->setupBuffer(arch::dma_buffer_view{nullptr, (char *)buffer, numSectors << lbaShift_}, controller_->dataTransferPolicy());
+	cmdBuf.opcode = spec::kFlush;
+	cmdBuf.namespaceId = convert_endian<endian::little, endian::native>(nsid_);
 
-	co_await controller_->submitIoCommand(std::move(cmd));
+	auto res = co_await controller_->submitIoCommand(std::move(cmd));
+	if(!res.first.successful())
+		std::cout << std::format("block/nvme: Flush failed with status {:#x}",
+				res.first.status) << std::endl;
 }
 
 async::result<size_t> Namespace::getSize() {
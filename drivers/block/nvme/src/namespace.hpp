@@ -8,20 +8,35 @@
 struct Controller;
 
 struct Namespace : blockfs::BlockDevice {
-	Namespace(Controller *controller, unsigned int nsid, int lbaShift, size_t lbaCount);
+	Namespace(Controller *controller, unsigned int nsid, int lbaShift, size_t lbaCount,
+			uint16_t oncs, bool volatileWriteCache);
 
 	async::detached run();
 
 	async::result<void> readSectors(uint64_t sector, void *buf, size_t numSectors) override;
 	async::result<void> writeSectors(uint64_t sector, const void *buf, size_t numSectors) override;
+	async::result<void> readSectorsV(uint64_t sector, std::span<const blockfs::Segment> segments) override;
+	async::result<void> writeSectorsV(uint64_t sector, std::span<const blockfs::Segment> segments) override;
+	async::result<void> readSectorsPolled(uint64_t sector, void *buf, size_t numSectors) override;
+	async::result<void> writeSectorsPolled(uint64_t sector, const void *buf, size_t numSectors) override;
+	async::result<void> discard(uint64_t sector, size_t numSectors) override;
+	async::result<void> writeZeroes(uint64_t sector, size_t numSectors) override;
+	async::result<void> flush() override;
 	async::result<size_t> getSize() override;
 
 	async::result<void> handleIoctl(managarm::fs::GenericIoctlRequest &req, helix::UniqueDescriptor conversation) override;
 
 private:
+	// Splits the transfer into commands of at most maxTransferSectors_ each.
+	async::result<void> transfer(uint8_t opcode, uint64_t sector,
+			std::span<const blockfs::Segment> segments, bool polled = false);
+
 	Controller *controller_;
 	unsigned int nsid_;
 	int lbaShift_;
 	size_t lbaCount_;
+	size_t maxTransferSectors_;
+	bool supportsWriteZeroes_;
+	bool volatileWriteCache_;
 	std::unique_ptr<mbus_ng::EntityManager> mbusEntity_;
 };
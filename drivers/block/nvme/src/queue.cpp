@@ -1,12 +1,16 @@
+#include <algorithm>
 #include <arch/bit.hpp>
 #include <helix/ipc.hpp>
 #include <helix/memory.hpp>
+#include <helix/timer.hpp>
 
 #include "queue.hpp"
 #include "spec.hpp"
 
-PciExpressQueue::PciExpressQueue(unsigned int qid, unsigned int depth, arch::mem_space doorbells, size_t interruptVector)
-	: Queue(qid, depth), doorbells_(doorbells), sqTail_(0), cqHead_(0), cqPhase_(1), interruptVector_{interruptVector} {
+PciExpressQueue::PciExpressQueue(unsigned int qid, unsigned int depth, arch::mem_space doorbells,
+		size_t interruptVector, bool polled)
+	: Queue(qid, depth), doorbells_(doorbells), sqTail_(0), cqHead_(0), cqPhase_(1),
+		interruptVector_{interruptVector}, polled_{polled} {
 
 }
 
@@ -40,10 +44,25 @@ async::result<void> PciExpressQueue::init() {
 
 async::detached PciExpressQueue::run() {
 	submitPendingLoop();
+	if (polled_)
+		pollLoop();
 
 	co_return;
 }
 
+async::detached PciExpressQueue::pollLoop() {
+	while (true) {
+		if (!commandsInFlight_) {
+			co_await pollDoorbell_.async_wait();
+			continue;
+		}
+
+		handleIrq();
+		if (commandsInFlight_)
+			co_await helix::sleepFor(pollIntervalNs);
+	}
+}
+
 int PciExpressQueue::handleIrq() {
 	using arch::convert_endian;
 	using arch::endian;
@@ -118,7 +137,43 @@ async::result<void> PciExpressQueue::submitCommandToDevice(std::unique_ptr<Comma
 	commandsInFlight_++;
 }
 
+async::result<Command::Result> PciExpressQueue::submitPolledCommand(std::unique_ptr<Command> cmd) {
+	auto future = cmd->getFuture();
+
+	uint64_t start;
+	HEL_CHECK(helGetClock(&start));
+
+	// Submit right away; handing the command to submitPendingLoop() costs a wakeup.
+	co_await submitCommandToDevice(std::move(cmd));
+	pollDoorbell_.raise();
+
+	// Spin on the phase bit of the CQ. This blocks the dispatcher, hence the window is short;
+	// if it passes without a completion, pollLoop() eventually reaps the command.
+	uint64_t window = 0;
+	if (avgLatencyNs_ <= maxSpinNs)
+		window = std::clamp(avgLatencyNs_ + avgLatencyNs_ / 2, minSpinNs, maxSpinNs);
+	while (true) {
+		if (handleIrq())
+			break;
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		if (now - start >= window)
+			break;
+	}
+
+	auto result = *(co_await future.get());
+
+	uint64_t end;
+	HEL_CHECK(helGetClock(&end));
+	avgLatencyNs_ = (7 * avgLatencyNs_ + (end - start)) / 8;
+
+	co_return result;
+}
+
 async::result<Command::Result> PciExpressQueue::submitCommand(std::unique_ptr<Command> cmd) {
+	if (polled_)
+		co_return co_await submitPolledCommand(std::move(cmd));
+
 	auto future = cmd->getFuture();
 
 	pendingCmdQueue_.put(std::move(cmd));
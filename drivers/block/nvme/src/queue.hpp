@@ -42,7 +42,9 @@ protected:
 };
 
 struct PciExpressQueue final : Queue {
-	PciExpressQueue(unsigned int index, unsigned int depth, arch::mem_space doorbells, size_t interruptVector = 0);
+	// Polled queues have no interrupt vector; their completions are reaped by polling the CQ.
+	PciExpressQueue(unsigned int index, unsigned int depth, arch::mem_space doorbells,
+			size_t interruptVector = 0, bool polled = false);
 
 	async::result<void> init() override;
 	async::detached run() override;
@@ -58,6 +60,11 @@ struct PciExpressQueue final : Queue {
 		return interruptVector_;
 	}
 
+	bool polled() const {
+		return polled_;
+	}
+
+	// Reaps all completions that are posted to the CQ; returns their number.
 	int handleIrq();
 
 private:
@@ -70,9 +77,24 @@ private:
 	uint16_t cqHead_;
 	uint8_t cqPhase_;
 	size_t interruptVector_;
+	bool polled_;
+
+	// Commands on polled queues spin on the CQ for a window that adapts to the average
+	// completion latency. Devices that are slower than maxSpinNs are not spun on at all.
+	static constexpr uint64_t minSpinNs = 2'000;
+	static constexpr uint64_t maxSpinNs = 50'000;
+	// Interval at which pollLoop() checks the CQ while commands are in flight.
+	static constexpr uint64_t pollIntervalNs = 20'000;
+
+	// Moving average of the completion latency of polled commands, in nanoseconds.
+	uint64_t avgLatencyNs_ = minSpinNs;
+	async::recurring_event pollDoorbell_;
 
 	async::detached submitPendingLoop();
+	// Reaps completions that were not seen while spinning.
+	async::detached pollLoop();
 
 	async::result<Command::Result> submitCommand(std::unique_ptr<Command> cmd) override;
+	async::result<Command::Result> submitPolledCommand(std::unique_ptr<Command> cmd);
 	async::result<void> submitCommandToDevice(std::unique_ptr<Command> cmd);
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <compare>
+#include <stddef.h>
 #include <stdint.h>
 #include <type_traits>
 
@@ -8,14 +9,39 @@ namespace spec {
 
 enum class DataTransfer {
 	PRP,
+	// Transport SGL descriptors, as used by NVMe over Fabrics.
 	SGL,
+	// SGL data block descriptors that point to host memory (PCIe only).
+	HostSGL,
 };
 
 enum CommandOpcode {
+	kFlush = 0x00,
 	kWrite = 0x01,
 	kRead = 0x02,
+	kWriteZeroes = 0x08,
+	kDatasetManagement = 0x09,
 };
 
+// Optional NVM Command Support (ONCS) field of IdentifyController.
+enum OncsFlags {
+	kOncsDatasetManagement = 1 << 2,
+	kOncsWriteZeroes = 1 << 3,
+};
+
+// Volatile Write Cache (VWC) field of IdentifyController.
+enum VwcFlags {
+	kVwcPresent = 1 << 0,
+};
+
+// Attributes of Dataset Management commands (in CDW11).
+enum DsmAttributes {
+	kDsmDeallocate = 1 << 2,
+};
+
+// A Dataset Management command takes up to this many ranges.
+constexpr size_t maxDsmRanges = 256;
+
 enum class AdminOpcode {
 	DeleteSQ = 0x0,
 	CreateSQ = 0x1,
@@ -61,6 +87,18 @@ struct SglDataBlock {
 	uint8_t sglDescriptorType: 4;
 };
 
+enum SglDescriptorType {
+	kSglDataBlock = 0x0,
+	kSglSegment = 0x2,
+	kSglLastSegment = 0x3,
+};
+
+// Bits 1:0 of IdentifyController::sgls.
+enum SglSupport {
+	kSglSupported = 0x1,
+	kSglSupportedDwordAligned = 0x2,
+};
+
 union Sgl {
 	SglGeneric generic;
 	SglDataBlock dataBlock;
@@ -220,6 +258,13 @@ struct IdentifyNamespace {
 };
 static_assert(sizeof(IdentifyNamespace) == 0x1000);
 
+struct DsmRange {
+	uint32_t attributes;
+	uint32_t length;
+	uint64_t startLba;
+};
+static_assert(sizeof(DsmRange) == 16);
+
 union DataPointer {
 	struct {
 		uint64_t prp1;
@@ -487,6 +532,31 @@ struct C2HData {
 	uint8_t __reserved2[4];
 };
 
+struct H2CData {
+	PduCommonHeader ch;
+	uint16_t commandCapsuleId;
+	uint16_t transferTag;
+	uint32_t dataOffset;
+	uint32_t dataLength;
+	uint8_t __reserved1[4];
+};
+
+struct R2T {
+	PduCommonHeader ch;
+	uint16_t commandCapsuleId;
+	uint16_t transferTag;
+	uint32_t r2tOffset;
+	uint32_t r2tLength;
+	uint8_t __reserved1[4];
+};
+
+// Flags of H2CData and C2HData PDUs.
+constexpr uint8_t kPduFlagLast = 1 << 2;
+constexpr uint8_t kPduFlagSuccess = 1 << 3;
+
+// Data of the admin queue that every controller accepts in-capsule.
+constexpr size_t adminInCapsuleSize = 8192;
+
 } // namespace tcp
 
 } // namespace spec
@@ -1,6 +1,8 @@
 
 #include <stdlib.h>
+#include <algorithm>
 #include <iostream>
+#include <thread>
 
 #include "block.hpp"
 
@@ -13,81 +15,236 @@ static bool logInitiateRetire = false;
 // UserRequest
 // --------------------------------------------------------
 
-UserRequest::UserRequest(bool write_, uint64_t sector_, void *buffer_, size_t num_sectors_)
-: write{write_}, sector{sector_}, buffer{buffer_}, numSectors{num_sectors_} { }
+UserRequest::UserRequest(uint32_t type_, uint64_t sector_,
+		std::vector<arch::dma_buffer_view> segments_, size_t num_sectors_)
+: type{type_}, sector{sector_}, segments{std::move(segments_)}, numSectors{num_sectors_},
+		header{}, range{}, status{0} { }
 
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
 
 Device::Device(std::unique_ptr<virtio_core::Transport> transport, int64_t parent_id)
-: blockfs::BlockDevice{512, parent_id}, _transport{std::move(transport)},
-		_requestQueue{nullptr}, _size{0} { }
+: blockfs::BlockDevice{512, parent_id}, _transport{std::move(transport)}, _size{0} { }
 
 void Device::runDevice() {
+	bool useMq = false;
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_MQ)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_MQ);
+		useMq = true;
+	}
+	if(_transport->checkDeviceFeature(virtio_core::VIRTIO_RING_F_INDIRECT_DESC)) {
+		_transport->acknowledgeDriverFeature(virtio_core::VIRTIO_RING_F_INDIRECT_DESC);
+		_useIndirect = true;
+	}
+	bool hasSizeMax = false;
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_SIZE_MAX)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_SIZE_MAX);
+		hasSizeMax = true;
+	}
+	bool hasSegMax = false;
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_SEG_MAX)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_SEG_MAX);
+		hasSegMax = true;
+	}
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_FLUSH)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_FLUSH);
+		_supportsFlush = true;
+	}
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_DISCARD)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_DISCARD);
+		supportsDiscard = true;
+	}
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_WRITE_ZEROES)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_WRITE_ZEROES);
+		_supportsWriteZeroes = true;
+	}
 	_transport->finalizeFeatures();
-	_transport->claimQueues(1);
-	_requestQueue = _transport->setupQueue(0);
+
+	// Use one virtq per CPU, but not more than the device offers.
+	size_t numQueues = 1;
+	if(useMq) {
+		size_t deviceQueues = std::max(uint16_t{1},
+				_transport->space().load(spec::regs::numQueues));
+		numQueues = std::min(deviceQueues,
+				size_t{std::max(std::thread::hardware_concurrency(), 1u)});
+	}
+	_transport->claimQueues(numQueues);
+	for(size_t i = 0; i < numQueues; i++) {
+		auto queue = std::make_unique<RequestQueue>();
+		queue->virtq = _transport->setupQueue(i);
+		_queues.push_back(std::move(queue));
+	}
+	std::cout << "virtio: Using " << numQueues << " request queue(s)"
+			<< (_useIndirect ? " with indirect descriptors" : "") << std::endl;
 
 	auto size = static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[0]))
 			| (static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[1])) << 32);
 	std::cout << "virtio: Disk size: " << size << " sectors" << std::endl;
 	_size = size;
 
-	_transport->runDevice();
-
-	// perform device specific setup
-	virtRequestBuffer = new VirtRequest[_requestQueue->numDescriptors()];
-	statusBuffer = new uint8_t[_requestQueue->numDescriptors()];
+	// Without indirect descriptors, a request occupies one virtq descriptor per segment.
+	// Limit requests to ensure that we don't monopolize the device.
+	// The header, the status byte and (for discard requests) the range need their own descriptors.
+	if(_useIndirect) {
+		_maxSegments = virtio_core::IndirectTable::maxDescriptors - 3;
+	}else{
+		_maxSegments = _queues.front()->virtq->numDescriptors() / 4;
+	}
+	if(hasSegMax)
+		_maxSegments = std::min(_maxSegments,
+				size_t{std::max(uint32_t{1}, _transport->space().load(spec::regs::segMax))});
+	assert(_maxSegments >= 1);
+
+	// Segments never cross page boundaries since we cannot know whether pages are
+	// physically contiguous. However, the device might not even accept whole pages.
+	if(hasSizeMax)
+		_maxSegmentSize = std::clamp(size_t{_transport->space().load(spec::regs::sizeMax)},
+				size_t{512}, size_t{0x1000}) & ~size_t{511};
+
+	if(supportsDiscard)
+		_maxDiscardSectors = std::max(uint32_t{1},
+				_transport->space().load(spec::regs::maxDiscardSectors));
+	if(_supportsWriteZeroes)
+		_maxWriteZeroesSectors = std::max(uint32_t{1},
+				_transport->space().load(spec::regs::maxWriteZeroesSectors));
+
+	maxQueueDepth = 0;
+	for(auto &queue : _queues) {
+		auto depth = queue->virtq->numDescriptors();
+		if(!_useIndirect)
+			depth /= 3;
+		maxQueueDepth += std::max(depth, size_t{1});
+	}
+	maxMergeBytes = std::max(maxMergeBytes, _maxSegments * _maxSegmentSize);
 
-	// natural alignment makes sure that request headers do not cross page boundaries
-	assert((uintptr_t)virtRequestBuffer % sizeof(VirtRequest) == 0);
+	_transport->runDevice();
 
-	// setup an interrupt for the device
-	_processRequests();
+	for(auto &queue : _queues)
+		_processRequests(queue.get());
 
 	blockfs::runDevice(this);
 }
 
 async::result<void> Device::readSectors(uint64_t sector,
 		void *buffer, size_t num_sectors) {
-	// Natural alignment makes sure a sector does not cross a page boundary.
-	assert(!((uintptr_t)buffer % 512));
-//	printf("readSectors(%lu, %lu)\n", sector, num_sectors);
-
-	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
-	assert(max_sectors >= 1);
-
-	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(false, sector + progress,
-				(char *)buffer + 512 * progress,
-				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.raise();
-		co_await request->event.wait();
-		delete request;
-	}
+	blockfs::Segment segment{buffer, num_sectors};
+	co_await _transfer(false, sector, {&segment, 1});
 }
 
 async::result<void> Device::writeSectors(uint64_t sector,
 		const void *buffer, size_t num_sectors) {
-	// Natural alignment makes sure a sector does not cross a page boundary.
-	assert(!((uintptr_t)buffer % 512));
-//	printf("writeSectors(%lu, %lu)\n", sector, num_sectors);
-
-	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
-	assert(max_sectors >= 1);
-
-	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(true, sector + progress,
-				(char *)buffer + 512 * progress,
-				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.raise();
+	blockfs::Segment segment{const_cast<void *>(buffer), num_sectors};
+	co_await _transfer(true, sector, {&segment, 1});
+}
+
+async::result<void> Device::readSectorsV(uint64_t sector,
+		std::span<const blockfs::Segment> segments) {
+	co_await _transfer(false, sector, segments);
+}
+
+async::result<void> Device::writeSectorsV(uint64_t sector,
+		std::span<const blockfs::Segment> segments) {
+	co_await _transfer(true, sector, segments);
+}
+
+Device::RequestQueue *Device::_currentQueue() {
+	// Requests complete on the queue they were submitted to; keep them on the current CPU.
+	int cpu;
+	HEL_CHECK(helGetCurrentCpu(&cpu));
+	return _queues[static_cast<size_t>(cpu) % _queues.size()].get();
+}
+
+async::result<void> Device::_submit(UserRequest *request) {
+	auto queue = _currentQueue();
+	queue->pending.push(request);
+	queue->doorbell.raise();
+	co_await request->event.wait();
+}
+
+async::result<void> Device::_transfer(bool write, uint64_t sector,
+		std::span<const blockfs::Segment> segments) {
+//	printf("transfer(%d, %lu, %zu segments)\n", write, sector, segments.size());
+
+	std::vector<std::unique_ptr<UserRequest>> requests;
+	std::vector<arch::dma_buffer_view> pieces;
+	size_t num_sectors = 0;
+
+	// Submit all requests first so that the device can work on them concurrently.
+	auto submit = [&] {
+		auto request = std::make_unique<UserRequest>(write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN,
+				sector, std::move(pieces), num_sectors);
+		auto queue = _currentQueue();
+		queue->pending.push(request.get());
+		queue->doorbell.raise();
+		requests.push_back(std::move(request));
+
+		sector += num_sectors;
+		pieces.clear();
+		num_sectors = 0;
+	};
+
+	for(auto &segment : segments) {
+		// Natural alignment makes sure a sector does not cross a page boundary.
+		assert(!((uintptr_t)segment.buffer % 512));
+
+		auto address = reinterpret_cast<uintptr_t>(segment.buffer);
+		auto end = address + 512 * segment.numSectors;
+		while(address < end) {
+			if(pieces.size() == _maxSegments)
+				submit();
+
+			auto chunk = std::min({end - address, 0x1000 - (address & 0xFFF), _maxSegmentSize});
+			pieces.push_back(arch::dma_buffer_view{nullptr,
+					reinterpret_cast<void *>(address), chunk});
+			num_sectors += chunk / 512;
+			address += chunk;
+		}
+	}
+	if(num_sectors)
+		submit();
+
+	for(auto &request : requests)
 		co_await request->event.wait();
-		delete request;
+}
+
+async::result<void> Device::discard(uint64_t sector, size_t num_sectors) {
+	if(!supportsDiscard)
+		co_return;
+	co_await _transferRange(VIRTIO_BLK_T_DISCARD, sector, num_sectors, _maxDiscardSectors);
+}
+
+async::result<void> Device::writeZeroes(uint64_t sector, size_t num_sectors) {
+	if(!_supportsWriteZeroes) {
+		co_await BlockDevice::writeZeroes(sector, num_sectors);
+		co_return;
+	}
+	co_await _transferRange(VIRTIO_BLK_T_WRITE_ZEROES, sector, num_sectors,
+			_maxWriteZeroesSectors);
+}
+
+async::result<void> Device::flush() {
+	// Without VIRTIO_BLK_F_FLUSH, the device does not cache writes.
+	if(!_supportsFlush)
+		co_return;
+
+	UserRequest request{VIRTIO_BLK_T_FLUSH, 0, {}, 0};
+	co_await _submit(&request);
+}
+
+async::result<void> Device::_transferRange(uint32_t type, uint64_t sector,
+		size_t num_sectors, size_t max_sectors) {
+	while(num_sectors) {
+		auto n = std::min(num_sectors, max_sectors);
+
+		UserRequest request{type, sector, {}, n};
+		request.range.sector = sector;
+		request.range.numSectors = n;
+		request.range.flags = 0;
+		co_await _submit(&request);
+
+		sector += n;
+		num_sectors -= n;
 	}
 }
 
@@ -95,64 +252,94 @@ async::result<size_t> Device::getSize() {
 	co_return _size * 512;
 }
 
-async::detached Device::_processRequests() {
+async::detached Device::_processRequests(RequestQueue *queue) {
+	auto virtq = queue->virtq;
 	while(true) {
-		if(_pendingQueue.empty()) {
-			co_await _pendingDoorbell.async_wait();
+		if(queue->pending.empty()) {
+			co_await queue->doorbell.async_wait();
 			continue;
 		}
 
-		auto request = _pendingQueue.front();
-		_pendingQueue.pop();
-		assert(request->numSectors);
+		auto request = queue->pending.front();
+		queue->pending.pop();
+		assert(request->numSectors || request->type == VIRTIO_BLK_T_FLUSH);
 
-		// Setup the descriptor for the request header.
-		virtio_core::Chain chain;
-		chain.append(co_await _requestQueue->obtainDescriptor());
+		request->header.type = request->type;
+		request->header.reserved = 0;
+		request->header.sector = request->sector;
 
-		VirtRequest *header = &virtRequestBuffer[chain.front().tableIndex()];
-		if(request->write) {
-			header->type = VIRTIO_BLK_T_OUT;
-		}else{
-			header->type = VIRTIO_BLK_T_IN;
-		}
-		header->reserved = 0;
-		header->sector = request->sector;
+		bool hasRange = request->type == VIRTIO_BLK_T_DISCARD
+				|| request->type == VIRTIO_BLK_T_WRITE_ZEROES;
 
-		chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-				header, sizeof(VirtRequest)});
+		virtio_core::Chain chain;
+		if(_useIndirect) {
+			// The whole request fits into a single virtq descriptor.
+			auto table = std::make_unique<virtio_core::IndirectTable>();
+			table->append(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
+					&request->header, sizeof(VirtRequest)});
+			if(hasRange)
+				table->append(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
+						&request->range, sizeof(VirtDiscardWriteZeroes)});
+			for(auto &segment : request->segments) {
+				if(request->type == VIRTIO_BLK_T_OUT) {
+					table->append(virtio_core::hostToDevice, segment);
+				}else{
+					table->append(virtio_core::deviceToHost, segment);
+				}
+			}
+			table->append(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
+					&request->status, 1});
 
-		// Setup descriptors for the transfered data.
-		for(size_t i = 0; i < request->numSectors; i++) {
-			chain.append(co_await _requestQueue->obtainDescriptor());
-			if(request->write) {
+			chain.append(co_await virtq->obtainDescriptor());
+			chain.front().setupIndirect(*table);
+			request->indirect = std::move(table);
+		}else{
+			// Setup the descriptor for the request header.
+			chain.append(co_await virtq->obtainDescriptor());
+			chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
+					&request->header, sizeof(VirtRequest)});
+
+			// Discard and write-zeroes requests only carry the range.
+			if(hasRange) {
+				chain.append(co_await virtq->obtainDescriptor());
 				chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
-			}else{
-				chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
+						&request->range, sizeof(VirtDiscardWriteZeroes)});
+			}
+
+			// Setup descriptors for the transfered data.
+			for(auto &segment : request->segments) {
+				chain.append(co_await virtq->obtainDescriptor());
+				if(request->type == VIRTIO_BLK_T_OUT) {
+					chain.setupBuffer(virtio_core::hostToDevice, segment);
+				}else{
+					chain.setupBuffer(virtio_core::deviceToHost, segment);
+				}
 			}
+
+			// Setup a descriptor for the status byte.
+			chain.append(co_await virtq->obtainDescriptor());
+			chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
+					&request->status, 1});
 		}
 
 		if(logInitiateRetire)
-			std::cout << "Submitting " << request->numSectors
+			std::cout << "Submitting " << request->segments.size()
 					<< " data descriptors" << std::endl;
 
-		// Setup a descriptor for the status byte.
-		chain.append(co_await _requestQueue->obtainDescriptor());
-		chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-				&statusBuffer[chain.front().tableIndex()], 1});
-
 		// Submit the request to the device
-		_requestQueue->postDescriptor(chain.front(), request,
+		virtq->postDescriptor(chain.front(), request,
 				[] (virtio_core::Request *base_request) {
 			auto request = static_cast<UserRequest *>(base_request);
 			if(logInitiateRetire)
-				std::cout << "Retiring " << request->numSectors
+				std::cout << "Retiring " << request->segments.size()
 						<< " data descriptors" << std::endl;
+			request->indirect.reset();
 			request->event.raise();
 		});
-		_requestQueue->notify();
+
+		// Kick the device once for all requests that are currently queued.
+		if(queue->pending.empty())
+			virtq->notify();
 	}
 }
 
@@ -1,6 +1,7 @@
 
 #include <memory>
 #include <queue>
+#include <vector>
 
 #include <blockfs.hpp>
 #include <core/virtio/core.hpp>
@@ -20,15 +21,40 @@ struct VirtRequest {
 };
 static_assert(sizeof(VirtRequest) == 16, "Bad sizeof(VirtRequest)");
 
+// Payload of discard and write-zeroes requests.
+struct VirtDiscardWriteZeroes {
+	uint64_t sector;
+	uint32_t numSectors;
+	uint32_t flags;
+};
+static_assert(sizeof(VirtDiscardWriteZeroes) == 16, "Bad sizeof(VirtDiscardWriteZeroes)");
+
 enum {
 	VIRTIO_BLK_T_IN = 0,
-	VIRTIO_BLK_T_OUT = 1
+	VIRTIO_BLK_T_OUT = 1,
+	VIRTIO_BLK_T_FLUSH = 4,
+	VIRTIO_BLK_T_DISCARD = 11,
+	VIRTIO_BLK_T_WRITE_ZEROES = 13
+};
+
+enum {
+	VIRTIO_BLK_F_SIZE_MAX = 1,
+	VIRTIO_BLK_F_SEG_MAX = 2,
+	VIRTIO_BLK_F_FLUSH = 9,
+	VIRTIO_BLK_F_MQ = 12,
+	VIRTIO_BLK_F_DISCARD = 13,
+	VIRTIO_BLK_F_WRITE_ZEROES = 14
 };
 
 namespace spec::regs {
 	inline constexpr arch::scalar_register<uint32_t> capacity[] = {
 			arch::scalar_register<uint32_t>{0},
 			arch::scalar_register<uint32_t>{4}};
+	inline constexpr arch::scalar_register<uint32_t> sizeMax{8};
+	inline constexpr arch::scalar_register<uint32_t> segMax{12};
+	inline constexpr arch::scalar_register<uint16_t> numQueues{34};
+	inline constexpr arch::scalar_register<uint32_t> maxDiscardSectors{36};
+	inline constexpr arch::scalar_register<uint32_t> maxWriteZeroesSectors{48};
 }
 
 struct Device;
@@ -38,13 +64,25 @@ struct Device;
 // --------------------------------------------------------
 
 struct UserRequest : virtio_core::Request {
-	UserRequest(bool write, uint64_t sector, void *buffer, size_t num_sectors);
+	UserRequest(uint32_t type, uint64_t sector, std::vector<arch::dma_buffer_view> segments,
+			size_t num_sectors);
 
-	bool write;
+	// One of the VIRTIO_BLK_T_* constants.
+	uint32_t type;
 	uint64_t sector;
-	void *buffer;
+	// Physically contiguous parts of the data buffer, one descriptor each.
+	// Empty for flush, discard and write-zeroes requests.
+	std::vector<arch::dma_buffer_view> segments;
 	size_t numSectors;
 
+	// Natural alignment makes sure that these do not cross a page boundary.
+	alignas(16) VirtRequest header;
+	alignas(16) VirtDiscardWriteZeroes range;
+	uint8_t status;
+
+	// Holds the descriptors of the request if indirect descriptors are used.
+	std::unique_ptr<virtio_core::IndirectTable> indirect;
+
 	async::oneshot_event event;
 };
 
@@ -63,28 +101,65 @@ struct Device : blockfs::BlockDevice {
 	async::result<void> writeSectors(uint64_t sector,
 			const void *buffer, size_t num_sectors) override;
 
+	async::result<void> readSectorsV(uint64_t sector,
+			std::span<const blockfs::Segment> segments) override;
+
+	async::result<void> writeSectorsV(uint64_t sector,
+			std::span<const blockfs::Segment> segments) override;
+
+	async::result<void> discard(uint64_t sector, size_t num_sectors) override;
+
+	async::result<void> writeZeroes(uint64_t sector, size_t num_sectors) override;
+
+	async::result<void> flush() override;
+
 	async::result<size_t> getSize() override;
 
 private:
-	// Submits requests from _pendingQueue to the device.
-	async::detached _processRequests();
+	// A virtq together with the requests that wait for its descriptors.
+	struct RequestQueue {
+		virtio_core::Queue *virtq;
 
-	std::unique_ptr<virtio_core::Transport> _transport;
+		// Stores UserRequest objects that have not been submitted yet.
+		std::queue<UserRequest *> pending;
+		async::recurring_event doorbell;
+	};
+
+	// Returns the queue of the current CPU.
+	RequestQueue *_currentQueue();
+
+	// Submits the request and waits for its completion.
+	async::result<void> _submit(UserRequest *request);
 
-	// The single virtq of this device.
-	virtio_core::Queue *_requestQueue;
+	// Splits the transfer into UserRequests, submits them and waits for all of them.
+	async::result<void> _transfer(bool write, uint64_t sector,
+			std::span<const blockfs::Segment> segments);
 
-	// Stores UserRequest objects that have not been submitted yet.
-	std::queue<UserRequest *> _pendingQueue;
-	async::recurring_event _pendingDoorbell;
+	// Same as _transfer() but for discard and write-zeroes requests.
+	async::result<void> _transferRange(uint32_t type, uint64_t sector,
+			size_t num_sectors, size_t max_sectors);
 
-	// these two buffer store virtio-block request header and status bytes
-	// they are indexed by the index of the request's first descriptor
-	VirtRequest *virtRequestBuffer;
-	uint8_t *statusBuffer;
+	// Submits requests from the pending queue to the device.
+	async::detached _processRequests(RequestQueue *queue);
+
+	std::unique_ptr<virtio_core::Transport> _transport;
+
+	// One virtq per CPU if VIRTIO_BLK_F_MQ is supported.
+	std::vector<std::unique_ptr<RequestQueue>> _queues;
 
 	// The size of the disk
 	size_t _size;
+
+	bool _useIndirect = false;
+	// Maximal number of data descriptors per request.
+	size_t _maxSegments = 0;
+	// Maximal size of a single data descriptor.
+	size_t _maxSegmentSize = 0x1000;
+
+	bool _supportsFlush = false;
+	bool _supportsWriteZeroes = false;
+	size_t _maxDiscardSectors = 0;
+	size_t _maxWriteZeroesSectors = 0;
 };
 
 } } // namespace block::virtio
@@ -69,7 +69,9 @@ async::detached observeDevices() {
 int main() {
 	printf("Starting virtio-block driver\n");
 
-//	HEL_CHECK(helSetPriority(kHelThisThread, 3));
+	// Complete requests promptly even if batch work saturates the CPU;
+	// the budget (2 ms per 10 ms) keeps us from starving other threads.
+	HEL_CHECK(helSetLatencyClass(kHelThisThread, 0, 2'000'000, 10'000'000));
 
 	observeDevices();
 	async::run_forever(helix::currentDispatcher);
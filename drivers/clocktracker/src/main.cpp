@@ -7,6 +7,7 @@
 #include <protocols/mbus/client.hpp>
 #include <bragi/helpers-std.hpp>
 #include <clock.bragi.hpp>
+#include <kerncfg.bragi.hpp>
 
 // ----------------------------------------------------------------------------
 // RTC handling.
@@ -52,6 +53,43 @@ async::result<RtcTime> getRtcTime() {
 	co_return RtcTime{resp.ref_nanos(), resp.rtc_nanos()};
 }
 
+// ----------------------------------------------------------------------------
+// Kernel clock page handling.
+// ----------------------------------------------------------------------------
+
+// Publishes the realtime clock in the kernel's clock page.
+async::result<void> setKernelRealtime(RtcTime time) {
+	auto filter = mbus_ng::Conjunction{{
+		mbus_ng::EqualsFilter{"class", "kerncfg"}
+	}};
+
+	auto enumerator = mbus_ng::Instance::global().enumerate(filter);
+	auto [_, events] = (co_await enumerator.nextEvents()).unwrap();
+	assert(events.size() == 1);
+
+	auto entity = co_await mbus_ng::Instance::global().getEntity(events[0].id);
+	auto lane = (co_await entity.getRemoteLane()).unwrap();
+
+	managarm::kerncfg::SetRealtimeRequest req;
+	req.set_ref_nanos(std::get<0>(time));
+	req.set_realtime_nanos(std::get<1>(time));
+
+	auto [offer, sendReq, recvResp] = co_await helix_ng::exchangeMsgs(
+		lane,
+		helix_ng::offer(
+			helix_ng::want_lane,
+			helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+			helix_ng::recvInline())
+	);
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(recvResp.error());
+
+	auto resp = *bragi::parse_head_only<managarm::kerncfg::SvrResponse>(recvResp);
+	recvResp.reset();
+	assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+}
+
 // ----------------------------------------------------------------------------
 // Tracker page handling.
 // ----------------------------------------------------------------------------
@@ -151,6 +189,7 @@ async::detached initializeDriver() {
 			<< std::get<1>(result) << std::endl;
 	accessPage()->refClock = std::get<0>(result);
 	accessPage()->baseRealtime = std::get<1>(result);
+	co_await setKernelRealtime(result);
 
 	// Create an mbus object for the device.
 	mbus_ng::Properties descriptor{
@@ -78,7 +78,7 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 
 		GfxDevice::BufferObject *getBufferObject();
 		uint32_t getPixelPitch();
-		void notifyDirty() override;
+		void notifyDirty(std::vector<drm_mode_rect> damage) override;
 		uint32_t getWidth() override;
 		uint32_t getHeight() override;
 		uint32_t getModifier() override {
@@ -362,8 +362,8 @@ uint32_t GfxDevice::FrameBuffer::getHeight() {
 	return _bo->getHeight();
 }
 
-void GfxDevice::FrameBuffer::notifyDirty() {
-
+void GfxDevice::FrameBuffer::notifyDirty(std::vector<drm_mode_rect>) {
+	// The device scans out of the framebuffer in VRAM directly.
 }
 
 // ----------------------------------------------------------------
@@ -386,8 +386,9 @@ GfxDevice::BufferObject::BufferObject(GfxDevice *device, size_t alignment, size_
 	assert(!((_offset + _displacement) % _alignment));
 
 	HelHandle handle;
+	// BOs are scanned out directly from VRAM, so clients should map them write-combining.
 	HEL_CHECK(helCreateSliceView(_device->_videoRam.getHandle(),
-			_offset + _displacement, _size, 0, &handle));
+			_offset + _displacement, _size, kHelSliceCacheWriteCombine, &handle));
 	_memoryView = helix::UniqueDescriptor{handle};
 };
 
@@ -1,6 +1,8 @@
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
+#include <atomic>
 #include <iostream>
 #include <memory>
 
@@ -172,6 +174,12 @@ int computeSdvoMultiplier(int pixel_clock) {
 }
 
 struct Controller {
+	// Size of the ring buffer that we submit blitter commands to.
+	static constexpr size_t ringSize = 0x4000;
+
+	// The cursor plane scans out a 64x64 ARGB image.
+	static constexpr unsigned int cursorSize = 64;
+
 	Controller(arch::mem_space ctrl, void *memory)
 	: _ctrl{ctrl}, _memory{memory} { }
 
@@ -209,6 +217,25 @@ private:
 
 	void disablePlane();
 	void enablePlane(Framebuffer *fb);
+
+	void enableCursor(uintptr_t address);
+	void moveCursor(int x, int y);
+	void disableCursor();
+
+	// ------------------------------------------------------------------------
+	// Blitter functions.
+	// ------------------------------------------------------------------------
+
+	void setupRing();
+	void emitCommands(const uint32_t *dwords, size_t count);
+	// Busy waits until the GPU has executed all submitted commands.
+	void waitForRing();
+	size_t _ringSpace();
+
+	void blitFill(Framebuffer *fb, unsigned int x, unsigned int y,
+			unsigned int width, unsigned int height, uint32_t color);
+	void blitCopy(Framebuffer *dest, Framebuffer *source, unsigned int x, unsigned int y,
+			unsigned int width, unsigned int height);
 	
 	// ------------------------------------------------------------------------
 	// Port handling functions.
@@ -223,9 +250,21 @@ private:
 
 	void relinquishVga();
 
+	// Returns the graphics address of a page-aligned chunk of graphics memory.
+	// This assumes that the firmware maps the aperture linearly, just like for the framebuffer.
+	uintptr_t allocateGraphicsMemory(size_t size);
+
+	void *accessGraphicsMemory(uintptr_t address) {
+		return reinterpret_cast<char *>(_memory) + address;
+	}
+
 private:
 	arch::mem_space _ctrl;
 	void *_memory;
+	uintptr_t _graphicsBrk = 0;
+
+	uintptr_t _ringAddress = 0;
+	size_t _ringTail = 0;
 };
 
 void Controller::run() {
@@ -243,12 +282,30 @@ void Controller::run() {
 	fb.width = mode.horizontal.active;
 	fb.height = mode.vertical.active;
 	fb.stride = fb.width * 4;
-	fb.address = 0;
+	fb.address = allocateGraphicsMemory(fb.stride * fb.height);
+
+	// The CPU only draws into a staging buffer; the blitter copies it to the scanout buffer.
+	Framebuffer staging = fb;
+	staging.address = allocateGraphicsMemory(staging.stride * staging.height);
+
+	auto pixels = reinterpret_cast<uint32_t *>(accessGraphicsMemory(staging.address));
+	for(size_t x = 0; x < staging.width; x++)
+		for(size_t y = 0; y < staging.height; y++)
+			pixels[y * staging.width + x] = (x / 5) | ((y / 4) << 8);
+
+	// Set up a cursor image: a white arrow with a black outline.
+	auto cursorAddress = allocateGraphicsMemory(cursorSize * cursorSize * 4);
+	auto cursor = reinterpret_cast<uint32_t *>(accessGraphicsMemory(cursorAddress));
+	for(unsigned int y = 0; y < cursorSize; y++) {
+		for(unsigned int x = 0; x < cursorSize; x++) {
+			uint32_t pixel = 0;
+			if(x <= y && y < cursorSize / 2)
+				pixel = (!x || x == y || y == cursorSize / 2 - 1) ? 0xFF000000 : 0xFFFFFFFF;
+			cursor[y * cursorSize + x] = pixel;
+		}
+	}
 
-	auto plane = reinterpret_cast<uint32_t *>(_memory);
-	for(size_t x = 0; x < fb.width; x++)
-		for(size_t y = 0; y < fb.height; y++)
-			plane[y * fb.width + x] = (x / 5) | ((y / 4) << 8);
+	setupRing();
 
 	// Perform the mode setting.
 	auto multiplier = computeSdvoMultiplier(mode.dot);
@@ -265,7 +322,13 @@ void Controller::run() {
 	programPipe(mode);
 	dumpPipe();
 	enablePlane(&fb);
+	enableCursor(cursorAddress);
+	moveCursor(fb.width / 2, fb.height / 2);
 	enableDac();
+
+	blitCopy(&fb, &staging, 0, 0, fb.width, fb.height);
+	waitForRing();
+	std::cout << "gfx_intel: Blitter copy completed" << std::endl;
 }
 
 // ------------------------------------------------------------------------
@@ -523,6 +586,120 @@ void Controller::enablePlane(Framebuffer *fb) {
 			| plane_control::enablePlane(true));
 }
 
+void Controller::enableCursor(uintptr_t address) {
+	assert(!(address & 0xFFF));
+	_ctrl.store(regs::cursorControl, cursor_control::mode(CursorMode::argb64)
+			| cursor_control::pipeSelect(0));
+	// Writing the base address arms the update of all cursor registers.
+	_ctrl.store(regs::cursorBase, address);
+}
+
+void Controller::moveCursor(int x, int y) {
+	_ctrl.store(regs::cursorPosition, cursor_position::x(std::abs(x))
+			| cursor_position::xSign(x < 0)
+			| cursor_position::y(std::abs(y))
+			| cursor_position::ySign(y < 0));
+	_ctrl.store(regs::cursorBase, _ctrl.load(regs::cursorBase));
+}
+
+void Controller::disableCursor() {
+	_ctrl.store(regs::cursorControl, cursor_control::mode(CursorMode::disabled));
+	_ctrl.store(regs::cursorBase, 0);
+}
+
+// ------------------------------------------------------------------------
+// Blitter functions.
+// ------------------------------------------------------------------------
+
+void Controller::setupRing() {
+	_ringAddress = allocateGraphicsMemory(ringSize);
+	_ringTail = 0;
+
+	_ctrl.store(regs::ringControl, ring_control::enableRing(false));
+	_ctrl.store(regs::ringTail, ring_tail::offset(0));
+	_ctrl.store(regs::ringHead, ring_head::offset(0));
+	_ctrl.store(regs::ringStart, _ringAddress);
+	_ctrl.store(regs::ringControl, ring_control::numPages(ringSize / 0x1000 - 1)
+			| ring_control::enableRing(true));
+
+	while(_ctrl.load(regs::ringHead) & ring_head::offset) {
+		// Busy wait until the head is reset.
+	}
+}
+
+size_t Controller::_ringSpace() {
+	size_t head = (_ctrl.load(regs::ringHead) & ring_head::offset) * 4;
+	// Keep a qword between the tail and the head; otherwise a full ring looks empty.
+	return (head - _ringTail - 8) & (ringSize - 1);
+}
+
+void Controller::emitCommands(const uint32_t *dwords, size_t count) {
+	// The tail must be qword aligned.
+	auto size = ((count + 1) & ~size_t{1}) * 4;
+	assert(size < ringSize);
+
+	auto ring = reinterpret_cast<volatile uint32_t *>(accessGraphicsMemory(_ringAddress));
+	if(_ringTail + size > ringSize) {
+		// Pad the rest of the ring with no-ops and wrap around.
+		while(_ringSpace() < ringSize - _ringTail) {
+			// Busy wait until the GPU catches up.
+		}
+		for(size_t offset = _ringTail; offset < ringSize; offset += 4)
+			ring[offset / 4] = commands::miNoop;
+		_ringTail = 0;
+	}
+	while(_ringSpace() < size) {
+		// Busy wait until the GPU catches up.
+	}
+
+	for(size_t i = 0; i < size / 4; i++)
+		ring[_ringTail / 4 + i] = (i < count) ? dwords[i] : commands::miNoop;
+	_ringTail = (_ringTail + size) & (ringSize - 1);
+
+	// Make sure that the commands are visible before the GPU fetches them.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	_ctrl.store(regs::ringTail, ring_tail::offset(_ringTail / 8));
+}
+
+void Controller::waitForRing() {
+	while((_ctrl.load(regs::ringHead) & ring_head::offset) * 4 != _ringTail) {
+		// Busy wait until the GPU is idle.
+	}
+}
+
+void Controller::blitFill(Framebuffer *fb, unsigned int x, unsigned int y,
+		unsigned int width, unsigned int height, uint32_t color) {
+	assert(x + width <= fb->width && y + height <= fb->height);
+	uint32_t batch[] = {
+		commands::xyColorBlt,
+		commands::bltDepth32 | commands::ropPatCopy | fb->stride,
+		(y << 16) | x,
+		((y + height) << 16) | (x + width),
+		static_cast<uint32_t>(fb->address),
+		color,
+		commands::miFlush
+	};
+	emitCommands(batch, sizeof(batch) / sizeof(uint32_t));
+}
+
+void Controller::blitCopy(Framebuffer *dest, Framebuffer *source, unsigned int x, unsigned int y,
+		unsigned int width, unsigned int height) {
+	assert(x + width <= dest->width && y + height <= dest->height);
+	assert(x + width <= source->width && y + height <= source->height);
+	uint32_t batch[] = {
+		commands::xySrcCopyBlt,
+		commands::bltDepth32 | commands::ropSrcCopy | dest->stride,
+		(y << 16) | x,
+		((y + height) << 16) | (x + width),
+		static_cast<uint32_t>(dest->address),
+		(y << 16) | x,
+		source->stride,
+		static_cast<uint32_t>(source->address),
+		commands::miFlush
+	};
+	emitCommands(batch, sizeof(batch) / sizeof(uint32_t));
+}
+
 // ------------------------------------------------------------------------
 // Port handling functions.
 // ------------------------------------------------------------------------
@@ -551,6 +728,13 @@ void Controller::relinquishVga() {
 			| vga_control::disableVga(true));
 }
 
+uintptr_t Controller::allocateGraphicsMemory(size_t size) {
+	auto address = _graphicsBrk;
+	_graphicsBrk += (size + 0xFFF) & ~size_t{0xFFF};
+	assert(_graphicsBrk <= 0x1000'0000);
+	return address;
+}
+
 // ----------------------------------------------------------------
 // Freestanding PCI discovery functions.
 // ----------------------------------------------------------------
@@ -162,6 +162,76 @@ namespace vga_control {
 	static constexpr arch::field<uint32_t, unsigned int> centeringMode(30, 2);
 }
 
+// ----------------------------------------------------------------------------
+// Cursor plane registers.
+// ----------------------------------------------------------------------------
+
+namespace regs {
+	static constexpr arch::bit_register<uint32_t> cursorControl(0x70080);
+	static constexpr arch::scalar_register<uint32_t> cursorBase(0x70084);
+	static constexpr arch::bit_register<uint32_t> cursorPosition(0x70088);
+}
+
+enum class CursorMode : unsigned int {
+	disabled = 0,
+	argb64 = 0x27
+};
+
+namespace cursor_control {
+	static constexpr arch::field<uint32_t, CursorMode> mode(0, 6);
+	static constexpr arch::field<uint32_t, unsigned int> pipeSelect(28, 2);
+}
+
+namespace cursor_position {
+	static constexpr arch::field<uint32_t, unsigned int> x(0, 12);
+	static constexpr arch::field<uint32_t, bool> xSign(15, 1);
+	static constexpr arch::field<uint32_t, unsigned int> y(16, 12);
+	static constexpr arch::field<uint32_t, bool> ySign(31, 1);
+}
+
+// ----------------------------------------------------------------------------
+// Ring buffer registers.
+// ----------------------------------------------------------------------------
+
+// Pre-Gen6 hardware executes blitter commands on the render ring.
+namespace regs {
+	static constexpr arch::bit_register<uint32_t> ringTail(0x2030);
+	static constexpr arch::bit_register<uint32_t> ringHead(0x2034);
+	static constexpr arch::scalar_register<uint32_t> ringStart(0x2038);
+	static constexpr arch::bit_register<uint32_t> ringControl(0x203C);
+}
+
+namespace ring_tail {
+	static constexpr arch::field<uint32_t, unsigned int> offset(3, 18);
+}
+
+namespace ring_head {
+	static constexpr arch::field<uint32_t, unsigned int> offset(2, 19);
+}
+
+namespace ring_control {
+	static constexpr arch::field<uint32_t, bool> enableRing(0, 1);
+	// Length of the ring in pages minus one.
+	static constexpr arch::field<uint32_t, unsigned int> numPages(12, 9);
+}
+
+// ----------------------------------------------------------------------------
+// Commands.
+// ----------------------------------------------------------------------------
+
+namespace commands {
+	inline constexpr uint32_t miNoop = 0;
+	inline constexpr uint32_t miFlush = 0x04 << 23;
+
+	// 2D commands that write all channels of 32 bpp pixels.
+	inline constexpr uint32_t xyColorBlt = (2 << 29) | (0x50 << 22) | (3 << 20) | (6 - 2);
+	inline constexpr uint32_t xySrcCopyBlt = (2 << 29) | (0x53 << 22) | (3 << 20) | (8 - 2);
+
+	inline constexpr uint32_t bltDepth32 = 3 << 24;
+	inline constexpr uint32_t ropPatCopy = 0xF0 << 16;
+	inline constexpr uint32_t ropSrcCopy = 0xCC << 16;
+}
+
 // ----------------------------------------------------------------------------
 // VGA BIOS registers.
 // ----------------------------------------------------------------------------
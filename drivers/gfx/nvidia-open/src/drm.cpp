@@ -445,7 +445,7 @@ GfxDevice::BufferObject *GfxDevice::FrameBuffer::getBufferObject() { return _bo.
 
 uint32_t GfxDevice::FrameBuffer::getPixelPitch() { return _pixelPitch; }
 
-void GfxDevice::FrameBuffer::notifyDirty() {}
+void GfxDevice::FrameBuffer::notifyDirty(std::vector<drm_mode_rect>) {}
 
 uint32_t GfxDevice::FrameBuffer::getWidth() { return _bo->getWidth(); }
 
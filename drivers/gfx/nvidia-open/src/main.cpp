@@ -403,9 +403,16 @@ async::result<void> GfxDevice::initialize() {
 
 	apertureHandle_ = co_await hwDevice_.accessBar(1);
 
-	auto vendor_dev = co_await hwDevice_.loadPciSpace(pci::Vendor, 4);
-	auto class_code = co_await hwDevice_.loadPciSpace(pci::Revision, 4);
-	auto subsystem = co_await hwDevice_.loadPciSpace(pci::SubsystemVendor, 4);
+	// Read all IDs from the header with a single request.
+	auto header = co_await hwDevice_.loadPciSpaceRange(0, 0x30);
+	auto load32 = [&] (size_t offset) -> uint32_t {
+		return header[offset] | (header[offset + 1] << 8) | (header[offset + 2] << 16)
+			| (uint32_t{header[offset + 3]} << 24);
+	};
+
+	auto vendor_dev = load32(pci::Vendor);
+	auto class_code = load32(pci::Revision);
+	auto subsystem = load32(pci::SubsystemVendor);
 
 	vendor_ = vendor_dev & 0xFFFF;
 	device_ = vendor_dev >> 16;
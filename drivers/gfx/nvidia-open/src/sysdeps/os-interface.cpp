@@ -655,7 +655,7 @@ NV_STATUS NV_API_CALL nv_alloc_pages(
     NvU64 page_size [[maybe_unused]],
     NvBool contiguous,
     NvU32 cache_type,
-    NvBool zeroed,
+    NvBool zeroed [[maybe_unused]],
     NvBool unencrypted [[maybe_unused]],
     NvS32 node_id,
     NvU64 *pte_array,
@@ -678,13 +678,18 @@ NV_STATUS NV_API_CALL nv_alloc_pages(
 	auto info = new AllocInfo{handle, page_count, 0};
 	*reinterpret_cast<AllocInfo **>(priv_data) = info;
 
-	helix::Mapping map{helix::BorrowedDescriptor{handle}, 0, page_count << 12};
-	if (zeroed) {
-		memset(map.get(), 0, page_count << 12);
-	}
-
-	for (size_t i = 0; i < ((contiguous) ? 1 : page_count); i++) {
-		pte_array[i] = helix::addressToPhysical(uintptr_t(map.get()) + (i << 12));
+	// Fresh memory is always zeroed by the kernel, hence there is no need to map it.
+	auto ranges = helix::physicalRanges(handle, 0, page_count << 12);
+	if (contiguous) {
+		assert(ranges.size() == 1);
+		pte_array[0] = ranges[0].physical;
+	} else {
+		size_t n = 0;
+		for (auto &range : ranges) {
+			for (size_t off = 0; off < range.length; off += 0x1000)
+				pte_array[n++] = range.physical + off;
+		}
+		assert(n == page_count);
 	}
 
 	return NV_OK;
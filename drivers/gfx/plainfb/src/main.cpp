@@ -161,6 +161,41 @@ GfxDevice::createDumb(uint32_t width, uint32_t height, uint32_t bpp) {
 	return std::make_pair(bo, pitch);
 }
 
+void GfxDevice::_blit(FrameBuffer *fb, std::span<const drm_mode_rect> damage) {
+	auto bo = fb->getBufferObject();
+	auto minWidth = static_cast<int32_t>(std::min(bo->getWidth(), _screenWidth));
+	auto minHeight = static_cast<int32_t>(std::min(bo->getHeight(), _screenHeight));
+
+	for(auto rect : damage) {
+		// fastCopy16() needs 16-byte aligned rows, i.e., multiples of four pixels.
+		auto x1 = rect.x1 & ~3;
+		auto x2 = std::min((rect.x2 + 3) & ~3, minWidth);
+		auto y2 = std::min(rect.y2, minHeight);
+		if(x1 >= x2 || rect.y1 >= y2)
+			continue;
+
+		auto dest = reinterpret_cast<char *>(_fbMapping.get())
+				+ rect.y1 * _screenPitch + x1 * 4;
+		auto src = reinterpret_cast<char *>(bo->accessMapping())
+				+ rect.y1 * fb->getPitch() + x1 * 4;
+		size_t size = (x2 - x1) * 4;
+
+		if(fb->fastScanout() && !(size & 15)) {
+			for(int32_t k = rect.y1; k < y2; k++) {
+				drm_core::fastCopy16(dest, src, size);
+				dest += _screenPitch;
+				src += fb->getPitch();
+			}
+		}else{
+			for(int32_t k = rect.y1; k < y2; k++) {
+				memcpy(dest, src, size);
+				dest += _screenPitch;
+				src += fb->getPitch();
+			}
+		}
+	}
+}
+
 // ----------------------------------------------------------------
 // GfxDevice::Configuration.
 // ----------------------------------------------------------------
@@ -215,27 +250,7 @@ async::detached GfxDevice::Configuration::_dispatch(std::unique_ptr<drm_core::At
 
 		if(plane_state->fb != nullptr) {
 			auto fb = static_pointer_cast<GfxDevice::FrameBuffer>(plane_state->fb);
-
-			auto bo = fb->getBufferObject();
-			auto dest = reinterpret_cast<char *>(_device->_fbMapping.get());
-			auto src = reinterpret_cast<char *>(bo->accessMapping());
-
-			auto minWidth = std::min(bo->getWidth(), _device->_screenWidth);
-			auto minHeight = std::min(bo->getHeight(), _device->_screenHeight);
-
-			if(fb->fastScanout()) {
-				for(unsigned int k = 0; k < minHeight; k++) {
-					drm_core::fastCopy16(dest, src, minWidth * 4);
-					dest += _device->_screenPitch;
-					src += fb->getPitch();
-				}
-			}else{
-				for(unsigned int k = 0; k < minHeight; k++) {
-					memcpy(dest, src, minWidth * 4);
-					dest += _device->_screenPitch;
-					src += fb->getPitch();
-				}
-			}
+			_device->_blit(fb.get(), plane_state->damage());
 		}
 	} else {
 		std::cout << "gfx/plainfb: Disable scanout" << std::endl;
@@ -299,9 +314,10 @@ GfxDevice::BufferObject *GfxDevice::FrameBuffer::getBufferObject() {
 	return _bo.get();
 }
 
-void GfxDevice::FrameBuffer::notifyDirty() {
-	// TODO: Re-blit the FrameBuffer if it is currently displayed.
-	std::cout << "gfx/plainfb: notifyDirty() is not implemented correctly" << std::endl;
+void GfxDevice::FrameBuffer::notifyDirty(std::vector<drm_mode_rect> damage) {
+	if(!_device->_claimedDevice || _device->_plane->drmState()->fb.get() != this)
+		return;
+	_device->_blit(this, damage);
 }
 
 uint32_t GfxDevice::FrameBuffer::getWidth() {
@@ -361,9 +377,10 @@ async::detached bindController(mbus_ng::Entity hwEntity) {
 			<< " bpp, pitch: " << info.pitch << ")" << std::endl;
 	assert(info.bpp == 32);
 
+	auto fbView = drm_core::createWriteCombiningView(fbMemory, info.pitch * info.height);
 	auto gfxDevice = std::make_shared<GfxDevice>(std::move(hwDevice),
 			info.width, info.height, info.pitch,
-			helix::Mapping{fbMemory, 0, info.pitch * info.height});
+			helix::Mapping{fbView, 0, info.pitch * info.height});
 	auto config = co_await gfxDevice->initialize();
 
 	// Create an mbus object for the device.
@@ -76,7 +76,7 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 		bool fastScanout() { return _fastScanout; }
 
 		GfxDevice::BufferObject *getBufferObject();
-		void notifyDirty() override;
+		void notifyDirty(std::vector<drm_mode_rect> damage) override;
 		uint32_t getWidth() override;
 		uint32_t getHeight() override;
 		uint32_t getModifier() override {
@@ -106,6 +106,9 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 	std::tuple<std::string, std::string, std::string> driverInfo() override;
 
 private:
+	// Copies the damaged regions of a framebuffer to the screen.
+	void _blit(FrameBuffer *fb, std::span<const drm_mode_rect> damage);
+
 	protocols::hw::Device _hwDevice;
 	unsigned int _screenWidth;
 	unsigned int _screenHeight;
@@ -33,73 +33,6 @@ private:
 	std::coroutine_handle<> _handle;
 };
 
-async::result<void> Cmd::transferToHost2d(uint32_t width, uint32_t height, uint32_t resourceId, GfxDevice *device) {
-	spec::XferToHost2d xfer;
-	memset(&xfer, 0, sizeof(spec::XferToHost2d));
-	xfer.header.type = spec::cmd::xferToHost2d;
-	xfer.rect.x = 0;
-	xfer.rect.y = 0;
-	xfer.rect.width = width;
-	xfer.rect.height = height;
-	xfer.resourceId = resourceId;
-
-	spec::Header xfer_result;
-	virtio_core::Chain xfer_chain;
-	co_await virtio_core::scatterGather(virtio_core::hostToDevice,
-			xfer_chain, device->_controlQ,
-			arch::dma_buffer_view{nullptr, &xfer, sizeof(spec::XferToHost2d)});
-	co_await virtio_core::scatterGather(virtio_core::deviceToHost,
-			xfer_chain, device->_controlQ,
-			arch::dma_buffer_view{nullptr, &xfer_result, sizeof(spec::Header)});
-	co_await AwaitableRequest{device->_controlQ, xfer_chain.front()};
-	assert(xfer_result.type == spec::resp::noData);
-}
-
-async::result<void> Cmd::setScanout(uint32_t width, uint32_t height, uint32_t scanoutId, uint32_t resourceId, GfxDevice *device) {
-	spec::SetScanout scanout;
-	memset(&scanout, 0, sizeof(spec::SetScanout));
-	scanout.header.type = spec::cmd::setScanout;
-	scanout.rect.x = 0;
-	scanout.rect.y = 0;
-	scanout.rect.width = width;
-	scanout.rect.height = height;
-	scanout.scanoutId = scanoutId;
-	scanout.resourceId = resourceId;
-
-	spec::Header scanout_result;
-	virtio_core::Chain scanout_chain;
-	co_await virtio_core::scatterGather(virtio_core::hostToDevice,
-			scanout_chain, device->_controlQ,
-			arch::dma_buffer_view{nullptr, &scanout, sizeof(spec::SetScanout)});
-	co_await virtio_core::scatterGather(virtio_core::deviceToHost,
-			scanout_chain, device->_controlQ,
-			arch::dma_buffer_view{nullptr, &scanout_result, sizeof(spec::Header)});
-	co_await AwaitableRequest{device->_controlQ, scanout_chain.front()};
-
-	assert(scanout_result.type == spec::resp::noData);
-}
-
-async::result<void> Cmd::resourceFlush(uint32_t width, uint32_t height, uint32_t resourceId, GfxDevice *device) {
-	spec::ResourceFlush flush;
-	memset(&flush, 0, sizeof(spec::ResourceFlush));
-	flush.header.type = spec::cmd::resourceFlush;
-	flush.rect.x = 0;
-	flush.rect.y = 0;
-	flush.rect.width = width;
-	flush.rect.height = height;
-	flush.resourceId = resourceId;
-
-	spec::Header flush_result;
-	virtio_core::Chain flush_chain;
-	co_await virtio_core::scatterGather(virtio_core::hostToDevice, flush_chain, device->_controlQ,
-		arch::dma_buffer_view{nullptr, &flush, sizeof(spec::ResourceFlush)});
-	co_await virtio_core::scatterGather(virtio_core::deviceToHost, flush_chain, device->_controlQ,
-		arch::dma_buffer_view{nullptr, &flush_result, sizeof(spec::Header)});
-	co_await AwaitableRequest{device->_controlQ, flush_chain.front()};
-
-	assert(flush_result.type == spec::resp::noData);
-}
-
 async::result<spec::DisplayInfo> Cmd::getDisplayInfo(GfxDevice *device) {
 	spec::Header header;
 	header.type = spec::cmd::getDisplayInfo;
@@ -141,9 +74,11 @@ async::result<void> Cmd::create2d(uint32_t width, uint32_t height, uint32_t reso
 	assert(result.type == spec::resp::noData);
 }
 
-async::result<void> Cmd::attachBacking(uint32_t resourceId, void *ptr, size_t size, GfxDevice *device) {
+namespace {
+
+std::vector<spec::MemEntry> memEntries(void *ptr, size_t size) {
 	assert(ptr);
-	
+
 	std::vector<spec::MemEntry> entries;
 	for(size_t page = 0; page < size; page += 4096) {
 		spec::MemEntry entry;
@@ -155,6 +90,13 @@ async::result<void> Cmd::attachBacking(uint32_t resourceId, void *ptr, size_t si
 		entry.length = 4096;
 		entries.push_back(entry);
 	}
+	return entries;
+}
+
+} // namespace
+
+async::result<void> Cmd::attachBacking(uint32_t resourceId, void *ptr, size_t size, GfxDevice *device) {
+	auto entries = memEntries(ptr, size);
 
 	spec::AttachBacking attachment;
 	memset(&attachment, 0, sizeof(spec::AttachBacking));
@@ -174,3 +116,121 @@ async::result<void> Cmd::attachBacking(uint32_t resourceId, void *ptr, size_t si
 
 	assert(attach_result.type == spec::resp::noData);
 }
+
+async::result<void> Cmd::createBlob(uint32_t resourceId, void *ptr, size_t size, GfxDevice *device) {
+	auto entries = memEntries(ptr, size);
+
+	spec::CreateBlob blob;
+	memset(&blob, 0, sizeof(spec::CreateBlob));
+	blob.header.type = spec::cmd::createBlob;
+	blob.resourceId = resourceId;
+	blob.blobMem = spec::blob::memGuest;
+	blob.blobFlags = spec::blob::flagUseShareable;
+	blob.numEntries = entries.size();
+	blob.size = size;
+
+	spec::Header blob_result;
+	virtio_core::Chain blob_chain;
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice, blob_chain, device->_controlQ,
+			arch::dma_buffer_view{nullptr, &blob, sizeof(spec::CreateBlob)});
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice, blob_chain, device->_controlQ,
+			arch::dma_buffer_view{nullptr, entries.data(), entries.size() * sizeof(spec::MemEntry)});
+	co_await virtio_core::scatterGather(virtio_core::deviceToHost, blob_chain, device->_controlQ,
+			arch::dma_buffer_view{nullptr, &blob_result, sizeof(spec::Header)});
+	co_await AwaitableRequest{device->_controlQ, blob_chain.front()};
+
+	assert(blob_result.type == spec::resp::noData);
+}
+
+// ----------------------------------------------------------------
+// CommandBatch.
+// ----------------------------------------------------------------
+
+template<typename T>
+async::result<void> CommandBatch::_append(const T &command) {
+	// Each command takes two descriptors. Submit early such that we do not wait for
+	// descriptors that are only freed once the batch completes.
+	if(2 * (_commands.size() + 1) > _device->_controlQ->numDescriptors())
+		co_await submit();
+
+	auto &cmd = _commands.emplace_back();
+	cmd.batch = this;
+	cmd.buffer.resize(sizeof(T));
+	memcpy(cmd.buffer.data(), &command, sizeof(T));
+
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice, cmd.chain, _device->_controlQ,
+			arch::dma_buffer_view{nullptr, cmd.buffer.data(), cmd.buffer.size()});
+	co_await virtio_core::scatterGather(virtio_core::deviceToHost, cmd.chain, _device->_controlQ,
+			arch::dma_buffer_view{nullptr, &cmd.result, sizeof(spec::Header)});
+}
+
+async::result<void> CommandBatch::transferToHost2d(spec::Rect rect, uint64_t offset, uint32_t resourceId) {
+	spec::XferToHost2d xfer;
+	memset(&xfer, 0, sizeof(spec::XferToHost2d));
+	xfer.header.type = spec::cmd::xferToHost2d;
+	xfer.rect = rect;
+	xfer.offset = offset;
+	xfer.resourceId = resourceId;
+	co_await _append(xfer);
+}
+
+async::result<void> CommandBatch::setScanout(uint32_t width, uint32_t height, uint32_t scanoutId, uint32_t resourceId) {
+	spec::SetScanout scanout;
+	memset(&scanout, 0, sizeof(spec::SetScanout));
+	scanout.header.type = spec::cmd::setScanout;
+	scanout.rect.x = 0;
+	scanout.rect.y = 0;
+	scanout.rect.width = width;
+	scanout.rect.height = height;
+	scanout.scanoutId = scanoutId;
+	scanout.resourceId = resourceId;
+	co_await _append(scanout);
+}
+
+async::result<void> CommandBatch::setScanoutBlob(uint32_t width, uint32_t height, uint32_t format, uint32_t stride,
+		uint32_t scanoutId, uint32_t resourceId) {
+	spec::SetScanoutBlob scanout;
+	memset(&scanout, 0, sizeof(spec::SetScanoutBlob));
+	scanout.header.type = spec::cmd::setScanoutBlob;
+	scanout.rect.width = width;
+	scanout.rect.height = height;
+	scanout.scanoutId = scanoutId;
+	scanout.resourceId = resourceId;
+	scanout.width = width;
+	scanout.height = height;
+	scanout.format = format;
+	scanout.strides[0] = stride;
+	co_await _append(scanout);
+}
+
+async::result<void> CommandBatch::resourceFlush(spec::Rect rect, uint32_t resourceId) {
+	spec::ResourceFlush flush;
+	memset(&flush, 0, sizeof(spec::ResourceFlush));
+	flush.header.type = spec::cmd::resourceFlush;
+	flush.rect = rect;
+	flush.resourceId = resourceId;
+	co_await _append(flush);
+}
+
+async::result<void> CommandBatch::submit() {
+	if(_commands.empty())
+		co_return;
+
+	std::vector<virtio_core::Submission> submissions;
+	for(auto &cmd : _commands) {
+		submissions.push_back({cmd.chain.front(), &cmd, [] (virtio_core::Request *base) {
+			auto cmd = static_cast<Command *>(base);
+			if(!--cmd->batch->_pending)
+				cmd->batch->_doneEvent.raise();
+		}});
+	}
+
+	_pending = _commands.size();
+	_device->_controlQ->submitBatch(submissions);
+	while(_pending)
+		co_await _doneEvent.async_wait();
+
+	for(auto &cmd : _commands)
+		assert(cmd.result.type == spec::resp::noData);
+	_commands.clear();
+}
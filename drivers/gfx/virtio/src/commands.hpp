@@ -1,14 +1,55 @@
 #pragma once
 
+#include <deque>
+#include <vector>
+
+#include <async/recurring-event.hpp>
 #include <async/result.hpp>
 
 #include "src/virtio.hpp"
 
 struct Cmd {
-	static async::result<void> transferToHost2d(uint32_t width, uint32_t height, uint32_t resourceId, GfxDevice *device);
-	static async::result<void> setScanout(uint32_t width, uint32_t height, uint32_t scanoutId, uint32_t resourceId, GfxDevice *device);
-	static async::result<void> resourceFlush(uint32_t width, uint32_t height, uint32_t resourceId, GfxDevice *device);
 	static async::result<spec::DisplayInfo> getDisplayInfo(GfxDevice *device);
 	static async::result<void> create2d(uint32_t width, uint32_t height, uint32_t resourceId, GfxDevice *device);
 	static async::result<void> attachBacking(uint32_t resourceId, void *ptr, size_t size, GfxDevice *device);
+	// Creates a resource that the host accesses in guest memory, i.e., without transfers.
+	static async::result<void> createBlob(uint32_t resourceId, void *ptr, size_t size, GfxDevice *device);
+};
+
+// Collects the control commands of a page flip or damage update. submit() posts all of them
+// with a single notification of the device and waits for them at once.
+struct CommandBatch {
+	CommandBatch(GfxDevice *device)
+	: _device{device} { }
+
+	CommandBatch(const CommandBatch &) = delete;
+
+	CommandBatch &operator= (const CommandBatch &) = delete;
+
+	// The offset locates the top-left pixel of the rectangle in the resource's backing.
+	async::result<void> transferToHost2d(spec::Rect rect, uint64_t offset, uint32_t resourceId);
+	async::result<void> setScanout(uint32_t width, uint32_t height, uint32_t scanoutId, uint32_t resourceId);
+	async::result<void> setScanoutBlob(uint32_t width, uint32_t height, uint32_t format, uint32_t stride,
+			uint32_t scanoutId, uint32_t resourceId);
+	async::result<void> resourceFlush(spec::Rect rect, uint32_t resourceId);
+
+	// The device executes the commands in order.
+	async::result<void> submit();
+
+private:
+	struct Command : virtio_core::Request {
+		CommandBatch *batch;
+		std::vector<std::byte> buffer;
+		spec::Header result;
+		virtio_core::Chain chain;
+	};
+
+	template<typename T>
+	async::result<void> _append(const T &command);
+
+	GfxDevice *_device;
+	// Commands must not move until the device returns them.
+	std::deque<Command> _commands;
+	size_t _pending = 0;
+	async::recurring_event _doneEvent;
 };
@@ -74,6 +74,12 @@ async::result<std::unique_ptr<drm_core::Configuration>> GfxDevice::initialize()
 	if(_transport->checkDeviceFeature(VIRTIO_GPU_F_EDID))
 		_transport->acknowledgeDriverFeature(VIRTIO_GPU_F_EDID);
 
+	// Required to scan out of imported PRIME buffers.
+	if(_transport->checkDeviceFeature(VIRTIO_GPU_F_RESOURCE_BLOB)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_GPU_F_RESOURCE_BLOB);
+		_blobResources = true;
+	}
+
 	_transport->finalizeFeatures();
 	_transport->claimQueues(2);
 
@@ -179,7 +185,7 @@ std::unique_ptr<drm_core::Configuration> GfxDevice::createConfiguration() {
 }
 
 std::shared_ptr<drm_core::FrameBuffer> GfxDevice::createFrameBuffer(std::shared_ptr<drm_core::BufferObject> base_bo,
-		uint32_t width, uint32_t height, uint32_t, uint32_t pitch, uint32_t mod [[maybe_unused]]) {
+		uint32_t width, uint32_t height, uint32_t format, uint32_t pitch, uint32_t mod [[maybe_unused]]) {
 	auto bo = std::static_pointer_cast<GfxDevice::BufferObject>(base_bo);
 
 	assert(pitch % 4 == 0);
@@ -187,12 +193,27 @@ std::shared_ptr<drm_core::FrameBuffer> GfxDevice::createFrameBuffer(std::shared_
 	assert(pitch / 4 >= width);
 	assert(bo->getSize() >= pitch * height);
 
-	auto fb = std::make_shared<FrameBuffer>(this, bo);
+	auto fb = std::make_shared<FrameBuffer>(this, bo, width, height, format, pitch);
 	fb->setupWeakPtr(fb);
 	registerObject(fb.get());
 	return fb;
 }
 
+std::shared_ptr<drm_core::BufferObject>
+GfxDevice::importMemory(helix::UniqueDescriptor memory, size_t size) {
+	if(!_blobResources)
+		return nullptr;
+
+	auto bo = std::make_shared<BufferObject>(this, _resourceIdAllocator.allocate(), size,
+			std::move(memory), 0, 0, true);
+
+	auto mapping = installMapping(bo.get());
+	bo->setupMapping(mapping);
+
+	bo->_initHw();
+	return bo;
+}
+
 std::tuple<int, int, int> GfxDevice::driverVersion() {
 	return {0, 0, 1};
 }
@@ -276,31 +297,23 @@ async::detached GfxDevice::Configuration::_dispatch(std::unique_ptr<drm_core::At
 		_device->_claimedDevice = true;
 	}
 
+	CommandBatch batch{_device};
+
 	auto crtc_states = state->crtc_states();
 
 	for(auto pair : crtc_states) {
 		auto cs = pair.second;
 		auto crtc = cs->crtc().lock();
-		auto pps = state->plane(crtc->primaryPlane()->id());
 
 		if(cs->mode == nullptr) {
 			std::cout << "gfx/virtio: Disable scanout" << std::endl;
-			co_await Cmd::setScanout(0, 0, 0, 0, _device);
+			co_await batch.setScanout(0, 0, 0, 0);
 
 			continue;
 		}
 
-		if(pps->fb != nullptr) {
-			auto fb = static_pointer_cast<GfxDevice::FrameBuffer>(pps->fb);
-			auto scanoutId = static_pointer_cast<GfxDevice::Plane>(pps->plane)->scanoutId();
-			auto resourceId = fb->getBufferObject()->resourceId();
-
-			co_await fb->getBufferObject()->wait();
-
-			co_await Cmd::transferToHost2d(pps->src_w, pps->src_h, resourceId, _device);
-			co_await Cmd::setScanout(pps->src_w, pps->src_h, scanoutId, resourceId, _device);
-			co_await Cmd::resourceFlush(pps->src_w, pps->src_h, resourceId, _device);
-		}
+		// Make sure that the primary plane is updated below.
+		state->plane(crtc->primaryPlane()->id());
 	}
 
 	auto plane_states = state->plane_states();
@@ -308,20 +321,26 @@ async::detached GfxDevice::Configuration::_dispatch(std::unique_ptr<drm_core::At
 	for(auto pair : plane_states) {
 		auto ps = pair.second;
 
+		if(ps->crtc && state->crtc(ps->crtc->id())->mode == nullptr)
+			continue;
+
 		if(ps->fb != nullptr) {
 			auto fb = static_pointer_cast<GfxDevice::FrameBuffer>(ps->fb);
-			auto resourceId = fb->getBufferObject()->resourceId();
 
 			co_await fb->getBufferObject()->wait();
 
+			// The host keeps a copy of each resource, hence a new framebuffer is fully damaged.
+			auto damage = ps->damage(true);
+
 			// TODO: if(!fb->getBufferObject()->is3D())
-				co_await Cmd::transferToHost2d(ps->src_w, ps->src_h, resourceId, _device);
+				co_await fb->_transfer(batch, damage);
 
-			co_await Cmd::setScanout(ps->src_w, ps->src_h, static_pointer_cast<GfxDevice::Plane>(ps->plane)->scanoutId(), resourceId, _device);
-			co_await Cmd::resourceFlush(ps->src_w, ps->src_h, resourceId, _device);
+			co_await fb->_setScanout(batch, ps->src_w, ps->src_h, static_pointer_cast<GfxDevice::Plane>(ps->plane)->scanoutId());
+			co_await fb->_flush(batch, damage);
 		}
 	}
 
+	co_await batch.submit();
 	complete();
 }
 
@@ -366,8 +385,10 @@ int GfxDevice::Crtc::scanoutId() {
 // ----------------------------------------------------------------
 
 GfxDevice::FrameBuffer::FrameBuffer(GfxDevice *device,
-		std::shared_ptr<GfxDevice::BufferObject> bo)
-: drm_core::FrameBuffer { device, device->allocator.allocate() } {
+		std::shared_ptr<GfxDevice::BufferObject> bo,
+		uint32_t width, uint32_t height, uint32_t format, uint32_t pitch)
+: drm_core::FrameBuffer { device, device->allocator.allocate() },
+		_width{width}, _height{height}, _format{format}, _pitch{pitch} {
 	_bo = bo;
 	_device = device;
 }
@@ -376,21 +397,65 @@ GfxDevice::BufferObject *GfxDevice::FrameBuffer::getBufferObject() {
 	return _bo.get();
 }
 
-void GfxDevice::FrameBuffer::notifyDirty() {
-	_xferAndFlush();
+void GfxDevice::FrameBuffer::notifyDirty(std::vector<drm_mode_rect> damage) {
+	_xferAndFlush(std::move(damage));
 }
 
 uint32_t GfxDevice::FrameBuffer::getWidth() {
-	return _bo->getWidth();
+	return _width;
 }
 
 uint32_t GfxDevice::FrameBuffer::getHeight() {
-	return _bo->getHeight();
+	return _height;
 }
 
-async::detached GfxDevice::FrameBuffer::_xferAndFlush() {
-	co_await Cmd::transferToHost2d(_bo->getWidth(), _bo->getHeight(), _bo->resourceId(), _device);
-	co_await Cmd::resourceFlush(_bo->getWidth(), _bo->getHeight(), _bo->resourceId(), _device);
+namespace {
+
+spec::Rect toRect(const drm_mode_rect &rect) {
+	return {static_cast<uint32_t>(rect.x1), static_cast<uint32_t>(rect.y1),
+			static_cast<uint32_t>(rect.x2 - rect.x1), static_cast<uint32_t>(rect.y2 - rect.y1)};
+}
+
+} // namespace
+
+async::result<void> GfxDevice::FrameBuffer::_transfer(CommandBatch &batch,
+		const std::vector<drm_mode_rect> &damage) {
+	// The host reads blob resources directly from guest memory.
+	if(_bo->isBlob())
+		co_return;
+
+	for(auto &rect : damage) {
+		auto r = toRect(rect);
+		co_await batch.transferToHost2d(r, uint64_t{r.y} * _pitch + uint64_t{r.x} * 4,
+				_bo->resourceId());
+	}
+}
+
+async::result<void> GfxDevice::FrameBuffer::_flush(CommandBatch &batch,
+		const std::vector<drm_mode_rect> &damage) {
+	for(auto &rect : damage)
+		co_await batch.resourceFlush(toRect(rect), _bo->resourceId());
+}
+
+async::result<void> GfxDevice::FrameBuffer::_setScanout(CommandBatch &batch,
+		uint32_t width, uint32_t height, uint32_t scanoutId) {
+	if(!_bo->isBlob()) {
+		co_await batch.setScanout(width, height, scanoutId, _bo->resourceId());
+		co_return;
+	}
+
+	auto format = spec::format::bgrx;
+	if(_format == DRM_FORMAT_ARGB8888)
+		format = spec::format::bgra;
+	co_await batch.setScanoutBlob(width, height, format, _pitch, scanoutId,
+			_bo->resourceId());
+}
+
+async::detached GfxDevice::FrameBuffer::_xferAndFlush(std::vector<drm_mode_rect> damage) {
+	CommandBatch batch{_device};
+	co_await _transfer(batch, damage);
+	co_await _flush(batch, damage);
+	co_await batch.submit();
 }
 
 // ----------------------------------------------------------------
@@ -435,8 +500,12 @@ std::pair<helix::BorrowedDescriptor, uint64_t> GfxDevice::BufferObject::getMemor
 }
 
 async::detached GfxDevice::BufferObject::_initHw() {
-	co_await Cmd::create2d(getWidth(), getHeight(), _resourceId, _device);
-	co_await Cmd::attachBacking(_resourceId, _mapping.get(), getSize(), _device);
+	if(_blob) {
+		co_await Cmd::createBlob(_resourceId, _mapping.get(), getSize(), _device);
+	}else{
+		co_await Cmd::create2d(getWidth(), getHeight(), _resourceId, _device);
+		co_await Cmd::attachBacking(_resourceId, _mapping.get(), getSize(), _device);
+	}
 
 	_jump.raise();
 }
@@ -6,6 +6,7 @@
 namespace spec {
 
 namespace format {
+	inline constexpr uint32_t bgra = 1;
 	inline constexpr uint32_t bgrx = 2;
 	inline constexpr uint32_t xrgb = 4;
 }
@@ -105,6 +106,23 @@ struct MemEntry {
 	uint32_t padding;
 };
 
+namespace blob {
+	inline constexpr uint32_t memGuest = 1;
+
+	inline constexpr uint32_t flagUseShareable = 2;
+} //namespace blob
+
+// Followed by numEntries MemEntry structs.
+struct CreateBlob {
+	Header header;
+	uint32_t resourceId;
+	uint32_t blobMem;
+	uint32_t blobFlags;
+	uint32_t numEntries;
+	uint64_t blobId;
+	uint64_t size;
+};
+
 struct XferToHost2d {
 	Header header;
 	Rect rect;
@@ -120,6 +138,19 @@ struct SetScanout {
 	uint32_t resourceId;
 };
 
+struct SetScanoutBlob {
+	Header header;
+	Rect rect;
+	uint32_t scanoutId;
+	uint32_t resourceId;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint32_t padding;
+	uint32_t strides[4];
+	uint32_t offsets[4];
+};
+
 struct ResourceFlush {
 	Header header;
 	Rect rect;
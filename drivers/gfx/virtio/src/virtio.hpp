@@ -16,9 +16,11 @@
 #include "spec.hpp"
 
 struct Cmd;
+struct CommandBatch;
 
 struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevice> {
 	friend struct Cmd;
+	friend struct CommandBatch;
 
 	struct FrameBuffer;
 
@@ -57,8 +59,8 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 
 	struct BufferObject final : drm_core::BufferObject, std::enable_shared_from_this<BufferObject> {
 		BufferObject(GfxDevice *device, uint32_t id, size_t size, helix::UniqueDescriptor memory,
-			uint32_t width, uint32_t height)
-		: drm_core::BufferObject{width, height}, _device{device}, _resourceId{id}, _size{size}, _memory{std::move(memory)}, _mapping{_memory, 0, _size} {
+			uint32_t width, uint32_t height, bool blob = false)
+		: drm_core::BufferObject{width, height}, _device{device}, _resourceId{id}, _size{size}, _memory{std::move(memory)}, _mapping{_memory, 0, _size}, _blob{blob} {
 		};
 
 		~BufferObject();
@@ -70,12 +72,19 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 		async::result<void> wait();
 		uint32_t resourceId();
 
+		// Blob resources are backed by guest memory that the host reads directly.
+		// Their format and dimensions are only known once they are scanned out.
+		bool isBlob() {
+			return _blob;
+		}
+
 	private:
 		GfxDevice *_device;
 		uint32_t _resourceId;
 		size_t _size;
 		helix::UniqueDescriptor _memory;
 		helix::Mapping _mapping;
+		bool _blob;
 		async::oneshot_event _jump;
 	};
 
@@ -101,20 +110,30 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 	};
 
 	struct FrameBuffer final : drm_core::FrameBuffer {
-		FrameBuffer(GfxDevice *device, std::shared_ptr<GfxDevice::BufferObject> bo);
+		FrameBuffer(GfxDevice *device, std::shared_ptr<GfxDevice::BufferObject> bo,
+				uint32_t width, uint32_t height, uint32_t format, uint32_t pitch);
 
 		GfxDevice::BufferObject *getBufferObject();
-		void notifyDirty() override;
+		void notifyDirty(std::vector<drm_mode_rect> damage) override;
 		uint32_t getWidth() override;
 		uint32_t getHeight() override;
 		uint32_t getModifier() override {
 			return DRM_FORMAT_MOD_LINEAR;
 		}
-		async::detached _xferAndFlush();
+		// Transfer the damaged regions to the host resource and flush them to the display.
+		async::result<void> _transfer(CommandBatch &batch, const std::vector<drm_mode_rect> &damage);
+		async::result<void> _flush(CommandBatch &batch, const std::vector<drm_mode_rect> &damage);
+		async::detached _xferAndFlush(std::vector<drm_mode_rect> damage);
+		async::result<void> _setScanout(CommandBatch &batch, uint32_t width, uint32_t height,
+				uint32_t scanoutId);
 
 	private:
 		std::shared_ptr<GfxDevice::BufferObject> _bo;
 		GfxDevice *_device;
+		uint32_t _width;
+		uint32_t _height;
+		uint32_t _format;
+		uint32_t _pitch;
 	};
 
 	GfxDevice(std::unique_ptr<virtio_core::Transport> transport);
@@ -126,6 +145,8 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 	std::shared_ptr<drm_core::FrameBuffer>
 			createFrameBuffer(std::shared_ptr<drm_core::BufferObject> bo,
 			uint32_t width, uint32_t height, uint32_t format, uint32_t pitch, uint32_t mod [[maybe_unused]]) override;
+	std::shared_ptr<drm_core::BufferObject> importMemory(helix::UniqueDescriptor memory,
+			size_t size) override;
 
 	//returns major, minor, patchlvl
 	std::tuple<int, int, int> driverVersion() override;
@@ -145,4 +166,5 @@ private:
 	id_allocator<uint32_t> _resourceIdAllocator;
 
 	bool _virgl3D = false;
+	bool _blobResources = false;
 };
@@ -77,6 +77,17 @@ async::result<std::unique_ptr<drm_core::Configuration>> GfxDevice::initialize()
 	if (_deviceCaps & (uint32_t)caps::irqmask) {
 		writeRegister(register_index::irqmask, 0);
 		_operational.store(ports::irq_status_port, 0xFF);
+
+		_irq = co_await _hwDev.accessIrq();
+		_processIrqs();
+
+		// Command buffers complete asynchronously, hence they require interrupts.
+		if (hasCapability(caps::command_buffers)) {
+			_setupCommandBuffers();
+
+			uint32_t start[] = {(uint32_t)device_context_command::start_stop_context, 1, cb::context_0};
+			co_await _submitCommandBuffer(start, cb::context_device);
+		}
 	} else {
 		printf("\e[35mgfx/vmware: device doesn't support interrupts\e[39m\n");
 	}
@@ -215,37 +226,116 @@ std::unique_ptr<drm_core::Configuration> GfxDevice::createConfiguration() {
 	return std::make_unique<Configuration>(this);
 }
 
-async::result<void> GfxDevice::waitIrq(uint32_t irq_mask) {
+template<typename F>
+async::result<void> GfxDevice::waitIrq(uint32_t irq_mask, F condition) {
+	if (!(_deviceCaps & (uint32_t)caps::irqmask)) {
+		// Reading the busy register blocks until the host has processed the FIFO.
+		while (!condition()) {
+			writeRegister(register_index::sync, sync_reasons::generic);
+			readRegister(register_index::busy);
+		}
+		co_return;
+	}
 
-	static uint64_t irq_sequence;
+	if ((_irqMask & irq_mask) != irq_mask) {
+		_irqMask |= irq_mask;
+		writeRegister(register_index::irqmask, _irqMask);
+	}
 
-	if (_deviceCaps & (uint32_t)caps::irqmask) {
-		writeRegister(register_index::irqmask, irq_mask);
-		writeRegister(register_index::sync, 1);
+	while (true) {
+		// Only IRQs that arrive after the condition is checked can change its outcome.
+		_irqFlags &= ~irq_mask;
+		if (condition())
+			break;
+		co_await _irqEvent.async_wait_if([&] { return !(_irqFlags & irq_mask); });
+	}
+}
 
-		auto irq = co_await _hwDev.accessIrq();
+async::detached GfxDevice::_processIrqs() {
+	co_await _hwDev.enableBusIrq();
 
-		while (true) {
-			auto await = co_await helix_ng::awaitEvent(irq, irq_sequence);
-			HEL_CHECK(await.error());
-			irq_sequence = await.sequence();
-
-			uint32_t irq_flags = _operational.load(ports::irq_status_port);
-			if (!(irq_flags & irq_mask)) {
-				HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckNack, irq_sequence));
-				continue;
-			}
+	// TODO: The kick here should not be required.
+	HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckKick, 0));
 
-			_operational.store(ports::irq_status_port, irq_flags);
+	uint64_t sequence = 0;
+	while (true) {
+		auto await = co_await helix_ng::awaitEvent(_irq, sequence);
+		HEL_CHECK(await.error());
+		sequence = await.sequence();
 
-			HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, irq_sequence));
-			break;
+		uint32_t status = _operational.load(ports::irq_status_port);
+		if (!status) {
+			HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckNack, sequence));
+			continue;
 		}
-	} else {
-		writeRegister(register_index::sync, 1);
-		readRegister(register_index::busy);
+
+		_operational.store(ports::irq_status_port, status);
+		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
+
+		if (status & irq_flags::error)
+			printf("\e[31mgfx/vmware: device reported an error\e[39m\n");
+
+		_irqFlags |= status;
+		_irqEvent.raise();
+	}
+}
+
+void GfxDevice::_setupCommandBuffers() {
+	constexpr size_t numBuffers = 2;
+	constexpr size_t stride = (sizeof(cb::header) + CommandBatch::maxSize + 0xFFF) & ~size_t(0xFFF);
+
+	HelHandle memory;
+	void *window;
+	HEL_CHECK(helAllocateMemory(numBuffers * stride, kHelAllocContinuous, nullptr, &memory));
+	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
+			0, numBuffers * stride, kHelMapProtRead | kHelMapProtWrite, &window));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, memory));
+
+	_commandBuffers.resize(numBuffers);
+	for (size_t i = 0; i < numBuffers; i++) {
+		auto &buffer = _commandBuffers[i];
+		buffer.header = reinterpret_cast<cb::header *>(static_cast<char *>(window) + i * stride);
+		buffer.commands = reinterpret_cast<uint32_t *>(buffer.header + 1);
+		buffer.physical = helix::ptrToPhysical(buffer.header);
+		_freeCommandBuffers.push_back(&buffer);
+	}
+}
+
+async::result<void> GfxDevice::_submitCommandBuffer(std::span<const uint32_t> commands, uint32_t context) {
+	assert(commands.size_bytes() <= CommandBatch::maxSize);
+
+	co_await _commandBufferFreed.async_wait_if([&] { return _freeCommandBuffers.empty(); });
+	auto buffer = _freeCommandBuffers.back();
+	_freeCommandBuffers.pop_back();
+
+	memcpy(buffer->commands, commands.data(), commands.size_bytes());
+	memset(buffer->header, 0, sizeof(cb::header));
+	buffer->header->length = commands.size_bytes();
+	buffer->header->pa = buffer->physical + sizeof(cb::header);
+
+	while (true) {
+		buffer->header->status = cb::status::none;
+		writeRegister(register_index::command_high, buffer->physical >> 32);
+		writeRegister(register_index::command_low, (buffer->physical & ~uintptr_t{cb::context_mask}) | context);
+
+		co_await waitIrq(irq_flags::command_buffer, [&] {
+			return buffer->header->status != cb::status::none;
+		});
+		if (buffer->header->status != cb::status::queue_full)
+			break;
+
+		// The device rejected the buffer; retry once another buffer of the context completes.
+		co_await waitIrq(irq_flags::command_buffer, [first = true] () mutable {
+			return !std::exchange(first, false);
+		});
 	}
 
+	if (buffer->header->status != cb::status::completed)
+		printf("\e[31mgfx/vmware: command buffer failed with status %u at offset %u\e[39m\n",
+				(uint32_t)buffer->header->status, buffer->header->error_offset);
+
+	_freeCommandBuffers.push_back(buffer);
+	_commandBufferFreed.raise();
 }
 
 // ----------------------------------------------------------------
@@ -253,7 +343,7 @@ async::result<void> GfxDevice::waitIrq(uint32_t irq_mask) {
 // ----------------------------------------------------------------
 
 GfxDevice::DeviceFifo::DeviceFifo(GfxDevice *device, helix::Mapping fifoMapping)
-	:_device{device}, _fifoMapping{std::move(fifoMapping)}, _fifoSize{0} {
+	:_device{device}, _fifoMapping{std::move(fifoMapping)}, _reservedSize{0}, _fifoSize{0} {
 }
 
 void inline GfxDevice::DeviceFifo::writeRegister(fifo_index idx, uint32_t value) {
@@ -284,6 +374,18 @@ bool GfxDevice::DeviceFifo::hasCapability(caps capability) {
 	return (readRegister(fifo_index::capabilities) & (uint32_t)capability) != 0;
 }
 
+void GfxDevice::DeviceFifo::ping(uint32_t reason) {
+	// The host clears the busy register once it stops processing the FIFO.
+	if (_device->hasCapability(caps::fifo_extended)) {
+		auto busy = static_cast<uint32_t *>(_fifoMapping.get()) + (uint32_t)fifo_index::busy;
+		uint32_t expected = 0;
+		if (!__atomic_compare_exchange_n(busy, &expected, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			return;
+	}
+
+	_device->writeRegister(register_index::sync, reason);
+}
+
 async::result<void *> GfxDevice::DeviceFifo::reserve(size_t size) {
 	size_t bytes = size * 4;
 	uint32_t min = readRegister(fifo_index::min);
@@ -293,46 +395,44 @@ async::result<void *> GfxDevice::DeviceFifo::reserve(size_t size) {
 	bool reserveable = hasCapability(caps::fifo_reserve);
 
 	assert(bytes < (max - min));
-	assert(!(bytes % 4));
+	assert(bytes <= sizeof(_bounceBuf));
 	assert(_reservedSize == 0);
 
-	_reservedSize = bytes;
-
-	_usingBounceBuf = false;
-
-	while(1) {
+	while (1) {
 		uint32_t stop = readRegister(fifo_index::stop);
 		bool in_place = false;
+		bool full = false;
 
 		if (next_cmd >= stop) {
 			if (next_cmd + bytes < max ||
 				(next_cmd + bytes == max && stop > min)) in_place = true;
-
-			else if ((max - next_cmd) + (stop - min) <= bytes) {
-				co_await _device->waitIrq(2); // TODO: add a definiton for the mask
-			} else {
-				_usingBounceBuf = true;
-			}
+			else if ((max - next_cmd) + (stop - min) <= bytes) full = true;
 		} else {
 			if (next_cmd + bytes < stop) in_place = true;
-			else co_await _device->waitIrq(2); // TODO: add a definiton for the mask
+			else full = true;
 		}
 
-		if (in_place) {
-			if (reserveable) {
-				writeRegister(fifo_index::reserved, bytes);
-				auto mem = static_cast<uint8_t *>(_fifoMapping.get());
-				auto ptr = mem + next_cmd;
+		if (full) {
+			ping(sync_reasons::fifo_full);
+			co_await _device->waitIrq(irq_flags::fifo_progress, [&] {
+				return readRegister(fifo_index::stop) != stop;
+			});
+			continue;
+		}
 
-				co_return ptr;
-			}
+		_reservedSize = bytes;
+
+		if (in_place && reserveable) {
+			_usingBounceBuf = false;
+			writeRegister(fifo_index::reserved, bytes);
+			auto mem = static_cast<uint8_t *>(_fifoMapping.get());
+			co_return mem + next_cmd;
 		}
 
+		// commit() copies the commands into the FIFO, possibly wrapping around its end.
 		_usingBounceBuf = true;
 		co_return _bounceBuf;
 	}
-
-	co_return nullptr;
 }
 
 void GfxDevice::DeviceFifo::commit(size_t bytes) {
@@ -380,25 +480,81 @@ void GfxDevice::DeviceFifo::commit(size_t bytes) {
 		writeRegister(fifo_index::reserved, 0);
 }
 
-void GfxDevice::DeviceFifo::commitAll() {
-	commit(_reservedSize);
+async::result<void> GfxDevice::DeviceFifo::write(std::span<const uint32_t> commands) {
+	auto ptr = co_await reserve(commands.size());
+	memcpy(ptr, commands.data(), commands.size_bytes());
+	commit(commands.size_bytes());
+	ping(sync_reasons::generic);
+}
+
+void GfxDevice::DeviceFifo::moveCursor(int x, int y) {
+	if (!_device->hasCapability(caps::cursor))
+		return;
+
+	if (hasCapability(caps::fifo_cursor_bypass_3)) {
+		writeRegister(fifo_index::cursor_x, x);
+		writeRegister(fifo_index::cursor_y, y);
+		writeRegister(fifo_index::cursor_count, readRegister(fifo_index::cursor_count) + 1);
+		writeRegister(fifo_index::cursor_screen_id, 0xFFFFFFFF);
+	} else {
+		_device->writeRegister(register_index::cursor_x, x);
+		_device->writeRegister(register_index::cursor_y, y);
+	}
+}
+
+void GfxDevice::DeviceFifo::setCursorState(bool enabled) {
+	if (!_device->hasCapability(caps::cursor))
+		return;
+
+	if (hasCapability(caps::fifo_cursor_bypass_3)) {
+		writeRegister(fifo_index::cursor_on, enabled ? 1 : 0);
+	} else {
+		_device->writeRegister(register_index::cursor_on, enabled ? 1 : 0);
+	}
+}
+
+// ----------------------------------------------------------------
+// GfxDevice::CommandBatch
+// ----------------------------------------------------------------
+
+async::result<uint32_t *> GfxDevice::CommandBatch::_append(uint32_t command, size_t size) {
+	assert(!(size % 4));
+	assert(4 + size <= maxSize);
+
+	if ((_commands.size() + 1) * 4 + size > maxSize)
+		co_await submit();
+
+	auto offset = _commands.size();
+	_commands.resize(offset + 1 + size / 4);
+	_commands[offset] = command;
+	co_return _commands.data() + offset + 1;
+}
+
+async::result<void> GfxDevice::CommandBatch::submit() {
+	if (_commands.empty())
+		co_return;
+
+	if (!_device->_commandBuffers.empty()) {
+		co_await _device->_submitCommandBuffer(_commands, cb::context_0);
+	} else {
+		co_await _device->_fifo.write(_commands);
+	}
+	_commands.clear();
 }
 
 #define SVGA_BITMAP_SIZE(w, h)      ((((w) + 31) >> 5) * (h))
 #define SVGA_PIXMAP_SIZE(w, h, bpp) (((((w) * (bpp)) + 31) >> 5) * (h))
 
-async::result<void> GfxDevice::DeviceFifo::defineCursor(int width, int height, GfxDevice::BufferObject *bo) {
+async::result<void> GfxDevice::CommandBatch::defineCursor(int width, int height, GfxDevice::BufferObject *bo) {
 
 	if (!_device->hasCapability(caps::cursor))
 		co_return;
 
-	// size in dwords
-	size_t size = sizeof(commands::define_cursor) / 4 + 1 + SVGA_BITMAP_SIZE(width, height) + SVGA_PIXMAP_SIZE(width, height, 32);
+	// size in bytes, without the command index
+	size_t size = sizeof(commands::define_cursor) + (SVGA_BITMAP_SIZE(width, height) + SVGA_PIXMAP_SIZE(width, height, 32)) * 4;
 
-	auto ptr = static_cast<uint32_t *>(co_await reserve(size));
-
-	ptr[0] = (uint32_t)command_index::define_cursor;
-	auto cmd = reinterpret_cast<commands::define_cursor *>(ptr + 1);
+	auto cmd = reinterpret_cast<commands::define_cursor *>(
+			co_await _append((uint32_t)command_index::define_cursor, size));
 
 	cmd->width = width;
 	cmd->height = height;
@@ -414,8 +570,6 @@ async::result<void> GfxDevice::DeviceFifo::defineCursor(int width, int height, G
 		auto pixels = static_cast<uint32_t *>(bitmap.get());
 		auto mask = reinterpret_cast<uint8_t *>(cmd->pixel_data);
 
-		memset(cmd->pixel_data, 0x00, (SVGA_BITMAP_SIZE(width, height) + SVGA_PIXMAP_SIZE(width, height, 32)) * 4);
-
 		for (int i = 0; i < height; i++) {
 			for (int j = 0; j < width; j++) {
 				int idx = width * i + j;
@@ -427,50 +581,63 @@ async::result<void> GfxDevice::DeviceFifo::defineCursor(int width, int height, G
 
 		memcpy(cmd->pixel_data + SVGA_BITMAP_SIZE(width, height) * 4, pixels, width * height * 4);
 	}
-	commitAll();
 }
 
-void GfxDevice::DeviceFifo::moveCursor(int x, int y) {
-	if (!_device->hasCapability(caps::cursor))
-		return;
+async::result<void> GfxDevice::CommandBatch::defineScreen(uint32_t width, uint32_t height, uint32_t pitch) {
+	auto cmd = reinterpret_cast<commands::define_screen *>(
+			co_await _append((uint32_t)command_index::define_screen, sizeof(commands::define_screen)));
 
-	if (hasCapability(caps::fifo_cursor_bypass_3)) {
-		writeRegister(fifo_index::cursor_x, x);
-		writeRegister(fifo_index::cursor_y, y);
-		writeRegister(fifo_index::cursor_count, readRegister(fifo_index::cursor_count) + 1);
-		writeRegister(fifo_index::cursor_screen_id, 0xFFFFFFFF);
-	} else {
-		_device->writeRegister(register_index::cursor_x, x);
-		_device->writeRegister(register_index::cursor_y, y);
-	}
-}
-
-void GfxDevice::DeviceFifo::setCursorState(bool enabled) {
-	if (!_device->hasCapability(caps::cursor))
-		return;
-
-	if (hasCapability(caps::fifo_cursor_bypass_3)) {
-		writeRegister(fifo_index::cursor_on, enabled ? 1 : 0);
-	} else {
-		_device->writeRegister(register_index::cursor_on, enabled ? 1 : 0);
-	}
+	// The screen scans out of VRAM, hence update commands keep working as without screen objects.
+	cmd->struct_size = sizeof(commands::define_screen);
+	cmd->id = 0;
+	cmd->flags = screen_flags::has_root | screen_flags::is_primary;
+	cmd->width = width;
+	cmd->height = height;
+	cmd->root_x = 0;
+	cmd->root_y = 0;
+	cmd->backing_gmr_id = gmr_framebuffer;
+	cmd->backing_offset = 0;
+	cmd->backing_pitch = pitch;
 }
 
-async::result<void> GfxDevice::DeviceFifo::updateRectangle(int x, int y, int w, int h) {
-	// size in dwords
-	size_t size = sizeof(commands::update_rectangle) / 4 + 1;
-
-	auto ptr = static_cast<uint32_t *>(co_await reserve(size));
-
-	ptr[0] = (uint32_t)command_index::update;
-	auto cmd = reinterpret_cast<commands::update_rectangle *>(ptr + 1);
+async::result<void> GfxDevice::CommandBatch::updateRectangle(int x, int y, int w, int h) {
+	auto cmd = reinterpret_cast<commands::update_rectangle *>(
+			co_await _append((uint32_t)command_index::update, sizeof(commands::update_rectangle)));
 
 	cmd->x = x;
 	cmd->y = y;
 	cmd->w = w;
 	cmd->h = h;
+}
+
+async::result<void> GfxDevice::_present(CommandBatch &batch, FrameBuffer *fb, std::vector<drm_mode_rect> damage) {
+	auto bo = fb->getBufferObject();
+	helix::Mapping user_fb{bo->getMemory().first, 0, bo->getSize()};
+	int w = _width,
+		h = _height;
+	size_t pitch = fb->getPixelPitch();
+
+	for (auto rect : damage) {
+		auto x2 = std::min(rect.x2, w);
+		auto y2 = std::min(rect.y2, h);
+		if (rect.x1 >= x2 || rect.y1 >= y2)
+			continue;
+
+		// The framebuffer has the same layout as the device's frame buffer.
+		auto dest = reinterpret_cast<char *>(_fbMapping.get()) + rect.y1 * pitch + rect.x1 * 4;
+		auto src = reinterpret_cast<char *>(user_fb.get()) + rect.y1 * pitch + rect.x1 * 4;
+		if (!rect.x1 && static_cast<size_t>(x2) * 4 == pitch && !((y2 - rect.y1) * pitch & 15)) {
+			drm_core::fastCopy16(dest, src, (y2 - rect.y1) * pitch);
+		} else {
+			for (int32_t k = rect.y1; k < y2; k++) {
+				memcpy(dest, src, (x2 - rect.x1) * 4);
+				dest += pitch;
+				src += pitch;
+			}
+		}
 
-	commitAll();
+		co_await batch.updateRectangle(rect.x1, rect.y1, x2 - rect.x1, y2 - rect.y1);
+	}
 }
 
 // ----------------------------------------------------------------
@@ -577,6 +744,8 @@ async::detached GfxDevice::Configuration::commitConfiguration(std::unique_ptr<dr
 
 	_device->_primaryPlane->setCurrentFrameBuffer(primary_plane_state->fb.get());
 
+	CommandBatch batch{_device};
+
 	if(crtc_state->mode != nullptr) {
 		if (!_device->_isClaimed) {
 			co_await _device->_hwDev.claimDevice();
@@ -590,15 +759,22 @@ async::detached GfxDevice::Configuration::commitConfiguration(std::unique_ptr<dr
 			_device->writeRegister(register_index::height, primary_plane_state->src_h);
 			_device->writeRegister(register_index::bits_per_pixel, 32);
 			_device->writeRegister(register_index::enable, 1);
+			_device->_width = primary_plane_state->src_w;
+			_device->_height = primary_plane_state->src_h;
+
+			if (_device->_fifo.hasCapability(caps::fifo_screen_object)
+					|| _device->_fifo.hasCapability(caps::fifo_screen_object_2))
+				co_await batch.defineScreen(primary_plane_state->src_w, primary_plane_state->src_h,
+						primary_plane_state->src_w * 4);
 		}
 	}
 
+	bool show_cursor = false;
 	if (_cursorUpdate) {
 		if (cursor_plane_state->src_w != 0 && cursor_plane_state->src_h != 0) {
-			_device->_fifo.setCursorState(true);
 			auto cursor_fb = static_pointer_cast<GfxDevice::FrameBuffer>(cursor_plane_state->fb);
-			co_await _device->_fifo.defineCursor(cursor_plane_state->src_w, cursor_plane_state->src_h, cursor_fb->getBufferObject());
-			_device->_fifo.setCursorState(true);
+			co_await batch.defineCursor(cursor_plane_state->src_w, cursor_plane_state->src_h, cursor_fb->getBufferObject());
+			show_cursor = true;
 		} else {
 			_device->_fifo.setCursorState(false);
 		}
@@ -610,14 +786,20 @@ async::detached GfxDevice::Configuration::commitConfiguration(std::unique_ptr<dr
 
 	if (primary_plane_state->fb != nullptr) {
 		auto fb = static_pointer_cast<GfxDevice::FrameBuffer>(primary_plane_state->fb);
-		helix::Mapping user_fb{fb->getBufferObject()->getMemory().first, 0, fb->getBufferObject()->getSize()};
-		drm_core::fastCopy16(_device->_fbMapping.get(), user_fb.get(), fb->getBufferObject()->getSize());
-		int w = _device->readRegister(register_index::width),
-			h = _device->readRegister(register_index::height);
+		// A mode switch invalidates the whole screen, not only the damaged regions.
+		auto damage = switch_mode
+			? drm_core::clipDamage({}, fb->getWidth(), fb->getHeight())
+			: primary_plane_state->damage();
 
-		co_await _device->_fifo.updateRectangle(0, 0, w, h);
+		co_await _device->_present(batch, fb.get(), std::move(damage));
 	}
 
+	co_await batch.submit();
+
+	// Only show the cursor once the device knows its new image.
+	if (show_cursor)
+		_device->_fifo.setCursorState(true);
+
 	complete();
 }
 
@@ -662,6 +844,7 @@ drm_core::Plane *GfxDevice::Crtc::Crtc::cursorPlane() {
 GfxDevice::FrameBuffer::FrameBuffer(GfxDevice *dev,
 		std::shared_ptr<GfxDevice::BufferObject> bo, uint32_t pixel_pitch)
 	: drm_core::FrameBuffer { dev, dev->allocator.allocate() } {
+	_device = dev;
 	_bo = bo;
 	_pixelPitch = pixel_pitch;
 }
@@ -674,8 +857,14 @@ uint32_t GfxDevice::FrameBuffer::getPixelPitch() {
 	return _pixelPitch;
 }
 
-void GfxDevice::FrameBuffer::notifyDirty() {
-
+void GfxDevice::FrameBuffer::notifyDirty(std::vector<drm_mode_rect> damage) {
+	if (!_device->_isClaimed || _device->_primaryPlane->drmState()->fb.get() != this)
+		return;
+	[] (GfxDevice *device, FrameBuffer *fb, std::vector<drm_mode_rect> damage) -> async::detached {
+		CommandBatch batch{device};
+		co_await device->_present(batch, fb, std::move(damage));
+		co_await batch.submit();
+	}(_device, this, std::move(damage));
 }
 
 uint32_t GfxDevice::FrameBuffer::getWidth() {
@@ -735,8 +924,9 @@ async::result<void> setupDevice(mbus_ng::Entity hwEntity) {
 	auto fb_bar_info = info.barInfo[1];
 	auto fifo_bar_info = info.barInfo[2];
 
+	auto fb_view = drm_core::createWriteCombiningView(fb_bar, fb_bar_info.length);
 	auto gfxDevice = std::make_shared<GfxDevice>(std::move(pci_device),
-			helix::Mapping{fb_bar, 0, fb_bar_info.length},
+			helix::Mapping{fb_view, 0, fb_bar_info.length},
 			helix::Mapping{fifo_bar, 0, fifo_bar_info.length},
 			std::move(io_bar), io_bar_info.address);
 
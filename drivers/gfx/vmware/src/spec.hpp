@@ -67,7 +67,9 @@ enum class register_index : uint32_t {
 	traces = 45,
 	gmrs_max_pages = 46,
 	memory_size = 47,
-	top = 48,
+	command_low = 48,
+	command_high = 49,
+	top = 50,
 };
 
 enum class command_index : uint32_t {
@@ -157,6 +159,83 @@ namespace commands {
 		uint32_t w;
 		uint32_t h;
 	};
+
+	struct define_screen {
+		uint32_t struct_size;		// sizeof(define_screen)
+		uint32_t id;
+		uint32_t flags;
+		uint32_t width;
+		uint32_t height;
+		int32_t root_x;
+		int32_t root_y;
+		uint32_t backing_gmr_id;	// gmr_framebuffer for VRAM
+		uint32_t backing_offset;
+		uint32_t backing_pitch;
+	};
+
+	// device context commands, only valid in command buffers of cb::context_device
+	struct start_stop_context {
+		uint32_t enable;
+		uint32_t context;
+	};
+}
+
+namespace screen_flags {
+	constexpr uint32_t has_root = 1 << 0;
+	constexpr uint32_t is_primary = 1 << 1;
+	constexpr uint32_t fullscreen_hint = 1 << 2;
+}
+
+constexpr uint32_t gmr_framebuffer = 0xFFFFFFFE;
+
+enum class device_context_command : uint32_t {
+	nop = 0,
+	start_stop_context = 1,
+};
+
+namespace irq_flags {
+	constexpr uint32_t any_fence = 0x1;
+	constexpr uint32_t fifo_progress = 0x2;
+	constexpr uint32_t fence_goal = 0x4;
+	constexpr uint32_t command_buffer = 0x8;
+	constexpr uint32_t error = 0x10;
+}
+
+namespace sync_reasons {
+	constexpr uint32_t generic = 1;
+	constexpr uint32_t fifo_full = 2;
+}
+
+// command buffers (caps::command_buffers) are fetched by the device via DMA
+namespace cb {
+	constexpr uint32_t context_0 = 0;
+	constexpr uint32_t context_device = 0x3F;
+	constexpr uint32_t context_mask = 0x3F;
+
+	enum class status : uint32_t {
+		none = 0,
+		completed = 1,
+		queue_full = 2,
+		command_error = 3,
+		header_error = 4,
+		preempted = 5,
+		submission_error = 6,
+		partial_complete = 7,
+	};
+
+	// must be 64-byte aligned in physical memory
+	struct header {
+		volatile cb::status status;	// written by the device
+		volatile uint32_t error_offset;	// written by the device
+		uint64_t id;
+		uint32_t flags;
+		uint32_t length;
+		uint64_t pa;
+		uint32_t offset;
+		uint32_t dx_context;
+		uint32_t must_be_zero[6];
+	};
+	static_assert(sizeof(header) == 64);
 }
 
 enum class caps : uint32_t {
@@ -165,4 +244,7 @@ enum class caps : uint32_t {
 	irqmask = 0x00040000,
 	fifo_reserve = (1<<6),
 	fifo_cursor_bypass_3 = (1<<4),
+	fifo_screen_object = (1<<7),
+	fifo_screen_object_2 = (1<<9),
+	command_buffers = 0x01000000,
 };
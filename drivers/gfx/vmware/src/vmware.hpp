@@ -1,6 +1,7 @@
 
 #include <queue>
 #include <map>
+#include <span>
 #include <unordered_map>
 
 #include <arch/io_space.hpp>
@@ -76,7 +77,7 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 
 		GfxDevice::BufferObject *getBufferObject();
 		uint32_t getPixelPitch();
-		void notifyDirty() override;
+		void notifyDirty(std::vector<drm_mode_rect> damage) override;
 		uint32_t getWidth() override;
 		uint32_t getHeight() override;
 		uint32_t getModifier() override {
@@ -84,6 +85,7 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 		}
 
 	private:
+		GfxDevice *_device;
 		std::shared_ptr<GfxDevice::BufferObject> _bo;
 		uint32_t _pixelPitch;
 	};
@@ -92,15 +94,16 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 		DeviceFifo(GfxDevice *device, helix::Mapping fifoMapping);
 
 		void initialize();
-		async::result<void> defineCursor(int width, int height, GfxDevice::BufferObject *bo);
 		void moveCursor(int x, int y);
 		void setCursorState(bool enabled);
 		bool hasCapability(caps capability);
-		async::result<void> updateRectangle(int x, int y, int w, int h);
+		// Copies a batch of commands into the FIFO and notifies the device.
+		async::result<void> write(std::span<const uint32_t> commands);
 	private:
 		async::result<void *> reserve(size_t size);
 		void commit(size_t);
-		void commitAll();
+		// Only traps into the host if it is not already processing the FIFO.
+		void ping(uint32_t reason);
 		void writeRegister(fifo_index idx, uint32_t value);
 		uint32_t readRegister(fifo_index idx);
 
@@ -114,6 +117,35 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 		bool _usingBounceBuf;
 	};
 
+	// Collects the commands of a commit such that they reach the device at once,
+	// either in a command buffer or in a single FIFO reservation.
+	struct CommandBatch {
+		// Larger batches are submitted in multiple parts.
+		static constexpr size_t maxSize = 256 * 1024;
+
+		CommandBatch(GfxDevice *device)
+		: _device{device} { }
+
+		CommandBatch(const CommandBatch &) = delete;
+
+		CommandBatch &operator= (const CommandBatch &) = delete;
+
+		async::result<void> defineCursor(int width, int height, GfxDevice::BufferObject *bo);
+		async::result<void> defineScreen(uint32_t width, uint32_t height, uint32_t pitch);
+		async::result<void> updateRectangle(int x, int y, int w, int h);
+
+		// The device executes the commands in order.
+		async::result<void> submit();
+
+	private:
+		// Returns a pointer to the zero-initialized body of the command;
+		// it is only valid until the next command is appended.
+		async::result<uint32_t *> _append(uint32_t command, size_t size);
+
+		GfxDevice *_device;
+		std::vector<uint32_t> _commands;
+	};
+
 	GfxDevice(protocols::hw::Device hw_device,
 			helix::Mapping fb,
 			helix::Mapping fifo,
@@ -131,6 +163,22 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 	std::tuple<std::string, std::string, std::string> driverInfo() override;
 
 private:
+	// Copies the damaged regions of a framebuffer to the screen and appends their updates.
+	async::result<void> _present(CommandBatch &batch, FrameBuffer *fb, std::vector<drm_mode_rect> damage);
+
+	// Command buffers are submitted to the device by writing their physical address
+	// into the command registers. The device fetches them via DMA.
+	struct CommandBuffer {
+		cb::header *header;
+		uint32_t *commands;
+		uintptr_t physical;
+	};
+
+	void _setupCommandBuffers();
+	async::result<void> _submitCommandBuffer(std::span<const uint32_t> commands, uint32_t context);
+
+	async::detached _processIrqs();
+
 	std::shared_ptr<Crtc> _crtc;
 	std::shared_ptr<Encoder> _encoder;
 	std::shared_ptr<Connector> _connector;
@@ -141,7 +189,10 @@ private:
 	void writeRegister(register_index reg, uint32_t value);
 	bool hasCapability(caps capability);
 
-	async::result<void> waitIrq(uint32_t irq_mask);
+	// Waits until the condition is met. The device raises one of the IRQs in the mask
+	// whenever the condition might have changed.
+	template<typename F>
+	async::result<void> waitIrq(uint32_t irq_mask, F condition);
 
 	protocols::hw::Device _hwDev;
 	DeviceFifo _fifo;
@@ -149,7 +200,20 @@ private:
 	arch::io_space _operational;
 	helix::Mapping _fbMapping;
 
+	helix::UniqueDescriptor _irq;
+	// IRQs that were raised since the last waitIrq() that checked them.
+	uint32_t _irqFlags = 0;
+	uint32_t _irqMask = 0;
+	async::recurring_event _irqEvent;
+
+	std::vector<CommandBuffer> _commandBuffers;
+	std::vector<CommandBuffer *> _freeCommandBuffers;
+	async::recurring_event _commandBufferFreed;
+
 	bool _isClaimed;
+	// Dimensions of the current mode, such that presenting does not read registers.
+	uint32_t _width = 0;
+	uint32_t _height = 0;
 	uint32_t _deviceVersion;
 	uint32_t _deviceCaps;
 };
@@ -493,6 +493,7 @@ async::result<void> Controller::KbdDevice::run() {
 	mbus_ng::Properties descriptor{
 		{"unix.subsystem", mbus_ng::StringItem{"input"}}
 	};
+	descriptor.merge(_evDev->mbusProperties());
 
 	auto entity = (co_await mbus_ng::Instance::global().createEntity(
 		"ps2kbd", descriptor)).unwrap();
@@ -578,6 +579,7 @@ async::result<void> Controller::MouseDevice::run() {
 	mbus_ng::Properties descriptor{
 		{"unix.subsystem", mbus_ng::StringItem{"input"}}
 	};
+	descriptor.merge(_evDev->mbusProperties());
 
 	auto entity = (co_await mbus_ng::Instance::global().createEntity(
 		"ps2mouse", descriptor)).unwrap();
@@ -5,9 +5,52 @@
 #include <protocols/mbus/client.hpp>
 #include <protocols/ostrace/ostrace.hpp>
 #include <stdint.h>
+#include <array>
+#include <span>
 
 namespace blockfs {
 
+// Virtually contiguous part of the buffer of a vectored request.
+// As for readSectors() and writeSectors(), the memory must be locked.
+struct Segment {
+	void *buffer;
+	size_t numSectors;
+};
+
+// I/O accounting of a device, see DeviceStatsRequest in fs.bragi.
+// Sectors are counted in units of 512 bytes, times in nanoseconds.
+struct IoStats {
+	// Bucket i counts requests that took [2^i, 2^(i+1)) microseconds.
+	static constexpr size_t numBuckets = 24;
+
+	struct Counters {
+		uint64_t ios = 0;
+		// Number of requests that were merged into adjacent ones.
+		uint64_t merges = 0;
+		uint64_t sectors = 0;
+		uint64_t ticks = 0;
+		std::array<uint64_t, numBuckets> histogram{};
+	};
+
+	// Returns the start time of a request; it must be passed to complete().
+	uint64_t start();
+	void complete(bool write, size_t bytes, uint64_t startTime);
+
+	// Accounts for the time that passed since the last update.
+	void update();
+
+	Counters reads;
+	Counters writes;
+	uint64_t inFlight = 0;
+	// Time during which at least one request was in flight.
+	uint64_t ioTicks = 0;
+	// Time that requests were in flight, summed over all requests.
+	uint64_t timeInQueue = 0;
+
+private:
+	uint64_t _lastUpdate = 0;
+};
+
 struct BlockDevice {
 	BlockDevice(size_t sector_size, int64_t parent_id);
 
@@ -20,8 +63,49 @@ struct BlockDevice {
 		throw std::runtime_error("BlockDevice does not support writeSectors()");
 	}
 
+	// Vectored variants of readSectors() and writeSectors(): the segments are
+	// transferred to/from consecutive sectors starting at the given sector.
+	// The default implementation issues one request per segment.
+	virtual async::result<void> readSectorsV(uint64_t sector, std::span<const Segment> segments);
+	virtual async::result<void> writeSectorsV(uint64_t sector, std::span<const Segment> segments);
+
+	// Variants of readSectors() and writeSectors() for latency-sensitive requests.
+	// Devices that support completion polling finish them without waiting for an IRQ.
+	// The default implementation forwards to readSectors() and writeSectors().
+	virtual async::result<void> readSectorsPolled(uint64_t sector, void *buffer,
+			size_t num_sectors) {
+		return readSectors(sector, buffer, num_sectors);
+	}
+
+	virtual async::result<void> writeSectorsPolled(uint64_t sector, const void *buffer,
+			size_t num_sectors) {
+		return writeSectors(sector, buffer, num_sectors);
+	}
+
+	// Tells the device that the sectors no longer hold data that is needed
+	// (i.e., TRIM). Afterwards, their contents are undefined.
+	// Devices that do not set supportsDiscard ignore discards.
+	virtual async::result<void> discard(uint64_t, size_t) {
+		co_return;
+	}
+
+	// Sets the sectors to zero. The default implementation writes zero-filled buffers;
+	// devices override it if they can zero sectors without transferring data.
+	virtual async::result<void> writeZeroes(uint64_t sector, size_t num_sectors);
+
+	// Makes all writes that completed before the call durable,
+	// i.e., flushes the volatile write cache of the device (if any).
+	virtual async::result<void> flush() {
+		co_return;
+	}
+
 	virtual async::result<size_t> getSize() = 0;
 
+	// While the device is plugged, requests are held back such that they can be merged;
+	// they are dispatched on the matching unplug(). Do not wait for requests while plugged.
+	virtual void plug() { }
+	virtual void unplug() { }
+
 	virtual async::result<void> handleIoctl(managarm::fs::GenericIoctlRequest &req, helix::UniqueDescriptor conversation) {
 		std::cout << "\e[31m" "libblockfs: Unknown ioctl() message with ID "
 				<< req.command() << "\e[39m" << std::endl;
@@ -35,6 +119,19 @@ struct BlockDevice {
 	const size_t sectorSize;
 	int64_t parentId = -1;
 
+	// Hints for the request queue that runDevice() puts in front of the device.
+	// Requests to rotational devices are sorted by sector.
+	bool rotational = false;
+	// Maximal number of requests that are passed to the device concurrently.
+	size_t maxQueueDepth = 32;
+	// Requests are not merged beyond this size.
+	size_t maxMergeBytes = 256 * 1024;
+	// Set if discard() actually reaches the device.
+	bool supportsDiscard = false;
+
+	// Maintained by the request queue (for disks) and by partitions.
+	IoStats ioStats;
+
 	std::string diskNamePrefix = "sd";
 	std::string diskNameSuffix = "";
 	std::string partNameSuffix = "";
@@ -46,6 +46,8 @@ struct Interface {
 	async::result<frg::expected<Error, std::vector<uint64_t>>> reportLuns();
 
 	bool enableRead6{};
+	// Number of commands that sendScsiCommand() accepts concurrently.
+	size_t maxInFlight{1};
 };
 
 struct StorageDevice : Interface, blockfs::BlockDevice {
@@ -77,7 +79,10 @@ private:
 		frg::default_list_hook<Request> requestHook;
 	};
 
+	async::detached performRequest_(Request *req);
+
 	async::recurring_event doorbell_;
+	size_t inFlight_{0};
 
 	frg::intrusive_list<
 		Request,
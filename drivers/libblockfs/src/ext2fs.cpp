@@ -3,13 +3,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
+#include <bit>
 #include <iostream>
+#include <optional>
+#include <dirent.h>
 #include <sys/stat.h>
 
 #include <async/result.hpp>
 #include <core/clock.hpp>
 #include <helix/ipc.hpp>
 #include <helix/memory.hpp>
+#include <helix/timer.hpp>
 
 #include <array>
 
@@ -23,6 +27,241 @@ namespace {
 
 	constexpr int pageShift = 12;
 	constexpr size_t pageSize = size_t{1} << pageShift;
+
+	// Dirty data written through write() is flushed at this interval (in ns)
+	// or as soon as the amount of dirty data exceeds dirtyThreshold.
+	constexpr uint64_t writebackInterval = 5'000'000'000;
+	constexpr size_t dirtyThreshold = 4 << 20;
+
+	// fsync() waits this long (in ns) for concurrent calls that can share its commit.
+	constexpr uint64_t commitWindow = 1'000'000;
+
+	// prefetchInodes() reads over gaps of up to prefetchGap pages
+	// but limits each range to maxPrefetchPages pages.
+	constexpr size_t prefetchGap = 2;
+	constexpr size_t maxPrefetchPages = 16;
+
+	template<typename E>
+	E *extentEntries(DiskExtentHeader *node) {
+		return reinterpret_cast<E *>(node + 1);
+	}
+
+	uint64_t extentStart(const DiskExtent &extent) {
+		return extent.startLo | (uint64_t{extent.startHi} << 32);
+	}
+
+	size_t extentLength(const DiskExtent &extent) {
+		if(extent.len > EXT4_EXT_INIT_MAX_LEN)
+			return extent.len - EXT4_EXT_INIT_MAX_LEN;
+		return extent.len;
+	}
+
+	uint64_t indexLeaf(const DiskExtentIndex &idx) {
+		return idx.leafLo | (uint64_t{idx.leafHi} << 32);
+	}
+
+	// Sets up an empty extent tree in a freshly created inode.
+	void initExtentRoot(DiskInode *disk_inode) {
+		disk_inode->flags |= EXT4_EXTENTS_FL;
+		auto root = reinterpret_cast<DiskExtentHeader *>(disk_inode->data.embedded);
+		root->magic = EXT4_EXT_MAGIC;
+		root->entries = 0;
+		root->max = (sizeof(FileData) - sizeof(DiskExtentHeader)) / sizeof(DiskExtent);
+		root->depth = 0;
+		root->generation = 0;
+	}
+
+	// Directory hashes; these must match the Linux implementation (fs/ext4/hash.c).
+
+	void teaTransform(uint32_t buf[4], const uint32_t in[4]) {
+		uint32_t sum = 0;
+		uint32_t b0 = buf[0], b1 = buf[1];
+		uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+		for(int n = 0; n < 16; n++) {
+			sum += 0x9E3779B9;
+			b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+			b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+		}
+		buf[0] += b0;
+		buf[1] += b1;
+	}
+
+	void halfMd4Transform(uint32_t buf[4], const uint32_t in[8]) {
+		auto f = [] (uint32_t x, uint32_t y, uint32_t z) { return z ^ (x & (y ^ z)); };
+		auto g = [] (uint32_t x, uint32_t y, uint32_t z) { return (x & y) + ((x ^ y) & z); };
+		auto h = [] (uint32_t x, uint32_t y, uint32_t z) { return x ^ y ^ z; };
+		auto round = [] (auto fn, uint32_t &a, uint32_t b, uint32_t c, uint32_t d,
+				uint32_t x, int s) {
+			a = std::rotl(a + fn(b, c, d) + x, s);
+		};
+		constexpr uint32_t k2 = 013240474631;
+		constexpr uint32_t k3 = 015666365641;
+
+		uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+		round(f, a, b, c, d, in[0], 3);
+		round(f, d, a, b, c, in[1], 7);
+		round(f, c, d, a, b, in[2], 11);
+		round(f, b, c, d, a, in[3], 19);
+		round(f, a, b, c, d, in[4], 3);
+		round(f, d, a, b, c, in[5], 7);
+		round(f, c, d, a, b, in[6], 11);
+		round(f, b, c, d, a, in[7], 19);
+
+		round(g, a, b, c, d, in[1] + k2, 3);
+		round(g, d, a, b, c, in[3] + k2, 5);
+		round(g, c, d, a, b, in[5] + k2, 9);
+		round(g, b, c, d, a, in[7] + k2, 13);
+		round(g, a, b, c, d, in[0] + k2, 3);
+		round(g, d, a, b, c, in[2] + k2, 5);
+		round(g, c, d, a, b, in[4] + k2, 9);
+		round(g, b, c, d, a, in[6] + k2, 13);
+
+		round(h, a, b, c, d, in[3] + k3, 3);
+		round(h, d, a, b, c, in[7] + k3, 9);
+		round(h, c, d, a, b, in[2] + k3, 11);
+		round(h, b, c, d, a, in[6] + k3, 15);
+		round(h, a, b, c, d, in[1] + k3, 3);
+		round(h, d, a, b, c, in[5] + k3, 9);
+		round(h, c, d, a, b, in[0] + k3, 11);
+		round(h, b, c, d, a, in[4] + k3, 15);
+
+		buf[0] += a;
+		buf[1] += b;
+		buf[2] += c;
+		buf[3] += d;
+	}
+
+	// C is either signed char or unsigned char (for the *_UNSIGNED hashes).
+	template<typename C>
+	uint32_t legacyHash(const char *name, size_t length) {
+		uint32_t hash0 = 0x12A3FE2D, hash1 = 0x37ABE8F9;
+		for(size_t i = 0; i < length; i++) {
+			uint32_t hash = hash1 + (hash0 ^ (static_cast<int>(static_cast<C>(name[i])) * 7152373));
+			if(hash & 0x80000000)
+				hash -= 0x7FFFFFFF;
+			hash1 = hash0;
+			hash0 = hash;
+		}
+		return hash0 << 1;
+	}
+
+	template<typename C>
+	void strToHashBuf(const char *msg, size_t length, uint32_t *buf, int num) {
+		uint32_t pad = static_cast<uint32_t>(length) | (static_cast<uint32_t>(length) << 8);
+		pad |= pad << 16;
+
+		uint32_t val = pad;
+		length = std::min(length, static_cast<size_t>(num) * 4);
+		for(size_t i = 0; i < length; i++) {
+			val = static_cast<int>(static_cast<C>(msg[i])) + (val << 8);
+			if((i % 4) == 3) {
+				*buf++ = val;
+				val = pad;
+				num--;
+			}
+		}
+		if(--num >= 0)
+			*buf++ = val;
+		while(--num >= 0)
+			*buf++ = pad;
+	}
+
+	uint32_t computeDirHash(const char *name, size_t length, int version,
+			const uint32_t seed[4]) {
+		uint32_t buf[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+		if(seed[0] || seed[1] || seed[2] || seed[3])
+			memcpy(buf, seed, sizeof(buf));
+
+		uint32_t in[8];
+		uint32_t hash;
+		switch(version) {
+		case EXT2_HASH_LEGACY:
+			hash = legacyHash<signed char>(name, length);
+			break;
+		case EXT2_HASH_LEGACY_UNSIGNED:
+			hash = legacyHash<unsigned char>(name, length);
+			break;
+		case EXT2_HASH_HALF_MD4:
+		case EXT2_HASH_HALF_MD4_UNSIGNED:
+			for(size_t k = 0; k < length; k += 32) {
+				if(version == EXT2_HASH_HALF_MD4) {
+					strToHashBuf<signed char>(name + k, length - k, in, 8);
+				}else{
+					strToHashBuf<unsigned char>(name + k, length - k, in, 8);
+				}
+				halfMd4Transform(buf, in);
+			}
+			hash = buf[1];
+			break;
+		case EXT2_HASH_TEA:
+		case EXT2_HASH_TEA_UNSIGNED:
+			for(size_t k = 0; k < length; k += 16) {
+				if(version == EXT2_HASH_TEA) {
+					strToHashBuf<signed char>(name + k, length - k, in, 4);
+				}else{
+					strToHashBuf<unsigned char>(name + k, length - k, in, 4);
+				}
+				teaTransform(buf, in);
+			}
+			hash = buf[0];
+			break;
+		default:
+			assert(!"unexpected hash version");
+			abort();
+		}
+
+		// The lowest bit marks hash collisions in the index; 0xFFFFFFFE marks the end.
+		hash &= ~uint32_t{1};
+		if(hash == (0x7FFFFFFF << 1))
+			hash = (0x7FFFFFFF - 1) << 1;
+		return hash;
+	}
+
+	// Number of entries that fit into an index node or the root block.
+	constexpr size_t dxNodeHeader = 8;
+	constexpr size_t dxRootHeader = 24 + sizeof(DiskDxRootInfo);
+	// We do not support the large_dir feature.
+	constexpr int maxDxLevels = 2;
+
+	uint32_t dxBlock(const DiskDxEntry &entry) {
+		return entry.block & 0x00FFFFFF;
+	}
+
+	DiskDxCountLimit *dxCountLimit(DiskDxEntry *entries) {
+		return reinterpret_cast<DiskDxCountLimit *>(entries);
+	}
+
+	// Inserts an entry after frame.at; the node must have room.
+	void insertDxEntry(Inode::DxFrame &frame, uint32_t hash, uint32_t block) {
+		auto countLimit = dxCountLimit(frame.entries);
+		assert(countLimit->count < countLimit->limit);
+		auto pos = frame.at + 1;
+		memmove(pos + 1, pos, (frame.entries + countLimit->count - pos) * sizeof(DiskDxEntry));
+		pos->hash = hash;
+		pos->block = block;
+		countLimit->count++;
+	}
+
+	// Rewrites a directory block such that it contains the given entries; the last entry
+	// covers the rest of the block. The entries must not point into the block itself.
+	void packDirBlock(char *block, size_t blockSize, const std::vector<const DiskDirEntry *> &entries) {
+		memset(block, 0, blockSize);
+		auto last = reinterpret_cast<DiskDirEntry *>(block);
+		size_t offset = 0;
+		for(auto entry : entries) {
+			auto length = (sizeof(DiskDirEntry) + entry->nameLength + 3) & ~size_t(3);
+			last = reinterpret_cast<DiskDirEntry *>(block + offset);
+			memcpy(last, entry, sizeof(DiskDirEntry) + entry->nameLength);
+			last->recordLength = length;
+			offset += length;
+		}
+		if(entries.empty()) {
+			last->recordLength = blockSize;
+		}else{
+			last->recordLength += blockSize - offset;
+		}
+	}
 }
 
 // --------------------------------------------------------
@@ -53,42 +292,353 @@ Inode::findEntry(std::string name) {
 	co_await submit.async_wait();
 	HEL_CHECK(lock_memory.error());
 
-	// Read the directory structure.
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
+	auto disk_entry = findDiskEntry(name, nullptr);
+	if(!disk_entry)
+		co_return std::nullopt;
+
+	DirEntry entry;
+	entry.inode = disk_entry->inode;
+
+	switch(disk_entry->fileType) {
+	case EXT2_FT_REG_FILE:
+		entry.fileType = kTypeRegular; break;
+	case EXT2_FT_DIR:
+		entry.fileType = kTypeDirectory; break;
+	case EXT2_FT_SYMLINK:
+		entry.fileType = kTypeSymlink; break;
+	default:
+		entry.fileType = kTypeNone;
+	}
+
+	co_return entry;
+}
+
+DiskDirEntry *Inode::findDiskEntry(const std::string &name, DiskDirEntry **previous) {
+	uint32_t hash;
+	DxFrame frames[maxDxLevels];
+	if(auto levels = probeIndex(name, hash, frames); levels) {
+		do {
+			auto entry = searchDirBlock(dxBlock(*frames[levels - 1].at), name, previous);
+			if(entry)
+				return entry;
+		} while(nextIndexLeaf(hash, frames, levels));
+		return nullptr;
+	}
+
+	assert(!(fileSize() & (fs.blockSize - 1)));
+	for(uint32_t block = 0; block < (fileSize() >> fs.blockShift); block++) {
+		auto entry = searchDirBlock(block, name, previous);
+		if(entry)
+			return entry;
+	}
+	return nullptr;
+}
+
+DiskDirEntry *Inode::searchDirBlock(uint32_t block, const std::string &name,
+		DiskDirEntry **previous) {
+	auto base = reinterpret_cast<char *>(fileMapping.get()) + (size_t{block} << fs.blockShift);
+
+	DiskDirEntry *previous_entry = nullptr;
+	size_t offset = 0;
+	while(offset < fs.blockSize) {
 		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(fileMapping.get()) + offset);
+		auto disk_entry = reinterpret_cast<DiskDirEntry *>(base + offset);
 		assert(disk_entry->recordLength);
 
 		if(disk_entry->inode
 				&& name.length() == disk_entry->nameLength
 				&& !memcmp(disk_entry->name, name.data(), name.length())) {
-			DirEntry entry;
-			entry.inode = disk_entry->inode;
-
-			switch(disk_entry->fileType) {
-			case EXT2_FT_REG_FILE:
-				entry.fileType = kTypeRegular; break;
-			case EXT2_FT_DIR:
-				entry.fileType = kTypeDirectory; break;
-			case EXT2_FT_SYMLINK:
-				entry.fileType = kTypeSymlink; break;
-			default:
-				entry.fileType = kTypeNone;
-			}
-
-			co_return entry;
+			if(previous)
+				*previous = previous_entry;
+			return disk_entry;
 		}
 
 		offset += disk_entry->recordLength;
+		previous_entry = disk_entry;
+	}
+	assert(offset == fs.blockSize);
+
+	return nullptr;
+}
+
+std::optional<std::pair<size_t, size_t>> Inode::findDirSlot(uint32_t block, size_t required) {
+	size_t offset = size_t{block} << fs.blockShift;
+	size_t end = offset + fs.blockSize;
+	while(offset < end) {
+		assert(!(offset & 3));
+		auto previous_entry = reinterpret_cast<DiskDirEntry *>(
+				reinterpret_cast<char *>(fileMapping.get()) + offset);
+		assert(previous_entry->recordLength);
+
+		// Reuse unused entries (e.g., the first entry of a block after unlink()).
+		if(!previous_entry->inode && previous_entry->recordLength >= required)
+			return std::pair<size_t, size_t>{offset, previous_entry->recordLength};
+
+		// Calculate available space after we contract previous_entry.
+		auto contracted = (sizeof(DiskDirEntry) + previous_entry->nameLength + 3) & ~size_t(3);
+		assert(previous_entry->recordLength >= contracted);
+		auto available = previous_entry->recordLength - contracted;
+
+		// Check whether we can shrink previous_entry and insert a new entry after it.
+		if(previous_entry->inode && available >= required) {
+			previous_entry->recordLength = contracted;
+			return std::pair<size_t, size_t>{offset + contracted, available};
+		}
+
+		offset += previous_entry->recordLength;
+	}
+	assert(offset == end);
+
+	return std::nullopt;
+}
+
+async::result<uint32_t> Inode::growDirectory(std::vector<helix::UniqueDescriptor> &locks) {
+	auto offset = fileSize();
+	assert(!(offset & (fs.blockSize - 1)));
+
+	auto block = offset >> fs.blockShift;
+	auto newSize = offset + fs.blockSize;
+	setFileSize(newSize);
+	co_await fs.assignDataBlocks(this, block, 1);
+	HEL_CHECK(helResizeMemory(backingMemory, (newSize + 0xFFF) & ~size_t(0xFFF)));
+	fileMapping = helix::Mapping{helix::BorrowedDescriptor{frontalMemory},
+			0, newSize,
+			kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+
+	helix::LockMemoryView lock_memory;
+	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
+			&lock_memory,
+			0, (newSize + 0xFFF) & ~size_t(0xFFF), helix::Dispatcher::global());
+	co_await submit.async_wait();
+	HEL_CHECK(lock_memory.error());
+	locks.push_back(lock_memory.descriptor());
+
+	co_return block;
+}
+
+uint32_t Inode::dirHash(const char *name, size_t length) {
+	auto info = reinterpret_cast<DiskDxRootInfo *>(
+			reinterpret_cast<char *>(fileMapping.get()) + 24);
+	int version = info->hashVersion;
+	if(fs.unsignedHash)
+		version += EXT2_HASH_LEGACY_UNSIGNED;
+	return computeDirHash(name, length, version, fs.hashSeed);
+}
+
+int Inode::probeIndex(const std::string &name, uint32_t &hash, DxFrame *frames) {
+	if(!(diskInode()->flags & EXT2_INDEX_FL) || fileSize() < 2 * fs.blockSize)
+		return 0;
+
+	auto base = reinterpret_cast<char *>(fileMapping.get());
+	auto info = reinterpret_cast<DiskDxRootInfo *>(base + 24);
+	if(info->reservedZero || info->infoLength != sizeof(DiskDxRootInfo)
+			|| info->hashVersion > EXT2_HASH_TEA
+			|| info->indirectLevels >= maxDxLevels)
+		return 0;
+	hash = dirHash(name.data(), name.length());
+
+	auto entries = reinterpret_cast<DiskDxEntry *>(base + dxRootHeader);
+	int levels = 0;
+	while(true) {
+		auto countLimit = dxCountLimit(entries);
+		if(!countLimit->count || countLimit->count > countLimit->limit)
+			return 0;
+
+		// Find the last entry that starts at or below the hash.
+		auto at = std::upper_bound(entries + 1, entries + countLimit->count, hash,
+				[] (uint32_t h, const DiskDxEntry &entry) {
+			return h < entry.hash;
+		}) - 1;
+		frames[levels++] = {entries, at};
+
+		if((size_t{dxBlock(*at)} + 1) << fs.blockShift > fileSize())
+			return 0;
+		if(levels > info->indirectLevels)
+			return levels;
+		entries = reinterpret_cast<DiskDxEntry *>(base
+				+ (size_t{dxBlock(*at)} << fs.blockShift) + dxNodeHeader);
+	}
+}
+
+bool Inode::nextIndexLeaf(uint32_t hash, DxFrame *frames, int levels) {
+	auto base = reinterpret_cast<char *>(fileMapping.get());
+
+	int k = levels - 1;
+	while(true) {
+		frames[k].at++;
+		if(frames[k].at < frames[k].entries + dxCountLimit(frames[k].entries)->count)
+			break;
+		if(!k)
+			return false;
+		k--;
+	}
+
+	// The low bit of the hash is set if the next leaf continues the same hash.
+	if((frames[k].at->hash & ~uint32_t{1}) != hash)
+		return false;
+
+	for(; k + 1 < levels; k++) {
+		auto entries = reinterpret_cast<DiskDxEntry *>(base
+				+ (size_t{dxBlock(*frames[k].at)} << fs.blockShift) + dxNodeHeader);
+		frames[k + 1] = {entries, entries};
+	}
+	return true;
+}
+
+async::result<std::optional<std::pair<size_t, size_t>>>
+Inode::findIndexedSlot(const std::string &name, size_t required,
+		std::vector<helix::UniqueDescriptor> &locks) {
+	// Each iteration either finds a slot or restructures the index once.
+	for(int attempt = 0; attempt < 4 * maxDxLevels; attempt++) {
+		uint32_t hash;
+		DxFrame frames[maxDxLevels];
+		auto levels = probeIndex(name, hash, frames);
+		if(!levels)
+			co_return std::nullopt;
+
+		auto leaf = dxBlock(*frames[levels - 1].at);
+		if(auto slot = findDirSlot(leaf, required); slot)
+			co_return slot;
+
+		// Make sure that the index node above the leaf has room for another entry.
+		auto parentCount = dxCountLimit(frames[levels - 1].entries);
+		if(parentCount->count == parentCount->limit) {
+			auto rootCount = dxCountLimit(frames[0].entries);
+			if(levels == 1) {
+				// Move the entries of the root into a new node.
+				auto block = co_await growDirectory(locks);
+				auto base = reinterpret_cast<char *>(fileMapping.get());
+				auto info = reinterpret_cast<DiskDxRootInfo *>(base + 24);
+				auto root = reinterpret_cast<DiskDxEntry *>(base + dxRootHeader);
+				auto node = base + (size_t{block} << fs.blockShift);
+
+				memset(node, 0, fs.blockSize);
+				reinterpret_cast<DiskDirEntry *>(node)->recordLength = fs.blockSize;
+				auto entries = reinterpret_cast<DiskDxEntry *>(node + dxNodeHeader);
+				memcpy(entries, root, dxCountLimit(root)->count * sizeof(DiskDxEntry));
+				dxCountLimit(entries)->limit = (fs.blockSize - dxNodeHeader) / sizeof(DiskDxEntry);
+
+				dxCountLimit(root)->count = 1;
+				root[0].block = block;
+				info->indirectLevels = 1;
+			}else if(rootCount->count < rootCount->limit) {
+				// Split the node and add the upper half to the root.
+				auto block = co_await growDirectory(locks);
+				levels = probeIndex(name, hash, frames);
+				assert(levels == 2);
+				auto base = reinterpret_cast<char *>(fileMapping.get());
+				auto node = base + (size_t{block} << fs.blockShift);
+				auto full = frames[1].entries;
+				auto count = dxCountLimit(full)->count;
+				auto split = count / 2;
+
+				memset(node, 0, fs.blockSize);
+				reinterpret_cast<DiskDirEntry *>(node)->recordLength = fs.blockSize;
+				auto entries = reinterpret_cast<DiskDxEntry *>(node + dxNodeHeader);
+				auto key = full[split].hash;
+				memcpy(entries, full + split, (count - split) * sizeof(DiskDxEntry));
+				dxCountLimit(entries)->limit = (fs.blockSize - dxNodeHeader) / sizeof(DiskDxEntry);
+				dxCountLimit(entries)->count = count - split;
+				dxCountLimit(full)->count = split;
+
+				insertDxEntry(frames[0], key, block);
+			}else{
+				// The index is full.
+				co_return std::nullopt;
+			}
+		}else{
+			// Split the leaf: move the upper half of its entries (sorted by hash) to a new block.
+			auto block = co_await growDirectory(locks);
+			levels = probeIndex(name, hash, frames);
+			assert(levels);
+			auto base = reinterpret_cast<char *>(fileMapping.get());
+			auto leafBase = base + (size_t{leaf} << fs.blockShift);
+
+			std::vector<char> copy(leafBase, leafBase + fs.blockSize);
+			std::vector<std::pair<uint32_t, const DiskDirEntry *>> sorted;
+			for(size_t offset = 0; offset < fs.blockSize; ) {
+				auto entry = reinterpret_cast<const DiskDirEntry *>(copy.data() + offset);
+				if(entry->inode)
+					sorted.push_back({dirHash(entry->name, entry->nameLength), entry});
+				offset += entry->recordLength;
+			}
+			if(sorted.size() < 2)
+				co_return std::nullopt;
+			std::stable_sort(sorted.begin(), sorted.end(), [] (auto &a, auto &b) {
+				return a.first < b.first;
+			});
+
+			auto split = sorted.size() / 2;
+			auto key = sorted[split].first;
+			bool continued = key == sorted[split - 1].first;
+
+			std::vector<const DiskDirEntry *> lower, upper;
+			for(size_t i = 0; i < sorted.size(); i++)
+				(i < split ? lower : upper).push_back(sorted[i].second);
+			packDirBlock(leafBase, fs.blockSize, lower);
+			packDirBlock(base + (size_t{block} << fs.blockShift), fs.blockSize, upper);
+
+			insertDxEntry(frames[levels - 1], key | continued, block);
+		}
+
+		auto syncDir = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle}, fileMapping.get(), fileSize());
+		HEL_CHECK(syncDir.error());
 	}
-	assert(offset == fileSize());
 
 	co_return std::nullopt;
 }
 
+async::result<bool> Inode::makeIndexed(std::vector<helix::UniqueDescriptor> &locks) {
+	assert(fileSize() == fs.blockSize);
+
+	// The root block keeps "." and ".."; the index is stored in the space of "..".
+	auto dot = reinterpret_cast<DiskDirEntry *>(fileMapping.get());
+	auto dotDot = reinterpret_cast<DiskDirEntry *>(
+			reinterpret_cast<char *>(fileMapping.get()) + 12);
+	if(dot->recordLength != 12 || dotDot->nameLength != 2 || memcmp(dotDot->name, "..", 2))
+		co_return false;
+
+	std::vector<char> copy(reinterpret_cast<char *>(fileMapping.get()),
+			reinterpret_cast<char *>(fileMapping.get()) + fs.blockSize);
+	std::vector<const DiskDirEntry *> entries;
+	size_t offset = 12 + dotDot->recordLength;
+	while(offset < fs.blockSize) {
+		auto entry = reinterpret_cast<const DiskDirEntry *>(copy.data() + offset);
+		if(entry->inode)
+			entries.push_back(entry);
+		offset += entry->recordLength;
+	}
+
+	auto block = co_await growDirectory(locks);
+	assert(block == 1);
+	auto base = reinterpret_cast<char *>(fileMapping.get());
+	packDirBlock(base + fs.blockSize, fs.blockSize, entries);
+
+	dotDot = reinterpret_cast<DiskDirEntry *>(base + 12);
+	dotDot->recordLength = fs.blockSize - 12;
+	memset(base + 24, 0, fs.blockSize - 24);
+	auto info = reinterpret_cast<DiskDxRootInfo *>(base + 24);
+	info->hashVersion = fs.defHashVersion;
+	info->infoLength = sizeof(DiskDxRootInfo);
+	auto root = reinterpret_cast<DiskDxEntry *>(base + dxRootHeader);
+	dxCountLimit(root)->limit = (fs.blockSize - dxRootHeader) / sizeof(DiskDxEntry);
+	dxCountLimit(root)->count = 1;
+	root[0].block = block;
+
+	auto syncDir = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle}, fileMapping.get(), fileSize());
+	HEL_CHECK(syncDir.error());
+
+	diskInode()->flags |= EXT2_INDEX_FL;
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			diskMapping.get(), fs.inodeSize);
+	HEL_CHECK(syncInode.error());
+
+	co_return true;
+}
+
 async::result<std::optional<DirEntry>>
 Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 	assert(!name.empty() && name != "." && name != "..");
@@ -135,6 +685,7 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 		target->diskInode()->linksCount++;
 
 		// Flush the target inode to disk.
+		fs.revokeLease(target->number);
 		auto syncInode = co_await helix_ng::synchronizeSpace(
 				helix::BorrowedDescriptor{kHelNullHandle},
 				target->diskMapping.get(), fs.inodeSize);
@@ -146,17 +697,22 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 		co_return entry;
 	};
 
-	helix::LockMemoryView lock_memory;
-	auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
+	std::vector<helix::UniqueDescriptor> locks;
+	{
+		helix::LockMemoryView lock_memory;
+		auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
+		auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
+				&lock_memory,
+				0, map_size, helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(lock_memory.error());
+		locks.push_back(lock_memory.descriptor());
+	}
 
 	auto time = clk::getRealtime();
 	diskInode()->mtime = time.tv_sec;
 
+	fs.revokeLease(number);
 	auto syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
 			diskMapping.get(), fs.inodeSize);
@@ -166,53 +722,48 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 	// We use name.size() + 1 for the entry name length to account for the null terminator
 	auto required = (sizeof(DiskDirEntry) + name.size() + 1 + 3) & ~size_t(3);
 
-	// Walk the directory structure.
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
-		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto previous_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(fileMapping.get()) + offset);
-		assert(previous_entry->recordLength);
+	// For hashed directories, only the leaf that the index points to is considered.
+	if(diskInode()->flags & EXT2_INDEX_FL) {
+		auto slot = co_await findIndexedSlot(name, required, locks);
+		if(slot)
+			co_return co_await appendDirEntry(slot->first, slot->second);
 
-		// Calculate available space after we contract previous_entry.
-		auto contracted = (sizeof(DiskDirEntry) + previous_entry->nameLength + 3) & ~size_t(3);
-		assert(previous_entry->recordLength >= contracted);
-		auto available = previous_entry->recordLength - contracted;
+		// We cannot keep the index consistent; drop it such that other
+		// implementations fall back to linear lookups.
+		diskInode()->flags &= ~EXT2_INDEX_FL;
+		syncInode = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle},
+				diskMapping.get(), fs.inodeSize);
+		HEL_CHECK(syncInode.error());
+	}
 
-		// Check whether we can shrink previous_entry and insert a new entry after it.
-		if(available >= required) {
-			// Update the existing dentry.
-			previous_entry->recordLength = contracted;
+	// Walk the directory structure.
+	assert(!(fileSize() & (fs.blockSize - 1)));
+	for(uint32_t block = 0; block < (fileSize() >> fs.blockShift); block++) {
+		if(auto slot = findDirSlot(block, required); slot)
+			co_return co_await appendDirEntry(slot->first, slot->second);
+	}
 
-			co_return co_await appendDirEntry(offset + contracted, available);
-		}
+	// Directories that outgrow a single block are converted to hashed directories.
+	if((fs.featureCompat & EXT2_FEATURE_COMPAT_DIR_INDEX)
+			&& fileSize() == fs.blockSize
+			&& co_await makeIndexed(locks)) {
+		auto slot = co_await findIndexedSlot(name, required, locks);
+		if(slot)
+			co_return co_await appendDirEntry(slot->first, slot->second);
 
-		offset += previous_entry->recordLength;
+		diskInode()->flags &= ~EXT2_INDEX_FL;
+		syncInode = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle},
+				diskMapping.get(), fs.inodeSize);
+		HEL_CHECK(syncInode.error());
 	}
-	assert(offset == fileSize());
 
 	// If we made it this far, we ran out of space in the directory. Resize it.
-	auto blockOffset = (offset & ~(fs.blockSize - 1)) >> fs.blockShift;
-	auto newSize = (offset + fs.blockSize + 0xFFF) & ~size_t(0xFFF);
-	setFileSize(newSize);
-	co_await fs.assignDataBlocks(this, blockOffset, 1);
-	HEL_CHECK(helResizeMemory(backingMemory, newSize));
-	fileMapping = helix::Mapping{helix::BorrowedDescriptor{frontalMemory},
-			0, newSize,
-			kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+	auto block = co_await growDirectory(locks);
 
 	// Now append the entry that we couldn't add before.
-	{
-		helix::LockMemoryView lock_memory;
-		auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-				&lock_memory,
-				0, newSize, helix::Dispatcher::global());
-		co_await submit.async_wait();
-		HEL_CHECK(lock_memory.error());
-
-		co_return co_await appendDirEntry(offset, fileSize() - offset);
-	}
+	co_return co_await appendDirEntry(size_t{block} << fs.blockShift, fs.blockSize);
 }
 
 async::result<frg::expected<protocols::fs::Error>> Inode::unlink(std::string name) {
@@ -232,89 +783,77 @@ async::result<frg::expected<protocols::fs::Error>> Inode::unlink(std::string nam
 	co_await submit.async_wait();
 	HEL_CHECK(lock_memory.error());
 
-	// Read the directory structure.
 	DiskDirEntry *previous_entry = nullptr;
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
-		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(fileMapping.get()) + offset);
-		assert(disk_entry->recordLength);
-
-		if(disk_entry->inode
-				&& name.length() == disk_entry->nameLength
-				&& !memcmp(disk_entry->name, name.data(), name.length())) {
+	auto disk_entry = findDiskEntry(name, &previous_entry);
+	if(disk_entry) {
+		auto target = fs.accessInode(disk_entry->inode);
+		co_await target->readyJump.wait();
 
-			auto target = fs.accessInode(disk_entry->inode);
-			co_await target->readyJump.wait();
+		if(target->fileType == kTypeDirectory) {
+			if(target->diskInode()->linksCount > 2) {
+				co_return protocols::fs::Error::directoryNotEmpty;
+			}
 
-			if(target->fileType == kTypeDirectory) {
-				if(target->diskInode()->linksCount > 2) {
+			helix::LockMemoryView target_lock_memory;
+			auto target_map_size = (target->fileSize() + 0xFFF) & ~size_t(0xFFF);
+			auto &&target_submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(target->frontalMemory),
+					&target_lock_memory,
+					0, target_map_size, helix::Dispatcher::global());
+			co_await target_submit.async_wait();
+			HEL_CHECK(target_lock_memory.error());
+
+			// Check the directory entries for anything other than "." and "..".
+			uintptr_t target_offset = 0;
+			while(target_offset < target->fileSize()) {
+				assert(!(target_offset & 3));
+				assert(target_offset + sizeof(DiskDirEntry) <= target->fileSize());
+				auto target_disk_entry = reinterpret_cast<DiskDirEntry *>(
+					reinterpret_cast<char*>(target->fileMapping.get()) + target_offset);
+				assert(target_disk_entry);
+				assert(target_disk_entry->recordLength);
+
+				if(!target_disk_entry->inode) {
+					// Unused entry (also used by hashed directories for index blocks).
+				} else if(target_disk_entry->nameLength == 2
+					&& target_disk_entry->name[0] == '.'
+					&& target_disk_entry->name[1] == '.') {
+					// ".."
+				} else if(target_disk_entry->nameLength == 1
+					&& target_disk_entry->name[0] == '.') {
+					// "."
+				} else {
+					// Directory has stuff in it, do not delete it.
 					co_return protocols::fs::Error::directoryNotEmpty;
 				}
 
-				helix::LockMemoryView target_lock_memory;
-				auto target_map_size = (target->fileSize() + 0xFFF) & ~size_t(0xFFF);
-				auto &&target_submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(target->frontalMemory),
-						&target_lock_memory,
-						0, target_map_size, helix::Dispatcher::global());
-				co_await target_submit.async_wait();
-				HEL_CHECK(target_lock_memory.error());
-
-				// Check the directory entries for anything other than "." and "..".
-				uintptr_t target_offset = 0;
-				while(target_offset < target->fileSize()) {
-					assert(!(target_offset & 3));
-					assert(target_offset + sizeof(DiskDirEntry) <= target->fileSize());
-					auto target_disk_entry = reinterpret_cast<DiskDirEntry *>(
-						reinterpret_cast<char*>(target->fileMapping.get()) + target_offset);
-					assert(target_disk_entry);
-					assert(target_disk_entry->recordLength);
-
-					if(target_disk_entry->inode
-						&& target_disk_entry->nameLength == 2
-						&& target_disk_entry->name[0] == '.'
-						&& target_disk_entry->name[1] == '.') {
-						// ".."
-					} else if(target_disk_entry->inode
-						&& target_disk_entry->nameLength == 1
-						&& target_disk_entry->name[0] == '.') {
-						// "."
-					} else {
-						// Directory has stuff in it, do not delete it.
-						co_return protocols::fs::Error::directoryNotEmpty;
-					}
-
-					target_offset += target_disk_entry->recordLength;
-				}
+				target_offset += target_disk_entry->recordLength;
 			}
+		}
 
-			// The directory should start with "." and "..". As those entries are never deleted,
-			// we can assume that a previous entry exists.
-			assert(previous_entry);
+		// Merge the entry into the previous one of the same block.
+		// Entries at the start of a block are marked as unused instead.
+		if(previous_entry) {
 			previous_entry->recordLength += disk_entry->recordLength;
+		}else{
+			disk_entry->inode = 0;
+		}
 
-			// Flush the data to disk.
-			// TODO: It would be enough to flush only one or two pages here.
-			auto syncDir = co_await helix_ng::synchronizeSpace(
-					helix::BorrowedDescriptor{kHelNullHandle}, fileMapping.get(), fileSize());
-			HEL_CHECK(syncDir.error());
-
-			// Decrement the inode's link count
-			target->diskInode()->linksCount--;
-			auto syncInode = co_await helix_ng::synchronizeSpace(
-					helix::BorrowedDescriptor{kHelNullHandle},
-					target->diskMapping.get(), fs.inodeSize);
-			HEL_CHECK(syncInode.error());
+		// Flush the data to disk.
+		// TODO: It would be enough to flush only one or two pages here.
+		auto syncDir = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle}, fileMapping.get(), fileSize());
+		HEL_CHECK(syncDir.error());
 
-			co_return {};
-		}
+		// Decrement the inode's link count
+		target->diskInode()->linksCount--;
+		fs.revokeLease(target->number);
+		auto syncInode = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle},
+				target->diskMapping.get(), fs.inodeSize);
+		HEL_CHECK(syncInode.error());
 
-		offset += disk_entry->recordLength;
-		previous_entry = disk_entry;
+		co_return {};
 	}
-	assert(offset == fileSize());
 
 	co_return protocols::fs::Error::fileNotFound;
 }
@@ -374,6 +913,7 @@ async::result<std::optional<DirEntry>> Inode::mkdir(std::string name) {
 	memcpy(dotDotEntry->name, "..", 3);
 
 	// Synchronize this inode to update the linksCount
+	fs.revokeLease(number);
 	syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
 			diskMapping.get(), fs.inodeSize);
@@ -413,6 +953,7 @@ async::result<protocols::fs::Error> Inode::chmod(int mode) {
 
 	diskInode()->mode = (diskInode()->mode & 0xFFFFF000) | mode;
 
+	fs.revokeLease(number);
 	auto syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
 			diskMapping.get(), fs.inodeSize);
@@ -430,6 +971,7 @@ async::result<protocols::fs::Error> Inode::utimensat(std::optional<timespec> ati
 		diskInode()->mtime = mtime->tv_sec;
 	diskInode()->ctime = ctime.tv_sec;
 
+	fs.revokeLease(number);
 	auto syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
 			diskMapping.get(), fs.inodeSize);
@@ -461,14 +1003,39 @@ async::result<void> FileSystem::init() {
 	sectorsPerBlock = blockSize / 512;
 	blocksPerGroup = sb.blocksPerGroup;
 	inodesPerGroup = sb.inodesPerGroup;
-	blocksCount = sb.blocksCount;
 	inodesCount = sb.inodesCount;
-	numBlockGroups = (sb.blocksCount + (sb.blocksPerGroup - 1)) / sb.blocksPerGroup;
+	featureCompat = sb.revLevel ? sb.featureCompat : 0;
+	featureIncompat = sb.revLevel ? sb.featureIncompat : 0;
+	memcpy(hashSeed, sb.hashSeed, sizeof(hashSeed));
+	defHashVersion = sb.defHashVersion <= EXT2_HASH_TEA ? sb.defHashVersion : EXT2_HASH_HALF_MD4;
+	unsignedHash = sb.flags & EXT2_FLAGS_UNSIGNED_HASH;
+	if(featureIncompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+		blocksCount = sb.blocksCount | (uint64_t{sb.blocksCountHi} << 32);
+		groupDescSize = sb.descSize;
+		assert(groupDescSize >= sizeof(DiskGroupDesc) + sizeof(DiskGroupDescHi));
+	}else{
+		blocksCount = sb.blocksCount;
+		groupDescSize = sizeof(DiskGroupDesc);
+	}
+	numBlockGroups = (blocksCount + (sb.blocksPerGroup - 1)) / sb.blocksPerGroup;
+	blockGroupHints.resize(numBlockGroups, 0);
+
+	// flex_bg only changes the placement of the group metadata, which we always
+	// look up in the descriptors; all other features affect the on-disk format.
+	constexpr uint32_t supportedIncompat = EXT2_FEATURE_INCOMPAT_FILETYPE
+			| EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_64BIT
+			| EXT4_FEATURE_INCOMPAT_FLEX_BG;
+	if(featureIncompat & ~supportedIncompat)
+		std::cout << "\e[33m" "ext2fs: Unsupported r/w-required features: "
+				<< (featureIncompat & ~supportedIncompat) << "\e[39m" << std::endl;
+	if(sb.revLevel && (sb.featureRoCompat & (EXT4_FEATURE_RO_COMPAT_GDT_CSUM
+			| EXT4_FEATURE_RO_COMPAT_METADATA_CSUM)))
+		std::cout << "\e[33m" "ext2fs: Checksums are not updated on writes" "\e[39m" << std::endl;
 
 	if(logSuperblock) {
 		std::cout << "ext2fs: Revision is: " << sb.revLevel << std::endl;
 		std::cout << "ext2fs: Block size is: " << blockSize << std::endl;
-		std::cout << "ext2fs:     There are " << sb.blocksCount << " blocks" << std::endl;
+		std::cout << "ext2fs:     There are " << blocksCount << " blocks" << std::endl;
 		std::cout << "ext2fs: Inode size is: " << inodeSize << std::endl;
 		std::cout << "ext2fs:     There are " << sb.inodesCount << " blocks" << std::endl;
 		std::cout << "ext2fs:     First available inode is: " << sb.firstIno << std::endl;
@@ -480,8 +1047,7 @@ async::result<void> FileSystem::init() {
 		std::cout << "ext2fs:     Inodes per group: " << inodesPerGroup << std::endl;
 	}
 
-	blockGroupDescriptorBuffer.resize((numBlockGroups * sizeof(DiskGroupDesc) + 511) & ~size_t(511));
-	bgdt = (DiskGroupDesc *)blockGroupDescriptorBuffer.data();
+	blockGroupDescriptorBuffer.resize((numBlockGroups * groupDescSize + 511) & ~size_t(511));
 
 	auto bgdt_offset = (2048 + blockSize - 1) & ~size_t(blockSize - 1);
 	co_await device->readSectors((bgdt_offset >> blockShift) * sectorsPerBlock,
@@ -510,6 +1076,8 @@ async::result<void> FileSystem::init() {
 
 	manageInodeTable(helix::UniqueDescriptor{inode_table_backing});
 
+	runWriteback();
+
 	co_return;
 }
 
@@ -522,7 +1090,7 @@ async::detached FileSystem::manageBlockBitmap(helix::UniqueDescriptor memory) {
 		HEL_CHECK(manage.error());
 
 		auto bg_idx = manage.offset() >> blockPagesShift;
-		auto block = bgdt[bg_idx].blockBitmap;
+		auto block = groupBlockBitmap(bg_idx);
 		assert(block);
 
 		assert(!(manage.offset() & ((1 << blockPagesShift) - 1))
@@ -559,7 +1127,7 @@ async::detached FileSystem::manageInodeBitmap(helix::UniqueDescriptor memory) {
 		HEL_CHECK(manage.error());
 
 		auto bg_idx = manage.offset() >> blockPagesShift;
-		auto block = bgdt[bg_idx].inodeBitmap;
+		auto block = groupInodeBitmap(bg_idx);
 		assert(block);
 
 		assert(!(manage.offset() & ((1 << blockPagesShift) - 1))
@@ -603,7 +1171,7 @@ async::detached FileSystem::manageInodeTable(helix::UniqueDescriptor memory) {
 		// TODO: Use shifts instead of division.
 		auto bg_idx = manage.offset() / (inodesPerGroup * inodeSize);
 		auto bg_offset = manage.offset() % (inodesPerGroup * inodeSize);
-		auto block = bgdt[bg_idx].inodeTable;
+		auto block = groupInodeTable(bg_idx);
 		assert(block);
 
 		if(manage.type() == kHelManageInitialize) {
@@ -649,6 +1217,71 @@ auto FileSystem::accessInode(uint32_t number) -> std::shared_ptr<Inode> {
 	return new_inode;
 }
 
+void FileSystem::prefetchInodes(std::vector<uint32_t> numbers) {
+	auto groupSize = size_t{inodesPerGroup} * inodeSize;
+
+	std::vector<size_t> pages;
+	for(auto number : numbers) {
+		assert(number > 0);
+		// Inodes that are in use are already loaded.
+		auto it = activeInodes.find(number);
+		if(it != activeInodes.end() && !it->second.expired())
+			continue;
+		pages.push_back((size_t{number - 1} * inodeSize) >> pageShift);
+	}
+	std::ranges::sort(pages);
+	pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+	size_t i = 0;
+	while(i < pages.size()) {
+		auto first = pages[i];
+		auto last = first;
+		// manageInodeTable() expects requests within a single block group.
+		auto group = (first << pageShift) / groupSize;
+		while(++i < pages.size()) {
+			if(pages[i] - last > prefetchGap || pages[i] - first >= maxPrefetchPages
+					|| (pages[i] << pageShift) / groupSize != group)
+				break;
+			last = pages[i];
+		}
+
+		[] (FileSystem *self, size_t offset, size_t size) -> async::detached {
+			// Locking the range makes the kernel initialize it; the pages stay cached.
+			helix::LockMemoryView lock_table;
+			auto &&submit = helix::submitLockMemoryView(self->inodeTable,
+					&lock_table, offset, size, helix::Dispatcher::global());
+			co_await submit.async_wait();
+			HEL_CHECK(lock_table.error());
+		}(this, first << pageShift, (last - first + 1) << pageShift);
+	}
+}
+
+bool FileSystem::grantLease(uint32_t number) {
+	if(!watchingLeases)
+		return false;
+	leasedInodes.insert(number);
+	return true;
+}
+
+void FileSystem::revokeLease(uint32_t number) {
+	if(!leasedInodes.erase(number))
+		return;
+	revokedLeases.push_back(number);
+	leasesRevoked.raise();
+}
+
+async::result<std::vector<int64_t>> FileSystem::waitForRevokedLeases(size_t max) {
+	watchingLeases = true;
+	while(revokedLeases.empty())
+		co_await leasesRevoked.async_wait();
+
+	std::vector<int64_t> inodes;
+	auto n = std::min(max, revokedLeases.size());
+	inodes.assign(revokedLeases.begin(), revokedLeases.begin() + n);
+	revokedLeases.erase(revokedLeases.begin(), revokedLeases.begin() + n);
+	co_return inodes;
+}
+
 async::result<std::shared_ptr<Inode>> FileSystem::createRegular(int uid, int gid) {
 	auto ino = co_await allocateInode();
 	assert(ino);
@@ -673,6 +1306,8 @@ async::result<std::shared_ptr<Inode>> FileSystem::createRegular(int uid, int gid
 	memset(disk_inode, 0, inodeSize);
 	disk_inode->mode = EXT2_S_IFREG;
 	disk_inode->generation = generation + 1;
+	if(featureIncompat & EXT4_FEATURE_INCOMPAT_EXTENTS)
+		initExtentRoot(disk_inode);
 	struct timespec time = clk::getRealtime();
 	disk_inode->atime = time.tv_sec;
 	disk_inode->ctime = time.tv_sec;
@@ -707,6 +1342,8 @@ async::result<std::shared_ptr<Inode>> FileSystem::createDirectory() {
 	memset(disk_inode, 0, inodeSize);
 	disk_inode->mode = EXT2_S_IFDIR;
 	disk_inode->generation = generation + 1;
+	if(featureIncompat & EXT4_FEATURE_INCOMPAT_EXTENTS)
+		initExtentRoot(disk_inode);
 	struct timespec time = clk::getRealtime();
 	disk_inode->atime = time.tv_sec;
 	disk_inode->ctime = time.tv_sec;
@@ -714,7 +1351,7 @@ async::result<std::shared_ptr<Inode>> FileSystem::createDirectory() {
 
 	// update usedDirsCount in the respective bgdt for this inode
 	auto bg_idx = (ino - 1) / inodesPerGroup;
-	bgdt[bg_idx].usedDirsCount++;
+	groupDesc(bg_idx).usedDirsCount++;
 	co_await writebackBgdt();
 
 	co_return accessInode(ino);
@@ -756,16 +1393,16 @@ async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
 		const void *buffer, size_t length) {
 	co_await inode->readyJump.wait();
 
-	// Make sure that data blocks are allocated.
-	auto blockOffset = (offset & ~(blockSize - 1)) >> blockShift;
-	auto blockCount = ((offset & (blockSize - 1)) + length + (blockSize - 1)) >> blockShift;
-	co_await assignDataBlocks(inode, blockOffset, blockCount);
+	// Data blocks are only assigned by flushInode() or on writeback.
+	// This allows us to allocate contiguous runs for many small writes.
+	markDirty(inode, offset, length);
 
 	// Resize the file if necessary.
 	if(offset + length > inode->fileSize()) {
 		HEL_CHECK(helResizeMemory(inode->backingMemory,
 				(offset + length + 0xFFF) & ~size_t(0xFFF)));
 		inode->setFileSize(offset + length);
+		revokeLease(inode->number);
 		auto syncInode = co_await helix_ng::synchronizeSpace(
 				helix::BorrowedDescriptor{kHelNullHandle},
 				inode->diskMapping.get(), inodeSize);
@@ -797,6 +1434,163 @@ async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
 			helix::BorrowedDescriptor(inode->frontalMemory),
 			offset, length, buffer);
 	HEL_CHECK(writeMemory.error());
+
+	if(dirtyBytes >= dirtyThreshold && !flushing)
+		[] (FileSystem *self) -> async::detached {
+			co_await self->flushDirty();
+		}(this);
+}
+
+void FileSystem::markDirty(Inode *inode, uint64_t offset, size_t length) {
+	if(!length)
+		return;
+
+	auto &ranges = inode->dirtyRanges;
+	auto start = offset;
+	auto end = offset + length;
+
+	// Merge with all ranges that overlap or touch [start, end).
+	auto it = ranges.upper_bound(start);
+	if(it != ranges.begin() && std::prev(it)->second >= start)
+		it = std::prev(it);
+	while(it != ranges.end() && it->first <= end) {
+		start = std::min(start, it->first);
+		end = std::max(end, it->second);
+		dirtyBytes -= it->second - it->first;
+		it = ranges.erase(it);
+	}
+	ranges.emplace(start, end);
+	dirtyBytes += end - start;
+
+	if(!dirtyInodes.contains(inode->number))
+		dirtyInodes.emplace(inode->number, inode->shared_from_this());
+}
+
+async::detached FileSystem::runWriteback() {
+	while(true) {
+		co_await helix::sleepFor(writebackInterval);
+		co_await flushDirty();
+	}
+}
+
+async::result<void> FileSystem::flushDirty() {
+	if(flushing)
+		co_return;
+	flushing = true;
+
+	while(!dirtyInodes.empty()) {
+		auto inodes = std::move(dirtyInodes);
+		dirtyInodes.clear();
+		for(auto &[number, inode] : inodes)
+			co_await flushInode(inode);
+	}
+
+	if(bgdtDirty) {
+		bgdtDirty = false;
+		co_await writebackBgdt();
+	}
+
+	flushing = false;
+}
+
+async::result<void> FileSystem::flushInode(std::shared_ptr<Inode> inode, bool dataOnly) {
+	auto ranges = std::move(inode->dirtyRanges);
+	inode->dirtyRanges.clear();
+
+	for(auto [start, end] : ranges) {
+		dirtyBytes -= end - start;
+
+		// The file might have been truncated in the meantime.
+		end = std::min(end, inode->fileSize());
+		if(start >= end)
+			continue;
+
+		// Assign all blocks of the range at once such that they end up contiguous.
+		auto blockOffset = start >> blockShift;
+		auto blockEnd = (end + blockSize - 1) >> blockShift;
+		co_await assignDataBlocks(inode.get(), blockOffset, blockEnd - blockOffset);
+
+		// Write back the page cache; the kernel passes the dirty pages to manageFileData().
+		auto mapOffset = start & ~size_t(0xFFF);
+		auto mapSize = ((end + 0xFFF) & ~size_t(0xFFF)) - mapOffset;
+		helix::Mapping fileMap{helix::BorrowedDescriptor{inode->frontalMemory},
+				static_cast<ptrdiff_t>(mapOffset), mapSize,
+				kHelMapProtRead | kHelMapDontRequireBacking};
+		auto syncFile = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle},
+				fileMap.get(), mapSize);
+		HEL_CHECK(syncFile.error());
+	}
+
+	// Block assignment updated the block map or extent tree.
+	if(dataOnly && !inode->metadataDirty)
+		co_return;
+	inode->metadataDirty = false;
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			inode->diskMapping.get(), inodeSize);
+	HEL_CHECK(syncInode.error());
+}
+
+async::result<void> FileSystem::sync(std::shared_ptr<Inode> inode, bool dataOnly) {
+	co_await inode->readyJump.wait();
+
+	auto [it, inserted] = syncInodes.try_emplace(inode->number, inode, dataOnly);
+	if(!inserted)
+		it->second.second = it->second.second && dataOnly;
+
+	// The next commit that starts takes syncInodes, including this inode.
+	auto target = commitsStarted + 1;
+	if(!committing)
+		runCommits();
+	while(commitsCompleted < target)
+		co_await commitDone.async_wait();
+}
+
+async::detached FileSystem::runCommits() {
+	committing = true;
+
+	while(!syncInodes.empty()) {
+		// Give concurrent callers the chance to join this commit.
+		co_await helix::sleepFor(commitWindow);
+
+		auto inodes = std::move(syncInodes);
+		syncInodes.clear();
+		commitsStarted++;
+
+		// A concurrent flushDirty() may have taken dirty ranges of these inodes
+		// without writing them back yet; synchronizing the whole file covers them.
+		bool wholeFiles = flushing;
+
+		for(auto &[number, entry] : inodes) {
+			auto &[inode, dataOnly] = entry;
+			dirtyInodes.erase(number);
+			co_await flushInode(inode, dataOnly);
+
+			if(wholeFiles && inode->fileSize()) {
+				auto mapSize = (inode->fileSize() + 0xFFF) & ~size_t(0xFFF);
+				helix::Mapping fileMap{helix::BorrowedDescriptor{inode->frontalMemory},
+						0, mapSize, kHelMapProtRead | kHelMapDontRequireBacking};
+				auto syncFile = co_await helix_ng::synchronizeSpace(
+						helix::BorrowedDescriptor{kHelNullHandle},
+						fileMap.get(), mapSize);
+				HEL_CHECK(syncFile.error());
+			}
+		}
+
+		if(bgdtDirty) {
+			bgdtDirty = false;
+			co_await writebackBgdt();
+		}
+
+		// One cache flush makes all writes of the commit durable.
+		co_await device->flush();
+
+		commitsCompleted++;
+		commitDone.raise();
+	}
+
+	committing = false;
 }
 
 async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
@@ -898,6 +1692,9 @@ async::detached FileSystem::manageFileData(std::shared_ptr<Inode> inode) {
 			size_t num_blocks = (backed_size + (inode->fs.blockSize - 1)) / inode->fs.blockSize;
 
 			assert(num_blocks * inode->fs.blockSize <= manage.length());
+			// Pages can be written back before flushInode() assigned their blocks.
+			co_await inode->fs.assignDataBlocks(inode.get(),
+					manage.offset() / inode->fs.blockSize, num_blocks);
 			co_await inode->fs.writeDataBlocks(inode, manage.offset() / inode->fs.blockSize,
 					num_blocks, file_map.get());
 
@@ -981,8 +1778,69 @@ async::detached FileSystem::manageIndirect(std::shared_ptr<Inode> inode,
 	}
 }
 
-async::result<uint32_t> FileSystem::allocateBlock() {
-	for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
+namespace {
+
+// Finds the first clear bit in [from, limit) of a bitmap and returns it together with
+// the length of the run of clear bits that starts there (at most maxCount).
+std::optional<std::pair<uint32_t, uint32_t>> findClearRun(const uint32_t *words,
+		uint32_t from, uint32_t limit, uint32_t maxCount) {
+	uint32_t bit = from;
+	while(bit < limit) {
+		// Treat the bits below the start position as set.
+		auto word = words[bit / 32] | ((uint32_t{1} << (bit % 32)) - 1);
+		if(word == 0xFFFFFFFF) {
+			bit = (bit / 32 + 1) * 32;
+			continue;
+		}
+		bit = (bit & ~uint32_t{31}) + std::countr_one(word);
+		if(bit >= limit)
+			break;
+
+		uint32_t end = bit;
+		while(end < limit && end - bit < maxCount) {
+			auto shift = end % 32;
+			auto zeros = std::min<uint32_t>(std::countr_zero(words[end / 32] >> shift),
+					32 - shift);
+			end += zeros;
+			if(shift + zeros < 32)
+				break;
+		}
+		return std::pair{bit, std::min({end, limit, bit + maxCount}) - bit};
+	}
+	return std::nullopt;
+}
+
+} // anonymous namespace
+
+async::result<uint32_t> FileSystem::allocateBlock(uint64_t goal) {
+	auto [block, count] = co_await allocateBlocks(goal, 1);
+	assert(!block || count == 1);
+	assert(block <= UINT32_MAX && "TODO: Restrict block map allocations to 32 bits");
+	co_return block;
+}
+
+async::result<std::pair<uint64_t, size_t>> FileSystem::allocateBlocks(uint64_t goal,
+		size_t maxCount) {
+	assert(maxCount);
+	if(goal >= blocksCount)
+		goal = 0;
+	uint32_t goalGroup = goal / blocksPerGroup;
+	uint32_t goalBit = goal % blocksPerGroup;
+
+	for(uint32_t n = 0; n < numBlockGroups; n++) {
+		auto bg_idx = (goalGroup + n) % numBlockGroups;
+		// Skip full groups without touching their bitmaps.
+		// The bitmaps of uninitialized groups are not valid on disk.
+		auto &desc = groupDesc(bg_idx);
+		if(!desc.freeBlocksCount || (desc.flags & EXT4_BG_BLOCK_UNINIT))
+			continue;
+
+		auto &hint = blockGroupHints[bg_idx];
+		auto limit = static_cast<uint32_t>(std::min(uint64_t{blocksPerGroup},
+				blocksCount - uint64_t{bg_idx} * blocksPerGroup));
+		if(hint >= limit)
+			continue;
+
 		helix::LockMemoryView lock_bitmap;
 		auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
 				&lock_bitmap,
@@ -996,36 +1854,109 @@ async::result<uint32_t> FileSystem::allocateBlock() {
 				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
 
 		auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
-		for(unsigned int i = 0; i < (blocksPerGroup + 31) / 32; i++) {
-			if(words[i] == 0xFFFFFFFF)
+		auto runLimit = static_cast<uint32_t>(std::min(maxCount, size_t{blocksPerGroup}));
+
+		// In the goal group, prefer blocks after the goal; otherwise start at the hint.
+		std::optional<std::pair<uint32_t, uint32_t>> run;
+		if(!n && goalBit > hint)
+			run = findClearRun(words, goalBit, limit, runLimit);
+		if(!run) {
+			run = findClearRun(words, hint, limit, runLimit);
+			// Everything below the first clear bit is allocated.
+			hint = run ? run->first : limit;
+		}
+		if(!run)
+			continue;
+
+		auto [bit, count] = *run;
+		for(uint32_t i = bit; i < bit + count; i++)
+			words[i / 32] |= uint32_t{1} << (i % 32);
+		if(hint == bit)
+			hint = bit + count;
+
+		// TODO: Make sure we never return reserved blocks.
+		auto block = uint64_t{bg_idx} * blocksPerGroup + bit;
+		assert(block);
+		assert(block + count <= blocksCount);
+
+		desc.freeBlocksCount -= count;
+		bgdtDirty = true;
+
+		co_return std::pair<uint64_t, size_t>{block, count};
+	}
+
+	co_return std::pair<uint64_t, size_t>{0, 0};
+}
+
+async::result<uint64_t> FileSystem::trimFreeBlocks(uint64_t start, uint64_t length,
+		uint64_t minLength) {
+	auto firstBlock = start >> blockShift;
+	auto endByte = (length > UINT64_MAX - start) ? UINT64_MAX : start + length;
+	auto endBlock = std::min(blocksCount, endByte >> blockShift);
+	auto minBlocks = std::max(uint64_t{1}, (minLength + blockSize - 1) >> blockShift);
+
+	uint64_t trimmed = 0;
+	for(uint64_t bg_idx = firstBlock / blocksPerGroup;
+			bg_idx < numBlockGroups && bg_idx * blocksPerGroup < endBlock; bg_idx++) {
+		// The bitmaps of uninitialized groups are not valid on disk.
+		auto &desc = groupDesc(bg_idx);
+		if(!desc.freeBlocksCount || (desc.flags & EXT4_BG_BLOCK_UNINIT))
+			continue;
+
+		auto groupStart = bg_idx * blocksPerGroup;
+		auto from = static_cast<uint32_t>(std::max(firstBlock, groupStart) - groupStart);
+		auto limit = static_cast<uint32_t>(std::min(uint64_t{blocksPerGroup},
+				endBlock - groupStart));
+
+		helix::LockMemoryView lock_bitmap;
+		auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
+				&lock_bitmap,
+				bg_idx << blockPagesShift, 1 << blockPagesShift,
+				helix::Dispatcher::global());
+		co_await submit_bitmap.async_wait();
+		HEL_CHECK(lock_bitmap.error());
+
+		helix::Mapping bitmap_map{blockBitmap,
+				static_cast<ptrdiff_t>(bg_idx << blockPagesShift), size_t{1} << blockPagesShift,
+				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+		auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
+
+		// Mark the runs as allocated while the discards are in flight, such that
+		// allocateBlocks() does not hand them out in the meantime.
+		std::vector<BlockRun> runs;
+		uint32_t bit = from;
+		while(auto run = findClearRun(words, bit, limit, blocksPerGroup)) {
+			auto [first, count] = *run;
+			bit = first + count;
+			if(count < minBlocks)
 				continue;
-			for(int j = 0; j < 32; j++) {
-				if(i * 32 + j >= blocksPerGroup)
-					break;
-				if(words[i] & (static_cast<uint32_t>(1) << j))
-					continue;
-				// TODO: Make sure we never return reserved blocks.
-				// TODO: Make sure we never return blocks higher than the max. block in the SB.
-				auto block = bg_idx * blocksPerGroup + i * 32 + j;
-				assert(block);
-				assert(block < blocksCount);
-				words[i] |= static_cast<uint32_t>(1) << j;
+			for(uint32_t i = first; i < first + count; i++)
+				words[i / 32] |= uint32_t{1} << (i % 32);
+			runs.push_back({groupStart + first, count, 0});
+		}
 
-				bgdt[bg_idx].freeBlocksCount--;
-				co_await writebackBgdt();
+		co_await discardRuns(runs);
 
-				co_return block;
-			}
-			assert(!"Failed to find zero-bit");
+		auto &hint = blockGroupHints[bg_idx];
+		for(auto &run : runs) {
+			auto first = static_cast<uint32_t>(run.block - groupStart);
+			for(uint32_t i = first; i < first + run.count; i++)
+				words[i / 32] &= ~(uint32_t{1} << (i % 32));
+			hint = std::min(hint, first);
+			trimmed += run.count << blockShift;
 		}
 	}
 
-	co_return 0;
+	co_return trimmed;
 }
 
 async::result<uint32_t> FileSystem::allocateInode() {
 	// TODO: Do not start at block group zero.
 	for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
+		// The bitmaps of uninitialized groups are not valid on disk.
+		if(groupDesc(bg_idx).flags & EXT4_BG_INODE_UNINIT)
+			continue;
+
 		helix::LockMemoryView lock_bitmap;
 		auto &&submit_bitmap = helix::submitLockMemoryView(inodeBitmap,
 				&lock_bitmap,
@@ -1054,7 +1985,7 @@ async::result<uint32_t> FileSystem::allocateInode() {
 				assert(ino < inodesCount);
 				words[i] |= static_cast<uint32_t>(1) << j;
 
-				bgdt[bg_idx].freeInodesCount--;
+				groupDesc(bg_idx).freeInodesCount--;
 				co_await writebackBgdt();
 
 				co_return ino;
@@ -1068,6 +1999,21 @@ async::result<uint32_t> FileSystem::allocateInode() {
 
 async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 		uint64_t block_offset, size_t num_blocks) {
+	co_await inode->assignMutex.async_lock();
+	auto allocated = inode->diskInode()->blocks;
+	if(inode->diskInode()->flags & EXT4_EXTENTS_FL) {
+		co_await assignExtentBlocks(inode, block_offset, num_blocks);
+	}else{
+		co_await assignMappedBlocks(inode, block_offset, num_blocks);
+	}
+	if(inode->diskInode()->blocks != allocated)
+		inode->metadataDirty = true;
+	inode->assignMutex.unlock();
+}
+
+async::result<void> FileSystem::assignMappedBlocks(Inode *inode,
+		uint64_t block_offset, size_t num_blocks) {
+
 	size_t per_indirect = blockSize / 4;
 	size_t per_single = per_indirect;
 	size_t per_double = per_indirect * per_indirect;
@@ -1079,31 +2025,28 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 
 	auto disk_inode = inode->diskInode();
 
+	// Place new blocks after the preceding block of the file or in the inode's group.
+	uint32_t goal = ((inode->number - 1) / inodesPerGroup) * blocksPerGroup;
+	if(block_offset && block_offset <= i_range && disk_inode->data.blocks.direct[block_offset - 1])
+		goal = disk_inode->data.blocks.direct[block_offset - 1] + 1;
+
 	size_t prg = 0;
 	while(prg < num_blocks) {
 		if(block_offset + prg < i_range) {
-			while(prg < num_blocks
-					&& block_offset + prg < i_range) {
-				auto idx = block_offset + prg;
-				if(disk_inode->data.blocks.direct[idx]) {
-					prg++;
-					continue;
-				}
-				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
-				disk_inode->blocks += (blockSize / 512);
-				disk_inode->data.blocks.direct[idx] = block;
-				prg++;
-			}
+			auto idx = block_offset + prg;
+			auto n = std::min(num_blocks - prg, i_range - idx);
+			co_await assignBlockSlots(inode, &disk_inode->data.blocks.direct[idx], n, goal);
+			prg += n;
 		}else if(block_offset + prg < s_range) {
 			bool needsReset = false;
 
 			// Allocate the single-indirect block itself.
 			if(!disk_inode->data.blocks.singleIndirect) {
-				auto block = co_await allocateBlock();
+				auto block = co_await allocateBlock(goal);
 				assert(block && "Out of disk space"); // TODO: Fix this.
 				disk_inode->blocks += (blockSize / 512);
 				disk_inode->data.blocks.singleIndirect = block;
+				goal = block + 1;
 				needsReset = true;
 			}
 
@@ -1122,26 +2065,18 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 			if(needsReset)
 				memset(window, 0, size_t{1} << blockPagesShift);
 
-			while(prg < num_blocks
-					&& block_offset + prg < s_range) {
-				auto idx = block_offset + prg - i_range;
-				if(window[idx]) {
-					prg++;
-					continue;
-				}
-				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
-				disk_inode->blocks += (blockSize / 512);
-				window[idx] = block;
-				prg++;
-			}
+			auto idx = block_offset + prg - i_range;
+			auto n = std::min(num_blocks - prg, s_range - (block_offset + prg));
+			co_await assignBlockSlots(inode, &window[idx], n, goal);
+			prg += n;
 		}else if(block_offset + prg < d_range) {
 			bool doubleNeedsReset = false;
 			if(!disk_inode->data.blocks.doubleIndirect) {
-				auto block = co_await allocateBlock();
+				auto block = co_await allocateBlock(goal);
 				assert(block && "Out of disk space"); // TODO: Fix this.
 				disk_inode->blocks += (blockSize / 512);
 				disk_inode->data.blocks.doubleIndirect = block;
+				goal = block + 1;
 				doubleNeedsReset = true;
 			}
 
@@ -1168,10 +2103,11 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 				bool needsReset = false;
 				if(!double_window[indirect_frame]) {
 					// Allocate the single indirect block.
-					auto block = co_await allocateBlock();
+					auto block = co_await allocateBlock(goal);
 					assert(block && "Out of disk space"); // TODO: Fix this.
 					disk_inode->blocks += (blockSize / 512);
 					double_window[indirect_frame] = block;
+					goal = block + 1;
 					needsReset = true;
 				}
 
@@ -1190,16 +2126,11 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 				if(needsReset)
 					memset(window, 0, size_t{1} << blockPagesShift);
 
-				if(window[indirect_index]) {
-					prg++;
-					continue;
-				}
-
-				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
-				disk_inode->blocks += (blockSize / 512);
-				window[indirect_index] = block;
-				prg++;
+				// Fill the remainder of this indirect block in one go.
+				auto n = std::min({num_blocks - prg, per_indirect - indirect_index,
+						d_range - (block_offset + prg)});
+				co_await assignBlockSlots(inode, &window[indirect_index], n, goal);
+				prg += n;
 			}
 		}else{
 			assert(!"TODO: Implement allocation in triple indirect blocks");
@@ -1212,6 +2143,384 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 	HEL_CHECK(syncInode.error());
 }
 
+async::result<void> FileSystem::assignBlockSlots(Inode *inode,
+		uint32_t *slots, size_t count, uint32_t &goal) {
+	auto disk_inode = inode->diskInode();
+
+	size_t i = 0;
+	while(i < count) {
+		if(slots[i]) {
+			goal = slots[i] + 1;
+			i++;
+			continue;
+		}
+
+		// Allocate a contiguous run for all consecutive holes.
+		size_t holes = 1;
+		while(i + holes < count && !slots[i + holes])
+			holes++;
+
+		auto [block, allocated] = co_await allocateBlocks(goal, holes);
+		assert(block && "Out of disk space"); // TODO: Fix this.
+		assert(block + allocated <= UINT32_MAX
+				&& "TODO: Restrict block map allocations to 32 bits");
+		for(size_t k = 0; k < allocated; k++)
+			slots[i + k] = block + k;
+		disk_inode->blocks += allocated * (blockSize / 512);
+		goal = block + allocated;
+		i += allocated;
+	}
+}
+
+async::result<DiskExtentHeader *> FileSystem::accessExtentNode(Inode *inode, uint64_t block) {
+	DiskExtentHeader *node;
+	if(!block) {
+		node = reinterpret_cast<DiskExtentHeader *>(inode->diskInode()->data.embedded);
+	}else{
+		auto it = inode->extentBlocks.find(block);
+		if(it == inode->extentBlocks.end()) {
+			std::vector<std::byte> buffer(blockSize);
+			co_await device->readSectors(block * sectorsPerBlock,
+					buffer.data(), sectorsPerBlock);
+			// If another coroutine loaded the block in the meantime, its copy is kept.
+			it = inode->extentBlocks.emplace(block, std::move(buffer)).first;
+		}
+		node = reinterpret_cast<DiskExtentHeader *>(it->second.data());
+	}
+	assert(node->magic == EXT4_EXT_MAGIC);
+	co_return node;
+}
+
+async::result<void> FileSystem::writebackExtentNode(Inode *inode, uint64_t block) {
+	if(!block) {
+		auto syncInode = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle},
+				inode->diskMapping.get(), inodeSize);
+		HEL_CHECK(syncInode.error());
+		co_return;
+	}
+
+	auto it = inode->extentBlocks.find(block);
+	assert(it != inode->extentBlocks.end());
+	co_await device->writeSectors(block * sectorsPerBlock,
+			it->second.data(), sectorsPerBlock);
+}
+
+async::result<ExtentPath> FileSystem::walkExtents(Inode *inode, uint64_t index) {
+	ExtentPath path;
+	path.bound = uint64_t{1} << 32;
+
+	uint64_t block = 0;
+	while(true) {
+		auto node = co_await accessExtentNode(inode, block);
+
+		// Index entries and extents both start with their first logical block.
+		auto keyOf = [&] (int i) -> uint64_t {
+			return extentEntries<DiskExtent>(node)[i].block;
+		};
+
+		// Binary search for the first entry that starts after index.
+		int lo = 0;
+		int hi = node->entries;
+		while(lo < hi) {
+			auto mid = (lo + hi) / 2;
+			if(keyOf(mid) <= index) {
+				lo = mid + 1;
+			}else{
+				hi = mid;
+			}
+		}
+		if(lo < node->entries)
+			path.bound = std::min(path.bound, keyOf(lo));
+
+		if(!node->depth) {
+			path.levels.push_back({block, node, lo - 1});
+			co_return path;
+		}
+
+		// If index precedes all entries, descend into the first child.
+		assert(node->entries);
+		auto i = std::max(lo - 1, 0);
+		path.levels.push_back({block, node, i});
+		block = indexLeaf(extentEntries<DiskExtentIndex>(node)[i]);
+	}
+}
+
+async::result<ExtentMapping> FileSystem::mapExtents(Inode *inode,
+		uint64_t index, size_t maxCount) {
+	auto path = co_await walkExtents(inode, index);
+	auto &leaf = path.levels.back();
+	auto extents = extentEntries<DiskExtent>(leaf.node);
+
+	if(leaf.index >= 0) {
+		auto &extent = extents[leaf.index];
+		uint64_t end = extent.block + extentLength(extent);
+		if(index < end) {
+			ExtentMapping mapping{extentStart(extent) + (index - extent.block),
+					static_cast<size_t>(std::min<uint64_t>(maxCount, end - index)),
+					extent.len > EXT4_EXT_INIT_MAX_LEN};
+
+			// Merge extents that are also adjacent on disk; this is common since
+			// extents are limited to EXT4_EXT_INIT_MAX_LEN blocks.
+			for(int i = leaf.index + 1; i < leaf.node->entries && mapping.count < maxCount; i++) {
+				auto &next = extents[i];
+				if(next.block != index + mapping.count
+						|| extentStart(next) != mapping.block + mapping.count
+						|| (next.len > EXT4_EXT_INIT_MAX_LEN) != mapping.uninitialized)
+					break;
+				mapping.count = std::min(maxCount, mapping.count + extentLength(next));
+			}
+			co_return mapping;
+		}
+	}
+
+	co_return ExtentMapping{0,
+			static_cast<size_t>(std::min<uint64_t>(maxCount, path.bound - index)), false};
+}
+
+async::result<void> FileSystem::assignExtentBlocks(Inode *inode,
+		uint64_t block_offset, size_t num_blocks) {
+	auto disk_inode = inode->diskInode();
+
+	// Place new blocks after the preceding extent or in the inode's group.
+	uint64_t goal = uint64_t{(inode->number - 1) / inodesPerGroup} * blocksPerGroup;
+
+	size_t prg = 0;
+	while(prg < num_blocks) {
+		auto index = block_offset + prg;
+		auto path = co_await walkExtents(inode, index);
+		auto &leaf = path.levels.back();
+
+		if(leaf.index >= 0) {
+			auto &extent = extentEntries<DiskExtent>(leaf.node)[leaf.index];
+			auto start = extentStart(extent);
+			auto length = extentLength(extent);
+			goal = start + length;
+
+			if(index < extent.block + length) {
+				if(extent.len > EXT4_EXT_INIT_MAX_LEN) {
+					// Zero the extent on disk before marking it as initialized.
+					// TODO: Split the extent instead of initializing all of it.
+					constexpr size_t zeroChunk = 64;
+					std::vector<std::byte> zeros(std::min(length, zeroChunk) * blockSize);
+					for(size_t k = 0; k < length; k += zeroChunk)
+						co_await device->writeSectors((start + k) * sectorsPerBlock, zeros.data(),
+								std::min(length - k, zeroChunk) * sectorsPerBlock);
+					extent.len -= EXT4_EXT_INIT_MAX_LEN;
+					co_await writebackExtentNode(inode, leaf.block);
+				}
+				prg += std::min<uint64_t>(num_blocks - prg, extent.block + length - index);
+				continue;
+			}
+		}
+
+		// Allocate a contiguous run for the hole; a single extent covers at most
+		// EXT4_EXT_INIT_MAX_LEN blocks.
+		auto holes = std::min<uint64_t>({num_blocks - prg, path.bound - index,
+				EXT4_EXT_INIT_MAX_LEN});
+		auto [block, allocated] = co_await allocateBlocks(goal, holes);
+		assert(block && "Out of disk space"); // TODO: Fix this.
+		disk_inode->blocks += allocated * (blockSize / 512);
+		co_await insertExtent(inode, index, block, allocated);
+		goal = block + allocated;
+		prg += allocated;
+	}
+
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			inode->diskMapping.get(), inodeSize);
+	HEL_CHECK(syncInode.error());
+}
+
+async::result<void> FileSystem::insertExtent(Inode *inode, uint64_t index,
+		uint64_t block, size_t count) {
+	while(true) {
+		auto path = co_await walkExtents(inode, index);
+		auto &leaf = path.levels.back();
+		auto extents = extentEntries<DiskExtent>(leaf.node);
+
+		// Extend the preceding extent if the new blocks directly follow it.
+		// Note that this never applies to uninitialized extents.
+		if(leaf.index >= 0) {
+			auto &prev = extents[leaf.index];
+			if(prev.len + count <= EXT4_EXT_INIT_MAX_LEN
+					&& prev.block + prev.len == index
+					&& extentStart(prev) + prev.len == block) {
+				prev.len += count;
+				co_await writebackExtentNode(inode, leaf.block);
+				co_return;
+			}
+		}
+
+		// Make room in the leaf: split the lowest full node below a non-full one,
+		// or grow the tree if all nodes on the path are full.
+		size_t k = path.levels.size();
+		while(k && path.levels[k - 1].node->entries == path.levels[k - 1].node->max)
+			k--;
+		if(!k) {
+			co_await growExtentTree(inode, block);
+			continue;
+		}else if(k < path.levels.size()) {
+			co_await splitExtentNode(inode, path, k);
+			continue;
+		}
+
+		unsigned int pos = leaf.index + 1;
+		memmove(&extents[pos + 1], &extents[pos],
+				(leaf.node->entries - pos) * sizeof(DiskExtent));
+		extents[pos].block = index;
+		extents[pos].len = count;
+		extents[pos].startHi = block >> 32;
+		extents[pos].startLo = block;
+		leaf.node->entries++;
+		co_await writebackExtentNode(inode, leaf.block);
+
+		// If the extent became the first entry of its leaf, update the keys of the parents.
+		for(size_t j = path.levels.size() - 1; j && !pos; j--) {
+			auto &parent = path.levels[j - 1];
+			auto &key = extentEntries<DiskExtentIndex>(parent.node)[parent.index].block;
+			if(key <= index)
+				break;
+			key = index;
+			co_await writebackExtentNode(inode, parent.block);
+			pos = parent.index;
+		}
+		co_return;
+	}
+}
+
+async::result<void> FileSystem::growExtentTree(Inode *inode, uint64_t goal) {
+	auto root = co_await accessExtentNode(inode, 0);
+
+	auto [block, count] = co_await allocateBlocks(goal, 1);
+	assert(block && "Out of disk space"); // TODO: Fix this.
+	inode->diskInode()->blocks += blockSize / 512;
+
+	std::vector<std::byte> buffer(blockSize);
+	auto node = reinterpret_cast<DiskExtentHeader *>(buffer.data());
+	memcpy(node, root, sizeof(DiskExtentHeader) + root->entries * sizeof(DiskExtent));
+	node->max = (blockSize - sizeof(DiskExtentHeader)) / sizeof(DiskExtent);
+	uint32_t key = extentEntries<DiskExtent>(node)[0].block;
+
+	co_await device->writeSectors(block * sectorsPerBlock, buffer.data(), sectorsPerBlock);
+	inode->extentBlocks.emplace(block, std::move(buffer));
+
+	auto &idx = extentEntries<DiskExtentIndex>(root)[0];
+	idx.block = key;
+	idx.leafLo = block;
+	idx.leafHi = block >> 32;
+	idx.unused = 0;
+	root->entries = 1;
+	root->depth++;
+	co_await writebackExtentNode(inode, 0);
+}
+
+async::result<void> FileSystem::splitExtentNode(Inode *inode, ExtentPath &path, size_t level) {
+	assert(level);
+	auto &current = path.levels[level];
+	auto &parent = path.levels[level - 1];
+	auto node = current.node;
+	assert(node->entries == node->max);
+	assert(parent.node->entries < parent.node->max);
+
+	auto [block, count] = co_await allocateBlocks(current.block, 1);
+	assert(block && "Out of disk space"); // TODO: Fix this.
+	inode->diskInode()->blocks += blockSize / 512;
+
+	// When appending (the common case), only move the last entry
+	// such that we do not leave half-empty nodes behind.
+	unsigned int split = node->entries / 2;
+	if(current.index + 1 == node->entries)
+		split = node->entries - 1;
+
+	std::vector<std::byte> buffer(blockSize);
+	auto sibling = reinterpret_cast<DiskExtentHeader *>(buffer.data());
+	sibling->magic = EXT4_EXT_MAGIC;
+	sibling->entries = node->entries - split;
+	sibling->max = node->max;
+	sibling->depth = node->depth;
+	sibling->generation = 0;
+	memcpy(extentEntries<DiskExtent>(sibling), extentEntries<DiskExtent>(node) + split,
+			sibling->entries * sizeof(DiskExtent));
+	uint32_t key = extentEntries<DiskExtent>(sibling)[0].block;
+	node->entries = split;
+
+	co_await device->writeSectors(block * sectorsPerBlock, buffer.data(), sectorsPerBlock);
+	inode->extentBlocks.emplace(block, std::move(buffer));
+	co_await writebackExtentNode(inode, current.block);
+
+	auto indices = extentEntries<DiskExtentIndex>(parent.node);
+	unsigned int pos = parent.index + 1;
+	memmove(&indices[pos + 1], &indices[pos],
+			(parent.node->entries - pos) * sizeof(DiskExtentIndex));
+	indices[pos].block = key;
+	indices[pos].leafLo = block;
+	indices[pos].leafHi = block >> 32;
+	indices[pos].unused = 0;
+	parent.node->entries++;
+	co_await writebackExtentNode(inode, parent.block);
+}
+
+async::result<void> FileSystem::transferRuns(const std::vector<BlockRun> &runs,
+		void *buffer, bool write) {
+	if(runs.size() == 1) {
+		auto &run = runs.front();
+		auto ptr = reinterpret_cast<uint8_t *>(buffer) + run.progress * blockSize;
+		if(write) {
+			co_await device->writeSectors(run.block * sectorsPerBlock,
+					ptr, run.count * sectorsPerBlock);
+		}else{
+			co_await device->readSectors(run.block * sectorsPerBlock,
+					ptr, run.count * sectorsPerBlock);
+		}
+		co_return;
+	}
+
+	size_t pending = runs.size();
+	async::recurring_event done;
+
+	device->plug();
+	for(auto &run : runs) {
+		[] (FileSystem *self, BlockRun run, uint8_t *ptr, bool write,
+				size_t *pending, async::recurring_event *done) -> async::detached {
+			if(write) {
+				co_await self->device->writeSectors(run.block * self->sectorsPerBlock,
+						ptr, run.count * self->sectorsPerBlock);
+			}else{
+				co_await self->device->readSectors(run.block * self->sectorsPerBlock,
+						ptr, run.count * self->sectorsPerBlock);
+			}
+			(*pending)--;
+			done->raise();
+		}(this, run, reinterpret_cast<uint8_t *>(buffer) + run.progress * blockSize,
+				write, &pending, &done);
+	}
+	device->unplug();
+
+	while(pending)
+		co_await done.async_wait();
+}
+
+async::result<void> FileSystem::discardRuns(const std::vector<BlockRun> &runs) {
+	size_t pending = runs.size();
+	async::recurring_event done;
+
+	device->plug();
+	for(auto &run : runs) {
+		[] (FileSystem *self, BlockRun run,
+				size_t *pending, async::recurring_event *done) -> async::detached {
+			co_await self->device->discard(run.block * self->sectorsPerBlock,
+					run.count * self->sectorsPerBlock);
+			(*pending)--;
+			done->raise();
+		}(this, run, &pending, &done);
+	}
+	device->unplug();
+
+	while(pending)
+		co_await done.async_wait();
+}
+
 async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 		uint64_t offset, size_t num_blocks, void *buffer) {
 	// We perform "block-fusion" here i.e. we try to read/write multiple
@@ -1238,6 +2547,26 @@ async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 	co_await inode->readyJump.wait();
 	// TODO: Assert that we do not read past the EOF.
 
+	// Resolving the mapping may fault in indirect or extent blocks;
+	// thus, we only submit the data transfers once all runs are known.
+	std::vector<BlockRun> runs;
+
+	if(inode->diskInode()->flags & EXT4_EXTENTS_FL) {
+		size_t progress = 0;
+		while(progress < num_blocks) {
+			auto mapping = co_await mapExtents(inode.get(), offset + progress,
+					num_blocks - progress);
+			if(mapping.block && !mapping.uninitialized) {
+				runs.push_back({mapping.block, mapping.count, progress});
+			}else{
+				memset((uint8_t *)buffer + progress * blockSize, 0, mapping.count * blockSize);
+			}
+			progress += mapping.count;
+		}
+		co_await transferRuns(runs, buffer, false);
+		co_return;
+	}
+
 	constexpr size_t indirectBufferSize = 8;
 
 	std::array<uint32_t, indirectBufferSize> indirectBuffer;
@@ -1321,14 +2650,13 @@ async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 //				<< " blocks, starting at " << issue.first << std::endl;
 
 		if (issue.first) {
-			co_await device->readSectors(issue.first * sectorsPerBlock,
-					(uint8_t *)buffer + progress * blockSize,
-					issue.second * sectorsPerBlock);
+			runs.push_back({issue.first, issue.second, progress});
 		} else {
 			memset((uint8_t *)buffer + progress * blockSize, 0, issue.second * blockSize);
 		}
 		progress += issue.second;
 	}
+	co_await transferRuns(runs, buffer, false);
 }
 
 // TODO: There is a lot of overlap between this method and readDataBlocks.
@@ -1359,6 +2687,22 @@ async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 	co_await inode->readyJump.wait();
 	// TODO: Assert that we do not write past the EOF.
 
+	std::vector<BlockRun> runs;
+
+	if(inode->diskInode()->flags & EXT4_EXTENTS_FL) {
+		size_t progress = 0;
+		while(progress < num_blocks) {
+			auto mapping = co_await mapExtents(inode.get(), offset + progress,
+					num_blocks - progress);
+			// assignDataBlocks() initializes all extents that it touches.
+			assert(mapping.block && !mapping.uninitialized);
+			runs.push_back({mapping.block, mapping.count, progress});
+			progress += mapping.count;
+		}
+		co_await transferRuns(runs, const_cast<void *>(buffer), true);
+		co_return;
+	}
+
 	size_t progress = 0;
 	while(progress < num_blocks) {
 		// Block number and block count of the writeSectors() command that we will issue here.
@@ -1413,11 +2757,10 @@ async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 //				<< " blocks, starting at " << issue.first << std::endl;
 
 		assert(issue.first);
-		co_await device->writeSectors(issue.first * sectorsPerBlock,
-				(const uint8_t *)buffer + progress * blockSize,
-				issue.second * sectorsPerBlock);
+		runs.push_back({issue.first, issue.second, progress});
 		progress += issue.second;
 	}
+	co_await transferRuns(runs, const_cast<void *>(buffer), true);
 }
 
 
@@ -1425,6 +2768,7 @@ async::result<void> FileSystem::truncate(Inode *inode, size_t size) {
 	HEL_CHECK(helResizeMemory(inode->backingMemory,
 			(size + 0xFFF) & ~size_t(0xFFF)));
 	inode->setFileSize(size);
+	revokeLease(inode->number);
 	auto syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
 			inode->diskMapping.get(), inodeSize);
@@ -1438,6 +2782,30 @@ async::result<void> FileSystem::writebackBgdt() {
 			blockGroupDescriptorBuffer.data(), blockGroupDescriptorBuffer.size() / 512);
 }
 
+uint64_t FileSystem::groupBlockBitmap(uint32_t bg_idx) {
+	auto &desc = groupDesc(bg_idx);
+	uint64_t block = desc.blockBitmap;
+	if(groupDescSize > sizeof(DiskGroupDesc))
+		block |= uint64_t{reinterpret_cast<DiskGroupDescHi *>(&desc + 1)->blockBitmapHi} << 32;
+	return block;
+}
+
+uint64_t FileSystem::groupInodeBitmap(uint32_t bg_idx) {
+	auto &desc = groupDesc(bg_idx);
+	uint64_t block = desc.inodeBitmap;
+	if(groupDescSize > sizeof(DiskGroupDesc))
+		block |= uint64_t{reinterpret_cast<DiskGroupDescHi *>(&desc + 1)->inodeBitmapHi} << 32;
+	return block;
+}
+
+uint64_t FileSystem::groupInodeTable(uint32_t bg_idx) {
+	auto &desc = groupDesc(bg_idx);
+	uint64_t block = desc.inodeTable;
+	if(groupDescSize > sizeof(DiskGroupDesc))
+		block |= uint64_t{reinterpret_cast<DiskGroupDescHi *>(&desc + 1)->inodeTableHi} << 32;
+	return block;
+}
+
 // --------------------------------------------------------
 // OpenFile
 // --------------------------------------------------------
@@ -1489,5 +2857,72 @@ OpenFile::readEntries() {
 	co_return std::nullopt;
 }
 
+namespace {
+
+uint8_t direntType(uint8_t fileType) {
+	switch(fileType) {
+	case EXT2_FT_REG_FILE: return DT_REG;
+	case EXT2_FT_DIR: return DT_DIR;
+	case EXT2_FT_CHRDEV: return DT_CHR;
+	case EXT2_FT_BLKDEV: return DT_BLK;
+	case EXT2_FT_FIFO: return DT_FIFO;
+	case EXT2_FT_SOCK: return DT_SOCK;
+	case EXT2_FT_SYMLINK: return DT_LNK;
+	default: return DT_UNKNOWN;
+	}
+}
+
+} // anonymous namespace
+
+async::result<frg::expected<protocols::fs::Error, size_t>>
+OpenFile::readDirents(void *buffer, size_t size) {
+	co_await inode->readyJump.wait();
+
+	if(inode->fileType != kTypeDirectory)
+		co_return protocols::fs::Error::notDirectory;
+
+	auto map_size = (inode->fileSize() + 0xFFF) & ~size_t(0xFFF);
+	if(!map_size)
+		co_return 0;
+
+	helix::LockMemoryView lock_memory;
+	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(inode->frontalMemory),
+			&lock_memory, 0, map_size, helix::Dispatcher::global());
+	co_await submit.async_wait();
+	HEL_CHECK(lock_memory.error());
+
+	helix::Mapping file_map{helix::BorrowedDescriptor{inode->frontalMemory},
+			0, map_size,
+			kHelMapProtRead | kHelMapDontRequireBacking};
+
+	protocols::fs::DirentWriter writer{buffer, size};
+	// Callers usually stat() the returned entries next; start loading their inodes.
+	std::vector<uint32_t> numbers;
+	assert(offset <= inode->fileSize());
+	while(offset < inode->fileSize()) {
+		assert(!(offset & 3));
+		assert(offset + sizeof(DiskDirEntry) <= inode->fileSize());
+		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
+				reinterpret_cast<char *>(file_map.get()) + offset);
+		assert(offset + disk_entry->recordLength <= inode->fileSize());
+
+		auto next = offset + disk_entry->recordLength;
+		if(disk_entry->inode) {
+			if(!writer.append(disk_entry->inode, next, direntType(disk_entry->fileType),
+					std::string_view{disk_entry->name, disk_entry->nameLength})) {
+				// The caller's buffer must be able to hold at least one entry.
+				if(!writer.size())
+					co_return protocols::fs::Error::illegalArguments;
+				break;
+			}
+			numbers.push_back(disk_entry->inode);
+		}
+		offset = next;
+	}
+
+	inode->fs.prefetchInodes(std::move(numbers));
+	co_return writer.size();
+}
+
 } } // namespace blockfs::ext2fs
 
@@ -1,6 +1,7 @@
 
 #include <string.h>
 #include <time.h>
+#include <map>
 #include <optional>
 #include <memory>
 #include <optional>
@@ -9,6 +10,7 @@
 #include <vector>
 #include <protocols/fs/file-locks.hpp>
 
+#include <async/mutex.hpp>
 #include <async/oneshot-event.hpp>
 #include <async/recurring-event.hpp>
 #include <hel.h>
@@ -89,11 +91,21 @@ struct DiskSuperblock {
 	//-- Directory Indexing Support --
 	uint32_t hashSeed[4];
 	uint8_t defHashVersion;
-	uint8_t padding[3];
+	uint8_t jnlBackupType;
+	uint16_t descSize;
 	//-- Other options --
 	uint32_t defaultMountOptions;
 	uint32_t firstMetaBg;
-	uint8_t unused[760];
+	uint32_t mkfsTime;
+	uint32_t jnlBlocks[17];
+	//-- 64bit Support --
+	uint32_t blocksCountHi;
+	uint32_t rBlocksCountHi;
+	uint32_t freeBlocksCountHi;
+	uint16_t minExtraIsize;
+	uint16_t wantExtraIsize;
+	uint32_t flags;
+	uint8_t unused[668];
 };
 static_assert(sizeof(DiskSuperblock) == 1024, "Bad DiskSuperblock struct size");
 
@@ -104,11 +116,32 @@ struct DiskGroupDesc {
 	uint16_t freeBlocksCount;
 	uint16_t freeInodesCount;
 	uint16_t usedDirsCount;
-	uint16_t pad;
+	uint16_t flags;
 	uint8_t reserved[12];
 };
 static_assert(sizeof(DiskGroupDesc) == 32, "Bad DiskGroupDesc struct size");
 
+// Follows DiskGroupDesc if the 64bit feature is enabled.
+struct DiskGroupDescHi {
+	uint32_t blockBitmapHi;
+	uint32_t inodeBitmapHi;
+	uint32_t inodeTableHi;
+	uint16_t freeBlocksCountHi;
+	uint16_t freeInodesCountHi;
+	uint16_t usedDirsCountHi;
+	uint16_t itableUnusedHi;
+	uint32_t excludeBitmapHi;
+	uint16_t blockBitmapCsumHi;
+	uint16_t inodeBitmapCsumHi;
+	uint32_t reserved;
+};
+static_assert(sizeof(DiskGroupDescHi) == 32, "Bad DiskGroupDescHi struct size");
+
+enum {
+	EXT4_BG_INODE_UNINIT = 0x1,
+	EXT4_BG_BLOCK_UNINIT = 0x2
+};
+
 struct DiskInode {
 	uint16_t mode;
 	uint16_t uid;
@@ -135,6 +168,65 @@ enum {
 	EXT2_ROOT_INO = 2
 };
 
+enum {
+	EXT2_INDEX_FL = 0x1000,
+	EXT4_EXTENTS_FL = 0x80000
+};
+
+enum {
+	EXT2_FLAGS_UNSIGNED_HASH = 0x2
+};
+
+enum {
+	EXT2_FEATURE_COMPAT_DIR_INDEX = 0x20
+};
+
+enum {
+	EXT2_FEATURE_INCOMPAT_FILETYPE = 0x2,
+	EXT4_FEATURE_INCOMPAT_EXTENTS = 0x40,
+	EXT4_FEATURE_INCOMPAT_64BIT = 0x80,
+	EXT4_FEATURE_INCOMPAT_FLEX_BG = 0x200
+};
+
+enum {
+	EXT4_FEATURE_RO_COMPAT_GDT_CSUM = 0x10,
+	EXT4_FEATURE_RO_COMPAT_METADATA_CSUM = 0x400
+};
+
+// Extent trees replace FileData::Blocks if EXT4_EXTENTS_FL is set.
+// Each node starts with a header, followed by index entries (inner nodes)
+// or extents (leaves). The root node is stored in FileData::embedded.
+struct DiskExtentHeader {
+	uint16_t magic;
+	uint16_t entries;
+	uint16_t max;
+	uint16_t depth;
+	uint32_t generation;
+};
+static_assert(sizeof(DiskExtentHeader) == 12, "Bad DiskExtentHeader struct size");
+
+struct DiskExtentIndex {
+	uint32_t block;
+	uint32_t leafLo;
+	uint16_t leafHi;
+	uint16_t unused;
+};
+static_assert(sizeof(DiskExtentIndex) == 12, "Bad DiskExtentIndex struct size");
+
+struct DiskExtent {
+	uint32_t block;
+	uint16_t len;
+	uint16_t startHi;
+	uint32_t startLo;
+};
+static_assert(sizeof(DiskExtent) == 12, "Bad DiskExtent struct size");
+
+enum {
+	EXT4_EXT_MAGIC = 0xF30A,
+	// Extents longer than this are uninitialized (i.e., read as zeros).
+	EXT4_EXT_INIT_MAX_LEN = 0x8000
+};
+
 enum {
 	EXT2_S_IFMT = 0xF000,
 	EXT2_S_IFLNK = 0xA000,
@@ -150,9 +242,47 @@ struct DiskDirEntry {
 	char name[];
 };
 
+// Hashed directories (EXT2_INDEX_FL) keep a tree of hash ranges in their first block
+// (after the "." and ".." entries) and in blocks that consist of a single empty entry.
+// Both still parse as regular directory blocks.
+struct DiskDxRootInfo {
+	uint32_t reservedZero;
+	uint8_t hashVersion;
+	uint8_t infoLength;
+	uint8_t indirectLevels;
+	uint8_t unusedFlags;
+};
+static_assert(sizeof(DiskDxRootInfo) == 8, "Bad DiskDxRootInfo struct size");
+
+struct DiskDxEntry {
+	uint32_t hash;
+	uint32_t block;
+};
+static_assert(sizeof(DiskDxEntry) == 8, "Bad DiskDxEntry struct size");
+
+// Overlays the hash of the first DiskDxEntry of each node; the first entry
+// covers all hashes below the one of the second entry.
+struct DiskDxCountLimit {
+	uint16_t limit;
+	uint16_t count;
+};
+
+enum {
+	EXT2_HASH_LEGACY = 0,
+	EXT2_HASH_HALF_MD4 = 1,
+	EXT2_HASH_TEA = 2,
+	EXT2_HASH_LEGACY_UNSIGNED = 3,
+	EXT2_HASH_HALF_MD4_UNSIGNED = 4,
+	EXT2_HASH_TEA_UNSIGNED = 5
+};
+
 enum {
 	EXT2_FT_REG_FILE = 1,
 	EXT2_FT_DIR = 2,
+	EXT2_FT_CHRDEV = 3,
+	EXT2_FT_BLKDEV = 4,
+	EXT2_FT_FIFO = 5,
+	EXT2_FT_SOCK = 6,
 	EXT2_FT_SYMLINK = 7
 };
 
@@ -195,6 +325,37 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	async::result<protocols::fs::Error> chmod(int mode);
 	async::result<protocols::fs::Error> utimensat(std::optional<timespec> atime, std::optional<timespec> mtime, timespec ctime);
 
+	// Directory helpers; fileMapping must be locked.
+	DiskDirEntry *findDiskEntry(const std::string &name, DiskDirEntry **previous);
+	// Returns the entry and the entry before it in the same block (or nullptr).
+	DiskDirEntry *searchDirBlock(uint32_t block, const std::string &name,
+			DiskDirEntry **previous);
+	// Finds space for an entry in a block, shrinking an existing entry if necessary.
+	// Returns the offset and record length of the new entry.
+	std::optional<std::pair<size_t, size_t>> findDirSlot(uint32_t block, size_t required);
+	// Appends a block to the directory (remapping fileMapping) and returns its number.
+	async::result<uint32_t> growDirectory(std::vector<helix::UniqueDescriptor> &locks);
+
+	// Hashed directory index, see EXT2_INDEX_FL.
+	struct DxFrame {
+		DiskDxEntry *entries;
+		DiskDxEntry *at;
+	};
+
+	uint32_t dirHash(const char *name, size_t length);
+	// Walks the index down to the leaf for name and returns the number of levels
+	// (or zero if the directory has no usable index).
+	int probeIndex(const std::string &name, uint32_t &hash, DxFrame *frames);
+	// Moves to the next leaf if it continues a run of colliding hashes.
+	bool nextIndexLeaf(uint32_t hash, DxFrame *frames, int levels);
+	// Splits index nodes and leaves until the leaf for name has room.
+	// Returns std::nullopt if the entry has to be inserted without the index.
+	async::result<std::optional<std::pair<size_t, size_t>>>
+	findIndexedSlot(const std::string &name, size_t required,
+			std::vector<helix::UniqueDescriptor> &locks);
+	// Converts a single-block directory into a hashed one.
+	async::result<bool> makeIndexed(std::vector<helix::UniqueDescriptor> &locks);
+
 	FileSystem &fs;
 
 	// ext2fs on-disk inode number
@@ -227,12 +388,25 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	// - Indirection level 3/3 for triple indirect blocks.
 	helix::UniqueDescriptor indirectOrder3;
 
+	// Caches the extent tree blocks of the inode (indexed by their block number).
+	std::unordered_map<uint64_t, std::vector<std::byte>> extentBlocks;
+
+	// Byte ranges (start -> end) that were written through FileSystem::write()
+	// but not flushed yet. Blocks for these ranges are assigned on writeback.
+	std::map<uint64_t, uint64_t> dirtyRanges;
+	// Serializes assignDataBlocks() since writeback can race with flushInode().
+	async::mutex assignMutex;
+	// Set if block assignment changed the on-disk inode since flushInode() wrote it back.
+	// fdatasync() only needs to write back the inode if this is set.
+	bool metadataDirty = false;
+
 	// NOTE: The following fields are only meaningful if the isReady is true
 
 	FileType fileType;
 
 	int uid, gid;
 	FlockManager flockManager;
+	protocols::fs::RangeLockManager rangeLockManager;
 
 	std::unordered_set<std::string> obstructedLinks;
 };
@@ -241,6 +415,36 @@ struct Inode : std::enable_shared_from_this<Inode> {
 // FileSystem
 // --------------------------------------------------------
 
+// Result of a lookup in an extent tree, from the root to the leaf.
+struct ExtentPath {
+	struct Level {
+		// Block that stores the node (zero for the root in the inode).
+		uint64_t block;
+		DiskExtentHeader *node;
+		// Last entry that starts at or before the looked up block (or -1).
+		int index;
+	};
+
+	std::vector<Level> levels;
+	// First logical block after the looked up block that starts another entry.
+	uint64_t bound;
+};
+
+// Physical run that backs a range of logical blocks.
+struct ExtentMapping {
+	// Zero for holes.
+	uint64_t block;
+	size_t count;
+	bool uninitialized;
+};
+
+// Run of physical blocks that corresponds to buffer + progress * blockSize.
+struct BlockRun {
+	uint64_t block;
+	size_t count;
+	size_t progress;
+};
+
 struct FileSystem {
 	FileSystem(BlockDevice *device);
 
@@ -252,23 +456,90 @@ struct FileSystem {
 
 	std::shared_ptr<Inode> accessRoot();
 	std::shared_ptr<Inode> accessInode(uint32_t number);
+	// Loads the inode table pages of the given inodes in the background.
+	// Nearby pages are read as one range; all ranges are read concurrently.
+	void prefetchInodes(std::vector<uint32_t> numbers);
 	async::result<std::shared_ptr<Inode>> createRegular(int uid, int gid);
 	async::result<std::shared_ptr<Inode>> createDirectory();
 	async::result<std::shared_ptr<Inode>> createSymlink();
 
+	// Attribute leases, see WatchAttributesRequest in fs.bragi.
+	// Leases are only granted once a client watches for revocations.
+	bool grantLease(uint32_t number);
+	// Must be called whenever the attributes of an inode change.
+	void revokeLease(uint32_t number);
+	// Waits until at least one lease is revoked and returns (at most max) revoked inodes.
+	async::result<std::vector<int64_t>> waitForRevokedLeases(size_t max);
+
 	async::result<void> write(Inode *inode, uint64_t offset,
 			const void *buffer, size_t length);
 
+	// Delayed allocation: write() only records dirty ranges; they are flushed
+	// periodically or once dirtyThreshold bytes are dirty.
+	void markDirty(Inode *inode, uint64_t offset, size_t length);
+	async::detached runWriteback();
+	// Flushes all dirty inodes, then the block group descriptors.
+	async::result<void> flushDirty();
+	// Assigns blocks to the dirty ranges of the inode and writes back its page cache.
+	// If dataOnly is set, the inode itself is only written back if it is metadataDirty.
+	async::result<void> flushInode(std::shared_ptr<Inode> inode, bool dataOnly = false);
+
+	// Implements fsync() and fdatasync(). Calls that arrive within commitWindow of each other
+	// (or while a commit is running) are grouped into a single commit, which writes back
+	// all of their inodes and then flushes the device once.
+	async::result<void> sync(std::shared_ptr<Inode> inode, bool dataOnly);
+	async::detached runCommits();
+
 	async::detached initiateInode(std::shared_ptr<Inode> inode);
 	async::detached manageFileData(std::shared_ptr<Inode> inode);
 	async::detached manageIndirect(std::shared_ptr<Inode> inode, int order,
 			helix::UniqueDescriptor memory);
 
-	async::result<uint32_t> allocateBlock();
+	// Allocates a block close to (preferably after) goal.
+	// The block is suitable for block maps, i.e., it fits into 32 bits.
+	async::result<uint32_t> allocateBlock(uint64_t goal = 0);
+	// Allocates a run of up to maxCount contiguous blocks close to goal.
+	// Returns the first block and the length of the run (or zero if the disk is full).
+	async::result<std::pair<uint64_t, size_t>> allocateBlocks(uint64_t goal, size_t maxCount);
 	async::result<uint32_t> allocateInode();
 
+	// Implements FITRIM: discards the free blocks in [start, start + length) (in bytes)
+	// that form runs of at least minLength bytes. Returns the number of discarded bytes.
+	async::result<uint64_t> trimFreeBlocks(uint64_t start, uint64_t length, uint64_t minLength);
+
 	async::result<void> assignDataBlocks(Inode *inode,
 			uint64_t block_offset, size_t num_blocks);
+	// Counterpart of assignExtentBlocks() for inodes that use block maps.
+	async::result<void> assignMappedBlocks(Inode *inode,
+			uint64_t block_offset, size_t num_blocks);
+	// Assigns blocks to all empty slots of a block pointer array;
+	// goal is updated to follow the last assigned block.
+	async::result<void> assignBlockSlots(Inode *inode,
+			uint32_t *slots, size_t count, uint32_t &goal);
+
+	// Returns the root node (block zero) or a cached extent tree block.
+	async::result<DiskExtentHeader *> accessExtentNode(Inode *inode, uint64_t block);
+	async::result<void> writebackExtentNode(Inode *inode, uint64_t block);
+	async::result<ExtentPath> walkExtents(Inode *inode, uint64_t index);
+	// Maps up to maxCount blocks starting at index; adjacent extents are merged.
+	async::result<ExtentMapping> mapExtents(Inode *inode, uint64_t index, size_t maxCount);
+	// Counterpart of assignDataBlocks() for inodes with EXT4_EXTENTS_FL.
+	async::result<void> assignExtentBlocks(Inode *inode,
+			uint64_t block_offset, size_t num_blocks);
+	async::result<void> insertExtent(Inode *inode, uint64_t index,
+			uint64_t block, size_t count);
+	// Moves the entries of the root node into a new block, increasing the depth of the tree.
+	async::result<void> growExtentTree(Inode *inode, uint64_t goal);
+	// Splits the (full) node at the given level; its parent must have room.
+	async::result<void> splitExtentNode(Inode *inode, ExtentPath &path, size_t level);
+
+	// Submits all runs at once (with the device plugged) such that the block layer
+	// can merge and reorder them; waits until all of them are completed.
+	async::result<void> transferRuns(const std::vector<BlockRun> &runs,
+			void *buffer, bool write);
+
+	// Counterpart of transferRuns() for discards.
+	async::result<void> discardRuns(const std::vector<BlockRun> &runs);
 
 	async::result<void> readDataBlocks(std::shared_ptr<Inode> inode, uint64_t block_offset,
 			size_t num_blocks, void *buffer);
@@ -278,6 +549,19 @@ struct FileSystem {
 	async::result<void> truncate(Inode *inode, size_t size);
 
 	async::result<void> writebackBgdt();
+	// Block allocations only mark the BGDT dirty; flushDirty() writes it back.
+	bool bgdtDirty = false;
+
+	DiskGroupDesc &groupDesc(uint32_t bg_idx) {
+		return *reinterpret_cast<DiskGroupDesc *>(blockGroupDescriptorBuffer.data()
+				+ bg_idx * groupDescSize);
+	}
+
+	// With flex_bg, the metadata of a group can be stored in other groups;
+	// hence, always go through these accessors.
+	uint64_t groupBlockBitmap(uint32_t bg_idx);
+	uint64_t groupInodeBitmap(uint32_t bg_idx);
+	uint64_t groupInodeTable(uint32_t bg_idx);
 
 	BlockDevice *device;
 	uint16_t inodeSize;
@@ -288,16 +572,43 @@ struct FileSystem {
 	uint32_t numBlockGroups;
 	uint32_t blocksPerGroup;
 	uint32_t inodesPerGroup;
-	uint32_t blocksCount;
+	uint64_t blocksCount;
 	uint32_t inodesCount;
+	uint32_t featureCompat;
+	uint32_t featureIncompat;
+	// Parameters for hashed directories.
+	uint32_t hashSeed[4];
+	uint8_t defHashVersion;
+	bool unsignedHash;
+	// Size of each entry of the block group descriptor table.
+	size_t groupDescSize;
 	std::vector<std::byte> blockGroupDescriptorBuffer;
-	DiskGroupDesc *bgdt;
+	// Per block group: all blocks below this index (relative to the group) are allocated.
+	std::vector<uint32_t> blockGroupHints;
 
 	helix::UniqueDescriptor blockBitmap;
 	helix::UniqueDescriptor inodeBitmap;
 	helix::UniqueDescriptor inodeTable;
 
 	std::unordered_map<uint32_t, std::weak_ptr<Inode>> activeInodes;
+
+	bool watchingLeases = false;
+	std::unordered_set<uint32_t> leasedInodes;
+	std::vector<int64_t> revokedLeases;
+	async::recurring_event leasesRevoked;
+
+	// Inodes with non-empty dirtyRanges and the total size of these ranges.
+	std::unordered_map<uint32_t, std::shared_ptr<Inode>> dirtyInodes;
+	size_t dirtyBytes = 0;
+	bool flushing = false;
+
+	// Inodes that join the next commit; the flag is set if only their data is synced.
+	std::unordered_map<uint32_t, std::pair<std::shared_ptr<Inode>, bool>> syncInodes;
+	// Number of commits that took syncInodes and number of commits that finished.
+	uint64_t commitsStarted = 0;
+	uint64_t commitsCompleted = 0;
+	bool committing = false;
+	async::recurring_event commitDone;
 };
 
 // --------------------------------------------------------
@@ -309,9 +620,15 @@ struct OpenFile {
 
 	async::result<std::optional<std::string>> readEntries();
 
+	// Fills the buffer with struct dirent64 entries. The offset cookies are
+	// offsets into the directory file.
+	async::result<frg::expected<protocols::fs::Error, size_t>>
+	readDirents(void *buffer, size_t size);
+
 	std::shared_ptr<Inode> inode;
 	uint64_t offset;
 	Flock flock;
+	protocols::fs::RangeLockHandle rangeLocks;
 	bool append;
 };
 
@@ -66,7 +66,9 @@ Partition &Table::getPartition(int index) {
 Partition::Partition(Table &table, Guid id, Guid type,
 		uint64_t start_lba, uint64_t num_sectors)
 : BlockDevice(table.getDevice()->sectorSize, table.getDevice()->parentId), _table(table),
-	_id(id), _type(type), _startLba(start_lba), _numSectors(num_sectors) { }
+	_id(id), _type(type), _startLba(start_lba), _numSectors(num_sectors) {
+	supportsDiscard = table.getDevice()->supportsDiscard;
+}
 
 Guid Partition::type() {
 	return _type;
@@ -74,19 +76,83 @@ Guid Partition::type() {
 
 async::result<void> Partition::readSectors(uint64_t sector, void *buffer, size_t count) {
 	assert(sector + count <= _numSectors);
-	return _table.getDevice()->readSectors(_startLba + sector,
+	auto startTime = ioStats.start();
+	co_await _table.getDevice()->readSectors(_startLba + sector,
 			buffer, count);
+	ioStats.complete(false, count * sectorSize, startTime);
 }
 
 async::result<void> Partition::writeSectors(uint64_t sector, const void *buffer, size_t count) {
 	assert(sector + count <= _numSectors);
-	return _table.getDevice()->writeSectors(_startLba + sector,
+	auto startTime = ioStats.start();
+	co_await _table.getDevice()->writeSectors(_startLba + sector,
 			buffer, count);
+	ioStats.complete(true, count * sectorSize, startTime);
+}
+
+async::result<void> Partition::readSectorsV(uint64_t sector,
+		std::span<const Segment> segments) {
+	size_t count = 0;
+	for(auto &segment : segments)
+		count += segment.numSectors;
+	assert(sector + count <= _numSectors);
+	auto startTime = ioStats.start();
+	co_await _table.getDevice()->readSectorsV(_startLba + sector, segments);
+	ioStats.complete(false, count * sectorSize, startTime);
+}
+
+async::result<void> Partition::writeSectorsV(uint64_t sector,
+		std::span<const Segment> segments) {
+	size_t count = 0;
+	for(auto &segment : segments)
+		count += segment.numSectors;
+	assert(sector + count <= _numSectors);
+	auto startTime = ioStats.start();
+	co_await _table.getDevice()->writeSectorsV(_startLba + sector, segments);
+	ioStats.complete(true, count * sectorSize, startTime);
+}
+
+async::result<void> Partition::readSectorsPolled(uint64_t sector, void *buffer, size_t count) {
+	assert(sector + count <= _numSectors);
+	auto startTime = ioStats.start();
+	co_await _table.getDevice()->readSectorsPolled(_startLba + sector,
+			buffer, count);
+	ioStats.complete(false, count * sectorSize, startTime);
+}
+
+async::result<void> Partition::writeSectorsPolled(uint64_t sector, const void *buffer, size_t count) {
+	assert(sector + count <= _numSectors);
+	auto startTime = ioStats.start();
+	co_await _table.getDevice()->writeSectorsPolled(_startLba + sector,
+			buffer, count);
+	ioStats.complete(true, count * sectorSize, startTime);
+}
+
+async::result<void> Partition::discard(uint64_t sector, size_t num_sectors) {
+	assert(sector + num_sectors <= _numSectors);
+	co_await _table.getDevice()->discard(_startLba + sector, num_sectors);
+}
+
+async::result<void> Partition::writeZeroes(uint64_t sector, size_t num_sectors) {
+	assert(sector + num_sectors <= _numSectors);
+	co_await _table.getDevice()->writeZeroes(_startLba + sector, num_sectors);
+}
+
+async::result<void> Partition::flush() {
+	co_await _table.getDevice()->flush();
 }
 
 async::result<size_t> Partition::getSize() {
 	co_return _numSectors * sectorSize;
 }
 
+void Partition::plug() {
+	_table.getDevice()->plug();
+}
+
+void Partition::unplug() {
+	_table.getDevice()->unplug();
+}
+
 } } // namespace blockfs::gpt
 
@@ -104,8 +104,29 @@ struct Partition : public BlockDevice {
 	async::result<void> writeSectors(uint64_t sector, const void *buffer,
 			size_t num_sectors) override;
 
+	async::result<void> readSectorsV(uint64_t sector,
+			std::span<const Segment> segments) override;
+
+	async::result<void> writeSectorsV(uint64_t sector,
+			std::span<const Segment> segments) override;
+
+	async::result<void> readSectorsPolled(uint64_t sector, void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> writeSectorsPolled(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> discard(uint64_t sector, size_t num_sectors) override;
+
+	async::result<void> writeZeroes(uint64_t sector, size_t num_sectors) override;
+
+	async::result<void> flush() override;
+
 	async::result<size_t> getSize() override;
 
+	void plug() override;
+	void unplug() override;
+
 	Guid id();
 
 	Guid type();
@@ -2,7 +2,9 @@
 #include <string.h>
 #include <iostream>
 #include <algorithm>
+#include <bit>
 #include <string>
+#include <vector>
 #include <sys/epoll.h>
 #include <linux/cdrom.h>
 #include <linux/fs.h>
@@ -17,6 +19,7 @@
 #include <blockfs.hpp>
 #include "gpt.hpp"
 #include "ext2fs.hpp"
+#include "queue.hpp"
 #include "raw.hpp"
 #include "fs.bragi.hpp"
 #include <bragi/helpers-std.hpp>
@@ -84,6 +87,27 @@ async::result<protocols::fs::Error> flock(void *object, int flags) {
 	co_return result;
 }
 
+async::result<frg::expected<protocols::fs::Error, protocols::fs::RangeLock>>
+lockRange(void *object, protocols::fs::RangeLockCommand command, bool ofd,
+		protocols::fs::RangeLock lock) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_await self->inode->readyJump.wait();
+	auto manager = &self->inode->rangeLockManager;
+
+	if(command == protocols::fs::RangeLockCommand::test) {
+		auto conflict = self->rangeLocks.test(manager, ofd, lock);
+		if(!conflict)
+			co_return protocols::fs::RangeLock{};
+		co_return *conflict;
+	}
+
+	auto result = co_await self->rangeLocks.lock(manager, ofd, lock,
+			command == protocols::fs::RangeLockCommand::setWait);
+	if(result != protocols::fs::Error::none)
+		co_return result;
+	co_return lock;
+}
+
 async::result<protocols::fs::ReadResult> read(void *object, helix_ng::CredentialsView,
 		void *buffer, size_t length) {
 	if (!length)
@@ -223,6 +247,55 @@ async::result<frg::expected<protocols::fs::Error, size_t>> pwrite(void *object,
 	co_return length;
 }
 
+async::result<frg::expected<protocols::fs::Error, size_t>>
+copyFileRange(void *object, std::optional<int64_t> offset, int64_t targetInode,
+		int64_t targetOffset, size_t length) {
+	// Bound the size of the mapping below.
+	constexpr size_t maxChunkSize = 1 << 20;
+
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_await self->inode->readyJump.wait();
+
+	auto target = self->inode->fs.accessInode(targetInode);
+	co_await target->readyJump.wait();
+	if(target->fileType != kTypeRegular)
+		co_return protocols::fs::Error::illegalArguments;
+
+	// ext2 cannot share blocks between files, hence we copy the data from the
+	// page cache of the source file into the page cache of the target file.
+	auto chunkOffset = offset.value_or(self->offset);
+	if(static_cast<uint64_t>(chunkOffset) >= self->inode->fileSize())
+		co_return size_t{0};
+	auto chunkSize = std::min({length, maxChunkSize,
+			static_cast<size_t>(self->inode->fileSize() - chunkOffset)});
+	if(!chunkSize)
+		co_return size_t{0};
+	// Like Linux, reject overlapping ranges within the same file.
+	if(target == self->inode && chunkOffset < targetOffset + static_cast<int64_t>(chunkSize)
+			&& targetOffset < chunkOffset + static_cast<int64_t>(chunkSize))
+		co_return protocols::fs::Error::illegalArguments;
+
+	auto mapOffset = chunkOffset & ~int64_t(0xFFF);
+	auto mapSize = (((chunkOffset & int64_t(0xFFF)) + chunkSize + 0xFFF) & ~size_t(0xFFF));
+
+	helix::LockMemoryView lockMemory;
+	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(self->inode->frontalMemory),
+			&lockMemory, mapOffset, mapSize, helix::Dispatcher::global());
+	co_await submit.async_wait();
+	HEL_CHECK(lockMemory.error());
+
+	helix::Mapping fileMap{helix::BorrowedDescriptor{self->inode->frontalMemory},
+			static_cast<ptrdiff_t>(mapOffset), mapSize,
+			kHelMapProtRead | kHelMapDontRequireBacking};
+
+	co_await self->inode->fs.write(target.get(), targetOffset,
+			reinterpret_cast<char *>(fileMap.get()) + (chunkOffset - mapOffset), chunkSize);
+	if(!offset)
+		self->offset += chunkSize;
+
+	co_return chunkSize;
+}
+
 async::result<helix::BorrowedDescriptor>
 accessMemory(void *object) {
 	auto self = static_cast<ext2fs::OpenFile *>(object);
@@ -241,6 +314,17 @@ readEntries(void *object) {
 	co_return co_await self->readEntries();
 }
 
+async::result<frg::expected<protocols::fs::Error, size_t>>
+readDirents(void *object, void *buffer, size_t size) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+
+	ostContext.emit(
+		ostEvtReadDir
+	);
+
+	co_return co_await self->readDirents(buffer, size);
+}
+
 async::result<frg::expected<protocols::fs::Error>>
 truncate(void *object, size_t size) {
 	auto self = static_cast<ext2fs::OpenFile *>(object);
@@ -248,6 +332,13 @@ truncate(void *object, size_t size) {
 	co_return {};
 }
 
+async::result<frg::expected<protocols::fs::Error>>
+fsync(void *object, bool dataOnly) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_await self->inode->fs.sync(self->inode, dataOnly);
+	co_return {};
+}
+
 async::result<int> getFileFlags(void *) {
 	std::cout << "libblockfs: getFileFlags is stubbed" << std::endl;
     co_return 0;
@@ -258,6 +349,58 @@ async::result<void> setFileFlags(void *, int) {
     co_return;
 }
 
+async::result<void> ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg,
+		helix::UniqueLane conversation) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+
+	if(id != managarm::fs::GenericIoctlRequest::message_id) {
+		std::cout << "\e[31m" "libblockfs: Unknown ioctl() message with ID "
+				<< id << "\e[39m" << std::endl;
+		auto [dismiss] = co_await helix_ng::exchangeMsgs(
+			conversation, helix_ng::dismiss());
+		HEL_CHECK(dismiss.error());
+		co_return;
+	}
+
+	auto req = bragi::parse_head_only<managarm::fs::GenericIoctlRequest>(msg);
+	assert(req);
+
+	if(req->command() == FITRIM) {
+		fstrim_range range;
+		auto [recv_range] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(&range, sizeof(range))
+		);
+		HEL_CHECK(recv_range.error());
+
+		managarm::fs::GenericIoctlReply resp;
+		auto &fs = self->inode->fs;
+		if(!fs.device->supportsDiscard) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+			range.len = 0;
+		}else{
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			range.len = co_await fs.trimFreeBlocks(range.start, range.len, range.minlen);
+		}
+
+		// Like Linux, return the number of discarded bytes in range.len.
+		auto [send_resp, send_range] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
+			helix_ng::sendBuffer(&range, sizeof(range))
+		);
+		HEL_CHECK(send_resp.error());
+		HEL_CHECK(send_range.error());
+	}else{
+		std::cout << "\e[31m" "libblockfs: Unknown ioctl() message with ID "
+				<< req->command() << "\e[39m" << std::endl;
+
+		auto [dismiss] = co_await helix_ng::exchangeMsgs(
+			conversation, helix_ng::dismiss());
+		HEL_CHECK(dismiss.error());
+	}
+}
+
 constexpr protocols::fs::FileOperations fileOperations {
 	.seekAbs      = &seekAbs,
 	.seekRel      = &seekRel,
@@ -267,11 +410,16 @@ constexpr protocols::fs::FileOperations fileOperations {
 	.write        = &write,
 	.pwrite       = &pwrite,
 	.readEntries  = &readEntries,
+	.readDirents  = &readDirents,
 	.accessMemory = &accessMemory,
 	.truncate     = &truncate,
+	.fsync        = &fsync,
+	.ioctl        = &ioctl,
 	.flock        = &flock,
+	.lockRange    = &lockRange,
 	.getFileFlags = &getFileFlags,
 	.setFileFlags = &setFileFlags,
+	.copyFileRange = &copyFileRange,
 };
 
 async::result<frg::expected<protocols::fs::Error, protocols::fs::GetLinkResult>>
@@ -379,6 +527,7 @@ getStats(std::shared_ptr<void> object) {
 	stats.accessTime.tv_sec = self->diskInode()->atime;
 	stats.dataModifyTime.tv_sec = self->diskInode()->mtime;;
 	stats.anyChangeTime.tv_sec = self->diskInode()->ctime;
+	stats.lease = self->fs.grantLease(self->number);
 
 	co_return stats;
 }
@@ -397,6 +546,7 @@ open(std::shared_ptr<void> object, bool append) {
 	struct timespec time = clk::getRealtime();
 	self->diskInode()->atime = time.tv_sec;
 
+	self->fs.revokeLease(self->number);
 	auto syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
 			self->diskMapping.get(), self->fs.inodeSize);
@@ -561,31 +711,32 @@ constexpr protocols::fs::NodeOperations nodeOperations{
 	.traverseLinks = &traverseLinks
 };
 
-async::result<protocols::fs::ReadResult> rawRead(void *object, helix_ng::CredentialsView,
-		void *buffer, size_t length) {
+// O_DIRECT transfers must be aligned to the sector size.
+bool isDirectAligned(raw::OpenFile *self, uint64_t offset, size_t length) {
+	auto sectorSize = self->rawFs->device->sectorSize;
+	return !(offset % sectorSize) && !(length % sectorSize);
+}
+
+async::result<protocols::fs::ReadResult> rawPread(void *object, int64_t offset,
+		helix_ng::CredentialsView, void *buffer, size_t length) {
 	assert(length);
 
 	uint64_t start;
 	HEL_CHECK(helGetClock(&start));
 
 	auto self = static_cast<raw::OpenFile *>(object);
-	auto file_size = co_await self->rawFs->device->getSize();
-
-	if(self->offset >= file_size)
-		co_return size_t{0};
-
-	auto remaining = file_size - self->offset;
-	auto chunkSize = std::min(length, remaining);
-	if(!chunkSize)
-		co_return size_t{0}; // TODO: Return an explicit end-of-file error?
-
-	auto chunk_offset = self->offset;
-	self->offset += chunkSize;
-
-	auto readMemory = co_await helix_ng::readMemory(
-			helix::BorrowedDescriptor(self->rawFs->frontalMemory),
-			chunk_offset, chunkSize, buffer);
-	HEL_CHECK(readMemory.error());
+	if(offset < 0)
+		co_return protocols::fs::Error::illegalArguments;
+
+	size_t chunkSize;
+	if(self->direct) {
+		if(!isDirectAligned(self, offset, length))
+			co_return protocols::fs::Error::illegalArguments;
+		chunkSize = co_await self->rawFs->readDirect(offset, buffer, length,
+				self->polled);
+	}else{
+		chunkSize = co_await self->rawFs->readCached(offset, buffer, length);
+	}
 
 	uint64_t end;
 	HEL_CHECK(helGetClock(&end));
@@ -599,6 +750,49 @@ async::result<protocols::fs::ReadResult> rawRead(void *object, helix_ng::Credent
 	co_return chunkSize;
 }
 
+async::result<protocols::fs::ReadResult> rawRead(void *object, helix_ng::CredentialsView credentials,
+		void *buffer, size_t length) {
+	auto self = static_cast<raw::OpenFile *>(object);
+
+	auto result = co_await rawPread(object, self->offset, credentials, buffer, length);
+	if(auto chunkSize = std::get_if<size_t>(&result))
+		self->offset += *chunkSize;
+	co_return result;
+}
+
+async::result<frg::expected<protocols::fs::Error, size_t>> rawPwrite(void *object, int64_t offset,
+		helix_ng::CredentialsView, const void *buffer, size_t length) {
+	auto self = static_cast<raw::OpenFile *>(object);
+	if(offset < 0)
+		co_return protocols::fs::Error::illegalArguments;
+	if(!length)
+		co_return size_t{0};
+
+	size_t chunkSize;
+	if(self->direct) {
+		if(!isDirectAligned(self, offset, length))
+			co_return protocols::fs::Error::illegalArguments;
+		chunkSize = co_await self->rawFs->writeDirect(offset, buffer, length,
+				self->polled);
+	}else{
+		chunkSize = co_await self->rawFs->writeCached(offset, buffer, length);
+	}
+
+	if(!chunkSize)
+		co_return protocols::fs::Error::noSpaceLeft;
+	co_return chunkSize;
+}
+
+async::result<frg::expected<protocols::fs::Error, size_t>> rawWrite(void *object,
+		helix_ng::CredentialsView credentials, const void *buffer, size_t length) {
+	auto self = static_cast<raw::OpenFile *>(object);
+
+	auto result = co_await rawPwrite(object, self->offset, credentials, buffer, length);
+	if(result)
+		self->offset += result.value();
+	co_return result;
+}
+
 async::result<protocols::fs::Error> rawFlock(void *object, int flags) {
 	auto self = static_cast<raw::OpenFile*>(object);
 
@@ -641,26 +835,192 @@ async::result<void> rawIoctl(void *object, uint32_t id, helix_ng::RecvInlineResu
 					helix_ng::sendBuffer(ser.data(), ser.size())
 			);
 			HEL_CHECK(send_resp.error());
+		} else if (req->command() == BLKDISCARD || req->command() == BLKZEROOUT) {
+			// The argument is {start, length} in bytes.
+			uint64_t range[2];
+			auto [recv_range] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::recvBuffer(range, sizeof(range))
+			);
+			HEL_CHECK(recv_range.error());
+
+			auto device = self->rawFs->device;
+			auto deviceSize = co_await device->getSize();
+
+			managarm::fs::GenericIoctlReply rsp;
+			if (range[0] % device->sectorSize || range[1] % device->sectorSize
+					|| range[0] > deviceSize || range[1] > deviceSize - range[0]) {
+				rsp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+			} else if (req->command() == BLKDISCARD && !device->supportsDiscard) {
+				rsp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+			} else {
+				co_await self->rawFs->discardDirect(range[0], range[1],
+						req->command() == BLKZEROOUT);
+				rsp.set_error(managarm::fs::Errors::SUCCESS);
+			}
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(rsp, frg::stl_allocator{})
+			);
+			HEL_CHECK(send_resp.error());
+		} else if (req->command() == BLKFLSBUF) {
+			// Raw writes are written through, so only the device cache needs to be flushed.
+			co_await self->rawFs->device->flush();
+
+			managarm::fs::GenericIoctlReply rsp;
+			rsp.set_error(managarm::fs::Errors::SUCCESS);
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(rsp, frg::stl_allocator{})
+			);
+			HEL_CHECK(send_resp.error());
 		} else {
 			co_await self->rawFs->device->handleIoctl(req.value(), std::move(conversation));
 		}
 	}
 }
 
+async::result<frg::expected<protocols::fs::Error>> rawFsync(void *object, bool) {
+	auto self = static_cast<raw::OpenFile *>(object);
+	// Raw writes are written through, so only the device cache needs to be flushed.
+	co_await self->rawFs->device->flush();
+	co_return {};
+}
+
 constexpr protocols::fs::FileOperations rawOperations {
 	.seekAbs = rawSeekAbs,
 	.seekRel = rawSeekRel,
 	.seekEof = rawSeekEof,
 	.read = rawRead,
+	.pread = rawPread,
+	.write = rawWrite,
+	.pwrite = rawPwrite,
+	.fsync = rawFsync,
 	.ioctl = rawIoctl,
 	.flock = rawFlock,
 };
 
+// Replies to a WatchAttributesRequest once leases are revoked.
+async::detached watchAttributes(ext2fs::FileSystem *fs, helix::UniqueDescriptor conversation,
+		size_t maxInodes) {
+	auto inodes = co_await fs->waitForRevokedLeases(maxInodes);
+
+	managarm::fs::WatchAttributesReply resp;
+	resp.set_error(managarm::fs::Errors::SUCCESS);
+	resp.set_num_inodes(inodes.size());
+
+	auto ser = resp.SerializeAsString();
+	auto [send_resp, send_inodes] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::sendBuffer(ser.data(), ser.size()),
+		helix_ng::sendBuffer(inodes.data(), inodes.size() * sizeof(int64_t))
+	);
+	HEL_CHECK(send_resp.error());
+	HEL_CHECK(send_inodes.error());
+}
+
 } // anonymous namespace
 
+uint64_t IoStats::start() {
+	update();
+	inFlight++;
+
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	return now;
+}
+
+void IoStats::complete(bool write, size_t bytes, uint64_t startTime) {
+	update();
+	assert(inFlight);
+	inFlight--;
+
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	auto latency = now - startTime;
+
+	auto &counters = write ? writes : reads;
+	counters.ios++;
+	counters.sectors += bytes / 512;
+	counters.ticks += latency;
+
+	auto micros = latency / 1000;
+	size_t bucket = micros ? std::bit_width(micros) - 1 : 0;
+	counters.histogram[std::min(bucket, numBuckets - 1)]++;
+}
+
+void IoStats::update() {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	if(inFlight) {
+		ioTicks += now - _lastUpdate;
+		timeInQueue += inFlight * (now - _lastUpdate);
+	}
+	_lastUpdate = now;
+}
+
 BlockDevice::BlockDevice(size_t sector_size, int64_t parent_id)
 : size(0), sectorSize(sector_size), parentId(parent_id) { }
 
+async::result<void> BlockDevice::readSectorsV(uint64_t sector, std::span<const Segment> segments) {
+	for(auto &segment : segments) {
+		co_await readSectors(sector, segment.buffer, segment.numSectors);
+		sector += segment.numSectors;
+	}
+}
+
+async::result<void> BlockDevice::writeSectorsV(uint64_t sector, std::span<const Segment> segments) {
+	for(auto &segment : segments) {
+		co_await writeSectors(sector, segment.buffer, segment.numSectors);
+		sector += segment.numSectors;
+	}
+}
+
+async::result<void> BlockDevice::writeZeroes(uint64_t sector, size_t num_sectors) {
+	// Write at most 64 KiB at a time.
+	auto chunkSectors = std::max(size_t{0x10000} / sectorSize, size_t{1});
+	std::vector<std::byte> zeroes(std::min(num_sectors, chunkSectors) * sectorSize);
+	while(num_sectors) {
+		auto n = std::min(num_sectors, chunkSectors);
+		co_await writeSectors(sector, zeroes.data(), n);
+		sector += n;
+		num_sectors -= n;
+	}
+}
+
+async::result<void> sendDeviceStats(helix::UniqueDescriptor conversation, IoStats &stats) {
+	stats.update();
+
+	managarm::fs::DeviceStatsReply resp;
+	resp.set_error(managarm::fs::Errors::SUCCESS);
+	resp.set_read_ios(stats.reads.ios);
+	resp.set_read_merges(stats.reads.merges);
+	resp.set_read_sectors(stats.reads.sectors);
+	resp.set_read_ticks(stats.reads.ticks / 1'000'000);
+	resp.set_write_ios(stats.writes.ios);
+	resp.set_write_merges(stats.writes.merges);
+	resp.set_write_sectors(stats.writes.sectors);
+	resp.set_write_ticks(stats.writes.ticks / 1'000'000);
+	resp.set_in_flight(stats.inFlight);
+	resp.set_io_ticks(stats.ioTicks / 1'000'000);
+	resp.set_time_in_queue(stats.timeInQueue / 1'000'000);
+	resp.set_num_buckets(IoStats::numBuckets);
+
+	std::array<uint64_t, 2 * IoStats::numBuckets> histograms;
+	std::ranges::copy(stats.reads.histogram, histograms.begin());
+	std::ranges::copy(stats.writes.histogram, histograms.begin() + IoStats::numBuckets);
+
+	auto [send_resp, send_histograms] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
+		helix_ng::sendBuffer(histograms.data(), histograms.size() * sizeof(uint64_t))
+	);
+	HEL_CHECK(send_resp.error());
+	HEL_CHECK(send_histograms.error());
+}
+
 async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition, std::unique_ptr<raw::RawFs> rawFs) {
 	std::cout << "unix device: Connection" << std::endl;
 
@@ -745,6 +1105,15 @@ async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition
 			);
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(push_node.error());
+		}else if(preamble.id() == managarm::fs::WatchAttributesRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::fs::WatchAttributesRequest>(recv_head);
+			if(!req || !req->max_inodes()) {
+				std::cout << "libblockfs: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			// This request only completes once leases are revoked; do not block the lane.
+			watchAttributes(fs.get(), std::move(conversation), req->max_inodes());
 		}else if(preamble.id() == managarm::fs::RenameRequest::message_id) {
 			std::vector<std::byte> tail(preamble.tail_size());
 			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
@@ -837,7 +1206,9 @@ async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition
 		}else if(req.req_type() == managarm::fs::CntReqType::DEV_OPEN) {
 			helix::UniqueLane local_lane, remote_lane;
 			std::tie(local_lane, remote_lane) = helix::createStream();
-			auto file = smarter::make_shared<raw::OpenFile>(rawFs.get());
+			auto file = smarter::make_shared<raw::OpenFile>(rawFs.get(),
+					req.flags() & managarm::fs::OpenFlags::OF_DIRECT,
+					req.flags() & managarm::fs::OpenFlags::OF_POLLED);
 			async::detach(protocols::fs::servePassthrough(std::move(local_lane),
 					file,
 					&rawOperations));
@@ -853,6 +1224,8 @@ async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition
 			);
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(push_node.error());
+		} else if(preamble.id() == managarm::fs::DeviceStatsRequest::message_id) {
+			co_await sendDeviceStats(std::move(conversation), partition->ioStats);
 		} else if(preamble.id() == managarm::fs::GenericIoctlRequest::message_id) {
 			auto req = bragi::parse_head_only<managarm::fs::GenericIoctlRequest>(recv_head);
 
@@ -942,7 +1315,9 @@ async::detached serveDevice(helix::UniqueLane lane, std::unique_ptr<raw::RawFs>
 		}else if(req.req_type() == managarm::fs::CntReqType::DEV_OPEN) {
 			helix::UniqueLane local_lane, remote_lane;
 			std::tie(local_lane, remote_lane) = helix::createStream();
-			auto file = smarter::make_shared<raw::OpenFile>(rawFs.get());
+			auto file = smarter::make_shared<raw::OpenFile>(rawFs.get(),
+					req.flags() & managarm::fs::OpenFlags::OF_DIRECT,
+					req.flags() & managarm::fs::OpenFlags::OF_POLLED);
 			async::detach(protocols::fs::servePassthrough(std::move(local_lane),
 					file,
 					&rawOperations));
@@ -958,6 +1333,8 @@ async::detached serveDevice(helix::UniqueLane lane, std::unique_ptr<raw::RawFs>
 			);
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(push_node.error());
+		} else if(preamble.id() == managarm::fs::DeviceStatsRequest::message_id) {
+			co_await sendDeviceStats(std::move(conversation), rawFs->device->ioStats);
 		} else if(preamble.id() == managarm::fs::GenericIoctlRequest::message_id) {
 			auto req = bragi::parse_head_only<managarm::fs::GenericIoctlRequest>(recv_head);
 
@@ -1003,6 +1380,10 @@ async::detached runDevice(BlockDevice *device) {
 	if(!clkInitialized)
 		co_await clk::enumerateTracker();
 
+	// All users of the device (including partitions) go through the request queue.
+	// Like the table below, the queue is never deleted.
+	device = new RequestQueue(device);
+
 	// TODO(qookie): Don't leak the table.
 	// Currently it should be fine to leak it since neither it nor
 	// the device gets deleted anyway.
@@ -0,0 +1,284 @@
+
+#include <assert.h>
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+
+#include "queue.hpp"
+
+namespace blockfs {
+
+RequestQueue::RequestQueue(BlockDevice *device)
+: BlockDevice(device->sectorSize, device->parentId), _device(device) {
+	size = device->size;
+	diskNamePrefix = device->diskNamePrefix;
+	diskNameSuffix = device->diskNameSuffix;
+	partNameSuffix = device->partNameSuffix;
+	rotational = device->rotational;
+	maxQueueDepth = std::max(device->maxQueueDepth, size_t{1});
+	maxMergeBytes = device->maxMergeBytes;
+	supportsDiscard = device->supportsDiscard;
+}
+
+async::result<void> RequestQueue::readSectors(uint64_t sector, void *buffer,
+		size_t num_sectors) {
+	Segment segment{buffer, num_sectors};
+	co_await readSectorsV(sector, {&segment, 1});
+}
+
+async::result<void> RequestQueue::writeSectors(uint64_t sector, const void *buffer,
+		size_t num_sectors) {
+	Segment segment{const_cast<void *>(buffer), num_sectors};
+	co_await writeSectorsV(sector, {&segment, 1});
+}
+
+async::result<void> RequestQueue::readSectorsV(uint64_t sector,
+		std::span<const Segment> segments) {
+	Request request;
+	request.type = RequestType::read;
+	request.sector = sector;
+	request.numSectors = 0;
+	for(auto &segment : segments)
+		request.numSectors += segment.numSectors;
+	request.segments = segments;
+	co_await _submit(&request);
+}
+
+async::result<void> RequestQueue::writeSectorsV(uint64_t sector,
+		std::span<const Segment> segments) {
+	Request request;
+	request.type = RequestType::write;
+	request.sector = sector;
+	request.numSectors = 0;
+	for(auto &segment : segments)
+		request.numSectors += segment.numSectors;
+	request.segments = segments;
+	co_await _submit(&request);
+}
+
+async::result<void> RequestQueue::readSectorsPolled(uint64_t sector, void *buffer,
+		size_t num_sectors) {
+	auto startTime = ioStats.start();
+	co_await _device->readSectorsPolled(sector, buffer, num_sectors);
+	ioStats.complete(false, num_sectors * sectorSize, startTime);
+}
+
+async::result<void> RequestQueue::writeSectorsPolled(uint64_t sector, const void *buffer,
+		size_t num_sectors) {
+	auto startTime = ioStats.start();
+	co_await _device->writeSectorsPolled(sector, buffer, num_sectors);
+	ioStats.complete(true, num_sectors * sectorSize, startTime);
+}
+
+async::result<void> RequestQueue::discard(uint64_t sector, size_t num_sectors) {
+	if(!supportsDiscard)
+		co_return;
+
+	Request request;
+	request.type = RequestType::discard;
+	request.sector = sector;
+	request.numSectors = num_sectors;
+	co_await _submit(&request);
+}
+
+async::result<void> RequestQueue::writeZeroes(uint64_t sector, size_t num_sectors) {
+	Request request;
+	request.type = RequestType::writeZeroes;
+	request.sector = sector;
+	request.numSectors = num_sectors;
+	co_await _submit(&request);
+}
+
+async::result<void> RequestQueue::flush() {
+	return _device->flush();
+}
+
+async::result<size_t> RequestQueue::getSize() {
+	return _device->getSize();
+}
+
+async::result<void> RequestQueue::handleIoctl(managarm::fs::GenericIoctlRequest &req,
+		helix::UniqueDescriptor conversation) {
+	return _device->handleIoctl(req, std::move(conversation));
+}
+
+void RequestQueue::plug() {
+	_plugCount++;
+}
+
+void RequestQueue::unplug() {
+	assert(_plugCount);
+	if(!--_plugCount)
+		_dispatch();
+}
+
+async::result<void> RequestQueue::_submit(Request *request) {
+	if(!request->numSectors)
+		co_return;
+
+	// TODO: Account discards and zeroing separately, like Linux does.
+	bool accounted = request->type == RequestType::read
+			|| request->type == RequestType::write;
+
+	uint64_t startTime = 0;
+	if(accounted)
+		startTime = ioStats.start();
+	_pending.push_back(request);
+	_dispatch();
+	co_await request->event.wait();
+	if(accounted)
+		ioStats.complete(request->type == RequestType::write,
+				request->numSectors * sectorSize, startTime);
+}
+
+void RequestQueue::_dispatch() {
+	auto maxSectors = std::max(maxMergeBytes / sectorSize, size_t{1});
+
+	while(!_plugCount && _inFlight < maxQueueDepth && !_pending.empty()) {
+		auto index = _pick();
+		auto head = _pending[index];
+		_pending.erase(_pending.begin() + index);
+
+		// Merge pending requests that are adjacent to the batch (on either side).
+		std::vector<Request *> batch{head};
+		auto start = head->sector;
+		auto end = head->sector + head->numSectors;
+		// Discards and zeroing do not transfer data, hence they are not limited in size.
+		bool transfersData = head->type == RequestType::read
+				|| head->type == RequestType::write;
+		bool merged = true;
+		while(merged) {
+			merged = false;
+			for(size_t i = 0; i < _pending.size(); i++) {
+				auto request = _pending[i];
+				if(request->type != head->type
+						|| (transfersData && end - start + request->numSectors > maxSectors)
+						|| _isBlocked(i))
+					continue;
+
+				if(request->sector == end) {
+					batch.push_back(request);
+					end += request->numSectors;
+				}else if(request->sector + request->numSectors == start) {
+					batch.insert(batch.begin(), request);
+					start = request->sector;
+				}else{
+					continue;
+				}
+				_pending.erase(_pending.begin() + i);
+				if(head->type == RequestType::read)
+					ioStats.reads.merges++;
+				else if(head->type == RequestType::write)
+					ioStats.writes.merges++;
+				merged = true;
+				break;
+			}
+		}
+
+		_headPosition = end;
+		_inFlight++;
+		_perform(std::move(batch));
+	}
+}
+
+size_t RequestQueue::_pick() {
+	if(!rotational)
+		return 0;
+
+	// C-LOOK: serve the lowest sector at or after the head position,
+	// wrap around to the lowest sector overall once there is none.
+	std::optional<size_t> ahead;
+	std::optional<size_t> lowest;
+	for(size_t i = 0; i < _pending.size(); i++) {
+		if(_isBlocked(i))
+			continue;
+		auto sector = _pending[i]->sector;
+		if(sector >= _headPosition && (!ahead || sector < _pending[*ahead]->sector))
+			ahead = i;
+		if(!lowest || sector < _pending[*lowest]->sector)
+			lowest = i;
+	}
+
+	// The oldest request is never blocked.
+	assert(lowest);
+	return ahead ? *ahead : *lowest;
+}
+
+bool RequestQueue::_isBlocked(size_t index) {
+	auto request = _pending[index];
+	for(size_t i = 0; i < index; i++) {
+		auto older = _pending[i];
+		if(older->type == RequestType::read && request->type == RequestType::read)
+			continue;
+		if(older->sector < request->sector + request->numSectors
+				&& request->sector < older->sector + older->numSectors)
+			return true;
+	}
+	return false;
+}
+
+async::detached RequestQueue::_perform(std::vector<Request *> batch) {
+	auto head = batch.front();
+
+	if(head->type == RequestType::discard || head->type == RequestType::writeZeroes) {
+		size_t numSectors = 0;
+		for(auto request : batch)
+			numSectors += request->numSectors;
+
+		if(head->type == RequestType::discard) {
+			co_await _device->discard(head->sector, numSectors);
+		}else{
+			co_await _device->writeZeroes(head->sector, numSectors);
+		}
+		_complete(std::move(batch));
+		co_return;
+	}
+
+	// The requests are adjacent on disk; pass their buffers to the device as
+	// one vectored request, coalescing buffers that are also adjacent in memory.
+	std::vector<Segment> segments;
+	for(auto request : batch) {
+		for(auto &segment : request->segments) {
+			if(!segment.numSectors)
+				continue;
+			if(!segments.empty()) {
+				auto &last = segments.back();
+				if(static_cast<std::byte *>(last.buffer) + last.numSectors * sectorSize
+						== segment.buffer) {
+					last.numSectors += segment.numSectors;
+					continue;
+				}
+			}
+			segments.push_back(segment);
+		}
+	}
+	assert(!segments.empty());
+
+	if(segments.size() == 1) {
+		if(head->type == RequestType::write) {
+			co_await _device->writeSectors(head->sector, segments.front().buffer,
+					segments.front().numSectors);
+		}else{
+			co_await _device->readSectors(head->sector, segments.front().buffer,
+					segments.front().numSectors);
+		}
+	}else{
+		if(head->type == RequestType::write) {
+			co_await _device->writeSectorsV(head->sector, segments);
+		}else{
+			co_await _device->readSectorsV(head->sector, segments);
+		}
+	}
+
+	_complete(std::move(batch));
+}
+
+void RequestQueue::_complete(std::vector<Request *> batch) {
+	for(auto request : batch)
+		request->event.raise();
+
+	_inFlight--;
+	_dispatch();
+}
+
+} // namespace blockfs
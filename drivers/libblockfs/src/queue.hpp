@@ -0,0 +1,90 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include <async/oneshot-event.hpp>
+#include <blockfs.hpp>
+
+namespace blockfs {
+
+// Sits between the file systems and a BlockDevice. Merges requests to adjacent sectors
+// into vectored requests, sorts requests for rotational devices, limits the number of
+// requests that are in flight at the device and supports plugging.
+struct RequestQueue final : BlockDevice {
+	RequestQueue(BlockDevice *device);
+
+	async::result<void> readSectors(uint64_t sector, void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> writeSectors(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> readSectorsV(uint64_t sector,
+			std::span<const Segment> segments) override;
+
+	async::result<void> writeSectorsV(uint64_t sector,
+			std::span<const Segment> segments) override;
+
+	// Polled requests bypass the queue since merging and plugging only add latency.
+	async::result<void> readSectorsPolled(uint64_t sector, void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> writeSectorsPolled(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> discard(uint64_t sector, size_t num_sectors) override;
+
+	async::result<void> writeZeroes(uint64_t sector, size_t num_sectors) override;
+
+	// Only covers completed writes, hence it does not need to be ordered against other requests.
+	async::result<void> flush() override;
+
+	async::result<size_t> getSize() override;
+
+	async::result<void> handleIoctl(managarm::fs::GenericIoctlRequest &req,
+			helix::UniqueDescriptor conversation) override;
+
+	void plug() override;
+	void unplug() override;
+
+private:
+	enum class RequestType {
+		read,
+		write,
+		discard,
+		writeZeroes
+	};
+
+	struct Request {
+		RequestType type;
+		uint64_t sector;
+		size_t numSectors;
+		// Empty unless type is read or write.
+		std::span<const Segment> segments;
+		async::oneshot_event event;
+	};
+
+	async::result<void> _submit(Request *request);
+
+	// Passes pending requests to the device until the queue depth is reached.
+	void _dispatch();
+	// Returns the index of the pending request that should be dispatched next.
+	size_t _pick();
+	// Returns true if the pending request must not overtake an older one.
+	bool _isBlocked(size_t index);
+
+	async::detached _perform(std::vector<Request *> batch);
+	// Wakes up the requests of a batch that the device finished.
+	void _complete(std::vector<Request *> batch);
+
+	BlockDevice *_device;
+	// Pending requests in submission order.
+	std::deque<Request *> _pending;
+	size_t _inFlight = 0;
+	unsigned int _plugCount = 0;
+	// Sector after the last dispatched request.
+	uint64_t _headPosition = 0;
+};
+
+} // namespace blockfs
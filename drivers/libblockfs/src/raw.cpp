@@ -1,8 +1,40 @@
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <new>
+
 #include "raw.hpp"
 
 namespace blockfs {
 namespace raw {
 
+namespace {
+
+// Drivers require sector-aligned buffers, but the passthrough server places request
+// data at arbitrary heap addresses. Such buffers are bounced through aligned memory.
+struct BounceBuffer {
+	BounceBuffer() = default;
+
+	BounceBuffer(const BounceBuffer &) = delete;
+	BounceBuffer &operator=(const BounceBuffer &) = delete;
+
+	~BounceBuffer() {
+		if(_memory)
+			operator delete(_memory, std::align_val_t{0x1000});
+	}
+
+	void *allocate(size_t size) {
+		assert(!_memory);
+		_memory = operator new(size, std::align_val_t{0x1000});
+		return _memory;
+	}
+
+private:
+	void *_memory = nullptr;
+};
+
+} // anonymous namespace
+
 RawFs::RawFs(BlockDevice *device)
 : device{device} { }
 
@@ -11,6 +43,9 @@ async::result<void> RawFs::init() {
 	auto cache_size = (device_size + 0xFFF) & ~size_t(0xFFF);
 	HEL_CHECK(helCreateManagedMemory(cache_size, 0,
 				&backingMemory, &frontalMemory));
+	fileMapping = helix::Mapping{helix::BorrowedDescriptor{frontalMemory},
+			0, cache_size,
+			kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
 
 	manageMapping();
 	co_return;
@@ -29,6 +64,11 @@ async::detached RawFs::manageMapping() {
 		assert(manage.offset() + manage.length() <= cache_size);
 
 		if(manage.type() == kHelManageInitialize) {
+			// Record the pages before reading them such that concurrent direct writes
+			// update them once they are initialized.
+			for(size_t off = 0; off < manage.length(); off += 0x1000)
+				cachedPages_.insert((manage.offset() + off) >> 12);
+
 			helix::Mapping file_map{helix::BorrowedDescriptor{backingMemory},
 				static_cast<ptrdiff_t>(manage.offset()), manage.length(), kHelMapProtWrite};
 			assert(!(manage.offset() & device->sectorSize));
@@ -63,8 +103,153 @@ async::detached RawFs::manageMapping() {
 	}
 }
 
-OpenFile::OpenFile(RawFs *rawFs)
-: rawFs(rawFs) { }
+async::result<size_t> RawFs::readCached(uint64_t offset, void *buffer, size_t length) {
+	auto device_size = co_await device->getSize();
+	if(offset >= device_size)
+		co_return 0;
+	auto chunk_size = std::min(length, device_size - offset);
+
+	auto readMemory = co_await helix_ng::readMemory(
+			helix::BorrowedDescriptor(frontalMemory),
+			offset, chunk_size, buffer);
+	HEL_CHECK(readMemory.error());
+	co_return chunk_size;
+}
+
+async::result<size_t> RawFs::writeCached(uint64_t offset, const void *buffer, size_t length) {
+	auto device_size = co_await device->getSize();
+	if(offset >= device_size)
+		co_return 0;
+	auto chunk_size = std::min(length, device_size - offset);
+
+	auto writeMemory = co_await helix_ng::writeMemory(
+			helix::BorrowedDescriptor(frontalMemory),
+			offset, chunk_size, buffer);
+	HEL_CHECK(writeMemory.error());
+
+	// There is no periodic writeback of the raw cache, hence write through.
+	co_await flushRange(offset, chunk_size);
+	co_return chunk_size;
+}
+
+async::result<size_t> RawFs::readDirect(uint64_t offset, void *buffer, size_t length,
+		bool polled) {
+	assert(!(offset % device->sectorSize));
+	assert(!(length % device->sectorSize));
+
+	auto device_size = co_await device->getSize();
+	if(offset >= device_size)
+		co_return 0;
+	// The device size is a multiple of the sector size, so this stays aligned.
+	auto chunk_size = std::min(length, device_size - offset);
+
+	// Make sure that we see data that was written through the cache.
+	co_await flushRange(offset, chunk_size);
+
+	BounceBuffer bounce;
+	auto target = buffer;
+	if(reinterpret_cast<uintptr_t>(buffer) % device->sectorSize)
+		target = bounce.allocate(chunk_size);
+
+	if(polled) {
+		co_await device->readSectorsPolled(offset / device->sectorSize, target,
+				chunk_size / device->sectorSize);
+	}else{
+		co_await device->readSectors(offset / device->sectorSize, target,
+				chunk_size / device->sectorSize);
+	}
+
+	if(target != buffer)
+		memcpy(buffer, target, chunk_size);
+	co_return chunk_size;
+}
+
+async::result<size_t> RawFs::writeDirect(uint64_t offset, const void *buffer, size_t length,
+		bool polled) {
+	assert(!(offset % device->sectorSize));
+	assert(!(length % device->sectorSize));
+
+	auto device_size = co_await device->getSize();
+	if(offset >= device_size)
+		co_return 0;
+	auto chunk_size = std::min(length, device_size - offset);
+
+	BounceBuffer bounce;
+	auto source = buffer;
+	if(reinterpret_cast<uintptr_t>(buffer) % device->sectorSize) {
+		auto copy = bounce.allocate(chunk_size);
+		memcpy(copy, buffer, chunk_size);
+		source = copy;
+	}
+
+	if(polled) {
+		co_await device->writeSectorsPolled(offset / device->sectorSize, source,
+				chunk_size / device->sectorSize);
+	}else{
+		co_await device->writeSectors(offset / device->sectorSize, source,
+				chunk_size / device->sectorSize);
+	}
+
+	co_await updateCachedPages(offset, chunk_size, buffer);
+	co_return chunk_size;
+}
+
+async::result<void> RawFs::discardDirect(uint64_t offset, size_t length, bool zero) {
+	assert(!(offset % device->sectorSize));
+	assert(!(length % device->sectorSize));
+
+	// Otherwise, the writeback of dirty pages could overwrite the range later.
+	co_await flushRange(offset, length);
+
+	if(zero) {
+		co_await device->writeZeroes(offset / device->sectorSize, length / device->sectorSize);
+	}else{
+		co_await device->discard(offset / device->sectorSize, length / device->sectorSize);
+	}
+
+	// Discarded sectors have undefined contents, so zeroes are also fine for discards.
+	co_await updateCachedPages(offset, length, nullptr);
+}
+
+async::result<void> RawFs::updateCachedPages(uint64_t offset, size_t length,
+		const void *buffer) {
+	static const std::array<char, 0x1000> zeroPage{};
+
+	// This dirties the pages, but a later writeback only writes the same data again;
+	// in particular, stale dirty data cannot overwrite what was written to the device.
+	auto end = offset + length;
+	for(auto it = cachedPages_.lower_bound(offset >> 12);
+			it != cachedPages_.end() && (*it << 12) < end; ++it) {
+		auto page_begin = std::max(*it << 12, offset);
+		auto page_end = std::min((*it + 1) << 12, end);
+
+		auto data = buffer
+				? static_cast<const char *>(buffer) + (page_begin - offset)
+				: zeroPage.data();
+		auto writeMemory = co_await helix_ng::writeMemory(
+				helix::BorrowedDescriptor(frontalMemory),
+				page_begin, page_end - page_begin, data);
+		HEL_CHECK(writeMemory.error());
+	}
+}
+
+async::result<void> RawFs::flushRange(uint64_t offset, size_t length) {
+	auto begin = offset & ~uint64_t(0xFFF);
+	auto end = (offset + length + 0xFFF) & ~uint64_t(0xFFF);
+
+	// Pages that were never initialized cannot be dirty.
+	auto it = cachedPages_.lower_bound(begin >> 12);
+	if(it == cachedPages_.end() || *it >= (end >> 12))
+		co_return;
+
+	auto sync = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			reinterpret_cast<char *>(fileMapping.get()) + begin, end - begin);
+	HEL_CHECK(sync.error());
+}
+
+OpenFile::OpenFile(RawFs *rawFs, bool direct, bool polled)
+: rawFs(rawFs), offset{0}, direct{direct}, polled{polled} { }
 
 } // namespace raw
 } // namespace blockfs
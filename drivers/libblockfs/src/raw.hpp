@@ -1,4 +1,6 @@
 
+#include <set>
+
 #include <hel.h>
 #include <helix/ipc.hpp>
 #include <helix/memory.hpp>
@@ -18,19 +20,50 @@ struct RawFs {
 
 	async::detached manageMapping();
 
+	// Reads or writes through the page cache. Writes are flushed before returning.
+	async::result<size_t> readCached(uint64_t offset, void *buffer, size_t length);
+	async::result<size_t> writeCached(uint64_t offset, const void *buffer, size_t length);
+
+	// Transfers directly between the buffer and the device, bypassing the page cache.
+	// Offset and length must be multiples of the sector size.
+	// Dirty cached pages are written back before reads; cached copies are updated after writes.
+	// If polled is set, the device completes the transfer by polling (see readSectorsPolled()).
+	async::result<size_t> readDirect(uint64_t offset, void *buffer, size_t length,
+			bool polled = false);
+	async::result<size_t> writeDirect(uint64_t offset, const void *buffer, size_t length,
+			bool polled = false);
+	// Implements BLKDISCARD (or BLKZEROOUT if zero is set); same alignment requirements.
+	async::result<void> discardDirect(uint64_t offset, size_t length, bool zero);
+
 	BlockDevice *device;
 	HelHandle backingMemory;
 	HelHandle frontalMemory;
 	helix::Mapping fileMapping;
 	FlockManager flockManager;
+
+private:
+	// Writes back all dirty cached pages that overlap the given range.
+	async::result<void> flushRange(uint64_t offset, size_t length);
+
+	// Copies data that was written to the device into the pages of the range that
+	// are cached. A null buffer stands for zeroes.
+	async::result<void> updateCachedPages(uint64_t offset, size_t length, const void *buffer);
+
+	// Indices of pages that were initialized in the page cache.
+	// Used to keep the cache coherent with direct I/O.
+	std::set<uint64_t> cachedPages_;
 };
 
 struct OpenFile {
-	OpenFile(RawFs *rawFs);
+	OpenFile(RawFs *rawFs, bool direct = false, bool polled = false);
 
 	RawFs *rawFs;
 	uint64_t offset;
 	Flock flock;
+	// Set if the file was opened with O_DIRECT.
+	bool direct;
+	// Set if direct transfers should be completed by polling.
+	bool polled;
 };
 
 } // namespace raw
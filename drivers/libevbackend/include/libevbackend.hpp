@@ -1,6 +1,8 @@
 #pragma once
 
+#include <array>
 #include <map>
+#include <optional>
 #include <vector>
 
 #include <async/result.hpp>
@@ -25,13 +27,6 @@ struct StagedEvent {
 	int value;
 };
 
-struct PendingEvent {
-	int type;
-	int code;
-	int value;
-	struct timespec timestamp;
-};
-
 // --------------------------------------------
 // EventDevice
 // --------------------------------------------
@@ -75,7 +70,21 @@ struct File {
 
 	~File();
 
+	// Size of the per-file event ring. Must be a power of two.
+	static constexpr size_t ringSize = 1024;
+
 private:
+	size_t _queued() {
+		return _ringTail - _ringHead;
+	}
+
+	// Queues a SYN_REPORT frame. Returns false if it does not fit into the ring.
+	bool _pushFrame(const std::vector<StagedEvent> &frame, const struct timespec &timestamp);
+
+	// Merges a frame of relative motion into the last queued frame if the client
+	// falls behind. Returns true if the frame was merged.
+	bool _coalesceFrame(const std::vector<StagedEvent> &frame, const struct timespec &timestamp);
+
 	EventDevice *_device;
 	boost::intrusive::list_member_hook<> hook;
 	protocols::fs::StatusPageProvider _statusPage;
@@ -86,7 +95,12 @@ private:
 	// Clock ID for input timestamps.
 	int _clockId;
 
-	std::deque<PendingEvent> _pending;
+	// Events are queued as whole SYN_REPORT frames; reads copy as many events as fit.
+	std::array<input_event, ringSize> _ring;
+	uint64_t _ringHead = 0;
+	uint64_t _ringTail = 0;
+	// Start of the last queued frame, as long as the client did not read any part of it.
+	std::optional<uint64_t> _lastFrame;
 	bool _overflow = false;
 };
 
@@ -108,6 +122,13 @@ public:
 
 	void enableEvent(int type, int code);
 
+	// Classify the device based on its supported events, similar to udev's input_id.
+	bool isKeyboard();
+	bool isMouse();
+
+	// Returns the input.* mbus properties that describe the device's capabilities.
+	mbus_ng::Properties mbusProperties();
+
 	void emitEvent(int type, int code, int value);
 
 	void notify();
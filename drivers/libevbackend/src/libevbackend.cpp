@@ -93,10 +93,10 @@ File::read(void *object, helix_ng::CredentialsView, void *buffer, size_t max_siz
 	if(max_size < sizeof(input_event))
 		co_return protocols::fs::Error::illegalArguments;
 
-	if(self->_nonBlock && self->_pending.empty() && !self->_overflow)
+	if(self->_nonBlock && !self->_queued() && !self->_overflow)
 		co_return protocols::fs::Error::wouldBlock;
 
-	while(self->_pending.empty() && !self->_overflow)
+	while(!self->_queued() && !self->_overflow)
 		co_await self->_statusBell.async_wait();
 
 	if(self->_overflow) {
@@ -113,32 +113,33 @@ File::read(void *object, helix_ng::CredentialsView, void *buffer, size_t max_siz
 		memcpy(reinterpret_cast<char *>(buffer), &uev, sizeof(input_event));
 
 		// Reset the overflow flag.
-		self->_pending.clear();
+		self->_ringHead = self->_ringTail;
+		self->_lastFrame.reset();
 		self->_overflow = false;
+		self->_statusPage.update(self->_currentSeq, 0);
 
 		co_return sizeof(input_event);
 	}else{
+		auto count = std::min(self->_queued(), max_size / sizeof(input_event));
+
+		// The events wrap around the end of the ring at most once.
 		size_t written = 0;
-		while(!self->_pending.empty()
-				&& written + sizeof(input_event) <= max_size) {
-			auto evt = self->_pending.front();
-			self->_pending.pop_front();
-			if(self->_pending.empty())
-				self->_statusPage.update(self->_currentSeq, 0);
-
-			input_event uev;
-			memset(&uev, 0, sizeof(input_event));
-			uev.time.tv_sec = evt.timestamp.tv_sec;
-			uev.time.tv_usec = evt.timestamp.tv_nsec / 1000;
-			uev.type = evt.type;
-			uev.code = evt.code;
-			uev.value = evt.value;
-			memcpy(reinterpret_cast<char *>(buffer) + written, &uev, sizeof(input_event));
-			written += sizeof(input_event);
+		while(written < count) {
+			auto offset = self->_ringHead & (ringSize - 1);
+			auto chunk = std::min(count - written, ringSize - offset);
+			memcpy(reinterpret_cast<char *>(buffer) + written * sizeof(input_event),
+					&self->_ring[offset], chunk * sizeof(input_event));
+			self->_ringHead += chunk;
+			written += chunk;
 		}
 
+		if(self->_lastFrame && *self->_lastFrame < self->_ringHead)
+			self->_lastFrame.reset();
+		if(!self->_queued())
+			self->_statusPage.update(self->_currentSeq, 0);
+
 		assert(written);
-		co_return written;
+		co_return written * sizeof(input_event);
 	}
 }
 
@@ -166,7 +167,7 @@ File::pollStatus(void *object) {
 
 	co_return protocols::fs::PollStatusResult{
 		self->_currentSeq,
-		self->_pending.empty() ? 0 : EPOLLIN
+		self->_queued() ? EPOLLIN : 0
 	};
 }
 
@@ -364,6 +365,66 @@ File::~File() {
 	_device->_files.erase(_device->_files.iterator_to(*this));
 }
 
+bool File::_pushFrame(const std::vector<StagedEvent> &frame, const struct timespec &timestamp) {
+	if(_queued() + frame.size() > ringSize)
+		return false;
+
+	_lastFrame = _ringTail;
+	for(auto &evt : frame) {
+		auto &uev = _ring[_ringTail & (ringSize - 1)];
+		memset(&uev, 0, sizeof(input_event));
+		uev.time.tv_sec = timestamp.tv_sec;
+		uev.time.tv_usec = timestamp.tv_nsec / 1000;
+		uev.type = evt.type;
+		uev.code = evt.code;
+		uev.value = evt.value;
+		_ringTail++;
+	}
+	return true;
+}
+
+bool File::_coalesceFrame(const std::vector<StagedEvent> &frame, const struct timespec &timestamp) {
+	if(!_lastFrame || _queued() < ringSize / 2)
+		return false;
+
+	auto isMotion = [] (int type, int code) {
+		return type == EV_REL || (type == EV_SYN && code == SYN_REPORT);
+	};
+	auto findAxis = [&] (int code) -> input_event * {
+		for(auto seq = *_lastFrame; seq != _ringTail; seq++) {
+			auto &uev = _ring[seq & (ringSize - 1)];
+			if(uev.type == EV_REL && uev.code == code)
+				return &uev;
+		}
+		return nullptr;
+	};
+
+	// Both frames must only contain relative motion, and the last frame already has
+	// to report all axes of the new one; otherwise, clients would observe reordering.
+	for(auto seq = *_lastFrame; seq != _ringTail; seq++) {
+		auto &uev = _ring[seq & (ringSize - 1)];
+		if(!isMotion(uev.type, uev.code))
+			return false;
+	}
+	for(auto &evt : frame) {
+		if(!isMotion(evt.type, evt.code))
+			return false;
+		if(evt.type == EV_REL && !findAxis(evt.code))
+			return false;
+	}
+
+	for(auto &evt : frame) {
+		if(evt.type == EV_REL)
+			findAxis(evt.code)->value += evt.value;
+	}
+	for(auto seq = *_lastFrame; seq != _ringTail; seq++) {
+		auto &uev = _ring[seq & (ringSize - 1)];
+		uev.time.tv_sec = timestamp.tv_sec;
+		uev.time.tv_usec = timestamp.tv_nsec / 1000;
+	}
+	return true;
+}
+
 // ----------------------------------------------------------------------------
 // EventDevice implementation.
 // ----------------------------------------------------------------------------
@@ -449,6 +510,28 @@ void EventDevice::enableEvent(int type, int code) {
 	setBit(_typeBits.data(), _typeBits.size(), type);
 }
 
+bool EventDevice::isKeyboard() {
+	// Like udev, we require the keys KEY_ESC to KEY_D.
+	for(int code = KEY_ESC; code <= KEY_D; code++)
+		if(!(_keyBits[code / 8] & (1 << (code % 8))))
+			return false;
+	return true;
+}
+
+bool EventDevice::isMouse() {
+	auto hasRel = [&] (int code) { return _relBits[code / 8] & (1 << (code % 8)); };
+	return hasRel(REL_X) && hasRel(REL_Y) && (_keyBits[BTN_LEFT / 8] & (1 << (BTN_LEFT % 8)));
+}
+
+mbus_ng::Properties EventDevice::mbusProperties() {
+	mbus_ng::Properties properties;
+	if(isKeyboard())
+		properties.insert({"input.keyboard", mbus_ng::StringItem{"1"}});
+	if(isMouse())
+		properties.insert({"input.mouse", mbus_ng::StringItem{"1"}});
+	return properties;
+}
+
 void EventDevice::emitEvent(int type, int code, int value) {
 	auto getBit = [] (uint8_t *array, size_t length, unsigned int bit) -> bool {
 		assert(bit / 8 < length);
@@ -537,22 +620,28 @@ void EventDevice::notify() {
 		if(clock_gettime(file._clockId, &now))
 			throw std::runtime_error("clock_gettime() failed");
 
-		if(file._pending.size() > 1024) {
-			file._overflow = true;
-			continue;
-		}
-
 		if(logCodes)
 			for(StagedEvent evt : _staged)
 				std::cout << "[" << now.tv_sec << "." << (now.tv_nsec / 1'000'000)
 						<< "] Event type: " << evt.type << ", code: " << evt.code
 						<< ", value: " << evt.value << std::endl;
 
-		for(StagedEvent evt : _staged)
-			file._pending.push_back(PendingEvent{evt.type, evt.code, evt.value, now});
-		file._currentSeq++;
-		file._statusPage.update(file._currentSeq, EPOLLIN);
-		file._statusBell.raise();
+		// The file is already readable, hence neither path below needs a wakeup.
+		if(file._coalesceFrame(_staged, now))
+			continue;
+
+		bool wasEmpty = !file._queued();
+		if(!file._pushFrame(_staged, now)) {
+			file._overflow = true;
+			continue;
+		}
+
+		// Readers and pollers only wait while the file is empty.
+		if(wasEmpty) {
+			file._currentSeq++;
+			file._statusPage.update(file._currentSeq, EPOLLIN);
+			file._statusBell.raise();
+		}
 	}
 	_staged.clear();
 }
@@ -29,6 +29,13 @@ enum class NicType {
 	Lem,
 };
 
+// Interrupt throttling classes of the adaptive ITR algorithm (see e1000_update_itr in Linux).
+enum class ItrClass {
+	lowestLatency,
+	lowLatency,
+	bulk,
+};
+
 #define em_mac_min e1000_82547
 #define igb_mac_min e1000_82575
 
@@ -39,7 +46,10 @@ struct E1000Nic : nic::Link {
 	E1000Nic(protocols::hw::Device device);
 
 	async::result<size_t> receive(arch::dma_buffer_view) override;
+	async::result<size_t> receive(arch::dma_buffer_view, ReceiveInfo &info) override;
+	async::result<size_t> receiveBatch(std::span<ReceivedFrame> frames) override;
 	async::result<void> send(const arch::dma_buffer_view) override;
+	async::result<void> send(const arch::dma_buffer_view, const SendOffload &offload) override;
 
 	async::result<void> init();
 
@@ -58,10 +68,20 @@ private:
 	void em_rxd_setup();
 	void reap_tx_buffers();
 
-	bool eth_rx_pop();
+	size_t eth_rx_pop();
+
+	bool rxReady();
+	size_t rxTake(arch::dma_buffer_view frame, bool &verified);
+	void rxRefill();
+	void updateRxInterrupt();
+
+	void updateItr();
+	void setInterruptRate(unsigned int intsPerSec);
 
 	int setPromiscuousMode(struct e1000_hw *hw, int flags);
 
+	// BAR0 stays open since the IRQ kernlet binds it.
+	helix::UniqueDescriptor _mmioBar;
 	helix::Mapping _mmio_mapping;
 	arch::mem_space _mmio;
 
@@ -81,6 +101,18 @@ private:
 
 	std::queue<Request *> _requests;
 
+	// Descriptors are handed back to the card in bulk by rxRefill().
+	bool _rxRefillPending = false;
+	uint32_t _rxTail = 0;
+	// RX interrupts are masked while frames are pending; receive requests poll the ring.
+	bool _rxIrqMasked = false;
+
+	// Frames and bytes received since the last adaptive ITR update.
+	uint32_t _itrPackets = 0;
+	uint32_t _itrBytes = 0;
+	ItrClass _itrClass = ItrClass::lowLatency;
+	unsigned int _itrRate = 0;
+
 public:
 	struct e1000_hw _hw;
 	struct e1000_osdep _osdep;
@@ -1,19 +1,150 @@
+#include <algorithm>
+#include <fafnir/dsl.hpp>
 #include <nic/freebsd-e1000/common.hpp>
+#include <protocols/kernlet/compiler.hpp>
+#include <vector>
+
+namespace {
+
+// Interrupt rates of the ITR classes.
+unsigned int itrRate(ItrClass c) {
+	switch(c) {
+		case ItrClass::lowestLatency: return 70000;
+		case ItrClass::lowLatency: return 20000;
+		case ItrClass::bulk: return 4000;
+	}
+	return 8000;
+}
+
+// Classifies the traffic since the last interrupt (see e1000_update_itr in Linux).
+ItrClass classifyItr(ItrClass current, uint32_t packets, uint32_t bytes) {
+	if(!packets)
+		return current;
+
+	switch(current) {
+		case ItrClass::lowestLatency:
+			// Jumbo frames get bulk treatment.
+			if(bytes / packets > 8000)
+				return ItrClass::bulk;
+			if(packets < 5 && bytes > 512)
+				return ItrClass::lowLatency;
+			break;
+		case ItrClass::lowLatency:
+			if(bytes > 10000) {
+				if(bytes / packets > 8000)
+					return ItrClass::bulk;
+				if(packets < 10 || bytes / packets > 1200)
+					return ItrClass::bulk;
+				if(packets > 35)
+					return ItrClass::lowestLatency;
+			} else if(bytes / packets > 2000) {
+				return ItrClass::bulk;
+			} else if(packets <= 2 && bytes < 512) {
+				return ItrClass::lowestLatency;
+			}
+			break;
+		case ItrClass::bulk:
+			if(bytes > 25000) {
+				if(packets > 35)
+					return ItrClass::lowLatency;
+			} else if(bytes < 6000) {
+				return ItrClass::lowLatency;
+			}
+			break;
+	}
+	return current;
+}
+
+} // namespace
+
+void E1000Nic::setInterruptRate(unsigned int intsPerSec) {
+	// The ITR registers count in units of 256ns.
+	uint32_t itr = 1000000000 / (intsPerSec * 256);
+	E1000_WRITE_REG(&_hw, E1000_ITR, itr);
+
+	// With MSI-X, the 82574 throttles using the EITR registers.
+	if(_hw.mac.type == e1000_82574) {
+		for(int i = 0; i < 4; i++)
+			E1000_WRITE_REG(&_hw, E1000_EITR_82574(i), itr);
+	}
+
+	_itrRate = intsPerSec;
+}
+
+void E1000Nic::updateItr() {
+	// igb devices throttle through EITR, which has a different format.
+	if(_hw.mac.type < e1000_82540 || _hw.mac.type >= igb_mac_min)
+		return;
+
+	_itrClass = classifyItr(_itrClass, _itrPackets, _itrBytes);
+	_itrPackets = 0;
+	_itrBytes = 0;
+
+	// Bias towards bulk: the rate increases in steps but decreases immediately.
+	auto rate = itrRate(_itrClass);
+	if(rate > _itrRate)
+		rate = std::min(_itrRate + rate / 4, rate);
+	if(rate != _itrRate)
+		setInterruptRate(rate);
+}
 
 async::detached E1000Nic::processIrqs() {
+	co_await connectKernletCompiler();
+
+	std::vector<uint8_t> kernletProgram;
+	fnr::emit_to(std::back_inserter(kernletProgram),
+		// Load the ICR register. Reading ICR clears it and deasserts the IRQ.
+		fnr::scope_push{} (
+			fnr::intrin{"__mmio_read32", 2, 1} (
+				fnr::binding{0}, // BAR0 (bound to slot 0).
+				fnr::binding{1} // Offset of the registers within BAR0 (bound to slot 1).
+					+ fnr::literal{E1000_ICR}
+			)
+		),
+		// The IRQ belongs to us iff a cause bit was set.
+		fnr::check_if{},
+			fnr::scope_get{0},
+		fnr::then{},
+			// Pass the causes to user space through the bitset event (bound to slot 2).
+			fnr::intrin{"__trigger_bitset", 2, 0} (
+				fnr::binding{2},
+				fnr::scope_get{0}
+			),
+			fnr::scope_push{} ( fnr::literal{1} ),
+		fnr::else_then{},
+			fnr::scope_push{} ( fnr::literal{2} ),
+		fnr::end{}
+	);
+
+	auto kernletObject = co_await compile(kernletProgram.data(),
+			kernletProgram.size(), {BindType::memoryView, BindType::offset,
+			BindType::bitsetEvent});
+
+	HelHandle eventHandle;
+	HEL_CHECK(helCreateBitsetEvent(&eventHandle));
+	helix::UniqueDescriptor event{eventHandle};
+
+	HelKernletData data[3];
+	data[0].handle = _mmioBar.getHandle();
+	data[1].handle = _mmio_mapping.offset();
+	data[2].handle = event.getHandle();
+	HelHandle boundHandle;
+	HEL_CHECK(helBindKernlet(kernletObject.getHandle(), data, 3, &boundHandle));
+	HEL_CHECK(helAutomateIrq(_irq.getHandle(), 0, boundHandle));
+
 	co_await _device.enableBusIrq();
 
-	// TODO: The kick here should not be required.
-	HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckKick, 0));
+	// Clear the IRQ in case it was pending while we attached the kernlet.
+	HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckKick | kHelAckClear, 0));
 
 	uint64_t sequence = 0;
 	while(true) {
-		auto await = co_await helix_ng::awaitEvent(_irq, sequence);
+		auto await = co_await helix_ng::awaitEvent(event, sequence);
 		HEL_CHECK(await.error());
 		sequence = await.sequence();
 
-		auto status = E1000_READ_REG(&_hw, E1000_ICR);
-		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
+		// Causes that were raised since the last wakeup, as read from ICR by the kernlet.
+		uint32_t status = await.bitset();
 
 		if(status & E1000_ICR_LSC) {
 			printf("e1000: link up\n");
@@ -24,16 +155,19 @@ async::detached E1000Nic::processIrqs() {
 		if(status & (E1000_ICR_TXQE | E1000_ICR_TXDW))
 			status &= ~(E1000_ICR_TXQE | E1000_ICR_TXDW);
 
-		if(status & E1000_ICR_RXT0) {
-			printf("e1000: handling packet RX irq\n");
-			while(eth_rx_pop());
-			status &= ~E1000_ICR_RXT0;
+		if(status & (E1000_ICR_RXT0 | E1000_ICR_RXDMT0)) {
+			// Drains the ring as far as buffers are posted; if frames remain,
+			// RX interrupts stay masked until receive requests consumed them.
+			eth_rx_pop();
+			status &= ~(E1000_ICR_RXT0 | E1000_ICR_RXDMT0);
 		}
 
 		status &= ~E1000_ICR_INT_ASSERTED;
 
 		if(status)
 			printf("e1000: unhandled IRQ status 0x%08x\n", status);
+
+		updateItr();
 	}
 
 	co_return;
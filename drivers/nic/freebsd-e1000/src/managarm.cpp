@@ -36,6 +36,7 @@
 #include <memory>
 #include <net/ethernet.h>
 #include <nic/freebsd-e1000/common.hpp>
+#include <stdexcept>
 #include <unistd.h>
 
 E1000Nic::E1000Nic(protocols::hw::Device device)
@@ -60,6 +61,7 @@ async::result<void> E1000Nic::init() {
 
 	_mmio_mapping = {bar0, barInfo.offset, barInfo.length};
 	_mmio = _mmio_mapping.get();
+	_mmioBar = std::move(bar0);
 
 	_hw.back = &_osdep;
 	_osdep.membase = uintptr_t(_mmio_mapping.get());
@@ -164,6 +166,11 @@ async::result<void> E1000Nic::init() {
 		mac_[i] = _hw.mac.addr[i];
 	}
 
+	// Checksum offload is available since the 82543. We do not use advanced descriptors
+	// on igb devices, hence their receive status is not evaluated.
+	capabilities_.txChecksum = _hw.mac.type >= e1000_82543;
+	capabilities_.rxChecksum = _hw.mac.type >= e1000_82543 && _hw.mac.type < igb_mac_min;
+
 	e1000_disable_ulp_lpt_lp(&_hw, true);
 
 	_rxd = arch::dma_array<struct e1000_rx_desc>(dmaPool_, RX_QUEUE_SIZE);
@@ -213,6 +220,11 @@ fail:
 }
 
 async::result<size_t> E1000Nic::receive(arch::dma_buffer_view frame) {
+	ReceiveInfo info;
+	co_return co_await receive(frame, info);
+}
+
+async::result<size_t> E1000Nic::receive(arch::dma_buffer_view frame, ReceiveInfo &info) {
 	Request req{.frame = frame};
 	_requests.push(&req);
 
@@ -220,15 +232,61 @@ async::result<size_t> E1000Nic::receive(arch::dma_buffer_view frame) {
 
 	co_await req.event.wait();
 
+	info.checksumVerified = req.checksumVerified;
 	co_return req.size;
 }
 
+async::result<size_t> E1000Nic::receiveBatch(std::span<ReceivedFrame> frames) {
+	if(frames.empty())
+		co_return 0;
+
+	Request req{.frame = frames[0].buffer};
+	_requests.push(&req);
+
+	eth_rx_pop();
+
+	co_await req.event.wait();
+
+	frames[0].length = req.size;
+	frames[0].info.checksumVerified = req.checksumVerified;
+
+	// Take the rest of the burst without waiting for further IRQs.
+	size_t count = 1;
+	while(count < frames.size() && _requests.empty() && rxReady()) {
+		bool verified = false;
+		frames[count].length = rxTake(frames[count].buffer, verified);
+		frames[count].info.checksumVerified = verified;
+		count++;
+	}
+
+	rxRefill();
+	updateRxInterrupt();
+	co_return count;
+}
+
 async::result<void> E1000Nic::send(const arch::dma_buffer_view buf) {
+	co_await send(buf, SendOffload{});
+}
+
+async::result<void> E1000Nic::send(const arch::dma_buffer_view buf, const SendOffload &offload) {
+	if(offload.segmentSize)
+		throw std::runtime_error("e1000: TSO is not supported");
+	if(offload.needsChecksum && !capabilities_.txChecksum)
+		throw std::runtime_error("e1000: checksum offload is not supported");
+
 	reap_tx_buffers();
 
 	memcpy(&_txdbuf[_txIndex], buf.data(), buf.size());
 	struct e1000_tx_desc* desc = &_txd[_txIndex];
+	desc->upper.data = 0;
 	desc->lower.data = E1000_TXD_CMD_EOP | E1000_TXD_CMD_IFCS | E1000_TXD_CMD_RS | buf.size();
+	if(offload.needsChecksum) {
+		// Legacy descriptors sum up everything from CSS to the end of the frame,
+		// including the pseudo header sum that is already stored at CSO.
+		desc->lower.data |= E1000_TXD_CMD_IC;
+		desc->lower.flags.cso = offload.csumStart + offload.csumOffset;
+		desc->upper.fields.css = offload.csumStart;
+	}
 
 	++_txIndex;
 	E1000_WRITE_REG(&_hw, E1000_TDT(0), _txIndex);
@@ -238,11 +296,17 @@ async::result<void> E1000Nic::send(const arch::dma_buffer_view buf) {
 }
 
 async::result<void> E1000Nic::identifyHardware() {
-	_hw.vendor_id = co_await _device.loadPciSpace(pci::Vendor, 2);
-	_hw.device_id = co_await _device.loadPciSpace(pci::Device, 2);
-	_hw.revision_id = co_await _device.loadPciSpace(pci::Revision, 1);
-	_hw.subsystem_vendor_id = co_await _device.loadPciSpace(pci::SubsystemVendor, 2);
-	_hw.subsystem_device_id = co_await _device.loadPciSpace(pci::SubsystemDevice, 2);
+	// Read all IDs from the header with a single request.
+	auto header = co_await _device.loadPciSpaceRange(0, 0x30);
+	auto load16 = [&] (size_t offset) -> u16 {
+		return header[offset] | (header[offset + 1] << 8);
+	};
+
+	_hw.vendor_id = load16(pci::Vendor);
+	_hw.device_id = load16(pci::Device);
+	_hw.revision_id = header[pci::Revision];
+	_hw.subsystem_vendor_id = load16(pci::SubsystemVendor);
+	_hw.subsystem_device_id = load16(pci::SubsystemDevice);
 
 	auto ret = e1000_set_mac_type(&_hw);
 	assert(ret == E1000_SUCCESS);
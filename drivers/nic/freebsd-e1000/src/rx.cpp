@@ -33,6 +33,22 @@
 
 #include <nic/freebsd-e1000/common.hpp>
 
+namespace {
+
+// Returns true if the card verified the TCP or UDP checksum (see em_receive_checksum in FreeBSD).
+bool checksumVerified(uint16_t status, uint8_t errors) {
+	if(status & E1000_RXD_STAT_IXSM)
+		return false;
+	if(!(status & (E1000_RXD_STAT_TCPCS | E1000_RXD_STAT_UDPCS)))
+		return false;
+	return !(errors & (E1000_RXD_ERR_TCPE | E1000_RXD_ERR_IPE));
+}
+
+// RX causes that are masked while the ring is polled.
+constexpr uint32_t rxInterrupts = E1000_IMS_RXT0 | E1000_IMS_RXDMT0;
+
+} // namespace
+
 void E1000Nic::em_eth_rx_ack() {
 	uint32_t n = _rxIndex();
 	union e1000_rx_desc_extended* desc = (union e1000_rx_desc_extended*)&_rxd[n];
@@ -52,48 +68,89 @@ void E1000Nic::em_rxd_setup() {
 	}
 }
 
-bool E1000Nic::eth_rx_pop() {
-	if(_requests.empty()) {
-		printf("e1000: no requests queued\n");
-		return false;
+bool E1000Nic::rxReady() {
+	if(_hw.mac.type >= em_mac_min) {
+		union e1000_rx_desc_extended* desc = (union e1000_rx_desc_extended*) &_rxd[_rxIndex];
+		return desc->wb.upper.status_error & E1000_RXD_STAT_DD;
 	}
 
-	auto req = _requests.front();
-	assert(req);
+	return _rxd[_rxIndex].status & E1000_RXD_STAT_DD;
+}
+
+// Copies out the frame of the next descriptor. The descriptor is only handed back
+// to the card by rxRefill(), such that the tail register is written once per batch.
+size_t E1000Nic::rxTake(arch::dma_buffer_view frame, bool &verified) {
+	size_t size;
 
 	if(_hw.mac.type >= em_mac_min) {
 		union e1000_rx_desc_extended* desc = (union e1000_rx_desc_extended*) &_rxd[_rxIndex];
 
-		if(!(desc->wb.upper.status_error & E1000_RXD_STAT_DD)) {
-			return false;
+		size = desc->wb.upper.length;
+		memcpy(frame.data(), &_rxdbuf[_rxIndex], size);
+		if(capabilities_.rxChecksum) {
+			auto staterr = desc->wb.upper.status_error;
+			verified = checksumVerified(staterr, staterr >> 24);
 		}
 
-		memcpy(req->frame.data(), &_rxdbuf[_rxIndex], desc->wb.upper.length);
-		req->size = desc->wb.upper.length;
-
 		em_eth_rx_ack();
 	} else {
 		struct e1000_rx_desc* desc = &_rxd[_rxIndex];
 
-		if(!(desc->status & E1000_RXD_STAT_DD)) {
-			return false;
-		}
-
 		// copy out packet
-		memcpy(req->frame.data(), &_rxdbuf[_rxIndex], desc->length);
-		req->size = desc->length;
+		size = desc->length;
+		memcpy(frame.data(), &_rxdbuf[_rxIndex], size);
+		if(capabilities_.rxChecksum)
+			verified = checksumVerified(desc->status, desc->errors);
 
 		desc->status = 0;
 	}
 
-	E1000_WRITE_REG(&_hw, E1000_RDT(0), _rxIndex());
+	_rxTail = _rxIndex();
+	_rxRefillPending = true;
 	++_rxIndex;
 
-	_requests.pop();
+	_itrPackets++;
+	_itrBytes += size;
+	return size;
+}
 
-	req->event.raise();
+void E1000Nic::rxRefill() {
+	if(!_rxRefillPending)
+		return;
 
-	return true;
+	E1000_WRITE_REG(&_hw, E1000_RDT(0), _rxTail);
+	_rxRefillPending = false;
+}
+
+// NAPI-style polling: while frames are pending, RX interrupts stay masked and the ring
+// is drained whenever the netserver posts new buffers. Frames that arrive while the
+// interrupt is masked set the cause bit, hence unmasking raises the IRQ again.
+void E1000Nic::updateRxInterrupt() {
+	bool pending = rxReady();
+	if(pending && !_rxIrqMasked) {
+		E1000_WRITE_REG(&_hw, E1000_IMC, rxInterrupts);
+		_rxIrqMasked = true;
+	} else if(!pending && _rxIrqMasked) {
+		E1000_WRITE_REG(&_hw, E1000_IMS, rxInterrupts);
+		_rxIrqMasked = false;
+	}
+}
+
+size_t E1000Nic::eth_rx_pop() {
+	size_t count = 0;
+	while(!_requests.empty() && rxReady()) {
+		auto req = _requests.front();
+		assert(req);
+		_requests.pop();
+
+		req->size = rxTake(req->frame, req->checksumVerified);
+		req->event.raise();
+		count++;
+	}
+
+	rxRefill();
+	updateRxInterrupt();
+	return count;
 }
 
 #define EM_RADV 64
@@ -108,7 +165,6 @@ bool E1000Nic::eth_rx_pop() {
 #define IGB_TX_WTHRESH ((_hw.mac.type != e1000_82575) ? 1 : 16)
 
 #define MAX_INTS_PER_SEC 8000
-#define DEFAULT_ITR (1000000000 / (MAX_INTS_PER_SEC * 256))
 
 async::result<void> E1000Nic::rxInit() {
 	/*
@@ -138,10 +194,10 @@ async::result<void> E1000Nic::rxInit() {
 	if(_hw.mac.type >= e1000_82540) {
 		E1000_WRITE_REG(&_hw, E1000_RADV, EM_RADV);
 		/*
-		 * Set the interrupt throttling rate. Value is calculated
-		 * as DEFAULT_ITR = 1/(MAX_INTS_PER_SEC * 256ns)
+		 * Set the initial interrupt throttling rate; it is adapted
+		 * to the load by updateItr().
 		 */
-		E1000_WRITE_REG(&_hw, E1000_ITR, DEFAULT_ITR);
+		setInterruptRate(MAX_INTS_PER_SEC);
 	}
 
 	E1000_WRITE_REG(&_hw, E1000_RDTR, EM_RDTR);
@@ -150,21 +206,17 @@ async::result<void> E1000Nic::rxInit() {
 	u32 rfctl = E1000_READ_REG(&_hw, E1000_RFCTL);
 	rfctl |= E1000_RFCTL_EXTEN;
 
-	/*
-	* When using MSIX interrupts we need to throttle
-	* using the EITR register (82574 only)
-	*/
 	if (_hw.mac.type == e1000_82574) {
-		for (int i = 0; i < 4; i++) {
-			E1000_WRITE_REG(&_hw, E1000_EITR_82574(i), DEFAULT_ITR);
-		}
 		/* Disable accelerated acknowledge */
 		rfctl |= E1000_RFCTL_ACK_DIS;
 	}
 
 	E1000_WRITE_REG(&_hw, E1000_RFCTL, rfctl);
 	u32 rxcsum = E1000_READ_REG(&_hw, E1000_RXCSUM);
-	rxcsum &= ~E1000_RXCSUM_TUOFL;
+	if(capabilities_.rxChecksum)
+		rxcsum |= E1000_RXCSUM_TUOFL | E1000_RXCSUM_IPOFL;
+	else
+		rxcsum &= ~E1000_RXCSUM_TUOFL;
 	E1000_WRITE_REG(&_hw, E1000_RXCSUM, rxcsum);
 
 	/*
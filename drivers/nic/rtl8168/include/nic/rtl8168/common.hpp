@@ -85,12 +85,19 @@ public:
 	};
 
 	async::result<size_t> receive(arch::dma_buffer_view) override;
+	async::result<size_t> receive(arch::dma_buffer_view, ReceiveInfo &info) override;
+	async::result<size_t> receiveBatch(std::span<ReceivedFrame> frames) override;
 	async::result<void> send(const arch::dma_buffer_view) override;
+	async::result<void> send(const arch::dma_buffer_view, const SendOffload &offload) override;
 
 	async::result<void> init();
 
 	void ringDoorbell();
 
+	// NAPI-style polling: while frames are pending, RX interrupts stay masked and the ring
+	// is drained whenever the netserver posts new buffers.
+	void updateRxInterrupt();
+
 	void printRegisters();
 
 	// Workarounds
@@ -213,8 +220,15 @@ private:
 			[[maybe_unused]] volatile auto c = _mmio.load(a_register);
 	}
 
+	// Attaches a kernlet that acks the IRQ; returns the bitset event that it raises.
+	async::result<helix::UniqueDescriptor> setupIrqKernlet();
 	async::detached processIrqs();
 
+	// Adapts the interrupt mitigation to the number of frames per IRQ.
+	void updateMitigation(size_t frames);
+
+	// The MMIO BAR stays open since the IRQ kernlet binds it.
+	helix::UniqueDescriptor _mmioBar;
 	helix::Mapping _mmio_mapping;
 	arch::mem_space _mmio;
 
@@ -231,4 +245,9 @@ private:
 	MacRevision _revision;
 	DashType _dash_type;
 	uint8_t _pci_function = 0;
+
+	bool _rxIrqMasked = false;
+	// Number of consecutive IRQs that indicated the opposite load.
+	unsigned int _mitigationVotes = 0;
+	bool _mitigated = false;
 };
@@ -5,6 +5,7 @@
 #include <arch/dma_structs.hpp>
 #include <arch/variable.hpp>
 #include <core/queue.hpp>
+#include <netserver/nic.hpp>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -23,6 +24,7 @@ struct Request {
 	QueueIndex index;
 	async::oneshot_event event;
 	arch::dma_buffer_view frame;
+	nic::Link::ReceiveInfo info;
 };
 
 namespace flags {
@@ -37,6 +39,14 @@ namespace tx {
 	constexpr arch::field<uint32_t, uint16_t> frame_length(0, 16);
 }
 
+// Second descriptor word (Descriptor::vlan) of TX descriptors on RTL8168C and later.
+namespace tx_opts2 {
+	constexpr arch::field<uint32_t, bool> udp_checksum(31, 1);
+	constexpr arch::field<uint32_t, bool> tcp_checksum(30, 1);
+	constexpr arch::field<uint32_t, bool> ip_checksum(29, 1);
+	constexpr arch::field<uint32_t, uint16_t> transport_offset(18, 10);
+}
+
 namespace rx {
 	constexpr arch::field<uint32_t, bool> ownership(31, 1);
 	constexpr bool owner_nic = true;
@@ -49,6 +59,12 @@ namespace rx {
 	constexpr arch::field<uint32_t, bool> receive_watchdog_timer_expired(22, 1);
 	constexpr arch::field<uint32_t, bool> receive_error(21, 1);
 	constexpr arch::field<uint32_t, uint8_t> protocol_id(17, 2);
+	constexpr uint8_t protocol_udp = 1;
+	constexpr uint8_t protocol_tcp = 2;
+	// Only valid if the checksum bit of cp_cmd is set.
+	constexpr arch::field<uint32_t, bool> ip_checksum_failed(16, 1);
+	constexpr arch::field<uint32_t, bool> udp_checksum_failed(15, 1);
+	constexpr arch::field<uint32_t, bool> tcp_checksum_failed(14, 1);
 	constexpr arch::field<uint32_t, uint16_t> frame_length(0, 13);
 }
 
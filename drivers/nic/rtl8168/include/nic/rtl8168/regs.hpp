@@ -174,11 +174,21 @@ namespace receive_config {
 	constexpr uint16_t accept_ok = 0x0F;
 }
 
+// Frame counts are in units of four frames; timers are in units that depend on the
+// link speed and the timer scale in cp_cmd (5 us at gigabit speed with the default scale).
+namespace interrupt_mitigate {
+	constexpr arch::field<uint16_t, uint8_t> tx_timer{12, 4};
+	constexpr arch::field<uint16_t, uint8_t> tx_frames{8, 4};
+	constexpr arch::field<uint16_t, uint8_t> rx_timer{4, 4};
+	constexpr arch::field<uint16_t, uint8_t> rx_frames{0, 4};
+}
+
 namespace interrupt_mask {
 	constexpr arch::field<uint16_t, bool> rx_ok{0, 1};
 	constexpr arch::field<uint16_t, bool> rx_err{1, 1};
 	constexpr arch::field<uint16_t, bool> tx_ok{2, 1};
 	constexpr arch::field<uint16_t, bool> tx_err{3, 1};
+	constexpr arch::field<uint16_t, bool> rx_overflow{4, 1};
 	constexpr arch::field<uint16_t, bool> link_change{5, 1};
 	constexpr arch::field<uint16_t, bool> rx_fifo_overflow{6, 1};
 	constexpr arch::field<uint16_t, bool> tx_desc_unavailable{7, 1};
@@ -4,6 +4,7 @@
 #include <nic/rtl8168/common.hpp>
 #include <nic/rtl8168/descriptor.hpp>
 #include <queue>
+#include <utility>
 
 struct RealtekNic;
 
@@ -16,13 +17,27 @@ struct RxQueue {
 
 	void handleRxOk();
 	bool checkOwnerOfNextDescriptor();
-	async::result<size_t> submitDescriptor(arch::dma_buffer_view frame, RealtekNic &nic);
+	// Returns true if the card filled a descriptor that was not consumed yet.
+	bool framesPending();
+	// Consumes the next descriptor without posting a request. Only valid if no requests
+	// are queued and framesPending() returned true.
+	size_t takeDescriptor(arch::dma_buffer_view frame, nic::Link::ReceiveInfo &info);
+	// Returns the number of frames that were received since the last call.
+	size_t consumeCompleted() {
+		return std::exchange(_completed, 0);
+	}
+	async::result<size_t> submitDescriptor(arch::dma_buffer_view frame, RealtekNic &nic,
+			nic::Link::ReceiveInfo &info);
 	async::result<void> postDescriptor(arch::dma_buffer_view frame, RealtekNic &nic, std::shared_ptr<Request> req);
 private:
+	// Returns zero if the card did not fill the descriptor yet.
+	size_t completeDescriptor_(size_t i, arch::dma_buffer_view frame, nic::Link::ReceiveInfo &info);
+
 	size_t _descriptor_count;
 	std::vector<arch::dma_buffer> _descriptor_buffers;
 	std::queue<std::shared_ptr<Request>> _requests;
 	arch::dma_array<Descriptor> _descriptors;
 	QueueIndex _last_rx_index;
 	QueueIndex _next_index;
+	size_t _completed = 0;
 };
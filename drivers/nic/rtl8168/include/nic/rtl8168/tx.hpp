@@ -16,8 +16,10 @@ struct TxQueue {
 		return helix_ng::ptrToPhysical(&_descriptors[0]);
 	}
 
-	async::result<void> submitDescriptor(arch::dma_buffer_view frame, RealtekNic &nic);
-	async::result<void> postDescriptor(arch::dma_buffer_view frame, RealtekNic &nic, std::shared_ptr<Request> req);
+	async::result<void> submitDescriptor(arch::dma_buffer_view frame, RealtekNic &nic,
+			const nic::Link::SendOffload &offload);
+	async::result<void> postDescriptor(arch::dma_buffer_view frame, RealtekNic &nic, std::shared_ptr<Request> req,
+			const nic::Link::SendOffload &offload);
 
 	bool bufferEmpty() {
 		return _amount_free_descriptors == _descriptor_count;
@@ -1,6 +1,7 @@
 #include <async/basic.hpp>
 #include <cctype>
 #include <cstdint>
+#include <fafnir/dsl.hpp>
 #include <initializer_list>
 #include <nic/rtl8168/common.hpp>
 #include <nic/rtl8168/rtl8168.hpp>
@@ -9,8 +10,27 @@
 #include <frg/logging.hpp>
 #include <helix/timer.hpp>
 #include <memory>
+#include <protocols/kernlet/compiler.hpp>
+#include <stdexcept>
 #include <unistd.h>
 
+namespace {
+
+// Interrupt mitigation is enabled once this many frames were received per IRQ
+// (and disabled below mitigationOffFrames) for mitigationVotes consecutive IRQs.
+constexpr size_t mitigationOnFrames = 16;
+constexpr size_t mitigationOffFrames = 2;
+constexpr unsigned int mitigationVotes = 3;
+
+// kernletcc only emits x86_64 code, hence other architectures ack IRQs from user space.
+#ifdef __x86_64__
+constexpr bool useIrqKernlet = true;
+#else
+constexpr bool useIrqKernlet = false;
+#endif
+
+} // namespace
+
 static const std::unordered_map<RealtekNic::MacRevision, std::string> rtl_chip_infos = {
 	// PCI Devices
 	{RealtekNic::MacRevision::MacVer02, "RTL8169s"},
@@ -94,6 +114,7 @@ async::result<void> RealtekNic::getMmio() {
 
 	_mmio_mapping = {bar, barInfo.offset, barInfo.length};
 	_mmio = _mmio_mapping.get();
+	_mmioBar = std::move(bar);
 }
 
 void RealtekNic::determineMacRevision() {
@@ -354,6 +375,11 @@ async::result<bool> RealtekNic::startCard() {
 
 	// TODO: CpCmd stuff
 	//       it seems like they just mask it with CPCMD_MASK here
+	// Let the card verify the checksums of received frames.
+	_mmio.store(regs::cp_cmd, _mmio.load(regs::cp_cmd) / flags::cp_cmd::checksum(true));
+	capabilities_.rxChecksum = true;
+	// Checksum offload uses the descriptor layout of RTL8168C and later.
+	capabilities_.txChecksum = _revision > MacRevision::MacVer06;
 
 	if(_revision <= MacRevision::MacVer06) {
 		assert(!"Not Implemented"); // rtl_hw_start_8169
@@ -525,19 +551,161 @@ async::result<void> RealtekNic::init() {
 // TODO: We really should not do this like this
 //       What we should do is have a constant callback we always poll to, as this way of doing things will always be prone to race conditions
 async::result<size_t> RealtekNic::receive(arch::dma_buffer_view frame) {
-	co_return co_await _rxQueue->submitDescriptor(frame, *this);
+	ReceiveInfo info;
+	co_return co_await _rxQueue->submitDescriptor(frame, *this, info);
+}
+
+async::result<size_t> RealtekNic::receive(arch::dma_buffer_view frame, ReceiveInfo &info) {
+	co_return co_await _rxQueue->submitDescriptor(frame, *this, info);
+}
+
+async::result<size_t> RealtekNic::receiveBatch(std::span<ReceivedFrame> frames) {
+	if(frames.empty())
+		co_return 0;
+
+	frames[0].length = co_await _rxQueue->submitDescriptor(frames[0].buffer, *this, frames[0].info);
+
+	// Take the rest of the burst without waiting for further IRQs.
+	size_t count = 1;
+	while(count < frames.size() && _rxQueue->framesPending()) {
+		frames[count].length = _rxQueue->takeDescriptor(frames[count].buffer, frames[count].info);
+		count++;
+	}
+
+	updateRxInterrupt();
+	co_return count;
+}
+
+void RealtekNic::updateRxInterrupt() {
+	bool pending = _rxQueue->framesPending();
+	if(pending == _rxIrqMasked)
+		return;
+
+	// Frames that arrive while the interrupts are masked still set the status bits,
+	// hence unmasking raises the IRQ again.
+	uint16_t rxInterrupts = (flags::interrupt_mask::rx_ok(true)
+			| flags::interrupt_mask::rx_err(true)
+			| flags::interrupt_mask::rx_overflow(true)
+			| flags::interrupt_mask::rx_fifo_overflow(true)).bits();
+	if(_model == PciModel::RTL8125) {
+		_mmio.store(regs::rtl8125::interrupt_mask_val, pending ? ~uint32_t{rxInterrupts} : ~uint32_t{0});
+	} else {
+		_mmio.store(regs::interrupt_mask_val, pending ? uint16_t(~rxInterrupts) : uint16_t(~0));
+	}
+	_rxIrqMasked = pending;
+}
+
+void RealtekNic::updateMitigation(size_t frames) {
+	// The RTL8125 configures interrupt mitigation through different registers.
+	if(_model == PciModel::RTL8125)
+		return;
+
+	bool flip = _mitigated ? (frames <= mitigationOffFrames) : (frames >= mitigationOnFrames);
+	if(!flip) {
+		_mitigationVotes = 0;
+		return;
+	}
+	if(++_mitigationVotes < mitigationVotes)
+		return;
+
+	_mitigationVotes = 0;
+	_mitigated = !_mitigated;
+	if(_mitigated) {
+		// Wait for 16 frames or roughly 20us.
+		_mmio.store(regs::interrupt_mitigate,
+			flags::interrupt_mitigate::rx_frames(4)
+			| flags::interrupt_mitigate::rx_timer(4)
+			| flags::interrupt_mitigate::tx_frames(4)
+			| flags::interrupt_mitigate::tx_timer(4));
+	} else {
+		_mmio.store(regs::interrupt_mitigate, arch::bit_value<uint16_t>(0));
+	}
+	if(logIRQs)
+		std::cout << "drivers/rtl8168: interrupt mitigation "
+				<< (_mitigated ? "enabled" : "disabled") << std::endl;
 }
 
 async::result<void> RealtekNic::send(arch::dma_buffer_view payload) {
-	co_await _txQueue->submitDescriptor(payload, *this);
+	co_await _txQueue->submitDescriptor(payload, *this, SendOffload{});
+}
+
+async::result<void> RealtekNic::send(arch::dma_buffer_view payload, const SendOffload &offload) {
+	if(offload.segmentSize)
+		throw std::runtime_error("drivers/rtl8168: TSO is not supported");
+	if(offload.needsChecksum && !capabilities_.txChecksum)
+		throw std::runtime_error("drivers/rtl8168: checksum offload is not supported");
+	co_await _txQueue->submitDescriptor(payload, *this, offload);
 }
 
 
+async::result<helix::UniqueDescriptor> RealtekNic::setupIrqKernlet() {
+	co_await connectKernletCompiler();
+
+	std::vector<uint8_t> kernletProgram;
+	fnr::emit_to(std::back_inserter(kernletProgram),
+		// Load the ISR register.
+		fnr::scope_push{} (
+			fnr::intrin{"__mmio_read16", 2, 1} (
+				fnr::binding{0}, // MMIO BAR (bound to slot 0).
+				fnr::binding{1} // Offset of the registers within the BAR (bound to slot 1).
+					+ fnr::literal{regs::interrupt_status.offset()}
+			)
+		),
+		// Ack the IRQ iff one of the bits was set.
+		fnr::check_if{},
+			fnr::scope_get{0},
+		fnr::then{},
+			// Write back the interrupt bits to ISR to deassert the IRQ.
+			fnr::intrin{"__mmio_write16", 3, 0} (
+				fnr::binding{0},
+				fnr::binding{1}
+					+ fnr::literal{regs::interrupt_status.offset()},
+				fnr::scope_get{0}
+			),
+			// Trigger the bitset event (bound to slot 2).
+			fnr::intrin{"__trigger_bitset", 2, 0} (
+				fnr::binding{2},
+				fnr::scope_get{0}
+			),
+			fnr::scope_push{} ( fnr::literal{1} ),
+		fnr::else_then{},
+			fnr::scope_push{} ( fnr::literal{2} ),
+		fnr::end{}
+	);
+
+	auto kernletObject = co_await compile(kernletProgram.data(),
+			kernletProgram.size(), {BindType::memoryView, BindType::offset,
+			BindType::bitsetEvent});
+
+	HelHandle eventHandle;
+	HEL_CHECK(helCreateBitsetEvent(&eventHandle));
+	helix::UniqueDescriptor event{eventHandle};
+
+	HelKernletData data[3];
+	data[0].handle = _mmioBar.getHandle();
+	data[1].handle = _mmio_mapping.offset();
+	data[2].handle = event.getHandle();
+	HelHandle boundHandle;
+	HEL_CHECK(helBindKernlet(kernletObject.getHandle(), data, 3, &boundHandle));
+	HEL_CHECK(helAutomateIrq(_irq.getHandle(), 0, boundHandle));
+
+	co_return std::move(event);
+}
+
 async::detached RealtekNic::processIrqs() {
+	helix::UniqueDescriptor event;
+	if(useIrqKernlet)
+		event = co_await setupIrqKernlet();
+
 	co_await _device.enableBusIrq();
 
-	// TODO: The kick here should not be required.
-	HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckKick, 0));
+	if(useIrqKernlet) {
+		// Clear the IRQ in case it was pending while we attached the kernlet.
+		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckKick | kHelAckClear, 0));
+	}else{
+		// TODO: The kick here should not be required.
+		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckKick, 0));
+	}
 
 	if(logIRQs) {
 		std::cout << "drivers/rtl8168: entering processIrqs loop" << std::endl;
@@ -550,22 +718,31 @@ async::detached RealtekNic::processIrqs() {
 		_mmio.store(regs::timer_interrupt, 0x400);
 	}
 	while(true) {
-		auto await = co_await helix_ng::awaitEvent(_irq, sequence);
-		HEL_CHECK(await.error());
-		sequence = await.sequence();
+		arch::bit_value<uint16_t> status{0};
+		if(useIrqKernlet) {
+			// The kernlet already acked these bits in ISR.
+			auto await = co_await helix_ng::awaitEvent(event, sequence);
+			HEL_CHECK(await.error());
+			sequence = await.sequence();
+			status = arch::bit_value<uint16_t>(static_cast<uint16_t>(await.bitset()));
+		}else{
+			auto await = co_await helix_ng::awaitEvent(_irq, sequence);
+			HEL_CHECK(await.error());
+			sequence = await.sequence();
+
+			status = _mmio.load(regs::interrupt_status);
+			if(uint16_t(status) == 0x0000) {
+				HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
+				continue;
+			}
 
-		auto status = _mmio.load(regs::interrupt_status);
-		if(logIRQs) {
-			frg::to(std::cout) << frg::fmt("drivers/rtl8168: IRQ received status 0x{:04x}", uint16_t(status)) << frg::endlog;
+			_mmio.store(regs::interrupt_status, status);
 		}
 
-		if(uint16_t(status) == 0x0000) {
-			HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
-			continue;
+		if(logIRQs) {
+			frg::to(std::cout) << frg::fmt("drivers/rtl8168: IRQ received status 0x{:04x}", uint16_t(status)) << frg::endlog;
 		}
 
-		_mmio.store(regs::interrupt_status, status);
-
 		// Did the status of the network link change?
 		if(status & flags::interrupt_status::link_change) {
 			if(logIRQs) {
@@ -604,7 +781,10 @@ async::detached RealtekNic::processIrqs() {
 			if(logIRQs) {
 				std::cout << "drivers/rtl8168: RX_OK" << std::endl;
 			}
+			// Drains the ring as far as buffers are posted; if frames remain,
+			// RX interrupts stay masked until receive requests consumed them.
 			_rxQueue->handleRxOk();
+			updateRxInterrupt();
 		}
 
 		// Did the NIC encounter an error doing receive?
@@ -624,7 +804,10 @@ async::detached RealtekNic::processIrqs() {
 			_mmio.store(regs::timer_count, 1);
 		}
 
-		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
+		updateMitigation(_rxQueue->consumeCompleted());
+
+		if(!useIrqKernlet)
+			HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
 	}
 }
 
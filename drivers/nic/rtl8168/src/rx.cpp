@@ -3,6 +3,7 @@
 #include <nic/rtl8168/descriptor.hpp>
 #include <nic/rtl8168/regs.hpp>
 #include <nic/rtl8168/debug_options.hpp>
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -98,13 +99,19 @@ RxQueue::RxQueue(size_t descriptors, RealtekNic &nic) : _descriptor_count{descri
 	_descriptors[_descriptor_count - 1].flags |= flags::rx::eor(true);
 }
 
-async::result<size_t> RxQueue::submitDescriptor(arch::dma_buffer_view frame, RealtekNic &nic) {
+async::result<size_t> RxQueue::submitDescriptor(arch::dma_buffer_view frame, RealtekNic &nic,
+		nic::Link::ReceiveInfo &info) {
 	auto ev_req = std::make_shared<Request>(_descriptor_count);
 
 	co_await postDescriptor(frame, nic, ev_req);
 
+	// Frames that arrived while no buffers were posted do not raise another IRQ.
+	handleRxOk();
+	nic.updateRxInterrupt();
+
 	co_await ev_req->event.wait();
 
+	info = ev_req->info;
 	co_return ev_req->frame.size();
 }
 
@@ -123,59 +130,91 @@ bool RxQueue::checkOwnerOfNextDescriptor() {
 	return (_descriptors[_next_index].flags & flags::rx::ownership) == flags::rx::owner_nic;
 }
 
+bool RxQueue::framesPending() {
+	size_t i = _requests.empty() ? size_t{_next_index} : size_t{_requests.front()->index};
+	if((_descriptors[i].flags & flags::rx::ownership) == flags::rx::owner_nic)
+		return false;
+	return (_descriptors[i].flags & flags::rx::frame_length) != 0;
+}
+
+size_t RxQueue::takeDescriptor(arch::dma_buffer_view frame, nic::Link::ReceiveInfo &info) {
+	assert(_requests.empty());
+	auto size = completeDescriptor_(_next_index, frame, info);
+	assert(size);
+	++_next_index;
+	return size;
+}
+
 // TODO: support large packets
-void RxQueue::handleRxOk() {
-	while(!_requests.empty()) {
-		auto req = _requests.front();
-		auto i = req->index;
+size_t RxQueue::completeDescriptor_(size_t i, arch::dma_buffer_view frame,
+		nic::Link::ReceiveInfo &info) {
+	if((_descriptors[i].flags & flags::rx::ownership) == flags::rx::owner_nic) // Descriptor was not transmitted?
+		return 0;
 
-		if((_descriptors[i].flags & flags::rx::ownership) == flags::rx::owner_nic) // Descriptor was not transmitted?
-			break;
+	__sync_synchronize();
 
-		__sync_synchronize();
-
-		auto _flags = _descriptors[i].flags;
-
-		if(logRXDescriptor) {
-			std::cout << "drivers/rtl8168: got RX descriptor, flags:" << std::endl;
-
-			if(_flags & flags::rx::eor) {
-				std::cout << "\t\t eor" << std::endl;
-			}
-			if(_flags & flags::rx::physical_address_ok) {
-				std::cout << "\t\t physical_address_ok" << std::endl;
-			}
-			if(_flags & flags::rx::first_segment) {
-				std::cout << "\t\t first_segment" << std::endl;
-			}
-			if(_flags & flags::rx::last_segment) {
-				std::cout << "\t\t last_segment" << std::endl;
-			}
-			if(_flags & flags::rx::broadcast_packet) {
-				std::cout << "\t\t broadcast_packet" << std::endl;
-			}
-			if(_flags & flags::rx::receive_watchdog_timer_expired) {
-				std::cout << "\t\t receive_watchdog_timer_expired" << std::endl;
-			}
-			if(_flags & flags::rx::receive_error) {
-				std::cout << "\t\t receive_error" << std::endl;
-			}
-		}
+	auto _flags = _descriptors[i].flags;
 
-		auto size = _flags & flags::rx::frame_length;
+	if(logRXDescriptor) {
+		std::cout << "drivers/rtl8168: got RX descriptor, flags:" << std::endl;
 
-		if(size == 0) {
-			break;
+		if(_flags & flags::rx::eor) {
+			std::cout << "\t\t eor" << std::endl;
+		}
+		if(_flags & flags::rx::physical_address_ok) {
+			std::cout << "\t\t physical_address_ok" << std::endl;
+		}
+		if(_flags & flags::rx::first_segment) {
+			std::cout << "\t\t first_segment" << std::endl;
+		}
+		if(_flags & flags::rx::last_segment) {
+			std::cout << "\t\t last_segment" << std::endl;
+		}
+		if(_flags & flags::rx::broadcast_packet) {
+			std::cout << "\t\t broadcast_packet" << std::endl;
+		}
+		if(_flags & flags::rx::receive_watchdog_timer_expired) {
+			std::cout << "\t\t receive_watchdog_timer_expired" << std::endl;
+		}
+		if(_flags & flags::rx::receive_error) {
+			std::cout << "\t\t receive_error" << std::endl;
 		}
+	}
 
-		memcpy(req->frame.data(), _descriptor_buffers[i].data(), size);
-		req->frame = req->frame.subview(0, size);
+	auto size = _flags & flags::rx::frame_length;
 
-		_descriptors[i].flags = flags::rx::eor(_descriptors[i].flags & flags::rx::eor) |
-			flags::rx::ownership(flags::rx::owner_nic) | flags::rx::frame_length(2048);
-		_descriptors[i].vlan = 0;
+	if(size == 0) {
+		return 0;
+	}
+
+	memcpy(frame.data(), _descriptor_buffers[i].data(), size);
+
+	// The card only reports the protocol if it verified the checksum of a TCP or UDP frame.
+	auto protocol = _flags & flags::rx::protocol_id;
+	bool failed = (_flags & flags::rx::ip_checksum_failed)
+		|| (_flags & flags::rx::udp_checksum_failed)
+		|| (_flags & flags::rx::tcp_checksum_failed);
+	info.checksumVerified = !failed
+		&& (protocol == flags::rx::protocol_udp || protocol == flags::rx::protocol_tcp);
+
+	_descriptors[i].flags = flags::rx::eor(_descriptors[i].flags & flags::rx::eor) |
+		flags::rx::ownership(flags::rx::owner_nic) | flags::rx::frame_length(2048);
+	_descriptors[i].vlan = 0;
+
+	_completed++;
+	return size;
+}
+
+void RxQueue::handleRxOk() {
+	while(!_requests.empty()) {
+		auto req = _requests.front();
+
+		auto size = completeDescriptor_(req->index, req->frame, req->info);
+		if(!size)
+			break;
+		req->frame = req->frame.subview(0, size);
 
-		req->event.raise();
 		_requests.pop();
+		req->event.raise();
 	}
 }
@@ -7,6 +7,29 @@
 #include <nic/rtl8168/regs.hpp>
 #include <nic/rtl8168/debug_options.hpp>
 
+namespace {
+
+// Completes a checksum whose pseudo header sum is already stored at start + offset.
+void completeChecksum(arch::dma_buffer_view frame, size_t start, size_t offset) {
+	auto bytes = reinterpret_cast<uint8_t *>(frame.data());
+	uint32_t sum = 0;
+	for(size_t i = start; i + 1 < frame.size(); i += 2)
+		sum += (uint32_t{bytes[i]} << 8) | bytes[i + 1];
+	if((frame.size() - start) & 1)
+		sum += uint32_t{bytes[frame.size() - 1]} << 8;
+	while(sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	uint16_t csum = ~sum;
+	// Zero means "no checksum" for UDP.
+	if(!csum)
+		csum = 0xFFFF;
+	bytes[start + offset] = csum >> 8;
+	bytes[start + offset + 1] = csum & 0xFF;
+}
+
+} // namespace
+
 void RealtekNic::setTxConfigRegisters() {
 	auto val = flags::transmit_config::mxdma(flags::transmit_config::mxdma_burst) |
 		flags::transmit_config::ifg(flags::transmit_config::ifg_normal);
@@ -40,16 +63,18 @@ TxQueue::TxQueue(size_t descriptors, RealtekNic &nic) : _descriptor_count{descri
 	_descriptors[_descriptor_count - 1].flags |= flags::tx::eor(true);
 }
 
-async::result<void> TxQueue::submitDescriptor(arch::dma_buffer_view payload, RealtekNic &nic) {
+async::result<void> TxQueue::submitDescriptor(arch::dma_buffer_view payload, RealtekNic &nic,
+		const nic::Link::SendOffload &offload) {
 	auto ev_req = std::make_shared<Request>(_descriptor_count);
 
-	co_await postDescriptor(payload, nic, ev_req);
+	co_await postDescriptor(payload, nic, ev_req, offload);
 	co_await ev_req->event.wait();
 }
 
 // TODO: support large packets
 // TODO: this function should be able to fail; there may not be enough space in the ring buffer, which should be handled gracefully
-async::result<void> TxQueue::postDescriptor(arch::dma_buffer_view payload, RealtekNic &nic, std::shared_ptr<Request> req) {
+async::result<void> TxQueue::postDescriptor(arch::dma_buffer_view payload, RealtekNic &nic, std::shared_ptr<Request> req,
+		const nic::Link::SendOffload &offload) {
 	assert(_amount_free_descriptors);
 
 	_requests.push(req);
@@ -67,6 +92,21 @@ async::result<void> TxQueue::postDescriptor(arch::dma_buffer_view payload, Realt
 
 	memcpy(_descriptor_buffers[tx_index()].data(), payload.data(), payload.size());
 
+	if(offload.needsChecksum) {
+		// Some cards include the padding of short frames in the checksum (see rtl_test_hw_pad_bug in Linux).
+		if(payload.size() < 60) {
+			completeChecksum(arch::dma_buffer_view{_descriptor_buffers[tx_index()]}.subview(0, payload.size()),
+				offload.csumStart, offload.csumOffset);
+		} else {
+			// csumOffset distinguishes TCP (16) from UDP (6).
+			bool tcp = offload.csumOffset == 16;
+			desc->vlan = (flags::tx_opts2::ip_checksum(true)
+				| flags::tx_opts2::tcp_checksum(tcp)
+				| flags::tx_opts2::udp_checksum(!tcp)
+				| flags::tx_opts2::transport_offset(offload.csumStart)).bits();
+		}
+	}
+
 	// Force strict ordering of the ownership flag, in the event that we are already transmitting
 	desc->flags |= flags::tx::first_segment(true);
 	desc->flags |= flags::tx::last_segment(true);
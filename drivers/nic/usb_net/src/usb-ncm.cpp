@@ -1,3 +1,4 @@
+#include <helix/timer.hpp>
 #include <nic/usb_net/usb_net.hpp>
 #include <net/ethernet.h>
 
@@ -9,6 +10,17 @@ namespace nic::usb_ncm {
 
 constexpr bool debugNcm = false;
 
+// Upper bounds for the NTB sizes; the function may ask for smaller NTBs.
+// NTB16 cannot exceed 64 KiB in any case.
+constexpr size_t rxNtbMaxSize = 16384;
+constexpr size_t txNtbMaxSize = 16384;
+
+// Outgoing frames are held back for at most this long (in ns) to fill up an NTB.
+constexpr uint64_t txFlushDelay = 400'000;
+
+// Limits the walk along wNextNdpIndex in malformed NTBs.
+constexpr size_t maxNdpsPerNtb = 32;
+
 UsbNcmNic::UsbNcmNic(mbus_ng::EntityId entity, protocols::usb::Device hw_device, nic::MacAddress mac,
 		protocols::usb::Interface ctrl_intf, protocols::usb::Endpoint ctrl_ep,
 		protocols::usb::Interface data_intf, protocols::usb::Endpoint in, protocols::usb::Endpoint out,
@@ -120,6 +132,39 @@ async::result<void> UsbNcmNic::initialize() {
 	if(debugNcm)
 		std::cout << std::format("{}", *params) << std::endl;
 
+	rxNtbSize_ = std::min(size_t{params->dwNtbInMaxSize}, rxNtbMaxSize);
+	if(rxNtbSize_ < params->dwNtbInMaxSize) {
+		// The 8 byte form is only understood by functions that announce it.
+		bool withDatagrams = ncm_hdr->bmNetworkCapabilities & regs::bmNetworkCapabilities::ntbInputSize;
+		arch::dma_object<NtbInputSize> inputSize{&dmaPool_};
+		inputSize->dwNtbInMaxSize = rxNtbSize_;
+		inputSize->wNtbInMaxDatagrams = 0;
+		inputSize->reserved = 0;
+
+		ctrl_msg->type = protocols::usb::setup_type::byClass | protocols::usb::setup_type::targetInterface;
+		ctrl_msg->request = uint8_t(nic::usb_net::RequestCode::SET_NTB_INPUT_SIZE);
+		ctrl_msg->value = 0;
+		ctrl_msg->index = ctrl_intf_.num();
+		ctrl_msg->length = withDatagrams ? sizeof(NtbInputSize) : sizeof(uint32_t);
+
+		res = co_await device_.transfer(protocols::usb::ControlTransfer{
+			protocols::usb::kXferToDevice, ctrl_msg,
+			inputSize.view_buffer().subview(0, ctrl_msg->length)
+		});
+		if(!res) {
+			printf("netserver: NCM function rejected NTB input size %zu\n", rxNtbSize_);
+			rxNtbSize_ = params->dwNtbInMaxSize;
+		}
+	}
+	rxNtb_ = arch::dma_buffer{&dmaPool_, rxNtbSize_};
+
+	txNtbSize_ = std::min(size_t{params->dwNtbOutMaxSize}, txNtbMaxSize);
+	txDivisor_ = std::max(params->wNdpOutDivisor, uint16_t{1});
+	txRemainder_ = params->wNdpOutPayloadRemainder % txDivisor_;
+	txNdpAlignment_ = std::max(params->wNdpOutAlignment, uint16_t{4});
+	txMaxDatagrams_ = params->wNtbOutMaxDatagrams;
+	txNtb_ = arch::dma_buffer{&dmaPool_, txNtbSize_};
+
 	if(ncm_hdr->bmNetworkCapabilities & regs::bmNetworkCapabilities::crcMode) {
 		ctrl_msg->type = protocols::usb::setup_type::byClass | protocols::usb::setup_type::targetInterface;
 		ctrl_msg->request = uint8_t(nic::usb_net::RequestCode::SET_CRC_MODE);
@@ -164,6 +209,7 @@ async::result<void> UsbNcmNic::initialize() {
 	}
 
 	listenForNotifications();
+	flushLoop_();
 }
 
 async::detached UsbNcmNic::listenForNotifications() {
@@ -200,45 +246,192 @@ async::detached UsbNcmNic::listenForNotifications() {
 	co_return;
 }
 
-async::result<size_t> UsbNcmNic::receive(arch::dma_buffer_view frame) {
-	arch::dma_buffer buf{&dmaPool_, mtu};
+bool UsbNcmNic::parseNtb_(size_t length) {
+	if(length < sizeof(NcmTransferHeader))
+		return false;
+
+	auto ncmHeader = reinterpret_cast<NcmTransferHeader *>(rxNtb_.data());
+	if(ncmHeader->dwSignature != NCM_NTH16_SIGNATURE
+			|| ncmHeader->wHeaderLength != sizeof(NcmTransferHeader))
+		return false;
+	// Devices may append padding (e.g., to avoid zero length packets).
+	length = std::min(length, size_t{ncmHeader->wBlockLength});
+
+	size_t ndpIndex = ncmHeader->wNdpIndex;
+	for(size_t i = 0; ndpIndex && i < maxNdpsPerNtb; i++) {
+		if(ndpIndex % 4 || ndpIndex < sizeof(NcmTransferHeader) || ndpIndex + ndpHeaderSize > length)
+			return false;
+
+		auto ndp = reinterpret_cast<NcmDatagramPointer *>(rxNtb_.subview(ndpIndex).data());
+		if(ndp->dwSignature != NCM_NDP16_NO_CRC_SIGNATURE || ndp->wLength < ndpHeaderSize
+				|| ndpIndex + ndp->wLength > length)
+			return false;
+
+		auto entries = reinterpret_cast<NcmDatagram *>(rxNtb_.subview(ndpIndex + ndpHeaderSize).data());
+		auto numEntries = (ndp->wLength - ndpHeaderSize) / sizeof(NcmDatagram);
+		for(size_t j = 0; j < numEntries; j++) {
+			auto datagram = entries[j];
+			if(!datagram.Index || !datagram.Length)
+				break;
+			if(size_t{datagram.Index} + datagram.Length > length
+					|| datagram.Length < sizeof(ether_header)
+					|| datagram.Length > receiveBufferSize()) {
+				if(debugNcm)
+					printf("netserver: dropping malformed NCM datagram\n");
+				continue;
+			}
+			rxDatagrams_.push_back(datagram);
+		}
+
+		ndpIndex = ndp->wNextNdpIndex;
+	}
+
+	return true;
+}
 
-	auto res = co_await data_in_.transfer(protocols::usb::BulkTransfer{protocols::usb::kXferToHost, buf});
+async::result<void> UsbNcmNic::fetchNtb_() {
+	rxDatagrams_.clear();
+	rxNext_ = 0;
+
+	protocols::usb::BulkTransfer transfer{protocols::usb::kXferToHost, rxNtb_};
+	transfer.allowShortPackets = true;
+	auto res = co_await data_in_.transfer(transfer);
 	assert(res);
 
-	if(res.value() != 0) {
-		auto ncmHeader = reinterpret_cast<NcmTransferHeader *>(buf.data());
-		auto ndp = reinterpret_cast<NcmDatagramPointer *>(buf.subview(ncmHeader->wNdpIndex).data());
-		memcpy(frame.data(), buf.subview(ndp->wDatagram[0].Index).data(), ndp->wDatagram[0].Length);
-		co_return ndp->wDatagram[0].Length;
+	if(!parseNtb_(res.value()))
+		printf("netserver: received malformed NCM transfer block\n");
+}
+
+size_t UsbNcmNic::takeDatagram_(arch::dma_buffer_view frame) {
+	auto datagram = rxDatagrams_[rxNext_++];
+	memcpy(frame.data(), rxNtb_.subview(datagram.Index).data(), datagram.Length);
+	return datagram.Length;
+}
+
+async::result<size_t> UsbNcmNic::receive(arch::dma_buffer_view frame) {
+	while(rxNext_ == rxDatagrams_.size())
+		co_await fetchNtb_();
+
+	co_return takeDatagram_(frame);
+}
+
+async::result<size_t> UsbNcmNic::receiveBatch(std::span<ReceivedFrame> frames) {
+	while(rxNext_ == rxDatagrams_.size())
+		co_await fetchNtb_();
+
+	// Hand out all datagrams of the NTB at once.
+	size_t count = 0;
+	while(count < frames.size() && rxNext_ < rxDatagrams_.size()) {
+		auto &frame = frames[count++];
+		frame.info = {};
+		frame.length = takeDatagram_(frame.buffer);
 	}
+	co_return count;
+}
 
-	assert(!"USB NIC receive failed!");
+// Datagrams start at offsets that satisfy offset % wNdpOutDivisor == wNdpOutPayloadRemainder.
+size_t UsbNcmNic::alignDatagram_(size_t offset) const {
+	auto aligned = offset - offset % txDivisor_ + txRemainder_;
+	if(aligned < offset)
+		aligned += txDivisor_;
+	return aligned;
 }
 
-async::result<void> UsbNcmNic::send(const arch::dma_buffer_view payload) {
-	arch::dma_buffer buf{&dmaPool_, sizeof(NcmTransferHeader) + sizeof(NcmDatagramPointer) + payload.size()};
-	auto ncmHeader = reinterpret_cast<NcmTransferHeader *>(buf.data());
+bool UsbNcmNic::txFits_(size_t size) const {
+	if(txMaxDatagrams_ && txDatagrams_.size() == txMaxDatagrams_)
+		return false;
+
+	// The NDP follows the datagrams and needs room for one more entry plus the terminator.
+	auto end = alignDatagram_(txOffset_) + size;
+	auto ndpIndex = (end + txNdpAlignment_ - 1) & ~(txNdpAlignment_ - 1);
+	auto ndpLength = ndpHeaderSize + (txDatagrams_.size() + 2) * sizeof(NcmDatagram);
+	return ndpIndex + ndpLength <= txNtbSize_;
+}
+
+void UsbNcmNic::flushEarly_() {
+	txFlushNow_ = true;
+	if(txFlushTimer_)
+		txFlushTimer_->cancel();
+}
+
+size_t UsbNcmNic::finalizeNtb_() {
+	auto ndpIndex = (txOffset_ + txNdpAlignment_ - 1) & ~(txNdpAlignment_ - 1);
+	auto ndpLength = ndpHeaderSize + (txDatagrams_.size() + 1) * sizeof(NcmDatagram);
+
+	auto ndp = reinterpret_cast<NcmDatagramPointer *>(txNtb_.subview(ndpIndex).data());
+	ndp->dwSignature = NCM_NDP16_NO_CRC_SIGNATURE;
+	ndp->wLength = uint16_t(ndpLength);
+	ndp->wNextNdpIndex = 0;
+	auto entries = reinterpret_cast<NcmDatagram *>(txNtb_.subview(ndpIndex + ndpHeaderSize).data());
+	for(size_t i = 0; i < txDatagrams_.size(); i++)
+		entries[i] = txDatagrams_[i];
+	entries[txDatagrams_.size()] = {0, 0};
+
+	// Pad the NTB instead of sending a zero length packet if it ends on a packet boundary.
+	// 64 divides the maximum packet size of bulk endpoints at all speeds.
+	auto length = ndpIndex + ndpLength;
+	if(!(length % 64) && length < txNtbSize_)
+		length++;
+
+	auto ncmHeader = reinterpret_cast<NcmTransferHeader *>(txNtb_.data());
 	ncmHeader->dwSignature = NCM_NTH16_SIGNATURE;
 	ncmHeader->wHeaderLength = sizeof(*ncmHeader);
 	ncmHeader->wSequence = seq_++;
-	ncmHeader->wBlockLength = uint16_t(buf.size());
-	ncmHeader->wNdpIndex = sizeof(*ncmHeader);
+	ncmHeader->wBlockLength = uint16_t(length);
+	ncmHeader->wNdpIndex = uint16_t(ndpIndex);
 
-	auto ndp = reinterpret_cast<NcmDatagramPointer *>(buf.subview(ncmHeader->wNdpIndex).data());
-	ndp->dwSignature = NCM_NDP16_NO_CRC_SIGNATURE;
-	ndp->wLength = sizeof(*ndp);
-	ndp->wNextNdpIndex = 0;
-	ndp->wDatagram[0].Index = ncmHeader->wHeaderLength + ndp->wLength;
-	ndp->wDatagram[0].Length = uint16_t(payload.size());
-	ndp->wDatagram[1].Index = 0;
-	ndp->wDatagram[1].Length = 0;
+	return length;
+}
+
+async::detached UsbNcmNic::flushLoop_() {
+	while(true) {
+		while(txDatagrams_.empty())
+			co_await txPending_.async_wait();
+
+		// Give further frames a chance to join the NTB unless it is already full.
+		if(!txFlushNow_) {
+			async::cancellation_event timer;
+			txFlushTimer_ = &timer;
+			co_await helix::sleepFor(txFlushDelay, timer);
+			txFlushTimer_ = nullptr;
+		}
+		txFlushNow_ = false;
+
+		auto length = finalizeNtb_();
+		arch::dma_buffer ntb{&dmaPool_, txNtbSize_};
+		std::swap(ntb, txNtb_);
+		txOffset_ = sizeof(NcmTransferHeader);
+		txDatagrams_.clear();
+		txSpace_.raise();
+
+		// Senders fill the next NTB while this one is in flight.
+		auto res = co_await data_out_.transfer(protocols::usb::BulkTransfer{
+			protocols::usb::kXferToDevice, ntb.subview(0, length)
+		});
+		assert(res);
+	}
+}
 
-	memcpy(buf.subview(ndp->wDatagram[0].Index).data(), payload.data(), payload.size());
+async::result<void> UsbNcmNic::send(const arch::dma_buffer_view payload) {
+	while(!txFits_(payload.size())) {
+		if(txDatagrams_.empty()) {
+			printf("netserver: dropping %zu byte frame that exceeds the NCM NTB size\n",
+					payload.size());
+			co_return;
+		}
+		flushEarly_();
+		co_await txSpace_.async_wait();
+	}
 
-	auto res = co_await data_out_.transfer(protocols::usb::BulkTransfer{protocols::usb::kXferToDevice, buf});
-	assert(res);
-	co_return;
+	auto offset = alignDatagram_(txOffset_);
+	memcpy(txNtb_.subview(offset).data(), payload.data(), payload.size());
+	txDatagrams_.push_back({uint16_t(offset), uint16_t(payload.size())});
+	txOffset_ = offset + payload.size();
+
+	if(txDatagrams_.size() == 1)
+		txPending_.raise();
+	if(txMaxDatagrams_ && txDatagrams_.size() == txMaxDatagrams_)
+		flushEarly_();
 }
 
 } // namespace nic::usb_ncm
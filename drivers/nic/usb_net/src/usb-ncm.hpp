@@ -1,8 +1,12 @@
 #pragma once
 
 #include <arch/bits.hpp>
+#include <async/cancellation.hpp>
+#include <async/recurring-event.hpp>
+#include <cstddef>
 #include <format>
 #include <protocols/mbus/client.hpp>
+#include <vector>
 
 #include "usb-net.hpp"
 
@@ -19,16 +23,23 @@ struct [[gnu::packed]] NcmTransferHeader {
 	uint16_t wNdpIndex;
 };
 
+struct [[gnu::packed]] NcmDatagram {
+	uint16_t Index;
+	uint16_t Length;
+};
+
+// An NDP holds a variable number of datagram entries, terminated by a zero entry.
+// The fixed size of wDatagram only covers NTBs with a single datagram.
 struct [[gnu::packed]] NcmDatagramPointer {
 	uint32_t dwSignature;
 	uint16_t wLength;
 	uint16_t wNextNdpIndex;
-	struct [[gnu::packed]] {
-		uint16_t Index;
-		uint16_t Length;
-	} wDatagram[2];
+	NcmDatagram wDatagram[2];
 };
 
+// Size of an NDP16 without its datagram entries.
+constexpr size_t ndpHeaderSize = offsetof(NcmDatagramPointer, wDatagram);
+
 struct NtbParameter {
 	uint16_t wLength;
 	uint16_t bmNtbFormatsSupported;
@@ -44,6 +55,14 @@ struct NtbParameter {
 	uint16_t wNtbOutMaxDatagrams;
 };
 
+// Data stage of SET_NTB_INPUT_SIZE; wNtbInMaxDatagrams is only sent if the
+// function announces bmNetworkCapabilities::ntbInputSize.
+struct NtbInputSize {
+	uint32_t dwNtbInMaxSize;
+	uint16_t wNtbInMaxDatagrams;
+	uint16_t reserved;
+};
+
 struct UsbNcmNic : UsbNic {
 	UsbNcmNic(mbus_ng::EntityId entity, protocols::usb::Device hw_device, nic::MacAddress mac,
 		protocols::usb::Interface ctrl_intf, protocols::usb::Endpoint ctrl_ep,
@@ -54,10 +73,46 @@ struct UsbNcmNic : UsbNic {
 	async::detached listenForNotifications() override;
 
 	async::result<size_t> receive(arch::dma_buffer_view) override;
+	async::result<size_t> receiveBatch(std::span<ReceivedFrame> frames) override;
+	// Frames are aggregated into NTBs, hence this returns before the frame is transmitted.
 	async::result<void> send(const arch::dma_buffer_view) override;
 private:
+	// Receives the next NTB and collects all of its datagrams into rxDatagrams_.
+	async::result<void> fetchNtb_();
+	bool parseNtb_(size_t length);
+	size_t takeDatagram_(arch::dma_buffer_view frame);
+
+	size_t alignDatagram_(size_t offset) const;
+	bool txFits_(size_t size) const;
+	void flushEarly_();
+	// Writes the NTH and the NDP of the current NTB and returns its block length.
+	size_t finalizeNtb_();
+	async::detached flushLoop_();
+
 	mbus_ng::EntityId entity_;
 	size_t config_index_;
+
+	size_t rxNtbSize_ = 0;
+	arch::dma_buffer rxNtb_;
+	std::vector<NcmDatagram> rxDatagrams_;
+	size_t rxNext_ = 0;
+
+	// Layout constraints of outgoing NTBs as reported by GET_NTB_PARAMETERS.
+	size_t txNtbSize_ = 0;
+	size_t txDivisor_ = 1;
+	size_t txRemainder_ = 0;
+	size_t txNdpAlignment_ = 4;
+	size_t txMaxDatagrams_ = 0;
+
+	arch::dma_buffer txNtb_;
+	size_t txOffset_ = sizeof(NcmTransferHeader);
+	std::vector<NcmDatagram> txDatagrams_;
+	bool txFlushNow_ = false;
+	async::cancellation_event *txFlushTimer_ = nullptr;
+	// Raised when the first datagram enters an empty NTB.
+	async::recurring_event txPending_;
+	// Raised when the current NTB was handed to the flush loop.
+	async::recurring_event txSpace_;
 };
 
 namespace regs {
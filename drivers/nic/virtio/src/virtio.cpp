@@ -1,7 +1,15 @@
 #include <nic/virtio/virtio.hpp>
 
+#include <algorithm>
+#include <deque>
+#include <optional>
+#include <span>
+#include <thread>
+
 #include <arch/dma_pool.hpp>
+#include <async/recurring-event.hpp>
 #include <core/virtio/core.hpp>
+#include <helix/memory.hpp>
 
 namespace {
 	constexpr bool logFrames = false;
@@ -11,12 +19,25 @@ namespace {
 // Device feature bits.
 constexpr size_t legacyHeaderSize = 10;
 enum {
-	VIRTIO_NET_F_MAC = 5
+	VIRTIO_NET_F_CSUM = 0,
+	VIRTIO_NET_F_GUEST_CSUM = 1,
+	VIRTIO_NET_F_MAC = 5,
+	VIRTIO_NET_F_GUEST_TSO4 = 7,
+	VIRTIO_NET_F_HOST_TSO4 = 11,
+	VIRTIO_NET_F_MRG_RXBUF = 15,
+	VIRTIO_NET_F_CTRL_VQ = 17,
+	VIRTIO_NET_F_MQ = 22
+};
+
+// Offsets into the device configuration space.
+enum {
+	VIRTIO_NET_CONFIG_MAX_QUEUE_PAIRS = 8
 };
 
 // Bits for VirtHeader::flags.
 enum {
-	VIRTIO_NET_HDR_F_NEEDS_CSUM = 1
+	VIRTIO_NET_HDR_F_NEEDS_CSUM = 1,
+	VIRTIO_NET_HDR_F_DATA_VALID = 2
 };
 
 // Values for VirtHeader::gsoType.
@@ -28,6 +49,14 @@ enum {
 	VIRTIO_NET_HDR_GSO_ECN = 0x80
 };
 
+// Classes and commands of the control virtq.
+enum {
+	VIRTIO_NET_CTRL_MQ = 4,
+	VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET = 0,
+
+	VIRTIO_NET_OK = 0
+};
+
 struct VirtHeader {
 	uint8_t flags;
 	uint8_t gsoType;
@@ -38,20 +67,65 @@ struct VirtHeader {
 	uint16_t numBuffers;
 };
 
+struct CtrlHeader {
+	uint8_t cls;
+	uint8_t command;
+};
+
+// Largest frame that the device can deliver with VIRTIO_NET_F_GUEST_TSO4.
+constexpr size_t maxCoalescedFrame = 14 + 0xFFFF;
+
 struct VirtioNic : nic::Link {
 	VirtioNic(mbus_ng::EntityId entity, std::unique_ptr<virtio_core::Transport> transport);
 	async::result<void> initialize();
 
 	async::result<size_t> receive(arch::dma_buffer_view) override;
+	async::result<size_t> receive(arch::dma_buffer_view, ReceiveInfo &info) override;
+	async::result<size_t> receiveBatch(std::span<ReceivedFrame> frames) override;
 	async::result<void> send(const arch::dma_buffer_view) override;
+	async::result<void> send(const arch::dma_buffer_view, const SendOffload &offload) override;
 
 	~VirtioNic() override = default;
 private:
+	struct QueuePair;
+
+	// Receive buffers stay posted to the device; receive() copies frames out of them.
+	struct RxBuffer : virtio_core::Request {
+		QueuePair *pair;
+		arch::dma_buffer buffer;
+	};
+
+	struct QueuePair {
+		VirtioNic *nic;
+		virtio_core::Queue *receiveVq;
+		virtio_core::Queue *transmitVq;
+		std::vector<std::unique_ptr<RxBuffer>> buffers;
+		// Buffers returned by the device, in the order in which they were used.
+		std::deque<RxBuffer *> completed;
+	};
+
+	async::result<void> postReceive_(RxBuffer *buffer);
+
+	// Copies the next frame out of the pair's completed buffers and reposts them.
+	// Returns std::nullopt if no complete frame is available.
+	async::result<std::optional<size_t>> assembleFrame_(QueuePair *pair,
+			arch::dma_buffer_view frame, ReceiveInfo &info);
+
+	async::result<bool> setQueuePairs_(uint16_t count);
+
+	// Pair that transmits frames of the given flow (see SendOffload::flowHash).
+	QueuePair *transmitPair_(uint32_t flowHash);
+
 	mbus_ng::EntityId entity_;
 	std::unique_ptr<virtio_core::Transport> transport_;
-	arch::contiguous_pool dmaPool_;
-	virtio_core::Queue *receiveVq_;
-	virtio_core::Queue *transmitVq_;
+	helix::HugeDmaPool dmaPool_;
+	std::vector<std::unique_ptr<QueuePair>> pairs_;
+	virtio_core::Queue *controlVq_ = nullptr;
+	async::recurring_event rxDoorbell_;
+
+	size_t headerSize_ = legacyHeaderSize;
+	size_t rxBufferSize_ = 0;
+	bool mergeable_ = false;
 };
 
 VirtioNic::VirtioNic(mbus_ng::EntityId entity, std::unique_ptr<virtio_core::Transport> transport)
@@ -70,10 +144,74 @@ VirtioNic::VirtioNic(mbus_ng::EntityId entity, std::unique_ptr<virtio_core::Tran
 		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MAC);
 	}
 
+	// Multiqueue needs the control virtq to enable more than one queue pair.
+	bool useMq = false;
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_CTRL_VQ)
+			&& transport_->checkDeviceFeature(VIRTIO_NET_F_MQ)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_CTRL_VQ);
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MQ);
+		useMq = true;
+	}
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_MRG_RXBUF)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MRG_RXBUF);
+		mergeable_ = true;
+		headerSize_ = sizeof(VirtHeader);
+	}
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_CSUM)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_CSUM);
+		capabilities_.txChecksum = true;
+		if(transport_->checkDeviceFeature(VIRTIO_NET_F_HOST_TSO4)) {
+			transport_->acknowledgeDriverFeature(VIRTIO_NET_F_HOST_TSO4);
+			capabilities_.tso4 = true;
+		}
+	}
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_GUEST_CSUM)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_GUEST_CSUM);
+		capabilities_.rxChecksum = true;
+		// Without mergeable buffers, each receive buffer would need to fit 64 KiB.
+		if(mergeable_ && transport_->checkDeviceFeature(VIRTIO_NET_F_GUEST_TSO4)) {
+			transport_->acknowledgeDriverFeature(VIRTIO_NET_F_GUEST_TSO4);
+			capabilities_.lro4 = true;
+			capabilities_.maxReceiveSize = maxCoalescedFrame;
+		}
+	}
+
 	transport_->finalizeFeatures();
-	transport_->claimQueues(2);
-	receiveVq_ = transport_->setupQueue(0);
-	transmitVq_ = transport_->setupQueue(1);
+
+	// Use one queue pair per CPU, but not more than the device offers.
+	unsigned int maxPairs = 1;
+	unsigned int numPairs = 1;
+	if(useMq) {
+		maxPairs = std::max(uint16_t{1},
+				transport_->loadConfig16(VIRTIO_NET_CONFIG_MAX_QUEUE_PAIRS));
+		numPairs = std::min(maxPairs, std::max(std::thread::hardware_concurrency(), 1u));
+	}
+
+	// RX and TX virtqs alternate; the control virtq follows all pairs.
+	transport_->claimQueues(useMq ? 2 * maxPairs + 1 : 2);
+	for(unsigned int i = 0; i < numPairs; i++) {
+		auto pair = std::make_unique<QueuePair>();
+		pair->nic = this;
+		pair->receiveVq = transport_->setupQueue(2 * i);
+		pair->transmitVq = transport_->setupQueue(2 * i + 1);
+		pairs_.push_back(std::move(pair));
+	}
+	if(useMq)
+		controlVq_ = transport_->setupQueue(2 * maxPairs);
+	capabilities_.numQueues = numPairs;
+
+	// Mergeable buffers are required to be able to hold at least a full header.
+	if(capabilities_.lro4) {
+		rxBufferSize_ = 0x1000;
+	}else{
+		rxBufferSize_ = headerSize_ + 1514;
+	}
+
+	std::cout << "virtio-driver: Using " << numPairs << " queue pair(s)"
+			<< (mergeable_ ? ", mergeable receive buffers" : "")
+			<< (capabilities_.txChecksum ? ", checksum offload" : "")
+			<< (capabilities_.tso4 ? ", TSO" : "")
+			<< (capabilities_.lro4 ? ", LRO" : "") << std::endl;
 
 	promiscuous_ = true;
 	all_multicast_ = true;
@@ -85,6 +223,29 @@ VirtioNic::VirtioNic(mbus_ng::EntityId entity, std::unique_ptr<virtio_core::Tran
 }
 
 async::result<void> VirtioNic::initialize() {
+	if(pairs_.size() > 1) {
+		if(!(co_await setQueuePairs_(pairs_.size()))) {
+			std::cout << "virtio-driver: Failed to enable multiple queue pairs" << std::endl;
+			pairs_.resize(1);
+			capabilities_.numQueues = 1;
+		}
+	}
+
+	// Fill all receive virtqs. Without mergeable buffers, each buffer needs two descriptors.
+	for(auto &pair : pairs_) {
+		size_t numBuffers = pair->receiveVq->numDescriptors();
+		if(!mergeable_)
+			numBuffers /= 2;
+		for(size_t i = 0; i < numBuffers; i++) {
+			auto buffer = std::make_unique<RxBuffer>();
+			buffer->pair = pair.get();
+			buffer->buffer = arch::dma_buffer{&dmaPool_, rxBufferSize_};
+			co_await postReceive_(buffer.get());
+			pair->buffers.push_back(std::move(buffer));
+		}
+		pair->receiveVq->notify();
+	}
+
 	mbus_ng::Properties netProperties{
 		{"drvcore.mbus-parent", mbus_ng::StringItem{std::to_string(entity_)}},
 		{"unix.subsystem", mbus_ng::StringItem{"net"}},
@@ -104,38 +265,207 @@ async::result<void> VirtioNic::initialize() {
 	}(std::move(netClassEntity));
 }
 
-async::result<size_t> VirtioNic::receive(arch::dma_buffer_view frame) {
-	arch::dma_object<VirtHeader> header { &dmaPool_ };
+async::result<bool> VirtioNic::setQueuePairs_(uint16_t count) {
+	arch::dma_object<CtrlHeader> header { &dmaPool_ };
+	arch::dma_object<uint16_t> pairs { &dmaPool_ };
+	arch::dma_object<uint8_t> ack { &dmaPool_ };
+	header->cls = VIRTIO_NET_CTRL_MQ;
+	header->command = VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET;
+	*pairs.data() = count;
+	*ack.data() = 0xFF;
 
 	virtio_core::Chain chain;
-	chain.append(co_await receiveVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::deviceToHost,
-			header.view_buffer().subview(0, legacyHeaderSize));
-	chain.append(co_await receiveVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::deviceToHost, frame);
+	chain.append(co_await controlVq_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::hostToDevice, header.view_buffer());
+	chain.append(co_await controlVq_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::hostToDevice, pairs.view_buffer());
+	chain.append(co_await controlVq_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::deviceToHost, ack.view_buffer());
+	co_await controlVq_->submitDescriptor(chain.front());
+
+	co_return *ack.data() == VIRTIO_NET_OK;
+}
+
+async::result<void> VirtioNic::postReceive_(RxBuffer *buffer) {
+	auto vq = buffer->pair->receiveVq;
+	arch::dma_buffer_view view = buffer->buffer;
+
+	virtio_core::Chain chain;
+	if(mergeable_) {
+		// The header is part of the first buffer of each frame.
+		chain.append(co_await vq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost, view);
+	}else{
+		chain.append(co_await vq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost, view.subview(0, headerSize_));
+		chain.append(co_await vq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost, view.subview(headerSize_));
+	}
+
+	vq->postDescriptor(chain.front(), buffer,
+			[] (virtio_core::Request *base_request) {
+		auto buffer = static_cast<RxBuffer *>(base_request);
+		buffer->pair->completed.push_back(buffer);
+		buffer->pair->nic->rxDoorbell_.raise();
+	});
+}
+
+async::result<std::optional<size_t>> VirtioNic::assembleFrame_(QueuePair *pair,
+		arch::dma_buffer_view frame, ReceiveInfo &info) {
+	if(pair->completed.empty())
+		co_return std::nullopt;
+
+	VirtHeader header{};
+	memcpy(&header, pair->completed.front()->buffer.data(), headerSize_);
+
+	// With mergeable buffers, a frame can span multiple buffers.
+	size_t numBuffers = 1;
+	if(mergeable_)
+		numBuffers = std::max(header.numBuffers, uint16_t{1});
+	if(pair->completed.size() < numBuffers)
+		co_return std::nullopt;
+
+	size_t length = 0;
+	bool truncated = false;
+	for(size_t i = 0; i < numBuffers; i++) {
+		auto buffer = pair->completed.front();
+		pair->completed.pop_front();
+
+		size_t skip = i ? 0 : headerSize_;
+		assert(buffer->len >= skip);
+		size_t chunk = buffer->len - skip;
+		if(length + chunk > frame.size()) {
+			truncated = true;
+		}else{
+			memcpy(reinterpret_cast<uint8_t *>(frame.data()) + length,
+					reinterpret_cast<uint8_t *>(buffer->buffer.data()) + skip, chunk);
+			length += chunk;
+		}
+
+		co_await postReceive_(buffer);
+	}
+	pair->receiveVq->notify();
+
+	if(truncated) {
+		std::cout << "virtio-driver: Dropping frame that exceeds the receive buffer"
+				<< std::endl;
+		co_return std::nullopt;
+	}
+
+	// Frames with a partial checksum never left the host, hence they do not need to be
+	// verified; like Linux, we do not complete the checksum field of such frames.
+	info.checksumVerified = header.flags
+			& (VIRTIO_NET_HDR_F_NEEDS_CSUM | VIRTIO_NET_HDR_F_DATA_VALID);
 
-	co_return (co_await receiveVq_->submitDescriptor(chain.front()) - legacyHeaderSize);
+	if(logFrames)
+		std::cout << "virtio-driver: received frame of " << length << " bytes" << std::endl;
+	co_return length;
+}
+
+async::result<size_t> VirtioNic::receive(arch::dma_buffer_view frame) {
+	ReceiveInfo info;
+	co_return co_await receive(frame, info);
+}
+
+async::result<size_t> VirtioNic::receive(arch::dma_buffer_view frame, ReceiveInfo &info) {
+	info = {};
+	while(true) {
+		bool progress = false;
+		for(auto &pair : pairs_) {
+			if(pair->completed.empty())
+				continue;
+			progress = true;
+			if(auto length = co_await assembleFrame_(pair.get(), frame, info); length)
+				co_return *length;
+		}
+
+		// Wait until the device returns more buffers.
+		if(!progress)
+			co_await rxDoorbell_.async_wait();
+	}
+}
+
+async::result<size_t> VirtioNic::receiveBatch(std::span<ReceivedFrame> frames) {
+	size_t count = 0;
+	while(true) {
+		// Round-robin over the pairs such that a busy queue does not starve the others.
+		bool progress = false;
+		for(auto &pair : pairs_) {
+			if(count == frames.size())
+				co_return count;
+			if(pair->completed.empty())
+				continue;
+			auto &frame = frames[count];
+			frame.info = {};
+			auto pending = pair->completed.size();
+			if(auto length = co_await assembleFrame_(pair.get(), frame.buffer, frame.info); length) {
+				frame.length = *length;
+				++count;
+			}
+			// Incomplete frames leave the buffers in place.
+			if(pair->completed.size() != pending)
+				progress = true;
+		}
+
+		if(progress)
+			continue;
+		if(count)
+			co_return count;
+		co_await rxDoorbell_.async_wait();
+	}
+}
+
+VirtioNic::QueuePair *VirtioNic::transmitPair_(uint32_t flowHash) {
+	if(flowHash)
+		return pairs_[flowHash % pairs_.size()].get();
+	int cpu;
+	HEL_CHECK(helGetCurrentCpu(&cpu));
+	return pairs_[static_cast<size_t>(cpu) % pairs_.size()].get();
 }
 
 async::result<void> VirtioNic::send(const arch::dma_buffer_view payload) {
-	if (payload.size() > 1514) {
+	co_await send(payload, SendOffload{});
+}
+
+async::result<void> VirtioNic::send(const arch::dma_buffer_view payload,
+		const SendOffload &offload) {
+	if(offload.segmentSize) {
+		if(!capabilities_.tso4 || !offload.needsChecksum)
+			throw std::runtime_error("TSO requested but not supported");
+		if(payload.size() > maxCoalescedFrame)
+			throw std::runtime_error("data exceeds maximal TSO frame");
+	}else if (payload.size() > 1514) {
 		throw std::runtime_error("data exceeds mtu");
 	}
+	if(offload.needsChecksum && !capabilities_.txChecksum)
+		throw std::runtime_error("checksum offload requested but not supported");
 
 	arch::dma_object<VirtHeader> header { &dmaPool_ };
 	memset(header.data(), 0, sizeof(VirtHeader));
+	if(offload.needsChecksum) {
+		header->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+		header->csumStart = offload.csumStart;
+		header->csumOffset = offload.csumOffset;
+	}
+	if(offload.segmentSize) {
+		header->gsoType = VIRTIO_NET_HDR_GSO_TCPV4;
+		header->gsoSize = offload.segmentSize;
+		header->hdrLen = offload.headerLength;
+	}
+
+	auto vq = transmitPair_(offload.flowHash)->transmitVq;
 
 	virtio_core::Chain chain;
-	chain.append(co_await transmitVq_->obtainDescriptor());
+	chain.append(co_await vq->obtainDescriptor());
 	chain.setupBuffer(virtio_core::hostToDevice,
-			header.view_buffer().subview(0, legacyHeaderSize));
-	chain.append(co_await transmitVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::hostToDevice, payload);
+			header.view_buffer().subview(0, headerSize_));
+	// Segmentation offload frames are not necessarily contiguous in physical memory.
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice, chain, vq, payload);
 
 	if(logFrames) {
 		std::cout << "virtio-driver: sending frame" << std::endl;
 	}
-	co_await transmitVq_->submitDescriptor(chain.front());
+	co_await vq->submitDescriptor(chain.front());
 	if(logFrames) {
 		std::cout << "virtio-driver: sent frame" << std::endl;
 	}
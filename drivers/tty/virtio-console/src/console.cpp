@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <stdlib.h>
 #include <string.h>
 #include <iostream>
+#include <optional>
 
 #include "console.hpp"
 
@@ -9,7 +11,10 @@
 #include <frg/std_compat.hpp>
 #include <protocols/mbus/client.hpp>
 #include <bragi/helpers-std.hpp>
+#include <helix/memory.hpp>
+#include <protocols/fs/server.hpp>
 #include <kerncfg.bragi.hpp>
+#include <fs.bragi.hpp>
 
 async::result<helix::UniqueLane> enumerateKerncfgByteRing(const char *purpose) {
 	auto filter = mbus_ng::Conjunction{{
@@ -55,27 +60,389 @@ getKerncfgByteRingPart(helix::BorrowedLane lane,
 	co_return std::make_tuple(resp.size(), resp.effective_dequeue(), resp.new_dequeue());
 }
 
+// Mirror of a kerncfg-byte-ring that is mapped read-only (see HelLogRingHeader).
+struct KerncfgRingMirror {
+	helix::Mapping header;
+	helix::Mapping data;
+	size_t size;
+};
+
+async::result<std::optional<KerncfgRingMirror>> mapKerncfgByteRing(helix::BorrowedLane lane) {
+	managarm::kerncfg::GetBufferMemoryRequest req;
+
+	auto [offer, sendReq, recvResp, pullHeader, pullData] =
+		co_await helix_ng::exchangeMsgs(lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline(),
+				helix_ng::pullDescriptor(),
+				helix_ng::pullDescriptor()
+			)
+		);
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(recvResp.error());
+
+	auto resp = *bragi::parse_head_only<managarm::kerncfg::SvrResponse>(recvResp);
+	recvResp.reset();
+	// Only some rings are mirrored; the kernel does not send descriptors for the others.
+	if(resp.error() == managarm::kerncfg::Error::ILLEGAL_REQUEST)
+		co_return std::nullopt;
+	assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+	HEL_CHECK(pullHeader.error());
+	HEL_CHECK(pullData.error());
+
+	co_return KerncfgRingMirror{
+		helix::Mapping{pullHeader.descriptor(), 0, 0x1000, kHelMapProtRead},
+		helix::Mapping{pullData.descriptor(), 0, resp.size(), kHelMapProtRead},
+		resp.size()
+	};
+}
+
+// Returns the head of the ring once it is at least watermark bytes past dequeue.
+async::result<uint64_t> waitKerncfgByteRing(helix::BorrowedLane lane,
+		uint64_t dequeue, uint64_t watermark) {
+	managarm::kerncfg::WaitBufferRequest req;
+	req.set_dequeue(dequeue);
+	req.set_watermark(watermark);
+
+	auto [offer, sendReq, recvResp] =
+		co_await helix_ng::exchangeMsgs(lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline()
+			)
+		);
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(recvResp.error());
+
+	auto resp = *bragi::parse_head_only<managarm::kerncfg::SvrResponse>(recvResp);
+	assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+	co_return resp.new_dequeue();
+}
+
+// Copies the payloads of the records in [dequeue, head) into chunk, like GetBufferContentsRequest.
+// Returns the number of bytes that were copied; dequeue is advanced past the copied records.
+size_t copyFromKerncfgRingMirror(KerncfgRingMirror &mirror, arch::dma_buffer_view chunk,
+		uint64_t &dequeue, uint64_t head) {
+	auto header = reinterpret_cast<HelLogRingHeader *>(mirror.header.get());
+	auto data = reinterpret_cast<const char *>(mirror.data.get());
+	auto out = reinterpret_cast<char *>(chunk.data());
+
+	size_t progress = 0;
+	while(dequeue < head) {
+		auto tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+		if(dequeue < tail) {
+			std::cerr << "virtio-console: warning, we missed "
+				<< (tail - dequeue) << " bytes (" << header->overwrittenRecords
+				<< " records were overwritten so far)" << std::endl;
+			dequeue = tail;
+			continue;
+		}
+
+		auto offset = dequeue & (mirror.size - 1);
+		uint64_t length;
+		memcpy(&length, data + offset, sizeof(uint64_t));
+		if(length > mirror.size - sizeof(uint64_t)) {
+			// Retry if the record was overwritten while we read its length.
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if(__atomic_load_n(&header->tail, __ATOMIC_RELAXED) > dequeue)
+				continue;
+			std::cerr << "virtio-console: ring mirror is corrupted" << std::endl;
+			dequeue = head;
+			break;
+		}
+		if(progress + length > chunk.size()) {
+			if(progress)
+				break;
+			std::cerr << "virtio-console: dropping record of " << length << " bytes" << std::endl;
+			dequeue += (sizeof(uint64_t) + length + 7) & ~uint64_t{7};
+			continue;
+		}
+
+		auto preWrap = std::min(mirror.size - (offset + sizeof(uint64_t)), size_t{length});
+		memcpy(out + progress, data + offset + sizeof(uint64_t), preWrap);
+		memcpy(out + progress + preWrap, data, length - preWrap);
+
+		// Discard the record if it was overwritten while we copied it.
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&header->tail, __ATOMIC_RELAXED) > dequeue)
+			continue;
+
+		progress += length;
+		dequeue += (sizeof(uint64_t) + length + 7) & ~uint64_t{7};
+	}
+
+	return progress;
+}
+
 namespace tty {
 namespace virtio_console {
 
+namespace {
+
+async::result<protocols::fs::ReadResult>
+read(void *object, helix_ng::CredentialsView, void *buffer, size_t length) {
+	auto self = static_cast<Port *>(object);
+	if(!length)
+		co_return size_t{0};
+	co_return co_await self->read(buffer, length);
+}
+
+async::result<frg::expected<protocols::fs::Error, size_t>>
+write(void *object, helix_ng::CredentialsView, const void *buffer, size_t length) {
+	auto self = static_cast<Port *>(object);
+	co_await self->write(buffer, length);
+	co_return length;
+}
+
+async::result<protocols::fs::SeekResult> seek(void *, int64_t) {
+	co_return protocols::fs::Error::seekOnPipe;
+}
+
+constexpr auto fileOperations = protocols::fs::FileOperations{
+	.seekAbs = &seek,
+	.seekRel = &seek,
+	.seekEof = &seek,
+	.read = &read,
+	.write = &write,
+};
+
+async::detached serveTerminal(helix::UniqueLane lane, smarter::shared_ptr<Port> port) {
+	while(true) {
+		auto [accept, recv_req] = co_await helix_ng::exchangeMsgs(lane,
+			helix_ng::accept(
+				helix_ng::recvInline())
+		);
+		HEL_CHECK(accept.error());
+		HEL_CHECK(recv_req.error());
+
+		auto conversation = accept.descriptor();
+
+		managarm::fs::CntRequest req;
+		req.ParseFromArray(recv_req.data(), recv_req.length());
+		recv_req.reset();
+		if(req.req_type() == managarm::fs::CntReqType::DEV_OPEN) {
+			auto [local_lane, remote_lane] = helix::createStream();
+			async::detach(protocols::fs::servePassthrough(
+					std::move(local_lane), port, &fileOperations));
+
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp, push_node] = co_await helix_ng::exchangeMsgs(conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::pushDescriptor(remote_lane)
+			);
+			HEL_CHECK(send_resp.error());
+			HEL_CHECK(push_node.error());
+		}else{
+			throw std::runtime_error("Invalid serveTerminal request!");
+		}
+	}
+}
+
+} // anonymous namespace
+
+// --------------------------------------------------------
+// Port
+// --------------------------------------------------------
+
+Port::Port(uint32_t id, arch::contiguous_pool *dmaPool,
+		virtio_core::Queue *rxQueue, virtio_core::Queue *txQueue)
+: id_{id}, dmaPool_{dmaPool}, rxQueue_{rxQueue}, txQueue_{txQueue} {
+	flushTransmits_();
+}
+
+async::result<void> Port::setupReceive() {
+	// Post buffers ahead of time, such that the device can deliver bursts of data
+	// without waiting for read() calls.
+	size_t numBuffers = std::min(rxQueue_->numDescriptors(), maxRxBuffers);
+	for(size_t i = 0; i < numBuffers; i++) {
+		auto buffer = std::make_unique<RxBuffer>();
+		buffer->port = this;
+		buffer->buffer = arch::dma_buffer{dmaPool_, rxBufferSize};
+		co_await postReceive_(buffer.get());
+		rxBuffers_.push_back(std::move(buffer));
+	}
+	rxQueue_->notify();
+}
+
+async::detached Port::serve(smarter::shared_ptr<Port> self, mbus_ng::EntityId parent) {
+	// Port 0 is the console port; other ports are generic data channels.
+	mbus_ng::Properties descriptor{
+		{"drvcore.mbus-parent", mbus_ng::StringItem{std::to_string(parent)}},
+		{"generic.devtype", mbus_ng::StringItem{"block"}},
+		{"generic.devname", mbus_ng::StringItem{id_ ? "vport" : "hvc"}}
+	};
+
+	auto entity = (co_await mbus_ng::Instance::global().createEntity(
+			"virtio-console-port" + std::to_string(id_), descriptor)).unwrap();
+
+	while(true) {
+		auto [localLane, remoteLane] = helix::createStream();
+
+		// If this fails, too bad!
+		(void)(co_await entity.serveRemoteLane(std::move(remoteLane)));
+
+		serveTerminal(std::move(localLane), self);
+	}
+}
+
+async::result<void> Port::postReceive_(RxBuffer *buffer) {
+	virtio_core::Chain chain;
+	chain.append(co_await rxQueue_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::deviceToHost, buffer->buffer);
+
+	rxQueue_->postDescriptor(chain.front(), buffer,
+			[] (virtio_core::Request *base_request) {
+		auto buffer = static_cast<RxBuffer *>(base_request);
+		buffer->port->rxCompleted_.push_back(buffer);
+		buffer->port->rxDoorbell_.raise();
+	});
+}
+
+async::result<size_t> Port::read(void *buffer, size_t length) {
+	while(rxCompleted_.empty())
+		co_await rxDoorbell_.async_wait();
+
+	// Copy out of as many buffers as possible and repost them with a single notification.
+	size_t progress = 0;
+	bool reposted = false;
+	while(progress < length && !rxCompleted_.empty()) {
+		auto rx = rxCompleted_.front();
+		assert(rxOffset_ <= rx->len);
+		size_t chunk = std::min(length - progress, rx->len - rxOffset_);
+		memcpy(reinterpret_cast<char *>(buffer) + progress,
+				reinterpret_cast<char *>(rx->buffer.data()) + rxOffset_, chunk);
+		progress += chunk;
+		rxOffset_ += chunk;
+
+		if(rxOffset_ == rx->len) {
+			rxCompleted_.pop_front();
+			rxOffset_ = 0;
+			co_await postReceive_(rx);
+			reposted = true;
+		}
+	}
+	if(reposted)
+		rxQueue_->notify();
+
+	co_return progress;
+}
+
+async::result<void> Port::write(const void *buffer, size_t length) {
+	std::vector<arch::dma_buffer> chunks;
+	for(size_t progress = 0; progress < length; progress += txChunkSize) {
+		auto chunk = std::min(length - progress, txChunkSize);
+		arch::dma_buffer dmaBuffer{dmaPool_, chunk};
+		memcpy(dmaBuffer.data(), reinterpret_cast<const char *>(buffer) + progress, chunk);
+		chunks.push_back(std::move(dmaBuffer));
+	}
+
+	// Queue all chunks before waiting for any of them. flushTransmits_() picks them up
+	// as a single batch.
+	std::vector<TxRequest> requests(chunks.size());
+	for(size_t i = 0; i < chunks.size(); i++) {
+		requests[i].view = chunks[i];
+		txPending_.push_back(&requests[i]);
+	}
+	txDoorbell_.raise();
+
+	for(auto &request : requests)
+		co_await request.done.wait();
+}
+
+async::result<void> Port::transmit(arch::dma_buffer_view view) {
+	TxRequest request;
+	request.view = view;
+	txPending_.push_back(&request);
+	txDoorbell_.raise();
+
+	co_await request.done.wait();
+}
+
+async::detached Port::flushTransmits_() {
+	while(true) {
+		while(txPending_.empty())
+			co_await txDoorbell_.async_wait();
+
+		// Post all pending chains and notify the device once. Each chain takes a single
+		// descriptor; we cannot obtain more descriptors than the virtq has before posting.
+		std::vector<virtio_core::Submission> batch;
+		while(!txPending_.empty() && batch.size() < txQueue_->numDescriptors()) {
+			auto request = txPending_.front();
+			txPending_.pop_front();
+
+			virtio_core::Chain chain;
+			chain.append(co_await txQueue_->obtainDescriptor());
+			chain.setupBuffer(virtio_core::hostToDevice, request->view);
+			batch.push_back({chain.front(), request, [] (virtio_core::Request *base_request) {
+				auto request = static_cast<TxRequest *>(base_request);
+				request->done.raise();
+			}});
+		}
+		txQueue_->submitBatch(batch);
+	}
+}
+
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
 
-Device::Device(std::unique_ptr<virtio_core::Transport> transport)
-: transport_{std::move(transport)} { }
+Device::Device(mbus_ng::EntityId entity, std::unique_ptr<virtio_core::Transport> transport)
+: entity_{entity}, transport_{std::move(transport)} { }
 
 async::detached Device::runDevice() {
+	if(transport_->checkDeviceFeature(VIRTIO_CONSOLE_F_MULTIPORT)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_CONSOLE_F_MULTIPORT);
+		multiport_ = true;
+	}
 	transport_->finalizeFeatures();
-	transport_->claimQueues(2);
-	rxQueue_ = transport_->setupQueue(0);
-	txQueue_ = transport_->setupQueue(1);
 
-	auto maxPorts = transport_->space().load(spec::regs::maxPorts);
-	std::cout << "virtio-console: Device supports " << maxPorts << " ports" << std::endl;
+	// Port 0 uses virtqs 0 and 1, the control virtqs are 2 and 3,
+	// port n > 0 uses virtqs 2n + 2 and 2n + 3.
+	uint32_t numPorts = 1;
+	if(multiport_) {
+		auto maxPorts = transport_->space().load(spec::regs::maxPorts);
+		std::cout << "virtio-console: Device supports " << maxPorts << " ports" << std::endl;
+		numPorts = std::clamp(maxPorts, uint32_t{1}, maxSupportedPorts);
+	}
+
+	transport_->claimQueues(multiport_ ? 2 * (numPorts + 1) : 2);
+	for(uint32_t i = 0; i < numPorts; i++) {
+		unsigned int rxIndex = i ? 2 * i + 2 : 0;
+		ports_.push_back(smarter::make_shared<Port>(i, &dmaPool_,
+				transport_->setupQueue(rxIndex), transport_->setupQueue(rxIndex + 1)));
+	}
+	if(multiport_) {
+		controlRxQueue_ = transport_->setupQueue(2);
+		controlTxQueue_ = transport_->setupQueue(3);
+	}
 
 	transport_->runDevice();
 
+	if(multiport_) {
+		// Ports are set up once the device announces them.
+		size_t numBuffers = std::min(controlRxQueue_->numDescriptors(), maxRxBuffers);
+		for(size_t i = 0; i < numBuffers; i++) {
+			auto buffer = std::make_unique<ControlBuffer>();
+			buffer->device = this;
+			buffer->buffer = arch::dma_buffer{&dmaPool_, rxBufferSize};
+			co_await postControlReceive_(buffer.get());
+			controlBuffers_.push_back(std::move(buffer));
+		}
+		controlRxQueue_->notify();
+
+		processControl_();
+		co_await sendControl_(0, spec::control::deviceReady, 1);
+	}else{
+		co_await ports_[0]->setupReceive();
+		ports_[0]->serve(ports_[0], entity_);
+	}
+
 	auto dumpKerncfgRing = [this] (const char *name, size_t watermark) -> async::result<void> {
 		auto lane = co_await enumerateKerncfgByteRing(name);
 
@@ -83,6 +450,23 @@ async::detached Device::runDevice() {
 
 		arch::dma_buffer chunkBuffer{&dmaPool_, 1 << 16};
 
+		// If the kernel mirrors the ring, read records from the mapping;
+		// the kernel is only asked to wait for new data.
+		if(auto mirror = co_await mapKerncfgByteRing(lane); mirror) {
+			auto header = reinterpret_cast<HelLogRingHeader *>(mirror->header.get());
+			dequeue = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+
+			while (true) {
+				auto head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+				if (head - dequeue < watermark)
+					head = co_await waitKerncfgByteRing(lane, dequeue, watermark);
+
+				auto size = copyFromKerncfgRingMirror(*mirror, chunkBuffer, dequeue, head);
+				if (size)
+					co_await ports_[0]->transmit(chunkBuffer.subview(0, size));
+			}
+		}
+
 		while (true) {
 			auto [size, effectiveDequeue, newDequeue] = co_await getKerncfgByteRingPart(
 					lane, chunkBuffer, dequeue, watermark);
@@ -94,10 +478,8 @@ async::detached Device::runDevice() {
 
 			dequeue = newDequeue;
 
-			virtio_core::Chain chain;
-			chain.append(co_await txQueue_->obtainDescriptor());
-			chain.setupBuffer(virtio_core::hostToDevice, chunkBuffer.subview(0, size));
-			co_await txQueue_->submitDescriptor(chain.front());
+			if (size)
+				co_await ports_[0]->transmit(chunkBuffer.subview(0, size));
 		}
 	};
 
@@ -107,4 +489,93 @@ async::detached Device::runDevice() {
 	co_return;
 }
 
+async::result<void> Device::postControlReceive_(ControlBuffer *buffer) {
+	virtio_core::Chain chain;
+	chain.append(co_await controlRxQueue_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::deviceToHost, buffer->buffer);
+
+	controlRxQueue_->postDescriptor(chain.front(), buffer,
+			[] (virtio_core::Request *base_request) {
+		auto buffer = static_cast<ControlBuffer *>(base_request);
+		buffer->device->controlCompleted_.push_back(buffer);
+		buffer->device->controlDoorbell_.raise();
+	});
+}
+
+async::result<void> Device::sendControl_(uint32_t id, uint16_t event, uint16_t value) {
+	arch::dma_object<spec::Control> msg{&dmaPool_};
+	msg->id = id;
+	msg->event = event;
+	msg->value = value;
+
+	virtio_core::Chain chain;
+	chain.append(co_await controlTxQueue_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::hostToDevice, msg.view_buffer());
+	co_await controlTxQueue_->submitDescriptor(chain.front());
+}
+
+async::detached Device::processControl_() {
+	while(true) {
+		while(controlCompleted_.empty())
+			co_await controlDoorbell_.async_wait();
+
+		auto buffer = controlCompleted_.front();
+		controlCompleted_.pop_front();
+
+		if(buffer->len >= sizeof(spec::Control)) {
+			spec::Control msg;
+			memcpy(&msg, buffer->buffer.data(), sizeof(spec::Control));
+			co_await handleControl_(msg,
+					reinterpret_cast<char *>(buffer->buffer.data()) + sizeof(spec::Control),
+					buffer->len - sizeof(spec::Control));
+		}else{
+			std::cout << "virtio-console: Ignoring short control message" << std::endl;
+		}
+
+		co_await postControlReceive_(buffer);
+		controlRxQueue_->notify();
+	}
+}
+
+async::result<void> Device::handleControl_(spec::Control msg, const char *data, size_t size) {
+	auto port = port_(msg.id);
+
+	switch(msg.event) {
+		case spec::control::deviceAdd:
+			if(!port) {
+				std::cout << "virtio-console: Port " << msg.id
+						<< " exceeds the number of supported ports" << std::endl;
+				co_await sendControl_(msg.id, spec::control::portReady, 0);
+				break;
+			}
+			co_await port->setupReceive();
+			port->serve(ports_[msg.id], entity_);
+			co_await sendControl_(msg.id, spec::control::portReady, 1);
+			break;
+		case spec::control::consolePort:
+			if(!port)
+				break;
+			// Console ports are always open from the guest's point of view.
+			co_await sendControl_(msg.id, spec::control::portOpen, 1);
+			break;
+		case spec::control::portName:
+			if(!port)
+				break;
+			std::cout << "virtio-console: Port " << msg.id << " is named "
+					<< std::string_view{data, strnlen(data, size)} << std::endl;
+			break;
+		case spec::control::portOpen:
+			// Data that is written while the host side is closed is discarded by the device.
+			break;
+		case spec::control::deviceRemove:
+			std::cout << "virtio-console: Removal of port " << msg.id
+					<< " is not supported" << std::endl;
+			break;
+		case spec::control::resize:
+			break;
+		default:
+			std::cout << "virtio-console: Unexpected control event " << msg.event << std::endl;
+	}
+}
+
 } } // namespace tty::virtio_console
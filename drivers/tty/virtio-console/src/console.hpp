@@ -1,8 +1,13 @@
+#include <deque>
 #include <queue>
 #include <memory>
 
 #include <arch/dma_pool.hpp>
+#include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
 #include <core/virtio/core.hpp>
+#include <protocols/mbus/client.hpp>
+#include <smarter.hpp>
 
 namespace tty {
 namespace virtio_console {
@@ -11,6 +16,11 @@ namespace virtio_console {
 // VirtIO data structures and constants
 // --------------------------------------------------------
 
+enum {
+	VIRTIO_CONSOLE_F_SIZE = 0,
+	VIRTIO_CONSOLE_F_MULTIPORT = 1
+};
+
 namespace spec::regs {
 	inline constexpr arch::scalar_register<uint16_t> cols{0};
 	inline constexpr arch::scalar_register<uint16_t> rows{2};
@@ -18,21 +28,142 @@ namespace spec::regs {
 	inline constexpr arch::scalar_register<uint32_t> emergencyWrite{8};
 }
 
+namespace spec {
+	// Messages on the control virtqs (only with VIRTIO_CONSOLE_F_MULTIPORT).
+	struct Control {
+		uint32_t id;
+		uint16_t event;
+		uint16_t value;
+	};
+	static_assert(sizeof(Control) == 8);
+
+	namespace control {
+		inline constexpr uint16_t deviceReady = 0;
+		inline constexpr uint16_t deviceAdd = 1;
+		inline constexpr uint16_t deviceRemove = 2;
+		inline constexpr uint16_t portReady = 3;
+		inline constexpr uint16_t consolePort = 4;
+		inline constexpr uint16_t resize = 5;
+		inline constexpr uint16_t portOpen = 6;
+		inline constexpr uint16_t portName = 7;
+	}
+}
+
+// Size of each receive buffer.
+inline constexpr size_t rxBufferSize = 0x1000;
+
+// Maximal number of receive buffers that are posted per virtq.
+inline constexpr size_t maxRxBuffers = 64;
+
+// Writes are split into chains of at most this size.
+inline constexpr size_t txChunkSize = 0x10000;
+
+// Limits the number of virtqs that we set up.
+inline constexpr uint32_t maxSupportedPorts = 16;
+
+struct Port;
+struct Device;
+
+// Receive buffers stay posted to the device; read() copies data out of them.
+struct RxBuffer : virtio_core::Request {
+	Port *port;
+	arch::dma_buffer buffer;
+};
+
+struct ControlBuffer : virtio_core::Request {
+	Device *device;
+	arch::dma_buffer buffer;
+};
+
+struct TxRequest : virtio_core::Request {
+	arch::dma_buffer_view view;
+	async::oneshot_event done;
+};
+
+// --------------------------------------------------------
+// Port
+// --------------------------------------------------------
+
+struct Port {
+	Port(uint32_t id, arch::contiguous_pool *dmaPool,
+			virtio_core::Queue *rxQueue, virtio_core::Queue *txQueue);
+
+	uint32_t id() {
+		return id_;
+	}
+
+	// Posts all receive buffers to the device.
+	async::result<void> setupReceive();
+
+	// Creates an mbus entity that exposes the port as a terminal.
+	async::detached serve(smarter::shared_ptr<Port> self, mbus_ng::EntityId parent);
+
+	async::result<size_t> read(void *buffer, size_t length);
+
+	// Transmits data; the data is copied into chains of at most txChunkSize bytes.
+	async::result<void> write(const void *buffer, size_t length);
+
+	// Transmits a buffer without copying it.
+	// All chains that are queued at the same time are submitted with a single notification.
+	async::result<void> transmit(arch::dma_buffer_view view);
+
+private:
+	async::result<void> postReceive_(RxBuffer *buffer);
+
+	async::detached flushTransmits_();
+
+	uint32_t id_;
+	arch::contiguous_pool *dmaPool_;
+	virtio_core::Queue *rxQueue_;
+	virtio_core::Queue *txQueue_;
+
+	std::vector<std::unique_ptr<RxBuffer>> rxBuffers_;
+	// Buffers returned by the device, in the order in which they were used.
+	std::deque<RxBuffer *> rxCompleted_;
+	// Number of bytes of rxCompleted_.front() that were already read.
+	size_t rxOffset_ = 0;
+	async::recurring_event rxDoorbell_;
+
+	std::deque<TxRequest *> txPending_;
+	async::recurring_event txDoorbell_;
+};
 
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
 
 struct Device {
-	Device(std::unique_ptr<virtio_core::Transport> transport);
+	Device(mbus_ng::EntityId entity, std::unique_ptr<virtio_core::Transport> transport);
 
 	async::detached runDevice();
 
 private:
+	async::result<void> postControlReceive_(ControlBuffer *buffer);
+
+	async::result<void> sendControl_(uint32_t id, uint16_t event, uint16_t value);
+
+	async::detached processControl_();
+
+	async::result<void> handleControl_(spec::Control msg, const char *data, size_t size);
+
+	Port *port_(uint32_t id) {
+		if(id >= ports_.size())
+			return nullptr;
+		return ports_[id].get();
+	}
+
+	mbus_ng::EntityId entity_;
 	arch::contiguous_pool dmaPool_;
 	std::unique_ptr<virtio_core::Transport> transport_;
-	virtio_core::Queue *rxQueue_;
-	virtio_core::Queue *txQueue_;
+	bool multiport_ = false;
+
+	std::vector<smarter::shared_ptr<Port>> ports_;
+
+	virtio_core::Queue *controlRxQueue_ = nullptr;
+	virtio_core::Queue *controlTxQueue_ = nullptr;
+	std::vector<std::unique_ptr<ControlBuffer>> controlBuffers_;
+	std::deque<ControlBuffer *> controlCompleted_;
+	async::recurring_event controlDoorbell_;
 };
 
 } } // namespace console::virtio_console
@@ -17,7 +17,7 @@ async::detached bindDevice(mbus_ng::Entity hwEntity) {
 	auto transport = co_await virtio_core::discover(std::move(hwDevice),
 			virtio_core::DiscoverMode::transitional);
 
-	auto device = new tty::virtio_console::Device{std::move(transport)};
+	auto device = new tty::virtio_console::Device{hwEntity.id(), std::move(transport)};
 	device->runDevice();
 }
 
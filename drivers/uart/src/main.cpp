@@ -21,10 +21,95 @@
 
 static constexpr bool logIrqs = false;
 static constexpr bool logTx = false;
+static constexpr bool logFifo = false;
 
 arch::io_space base;
 helix::UniqueIrq irq;
 
+// Size of the device's FIFOs in bytes; determined by detectFifo().
+size_t fifoSize = 1;
+bool fifo64 = false;
+
+// Current RX trigger level, as an index into rxTriggerBytes().
+int rxTrigger = 3;
+
+// Number of bytes received since the last overrun.
+size_t rxSinceOverrun = 0;
+
+// The RX trigger level is raised again after this many bytes have been received
+// without an overrun. Higher trigger levels save IRQs; lower levels leave more room
+// in the FIFO to absorb IRQ latency.
+constexpr size_t rxRaiseThreshold = 4096;
+
+size_t rxTriggerBytes(int trigger) {
+	constexpr size_t bytes16[] = {1, 4, 8, 14};
+	constexpr size_t bytes64[] = {1, 16, 32, 56};
+	if(fifoSize == 1)
+		return 1;
+	return fifo64 ? bytes64[trigger] : bytes16[trigger];
+}
+
+void storeFifoControl(bool clear) {
+	auto enable = fifoSize > 1 ? FifoCtrl::enable : FifoCtrl::disable;
+	auto clearFifos = clear ? FifoCtrl::enable : FifoCtrl::disable;
+
+	// The 64-byte mode bit of the 16750 can only be written while DLAB is set.
+	auto lcr = base.load(uart_register::lineControl);
+	base.store(uart_register::lineControl, lcr / line_control::dlab(true));
+	base.store(uart_register::fifoControl,
+			fifo_control::fifoEnable(enable)
+			| fifo_control::clearRx(clearFifos)
+			| fifo_control::clearTx(clearFifos)
+			| fifo_control::fifo64(fifo64 ? FifoCtrl::enable : FifoCtrl::disable)
+			| fifo_control::fifoIrqLvl(static_cast<FifoCtrl>(rxTrigger)));
+	base.store(uart_register::lineControl, lcr);
+}
+
+// Determines the FIFO size from the IIR after trying to enable the FIFOs in 64-byte mode.
+// This distinguishes 8250/16450 (no FIFO), 16550 (broken FIFO), 16550A (16 bytes)
+// and 16750 (64 bytes).
+void detectFifo() {
+	fifoSize = 16;
+	fifo64 = true;
+	storeFifoControl(true);
+
+	auto ident = base.load(uart_register::irqIdentification);
+	if((ident & irq_ident_register::fifoState) != 3) {
+		fifoSize = 1;
+		fifo64 = false;
+	}else if(ident & irq_ident_register::fifo64Enabled) {
+		fifoSize = 64;
+	}else{
+		fifo64 = false;
+	}
+	storeFifoControl(true);
+
+	std::cout << "uart: Using " << fifoSize << " byte FIFO" << std::endl;
+}
+
+void lowerRxTrigger() {
+	rxSinceOverrun = 0;
+	if(!rxTrigger)
+		return;
+	rxTrigger--;
+	if(logFifo)
+		std::cout << "uart: Lowering RX trigger level to "
+				<< rxTriggerBytes(rxTrigger) << " bytes" << std::endl;
+	storeFifoControl(false);
+}
+
+void accountRx(size_t count) {
+	rxSinceOverrun += count;
+	if(rxSinceOverrun < rxRaiseThreshold || rxTrigger == 3)
+		return;
+	rxSinceOverrun = 0;
+	rxTrigger++;
+	if(logFifo)
+		std::cout << "uart: Raising RX trigger level to "
+				<< rxTriggerBytes(rxTrigger) << " bytes" << std::endl;
+	storeFifoControl(false);
+}
+
 struct ReadRequest {
 	ReadRequest(void *buffer, size_t maxLength)
 	: buffer(buffer), maxLength(maxLength) { }
@@ -106,9 +191,6 @@ boost::intrusive::list<
 	>
 > sendRequests;
 
-// Size of the device's TX FIFO in bytes.
-constexpr size_t txFifoSize = 16;
-
 bool txInFlight = false;
 
 void flushSends() {
@@ -127,7 +209,7 @@ void flushSends() {
 		>
 	> pending;
 
-	size_t fifoAvailable = txFifoSize;
+	size_t fifoAvailable = fifoSize;
 	while(!sendRequests.empty() && fifoAvailable) {
 		auto req = &sendRequests.front();
 		assert(req->progress < req->length);
@@ -182,15 +264,40 @@ async::detached handleIrqs() {
 				break;
 
 			if((reason & irq_ident_register::id) == IrqIds::lineStatus) {
+				// Reading the LSR clears the IRQ.
+				auto status = base.load(uart_register::lineStatus);
 				std::cout << "uart: Overrun, Parity, Framing or Break Error!" << std::endl;
+				if(status & line_status::overrunError)
+					lowerRxTrigger();
 			}else if((reason & irq_ident_register::id) == IrqIds::dataAvailable
 					|| (reason & irq_ident_register::id) == IrqIds::charTimeout) {
 				if(logIrqs)
 					std::cout << "uart: IRQ caused by: RX available" << std::endl;
 
-				while(base.load(uart_register::lineStatus) & line_status::dataReady) {
-					auto c = base.load(uart_register::data);
-					recvBuffer.push_back(c);
+				// If the trigger level is reached, the FIFO holds at least that many bytes.
+				// Read them without polling the LSR after each byte.
+				size_t count = 0;
+				if((reason & irq_ident_register::id) == IrqIds::dataAvailable) {
+					for(; count < rxTriggerBytes(rxTrigger); count++)
+						recvBuffer.push_back(base.load(uart_register::data));
+				}
+
+				bool overrun = false;
+				while(true) {
+					auto status = base.load(uart_register::lineStatus);
+					if(status & line_status::overrunError)
+						overrun = true;
+					if(!(status & line_status::dataReady))
+						break;
+					recvBuffer.push_back(base.load(uart_register::data));
+					count++;
+				}
+
+				if(overrun) {
+					std::cout << "uart: RX overrun" << std::endl;
+					lowerRxTrigger();
+				}else{
+					accountRx(count);
 				}
 				if(!recvRequests.empty())
 					completeRecvs();
@@ -345,9 +452,7 @@ int main() {
 	base = arch::global_io.subspace(COM1);
 
 	// Perform general initialization.
-	base.store(uart_register::fifoControl,
-			fifo_control::fifoEnable(FifoCtrl::enable)
-			| fifo_control::fifoIrqLvl(FifoCtrl::triggerLvl14));
+	detectFifo();
 
 	// Wait for the FIFO to become empty.
 	while(!(base.load(uart_register::lineStatus) & line_status::txReady))
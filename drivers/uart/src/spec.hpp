@@ -79,6 +79,10 @@ namespace irq_enable {
 
 namespace fifo_control {
 	arch::field<uint8_t, FifoCtrl> fifoEnable(0, 1);
+	arch::field<uint8_t, FifoCtrl> clearRx(1, 1);
+	arch::field<uint8_t, FifoCtrl> clearTx(2, 1);
+	// 16750 only. Enables the 64-byte FIFOs; only writable while DLAB is set.
+	arch::field<uint8_t, FifoCtrl> fifo64(5, 1);
 	arch::field<uint8_t, FifoCtrl> fifoIrqLvl(6, 2);
 }
 
@@ -91,10 +95,14 @@ namespace line_control {
 
 namespace line_status {
 	arch::field<uint8_t, bool> dataReady(0, 1);
+	arch::field<uint8_t, bool> overrunError(1, 1);
 	arch::field<uint8_t, bool> txReady(5, 1);
 }
 
 namespace irq_ident_register {
 	arch::field<uint8_t, bool> ignore(0, 1);
 	arch::field<uint8_t, IrqIds> id(1, 3);
+	arch::field<uint8_t, bool> fifo64Enabled(5, 1);
+	// Both bits are set if the FIFOs are enabled and working (i.e., on 16550A and later).
+	arch::field<uint8_t, uint8_t> fifoState(6, 2);
 }
@@ -719,6 +719,7 @@ async::detached HidDevice::run(proto::Device device, int config_num, int intf_nu
 	mbus_ng::Properties mbusDescriptor{
 		{"unix.subsystem", mbus_ng::StringItem{"input"}}
 	};
+	mbusDescriptor.merge(_eventDev->mbusProperties());
 
 	auto entity = (co_await mbus_ng::Instance::global().createEntity(
 		"input-usb-hid", mbusDescriptor)).unwrap();
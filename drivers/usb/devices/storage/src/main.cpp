@@ -22,7 +22,7 @@ namespace {
 
 namespace proto = protocols::usb;
 
-async::detached StorageDevice::run(int config_num, int intf_num) {
+async::detached StorageDevice::run(int config_num, int intf_num, int alternative) {
 	// I own a USB key that does not support the READ6 command. ~AvdG
 	enableRead6 = false;
 
@@ -33,6 +33,10 @@ async::detached StorageDevice::run(int config_num, int intf_num) {
 
 	proto::walkConfiguration(descriptor, [&] (int type, size_t, void *, const auto &info) {
 		if(type == proto::descriptor_type::endpoint) {
+			if(info.interfaceNumber.value() != intf_num
+					|| info.interfaceAlternative.value() != alternative)
+				return;
+
 			if(info.endpointIn.value()) {
 				in_endp_number = info.endpointNumber.value();
 			}else if(!info.endpointIn.value()) {
@@ -50,7 +54,7 @@ async::detached StorageDevice::run(int config_num, int intf_num) {
 		std::cout << "block-usb: Setting up configuration" << std::endl;
 
 	auto config = (co_await usbDevice_.useConfiguration(0, config_num)).unwrap();
-	auto intf = (co_await config.useInterface(intf_num, 0)).unwrap();
+	auto intf = (co_await config.useInterface(intf_num, alternative)).unwrap();
 	endp_in_ = (co_await intf.getEndpoint(proto::PipeType::in, in_endp_number.value())).unwrap();
 	endp_out_ = (co_await intf.getEndpoint(proto::PipeType::out, out_endp_number.value())).unwrap();
 
@@ -116,15 +120,40 @@ async::result<frg::expected<scsi::Error, size_t>> StorageDevice::sendScsiCommand
 	co_return info.data.size();
 }
 
+async::detached runUas(mbus_ng::Entity entity, proto::Device device, int config_num,
+		int intf_num, int alternative, uas::PipeConfig pipes, std::optional<int> bot_alternative) {
+	auto properties = (co_await entity.getProperties()).unwrap();
+	bool useStreams = false;
+	if(auto speed = std::get_if<mbus_ng::StringItem>(&properties["usb.speed"]); speed)
+		useStreams = speed->value == "5000";
+
+	auto uas_device = new uas::StorageDevice(device, entity.id());
+	if(co_await uas_device->setup(config_num, intf_num, alternative, pipes, useStreams)) {
+		uas_device->runScsi();
+		blockfs::runDevice(uas_device);
+		co_return;
+	}
+	delete uas_device;
+
+	if(!bot_alternative)
+		co_return;
+
+	std::cout << "block-usb: Falling back to Bulk-Only Transport" << std::endl;
+	auto storage_device = new StorageDevice(device, entity.id());
+	storage_device->run(config_num, intf_num, bot_alternative.value());
+	blockfs::runDevice(storage_device);
+}
+
 async::detached bindDevice(mbus_ng::Entity entity) {
 	auto lane = (co_await entity.getRemoteLane()).unwrap();
 	auto device = proto::connect(std::move(lane));
 
 	std::optional<int> config_number;
 	std::optional<int> intf_number;
-	std::optional<int> intf_class;
-	std::optional<int> intf_subclass;
-	std::optional<int> intf_protocol;
+	// Alternatives of the first interface that implement BOT and UAS, respectively.
+	std::optional<int> bot_alternative;
+	std::optional<int> uas_alternative;
+	uas::PipeConfig uas_pipes;
 
 	if(logEnumeration)
 		std::cout << "block-usb: Getting configuration descriptor" << std::endl;
@@ -135,12 +164,16 @@ async::detached bindDevice(mbus_ng::Entity entity) {
 		co_return;
 	}
 
+	// The UAS alternative while its descriptors are being walked.
+	std::optional<int> current_alternative;
+
 	proto::walkConfiguration(descriptorOrError.value(), [&] (int type, size_t, void *p, const auto &info) {
 		if(type == proto::descriptor_type::configuration) {
 			assert(!config_number);
 			config_number = info.configNumber.value();
 		}else if(type == proto::descriptor_type::interface) {
-			if(intf_number) {
+			current_alternative = std::nullopt;
+			if(intf_number && info.interfaceNumber.value() != intf_number.value()) {
 				std::cout << "block-usb: Ignoring interface "
 						<< info.interfaceNumber.value() << std::endl;
 				return;
@@ -150,31 +183,59 @@ async::detached bindDevice(mbus_ng::Entity entity) {
 						<< ", alternative: " << info.interfaceAlternative.value() << std::endl;
 			intf_number = info.interfaceNumber.value();
 
-			assert(!intf_class);
-			assert(!intf_subclass);
-			assert(!intf_protocol);
 			auto desc = (proto::InterfaceDescriptor *)p;
-			intf_class = desc->interfaceClass;
-			intf_subclass = desc->interfaceSubClass;
-			intf_protocol = desc->interfaceProtocol;
+			if(logEnumeration)
+				std::cout << "block-usb: Interface class: 0x" << std::hex << int{desc->interfaceClass}
+						<< ", subclass: 0x" << int{desc->interfaceSubClass}
+						<< ", protocol: 0x" << int{desc->interfaceProtocol}
+						<< std::dec << std::endl;
+			if(desc->interfaceClass != protocols::usb::usb_class::mass_storage
+					|| desc->interfaceSubClass != 0x06)
+				return;
+
+			if(desc->interfaceProtocol == 0x50 && !bot_alternative) {
+				bot_alternative = info.interfaceAlternative.value();
+			}else if(desc->interfaceProtocol == 0x62 && !uas_alternative) {
+				uas_alternative = info.interfaceAlternative.value();
+				current_alternative = uas_alternative;
+			}
+		}else if(type == uas::pipeUsageDescriptorType) {
+			if(!current_alternative || !info.endpointNumber)
+				return;
+
+			auto desc = (uas::PipeUsageDescriptor *)p;
+			switch(desc->pipeId) {
+			case uas::kPipeCommand: uas_pipes.command = info.endpointNumber.value(); break;
+			case uas::kPipeStatus: uas_pipes.status = info.endpointNumber.value(); break;
+			case uas::kPipeDataIn: uas_pipes.dataIn = info.endpointNumber.value(); break;
+			case uas::kPipeDataOut: uas_pipes.dataOut = info.endpointNumber.value(); break;
+			default:
+				std::cout << "block-usb: Unexpected UAS pipe ID "
+						<< int{desc->pipeId} << std::endl;
+			}
 		}
 	});
 
-	if(logEnumeration)
-		std::cout << "block-usb: Device class: 0x" << std::hex << intf_class.value()
-				<< ", subclass: 0x" << intf_subclass.value()
-				<< ", protocol: 0x" << intf_protocol.value()
-				<< std::dec << std::endl;
-	if(intf_class.value() != protocols::usb::usb_class::mass_storage
-			|| intf_subclass.value() != 0x06
-			|| intf_protocol.value() != 0x50)
+	if(!config_number || !intf_number)
+		co_return;
+
+	if(uas_alternative && uas_pipes.command && uas_pipes.status
+			&& uas_pipes.dataIn && uas_pipes.dataOut) {
+		if(logEnumeration)
+			std::cout << "block-usb: Detected UAS device" << std::endl;
+		runUas(std::move(entity), std::move(device), config_number.value(),
+				intf_number.value(), uas_alternative.value(), uas_pipes, bot_alternative);
+		co_return;
+	}
+
+	if(!bot_alternative)
 		co_return;
 
 	if(logEnumeration)
 		std::cout << "block-usb: Detected USB device" << std::endl;
 
 	auto storage_device = new StorageDevice(device, entity.id());
-	storage_device->run(config_number.value(), intf_number.value());
+	storage_device->run(config_number.value(), intf_number.value(), bot_alternative.value());
 	blockfs::runDevice(storage_device);
 }
 
@@ -2,9 +2,14 @@
 #include <async/oneshot-event.hpp>
 #include <async/result.hpp>
 #include <blockfs.hpp>
+#include <protocols/usb/api.hpp>
 #include <scsi.hpp>
 #include <boost/intrusive/list.hpp>
 
+#include <array>
+#include <optional>
+#include <vector>
+
 enum Signatures {
 	kSignCbw = 0x43425355,
 	kSignCsw = 0x53425355
@@ -29,12 +34,13 @@ struct [[ gnu::packed ]] CommandStatusWrapper {
 };
 static_assert(sizeof(CommandStatusWrapper) == 13);
 
+// Bulk-Only Transport.
 struct StorageDevice : scsi::StorageDevice {
 	StorageDevice(protocols::usb::Device usb_device, int64_t parent_id)
 	: scsi::StorageDevice(512, parent_id), usbDevice_(std::move(usb_device)),
 		endp_in_{nullptr}, endp_out_{nullptr} { }
 
-	async::detached run(int config_num, int intf_num);
+	async::detached run(int config_num, int intf_num, int alternative);
 
 	async::result<frg::expected<scsi::Error, size_t>> sendScsiCommand(const scsi::CommandInfo &info) override;
 
@@ -44,3 +50,127 @@ private:
 	protocols::usb::Endpoint endp_out_;
 };
 
+// --------------------------------------------------------
+// USB Attached SCSI
+// --------------------------------------------------------
+
+namespace uas {
+
+enum IuId : uint8_t {
+	kIuCommand = 0x01,
+	kIuSense = 0x03,
+	kIuResponse = 0x04,
+	kIuReadReady = 0x06,
+	kIuWriteReady = 0x07
+};
+
+enum PipeId : uint8_t {
+	kPipeCommand = 1,
+	kPipeStatus = 2,
+	kPipeDataIn = 3,
+	kPipeDataOut = 4
+};
+
+// Follows each endpoint descriptor of a UAS interface.
+inline constexpr uint8_t pipeUsageDescriptorType = 0x24;
+
+struct [[ gnu::packed ]] PipeUsageDescriptor {
+	uint8_t length;
+	uint8_t descriptorType;
+	uint8_t pipeId;
+	uint8_t reserved;
+};
+
+struct [[ gnu::packed ]] CommandIu {
+	uint8_t iuId;
+	uint8_t reserved0;
+	uint16_t tag; // Big endian.
+	uint8_t attributes;
+	uint8_t reserved1;
+	uint8_t additionalCdbLength;
+	uint8_t reserved2;
+	uint8_t lun[8];
+	uint8_t cdb[16];
+};
+static_assert(sizeof(CommandIu) == 32);
+
+// Common prefix of all IUs on the status pipe.
+struct [[ gnu::packed ]] IuHeader {
+	uint8_t iuId;
+	uint8_t reserved0;
+	uint16_t tag; // Big endian.
+};
+
+struct [[ gnu::packed ]] SenseIu {
+	IuHeader header;
+	uint16_t statusQualifier;
+	uint8_t status;
+	uint8_t reserved[7];
+	uint16_t senseLength;
+	uint8_t senseData[96];
+};
+
+struct [[ gnu::packed ]] ResponseIu {
+	IuHeader header;
+	uint8_t additionalInfo[3];
+	uint8_t responseCode;
+};
+static_assert(sizeof(ResponseIu) == 8);
+
+// Size of the buffer that receives IUs from the status pipe.
+inline constexpr size_t statusBufferSize = sizeof(SenseIu);
+
+// Tags are used as stream IDs, hence they start at 1.
+inline constexpr size_t maxTags = 32;
+
+// Endpoint numbers of the UAS pipes within one interface alternative.
+struct PipeConfig {
+	std::optional<int> command;
+	std::optional<int> status;
+	std::optional<int> dataIn;
+	std::optional<int> dataOut;
+};
+
+// Each command is identified by a tag. On SuperSpeed, the tag doubles as the stream ID of
+// the status and data pipes such that the device can complete commands in any order.
+// On high-speed, streams are not available and the device announces the data phase
+// of each command through Read Ready and Write Ready IUs on the status pipe.
+struct StorageDevice : scsi::StorageDevice {
+	StorageDevice(protocols::usb::Device usb_device, int64_t parent_id)
+	: scsi::StorageDevice(512, parent_id), usbDevice_(std::move(usb_device)) { }
+
+	// Returns false if the device cannot be driven via UAS (e.g., if the host lacks streams).
+	async::result<bool> setup(int config_num, int intf_num, int alternative,
+			PipeConfig pipes, bool useStreams);
+
+	async::result<frg::expected<scsi::Error, size_t>> sendScsiCommand(const scsi::CommandInfo &info) override;
+
+private:
+	struct Command {
+		const scsi::CommandInfo *info;
+		arch::dma_buffer_view status;
+		frg::expected<protocols::usb::UsbError, size_t> dataResult{size_t{0}};
+		async::oneshot_event done;
+	};
+
+	// Only used without streams: receives IUs from the status pipe and performs data phases.
+	async::detached statusLoop_();
+
+	async::result<frg::expected<protocols::usb::UsbError, size_t>> transferData_(Command *cmd,
+			uint16_t stream);
+
+	frg::expected<scsi::Error, size_t> complete_(Command *cmd, uint16_t tag);
+
+	protocols::usb::Device usbDevice_;
+	std::optional<protocols::usb::Endpoint> command_;
+	std::optional<protocols::usb::Endpoint> status_;
+	std::optional<protocols::usb::Endpoint> dataIn_;
+	std::optional<protocols::usb::Endpoint> dataOut_;
+	bool useStreams_ = false;
+
+	std::vector<uint16_t> freeTags_;
+	std::array<Command *, maxTags + 1> commands_{};
+	std::array<std::array<uint8_t, statusBufferSize>, maxTags + 1> statusBuffers_{};
+};
+
+} // namespace uas
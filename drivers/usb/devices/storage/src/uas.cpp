@@ -0,0 +1,204 @@
+
+#include <algorithm>
+#include <iostream>
+
+#include <assert.h>
+#include <string.h>
+
+#include <arch/bit.hpp>
+#include <async/algorithm.hpp>
+#include <async/result.hpp>
+#include <protocols/usb/usb.hpp>
+#include <protocols/usb/api.hpp>
+#include <protocols/usb/client.hpp>
+
+#include "storage.hpp"
+
+namespace {
+	constexpr bool logSteps = false;
+}
+
+namespace proto = protocols::usb;
+
+namespace uas {
+
+async::result<bool> StorageDevice::setup(int config_num, int intf_num, int alternative,
+		PipeConfig pipes, bool useStreams) {
+	// UAS devices do not support the READ6 command.
+	enableRead6 = false;
+
+	auto config = (co_await usbDevice_.useConfiguration(0, config_num)).unwrap();
+	auto intf = (co_await config.useInterface(intf_num, alternative)).unwrap();
+	command_ = (co_await intf.getEndpoint(proto::PipeType::out, pipes.command.value())).unwrap();
+	status_ = (co_await intf.getEndpoint(proto::PipeType::in, pipes.status.value())).unwrap();
+	dataIn_ = (co_await intf.getEndpoint(proto::PipeType::in, pipes.dataIn.value())).unwrap();
+	dataOut_ = (co_await intf.getEndpoint(proto::PipeType::out, pipes.dataOut.value())).unwrap();
+
+	size_t numTags = maxTags;
+	if(useStreams) {
+		// SuperSpeed UAS requires streams on the status and data pipes.
+		for(auto endpoint : {&status_, &dataIn_, &dataOut_}) {
+			auto streams = co_await (*endpoint)->allocateStreams(maxTags);
+			if(!streams) {
+				std::cout << "block-usb: Failed to allocate UAS streams" << std::endl;
+				co_return false;
+			}
+			numTags = std::min(numTags, streams.value());
+		}
+	}
+	useStreams_ = useStreams;
+
+	for(size_t tag = numTags; tag >= 1; tag--)
+		freeTags_.push_back(tag);
+	maxInFlight = numTags;
+	maxQueueDepth = numTags;
+
+	std::cout << "block-usb: Using UAS with " << numTags << " tags"
+			<< (useStreams ? " (streams)" : "") << std::endl;
+
+	if(!useStreams_)
+		statusLoop_();
+
+	co_return true;
+}
+
+async::result<frg::expected<proto::UsbError, size_t>>
+StorageDevice::transferData_(Command *cmd, uint16_t stream) {
+	if(!cmd->info->isWrite) {
+		proto::BulkTransfer xfer{proto::XferFlags::kXferToHost, cmd->info->data};
+		xfer.allowShortPackets = true;
+		xfer.streamId = stream;
+		co_return co_await dataIn_->transfer(xfer);
+	}else{
+		proto::BulkTransfer xfer{proto::XferFlags::kXferToDevice, cmd->info->data};
+		xfer.streamId = stream;
+		co_return co_await dataOut_->transfer(xfer);
+	}
+}
+
+async::detached StorageDevice::statusLoop_() {
+	std::array<uint8_t, statusBufferSize> buffer;
+	while(true) {
+		proto::BulkTransfer xfer{proto::XferFlags::kXferToHost,
+				arch::dma_buffer_view{nullptr, buffer.data(), buffer.size()}};
+		xfer.allowShortPackets = true;
+		auto res = co_await status_->transfer(xfer);
+		if(!res || res.value() < sizeof(IuHeader)) {
+			std::cout << "block-usb: Failed to receive UAS status IU" << std::endl;
+			continue;
+		}
+
+		IuHeader header;
+		memcpy(&header, buffer.data(), sizeof(IuHeader));
+		auto tag = arch::from_endian<arch::big_endian, uint16_t>(header.tag);
+		if(!tag || tag > maxTags || !commands_[tag]) {
+			std::cout << "block-usb: UAS IU for unknown tag " << tag << std::endl;
+			continue;
+		}
+		auto cmd = commands_[tag];
+
+		if(header.iuId == kIuReadReady || header.iuId == kIuWriteReady) {
+			// The data pipes are not shared with other commands until this phase completes.
+			cmd->dataResult = co_await transferData_(cmd, 0);
+		}else{
+			memcpy(cmd->status.data(), buffer.data(), res.value());
+			cmd->done.raise();
+		}
+	}
+}
+
+frg::expected<scsi::Error, size_t> StorageDevice::complete_(Command *cmd, uint16_t tag) {
+	IuHeader header;
+	memcpy(&header, cmd->status.data(), sizeof(IuHeader));
+	assert(arch::from_endian<arch::big_endian, uint16_t>(header.tag) == tag);
+
+	if(header.iuId == kIuResponse) {
+		ResponseIu response;
+		memcpy(&response, cmd->status.data(), sizeof(ResponseIu));
+		std::cout << "block-usb: UAS command failed with response code 0x"
+				<< std::hex << int{response.responseCode} << std::dec << std::endl;
+		return scsi::Error{.type = scsi::ErrorType::deviceSpecific,
+				.code = response.responseCode};
+	}
+	assert(header.iuId == kIuSense);
+
+	SenseIu sense;
+	memcpy(&sense, cmd->status.data(), sizeof(SenseIu));
+	if(sense.status)
+		return scsi::statusToError(sense.status);
+
+	if(!cmd->dataResult)
+		return scsi::Error{.type = scsi::ErrorType::deviceSpecific, .code = 0};
+	return cmd->dataResult.value();
+}
+
+async::result<frg::expected<scsi::Error, size_t>>
+StorageDevice::sendScsiCommand(const scsi::CommandInfo &info) {
+	// runScsi() never exceeds maxInFlight commands.
+	assert(!freeTags_.empty());
+	auto tag = freeTags_.back();
+	freeTags_.pop_back();
+
+	CommandIu iu{};
+	iu.iuId = kIuCommand;
+	iu.tag = arch::to_endian<arch::big_endian, uint16_t>(tag);
+	assert(info.command.size() <= sizeof(iu.cdb));
+	memcpy(iu.cdb, info.command.data(), info.command.size());
+
+	Command cmd{};
+	cmd.info = &info;
+	cmd.status = arch::dma_buffer_view{nullptr, statusBuffers_[tag].data(), statusBufferSize};
+	commands_[tag] = &cmd;
+
+	if(logSteps)
+		std::cout << "block-usb: Sending UAS command with tag " << tag << std::endl;
+
+	frg::expected<proto::UsbError, size_t> commandResult{size_t{0}};
+	if(useStreams_) {
+		// Queue the status and data transfers together with the command.
+		// The host controller keeps them pending until the device selects the stream.
+		frg::expected<proto::UsbError, size_t> statusResult{size_t{0}};
+		auto receiveStatus = [&] () -> async::result<void> {
+			proto::BulkTransfer xfer{proto::XferFlags::kXferToHost, cmd.status};
+			xfer.allowShortPackets = true;
+			xfer.streamId = tag;
+			statusResult = co_await status_->transfer(xfer);
+		};
+		auto transferData = [&] () -> async::result<void> {
+			if(info.data.size())
+				cmd.dataResult = co_await transferData_(&cmd, tag);
+		};
+		auto sendCommand = [&] () -> async::result<void> {
+			commandResult = co_await command_->transfer(proto::BulkTransfer{
+					proto::XferFlags::kXferToDevice,
+					arch::dma_buffer_view{nullptr, &iu, sizeof(CommandIu)}});
+		};
+		co_await async::when_all(receiveStatus(), transferData(), sendCommand());
+
+		if(!statusResult)
+			commandResult = statusResult.error();
+	}else{
+		commandResult = co_await command_->transfer(proto::BulkTransfer{
+				proto::XferFlags::kXferToDevice,
+				arch::dma_buffer_view{nullptr, &iu, sizeof(CommandIu)}});
+		if(commandResult)
+			co_await cmd.done.wait();
+	}
+
+	frg::expected<scsi::Error, size_t> result = size_t{0};
+	if(!commandResult) {
+		std::cout << "block-usb: UAS transfer failed" << std::endl;
+		result = scsi::Error{.type = scsi::ErrorType::deviceSpecific, .code = 0};
+	}else{
+		result = complete_(&cmd, tag);
+	}
+
+	if(logSteps)
+		std::cout << "block-usb: UAS command with tag " << tag << " complete" << std::endl;
+
+	commands_[tag] = nullptr;
+	freeTags_.push_back(tag);
+	co_return result;
+}
+
+} // namespace uas
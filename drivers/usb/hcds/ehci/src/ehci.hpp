@@ -1,5 +1,7 @@
 
 #include <queue>
+#include <unordered_map>
+#include <vector>
 
 #include <arch/mem_space.hpp>
 #include <arch/dma_structs.hpp>
@@ -49,6 +51,19 @@ struct Controller final : proto::BaseController, std::enable_shared_from_this<Co
 
 	};
 
+	// Recycles the qTDs of completed transactions. Each device has its own arena;
+	// since most transfers of a device have the same size, qTD arrays are reused by size.
+	struct TdArena {
+		arch::dma_array<TransferDescriptor> allocate(size_t count);
+		void recycle(arch::dma_array<TransferDescriptor> transfers);
+
+	private:
+		// Limits the number of cached arrays of each size.
+		static constexpr size_t maxCachedPerSize = 8;
+
+		std::unordered_map<size_t, std::vector<arch::dma_array<TransferDescriptor>>> _cache;
+	};
+
 	struct Transaction : AsyncItem {
 		explicit Transaction(arch::dma_array<TransferDescriptor> transfers, size_t size)
 		: transfers{std::move(transfers)}, fullSize{size},
@@ -62,13 +77,14 @@ struct Controller final : proto::BaseController, std::enable_shared_from_this<Co
 	};
 
 	struct QueueEntity : AsyncItem {
-		QueueEntity(arch::dma_object<QueueHead> the_head, int address,
+		QueueEntity(arch::dma_object<QueueHead> the_head, TdArena *arena, int address,
 				int pipe, proto::PipeType type, size_t packet_size);
 
 		bool getReclaim();
 		void setReclaim(bool reclaim);
 		void setAddress(int address);
 		arch::dma_object<QueueHead> head;
+		TdArena *arena;
 		boost::intrusive::list<Transaction> transactions;
 	};
 
@@ -78,14 +94,15 @@ struct Controller final : proto::BaseController, std::enable_shared_from_this<Co
 	// ------------------------------------------------------------------------
 
 	struct EndpointSlot {
-		size_t maxPacketSize;
-		QueueEntity *queueEntity;
+		size_t maxPacketSize = 0;
+		QueueEntity *queueEntity = nullptr;
 	};
 
 	struct DeviceSlot {
 		EndpointSlot controlStates[16];
 		EndpointSlot outStates[16];
 		EndpointSlot inStates[16];
+		TdArena tdArena;
 	};
 
 	std::queue<int> _addressStack;
@@ -139,10 +156,10 @@ public:
 	// Transfer functions.
 	// ------------------------------------------------------------------------
 
-	static Transaction *_buildControl(proto::XferFlags dir,
+	static Transaction *_buildControl(TdArena *arena, proto::XferFlags dir,
 			arch::dma_object_view<proto::SetupPacket> setup, arch::dma_buffer_view buffer,
 			size_t max_packet_size);
-	static Transaction *_buildInterruptOrBulk(proto::XferFlags dir,
+	static Transaction *_buildInterruptOrBulk(TdArena *arena, proto::XferFlags dir,
 			arch::dma_buffer_view buffer, size_t max_packet_size,
 			bool lazy_notification);
 
@@ -170,6 +187,8 @@ private:
 
 	void _progressSchedule();
 	void _progressQueue(QueueEntity *entity);
+	// Returns true if the front transaction of the queue completed.
+	bool _progressTransaction(QueueEntity *entity);
 
 	boost::intrusive::list<QueueEntity> _asyncSchedule;
 	arch::dma_object<QueueHead> _asyncQh;
@@ -201,6 +220,8 @@ private:
 	arch::mem_space _operational;
 
 	int _numPorts;
+	// Interrupt threshold in microframes (USBCMD.ITC). Can be set by ehci.itc on the command line.
+	uint8_t _irqThreshold = 0x08;
 	proto::Enumerator _enumerator;
 
 	mbus_ng::EntityManager _entity;
@@ -1,6 +1,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <functional>
 #include <iostream>
@@ -9,7 +10,9 @@
 #include <arch/dma_pool.hpp>
 #include <async/result.hpp>
 #include <boost/intrusive/list.hpp>
+#include <core/cmdline.hpp>
 #include <fafnir/dsl.hpp>
+#include <frg/cmdline.hpp>
 #include <helix/ipc.hpp>
 #include <protocols/hw/client.hpp>
 #include <protocols/kernlet/compiler.hpp>
@@ -167,6 +170,26 @@ Controller::Controller(protocols::hw::Device hw_device, mbus_ng::EntityManager e
 }
 
 async::detached Controller::initialize() {
+	Cmdline cmdHelper;
+	auto cmdline = co_await cmdHelper.get();
+	frg::string_view itc_option = "";
+	frg::array args = {
+		frg::option{"ehci.itc", frg::as_string_view(itc_option)},
+	};
+	frg::parse_arguments(cmdline.c_str(), args);
+	if(itc_option.size()) {
+		// Valid thresholds are powers of two up to 64 microframes.
+		auto itc = strtoul(std::string{itc_option.data(), itc_option.size()}.c_str(), nullptr, 0);
+		if(itc && itc <= 64 && !(itc & (itc - 1))) {
+			_irqThreshold = itc;
+		}else{
+			std::cout << "ehci: Ignoring invalid interrupt threshold " << itc << std::endl;
+		}
+	}
+	if(logControllerEnumeration)
+		std::cout << "ehci: Using an interrupt threshold of "
+				<< static_cast<int>(_irqThreshold) << " microframes" << std::endl;
+
 	auto ext_pointer = _space.load(cap_regs::hccparams) & hccparams::extPointer;
 	if(ext_pointer) {
 		auto header = co_await _hwDevice.loadPciSpace(ext_pointer, 2);
@@ -208,7 +231,7 @@ async::detached Controller::initialize() {
 	}
 
 	// Reset the controller.
-	_operational.store(op_regs::usbcmd, usbcmd::hcReset(true) | usbcmd::irqThreshold(0x08));
+	_operational.store(op_regs::usbcmd, usbcmd::hcReset(true) | usbcmd::irqThreshold(_irqThreshold));
 	while(_operational.load(op_regs::usbcmd) & usbcmd::hcReset) {
 		// Wait until the reset is complete.
 	}
@@ -219,7 +242,7 @@ async::detached Controller::initialize() {
 	_operational.store(op_regs::usbintr, usbintr::transaction(true)
 			| usbintr::usbError(true) | usbintr::portChange(true)
 			| usbintr::hostError(true));
-	_operational.store(op_regs::usbcmd, usbcmd::run(true) | usbcmd::irqThreshold(0x08));
+	_operational.store(op_regs::usbcmd, usbcmd::run(true) | usbcmd::irqThreshold(_irqThreshold));
 	_operational.store(op_regs::configflag, 0x01);
 
 	_rootHub = std::make_shared<RootHub>(this);
@@ -295,16 +318,17 @@ Controller::enumerateDevice(std::shared_ptr<proto::Hub> hub, int port, proto::De
 	// Requires split TX when we have hub support
 	assert(speed == proto::DeviceSpeed::highSpeed);
 
-	// This queue will become the default control pipe of our new device.
-	auto dma_obj = arch::dma_object<QueueHead>{&schedulePool};
-	auto queue = new QueueEntity{std::move(dma_obj), 0, 0, proto::PipeType::control, 64};
-	_linkAsync(queue);
-
 	// Allocate an address for the device.
 	assert(!_addressStack.empty());
 	auto address = _addressStack.front();
 	_addressStack.pop();
 
+	// This queue will become the default control pipe of our new device.
+	auto dma_obj = arch::dma_object<QueueHead>{&schedulePool};
+	auto queue = new QueueEntity{std::move(dma_obj), &_activeDevices[address].tdArena,
+			0, 0, proto::PipeType::control, 64};
+	_linkAsync(queue);
+
 	if(logDeviceEnumeration)
 		std::cout << "ehci: Setting device address" << std::endl;
 
@@ -607,25 +631,23 @@ Controller::useInterface(int address, uint8_t configIndex, uint8_t configValue,
 			std::cout << "\e[35mehci: Endpoint is high bandwidth\e[39m" << std::endl;
 
 		int pipe = info.endpointNumber.value();
-		if(info.endpointIn.value()) {
-			if(logDeviceEnumeration)
-				std::cout << "ehci: Setting up IN pipe " << pipe
-						<< " (max. packet size: " << desc->maxPacketSize << ")" << std::endl;
-			_activeDevices[address].inStates[pipe].maxPacketSize = packet_size;
-			_activeDevices[address].inStates[pipe].queueEntity
-					= new QueueEntity{arch::dma_object<QueueHead>{&schedulePool},
-							address, pipe, proto::PipeType::in, desc->maxPacketSize};
-			this->_linkAsync(_activeDevices[address].inStates[pipe].queueEntity);
-		}else{
-			if(logDeviceEnumeration)
-				std::cout << "ehci: Setting up OUT pipe " << pipe
-						<< " (max. packet size: " << desc->maxPacketSize << ")" << std::endl;
-			_activeDevices[address].outStates[pipe].maxPacketSize = packet_size;
-			_activeDevices[address].outStates[pipe].queueEntity
-					= new QueueEntity{arch::dma_object<QueueHead>{&schedulePool},
-							address, pipe, proto::PipeType::out, desc->maxPacketSize};
-			this->_linkAsync(_activeDevices[address].outStates[pipe].queueEntity);
-		}
+		auto type = info.endpointIn.value() ? proto::PipeType::in : proto::PipeType::out;
+		auto endpoint = info.endpointIn.value() ? &_activeDevices[address].inStates[pipe]
+				: &_activeDevices[address].outStates[pipe];
+
+		// Queue heads stay in the schedule once they are set up,
+		// hence the queue of each endpoint is only created once.
+		if(endpoint->queueEntity)
+			return;
+
+		if(logDeviceEnumeration)
+			std::cout << "ehci: Setting up " << (info.endpointIn.value() ? "IN" : "OUT")
+					<< " pipe " << pipe
+					<< " (max. packet size: " << desc->maxPacketSize << ")" << std::endl;
+		endpoint->maxPacketSize = packet_size;
+		endpoint->queueEntity = new QueueEntity{arch::dma_object<QueueHead>{&schedulePool},
+				&_activeDevices[address].tdArena, address, pipe, type, desc->maxPacketSize};
+		this->_linkAsync(endpoint->queueEntity);
 	});
 
 	assert(valueByIndex);
@@ -644,9 +666,9 @@ Controller::useInterface(int address, uint8_t configIndex, uint8_t configValue,
 // Schedule classes.
 // ------------------------------------------------------------------------
 
-Controller::QueueEntity::QueueEntity(arch::dma_object<QueueHead> the_head,
+Controller::QueueEntity::QueueEntity(arch::dma_object<QueueHead> the_head, TdArena *arena,
 		int address, int pipe, proto::PipeType type, size_t packet_size)
-: head(std::move(the_head)) {
+: head(std::move(the_head)), arena{arena} {
 	head->horizontalPtr.store(qh_horizontal::terminate(false)
 			| qh_horizontal::typeSelect(0x01)
 			| qh_horizontal::horizontalPtr(schedulePointer(head.data())));
@@ -682,6 +704,22 @@ void Controller::QueueEntity::setAddress(int address) {
 	head->flags.store((flags & ~qh_flags::deviceAddr) | qh_flags::deviceAddr(address));
 }
 
+arch::dma_array<TransferDescriptor> Controller::TdArena::allocate(size_t count) {
+	auto it = _cache.find(count);
+	if(it != _cache.end() && !it->second.empty()) {
+		auto transfers = std::move(it->second.back());
+		it->second.pop_back();
+		return transfers;
+	}
+	return arch::dma_array<TransferDescriptor>{&schedulePool, count};
+}
+
+void Controller::TdArena::recycle(arch::dma_array<TransferDescriptor> transfers) {
+	auto &cached = _cache[transfers.size()];
+	if(cached.size() < maxCachedPerSize)
+		cached.push_back(std::move(transfers));
+}
+
 // ------------------------------------------------------------------------
 // Transfer functions.
 // ------------------------------------------------------------------------
@@ -691,7 +729,7 @@ Controller::transfer(int address, int pipe, proto::ControlTransfer info) {
 	auto device = &_activeDevices[address];
 	auto endpoint = &device->controlStates[pipe];
 
-	auto transaction = _buildControl(info.flags,
+	auto transaction = _buildControl(endpoint->queueEntity->arena, info.flags,
 			info.setup, info.buffer,  endpoint->maxPacketSize);
 	auto future = transaction->promise.get_future();
 	_linkTransaction(endpoint->queueEntity, transaction);
@@ -711,7 +749,7 @@ Controller::transfer(int address, proto::PipeType type, int pipe,
 		endpoint = &device->outStates[pipe];
 	}
 
-	auto transaction = _buildInterruptOrBulk(info.flags,
+	auto transaction = _buildInterruptOrBulk(endpoint->queueEntity->arena, info.flags,
 			info.buffer, endpoint->maxPacketSize, info.lazyNotification);
 	auto future = transaction->promise.get_future();
 	_linkTransaction(endpoint->queueEntity, transaction);
@@ -731,7 +769,7 @@ Controller::transfer(int address, proto::PipeType type, int pipe,
 		endpoint = &device->outStates[pipe];
 	}
 
-	auto transaction = _buildInterruptOrBulk(info.flags,
+	auto transaction = _buildInterruptOrBulk(endpoint->queueEntity->arena, info.flags,
 			info.buffer, endpoint->maxPacketSize, info.lazyNotification);
 	auto future = transaction->promise.get_future();
 	_linkTransaction(endpoint->queueEntity, transaction);
@@ -739,14 +777,14 @@ Controller::transfer(int address, proto::PipeType type, int pipe,
 }
 
 
-auto Controller::_buildControl(proto::XferFlags dir,
+auto Controller::_buildControl(TdArena *arena, proto::XferFlags dir,
 		arch::dma_object_view<proto::SetupPacket> setup, arch::dma_buffer_view buffer,
 		size_t) -> Transaction * {
 	assert((dir == proto::kXferToDevice) || (dir == proto::kXferToHost));
 
 	size_t num_data = (buffer.size() + 0x3FFF) / 0x4000;
 	assert(num_data <= 1);
-	arch::dma_array<TransferDescriptor> transfers{&schedulePool, num_data + 2};
+	auto transfers = arena->allocate(num_data + 2);
 
 	// TODO: This code is horribly broken if the setup packet or
 	// one of the data packets crosses a page boundary.
@@ -791,7 +829,7 @@ auto Controller::_buildControl(proto::XferFlags dir,
 	return new Transaction{std::move(transfers), buffer.size()};
 }
 
-auto Controller::_buildInterruptOrBulk(proto::XferFlags dir,
+auto Controller::_buildInterruptOrBulk(TdArena *arena, proto::XferFlags dir,
 		arch::dma_buffer_view buffer, size_t max_packet_size,
 		bool lazy_notification) -> Transaction * {
 	assert((dir == proto::kXferToDevice) || (dir == proto::kXferToHost));
@@ -816,7 +854,7 @@ auto Controller::_buildInterruptOrBulk(proto::XferFlags dir,
 		std::cout << "ehci: Building transfer using " << num_data << " TDs" << std::endl;
 
 	// Finally construct each qTD.
-	arch::dma_array<TransferDescriptor> transfers{&schedulePool, num_data};
+	auto transfers = arena->allocate(num_data);
 
 	size_t progress = 0;
 	for(size_t i = 0; i < num_data; i++) {
@@ -868,7 +906,7 @@ auto Controller::_buildInterruptOrBulk(proto::XferFlags dir,
 
 async::result<frg::expected<proto::UsbError, size_t>> Controller::_directTransfer(proto::ControlTransfer info,
 		QueueEntity *queue, size_t max_packet_size) {
-	auto transaction = _buildControl(info.flags,
+	auto transaction = _buildControl(queue->arena, info.flags,
 			info.setup, info.buffer, max_packet_size);
 	auto future = transaction->promise.get_future();
 	_linkTransaction(queue, transaction);
@@ -887,7 +925,7 @@ void Controller::_linkAsync(QueueEntity *entity) {
 				| qh_horizontal::typeSelect(1));
 		_operational.store(op_regs::asynclistaddr, schedulePointer(entity->head.data()));
 		_operational.store(op_regs::usbcmd, usbcmd::asyncEnable(true)
-				| usbcmd::run(true) | usbcmd::irqThreshold(0x08));
+				| usbcmd::run(true) | usbcmd::irqThreshold(_irqThreshold));
 	}else{
 		entity->head->horizontalPtr.store(
 				qh_horizontal::horizontalPtr(schedulePointer(_asyncSchedule.front().head.data()))
@@ -927,6 +965,15 @@ void Controller::_linkTransaction(QueueEntity *queue, Transaction *transaction)
 			// TODO: We could ensure that the new TD pointer is part of the transaction.
 			std::cout << "ehci: AdvanceQueue to new transaction" << std::endl;
 		}
+	}else{
+		// Chain the transaction to the last qTD of the queue, such that the controller
+		// proceeds without waiting for us. If the controller already fetched that qTD,
+		// _progressQueue() restarts the queue once the previous transaction completes.
+		if(logSubmits)
+			std::cout << "ehci: Chaining in _linkTransaction" << std::endl;
+		auto &last = queue->transactions.back();
+		last.transfers[last.transfers.size() - 1].nextTd.store(
+				td_ptr::ptr(schedulePointer(&transaction->transfers[0])));
 	}
 
 	queue->transactions.push_back(*transaction);
@@ -941,9 +988,14 @@ void Controller::_progressSchedule() {
 }
 
 void Controller::_progressQueue(QueueEntity *entity) {
-	if(entity->transactions.empty())
-		return;
+	// Since transactions are chained, multiple transactions can complete per IRQ.
+	while(!entity->transactions.empty()) {
+		if(!_progressTransaction(entity))
+			return;
+	}
+}
 
+bool Controller::_progressTransaction(QueueEntity *entity) {
 	auto active = &entity->transactions.front();
 	while(active->numComplete < active->transfers.size()) {
 		auto transfer = &active->transfers[active->numComplete];
@@ -968,19 +1020,25 @@ void Controller::_progressQueue(QueueEntity *entity) {
 		assert(active->fullSize >= active->lostSize);
 		active->promise.set_value(active->fullSize - active->lostSize);
 
-		// Clean up the Queue.
+		// Clean up the Queue. The controller does not access the qTDs of
+		// completed transactions anymore, hence they can be recycled.
 		entity->transactions.pop_front();
-		//delete active;
-		// TODO: _reclaim(active);
+		entity->arena->recycle(std::move(active->transfers));
+		delete active;
 
-		// Schedule the next transaction.
-		assert(entity->head->nextTd.load() & td_ptr::terminate);
+		// Restart the queue if it stopped before it saw the chained transaction.
 		if(!entity->transactions.empty()) {
-			if(logSubmits)
-				std::cout << "ehci: Linking in _progressQueue" << std::endl;
 			auto front = &entity->transactions.front();
-			entity->head->nextTd.store(qh_nextTd::nextTd(schedulePointer(&front->transfers[0])));
+			if((entity->head->nextTd.load() & td_ptr::terminate)
+					&& !(entity->head->status.load() & qh_status::active)
+					&& (front->transfers[0].status.load() & td_status::active)) {
+				if(logSubmits)
+					std::cout << "ehci: Linking in _progressQueue" << std::endl;
+				entity->head->nextTd.store(qh_nextTd::nextTd(
+						schedulePointer(&front->transfers[0])));
+			}
 		}
+		return true;
 	}else if((active->transfers[current].status.load() & td_status::halted)
 			|| (active->transfers[current].status.load() & td_status::transactionError)
 			|| (active->transfers[current].status.load() & td_status::babbleDetected)
@@ -994,6 +1052,7 @@ void Controller::_progressQueue(QueueEntity *entity) {
 		//delete active;
 		// TODO: _reclaim(active);
 	}
+	return false;
 }
 
 // ----------------------------------------------------------------------------
@@ -64,6 +64,14 @@ private:
 using InputContext = ContextArray<34>;
 using DeviceContext = ContextArray<32>;
 
+// Entry of a (linear) primary stream context array.
+struct alignas(16) StreamContext {
+	uint32_t val[4];
+};
+
+// Stream context type of a stream context that points to a transfer ring.
+inline constexpr uint32_t streamCtxPrimaryRing = 1;
+
 struct ContextField {
 	int word;
 	uint32_t value;
@@ -157,6 +165,18 @@ namespace SlotFields {
 } // namespace SlotFields
 
 namespace EpFields {
+	constexpr ContextField epState(uint8_t v) {
+		return {0, uint32_t{v & 0b111u}};
+	}
+
+	constexpr ContextField maxPStreams(uint8_t v) {
+		return {0, uint32_t{v & 0x1Fu} << 10};
+	}
+
+	constexpr ContextField linearStreamArray(bool v) {
+		return {0, uint32_t{v} << 15};
+	}
+
 	constexpr ContextField interval(uint8_t v) {
 		return {0, uint32_t{v} << 16};
 	}
@@ -173,6 +193,10 @@ namespace EpFields {
 		return {1, uint32_t{v & 0b111u} << 3};
 	}
 
+	constexpr ContextField maxBurst(uint8_t v) {
+		return {1, uint32_t{v} << 8};
+	}
+
 	constexpr ContextField maxPacketSize(uint16_t v) {
 		return {1, uint32_t{v} << 16};
 	}
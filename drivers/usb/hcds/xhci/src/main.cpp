@@ -1,7 +1,9 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <algorithm>
 #include <optional>
 #include <functional>
 #include <memory>
@@ -35,13 +37,12 @@ namespace proto = protocols::usb;
 std::vector<std::shared_ptr<Controller>> globalControllers;
 
 Controller::Controller(protocols::hw::Device hw_device, mbus_ng::Entity entity, helix::Mapping mapping,
-		helix::UniqueDescriptor mmio, helix::UniqueIrq irq, std::string name)
+		helix::UniqueDescriptor mmio, std::vector<helix::UniqueIrq> irqs, std::string name)
 : _hw_device{std::move(hw_device)}, _mapping{std::move(mapping)},
-		_mmio{std::move(mmio)}, _irq{std::move(irq)},
+		_mmio{std::move(mmio)}, _irqs{std::move(irqs)},
 		_space{_mapping.get()}, _name{name}, _memoryPool{},
 		_dcbaa{&_memoryPool, 256}, _cmdRing{this},
-		_eventRing{this},
-		_enumerator{this}, _largeCtx{false},
+		_enumerator{this}, _largeCtx{false}, _maxPsaSize{0},
 		_entity{std::move(entity)} {
 	auto doorbell_offset = _space.load(cap_regs::dboff);
 	_doorbells = _space.subspace(doorbell_offset);
@@ -122,6 +123,7 @@ async::detached Controller::initialize() {
 	std::cout << this << "Controller reset done" << std::endl;
 
 	_largeCtx = _space.load(cap_regs::hccparams1) & hccparams1::contextSize;
+	_maxPsaSize = _space.load(cap_regs::hccparams1) & hccparams1::maxPsaSize;
 
 	_maxDeviceSlots = _space.load(cap_regs::hcsparams1) & hcsparams1::maxDevSlots;
 	operational.store(op_regs::config, config::enabledDeviceSlots(_maxDeviceSlots));
@@ -159,16 +161,30 @@ async::detached Controller::initialize() {
 	// Tell the controller about our command ring
 	operational.store(op_regs::crcr, _cmdRing.getPtr() | 1);
 
-	// Set up interrupters
-	// TODO(qookie): MSIs let us use multiple interrupters to
-	// spread out the load (we probably want up to 1 per core?)
+	// Set up interrupters, one per IRQ that we got.
+	// ERST Max is the log2 of the number of event ring segments that the controller supports.
 	auto runtimeOffset = _space.load(cap_regs::rtsoff);
 	auto runtime = _space.subspace(runtimeOffset);
-	_interrupters.push_back(std::make_unique<Interrupter>(
-				&_eventRing,
-				interrupter::interrupterSpace(runtime, 0)));
-	_interrupters.back()->handleIrqs(_irq);
-	_interrupters.back()->initialize();
+	size_t numSegments = std::min(size_t{1} << (_space.load(cap_regs::hcsparams2) & hcsparams2::erstMax),
+			EventRing::maxSegments);
+	size_t numInterrupters = std::min(_irqs.size(),
+			size_t{_space.load(cap_regs::hcsparams1) & hcsparams1::maxIntrs});
+	assert(numInterrupters);
+
+	for (size_t i = 0; i < numInterrupters; i++) {
+		_interrupters.push_back(std::make_unique<Interrupter>(this,
+					interrupter::interrupterSpace(runtime, i),
+					numSegments, std::move(_irqs[i])));
+		_interrupters.back()->handleIrqs();
+		_interrupters.back()->initialize();
+	}
+	_irqs.clear();
+
+	if (numInterrupters > 1)
+		_bulkInterrupter = 1;
+
+	std::cout << this << "Using " << numInterrupters << " interrupters with "
+		<< numSegments * EventRing::segmentSize << " event TRBs each" << std::endl;
 
 	// Start the controller and enable interrupts
 	operational.store(op_regs::usbcmd, usbcmd::run(1) | usbcmd::intrEnable(1));
@@ -327,7 +343,7 @@ void Controller::processEvent(Event ev) {
 
 		case transferEvent:
 			if (auto ep = _devices[ev.slotId]->endpoint(ev.endpointId))
-				ep->transferRing().processEvent(ev);
+				ep->processEvent(ev);
 			else
 				std::cout << this << "Event for missing endpoint ID " << ev.endpointId
 					<< " on slot " << ev.slotId << std::endl;
@@ -351,40 +367,46 @@ void Controller::processEvent(Event ev) {
 
 void Interrupter::initialize() {
 	// Initialize the event ring segment table
-	_space.store(interrupter::erstsz, _ring->getErstSize());
-	_space.store(interrupter::erstbaLow,_ring->getErstPtr() & 0xFFFFFFFF);
-	_space.store(interrupter::erstbaHi, _ring->getErstPtr() >> 32);
+	_space.store(interrupter::erstsz, _ring.getErstSize());
+	_space.store(interrupter::erstbaLow,_ring.getErstPtr() & 0xFFFFFFFF);
+	_space.store(interrupter::erstbaHi, _ring.getErstPtr() >> 32);
 
-	_updateDequeue();
+	_updateDequeue(true);
 
+	// Let the controller coalesce events into fewer interrupts.
+	_space.store(interrupter::imod, moderationInterval);
 	_space.store(interrupter::iman, _space.load(interrupter::iman) | iman::enable(1));
 }
 
-async::detached Interrupter::handleIrqs(helix::UniqueIrq &irq) {
+async::detached Interrupter::handleIrqs() {
 	uint64_t sequence = 0;
 
 	while(1) {
-		auto await = co_await helix_ng::awaitEvent(irq, sequence);
+		auto await = co_await helix_ng::awaitEvent(_irq, sequence);
 		HEL_CHECK(await.error());
 		sequence = await.sequence();
 
 		if (!_isBusy()) {
-			HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckNack, sequence));
+			HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckNack, sequence));
 			continue;
 		}
 
 		_clearPending();
-		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, sequence));
+		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
 
-		_ring->processRing();
-		_updateDequeue();
+		// The event handler busy flag is only cleared once the ring is drained,
+		// so the controller does not interrupt us again in the middle of a burst.
+		while (_ring.processRing(dequeueUpdateInterval))
+			_updateDequeue(false);
+		_updateDequeue(true);
 	}
 }
 
-void Interrupter::_updateDequeue() {
+void Interrupter::_updateDequeue(bool clearBusy) {
+	auto ptr = _ring.getEventRingPtr();
+	_space.store(interrupter::erdpHi, ptr >> 32);
 	_space.store(interrupter::erdpLow,
-			(_ring->getEventRingPtr() & 0xFFFFFFF0) | (1 << 3));
-	_space.store(interrupter::erdpHi, _ring->getEventRingPtr() >> 32);
+			(ptr & 0xFFFFFFF0) | (clearBusy ? (1 << 3) : 0));
 }
 
 bool Interrupter::_isBusy() {
@@ -602,6 +624,8 @@ Device::useConfiguration(uint8_t index, uint8_t value) {
 		proto::PipeType dir;
 		int packetSize;
 		proto::EndpointType type;
+		uint8_t maxBurst = 0;
+		uint8_t maxStreams = 0;
 	};
 
 	std::vector<EndpointInfo> _eps = {};
@@ -616,6 +640,15 @@ Device::useConfiguration(uint8_t index, uint8_t value) {
 			valueByIndex = desc->configValue;
 		}
 
+		// The SuperSpeed endpoint companion descriptor follows its endpoint descriptor.
+		if(type == proto::descriptor_type::ss_endpoint_companion && !_eps.empty()) {
+			auto desc = (proto::SsEndpointCompanionDescriptor *)p;
+			_eps.back().maxBurst = desc->maxBurst;
+			if(_eps.back().type == proto::EndpointType::bulk)
+				_eps.back().maxStreams = desc->attributes & 0x1F;
+			return;
+		}
+
 		if(type != proto::descriptor_type::endpoint)
 			return;
 		auto desc = (proto::EndpointDescriptor *)p;
@@ -644,7 +677,8 @@ Device::useConfiguration(uint8_t index, uint8_t value) {
 		std::cout << _controller << "Setting up " << (ep.dir == proto::PipeType::in ? "in" : "out")
 			<< " endpoint " << ep.pipe << " (max packet size: " << ep.packetSize << ")" << std::endl;
 
-		FRG_CO_TRY(co_await setupEndpoint(ep.pipe, ep.dir, ep.packetSize, ep.type));
+		FRG_CO_TRY(co_await setupEndpoint(ep.pipe, ep.dir, ep.packetSize, ep.type,
+				ep.maxBurst, ep.maxStreams));
 	}
 
 	arch::dma_object<proto::SetupPacket> setConfig{setupPool()};
@@ -666,9 +700,9 @@ Device::transfer(proto::ControlTransfer info) {
 	co_return co_await _endpoints[0]->transfer(info);
 }
 
-void Device::submit(int endpoint) {
+void Device::submit(int endpoint, uint16_t streamId) {
 	assert(_slotId != -1);
-	_controller->ringDoorbell(_slotId, endpoint);
+	_controller->ringDoorbell(_slotId, endpoint, streamId);
 }
 
 static inline uint8_t getHcdSpeedId(proto::DeviceSpeed speed) {
@@ -734,7 +768,7 @@ Device::enumerate(size_t rootPort, size_t port, uint32_t route, std::shared_ptr<
 		case superSpeed: packetSize = 512; break;
 	}
 
-	_initEpCtx(inputCtx, 0, proto::PipeType::control, packetSize, proto::EndpointType::control);
+	_initEpCtx(inputCtx, 0, proto::PipeType::control, packetSize, proto::EndpointType::control, 0, 0);
 
 	_controller->setDeviceContext(_slotId, _devCtx);
 
@@ -799,14 +833,15 @@ static inline uint32_t getDefaultAverageTrbLen(proto::EndpointType type) {
 
 
 async::result<frg::expected<proto::UsbError>>
-Device::setupEndpoint(int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type) {
+Device::setupEndpoint(int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type,
+		uint8_t maxBurst, uint8_t maxStreams) {
 	InputContext inputCtx{_controller->largeCtx(), _controller->memoryPool()};
 
 	inputCtx.get(inputCtxCtrl) |= InputControlFields::add(0); // Slot Context
 	inputCtx.get(inputCtxSlot) = _devCtx.get(deviceCtxSlot);
 	inputCtx.get(inputCtxSlot) |= SlotFields::ctxEntries(31);
 
-	_initEpCtx(inputCtx, endpoint, dir, maxPacketSize, type);
+	_initEpCtx(inputCtx, endpoint, dir, maxPacketSize, type, maxBurst, maxStreams);
 
 	auto event = co_await _controller->submitCommand(
 			Command::configureEndpoint(_slotId,
@@ -823,6 +858,43 @@ Device::setupEndpoint(int endpoint, proto::PipeType dir, size_t maxPacketSize, p
 	co_return frg::success;
 }
 
+async::result<frg::expected<proto::UsbError>>
+Device::configureStreams(int endpointId, uintptr_t streamArray, uint8_t maxPStreams) {
+	InputContext inputCtx{_controller->largeCtx(), _controller->memoryPool()};
+
+	// Drop and re-add the endpoint to change its stream configuration.
+	inputCtx.get(inputCtxCtrl) |= InputControlFields::add(0); // Slot Context
+	inputCtx.get(inputCtxCtrl) |= InputControlFields::drop(endpointId);
+	inputCtx.get(inputCtxCtrl) |= InputControlFields::add(endpointId);
+	inputCtx.get(inputCtxSlot) = _devCtx.get(deviceCtxSlot);
+
+	auto &epCtx = inputCtx.get(inputCtxEp0 + endpointId - 1);
+	epCtx = _devCtx.get(deviceCtxEp0 + endpointId - 1);
+
+	epCtx &= ~EpFields::epState(0b111);
+	epCtx &= ~EpFields::maxPStreams(0x1F);
+	epCtx &= ~EpFields::dequeCycle(true);
+	epCtx &= ~EpFields::trPointerLo(~uintptr_t{0xF});
+	epCtx &= ~EpFields::trPointerHi(~uintptr_t{0xF});
+
+	epCtx |= EpFields::maxPStreams(maxPStreams);
+	epCtx |= EpFields::linearStreamArray(true);
+	epCtx |= EpFields::trPointerLo(streamArray);
+	epCtx |= EpFields::trPointerHi(streamArray);
+
+	auto event = co_await _controller->submitCommand(
+			Command::configureEndpoint(_slotId,
+				helix::ptrToPhysical(inputCtx.rawData())));
+
+	if (event.completionCode != 1)
+		std::cout << _controller << "Failed to configure streams for endpoint " << endpointId
+			<< ", completion code: " << completionCodeNames[event.completionCode] << std::endl;
+
+	FRG_CO_TRY(completionToError(event));
+
+	co_return frg::success;
+}
+
 async::result<frg::expected<proto::UsbError>>
 Device::configureHub(std::shared_ptr<proto::Hub> hub, proto::DeviceSpeed speed) {
 	InputContext inputCtx{_controller->largeCtx(), _controller->memoryPool()};
@@ -852,12 +924,13 @@ Device::configureHub(std::shared_ptr<proto::Hub> hub, proto::DeviceSpeed speed)
 	co_return frg::success;
 }
 
-void Device::_initEpCtx(InputContext &ctx, int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type) {
+void Device::_initEpCtx(InputContext &ctx, int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type,
+		uint8_t maxBurst, uint8_t maxStreams) {
 	int endpointId = getEndpointIndex(endpoint, dir);
 
 	ctx.get(inputCtxCtrl) |= InputControlFields::add(endpointId); // EP Context
 
-	auto ep = std::make_shared<EndpointState>(this, endpointId, type, maxPacketSize);
+	auto ep = std::make_shared<EndpointState>(this, endpointId, type, maxPacketSize, maxStreams);
 	_endpoints[endpointId - 1] = ep;
 
 	auto trPtr = ep->transferRing().getPtr();
@@ -870,6 +943,7 @@ void Device::_initEpCtx(InputContext &ctx, int endpoint, proto::PipeType dir, si
 	epCtx |= EpFields::interval(6);
 	epCtx |= EpFields::epType(getHcdEndpointType(dir, type));
 	epCtx |= EpFields::maxPacketSize(maxPacketSize);
+	epCtx |= EpFields::maxBurst(maxBurst);
 	// TODO(qookie): This is fine for USB 2 (unless max burst > 0),
 	// but for USB 3 this should use wBytesPerInterval from the SS
 	// endpoint companion descriptor.
@@ -975,23 +1049,104 @@ EndpointState::transfer(proto::ControlTransfer info) {
 	co_return info.buffer.size() - FRG_CO_TRY(maybeResidue);
 }
 
+ProducerRing *EndpointState::_ringFor(uint16_t streamId) {
+	if (_streamRings.empty())
+		return streamId ? nullptr : &_transferRing;
+	if (!streamId || streamId > _streamRings.size())
+		return nullptr;
+	return _streamRings[streamId - 1].get();
+}
+
+void EndpointState::processEvent(Event ev) {
+	for (auto &ring : _streamRings) {
+		if (ring->contains(ev.trbPointer)) {
+			ring->processEvent(ev);
+			return;
+		}
+	}
+
+	_transferRing.processEvent(ev);
+}
+
 async::result<frg::expected<proto::UsbError, size_t>>
-EndpointState::_bulkOrInterruptXfer(arch::dma_buffer_view buffer) {
-	ProducerRing::Transaction tx;
+EndpointState::allocateStreams(size_t count) {
+	auto controller = _device->controller();
+
+	if (_type != proto::EndpointType::bulk || !_maxStreams || !controller->maxPsaSize())
+		co_return proto::UsbError::unsupported;
+	if (!_streamRings.empty())
+		co_return _streamRings.size();
+
+	// Entry 0 of the stream array is reserved, the array has
+	// 2^(MaxPStreams + 1) entries and MaxPStreams must be at least 1.
+	count = std::min(count, size_t{1} << _maxStreams);
+	int order = std::clamp(static_cast<int>(std::bit_width(count)),
+			2, controller->maxPsaSize() + 1);
+	size_t numEntries = size_t{1} << order;
+	size_t numStreams = std::min(count, numEntries - 1);
+
+	_streamContexts = arch::dma_array<StreamContext>{controller->memoryPool(), numEntries};
+	memset(_streamContexts.data(), 0, numEntries * sizeof(StreamContext));
+
+	for (size_t i = 0; i < numStreams; i++) {
+		auto ring = std::make_unique<ProducerRing>(controller);
+		auto trPtr = ring->getPtr();
+
+		auto &ctx = _streamContexts[i + 1];
+		ctx.val[0] = static_cast<uint32_t>(trPtr & 0xFFFFFFF0) | (streamCtxPrimaryRing << 1) | 1;
+		ctx.val[1] = static_cast<uint32_t>(trPtr >> 32);
+
+		_streamRings.push_back(std::move(ring));
+	}
+
+	auto res = co_await _device->configureStreams(_endpointId,
+			helix::ptrToPhysical(_streamContexts.data()), order - 1);
+	if (!res) {
+		_streamRings.clear();
+		co_return res.error();
+	}
+
+	std::cout << controller << "Allocated " << numStreams << " streams for EP "
+		<< _endpointId << std::endl;
+
+	co_return numStreams;
+}
+
+async::result<frg::expected<proto::UsbError, size_t>>
+EndpointState::_bulkOrInterruptXfer(arch::dma_buffer_view buffer, uint16_t streamId) {
+	auto ring = _ringFor(streamId);
+	if (!ring)
+		co_return proto::UsbError::other;
 
+	auto interrupter = _device->controller()->interrupterFor(_type);
+	std::vector<RawTrb> trbs;
 	Transfer::buildNormalChain([&] (RawTrb trb) {
-		_transferRing.pushRawTrb(trb, &tx);
+		trbs.push_back(Transfer::withInterrupterTarget(trb, interrupter));
 	}, buffer, _maxPacketSize);
 
-	size_t nextDequeue = _transferRing.enqueuePtr();
-	bool nextCycle = _transferRing.producerCycle();
+	if (trbs.size() > ProducerRing::capacity()) {
+		std::cout << _device->controller() << "Transfer of " << buffer.size()
+			<< " bytes needs too many TRBs" << std::endl;
+		co_return proto::UsbError::unsupported;
+	}
 
-	_device->submit(_endpointId);
+	// Multiple transfers can be queued on the ring; the controller
+	// only interrupts once the final TRB of each transfer completes.
+	co_await ring->waitForSpace(trbs.size());
+
+	ProducerRing::Transaction tx;
+	for (auto &trb : trbs)
+		ring->pushRawTrb(trb, &tx);
+
+	size_t nextDequeue = ring->enqueuePtr();
+	bool nextCycle = ring->producerCycle();
+
+	_device->submit(_endpointId, streamId);
 
 	auto maybeResidue = co_await tx.normal();
 
 	if (!maybeResidue && maybeResidue.error() == proto::UsbError::stall) {
-		auto res = co_await _resetAfterError(nextDequeue, nextCycle);
+		auto res = co_await _resetAfterError(nextDequeue, nextCycle, streamId);
 		if (!res) {
 			std::cout << _device->controller() << "Failed to reset EP " << _endpointId
 				<< " after stall: " << (int)res.error() << std::endl;
@@ -1008,11 +1163,11 @@ EndpointState::transfer(proto::InterruptTransfer info) {
 
 async::result<frg::expected<proto::UsbError, size_t>>
 EndpointState::transfer(proto::BulkTransfer info) {
-	co_return co_await _bulkOrInterruptXfer(info.buffer);
+	co_return co_await _bulkOrInterruptXfer(info.buffer, info.streamId);
 }
 
 async::result<frg::expected<proto::UsbError>>
-EndpointState::_resetAfterError(size_t nextDequeue, bool cycle) {
+EndpointState::_resetAfterError(size_t nextDequeue, bool cycle, uint16_t streamId) {
 	// Issue the Reset Endpoint command to reset the xHC state
 	auto event = co_await _device->controller()->submitCommand(
 		Command::resetEndpoint(_device->slot(), _endpointId));
@@ -1044,19 +1199,29 @@ EndpointState::_resetAfterError(size_t nextDequeue, bool cycle) {
 
 	// Issue the Set TR Dequeue Pointer command to skip the failed
 	// transfer
-	auto dequeue = _transferRing.getPtr() + nextDequeue * sizeof(RawTrb);
+	auto ring = _ringFor(streamId);
+	auto dequeue = ring->getPtr() + nextDequeue * sizeof(RawTrb);
+	if (streamId)
+		dequeue |= streamCtxPrimaryRing << 1;
 	event = co_await _device->controller()->submitCommand(
 		Command::setTransferRingDequeue(_device->slot(), _endpointId,
-				dequeue | cycle));
+				dequeue | cycle, streamId));
 
 	if (event.completionCode != 1)
 		std::cout << _device->controller() << "Failed to set TR dequeue pointer"
 			<< ", completion code: " << completionCodeNames[event.completionCode] << std::endl;
+	else
+		ring->setDequeuePtr(nextDequeue);
 
 	FRG_CO_TRY(completionToError(event));
 
 	// Ring the doorbell to restart the pipe
-	_device->submit(_endpointId);
+	if (_streamRings.empty()) {
+		_device->submit(_endpointId);
+	} else {
+		for (size_t stream = 1; stream <= _streamRings.size(); stream++)
+			_device->submit(_endpointId, stream);
+	}
 
 	co_return frg::success;
 }
@@ -1071,14 +1236,16 @@ async::detached bindController(mbus_ng::Entity entity) {
 	assert(info.barInfo[0].ioType == protocols::hw::IoType::kIoTypeMemory);
 	auto bar = co_await device.accessBar(0);
 
-	helix::UniqueDescriptor irq;
+	std::vector<helix::UniqueIrq> irqs;
 
 	if (info.numMsis) {
 		co_await device.enableMsi();
-		irq = co_await device.installMsi(0);
+		auto numVectors = std::min(size_t{info.numMsis}, Controller::maxInterrupters);
+		for (size_t i = 0; i < numVectors; i++)
+			irqs.push_back(co_await device.installMsi(i));
 	} else {
 		co_await device.enableBusIrq();
-		irq = co_await device.accessIrq();
+		irqs.push_back(co_await device.accessIrq());
 	}
 
 	co_await device.enableBusmaster();
@@ -1087,7 +1254,7 @@ async::detached bindController(mbus_ng::Entity entity) {
 	helix::Mapping mapping{bar, info.barInfo[0].offset, info.barInfo[0].length};
 
 	auto controller = std::make_shared<Controller>(std::move(device), std::move(entity), std::move(mapping),
-			std::move(bar), std::move(irq), std::format("pci.{:08x}", info.barInfo[0].address));
+			std::move(bar), std::move(irqs), std::format("pci.{:08x}", info.barInfo[0].address));
 	controller->initialize();
 	globalControllers.push_back(std::move(controller));
 }
@@ -142,18 +142,24 @@ void Event::printInfo() {
 // EventRing
 // ------------------------------------------------------------------------
 
-EventRing::EventRing(Controller *controller)
-: _eventRing{controller->memoryPool()}, _erst{controller->memoryPool(), 1},
-	_dequeuePtr{0}, _controller{controller}, _ccs{1} {
+EventRing::EventRing(Controller *controller, size_t numSegments)
+: _erst{controller->memoryPool()}, _segment{0}, _dequeuePtr{0},
+	_controller{controller}, _ccs{1} {
+	assert(numSegments && numSegments <= maxSegments);
+
+	_segments.reserve(numSegments);
+	for (size_t i = 0; i < numSegments; i++) {
+		auto &segment = _segments.emplace_back(controller->memoryPool());
+		for (size_t j = 0; j < segmentSize; j++) {
+			segment->ent[j] = {{0, 0, 0, 0}};
+		}
 
-	for (size_t i = 0; i < eventRingSize; i++) {
-		_eventRing->ent[i] = {{0, 0, 0, 0}};
+		auto ptr = helix::ptrToPhysical(segment.data());
+		_erst->ent[i].ringSegmentBaseLow = ptr & 0xFFFFFFFF;
+		_erst->ent[i].ringSegmentBaseHi = ptr >> 32;
+		_erst->ent[i].ringSegmentSize = segmentSize;
+		_erst->ent[i].reserved = 0;
 	}
-
-	_erst[0].ringSegmentBaseLow = getEventRingPtr() & 0xFFFFFFFF;
-	_erst[0].ringSegmentBaseHi = getEventRingPtr() >> 32;
-	_erst[0].ringSegmentSize = eventRingSize;
-	_erst[0].reserved = 0;
 }
 
 uintptr_t EventRing::getErstPtr() {
@@ -161,31 +167,36 @@ uintptr_t EventRing::getErstPtr() {
 }
 
 uintptr_t EventRing::getEventRingPtr() {
-	return helix::ptrToPhysical(_eventRing.data()) + _dequeuePtr * sizeof(RawTrb);
+	return helix::ptrToPhysical(_segments[_segment].data()) + _dequeuePtr * sizeof(RawTrb);
 }
 
 size_t EventRing::getErstSize() {
-	return _erst.size();
+	return _segments.size();
 }
 
-void EventRing::processRing() {
-	while((_eventRing->ent[_dequeuePtr].val[3] & 1) == _ccs) {
-		RawTrb rawEv = _eventRing->ent[_dequeuePtr];
+bool EventRing::processRing(size_t maxEvents) {
+	for (size_t i = 0; i < maxEvents; i++) {
+		auto &segment = _segments[_segment];
+		if ((segment->ent[_dequeuePtr].val[3] & 1) != _ccs)
+			return false; // Not the proper cycle state
 
-		int oldCcs = _ccs;
+		RawTrb rawEv = segment->ent[_dequeuePtr];
 
 		_dequeuePtr++;
-		if (_dequeuePtr >= eventRingSize) {
-			_dequeuePtr = 0; // Wrap around
-			_ccs = !_ccs; // Invert cycle state
+		if (_dequeuePtr >= segmentSize) {
+			_dequeuePtr = 0;
+			_segment++;
+			if (_segment >= _segments.size()) {
+				_segment = 0; // Wrap around
+				_ccs = !_ccs; // Invert cycle state
+			}
 		}
 
-		if ((rawEv.val[3] & 1) != oldCcs)
-			break; // Not the proper cycle state
-
 		Event ev = Event::fromRawTrb(rawEv);
 		_controller->processEvent(ev);
 	}
+
+	return true;
 }
 
 // ------------------------------------------------------------------------
@@ -193,7 +204,8 @@ void EventRing::processRing() {
 // ------------------------------------------------------------------------
 
 ProducerRing::ProducerRing(Controller *controller)
-: _transactions{}, _ring{controller->memoryPool()}, _controller{controller}, _enqueuePtr{0}, _pcs{true} {
+: _transactions{}, _ring{controller->memoryPool()}, _controller{controller}, _enqueuePtr{0},
+	_dequeuePtr{0}, _pcs{true} {
 	for (uint32_t i = 0; i < ringSize; i++) {
 		_ring->ent[i] = {{0, 0, 0, 0}};
 	}
@@ -205,6 +217,37 @@ uintptr_t ProducerRing::getPtr() {
 	return helix::ptrToPhysical(_ring.data());
 }
 
+bool ProducerRing::contains(uintptr_t trbPointer) {
+	auto base = getPtr();
+	return trbPointer >= base && trbPointer < base + ringSize * sizeof(RawTrb);
+}
+
+size_t ProducerRing::freeTrbs() const {
+	// The link TRB is not part of the usable entries.
+	constexpr size_t usable = ringSize - 1;
+	size_t used = (_enqueuePtr + usable - _dequeuePtr) % usable;
+	return capacity() - used;
+}
+
+async::result<void> ProducerRing::waitForSpace(size_t count) {
+	assert(count <= capacity());
+
+	auto ticket = _nextTicket++;
+	while (ticket != _servedTicket || freeTrbs() < count)
+		co_await _spaceEvent.async_wait();
+	_servedTicket++;
+
+	// Let the next waiter re-check.
+	if (_servedTicket != _nextTicket)
+		_spaceEvent.raise();
+}
+
+void ProducerRing::setDequeuePtr(size_t dequeue) {
+	assert(dequeue < ringSize - 1);
+	_dequeuePtr = dequeue;
+	_spaceEvent.raise();
+}
+
 void ProducerRing::pushRawTrb(RawTrb cmd, Transaction *tx) {
 	_ring->ent[_enqueuePtr] = cmd;
 	_transactions[_enqueuePtr] = tx;
@@ -229,7 +272,11 @@ void ProducerRing::processEvent(Event ev) {
 			|| ev.type == TrbType::transferEvent);
 
 	size_t idx = (ev.trbPointer - getPtr()) / sizeof(RawTrb);
-	assert(idx < ringSize);
+	assert(idx < ringSize - 1);
+
+	// The controller processes the TRBs of a ring in order.
+	_dequeuePtr = (idx + 1) % (ringSize - 1);
+	_spaceEvent.raise();
 
 	auto tx = std::exchange(_transactions[idx], nullptr);
 
@@ -8,6 +8,7 @@
 
 #include <arch/dma_pool.hpp>
 
+#include <async/recurring-event.hpp>
 #include <async/result.hpp>
 #include <async/sequenced-event.hpp>
 
@@ -61,32 +62,41 @@ inline frg::expected<protocols::usb::UsbError> completionToError(Event ev) {
 struct Controller;
 
 struct EventRing {
-	constexpr static size_t eventRingSize = 128;
+	// Each segment fills one page, hence it never crosses a 64 KiB boundary.
+	constexpr static size_t segmentSize = 256;
+	constexpr static size_t maxSegments = 4;
 
-	struct alignas(64) ErstEntry {
+	struct ErstEntry {
 		uint32_t ringSegmentBaseLow;
 		uint32_t ringSegmentBaseHi;
 		uint32_t ringSegmentSize;
 		uint32_t reserved;
 	};
 
-	struct alignas(64) EventRingEntries {
-		RawTrb ent[eventRingSize];
+	struct alignas(64) Erst {
+		ErstEntry ent[maxSegments];
 	};
 
-	static_assert(sizeof(ErstEntry) == 64, "invalid ErstEntry size");
+	struct alignas(4096) Segment {
+		RawTrb ent[segmentSize];
+	};
+
+	static_assert(sizeof(ErstEntry) == 16, "invalid ErstEntry size");
 
-	EventRing(Controller *controller);
+	EventRing(Controller *controller, size_t numSegments);
 	uintptr_t getErstPtr();
 	uintptr_t getEventRingPtr();
 	size_t getErstSize();
 
-	void processRing();
+	// Processes at most maxEvents events.
+	// Returns true if the limit was reached, i.e., if more events may be pending.
+	bool processRing(size_t maxEvents);
 
 private:
-	arch::dma_object<EventRingEntries> _eventRing;
-	arch::dma_array<ErstEntry> _erst;
+	std::vector<arch::dma_object<Segment>> _segments;
+	arch::dma_object<Erst> _erst;
 
+	size_t _segment;
 	size_t _dequeuePtr;
 	Controller *_controller;
 
@@ -94,7 +104,8 @@ private:
 };
 
 struct ProducerRing {
-	constexpr static size_t ringSize = 128;
+	// The ring fills one page; the last TRB is the link TRB.
+	constexpr static size_t ringSize = 256;
 
 	struct Transaction {
 		async::result<frg::expected<protocols::usb::UsbError, size_t>>
@@ -126,9 +137,24 @@ struct ProducerRing {
 
 	ProducerRing(Controller *controller);
 	uintptr_t getPtr();
+	// Returns true if the physical address of the TRB belongs to this ring.
+	bool contains(uintptr_t trbPointer);
 	size_t enqueuePtr() const { return _enqueuePtr; }
 	bool producerCycle() const { return _pcs; }
 
+	// Maximal number of TRBs that can be outstanding at the same time.
+	// One TRB is kept free to distinguish a full ring from an empty one.
+	constexpr static size_t capacity() { return ringSize - 2; }
+	size_t freeTrbs() const;
+
+	// Waits until count TRBs can be pushed. Callers are served in order, such that
+	// transfers that are queued on the same ring do not overtake each other.
+	// The TRBs must be pushed before the caller suspends again.
+	async::result<void> waitForSpace(size_t count);
+
+	// Called after the dequeue pointer was moved by a Set TR Dequeue Pointer command.
+	void setDequeuePtr(size_t dequeue);
+
 	void pushRawTrb(RawTrb cmd, Transaction *tx);
 
 	void processEvent(Event ev);
@@ -138,8 +164,14 @@ private:
 	arch::dma_object<RingEntries> _ring;
 	Controller *_controller;
 	size_t _enqueuePtr;
+	// Index after the last TRB that the controller reported as completed.
+	size_t _dequeuePtr;
 
 	bool _pcs;
 
+	async::recurring_event _spaceEvent;
+	uint64_t _nextTicket = 0;
+	uint64_t _servedTicket = 0;
+
 	void updateLink();
 };
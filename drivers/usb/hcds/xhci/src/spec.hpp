@@ -50,6 +50,7 @@ namespace hcsparams2 {
 namespace hccparams1 {
 	inline constexpr arch::field<uint32_t, uint16_t> extCapPtr(16, 16);
 	inline constexpr arch::field<uint32_t, bool> contextSize(2, 1);
+	inline constexpr arch::field<uint32_t, uint8_t> maxPsaSize(12, 4);
 }
 
 namespace usbcmd {
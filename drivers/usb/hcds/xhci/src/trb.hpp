@@ -109,10 +109,11 @@ namespace Command {
 		};
 	}
 
-	constexpr RawTrb setTransferRingDequeue(uint8_t slotId, uint8_t endpointId, uintptr_t dequeue) {
+	constexpr RawTrb setTransferRingDequeue(uint8_t slotId, uint8_t endpointId, uintptr_t dequeue,
+			uint16_t streamId = 0) {
 		return RawTrb{
 			static_cast<uint32_t>(dequeue & 0xFFFFFFFF),
-			static_cast<uint32_t>(dequeue >> 32), 0,
+			static_cast<uint32_t>(dequeue >> 32), uint32_t{streamId} << 16,
 			(uint32_t{slotId} << 24) | (uint32_t{endpointId} << 16)
 			| (static_cast<uint32_t>(TrbType::setTrDequeuePtrCommand) << 10)
 		};
@@ -164,6 +165,11 @@ namespace Transfer {
 		return trb;
 	}
 
+	constexpr RawTrb withInterrupterTarget(RawTrb trb, uint16_t interrupter) {
+		trb.val[2] |= uint32_t{interrupter & 0x3FFu} << 22;
+		return trb;
+	}
+
 	template <typename FU, typename FB, typename ...Ts>
 	inline void buildTransferChain(size_t maxPacketSize, FU use, arch::dma_buffer_view view, FB build, Ts ...ts) {
 		assert(std::popcount(maxPacketSize) == 1);
@@ -174,7 +180,12 @@ namespace Transfer {
 			uintptr_t ptr = (uintptr_t)view.data() + progress;
 			uintptr_t pptr = helix::addressToPhysical(ptr);
 
-			auto chunk = std::min(view.size() - progress, 0x1000 - (ptr & 0xFFF));
+			// Physically contiguous pages share a TRB. TRB buffers must not cross
+			// a 64 KiB boundary, which also bounds the TRB length.
+			size_t chunk = std::min(view.size() - progress, 0x1000 - (ptr & 0xFFF));
+			while (progress + chunk < view.size() && ((pptr + chunk) & 0xFFFF)
+					&& helix::addressToPhysical(ptr + chunk) == pptr + chunk)
+				chunk += std::min(view.size() - progress - chunk, size_t{0x1000});
 
 			bool chain = (progress + chunk) < view.size();
 
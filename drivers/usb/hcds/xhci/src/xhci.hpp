@@ -65,19 +65,27 @@ struct Controller;
 // ----------------------------------------------------------------
 
 struct Interrupter {
-	Interrupter(EventRing *ring, arch::mem_space space)
-	: _ring{ring}, _space{space} { }
+	// Interrupt moderation interval in units of 250ns (i.e., 40us).
+	constexpr static uint32_t moderationInterval = 160;
+	// During long bursts, the dequeue pointer is written back after this many events
+	// such that the controller can reuse the consumed TRBs before the burst is drained.
+	constexpr static size_t dequeueUpdateInterval = EventRing::segmentSize / 2;
+
+	Interrupter(Controller *controller, arch::mem_space space, size_t numSegments,
+			helix::UniqueIrq irq)
+	: _ring{controller, numSegments}, _space{space}, _irq{std::move(irq)} { }
 
 	void initialize();
-	async::detached handleIrqs(helix::UniqueIrq &irq);
+	async::detached handleIrqs();
 
 private:
 	bool _isBusy();
 	void _clearPending();
-	void _updateDequeue();
+	void _updateDequeue(bool clearBusy);
 
-	EventRing *_ring;
+	EventRing _ring;
 	arch::mem_space _space;
+	helix::UniqueIrq _irq;
 };
 
 // ----------------------------------------------------------------
@@ -121,7 +129,7 @@ struct Device final : proto::DeviceData, std::enable_shared_from_this<Device> {
 	transfer(proto::ControlTransfer info) override;
 
 
-	void submit(int endpoint);
+	void submit(int endpoint, uint16_t streamId = 0);
 
 	async::result<frg::expected<proto::UsbError>>
 	enumerate(size_t rootPort, size_t port, uint32_t route, std::shared_ptr<proto::Hub> hub, proto::DeviceSpeed speed, int slotType);
@@ -130,7 +138,12 @@ struct Device final : proto::DeviceData, std::enable_shared_from_this<Device> {
 	readDescriptor(arch::dma_buffer_view dest, uint16_t desc);
 
 	async::result<frg::expected<proto::UsbError>>
-	setupEndpoint(int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type);
+	setupEndpoint(int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type,
+			uint8_t maxBurst = 0, uint8_t maxStreams = 0);
+
+	// Reconfigures the endpoint to use the given primary stream context array.
+	async::result<frg::expected<proto::UsbError>>
+	configureStreams(int endpointId, uintptr_t streamArray, uint8_t maxPStreams);
 
 	async::result<frg::expected<proto::UsbError>>
 	configureHub(std::shared_ptr<proto::Hub> hub, proto::DeviceSpeed speed);
@@ -158,7 +171,8 @@ private:
 
 	DeviceContext _devCtx;
 
-	void _initEpCtx(InputContext &ctx, int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type);
+	void _initEpCtx(InputContext &ctx, int endpoint, proto::PipeType dir, size_t maxPacketSize, proto::EndpointType type,
+			uint8_t maxBurst, uint8_t maxStreams);
 
 	std::array<std::shared_ptr<EndpointState>, 31> _endpoints;
 };
@@ -167,9 +181,10 @@ private:
 struct EndpointState final : proto::EndpointData {
 	friend struct Device;
 
-	explicit EndpointState(Device *device, int endpointId, proto::EndpointType type, size_t maxPacketSize)
+	explicit EndpointState(Device *device, int endpointId, proto::EndpointType type, size_t maxPacketSize,
+			uint8_t maxStreams = 0)
 	: _device{device}, _endpointId{endpointId}, _type{type},
-		_maxPacketSize{maxPacketSize}, _transferRing{device->controller()} { }
+		_maxPacketSize{maxPacketSize}, _maxStreams{maxStreams}, _transferRing{device->controller()} { }
 
 	async::result<frg::expected<proto::UsbError, size_t>>
 	transfer(proto::ControlTransfer info) override;
@@ -180,6 +195,12 @@ struct EndpointState final : proto::EndpointData {
 	async::result<frg::expected<proto::UsbError, size_t>>
 	transfer(proto::BulkTransfer info) override;
 
+	async::result<frg::expected<proto::UsbError, size_t>>
+	allocateStreams(size_t count) override;
+
+	// Dispatches a transfer event to the ring that contains the TRB.
+	void processEvent(Event ev);
+
 	ProducerRing &transferRing() {
 		return _transferRing;
 	}
@@ -190,13 +211,22 @@ private:
 	proto::EndpointType _type;
 
 	size_t _maxPacketSize;
+	// Log2 of the number of streams that the device supports (from the SS companion descriptor).
+	uint8_t _maxStreams;
 	ProducerRing _transferRing;
 
+	// Once streams are allocated, each stream has its own ring and _transferRing is unused.
+	// Stream n uses _streamRings[n - 1].
+	arch::dma_array<StreamContext> _streamContexts;
+	std::vector<std::unique_ptr<ProducerRing>> _streamRings;
+
+	ProducerRing *_ringFor(uint16_t streamId);
+
 	async::result<frg::expected<proto::UsbError, size_t>>
-	_bulkOrInterruptXfer(arch::dma_buffer_view buffer);
+	_bulkOrInterruptXfer(arch::dma_buffer_view buffer, uint16_t streamId = 0);
 
 	async::result<frg::expected<proto::UsbError>>
-	_resetAfterError(size_t nextDequeue, bool nextCycle);
+	_resetAfterError(size_t nextDequeue, bool nextCycle, uint16_t streamId = 0);
 };
 
 
@@ -234,9 +264,13 @@ struct Controller final : proto::BaseController {
 			mbus_ng::Entity entity,
 			helix::Mapping mapping,
 			helix::UniqueDescriptor mmio,
-			helix::UniqueIrq irq,
+			std::vector<helix::UniqueIrq> irqs,
 			std::string name);
 
+	// Interrupter 0 receives command completions and port status changes.
+	// If the controller has MSI(-X) vectors to spare, bulk endpoints get their own interrupter.
+	constexpr static size_t maxInterrupters = 2;
+
 	virtual ~Controller() = default;
 
 	async::detached initialize();
@@ -250,6 +284,15 @@ struct Controller final : proto::BaseController {
 
 	void processEvent(Event ev);
 
+	// Returns the interrupter that receives the transfer events of an endpoint.
+	// Throughput-bound bulk endpoints (storage, networking) are kept apart from
+	// latency-bound control and interrupt endpoints (HID, hubs).
+	uint16_t interrupterFor(proto::EndpointType type) const {
+		if (type == proto::EndpointType::bulk || type == proto::EndpointType::isochronous)
+			return _bulkInterrupter;
+		return 0;
+	}
+
 	void ringDoorbell(uint8_t doorbell, uint8_t target, uint16_t streamId = 0);
 
 	async::result<Event> submitCommand(RawTrb trb) {
@@ -265,6 +308,11 @@ struct Controller final : proto::BaseController {
 		return _largeCtx;
 	}
 
+	// Log2 of the maximal primary stream array size minus one; zero if streams are unsupported.
+	uint8_t maxPsaSize() const {
+		return _maxPsaSize;
+	}
+
 	void setDeviceContext(size_t slot, DeviceContext &ctx) {
 		_dcbaa[slot] = helix::ptrToPhysical(ctx.rawData());
 	}
@@ -366,7 +414,8 @@ private:
 	protocols::hw::Device _hw_device;
 	helix::Mapping _mapping;
 	helix::UniqueDescriptor _mmio;
-	helix::UniqueIrq _irq;
+	// Moved into the interrupters during initialize().
+	std::vector<helix::UniqueIrq> _irqs;
 	arch::mem_space _space;
 	arch::mem_space _doorbells;
 
@@ -381,13 +430,13 @@ private:
 	std::vector<arch::dma_buffer> _scratchpadBufs;
 
 	std::vector<std::unique_ptr<Interrupter>> _interrupters;
+	uint16_t _bulkInterrupter = 0;
 	std::vector<Port *> _ports;
 	std::array<std::shared_ptr<Device>, 256> _devices;
 
 	std::vector<std::shared_ptr<RootHub>> _rootHubs;
 
 	ProducerRing _cmdRing;
-	EventRing _eventRing;
 
 	int _numPorts;
 	int _maxDeviceSlots;
@@ -395,6 +444,7 @@ private:
 	proto::Enumerator _enumerator;
 
 	bool _largeCtx;
+	uint8_t _maxPsaSize;
 
 	mbus_ng::Entity _entity;
 };
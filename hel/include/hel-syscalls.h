@@ -44,6 +44,13 @@ extern inline __attribute__ (( always_inline )) HelError helTransferDescriptor(H
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helTransferDescriptors(
+		const HelHandle *handles, size_t count, HelHandle universeHandle,
+		HelHandle *outHandles) {
+	return helSyscall4(kHelCallTransferDescriptors, (HelWord)handles, (HelWord)count,
+			(HelWord)universeHandle, (HelWord)outHandles);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helDescriptorInfo(HelHandle handle,
 		struct HelDescriptorInfo *info) {
 	return helSyscall2(kHelCallDescriptorInfo, (HelWord)handle, (HelWord)info);
@@ -60,6 +67,12 @@ extern inline __attribute__ (( always_inline )) HelError helCloseDescriptor(
 	return helSyscall2(kHelCallCloseDescriptor, (HelWord)universeHandle, (HelWord)handle);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helCloseDescriptors(
+		HelHandle universeHandle, const HelHandle *handles, size_t count) {
+	return helSyscall3(kHelCallCloseDescriptors, (HelWord)universeHandle, (HelWord)handles,
+			(HelWord)count);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateQueue(
 		const struct HelQueueParameters *params, HelHandle *handle) {
 	HelWord hel_handle;
@@ -68,6 +81,15 @@ extern inline __attribute__ (( always_inline )) HelError helCreateQueue(
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helAddQueueChunks(HelHandle handle,
+		unsigned int numChunks, uintptr_t *offset) {
+	HelWord offsetWord;
+	HelError error = helSyscall2_1(kHelCallAddQueueChunks, (HelWord)handle, (HelWord)numChunks,
+			&offsetWord);
+	*offset = (uintptr_t)offsetWord;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCancelAsync(HelHandle handle,
 		uint64_t async_id) {
 	return helSyscall2(kHelCallCancelAsync, (HelWord)handle, (HelWord)async_id);
@@ -177,6 +199,16 @@ extern inline __attribute__ (( always_inline )) HelError helRunVirtualizedCpu(He
 	return error;
 }
 
+extern inline __attribute__ (( always_inline )) HelError helAddVmIoTrigger(HelHandle space,
+		const struct HelVmIoTrigger *trigger, HelHandle event) {
+	return helSyscall3(kHelCallAddVmIoTrigger, (HelWord)space, (HelWord)trigger, (HelWord)event);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helRemoveVmIoTrigger(HelHandle space,
+		const struct HelVmIoTrigger *trigger) {
+	return helSyscall2(kHelCallRemoveVmIoTrigger, (HelWord)space, (HelWord)trigger);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helGetRandomBytes(
 		void *buffer, size_t wantedSize, size_t *actualSize) {
 	HelWord outActualSize;
@@ -209,6 +241,22 @@ extern inline __attribute__ (( always_inline )) HelError helUnmapMemory(HelHandl
 	return helSyscall3(kHelCallUnmapMemory, (HelWord)space, (HelWord)pointer, (HelWord)size);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helDecommitMemory(HelHandle space,
+		void *pointer, size_t size) {
+	return helSyscall3(kHelCallDecommitMemory, (HelWord)space, (HelWord)pointer, (HelWord)size);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helPopulateMemory(HelHandle space,
+		void *pointer, size_t size, uint32_t flags) {
+	return helSyscall4(kHelCallPopulateMemory, (HelWord)space, (HelWord)pointer, (HelWord)size,
+			(HelWord)flags);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helQuerySpaceMemory(HelHandle space,
+		struct HelSpaceMemoryInfo *info) {
+	return helSyscall2(kHelCallQuerySpaceMemory, (HelWord)space, (HelWord)info);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitSynchronizeSpace(
 		HelHandle space, void *pointer, size_t size,
 		HelHandle queue, uintptr_t context) {
@@ -225,6 +273,17 @@ extern inline __attribute__ (( always_inline )) HelError helPointerPhysical(cons
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helQueryPhysicalRanges(HelHandle handle,
+		uintptr_t address, size_t size, struct HelPhysicalRange *ranges, size_t maxRanges,
+		size_t *numRanges) {
+	HelWord out_count;
+	HelError error = helSyscall6_1(kHelCallQueryPhysicalRanges, (HelWord)handle,
+			(HelWord)address, (HelWord)size, (HelWord)ranges, (HelWord)maxRanges, 0,
+			&out_count);
+	*numRanges = (size_t)out_count;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitReadMemory(HelHandle handle,
 		uintptr_t address, size_t length, void *buffer,
 		HelHandle queue, uintptr_t context) {
@@ -295,6 +354,31 @@ extern inline __attribute__ (( always_inline )) HelError helSetPriority(HelHandl
 	return helSyscall2(kHelCallSetPriority, (HelWord)handle, (HelWord)priority);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSetLatencyClass(HelHandle handle,
+		int priority, uint64_t budget, uint64_t period) {
+	return helSyscall4(kHelCallSetLatencyClass, (HelWord)handle, (HelWord)priority,
+			(HelWord)budget, (HelWord)period);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helCreateScheduleGroup(
+		HelHandle parentHandle, HelHandle *handle) {
+	HelWord handleWord;
+	HelError error = helSyscall1_1(kHelCallCreateScheduleGroup, (HelWord)parentHandle,
+			&handleWord);
+	*handle = (HelHandle)handleWord;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helConfigureScheduleGroup(
+		HelHandle handle, const struct HelScheduleGroupParams *params) {
+	return helSyscall2(kHelCallConfigureScheduleGroup, (HelWord)handle, (HelWord)params);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helSetScheduleGroup(HelHandle handle,
+		HelHandle groupHandle) {
+	return helSyscall2(kHelCallSetScheduleGroup, (HelWord)handle, (HelWord)groupHandle);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitObserve(HelHandle handle,
 		uint64_t in_seq, HelHandle queue, uintptr_t context) {
 	return helSyscall4(kHelCallSubmitObserve, (HelWord)handle, (HelWord)in_seq,
@@ -323,6 +407,15 @@ extern inline __attribute__ (( always_inline )) HelError helStoreRegisters(HelHa
 	return helSyscall3(kHelCallStoreRegisters, (HelWord)handle, (HelWord)set, (HelWord)image);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helPushSignalFrame(HelHandle handle,
+		const struct HelSignalFrame *frame, uintptr_t *address) {
+	HelWord addressWord;
+	HelError error = helSyscall2_1(kHelCallPushSignalFrame, (HelWord)handle, (HelWord)frame,
+			&addressWord);
+	*address = (uintptr_t)addressWord;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helWriteFsBase(void *pointer) {
 	return helSyscall1(kHelCallWriteFsBase, (HelWord)pointer);
 };
@@ -346,6 +439,11 @@ extern inline __attribute__ (( always_inline )) HelError helGetCurrentCpu(int *c
 	return error;
 }
 
+extern inline __attribute__ (( always_inline )) HelError helQueryKernelStats(
+		struct HelKernelStats *stats) {
+	return helSyscall1(kHelCallQueryKernelStats, (HelWord)stats);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helGetClock(uint64_t *counter) {
 	HelWord handle_word;
 	HelError error = helSyscall0_1(kHelCallGetClock, &handle_word);
@@ -353,6 +451,55 @@ extern inline __attribute__ (( always_inline )) HelError helGetClock(uint64_t *c
 	return error;
 };
 
+// Reads the monotonic clock from a page mapped through kHelClockMemory.
+// Falls back to helGetClock() if the clock cannot be read from user space.
+extern inline __attribute__ (( always_inline )) HelError helGetClockFromPage(
+		const struct HelClockPage *page, uint64_t *counter) {
+#if defined(__x86_64__)
+	while(1) {
+		uint64_t seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
+		if(seqlock & 1)
+			continue;
+
+		uint32_t flags = __atomic_load_n(&page->flags, __ATOMIC_RELAXED);
+		int32_t shift = __atomic_load_n(&page->tscShift, __ATOMIC_RELAXED);
+		uint64_t factor = __atomic_load_n(&page->tscFactor, __ATOMIC_RELAXED);
+
+		uint32_t lsw, msw;
+		asm volatile ("lfence; rdtsc" : "=a"(lsw), "=d"(msw));
+		uint64_t tsc = ((uint64_t)msw << 32) | (uint64_t)lsw;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) != seqlock)
+			continue;
+		if(!(flags & kHelClockPageTsc))
+			break;
+
+		*counter = (uint64_t)(((unsigned __int128)factor * tsc) >> shift);
+		return kHelErrNone;
+	}
+#else
+	(void)page;
+#endif
+	return helGetClock(counter);
+};
+
+// Reads the offset of the realtime clock from a page mapped through kHelClockMemory.
+extern inline __attribute__ (( always_inline )) int64_t helGetRealtimeOffsetFromPage(
+		const struct HelClockPage *page) {
+	while(1) {
+		uint64_t seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
+		if(seqlock & 1)
+			continue;
+
+		int64_t offset = __atomic_load_n(&page->realtimeOffset, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) == seqlock)
+			return offset;
+	}
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitClock(uint64_t counter,
 		HelHandle queue, uintptr_t context, uint64_t *async_id) {
 	HelWord async_word;
@@ -362,6 +509,15 @@ extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitClock(uin
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitClockSlack(uint64_t counter,
+		uint64_t slack, HelHandle queue, uintptr_t context, uint64_t *async_id) {
+	HelWord async_word;
+	HelError error = helSyscall4_1(kHelCallSubmitAwaitClockSlack, (HelWord)counter,
+			(HelWord)slack, (HelWord)queue, (HelWord)context, &async_word);
+	*async_id = (uint64_t)async_word;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateStream(HelHandle *lane1,
 		HelHandle *lane2, uint32_t attach_credentials) {
 	HelWord out_lane1;
@@ -379,6 +535,10 @@ extern inline __attribute__ (( always_inline )) HelError helSubmitAsync(HelHandl
 			(HelWord)queue, (HelWord)context, (HelWord)flags);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSubmitRing(HelHandle queue) {
+	return helSyscall1(kHelCallSubmitRing, (HelWord)queue);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helShutdownLane(HelHandle handle) {
 	return helSyscall1(kHelCallShutdownLane, (HelWord)handle);
 };
@@ -393,6 +553,31 @@ extern inline __attribute__ (( always_inline )) HelError helFutexWake(int *point
 	return helSyscall1(kHelCallFutexWake, (HelWord)pointer);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helFutexWaitVector(
+		const struct HelFutexWaitEntry *entries, size_t count, int64_t deadline,
+		size_t *index) {
+	HelWord index_word;
+	HelError error = helSyscall3_1(kHelCallFutexWaitVector, (HelWord)entries,
+			(HelWord)count, (HelWord)deadline, &index_word);
+	*index = (size_t)index_word;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helFutexWakeCount(int *pointer,
+		unsigned int count, unsigned int *woken) {
+	HelWord woken_word;
+	HelError error = helSyscall2_1(kHelCallFutexWakeCount, (HelWord)pointer,
+			(HelWord)count, &woken_word);
+	*woken = (unsigned int)woken_word;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helFutexRequeue(int *pointer,
+		int expected, int *target, unsigned int wakeCount, unsigned int requeueCount) {
+	return helSyscall5(kHelCallFutexRequeue, (HelWord)pointer, (HelWord)expected,
+			(HelWord)target, (HelWord)wakeCount, (HelWord)requeueCount);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateOneshotEvent(HelHandle *handle) {
 	HelWord handle_word;
 	HelError error = helSyscall0_1(kHelCallCreateOneshotEvent, &handle_word);
@@ -411,6 +596,20 @@ extern inline __attribute__ (( always_inline )) HelError helRaiseEvent(HelHandle
 	return helSyscall1(kHelCallRaiseEvent, (HelWord)handle);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helCreateMemoryPressureEvent(
+		const struct HelMemoryPressureWatermarks *watermarks, HelHandle *handle) {
+	HelWord handle_word;
+	HelError error = helSyscall1_1(kHelCallCreateMemoryPressureEvent,
+			(HelWord)watermarks, &handle_word);
+	*handle = (HelHandle)handle_word;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helQueryMemoryPressure(
+		struct HelMemoryPressureInfo *info) {
+	return helSyscall1(kHelCallQueryMemoryPressure, (HelWord)info);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helAccessIrq(int number, 
 		HelHandle *handle) {
 	HelWord handle_word;
@@ -437,6 +636,12 @@ extern inline __attribute__ (( always_inline )) HelError helAutomateIrq(HelHandl
 			(HelWord)kernlet);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helModerateIrq(HelHandle handle,
+		unsigned int maxEvents, uint64_t delay) {
+	return helSyscall3(kHelCallModerateIrq, (HelWord)handle, (HelWord)maxEvents,
+			(HelWord)delay);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helAccessIo(uintptr_t *port_array,
 		size_t num_ports, HelHandle *handle) {
 	HelWord out_handle;
@@ -18,7 +18,7 @@
 
 enum {
 	// largest system call number plus 1
-	kHelNumCalls = 105,
+	kHelNumCalls = 128,
 
 	kHelCallLog = 1,
 	kHelCallPanic = 10,
@@ -28,12 +28,15 @@ enum {
 
 	kHelCallCreateUniverse = 62,
 	kHelCallTransferDescriptor = 66,
+	kHelCallTransferDescriptors = 127,
 	kHelCallDescriptorInfo = 32,
 	kHelCallGetCredentials = 84,
 	kHelCallCloseDescriptor = 21,
+	kHelCallCloseDescriptors = 106,
 
 	kHelCallCreateQueue = 89,
 	kHelCallCancelAsync = 92,
+	kHelCallAddQueueChunks = 114,
 
 	kHelCallAllocateMemory = 51,
 	kHelCallResizeMemory = 83,
@@ -49,7 +52,11 @@ enum {
 	kHelCallSubmitProtectMemory = 99,
 	kHelCallSubmitSynchronizeSpace = 53,
 	kHelCallUnmapMemory = 36,
+	kHelCallDecommitMemory = 115,
+	kHelCallPopulateMemory = 116,
+	kHelCallQuerySpaceMemory = 121,
 	kHelCallPointerPhysical = 43,
+	kHelCallQueryPhysicalRanges = 124,
 	kHelCallSubmitReadMemory = 77,
 	kHelCallSubmitWriteMemory = 78,
 	kHelCallMemoryInfo = 26,
@@ -62,6 +69,10 @@ enum {
 	kHelCallCreateThread = 67,
 	kHelCallQueryThreadStats = 95,
 	kHelCallSetPriority = 85,
+	kHelCallSetLatencyClass = 108,
+	kHelCallCreateScheduleGroup = 117,
+	kHelCallConfigureScheduleGroup = 118,
+	kHelCallSetScheduleGroup = 119,
 	kHelCallYield = 34,
 	kHelCallSubmitObserve = 74,
 	kHelCallKillThread = 87,
@@ -70,31 +81,43 @@ enum {
 	kHelCallLoadRegisters = 75,
 	kHelCallStoreRegisters = 76,
 	kHelCallQueryRegisterInfo = 102,
+	kHelCallPushSignalFrame = 120,
 	kHelCallWriteFsBase = 41,
 	kHelCallGetClock = 42,
 	kHelCallSubmitAwaitClock = 80,
+	kHelCallSubmitAwaitClockSlack = 107,
 	kHelCallCreateVirtualizedCpu = 37,
 	kHelCallRunVirtualizedCpu = 38,
+	kHelCallAddVmIoTrigger = 122,
+	kHelCallRemoveVmIoTrigger = 123,
 	kHelCallGetRandomBytes = 101,
 	kHelCallWriteGsBase = 54,
 	kHelCallReadFsBase = 55,
 	kHelCallReadGsBase = 56,
 	kHelCallGetCurrentCpu = 57,
+	kHelCallQueryKernelStats = 109,
 
 	kHelCallCreateStream = 68,
 	kHelCallSubmitAsync = 79,
+	kHelCallSubmitRing = 113,
 	kHelCallShutdownLane = 91,
 
 	kHelCallFutexWait = 73,
 	kHelCallFutexWake = 71,
+	kHelCallFutexRequeue = 105,
+	kHelCallFutexWaitVector = 125,
+	kHelCallFutexWakeCount = 126,
 
 	kHelCallCreateOneshotEvent = 96,
 	kHelCallCreateBitsetEvent = 97,
 	kHelCallRaiseEvent = 98,
+	kHelCallCreateMemoryPressureEvent = 111,
+	kHelCallQueryMemoryPressure = 112,
 	kHelCallAccessIrq = 14,
 	kHelCallAcknowledgeIrq = 81,
 	kHelCallSubmitAwaitEvent = 82,
 	kHelCallAutomateIrq = 94,
+	kHelCallModerateIrq = 110,
 
 	kHelCallAccessIo = 11,
 	kHelCallEnableIo = 12,
@@ -180,7 +203,39 @@ enum {
 	kHelNullHandle = 0,
 	kHelThisUniverse = -1,
 	kHelThisThread = -2,
-	kHelZeroMemory = -3
+	kHelZeroMemory = -3,
+	kHelClockMemory = -4
+};
+
+enum {
+	//! The monotonic clock can be computed from the TSC.
+	kHelClockPageTsc = 1
+};
+
+//! Layout of the read-only page that is mapped through kHelClockMemory.
+//! Readers must retry if seqlock is odd or changes while reading.
+struct HelClockPage {
+	uint64_t seqlock;
+	uint32_t flags;
+	int32_t tscShift;
+	uint64_t tscFactor;
+	//! Realtime minus monotonic time (in nanoseconds).
+	int64_t realtimeOffset;
+};
+
+//! Layout of the header page of a kernel ring buffer that is mapped into user space
+//! (see kerncfg's GetBufferMemoryRequest).
+//! head and tail are byte positions; the data memory wraps at dataSize.
+//! Each record consists of a uint64_t length, followed by the payload,
+//! padded to a multiple of 8 bytes.
+//! The kernel updates tail before it overwrites records and head after it commits them.
+//! Hence, readers must re-check tail after copying a record.
+struct HelLogRingHeader {
+	uint64_t head;
+	uint64_t tail;
+	uint64_t dataSize;
+	//! Number of records that were overwritten since the ring was created.
+	uint64_t overwrittenRecords;
 };
 
 enum {
@@ -202,6 +257,7 @@ enum {
 	kHelActionSendFromBufferSg = 10,
 	kHelActionRecvInline = 7,
 	kHelActionRecvToBuffer = 3,
+	kHelActionRecvToBufferSg = 12,
 	kHelActionPushDescriptor = 2,
 	kHelActionPullDescriptor = 4
 };
@@ -233,10 +289,18 @@ struct HelDescriptorInfo {
 enum HelAllocFlags {
 	kHelAllocContinuous = 4,
 	kHelAllocOnDemand = 1,
+	// Prefer memory from HelAllocRestrictions::numaNode.
+	kHelAllocNumaHint = 8,
+	// Back the memory by physically contiguous 2 MiB chunks such that it can be
+	// mapped using huge pages. The size must be a multiple of 2 MiB.
+	kHelAllocHuge = 16,
 };
 
 struct HelAllocRestrictions {
 	int addressBits;
+	// Preferred NUMA node. Only used if kHelAllocNumaHint is passed.
+	// Without this hint, memory is taken from the node of the faulting CPU.
+	int numaNode;
 };
 
 enum HelManagedFlags {
@@ -258,6 +322,11 @@ enum HelMapFlags {
 	kHelMapFixedNoReplace = 4096
 };
 
+enum HelPopulateFlags {
+	//! Fault in writable mappings for writing (i.e., allocate private copies).
+	kHelPopulateWrite = 1
+};
+
 enum HelSliceFlags {
 	kHelSliceCacheWriteCombine = 1,
 };
@@ -294,6 +363,41 @@ struct HelRegisterInfo {
 	int setSize;
 };
 
+enum HelSignalFrameFlags {
+	//! Store a pointer to the SIMD state into the frame.
+	kHelSignalFrameSimdPointer = 1
+};
+
+//! Description of a signal frame, see ::helPushSignalFrame.
+struct HelSignalFrame {
+	//! Template of the frame that is copied to the stack of the thread.
+	//! On x86_64, the first word of the frame is overwritten by @p restorerIp.
+	const void *frame;
+	//! Size of the frame template (in bytes).
+	//! The SIMD state (see ::kHelRegsSimd) is stored directly after the frame.
+	size_t frameSize;
+	//! Offset into the frame at which the ::kHelRegsSignal image is stored.
+	size_t registersOffset;
+	//! Offset into the frame at which a pointer to the SIMD state is stored.
+	//! Only used if ::kHelSignalFrameSimdPointer is set.
+	size_t simdPointerOffset;
+	//! Offsets into the frame of the siginfo and the context that are passed to the handler.
+	size_t infoOffset;
+	size_t contextOffset;
+	//! Signal number that is passed to the handler.
+	int signalNumber;
+	//! Entry point of the handler.
+	uintptr_t handlerIp;
+	//! Address that the handler returns to.
+	uintptr_t restorerIp;
+	//! Alternate stack that the frame is pushed to (unless the thread already runs on it).
+	//! A size of zero disables the alternate stack.
+	uintptr_t altStackBase;
+	size_t altStackSize;
+	//! Flags from ::HelSignalFrameFlags.
+	uint32_t flags;
+};
+
 #if defined(__x86_64__)
 enum HelRegisterIndex {
 	kHelRegRax = 0,
@@ -448,6 +552,11 @@ enum HelSyscallArgs {
 
 #endif
 
+enum {
+	//! Adds a submission ring to the queue (see ::helSubmitRing).
+	kHelQueueSubmissionRing = 1
+};
+
 struct HelQueueParameters {
 	uint32_t flags;
 	unsigned int ringShift;
@@ -502,6 +611,41 @@ struct HelElement {
 	void *context;
 };
 
+enum {
+	//! Number of entries in a submission ring.
+	kHelSubmissionRingSize = 64,
+	//! Maximal number of actions per entry of a submission ring.
+	kHelSubmissionMaxActions = 8
+};
+
+//! A single entry of a submission ring.
+//! The fields correspond to the arguments of ::helSubmitAsync.
+struct HelSubmission {
+	HelHandle handle;
+	uint32_t numActions;
+	uint32_t flags;
+	uintptr_t context;
+	struct HelAction actions[kHelSubmissionMaxActions];
+};
+
+//! Submission ring of a HelQueue.
+//!
+//! The ring follows the chunks in the queue memory (at a 64-byte aligned offset).
+//! Entry n is stored at index n % kHelSubmissionRingSize.
+struct HelSubmissionRing {
+	//! Number of entries that user space produced. Only written by user space.
+	unsigned int tail;
+
+	//! Number of entries that the kernel consumed. Only written by the kernel.
+	//! User space may reuse an entry once this counter moves past it.
+	unsigned int head;
+
+	//! Keeps the counters on their own cache line.
+	char padding[56];
+
+	struct HelSubmission entries[kHelSubmissionRingSize];
+};
+
 struct HelSimpleResult {
 	HelError error;
 	int reserved;
@@ -568,8 +712,132 @@ union HelKernletData {
 	HelHandle handle;
 };
 
+//! Run-time statistics of a thread, see ::helQueryThreadStats.
+//! Times are in nanoseconds.
 struct HelThreadStats {
+	//! Time that the thread spent running in user space.
 	uint64_t userTime;
+	//! Time that the thread spent running in the kernel (i.e., in syscalls or page faults).
+	uint64_t kernelTime;
+	//! Number of times that the thread blocked.
+	uint64_t voluntarySwitches;
+	//! Number of times that the thread was preempted.
+	uint64_t involuntarySwitches;
+	//! Number of times that the thread was moved to a different CPU.
+	uint64_t migrations;
+};
+
+//! Parameters of a schedule group, see ::helConfigureScheduleGroup.
+struct HelScheduleGroupParams {
+	//! Share of CPU time relative to the siblings of the group.
+	//! Must be between 1 and 10000. The default weight is 100.
+	uint32_t weight;
+	//! Maximal run time of the group per period (in nanoseconds).
+	//! Zero disables the limit.
+	uint64_t quota;
+	//! Length of the period (in nanoseconds). Must be non-zero if @p quota is non-zero.
+	uint64_t period;
+};
+
+//! Memory pressure levels, see ::helCreateMemoryPressureEvent.
+enum HelMemoryPressure {
+	kHelMemoryPressureNone = 0,
+	//! Free memory fell below the low watermark. Caches should be shrunk.
+	kHelMemoryPressureLow = 1,
+	//! Free memory fell below the critical watermark.
+	//! With the default watermarks, the kernel starts to evict cached pages.
+	kHelMemoryPressureCritical = 2
+};
+
+//! Watermarks for ::helCreateMemoryPressureEvent, in bytes of free memory.
+//! Zero selects the kernel's default watermark.
+struct HelMemoryPressureWatermarks {
+	uint64_t lowFreeBytes;
+	uint64_t criticalFreeBytes;
+};
+
+//! Memory usage as reported by ::helQueryMemoryPressure.
+struct HelMemoryPressureInfo {
+	uint64_t totalBytes;
+	uint64_t freeBytes;
+	//! Memory used by the kernel's page cache (which the kernel can evict).
+	uint64_t cachedBytes;
+	//! Number of bytes that the kernel evicted so far.
+	uint64_t evictedBytes;
+	//! Current level with respect to the default watermarks.
+	uint32_t level;
+	uint32_t reserved;
+	//! Default watermarks, in bytes of free memory.
+	uint64_t defaultLowFreeBytes;
+	uint64_t defaultCriticalFreeBytes;
+	//! Sums of HelSpaceMemoryInfo::anonymousBytes and HelSpaceMemoryInfo::fileBytes
+	//! over all address spaces.
+	uint64_t mappedAnonymousBytes;
+	uint64_t mappedFileBytes;
+};
+
+//! Resident memory of an address space, see ::helQuerySpaceMemory.
+//! Pages that are mapped more than once are counted more than once.
+struct HelSpaceMemoryInfo {
+	//! Bytes of mapped memory that is not part of the page cache.
+	uint64_t anonymousBytes;
+	//! Bytes of mapped page cache memory (i.e., of managed memory).
+	uint64_t fileBytes;
+};
+
+//! Physically contiguous run of memory, see ::helQueryPhysicalRanges.
+struct HelPhysicalRange {
+	//! Physical address of the first byte.
+	uintptr_t physical;
+	//! Length of the run in bytes.
+	size_t length;
+};
+
+//! Maximal number of futexes that ::helFutexWaitVector can wait on.
+enum {
+	kHelMaxFutexWaitVector = 128
+};
+
+//! Futex that ::helFutexWaitVector waits on.
+struct HelFutexWaitEntry {
+	//! Pointer that identifies the futex.
+	int *pointer;
+	//! Expected value of the futex.
+	int expected;
+};
+
+//! System-wide event counters, summed over all CPUs.
+struct HelKernelStats {
+	//! Number of times that a CPU switched to a (possibly different) thread.
+	uint64_t contextSwitches;
+	//! Number of IPIs sent to other CPUs (wakeups, shootdowns and load balancing).
+	uint64_t ipisSent;
+	//! Number of page faults on read accesses.
+	uint64_t readFaults;
+	//! Number of page faults on write accesses.
+	uint64_t writeFaults;
+	//! Number of page faults on instruction fetches.
+	uint64_t executeFaults;
+	//! Number of page faults that could not be resolved.
+	uint64_t unresolvedFaults;
+	//! Number of TLB shootdowns that were requested.
+	uint64_t shootdowns;
+	//! Number of IPC submissions (i.e., calls to ::helSubmitAsync).
+	uint64_t ipcSubmits;
+	//! Number of calls to ::helFutexWait and ::helFutexWaitVector.
+	uint64_t futexWaits;
+	//! Number of calls to ::helFutexWake and ::helFutexWakeCount.
+	uint64_t futexWakes;
+	//! Number of calls into the physical memory allocator.
+	uint64_t physicalAllocations;
+	//! Number of calls to free physical memory.
+	uint64_t physicalFrees;
+	//! Number of times that the kernel had to wait for user space to supply
+	//! a chunk to an IPC queue before it could post a completion.
+	uint64_t ipcQueueStalls;
+	//! Number of context switches that directly ran a thread that was woken up
+	//! by the previous thread before it blocked (e.g., the receiver of an IPC message).
+	uint64_t handoffSwitches;
 };
 
 enum {
@@ -586,6 +854,28 @@ struct HelVmexitReason {
 	size_t flags;
 };
 
+//! Flags for HelVmIoTrigger::flags.
+enum HelVmIoTriggerFlags {
+	//! Only match writes of HelVmIoTrigger::value.
+	//! Otherwise, all writes to the port match.
+	kHelVmIoTriggerMatchValue = 1,
+};
+
+//! Guest port write that is handled by the kernel, see ::helAddVmIoTrigger.
+struct HelVmIoTrigger {
+	//! I/O port that is written by the guest.
+	uint16_t port;
+	//! Size of the write in bytes (1, 2 or 4). Zero matches writes of all sizes.
+	uint8_t size;
+	uint8_t reserved;
+	//! See ::HelVmIoTriggerFlags.
+	uint32_t flags;
+	//! Value that is matched if ::kHelVmIoTriggerMatchValue is set.
+	uint32_t value;
+	//! Bits that are raised on the event.
+	uint32_t bits;
+};
+
 // see RFC 5424
 enum HelLogSeverity {
 	kHelLogSeverityEmergency,
@@ -649,6 +939,21 @@ HEL_C_LINKAGE HelError helCreateUniverse(HelHandle *handle);
 HEL_C_LINKAGE HelError helTransferDescriptor(HelHandle handle, HelHandle universeHandle,
 		HelHandle *outHandle);
 
+//! Copies multiple descriptors from the current universe to another universe at once.
+//!
+//! Either all descriptors are copied or none of them (unless writing @p outHandles faults).
+//! @param[in] handles
+//!    	Array of handles to the descriptors to transfer.
+//! @param[in] count
+//!    	Number of elements in @p handles.
+//! @param[in] universeHandle
+//!    	Handle to the destination universe.
+//! @param[out] outHandles
+//!    	Array of @p count elements that receives the handles to the copied descriptors
+//!    	(valid in the universe specified by @p universeHandle), in the order of @p handles.
+HEL_C_LINKAGE HelError helTransferDescriptors(const HelHandle *handles, size_t count,
+		HelHandle universeHandle, HelHandle *outHandles);
+
 HEL_C_LINKAGE HelError helDescriptorInfo(HelHandle handle, struct HelDescriptorInfo *info);
 
 //! Returns the credentials associated with a given descriptor.
@@ -666,6 +971,19 @@ HEL_C_LINKAGE HelError helGetCredentials(HelHandle handle, uint32_t flags,
 //!    	Handle to be closed.
 HEL_C_LINKAGE HelError helCloseDescriptor(HelHandle universeHandle, HelHandle handle);
 
+//! Closes multiple descriptors at once.
+//!
+//! All handles are processed, even if some of them do not refer to a descriptor.
+//! In that case, ::kHelErrNoDescriptor is returned after all other handles are closed.
+//! @param[in] universeHandle
+//!    	Handle to the universe containing @p handles.
+//! @param[in] handles
+//!    	Array of handles to be closed.
+//! @param[in] count
+//!    	Number of elements in @p handles.
+HEL_C_LINKAGE HelError helCloseDescriptors(HelHandle universeHandle, const HelHandle *handles,
+		size_t count);
+
 //! @}
 //! @name Management of IPC Queues
 //! @{
@@ -678,6 +996,23 @@ HEL_C_LINKAGE HelError helCloseDescriptor(HelHandle universeHandle, HelHandle ha
 HEL_C_LINKAGE HelError helCreateQueue(const struct HelQueueParameters *params,
 		HelHandle *handle);
 
+//! Adds chunks to an IPC queue.
+//!
+//! The chunks are appended to the memory of the queue and have the chunk size
+//! that the queue was created with. They are numbered consecutively after the
+//! existing chunks. The total number of chunks can not exceed the size of
+//! the index queue (i.e., 1 << ringShift).
+//! @param[in] queueHandle
+//!    	Handle to the queue.
+//! @param[in] numChunks
+//!    	Number of chunks to add.
+//! @param[out] offset
+//!    	Offset of the first new chunk within the memory of the queue.
+//!    	The remaining chunks follow at a stride of sizeof(HelChunk) plus the
+//!    	chunk size, rounded up to a multiple of 64 bytes.
+HEL_C_LINKAGE HelError helAddQueueChunks(HelHandle queueHandle, unsigned int numChunks,
+		uintptr_t *offset);
+
 //! Cancels an ongoing asynchronous operation.
 //! @param[in] queueHandle
 //!    	Handle to the queue that the operation was submitted to.
@@ -693,6 +1028,8 @@ HEL_C_LINKAGE HelError helCancelAsync(HelHandle queueHandle, uint64_t asyncId);
 //! @param[in] size
 //!    	Size of the memory object in bytes.
 //!    	Must be aligned to the system's page size.
+//! @param[in] flags
+//!    	Combination of ::HelAllocFlags.
 //! @param[in] restrictions
 //!    	Specifies restrictions for the kernel's memory allocator.
 //!    	May be @p NULL if there are no restrictions.
@@ -785,6 +1122,8 @@ HEL_C_LINKAGE HelError helCreateSpace(HelHandle *handle);
 //! Maps memory objects into an address space.
 //! @param[in] memoryHandle
 //!     Handle to the memory object.
+//!     Can be ::kHelClockMemory to map the kernel's clock page (see ::HelClockPage)
+//!     read-only.
 //! @param[in] spaceHandle
 //!     Handle to the address space (see ::helCreateSpace).
 //! @param[in] pointer
@@ -848,8 +1187,78 @@ HEL_C_LINKAGE HelError helSubmitSynchronizeSpace(HelHandle spaceHandle,
 //!    	Must be aligned to the system's page size.
 HEL_C_LINKAGE HelError helUnmapMemory(HelHandle spaceHandle, void *pointer, size_t size);
 
+//! Drops the private pages of a range of an address space.
+//!
+//! The range stays mapped. Subsequent accesses observe the contents of the
+//! underlying memory object, i.e., zeros for copy-on-write mappings of ::kHelZeroMemory.
+//! Mappings that do not own private pages are not affected.
+//! Pages that are locked (e.g., by ::helSubmitLockMemoryView) retain their contents.
+//! @param[in] spaceHandle
+//!     Handle to the address space containing @p pointer.
+//! @param[in] pointer
+//!     Pointer to the range that is decommitted.
+//!    	Must be aligned to the system's page size.
+//! @param[in] size
+//!    	Size of the range that is decommitted.
+//!    	Must be aligned to the system's page size.
+HEL_C_LINKAGE HelError helDecommitMemory(HelHandle spaceHandle, void *pointer, size_t size);
+
+//! Prefaults a range of an address space.
+//!
+//! This has the same effect as touching each page of the range,
+//! but it avoids taking a page fault for each page.
+//! Inaccessible mappings are skipped.
+//! @param[in] spaceHandle
+//!     Handle to the address space containing @p pointer.
+//! @param[in] pointer
+//!     Pointer to the range that is populated.
+//!    	Must be aligned to the system's page size.
+//! @param[in] size
+//!    	Size of the range that is populated.
+//!    	Must be aligned to the system's page size.
+//! @param[in] flags
+//!     See ::HelPopulateFlags.
+HEL_C_LINKAGE HelError helPopulateMemory(HelHandle spaceHandle, void *pointer, size_t size,
+		uint32_t flags);
+
+//! Query the amount of memory that is resident in an address space.
+//!
+//! The kernel updates these counters whenever pages are mapped or unmapped.
+//! @param[in] spaceHandle
+//!     Handle to the address space.
+//! @param[out] info
+//!     Resident memory of the address space.
+HEL_C_LINKAGE HelError helQuerySpaceMemory(HelHandle spaceHandle,
+		struct HelSpaceMemoryInfo *info);
+
 HEL_C_LINKAGE HelError helPointerPhysical(const void *pointer, uintptr_t *physical);
 
+//! Query the physical memory that backs a range of memory.
+//!
+//! Unlike ::helPointerPhysical, this translates a whole range in a single call.
+//! Pages are made present (e.g., allocated) as needed. Physically contiguous pages
+//! are coalesced into a single range.
+//! @param[in] handle
+//!     Handle to a memory object or a slice of a memory object.
+//!     If this is ::kHelNullHandle, @p address is a virtual address
+//!     in the address space of the calling thread.
+//! @param[in] address
+//!     Offset into the memory object or virtual address of the range.
+//!     Does not need to be page aligned.
+//! @param[in] size
+//!     Size of the range in bytes.
+//! @param[out] ranges
+//!     Array that receives the physical ranges, in order of their offsets.
+//! @param[in] maxRanges
+//!     Capacity of @p ranges.
+//! @param[out] numRanges
+//!     Number of ranges that were written to @p ranges.
+//! @return
+//!     ::kHelErrBufferTooSmall if @p ranges cannot store all ranges.
+//!     In this case, the first @p maxRanges ranges are written.
+HEL_C_LINKAGE HelError helQueryPhysicalRanges(HelHandle handle, uintptr_t address,
+		size_t size, struct HelPhysicalRange *ranges, size_t maxRanges, size_t *numRanges);
+
 //! Load memory (i.e., bytes) from a descriptor.
 //!
 //! This is an asynchronous operation.
@@ -942,6 +1351,55 @@ HEL_C_LINKAGE HelError helQueryThreadStats(HelHandle handle, struct HelThreadSta
 //!     New priority value of the thread.
 HEL_C_LINKAGE HelError helSetPriority(HelHandle handle, int priority);
 
+//! Move a thread into the latency scheduling class.
+//!
+//! Threads in the latency class run before all threads of the regular class
+//! as long as they stay within their runtime budget.
+//! Once a thread exhausts its budget, it is scheduled with its regular priority
+//! until its next period starts. This is intended for latency-sensitive
+//! threads such as IRQ handling threads of drivers.
+//! Use ::helSetPriority to move a thread back into the regular class.
+//! @param[in] handle
+//!     Handle to the thread.
+//! @param[in] priority
+//!     Priority of the thread within the latency class.
+//! @param[in] budget
+//!     Maximal runtime of the thread per period (in nanoseconds).
+//!     Must be non-zero and smaller than @p period.
+//! @param[in] period
+//!     Length of the period (in nanoseconds).
+HEL_C_LINKAGE HelError helSetLatencyClass(HelHandle handle, int priority,
+		uint64_t budget, uint64_t period);
+
+//! Create a schedule group.
+//!
+//! Schedule groups form a hierarchy. On each CPU, groups receive a share of CPU time
+//! that is proportional to their weight; this share is divided among
+//! the threads and subgroups of the group. Additionally, the run time of a group
+//! can be limited to a quota per period (see ::helConfigureScheduleGroup).
+//! @param[in] parentHandle
+//!     Handle to the parent group or ::kHelNullHandle to create a top-level group.
+//! @param[out] handle
+//!     Handle to the new group.
+HEL_C_LINKAGE HelError helCreateScheduleGroup(HelHandle parentHandle, HelHandle *handle);
+
+//! Set the weight and the bandwidth limit of a schedule group.
+//! @param[in] handle
+//!     Handle to the group.
+//! @param[in] params
+//!     New parameters of the group.
+HEL_C_LINKAGE HelError helConfigureScheduleGroup(HelHandle handle,
+		const struct HelScheduleGroupParams *params);
+
+//! Move a thread into a schedule group.
+//!
+//! The change takes effect the next time that the thread is scheduled.
+//! @param[in] handle
+//!     Handle to the thread.
+//! @param[in] groupHandle
+//!     Handle to the group or ::kHelNullHandle to move the thread to the top level.
+HEL_C_LINKAGE HelError helSetScheduleGroup(HelHandle handle, HelHandle groupHandle);
+
 //! Yields the current thread.
 HEL_C_LINKAGE HelError helYield();
 
@@ -994,6 +1452,21 @@ HEL_C_LINKAGE HelError helLoadRegisters(HelHandle handle, int set, void *image);
 //!     Copy of the register image.
 HEL_C_LINKAGE HelError helStoreRegisters(HelHandle handle, int set, const void *image);
 
+//! Push a signal frame to the stack of a suspended thread
+//! and redirect the thread to a signal handler.
+//!
+//! This is equivalent to loading the ::kHelRegsSignal and ::kHelRegsSimd images,
+//! writing them to the stack of the thread and storing the registers that
+//! enter the handler, but it does not require a round trip per step.
+//! @param[in] handle
+//!     Handle to the thread.
+//! @param[in] frame
+//!     Description of the frame.
+//! @param[out] address
+//!     Address of the frame on the stack of the thread.
+HEL_C_LINKAGE HelError helPushSignalFrame(HelHandle handle,
+		const struct HelSignalFrame *frame, uintptr_t *address);
+
 //! Query register-related information.
 //! @param[in] set
 //      Register set to query information for.
@@ -1012,6 +1485,14 @@ HEL_C_LINKAGE HelError helReadGsBase(void **pointer);
 //! Gets the index of the cpu which the calling thread is running on.
 HEL_C_LINKAGE HelError helGetCurrentCpu(int *cpu);
 
+//! Query system-wide kernel statistics.
+//!
+//! The counters are maintained per CPU and summed up on each call;
+//! values are monotonically increasing but not synchronized with each other.
+//! @param[out] stats
+//!     Statistics of the kernel.
+HEL_C_LINKAGE HelError helQueryKernelStats(struct HelKernelStats *stats);
+
 //! Read the system-wide monotone clock.
 //!
 //! @param[out] counter
@@ -1028,10 +1509,51 @@ HEL_C_LINKAGE HelError helGetClock(uint64_t *counter);
 HEL_C_LINKAGE HelError helSubmitAwaitClock(uint64_t counter,
 		HelHandle queue, uintptr_t context, uint64_t *asyncId);
 
+//! Wait until time passes, allowing the kernel to delay the wakeup.
+//!
+//! This is an asynchronous operation.
+//! The operation completes at some point between @p counter
+//! and @p counter + @p slack. This allows the kernel to handle
+//! timers with nearby deadlines using a single timer interrupt.
+//! @param[in] counter
+//!     Deadline (absolute, see ::helGetClock).
+//! @param[in] slack
+//!     Maximal delay (in nanoseconds) after the deadline.
+//! @param[out] asyncId
+//!     ID to identify the asynchronous operation (absolute, see ::helCancelAsync).
+HEL_C_LINKAGE HelError helSubmitAwaitClockSlack(uint64_t counter, uint64_t slack,
+		HelHandle queue, uintptr_t context, uint64_t *asyncId);
+
 HEL_C_LINKAGE HelError helCreateVirtualizedCpu(HelHandle handle, HelHandle *out_handle);
 
 HEL_C_LINKAGE HelError helRunVirtualizedCpu(HelHandle handle, struct HelVmexitReason *reason);
 
+//! Lets the kernel handle guest writes to an I/O port.
+//!
+//! Matching port writes of all virtualized CPUs of the space raise the bits of the
+//! event and resume the guest directly, i.e., ::helRunVirtualizedCpu does not return.
+//! This is intended for doorbells such as virtio queue notifications.
+//! If multiple triggers match a write, only one of them raises its event.
+//! @param[in] spaceHandle
+//!     Handle to the virtualized space (see ::helCreateVirtualizedSpace).
+//! @param[in] trigger
+//!     Writes that are matched and bits that are raised.
+//! @param[in] eventHandle
+//!     Handle to a bitset event (see ::helCreateBitsetEvent).
+//!     Returns ::kHelErrAlreadyExists if a trigger with the same match already exists
+//!     and ::kHelErrOutOfBounds if the space has too many triggers.
+HEL_C_LINKAGE HelError helAddVmIoTrigger(HelHandle spaceHandle,
+		const struct HelVmIoTrigger *trigger, HelHandle eventHandle);
+
+//! Removes a trigger that was added by ::helAddVmIoTrigger.
+//! @param[in] spaceHandle
+//!     Handle to the virtualized space.
+//! @param[in] trigger
+//!     Trigger with the same port, size, flags and value as the trigger that is removed.
+//!     HelVmIoTrigger::bits is ignored.
+HEL_C_LINKAGE HelError helRemoveVmIoTrigger(HelHandle spaceHandle,
+		const struct HelVmIoTrigger *trigger);
+
 HEL_C_LINKAGE HelError helGetRandomBytes(void *buffer, size_t wantedSize, size_t *actualSize);
 
 //! Get a thread's CPU affinity mask.
@@ -1077,6 +1599,18 @@ HEL_C_LINKAGE HelError helCreateStream(HelHandle *lane1, HelHandle *lane2, uint3
 HEL_C_LINKAGE HelError helSubmitAsync(HelHandle handle, const struct HelAction *actions,
 		size_t count, HelHandle queue, uintptr_t context, uint32_t flags);
 
+//! Submits all pending entries of a queue's submission ring.
+//!
+//! Each entry is processed as if it was passed to ::helSubmitAsync;
+//! completions are posted to the queue itself. Entries that user space
+//! produces while this call runs may or may not be processed.
+//! If an entry cannot be submitted, processing stops and the error
+//! is returned; the entry is consumed nevertheless.
+//! @param[in] queue
+//!     Handle to the queue. The queue must have been created with
+//!     ::kHelQueueSubmissionRing.
+HEL_C_LINKAGE HelError helSubmitRing(HelHandle queue);
+
 HEL_C_LINKAGE HelError helShutdownLane(HelHandle handle);
 
 //! Create a token object.
@@ -1107,6 +1641,51 @@ HEL_C_LINKAGE HelError helFutexWait(int *pointer, int expected, int64_t deadline
 //!     Pointer that identifies the futex.
 HEL_C_LINKAGE HelError helFutexWake(int *pointer);
 
+//! Waits on multiple futexes until any of them is woken up.
+//!
+//! This is similar to Linux' futex_waitv(). The function returns immediately
+//! if any futex does not match its expected value.
+//! @param[in] entries
+//!     Array of futexes and their expected values.
+//! @param[in] count
+//!     Number of entries; must be between 1 and ::kHelMaxFutexWaitVector.
+//! @param[in] deadline
+//!     Timeout (in absolute monotone time, see ::helGetClock).
+//! @param[out] index
+//!     Index of the futex that woke up the thread or that did not match its
+//!     expected value. Set to @p count if no futex woke up the thread
+//!     (i.e., if the deadline expired).
+HEL_C_LINKAGE HelError helFutexWaitVector(const struct HelFutexWaitEntry *entries,
+		size_t count, int64_t deadline, size_t *index);
+
+//! Wakes up a limited number of waiters of a futex.
+//! @param[in] pointer
+//!     Pointer that identifies the futex.
+//! @param[in] count
+//!     Maximal number of waiters that are woken up.
+//! @param[out] woken
+//!     Number of waiters that were woken up.
+HEL_C_LINKAGE HelError helFutexWakeCount(int *pointer, unsigned int count,
+		unsigned int *woken);
+
+//! Wakes up some waiters of a futex and moves other waiters to a different futex.
+//!
+//! The operation is only performed if the futex pointed to by @p pointer
+//! matches @p expected. This is similar to Linux' FUTEX_CMP_REQUEUE.
+//! @param[in] pointer
+//!     Pointer that identifies the futex.
+//! @param[in] expected
+//!     Expected value of the futex. If the value does not match,
+//!     this function fails with ::kHelErrCancelled and does nothing.
+//! @param[in] target
+//!     Pointer that identifies the futex that waiters are moved to.
+//! @param[in] wakeCount
+//!     Maximal number of waiters that are woken up.
+//! @param[in] requeueCount
+//!     Maximal number of waiters that are moved to @p target.
+HEL_C_LINKAGE HelError helFutexRequeue(int *pointer, int expected, int *target,
+		unsigned int wakeCount, unsigned int requeueCount);
+
 //! @}
 //! @name Event Handling
 //! @{
@@ -1126,6 +1705,24 @@ HEL_C_LINKAGE HelError helCreateBitsetEvent(HelHandle *handle);
 //!     Handle to the event that will be raised.
 HEL_C_LINKAGE HelError helRaiseEvent(HelHandle handle);
 
+//! Create a bitset event that reports changes of the memory pressure level.
+//!
+//! Whenever the level changes, bit (1 << level) is raised (see ::HelMemoryPressure).
+//! If the pressure is already elevated, the corresponding bit is raised immediately.
+//! The kernel samples the amount of free memory periodically, so the event can lag
+//! behind allocations by a few milliseconds.
+//! @param[in] watermarks
+//!     Watermarks that determine the level. May be NULL to use the defaults.
+//! @param[out] handle
+//!     Handle to the new event. Can be awaited using ::helSubmitAwaitEvent.
+HEL_C_LINKAGE HelError helCreateMemoryPressureEvent(
+		const struct HelMemoryPressureWatermarks *watermarks, HelHandle *handle);
+
+//! Query the current memory usage and pressure level.
+//! @param[out] info
+//!     Current memory usage.
+HEL_C_LINKAGE HelError helQueryMemoryPressure(struct HelMemoryPressureInfo *info);
+
 HEL_C_LINKAGE HelError helAccessIrq(int number, HelHandle *handle);
 
 HEL_C_LINKAGE HelError helAcknowledgeIrq(HelHandle handle, uint32_t flags, uint64_t sequence);
@@ -1142,6 +1739,23 @@ HEL_C_LINKAGE HelError helSubmitAwaitEvent(HelHandle handle, uint64_t sequence,
 
 HEL_C_LINKAGE HelError helAutomateIrq(HelHandle handle, uint32_t flags, HelHandle kernlet);
 
+//! Enables or disables interrupt coalescing for an edge-triggered IRQ.
+//!
+//! By default, an IRQ stays in service after it is delivered until it is
+//! re-armed by ::helAcknowledgeIrq; drivers can keep polling their device
+//! in the meantime. With coalescing, the kernel acknowledges the IRQ itself
+//! and only completes ::helSubmitAwaitEvent once @p maxEvents IRQs were raised
+//! or @p delay nanoseconds after the first pending IRQ. Acknowledging
+//! the IRQ is a no-op in this mode.
+//! @param[in] handle
+//!     Handle to the IRQ.
+//! @param[in] maxEvents
+//!     Maximal number of IRQs that are coalesced. Zero disables coalescing.
+//! @param[in] delay
+//!     Maximal delay (in nanoseconds) before pending IRQs are delivered.
+//!     Must be non-zero if @p maxEvents is greater than one.
+HEL_C_LINKAGE HelError helModerateIrq(HelHandle handle, unsigned int maxEvents, uint64_t delay);
+
 //! @}
 //! @name Input/Output
 //! @{
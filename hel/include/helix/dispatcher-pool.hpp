@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <async/execution.hpp>
+#include <helix/ipc.hpp>
+
+namespace helix {
+
+// Runs coroutines on a fixed number of threads. Each thread owns a Dispatcher (and thus
+// a HelQueue); completions of operations are delivered to the thread whose Dispatcher
+// the operation was submitted to, i.e., usually to the thread that submitted it.
+// Coroutines move to the pool by awaiting schedule(). Each thread has its own run queue;
+// idle threads steal ready coroutines from the run queues of other threads.
+//
+// Example:
+//	helix::DispatcherPool pool{4};
+//	async::detach([&] () -> async::result<void> {
+//		co_await pool.schedule();
+//		// Now running on one of the pool's threads.
+//	}());
+//
+// Ready coroutines take precedence over completions, hence coroutines should not yield
+// to the pool in a loop without submitting operations. Pools are never destructed.
+struct DispatcherPool {
+	struct Task {
+		virtual void run() = 0;
+
+	protected:
+		~Task() = default;
+	};
+
+	template<typename Receiver>
+	struct ScheduleOperation final : private Task {
+		ScheduleOperation(DispatcherPool *pool, Receiver receiver)
+		: pool_{pool}, receiver_{std::move(receiver)} { }
+
+		ScheduleOperation(const ScheduleOperation &) = delete;
+
+		ScheduleOperation &operator= (const ScheduleOperation &) = delete;
+
+		void start() {
+			pool_->post(this);
+		}
+
+	private:
+		void run() override {
+			async::execution::set_value(receiver_);
+		}
+
+		DispatcherPool *pool_;
+		Receiver receiver_;
+	};
+
+	struct [[nodiscard]] ScheduleSender {
+		using value_type = void;
+
+		template<typename Receiver>
+		ScheduleOperation<Receiver> connect(Receiver receiver) {
+			return {pool, std::move(receiver)};
+		}
+
+		DispatcherPool *pool;
+	};
+
+	friend async::sender_awaiter<ScheduleSender> operator co_await (ScheduleSender sender) {
+		return {sender};
+	}
+
+	// Starts numThreads threads. Returns once all of them have set up their queues.
+	explicit DispatcherPool(unsigned int numThreads);
+
+	DispatcherPool(const DispatcherPool &) = delete;
+
+	DispatcherPool &operator= (const DispatcherPool &) = delete;
+
+	unsigned int numThreads() {
+		return _workers.size();
+	}
+
+	// Dispatcher of the i-th thread. Submissions to this Dispatcher complete on
+	// that thread (see helix_ng::pinLane()).
+	Dispatcher &dispatcher(unsigned int i) {
+		return *_workers[i]->dispatcher;
+	}
+
+	// Index of the calling thread within the pool or -1 if it does not belong to the pool.
+	int currentThread();
+
+	// Resumes the awaiting coroutine on one of the pool's threads.
+	ScheduleSender schedule() {
+		return {this};
+	}
+
+	// Runs the task on one of the pool's threads. If called from a thread of the pool,
+	// the task is queued on that thread (but it might still be stolen by an idle thread).
+	void post(Task *task);
+
+private:
+	struct Worker : private Context {
+		friend struct DispatcherPool;
+
+		Worker(DispatcherPool *pool, unsigned int index)
+		: pool{pool}, index{index} { }
+
+	private:
+		// Wake-ups are posted as asynchronous NOPs; there is nothing to do on completion.
+		void complete(ElementHandle) override { }
+
+		DispatcherPool *pool;
+		unsigned int index;
+		Dispatcher *dispatcher = nullptr;
+
+		std::mutex mutex;
+		std::deque<Task *> tasks;
+
+		// Set while the thread (potentially) waits for completions.
+		std::atomic<bool> sleeping{false};
+	};
+
+	// Worker of the calling thread (if it belongs to any pool).
+	static thread_local Worker *_currentWorker;
+
+	[[noreturn]] void _runWorker(Worker *worker);
+
+	Task *_takeTask(Worker *worker);
+	void _wake(Worker *worker);
+
+	std::vector<std::unique_ptr<Worker>> _workers;
+	std::atomic<unsigned int> _nextWorker{0};
+};
+
+} // namespace helix
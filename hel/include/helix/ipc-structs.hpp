@@ -475,6 +475,11 @@ struct RecvBuffer {
 	size_t size;
 };
 
+struct RecvBufferSg {
+	const HelSgItem *buf;
+	size_t size;
+};
+
 struct RecvInline { };
 
 struct PushDescriptor {
@@ -562,10 +567,25 @@ inline auto sendBufferSg(const HelSgItem *data, size_t length) {
 	return SendBufferSg{data, length};
 }
 
+// The kernel copies the SG list on submission; only the buffers that it refers to
+// need to outlive the operation.
+inline auto sendBufferV(std::span<const HelSgItem> items) {
+	return SendBufferSg{items.data(), items.size()};
+}
+
 inline auto recvBuffer(void *data, size_t length) {
 	return RecvBuffer{data, length};
 }
 
+inline auto recvBufferSg(const HelSgItem *data, size_t length) {
+	return RecvBufferSg{data, length};
+}
+
+// Scatters the received data across the buffers in the given order.
+inline auto recvBufferV(std::span<const HelSgItem> items) {
+	return RecvBufferSg{items.data(), items.size()};
+}
+
 inline auto recvInline() {
 	return RecvInline{};
 }
@@ -705,6 +725,16 @@ inline auto createActionsArrayFor(bool chain, const RecvBuffer &item) {
 	return frg::array<HelAction, 1>{action};
 }
 
+inline auto createActionsArrayFor(bool chain, const RecvBufferSg &item) {
+	HelAction action{};
+	action.type = kHelActionRecvToBufferSg;
+	action.flags = chain ? kHelItemChain : 0;
+	action.buffer = const_cast<HelSgItem *>(item.buf);
+	action.length = item.size;
+
+	return frg::array<HelAction, 1>{action};
+}
+
 inline auto createActionsArrayFor(bool chain, const RecvInline &) {
 	HelAction action{};
 	action.type = kHelActionRecvInline;
@@ -800,6 +830,10 @@ inline auto resultTypeTuple(const RecvBuffer &) {
 	return frg::tuple<RecvBufferResult>{};
 }
 
+inline auto resultTypeTuple(const RecvBufferSg &) {
+	return frg::tuple<RecvBufferResult>{};
+}
+
 inline auto resultTypeTuple(const RecvInline &) {
 	return frg::tuple<RecvInlineResult>{};
 }
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <tuple>
 #include <array>
 
@@ -142,6 +146,8 @@ struct CurrentDispatcherToken {
 
 inline constexpr CurrentDispatcherToken currentDispatcher;
 
+// Each thread has its own Dispatcher (see global()). Completions are dispatched by the
+// thread that owns the Dispatcher but ElementHandles can be released by any thread.
 struct Dispatcher {
 	friend struct ElementHandle;
 
@@ -160,31 +166,76 @@ private:
 	};
 
 public:
-	static constexpr int sizeShift = 9;
+	// Geometry of the HelQueue.
+	struct Parameters {
+		// The index queue has 1 << ringShift entries; this bounds the number of chunks.
+		unsigned int ringShift = 9;
+		// Number of chunks that are allocated when the queue is created.
+		unsigned int numChunks = 16;
+		// If the kernel has to wait for a free chunk, more chunks are added
+		// to the queue, up to this limit.
+		unsigned int maxChunks = 64;
+		size_t chunkSize = 4096;
+	};
+
+	struct Statistics {
+		// Number of chunks that are currently allocated.
+		unsigned int numChunks;
+		// Number of times that the kernel had to wait for a free chunk.
+		uint64_t numStalls;
+	};
 
 	static Dispatcher &global();
 
 	Dispatcher()
-	: _handle{kHelNullHandle}, _queue{nullptr},
-			_activeChunks{0}, _retrieveIndex{0}, _nextIndex{0}, _lastProgress{0} { }
+	: _handle{kHelNullHandle}, _queue{nullptr}, _numChunks{0}, _reservedPerChunk{0},
+			_useRing{false}, _ring{nullptr}, _ringTail{0},
+			_activeChunks{0}, _hadWaiters{false}, _numStalls{0},
+			_retrieveIndex{0}, _nextIndex{0}, _lastProgress{0} { }
 
 	Dispatcher(const Dispatcher &) = delete;
 
 	Dispatcher &operator= (const Dispatcher &) = delete;
 
+	// Must be called before the queue is created by acquire().
+	void configure(const Parameters &parameters) {
+		assert(!_handle);
+		assert(parameters.numChunks && parameters.numChunks <= parameters.maxChunks);
+		assert(parameters.maxChunks <= (1u << parameters.ringShift));
+		_parameters = parameters;
+	}
+
+	Statistics statistics() {
+		std::lock_guard lock{_mutex};
+		return {.numChunks = _numChunks, .numStalls = _numStalls};
+	}
+
+	// Makes the thread that owns this Dispatcher defer its submissions until the next
+	// wait() (or until the ring fills up) and pass them to the kernel in a single syscall.
+	// Only suitable for threads that always return to wait() instead of blocking
+	// synchronously. Must be called before the queue is created by acquire().
+	void enableSubmissionRing() {
+		assert(!_handle);
+		_useRing = true;
+	}
+
 	HelHandle acquire() {
 		if(!_handle) {
 			HelQueueParameters params {
-				.flags = 0,
-				.ringShift = sizeShift,
-				.numChunks = 16,
-				.chunkSize = 4096,
+				.flags = _useRing ? uint32_t{kHelQueueSubmissionRing} : 0,
+				.ringShift = _parameters.ringShift,
+				.numChunks = _parameters.numChunks,
+				.chunkSize = _parameters.chunkSize,
 			};
 			HEL_CHECK(helCreateQueue(&params, &_handle));
 
-			auto chunksOffset = (sizeof(HelQueue) + (sizeof(int) << sizeShift) + 63) & ~size_t(63);
+			auto chunksOffset = (sizeof(HelQueue) + (sizeof(int) << params.ringShift) + 63)
+					& ~size_t(63);
 			auto reservedPerChunk = (sizeof(HelChunk) + params.chunkSize + 63) & ~size_t(63);
-			auto overallSize = chunksOffset + params.numChunks * reservedPerChunk;
+			auto ringOffset = chunksOffset + params.numChunks * reservedPerChunk;
+			auto overallSize = ringOffset;
+			if(_useRing)
+				overallSize += sizeof(HelSubmissionRing);
 
 			void *mapping;
 			HEL_CHECK(helMapMemory(_handle, kHelNullHandle, nullptr,
@@ -192,44 +243,81 @@ public:
 					kHelMapProtRead | kHelMapProtWrite, &mapping));
 
 			_queue = reinterpret_cast<HelQueue *>(mapping);
+			_reservedPerChunk = reservedPerChunk;
+			_chunks = std::make_unique<HelChunk *[]>(_parameters.maxChunks);
+			_refCounts = std::make_unique<std::atomic<int>[]>(_parameters.maxChunks);
 			auto chunksPtr = reinterpret_cast<std::byte *>(mapping) + chunksOffset;
-			for(unsigned int i = 0; i < 16; ++i)
+			for(unsigned int i = 0; i < params.numChunks; ++i)
 				_chunks[i] = reinterpret_cast<HelChunk *>(chunksPtr + i * reservedPerChunk);
+			_numChunks = params.numChunks;
+			if(_useRing)
+				_ring = reinterpret_cast<HelSubmissionRing *>(
+						reinterpret_cast<std::byte *>(mapping) + ringOffset);
 		}
 
 		return _handle;
 	}
 
-	void wait() {
-		while(true) {
-			// TODO: Initialize all chunks when setting up the queue.
-			if(_retrieveIndex == _nextIndex) {
-				assert(_activeChunks < 16);
-
-				// Reset and enqueue the new chunk.
-				_chunks[_activeChunks]->progressFutex = 0;
+	// Equivalent to helSubmitAsync() on this Dispatcher's queue, except that the
+	// submission may be deferred (see enableSubmissionRing()).
+	void submitAsync(HelHandle lane, const HelAction *actions, size_t count, uintptr_t context) {
+		auto handle = acquire();
+
+		// Other threads cannot know when the owner calls wait() next.
+		if(_ring && this == &global()) {
+			if(count <= kHelSubmissionMaxActions) {
+				if(_ringTail - __atomic_load_n(&_ring->head, __ATOMIC_ACQUIRE)
+						== kHelSubmissionRingSize)
+					flushSubmissions();
+
+				auto entry = &_ring->entries[_ringTail % kHelSubmissionRingSize];
+				entry->handle = lane;
+				entry->numActions = count;
+				entry->flags = 0;
+				entry->context = context;
+				memcpy(entry->actions, actions, count * sizeof(HelAction));
+				_ringTail++;
+				__atomic_store_n(&_ring->tail, _ringTail, __ATOMIC_RELEASE);
+				return;
+			}
 
-				_queue->indexQueue[_nextIndex & ((1 << sizeShift) - 1)] = _activeChunks;
-				_nextIndex = ((_nextIndex + 1) & kHelHeadMask);
-				_wakeHeadFutex();
+			// Preserve the order of submissions.
+			flushSubmissions();
+		}
 
-				_refCounts[_activeChunks] = 1;
-				_activeChunks++;
-				continue;
-			}else if (_hadWaiters && _activeChunks < (1 << sizeShift)) {
-				assert(_activeChunks < 16);
+		HEL_CHECK(helSubmitAsync(lane, actions, count, handle, context, 0));
+	}
 
-				// Reset and enqueue the new chunk.
-				_chunks[_activeChunks]->progressFutex = 0;
+	// Passes all deferred submissions to the kernel.
+	void flushSubmissions() {
+		if(!_ring)
+			return;
+		if(_ringTail == __atomic_load_n(&_ring->head, __ATOMIC_ACQUIRE))
+			return;
+		// The ring never holds more entries than the kernel processes per call.
+		HEL_CHECK(helSubmitRing(_handle));
+		assert(_ringTail == __atomic_load_n(&_ring->head, __ATOMIC_ACQUIRE));
+	}
 
-				_queue->indexQueue[_nextIndex & ((1 << sizeShift) - 1)] = _activeChunks;
-				_nextIndex = ((_nextIndex + 1) & kHelHeadMask);
-				_wakeHeadFutex();
+	void wait() {
+		// Completions of deferred submissions cannot arrive otherwise.
+		flushSubmissions();
 
-				_refCounts[_activeChunks] = 1;
-				_activeChunks++;
+		while(true) {
+			// TODO: Initialize all chunks when setting up the queue.
+			std::unique_lock lock{_mutex};
+			if(_retrieveIndex == _nextIndex) {
+				assert(_activeChunks < _numChunks);
+				_enqueueNewChunk();
+				continue;
+			}else if(_hadWaiters && _activeChunks < _parameters.maxChunks) {
+				// All chunks are in use; the kernel stalled until one was requeued.
+				if(_activeChunks == _numChunks)
+					_addChunks();
+				_enqueueNewChunk();
 				_hadWaiters = false;
 			}
+			lock.unlock();
 
 			bool done;
 			_waitProgressFutex(&done);
@@ -247,7 +335,7 @@ public:
 			_lastProgress += sizeof(HelElement) + element->length;
 
 			auto context = reinterpret_cast<Context *>(element->context);
-			_refCounts[_numberOf(_retrieveIndex)]++;
+			_reference(_numberOf(_retrieveIndex));
 			context->complete(ElementHandle{this, _numberOf(_retrieveIndex),
 					ptr + sizeof(HelElement)});
 			return;
@@ -255,32 +343,73 @@ public:
 	}
 
 private:
+	// Enqueues a chunk that was not used before. Caller must hold _mutex.
+	void _enqueueNewChunk() {
+		// Reset and enqueue the new chunk.
+		_chunks[_activeChunks]->progressFutex = 0;
+
+		_queue->indexQueue[_nextIndex & _ringMask()] = _activeChunks;
+		_nextIndex = ((_nextIndex + 1) & kHelHeadMask);
+		_wakeHeadFutex();
+
+		_refCounts[_activeChunks].store(1, std::memory_order_relaxed);
+		_activeChunks++;
+	}
+
+	// Grows the queue (doubling the number of chunks). Caller must hold _mutex.
+	void _addChunks() {
+		auto n = std::min(_numChunks, _parameters.maxChunks - _numChunks);
+		assert(n);
+
+		uintptr_t offset;
+		HEL_CHECK(helAddQueueChunks(_handle, n, &offset));
+
+		// Mappings must be page aligned.
+		auto mapOffset = offset & ~uintptr_t(0xFFF);
+		auto mapSize = (offset + n * _reservedPerChunk - mapOffset + 0xFFF) & ~size_t(0xFFF);
+		void *mapping;
+		HEL_CHECK(helMapMemory(_handle, kHelNullHandle, nullptr,
+				mapOffset, mapSize, kHelMapProtRead | kHelMapProtWrite, &mapping));
+
+		auto chunksPtr = reinterpret_cast<std::byte *>(mapping) + (offset - mapOffset);
+		for(unsigned int i = 0; i < n; ++i)
+			_chunks[_numChunks + i] = reinterpret_cast<HelChunk *>(
+					chunksPtr + i * _reservedPerChunk);
+		_numChunks += n;
+	}
+
 	void _surrender(int cn) {
-		assert(_refCounts[cn] > 0);
-		if(_refCounts[cn]-- > 1)
+		auto previous = _refCounts[cn].fetch_sub(1, std::memory_order_acq_rel);
+		assert(previous > 0);
+		if(previous > 1)
 			return;
 
 		// Reset and requeue the chunk.
+		std::lock_guard lock{_mutex};
 		_chunks[cn]->progressFutex = 0;
 
-		_queue->indexQueue[_nextIndex & ((1 << sizeShift) - 1)] = cn;
+		_queue->indexQueue[_nextIndex & _ringMask()] = cn;
 		_nextIndex = ((_nextIndex + 1) & kHelHeadMask);
 		_wakeHeadFutex();
 
-		_refCounts[cn] = 1;
+		_refCounts[cn].store(1, std::memory_order_relaxed);
 	}
 
 	void _reference(int cn) {
-		_refCounts[cn]++;
+		_refCounts[cn].fetch_add(1, std::memory_order_relaxed);
 	}
 
 private:
+	int _ringMask() {
+		return (1 << _parameters.ringShift) - 1;
+	}
+
 	int _numberOf(int index) {
-		return _queue->indexQueue[index & ((1 << sizeShift) - 1)];
+		return _queue->indexQueue[index & _ringMask()];
 	}
 
 	HelChunk *_retrieveChunk() {
-		auto cn = _queue->indexQueue[_retrieveIndex & ((1 << sizeShift) - 1)];
+		auto cn = _queue->indexQueue[_retrieveIndex & _ringMask()];
 		return _chunks[cn];
 	}
 
@@ -289,6 +418,7 @@ private:
 		if(futex & kHelHeadWaiters) {
 			HEL_CHECK(helFutexWake(&_queue->headFutex));
 			_hadWaiters = true;
+			_numStalls++;
 		}
 	}
 
@@ -317,12 +447,27 @@ private:
 	}
 
 private:
+	Parameters _parameters;
+
 	HelHandle _handle;
 	HelQueue *_queue;
-	HelChunk *_chunks[16];
+	// Pointers to the chunks (allocated for maxChunks entries).
+	std::unique_ptr<HelChunk *[]> _chunks;
+	unsigned int _numChunks;
+	size_t _reservedPerChunk;
+
+	// Submission ring. Only accessed by the thread that owns the Dispatcher.
+	bool _useRing;
+	HelSubmissionRing *_ring;
+	unsigned int _ringTail;
+
+	// Protects _nextIndex, _hadWaiters, _numChunks, _numStalls and the kernel's side of the queue
+	// against threads that release the last ElementHandle of a chunk.
+	std::mutex _mutex;
 
-	int _activeChunks;
+	unsigned int _activeChunks;
 	bool _hadWaiters;
+	uint64_t _numStalls;
 
 	// Index of the chunk that we are currently retrieving/inserting next.
 	int _retrieveIndex;
@@ -331,8 +476,8 @@ private:
 	// Progress into the current chunk.
 	int _lastProgress;
 
-	// Per-chunk reference counts.
-	int _refCounts[16];
+	// Per-chunk reference counts (allocated for maxChunks entries).
+	std::unique_ptr<std::atomic<int>[]> _refCounts;
 };
 
 inline void CurrentDispatcherToken::wait() {
@@ -554,18 +699,32 @@ using namespace helix;
 // ExchangeMsgsSender
 // --------------------------------------------------------------------
 
+// A lane whose submissions always complete on the given Dispatcher (instead of
+// the Dispatcher of the submitting thread). With a DispatcherPool, this keeps all
+// requests of a client on the same thread.
+struct PinnedLane {
+	BorrowedDescriptor lane;
+	Dispatcher *dispatcher;
+};
+
+inline PinnedLane pinLane(BorrowedDescriptor lane, Dispatcher &dispatcher) {
+	return {std::move(lane), &dispatcher};
+}
+
 template <typename Results, typename Actions, typename Receiver>
 struct ExchangeMsgsOperation : private Context {
-	ExchangeMsgsOperation(BorrowedDescriptor lane, Actions actions, Receiver receiver)
-	: lane_{std::move(lane)}, actions_{std::move(actions)}, receiver_{std::move(receiver)} { }
+	ExchangeMsgsOperation(BorrowedDescriptor lane, Dispatcher *dispatcher,
+			Actions actions, Receiver receiver)
+	: lane_{std::move(lane)}, dispatcher_{dispatcher},
+		actions_{std::move(actions)}, receiver_{std::move(receiver)} { }
 
 	void start() {
 		auto helActions = frg::apply(chainActionArrays, actions_);
 
+		auto &dispatcher = dispatcher_ ? *dispatcher_ : Dispatcher::global();
 		auto context = static_cast<Context *>(this);
-		HEL_CHECK(helSubmitAsync(lane_.getHandle(),
-				helActions.data(), helActions.size(), Dispatcher::global().acquire(),
-				reinterpret_cast<uintptr_t>(context), 0));
+		dispatcher.submitAsync(lane_.getHandle(), helActions.data(), helActions.size(),
+				reinterpret_cast<uintptr_t>(context));
 	}
 
 private:
@@ -581,6 +740,7 @@ private:
 	}
 
 	BorrowedDescriptor lane_;
+	Dispatcher *dispatcher_;
 	Actions actions_;
 	Receiver receiver_;
 };
@@ -590,15 +750,20 @@ struct [[nodiscard]] ExchangeMsgsSender {
 	using value_type = Results;
 
 	ExchangeMsgsSender(BorrowedDescriptor lane, Results, Actions actions)
-	: lane_{std::move(lane)}, actions_{std::move(actions)} { }
+	: lane_{std::move(lane)}, dispatcher_{nullptr}, actions_{std::move(actions)} { }
+
+	ExchangeMsgsSender(PinnedLane lane, Results, Actions actions)
+	: lane_{std::move(lane.lane)}, dispatcher_{lane.dispatcher},
+		actions_{std::move(actions)} { }
 
 	template<typename Receiver>
 	ExchangeMsgsOperation<Results, Actions, Receiver> connect(Receiver receiver) {
-		return {std::move(lane_), std::move(actions_), std::move(receiver)};
+		return {std::move(lane_), dispatcher_, std::move(actions_), std::move(receiver)};
 	}
 
 private:
 	BorrowedDescriptor lane_;
+	Dispatcher *dispatcher_;
 	Actions actions_;
 };
 
@@ -617,6 +782,15 @@ auto exchangeMsgs(BorrowedDescriptor descriptor, Args &&...args) {
 	};
 }
 
+template <typename ...Args>
+auto exchangeMsgs(PinnedLane lane, Args &&...args) {
+	return ExchangeMsgsSender{
+		std::move(lane),
+		createResultsTuple(args...),
+		frg::tuple{std::forward<Args>(args)...}
+	};
+}
+
 // --------------------------------------------------------------------
 // Operations other than exchangeMsgs().
 // --------------------------------------------------------------------
@@ -2,6 +2,11 @@
 
 #include <string.h>
 
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <arch/dma_pool.hpp>
 #include <hel.h>
 #include <helix/ipc.hpp>
 
@@ -81,4 +86,176 @@ inline uintptr_t addressToPhysical(uintptr_t p) {
 	return phys;
 }
 
+// Returns the physically contiguous runs that back [offset, offset + size) of a memory object.
+// If memory is kHelNullHandle, offset is an address in our own address space.
+// Unlike calling addressToPhysical() for each page, this usually takes a single syscall.
+std::vector<HelPhysicalRange> physicalRanges(HelHandle memory, uintptr_t offset, size_t size);
+
+inline std::vector<HelPhysicalRange> physicalRanges(const void *p, size_t size) {
+	return physicalRanges(kHelNullHandle, reinterpret_cast<uintptr_t>(p), size);
+}
+
+// DMA pool that carves buffers out of physically contiguous 2 MiB regions.
+// Buffers of up to maxObjectSize bytes are grouped into power-of-two size classes
+// and served from per-thread free lists; allocating and freeing them neither takes
+// a lock nor issues a syscall unless a free list needs to be refilled or drained.
+// Larger buffers get their own physically contiguous memory object.
+// Memory of the regions is only returned to the kernel when the pool is destroyed.
+struct HugeDmaPool final : arch::dma_pool {
+	static constexpr size_t regionSize = size_t{1} << 21;
+
+	static constexpr int minClassShift = 6;
+	static constexpr int numClasses = 12;
+	static constexpr size_t maxObjectSize = size_t{1} << (minClassShift + numClasses - 1);
+
+	// Threads beyond the first maxThreads threads share a locked free list.
+	static constexpr size_t maxThreads = 16;
+	static constexpr size_t cacheCapacity = 64;
+	// Number of buffers that are moved between a thread's cache and the shared lists at once.
+	static constexpr size_t batchSize = cacheCapacity / 2;
+
+	static constexpr size_t classSize(int sizeClass) {
+		return size_t{1} << (minClassShift + sizeClass);
+	}
+
+	static constexpr int sizeClassOf(size_t size) {
+		int sizeClass = 0;
+		while(size > classSize(sizeClass))
+			sizeClass++;
+		return sizeClass;
+	}
+
+	explicit HugeDmaPool(int addressBits = 64)
+	: addressBits_{addressBits} { }
+
+	HugeDmaPool(const HugeDmaPool &) = delete;
+	HugeDmaPool &operator= (const HugeDmaPool &) = delete;
+
+	~HugeDmaPool();
+
+	void *allocate(size_t size, size_t count, size_t align) override {
+		size_t total = size * count;
+		if(total < align)
+			total = align;
+		if(total > maxObjectSize)
+			return allocateLarge_(total, align);
+
+		auto sizeClass = sizeClassOf(total);
+		auto index = threadIndex_();
+		if(index >= maxThreads)
+			return allocateShared_(sizeClass);
+
+		auto cache = &caches_[index];
+		auto object = cache->heads[sizeClass];
+		if(!object) [[unlikely]] {
+			refill_(cache, sizeClass);
+			object = cache->heads[sizeClass];
+		}
+		cache->heads[sizeClass] = object->next;
+		cache->counts[sizeClass]--;
+		return object;
+	}
+
+	void deallocate(void *pointer, size_t size, size_t count, size_t align) override {
+		size_t total = size * count;
+		if(total < align)
+			total = align;
+		if(total > maxObjectSize) {
+			deallocateLarge_(pointer);
+			return;
+		}
+
+		auto sizeClass = sizeClassOf(total);
+		auto object = static_cast<FreeObject *>(pointer);
+		auto index = threadIndex_();
+		if(index >= maxThreads) {
+			deallocateShared_(object, sizeClass);
+			return;
+		}
+
+		auto cache = &caches_[index];
+		if(cache->counts[sizeClass] == cacheCapacity) [[unlikely]]
+			drain_(cache, sizeClass);
+		object->next = cache->heads[sizeClass];
+		cache->heads[sizeClass] = object;
+		cache->counts[sizeClass]++;
+	}
+
+	// Returns the physical address of a buffer that was allocated from this pool.
+	// For buffers in a region, this does not issue a syscall.
+	uintptr_t physical(const void *pointer) {
+		auto address = reinterpret_cast<uintptr_t>(pointer);
+
+		// Buffers of one driver are usually allocated from the same few regions,
+		// hence we check the region of the last lookup first.
+		auto cached = lastRegion_.load(std::memory_order_relaxed);
+		if(address - cached->base < regionSize) [[likely]]
+			return cached->physical + (address - cached->base);
+
+		return physicalSlow_(address);
+	}
+
+private:
+	struct FreeObject {
+		FreeObject *next;
+	};
+
+	struct alignas(64) ThreadCache {
+		FreeObject *heads[numClasses] = {};
+		size_t counts[numClasses] = {};
+	};
+
+	struct Region {
+		uintptr_t base;
+		uintptr_t physical;
+		HelHandle memory;
+	};
+
+	struct LargeBuffer {
+		uintptr_t base;
+		size_t size;
+		uintptr_t physical;
+		HelHandle memory;
+	};
+
+	// Returns a small integer that identifies the calling thread.
+	static size_t threadIndex_() {
+		static std::atomic<size_t> nextIndex{0};
+		thread_local size_t index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+		return index;
+	}
+
+	void refill_(ThreadCache *cache, int sizeClass);
+	void drain_(ThreadCache *cache, int sizeClass);
+	void *allocateShared_(int sizeClass);
+	void deallocateShared_(FreeObject *object, int sizeClass);
+
+	// Takes a buffer of the given class from the shared lists or carves a new one.
+	// Must be called with mutex_ held.
+	FreeObject *takeLocked_(int sizeClass);
+
+	void *allocateLarge_(size_t size, size_t align);
+	void deallocateLarge_(void *pointer);
+
+	uintptr_t physicalSlow_(uintptr_t address);
+
+	// Sentinel for lastRegion_ that never matches any address.
+	static constexpr Region noRegion_{~uintptr_t{0}, 0, kHelNullHandle};
+
+	int addressBits_;
+
+	ThreadCache caches_[maxThreads];
+
+	std::mutex mutex_;
+	// The following members are protected by mutex_.
+	FreeObject *shared_[numClasses] = {};
+	// Regions are only appended; their entries are never modified once they exist.
+	std::vector<Region *> regions_;
+	// Offset into the last region up to which buffers were carved.
+	size_t carveOffset_ = 0;
+	std::vector<LargeBuffer> largeBuffers_;
+
+	std::atomic<const Region *> lastRegion_{&noRegion_};
+};
+
 } // namespace helix
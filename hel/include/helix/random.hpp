@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace helix {
+
+// Fills the buffer with random bytes from the kernel's CSPRNG.
+// Small requests are served from a per-thread buffer that is refilled by helGetRandomBytes;
+// thus, most requests do not enter the kernel. Consumed bytes are wiped from the buffer,
+// and the buffer of the forking thread is wiped in the child on fork().
+void getRandomBytes(void *buffer, size_t size);
+
+} // namespace helix
@@ -0,0 +1,132 @@
+#include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <helix/dispatcher-pool.hpp>
+
+namespace helix {
+
+thread_local DispatcherPool::Worker *DispatcherPool::_currentWorker = nullptr;
+
+DispatcherPool::DispatcherPool(unsigned int numThreads) {
+	assert(numThreads > 0);
+	for(unsigned int i = 0; i < numThreads; i++)
+		_workers.push_back(std::make_unique<Worker>(this, i));
+
+	struct WorkerStart {
+		Worker *worker;
+		sem_t started;
+	};
+
+	for(auto &worker : _workers) {
+		WorkerStart start{worker.get(), {}};
+		sem_init(&start.started, 0, 0);
+
+		pthread_t thread;
+		auto ret = pthread_create(&thread, nullptr, [] (void *argument) -> void * {
+			auto start = static_cast<WorkerStart *>(argument);
+			auto worker = start->worker;
+
+			_currentWorker = worker;
+			worker->dispatcher = &Dispatcher::global();
+			worker->dispatcher->acquire();
+			sem_post(&start->started);
+
+			worker->pool->_runWorker(worker);
+		}, &start);
+		assert(ret == 0);
+		pthread_detach(thread);
+
+		// dispatcher() and post() require the queues of all threads to exist.
+		sem_wait(&start.started);
+		sem_destroy(&start.started);
+	}
+}
+
+int DispatcherPool::currentThread() {
+	auto worker = _currentWorker;
+	if(!worker || worker->pool != this)
+		return -1;
+	return worker->index;
+}
+
+void DispatcherPool::post(Task *task) {
+	auto n = _workers.size();
+
+	Worker *target;
+	if(auto index = currentThread(); index >= 0) {
+		target = _workers[index].get();
+	}else{
+		target = _workers[_nextWorker.fetch_add(1, std::memory_order_relaxed) % n].get();
+	}
+
+	{
+		std::lock_guard lock{target->mutex};
+		target->tasks.push_back(task);
+	}
+
+	// Wake up the target if it sleeps. Otherwise, wake up another thread that can steal the task.
+	for(size_t i = 0; i < n; i++) {
+		auto worker = _workers[(target->index + i) % n].get();
+		if(worker->sleeping.exchange(false, std::memory_order_seq_cst)) {
+			_wake(worker);
+			break;
+		}
+	}
+}
+
+void DispatcherPool::_runWorker(Worker *worker) {
+	while(true) {
+		if(auto task = _takeTask(worker); task) {
+			task->run();
+			continue;
+		}
+
+		// Pairs with the exchange() in post(): either post() observes the flag
+		// or we observe the task.
+		worker->sleeping.store(true, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(auto task = _takeTask(worker); task) {
+			worker->sleeping.store(false, std::memory_order_relaxed);
+			task->run();
+			continue;
+		}
+
+		worker->dispatcher->wait();
+		worker->sleeping.store(false, std::memory_order_relaxed);
+	}
+}
+
+DispatcherPool::Task *DispatcherPool::_takeTask(Worker *worker) {
+	{
+		std::lock_guard lock{worker->mutex};
+		if(!worker->tasks.empty()) {
+			auto task = worker->tasks.front();
+			worker->tasks.pop_front();
+			return task;
+		}
+	}
+
+	// Steal the most recently posted task of another thread.
+	// That thread works through its tasks in FIFO order, so this task would run last.
+	auto n = _workers.size();
+	for(size_t i = 1; i < n; i++) {
+		auto victim = _workers[(worker->index + i) % n].get();
+		std::lock_guard lock{victim->mutex};
+		if(!victim->tasks.empty()) {
+			auto task = victim->tasks.back();
+			victim->tasks.pop_back();
+			return task;
+		}
+	}
+
+	return nullptr;
+}
+
+void DispatcherPool::_wake(Worker *worker) {
+	auto context = static_cast<Context *>(worker);
+	HEL_CHECK(helSubmitAsyncNop(worker->dispatcher->acquire(),
+			reinterpret_cast<uintptr_t>(context)));
+}
+
+} // namespace helix
@@ -0,0 +1,170 @@
+
+#include <assert.h>
+
+#include <helix/memory.hpp>
+
+namespace helix {
+
+std::vector<HelPhysicalRange> physicalRanges(HelHandle memory, uintptr_t offset, size_t size) {
+	constexpr size_t batchSize = 16;
+
+	std::vector<HelPhysicalRange> ranges;
+	size_t progress = 0;
+	while(true) {
+		HelPhysicalRange batch[batchSize];
+		size_t count;
+		auto error = helQueryPhysicalRanges(memory, offset + progress, size - progress,
+				batch, batchSize, &count);
+		if(error != kHelErrBufferTooSmall)
+			HEL_CHECK(error);
+
+		for(size_t i = 0; i < count; i++) {
+			// Runs may continue across batches.
+			if(!ranges.empty() && ranges.back().physical + ranges.back().length
+					== batch[i].physical) {
+				ranges.back().length += batch[i].length;
+			}else{
+				ranges.push_back(batch[i]);
+			}
+			progress += batch[i].length;
+		}
+
+		if(error == kHelErrNone)
+			return ranges;
+	}
+}
+
+HugeDmaPool::~HugeDmaPool() {
+	for(auto region : regions_) {
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, reinterpret_cast<void *>(region->base),
+				regionSize));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, region->memory));
+		delete region;
+	}
+	for(auto &buffer : largeBuffers_) {
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, reinterpret_cast<void *>(buffer.base),
+				buffer.size));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, buffer.memory));
+	}
+}
+
+void HugeDmaPool::refill_(ThreadCache *cache, int sizeClass) {
+	std::lock_guard lock{mutex_};
+	while(cache->counts[sizeClass] < batchSize) {
+		auto object = takeLocked_(sizeClass);
+		object->next = cache->heads[sizeClass];
+		cache->heads[sizeClass] = object;
+		cache->counts[sizeClass]++;
+	}
+}
+
+void HugeDmaPool::drain_(ThreadCache *cache, int sizeClass) {
+	std::lock_guard lock{mutex_};
+	for(size_t i = 0; i < batchSize; i++) {
+		auto object = cache->heads[sizeClass];
+		cache->heads[sizeClass] = object->next;
+		cache->counts[sizeClass]--;
+		object->next = shared_[sizeClass];
+		shared_[sizeClass] = object;
+	}
+}
+
+void *HugeDmaPool::allocateShared_(int sizeClass) {
+	std::lock_guard lock{mutex_};
+	return takeLocked_(sizeClass);
+}
+
+void HugeDmaPool::deallocateShared_(FreeObject *object, int sizeClass) {
+	std::lock_guard lock{mutex_};
+	object->next = shared_[sizeClass];
+	shared_[sizeClass] = object;
+}
+
+HugeDmaPool::FreeObject *HugeDmaPool::takeLocked_(int sizeClass) {
+	if(auto object = shared_[sizeClass]; object) {
+		shared_[sizeClass] = object->next;
+		return object;
+	}
+
+	// Carve the buffer out of the current region. Regions are physically aligned to their size,
+	// hence aligning offsets within the region to the class size aligns the physical address.
+	auto objectSize = classSize(sizeClass);
+	auto offset = (carveOffset_ + objectSize - 1) & ~(objectSize - 1);
+	if(regions_.empty() || offset + objectSize > regionSize) {
+		HelAllocRestrictions restrictions{
+			.addressBits = addressBits_,
+			.numaNode = 0
+		};
+		HelHandle memory;
+		HEL_CHECK(helAllocateMemory(regionSize, kHelAllocHuge, &restrictions, &memory));
+
+		void *window;
+		HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr, 0, regionSize,
+				kHelMapProtRead | kHelMapProtWrite, &window));
+
+		// Since the region is physically contiguous, one lookup suffices for all of its buffers.
+		auto base = reinterpret_cast<uintptr_t>(window);
+		regions_.push_back(new Region{base, addressToPhysical(base), memory});
+		offset = 0;
+	}
+	carveOffset_ = offset + objectSize;
+	auto address = regions_.back()->base + offset;
+	return reinterpret_cast<FreeObject *>(address);
+}
+
+void *HugeDmaPool::allocateLarge_(size_t size, size_t align) {
+	assert(align <= Mapping::pageSize);
+	size = (size + Mapping::pageSize - 1) & ~(Mapping::pageSize - 1);
+
+	HelAllocRestrictions restrictions{
+		.addressBits = addressBits_,
+		.numaNode = 0
+	};
+	HelHandle memory;
+	HEL_CHECK(helAllocateMemory(size, kHelAllocContinuous, &restrictions, &memory));
+
+	void *window;
+	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr, 0, size,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+
+	auto base = reinterpret_cast<uintptr_t>(window);
+	auto physical = addressToPhysical(base);
+
+	std::lock_guard lock{mutex_};
+	largeBuffers_.push_back({base, size, physical, memory});
+	return window;
+}
+
+void HugeDmaPool::deallocateLarge_(void *pointer) {
+	LargeBuffer buffer;
+	{
+		std::lock_guard lock{mutex_};
+		auto it = largeBuffers_.begin();
+		while(it != largeBuffers_.end() && it->base != reinterpret_cast<uintptr_t>(pointer))
+			++it;
+		assert(it != largeBuffers_.end());
+		buffer = *it;
+		largeBuffers_.erase(it);
+	}
+
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, pointer, buffer.size));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, buffer.memory));
+}
+
+uintptr_t HugeDmaPool::physicalSlow_(uintptr_t address) {
+	std::lock_guard lock{mutex_};
+	for(auto region : regions_) {
+		if(address - region->base < regionSize) {
+			lastRegion_.store(region, std::memory_order_relaxed);
+			return region->physical + (address - region->base);
+		}
+	}
+	for(auto &buffer : largeBuffers_) {
+		if(address - buffer.base < buffer.size)
+			return buffer.physical + (address - buffer.base);
+	}
+	assert(!"helix: address does not belong to this HugeDmaPool");
+	__builtin_unreachable();
+}
+
+} // namespace helix
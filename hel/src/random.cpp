@@ -0,0 +1,76 @@
+#include <pthread.h>
+#include <string.h>
+
+#include <mutex>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+#include <helix/random.hpp>
+
+namespace helix {
+
+namespace {
+
+struct RandomState {
+	// Matches the maximal size of a single helGetRandomBytes call.
+	static constexpr size_t bufferSize = 256;
+
+	unsigned char buffer[bufferSize];
+	// Bytes are handed out from the end of the buffer.
+	size_t available = 0;
+};
+
+thread_local RandomState randomState;
+
+std::once_flag atforkOnce;
+
+void wipe(void *pointer, size_t size) {
+	memset(pointer, 0, size);
+	// Prevent the compiler from eliding the memset().
+	asm volatile ("" : : "r"(pointer) : "memory");
+}
+
+// The child only contains the forking thread, hence it suffices to wipe its buffer.
+// Otherwise, parent and child would hand out the same bytes.
+void wipeInChild() {
+	wipe(randomState.buffer, RandomState::bufferSize);
+	randomState.available = 0;
+}
+
+void fillFromKernel(void *buffer, size_t size) {
+	auto p = reinterpret_cast<unsigned char *>(buffer);
+	size_t progress = 0;
+	while(progress < size) {
+		size_t chunk;
+		HEL_CHECK(helGetRandomBytes(p + progress, size - progress, &chunk));
+		progress += chunk;
+	}
+}
+
+} // anonymous namespace
+
+void getRandomBytes(void *buffer, size_t size) {
+	std::call_once(atforkOnce, [] {
+		pthread_atfork(nullptr, nullptr, &wipeInChild);
+	});
+
+	// Large requests gain nothing from buffering.
+	if(size > RandomState::bufferSize) {
+		fillFromKernel(buffer, size);
+		return;
+	}
+
+	auto state = &randomState;
+	if(state->available < size) {
+		// Discard the remaining bytes; this keeps the code simple and the bytes are cheap.
+		fillFromKernel(state->buffer, RandomState::bufferSize);
+		state->available = RandomState::bufferSize;
+	}
+
+	auto source = state->buffer + state->available - size;
+	memcpy(buffer, source, size);
+	wipe(source, size);
+	state->available -= size;
+}
+
+} // namespace helix
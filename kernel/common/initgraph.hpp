@@ -57,9 +57,14 @@ struct Node {
 
 	const char *displayName() { return displayName_; }
 
+	// Whether the engine may activate this node concurrently with other nodes.
+	bool concurrent() { return concurrent_; }
+
 protected:
 	virtual void activate() {};
 
+	void setConcurrent() { concurrent_ = true; }
+
 	~Node() = default;
 
 private:
@@ -82,6 +87,7 @@ private:
 
 	bool done_ = false;
 	bool wanted_ = false;
+	bool concurrent_ = false;
 
 	unsigned int nUnsatisfied = 0;
 };
@@ -102,6 +108,19 @@ protected:
 	virtual void reportUnreached(Node *node) { (void)node; };
 	virtual void onUnreached() { __builtin_trap(); }
 
+	// Engines can override the following functions to activate concurrent nodes
+	// asynchronously. If startActivation() returns true, the engine takes ownership
+	// of the activation: it must call activateNode() (e.g., on another thread) and
+	// eventually return the node from awaitActivation().
+	virtual bool startActivation(Node *node) {
+		(void)node;
+		return false;
+	}
+	// Blocks until one of the nodes passed to startActivation() completes and returns it.
+	virtual Node *awaitActivation() { __builtin_trap(); }
+
+	void activateNode(Node *node) { node->activate(); }
+
 public:
 	void run(Node *goal = nullptr) {
 		frg::intrusive_list<
@@ -145,14 +164,27 @@ public:
 		}
 
 		// Now, run pending nodes until no such nodes remain.
-		while (!pending_.empty()) {
-			auto current = pending_.pop_front();
-			assert(current->wanted_);
-			assert(!current->done_);
-
-			preActivate(current);
-
-			current->activate();
+		// Concurrent nodes may still be in flight when the pending list runs empty.
+		unsigned int nInFlight = 0;
+		while (!pending_.empty() || nInFlight) {
+			Node *current;
+			if (!pending_.empty()) {
+				current = pending_.pop_front();
+				assert(current->wanted_);
+				assert(!current->done_);
+
+				preActivate(current);
+
+				if (current->concurrent_ && startActivation(current)) {
+					++nInFlight;
+					continue;
+				}
+				current->activate();
+			} else {
+				current = awaitActivation();
+				assert(nInFlight);
+				--nInFlight;
+			}
 			current->done_ = true;
 
 			postActivate(current);
@@ -211,6 +243,11 @@ struct Stage final : Node {
 	Stage(Engine *engine, const char *displayName) : Node{NodeType::stage, engine, displayName} {}
 };
 
+// Tag that marks a Task as safe to run concurrently with all nodes that it is not ordered with.
+struct Concurrent {};
+
+inline constexpr Concurrent concurrent;
+
 template <size_t N>
 struct Requires {
 	template <typename... Args>
@@ -278,6 +315,17 @@ struct Task final : Node {
 	Task(Engine *engine, const char *displayName, Entails<NE> e, F invocable)
 	: Task{engine, displayName, {}, e, std::move(invocable)} {}
 
+	Task(Engine *engine, const char *displayName, Requires<NR> r, Entails<NE> e, Concurrent,
+	     F invocable)
+	: Task{engine, displayName, r, e, std::move(invocable)} {
+		setConcurrent();
+	}
+
+	Task(Engine *engine, const char *displayName, Requires<NR> r, Concurrent, F invocable)
+	: Task{engine, displayName, r, {}, std::move(invocable)} {
+		setConcurrent();
+	}
+
 protected:
 	void activate() override { invocable_(); }
 
@@ -34,6 +34,7 @@ void
 renderChars(void *fb_ptr, unsigned int pitch, unsigned int x, unsigned int y, const char *c, int count, int fg, int bg, std::integral_constant<int, FontWidth>, std::integral_constant<int, FontHeight>) {
 	auto fg_rgb = rgbColor[fg];
 	auto bg_rgb = (bg < 0) ? defaultBg : rgbColor[bg];
+	auto diff_rgb = fg_rgb ^ bg_rgb;
 
 	auto fb = reinterpret_cast<uint32_t *>(fb_ptr);
 	auto line = fb + y * FontHeight * pitch + x * FontWidth;
@@ -41,10 +42,11 @@ renderChars(void *fb_ptr, unsigned int pitch, unsigned int x, unsigned int y, co
 		auto dest = line;
 		for (int k = 0; k < count; k++) {
 			auto dc = (c[k] >= 32 && c[k] <= 127) ? c[k] : 127;
-			auto fontbits = fontBitmap[(dc - 32) * FontHeight + i];
+			uint32_t fontbits = fontBitmap[(dc - 32) * FontHeight + i];
+			// Select the color without branching, such that whole rows are written back-to-back.
 			for (size_t j = 0; j < FontWidth; j++) {
-				int bit = (1 << ((FontWidth - 1) - j));
-				*dest++ = (fontbits & bit) ? fg_rgb : bg_rgb;
+				uint32_t set = -((fontbits >> ((FontWidth - 1) - j)) & 1);
+				*dest++ = bg_rgb ^ (diff_rgb & set);
 			}
 		}
 		line += pitch;
@@ -23,6 +23,7 @@ enum {
 	// Extendend features, EDX register
 	kCpuFlagSyscall = 0x800,
 	kCpuFlagNx = 0x100000,
+	kCpuFlagPage1Gb = 0x4000000,
 	kCpuFlagLongMode = 0x20000000
 };
 
@@ -58,6 +59,16 @@ inline void xsave(uint8_t *area, uint64_t rfbm) {
 	asm volatile("xsave %0" : : "m"(*area), "a"(low), "d"(high) : "memory");
 }
 
+// Like xsave() but does not write state components that are in their initial
+// configuration or that were not modified since the last xrstor() from the same area.
+inline void xsaveopt(uint8_t *area, uint64_t rfbm) {
+	assert(!((uintptr_t)area & 0x3F));
+
+	uintptr_t low = rfbm & 0xFFFFFFFF;
+	uintptr_t high = (rfbm >> 32) & 0xFFFFFFFF;
+	asm volatile("xsaveopt %0" : : "m"(*area), "a"(low), "d"(high) : "memory");
+}
+
 inline void xrstor(uint8_t *area, uint64_t rfbm) {
 	assert(!((uintptr_t)area & 0x3F));
 
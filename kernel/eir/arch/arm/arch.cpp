@@ -55,6 +55,9 @@ mapSingle4kPage(address_t address, address_t physical, uint32_t flags, CachingMo
 
 	auto l1_ent = ((uint64_t *)l1_ptr)[l1];
 	auto l2_ptr = l1_ent & 0xFFFFFFFFF000;
+	if ((l1_ent & kPageValid) && !(l1_ent & kPageTable))
+		eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address}
+		                   << " inside a block!" << frg::endlog;
 	if (!(l1_ent & kPageValid)) {
 		uint64_t addr = allocPage();
 
@@ -68,6 +71,9 @@ mapSingle4kPage(address_t address, address_t physical, uint32_t flags, CachingMo
 
 	auto l2_ent = ((uint64_t *)l2_ptr)[l2];
 	auto l3_ptr = l2_ent & 0xFFFFFFFFF000;
+	if ((l2_ent & kPageValid) && !(l2_ent & kPageTable))
+		eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address}
+		                   << " inside a block!" << frg::endlog;
 	if (!(l2_ent & kPageValid)) {
 		uint64_t addr = allocPage();
 
@@ -113,6 +119,72 @@ mapSingle4kPage(address_t address, address_t physical, uint32_t flags, CachingMo
 	((uint64_t *)l3_ptr)[l3] = new_entry;
 }
 
+bool haveLargePages(int shift) {
+	// With the 4 KiB granule, level 1 and level 2 entries can be block descriptors.
+	return shift == 21 || shift == 30;
+}
+
+void mapLargePage(address_t address, address_t physical, int shift, uint32_t flags) {
+	assert(shift == 21 || shift == 30);
+	assert(!(address & ((address_t{1} << shift) - 1)));
+	assert(!(physical & ((address_t{1} << shift) - 1)));
+
+	auto ttbr = (address >> 63) & 1;
+	auto l0 = (address >> 39) & 0x1FF;
+	auto l1 = (address >> 30) & 0x1FF;
+	auto l2 = (address >> 21) & 0x1FF;
+
+	auto l0_ent = ((uint64_t *)eirTTBR[ttbr])[l0];
+	auto l1_ptr = l0_ent & 0xFFFFFFFFF000;
+	if (!(l0_ent & kPageValid)) {
+		uint64_t addr = allocPage();
+
+		for (int i = 0; i < 512; i++)
+			((uint64_t *)addr)[i] = 0;
+
+		((uint64_t *)eirTTBR[ttbr])[l0] = addr | kPageValid | kPageTable;
+
+		l1_ptr = addr;
+	}
+
+	auto entry_ptr = &((uint64_t *)l1_ptr)[l1];
+	if (shift == 21) {
+		auto l1_ent = *entry_ptr;
+		if ((l1_ent & kPageValid) && !(l1_ent & kPageTable))
+			eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address}
+			                   << " inside a block!" << frg::endlog;
+
+		auto l2_ptr = l1_ent & 0xFFFFFFFFF000;
+		if (!(l1_ent & kPageValid)) {
+			uint64_t addr = allocPage();
+
+			for (int i = 0; i < 512; i++)
+				((uint64_t *)addr)[i] = 0;
+
+			*entry_ptr = addr | kPageValid | kPageTable;
+
+			l2_ptr = addr;
+		}
+		entry_ptr = &((uint64_t *)l2_ptr)[l2];
+	}
+
+	if (*entry_ptr & kPageValid)
+		eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address} << " twice!"
+		                   << frg::endlog;
+
+	// Block descriptors do not set kPageTable.
+	uint64_t new_entry = physical | kPageValid | kPageAccess | kPageWb | kPageInnerSh;
+
+	if (!(flags & PageFlags::write))
+		new_entry |= kPageRO;
+	if (!(flags & PageFlags::execute))
+		new_entry |= kPageXN | kPagePXN;
+	if (!(flags & PageFlags::global))
+		new_entry |= kPageNotGlobal;
+
+	*entry_ptr = new_entry;
+}
+
 address_t getSingle4kPage(address_t address) {
 	auto ttbr = (address >> 63) & 1;
 	auto l0 = (address >> 39) & 0x1FF;
@@ -129,11 +201,15 @@ address_t getSingle4kPage(address_t address) {
 	auto l2_ptr = l1_ent & 0xFFFFFFFFF000;
 	if (!(l1_ent & kPageValid))
 		return -1;
+	if (!(l1_ent & kPageTable))
+		return (l1_ent & 0xFFFFC0000000) + (address & 0x3FFFF000);
 
 	auto l2_ent = ((uint64_t *)l2_ptr)[l2];
 	auto l3_ptr = l2_ent & 0xFFFFFFFFF000;
 	if (!(l2_ent & kPageValid))
 		return -1;
+	if (!(l2_ent & kPageTable))
+		return (l2_ent & 0xFFFFFFE00000) + (address & 0x1FF000);
 
 	auto l3_ent = ((uint64_t *)l3_ptr)[l3];
 	auto page_ptr = l3_ent & 0xFFFFFFFFF000;
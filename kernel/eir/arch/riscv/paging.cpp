@@ -42,6 +42,10 @@ mapSingle4kPage(address_t address, address_t physical, uint32_t flags, CachingMo
 		int shift = 12 + 9 * n;
 		unsigned int vpn = (address >> shift) & 0x1FF;
 
+		if (table[vpn] & (pteRead | pteWrite | pteExecute))
+			eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address}
+			                   << " inside a large page!" << frg::endlog;
+
 		if (table[vpn] & pteValid) {
 			table = physToVirt<uint64_t>((table[vpn] & ptePpnMask) << 2);
 		} else {
@@ -68,6 +72,58 @@ mapSingle4kPage(address_t address, address_t physical, uint32_t flags, CachingMo
 	table[vpn0] = pte0;
 }
 
+bool haveLargePages(int shift) {
+	// Megapages and gigapages are available in all paging modes that we support.
+	return shift == 21 || shift == 30;
+}
+
+void mapLargePage(address_t address, address_t physical, int shift, uint32_t flags) {
+	assert(shift == 21 || shift == 30);
+	assert(!(address & ((address_t{1} << shift) - 1)));
+	assert(!(physical & ((address_t{1} << shift) - 1)));
+	assert(riscvConfig.numPtLevels);
+
+	// The leaf is at VPN[leafLevel].
+	int leafLevel = (shift - 12) / 9;
+
+	auto *table = physToVirt<uint64_t>(pml4);
+	for (int n = riscvConfig.numPtLevels - 1; n > leafLevel; --n) {
+		int levelShift = 12 + 9 * n;
+		unsigned int vpn = (address >> levelShift) & 0x1FF;
+
+		if (table[vpn] & (pteRead | pteWrite | pteExecute))
+			eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address}
+			                   << " inside a large page!" << frg::endlog;
+
+		if (table[vpn] & pteValid) {
+			table = physToVirt<uint64_t>((table[vpn] & ptePpnMask) << 2);
+		} else {
+			auto nextPtPage = allocPage();
+
+			auto *nextPtPtr = physToVirt<uint64_t>(nextPtPage);
+			for (int j = 0; j < 512; j++)
+				nextPtPtr[j] = 0;
+
+			table[vpn] = (nextPtPage >> 2) | pteValid;
+			table = nextPtPtr;
+		}
+	}
+
+	unsigned int vpn = (address >> shift) & 0x1FF;
+	if (table[vpn] & pteValid)
+		eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address} << " twice!"
+		                   << frg::endlog;
+
+	uint64_t pte = (physical >> 2) | pteValid | pteRead | pteAccess;
+	if (flags & PageFlags::write)
+		pte |= pteWrite | pteDirty;
+	if (flags & PageFlags::execute)
+		pte |= pteExecute;
+	if (flags & PageFlags::global)
+		pte |= pteGlobal;
+	table[vpn] = pte;
+}
+
 int getKernelVirtualBits() {
 	assert(riscvConfig.numPtLevels);
 	return 9 * riscvConfig.numPtLevels + 12;
@@ -27,6 +27,7 @@ enum X86PageFlags {
 	kPageUser = 4,
 	kPagePwt = 0x8,
 	kPagePat = 0x80,
+	kPageHuge = 0x80, // In PDPT and PD entries.
 	kPageGlobal = 0x100,
 	kPageXd = 0x8000000000000000
 };
@@ -73,6 +74,9 @@ mapSingle4kPage(address_t address, address_t physical, uint32_t flags, CachingMo
 		(physToVirt<uint64_t>(pml4))[pml4_index] = pdpt | kPagePresent | kPageWrite;
 	}
 	uint64_t pdpt_entry = (physToVirt<uint64_t>(pdpt))[pdpt_index];
+	if ((pdpt_entry & kPagePresent) && (pdpt_entry & kPageHuge))
+		eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address}
+		                   << " inside a large page!" << frg::endlog;
 
 	// find the pd entry; create pd if necessary
 	uintptr_t pd = (uintptr_t)(pdpt_entry & 0xFFFFF000);
@@ -83,6 +87,9 @@ mapSingle4kPage(address_t address, address_t physical, uint32_t flags, CachingMo
 		(physToVirt<uint64_t>(pdpt))[pdpt_index] = pd | kPagePresent | kPageWrite;
 	}
 	uint64_t pd_entry = (physToVirt<uint64_t>(pd))[pd_index];
+	if ((pd_entry & kPagePresent) && (pd_entry & kPageHuge))
+		eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address}
+		                   << " inside a large page!" << frg::endlog;
 
 	// find the pt entry; create pt if necessary
 	uintptr_t pt = (uintptr_t)(pd_entry & 0xFFFFF000);
@@ -114,6 +121,71 @@ mapSingle4kPage(address_t address, address_t physical, uint32_t flags, CachingMo
 	(physToVirt<uint64_t>(pt))[pt_index] = new_entry;
 }
 
+bool haveLargePages(int shift) {
+	if (shift == 21)
+		return true;
+	if (shift == 30)
+		return common::x86::cpuid(common::x86::kCpuIndexExtendedFeatures)[3]
+		       & common::x86::kCpuFlagPage1Gb;
+	return false;
+}
+
+void mapLargePage(address_t address, address_t physical, int shift, uint32_t flags) {
+	assert(shift == 21 || shift == 30);
+	assert(address % (address_t{1} << shift) == 0);
+	assert(physical % (address_t{1} << shift) == 0);
+
+	int pml4_index = (int)((address >> 39) & 0x1FF);
+	int pdpt_index = (int)((address >> 30) & 0x1FF);
+	int pd_index = (int)((address >> 21) & 0x1FF);
+
+	// find the pml4_entry. the pml4 is always present
+	uintptr_t pml4 = eirPml4Pointer;
+	uint64_t pml4_entry = (physToVirt<uint64_t>(pml4))[pml4_index];
+
+	// find the pdpt entry; create pdpt if necessary
+	uintptr_t pdpt = (uintptr_t)(pml4_entry & 0xFFFFF000);
+	if (!(pml4_entry & kPagePresent)) {
+		pdpt = allocPage();
+		for (int i = 0; i < 512; i++)
+			(physToVirt<uint64_t>(pdpt))[i] = 0;
+		(physToVirt<uint64_t>(pml4))[pml4_index] = pdpt | kPagePresent | kPageWrite;
+	}
+
+	uint64_t *entry_ptr = &(physToVirt<uint64_t>(pdpt))[pdpt_index];
+	if (shift == 21) {
+		// find the pd entry; create pd if necessary
+		uint64_t pdpt_entry = *entry_ptr;
+		if ((pdpt_entry & kPagePresent) && (pdpt_entry & kPageHuge))
+			eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address}
+			                   << " inside a large page!" << frg::endlog;
+
+		uintptr_t pd = (uintptr_t)(pdpt_entry & 0xFFFFF000);
+		if (!(pdpt_entry & kPagePresent)) {
+			pd = allocPage();
+			for (int i = 0; i < 512; i++)
+				(physToVirt<uint64_t>(pd))[i] = 0;
+			*entry_ptr = pd | kPagePresent | kPageWrite;
+		}
+		entry_ptr = &(physToVirt<uint64_t>(pd))[pd_index];
+	}
+
+	// setup the new large page entry
+	if (*entry_ptr & kPagePresent)
+		eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address} << " twice!"
+		                   << frg::endlog;
+
+	uint64_t new_entry = physical | kPagePresent | kPageHuge;
+	if (flags & PageFlags::write)
+		new_entry |= kPageWrite;
+	if (!(flags & PageFlags::execute))
+		new_entry |= kPageXd;
+	if (flags & PageFlags::global)
+		new_entry |= kPageGlobal;
+
+	*entry_ptr = new_entry;
+}
+
 address_t getSingle4kPage(address_t address) {
 	assert(address % pageSize == 0);
 
@@ -136,12 +208,16 @@ address_t getSingle4kPage(address_t address) {
 	uintptr_t pd = (uintptr_t)(pdpt_entry & 0xFFFFF000);
 	if (!(pdpt_entry & kPagePresent))
 		return -1;
+	if (pdpt_entry & kPageHuge)
+		return (pdpt_entry & 0xF'FFFF'C000'0000) + (address & 0x3FFF'F000);
 	uint64_t pd_entry = (physToVirt<uint64_t>(pd))[pd_index];
 
 	// find the pt entry; bail out if pt is missing
 	uintptr_t pt = (uintptr_t)(pd_entry & 0xFFFFF000);
 	if (!(pd_entry & kPagePresent))
 		return -1;
+	if (pd_entry & kPageHuge)
+		return (pd_entry & 0xF'FFFF'FFE0'0000) + (address & 0x1F'F000);
 	uint64_t pt_entry = (physToVirt<uint64_t>(pt))[pt_index];
 
 	// setup the new pt entry
@@ -35,6 +35,13 @@ void mapSingle4kPage(
 );
 address_t getSingle4kPage(address_t address);
 
+// Returns true if pages of size (1 << shift) can be mapped by a single entry in a
+// higher level page table (e.g., 2 MiB and 1 GiB pages).
+bool haveLargePages(int shift);
+// Maps a page of size (1 << shift) with write-back caching.
+// Precondition: haveLargePages(shift).
+void mapLargePage(address_t address, address_t physical, int shift, uint32_t flags);
+
 [[gnu::weak]] void initPlatform();
 void initProcessorEarly();
 void initProcessorPaging(void *kernel_start, uint64_t &kernel_entry);
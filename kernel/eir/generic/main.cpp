@@ -314,6 +314,50 @@ void unpoisonKasanShadow(address_t base, size_t size) {
 
 // ----------------------------------------------------------------------------
 
+namespace {
+
+// Maps [physical, physical + size) to address, using the largest pages that the
+// alignment of both addresses permits. This keeps the number of TLB entries that
+// are needed to cover the direct physical map low.
+void mapPhysicalRange(address_t address, address_t physical, size_t size, uint32_t flags) {
+	assert(!(size & (pageSize - 1)));
+
+	frg::array<int, 2> largeShifts{30, 21};
+	frg::array<bool, 2> haveLarge{haveLargePages(30), haveLargePages(21)};
+
+	size_t numPages[3] = {0, 0, 0};
+	address_t offset = 0;
+	while (offset < size) {
+		size_t k = 0;
+		for (; k < largeShifts.size(); ++k) {
+			auto largeSize = address_t{1} << largeShifts[k];
+			if (!haveLarge[k])
+				continue;
+			if (((address + offset) | (physical + offset)) & (largeSize - 1))
+				continue;
+			if (size - offset < largeSize)
+				continue;
+			break;
+		}
+
+		if (k < largeShifts.size()) {
+			mapLargePage(address + offset, physical + offset, largeShifts[k], flags);
+			offset += address_t{1} << largeShifts[k];
+		} else {
+			mapSingle4kPage(address + offset, physical + offset, flags);
+			offset += pageSize;
+		}
+		++numPages[k];
+	}
+
+	eir::infoLogger() << "eir: Mapped 0x" << frg::hex_fmt{physical} << " to 0x"
+	                  << frg::hex_fmt{address} << " using " << numPages[0] << " 1 GiB, "
+	                  << numPages[1] << " 2 MiB and " << numPages[2] << " 4 KiB pages"
+	                  << frg::endlog;
+}
+
+} // namespace
+
 void mapRegionsAndStructs() {
 	const auto &ml = getMemoryLayout();
 
@@ -331,24 +375,23 @@ void mapRegionsAndStructs() {
 			continue;
 
 		// Map the region itself.
-		for (address_t page = 0; page < regions[i].size; page += pageSize)
-			mapSingle4kPage(
-			    ml.directPhysical + regions[i].address + page,
-			    regions[i].address + page,
-			    PageFlags::write | PageFlags::global
-			);
+		mapPhysicalRange(
+		    ml.directPhysical + regions[i].address,
+		    regions[i].address,
+		    regions[i].size,
+		    PageFlags::write | PageFlags::global
+		);
 		mapKasanShadow(ml.directPhysical + regions[i].address, regions[i].size);
 		unpoisonKasanShadow(ml.directPhysical + regions[i].address, regions[i].size);
 
 		// Map the buddy tree (also to the direct physical map).
 		address_t buddyMapping = ml.directPhysical + regions[i].buddyTree;
-		for (address_t page = 0; page < regions[i].buddyOverhead; page += pageSize) {
-			mapSingle4kPage(
-			    buddyMapping + page,
-			    regions[i].buddyTree + page,
-			    PageFlags::write | PageFlags::global
-			);
-		}
+		mapPhysicalRange(
+		    buddyMapping,
+		    regions[i].buddyTree,
+		    regions[i].buddyOverhead,
+		    PageFlags::write | PageFlags::global
+		);
 		mapKasanShadow(buddyMapping, regions[i].buddyOverhead);
 		unpoisonKasanShadow(buddyMapping, regions[i].buddyOverhead);
 		regions[i].buddyMap = buddyMapping;
@@ -257,6 +257,13 @@ void initializeThisProcessor() {
 	asm volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
 	cpu_data->affinity = (mpidr & 0xFFFFFF) | (mpidr >> 32 & 0xFF) << 24;
 
+	// Approximate the topology by the affinity levels: if MPIDR.MT is set,
+	// Aff0 enumerates SMT threads; the next level up is assumed to be a cluster sharing the LLC.
+	auto levelShift = (mpidr & (uint64_t(1) << 24)) ? 8 : 0;
+	cpu_data->coreId = cpu_data->affinity >> levelShift;
+	cpu_data->llcId = cpu_data->affinity >> (levelShift + 8);
+	cpu_data->packageId = cpu_data->affinity >> (levelShift + 16);
+
 	cpu_data->irqStack = UniqueKernelStack::make();
 	cpu_data->detachedStack = UniqueKernelStack::make();
 	cpu_data->idleStack = UniqueKernelStack::make();
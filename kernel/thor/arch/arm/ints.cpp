@@ -15,12 +15,30 @@ void initializeIrqVectors() {
 	asm volatile ("msr vbar_el1, %0" :: "r"(&thorExcVectors));
 }
 
-extern "C" void enableIntsAndHaltForever();
-
-void suspendSelf() {
+void enterIdleDomain() {
 	assert(!intsAreEnabled());
 	getCpuData()->currentDomain = static_cast<uint64_t>(Domain::idle);
-	enableIntsAndHaltForever();
+}
+
+void waitForInterrupt() {
+	assert(!intsAreEnabled());
+	// WFI also wakes up on masked IRQs; unmask them to take the pending IRQ.
+	asm volatile ("wfi\n"
+		"\tmsr daifclr, #15\n"
+		"\tisb\n"
+		"\tmsr daifset, #15" : : : "memory");
+}
+
+bool haveMonitorWait() {
+	return false;
+}
+
+void monitorAddress(const void *) {
+	__builtin_trap();
+}
+
+void waitForMonitorOrInterrupt() {
+	__builtin_trap();
 }
 
 void sendPingIpi(CpuData *dstData) {
@@ -233,10 +251,7 @@ extern "C" void onPlatformIrq(IrqImageAccessor image) {
 			assert(!irqMutex().nesting());
 			disableUserAccess();
 
-			for(auto &binding : asidData.get()->bindings)
-				binding.shootdown();
-
-			asidData.get()->globalBinding.shootdown();
+			handleShootdownIpi();
 		} else if (irq == 2) {
 			assert(!irqMutex().nesting());
 			disableUserAccess();
@@ -262,7 +277,11 @@ extern "C" void onPlatformWork() {
 	disableUserAccess();
 
 	enableInts();
-	getCurrentThread()->mainWorkQueue()->run();
+	// run() limits the amount of background work; keep going until the WQ is drained.
+	auto wq = getCurrentThread()->mainWorkQueue();
+	do {
+		wq->run();
+	} while(wq->check());
 	disableInts();
 }
 
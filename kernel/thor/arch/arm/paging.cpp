@@ -104,6 +104,7 @@ void initializeAsidContext(CpuData *cpuData) {
 	// TODO(qookie): Check the max number of ASIDs. 256 is safe, but it could also be 65536.
 	asidData.get(cpuData).initialize(256);
 	asidData.get(cpuData)->globalBinding.initialize(globalBindingId);
+	enableShootdownIpis(cpuData);
 	asidData.get(cpuData)->globalBinding.initialBind(*kernelSpacePtr);
 }
 
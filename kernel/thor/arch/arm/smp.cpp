@@ -268,23 +268,28 @@ bool bootSecondary(DeviceTreeNode *node) {
 	return !dontWait;
 }
 
+static inline frg::array<frg::string_view, 2> psciCompatible = {
+	"arm,psci",
+	"arm,psci-1.0"
+};
+
+static inline frg::array<frg::string_view, 4> cpuCompatible = {
+	"arm,cortex-a72",
+	"arm,cortex-a53",
+	"arm,arm-v8",
+	"arm,armv8"
+};
+
 static initgraph::Task initAPs{&globalInitEngine, "arm.init-aps",
 	initgraph::Requires{getDeviceTreeParsedStage(), getTaskingAvailableStage()},
 	[] {
-		getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-			if (node->isCompatible<2>({"arm,psci", "arm,psci-1.0"})) {
-				psci_.initialize(node);
-				return true;
-			}
-
-			return false;
+		forEachCompatibleNode(psciCompatible, [&](DeviceTreeNode *node) -> bool {
+			psci_.initialize(node);
+			return true;
 		});
 
-		getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-			if (node->isCompatible<4>({"arm,cortex-a72", "arm,cortex-a53", "arm,arm-v8", "arm,armv8"})) {
-				bootSecondary(node);
-			}
-
+		forEachCompatibleNode(cpuCompatible, [&](DeviceTreeNode *node) -> bool {
+			bootSecondary(node);
 			return false;
 		});
 	}
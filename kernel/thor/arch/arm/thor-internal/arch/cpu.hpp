@@ -287,4 +287,8 @@ initgraph::Stage *getBootProcessorReadyStage();
 struct CpuData;
 void prepareCpuDataFor(CpuData *context, int cpu);
 
+inline void pause() {
+	asm volatile ("yield");
+}
+
 } // namespace thor
@@ -71,17 +71,17 @@ static DeviceTreeNode *timerNode = nullptr;
 static dt::IrqController *timerIrqParent = nullptr;
 static frg::manual_box<dtb::Cells> timerIrq;
 
+static inline frg::array<frg::string_view, 1> timerCompatible = {
+	"arm,armv8-timer"
+};
+
 static initgraph::Task initTimerIrq{&globalInitEngine, "arm.init-timer-irq",
 	initgraph::Requires{getIrqControllerReadyStage()},
 	initgraph::Entails{getTaskingAvailableStage()},
 	[] {
-		getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-			if (node->isCompatible<1>({"arm,armv8-timer"})) {
-				timerNode = node;
-				return true;
-			}
-
-			return false;
+		forEachCompatibleNode(timerCompatible, [&](DeviceTreeNode *node) -> bool {
+			timerNode = node;
+			return true;
 		});
 
 		assert(timerNode && "Failed to find timer");
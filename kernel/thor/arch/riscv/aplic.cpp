@@ -475,14 +475,12 @@ initgraph::Task initPlic{
     [] {
 	    phandleToImsic.initialize(frg::hash<uint32_t>{}, *kernelAlloc);
 
-	    getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-		    if (node->isCompatible(imsciCompatible))
-			    enumerateImsic(node);
+	    forEachCompatibleNode(imsciCompatible, [&](DeviceTreeNode *node) -> bool {
+		    enumerateImsic(node);
 		    return false;
 	    });
-	    getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-		    if (node->isCompatible(aplicCompatible))
-			    enumerateAplic(node);
+	    forEachCompatibleNode(aplicCompatible, [&](DeviceTreeNode *node) -> bool {
+		    enumerateAplic(node);
 		    return false;
 	    });
     }
@@ -44,10 +44,20 @@ void sendSelfCallIpi() {
 		doSendIpi(selfData);
 }
 
-void suspendSelf() {
+void enterIdleDomain() {}
+
+void waitForInterrupt() {
+	assert(!intsAreEnabled());
+	// WFI also wakes up on locally enabled IRQs while SIE is clear.
+	asm volatile("wfi" : : : "memory");
 	enableInts();
-	while (true)
-		asm volatile("wfi");
+	disableInts();
 }
 
+bool haveMonitorWait() { return false; }
+
+void monitorAddress(const void *) { __builtin_trap(); }
+
+void waitForMonitorOrInterrupt() { __builtin_trap(); }
+
 } // namespace thor
@@ -4,6 +4,7 @@
 #include <thor-internal/arch/paging.hpp>
 #include <thor-internal/arch/unimplemented.hpp>
 #include <thor-internal/cpu-data.hpp>
+#include <thor-internal/debug.hpp>
 #include <thor-internal/mm-rc.hpp>
 #include <thor-internal/physical.hpp>
 
@@ -21,33 +22,86 @@ constinit frg::manual_box<smarter::shared_ptr<KernelPageSpace>> kernelSpacePtr;
 // Physical page access.
 // --------------------------------------------------------
 
+namespace {
+
+// Upper bound on the number of ASIDs that we use per CPU.
+// Each ASID corresponds to a PageBinding; more bindings make rebinding and shootdown slower.
+constexpr int maxAsidCount = 256;
+
+// Number of ASIDs that are supported by the hart (determined on the boot CPU).
+// If this is 1, the ASID field of satp is not implemented and we always use ASID 0.
+constinit int asidCount = 0;
+
+uint64_t satpMode() {
+	return 8 + (ClientCursorPolicy::numLevels() - 3);
+}
+
+uint64_t makeSatp(PhysicalAddr root, int asid) {
+	assert(asid >= 0 && asid < asidCount);
+	return (root >> 12) | (uint64_t(asid) << 44) | (satpMode() << 60);
+}
+
+// The number of implemented ASID bits (ASIDLEN) can be determined by writing ones
+// to the ASID field of satp and reading back the result.
+int probeAsidCount() {
+	auto satp = riscv::readCsr<riscv::Csr::satp>();
+	riscv::writeCsr<riscv::Csr::satp>(satp | (UINT64_C(0xFFFF) << 44));
+	auto probed = riscv::readCsr<riscv::Csr::satp>();
+	riscv::writeCsr<riscv::Csr::satp>(satp);
+	// Changing the ASID does not require a fence but flush anyway to be safe.
+	asm volatile("sfence.vma" : : : "memory");
+
+	auto asidBits = __builtin_popcountll((probed >> 44) & 0xFFFF);
+	return frg::min(1 << asidBits, maxAsidCount);
+}
+
+} // namespace
+
 void switchToPageTable(PhysicalAddr root, int asid, bool invalidate) {
-	uint64_t mode = 8 + (ClientCursorPolicy::numLevels() - 3);
-	riscv::writeCsr<riscv::Csr::satp>((root >> 12) | (mode << 60));
-	asm volatile("sfence.vma" : : : "memory"); // This is too coarse (also invalidates global).
+	assert(asid != globalBindingId);
+	riscv::writeCsr<riscv::Csr::satp>(makeSatp(root, asid));
+	if(invalidate)
+		invalidateAsid(asid);
 }
 
 void switchAwayFromPageTable(int asid) {
-	// Switch to kernel page tables and invalidate.
-	auto root = KernelPageSpace::global().rootTable();
-	uint64_t mode = 8 + (ClientCursorPolicy::numLevels() - 3);
-	riscv::writeCsr<riscv::Csr::satp>((root >> 12) | (mode << 60));
-	asm volatile("sfence.vma" : : : "memory"); // This is too coarse (also invalidates global).
+	// Switch to the kernel page tables (which only contain global mappings)
+	// and drop all non-global translations of this ASID.
+	assert(asid != globalBindingId);
+	riscv::writeCsr<riscv::Csr::satp>(makeSatp(KernelPageSpace::global().rootTable(), asid));
+	invalidateAsid(asid);
 }
 
 void invalidateAsid(int asid) {
-	asm volatile("sfence.vma" : : : "memory"); // This is too coarse (also invalidates global).
+	if(asid == globalBindingId) {
+		asm volatile("sfence.vma" : : : "memory");
+	}else{
+		// This does not affect global mappings.
+		asm volatile("sfence.vma zero, %0" : : "r"(asid) : "memory");
+	}
 }
 
 void invalidatePage(int asid, const void *address) {
-	asm volatile("sfence.vma" : : : "memory"); // This is too coarse (also invalidates global).
+	if(asid == globalBindingId) {
+		// With rs2 = zero, this also invalidates global mappings.
+		asm volatile("sfence.vma %0, zero" : : "r"(address) : "memory");
+	}else{
+		asm volatile("sfence.vma %0, %1" : : "r"(address), "r"(asid) : "memory");
+	}
 }
 
 void initializeAsidContext(CpuData *cpuData) {
 	auto irqLock = frg::guard(&irqMutex());
 
-	asidData.get(cpuData).initialize(1);
+	// We assume that all harts implement the same number of ASID bits.
+	if(!asidCount) {
+		asidCount = probeAsidCount();
+		infoLogger() << "thor: Using " << asidCount << " ASIDs per CPU" << frg::endlog;
+	}
+
+	asidData.get(cpuData).initialize(asidCount);
 	asidData.get(cpuData)->globalBinding.initialize(globalBindingId);
+	enableShootdownIpis(cpuData);
 	asidData.get(cpuData)->globalBinding.initialBind(*kernelSpacePtr);
 }
 
@@ -210,9 +210,8 @@ initgraph::Task initPlic{
     initgraph::Requires{getDeviceTreeParsedStage()},
     initgraph::Entails{getTaskingAvailableStage()},
     [] {
-	    getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-		    if (node->isCompatible(plicCompatible))
-			    enumeratePlic(node);
+	    forEachCompatibleNode(plicCompatible, [&](DeviceTreeNode *node) -> bool {
+		    enumeratePlic(node);
 		    return false;
 	    });
     }
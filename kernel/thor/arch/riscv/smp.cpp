@@ -140,9 +140,8 @@ initgraph::Task initAPs{
     [] {
 	    setUpTrampoline();
 
-	    getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-		    if (node->isCompatible(cpuCompatible))
-			    bootAp(node);
+	    forEachCompatibleNode(cpuCompatible, [&](DeviceTreeNode *node) -> bool {
+		    bootAp(node);
 		    return false;
 	    });
     }
@@ -235,6 +235,11 @@ void prepareCpuDataFor(CpuData *context, int cpu);
 void setupBootCpuContext();
 void initializeThisProcessor();
 
+inline void pause() {
+	// Encoding of the Zihintpause PAUSE instruction; executes as a FENCE hint elsewhere.
+	asm volatile(".insn i 0x0F, 0, x0, x0, 0x010");
+}
+
 initgraph::Stage *getBootProcessorReadyStage();
 
 } // namespace thor
@@ -18,6 +18,4 @@ inline void disableInts() {
 
 inline void halt() { asm volatile("wfi"); }
 
-void suspendSelf();
-
 } // namespace thor
@@ -114,12 +114,8 @@ void handleRiscvIpi(Frame *frame) {
 	if (mask & PlatformCpuData::ipiPing)
 		localScheduler.get(cpuData).forcePreemptionCall();
 
-	if (mask & PlatformCpuData::ipiShootdown) {
-		for (auto &binding : asidData.get()->bindings)
-			binding.shootdown();
-
-		asidData.get()->globalBinding.shootdown();
-	}
+	if (mask & PlatformCpuData::ipiShootdown)
+		handleShootdownIpi();
 
 	if (mask & PlatformCpuData::ipiSelfCall)
 		SelfIntCallBase::runScheduledCalls();
@@ -320,7 +316,11 @@ void handleRiscvWorkOnExecutor(Executor *executor, Frame *frame) {
 	auto *cpuData = getCpuData();
 
 	enableInts();
-	getCurrentThread()->mainWorkQueue()->run();
+	// run() limits the amount of background work; keep going until the WQ is drained.
+	auto wq = getCurrentThread()->mainWorkQueue();
+	do {
+		wq->run();
+	} while(wq->check());
 	disableInts();
 
 	assert(!cpuData->stashedFs);
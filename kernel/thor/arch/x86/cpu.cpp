@@ -6,7 +6,9 @@
 #include <thor-internal/kasan.hpp>
 #include <thor-internal/load-balancing.hpp>
 #include <thor-internal/main.hpp>
+#include <thor-internal/numa.hpp>
 #include <thor-internal/physical.hpp>
+#include <thor-internal/profile.hpp>
 #include <thor-internal/ring-buffer.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/arch/pic.hpp>
@@ -18,6 +20,9 @@ namespace {
 }
 
 namespace {
+	// IDs for Executor::_simdId. Zero is reserved.
+	constinit std::atomic<uint64_t> nextSimdId{1};
+
 	void activateTss(common::x86::Tss64 *tss) {
 		common::x86::makeGdtTss64Descriptor(getCpuData()->gdt, kGdtIndexTask,
 				tss, sizeof(common::x86::Tss64));
@@ -79,6 +84,7 @@ Executor::Executor(UserContext *context, AbiParameters abi) {
 
 	_fxState()->mxcsr |= mxcsrInitializer;
 	_fxState()->fcw |= fcwInitializer;
+	_simdId = nextSimdId.fetch_add(1, std::memory_order_relaxed);
 
 	general()->rip = abi.ip;
 	general()->rflags = 0x200;
@@ -101,6 +107,7 @@ Executor::Executor(FiberContext *context, AbiParameters abi)
 
 	_fxState()->mxcsr |= mxcsrInitializer;
 	_fxState()->fcw |= fcwInitializer;
+	_simdId = nextSimdId.fetch_add(1, std::memory_order_relaxed);
 
 	general()->rip = abi.ip;
 	general()->rflags = 0x200;
@@ -114,6 +121,32 @@ Executor::~Executor() {
 	kernelAlloc->free(_pointer);
 }
 
+void Executor::_saveSimdState(bool optimized) {
+	if(getGlobalCpuFeatures()->haveXsave){
+		// XSAVEOPT is only correct if the save area was not modified since the last XRSTOR.
+		// This is guaranteed if the executor was running, as software only modifies
+		// the save area while the executor is not running and invalidateSimdState()
+		// forces an XRSTOR in that case.
+		if(optimized && getGlobalCpuFeatures()->haveXsaveopt) {
+			common::x86::xsaveopt((uint8_t*)_fxState(), ~0);
+		}else{
+			common::x86::xsave((uint8_t*)_fxState(), ~0);
+		}
+	}else{
+		asm volatile ("fxsaveq %0" : : "m" (*_fxState()));
+	}
+
+	// The registers still contain the executor's state.
+	auto cpuData = getPlatformCpuData();
+	cpuData->simdOwner = _simdId;
+	_simdCpu = cpuData;
+}
+
+void saveCurrentSimdState(Executor *executor) {
+	// The executor did not necessarily run before, so we cannot use XSAVEOPT.
+	executor->_saveSimdState(false);
+}
+
 void saveExecutor(Executor *executor, FaultImageAccessor accessor) {
 	executor->general()->rax = accessor._frame()->rax;
 	executor->general()->rbx = accessor._frame()->rbx;
@@ -140,11 +173,7 @@ void saveExecutor(Executor *executor, FaultImageAccessor accessor) {
 	executor->general()->clientFs = common::x86::rdmsr(common::x86::kMsrIndexFsBase);
 	executor->general()->clientGs = common::x86::rdmsr(common::x86::kMsrIndexKernelGsBase);
 
-	if(getGlobalCpuFeatures()->haveXsave){
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	} else {
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
+	executor->_saveSimdState(true);
 }
 
 void saveExecutor(Executor *executor, IrqImageAccessor accessor) {
@@ -174,11 +203,7 @@ void saveExecutor(Executor *executor, IrqImageAccessor accessor) {
 	executor->general()->clientGs = common::x86::rdmsr(common::x86::kMsrIndexKernelGsBase);
 
 
-	if(getGlobalCpuFeatures()->haveXsave){
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	}else{
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
+	executor->_saveSimdState(true);
 }
 
 void saveExecutor(Executor *executor, SyscallImageAccessor accessor) {
@@ -207,11 +232,7 @@ void saveExecutor(Executor *executor, SyscallImageAccessor accessor) {
 	executor->general()->clientFs = common::x86::rdmsr(common::x86::kMsrIndexFsBase);
 	executor->general()->clientGs = common::x86::rdmsr(common::x86::kMsrIndexKernelGsBase);
 
-	if(getGlobalCpuFeatures()->haveXsave){
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	}else{
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
+	executor->_saveSimdState(true);
 }
 
 extern "C" void workStub();
@@ -254,10 +275,17 @@ extern "C" [[ noreturn ]] void _restoreExecutorRegisters(void *pointer);
 	common::x86::wrmsr(common::x86::kMsrIndexFsBase, executor->general()->clientFs);
 	common::x86::wrmsr(common::x86::kMsrIndexKernelGsBase, executor->general()->clientGs);
 
-	if(getGlobalCpuFeatures()->haveXsave){
-		common::x86::xrstor((uint8_t*)executor->_fxState(), ~0);
-	}else{
-		asm volatile ("fxrstorq %0" : : "m" (*executor->_fxState()));
+	// If the executor's SIMD state is still loaded into the registers
+	// (i.e., it was saved on this CPU and no other executor was restored since),
+	// we can skip the (expensive) restore.
+	auto cpuData = getPlatformCpuData();
+	if(executor->_simdCpu != cpuData || cpuData->simdOwner != executor->_simdId) {
+		if(getGlobalCpuFeatures()->haveXsave){
+			common::x86::xrstor((uint8_t*)executor->_fxState(), ~0);
+		}else{
+			asm volatile ("fxrstorq %0" : : "m" (*executor->_fxState()));
+		}
+		cpuData->simdOwner = executor->_simdId;
 	}
 
 	uint16_t cs = executor->general()->cs;
@@ -382,6 +410,11 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 
 			auto xsaveCpuid = common::x86::cpuid(0xD);
 			globalCpuFeatures.xsaveRegionSize = xsaveCpuid[2];
+
+			if(common::x86::cpuid(0xD, 1)[0] & 1) {
+				debugLogger() << "thor: CPUs support XSAVEOPT" << frg::endlog;
+				globalCpuFeatures.haveXsaveopt = true;
+			}
 		}else{
 			debugLogger() << "thor: CPUs do not support XSAVE!" << frg::endlog;
 		}
@@ -402,6 +435,11 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 			}
 		}
 
+		if(common::x86::cpuid(0x1)[2] & (uint32_t(1) << 3)) {
+			debugLogger() << "thor: CPUs support MONITOR/MWAIT" << frg::endlog;
+			globalCpuFeatures.haveMonitorWait = true;
+		}
+
 		if(common::x86::cpuid(0x80000007)[3] & (1 << 8)) {
 			debugLogger() << "thor: CPUs support invariant TSC"
 					<< frg::endlog;
@@ -419,6 +457,13 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 					<< frg::endlog;
 		}
 
+		if(common::x86::cpuid(common::x86::kCpuIndexExtendedFeatures)[3] & (1 << 26)) {
+			debugLogger() << "thor: CPUs support 1 GiB pages" << frg::endlog;
+			globalCpuFeatures.haveGiantPages = true;
+		}else{
+			debugLogger() << "thor: CPUs do not support 1 GiB pages!" << frg::endlog;
+		}
+
 		auto intelPmLeaf = common::x86::cpuid(0xA)[0];
 		if(intelPmLeaf & 0xFF) {
 			debugLogger() << "thor: CPUs support Intel performance counters"
@@ -478,6 +523,12 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 			debugLogger() << "thor: CPUs support VMX"
 					<< frg::endlog;
 			globalCpuFeatures.haveVmx = true;
+
+			auto eptCaps = common::x86::rdmsr(0x48C);
+			if(eptCaps & (1 << 16))
+				globalCpuFeatures.haveEptLargePages = true;
+			if(eptCaps & (1 << 17))
+				globalCpuFeatures.haveEptGiantPages = true;
 		}else{
 			debugLogger() << "thor: CPUs do not support VMX!" << frg::endlog;
 		}
@@ -556,9 +607,82 @@ static initgraph::Task initBootProcessorTask{&globalInitEngine, "x86.init-boot-p
 	}
 };
 
+namespace {
+	unsigned int ceilLog2(uint32_t x) {
+		unsigned int s = 0;
+		while((uint32_t(1) << s) < x)
+			s++;
+		return s;
+	}
+
+	// Determine the SMT, LLC and package IDs of the current CPU from its (x2)APIC ID.
+	void discoverTopology(CpuData *cpuData) {
+		auto maxLeaf = common::x86::cpuid(0)[0];
+		uint32_t apicId = common::x86::cpuid(0x1)[1] >> 24;
+		unsigned int smtShift = 0;
+		unsigned int packageShift = 0;
+
+		// Leaf 0x1F (or its predecessor 0xB) enumerates the levels of the x2APIC ID.
+		bool haveLevels = false;
+		for(uint32_t leaf : {uint32_t(0x1F), uint32_t(0xB)}) {
+			if(maxLeaf < leaf || !common::x86::cpuid(leaf, 0)[1])
+				continue;
+			apicId = common::x86::cpuid(leaf, 0)[3];
+			for(uint32_t subleaf = 0; ; subleaf++) {
+				auto regs = common::x86::cpuid(leaf, subleaf);
+				auto type = (regs[2] >> 8) & 0xFF;
+				if(!type)
+					break;
+				// Type 1 is the SMT level. The shift of the last level yields the package ID.
+				if(type == 1)
+					smtShift = regs[0] & 0x1F;
+				packageShift = regs[0] & 0x1F;
+			}
+			haveLevels = true;
+			break;
+		}
+		if(!haveLevels && (common::x86::cpuid(0x1)[3] & (uint32_t(1) << 28)))
+			packageShift = ceilLog2((common::x86::cpuid(0x1)[1] >> 16) & 0xFF);
+
+		// Find the cache with the highest level. Intel uses leaf 4;
+		// AMD uses leaf 0x8000001D (if topology extensions are supported).
+		unsigned int llcShift = packageShift;
+		auto scanCaches = [&] (uint32_t leaf) -> bool {
+			uint32_t llcLevel = 0;
+			for(uint32_t subleaf = 0; subleaf < 16; subleaf++) {
+				auto regs = common::x86::cpuid(leaf, subleaf);
+				if(!(regs[0] & 0x1F))
+					break;
+				auto level = (regs[0] >> 5) & 7;
+				if(level > llcLevel) {
+					llcLevel = level;
+					llcShift = ceilLog2(((regs[0] >> 14) & 0xFFF) + 1);
+				}
+			}
+			return llcLevel != 0;
+		};
+		bool haveCaches = maxLeaf >= 4 && scanCaches(4);
+		if(!haveCaches && common::x86::cpuid(0x80000000)[0] >= 0x8000001D
+				&& (common::x86::cpuid(0x80000001)[2] & (uint32_t(1) << 22)))
+			scanCaches(0x8000001D);
+		if(packageShift && llcShift > packageShift)
+			llcShift = packageShift;
+
+		cpuData->coreId = apicId >> smtShift;
+		cpuData->llcId = apicId >> llcShift;
+		cpuData->packageId = apicId >> packageShift;
+
+		debugLogger() << "thor: CPU with APIC ID " << apicId << " is core " << cpuData->coreId
+				<< ", LLC " << cpuData->llcId << ", package " << cpuData->packageId << frg::endlog;
+	}
+
+}
+
 void initializeThisProcessor() {
 	auto cpuData = getCpuData();
 
+	discoverTopology(cpuData);
+
 	// Allocate per-CPU areas.
 	cpuData->irqStack = UniqueKernelStack::make();
 	cpuData->dfStack = UniqueKernelStack::make();
@@ -743,17 +867,31 @@ void initializeThisProcessor() {
 extern "C" uint8_t _binary_kernel_thor_arch_x86_trampoline_bin_start[];
 extern "C" uint8_t _binary_kernel_thor_arch_x86_trampoline_bin_end[];
 
+// The trampoline page contains the trampoline code, followed by an array of status blocks.
+// Each AP looks up its status block by APIC ID. This allows us to boot multiple APs at once.
+// Keep the layout in sync with trampoline.S.
 struct StatusBlock {
 	StatusBlock *self; // Pointer to this struct in the higher half.
 	unsigned int targetStage;
 	unsigned int initiatorStage;
 	unsigned int pml4;
+	unsigned int apicId;
 	uintptr_t stack;
 	void (*main)(StatusBlock *);
 	CpuData *cpuContext;
+	uint64_t padding[2];
 };
 
-static_assert(sizeof(StatusBlock) == 48, "Bad sizeof(StatusBlock)");
+static_assert(sizeof(StatusBlock) == 64, "Bad sizeof(StatusBlock)");
+
+namespace {
+	// TODO: Allocate a page in low physical memory instead of hard-coding it.
+	constexpr uintptr_t trampolinePma = 0x10000;
+	constexpr size_t statusBlocksOffset = 0x400;
+	constexpr size_t maxApsPerBatch = (kPageSize - statusBlocksOffset) / sizeof(StatusBlock);
+	// No AP uses this APIC ID; it marks unused status blocks.
+	constexpr unsigned int noApicId = ~0u;
+}
 
 void secondaryMain(StatusBlock *statusBlock) {
 	auto cpuContext = statusBlock->cpuContext;
@@ -767,82 +905,105 @@ void secondaryMain(StatusBlock *statusBlock) {
 	Scheduler::resume(cpuContext->wqFiber);
 
 	LoadBalancer::singleton().setOnline(cpuContext);
+	initializeProfileOnThisCpu();
 	auto scheduler = &localScheduler.get();
 	scheduler->update();
 	scheduler->forceReschedule();
 	scheduler->commitReschedule();
 }
 
-void bootSecondary(unsigned int apic_id) {
-	if(disableSmp)
+void bootSecondaries(frg::span<unsigned int> apicIds) {
+	if(disableSmp || !apicIds.size())
 		return;
 
-	// TODO: Allocate a page in low physical memory instead of hard-coding it.
-	uintptr_t pma = 0x10000;
-
 	// Copy the trampoline code into low physical memory.
+	// All APs share the same copy of the code.
 	auto image_size = (uintptr_t)_binary_kernel_thor_arch_x86_trampoline_bin_end
 			- (uintptr_t)_binary_kernel_thor_arch_x86_trampoline_bin_start;
-	assert(image_size <= kPageSize);
-	PageAccessor accessor{pma};
+	assert(image_size <= statusBlocksOffset);
+	PageAccessor accessor{trampolinePma};
 	memcpy(accessor.get(), _binary_kernel_thor_arch_x86_trampoline_bin_start, image_size);
 
-	// Allocate a stack for the initialization code.
-	constexpr size_t stack_size = 0x10000;
-	void *stack_ptr = kernelAlloc->allocate(stack_size);
-
-	auto [context, cpuNr] = extendPerCpuData();
-	prepareCpuDataFor(context, cpuNr);
-
-	context->localApicId = apic_id;
-	context->localLogRing = frg::construct<ReentrantRecordRing>(*kernelAlloc);
-
-	// Participate in global TLB invalidation *before* paging is used by the target CPU.
-	initializeAsidContext(context);
-
-	// Setup a status block to communicate information to the AP.
-	auto statusBlock = reinterpret_cast<StatusBlock *>(reinterpret_cast<char *>(accessor.get())
-			+ (kPageSize - sizeof(StatusBlock)));
-	debugLogger() << "status block accessed via: " << statusBlock << frg::endlog;
-
-	statusBlock->self = statusBlock;
-	statusBlock->targetStage = 0;
-	statusBlock->initiatorStage = 0;
-	statusBlock->pml4 = KernelPageSpace::global().rootTable();
-	statusBlock->stack = (uintptr_t)stack_ptr + stack_size;
-	statusBlock->main = &secondaryMain;
-	statusBlock->cpuContext = context;
-
-	// Send the IPI sequence that starts up the AP.
-	// On modern processors INIT lets the processor enter the wait-for-SIPI state.
-	// The BIOS is not involved in this process at all.
-	infoLogger() << "thor: Booting AP " << apic_id << "." << frg::endlog;
-	raiseInitAssertIpi(apic_id);
-	KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(10'000'000)); // Wait for 10ms.
-
-	// SIPI causes the processor to resume execution and resets CS:IP.
-	// Intel suggets to send two SIPIs (probably for redundancy reasons).
-	raiseStartupIpi(apic_id, pma);
-	KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(200'000)); // Wait for 200us.
-	raiseStartupIpi(apic_id, pma);
-	KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(200'000)); // Wait for 200us.
-
-	// Wait until the AP wakes up.
-	while(__atomic_load_n(&statusBlock->targetStage, __ATOMIC_ACQUIRE) < 1) {
-		pause();
-	}
-	debugLogger() << "thor: AP did wake up." << frg::endlog;
+	auto statusBlocks = reinterpret_cast<StatusBlock *>(reinterpret_cast<char *>(accessor.get())
+			+ statusBlocksOffset);
+
+	for(size_t base = 0; base < apicIds.size(); base += maxApsPerBatch) {
+		auto n = frg::min(apicIds.size() - base, maxApsPerBatch);
+
+		for(size_t i = 0; i < maxApsPerBatch; ++i)
+			statusBlocks[i].apicId = noApicId;
+
+		for(size_t i = 0; i < n; ++i) {
+			auto apicId = apicIds[base + i];
+
+			// Allocate a stack for the initialization code.
+			constexpr size_t stack_size = 0x10000;
+			void *stack_ptr = kernelAlloc->allocate(stack_size);
+
+			auto [context, cpuNr] = extendPerCpuData();
+			prepareCpuDataFor(context, cpuNr);
+
+			context->localApicId = apicId;
+			context->numaNode = getCpuNumaNode(apicId);
+			context->localLogRing = frg::construct<ReentrantRecordRing>(*kernelAlloc);
 
-	// We only let the AP proceed after all IPIs have been sent.
-	// This ensures that the AP does not execute boot code twice (e.g. in case
-	// it already wakes up after a single SIPI).
-	__atomic_store_n(&statusBlock->initiatorStage, 1, __ATOMIC_RELEASE);
+			// Participate in global TLB invalidation *before* paging is used by the target CPU.
+			initializeAsidContext(context);
 
-	// Wait until the AP exits the boot code.
-	while(__atomic_load_n(&statusBlock->targetStage, __ATOMIC_ACQUIRE) < 2) {
-		pause();
+			// Setup a status block to communicate information to the AP.
+			auto statusBlock = &statusBlocks[i];
+			statusBlock->self = statusBlock;
+			statusBlock->targetStage = 0;
+			statusBlock->initiatorStage = 0;
+			statusBlock->pml4 = KernelPageSpace::global().rootTable();
+			statusBlock->apicId = apicId;
+			statusBlock->stack = (uintptr_t)stack_ptr + stack_size;
+			statusBlock->main = &secondaryMain;
+			statusBlock->cpuContext = context;
+		}
+
+		// Send the IPI sequence that starts up the APs.
+		// On modern processors INIT lets the processor enter the wait-for-SIPI state.
+		// The BIOS is not involved in this process at all.
+		// We pipeline the sequence such that all APs of a batch share the same delays.
+		for(size_t i = 0; i < n; ++i) {
+			infoLogger() << "thor: Booting AP " << apicIds[base + i] << "." << frg::endlog;
+			raiseInitAssertIpi(apicIds[base + i]);
+		}
+		KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(10'000'000)); // Wait for 10ms.
+
+		// SIPI causes the processor to resume execution and resets CS:IP.
+		// Intel suggets to send two SIPIs (probably for redundancy reasons).
+		for(size_t i = 0; i < n; ++i)
+			raiseStartupIpi(apicIds[base + i], trampolinePma);
+		KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(200'000)); // Wait for 200us.
+		for(size_t i = 0; i < n; ++i)
+			raiseStartupIpi(apicIds[base + i], trampolinePma);
+		KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(200'000)); // Wait for 200us.
+
+		// Wait until the APs wake up.
+		for(size_t i = 0; i < n; ++i) {
+			while(__atomic_load_n(&statusBlocks[i].targetStage, __ATOMIC_ACQUIRE) < 1) {
+				pause();
+			}
+		}
+		debugLogger() << "thor: " << n << " APs did wake up." << frg::endlog;
+
+		// We only let the APs proceed after all IPIs have been sent.
+		// This ensures that no AP executes boot code twice (e.g. in case
+		// it already wakes up after a single SIPI).
+		for(size_t i = 0; i < n; ++i)
+			__atomic_store_n(&statusBlocks[i].initiatorStage, 1, __ATOMIC_RELEASE);
+
+		// Wait until all APs exit the boot code. Afterwards, the status blocks
+		// can be reused for the next batch.
+		for(size_t i = 0; i < n; ++i) {
+			while(__atomic_load_n(&statusBlocks[i].targetStage, __ATOMIC_ACQUIRE) < 2) {
+				pause();
+			}
+		}
+		debugLogger() << "thor: " << n << " APs finished booting." << frg::endlog;
 	}
-	debugLogger() << "thor: AP finished booting." << frg::endlog;
 }
 
 Error getEntropyFromCpu(void *buffer, size_t size) {
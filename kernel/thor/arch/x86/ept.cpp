@@ -1,3 +1,4 @@
+#include <thor-internal/arch/cpu.hpp>
 #include <thor-internal/arch/ept.hpp>
 #include <thor-internal/address-space.hpp>
 #include <thor-internal/physical.hpp>
@@ -9,6 +10,7 @@ constexpr uint64_t eptWrite = UINT64_C(1) << 1;
 constexpr uint64_t eptExecute = UINT64_C(1) << 2;
 constexpr uint64_t eptCacheWb = UINT64_C(6) << 3;
 constexpr uint64_t eptIgnorePat = UINT64_C(1) << 6;
+constexpr uint64_t eptLarge = UINT64_C(1) << 7;
 constexpr uint64_t eptDirty = UINT64_C(1) << 9;
 // TODO: Support user-executable permissions (needs VM-x bit).
 // constexpr uint64_t eptUserExecute = UINT64_C(1) << 10;
@@ -57,7 +59,7 @@ struct EptCursorPolicy {
 
 
 	static constexpr bool pteTablePresent(uint64_t pte) {
-		return pte & eptRead;
+		return (pte & eptRead) && !(pte & eptLarge);
 	}
 
 	static constexpr PhysicalAddr pteTableAddress(uint64_t pte) {
@@ -73,9 +75,36 @@ struct EptCursorPolicy {
 
 		return newPtAddr | eptRead | eptWrite | eptExecute;
 	}
+
+	static bool levelHasLargePages(size_t level) {
+		if(level == 2) // 2 MiB pages.
+			return getGlobalCpuFeatures()->haveEptLargePages;
+		if(level == 1) // 1 GiB pages.
+			return getGlobalCpuFeatures()->haveEptGiantPages;
+		return false;
+	}
+
+	static constexpr bool pteLargePage(uint64_t pte) {
+		return (pte & eptRead) && (pte & eptLarge);
+	}
+
+	static constexpr PhysicalAddr pteLargePageAddress(uint64_t pte) {
+		return pte & eptAddress;
+	}
+
+	static constexpr uint64_t pteBuildLarge(PhysicalAddr physical, PageFlags flags,
+			CachingMode cachingMode) {
+		return pteBuild(physical, flags, cachingMode) | eptLarge;
+	}
+
+	static constexpr uint64_t pteSplitLarge(uint64_t pte, size_t level) {
+		if(level != maxLevels - 1)
+			return pte;
+		return pte & ~eptLarge;
+	}
 };
 
-static_assert(CursorPolicy<EptCursorPolicy>);
+static_assert(LargePageCursorPolicy<EptCursorPolicy>);
 
 using EptCursor = thor::PageCursor<EptCursorPolicy>;
 
@@ -126,6 +155,18 @@ frg::expected<Error> EptOperations::faultPage(VirtualAddr va, MemoryView *view,
 			va, view, offset, flags, mode);
 }
 
+frg::expected<Error> EptOperations::faultAround(VirtualAddr va, MemoryView *view,
+		uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) {
+	return faultAroundByCursor<EptCursor>(pageSpace_,
+			va, view, offset, size, flags, mode);
+}
+
+frg::expected<Error> EptOperations::faultLargePage(VirtualAddr va, MemoryView *view,
+		uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) {
+	return faultLargePageByCursor<EptCursor>(pageSpace_,
+			va, view, offset, size, flags, mode);
+}
+
 frg::expected<Error> EptOperations::cleanPages(VirtualAddr va, MemoryView *view,
 		uintptr_t offset, size_t size) {
 	return cleanPagesByCursor<EptCursor>(pageSpace_,
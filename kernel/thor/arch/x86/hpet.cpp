@@ -68,7 +68,7 @@ struct HpetDevice final : IrqSink, ClockSource {
 	friend void setupHpet(PhysicalAddr);
 
 private:
-	using Mutex = frg::ticket_spinlock;
+	using Mutex = TicketSpinlock;
 
 	static constexpr bool logIrqs = false;
 
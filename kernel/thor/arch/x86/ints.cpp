@@ -7,6 +7,7 @@
 #include <thor-internal/arch/pmc-intel.hpp>
 #include <thor-internal/arch/system.hpp>
 #include <thor-internal/arch/pic.hpp>
+#include <thor-internal/arch/stack.hpp>
 
 extern char stubsPtr[], stubsLimit[];
 
@@ -470,10 +471,7 @@ extern "C" void onPlatformShootdown(IrqImageAccessor image) {
 	assert(!irqMutex().nesting());
 	disableUserAccess();
 
-	for(auto &binding : asidData.get()->bindings)
-		binding.shootdown();
-
-	asidData.get()->globalBinding.shootdown();
+	handleShootdownIpi();
 
 	acknowledgeIpi();
 
@@ -533,7 +531,11 @@ extern "C" void onPlatformWork() {
 	disableUserAccess();
 
 	enableInts();
-	getCurrentThread()->mainWorkQueue()->run();
+	// run() limits the amount of background work; keep going until the WQ is drained.
+	auto wq = getCurrentThread()->mainWorkQueue();
+	do {
+		wq->run();
+	} while(wq->check());
 	disableInts();
 }
 
@@ -554,6 +556,25 @@ namespace {
 			}
 		}
 	}
+
+	void recordProfileSample(CpuData *cpuData, NmiImageAccessor image) {
+		ProfileSample sample;
+		size_t n = 0;
+		sample.frames[n++] = *image.ip();
+
+		// We cannot take page faults in NMI context, hence we only walk kernel stacks.
+#ifdef THOR_HAS_FRAME_POINTERS
+		if(image.inKernelDomain())
+			walkStackFrom(*image.bp(), maxProfileFrames - 1, [&] (uintptr_t ip) {
+				sample.frames[n++] = ip;
+			});
+#endif
+
+		sample.header = n | (static_cast<uint64_t>(cpuData->cpuIndex) << 32);
+		if(!image.inKernelDomain())
+			sample.header |= ProfileSample::userBit;
+		cpuData->localProfileRing->enqueue(&sample, (1 + n) * sizeof(uint64_t));
+	}
 }
 
 extern "C" void onPlatformNmi(NmiImageAccessor image) {
@@ -573,15 +594,13 @@ extern "C" void onPlatformNmi(NmiImageAccessor image) {
 	bool explained = false;
 	auto pmcMechanism = cpuData->profileMechanism.load(std::memory_order_acquire);
 	if(pmcMechanism == ProfileMechanism::intelPmc && checkIntelPmcOverflow()) {
-		uintptr_t ip = *image.ip();
-		cpuData->localProfileRing->enqueue(&ip, sizeof(uintptr_t));
+		recordProfileSample(cpuData, image);
 		// Note: on Intel, the PMI is automatically masked on raises.
 		LocalApicContext::clearPmi();
 		setIntelPmc();
 		explained = true;
 	}else if(pmcMechanism == ProfileMechanism::amdPmc && checkAmdPmcOverflow()) {
-		uintptr_t ip = *image.ip();
-		cpuData->localProfileRing->enqueue(&ip, sizeof(uintptr_t));
+		recordProfileSample(cpuData, image);
 		setAmdPmc();
 		explained = true;
 	}
@@ -607,11 +626,35 @@ extern "C" void onPlatformNmi(NmiImageAccessor image) {
 			reinterpret_cast<uintptr_t>(gs));
 }
 
-extern "C" void enableIntsAndHaltForever();
+extern "C" void enterIdleDomainStub();
+
+void enterIdleDomain() {
+	assert(!intsAreEnabled());
+	enterIdleDomainStub();
+}
+
+void waitForInterrupt() {
+	assert(!intsAreEnabled());
+	// STI only takes effect after the next instruction, hence no IRQ can be missed.
+	asm volatile ("sti\n"
+		"\thlt\n"
+		"\tcli" : : : "memory");
+}
+
+bool haveMonitorWait() {
+	return getGlobalCpuFeatures()->haveMonitorWait;
+}
+
+void monitorAddress(const void *address) {
+	asm volatile ("monitor" : : "a"(address), "c"(0), "d"(0) : "memory");
+}
 
-void suspendSelf() {
+void waitForMonitorOrInterrupt() {
 	assert(!intsAreEnabled());
-	enableIntsAndHaltForever();
+	// Hint 0 requests C1. Deeper C-states would need to be enumerated via CPUID leaf 5.
+	asm volatile ("sti\n"
+		"\tmwait\n"
+		"\tcli" : : "a"(0), "c"(0) : "memory");
 }
 
 } // namespace thor
@@ -1,4 +1,5 @@
 #include <thor-internal/arch/npt.hpp>
+#include <thor-internal/arch/paging.hpp>
 #include <thor-internal/address-space.hpp>
 #include <thor-internal/physical.hpp>
 
@@ -8,7 +9,8 @@ constexpr uint64_t nptPresent = UINT64_C(1) << 0;
 constexpr uint64_t nptWrite = UINT64_C(1) << 1;
 constexpr uint64_t nptUser = UINT64_C(1) << 2;
 constexpr uint64_t nptDirty = UINT64_C(1) << 6;
-constexpr uint64_t nptXd = UINT64_C(1) << 6;
+constexpr uint64_t nptLarge = UINT64_C(1) << 7;
+constexpr uint64_t nptXd = UINT64_C(1) << 63;
 constexpr uint64_t nptAddress = 0x000F'FFFF'FFFF'F000;
 
 struct NptCursorPolicy {
@@ -53,7 +55,7 @@ struct NptCursorPolicy {
 
 
 	static constexpr bool pteTablePresent(uint64_t pte) {
-		return pte & nptPresent;
+		return (pte & nptPresent) && !(pte & nptLarge);
 	}
 
 	static constexpr PhysicalAddr pteTableAddress(uint64_t pte) {
@@ -69,9 +71,37 @@ struct NptCursorPolicy {
 
 		return newPtAddr | nptPresent | nptUser | nptWrite;
 	}
+
+	// Nested paging uses the host's page table format, including its large page support.
+	static bool levelHasLargePages(size_t level) {
+		if(level == 2) // 2 MiB pages.
+			return true;
+		if(level == 1) // 1 GiB pages.
+			return haveGiantPages();
+		return false;
+	}
+
+	static constexpr bool pteLargePage(uint64_t pte) {
+		return (pte & nptPresent) && (pte & nptLarge);
+	}
+
+	static constexpr PhysicalAddr pteLargePageAddress(uint64_t pte) {
+		return pte & nptAddress;
+	}
+
+	static constexpr uint64_t pteBuildLarge(PhysicalAddr physical, PageFlags flags,
+			CachingMode cachingMode) {
+		return pteBuild(physical, flags, cachingMode) | nptLarge;
+	}
+
+	static constexpr uint64_t pteSplitLarge(uint64_t pte, size_t level) {
+		if(level != maxLevels - 1)
+			return pte;
+		return pte & ~nptLarge;
+	}
 };
 
-static_assert(CursorPolicy<NptCursorPolicy>);
+static_assert(LargePageCursorPolicy<NptCursorPolicy>);
 
 using NptCursor = thor::PageCursor<NptCursorPolicy>;
 
@@ -114,6 +144,18 @@ frg::expected<Error> NptOperations::faultPage(VirtualAddr va, MemoryView *view,
 			va, view, offset, flags, mode);
 }
 
+frg::expected<Error> NptOperations::faultAround(VirtualAddr va, MemoryView *view,
+		uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) {
+	return faultAroundByCursor<NptCursor>(pageSpace_,
+			va, view, offset, size, flags, mode);
+}
+
+frg::expected<Error> NptOperations::faultLargePage(VirtualAddr va, MemoryView *view,
+		uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) {
+	return faultLargePageByCursor<NptCursor>(pageSpace_,
+			va, view, offset, size, flags, mode);
+}
+
 frg::expected<Error> NptOperations::cleanPages(VirtualAddr va, MemoryView *view,
 		uintptr_t offset, size_t size) {
 	return cleanPagesByCursor<NptCursor>(pageSpace_,
@@ -5,6 +5,7 @@
 #include <thor-internal/physical.hpp>
 #include <thor-internal/mm-rc.hpp>
 #include <thor-internal/arch-generic/paging.hpp>
+#include <thor-internal/arch/cpu.hpp>
 
 // --------------------------------------------------------
 // Physical page access.
@@ -99,6 +100,10 @@ KernelPageSpace &KernelPageSpace::global() {
 	return *kernelSpace;
 }
 
+bool haveGiantPages() {
+	return getGlobalCpuFeatures()->haveGiantPages;
+}
+
 // TODO(qookie): Can't we raise this?
 static constexpr int maxPcidCount = 8;
 
@@ -110,6 +115,7 @@ void initializeAsidContext(CpuData *cpuData) {
 
 	asidData.get(cpuData).initialize(pcidCount);
 	asidData.get(cpuData)->globalBinding.initialize(globalBindingId);
+	enableShootdownIpis(cpuData);
 	asidData.get(cpuData)->globalBinding.initialBind(*kernelSpacePtr);
 }
 
@@ -166,7 +172,7 @@ ClientPageSpace::~ClientPageSpace() {
 		PageAccessor accessor{ps};
 		auto tbl = reinterpret_cast<uint64_t *>(accessor.get());
 		for(int i = 0; i < 512; i++) {
-			if(tbl[i] & ptePresent)
+			if((tbl[i] & ptePresent) && !(tbl[i] & pteHuge))
 				physicalAllocator->free(tbl[i] & pteAddress, kPageSize);
 		}
 	};
@@ -175,7 +181,7 @@ ClientPageSpace::~ClientPageSpace() {
 		PageAccessor accessor{ps};
 		auto tbl = reinterpret_cast<uint64_t *>(accessor.get());
 		for(int i = 0; i < 512; i++) {
-			if(!(tbl[i] & ptePresent))
+			if(!(tbl[i] & ptePresent) || (tbl[i] & pteHuge))
 				continue;
 			clearLevel2(tbl[i] & pteAddress);
 			physicalAllocator->free(tbl[i] & pteAddress, kPageSize);
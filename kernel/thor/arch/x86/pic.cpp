@@ -4,6 +4,7 @@
 #include <arch/register.hpp>
 #include <thor-internal/arch/pic.hpp>
 #include <thor-internal/arch/hpet.hpp>
+#include <thor-internal/clock-page.hpp>
 #include <thor-internal/debug.hpp>
 #include <thor-internal/fiber.hpp>
 #include <initgraph.hpp>
@@ -223,6 +224,7 @@ void initLocalApicPerCpu() {
 	}
 
 	common::x86::wrmsr(common::x86::kMsrLocalApicBase, msr);
+	localApicContext()->apicId = getLocalApicId();
 
 	auto dumpLocalInt = [&] (int index) {
 		auto regstr = (index == 0 ? lApicLvtLocal0 : lApicLvtLocal1);
@@ -305,6 +307,12 @@ void calibrateApicTimer() {
 
 		infoLogger() << "thor: TSC ticks/ms: " << (tscElapsed / millis)
 					<< " on CPU #" << getCpuData()->cpuIndex << frg::endlog;
+
+		// User space can compute the monotonic clock from the TSC via the clock page.
+		if (getCpuData() == getCpuData(0) && getGlobalCpuFeatures()->haveInvariantTsc) {
+			auto inverseFreq = localApicContext()->tscInverseFreq;
+			publishClockTscParameters(inverseFreq.f, inverseFreq.s);
+		}
 	} else {
 		// Linux assumes invariant TSC to be globally synchronized.
 		localApicContext()->tscInverseFreq = apicContext.getFor(0).tscInverseFreq;
@@ -480,15 +488,28 @@ namespace {
 		}
 
 		uint64_t getMessageAddress() override {
-			return 0xFEE00000;
+			return 0xFEE00000 | (uint64_t{destination_} << 12);
 		}
 
 		uint32_t getMessageData() override {
 			return vector_;
 		}
 
+		Error setAffinity(int cpu) override {
+			if(cpu < 0 || static_cast<size_t>(cpu) >= getCpuCount())
+				return Error::illegalArgs;
+			// The IRQ vectors are the same on all CPUs, hence only the destination changes.
+			// Without interrupt remapping, MSIs can only address 8-bit APIC IDs.
+			auto apicId = apicContext.getFor(cpu).apicId;
+			if(apicId > 0xFF)
+				return Error::noHardwareSupport;
+			destination_ = apicId;
+			return Error::success;
+		}
+
 	private:
 		unsigned int vector_;
+		uint32_t destination_ = 0;
 	};
 }
 
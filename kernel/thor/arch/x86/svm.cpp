@@ -155,6 +155,14 @@ namespace thor::svm {
 				reason.exitReason = kHelVmexitHlt;
 				return reason;
 
+			case kSvmExitIoio:
+				if(!handleIoExit()) {
+					reason.exitReason = kHelVmexitUnknownPlatformSpecificExitCode;
+					reason.code = code;
+					return reason;
+				}
+				break;
+
 			case kSvmExitNPTFault: {
 				size_t address = vmcb->exitinfo2;
 				size_t exitFlags = vmcb->exitinfo1;
@@ -183,6 +191,36 @@ namespace thor::svm {
 		}
 	}
 
+	bool Vcpu::handleIoExit() {
+		auto info = vmcb->exitinfo1;
+		bool in = info & 1;
+		bool string = info & (1 << 2);
+		uint16_t port = info >> 16;
+		uint8_t size;
+		if(info & (1 << 4)) {
+			size = 1;
+		}else if(info & (1 << 5)) {
+			size = 2;
+		}else{
+			assert(info & (1 << 6));
+			size = 4;
+		}
+
+		// Only plain OUT instructions are handled in the kernel.
+		if(in || string)
+			return false;
+
+		uint32_t value = vmcb->rax;
+		if(size < 4)
+			value &= (uint32_t{1} << (size * 8)) - 1;
+		if(!space->handleIoWrite(port, size, value))
+			return false;
+
+		// exitinfo2 contains the RIP of the next instruction.
+		vmcb->rip = vmcb->exitinfo2;
+		return true;
+	}
+
 	void Vcpu::storeRegs(const HelX86VirtualizationRegs *regs) {
 		vmcb->rax = regs->rax;
 		gprState.rbx = regs->rbx;
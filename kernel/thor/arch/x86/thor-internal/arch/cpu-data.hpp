@@ -36,6 +36,10 @@ struct PlatformCpuData : public AssemblyCpuData {
 	bool havePcids = false;
 	bool haveSmap = false;
 	bool haveVirtualization = false;
+
+	// Identifies the executor whose SIMD state is currently loaded into the registers
+	// (see Executor::_simdId). Zero if the state is unknown.
+	uint64_t simdOwner = 0;
 };
 
 // Get a pointer to this CPU's PlatformCpuData instance.
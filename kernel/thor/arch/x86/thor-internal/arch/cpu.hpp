@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <utility>
 
+#include <frg/span.hpp>
 #include <frg/tuple.hpp>
 #include <x86/gdt.hpp>
 #include <x86/idt.hpp>
@@ -287,6 +288,11 @@ struct NmiImageAccessor {
 	Word *ip() { return &_frame()->rip; }
 	Word *cs() { return &_frame()->cs; }
 	Word *rflags() { return &_frame()->rflags; }
+	Word *bp() { return &_frame()->rbp; }
+
+	bool inKernelDomain() {
+		return !(_frame()->cs & 3);
+	}
 
 private:
 	// note: this struct is accessed from assembly.
@@ -377,6 +383,7 @@ struct Executor {
 	friend void saveExecutor(Executor *executor, SyscallImageAccessor accessor);
 	friend void workOnExecutor(Executor *executor);
 	friend void restoreExecutor(Executor *executor);
+	friend void saveCurrentSimdState(Executor *executor);
 
 	static size_t determineSize();
 	static size_t determineSimdSize();
@@ -497,10 +504,26 @@ public:
 		return reinterpret_cast<FxState *>(_pointer + sizeof(General) + 0x10);
 	}
 
+	// Must be called after _fxState() is modified by software.
+	// Forces the next restoreExecutor() to reload the SIMD registers.
+	void invalidateSimdState() {
+		_simdCpu = nullptr;
+	}
+
 private:
+	// Saves the SIMD registers. If optimized is true, the executor must be the one
+	// that was last restored on this CPU.
+	void _saveSimdState(bool optimized);
+
 	char *_pointer;
 	void *_syscallStack;
 	common::x86::Tss64 *_tss;
+
+	// Unique ID of this executor. Used to determine whether the executor's SIMD state
+	// is still loaded into the registers of _simdCpu (see PlatformCpuData::simdOwner).
+	uint64_t _simdId = 0;
+	// CPU that most recently saved the executor's SIMD state.
+	PlatformCpuData *_simdCpu = nullptr;
 };
 
 struct CpuFeatures {
@@ -508,12 +531,17 @@ struct CpuFeatures {
 	static constexpr uint32_t profileAmdSupported = 2;
 
 	bool haveXsave;
+	bool haveXsaveopt;
 	bool haveAvx;
 	bool haveZmm;
 	bool haveInvariantTsc;
+	bool haveMonitorWait;
 	bool haveTscDeadline;
 	bool haveVmx;
 	bool haveSvm;
+	bool haveGiantPages;
+	bool haveEptLargePages;
+	bool haveEptGiantPages;
 	uint32_t profileFlags;
 	size_t xsaveRegionSize;
 };
@@ -536,16 +564,11 @@ inline constexpr bool inHigherHalf(uintptr_t address) {
 void setupBootCpuContext();
 void initializeThisProcessor();
 
-void bootSecondary(unsigned int apic_id);
+// Boots the APs with the given APIC IDs. The APs are started in parallel.
+void bootSecondaries(frg::span<unsigned int> apicIds);
 
 // Save the current SIMD register state into the given executor.
-inline void saveCurrentSimdState(Executor *executor) {
-	if(getGlobalCpuFeatures()->haveXsave) {
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	} else {
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
-}
+void saveCurrentSimdState(Executor *executor);
 
 // --------------------------------------------------------
 // TSC functionality.
@@ -2,6 +2,7 @@
 
 #include <thor-internal/arch-generic/paging.hpp>
 #include <thor-internal/error.hpp>
+#include <thor-internal/kernel-locks.hpp>
 #include <thor-internal/virtualization.hpp>
 
 constexpr uint64_t EPT_READ = (0);
@@ -45,6 +46,12 @@ struct EptOperations final : VirtualOperations {
 	frg::expected<Error> faultPage(VirtualAddr va, MemoryView *view,
 			uintptr_t offset, PageFlags flags, CachingMode mode) override;
 
+	frg::expected<Error> faultAround(VirtualAddr va, MemoryView *view,
+			uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) override;
+
+	frg::expected<Error> faultLargePage(VirtualAddr va, MemoryView *view,
+			uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) override;
+
 	frg::expected<Error> cleanPages(VirtualAddr va, MemoryView *view,
 			uintptr_t offset, size_t size) override;
 
@@ -81,7 +88,7 @@ struct EptSpace final : VirtualizedPageSpace {
 private:
 	EptOperations eptOps_;
 	EptPageSpace pageSpace_;
-	frg::ticket_spinlock _mutex;
+	TicketSpinlock _mutex;
 };
 
 } // namespace thor
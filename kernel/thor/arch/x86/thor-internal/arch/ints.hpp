@@ -32,6 +32,4 @@ inline void halt() {
 	asm volatile ("hlt");
 }
 
-void suspendSelf();
-
 } // namespace thor
@@ -2,6 +2,7 @@
 
 #include <thor-internal/arch-generic/paging.hpp>
 #include <thor-internal/error.hpp>
+#include <thor-internal/kernel-locks.hpp>
 #include <thor-internal/virtualization.hpp>
 
 namespace thor::svm {
@@ -32,6 +33,12 @@ struct NptOperations final : VirtualOperations {
 	frg::expected<Error> faultPage(VirtualAddr va, MemoryView *view,
 			uintptr_t offset, PageFlags flags, CachingMode mode) override;
 
+	frg::expected<Error> faultAround(VirtualAddr va, MemoryView *view,
+			uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) override;
+
+	frg::expected<Error> faultLargePage(VirtualAddr va, MemoryView *view,
+			uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) override;
+
 	frg::expected<Error> cleanPages(VirtualAddr va, MemoryView *view,
 			uintptr_t offset, size_t size) override;
 
@@ -71,6 +78,6 @@ namespace thor::svm {
 	private:
 		NptOperations nptOps_;
 		NptPageSpace pageSpace_;
-		frg::ticket_spinlock _mutex;
+		TicketSpinlock _mutex;
 	};
 } // namespace thor::svm
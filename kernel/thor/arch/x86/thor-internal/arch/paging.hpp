@@ -18,16 +18,26 @@ constexpr uint64_t pteWrite = 0x2;
 constexpr uint64_t pteUser = 0x4;
 constexpr uint64_t ptePwt = 0x8;
 constexpr uint64_t ptePcd = 0x10;
+constexpr uint64_t pteAccessed = 0x20;
 constexpr uint64_t pteDirty = 0x40;
 constexpr uint64_t ptePat = 0x80;
 constexpr uint64_t pteGlobal = 0x100;
+// Available to software. Marks PTEs that were installed by fault-around.
+constexpr uint64_t ptePrefaulted = 0x200;
 constexpr uint64_t pteXd = 0x8000000000000000;
 constexpr uint64_t pteAddress = 0x000F'FFFF'FFFF'F000;
+// Only valid for non-last levels:
+constexpr uint64_t pteHuge = 0x80;
+constexpr uint64_t pteHugePat = 0x1000;
+constexpr uint64_t pteHugeAddress = 0x000F'FFFF'FFFF'E000;
 
 inline int getLowerHalfBits() {
 	return 47;
 }
 
+// Whether the CPU supports 1 GiB pages.
+bool haveGiantPages();
+
 template <bool Kernel>
 struct X86CursorPolicy {
 	static inline constexpr size_t maxLevels = 4;
@@ -49,9 +59,18 @@ struct X86CursorPolicy {
 		PageStatus status = page_status::present;
 		if(pte & pteDirty)
 			status |= page_status::dirty;
+		if(pte & ptePrefaulted) {
+			status |= page_status::prefaulted;
+			if(pte & pteAccessed)
+				status |= page_status::accessed;
+		}
 		return status;
 	}
 
+	static constexpr uint64_t pteMarkPrefaulted(uint64_t pte) {
+		return pte | ptePrefaulted;
+	}
+
 	static PageStatus pteClean(uint64_t *ptePtr) {
 		auto pte = __atomic_fetch_and(ptePtr, ~pteDirty, __ATOMIC_RELAXED);
 		return ptePageStatus(pte);
@@ -84,7 +103,7 @@ struct X86CursorPolicy {
 
 
 	static constexpr bool pteTablePresent(uint64_t pte) {
-		return pte & ptePresent;
+		return (pte & ptePresent) && !(pte & pteHuge);
 	}
 
 	static constexpr PhysicalAddr pteTableAddress(uint64_t pte) {
@@ -100,13 +119,48 @@ struct X86CursorPolicy {
 
 		return newPtAddr | ptePresent | pteWrite | pteUser;
 	}
+
+	static bool levelHasLargePages(size_t level) {
+		if(level == 2) // 2 MiB pages.
+			return true;
+		if(level == 1) // 1 GiB pages.
+			return haveGiantPages();
+		return false;
+	}
+
+	static constexpr bool pteLargePage(uint64_t pte) {
+		return (pte & ptePresent) && (pte & pteHuge);
+	}
+
+	static constexpr PhysicalAddr pteLargePageAddress(uint64_t pte) {
+		return pte & pteHugeAddress;
+	}
+
+	static constexpr uint64_t pteBuildLarge(PhysicalAddr physical, PageFlags flags,
+			CachingMode cachingMode) {
+		// The PAT bit is at a different position for large pages.
+		auto pte = pteBuild(physical, flags, cachingMode);
+		if(pte & ptePat)
+			pte = (pte & ~ptePat) | pteHugePat;
+		return pte | pteHuge;
+	}
+
+	static constexpr uint64_t pteSplitLarge(uint64_t pte, size_t level) {
+		if(level != maxLevels - 1)
+			return pte;
+		auto hadPat = pte & pteHugePat;
+		pte &= ~(pteHuge | pteHugePat);
+		if(hadPat)
+			pte |= ptePat;
+		return pte;
+	}
 };
 
 using KernelCursorPolicy = X86CursorPolicy<true>;
-static_assert(CursorPolicy<KernelCursorPolicy>);
+static_assert(LargePageCursorPolicy<KernelCursorPolicy>);
 
 using ClientCursorPolicy = X86CursorPolicy<false>;
-static_assert(CursorPolicy<ClientCursorPolicy>);
+static_assert(LargePageCursorPolicy<ClientCursorPolicy>);
 
 
 struct KernelPageSpace : PageSpace {
@@ -60,6 +60,7 @@ struct LocalApicContext {
 
 	static void clearPmi();
 
+	uint32_t apicId = 0;
 	bool useTscMode = false;
 	bool timersAreCalibrated = false;
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 namespace thor {
@@ -16,4 +17,28 @@ inline void walkThisStack(F functor) {
 	}
 }
 
+// Walks the frame pointer chain starting at bp, e.g., of an interrupted context.
+// In contrast to walkThisStack(), this does not trust the chain: it stops at
+// misaligned or non-increasing frame pointers and after maxFrames frames.
+// The functor receives the return addresses.
+template <typename F>
+inline void walkStackFrom(uintptr_t bp, size_t maxFrames, F functor) {
+	for(size_t n = 0; n < maxFrames; n++) {
+		if(bp < 0xffff800000000000 || (bp & 7))
+			return;
+		auto frame = reinterpret_cast<uintptr_t *>(bp);
+		auto ip = frame[1];
+		if(!ip)
+			return;
+		functor(ip);
+
+		// Frames must grow towards the top of the stack; this rules out cycles.
+		// We also do not follow links to other stacks.
+		auto next = frame[0];
+		if(next <= bp || next - bp >= 0x10000)
+			return;
+		bp = next;
+	}
+}
+
 } // namespace thor
@@ -196,6 +196,7 @@ namespace thor::svm {
 
 	enum {
 		kSvmExitHlt = 0x78,
+		kSvmExitIoio = 0x7B,
 		kSvmExitNPTFault = 0x400,
 	};
 
@@ -210,6 +211,10 @@ namespace thor::svm {
 		void storeRegs(const HelX86VirtualizationRegs *regs);
 		void loadRegs(HelX86VirtualizationRegs *res);
 
+		// Handles port writes that match a trigger of the space.
+		// Returns false if the exit needs to be handled by user space.
+		bool handleIoExit();
+
 		PhysicalAddr vmcb_region, host_additional_save_region, iopm_bitmap, msrpm_bitmap;
 		volatile Vmcb *vmcb;
 		GprState gprState;
@@ -383,6 +383,8 @@ namespace thor::vmx {
 				}
 			} else if(reason == VMEXIT_EXTERNAL_INTERRUPT) {
 				infoLogger() << "vmx: external-interrupt exit" << frg::endlog;
+			} else if(reason == VMEXIT_IO_INSTRUCTION && handleIoExit()) {
+				// The write was consumed by a trigger, resume the guest.
 			} else {
 				infoLogger() << "vmx: Unknown VMExit code: " << reason << frg::endlog;
 				exitInfo.exitReason = kHelVmexitUnknownPlatformSpecificExitCode;
@@ -392,6 +394,27 @@ namespace thor::vmx {
 		}
 	}
 
+	bool Vmcs::handleIoExit() {
+		auto qualification = vmread(EXIT_QUALIFICATION);
+		uint8_t size = (qualification & 7) + 1;
+		bool in = qualification & (1 << 3);
+		bool string = qualification & (1 << 4);
+		uint16_t port = qualification >> 16;
+
+		// Only plain OUT instructions are handled in the kernel.
+		if(in || string)
+			return false;
+
+		uint32_t value = state.rax;
+		if(size < 4)
+			value &= (uint32_t{1} << (size * 8)) - 1;
+		if(!space->handleIoWrite(port, size, value))
+			return false;
+
+		vmwrite(GUEST_RIP, vmread(GUEST_RIP) + vmread(VM_EXIT_INSTRUCTION_LENGTH));
+		return true;
+	}
+
 	void Vmcs::storeRegs(const HelX86VirtualizationRegs *regs) {
 		memcpy(&state, regs, sizeof(GuestState));
 
@@ -149,6 +149,9 @@ namespace regs {
 	constexpr arch::scalar_register<uint32_t> faultEventAddress{0x40};
 	constexpr arch::scalar_register<uint32_t> faultEventUpperAddress{0x44};
 	constexpr arch::bit_register<uint32_t> protectedMemoryEnable{0x64};
+	constexpr arch::scalar_register<uint64_t> invalidationQueueHead{0x80};
+	constexpr arch::scalar_register<uint64_t> invalidationQueueTail{0x88};
+	constexpr arch::scalar_register<uint64_t> invalidationQueueAddress{0x90};
 
 	// IOTLB registers, to be used as offsets into the IOTLB mem_space
 	constexpr arch::bit_register<uint64_t> iotlbInvalidateAddress{0x00};
@@ -175,12 +178,14 @@ namespace capability {
 
 namespace extendedCapability {
 	constexpr arch::field<uint64_t, bool> coherent{0, 1};
+	constexpr arch::field<uint64_t, bool> qi{1, 1};
 	constexpr arch::field<uint64_t, bool> pt{6, 1};
 	constexpr arch::field<uint64_t, uint16_t> ivo{8, 10};
 } // namespace extendedCapability
 
 namespace globalStatus {
 	constexpr arch::field<uint32_t, bool> interruptRemappingPointerStatus{24, 1};
+	constexpr arch::field<uint32_t, bool> queuedInvalidationEnable{26, 1};
 	constexpr arch::field<uint32_t, bool> writeBufferFlushStatus{27, 1};
 	constexpr arch::field<uint32_t, bool> faultLogStatus{39, 1};
 	constexpr arch::field<uint32_t, bool> rootTablePointerStatus{30, 1};
@@ -244,6 +249,36 @@ namespace iotlbInvalidate {
 	constexpr arch::field<uint64_t, bool> invalidateIotlb{63, 1};
 } // namespace iotlbInvalidate
 
+namespace invalidationDescriptor {
+	enum class Type : uint8_t {
+		ContextCache = 0x1,
+		Iotlb = 0x2,
+		Wait = 0x5,
+	};
+
+	// Common to all descriptor types.
+	constexpr arch::field<uint64_t, Type> type{0, 4};
+
+	// Context-cache and IOTLB invalidation descriptors.
+	// The granularity uses the same encoding as the register-based invalidation.
+	constexpr arch::field<uint64_t, uint8_t> granularity{4, 2};
+	constexpr arch::field<uint64_t, uint16_t> domainId{16, 16};
+	constexpr arch::field<uint64_t, SourceID> sourceId{32, 16};
+	constexpr arch::field<uint64_t, bool> drainWrites{6, 1};
+	constexpr arch::field<uint64_t, bool> drainReads{7, 1};
+
+	// Invalidation wait descriptors.
+	constexpr arch::field<uint64_t, bool> statusWrite{5, 1};
+	constexpr arch::field<uint64_t, bool> fence{6, 1};
+	constexpr arch::field<uint64_t, uint32_t> statusData{32, 32};
+
+	struct alignas(16) Entry {
+		uint64_t low;
+		uint64_t high;
+	};
+	static_assert(sizeof(Entry) == 16);
+} // namespace invalidationDescriptor
+
 namespace faultRecording {
 	constexpr arch::field<uint64_t, SourceID> sourceIdentifier{0, 16};
 	constexpr arch::field<uint64_t, uint8_t> faultReason{32, 8};
@@ -334,6 +369,11 @@ struct IntelIommu final : Iommu, IrqSink {
 
 		setRootEntryTable(rootTablePhys_);
 
+		// Register-based invalidation must not be used once the queue is enabled,
+		// hence this is done after the initial invalidation in setRootEntryTable().
+		if(ecap_ & extendedCapability::qi)
+			enableInvalidationQueue();
+
 		// sanitize firmware state by disabling this (optional) feature
 		if(cap_ & capability::plmr || cap_ & capability::phmr) {
 			regs_.store(regs::protectedMemoryEnable, regs_.load(regs::protectedMemoryEnable) / protectedMemoryEnable::epm(false));
@@ -419,21 +459,24 @@ struct IntelIommu final : Iommu, IrqSink {
 
 		auto contextEntry = &contextTable[sourceId.devfn()];
 
-		contextEntry->high.store(
-			contextTable::addressWidth(sagaw_ - 2) |
-			contextTable::domainId(1)
-		);
+		auto high = contextTable::addressWidth(sagaw_ - 2) | contextTable::domainId(1);
+		auto low = contextTable::present(true)
+				| contextTable::translationType(contextTable::TranslationType::Passthrough);
+
+		// Drivers re-enable DMA on every start; avoid the invalidations in that case.
+		if(uint64_t{contextEntry->low.load()} == uint64_t{low}
+				&& uint64_t{contextEntry->high.load()} == uint64_t{high})
+			return;
 
-		contextEntry->low.store(
-			contextTable::present(true) |
-			contextTable::translationType(contextTable::TranslationType::Passthrough)
-		);
+		contextEntry->high.store(high);
+		contextEntry->low.store(low);
 
 		flush(contextEntry);
 
 		if(initialized_) {
 			invalidateDeviceContext(0, sourceId);
 			invalidateDomainIotlb(1);
+			commitInvalidations();
 		}
 	}
 
@@ -471,6 +514,74 @@ private:
 		runGlobalCommand(globalStatus::writeBufferFlushStatus(true));
 	}
 
+	void enableInvalidationQueue() {
+		invalidationQueuePhys_ = physicalAllocator->allocate(kPageSize);
+		assert(invalidationQueuePhys_ != PhysicalAddr(-1) && "OOM");
+		PageAccessor queueAccessor{invalidationQueuePhys_};
+		memset(queueAccessor.get(), 0, kPageSize);
+		flush(queueAccessor.get(), kPageSize);
+		invalidationQueue_ = {reinterpret_cast<invalidationDescriptor::Entry *>(queueAccessor.get()),
+				kPageSize / sizeof(invalidationDescriptor::Entry)};
+
+		waitStatusPhys_ = physicalAllocator->allocate(kPageSize);
+		assert(waitStatusPhys_ != PhysicalAddr(-1) && "OOM");
+		PageAccessor statusAccessor{waitStatusPhys_};
+		memset(statusAccessor.get(), 0, kPageSize);
+		flush(statusAccessor.get(), kPageSize);
+		waitStatus_ = reinterpret_cast<uint32_t *>(statusAccessor.get());
+
+		// A queue size of zero means one page of 128-bit descriptors.
+		regs_.store(regs::invalidationQueueTail, 0);
+		regs_.store(regs::invalidationQueueAddress, invalidationQueuePhys_);
+
+		setGlobalBit(globalStatus::queuedInvalidationEnable(true));
+		while(!(regs_.load(regs::globalStatus) & globalStatus::queuedInvalidationEnable))
+			;
+
+		queuedInvalidation_ = true;
+		infoLogger() << "thor: IOMMU uses queued invalidation" << frg::endlog;
+	}
+
+	// Appends a descriptor to the invalidation queue. The descriptor is only
+	// submitted to the hardware by the next commitInvalidations().
+	void queueDescriptor(arch::bit_value<uint64_t> low, uint64_t high) {
+		// commitInvalidations() waits for the queue to drain, so we only need to make sure
+		// that a single batch fits into the queue.
+		assert(queuePending_ + 1 < invalidationQueue_.size());
+
+		auto entry = &invalidationQueue_[queueTail_];
+		entry->low = uint64_t{low};
+		entry->high = high;
+		flush(entry);
+
+		queueTail_ = (queueTail_ + 1) % invalidationQueue_.size();
+		queuePending_++;
+	}
+
+	// Submits all pending invalidations and waits until the hardware completed them.
+	// With register-based invalidation, each invalidation already completed synchronously.
+	void commitInvalidations() {
+		if(!queuedInvalidation_ || !queuePending_)
+			return;
+
+		auto sequence = ++waitSequence_;
+		queueDescriptor(invalidationDescriptor::type(invalidationDescriptor::Type::Wait)
+				| invalidationDescriptor::statusWrite(true)
+				| invalidationDescriptor::fence(true)
+				| invalidationDescriptor::statusData(sequence),
+			waitStatusPhys_);
+		regs_.store(regs::invalidationQueueTail, queueTail_ * sizeof(invalidationDescriptor::Entry));
+
+		while(true) {
+			// Make sure that we observe the status write if the IOMMU does not snoop.
+			flush(waitStatus_);
+			if(__atomic_load_n(waitStatus_, __ATOMIC_ACQUIRE) == sequence)
+				break;
+			pause();
+		}
+		queuePending_ = 0;
+	}
+
 	void invalidateGlobalContext() {
 		regs_.store(regs::contextCommand, contextCommand::invalidateContextCache(true) |
 		contextCommand::invalidationGranularity(contextCommand::InvalidationGranularity::Global));
@@ -479,6 +590,16 @@ private:
 	}
 
 	void invalidateDeviceContext(uint16_t domain, SourceID device) {
+		if(queuedInvalidation_) {
+			queueDescriptor(invalidationDescriptor::type(invalidationDescriptor::Type::ContextCache)
+					| invalidationDescriptor::granularity(static_cast<uint8_t>(
+						contextCommand::InvalidationGranularity::Device))
+					| invalidationDescriptor::sourceId(device)
+					| invalidationDescriptor::domainId(domain),
+				0);
+			return;
+		}
+
 		regs_.store(regs::contextCommand, contextCommand::invalidateContextCache(true) |
 			contextCommand::invalidationGranularity(contextCommand::InvalidationGranularity::Device) |
 			contextCommand::sourceId(device) | contextCommand::domainId(domain));
@@ -498,6 +619,17 @@ private:
 	}
 
 	void invalidateDomainIotlb(uint16_t domain) {
+		if(queuedInvalidation_) {
+			queueDescriptor(invalidationDescriptor::type(invalidationDescriptor::Type::Iotlb)
+					| invalidationDescriptor::granularity(static_cast<uint8_t>(
+						iotlbInvalidate::InvalidationGranularity::Domain))
+					| invalidationDescriptor::drainReads(true)
+					| invalidationDescriptor::drainWrites(true)
+					| invalidationDescriptor::domainId(domain),
+				0);
+			return;
+		}
+
 		while(iotlb_.load(regs::iotlbInvalidate) & iotlbInvalidate::invalidateIotlb);
 
 		iotlb_.store(regs::iotlbInvalidateAddress, arch::bit_value{0UL});
@@ -534,6 +666,15 @@ private:
 	frg::span<rootTable::Entry> rootTable_;
 	PhysicalAddr rootTablePhys_;
 
+	bool queuedInvalidation_ = false;
+	frg::span<invalidationDescriptor::Entry> invalidationQueue_{};
+	PhysicalAddr invalidationQueuePhys_ = PhysicalAddr(-1);
+	size_t queueTail_ = 0;
+	size_t queuePending_ = 0;
+	uint32_t *waitStatus_ = nullptr;
+	PhysicalAddr waitStatusPhys_ = PhysicalAddr(-1);
+	uint32_t waitSequence_ = 0;
+
 	uint16_t segment_;
 
 	arch::bit_value<uint64_t> cap_ = arch::bit_value<uint64_t>{0};
@@ -2,8 +2,10 @@
 #include <type_traits>
 #include <thor-internal/address-space.hpp>
 #include <thor-internal/coroutine.hpp>
+#include <thor-internal/main.hpp>
 #include <thor-internal/physical.hpp>
 #include <thor-internal/fiber.hpp>
+#include <frg/cmdline.hpp>
 #include <frg/container_of.hpp>
 #include <thor-internal/types.hpp>
 
@@ -15,6 +17,47 @@ namespace {
 	constexpr bool logCleanup = false;
 	constexpr bool logUsage = false;
 
+	// Number of pages around a read fault that are mapped if they are already present.
+	// Must be a power of two <= 512 such that the window never crosses a page table.
+	// Can be changed with thor.faultaround=<pages> on the kernel command line (0 disables it).
+	size_t faultAroundPages = 16;
+
+	std::atomic<uint64_t> faultAroundMapped{0};
+	std::atomic<uint64_t> faultAroundUsed{0};
+	std::atomic<uint64_t> faultAroundUnused{0};
+
+	ResidentCounters globalResident;
+
+	initgraph::Task parseFaultAroundOption{&globalInitEngine, "generic.parse-faultaround-option",
+		[] {
+			frg::string_view option;
+			frg::array args = {
+				frg::option{"thor.faultaround", frg::as_string_view(option)},
+			};
+			frg::parse_arguments(getKernelCmdline(), args);
+			if(!option.size())
+				return;
+
+			size_t pages = 0;
+			for(size_t i = 0; i < option.size(); ++i) {
+				if(option[i] < '0' || option[i] > '9') {
+					warningLogger() << "thor: Ignoring invalid thor.faultaround value" << frg::endlog;
+					return;
+				}
+				pages = pages * 10 + (option[i] - '0');
+				if(pages > 512)
+					pages = 512;
+			}
+
+			// Round down to a power of two.
+			while(pages & (pages - 1))
+				pages &= pages - 1;
+			faultAroundPages = pages;
+			infoLogger() << "thor: Fault-around maps up to " << faultAroundPages
+					<< " pages" << frg::endlog;
+		}
+	};
+
 	[[maybe_unused]]
 	void logRss(VirtualSpace *space) {
 		if(!logUsage)
@@ -32,6 +75,50 @@ namespace {
 		infoLogger() << "thor:     Physical usage: "
 				<< (physicalAllocator->numUsedPages() * 4) << " KiB, kernel usage: "
 				<< (kernelMemoryUsage / 1024) << " KiB" << frg::endlog;
+		infoLogger() << "thor:     Page magazine hits: "
+				<< physicalAllocator->numMagazineHits() << ", misses: "
+				<< physicalAllocator->numMagazineMisses() << frg::endlog;
+	}
+}
+
+// --------------------------------------------------------
+// Resident memory accounting.
+// --------------------------------------------------------
+
+void ResidentCounters::account(MemoryView *view, ptrdiff_t delta) {
+	if(!delta)
+		return;
+	bool pageCache = view->isPageCache();
+	add_(pageCache, delta);
+	globalResident.add_(pageCache, delta);
+}
+
+ResidentCounters &globalResidentCounters() {
+	return globalResident;
+}
+
+// --------------------------------------------------------
+// Fault-around statistics.
+// --------------------------------------------------------
+
+FaultAroundStatistics getFaultAroundStatistics() {
+	return {
+		.mappedAhead = faultAroundMapped.load(std::memory_order_relaxed),
+		.usedAhead = faultAroundUsed.load(std::memory_order_relaxed),
+		.unusedAhead = faultAroundUnused.load(std::memory_order_relaxed)
+	};
+}
+
+void countFaultAround(size_t mappedAhead) {
+	if(mappedAhead)
+		faultAroundMapped.fetch_add(mappedAhead, std::memory_order_relaxed);
+}
+
+void countPrefaultedUnmap(bool accessed) {
+	if(accessed) {
+		faultAroundUsed.fetch_add(1, std::memory_order_relaxed);
+	}else{
+		faultAroundUnused.fetch_add(1, std::memory_order_relaxed);
 	}
 }
 
@@ -57,7 +144,8 @@ frg::expected<Error> VirtualOperations::mapPresentPages(VirtualAddr va, MemoryVi
 		assert(!(physicalRange.get<0>() & (kPageSize - 1)));
 
 		mapSingle4k(va + progress, physicalRange.get<0>(),
-				flags, determineCachingMode(physicalRange.get<1>(), mode));
+				restrictPageFlags(physicalRange.get<0>(), flags),
+				determineCachingMode(physicalRange.get<1>(), mode));
 	}
 	return {};
 }
@@ -78,7 +166,8 @@ frg::expected<Error> VirtualOperations::remapPresentPages(VirtualAddr va, Memory
 		if(physicalRange.get<0>() != PhysicalAddr(-1)) {
 			assert(!(physicalRange.get<0>() & (kPageSize - 1)));
 			mapSingle4k(va + progress, physicalRange.get<0>(),
-					flags, determineCachingMode(physicalRange.get<1>(), mode));
+					restrictPageFlags(physicalRange.get<0>(), flags),
+					determineCachingMode(physicalRange.get<1>(), mode));
 		}
 
 		if(status & page_status::present) {
@@ -98,7 +187,8 @@ frg::expected<Error> VirtualOperations::faultPage(VirtualAddr va, MemoryView *vi
 	// TODO: detect spurious page faults.
 	PageStatus status = unmapSingle4k(va & ~(kPageSize - 1));
 	mapSingle4k(va & ~(kPageSize - 1), physicalRange.get<0>() & ~(kPageSize - 1),
-			flags, determineCachingMode(physicalRange.get<1>(), mode));
+			restrictPageFlags(physicalRange.get<0>(), flags),
+			determineCachingMode(physicalRange.get<1>(), mode));
 
 	if(status & page_status::present) {
 		if(status & page_status::dirty)
@@ -107,6 +197,16 @@ frg::expected<Error> VirtualOperations::faultPage(VirtualAddr va, MemoryView *vi
 	return {};
 }
 
+frg::expected<Error> VirtualOperations::faultAround(VirtualAddr, MemoryView *,
+		uintptr_t, size_t, PageFlags, CachingMode) {
+	return {};
+}
+
+frg::expected<Error> VirtualOperations::faultLargePage(VirtualAddr, MemoryView *,
+		uintptr_t, size_t, PageFlags, CachingMode) {
+	return Error::fault;
+}
+
 frg::expected<Error> VirtualOperations::cleanPages(VirtualAddr va, MemoryView *view,
 		uintptr_t offset, size_t size) {
 	assert(!(va & (kPageSize - 1)));
@@ -320,13 +420,83 @@ coroutine<void> Mapping::runEvictionLoop() {
 // CowMapping
 // --------------------------------------------------------
 
-CowChain::CowChain()
-: _pages{*kernelAlloc} {
+CowChain::CowChain(uintptr_t viewOffset, size_t length)
+: _viewOffset{viewOffset}, _length{length}, _pages{*kernelAlloc} {
 }
 
 CowChain::~CowChain() {
 	if(logCleanup)
 		infoLogger() << "thor: Releasing CowChain" << frg::endlog;
+
+	// Drop our references so that the remaining chains can adopt the pages.
+	for(size_t pg = 0; pg < _length; pg += kPageSize) {
+		if(auto it = _pages.find((_viewOffset + pg) >> kPageShift); it)
+			(*it)->chainRefs.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+// --------------------------------------------------------
+// RangeLock
+// --------------------------------------------------------
+
+void RangeLock::enqueue(Holder *holder, VirtualAddr address, size_t length, bool exclusive) {
+	assert(!holder->lock_);
+	assert(length);
+	holder->lock_ = this;
+	holder->address_ = address;
+	holder->length_ = length;
+	holder->exclusive_ = exclusive;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	_queue.push_back(holder);
+}
+
+coroutine<void> RangeLock::wait(Holder *holder) {
+	assert(holder->lock_ == this);
+
+	while(true) {
+		bool stillWaiting = co_await _releaseEvent.async_wait_if([&] () -> bool {
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			return _isBlocked(holder);
+		});
+		if(!stillWaiting)
+			break;
+		// Avoid running on the stack of release().
+		co_await WorkQueue::generalQueue()->schedule();
+	}
+}
+
+void RangeLock::release(Holder *holder) {
+	assert(holder->lock_ == this);
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		_queue.erase(_queue.iterator_to(holder));
+	}
+	holder->lock_ = nullptr;
+
+	// This can resume waiters inline, hence we cannot hold any locks here.
+	_releaseEvent.raise();
+}
+
+bool RangeLock::_isBlocked(Holder *holder) {
+	for(auto it = _queue.begin(); it != _queue.end(); ++it) {
+		auto other = *it;
+		if(other == holder)
+			return false;
+		if(!holder->exclusive_ && !other->exclusive_)
+			continue;
+		if(other->address_ < holder->address_ + holder->length_
+				&& holder->address_ < other->address_ + other->length_)
+			return true;
+	}
+	panicLogger() << "thor: RangeLock::Holder is not queued" << frg::endlog;
+	__builtin_unreachable();
 }
 
 // --------------------------------------------------------
@@ -396,85 +566,104 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 		VirtualAddr address, size_t offset, size_t length, uint32_t flags) {
 	assert(length);
 	assert(!(length % kPageSize));
+	assert((address % kPageSize) == 0);
 
 	if(offset + length > slice->length())
 		co_return Error::bufferTooSmall;
 
-	co_await _consistencyMutex.async_lock();
-	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+	RangeLock::Holder rangeHolder;
 	bool needsShootdown = false;
+	VirtualAddr actualAddress;
 
 	if (flags & kMapFixed) {
-		auto [start, end] = co_await _splitMappings(address, length);
-		assert(start || (!start && !end));
-		needsShootdown = co_await _unmapMappings(address, length, start, end);
-	}
+		co_await _lockRangeForUpdate(&rangeHolder, address, length);
+
+		frg::vector<frg::tuple<VirtualAddr, size_t>, KernelAlloc> freedRanges{*kernelAlloc};
+		co_await _splitMappings(address, length);
+		needsShootdown = co_await _unmapMappings(address, length, freedRanges);
 
-	// The shared_ptr to the new Mapping needs to survive until the locks are released.
-	VirtualAddr actualAddress;
-	smarter::shared_ptr<Mapping> mapping;
-	{
 		auto irqLock = frg::guard(&irqMutex());
 		auto spaceLock = frg::guard(&_snapshotMutex);
 
-		assert((address % kPageSize) == 0);
-		if(flags & kMapFixed) {
-			actualAddress = FRG_CO_TRY(_allocateAt(address, length));
-		}else if(flags & kMapFixedNoReplace) {
-			if(_areMappingsInRange(address, length)) {
-				co_return Error::alreadyExists;
-			}
-			actualAddress = FRG_CO_TRY(_allocateAt(address, length));
-		}else{
-			if(address && !_areMappingsInRange(address, length)) {
-				if(auto res = _allocateAt(address, length)) {
-					actualAddress = res.unwrap();
+		// We can reuse the range before shootdown since we keep holding the range lock.
+		for(auto [freedAddress, freedLength] : freedRanges)
+			_insertHole(freedAddress, freedLength);
+		actualAddress = FRG_CO_TRY(_allocateAt(address, length));
+	}else{
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceLock = frg::guard(&_snapshotMutex);
+
+			if(flags & kMapFixedNoReplace) {
+				if(_areMappingsInRange(address, length)) {
+					co_return Error::alreadyExists;
+				}
+				actualAddress = FRG_CO_TRY(_allocateAt(address, length));
+			}else{
+				if(address && !_areMappingsInRange(address, length)) {
+					if(auto res = _allocateAt(address, length)) {
+						actualAddress = res.unwrap();
+					}else {
+						actualAddress = FRG_CO_TRY(_allocate(length, flags));
+					}
 				}else {
 					actualAddress = FRG_CO_TRY(_allocate(length, flags));
 				}
-			}else {
-				actualAddress = FRG_CO_TRY(_allocate(length, flags));
 			}
+
+			// Queue the request before dropping the lock such that operations
+			// on the same range that are issued after us cannot overtake us.
+			_rangeLock.enqueue(&rangeHolder, actualAddress, length, true);
 		}
 
-	//	infoLogger() << "Creating new mapping at " << (void *)actualAddress
-	//			<< ", length: " << (void *)length << frg::endlog;
+		// Wait for earlier operations on the range (e.g., faults on the former hole).
+		co_await _rangeLock.wait(&rangeHolder);
+	}
 
-		// Setup a new Mapping object.
-		std::underlying_type_t<MappingFlags> mappingFlags = 0;
-
-		// TODO: The upgrading mechanism needs to be arch-specific:
-		// Some archs might only support RX, while other support X.
-		auto mask = kMapProtRead | kMapProtWrite | kMapProtExecute;
-		if((flags & mask) == (kMapProtRead | kMapProtWrite | kMapProtExecute)
-				|| (flags & mask) == (kMapProtWrite | kMapProtExecute)) {
-			// WX is upgraded to RWX.
-			mappingFlags |= MappingFlags::protRead | MappingFlags::protWrite
-				| MappingFlags::protExecute;
-		}else if((flags & mask) == (kMapProtRead | kMapProtExecute)
-				|| (flags & mask) == kMapProtExecute) {
-			// X is upgraded to RX.
-			mappingFlags |= MappingFlags::protRead | MappingFlags::protExecute;
-		}else if((flags & mask) == (kMapProtRead | kMapProtWrite)
-				|| (flags & mask) == kMapProtWrite) {
-			// W is upgraded to RW.
-			mappingFlags |= MappingFlags::protRead | MappingFlags::protWrite;
-		}else if((flags & mask) == kMapProtRead) {
-			mappingFlags |= MappingFlags::protRead;
-		}else{
-			assert(!(flags & mask));
-		}
+	// Setup a new Mapping object.
+	std::underlying_type_t<MappingFlags> mappingFlags = 0;
 
-		if(flags & kMapDontRequireBacking)
-			mappingFlags |= MappingFlags::dontRequireBacking;
+	// TODO: The upgrading mechanism needs to be arch-specific:
+	// Some archs might only support RX, while other support X.
+	auto mask = kMapProtRead | kMapProtWrite | kMapProtExecute;
+	if((flags & mask) == (kMapProtRead | kMapProtWrite | kMapProtExecute)
+			|| (flags & mask) == (kMapProtWrite | kMapProtExecute)) {
+		// WX is upgraded to RWX.
+		mappingFlags |= MappingFlags::protRead | MappingFlags::protWrite
+			| MappingFlags::protExecute;
+	}else if((flags & mask) == (kMapProtRead | kMapProtExecute)
+			|| (flags & mask) == kMapProtExecute) {
+		// X is upgraded to RX.
+		mappingFlags |= MappingFlags::protRead | MappingFlags::protExecute;
+	}else if((flags & mask) == (kMapProtRead | kMapProtWrite)
+			|| (flags & mask) == kMapProtWrite) {
+		// W is upgraded to RW.
+		mappingFlags |= MappingFlags::protRead | MappingFlags::protWrite;
+	}else if((flags & mask) == kMapProtRead) {
+		mappingFlags |= MappingFlags::protRead;
+	}else{
+		assert(!(flags & mask));
+	}
+
+	if(flags & kMapDontRequireBacking)
+		mappingFlags |= MappingFlags::dontRequireBacking;
+
+	assert(!(flags & kMapPopulate));
+
+	// The shared_ptr to the new Mapping needs to survive until the locks are released.
+	smarter::shared_ptr<Mapping> mapping;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto spaceLock = frg::guard(&_snapshotMutex);
+
+	//	infoLogger() << "Creating new mapping at " << (void *)actualAddress
+	//			<< ", length: " << (void *)length << frg::endlog;
 
 		mapping = smarter::allocate_shared<Mapping>(Allocator{},
 				length, static_cast<MappingFlags>(mappingFlags),
 				slice.lock(), slice->offset() + offset);
 		mapping->selfPtr = mapping;
 
-		assert(!(flags & kMapPopulate));
-
 		auto caching = CachingMode::null;
 		if(slice->getCachingFlags() == cacheWriteCombine)
 			caching = CachingMode::writeCombine;
@@ -541,14 +730,22 @@ VirtualSpace::protect(VirtualAddr address, size_t length, uint32_t flags) {
 		assert(!(flags & mask));
 	}
 
-	co_await _consistencyMutex.async_lock();
-	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+	RangeLock::Holder rangeHolder;
+	co_await _lockRangeForUpdate(&rangeHolder, address, length);
+
+	co_await _splitMappings(address, length);
+	auto current = address;
+	while(true) {
+		smarter::shared_ptr<Mapping> mapping;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceGuard = frg::guard(&_snapshotMutex);
 
-	auto [start, end] = co_await _splitMappings(address, length);
-	assert(start || (!start && !end));
-	for (auto it = start; it != end;) {
-		auto mapping = it->selfPtr.lock();
-		it = MappingTree::successor(it);
+			mapping = _findFirstMapping(current, address + length);
+		}
+		if(!mapping)
+			break;
+		current = mapping->address + mapping->length;
 
 		mapping->protect(static_cast<MappingFlags>(mappingFlags));
 
@@ -579,28 +776,38 @@ VirtualSpace::protect(VirtualAddr address, size_t length, uint32_t flags) {
 }
 
 coroutine<frg::expected<Error>> VirtualSpace::unmap(VirtualAddr address, size_t length) {
-	co_await _consistencyMutex.async_lock();
-	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+	RangeLock::Holder rangeHolder;
+	co_await _lockRangeForUpdate(&rangeHolder, address, length);
 
-	auto [start, end] = co_await _splitMappings(address, length);
-	assert(start || (!start && !end));
-	auto needsShootdown = co_await _unmapMappings(address, length, start, end);
+	frg::vector<frg::tuple<VirtualAddr, size_t>, KernelAlloc> freedRanges{*kernelAlloc};
+	co_await _splitMappings(address, length);
+	auto needsShootdown = co_await _unmapMappings(address, length, freedRanges);
 
 	if (needsShootdown)
 		co_await _ops->shootdown(address, length);
 
+	// Now that no TLB refers to the unmapped pages anymore, the range can be reused.
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto spaceGuard = frg::guard(&_snapshotMutex);
+
+		for(auto [freedAddress, freedLength] : freedRanges)
+			_insertHole(freedAddress, freedLength);
+	}
+
 	co_return {};
 }
 
 coroutine<frg::expected<Error>>
 VirtualSpace::synchronize(VirtualAddr address, size_t size) {
-	co_await _consistencyMutex.async_lock_shared();
-	frg::shared_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
-
 	auto misalign = address & (kPageSize - 1);
 	auto alignedAddress = address & ~(kPageSize - 1);
 	auto alignedSize = (size + misalign + kPageSize - 1) & ~(kPageSize - 1);
 
+	RangeLock::Holder rangeHolder;
+	_rangeLock.enqueue(&rangeHolder, alignedAddress, alignedSize, false);
+	co_await _rangeLock.wait(&rangeHolder);
+
 	size_t overallProgress = 0;
 	while(overallProgress < alignedSize) {
 		smarter::shared_ptr<Mapping> mapping;
@@ -629,11 +836,94 @@ VirtualSpace::synchronize(VirtualAddr address, size_t size) {
 	co_return {};
 }
 
+coroutine<frg::expected<Error>>
+VirtualSpace::discard(VirtualAddr address, size_t size, smarter::shared_ptr<WorkQueue> wq) {
+	auto misalign = address & (kPageSize - 1);
+	auto alignedAddress = address & ~(kPageSize - 1);
+	auto alignedSize = (size + misalign + kPageSize - 1) & ~(kPageSize - 1);
+
+	RangeLock::Holder rangeHolder;
+	_rangeLock.enqueue(&rangeHolder, alignedAddress, alignedSize, false);
+	co_await _rangeLock.wait(&rangeHolder);
+
+	size_t overallProgress = 0;
+	while(overallProgress < alignedSize) {
+		smarter::shared_ptr<Mapping> mapping;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceGuard = frg::guard(&_snapshotMutex);
+
+			mapping = _findMapping(alignedAddress + overallProgress);
+		}
+		if(!mapping)
+			co_return Error::fault;
+
+		auto mappingOffset = alignedAddress + overallProgress - mapping->address;
+		auto mappingChunk = frg::min(alignedSize - overallProgress,
+				mapping->length - mappingOffset);
+		assert(mapping->state == MappingState::active);
+		assert(mappingOffset + mappingChunk <= mapping->length);
+
+		// Eviction unmaps the pages from all affected mappings (including this one).
+		FRG_CO_TRY(co_await mapping->view->discardRange(mapping->viewOffset + mappingOffset,
+				mappingChunk, wq));
+
+		overallProgress += mappingChunk;
+	}
+
+	co_return {};
+}
+
+coroutine<frg::expected<Error>>
+VirtualSpace::populate(VirtualAddr address, size_t size, uint32_t faultFlags,
+		smarter::shared_ptr<WorkQueue> wq) {
+	auto misalign = address & (kPageSize - 1);
+	auto alignedAddress = address & ~(kPageSize - 1);
+	auto alignedSize = (size + misalign + kPageSize - 1) & ~(kPageSize - 1);
+
+	// handleFault() takes _rangeLock by itself.
+	size_t overallProgress = 0;
+	while(overallProgress < alignedSize) {
+		smarter::shared_ptr<Mapping> mapping;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceGuard = frg::guard(&_snapshotMutex);
+
+			mapping = _findMapping(alignedAddress + overallProgress);
+		}
+		if(!mapping)
+			co_return Error::fault;
+
+		auto mappingOffset = alignedAddress + overallProgress - mapping->address;
+		auto mappingChunk = frg::min(alignedSize - overallProgress,
+				mapping->length - mappingOffset);
+
+		uint32_t mappingFaultFlags = faultFlags & ~kFaultExecute;
+		if(!(mapping->flags & MappingFlags::protWrite))
+			mappingFaultFlags &= ~kFaultWrite;
+
+		// Inaccessible mappings are skipped, just as on Linux.
+		if(mapping->flags & MappingFlags::permissionMask) {
+			for(size_t pg = 0; pg < mappingChunk; pg += kPageSize)
+				FRG_CO_TRY(co_await handleFault(mapping->address + mappingOffset + pg,
+						mappingFaultFlags, wq));
+		}
+
+		overallProgress += mappingChunk;
+	}
+
+	co_return {};
+}
+
 coroutine<frg::expected<Error>>
 VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 		smarter::shared_ptr<WorkQueue> wq) {
-	co_await _consistencyMutex.async_lock_shared();
-	frg::shared_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+	// Operations that change the mapping lock all of it, hence it is enough to lock the page.
+	// In particular, faults on different pages (and operations on other mappings)
+	// do not wait for each other.
+	RangeLock::Holder rangeHolder;
+	_rangeLock.enqueue(&rangeHolder, address & ~(kPageSize - 1), kPageSize, false);
+	co_await _rangeLock.wait(&rangeHolder);
 
 	smarter::shared_ptr<Mapping> mapping;
 	{
@@ -660,6 +950,8 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 		FetchFlags fetchFlags = 0;
 		if(mapping->flags & MappingFlags::dontRequireBacking)
 			fetchFlags |= fetchDisallowBacking;
+		if(!(faultFlags & VirtualSpace::kFaultWrite))
+			fetchFlags |= fetchReadOnly;
 
 		FRG_CO_TRY(co_await mapping->view->fetchRange(
 				mapping->viewOffset + offset, fetchFlags, wq));
@@ -671,6 +963,23 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 		co_await mapping->evictionMutex.async_lock();
 		frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
 
+		// Prefer to map a large page if the mapping covers one entirely.
+		bool mappedLarge = false;
+		for(auto pageSize : largePageSizes) {
+			auto base = address & ~(pageSize - 1);
+			if(base < mapping->address || base + pageSize > mapping->address + mapping->length)
+				continue;
+			auto largeOutcome = _ops->faultLargePage(base, mapping->view.get(),
+					mapping->viewOffset + (base - mapping->address), pageSize,
+					mapping->compilePageFlags(), caching);
+			if(largeOutcome) {
+				mappedLarge = true;
+				break;
+			}
+		}
+		if(mappedLarge)
+			co_return {};
+
 		auto remapOutcome = _ops->faultPage(address & ~(kPageSize - 1),
 				mapping->view.get(), mapping->viewOffset + offset,
 				mapping->compilePageFlags(), caching);
@@ -687,13 +996,26 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 			}
 		}
 
+		// On read faults, also map neighbouring pages that are already present
+		// (e.g., in the page cache or in a CoW chain). Write faults are excluded to avoid
+		// the extra work for pages that are about to be copied anyway.
+		if(faultAroundPages > 1 && !(faultFlags & VirtualSpace::kFaultWrite)) {
+			uintptr_t windowSize = faultAroundPages * kPageSize;
+			uintptr_t windowBegin = offset & ~(windowSize - 1);
+			uintptr_t windowEnd = frg::min(windowBegin + windowSize, uintptr_t{mapping->length});
+			auto aroundOutcome = _ops->faultAround(mapping->address + windowBegin,
+					mapping->view.get(), mapping->viewOffset + windowBegin,
+					windowEnd - windowBegin, mapping->compilePageFlags(), caching);
+			assert(aroundOutcome);
+		}
+
 		co_return {};
 	}
 }
 
 coroutine<frg::expected<Error, PhysicalAddr>>
 VirtualSpace::retrievePhysical(VirtualAddr address, smarter::shared_ptr<WorkQueue> wq) {
-	// We do not take _consistencyMutex here since we are only interested in a snapshot.
+	// We do not take _rangeLock here since we are only interested in a snapshot.
 
 	smarter::shared_ptr<Mapping> mapping;
 	{
@@ -726,6 +1048,42 @@ VirtualSpace::retrievePhysical(VirtualAddr address, smarter::shared_ptr<WorkQueu
 	}
 }
 
+coroutine<frg::expected<Error, size_t>>
+VirtualSpace::retrievePhysicalExtents(VirtualAddr address, size_t size,
+		PhysicalExtent *extents, size_t &numExtents, size_t maxExtents,
+		smarter::shared_ptr<WorkQueue> wq) {
+	// As in retrievePhysical(), we are only interested in a snapshot.
+	size_t overallProgress = 0;
+	while(overallProgress < size) {
+		smarter::shared_ptr<Mapping> mapping;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceGuard = frg::guard(&_snapshotMutex);
+
+			mapping = _findMapping(address + overallProgress);
+		}
+		if(!mapping)
+			co_return Error::fault;
+
+		auto mappingOffset = address + overallProgress - mapping->address;
+		auto mappingChunk = frg::min(size - overallProgress,
+				mapping->length - mappingOffset);
+
+		FetchFlags fetchFlags = 0;
+		if(mapping->flags & MappingFlags::dontRequireBacking)
+			fetchFlags |= fetchDisallowBacking;
+
+		auto progress = FRG_CO_TRY(co_await thor::retrievePhysicalExtents(mapping->view.get(),
+				mapping->viewOffset + mappingOffset, mappingChunk, fetchFlags,
+				extents, numExtents, maxExtents, wq));
+		overallProgress += progress;
+		if(progress < mappingChunk)
+			break;
+	}
+
+	co_return overallProgress;
+}
+
 smarter::shared_ptr<Mapping> VirtualSpace::_findMapping(VirtualAddr address) {
 	auto current = _mappings.get_root();
 	while(current) {
@@ -866,224 +1224,246 @@ void VirtualSpace::_splitHole(Hole *hole, VirtualAddr offset, size_t length) {
 	frg::destruct(*kernelAlloc, hole);
 }
 
-coroutine<frg::tuple<Mapping *, Mapping *>> VirtualSpace::_splitMappings(uintptr_t address, size_t size) {
-	// _consistencyMutex is held here by the caller
-
-	auto left = _mappings.get_root();
-	while (left) {
-		if (auto next = MappingTree::get_left(left))
-			left = next;
-		else
-			break;
+smarter::shared_ptr<Mapping> VirtualSpace::_findFirstMapping(VirtualAddr address, VirtualAddr end) {
+	Mapping *result = nullptr;
+	auto current = _mappings.get_root();
+	while(current) {
+		if(current->address >= address) {
+			result = current;
+			current = MappingTree::get_left(current);
+		}else{
+			current = MappingTree::get_right(current);
+		}
 	}
 
-	Mapping *start = nullptr, *end = nullptr;
-	for (auto it = left; it;) {
-		if ((it->address + it->length) <= address) {
-			it = MappingTree::successor(it);
-			start = it;
-			continue;
-		}
+	if(!result || result->address >= end)
+		return nullptr;
+	return result->selfPtr.lock();
+}
 
-		if (it->address >= (address + size)) {
-			// If no mapping fell into the range, don't set the end iterator
-			if (start)
-				end = it;
+void VirtualSpace::_insertHole(VirtualAddr address, size_t length) {
+	// Find the holes that preceede/succeede the new hole.
+	Hole *pre = nullptr;
+	Hole *succ = nullptr;
 
-			break;
+	auto current = _holes.get_root();
+	while(current) {
+		if(address < current->address()) {
+			if(HoleTree::get_left(current)) {
+				current = HoleTree::get_left(current);
+			}else{
+				pre = HoleTree::predecessor(current);
+				succ = current;
+				break;
+			}
+		}else{
+			assert(address >= current->address() + current->length());
+			if(HoleTree::get_right(current)) {
+				current = HoleTree::get_right(current);
+			}else{
+				pre = current;
+				succ = HoleTree::successor(current);
+				break;
+			}
 		}
+	}
 
-		if (!start)
-			start = it;
+	// Try to merge the new hole and the existing ones.
+	if(pre && pre->address() + pre->length() == address
+			&& succ && address + length == succ->address()) {
+		auto hole = frg::construct<Hole>(*kernelAlloc, pre->address(),
+				pre->length() + length + succ->length());
+
+		_holes.remove(pre);
+		_holes.remove(succ);
+		_holes.insert(hole);
+		frg::destruct(*kernelAlloc, pre);
+		frg::destruct(*kernelAlloc, succ);
+	}else if(pre && pre->address() + pre->length() == address) {
+		auto hole = frg::construct<Hole>(*kernelAlloc,
+				pre->address(), pre->length() + length);
+
+		_holes.remove(pre);
+		_holes.insert(hole);
+		frg::destruct(*kernelAlloc, pre);
+	}else if(succ && address + length == succ->address()) {
+		auto hole = frg::construct<Hole>(*kernelAlloc,
+				address, length + succ->length());
+
+		_holes.remove(succ);
+		_holes.insert(hole);
+		frg::destruct(*kernelAlloc, succ);
+	}else{
+		auto hole = frg::construct<Hole>(*kernelAlloc,
+				address, length);
 
-		auto mapping = it->selfPtr.lock();
-		auto at = address;
+		_holes.insert(hole);
+	}
+}
 
-		// Starting split not within mapping, consider end split
-		if (at <= mapping->address)
-			at = address + size;
+coroutine<void> VirtualSpace::_lockRangeForUpdate(RangeLock::Holder *holder,
+		VirtualAddr address, size_t length) {
+	assert(length);
 
-		if (at > mapping->address && at < (mapping->address + mapping->length)) {
-			// Split mapping into left and right part
-			smarter::shared_ptr<Mapping> leftMapping = nullptr;
-			smarter::shared_ptr<Mapping> rightMapping = nullptr;
+	// Mappings that straddle the boundaries of the range are split and retired;
+	// faults on their remaining parts must not run concurrently with that.
+	auto determineExtent = [&] () -> frg::tuple<VirtualAddr, VirtualAddr> {
+		auto irqLock = frg::guard(&irqMutex());
+		auto spaceGuard = frg::guard(&_snapshotMutex);
+
+		auto begin = address;
+		auto end = address + length;
+		if(auto mapping = _findMapping(begin); mapping)
+			begin = mapping->address;
+		if(auto mapping = _findMapping(end - 1); mapping)
+			end = mapping->address + mapping->length;
+		return {begin, end};
+	};
 
-			assert(mapping->state == MappingState::active);
-			mapping->state = MappingState::zombie;
+	while(true) {
+		auto [lockBegin, lockEnd] = determineExtent();
+		_rangeLock.enqueue(holder, lockBegin, lockEnd - lockBegin, true);
+		co_await _rangeLock.wait(holder);
+
+		// The mappings at the boundaries might have changed while we were waiting.
+		auto [begin, end] = determineExtent();
+		if(begin >= lockBegin && end <= lockEnd)
+			co_return;
+		_rangeLock.release(holder);
+	}
+}
 
-			{
-				auto leftSize = at - mapping->address;
-				leftMapping = smarter::allocate_shared<Mapping>(Allocator{},
-						leftSize, mapping->flags, mapping->slice,
-						mapping->viewOffset);
-				leftMapping->selfPtr = leftMapping;
+coroutine<void> VirtualSpace::_splitMappings(uintptr_t address, size_t size) {
+	VirtualAddr splitPoints[] = {address, address + size};
+	for(auto at : splitPoints) {
+		smarter::shared_ptr<Mapping> mapping;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_snapshotMutex);
 
-				leftMapping->tie(selfPtr.lock(), mapping->address);
-			}
+			mapping = _findMapping(at);
+		}
+		if(!mapping || mapping->address == at)
+			continue;
+		assert(at > mapping->address && at < (mapping->address + mapping->length));
 
-			{
-				auto rightOffset = at - mapping->address;
-				rightMapping = smarter::allocate_shared<Mapping>(Allocator{},
-						mapping->length - rightOffset, mapping->flags, mapping->slice,
-						mapping->viewOffset + rightOffset);
-				rightMapping->selfPtr = rightMapping;
+		// Split mapping into left and right part
+		smarter::shared_ptr<Mapping> leftMapping = nullptr;
+		smarter::shared_ptr<Mapping> rightMapping = nullptr;
 
-				rightMapping->tie(selfPtr.lock(), at);
-			}
+		assert(mapping->state == MappingState::active);
+		mapping->state = MappingState::zombie;
 
-			assert(leftMapping && rightMapping);
+		{
+			auto leftSize = at - mapping->address;
+			leftMapping = smarter::allocate_shared<Mapping>(Allocator{},
+					leftSize, mapping->flags, mapping->slice,
+					mapping->viewOffset);
+			leftMapping->selfPtr = leftMapping;
 
-			// Now remove the mapping and insert the new mappings.
-			{
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&_snapshotMutex);
+			leftMapping->tie(selfPtr.lock(), mapping->address);
+		}
 
-				_mappings.remove(mapping.get());
+		{
+			auto rightOffset = at - mapping->address;
+			rightMapping = smarter::allocate_shared<Mapping>(Allocator{},
+					mapping->length - rightOffset, mapping->flags, mapping->slice,
+					mapping->viewOffset + rightOffset);
+			rightMapping->selfPtr = rightMapping;
 
-				_mappings.insert(leftMapping.get());
-				assert(leftMapping->state == MappingState::null);
-				leftMapping->state = MappingState::active;
+			rightMapping->tie(selfPtr.lock(), at);
+		}
 
-				_mappings.insert(rightMapping.get());
-				assert(rightMapping->state == MappingState::null);
-				rightMapping->state = MappingState::active;
-			}
+		assert(leftMapping && rightMapping);
 
-			// Retire the old mapping and start using the new ones.
-			// We keep one reference until the detach the observer.
-			leftMapping.ctr()->increment();
-			leftMapping->view->addObserver(&leftMapping->observer);
-			if (leftMapping->view->canEvictMemory())
-				async::detach_with_allocator(*kernelAlloc, leftMapping->runEvictionLoop());
+		// Now remove the mapping and insert the new mappings.
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_snapshotMutex);
 
-			// We keep one reference until the detach the observer.
-			rightMapping.ctr()->increment();
-			rightMapping->view->addObserver(&rightMapping->observer);
-			if (rightMapping->view->canEvictMemory())
-				async::detach_with_allocator(*kernelAlloc, rightMapping->runEvictionLoop());
+			_mappings.remove(mapping.get());
 
-			assert(mapping->state == MappingState::zombie);
-			mapping->state = MappingState::retired;
+			_mappings.insert(leftMapping.get());
+			assert(leftMapping->state == MappingState::null);
+			leftMapping->state = MappingState::active;
 
-			if (mapping->view->canEvictMemory()) {
-				mapping->cancelEviction.cancel();
-				co_await mapping->evictionDoneEvent.wait();
-			}
-			mapping->view->removeObserver(&mapping->observer);
-			mapping->selfPtr.ctr()->decrement();
+			_mappings.insert(rightMapping.get());
+			assert(rightMapping->state == MappingState::null);
+			rightMapping->state = MappingState::active;
+		}
 
-			// If start pointed to the freshly-removed mapping,
-			// determine the correct mapping to use as our new start.
-			// Generally, this will be the left mapping, however, if we split the mapping 3 ways
-			// so as to choose the center one, this will be the right mapping.
-			if (start == it) {
-				if(address < at) {
-					start = leftMapping.get();
-				} else {
-					start = rightMapping.get();
-				}
-			}
+		// Retire the old mapping and start using the new ones.
+		// We keep one reference until the detach the observer.
+		leftMapping.ctr()->increment();
+		leftMapping->view->addObserver(&leftMapping->observer);
+		if (leftMapping->view->canEvictMemory())
+			async::detach_with_allocator(*kernelAlloc, leftMapping->runEvictionLoop());
+
+		// We keep one reference until the detach the observer.
+		rightMapping.ctr()->increment();
+		rightMapping->view->addObserver(&rightMapping->observer);
+		if (rightMapping->view->canEvictMemory())
+			async::detach_with_allocator(*kernelAlloc, rightMapping->runEvictionLoop());
 
-			it = rightMapping.get();
-		} else {
-			it = MappingTree::successor(it);
+		assert(mapping->state == MappingState::zombie);
+		mapping->state = MappingState::retired;
+
+		if (mapping->view->canEvictMemory()) {
+			mapping->cancelEviction.cancel();
+			co_await mapping->evictionDoneEvent.wait();
 		}
+		mapping->view->removeObserver(&mapping->observer);
+		mapping->selfPtr.ctr()->decrement();
 	}
-
-	co_return frg::make_tuple(start, end);
 }
 
-coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length, Mapping *start, Mapping *end) {
+coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length,
+		frg::vector<frg::tuple<VirtualAddr, size_t>, KernelAlloc> &freedRanges) {
 	bool needsShootdown = false;
 
-	for (auto it = start; it != end;) {
-		auto mapping = it->selfPtr.lock();
-		it = MappingTree::successor(it);
-
-		if (mapping->address >= address && (mapping->address + mapping->length) <= (address + length)) {
-			needsShootdown = true;
+	auto current = address;
+	while(true) {
+		smarter::shared_ptr<Mapping> mapping;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceGuard = frg::guard(&_snapshotMutex);
 
-			assert(mapping->state == MappingState::active);
-			mapping->state = MappingState::zombie;
+			mapping = _findFirstMapping(current, address + length);
+		}
+		if(!mapping)
+			break;
+		current = mapping->address + mapping->length;
 
-			// Mark pages as dirty and unmap without holding a lock.
-			auto unmapOutcome = _ops->unmapPages(mapping->address, mapping->view.get(),
-						mapping->viewOffset, mapping->length);
-			assert(unmapOutcome);
+		// _splitMappings() ensures that the mapping is contained in the range.
+		assert(mapping->address >= address
+				&& (mapping->address + mapping->length) <= (address + length));
+		needsShootdown = true;
 
-			_mappings.remove(mapping.get());
+		assert(mapping->state == MappingState::active);
+		mapping->state = MappingState::zombie;
 
-			assert(mapping->state == MappingState::zombie);
-			mapping->state = MappingState::retired;
+		// Mark pages as dirty and unmap without holding a lock.
+		auto unmapOutcome = _ops->unmapPages(mapping->address, mapping->view.get(),
+					mapping->viewOffset, mapping->length);
+		assert(unmapOutcome);
 
-			if(mapping->view->canEvictMemory()) {
-				mapping->cancelEviction.cancel();
-				co_await mapping->evictionDoneEvent.wait();
-			}
-			mapping->view->removeObserver(&mapping->observer);
-			mapping->selfPtr.ctr()->decrement();
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceGuard = frg::guard(&_snapshotMutex);
 
-			// Finally, coalesce the hole in the hole tree.
-
-			// Find the holes that preceede/succeede mapping.
-			Hole *pre;
-			Hole *succ;
-
-			auto current = _holes.get_root();
-			while(true) {
-				assert(current);
-				if(mapping->address < current->address()) {
-					if(HoleTree::get_left(current)) {
-						current = HoleTree::get_left(current);
-					}else{
-						pre = HoleTree::predecessor(current);
-						succ = current;
-						break;
-					}
-				}else{
-					assert(mapping->address >= current->address() + current->length());
-					if(HoleTree::get_right(current)) {
-						current = HoleTree::get_right(current);
-					}else{
-						pre = current;
-						succ = HoleTree::successor(current);
-						break;
-					}
-				}
-			}
+			_mappings.remove(mapping.get());
+		}
+		freedRanges.push(frg::make_tuple(mapping->address, mapping->length));
 
-			// Try to merge the new hole and the existing ones.
-			if(pre && pre->address() + pre->length() == mapping->address
-					&& succ && mapping->address + mapping->length == succ->address()) {
-				auto hole = frg::construct<Hole>(*kernelAlloc, pre->address(),
-						pre->length() + mapping->length + succ->length());
-
-				_holes.remove(pre);
-				_holes.remove(succ);
-				_holes.insert(hole);
-				frg::destruct(*kernelAlloc, pre);
-				frg::destruct(*kernelAlloc, succ);
-			}else if(pre && pre->address() + pre->length() == mapping->address) {
-				auto hole = frg::construct<Hole>(*kernelAlloc,
-						pre->address(), pre->length() + mapping->length);
-
-				_holes.remove(pre);
-				_holes.insert(hole);
-				frg::destruct(*kernelAlloc, pre);
-			}else if(succ && mapping->address + mapping->length == succ->address()) {
-				auto hole = frg::construct<Hole>(*kernelAlloc,
-						mapping->address, mapping->length + succ->length());
-
-				_holes.remove(succ);
-				_holes.insert(hole);
-				frg::destruct(*kernelAlloc, succ);
-			}else{
-				auto hole = frg::construct<Hole>(*kernelAlloc,
-						mapping->address, mapping->length);
+		assert(mapping->state == MappingState::zombie);
+		mapping->state = MappingState::retired;
 
-				_holes.insert(hole);
-			}
+		if(mapping->view->canEvictMemory()) {
+			mapping->cancelEviction.cancel();
+			co_await mapping->evictionDoneEvent.wait();
 		}
+		mapping->view->removeObserver(&mapping->observer);
+		mapping->selfPtr.ctr()->decrement();
 	}
 
 	co_return needsShootdown;
@@ -1091,7 +1471,7 @@ coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length,
 
 coroutine<size_t> VirtualSpace::readPartialSpace(uintptr_t address,
 		void *buffer, size_t size, smarter::shared_ptr<WorkQueue> wq) {
-	// We do not take _consistencyMutex here since we are only interested in a snapshot.
+	// We do not take _rangeLock here since we are only interested in a snapshot.
 
 	size_t progress = 0;
 	while(progress < size) {
@@ -1165,7 +1545,7 @@ coroutine<size_t> VirtualSpace::readPartialSpace(uintptr_t address,
 
 coroutine<size_t> VirtualSpace::writePartialSpace(uintptr_t address,
 		const void *buffer, size_t size, smarter::shared_ptr<WorkQueue> wq) {
-	// We do not take _consistencyMutex here since we are only interested in a snapshot.
+	// We do not take _rangeLock here since we are only interested in a snapshot.
 
 	size_t progress = 0;
 	while(progress < size) {
@@ -1237,6 +1617,82 @@ coroutine<size_t> VirtualSpace::writePartialSpace(uintptr_t address,
 	co_return progress;
 }
 
+coroutine<frg::tuple<size_t, bool>> VirtualSpace::copyFromSpace(uintptr_t address,
+		VirtualSpace *source, uintptr_t sourceAddress, size_t size,
+		smarter::shared_ptr<WorkQueue> wq) {
+	// We do not take _rangeLock here since we are only interested in a snapshot.
+
+	size_t progress = 0;
+	while(progress < size) {
+		smarter::shared_ptr<Mapping> mapping;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceGuard = frg::guard(&_snapshotMutex);
+
+			mapping = _findMapping(address + progress);
+		}
+		if(!mapping)
+			co_return frg::make_tuple(progress, false);
+
+		auto startInMapping = address + progress - mapping->address;
+		auto limitInMapping = frg::min(size - progress, mapping->length - startInMapping);
+		// Otherwise, _findMapping() would have returned garbage.
+		assert(limitInMapping);
+
+		auto lockOutcome = co_await mapping->lockVirtualRange(startInMapping, limitInMapping, wq);
+		if(!lockOutcome)
+			co_return frg::make_tuple(progress, false);
+
+		FetchFlags fetchFlags = 0;
+		if(mapping->flags & MappingFlags::dontRequireBacking)
+			fetchFlags |= fetchDisallowBacking;
+
+		// This loop iterates until we hit the end of the mapping.
+		bool success = true;
+		bool sourceFault = false;
+		while(progress < size) {
+			auto offsetInMapping = address + progress - mapping->address;
+			if(offsetInMapping == mapping->length)
+				break;
+			assert(offsetInMapping < mapping->length);
+
+			// Ensure that the page is available.
+			auto touchOutcome = co_await mapping->view->fetchRange(
+					(mapping->viewOffset + offsetInMapping) & ~(kPageSize - 1), fetchFlags, wq);
+			if(!touchOutcome) {
+				success = false;
+				break;
+			}
+
+			auto [physical, cacheMode] = mapping->resolveRange(
+					offsetInMapping & ~(kPageSize - 1));
+			// Since we have locked the MemoryView, the physical address remains valid here.
+			assert(physical != PhysicalAddr(-1));
+
+			// Copy from the source space straight into the (locked) destination page.
+			PageAccessor accessor{physical};
+			auto misalign = offsetInMapping & (kPageSize - 1);
+			auto chunk = frg::min(size - progress, kPageSize - misalign);
+			assert(chunk); // Otherwise, we would have finished already.
+			auto copied = co_await source->readPartialSpace(sourceAddress + progress,
+					reinterpret_cast<std::byte *>(accessor.get()) + misalign, chunk, wq);
+			progress += copied;
+			if(copied != chunk) {
+				success = false;
+				sourceFault = true;
+				break;
+			}
+		}
+
+		mapping->unlockVirtualRange(startInMapping, limitInMapping);
+
+		if(!success)
+			co_return frg::make_tuple(progress, sourceFault);
+	}
+
+	co_return frg::make_tuple(progress, false);
+}
+
 // --------------------------------------------------------
 // AddressSpace
 // --------------------------------------------------------
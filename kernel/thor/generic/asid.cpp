@@ -4,28 +4,92 @@
 #include <thor-internal/arch-generic/paging.hpp>
 
 #include <thor-internal/cpu-data.hpp>
+#include <thor-internal/kernel-stats.hpp>
 
 namespace thor {
 
 THOR_DEFINE_PERCPU(asidData);
+THOR_DEFINE_PERCPU(shootdownCpuState);
 
 namespace {
 
+// If we're invalidating at least this many pages, we invalidate the whole ASID instead.
+constexpr size_t fullInvalidationThreshold = 64;
+
+void doInvalidateAsid(int asid) {
+	invalidateAsid(asid);
+
+	auto &stats = shootdownCpuState.get();
+	stats.asidInvalidations.store(stats.asidInvalidations.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+}
+
 void invalidateNode(int asid, ShootNode *node) {
-	// If we're invalidating a lot of pages, just invalidate the
-	// whole ASID instead.
 	// invalidateAsid(globalBindingId) is not allowed, so avoid
 	// the optimization in that case.
-	if(asid != globalBindingId && (node->size >> kPageShift) >= 64) {
-		invalidateAsid(asid);
+	if(asid != globalBindingId && (node->size >> kPageShift) >= fullInvalidationThreshold) {
+		doInvalidateAsid(asid);
 	} else {
-		for(size_t off = 0; off < node->size; off += kPageSize)
-			invalidatePage(asid, reinterpret_cast<void *>(node->address + off));
+		if(node->ranges.size()) {
+			for(size_t i = 0; i < node->ranges.size(); i++) {
+				auto &range = node->ranges[i];
+				for(size_t off = 0; off < range.size; off += kPageSize)
+					invalidatePage(asid, reinterpret_cast<void *>(range.address + off));
+			}
+		} else {
+			for(size_t off = 0; off < node->size; off += kPageSize)
+				invalidatePage(asid, reinterpret_cast<void *>(node->address + off));
+		}
+
+		auto &stats = shootdownCpuState.get();
+		stats.pageInvalidations.store(stats.pageInvalidations.load(std::memory_order_relaxed)
+				+ (node->size >> kPageShift), std::memory_order_relaxed);
 	}
 }
 
 } // namespace anonymous
 
+void enableShootdownIpis(CpuData *cpuData) {
+	shootdownCpuState.get(cpuData).ipiPending.store(false, std::memory_order_release);
+}
+
+void requestShootdownIpis() {
+	// The acq_rel exchanges (here and in handleShootdownIpi()) ensure that a CPU that
+	// clears its flag after we set it observes the shootdown requests that we queued before.
+	bool needIpi = false;
+	auto self = getCpuData();
+	for(size_t i = 0; i < getCpuCount(); i++) {
+		if(getCpuData(i) == self)
+			continue;
+		if(!shootdownCpuState.getFor(i).ipiPending.exchange(true, std::memory_order_acq_rel))
+			needIpi = true;
+	}
+	if(!needIpi)
+		return;
+
+	sendShootdownIpi();
+	countKernelStat(KernelStat::ipisSent);
+
+	auto &stats = shootdownCpuState.get();
+	stats.ipisSent.store(stats.ipisSent.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+}
+
+void handleShootdownIpi() {
+	assert(!intsAreEnabled());
+	auto &state = shootdownCpuState.get();
+
+	// Clear the flag *before* looking at the shootdown queues.
+	state.ipiPending.exchange(false, std::memory_order_acq_rel);
+	state.ipisReceived.store(state.ipisReceived.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+
+	for(auto &binding : asidData.get()->bindings)
+		binding.shootdown();
+
+	asidData.get()->globalBinding.shootdown();
+}
+
 
 ShootNodeList
 PageBinding::completeShootdown_(PageSpace *space, uint64_t afterSequence, bool doShootdown) {
@@ -34,6 +98,24 @@ PageBinding::completeShootdown_(PageSpace *space, uint64_t afterSequence, bool d
 
 	ShootNodeList complete;
 
+	// All pending requests are handled in a single batch. If they cover many pages
+	// in total, it is cheaper to invalidate the whole ASID once.
+	bool invalidatedAll = false;
+	if(doShootdown && id_ != globalBindingId && !space->shootQueue_.empty()) {
+		size_t numPages = 0;
+		auto current = space->shootQueue_.back();
+		while(current && current->sequence_ > afterSequence) {
+			if(current->initiatorCpu_ != getCpuData())
+				numPages += current->size >> kPageShift;
+			current = current->queueNode.previous;
+		}
+
+		if(numPages >= fullInvalidationThreshold) {
+			doInvalidateAsid(id_);
+			invalidatedAll = true;
+		}
+	}
+
 	if(!space->shootQueue_.empty()) {
 		auto current = space->shootQueue_.back();
 		while(current->sequence_ > afterSequence) {
@@ -41,7 +123,7 @@ PageBinding::completeShootdown_(PageSpace *space, uint64_t afterSequence, bool d
 
 			// Signal completion of the shootdown.
 			if(current->initiatorCpu_ != getCpuData()) {
-				if(doShootdown) {
+				if(doShootdown && !invalidatedAll) {
 					invalidateNode(id_, current);
 				}
 
@@ -272,7 +354,7 @@ void PageSpace::retire(RetireNode *node) {
 	if(!anyBindings)
 		node->complete();
 
-	sendShootdownIpi();
+	requestShootdownIpis();
 }
 
 
@@ -280,6 +362,8 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 	assert(!(node->address & (kPageSize - 1)));
 	assert(!(node->size & (kPageSize - 1)));
 
+	countKernelStat(KernelStat::shootdowns);
+
 	{
 		auto irqLock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&mutex_);
@@ -313,7 +397,7 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 		shootQueue_.push_back(node);
 	}
 
-	sendShootdownIpi();
+	requestShootdownIpis();
 	return false;
 }
 
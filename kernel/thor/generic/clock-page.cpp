@@ -0,0 +1,70 @@
+#include <string.h>
+
+#include <frg/eternal.hpp>
+#include <hel.h>
+#include <thor-internal/arch-generic/ints.hpp>
+#include <thor-internal/clock-page.hpp>
+#include <thor-internal/kernel-locks.hpp>
+#include <thor-internal/physical.hpp>
+
+namespace thor {
+
+namespace {
+
+struct ClockPage {
+	ClockPage() {
+		physical = physicalAllocator->allocate(kPageSize);
+		assert(physical != PhysicalAddr(-1) && "OOM when allocating the clock page");
+		PageAccessor accessor{physical};
+		memset(accessor.get(), 0, kPageSize);
+		page = reinterpret_cast<HelClockPage *>(accessor.get());
+
+		memory = smarter::allocate_shared<HardwareMemory>(*kernelAlloc, physical, kPageSize,
+				CachingMode::null);
+	}
+
+	// Writers are serialized by the lock; readers in user space use the seqlock.
+	template<typename F>
+	void update(F fn) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex);
+
+		auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_RELAXED);
+		__atomic_store_n(&page->seqlock, seqlock + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		fn(page);
+		__atomic_store_n(&page->seqlock, seqlock + 2, __ATOMIC_RELEASE);
+	}
+
+	PhysicalAddr physical;
+	HelClockPage *page;
+	smarter::shared_ptr<MemoryView> memory;
+	TicketSpinlock mutex;
+};
+
+ClockPage *getClockPage() {
+	static frg::eternal<ClockPage> singleton;
+	return &singleton.get();
+}
+
+} // anonymous namespace
+
+smarter::shared_ptr<MemoryView> getClockMemory() {
+	return getClockPage()->memory;
+}
+
+void publishClockTscParameters(uint64_t factor, int shift) {
+	getClockPage()->update([&] (HelClockPage *page) {
+		__atomic_store_n(&page->tscFactor, factor, __ATOMIC_RELAXED);
+		__atomic_store_n(&page->tscShift, shift, __ATOMIC_RELAXED);
+		__atomic_store_n(&page->flags, page->flags | kHelClockPageTsc, __ATOMIC_RELAXED);
+	});
+}
+
+void setClockRealtimeOffset(int64_t offset) {
+	getClockPage()->update([&] (HelClockPage *page) {
+		__atomic_store_n(&page->realtimeOffset, offset, __ATOMIC_RELAXED);
+	});
+}
+
+} // namespace thor
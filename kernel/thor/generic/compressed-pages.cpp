@@ -0,0 +1,291 @@
+#include <assert.h>
+#include <string.h>
+#include <atomic>
+
+#include <frg/algorithm.hpp>
+#include <thor-internal/compressed-pages.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/physical.hpp>
+
+namespace thor {
+
+namespace {
+
+// The kernel heap rounds allocations up to powers of two. Storing the compressed data
+// in fixed-size chunks avoids wasting up to half of each allocation.
+constexpr size_t chunkSize = 256;
+
+// Pages that do not compress to at most this size are more expensive to
+// store in compressed form than to keep resident.
+constexpr size_t maxCompressedSize = kPageSize * 3 / 4;
+constexpr size_t maxChunks = maxCompressedSize / chunkSize;
+
+// LZ4 block format constants.
+constexpr size_t minMatch = 4;
+// The last 5 bytes are always literals.
+constexpr size_t lastLiterals = 5;
+// The last match must start at least 12 bytes before the end of the block.
+constexpr size_t mfLimit = 12;
+constexpr size_t maxOffset = 0xFFFF;
+
+static_assert(kPageSize <= 0x10000, "hash table stores 16-bit positions");
+
+} // anonymous namespace
+
+struct CompressedPage {
+	// Size of the compressed data in bytes.
+	uint16_t size;
+	uint16_t numChunks;
+	uint8_t *chunks[maxChunks];
+};
+
+namespace {
+
+std::atomic<size_t> numStored{0};
+std::atomic<size_t> numStoredBytes{0};
+std::atomic<uint64_t> numRejected{0};
+
+uint32_t read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(uint32_t));
+	return v;
+}
+
+uint32_t hashSequence(uint32_t sequence) {
+	return (sequence * 2654435761u) >> (32 - PageCompressor::hashLog);
+}
+
+// Compresses src into dst. Returns zero if the output does not fit into dst.
+size_t lz4Compress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstCapacity,
+		uint16_t *table) {
+	size_t op = 0;
+
+	auto emitSequence = [&] (size_t anchor, size_t literals,
+			size_t offset, size_t matchLength) -> bool {
+		// Worst case: token, literal length, literals, offset, match length.
+		size_t worstCase = 1 + literals / 255 + 1 + literals + 2 + matchLength / 255 + 1;
+		if(op + worstCase > dstCapacity)
+			return false;
+
+		auto token = &dst[op++];
+		*token = 0;
+
+		if(literals >= 15) {
+			*token |= 15 << 4;
+			size_t n = literals - 15;
+			while(n >= 255) {
+				dst[op++] = 255;
+				n -= 255;
+			}
+			dst[op++] = n;
+		}else{
+			*token |= literals << 4;
+		}
+		memcpy(&dst[op], &src[anchor], literals);
+		op += literals;
+
+		// The last sequence only consists of literals.
+		if(!matchLength)
+			return true;
+
+		dst[op++] = offset & 0xFF;
+		dst[op++] = offset >> 8;
+
+		size_t extra = matchLength - minMatch;
+		if(extra >= 15) {
+			*token |= 15;
+			size_t n = extra - 15;
+			while(n >= 255) {
+				dst[op++] = 255;
+				n -= 255;
+			}
+			dst[op++] = n;
+		}else{
+			*token |= extra;
+		}
+		return true;
+	};
+
+	memset(table, 0, sizeof(uint16_t) << PageCompressor::hashLog);
+
+	size_t ip = 0;
+	size_t anchor = 0;
+	while(ip + mfLimit <= srcSize) {
+		auto sequence = read32(&src[ip]);
+		auto h = hashSequence(sequence);
+		size_t ref = table[h];
+		table[h] = ip;
+
+		if(ref >= ip || ip - ref > maxOffset || read32(&src[ref]) != sequence) {
+			ip++;
+			continue;
+		}
+
+		size_t length = minMatch;
+		while(ip + length < srcSize - lastLiterals && src[ref + length] == src[ip + length])
+			length++;
+
+		if(!emitSequence(anchor, ip - anchor, ip - ref, length))
+			return 0;
+		ip += length;
+		anchor = ip;
+	}
+
+	if(!emitSequence(anchor, srcSize - anchor, 0, 0))
+		return 0;
+	return op;
+}
+
+// Reads compressed data from a sequence of chunks.
+struct ChunkReader {
+	ChunkReader(CompressedPage *page)
+	: chunks_{page->chunks}, size_{page->size} { }
+
+	size_t remaining() {
+		return size_ - position_;
+	}
+
+	uint8_t byte() {
+		assert(position_ < size_);
+		auto b = chunks_[position_ / chunkSize][position_ % chunkSize];
+		position_++;
+		return b;
+	}
+
+	void copy(uint8_t *dst, size_t n) {
+		assert(n <= remaining());
+		while(n) {
+			auto offset = position_ % chunkSize;
+			auto chunk = frg::min(n, chunkSize - offset);
+			memcpy(dst, chunks_[position_ / chunkSize] + offset, chunk);
+			dst += chunk;
+			position_ += chunk;
+			n -= chunk;
+		}
+	}
+
+private:
+	uint8_t **chunks_;
+	size_t size_;
+	size_t position_ = 0;
+};
+
+// Decompresses an LZ4 block. Returns false if the data is corrupted.
+bool lz4Decompress(ChunkReader &src, uint8_t *dst, size_t dstSize) {
+	size_t op = 0;
+
+	auto readLength = [&] (size_t &length) -> bool {
+		uint8_t b;
+		do {
+			if(!src.remaining())
+				return false;
+			b = src.byte();
+			length += b;
+		} while(b == 255);
+		return true;
+	};
+
+	while(true) {
+		if(!src.remaining())
+			return false;
+		auto token = src.byte();
+
+		size_t literals = token >> 4;
+		if(literals == 15 && !readLength(literals))
+			return false;
+		if(literals > src.remaining() || literals > dstSize - op)
+			return false;
+		src.copy(&dst[op], literals);
+		op += literals;
+
+		if(!src.remaining())
+			return op == dstSize;
+
+		if(src.remaining() < 2)
+			return false;
+		size_t offset = src.byte();
+		offset |= size_t{src.byte()} << 8;
+		if(!offset || offset > op)
+			return false;
+
+		size_t length = token & 15;
+		if(length == 15 && !readLength(length))
+			return false;
+		length += minMatch;
+		if(length > dstSize - op)
+			return false;
+
+		// Matches may overlap the output, hence we copy byte by byte.
+		for(size_t i = 0; i < length; i++)
+			dst[op + i] = dst[op - offset + i];
+		op += length;
+	}
+}
+
+// The store may use up to this many bytes.
+size_t storeLimit() {
+	return physicalAllocator->numTotalPages() * kPageSize / 4;
+}
+
+} // anonymous namespace
+
+CompressedPage *PageCompressor::compress(PhysicalAddr physical) {
+	size_t size;
+	{
+		PageAccessor accessor{physical};
+		size = lz4Compress(reinterpret_cast<const uint8_t *>(accessor.get()), kPageSize,
+				buffer_, maxCompressedSize, hashTable_);
+	}
+	if(!size) {
+		numRejected.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	size_t numChunks = (size + chunkSize - 1) / chunkSize;
+	size_t footprint = sizeof(CompressedPage) + numChunks * chunkSize;
+	if(numStoredBytes.fetch_add(footprint, std::memory_order_relaxed) + footprint
+			> storeLimit()) {
+		numStoredBytes.fetch_sub(footprint, std::memory_order_relaxed);
+		numRejected.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	auto page = frg::construct<CompressedPage>(*kernelAlloc);
+	page->size = size;
+	page->numChunks = numChunks;
+	for(size_t i = 0; i < numChunks; i++) {
+		page->chunks[i] = static_cast<uint8_t *>(kernelAlloc->allocate(chunkSize));
+		auto offset = i * chunkSize;
+		memcpy(page->chunks[i], buffer_ + offset, frg::min(chunkSize, size - offset));
+	}
+	numStored.fetch_add(1, std::memory_order_relaxed);
+	return page;
+}
+
+void decompressPage(CompressedPage *page, PhysicalAddr physical) {
+	PageAccessor accessor{physical};
+	ChunkReader reader{page};
+	if(!lz4Decompress(reader, reinterpret_cast<uint8_t *>(accessor.get()), kPageSize))
+		panicLogger() << "thor: Compressed page is corrupted" << frg::endlog;
+}
+
+void freeCompressedPage(CompressedPage *page) {
+	size_t footprint = sizeof(CompressedPage) + page->numChunks * chunkSize;
+	for(size_t i = 0; i < page->numChunks; i++)
+		kernelAlloc->deallocate(page->chunks[i], chunkSize);
+	frg::destruct(*kernelAlloc, page);
+
+	numStored.fetch_sub(1, std::memory_order_relaxed);
+	numStoredBytes.fetch_sub(footprint, std::memory_order_relaxed);
+}
+
+CompressionStatistics getCompressionStatistics() {
+	return {
+		.storedPages = numStored.load(std::memory_order_relaxed),
+		.storedBytes = numStoredBytes.load(std::memory_order_relaxed),
+		.rejectedPages = numRejected.load(std::memory_order_relaxed)
+	};
+}
+
+} // namespace thor
@@ -116,11 +116,37 @@ KernelVirtualMemory::KernelVirtualMemory() {
 	virtualTree->insert(initialHole);
 }
 
+extern PerCpu<KernelVirtualCache> kernelVirtualCache;
+THOR_DEFINE_PERCPU(kernelVirtualCache);
+
+std::atomic<bool> KernelVirtualMemory::cachesEnabled_{false};
+
+void KernelVirtualMemory::enableCaches() {
+	cachesEnabled_.store(true, std::memory_order_relaxed);
+}
+
 void *KernelVirtualMemory::allocate(size_t size) {
 	// Round up to page size.
 	size = (size + kPageSize - 1) & ~(kPageSize - 1);
 
 	auto irqLock = frg::guard(&irqMutex());
+
+	if(size <= KernelVirtualCache::maxAreaSize
+			&& cachesEnabled_.load(std::memory_order_relaxed)) {
+		auto cache = &kernelVirtualCache.get();
+		for(size_t i = cache->count; i > 0; i--) {
+			auto area = cache->areas[i - 1];
+			if(area.size != size)
+				continue;
+			cache->areas[i - 1] = cache->areas[--cache->count];
+
+			auto pointer = reinterpret_cast<void *>(area.address);
+			kernelVirtualUsage += size; // FIXME: atomicity.
+			unpoisonKasanShadow(pointer, size);
+			return pointer;
+		}
+	}
+
 	auto lock = frg::guard(&mutex_);
 	void *pointer;
 	{
@@ -190,6 +216,88 @@ void KernelVirtualMemory::deallocate(void *pointer, size_t size) {
 	poisonKasanShadow(pointer, size);
 }
 
+// Shoots down a batch of lazily deallocated areas.
+// While the node is pending, deallocateLazily() appends areas to it.
+struct KernelVirtualMemory::LazyPurgeNode final : ShootNode {
+	void complete() override {
+		auto self = &KernelVirtualMemory::global();
+		for(size_t i = 0; i < numAreas; i++)
+			self->release_(areas[i].address, areas[i].size);
+		frg::destruct(getCoreAllocator(), this);
+	}
+
+	ShootRange areas[maxLazyAreas];
+	size_t numAreas = 0;
+};
+
+void KernelVirtualMemory::deallocateLazily(void *pointer, size_t size) {
+	static_assert(sizeof(LazyPurgeNode) <= kPageSize);
+
+	// Round up to page size.
+	size = (size + kPageSize - 1) & ~(kPageSize - 1);
+
+	LazyPurgeNode *purge = nullptr;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex_);
+
+		if(!pending_) {
+			pending_ = frg::construct<LazyPurgeNode>(getCoreAllocator());
+			pending_->size = 0;
+		}
+
+		pending_->areas[pending_->numAreas++] = {reinterpret_cast<VirtualAddr>(pointer), size};
+		pending_->size += size;
+
+		if(pending_->numAreas == maxLazyAreas || pending_->size >= lazyPurgeThreshold) {
+			purge = pending_;
+			pending_ = nullptr;
+		}
+	}
+
+	if(purge)
+		submitPurge_(purge);
+}
+
+void KernelVirtualMemory::purgeLazyAreas() {
+	LazyPurgeNode *purge;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex_);
+
+		purge = pending_;
+		pending_ = nullptr;
+	}
+
+	if(purge)
+		submitPurge_(purge);
+}
+
+void KernelVirtualMemory::submitPurge_(LazyPurgeNode *node) {
+	node->address = node->areas[0].address;
+	node->ranges = {node->areas, node->numAreas};
+	if(KernelPageSpace::global().submitShootdown(node))
+		node->complete();
+}
+
+void KernelVirtualMemory::release_(uintptr_t address, size_t size) {
+	if(size <= KernelVirtualCache::maxAreaSize
+			&& cachesEnabled_.load(std::memory_order_relaxed)) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto cache = &kernelVirtualCache.get();
+		if(cache->count < KernelVirtualCache::capacity) {
+			cache->areas[cache->count++] = {address, size};
+
+			assert(kernelVirtualUsage >= size);
+			kernelVirtualUsage -= size;
+			poisonKasanShadow(reinterpret_cast<void *>(address), size);
+			return;
+		}
+	}
+
+	deallocate(reinterpret_cast<void *>(address), size);
+}
+
 frg::manual_box<KernelVirtualMemory> kernelVirtualMemory;
 
 KernelVirtualMemory &KernelVirtualMemory::global() {
@@ -234,24 +342,7 @@ void KernelVirtualAlloc::unmap(uintptr_t address, size_t length) {
 	}
 	kernelMemoryUsage -= length;
 
-	// TODO: we could replace this closure by an appropriate async::detach_with_allocator call.
-	struct Closure final : ShootNode {
-		void complete() override {
-			frg::slab_allocator<CoreSlabPolicy, IrqSpinlock> coreAllocator(corePool.get());
-
-			KernelVirtualMemory::global().deallocate(reinterpret_cast<void *>(address), size);
-			Closure::~Closure();
-			asm volatile ("" : : : "memory");
-			frg::destruct(getCoreAllocator(), this);
-		}
-	};
-	static_assert(sizeof(Closure) <= kPageSize);
-
-	auto p = frg::construct<Closure>(getCoreAllocator());
-	p->address = address;
-	p->size = length;
-	if(KernelPageSpace::global().submitShootdown(p))
-		p->complete();
+	KernelVirtualMemory::global().deallocateLazily(reinterpret_cast<void *>(address), length);
 }
 
 frg::manual_box<LogRingBuffer> allocLog;
@@ -307,6 +398,108 @@ constinit frg::manual_box<
 
 constinit frg::manual_box<KernelAlloc> kernelAlloc = {};
 
+extern PerCpu<KernelHeapCache> kernelHeapCache;
+THOR_DEFINE_PERCPU(kernelHeapCache);
+
+std::atomic<bool> KernelAlloc::_cachesEnabled{false};
+
+void KernelAlloc::enableCaches() {
+	_cachesEnabled.store(true, std::memory_order_relaxed);
+}
+
+void *KernelAlloc::allocate(size_t size) {
+	if(size > KernelHeapCache::maxObjectSize)
+		return _backing.allocate(size);
+
+	// Note that we always allocate objects of the full class size,
+	// such that all objects can later be cached and serve all allocations of their class.
+	auto sizeClass = KernelHeapCache::sizeClassOf(size);
+	auto objectSize = KernelHeapCache::classSize(sizeClass);
+	if(!_cachesEnabled.load(std::memory_order_relaxed))
+		return _backing.allocate(objectSize);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto cache = &kernelHeapCache.get();
+	auto stack = &cache->stacks[sizeClass];
+	auto stats = &cache->stats[sizeClass];
+	stats->allocations.store(stats->allocations.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+
+	if(!stack->count) {
+		stats->refills.store(stats->refills.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+
+		// Refill the cache.
+		while(stack->count < KernelHeapCache::batchSize) {
+			auto object = _backing.allocate(objectSize);
+			poisonKasanShadow(object, objectSize);
+			stack->objects[stack->count++] = object;
+		}
+	}
+
+	// Since objects are passed to the slab_pool with their class size,
+	// KASAN does not detect accesses to the padding between size and the class size.
+	auto pointer = stack->objects[--stack->count];
+	unpoisonKasanShadow(pointer, objectSize);
+	return pointer;
+}
+
+void KernelAlloc::deallocate(void *pointer, size_t size) {
+	if(!pointer)
+		return;
+	if(size > KernelHeapCache::maxObjectSize) {
+		_backing.deallocate(pointer, size);
+		return;
+	}
+
+	auto sizeClass = KernelHeapCache::sizeClassOf(size);
+	auto objectSize = KernelHeapCache::classSize(sizeClass);
+	if(!_cachesEnabled.load(std::memory_order_relaxed)) {
+		_backing.deallocate(pointer, objectSize);
+		return;
+	}
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto cache = &kernelHeapCache.get();
+	auto stack = &cache->stacks[sizeClass];
+
+	if(stack->count == KernelHeapCache::capacity) {
+		auto stats = &cache->stats[sizeClass];
+		stats->drains.store(stats->drains.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+
+		// The cache is full. Drain a batch of objects back to the slab_pool.
+		for(size_t i = 0; i < KernelHeapCache::batchSize; i++) {
+			auto object = stack->objects[--stack->count];
+			unpoisonKasanShadow(object, objectSize);
+			_backing.deallocate(object, objectSize);
+		}
+	}
+
+	poisonKasanShadow(pointer, objectSize);
+	stack->objects[stack->count++] = pointer;
+}
+
+void *KernelAlloc::reallocate(void *pointer, size_t size) {
+	// Round up to the class size such that the object can later be put into the cache.
+	if(size && size <= KernelHeapCache::maxObjectSize)
+		size = KernelHeapCache::classSize(KernelHeapCache::sizeClassOf(size));
+	return _backing.reallocate(pointer, size);
+}
+
+KernelHeapStatistics getKernelHeapStatistics(int sizeClass) {
+	assert(sizeClass >= 0 && sizeClass < KernelHeapCache::numClasses);
+
+	KernelHeapStatistics result{};
+	for(size_t i = 0; i < getCpuCount(); i++) {
+		auto &stats = kernelHeapCache.getFor(i).stats[sizeClass];
+		result.allocations += stats.allocations.load(std::memory_order_relaxed);
+		result.refills += stats.refills.load(std::memory_order_relaxed);
+		result.drains += stats.drains.load(std::memory_order_relaxed);
+	}
+	return result;
+}
+
 // --------------------------------------------------------
 // CpuData
 // --------------------------------------------------------
@@ -1,13 +1,14 @@
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
 #include <thor-internal/arch/stack.hpp>
+#include <thor-internal/arch-generic/timer.hpp>
 #include <thor-internal/ring-buffer.hpp>
 
 namespace thor {
 
 namespace {
 	// Protects the data structures below.
-	constinit frg::ticket_spinlock logMutex;
+	constinit TicketSpinlock logMutex;
 
 	frg::manual_box<frg::intrusive_list<
 		LogHandler,
@@ -17,6 +18,9 @@ namespace {
 			&LogHandler::hook
 		>
 	>> globalLogList;
+
+	// See deferLogEmission().
+	constinit std::atomic<bool> logEmissionDeferred{false};
 } // anonymous namespace
 
 void LogHandler::emitUrgent(frg::string_view record) {
@@ -45,6 +49,12 @@ namespace {
 	bool tryStartEmitting();
 	bool tryFinishEmitting();
 
+	// Assumption: logMutex is held.
+	void flushLogHandlers() {
+		for (const auto &it : *globalLogList)
+			it->flush();
+	}
+
 	// Assumption: !intsAreEnabled().
 	void emitLogsFromRing() {
 		auto *cpuData = getCpuData();
@@ -59,7 +69,7 @@ namespace {
 
 				char buffer[logLineLength];
 				auto [success, recordPtr, nextPtr, actualSize] = cpuData->localLogRing->dequeueAt(
-						cpuData->localLogSeq, buffer, logLineLength);
+						cpuData->localLogSeq.load(std::memory_order_relaxed), buffer, logLineLength);
 				if (!success)
 					break;
 
@@ -69,13 +79,56 @@ namespace {
 				for (const auto &it : *globalLogList)
 					it->emit(record);
 
-				cpuData->localLogSeq = nextPtr;
+				cpuData->localLogSeq.store(nextPtr, std::memory_order_relaxed);
 			}
 
+			auto lock = frg::guard(&logMutex);
+			flushLogHandlers();
+
 			// Emit logs until no reentrant context has set the RS_PENDING flag.
 		} while(!tryFinishEmitting());
 	}
 
+	// Emits the oldest record of all per-CPU rings. Returns false if all rings are empty.
+	// Assumption: logMutex is held.
+	bool emitOldestRecord() {
+		CpuData *oldest = nullptr;
+		uint64_t oldestTimestamp = 0;
+		for (size_t i = 0; i < getCpuCount(); i++) {
+			auto *cpuData = getCpuData(i);
+			if (!cpuData->localLogRing)
+				continue;
+
+			// Only peek at the metadata; the record is dequeued again below.
+			LogMetadata md;
+			auto [success, recordPtr, nextPtr, actualSize] = cpuData->localLogRing->dequeueAt(
+					cpuData->localLogSeq.load(std::memory_order_relaxed), &md, sizeof(LogMetadata));
+			if (!success || actualSize < sizeof(LogMetadata))
+				continue;
+			if (!oldest || md.timestamp < oldestTimestamp) {
+				oldest = cpuData;
+				oldestTimestamp = md.timestamp;
+			}
+		}
+		if (!oldest)
+			return false;
+
+		char buffer[logLineLength];
+		auto [success, recordPtr, nextPtr, actualSize] = oldest->localLogRing->dequeueAt(
+				oldest->localLogSeq.load(std::memory_order_relaxed), buffer, logLineLength);
+		// Records are only dequeued with logMutex held, hence the ring cannot be empty.
+		assert(success);
+
+		if (actualSize < sizeof(LogMetadata))
+			panic();
+		frg::string_view record{buffer, actualSize};
+		for (const auto &it : *globalLogList)
+			it->emit(record);
+
+		oldest->localLogSeq.store(nextPtr, std::memory_order_relaxed);
+		return true;
+	}
+
 	// Assumption: !intsAreEnabled().
 	bool checkEmitting() {
 		auto s = getCpuData()->reentrantLogState.load(std::memory_order_relaxed);
@@ -148,12 +201,18 @@ namespace {
 
 			// If the expedited flag is set, we always emit logs.
 			// This is the path that kernel panics should usually take.
+			// Otherwise, avoid the global logMutex if we can.
 			bool avoidEmittingLogs = cpuData->avoidEmittingLogs.load(std::memory_order_relaxed);
-			if (!avoidEmittingLogs || expedited)
+			if (expedited) {
+				emitLogsFromRing();
+			} else if (logEmissionDeferred.load(std::memory_order_relaxed)) {
+				wakeLogDrain();
+			} else if (!avoidEmittingLogs) {
 				emitLogsFromRing();
+			}
 
-			// TODO: If we do not call into emitLogsFromRing() here,
-			//       we should wake up a (kernel) thread that emits the logs.
+			// TODO: Before deferLogEmission() is called, records that are posted while
+			//       avoidEmittingLogs is set are only emitted together with the next record.
 		} else {
 			if (record.size() < sizeof(LogMetadata))
 				panic();
@@ -179,7 +238,7 @@ namespace {
 			auto emit = [&] (char c) {
 				if (!stagedLength) {
 					// Put log metadata in front of actual log message.
-					LogMetadata md{.severity = severity};
+					LogMetadata md{.severity = severity, .timestamp = getRawTimestampCounter()};
 					memcpy(stagingBuffer, &md, sizeof(LogMetadata));
 					stagedLength = sizeof(LogMetadata);
 				}
@@ -323,6 +382,42 @@ void PanicSink::operator() (const char *msg) {
 	logProcessor.print('\n'); // Note: this is also required to flush.
 }
 
+void deferLogEmission() {
+	logEmissionDeferred.store(true, std::memory_order_relaxed);
+}
+
+bool haveDeferredLogs() {
+	for (size_t i = 0; i < getCpuCount(); i++) {
+		auto *cpuData = getCpuData(i);
+		if (!cpuData->localLogRing)
+			continue;
+		if (cpuData->localLogRing->peekHeadPtr()
+				!= cpuData->localLogSeq.load(std::memory_order_relaxed))
+			return true;
+	}
+	return false;
+}
+
+void drainDeferredLogs() {
+	StatelessIrqLock irqLock;
+
+	// If we interrupted the emission of logs on this CPU, retry later.
+	if (!tryStartEmitting())
+		return;
+
+	do {
+		while (true) {
+			auto lock = frg::guard(&logMutex);
+			if (!emitOldestRecord()) {
+				flushLogHandlers();
+				break;
+			}
+		}
+
+		// Emit logs until no reentrant context has set the RS_PENDING flag.
+	} while(!tryFinishEmitting());
+}
+
 void PanicSink::finalize(bool) {
 	StatelessIrqLock irqLock;
 
@@ -0,0 +1,196 @@
+#include <assert.h>
+#include <atomic>
+
+#include <thor-internal/arch-generic/ints.hpp>
+#include <thor-internal/cpu-data.hpp>
+#include <thor-internal/epoch.hpp>
+#include <thor-internal/kernel-locks.hpp>
+#include <thor-internal/work-queue.hpp>
+
+namespace thor {
+
+namespace {
+
+// Once a CPU has this many unreclaimed objects, epochRetire() tries to advance the epoch
+// itself instead of waiting for the next schedule point.
+constexpr size_t limboThreshold = 64;
+
+// The global epoch only increases. Objects retired in epoch e can be reclaimed
+// once the global epoch reaches e + 2: at that point, every CPU has either left its
+// critical section or entered a new one after the object was unlinked.
+constinit std::atomic<uint64_t> globalEpoch{1};
+
+} // anonymous namespace
+
+struct EpochReclaimer {
+	// Epoch in which the innermost critical section started (shifted left by one),
+	// with bit zero being set while the CPU is in a critical section.
+	std::atomic<uint64_t> localEpoch{0};
+	unsigned int nesting = 0;
+
+	// Retired objects, newest first. Epochs are non-increasing along the list.
+	EpochNode *limbo = nullptr;
+	size_t numLimbo = 0;
+
+	// Protects reclaimable and workletPosted against the worklet.
+	TicketSpinlock mutex;
+	// Objects that can be reclaimed, waiting for the worklet.
+	EpochNode *reclaimable = nullptr;
+	bool workletPosted = false;
+	Worklet worklet;
+
+	static bool tryAdvance();
+
+	void enter();
+	void exit();
+	void retire(EpochNode *node, void (*deleter)(EpochNode *));
+	void collect();
+	void runReclaim();
+};
+
+namespace {
+
+extern PerCpu<EpochReclaimer> epochReclaimer;
+THOR_DEFINE_PERCPU(epochReclaimer);
+
+} // anonymous namespace
+
+bool EpochReclaimer::tryAdvance() {
+	auto epoch = globalEpoch.load(std::memory_order_seq_cst);
+	for(size_t i = 0; i < getCpuCount(); i++) {
+		auto local = epochReclaimer.getFor(i).localEpoch.load(std::memory_order_seq_cst);
+		if((local & 1) && (local >> 1) != epoch)
+			return false;
+	}
+	// If this fails, another CPU advanced the epoch in the meantime.
+	globalEpoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+	return true;
+}
+
+void EpochReclaimer::enter() {
+	if(nesting++)
+		return;
+
+	// If the epoch changes before localEpoch becomes visible, the CPU that advances it
+	// might have missed us. Retry; the next advance will observe localEpoch.
+	auto epoch = globalEpoch.load(std::memory_order_relaxed);
+	while(true) {
+		localEpoch.store((epoch << 1) | 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto current = globalEpoch.load(std::memory_order_relaxed);
+		if(current == epoch)
+			break;
+		epoch = current;
+	}
+}
+
+void EpochReclaimer::exit() {
+	assert(nesting);
+	if(--nesting)
+		return;
+	localEpoch.store(0, std::memory_order_release);
+}
+
+void EpochReclaimer::retire(EpochNode *node, void (*deleter)(EpochNode *)) {
+	// Order the caller's unlinking stores before reading the epoch.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	node->_deleter = deleter;
+	node->_epoch = globalEpoch.load(std::memory_order_relaxed);
+	node->_next = limbo;
+	limbo = node;
+	numLimbo++;
+
+	if(numLimbo >= limboThreshold && !nesting)
+		collect();
+}
+
+void EpochReclaimer::collect() {
+	if(!limbo)
+		return;
+
+	tryAdvance();
+	auto epoch = globalEpoch.load(std::memory_order_acquire);
+
+	// Find the first object that can be reclaimed; all older objects can be reclaimed, too.
+	auto link = &limbo;
+	while(*link && (*link)->_epoch + 2 > epoch)
+		link = &(*link)->_next;
+	if(!*link)
+		return;
+
+	auto node = *link;
+	*link = nullptr;
+
+	bool mustPost = false;
+	{
+		auto lock = frg::guard(&mutex);
+
+		while(node) {
+			auto next = node->_next;
+			node->_next = reclaimable;
+			reclaimable = node;
+			numLimbo--;
+			node = next;
+		}
+
+		// Early during boot, the work queue does not exist yet.
+		if(!workletPosted && getCpuData()->generalWorkQueue) {
+			workletPosted = true;
+			mustPost = true;
+		}
+	}
+
+	if(mustPost) {
+		worklet.setup([] (Worklet *base) {
+			auto self = frg::container_of(base, &EpochReclaimer::worklet);
+			self->runReclaim();
+		}, WorkQueue::generalQueue(), WorkPriority::background);
+		WorkQueue::post(&worklet);
+	}
+}
+
+void EpochReclaimer::runReclaim() {
+	EpochNode *node;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex);
+
+		node = reclaimable;
+		reclaimable = nullptr;
+		workletPosted = false;
+	}
+
+	while(node) {
+		auto next = node->_next;
+		node->_deleter(node);
+		node = next;
+	}
+}
+
+EpochGuard::EpochGuard() {
+	irqMutex().lock();
+	epochReclaimer.get().enter();
+}
+
+EpochGuard::~EpochGuard() {
+	epochReclaimer.get().exit();
+	irqMutex().unlock();
+}
+
+void epochRetire(EpochNode *node, void (*deleter)(EpochNode *)) {
+	auto irqLock = frg::guard(&irqMutex());
+	epochReclaimer.get().retire(node, deleter);
+}
+
+void passEpochQuiescentState() {
+	assert(!intsAreEnabled());
+
+	auto reclaimer = &epochReclaimer.get();
+	// We might be interrupting a critical section (e.g., on a fault).
+	if(reclaimer->nesting)
+		return;
+	reclaimer->collect();
+}
+
+} // namespace thor
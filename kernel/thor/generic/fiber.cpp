@@ -35,7 +35,7 @@ void KernelFiber::blockCurrent(FiberBlocker *blocker) {
 
 		forkExecutor([&] {
 			runOnStack([] (Continuation cont, Executor *executor,
-					frg::unique_lock<frg::ticket_spinlock> lock) {
+					frg::unique_lock<TicketSpinlock> lock) {
 				scrubStack(executor, cont);
 				lock.unlock();
 				localScheduler.get().commitReschedule();
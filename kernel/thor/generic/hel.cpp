@@ -8,12 +8,16 @@
 #include <frg/dyn_array.hpp>
 #include <frg/small_vector.hpp>
 #include <thor-internal/event.hpp>
+#include <thor-internal/clock-page.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/io.hpp>
 #include <thor-internal/ipc-queue.hpp>
 #include <thor-internal/irq.hpp>
+#include <thor-internal/kernel-stats.hpp>
 #include <thor-internal/kernlet.hpp>
 #include <thor-internal/load-balancing.hpp>
+#include <thor-internal/memory-pressure.hpp>
+#include <thor-internal/ostrace.hpp>
 #include <thor-internal/physical.hpp>
 #include <thor-internal/random.hpp>
 #include <thor-internal/stream.hpp>
@@ -32,6 +36,10 @@
 using namespace thor;
 
 namespace {
+	// Flow transfers of at least this size are copied directly between address spaces
+	// instead of going through kernel bounce buffers.
+	constexpr size_t directTransferThreshold = 16 * 4096;
+
 	// TODO: Replace this by a function that returns the type of special descriptor.
 	bool isSpecialMemoryView(HelHandle handle) {
 		return handle == kHelZeroMemory;
@@ -101,6 +109,50 @@ size_t ipcSourceSize(size_t size) {
 	return (size + 7) & ~size_t(7);
 }
 
+// Scatter/gather lists are copied into the kernel (and walked on each transfer),
+// hence we limit their length.
+constexpr size_t maxSgItems = 1024;
+
+// Reads size bytes starting at offset within the concatenation of the buffers of an SG list.
+bool readUserSg(const HelSgItem *sgList, size_t numItems, size_t offset,
+		void *kernelPtr, size_t size) {
+	auto dest = reinterpret_cast<std::byte *>(kernelPtr);
+	for(size_t j = 0; j < numItems && size; j++) {
+		if(offset >= sgList[j].length) {
+			offset -= sgList[j].length;
+			continue;
+		}
+		auto chunk = frg::min(sgList[j].length - offset, size);
+		if(!readUserMemory(dest, reinterpret_cast<std::byte *>(sgList[j].buffer) + offset, chunk))
+			return false;
+		dest += chunk;
+		size -= chunk;
+		offset = 0;
+	}
+	assert(!size);
+	return true;
+}
+
+// Counterpart of readUserSg().
+bool writeUserSg(const HelSgItem *sgList, size_t numItems, size_t offset,
+		const void *kernelPtr, size_t size) {
+	auto src = reinterpret_cast<const std::byte *>(kernelPtr);
+	for(size_t j = 0; j < numItems && size; j++) {
+		if(offset >= sgList[j].length) {
+			offset -= sgList[j].length;
+			continue;
+		}
+		auto chunk = frg::min(sgList[j].length - offset, size);
+		if(!writeUserMemory(reinterpret_cast<std::byte *>(sgList[j].buffer) + offset, src, chunk))
+			return false;
+		src += chunk;
+		size -= chunk;
+		offset = 0;
+	}
+	assert(!size);
+	return true;
+}
+
 // TODO: one translate function per error source?
 HelError translateError(Error error) {
 	switch(error) {
@@ -286,6 +338,71 @@ HelError helTransferDescriptor(HelHandle handle, HelHandle universe_handle,
 	return kHelErrNone;
 }
 
+HelError helTransferDescriptors(const HelHandle *handles, size_t count,
+		HelHandle universeHandle, HelHandle *outHandles) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	// Process the handles in batches to bound the amount of work done while holding the lock.
+	constexpr size_t batchSize = 32;
+
+	smarter::shared_ptr<Universe> universe;
+	if(universeHandle == kHelThisUniverse) {
+		universe = thisUniverse.lock();
+	}else{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeLock(thisUniverse->lock);
+
+		auto universeIt = thisUniverse->getDescriptor(universeLock, universeHandle);
+		if(!universeIt)
+			return kHelErrNoDescriptor;
+		if(!universeIt->is<UniverseDescriptor>())
+			return kHelErrBadDescriptor;
+		universe = universeIt->get<UniverseDescriptor>().universe;
+	}
+
+	// Look up all descriptors before attaching any of them, such that the
+	// transfer has no effect if some handle is invalid.
+	frg::vector<AnyDescriptor, KernelAlloc> descriptors{*kernelAlloc};
+	descriptors.resize(count);
+	for(size_t offset = 0; offset < count; offset += batchSize) {
+		auto chunk = frg::min(count - offset, batchSize);
+
+		HelHandle batch[batchSize];
+		if(!readUserArray(handles + offset, batch, chunk))
+			return kHelErrFault;
+
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard lock(thisUniverse->lock);
+
+		for(size_t i = 0; i < chunk; ++i) {
+			auto descriptorIt = thisUniverse->getDescriptor(lock, batch[i]);
+			if(!descriptorIt)
+				return kHelErrNoDescriptor;
+			descriptors[offset + i] = *descriptorIt;
+		}
+	}
+
+	for(size_t offset = 0; offset < count; offset += batchSize) {
+		auto chunk = frg::min(count - offset, batchSize);
+
+		HelHandle batch[batchSize];
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			Universe::Guard lock(universe->lock);
+
+			for(size_t i = 0; i < chunk; ++i)
+				batch[i] = universe->attachDescriptor(lock,
+						std::move(descriptors[offset + i]));
+		}
+
+		if(!writeUserArray(outHandles + offset, batch, chunk))
+			return kHelErrFault;
+	}
+
+	return kHelErrNone;
+}
+
 HelError helDescriptorInfo(HelHandle handle, HelDescriptorInfo *) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -369,6 +486,56 @@ HelError helCloseDescriptor(HelHandle universeHandle, HelHandle handle) {
 	return kHelErrNone;
 }
 
+HelError helCloseDescriptors(HelHandle universeHandle, const HelHandle *handles, size_t count) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<Universe> universe;
+	if(universeHandle == kHelThisUniverse) {
+		universe = thisUniverse.lock();
+	}else{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeLock(thisUniverse->lock);
+
+		auto universeIt = thisUniverse->getDescriptor(universeLock, universeHandle);
+		if(!universeIt)
+			return kHelErrNoDescriptor;
+		if(!universeIt->is<UniverseDescriptor>())
+			return kHelErrBadDescriptor;
+		universe = universeIt->get<UniverseDescriptor>().universe;
+	}
+
+	// Process the handles in batches to bound the amount of work done while holding the lock.
+	constexpr size_t batchSize = 32;
+
+	bool anyMissing = false;
+	for(size_t offset = 0; offset < count; offset += batchSize) {
+		auto chunk = frg::min(count - offset, batchSize);
+
+		HelHandle batch[batchSize];
+		if(!readUserArray(handles + offset, batch, chunk))
+			return kHelErrFault;
+
+		frg::optional<AnyDescriptor> descriptors[batchSize];
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			Universe::Guard otherUniverseLock(universe->lock);
+
+			for(size_t i = 0; i < chunk; ++i) {
+				descriptors[i] = universe->detachDescriptor(otherUniverseLock, batch[i]);
+				if(!descriptors[i])
+					anyMissing = true;
+			}
+		}
+
+		// Note that the descriptors are released outside of the locks.
+	}
+
+	if(anyMissing)
+		return kHelErrNoDescriptor;
+	return kHelErrNone;
+}
+
 HelError helCreateQueue(const HelQueueParameters *paramsPtr, HelHandle *handle) {
 	auto thisThread = getCurrentThread();
 	auto thisUniverse = thisThread->getUniverse();
@@ -377,11 +544,15 @@ HelError helCreateQueue(const HelQueueParameters *paramsPtr, HelHandle *handle)
 	if(!readUserObject(paramsPtr, params))
 		return kHelErrFault;
 
-	if(params.flags)
+	if(params.flags & ~kHelQueueSubmissionRing)
 		return kHelErrIllegalArgs;
 
+	size_t submissionRingSize = 0;
+	if(params.flags & kHelQueueSubmissionRing)
+		submissionRingSize = sizeof(HelSubmissionRing);
+
 	auto queue = smarter::allocate_shared<IpcQueue>(*kernelAlloc,
-			params.ringShift, params.numChunks, params.chunkSize);
+			params.ringShift, params.numChunks, params.chunkSize, submissionRingSize);
 	queue->setupSelfPtr(queue);
 	{
 		auto irq_lock = frg::guard(&irqMutex());
@@ -394,6 +565,31 @@ HelError helCreateQueue(const HelQueueParameters *paramsPtr, HelHandle *handle)
 	return kHelErrNone;
 }
 
+HelError helAddQueueChunks(HelHandle handle, unsigned int numChunks, uintptr_t *offset) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<IpcQueue> queue;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		auto queueWrapper = thisUniverse->getDescriptor(universeGuard, handle);
+		if(!queueWrapper)
+			return kHelErrNoDescriptor;
+		if(!queueWrapper->is<QueueDescriptor>())
+			return kHelErrBadDescriptor;
+		queue = queueWrapper->get<QueueDescriptor>().queue;
+	}
+
+	auto offsetOrError = queue->addChunks(numChunks);
+	if(!offsetOrError)
+		return translateError(offsetOrError.error());
+	*offset = offsetOrError.value();
+
+	return kHelErrNone;
+}
+
 HelError helCancelAsync(HelHandle handle, uint64_t async_id) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -431,21 +627,37 @@ HelError helAllocateMemory(size_t size, uint32_t flags,
 //			<< ", sum of allocated memory: " << (void *)pressure << frg::endlog;
 
 	HelAllocRestrictions effective{
-		.addressBits = 64
+		.addressBits = 64,
+		.numaNode = 0
 	};
 	if(restrictions)
 		if(!readUserMemory(&effective, restrictions, sizeof(HelAllocRestrictions)))
 			return kHelErrFault;
 
+	int numaNode = numaNodeAny;
+	if(flags & kHelAllocNumaHint) {
+		if(effective.numaNode < 0 || effective.numaNode >= numNumaNodes())
+			return kHelErrIllegalArgs;
+		numaNode = effective.numaNode;
+	}
+
 	smarter::shared_ptr<AllocatedMemory> memory;
-	if(flags & kHelAllocContinuous) {
+	if(flags & kHelAllocHuge) {
+		constexpr size_t hugeChunkSize = size_t{1} << 21;
+		if(size & (hugeChunkSize - 1))
+			return kHelErrIllegalArgs;
 		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
-				size, kPageSize);
+				hugeChunkSize, hugeChunkSize, numaNode);
+	}else if(flags & kHelAllocContinuous) {
+		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
+				size, kPageSize, numaNode);
 	}else if(flags & kHelAllocOnDemand) {
-		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits);
+		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
+				kPageSize, kPageSize, numaNode);
 	}else{
 		// TODO:
-		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits);
+		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
+				kPageSize, kPageSize, numaNode);
 	}
 	memory->selfPtr = memory;
 
@@ -833,10 +1045,101 @@ HelError helRunVirtualizedCpu(HelHandle handle, HelVmexitReason *exitInfo) {
 	return kHelErrNone;
 }
 
+namespace {
+	HelError readVmIoTrigger(const HelVmIoTrigger *userTrigger, HelVmIoTrigger &trigger) {
+		if(!readUserObject(userTrigger, trigger))
+			return kHelErrFault;
+		if(trigger.size != 0 && trigger.size != 1 && trigger.size != 2 && trigger.size != 4)
+			return kHelErrIllegalArgs;
+		if(trigger.flags & ~static_cast<uint32_t>(kHelVmIoTriggerMatchValue))
+			return kHelErrIllegalArgs;
+		return kHelErrNone;
+	}
+}
+
+HelError helAddVmIoTrigger(HelHandle spaceHandle, const HelVmIoTrigger *userTrigger,
+		HelHandle eventHandle) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	HelVmIoTrigger trigger;
+	if(auto error = readVmIoTrigger(userTrigger, trigger); error != kHelErrNone)
+		return error;
+	if(!trigger.bits)
+		return kHelErrIllegalArgs;
+
+	smarter::shared_ptr<VirtualizedPageSpace> vspace;
+	smarter::shared_ptr<BitsetEvent> event;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		auto spaceWrapper = this_universe->getDescriptor(universe_guard, spaceHandle);
+		if(!spaceWrapper)
+			return kHelErrNoDescriptor;
+		if(!spaceWrapper->is<VirtualizedSpaceDescriptor>())
+			return kHelErrBadDescriptor;
+		vspace = spaceWrapper->get<VirtualizedSpaceDescriptor>().space;
+
+		auto eventWrapper = this_universe->getDescriptor(universe_guard, eventHandle);
+		if(!eventWrapper)
+			return kHelErrNoDescriptor;
+		if(!eventWrapper->is<BitsetEventDescriptor>())
+			return kHelErrBadDescriptor;
+		event = eventWrapper->get<BitsetEventDescriptor>().event;
+	}
+
+	auto error = vspace->addIoTrigger({
+		.port = trigger.port,
+		.size = trigger.size,
+		.matchValue = static_cast<bool>(trigger.flags & kHelVmIoTriggerMatchValue),
+		.value = trigger.value,
+		.event = std::move(event),
+		.bits = trigger.bits
+	});
+	if(error == Error::alreadyExists)
+		return kHelErrAlreadyExists;
+	if(error == Error::outOfBounds)
+		return kHelErrOutOfBounds;
+	assert(error == Error::success);
+
+	return kHelErrNone;
+}
+
+HelError helRemoveVmIoTrigger(HelHandle spaceHandle, const HelVmIoTrigger *userTrigger) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	HelVmIoTrigger trigger;
+	if(auto error = readVmIoTrigger(userTrigger, trigger); error != kHelErrNone)
+		return error;
+
+	smarter::shared_ptr<VirtualizedPageSpace> vspace;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		auto wrapper = this_universe->getDescriptor(universe_guard, spaceHandle);
+		if(!wrapper)
+			return kHelErrNoDescriptor;
+		if(!wrapper->is<VirtualizedSpaceDescriptor>())
+			return kHelErrBadDescriptor;
+		vspace = wrapper->get<VirtualizedSpaceDescriptor>().space;
+	}
+
+	auto error = vspace->removeIoTrigger(trigger.port, trigger.size,
+			trigger.flags & kHelVmIoTriggerMatchValue, trigger.value);
+	if(error == Error::illegalArgs)
+		return kHelErrIllegalArgs;
+	assert(error == Error::success);
+
+	return kHelErrNone;
+}
+
 HelError helGetRandomBytes(void *buffer, size_t wantedSize, size_t *actualSize) {
-	char bounceBuffer[128];
+	char bounceBuffer[256];
 	size_t generatedSize = generateRandomBytes(bounceBuffer,
-			frg::min(wantedSize, size_t{128}));
+			frg::min(wantedSize, size_t{256}));
 
 	if(!writeUserMemory(buffer, bounceBuffer, generatedSize))
 		return kHelErrFault;
@@ -887,9 +1190,15 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 		Universe::Guard universe_guard(this_universe->lock);
 
 		auto memory_wrapper = this_universe->getDescriptor(universe_guard, memory_handle);
-		if(!memory_wrapper)
+		if(memory_handle == kHelClockMemory) {
+			// The clock page is shared by all processes and must stay read-only.
+			if(map_flags & (AddressSpace::kMapProtWrite | AddressSpace::kMapProtExecute))
+				return kHelErrIllegalArgs;
+			slice = smarter::allocate_shared<MemorySlice>(*kernelAlloc,
+					getClockMemory(), 0, kPageSize);
+		}else if(!memory_wrapper) {
 			return kHelErrNoDescriptor;
-		if(memory_wrapper->is<MemorySliceDescriptor>()) {
+		}else if(memory_wrapper->is<MemorySliceDescriptor>()) {
 			slice = memory_wrapper->get<MemorySliceDescriptor>().slice;
 		}else if(memory_wrapper->is<MemoryViewDescriptor>()) {
 			auto memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
@@ -1041,6 +1350,115 @@ HelError helUnmapMemory(HelHandle space_handle, void *pointer, size_t length) {
 	return kHelErrNone;
 }
 
+HelError helDecommitMemory(HelHandle spaceHandle, void *pointer, size_t length) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	if((reinterpret_cast<uintptr_t>(pointer) & (kPageSize - 1)) || (length & (kPageSize - 1)))
+		return kHelErrIllegalArgs;
+
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		if(spaceHandle == kHelNullHandle) {
+			space = thisThread->getAddressSpace().lock();
+		}else{
+			auto spaceWrapper = thisUniverse->getDescriptor(universeGuard, spaceHandle);
+			if(!spaceWrapper)
+				return kHelErrNoDescriptor;
+			if(!spaceWrapper->is<AddressSpaceDescriptor>())
+				return kHelErrBadDescriptor;
+			space = spaceWrapper->get<AddressSpaceDescriptor>().space;
+		}
+	}
+
+	auto outcome = Thread::asyncBlockCurrent(space->discard((VirtualAddr)pointer, length,
+			thisThread->mainWorkQueue()->take()));
+	if(!outcome) {
+		if(outcome.error() == Error::outOfBounds)
+			return kHelErrOutOfBounds;
+		assert(outcome.error() == Error::fault);
+		return kHelErrFault;
+	}
+
+	return kHelErrNone;
+}
+
+HelError helPopulateMemory(HelHandle spaceHandle, void *pointer, size_t length, uint32_t flags) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	if((reinterpret_cast<uintptr_t>(pointer) & (kPageSize - 1)) || (length & (kPageSize - 1)))
+		return kHelErrIllegalArgs;
+	if(flags & ~kHelPopulateWrite)
+		return kHelErrIllegalArgs;
+
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		if(spaceHandle == kHelNullHandle) {
+			space = thisThread->getAddressSpace().lock();
+		}else{
+			auto spaceWrapper = thisUniverse->getDescriptor(universeGuard, spaceHandle);
+			if(!spaceWrapper)
+				return kHelErrNoDescriptor;
+			if(!spaceWrapper->is<AddressSpaceDescriptor>())
+				return kHelErrBadDescriptor;
+			space = spaceWrapper->get<AddressSpaceDescriptor>().space;
+		}
+	}
+
+	uint32_t faultFlags = 0;
+	if(flags & kHelPopulateWrite)
+		faultFlags |= AddressSpace::kFaultWrite;
+
+	auto outcome = Thread::asyncBlockCurrent(space->populate((VirtualAddr)pointer, length,
+			faultFlags, thisThread->mainWorkQueue()->take()));
+	if(!outcome) {
+		// Pages that cannot be populated (e.g., beyond the end of a file) would fault
+		// on access as well.
+		return kHelErrFault;
+	}
+
+	return kHelErrNone;
+}
+
+HelError helQuerySpaceMemory(HelHandle spaceHandle, HelSpaceMemoryInfo *userInfo) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		if(spaceHandle == kHelNullHandle) {
+			space = thisThread->getAddressSpace().lock();
+		}else{
+			auto spaceWrapper = thisUniverse->getDescriptor(universeGuard, spaceHandle);
+			if(!spaceWrapper)
+				return kHelErrNoDescriptor;
+			if(!spaceWrapper->is<AddressSpaceDescriptor>())
+				return kHelErrBadDescriptor;
+			space = spaceWrapper->get<AddressSpaceDescriptor>().space;
+		}
+	}
+
+	HelSpaceMemoryInfo info;
+	memset(&info, 0, sizeof(HelSpaceMemoryInfo));
+	info.anonymousBytes = space->residentCounters().anonymousBytes();
+	info.fileBytes = space->residentCounters().fileBytes();
+
+	if(!writeUserObject(userInfo, info))
+		return kHelErrFault;
+
+	return kHelErrNone;
+}
+
 HelError helSubmitSynchronizeSpace(HelHandle spaceHandle, void *pointer, size_t length,
 		HelHandle queueHandle, uintptr_t context) {
 	auto thisThread = getCurrentThread();
@@ -1106,6 +1524,81 @@ HelError helPointerPhysical(const void *pointer, uintptr_t *physical) {
 	return kHelErrNone;
 }
 
+HelError helQueryPhysicalRanges(HelHandle handle, uintptr_t address, size_t size,
+		HelPhysicalRange *userRanges, size_t maxRanges, size_t *numRanges) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
+	smarter::shared_ptr<MemoryView> view;
+	if(handle == kHelNullHandle) {
+		space = thisThread->getAddressSpace().lock();
+	}else{
+		size_t viewSize;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			Universe::Guard universeGuard(thisUniverse->lock);
+
+			auto wrapper = thisUniverse->getDescriptor(universeGuard, handle);
+			if(!wrapper)
+				return kHelErrNoDescriptor;
+			if(wrapper->is<MemoryViewDescriptor>()) {
+				view = wrapper->get<MemoryViewDescriptor>().memory;
+				viewSize = view->getLength();
+			}else if(wrapper->is<MemorySliceDescriptor>()) {
+				auto slice = wrapper->get<MemorySliceDescriptor>().slice;
+				view = slice->getView();
+				if(address + size > slice->length())
+					return kHelErrOutOfBounds;
+				address += slice->offset();
+				viewSize = slice->offset() + slice->length();
+			}else{
+				return kHelErrBadDescriptor;
+			}
+		}
+		if(address + size > viewSize)
+			return kHelErrOutOfBounds;
+	}
+
+	// Extents are retrieved in batches. The last extent of each batch is kept
+	// since it may be merged with the first extent of the next batch.
+	constexpr size_t batchSize = 32;
+	PhysicalExtent batch[batchSize];
+	size_t numBatch = 0;
+	size_t progress = 0;
+	size_t count = 0;
+	while(progress < size) {
+		auto bytesOrError = view
+			? Thread::asyncBlockCurrent(retrievePhysicalExtents(view.get(),
+					address + progress, size - progress, 0, batch, numBatch, batchSize,
+					thisThread->mainWorkQueue()->take()))
+			: Thread::asyncBlockCurrent(space->retrievePhysicalExtents(
+					address + progress, size - progress, batch, numBatch, batchSize,
+					thisThread->mainWorkQueue()->take()));
+		if(!bytesOrError)
+			return translateError(bytesOrError.error());
+		progress += bytesOrError.value();
+
+		size_t numDone = (progress == size) ? numBatch : numBatch - 1;
+		for(size_t i = 0; i < numDone; i++) {
+			if(count == maxRanges) {
+				*numRanges = count;
+				return kHelErrBufferTooSmall;
+			}
+			HelPhysicalRange range{.physical = batch[i].physical, .length = batch[i].size};
+			if(!writeUserObject(userRanges + count, range))
+				return kHelErrFault;
+			count++;
+		}
+		if(numDone < numBatch)
+			batch[0] = batch[numBatch - 1];
+		numBatch -= numDone;
+	}
+
+	*numRanges = count;
+	return kHelErrNone;
+}
+
 HelError helSubmitReadMemory(HelHandle handle, uintptr_t address,
 		size_t length, void *buffer,
 		HelHandle queueHandle, uintptr_t context) {
@@ -1692,7 +2185,16 @@ HelError helQueryThreadStats(HelHandle handle, HelThreadStats *user_stats) {
 
 	HelThreadStats stats;
 	memset(&stats, 0, sizeof(HelThreadStats));
-	stats.userTime = thread->runTime();
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto runTime = Scheduler::liveRunTime(thread.get());
+		auto kernelTime = frg::min(thread->kernelTime(), runTime);
+		stats.userTime = runTime - kernelTime;
+		stats.kernelTime = kernelTime;
+	}
+	stats.voluntarySwitches = thread->voluntarySwitches();
+	stats.involuntarySwitches = thread->involuntarySwitches();
+	stats.migrations = thread->migrations();
 
 	if(!writeUserObject(user_stats, stats))
 		return kHelErrFault;
@@ -1724,6 +2226,131 @@ HelError helSetPriority(HelHandle handle, int priority) {
 	return kHelErrNone;
 }
 
+HelError helSetLatencyClass(HelHandle handle, int priority, uint64_t budget, uint64_t period) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	// Without a budget that leaves room for other threads, this could starve the system.
+	if(!budget || budget >= period)
+		return kHelErrIllegalArgs;
+
+	smarter::shared_ptr<Thread> thread;
+	if(handle == kHelThisThread) {
+		thread = this_thread.lock();
+	}else{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		if(!thread_wrapper)
+			return kHelErrNoDescriptor;
+		if(!thread_wrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
+	}
+
+	Scheduler::setLatencyClass(thread.get(), priority, budget, period);
+
+	return kHelErrNone;
+}
+
+HelError helCreateScheduleGroup(HelHandle parentHandle, HelHandle *handle) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<ScheduleGroup> parent;
+	if(parentHandle != kHelNullHandle) {
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		auto parentWrapper = thisUniverse->getDescriptor(universeGuard, parentHandle);
+		if(!parentWrapper)
+			return kHelErrNoDescriptor;
+		if(!parentWrapper->is<ScheduleGroupDescriptor>())
+			return kHelErrBadDescriptor;
+		parent = parentWrapper->get<ScheduleGroupDescriptor>().group;
+	}
+
+	auto group = smarter::allocate_shared<ScheduleGroup>(*kernelAlloc, std::move(parent));
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		*handle = thisUniverse->attachDescriptor(universeGuard,
+				ScheduleGroupDescriptor(std::move(group)));
+	}
+
+	return kHelErrNone;
+}
+
+HelError helConfigureScheduleGroup(HelHandle handle, const HelScheduleGroupParams *userParams) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	HelScheduleGroupParams params;
+	if(!readUserObject(userParams, params))
+		return kHelErrFault;
+	if(params.weight < ScheduleGroup::minWeight || params.weight > ScheduleGroup::maxWeight)
+		return kHelErrIllegalArgs;
+	if(params.quota && !params.period)
+		return kHelErrIllegalArgs;
+
+	smarter::shared_ptr<ScheduleGroup> group;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		auto groupWrapper = thisUniverse->getDescriptor(universeGuard, handle);
+		if(!groupWrapper)
+			return kHelErrNoDescriptor;
+		if(!groupWrapper->is<ScheduleGroupDescriptor>())
+			return kHelErrBadDescriptor;
+		group = groupWrapper->get<ScheduleGroupDescriptor>().group;
+	}
+
+	group->setWeight(params.weight);
+	group->setBandwidth(params.quota, params.period);
+
+	return kHelErrNone;
+}
+
+HelError helSetScheduleGroup(HelHandle handle, HelHandle groupHandle) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<Thread> thread;
+	smarter::shared_ptr<ScheduleGroup> group;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		if(handle == kHelThisThread) {
+			thread = thisThread.lock();
+		}else{
+			auto threadWrapper = thisUniverse->getDescriptor(universeGuard, handle);
+			if(!threadWrapper)
+				return kHelErrNoDescriptor;
+			if(!threadWrapper->is<ThreadDescriptor>())
+				return kHelErrBadDescriptor;
+			thread = remove_tag_cast(threadWrapper->get<ThreadDescriptor>().thread);
+		}
+
+		if(groupHandle != kHelNullHandle) {
+			auto groupWrapper = thisUniverse->getDescriptor(universeGuard, groupHandle);
+			if(!groupWrapper)
+				return kHelErrNoDescriptor;
+			if(!groupWrapper->is<ScheduleGroupDescriptor>())
+				return kHelErrBadDescriptor;
+			group = groupWrapper->get<ScheduleGroupDescriptor>().group;
+		}
+	}
+
+	thread->setGroup(std::move(group));
+
+	return kHelErrNone;
+}
+
 HelError helYield() {
 	Thread::deferCurrent();
 
@@ -1864,6 +2491,57 @@ HelError helResume(HelHandle handle) {
 	return kHelErrNone;
 }
 
+namespace {
+
+#if defined(__x86_64__)
+	constexpr size_t signalRegisterCount = 19;
+	constexpr size_t signalRedZoneSize = 128;
+	// Calls misalign the stack by 8 bytes (i.e., (rsp + 8) % 16 == 0 at function entry).
+	constexpr size_t signalCallMisalign = 8;
+#elif defined(__aarch64__)
+	constexpr size_t signalRegisterCount = 35;
+	constexpr size_t signalRedZoneSize = 0;
+	constexpr size_t signalCallMisalign = 0;
+#endif
+
+	constexpr size_t maxSignalFrameSize = 4096;
+
+#if defined(__x86_64__) || defined(__aarch64__)
+	// Builds the kHelRegsSignal register image.
+	void loadSignalRegisters(Executor &executor, uintptr_t *regs) {
+#if defined(__x86_64__)
+		regs[0] = executor.general()->r8;
+		regs[1] = executor.general()->r9;
+		regs[2] = executor.general()->r10;
+		regs[3] = executor.general()->r11;
+		regs[4] = executor.general()->r12;
+		regs[5] = executor.general()->r13;
+		regs[6] = executor.general()->r14;
+		regs[7] = executor.general()->r15;
+		regs[8] = executor.general()->rdi;
+		regs[9] = executor.general()->rsi;
+		regs[10] = executor.general()->rbp;
+		regs[11] = executor.general()->rbx;
+		regs[12] = executor.general()->rdx;
+		regs[13] = executor.general()->rax;
+		regs[14] = executor.general()->rcx;
+		regs[15] = executor.general()->rsp;
+		regs[16] = executor.general()->rip;
+		regs[17] = executor.general()->rflags;
+		regs[18] = executor.general()->cs;
+#elif defined(__aarch64__)
+		regs[0] = executor.general()->far;
+		for (int i = 0; i < 31; i++)
+			regs[1 + i] = executor.general()->x[i];
+		regs[32] = executor.general()->sp;
+		regs[33] = executor.general()->elr;
+		regs[34] = executor.general()->spsr;
+#endif
+	}
+#endif
+
+} // anonymous namespace
+
 HelError helLoadRegisters(HelHandle handle, int set, void *image) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -1981,42 +2659,14 @@ HelError helLoadRegisters(HelHandle handle, int set, void *image) {
 		if(!writeUserMemory(image, &thread->_executor.general()->fp, sizeof(FpRegisters)))
 			return kHelErrFault;
 #endif
-	}else if(set == kHelRegsSignal) {
-		if(!thread) {
-			return kHelErrIllegalArgs;
-		}
-#if defined(__x86_64__)
-		uintptr_t regs[19];
-		regs[0] = thread->_executor.general()->r8;
-		regs[1] = thread->_executor.general()->r9;
-		regs[2] = thread->_executor.general()->r10;
-		regs[3] = thread->_executor.general()->r11;
-		regs[4] = thread->_executor.general()->r12;
-		regs[5] = thread->_executor.general()->r13;
-		regs[6] = thread->_executor.general()->r14;
-		regs[7] = thread->_executor.general()->r15;
-		regs[8] = thread->_executor.general()->rdi;
-		regs[9] = thread->_executor.general()->rsi;
-		regs[10] = thread->_executor.general()->rbp;
-		regs[11] = thread->_executor.general()->rbx;
-		regs[12] = thread->_executor.general()->rdx;
-		regs[13] = thread->_executor.general()->rax;
-		regs[14] = thread->_executor.general()->rcx;
-		regs[15] = thread->_executor.general()->rsp;
-		regs[16] = thread->_executor.general()->rip;
-		regs[17] = thread->_executor.general()->rflags;
-		regs[18] = thread->_executor.general()->cs;
-		if(!writeUserArray(reinterpret_cast<uintptr_t *>(image), regs, 19))
-			return kHelErrFault;
-#elif defined(__aarch64__)
-		uintptr_t regs[35];
-		regs[0] = thread->_executor.general()->far;
-		for (int i = 0; i < 31; i++)
-			regs[1 + i] = thread->_executor.general()->x[i];
-		regs[32] = thread->_executor.general()->sp;
-		regs[33] = thread->_executor.general()->elr;
-		regs[34] = thread->_executor.general()->spsr;
-		if(!writeUserArray(reinterpret_cast<uintptr_t *>(image), regs, 35))
+	}else if(set == kHelRegsSignal) {
+		if(!thread) {
+			return kHelErrIllegalArgs;
+		}
+#if defined(__x86_64__) || defined(__aarch64__)
+		uintptr_t regs[signalRegisterCount];
+		loadSignalRegisters(thread->_executor, regs);
+		if(!writeUserArray(reinterpret_cast<uintptr_t *>(image), regs, signalRegisterCount))
 			return kHelErrFault;
 #else
 		return kHelErrUnsupportedOperation;
@@ -2151,6 +2801,7 @@ HelError helStoreRegisters(HelHandle handle, int set, const void *image) {
 #if defined(__x86_64__)
 		if(!readUserMemory(thread->_executor._fxState(), image, Executor::determineSimdSize()))
 			return kHelErrFault;
+		thread->_executor.invalidateSimdState();
 #elif defined(__aarch64__)
 		if(!readUserMemory(&thread->_executor.general()->fp, image, sizeof(FpRegisters)))
 			return kHelErrFault;
@@ -2255,11 +2906,17 @@ HelError helGetClock(uint64_t *counter) {
 
 HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t context,
 		uint64_t *async_id) {
+	return helSubmitAwaitClockSlack(counter, 0, queue_handle, context, async_id);
+}
+
+HelError helSubmitAwaitClockSlack(uint64_t counter, uint64_t slack, HelHandle queue_handle,
+		uintptr_t context, uint64_t *async_id) {
 	struct Closure final : CancelNode, PrecisionTimerNode, IpcNode {
-		static void issue(uint64_t nanos, smarter::shared_ptr<IpcQueue> queue,
+		static void issue(uint64_t nanos, uint64_t slack, smarter::shared_ptr<IpcQueue> queue,
 				uintptr_t context, uint64_t *async_id) {
 			auto closure = frg::construct<Closure>(*kernelAlloc, nanos,
 					std::move(queue), context);
+			closure->setSlack(slack);
 			closure->queue->registerNode(closure);
 			*async_id = closure->asyncId();
 			generalTimerEngine()->installTimer(closure);
@@ -2319,7 +2976,7 @@ HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t
 	if(!queue->validSize(ipcSourceSize(sizeof(HelSimpleResult))))
 		return kHelErrQueueTooSmall;
 
-	Closure::issue(counter, std::move(queue), context, async_id);
+	Closure::issue(counter, slack, std::move(queue), context, async_id);
 
 	return kHelErrNone;
 }
@@ -2342,13 +2999,17 @@ HelError helCreateStream(HelHandle *lane1_handle, HelHandle *lane2_handle, uint3
 	return kHelErrNone;
 }
 
-HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count,
-		HelHandle queueHandle, uintptr_t context, uint32_t flags) {
+// If kernelActions is true, actions points to kernel memory (e.g., to a copy of an entry
+// of a submission ring) instead of user memory.
+HelError submitActions(HelHandle handle, const HelAction *actions, size_t count,
+		HelHandle queueHandle, uintptr_t context, uint32_t flags, bool kernelActions) {
 	if(flags)
 		return kHelErrIllegalArgs;
 	if(!count)
 		return kHelErrIllegalArgs;
 
+	countKernelStat(KernelStat::ipcSubmits);
+
 	auto thisThread = getCurrentThread();
 	auto thisUniverse = thisThread->getUniverse();
 
@@ -2375,12 +3036,17 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 		queue = queueWrapper->get<QueueDescriptor>().queue;
 	}
 
+	ostrace::tracepoint(ostrace::Tracepoint::ipcSubmit,
+			reinterpret_cast<uintptr_t>(queue.get()), context);
+
 	struct Item {
 		HelAction recipe;
 		size_t link;
 		StreamNode transmit;
 		QueueSource mainSource;
 		QueueSource dataSource;
+		// Kernel copy of the SG list (for SG actions that use the flow protocol).
+		frg::unique_memory<KernelAlloc> sgList;
 		union {
 			HelSimpleResult helSimpleResult;
 			HelHandleResult helHandleResult;
@@ -2406,7 +3072,11 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 		HelAction *recipe = &items[i].recipe;
 		auto node = &items[i].transmit;
 
-		readUserObject(actions + i, *recipe);
+		if(kernelActions) {
+			*recipe = actions[i];
+		}else{
+			readUserObject(actions + i, *recipe);
+		}
 
 		switch(recipe->type) {
 			case kHelActionDismiss:
@@ -2469,28 +3139,50 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				}
 				ipcSize += ipcSourceSize(sizeof(HelSimpleResult));
 				break;
-			case kHelActionSendFromBufferSg: {
+			case kHelActionSendFromBufferSg:
+			case kHelActionRecvToBufferSg: {
+				if(recipe->length > maxSgItems)
+					return kHelErrIllegalArgs;
+
+				frg::unique_memory<KernelAlloc> sgMemory;
+				if(recipe->length)
+					sgMemory = frg::unique_memory<KernelAlloc>{*kernelAlloc,
+							recipe->length * sizeof(HelSgItem)};
+				auto sgList = reinterpret_cast<HelSgItem *>(sgMemory.data());
+				if(!readUserArray(reinterpret_cast<HelSgItem *>(recipe->buffer),
+						sgList, recipe->length))
+					return kHelErrFault;
+
 				size_t length = 0;
-				auto sglist = reinterpret_cast<HelSgItem *>(recipe->buffer);
 				for(size_t j = 0; j < recipe->length; j++) {
-					HelSgItem item;
-					readUserObject(sglist + j, item);
-					length += item.length;
+					if(__builtin_add_overflow(length, sgList[j].length, &length))
+						return kHelErrIllegalArgs;
 				}
 
-				frg::unique_memory<KernelAlloc> buffer(*kernelAlloc, length);
-				size_t offset = 0;
-				for(size_t j = 0; j < recipe->length; j++) {
-					HelSgItem item;
-					readUserObject(sglist + j, item);
-					if(!readUserMemory(reinterpret_cast<char *>(buffer.data()) + offset,
-							reinterpret_cast<char *>(item.buffer), item.length))
-						return kHelErrFault;
-					offset += item.length;
+				if(recipe->type == kHelActionRecvToBufferSg) {
+					node->_tag = kTagRecvFlow;
+					node->_maxLength = length;
+					items[i].sgList = std::move(sgMemory);
+					++numFlows;
+					ipcSize += ipcSourceSize(sizeof(HelLengthResult));
+					break;
 				}
 
-				node->_tag = kTagSendKernelBuffer;
-				node->_inBuffer = std::move(buffer);
+				// Small messages are gathered into a kernel buffer; larger ones are
+				// streamed from the SG list without a contiguous staging copy.
+				if(length <= kPageSize) {
+					frg::unique_memory<KernelAlloc> buffer(*kernelAlloc, length);
+					if(!readUserSg(sgList, recipe->length, 0, buffer.data(), length))
+						return kHelErrFault;
+
+					node->_tag = kTagSendKernelBuffer;
+					node->_inBuffer = std::move(buffer);
+				}else{
+					node->_tag = kTagSendFlow;
+					node->_maxLength = length;
+					items[i].sgList = std::move(sgMemory);
+					++numFlows;
+				}
 				ipcSize += ipcSourceSize(sizeof(HelSimpleResult));
 				break;
 			}
@@ -2637,7 +3329,8 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 							node->_transmitBuffer.size());
 					link(&item->mainSource);
 					link(&item->dataSource);
-				}else if(recipe->type == kHelActionRecvToBuffer) {
+				}else if(recipe->type == kHelActionRecvToBuffer
+						|| recipe->type == kHelActionRecvToBufferSg) {
 					item->helLengthResult = {translateError(node->error()),
 							0, node->actualLength()};
 					item->mainSource.setup(&item->helLengthResult, sizeof(HelLengthResult));
@@ -2744,13 +3437,21 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				continue;
 			}
 
-			if(recipe->type == kHelActionSendFromBuffer
-					&& node->tag() == kTagSendFlow
+			// Plain buffers are treated as SG lists with a single item.
+			bool isSg = recipe->type == kHelActionSendFromBufferSg
+					|| recipe->type == kHelActionRecvToBufferSg;
+			HelSgItem single{recipe->buffer, recipe->length};
+			const HelSgItem *segments = isSg
+					? reinterpret_cast<const HelSgItem *>(item->sgList.data()) : &single;
+			size_t numSegments = isSg ? recipe->length : 1;
+			size_t length = node->_maxLength;
+
+			if(node->tag() == kTagSendFlow
 					&& peer->tag() == kTagRecvKernelBuffer) {
-				frg::unique_memory<KernelAlloc> buffer(*kernelAlloc, recipe->length);
+				frg::unique_memory<KernelAlloc> buffer(*kernelAlloc, length);
 
 				co_await thread->mainWorkQueue()->enter();
-				auto outcome = readUserMemory(buffer.data(), recipe->buffer, recipe->length);
+				auto outcome = readUserSg(segments, numSegments, 0, buffer.data(), length);
 				if(!outcome) {
 					// We complete with fault; the remote with success.
 					// TODO: it probably makes sense to introduce a "remote fault" error.
@@ -2765,11 +3466,37 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				peer->_transmitBuffer = std::move(buffer);
 				peer->complete();
 				node->complete();
-			}else if(recipe->type == kHelActionSendFromBuffer
-					&& node->tag() == kTagSendFlow
+			}else if(node->tag() == kTagSendFlow
 					&& peer->tag() == kTagRecvFlow) {
 				// Empty packets are handled by the generic stream code.
-				assert(recipe->length);
+				assert(length);
+
+				// For large buffers, let the receiver copy directly from our address space.
+				// This requires a contiguous source; SG lists are always sent in chunks.
+				if(!isSg && length >= directTransferThreshold) {
+					auto space = thread->getAddressSpace();
+
+					// Send the packet (may deallocate the peer!).
+					peer->flowQueue.put({
+						.size = length,
+						.terminate = true,
+						.space = space.get(),
+						.address = reinterpret_cast<uintptr_t>(recipe->buffer)
+					});
+
+					auto ackPacket = co_await node->flowQueue.async_get();
+					assert(ackPacket);
+					if(ackPacket->sourceFault) {
+						node->_error = Error::fault;
+					}else if(ackPacket->fault) {
+						node->_error = Error::remoteFault;
+					}else{
+						node->_error = Error::success;
+					}
+
+					node->complete();
+					continue;
+				}
 
 				size_t progress = 0;
 				size_t numSent = 0;
@@ -2823,12 +3550,12 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 					if(!xb.size())
 						xb = frg::unique_memory<KernelAlloc>{*kernelAlloc, 4096};
 
-					auto chunkSize = frg::min(recipe->length - progress, xb.size());
+					auto chunkSize = frg::min(length - progress, xb.size());
 					assert(chunkSize);
 
 					co_await thread->mainWorkQueue()->enter();
-					auto outcome = readUserMemory(xb.data(),
-							reinterpret_cast<std::byte *>(recipe->buffer) + progress, chunkSize);
+					auto outcome = readUserSg(segments, numSegments, progress,
+							xb.data(), chunkSize);
 					if(!outcome) {
 						// Send the packet (may deallocate the peer!).
 						peer->flowQueue.put({ .terminate = true, .fault = true });
@@ -2846,7 +3573,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 						break;
 					}
 
-					lastTransferSent = (progress + chunkSize == recipe->length);
+					lastTransferSent = (progress + chunkSize == length);
 					// Send the packet (may deallocate the peer!).
 					peer->flowQueue.put({
 						.data = xb.data(),
@@ -2858,10 +3585,11 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				}
 
 				node->complete();
-			}else if(recipe->type == kHelActionRecvToBuffer
-					&& peer->tag() == kTagSendKernelBuffer) {
+			}else if(peer->tag() == kTagSendKernelBuffer) {
+				assert(node->tag() == kTagRecvFlow);
+
 				co_await thread->mainWorkQueue()->enter();
-				auto outcome = writeUserMemory(recipe->buffer,
+				auto outcome = writeUserSg(segments, numSegments, 0,
 						peer->_inBuffer.data(), peer->_inBuffer.size());
 				if(!outcome) {
 					// We complete with fault; the remote with success.
@@ -2878,7 +3606,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				peer->complete();
 				node->complete();
 			}else{
-				assert(recipe->type == kHelActionRecvToBuffer
+				assert(node->tag() == kTagRecvFlow
 						&& peer->tag() == kTagSendFlow);
 
 				size_t progress = 0;
@@ -2888,13 +3616,54 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 					auto xferPacket = co_await node->flowQueue.async_get();
 					assert(xferPacket);
 
+					// Direct transfers consist of a single packet.
+					if(xferPacket->space) {
+						assert(!progress && xferPacket->terminate);
+						// Otherwise, there would have been a transmission error.
+						assert(xferPacket->size <= length);
+
+						size_t copied = 0;
+						bool sourceFault = false;
+						for(size_t j = 0; j < numSegments && copied < xferPacket->size; j++) {
+							auto chunk = frg::min(segments[j].length, xferPacket->size - copied);
+							if(!chunk)
+								continue;
+							auto [segmentCopied, segmentFault] = co_await thread->getAddressSpace()->copyFromSpace(
+									reinterpret_cast<uintptr_t>(segments[j].buffer),
+									xferPacket->space, xferPacket->address + copied, chunk,
+									thread->mainWorkQueue()->take());
+							copied += segmentCopied;
+							if(segmentFault) {
+								sourceFault = true;
+								break;
+							}
+							if(segmentCopied != chunk)
+								break;
+						}
+						bool localFault = !sourceFault && copied != xferPacket->size;
+
+						// Ack the packet (may deallocate the peer!).
+						peer->flowQueue.put({
+							.terminate = true,
+							.fault = localFault,
+							.sourceFault = sourceFault
+						});
+						if(localFault) {
+							node->_error = Error::fault;
+						}else if(sourceFault) {
+							node->_error = Error::remoteFault;
+						}else{
+							node->_actualLength = copied;
+						}
+						break;
+					}
+
 					if(xferPacket->data && !didFault) {
 						// Otherwise, there would have been a transmission error.
-						assert(progress + xferPacket->size <= recipe->length);
+						assert(progress + xferPacket->size <= length);
 
 						co_await thread->mainWorkQueue()->enter();
-						auto outcome = writeUserMemory(
-								reinterpret_cast<std::byte *>(recipe->buffer) + progress,
+						auto outcome = writeUserSg(segments, numSegments, progress,
 								xferPacket->data, xferPacket->size);
 						if(outcome) {
 							progress += xferPacket->size;
@@ -2947,6 +3716,49 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 	return kHelErrNone;
 }
 
+HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count,
+		HelHandle queueHandle, uintptr_t context, uint32_t flags) {
+	return submitActions(handle, actions, count, queueHandle, context, flags, false);
+}
+
+HelError helSubmitRing(HelHandle queueHandle) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<IpcQueue> queue;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(thisUniverse->lock);
+
+		auto queueWrapper = thisUniverse->getDescriptor(universe_guard, queueHandle);
+		if(!queueWrapper)
+			return kHelErrNoDescriptor;
+		if(!queueWrapper->is<QueueDescriptor>())
+			return kHelErrBadDescriptor;
+		queue = queueWrapper->get<QueueDescriptor>().queue;
+	}
+
+	if(!queue->hasSubmissionRing())
+		return kHelErrIllegalArgs;
+
+	// Bound the amount of work per call; otherwise, user space could keep us
+	// busy forever by refilling the ring.
+	for(size_t n = 0; n < kHelSubmissionRingSize; n++) {
+		// Copy the entry since user space can modify the ring concurrently.
+		HelSubmission entry;
+		if(!queue->popSubmission(&entry, sizeof(HelSubmission)))
+			break;
+
+		if(entry.numActions > kHelSubmissionMaxActions)
+			return kHelErrIllegalArgs;
+		if(auto error = submitActions(entry.handle, entry.actions, entry.numActions,
+				queueHandle, entry.context, entry.flags, true); error != kHelErrNone)
+			return error;
+	}
+
+	return kHelErrNone;
+}
+
 HelError helShutdownLane(HelHandle handle) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -2970,6 +3782,8 @@ HelError helShutdownLane(HelHandle handle) {
 }
 
 HelError helFutexWait(int *pointer, int expected, int64_t deadline) {
+	countKernelStat(KernelStat::futexWaits);
+
 	auto thisThread = getCurrentThread();
 	auto space = thisThread->getAddressSpace();
 
@@ -3005,6 +3819,8 @@ HelError helFutexWait(int *pointer, int expected, int64_t deadline) {
 }
 
 HelError helFutexWake(int *pointer) {
+	countKernelStat(KernelStat::futexWakes);
+
 	auto this_thread = getCurrentThread();
 	auto space = this_thread->getAddressSpace();
 
@@ -3016,6 +3832,107 @@ HelError helFutexWake(int *pointer) {
 	return kHelErrNone;
 }
 
+HelError helFutexWaitVector(const HelFutexWaitEntry *entries, size_t count,
+		int64_t deadline, size_t *index) {
+	countKernelStat(KernelStat::futexWaits);
+
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	if(!count || count > kHelMaxFutexWaitVector)
+		return kHelErrIllegalArgs;
+	if(deadline < 0 && deadline != -1)
+		return kHelErrIllegalArgs;
+
+	frg::vector<FutexRealm::WaitVectorEntry<GlobalFutex>, KernelAlloc> futexes{*kernelAlloc};
+	futexes.resize(count);
+	for(size_t i = 0; i < count; i++) {
+		// Drops the futexes that were already grabbed.
+		auto fail = [&] {
+			for(size_t j = 0; j < i; j++)
+				futexes[j].f.retire();
+			return kHelErrFault;
+		};
+
+		HelFutexWaitEntry entry;
+		if(!readUserObject(entries + i, entry))
+			return fail();
+
+		auto futexOrError = Thread::asyncBlockCurrent(
+				space->grabGlobalFutex(reinterpret_cast<uintptr_t>(entry.pointer),
+						thisThread->mainWorkQueue()->take()));
+		if(!futexOrError)
+			return fail();
+		futexes[i].f = std::move(futexOrError.value());
+		futexes[i].expected = entry.expected;
+	}
+
+	// waitVector() retires the futexes.
+	size_t woken;
+	if(deadline == -1) {
+		woken = Thread::asyncBlockCurrent(
+			getGlobalFutexRealm()->waitVector(futexes.data(), count)
+		);
+	}else{
+		woken = count;
+		Thread::asyncBlockCurrent(
+			async::race_and_cancel(
+				[&] (async::cancellation_token cancellation) {
+					return async::transform(
+						getGlobalFutexRealm()->waitVector(futexes.data(), count, cancellation),
+						[&] (size_t n) { woken = n; }
+					);
+				},
+				[&] (async::cancellation_token cancellation) {
+					return generalTimerEngine()->sleep(deadline, cancellation);
+				}
+			)
+		);
+	}
+
+	*index = woken;
+	return kHelErrNone;
+}
+
+HelError helFutexWakeCount(int *pointer, unsigned int count, unsigned int *woken) {
+	countKernelStat(KernelStat::futexWakes);
+
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	auto identityOrError = space->resolveGlobalFutex(reinterpret_cast<uintptr_t>(pointer));
+	if(!identityOrError)
+		return kHelErrFault;
+	*woken = getGlobalFutexRealm()->wake(identityOrError.value(), count);
+
+	return kHelErrNone;
+}
+
+HelError helFutexRequeue(int *pointer, int expected, int *target,
+		unsigned int wakeCount, unsigned int requeueCount) {
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	auto targetOrError = space->resolveGlobalFutex(reinterpret_cast<uintptr_t>(target));
+	if(!targetOrError)
+		return kHelErrFault;
+
+	auto futexOrError = Thread::asyncBlockCurrent(
+			space->grabGlobalFutex(reinterpret_cast<uintptr_t>(pointer),
+					thisThread->mainWorkQueue()->take()));
+	if(!futexOrError)
+		return kHelErrFault;
+	GlobalFutex futex = std::move(futexOrError.value());
+
+	auto error = getGlobalFutexRealm()->requeue(std::move(futex), targetOrError.value(),
+			expected, wakeCount, requeueCount);
+	if(error == Error::futexRace)
+		return kHelErrCancelled;
+	assert(error == Error::success);
+
+	return kHelErrNone;
+}
+
 HelError helCreateOneshotEvent(HelHandle *handle) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -3075,6 +3992,60 @@ HelError helRaiseEvent(HelHandle handle) {
 	return kHelErrNone;
 }
 
+HelError helCreateMemoryPressureEvent(const HelMemoryPressureWatermarks *userWatermarks,
+		HelHandle *handle) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	HelMemoryPressureWatermarks watermarks;
+	memset(&watermarks, 0, sizeof(HelMemoryPressureWatermarks));
+	if(userWatermarks && !readUserObject(userWatermarks, watermarks))
+		return kHelErrFault;
+
+	size_t lowPages = defaultLowPressureWatermark();
+	size_t criticalPages = defaultCriticalPressureWatermark();
+	if(watermarks.lowFreeBytes)
+		lowPages = watermarks.lowFreeBytes / kPageSize;
+	if(watermarks.criticalFreeBytes)
+		criticalPages = watermarks.criticalFreeBytes / kPageSize;
+	if(criticalPages > lowPages)
+		return kHelErrIllegalArgs;
+
+	auto event = smarter::allocate_shared<BitsetEvent>(*kernelAlloc);
+	watchMemoryPressure(event, lowPages, criticalPages);
+
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		*handle = this_universe->attachDescriptor(universe_guard,
+				BitsetEventDescriptor(std::move(event)));
+	}
+
+	return kHelErrNone;
+}
+
+HelError helQueryMemoryPressure(HelMemoryPressureInfo *userInfo) {
+	auto reclaimStats = getReclaimStatistics();
+
+	HelMemoryPressureInfo info;
+	memset(&info, 0, sizeof(HelMemoryPressureInfo));
+	info.totalBytes = physicalAllocator->numTotalPages() * kPageSize;
+	info.freeBytes = physicalAllocator->numFreePages() * kPageSize;
+	info.cachedBytes = reclaimStats.cachedPages * kPageSize;
+	info.evictedBytes = reclaimStats.evictedPages * kPageSize;
+	info.level = static_cast<uint32_t>(currentMemoryPressure());
+	info.defaultLowFreeBytes = defaultLowPressureWatermark() * kPageSize;
+	info.defaultCriticalFreeBytes = defaultCriticalPressureWatermark() * kPageSize;
+	info.mappedAnonymousBytes = globalResidentCounters().anonymousBytes();
+	info.mappedFileBytes = globalResidentCounters().fileBytes();
+
+	if(!writeUserObject(userInfo, info))
+		return kHelErrFault;
+
+	return kHelErrNone;
+}
+
 HelError helAccessIrq(int number, HelHandle *handle) {
 #ifdef __x86_64__
 	auto this_thread = getCurrentThread();
@@ -3124,6 +4095,9 @@ HelError helAcknowledgeIrq(HelHandle handle, uint32_t flags, uint64_t sequence)
 
 	Error error;
 	if(mode == kHelAckAcknowledge) {
+		// Coalesced IRQs are already acknowledged by the kernel.
+		if(irq->isModerated())
+			return kHelErrNone;
 		error = IrqPin::ackSink(irq.get(), sequence);
 	}else if(mode == kHelAckNack) {
 		error = IrqPin::nackSink(irq.get(), sequence);
@@ -3303,6 +4277,36 @@ HelError helAutomateIrq(HelHandle handle, uint32_t flags, HelHandle kernlet_hand
 	return kHelErrNone;
 }
 
+HelError helModerateIrq(HelHandle handle, unsigned int maxEvents, uint64_t delay) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<IrqObject> irq;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		auto irq_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		if(!irq_wrapper)
+			return kHelErrNoDescriptor;
+		if(!irq_wrapper->is<IrqDescriptor>())
+			return kHelErrBadDescriptor;
+		irq = irq_wrapper->get<IrqDescriptor>().irq;
+	}
+
+	auto error = IrqObject::setModeration(std::move(irq), maxEvents, delay);
+	if(error == Error::illegalArgs) {
+		return kHelErrIllegalArgs;
+	}else if(error == Error::illegalState) {
+		return kHelErrIllegalState;
+	}else if(error == Error::noHardwareSupport) {
+		return kHelErrUnsupportedOperation;
+	}else{
+		assert(error == Error::success);
+		return kHelErrNone;
+	}
+}
+
 HelError helAccessIo(uintptr_t *port_array, size_t num_ports,
 		HelHandle *handle) {
 	auto this_thread = getCurrentThread();
@@ -3412,12 +4416,18 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 				memory = wrapper->get<MemoryViewDescriptor>().memory;
 			}
 
-			auto window = reinterpret_cast<char *>(KernelVirtualMemory::global().allocate(0x10000));
-			assert(memory->getLength() <= 0x10000);
+			// Kernlets run in IRQ context, hence the view (e.g., a BAR or a
+			// DMA ring) has to be fully present when it is bound.
+			auto length = (memory->getLength() + kPageSize - 1) & ~(kPageSize - 1);
+			for(size_t off = 0; off < length; off += kPageSize) {
+				auto range = memory->peekRange(off);
+				if(range.get<0>() == PhysicalAddr(-1))
+					return kHelErrFault;
+			}
 
-			for(size_t off = 0; off < memory->getLength(); off += kPageSize) {
+			auto window = reinterpret_cast<char *>(KernelVirtualMemory::global().allocate(length));
+			for(size_t off = 0; off < length; off += kPageSize) {
 				auto range = memory->peekRange(off);
-				assert(range.get<0>() != PhysicalAddr(-1));
 				KernelPageSpace::global().mapSingle4k(reinterpret_cast<uintptr_t>(window + off),
 						range.get<0>(), page_access::write, range.get<1>());
 			}
@@ -3537,6 +4547,122 @@ HelError helSetAffinity(HelHandle handle, uint8_t *mask, size_t size) {
 	return kHelErrNone;
 }
 
+HelError helPushSignalFrame(HelHandle handle, const HelSignalFrame *userFrame,
+		uintptr_t *address) {
+#if defined(__x86_64__) || defined(__aarch64__)
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	HelSignalFrame params;
+	if(!readUserObject(userFrame, params))
+		return kHelErrFault;
+
+	auto fitsFrame = [&] (size_t offset, size_t size) {
+		return offset <= params.frameSize && size <= params.frameSize - offset;
+	};
+	if(params.frameSize > maxSignalFrameSize)
+		return kHelErrIllegalArgs;
+	if(!fitsFrame(params.registersOffset, signalRegisterCount * sizeof(uintptr_t))
+			|| !fitsFrame(params.infoOffset, 0)
+			|| !fitsFrame(params.contextOffset, 0))
+		return kHelErrIllegalArgs;
+	if((params.flags & kHelSignalFrameSimdPointer)
+			&& !fitsFrame(params.simdPointerOffset, sizeof(uintptr_t)))
+		return kHelErrIllegalArgs;
+#if defined(__x86_64__)
+	// The return address is stored at the top of the frame.
+	if(!fitsFrame(0, sizeof(uintptr_t)))
+		return kHelErrIllegalArgs;
+#endif
+
+	smarter::shared_ptr<Thread> thread;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		auto threadWrapper = thisUniverse->getDescriptor(universeGuard, handle);
+		if(!threadWrapper)
+			return kHelErrNoDescriptor;
+		if(!threadWrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = remove_tag_cast(threadWrapper->get<ThreadDescriptor>().thread);
+	}
+
+	// TODO: Make sure that the thread is actually suspenend!
+
+	frg::vector<uint8_t, KernelAlloc> frame{*kernelAlloc};
+	frame.resize(params.frameSize);
+	if(!readUserMemory(frame.data(), params.frame, params.frameSize))
+		return kHelErrFault;
+
+	uintptr_t regs[signalRegisterCount];
+	loadSignalRegisters(thread->_executor, regs);
+	memcpy(frame.data() + params.registersOffset, regs, sizeof(regs));
+
+#if defined(__x86_64__)
+	auto simdSize = Executor::determineSimdSize();
+	const void *simdState = thread->_executor._fxState();
+#elif defined(__aarch64__)
+	auto simdSize = sizeof(FpRegisters);
+	const void *simdState = &thread->_executor.general()->fp;
+#endif
+
+	// Switch to the alternate stack unless the thread already runs on it.
+	uintptr_t sp = *thread->_executor.sp();
+	if(params.altStackSize && (sp < params.altStackBase
+			|| sp - params.altStackBase > params.altStackSize))
+		sp = params.altStackBase + params.altStackSize;
+
+	size_t totalSize = signalRedZoneSize + params.frameSize + simdSize + 15 + signalCallMisalign;
+	if(sp < totalSize)
+		return kHelErrFault;
+	uintptr_t base = ((sp - signalRedZoneSize - params.frameSize - simdSize)
+			& ~uintptr_t(15)) - signalCallMisalign;
+
+	if(params.flags & kHelSignalFrameSimdPointer) {
+		uintptr_t simdPointer = base + params.frameSize;
+		memcpy(frame.data() + params.simdPointerOffset, &simdPointer, sizeof(uintptr_t));
+	}
+#if defined(__x86_64__)
+	memcpy(frame.data(), &params.restorerIp, sizeof(uintptr_t));
+#endif
+
+	// Write the frame directly into the thread's address space.
+	auto space = thread->getAddressSpace().lock();
+	auto frameOutcome = Thread::asyncBlockCurrent(space->writeSpace(base,
+			frame.data(), params.frameSize, thisThread->mainWorkQueue()->take()));
+	if(!frameOutcome)
+		return kHelErrFault;
+	auto simdOutcome = Thread::asyncBlockCurrent(space->writeSpace(base + params.frameSize,
+			simdState, simdSize, thisThread->mainWorkQueue()->take()));
+	if(!simdOutcome)
+		return kHelErrFault;
+
+	// Enter the handler.
+#if defined(__x86_64__)
+	thread->_executor.general()->rdi = params.signalNumber;
+	thread->_executor.general()->rsi = base + params.infoOffset;
+	thread->_executor.general()->rdx = base + params.contextOffset;
+	thread->_executor.general()->rax = 0; // Number of variable arguments.
+#elif defined(__aarch64__)
+	thread->_executor.general()->x[0] = params.signalNumber;
+	thread->_executor.general()->x[1] = base + params.infoOffset;
+	thread->_executor.general()->x[2] = base + params.contextOffset;
+	thread->_executor.general()->x[30] = params.restorerIp;
+#endif
+	*thread->_executor.ip() = params.handlerIp;
+	*thread->_executor.sp() = base;
+
+	*address = base;
+	return kHelErrNone;
+#else
+	(void)handle;
+	(void)userFrame;
+	(void)address;
+	return kHelErrUnsupportedOperation;
+#endif
+}
+
 HelError helQueryRegisterInfo(int set, HelRegisterInfo *info) {
 	HelRegisterInfo outInfo;
 
@@ -3619,6 +4745,30 @@ HelError helGetCurrentCpu(int *cpu) {
 	return kHelErrNone;
 }
 
+HelError helQueryKernelStats(HelKernelStats *userStats) {
+	HelKernelStats stats;
+	memset(&stats, 0, sizeof(HelKernelStats));
+	stats.contextSwitches = sumKernelStat(KernelStat::contextSwitches);
+	stats.ipisSent = sumKernelStat(KernelStat::ipisSent);
+	stats.readFaults = sumKernelStat(KernelStat::readFaults);
+	stats.writeFaults = sumKernelStat(KernelStat::writeFaults);
+	stats.executeFaults = sumKernelStat(KernelStat::executeFaults);
+	stats.unresolvedFaults = sumKernelStat(KernelStat::unresolvedFaults);
+	stats.shootdowns = sumKernelStat(KernelStat::shootdowns);
+	stats.ipcSubmits = sumKernelStat(KernelStat::ipcSubmits);
+	stats.futexWaits = sumKernelStat(KernelStat::futexWaits);
+	stats.futexWakes = sumKernelStat(KernelStat::futexWakes);
+	stats.physicalAllocations = sumKernelStat(KernelStat::physicalAllocations);
+	stats.physicalFrees = sumKernelStat(KernelStat::physicalFrees);
+	stats.ipcQueueStalls = sumKernelStat(KernelStat::ipcQueueStalls);
+	stats.handoffSwitches = sumKernelStat(KernelStat::handoffSwitches);
+
+	if(!writeUserObject(userStats, stats))
+		return kHelErrFault;
+
+	return kHelErrNone;
+}
+
 HelError helCreateToken(HelHandle *handle) {
 	auto thisThread = getCurrentThread();
 	auto thisUniverse = thisThread->getUniverse();
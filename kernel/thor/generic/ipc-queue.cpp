@@ -4,6 +4,8 @@
 #include <frg/container_of.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/ipc-queue.hpp>
+#include <thor-internal/kernel-stats.hpp>
+#include <thor-internal/ostrace.hpp>
 
 namespace thor {
 
@@ -11,12 +13,21 @@ namespace thor {
 // IpcQueue
 // ----------------------------------------------------------------------------
 
-IpcQueue::IpcQueue(unsigned int ringShift, unsigned int numChunks, size_t chunkSize)
+IpcQueue::IpcQueue(unsigned int ringShift, unsigned int numChunks, size_t chunkSize,
+		size_t submissionRingSize)
 : _ringShift{ringShift}, _chunkSize{chunkSize}, _chunkOffsets{*kernelAlloc},
-		_currentIndex{0}, _currentProgress{0}, _anyNodes{false} {
+		_currentIndex{0}, _currentProgress{0} {
 	auto chunksOffset = (sizeof(QueueStruct) + (sizeof(int) << ringShift) + 63) & ~size_t(63);
 	auto reservedPerChunk = (sizeof(ChunkStruct) + chunkSize + 63) & ~size_t(63);
 	auto overallSize = chunksOffset + numChunks * reservedPerChunk;
+	_reservedPerChunk = reservedPerChunk;
+
+	// The submission ring (if any) follows the chunks.
+	if(submissionRingSize) {
+		_submissionRingOffset = overallSize;
+		_submissionRingSize = submissionRingSize;
+		overallSize += submissionRingSize;
+	}
 
 	// Setup internal state.
 	_memory = smarter::allocate_shared<ImmediateMemory>(*kernelAlloc, overallSize);
@@ -24,6 +35,7 @@ IpcQueue::IpcQueue(unsigned int ringShift, unsigned int numChunks, size_t chunkS
 	_chunkOffsets.resize(numChunks);
 	for(unsigned int i = 0; i < numChunks; ++i)
 		_chunkOffsets[i] = chunksOffset + i * reservedPerChunk;
+	_memoryEnd = (overallSize + 63) & ~size_t(63);
 
 	async::detach_with_allocator(*kernelAlloc, _runQueue());
 }
@@ -32,18 +44,84 @@ bool IpcQueue::validSize(size_t size) {
 	return sizeof(ElementStruct) + size <= _chunkSize;
 }
 
+frg::expected<Error, uintptr_t> IpcQueue::addChunks(unsigned int numChunks) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_chunkMutex);
+
+	// User space must be able to enqueue all chunks at the same time.
+	if(!numChunks || _chunkOffsets.size() + numChunks > (size_t{1} << _ringShift))
+		return Error::illegalArgs;
+
+	auto offset = _memoryEnd;
+	_memoryEnd += numChunks * _reservedPerChunk;
+	_memory->grow(_memoryEnd);
+
+	auto firstChunk = _chunkOffsets.size();
+	_chunkOffsets.resize(firstChunk + numChunks);
+	for(unsigned int i = 0; i < numChunks; ++i)
+		_chunkOffsets[firstChunk + i] = offset + i * _reservedPerChunk;
+	return offset;
+}
+
+bool IpcQueue::popSubmission(void *entry, size_t entrySize) {
+	assert(_submissionRingOffset);
+	auto numEntries = (_submissionRingSize - sizeof(SubmissionRingStruct)) / entrySize;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_submissionMutex);
+
+	auto ring = _memory->accessImmediate<SubmissionRingStruct>(_submissionRingOffset);
+	// Pairs with the release store of user space after writing the entry.
+	auto tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if(tail == _submissionHead)
+		return false;
+
+	auto offset = _submissionRingOffset + sizeof(SubmissionRingStruct)
+			+ (_submissionHead % numEntries) * entrySize;
+	_memory->readImmediate(offset, entry, entrySize);
+
+	// Hand the entry back to user space. We ignore any value that
+	// user space might have written to head.
+	_submissionHead++;
+	__atomic_store_n(&ring->head, _submissionHead, __ATOMIC_RELEASE);
+	return true;
+}
+
 void IpcQueue::submit(IpcNode *node) {
-	{
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&_mutex);
-
-		assert(!node->_queueNode.in_list);
-		node->_queue = this;
-		_nodeQueue.push_back(node);
-		_anyNodes.store(true, std::memory_order_relaxed);
-	}
+	node->_queue = this;
+	ostrace::tracepoint(ostrace::Tracepoint::ipcComplete,
+			reinterpret_cast<uintptr_t>(this), node->_context);
+
+	auto head = _submitted.load(std::memory_order_relaxed);
+	do {
+		node->_next = head;
+	} while(!_submitted.compare_exchange_weak(head, node,
+			std::memory_order_release, std::memory_order_relaxed));
+
+	// If the stack was non-empty, _runQueue() has not drained it yet; it drains
+	// the stack before waiting on the doorbell again, so there is no need to ring it.
+	if(!head)
+		_doorbell.raise();
+}
 
-	_doorbell.raise();
+bool IpcQueue::_fetchSubmitted() {
+	if(_pendingHead)
+		return true;
+
+	auto stack = _submitted.exchange(nullptr, std::memory_order_acquire);
+	if(!stack)
+		return false;
+
+	// Reverse the stack to restore submission order.
+	IpcNode *list = nullptr;
+	while(stack) {
+		auto next = stack->_next;
+		stack->_next = list;
+		list = stack;
+		stack = next;
+	}
+	_pendingHead = list;
+	return true;
 }
 
 coroutine<void> IpcQueue::_runQueue() {
@@ -51,9 +129,9 @@ coroutine<void> IpcQueue::_runQueue() {
 
 	while(true) {
 		co_await _doorbell.async_wait_if([&] () -> bool {
-			return !_anyNodes.load(std::memory_order_relaxed);
+			return !_pendingHead && !_submitted.load(std::memory_order_relaxed);
 		});
-		if(!_anyNodes.load(std::memory_order_relaxed))
+		if(!_fetchSubmitted())
 			continue;
 
 		// Wait until the futex advances past _currentIndex.
@@ -75,19 +153,22 @@ coroutine<void> IpcQueue::_runQueue() {
 			if(pastCurrentChunk)
 				break;
 
+			// There are pending nodes but user space did not supply a chunk yet.
+			countKernelStat(KernelStat::ipcQueueStalls);
+
 			auto hfOffset = offsetof(QueueStruct, headFutex);
 			co_await getGlobalFutexRealm()->wait(_memory->getImmediateFutex(hfOffset),
 					_currentIndex | kHeadWaiters);
 		}
 
 		// Lock the chunk.
+		size_t iq = _currentIndex & ((size_t{1} << _ringShift) - 1);
+		size_t cn = *_memory->accessImmediate<int>(offsetof(QueueStruct, indexQueue) + iq * sizeof(int));
 		size_t chunkOffset;
 		{
 			auto irqLock = frg::guard(&irqMutex());
-			auto lock = frg::guard(&_mutex);
+			auto lock = frg::guard(&_chunkMutex);
 
-			size_t iq = + _currentIndex & ((size_t{1} << _ringShift) - 1);
-			size_t cn = *_memory->accessImmediate<int>(offsetof(QueueStruct, indexQueue) + iq * sizeof(int));
 			assert(cn < _chunkOffsets.size());
 			chunkOffset = _chunkOffsets[cn];
 		}
@@ -97,26 +178,18 @@ coroutine<void> IpcQueue::_runQueue() {
 		// This inner loop runs until the chunk is exhausted.
 		while(true) {
 			co_await _doorbell.async_wait_if([&] () -> bool {
-				return !_anyNodes.load(std::memory_order_relaxed);
+				return !_pendingHead && !_submitted.load(std::memory_order_relaxed);
 			});
-			if(!_anyNodes.load(std::memory_order_relaxed))
+			if(!_fetchSubmitted())
 				continue;
 
 			// Check if there is enough space in the current chunk.
-			IpcNode *node;
-			uintptr_t progress;
-			{
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&_mutex);
-
-				assert(!_nodeQueue.empty());
-				node = _nodeQueue.front();
-				progress = _currentProgress;
-			}
+			IpcNode *node = _pendingHead;
+			uintptr_t progress = _currentProgress;
 
 			// Compute the overall length of the element.
 			size_t length = 0;
-			for(auto sgSource = _nodeQueue.front()->_source; sgSource; sgSource = sgSource->link)
+			for(auto sgSource = node->_source; sgSource; sgSource = sgSource->link)
 				length += (sgSource->size + 7) & ~size_t(7);
 			assert(length <= _chunkSize);
 
@@ -163,26 +236,15 @@ coroutine<void> IpcQueue::_runQueue() {
 
 			// Update our internal state and retire the chunk.
 			if(!emitElement) {
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&_mutex);
-
 				_currentIndex = ((_currentIndex + 1) & kHeadMask);
 				_currentProgress = 0;
 				break;
 			}
 
 			// Update our internal state and retire the node.
-			{
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&_mutex);
-
-				_currentProgress += sizeof(ElementStruct) + length;
-				_nodeQueue.pop_front();
-
-				assert(_anyNodes.load(std::memory_order_relaxed));
-				if(_nodeQueue.empty())
-					_anyNodes.store(false, std::memory_order_relaxed);
-			}
+			_currentProgress += sizeof(ElementStruct) + length;
+			_pendingHead = node->_next;
+			node->_next = nullptr;
 
 			node->complete();
 		}
@@ -0,0 +1,159 @@
+#include <frg/cmdline.hpp>
+#include <thor-internal/arch/stack.hpp>
+#include <thor-internal/arch-generic/timer.hpp>
+#include <thor-internal/cpu-data.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/kernel-locks.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/ostrace.hpp>
+#include <thor-internal/timer.hpp>
+
+// IRQ-off tracer. If thor.irqtrace is passed on the kernel command line, each section in which
+// the outermost IrqMutex of a CPU keeps IRQs disabled is timed. Each CPU keeps the longest
+// sections together with the call stack at their end; a fiber periodically reports newly
+// recorded sections as ostrace events.
+// Since thor only preempts at points where IRQs are enabled, these sections are also
+// the sections in which preemption is off.
+
+namespace thor {
+
+constinit std::atomic<bool> irqTraceEnabled{false};
+
+struct IrqOffSection {
+	static constexpr size_t maxFrames = 16;
+
+	uint64_t ticks;
+	uintptr_t site;
+	uintptr_t frames[maxFrames];
+	size_t numFrames;
+	// Set when the section is recorded; cleared once it is reported.
+	bool unreported;
+};
+
+struct IrqTraceState {
+	// Number of sections that are kept; only the longest sections are kept.
+	static constexpr size_t numSections = 8;
+
+	// Protects sections against the reporter, which may run on another CPU.
+	TicketSpinlock mutex;
+	// Length of the shortest section in sections. Shorter sections are discarded
+	// without taking the lock.
+	std::atomic<uint64_t> threshold{0};
+	IrqOffSection sections[numSections]{};
+};
+
+extern PerCpu<IrqTraceState> irqTraceState;
+THOR_DEFINE_PERCPU(irqTraceState);
+
+void IrqMutex::traceStart_() {
+	_traceSite = reinterpret_cast<uintptr_t>(__builtin_return_address(0));
+	_traceStart = getRawTimestampCounter();
+}
+
+void IrqMutex::traceEnd_() {
+	auto site = _traceSite;
+	_traceSite = 0;
+	recordIrqOffSection(site, _traceStart);
+}
+
+// This is called before the outermost IrqMutex is released, hence IrqMutexes that
+// are taken below are nested and do not cause recursion.
+void recordIrqOffSection(uintptr_t site, uint64_t startTicks) {
+	auto ticks = getRawTimestampCounter() - startTicks;
+	auto state = &irqTraceState.get();
+	if(ticks <= state->threshold.load(std::memory_order_relaxed))
+		return;
+
+	auto lock = frg::guard(&state->mutex);
+
+	auto shortest = &state->sections[0];
+	for(auto &section : state->sections) {
+		if(section.ticks < shortest->ticks)
+			shortest = &section;
+	}
+	if(ticks <= shortest->ticks)
+		return;
+
+	shortest->ticks = ticks;
+	shortest->site = site;
+	shortest->numFrames = 0;
+	walkThisStack([&] (uintptr_t ip) {
+		if(shortest->numFrames < IrqOffSection::maxFrames)
+			shortest->frames[shortest->numFrames++] = ip;
+	});
+	shortest->unreported = true;
+
+	uint64_t threshold = ticks;
+	for(auto &section : state->sections) {
+		if(section.ticks < threshold)
+			threshold = section.ticks;
+	}
+	state->threshold.store(threshold, std::memory_order_relaxed);
+}
+
+namespace {
+
+void reportIrqOffSections() {
+	for(size_t i = 0; i < getCpuCount(); i++) {
+		auto state = &irqTraceState.getFor(i);
+
+		IrqOffSection pending[IrqTraceState::numSections];
+		size_t numPending = 0;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&state->mutex);
+
+			for(auto &section : state->sections) {
+				if(!section.unreported)
+					continue;
+				pending[numPending++] = section;
+				section.unreported = false;
+			}
+		}
+
+		for(size_t j = 0; j < numPending; j++) {
+			auto &section = pending[j];
+			ostrace::emit(ostEvtIrqOffSection,
+					ostAttrIrqOffCpu(i),
+					ostAttrIrqOffTicks(section.ticks),
+					ostAttrIrqOffSite(section.site),
+					ostAttrIrqOffStack({reinterpret_cast<const char *>(section.frames),
+							section.numFrames * sizeof(uintptr_t)}));
+		}
+	}
+}
+
+initgraph::Task initIrqTrace{&globalInitEngine, "generic.init-irq-trace",
+	initgraph::Requires{getOsTraceAvailableStage(),
+		getFibersAvailableStage()},
+	[] {
+		bool enable = false;
+		frg::array args = {
+			frg::option{"thor.irqtrace", frg::store_true(enable)},
+		};
+		frg::parse_arguments(getKernelCmdline(), args);
+		if(!enable)
+			return;
+
+		if(!wantOsTrace) {
+			infoLogger() << "thor: thor.irqtrace is ignored since ostrace is disabled"
+					<< frg::endlog;
+			return;
+		}
+
+		infoLogger() << "thor: IRQ-off tracing is enabled" << frg::endlog;
+		irqTraceEnabled.store(true, std::memory_order_relaxed);
+
+		KernelFiber::run([] {
+			while(true) {
+				KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(100'000'000));
+				reportIrqOffSections();
+			}
+		});
+	}
+};
+
+} // anonymous namespace
+
+} // namespace thor
@@ -187,6 +187,13 @@ void IrqPin::configure(IrqConfiguration desired) {
 	}
 }
 
+TriggerMode IrqPin::triggerMode() {
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	return _activeCfg.trigger;
+}
+
 void IrqPin::raise() {
 	assert(!intsAreEnabled());
 	auto lock = frg::guard(&_mutex);
@@ -480,27 +487,130 @@ void IrqObject::automate(smarter::shared_ptr<BoundKernlet> kernlet) {
 	_automationKernlet = std::move(kernlet);
 }
 
-IrqStatus IrqObject::raise() {
+Error IrqObject::setModeration(smarter::shared_ptr<IrqObject> self,
+		unsigned int maxEvents, uint64_t delay) {
+	auto pin = self->getPin();
+	if(!pin)
+		return Error::illegalState;
+	// Level-triggered IRQs would fire again if the kernel acknowledged them.
+	if(maxEvents && pin->triggerMode() != TriggerMode::edge)
+		return Error::noHardwareSupport;
+	if(maxEvents > 1 && !delay)
+		return Error::illegalArgs;
+
+	bool spawn = false;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		auto lock = frg::guard(self->sinkMutex());
+
+		if(self->_automationKernlet)
+			return Error::illegalState;
+
+		self->_moderateEvents = maxEvents;
+		self->_moderateDelay = delay;
+		if(!maxEvents) {
+			if(self->_pendingEvents)
+				self->_deliver();
+			// Let the moderation coroutine exit.
+			self->_moderationEvent.raise();
+		}else if(!self->_moderationRunning) {
+			self->_moderationRunning = true;
+			spawn = true;
+		}
+	}
+
+	if(!spawn)
+		return Error::success;
+
+	// This coroutine delivers pending IRQs once the coalescing delay expires.
+	[] (smarter::shared_ptr<IrqObject> self, enable_detached_coroutine = {}) -> void {
+		while(true) {
+			bool stop = false;
+			co_await self->_moderationEvent.async_wait_if([&] () -> bool {
+				auto irq_lock = frg::guard(&irqMutex());
+				auto lock = frg::guard(self->sinkMutex());
+
+				if(!self->_moderateEvents) {
+					self->_moderationRunning = false;
+					stop = true;
+					return false;
+				}
+				return !self->_pendingEvents;
+			});
+			if(stop)
+				co_return;
+
+			// Leave the IRQ context that raised the event.
+			co_await WorkQueue::generalQueue()->schedule();
+
+			uint64_t delay;
+			{
+				auto irq_lock = frg::guard(&irqMutex());
+				auto lock = frg::guard(self->sinkMutex());
+				delay = self->_moderateDelay;
+			}
+			co_await generalTimerEngine()->sleepFor(delay);
+
+			{
+				auto irq_lock = frg::guard(&irqMutex());
+				auto lock = frg::guard(self->sinkMutex());
+				if(self->_pendingEvents)
+					self->_deliver();
+			}
+		}
+	}(std::move(self));
+
+	return Error::success;
+}
+
+bool IrqObject::isModerated() {
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(sinkMutex());
+
+	return _moderateEvents;
+}
+
+void IrqObject::_deliver() {
+	_deliveredSequence = currentSequence();
+	_pendingEvents = 0;
+
 	while(!_waitQueue.empty()) {
 		auto node = _waitQueue.pop_front();
 		node->_error = Error::success;
-		node->_sequence = currentSequence();
+		node->_sequence = _deliveredSequence;
 		WorkQueue::post(node->_awaited);
 	}
+}
+
+IrqStatus IrqObject::raise() {
+	if(_moderateEvents && !_automationKernlet) {
+		if(++_pendingEvents >= _moderateEvents) {
+			_deliver();
+		}else if(_pendingEvents == 1) {
+			_moderationEvent.raise();
+		}
+		return IrqStatus::acked;
+	}
 
 	if(_automationKernlet) {
+		// The kernlet decides whether the IRQ belongs to this device. IRQs that it rejects
+		// (e.g., on shared lines) do not wake up user space.
 		auto result = _automationKernlet->invokeIrqAutomation();
 		if(result == 1) {
+			_deliver();
 			return IrqStatus::acked;
 		}else if(result == 2) {
 			return IrqStatus::nacked;
 		}else{
 			assert(!result);
 			infoLogger() << "thor: IRQ automation does not handle the IRQ?" << frg::endlog;
+			_deliver();
 			return IrqStatus::indefinite;
 		}
-	}else
-		return IrqStatus::indefinite;
+	}
+
+	_deliver();
+	return IrqStatus::indefinite;
 }
 
 void IrqObject::submitAwait(AwaitIrqNode *node, uint64_t sequence) {
@@ -508,9 +618,9 @@ void IrqObject::submitAwait(AwaitIrqNode *node, uint64_t sequence) {
 	auto lock = frg::guard(sinkMutex());
 
 	assert(sequence <= currentSequence());
-	if(sequence < currentSequence()) {
+	if(sequence < _deliveredSequence) {
 		node->_error = Error::success;
-		node->_sequence = currentSequence();
+		node->_sequence = _deliveredSequence;
 		WorkQueue::post(node->_awaited);
 	}else{
 		_waitQueue.push_back(node);
@@ -1,15 +1,21 @@
 #include <frg/string.hpp>
 
 #include <thor-internal/universe.hpp>
+#include <thor-internal/address-space.hpp>
+#include <thor-internal/clock-page.hpp>
+#include <thor-internal/arch-generic/asid.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/kerncfg.hpp>
+#include <thor-internal/kernel-locks.hpp>
 #include <thor-internal/ostrace.hpp>
 #include <thor-internal/kernel-log.hpp>
 #include <thor-internal/profile.hpp>
+#include <thor-internal/schedule.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/timer.hpp>
 #include <thor-internal/mbus.hpp>
+#include <thor-internal/memory-view.hpp>
 #include <thor-internal/physical.hpp>
 
 #include <bragi/helpers-frigg.hpp>
@@ -17,6 +23,7 @@
 #include "kerncfg.frigg_bragi.hpp"
 
 #include <thor-internal/ring-buffer.hpp>
+#include <thor-internal/ring-mirror.hpp>
 
 namespace thor {
 
@@ -101,6 +108,168 @@ private:
 			resp.set_error(managarm::kerncfg::Error::SUCCESS);
 			resp.set_num_cpu(getCpuCount());
 
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
+			bragi::write_head_only(resp, respBuffer);
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+			if(respError != Error::success) {
+				co_return respError;
+			}
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::GetReclaimStatsRequest>) {
+			auto req = bragi::parse_head_only<managarm::kerncfg::GetReclaimStatsRequest>(reqBuffer, *kernelAlloc);
+
+			if (!req) {
+				co_return Error::protocolViolation;
+			}
+
+			auto stats = getReclaimStatistics();
+
+			managarm::kerncfg::GetReclaimStatsResponse<KernelAlloc> resp(*kernelAlloc);
+			resp.set_error(managarm::kerncfg::Error::SUCCESS);
+			resp.set_cached_pages(stats.cachedPages);
+			resp.set_active_pages(stats.activePages);
+			resp.set_inactive_pages(stats.inactivePages);
+			resp.set_evicted_pages(stats.evictedPages);
+
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
+			bragi::write_head_only(resp, respBuffer);
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+			if(respError != Error::success) {
+				co_return respError;
+			}
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::GetFaultAroundStatsRequest>) {
+			auto req = bragi::parse_head_only<managarm::kerncfg::GetFaultAroundStatsRequest>(reqBuffer, *kernelAlloc);
+
+			if (!req) {
+				co_return Error::protocolViolation;
+			}
+
+			auto stats = getFaultAroundStatistics();
+
+			managarm::kerncfg::GetFaultAroundStatsResponse<KernelAlloc> resp(*kernelAlloc);
+			resp.set_error(managarm::kerncfg::Error::SUCCESS);
+			resp.set_mapped_ahead(stats.mappedAhead);
+			resp.set_used_ahead(stats.usedAhead);
+			resp.set_unused_ahead(stats.unusedAhead);
+
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
+			bragi::write_head_only(resp, respBuffer);
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+			if(respError != Error::success) {
+				co_return respError;
+			}
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::GetHeapStatsRequest>) {
+			auto req = bragi::parse_head_only<managarm::kerncfg::GetHeapStatsRequest>(reqBuffer, *kernelAlloc);
+
+			if (!req) {
+				co_return Error::protocolViolation;
+			}
+
+			managarm::kerncfg::GetHeapStatsResponse<KernelAlloc> resp(*kernelAlloc);
+			if(req->size_class() < KernelHeapCache::numClasses) {
+				auto sizeClass = static_cast<int>(req->size_class());
+				auto stats = getKernelHeapStatistics(sizeClass);
+				resp.set_error(managarm::kerncfg::Error::SUCCESS);
+				resp.set_object_size(KernelHeapCache::classSize(sizeClass));
+				resp.set_allocations(stats.allocations);
+				resp.set_refills(stats.refills);
+				resp.set_drains(stats.drains);
+			}else{
+				resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
+			}
+
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
+			bragi::write_head_only(resp, respBuffer);
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+			if(respError != Error::success) {
+				co_return respError;
+			}
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::GetShootdownStatsRequest>) {
+			auto req = bragi::parse_head_only<managarm::kerncfg::GetShootdownStatsRequest>(reqBuffer, *kernelAlloc);
+
+			if (!req) {
+				co_return Error::protocolViolation;
+			}
+
+			managarm::kerncfg::GetShootdownStatsResponse<KernelAlloc> resp(*kernelAlloc);
+			if(req->cpu() < getCpuCount()) {
+				auto &stats = shootdownCpuState.getFor(req->cpu());
+				resp.set_error(managarm::kerncfg::Error::SUCCESS);
+				resp.set_ipis_sent(stats.ipisSent.load(std::memory_order_relaxed));
+				resp.set_ipis_received(stats.ipisReceived.load(std::memory_order_relaxed));
+				resp.set_page_invalidations(stats.pageInvalidations.load(std::memory_order_relaxed));
+				resp.set_asid_invalidations(stats.asidInvalidations.load(std::memory_order_relaxed));
+			}else{
+				resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
+			}
+
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
+			bragi::write_head_only(resp, respBuffer);
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+			if(respError != Error::success) {
+				co_return respError;
+			}
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::GetWakeupStatsRequest>) {
+			auto req = bragi::parse_head_only<managarm::kerncfg::GetWakeupStatsRequest>(reqBuffer, *kernelAlloc);
+
+			if (!req) {
+				co_return Error::protocolViolation;
+			}
+
+			managarm::kerncfg::GetWakeupStatsResponse<KernelAlloc> resp(*kernelAlloc);
+			if(req->cpu() < getCpuCount()) {
+				auto stats = localScheduler.getFor(req->cpu()).wakeupStatistics();
+				resp.set_error(managarm::kerncfg::Error::SUCCESS);
+				resp.set_ipis_sent(stats.ipisSent);
+				resp.set_ipis_suppressed(stats.ipisSuppressed);
+			}else{
+				resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
+			}
+
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
+			bragi::write_head_only(resp, respBuffer);
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+			if(respError != Error::success) {
+				co_return respError;
+			}
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::GetLockStatsRequest>) {
+			auto req = bragi::parse_head_only<managarm::kerncfg::GetLockStatsRequest>(reqBuffer, *kernelAlloc);
+
+			if (!req) {
+				co_return Error::protocolViolation;
+			}
+
+			managarm::kerncfg::GetLockStatsResponse<KernelAlloc> resp(*kernelAlloc);
+			if(lockStatEnabled.load(std::memory_order_relaxed) && req->slot() < numLockStatSlots) {
+				auto entry = getLockStatSlot(req->slot());
+				resp.set_error(managarm::kerncfg::Error::SUCCESS);
+				resp.set_site(entry->site.load(std::memory_order_relaxed));
+				resp.set_lock_address(entry->lockAddress.load(std::memory_order_relaxed));
+				resp.set_acquisitions(entry->acquisitions.load(std::memory_order_relaxed));
+				resp.set_contended(entry->contended.load(std::memory_order_relaxed));
+				resp.set_wait_ticks(entry->waitTicks.load(std::memory_order_relaxed));
+				resp.set_max_hold_ticks(entry->maxHoldTicks.load(std::memory_order_relaxed));
+			}else{
+				resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
+			}
+
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
+			bragi::write_head_only(resp, respBuffer);
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+			if(respError != Error::success) {
+				co_return respError;
+			}
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::SetRealtimeRequest>) {
+			auto req = bragi::parse_head_only<managarm::kerncfg::SetRealtimeRequest>(reqBuffer, *kernelAlloc);
+
+			if (!req) {
+				co_return Error::protocolViolation;
+			}
+
+			setClockRealtimeOffset(req->realtime_nanos() - req->ref_nanos());
+
+			managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+			resp.set_error(managarm::kerncfg::Error::SUCCESS);
+
 			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
 			bragi::write_head_only(resp, respBuffer);
 			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
@@ -228,6 +397,62 @@ private:
 
 			if(dataError != Error::success)
 				co_return dataError;
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::GetBufferMemoryRequest>) {
+			auto maybeReq = bragi::parse_head_only<managarm::kerncfg::GetBufferMemoryRequest>(reqBuffer, *kernelAlloc);
+
+			if (!maybeReq)
+				co_return Error::protocolViolation;
+
+			auto mirror = buffer_->mirror();
+
+			managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+			if(mirror) {
+				resp.set_error(managarm::kerncfg::Error::SUCCESS);
+				resp.set_size(buffer_->size());
+			}else{
+				resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
+			}
+
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
+			bragi::write_head_only(resp, respBuffer);
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+			if(respError != Error::success)
+				co_return respError;
+
+			if(mirror) {
+				auto headerError = co_await PushDescriptorSender{lane,
+						MemoryViewDescriptor{mirror->headerMemory}};
+				if(headerError != Error::success)
+					co_return headerError;
+				auto dataError = co_await PushDescriptorSender{lane,
+						MemoryViewDescriptor{mirror->dataMemory}};
+				if(dataError != Error::success)
+					co_return dataError;
+			}
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::WaitBufferRequest>) {
+			auto maybeReq = bragi::parse_head_only<managarm::kerncfg::WaitBufferRequest>(reqBuffer, *kernelAlloc);
+
+			if (!maybeReq)
+				co_return Error::protocolViolation;
+
+			auto &req = *maybeReq;
+			auto target = req.dequeue() + frg::max(req.watermark(), uint64_t{1});
+			while(true) {
+				auto head = buffer_->head();
+				if(head >= target)
+					break;
+				co_await buffer_->wait(head);
+			}
+
+			managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+			resp.set_error(managarm::kerncfg::Error::SUCCESS);
+			resp.set_new_dequeue(buffer_->head());
+
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
+			bragi::write_head_only(resp, respBuffer);
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+			if(respError != Error::success)
+				co_return respError;
 		}else{
 			managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
 			resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
@@ -0,0 +1,102 @@
+#include <frg/cmdline.hpp>
+#include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/arch-generic/timer.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/kernel-locks.hpp>
+#include <thor-internal/main.hpp>
+
+namespace thor {
+
+constinit std::atomic<bool> lockStatEnabled{false};
+
+namespace {
+	// Open addressing hash table, indexed by call site. Entries are never removed.
+	constinit LockStatEntry lockStatTable[numLockStatSlots];
+
+	initgraph::Task parseLockStatOption{&globalInitEngine, "generic.parse-lockstat-option",
+		[] {
+			bool enable = false;
+			frg::array args = {
+				frg::option{"thor.lockstat", frg::store_true(enable)},
+			};
+			frg::parse_arguments(getKernelCmdline(), args);
+			if(!enable)
+				return;
+
+			infoLogger() << "thor: Lock statistics are enabled" << frg::endlog;
+			lockStatEnabled.store(true, std::memory_order_relaxed);
+		}
+	};
+
+	LockStatEntry *findLockStatEntry(uintptr_t site) {
+		// Fibonacci hashing; the low bits of the site are mostly determined by alignment.
+		size_t hash = (site * 0x9E37'79B9'7F4A'7C15) >> 32;
+		for(size_t i = 0; i < numLockStatSlots; i++) {
+			auto entry = &lockStatTable[(hash + i) % numLockStatSlots];
+			auto existing = entry->site.load(std::memory_order_relaxed);
+			if(existing == site)
+				return entry;
+			if(!existing) {
+				if(entry->site.compare_exchange_strong(existing, site,
+						std::memory_order_relaxed))
+					return entry;
+				if(existing == site)
+					return entry;
+			}
+		}
+		return nullptr;
+	}
+}
+
+LockStatEntry *getLockStatSlot(size_t slot) {
+	assert(slot < numLockStatSlots);
+	return &lockStatTable[slot];
+}
+
+void TicketSpinlock::spinUntil_(uint32_t ticket) {
+	while(servingTicket_.load(std::memory_order_acquire) != ticket)
+		pause();
+}
+
+void TicketSpinlock::lockWithStats_() {
+	auto site = reinterpret_cast<uintptr_t>(__builtin_return_address(0));
+
+	auto ticket = nextTicket_.fetch_add(1, std::memory_order_relaxed);
+	bool contended = false;
+	uint64_t waitStart = 0;
+	if(servingTicket_.load(std::memory_order_acquire) != ticket) {
+		contended = true;
+		waitStart = getRawTimestampCounter();
+		spinUntil_(ticket);
+	}
+	auto now = getRawTimestampCounter();
+
+	// If the table is full, we do not record statistics for this site.
+	auto entry = findLockStatEntry(site);
+	if(!entry)
+		return;
+	entry->lockAddress.store(reinterpret_cast<uintptr_t>(this), std::memory_order_relaxed);
+	entry->acquisitions.fetch_add(1, std::memory_order_relaxed);
+	if(contended) {
+		entry->contended.fetch_add(1, std::memory_order_relaxed);
+		entry->waitTicks.fetch_add(now - waitStart, std::memory_order_relaxed);
+	}
+
+	holdEntry_ = entry;
+	holdStart_ = now;
+}
+
+void TicketSpinlock::unlockWithStats_() {
+	auto entry = holdEntry_;
+	auto holdTicks = getRawTimestampCounter() - holdStart_;
+	holdEntry_ = nullptr;
+
+	auto max = entry->maxHoldTicks.load(std::memory_order_relaxed);
+	while(holdTicks > max) {
+		if(entry->maxHoldTicks.compare_exchange_weak(max, holdTicks,
+				std::memory_order_relaxed))
+			break;
+	}
+}
+
+} // namespace thor
@@ -48,6 +48,53 @@ void GlobalLogRing::Handler::emit(frg::string_view record) {
 		ptr_->wakeup_.schedule();
 }
 
+//-----------------------------------------------------------------------------
+// Log drain implementation.
+//-----------------------------------------------------------------------------
+
+namespace {
+
+// Emits the records of the per-CPU log rings (see deferLogEmission()).
+struct LogDrain {
+	struct Wakeup {
+		Wakeup(LogDrain *ptr)
+		: ptr_{ptr} {}
+
+		void operator() () {
+			ptr_->event.raise();
+		}
+
+	private:
+		LogDrain *ptr_;
+	};
+
+	async::recurring_event event;
+	SelfIntCall<Wakeup> wakeup{this};
+};
+
+frg::manual_box<LogDrain> logDrain;
+
+} // namespace
+
+void wakeLogDrain() {
+	logDrain->wakeup.schedule();
+}
+
+void initializeLogDrain() {
+	logDrain.initialize();
+
+	KernelFiber::run([] {
+		while (true) {
+			KernelFiber::asyncBlockCurrent(logDrain->event.async_wait_if([] () -> bool {
+				return !haveDeferredLogs();
+			}));
+			drainDeferredLogs();
+		}
+	});
+
+	deferLogEmission();
+}
+
 //-----------------------------------------------------------------------------
 // Kmsg implementation.
 //-----------------------------------------------------------------------------
@@ -1,4 +1,8 @@
+#include <atomic>
+
+#include <frg/spinlock.hpp>
 #include <thor-internal/arch-generic/paging.hpp>
+#include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
 #include <thor-internal/kernel_heap.hpp>
 #include <thor-internal/kernel-stack.hpp>
@@ -6,7 +10,62 @@
 
 namespace thor {
 
+namespace {
+
+// Per-CPU cache of free (but still mapped) kernel stacks.
+// Reusing cached stacks avoids the page table updates and,
+// more importantly, the TLB shootdown that is required to free a stack.
+struct KernelStackCache {
+	static constexpr size_t capacity = 8;
+
+	// Protects the cache against concurrent trimCaches() calls.
+	TicketSpinlock mutex;
+	char *stacks[capacity];
+	size_t count = 0;
+};
+
+extern PerCpu<KernelStackCache> kernelStackCache;
+THOR_DEFINE_PERCPU(kernelStackCache);
+
+constinit std::atomic<bool> cachesEnabled{false};
+
+// Do not cache stacks if more than this fraction of physical memory is in use.
+bool isMemoryLow() {
+	return physicalAllocator->numUsedPages() >= physicalAllocator->numTotalPages() * 3 / 4;
+}
+
+} // namespace anonymous
+
+void UniqueKernelStack::enableCaches() {
+	cachesEnabled.store(true, std::memory_order_relaxed);
+}
+
+void UniqueKernelStack::trimCaches() {
+	for(size_t i = 0; i < getCpuCount(); i++) {
+		auto cache = &kernelStackCache.getFor(i);
+		while(true) {
+			char *base;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&cache->mutex);
+				if(!cache->count)
+					break;
+				base = cache->stacks[--cache->count];
+			}
+			_release(base);
+		}
+	}
+}
+
 UniqueKernelStack UniqueKernelStack::make() {
+	if(cachesEnabled.load(std::memory_order_relaxed)) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto cache = &kernelStackCache.get();
+		auto lock = frg::guard(&cache->mutex);
+		if(cache->count)
+			return UniqueKernelStack(cache->stacks[--cache->count]);
+	}
+
 	size_t guardedSize = kSize + kPageSize;
 	auto pointer = KernelVirtualMemory::global().allocate(guardedSize);
 
@@ -25,38 +84,29 @@ UniqueKernelStack::~UniqueKernelStack() {
 	if(!_base)
 		return;
 
+	if(cachesEnabled.load(std::memory_order_relaxed) && !isMemoryLow()) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto cache = &kernelStackCache.get();
+		auto lock = frg::guard(&cache->mutex);
+		if(cache->count < KernelStackCache::capacity) {
+			cache->stacks[cache->count++] = _base;
+			return;
+		}
+	}
+
+	_release(_base);
+}
+
+void UniqueKernelStack::_release(char *base) {
 	size_t guardedSize = kSize + kPageSize;
-	auto address = reinterpret_cast<uintptr_t>(_base - guardedSize);
+	auto address = reinterpret_cast<uintptr_t>(base - guardedSize);
 	for(size_t offset = 0; offset < kSize; offset += kPageSize) {
 		PhysicalAddr physical = KernelPageSpace::global().unmapSingle4k(
 				address + guardedSize - kSize + offset);
 		physicalAllocator->free(physical, kPageSize);
 	}
 
-	struct Closure final : ShootNode {
-		void complete() override {
-			KernelVirtualMemory::global().deallocate(reinterpret_cast<void *>(address), size);
-			auto physical = thisPage;
-			Closure::~Closure();
-			asm volatile ("" : : : "memory");
-			physicalAllocator->free(physical, kPageSize);
-		}
-
-		PhysicalAddr thisPage;
-	};
-	static_assert(sizeof(Closure) <= kPageSize);
-
-	// We need some memory to store the closure that waits until shootdown completes.
-	// For now, our stategy consists of allocating one page of *physical* memory
-	// and accessing it through the global physical mapping.
-	auto physical = physicalAllocator->allocate(kPageSize);
-	PageAccessor accessor{physical};
-	auto p = new (accessor.get()) Closure;
-	p->thisPage = physical;
-	p->address = address;
-	p->size = guardedSize;
-	if(KernelPageSpace::global().submitShootdown(p))
-		p->complete();
+	KernelVirtualMemory::global().deallocateLazily(reinterpret_cast<void *>(address), guardedSize);
 }
 
 } //namespace thor
@@ -0,0 +1,15 @@
+#include <thor-internal/kernel-stats.hpp>
+
+namespace thor {
+
+THOR_DEFINE_PERCPU(kernelStatCounters);
+
+uint64_t sumKernelStat(KernelStat stat) {
+	uint64_t sum = 0;
+	for(size_t i = 0; i < getCpuCount(); i++)
+		sum += kernelStatCounters.getFor(i).counters[static_cast<int>(stat)]
+				.load(std::memory_order_relaxed);
+	return sum;
+}
+
+} // namespace thor
@@ -247,6 +247,17 @@ smarter::shared_ptr<KernletObject> processElfDso(const char *buffer,
 					infoLogger() << "    Read " << (unsigned int)value << frg::endlog;
 				return value;
 			};
+		uint16_t (*abi_mmio_read16)(const char *, ptrdiff_t) =
+			[] (const char *base, ptrdiff_t offset) -> uint16_t {
+				if(logIo)
+					infoLogger() << "__mmio_read16 on " << (void *)base
+							<< ", offset: " << offset << frg::endlog;
+				auto p = reinterpret_cast<const uint16_t *>(base + offset);
+				auto value = arch::mem_ops<uint16_t>::load(p);
+				if(logIo)
+					infoLogger() << "    Read " << (unsigned int)value << frg::endlog;
+				return value;
+			};
 		uint32_t (*abi_mmio_read32)(const char *, ptrdiff_t) =
 			[] (const char *base, ptrdiff_t offset) -> uint32_t {
 				if(logIo)
@@ -259,6 +270,16 @@ smarter::shared_ptr<KernletObject> processElfDso(const char *buffer,
 				return value;
 			};
 
+		void (*abi_mmio_write16)(char *, ptrdiff_t, uint16_t) =
+			[] (char *base, ptrdiff_t offset, uint16_t value) {
+				if(logIo)
+					infoLogger() << "__mmio_write16 on " << (void *)base
+							<< ", offset: " << offset << frg::endlog;
+				auto p = reinterpret_cast<uint16_t *>(base + offset);
+				arch::mem_ops<uint16_t>::store(p, value);
+				if(logIo)
+					infoLogger() << "    Wrote " << value << frg::endlog;
+			};
 		void (*abi_mmio_write32)(char *, ptrdiff_t, uint32_t) =
 			[] (char *base, ptrdiff_t offset, uint32_t value) {
 				if(logIo)
@@ -289,8 +310,12 @@ smarter::shared_ptr<KernletObject> processElfDso(const char *buffer,
 		if(name == "__mmio_read8")
 #endif
 			return reinterpret_cast<void *>(abi_mmio_read8);
+		else if(name == "__mmio_read16")
+			return reinterpret_cast<void *>(abi_mmio_read16);
 		else if(name == "__mmio_read32")
 			return reinterpret_cast<void *>(abi_mmio_read32);
+		else if(name == "__mmio_write16")
+			return reinterpret_cast<void *>(abi_mmio_write16);
 		else if(name == "__mmio_write32")
 			return reinterpret_cast<void *>(abi_mmio_write32);
 		else if(name == "__trigger_bitset")
@@ -1,4 +1,6 @@
 #include <frg/unique.hpp>
+#include <thor-internal/arch-generic/ints.hpp>
+#include <thor-internal/kernel-stats.hpp>
 #include <thor-internal/load-balancing.hpp>
 #include <thor-internal/timer.hpp>
 
@@ -16,8 +18,39 @@ constexpr uint64_t lbInterval = 100'000'000;
 constexpr uint64_t lbDecay = 184;
 constexpr uint64_t lbDecayInterval = 1'000'000'000;
 
+// Idle-time stealing and minimal interval between two steal attempts on the same CPU.
+constexpr bool enableIdleSteal = true;
+constexpr uint64_t lbIdleStealInterval = 1'000'000;
+
 frg::eternal<LoadBalancer> loadBalancer;
 
+// Returns the smallest scheduling domain that contains both CPUs.
+LbDomain domainBetween(CpuData *a, CpuData *b) {
+	if (a->packageId != b->packageId)
+		return LbDomain::system;
+	if (a->llcId != b->llcId)
+		return LbDomain::package;
+	if (a->coreId != b->coreId)
+		return LbDomain::llc;
+	return LbDomain::core;
+}
+
+// Additional imbalance that a migration within the given domain needs to remove.
+// Migrating out of the LLC loses the thread's cache footprint, hence we only do that
+// if it improves the balance by a sufficient margin.
+uint64_t migrationPenalty(LbDomain domain, uint64_t load) {
+	switch (domain) {
+	case LbDomain::core:
+	case LbDomain::llc:
+		return 0;
+	case LbDomain::package:
+		return load / 8;
+	case LbDomain::system:
+		return load / 4;
+	}
+	__builtin_unreachable();
+}
+
 } // namespace
 
 THOR_DEFINE_PERCPU(lbNode);
@@ -133,13 +166,18 @@ coroutine<void> LoadBalancer::run_(CpuData *cpu) {
 
 		if (enableLb) {
 			// Distribute load from other CPUs to this CPU.
+			// Pull from the closest CPUs first such that threads stay within their LLC
+			// (and within their package) whenever that suffices to balance the load.
 			// TODO: This loop probably does not scale very well since all CPUs try to pull from
 			//       all other CPUs in the same order (and this can cause lock contention).
 			uint64_t newLoad = thisNode->totalLoad;
-			for (size_t i = 0; i < getCpuCount(); ++i) {
-				auto *toCpu = getCpuData(i);
-				if (cpu != toCpu)
-					balanceBetween_(&lbNode.get(toCpu), thisNode, newLoad, idealLoad);
+			for (int d = 0; d < numLbDomains; ++d) {
+				auto domain = static_cast<LbDomain>(d);
+				for (size_t i = 0; i < getCpuCount(); ++i) {
+					auto *toCpu = getCpuData(i);
+					if (cpu != toCpu && domainBetween(cpu, toCpu) == domain)
+						balanceBetween_(&lbNode.get(toCpu), thisNode, newLoad, idealLoad, domain);
+				}
 			}
 		}
 
@@ -152,14 +190,111 @@ coroutine<void> LoadBalancer::run_(CpuData *cpu) {
 	co_return;
 }
 
-void LoadBalancer::balanceBetween_(LbNode *srcNode, LbNode *dstNode, uint64_t &newLoad, uint64_t idealLoad) {
-	auto improvesBalance = [] (uint64_t srcLoad, uint64_t dstLoad, uint64_t stolenLoad) -> bool {
+void LoadBalancer::stealOnIdle(CpuData *cpu) {
+	assert(!intsAreEnabled());
+	if (!enableLb || !enableIdleSteal)
+		return;
+
+	auto *thisNode = &lbNode.get(cpu);
+	if (!thisNode->cpu)
+		return;
+
+	// Rate limit the steal attempts. Since each attempt takes the locks of all nodes,
+	// we do not want CPUs that frequently go idle to do this on every reschedule.
+	auto now = getClockNanos();
+	if (now - thisNode->lastIdleSteal < lbIdleStealInterval)
+		return;
+	thisNode->lastIdleSteal = now;
+
+	auto irqLock = frg::guard(&irqMutex());
+
+	// Find the busiest node within each scheduling domain.
+	LbNode *busiest[numLbDomains]{};
+	uint64_t busiestLoad[numLbDomains]{};
+	for (size_t i = 0; i < getCpuCount(); ++i) {
+		auto *node = &lbNode.getFor(i);
+		if (node == thisNode || !node->cpu)
+			continue;
+
+		auto d = static_cast<int>(domainBetween(cpu, node->cpu));
+		auto lock = frg::guard(&node->mutex);
+		if (node->currentLoad > busiestLoad[d]) {
+			busiest[d] = node;
+			busiestLoad[d] = node->currentLoad;
+		}
+	}
+
+	// Steal from the closest domain that has a thread to spare.
+	for (int d = 0; d < numLbDomains; ++d) {
+		if (busiest[d] && stealFrom_(busiest[d], thisNode, static_cast<LbDomain>(d)))
+			return;
+	}
+}
+
+bool LoadBalancer::stealFrom_(LbNode *srcNode, LbNode *thisNode, LbDomain domain) {
+	auto *cpu = thisNode->cpu;
+
+	// Since this CPU is idle, the load that it carries is not runnable right now.
+	// Pull a single thread whose move reduces the maximal load, i.e., a thread that
+	// does not account for all of srcNode's load (plus the migration penalty).
+	LbControlBlock *stolen = nullptr;
+	{
+		auto lock = frg::guard(&srcNode->mutex);
+
+		for (auto it = srcNode->tasks.begin(); it != srcNode->tasks.end(); ++it) {
+			auto *cb = *it;
+			if (!cb->load_
+					|| cb->load_ + migrationPenalty(domain, cb->load_) >= srcNode->currentLoad)
+				continue;
+			if (!cb->inAffinityMask(cpu->cpuIndex))
+				continue;
+
+			// Prefer the thread that brings both loads closest to each other.
+			if (stolen && frg::max(cb->load_, srcNode->currentLoad - cb->load_)
+					>= frg::max(stolen->load_, srcNode->currentLoad - stolen->load_))
+				continue;
+			stolen = cb;
+		}
+
+		if (!stolen)
+			return false;
+
+		if (debugLb)
+			infoLogger() << "Idle CPU " << cpu->cpuIndex << " steals thread with load "
+					<< stolen->load_ << " from CPU " << srcNode->cpu->cpuIndex << frg::endlog;
+
+		// Move ownership from srcNode to thisNode.
+		// The thread itself migrates the next time that it passes through a preemption point
+		// on its current CPU (see Thread::handlePreemption()).
+		assert(stolen->node_ == srcNode);
+		srcNode->tasks.erase(srcNode->tasks.iterator_to(stolen));
+		stolen->node_ = thisNode;
+		stolen->_assignedCpu.store(cpu, std::memory_order_relaxed);
+		srcNode->currentLoad -= stolen->load_;
+	}
+
+	{
+		auto lock = frg::guard(&thisNode->mutex);
+
+		thisNode->tasks.push_back(stolen);
+		thisNode->currentLoad += stolen->load_;
+	}
+
+	// Make sure that the source CPU reconsiders its schedule soon.
+	sendPingIpi(srcNode->cpu);
+	countKernelStat(KernelStat::ipisSent);
+	return true;
+}
+
+void LoadBalancer::balanceBetween_(LbNode *srcNode, LbNode *dstNode, uint64_t &newLoad,
+		uint64_t idealLoad, LbDomain domain) {
+	auto improvesBalance = [domain] (uint64_t srcLoad, uint64_t dstLoad, uint64_t stolenLoad) -> bool {
 		uint64_t srcLoadPostMove = srcLoad - stolenLoad;
 		uint64_t dstLoadPostMove = dstLoad + stolenLoad;
 
 		uint64_t maxLoad = frg::max(srcLoad, dstLoad);
 		uint64_t maxLoadPostMove = frg::max(srcLoadPostMove, dstLoadPostMove);
-		return maxLoadPostMove < maxLoad;
+		return maxLoadPostMove + migrationPenalty(domain, stolenLoad) < maxLoad;
 	};
 
 	// Remove tasks from srcNode, put them into a temporary list.
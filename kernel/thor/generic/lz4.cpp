@@ -0,0 +1,76 @@
+#include <string.h>
+#include <stdint.h>
+#include <thor-internal/lz4.hpp>
+
+namespace thor {
+
+frg::optional<size_t> lz4DecompressBlock(const void *src, size_t srcSize,
+		void *dest, size_t destCapacity) {
+	auto ip = static_cast<const uint8_t *>(src);
+	auto iend = ip + srcSize;
+	auto ostart = static_cast<uint8_t *>(dest);
+	auto op = ostart;
+	auto oend = ostart + destCapacity;
+
+	// Lengths of 15 are extended by a sequence of bytes, terminated by a byte != 255.
+	auto extendLength = [&] (size_t &length) -> bool {
+		uint8_t b;
+		do {
+			if(ip == iend)
+				return false;
+			b = *ip++;
+			length += b;
+		} while(b == 255);
+		return true;
+	};
+
+	while(true) {
+		if(ip == iend)
+			return frg::null_opt;
+		auto token = *ip++;
+
+		// Copy the literals.
+		size_t literalLength = token >> 4;
+		if(literalLength == 15 && !extendLength(literalLength))
+			return frg::null_opt;
+		if(literalLength > static_cast<size_t>(iend - ip)
+				|| literalLength > static_cast<size_t>(oend - op))
+			return frg::null_opt;
+		memcpy(op, ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+
+		// The last sequence of a block only consists of literals.
+		if(ip == iend)
+			break;
+
+		// Copy the match.
+		if(iend - ip < 2)
+			return frg::null_opt;
+		size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+		ip += 2;
+		if(!offset || offset > static_cast<size_t>(op - ostart))
+			return frg::null_opt;
+
+		size_t matchLength = token & 0xF;
+		if(matchLength == 15 && !extendLength(matchLength))
+			return frg::null_opt;
+		matchLength += 4;
+		if(matchLength > static_cast<size_t>(oend - op))
+			return frg::null_opt;
+
+		auto match = op - offset;
+		if(offset >= matchLength) {
+			memcpy(op, match, matchLength);
+		}else{
+			// The match overlaps with its own output; it has to be copied bytewise.
+			for(size_t i = 0; i < matchLength; ++i)
+				op[i] = match[i];
+		}
+		op += matchLength;
+	}
+
+	return static_cast<size_t>(op - ostart);
+}
+
+} // namespace thor
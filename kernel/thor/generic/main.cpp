@@ -13,10 +13,12 @@
 #include <thor-internal/irq.hpp>
 #include <thor-internal/kerncfg.hpp>
 #include <thor-internal/kernel-log.hpp>
+#include <thor-internal/kernel-stats.hpp>
 #include <thor-internal/kernlet.hpp>
 #include <thor-internal/load-balancing.hpp>
 #include <thor-internal/main.hpp>
 #include <thor-internal/module.hpp>
+#include <thor-internal/ostrace.hpp>
 #include <thor-internal/pci/pci.hpp>
 #include <thor-internal/physical.hpp>
 #include <thor-internal/profile.hpp>
@@ -103,6 +105,10 @@ extern "C" void thorInitialize() {
 	infoLogger() << "thor: Basic memory management is ready" << frg::endlog;
 
 	runBootCpuDataInitializers();
+	physicalAllocator->enableMagazines();
+	KernelAlloc::enableCaches();
+	KernelVirtualMemory::enableCaches();
+	UniqueKernelStack::enableCaches();
 	initializeAsidContext(getCpuData());
 }
 
@@ -143,16 +149,30 @@ void GlobalInitEngine::onRealizeEdge(initgraph::Edge *edge) {
 				<< " -> n" << edge->target() << ";" << frg::endlog;
 }
 
+namespace {
+	// Timestamp for the boot timeline. The clock is not available for the earliest tasks.
+	uint64_t bootTimestamp() {
+		if(!haveTimer())
+			return 0;
+		return getClockNanos() / 1000;
+	}
+}
+
 void GlobalInitEngine::preActivate(initgraph::Node *node) {
 	if(node->type() == initgraph::NodeType::task)
 		infoLogger() << "thor: Running task " << node->displayName()
-				<< frg::endlog;
+				<< " (t = " << bootTimestamp() << " us)" << frg::endlog;
 }
 
 void GlobalInitEngine::postActivate(initgraph::Node *node) {
-	if(node->type() == initgraph::NodeType::stage)
+	if(node->type() == initgraph::NodeType::stage) {
 		infoLogger() << "thor: Reached stage " << node->displayName()
-				<< frg::endlog;
+				<< " (t = " << bootTimestamp() << " us)" << frg::endlog;
+	}else if(node->type() == initgraph::NodeType::task && !node->concurrent()) {
+		// Concurrent tasks log their completion on their own fiber.
+		infoLogger() << "thor: Finished task " << node->displayName()
+				<< " (t = " << bootTimestamp() << " us)" << frg::endlog;
+	}
 }
 
 void GlobalInitEngine::reportUnreached(initgraph::Node *node) {
@@ -166,6 +186,68 @@ void GlobalInitEngine::onUnreached() {
 			" that could not be reached (circular dependencies?)" << frg::endlog;
 }
 
+struct GlobalInitEngine::Activation {
+	Activation(GlobalInitEngine *engine, initgraph::Node *node)
+	: engine{engine}, node{node} { }
+
+	GlobalInitEngine *engine;
+	initgraph::Node *node;
+	Activation *next = nullptr;
+};
+
+bool GlobalInitEngine::startActivation(initgraph::Node *node) {
+	if(!concurrencyEnabled_)
+		return false;
+
+	// Spread concurrent tasks over all CPUs (including our own).
+	// Note that APs are booted by a non-concurrent task, hence all CPUs are online here.
+	auto cpu = nextCpu_++ % getCpuCount();
+	infoLogger() << "thor: Dispatching task " << node->displayName()
+			<< " to CPU " << cpu << frg::endlog;
+
+	auto activation = frg::construct<Activation>(*kernelAlloc, this, node);
+	KernelFiber::run([activation] {
+		auto engine = activation->engine;
+		engine->activateNode(activation->node);
+		infoLogger() << "thor: Finished task " << activation->node->displayName()
+				<< " (t = " << bootTimestamp() << " us)" << frg::endlog;
+
+		FiberBlocker *waiter = nullptr;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&engine->completionMutex_);
+
+			activation->next = engine->completed_;
+			engine->completed_ = activation;
+			std::swap(waiter, engine->completionWaiter_);
+		}
+		if(waiter)
+			KernelFiber::unblockOther(waiter);
+	}, &localScheduler.getFor(cpu));
+	return true;
+}
+
+initgraph::Node *GlobalInitEngine::awaitActivation() {
+	while(true) {
+		FiberBlocker blocker;
+		blocker.setup();
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&completionMutex_);
+
+			if(auto activation = completed_; activation) {
+				completed_ = activation->next;
+				auto node = activation->node;
+				frg::destruct(*kernelAlloc, activation);
+				return node;
+			}
+			assert(!completionWaiter_);
+			completionWaiter_ = &blocker;
+		}
+		KernelFiber::blockCurrent(&blocker);
+	}
+}
+
 constinit GlobalInitEngine globalInitEngine;
 
 initgraph::Stage *getTaskingAvailableStage() {
@@ -207,12 +289,14 @@ extern "C" void thorMain() {
 		// Complete the system initialization.
 		initializeMbusStream();
 
-		// Run all other initgraph tasks.
+		// Run all other initgraph tasks. From now on, tasks can run concurrently.
+		globalInitEngine.enableConcurrency();
 		globalInitEngine.run();
 
 		// enableWakeups() requires all CPUs to be ready to handle IPIs.
 		// TODO: this could be avoided by changing SelfIpiCall to avoid IPIs on CPUs that are not yet ready.
 		getGlobalLogRing()->enableWakeups();
+		initializeLogDrain();
 		transitionBootFb();
 
 		pci::runAllBridges();
@@ -328,21 +412,34 @@ extern "C" void thorMain() {
 							frg::construct<MfsDirectory>(*kernelAlloc));
 				}else{
 					assert((mode & type_mask) == regular_type);
-	//				if(logInitialization)
-						debugLogger() << "thor: initrd file " << path << frg::endlog;
-
-					auto memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc,
-							(file_size + (kPageSize - 1)) & ~size_t{kPageSize - 1});
-					memory->selfPtr = memory;
-					auto copyOutcome = KernelFiber::asyncBlockCurrent(memory->copyTo(0,
-							data, file_size,
-							thisFiber()->associatedWorkQueue()->take()));
-					assert(copyOutcome);
-
 					auto name = frg::string<KernelAlloc>{*kernelAlloc,
 							path.sub_string(it - path.data(), end - it)};
-					dir->link(std::move(name), frg::construct<MfsRegular>(*kernelAlloc,
-							std::move(memory), file_size));
+
+					// Compressed files are only expanded once they are accessed.
+					// The initrd stays mapped, hence we can refer to its data.
+					if(file_size >= sizeof(CompressedModuleHeader)
+							&& !memcmp(data, compressedModuleMagic, sizeof(compressedModuleMagic))) {
+	//					if(logInitialization)
+							debugLogger() << "thor: initrd file " << path
+									<< " (compressed)" << frg::endlog;
+
+						dir->link(std::move(name), frg::construct<MfsRegular>(*kernelAlloc,
+								data, file_size));
+					}else{
+	//					if(logInitialization)
+							debugLogger() << "thor: initrd file " << path << frg::endlog;
+
+						auto memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc,
+								(file_size + (kPageSize - 1)) & ~size_t{kPageSize - 1});
+						memory->selfPtr = memory;
+						auto copyOutcome = KernelFiber::asyncBlockCurrent(memory->copyTo(0,
+								data, file_size,
+								thisFiber()->associatedWorkQueue()->take()));
+						assert(copyOutcome);
+
+						dir->link(std::move(name), frg::construct<MfsRegular>(*kernelAlloc,
+								std::move(memory), file_size));
+					}
 				}
 
 				p = data + ((file_size + 3) & ~uint32_t{3});
@@ -429,12 +526,30 @@ void handlePageFault(FaultImageAccessor image, uintptr_t address, Word errorCode
 	if(errorCode & kPfInstruction)
 		flags |= AddressSpace::kFaultExecute;
 
+	if(errorCode & kPfWrite) {
+		countKernelStat(KernelStat::writeFaults);
+	}else if(errorCode & kPfInstruction) {
+		countKernelStat(KernelStat::executeFaults);
+	}else{
+		countKernelStat(KernelStat::readFaults);
+	}
+	ostrace::tracepoint(ostrace::Tracepoint::pageFault, address, flags);
+
+	// Faults from user space are accounted as kernel time of the thread.
+	// Faults in the kernel domain are already covered by the syscall.
+	bool userFault = !image.inKernelDomain();
+	if(userFault)
+		this_thread->enterKernelTime();
 	auto wq = this_thread->pagingWorkQueue();
-	if(Thread::asyncBlockCurrent(
-			address_space->handleFault(address, flags, wq->take()), wq))
+	bool handled = Thread::asyncBlockCurrent(
+			address_space->handleFault(address, flags, wq->take()), wq);
+	if(userFault)
+		this_thread->leaveKernelTime();
+	if(handled)
 		return;
 
 	// If we get here, the page fault could not be handled.
+	countKernelStat(KernelStat::unresolvedFaults);
 
 	if(logUnhandledPageFaults) {
 		infoLogger() << "thor: Unhandled page fault"
@@ -499,6 +614,7 @@ void handleIrq(IrqImageAccessor image, IrqPin *irq) {
 
 	if(logEveryIrq)
 		infoLogger() << "thor: IRQ " << irq->name() << frg::endlog;
+	ostrace::tracepoint(ostrace::Tracepoint::irq, reinterpret_cast<uintptr_t>(irq));
 
 	irq->raise();
 
@@ -536,6 +652,13 @@ void handleSyscall(SyscallImageAccessor image) {
 		return;
 	}
 
+	this_thread->enterKernelTime();
+
+	// On some architectures, the error register aliases the syscall number.
+	Word number = *image.number();
+	ostrace::tracepoint(ostrace::Tracepoint::syscallEnter, number,
+			reinterpret_cast<uintptr_t>(this_thread.get()));
+
 	Word arg0 = *image.in0();
 	Word arg1 = *image.in1();
 	Word arg2 = *image.in2();
@@ -569,6 +692,10 @@ void handleSyscall(SyscallImageAccessor image) {
 				&out_handle);
 		*image.out0() = out_handle;
 	} break;
+	case kHelCallTransferDescriptors: {
+		*image.error() = helTransferDescriptors((const HelHandle *)arg0, (size_t)arg1,
+				(HelHandle)arg2, (HelHandle *)arg3);
+	} break;
 	case kHelCallDescriptorInfo: {
 		*image.error() = helDescriptorInfo((HelHandle)arg0, (HelDescriptorInfo *)arg1);
 	} break;
@@ -578,12 +705,21 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallCloseDescriptor: {
 		*image.error() = helCloseDescriptor((HelHandle)arg0, (HelHandle)arg1);
 	} break;
+	case kHelCallCloseDescriptors: {
+		*image.error() = helCloseDescriptors((HelHandle)arg0,
+				(const HelHandle *)arg1, (size_t)arg2);
+	} break;
 
 	case kHelCallCreateQueue: {
 		HelHandle handle;
 		*image.error() = helCreateQueue((const HelQueueParameters *)arg0, &handle);
 		*image.out0() = handle;
 	} break;
+	case kHelCallAddQueueChunks: {
+		uintptr_t offset;
+		*image.error() = helAddQueueChunks((HelHandle)arg0, (unsigned int)arg1, &offset);
+		*image.out0() = offset;
+	} break;
 	case kHelCallCancelAsync: {
 		*image.error() = helCancelAsync((HelHandle)arg0, (uint64_t)arg1);
 	} break;
@@ -652,6 +788,16 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallUnmapMemory: {
 		*image.error() = helUnmapMemory((HelHandle)arg0, (void *)arg1, (size_t)arg2);
 	} break;
+	case kHelCallDecommitMemory: {
+		*image.error() = helDecommitMemory((HelHandle)arg0, (void *)arg1, (size_t)arg2);
+	} break;
+	case kHelCallPopulateMemory: {
+		*image.error() = helPopulateMemory((HelHandle)arg0, (void *)arg1, (size_t)arg2,
+				(uint32_t)arg3);
+	} break;
+	case kHelCallQuerySpaceMemory: {
+		*image.error() = helQuerySpaceMemory((HelHandle)arg0, (HelSpaceMemoryInfo *)arg1);
+	} break;
 	case kHelCallSubmitSynchronizeSpace: {
 		*image.error() = helSubmitSynchronizeSpace((HelHandle)arg0, (void *)arg1, (size_t)arg2,
 				(HelHandle)arg3, (uintptr_t)arg4);
@@ -661,6 +807,12 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helPointerPhysical((void *)arg0, &physical);
 		*image.out0() = physical;
 	} break;
+	case kHelCallQueryPhysicalRanges: {
+		size_t numRanges;
+		*image.error() = helQueryPhysicalRanges((HelHandle)arg0, (uintptr_t)arg1,
+				(size_t)arg2, (HelPhysicalRange *)arg3, (size_t)arg4, &numRanges);
+		*image.out0() = numRanges;
+	} break;
 	case kHelCallSubmitReadMemory: {
 		*image.error() = helSubmitReadMemory((HelHandle)arg0, (uintptr_t)arg1,
 				(size_t)arg2, (void *)arg3,
@@ -706,6 +858,13 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helRunVirtualizedCpu((HelHandle)arg0, (HelVmexitReason*)arg1);
 		break;
 	}
+	case kHelCallAddVmIoTrigger: {
+		*image.error() = helAddVmIoTrigger((HelHandle)arg0, (const HelVmIoTrigger *)arg1,
+				(HelHandle)arg2);
+	} break;
+	case kHelCallRemoveVmIoTrigger: {
+		*image.error() = helRemoveVmIoTrigger((HelHandle)arg0, (const HelVmIoTrigger *)arg1);
+	} break;
 	case kHelCallGetRandomBytes: {
 		size_t actualSize;
 		*image.error() = helGetRandomBytes((void *)arg0, (size_t)arg1, &actualSize);
@@ -723,6 +882,22 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallSetPriority: {
 		*image.error() = helSetPriority((HelHandle)arg0, (int)arg1);
 	} break;
+	case kHelCallSetLatencyClass: {
+		*image.error() = helSetLatencyClass((HelHandle)arg0, (int)arg1,
+				(uint64_t)arg2, (uint64_t)arg3);
+	} break;
+	case kHelCallCreateScheduleGroup: {
+		HelHandle handle;
+		*image.error() = helCreateScheduleGroup((HelHandle)arg0, &handle);
+		*image.out0() = handle;
+	} break;
+	case kHelCallConfigureScheduleGroup: {
+		*image.error() = helConfigureScheduleGroup((HelHandle)arg0,
+				(const HelScheduleGroupParams *)arg1);
+	} break;
+	case kHelCallSetScheduleGroup: {
+		*image.error() = helSetScheduleGroup((HelHandle)arg0, (HelHandle)arg1);
+	} break;
 	case kHelCallYield: {
 		*image.error() = helYield();
 	} break;
@@ -745,6 +920,12 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallStoreRegisters: {
 		*image.error() = helStoreRegisters((HelHandle)arg0, (int)arg1, (const void *)arg2);
 	} break;
+	case kHelCallPushSignalFrame: {
+		uintptr_t address;
+		*image.error() = helPushSignalFrame((HelHandle)arg0,
+				(const HelSignalFrame *)arg1, &address);
+		*image.out0() = address;
+	} break;
 	case kHelCallWriteFsBase: {
 		*image.error() = helWriteFsBase((void *)arg0);
 	} break;
@@ -772,6 +953,12 @@ void handleSyscall(SyscallImageAccessor image) {
 				(HelHandle)arg1, (uintptr_t)arg2, &async_id);
 		*image.out0() = async_id;
 	} break;
+	case kHelCallSubmitAwaitClockSlack: {
+		uint64_t async_id;
+		*image.error() = helSubmitAwaitClockSlack((uint64_t)arg0, (uint64_t)arg1,
+				(HelHandle)arg2, (uintptr_t)arg3, &async_id);
+		*image.out0() = async_id;
+	} break;
 
 	case kHelCallCreateStream: {
 		HelHandle lane1;
@@ -784,6 +971,9 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helSubmitAsync((HelHandle)arg0, (HelAction *)arg1,
 				(size_t)arg2, (HelHandle)arg3, (uintptr_t)arg4, (uint32_t)arg5);
 	} break;
+	case kHelCallSubmitRing: {
+		*image.error() = helSubmitRing((HelHandle)arg0);
+	} break;
 	case kHelCallShutdownLane: {
 		*image.error() = helShutdownLane((HelHandle)arg0);
 	} break;
@@ -794,6 +984,21 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallFutexWake: {
 		*image.error() = helFutexWake((int *)arg0);
 	} break;
+	case kHelCallFutexRequeue: {
+		*image.error() = helFutexRequeue((int *)arg0, (int)arg1, (int *)arg2,
+				(unsigned int)arg3, (unsigned int)arg4);
+	} break;
+	case kHelCallFutexWaitVector: {
+		size_t index;
+		*image.error() = helFutexWaitVector((const HelFutexWaitEntry *)arg0, (size_t)arg1,
+				(int64_t)arg2, &index);
+		*image.out0() = index;
+	} break;
+	case kHelCallFutexWakeCount: {
+		unsigned int woken;
+		*image.error() = helFutexWakeCount((int *)arg0, (unsigned int)arg1, &woken);
+		*image.out0() = woken;
+	} break;
 
 	case kHelCallCreateOneshotEvent: {
 		HelHandle handle;
@@ -808,6 +1013,15 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallRaiseEvent: {
 		*image.error() = helRaiseEvent((HelHandle)arg0);
 	} break;
+	case kHelCallCreateMemoryPressureEvent: {
+		HelHandle handle;
+		*image.error() = helCreateMemoryPressureEvent(
+				(const HelMemoryPressureWatermarks *)arg0, &handle);
+		*image.out0() = handle;
+	} break;
+	case kHelCallQueryMemoryPressure: {
+		*image.error() = helQueryMemoryPressure((HelMemoryPressureInfo *)arg0);
+	} break;
 	case kHelCallAccessIrq: {
 		HelHandle handle;
 		*image.error() = helAccessIrq((int)arg0, &handle);
@@ -823,6 +1037,9 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallAutomateIrq: {
 		*image.error() = helAutomateIrq((HelHandle)arg0, (uint32_t)arg1, (HelHandle)arg2);
 	} break;
+	case kHelCallModerateIrq: {
+		*image.error() = helModerateIrq((HelHandle)arg0, (unsigned int)arg1, (uint64_t)arg2);
+	} break;
 
 	case kHelCallAccessIo: {
 		HelHandle handle;
@@ -854,6 +1071,9 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helGetCurrentCpu(&cpu);
 		*image.out0() = (Word)cpu;
 	} break;
+	case kHelCallQueryKernelStats: {
+		*image.error() = helQueryKernelStats((HelKernelStats *)arg0);
+	} break;
 
 	case kHelCallQueryRegisterInfo: {
 		*image.error() = helQueryRegisterInfo((int)arg0, (HelRegisterInfo *)arg1);
@@ -872,6 +1092,11 @@ void handleSyscall(SyscallImageAccessor image) {
 	// Run more worklets that were posted by the syscall.
 	this_thread->mainWorkQueue()->run();
 
+	this_thread->leaveKernelTime();
+
+	ostrace::tracepoint(ostrace::Tracepoint::syscallExit, number,
+			reinterpret_cast<uintptr_t>(this_thread.get()));
+
 	// Note: Thread::raiseSignals() only returns if nothing needs to be raised.
 	//       Otherwise, it saves the syscall image and suspends this thread.
 	Thread::raiseSignals(image);
@@ -0,0 +1,169 @@
+#include <async/recurring-event.hpp>
+#include <frg/eternal.hpp>
+#include <frg/list.hpp>
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/kernel-locks.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/memory-pressure.hpp>
+#include <thor-internal/physical.hpp>
+#include <thor-internal/timer.hpp>
+
+namespace thor {
+
+namespace {
+
+constexpr bool logPressure = false;
+
+// Interval in which free memory is sampled while there are watchers.
+constexpr uint64_t samplingInterval = 50'000'000;
+
+MemoryPressure determineLevel(size_t freePages, size_t lowPages, size_t criticalPages,
+		MemoryPressure current) {
+	// Leaving a level requires some headroom. Otherwise, the level would flap if
+	// the amount of free memory stays close to a watermark.
+	auto clearlyAbove = [&] (size_t watermark) {
+		return freePages > watermark + watermark / 8;
+	};
+
+	if(freePages <= criticalPages)
+		return MemoryPressure::critical;
+	if(current == MemoryPressure::critical && !clearlyAbove(criticalPages))
+		return MemoryPressure::critical;
+	if(freePages <= lowPages)
+		return MemoryPressure::low;
+	if(current != MemoryPressure::none && !clearlyAbove(lowPages))
+		return MemoryPressure::low;
+	return MemoryPressure::none;
+}
+
+struct PressureWatcher {
+	PressureWatcher(smarter::weak_ptr<BitsetEvent> event, size_t lowPages, size_t criticalPages)
+	: event{std::move(event)}, lowPages{lowPages}, criticalPages{criticalPages} { }
+
+	smarter::weak_ptr<BitsetEvent> event;
+	size_t lowPages;
+	size_t criticalPages;
+	MemoryPressure level = MemoryPressure::none;
+	frg::default_list_hook<PressureWatcher> hook;
+};
+
+struct PressureMonitor {
+	static PressureMonitor &singleton() {
+		static frg::eternal<PressureMonitor> instance;
+		return instance.get();
+	}
+
+	void addWatcher(smarter::shared_ptr<BitsetEvent> event, size_t lowPages, size_t criticalPages) {
+		auto watcher = frg::construct<PressureWatcher>(*kernelAlloc,
+				event, lowPages, criticalPages);
+
+		// Report elevated pressure right away.
+		watcher->level = determineLevel(physicalAllocator->numFreePages(),
+				lowPages, criticalPages, MemoryPressure::none);
+		if(watcher->level != MemoryPressure::none)
+			event->trigger(uint32_t{1} << static_cast<int>(watcher->level));
+
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&mutex_);
+
+			watchers_.push_back(watcher);
+		}
+		numWatchers_.fetch_add(1, std::memory_order_relaxed);
+		watchersChanged_.raise();
+	}
+
+	void sample() {
+		auto freePages = physicalAllocator->numFreePages();
+
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex_);
+
+		auto it = watchers_.begin();
+		while(it != watchers_.end()) {
+			auto currentIt = it;
+			auto watcher = *currentIt;
+			++it;
+
+			auto event = watcher->event.lock();
+			if(!event) {
+				watchers_.erase(currentIt);
+				frg::destruct(*kernelAlloc, watcher);
+				numWatchers_.fetch_sub(1, std::memory_order_relaxed);
+				continue;
+			}
+
+			auto level = determineLevel(freePages, watcher->lowPages, watcher->criticalPages,
+					watcher->level);
+			if(level != watcher->level) {
+				if(logPressure)
+					infoLogger() << "thor: Memory pressure changes to level "
+							<< static_cast<int>(level) << " (" << freePages
+							<< " free pages)" << frg::endlog;
+				watcher->level = level;
+				event->trigger(uint32_t{1} << static_cast<int>(level));
+			}
+		}
+	}
+
+	void run() {
+		KernelFiber::run([this] {
+			while(true) {
+				// Do not wake up periodically if nobody is interested.
+				KernelFiber::asyncBlockCurrent(watchersChanged_.async_wait_if([this] () -> bool {
+					return !numWatchers_.load(std::memory_order_relaxed);
+				}));
+
+				sample();
+				KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(samplingInterval));
+			}
+		});
+	}
+
+private:
+	TicketSpinlock mutex_;
+
+	frg::intrusive_list<
+		PressureWatcher,
+		frg::locate_member<
+			PressureWatcher,
+			frg::default_list_hook<PressureWatcher>,
+			&PressureWatcher::hook
+		>
+	> watchers_;
+
+	std::atomic<size_t> numWatchers_{0};
+	async::recurring_event watchersChanged_;
+};
+
+initgraph::Task initPressureMonitor{&globalInitEngine, "generic.init-memory-pressure",
+	initgraph::Requires{getFibersAvailableStage()},
+	[] {
+		PressureMonitor::singleton().run();
+	}
+};
+
+} // anonymous namespace
+
+size_t defaultLowPressureWatermark() {
+	return physicalAllocator->numTotalPages() * 3 / 8;
+}
+
+size_t defaultCriticalPressureWatermark() {
+	// MemoryReclaimer evicts once 3/4 of all pages are in use.
+	return physicalAllocator->numTotalPages() / 4;
+}
+
+MemoryPressure currentMemoryPressure() {
+	return determineLevel(physicalAllocator->numFreePages(),
+			defaultLowPressureWatermark(), defaultCriticalPressureWatermark(),
+			MemoryPressure::none);
+}
+
+void watchMemoryPressure(smarter::shared_ptr<BitsetEvent> event,
+		size_t lowPages, size_t criticalPages) {
+	assert(criticalPages <= lowPages);
+	PressureMonitor::singleton().addWatcher(std::move(event), lowPages, criticalPages);
+}
+
+} // namespace thor
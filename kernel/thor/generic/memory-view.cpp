@@ -1,6 +1,7 @@
 #include <thor-internal/address-space.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/fiber.hpp>
+#include <thor-internal/kernel-stack.hpp>
 #include <thor-internal/main.hpp>
 #include <thor-internal/memory-view.hpp>
 #include <thor-internal/physical.hpp>
@@ -15,12 +16,17 @@ namespace {
 	// The following flags are debugging options to debug the correctness of various components.
 	constexpr bool tortureUncaching = false;
 	constexpr bool disableUncaching = false;
+	constexpr bool disableCompression = false;
 }
 
 // --------------------------------------------------------
 // Reclaim implementation.
 // --------------------------------------------------------
 
+// Pages are managed by a two-list LRU scheme: newly registered pages are put on the
+// inactive list and are only promoted to the active list when they are accessed again.
+// Eviction only takes pages from the inactive list. Hence, a single streaming pass over
+// a large file does not evict the working set of pages that are accessed frequently.
 struct MemoryReclaimer {
 	void addPage(CachePage *page) {
 		auto irqLock = frg::guard(&irqMutex());
@@ -28,9 +34,16 @@ struct MemoryReclaimer {
 
 		assert(!(page->flags & CachePage::reclaimRegistered));
 
-		_lruList.push_back(page);
+		if(page->flags & CachePage::reclaimActive) {
+			_activeList.push_back(page);
+			_numActive++;
+			_balanceLists();
+		}else{
+			_inactiveList.push_back(page);
+			_numInactive++;
+		}
 		page->flags |= CachePage::reclaimRegistered;
-		_cachedSize += kPageSize;
+		_numCached++;
 	}
 
 	void removePage(CachePage *page) {
@@ -47,11 +60,10 @@ struct MemoryReclaimer {
 
 			page->flags &= ~(CachePage::reclaimPosted | CachePage::reclaimInflight);
 		}else{
-			auto it = _lruList.iterator_to(page);
-			_lruList.erase(it);
-			_cachedSize -= kPageSize;
+			_unlinkPage(page);
 		}
 		page->flags &= ~CachePage::reclaimRegistered;
+		_numCached--;
 	}
 
 	void bumpPage(CachePage *page) {
@@ -67,13 +79,35 @@ struct MemoryReclaimer {
 			}
 
 			page->flags &= ~(CachePage::reclaimPosted | CachePage::reclaimInflight);
-			_cachedSize += kPageSize;
 		}else{
-			auto it = _lruList.iterator_to(page);
-			_lruList.erase(it);
+			_unlinkPage(page);
 		}
 
-		_lruList.push_back(page);
+		// This is (at least) the second access to the page; promote it.
+		page->flags |= CachePage::reclaimActive;
+		_activeList.push_back(page);
+		_numActive++;
+		_balanceLists();
+	}
+
+	void countEviction() {
+		_numEvicted.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	ReclaimStatistics getStatistics() {
+		auto compressionStats = getCompressionStatistics();
+
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		return {
+			.cachedPages = _numCached,
+			.activePages = _numActive,
+			.inactivePages = _numInactive,
+			.evictedPages = _numEvicted.load(std::memory_order_relaxed),
+			.compressedPages = compressionStats.storedPages,
+			.compressedBytes = compressionStats.storedBytes
+		};
 	}
 
 	auto awaitReclaim(CacheBundle *bundle, async::cancellation_token ct = {}) {
@@ -91,18 +125,22 @@ struct MemoryReclaimer {
 		auto irqLock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&_mutex);
 
-		if(bundle->_reclaimList.empty())
-			return nullptr;
-
-		auto page = bundle->_reclaimList.pop_front();
-
-		assert(page->flags & CachePage::reclaimRegistered);
-		assert(page->flags & CachePage::reclaimPosted);
-		assert(!(page->flags & CachePage::reclaimInflight));
+		return _takeReclaimPage(bundle);
+	}
 
-		page->flags |= CachePage::reclaimInflight;
+	// Like reclaimPage() but calls f(page) while the reclaimer's lock is still held.
+	// This is required for bundles that do not protect their pages by a lock.
+	// Returns false if there is no page to reclaim.
+	template<typename F>
+	bool reclaimPageWith(CacheBundle *bundle, F f) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
 
-		return page;
+		auto page = _takeReclaimPage(bundle);
+		if(!page)
+			return false;
+		f(page);
+		return true;
 	}
 
 	void runReclaimFiber() {
@@ -113,7 +151,7 @@ struct MemoryReclaimer {
 			auto irqLock = frg::guard(&irqMutex());
 			auto lock = frg::guard(&_mutex);
 
-			if(_lruList.empty())
+			if(_inactiveList.empty() && _activeList.empty())
 				return false;
 
 			if(!tortureUncaching) {
@@ -129,14 +167,18 @@ struct MemoryReclaimer {
 				}
 			}
 
-			auto page = _lruList.pop_front();
+			// Only evict from the inactive list. If it is empty, we need to demote an active page.
+			if(_inactiveList.empty())
+				_demotePage();
+			auto page = _inactiveList.pop_front();
+			_numInactive--;
 
 			assert(page->flags & CachePage::reclaimRegistered);
 			assert(!(page->flags & CachePage::reclaimPosted));
 			assert(!(page->flags & CachePage::reclaimInflight));
+			assert(!(page->flags & CachePage::reclaimActive));
 
 			page->flags |= CachePage::reclaimPosted;
-			_cachedSize -= kPageSize;
 
 			page->bundle->_reclaimList.push_back(page);
 			page->bundle->_reclaimEvent.raise();
@@ -147,12 +189,20 @@ struct MemoryReclaimer {
 		KernelFiber::run([=, this] {
 			while(true) {
 				if(logUncaching) {
-					auto irqLock = frg::guard(&irqMutex());
-					auto lock = frg::guard(&_mutex);
-					infoLogger() << "thor: " << (_cachedSize / 1024)
-							<< " KiB of cached pages" << frg::endlog;
+					auto stats = getStatistics();
+					infoLogger() << "thor: " << (stats.cachedPages * kPageSize / 1024)
+							<< " KiB of cached pages (" << stats.activePages << " active, "
+							<< stats.inactivePages << " inactive, "
+							<< stats.evictedPages << " evicted), "
+							<< stats.compressedPages << " compressed pages in "
+							<< (stats.compressedBytes / 1024) << " KiB" << frg::endlog;
 				}
 
+				// Cached kernel stacks are cheap to recreate, so release them first.
+				if(!disableUncaching && physicalAllocator->numUsedPages()
+						>= physicalAllocator->numTotalPages() * 3 / 4)
+					UniqueKernelStack::trimCaches();
+
 				while(checkReclaim())
 					;
 				if(tortureUncaching) {
@@ -165,30 +215,91 @@ struct MemoryReclaimer {
 	}
 
 private:
-	frg::ticket_spinlock _mutex;
-
-	frg::intrusive_list<
+	using LruList = frg::intrusive_list<
 		CachePage,
 		frg::locate_member<
 			CachePage,
 			frg::default_list_hook<CachePage>,
 			&CachePage::listHook
 		>
-	> _lruList;
+	>;
+
+	CachePage *_takeReclaimPage(CacheBundle *bundle) {
+		if(bundle->_reclaimList.empty())
+			return nullptr;
+
+		auto page = bundle->_reclaimList.pop_front();
+
+		assert(page->flags & CachePage::reclaimRegistered);
+		assert(page->flags & CachePage::reclaimPosted);
+		assert(!(page->flags & CachePage::reclaimInflight));
+
+		page->flags |= CachePage::reclaimInflight;
 
-	size_t _cachedSize = 0;
+		return page;
+	}
+
+	// Removes a page from the active or inactive list (depending on its flags).
+	void _unlinkPage(CachePage *page) {
+		if(page->flags & CachePage::reclaimActive) {
+			_activeList.erase(_activeList.iterator_to(page));
+			_numActive--;
+		}else{
+			_inactiveList.erase(_inactiveList.iterator_to(page));
+			_numInactive--;
+		}
+	}
+
+	// Moves the least recently used active page to the inactive list.
+	void _demotePage() {
+		assert(!_activeList.empty());
+		auto page = _activeList.pop_front();
+		_numActive--;
+
+		assert(page->flags & CachePage::reclaimActive);
+		page->flags &= ~CachePage::reclaimActive;
+		_inactiveList.push_back(page);
+		_numInactive++;
+	}
+
+	// Ensure that the active list does not grow larger than the inactive list.
+	// Otherwise, pages that were hot once would never become candidates for eviction.
+	void _balanceLists() {
+		while(_numActive > _numInactive + 1)
+			_demotePage();
+	}
+
+	TicketSpinlock _mutex;
+
+	LruList _activeList;
+	LruList _inactiveList;
+
+	size_t _numCached = 0;
+	size_t _numActive = 0;
+	size_t _numInactive = 0;
+	std::atomic<uint64_t> _numEvicted{0};
 };
 
 static frg::manual_box<MemoryReclaimer> globalReclaimer;
 
+// All pages of CopyOnWriteMemory objects share one bundle.
+// They are compressed by a single coroutine, see CopyOnWriteMemory::runReclaim().
+static frg::eternal<CacheBundle> anonymousBundle;
+
 static initgraph::Task initReclaim{&globalInitEngine, "generic.init-reclaim",
 	initgraph::Requires{getFibersAvailableStage()},
 	[] {
 		globalReclaimer.initialize();
 		globalReclaimer->runReclaimFiber();
+		if(!disableCompression)
+			CopyOnWriteMemory::runReclaim();
 	}
 };
 
+ReclaimStatistics getReclaimStatistics() {
+	return globalReclaimer->getStatistics();
+}
+
 // --------------------------------------------------------
 // MemoryView.
 // --------------------------------------------------------
@@ -331,6 +442,11 @@ bool MemoryView::asyncLockRange(uintptr_t offset, size_t size,
 	return true;
 }
 
+size_t MemoryView::peekContiguousRange(uintptr_t) {
+	// By default, we cannot make any guarantees beyond a single page.
+	return kPageSize;
+}
+
 coroutine<frg::expected<Error>>
 MemoryView::touchRange(uintptr_t offset, size_t size,
 		FetchFlags flags, smarter::shared_ptr<WorkQueue> wq) {
@@ -342,6 +458,11 @@ MemoryView::touchRange(uintptr_t offset, size_t size,
 	co_return {};
 }
 
+coroutine<frg::expected<Error>>
+MemoryView::discardRange(uintptr_t, size_t, smarter::shared_ptr<WorkQueue>) {
+	co_return {};
+}
+
 Error MemoryView::updateRange(ManageRequest, size_t, size_t) {
 	return Error::illegalObject;
 }
@@ -436,6 +557,41 @@ smarter::shared_ptr<MemoryView> getZeroMemory() {
 	return singleton.get();
 }
 
+PhysicalAddr getZeroPage() {
+	static PhysicalAddr physical = [] {
+		auto physical = physicalAllocator->allocateZeroed();
+		assert(physical != PhysicalAddr(-1) && "OOM");
+		return physical;
+	}();
+	return physical;
+}
+
+coroutine<frg::expected<Error, size_t>>
+retrievePhysicalExtents(MemoryView *view, uintptr_t offset, size_t size, FetchFlags flags,
+		PhysicalExtent *extents, size_t &numExtents, size_t maxExtents,
+		smarter::shared_ptr<WorkQueue> wq) {
+	size_t progress = 0;
+	while(progress < size) {
+		auto misalign = (offset + progress) & (kPageSize - 1);
+		auto range = FRG_CO_TRY(co_await view->fetchRange(offset + progress - misalign,
+				flags, wq));
+		assert(range.get<1>() > misalign);
+		auto physical = range.get<0>() + misalign;
+		auto chunk = frg::min(range.get<1>() - misalign, size - progress);
+
+		if(numExtents && extents[numExtents - 1].physical
+				+ extents[numExtents - 1].size == physical) {
+			extents[numExtents - 1].size += chunk;
+		}else{
+			if(numExtents == maxExtents)
+				break;
+			extents[numExtents++] = {physical, chunk};
+		}
+		progress += chunk;
+	}
+	co_return progress;
+}
+
 // --------------------------------------------------------
 // ImmediateMemory
 // --------------------------------------------------------
@@ -461,26 +617,35 @@ ImmediateMemory::~ImmediateMemory() {
 }
 
 void ImmediateMemory::resize(size_t newSize, async::any_receiver<void> receiver) {
-	{
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&_mutex);
+	grow(newSize);
+	receiver.set_value();
+}
 
-		size_t currentNumPages = _physicalPages.size();
-		size_t newNumPages = (newSize + kPageSize - 1) >> kPageShift;
-		assert(newNumPages >= currentNumPages);
-		_physicalPages.resize(newNumPages);
-		for(size_t i = currentNumPages; i < newNumPages; ++i) {
-			auto physical = physicalAllocator->allocate(kPageSize, 64);
-			assert(physical != PhysicalAddr(-1) && "OOM when allocating ImmediateMemory");
+void ImmediateMemory::grow(size_t newSize) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
 
-			PageAccessor accessor{physical};
-			memset(accessor.get(), 0, kPageSize);
+	size_t currentNumPages = _physicalPages.size();
+	size_t newNumPages = (newSize + kPageSize - 1) >> kPageShift;
+	assert(newNumPages >= currentNumPages);
+	_physicalPages.resize(newNumPages);
+	for(size_t i = currentNumPages; i < newNumPages; ++i) {
+		auto physical = physicalAllocator->allocate(kPageSize, 64);
+		assert(physical != PhysicalAddr(-1) && "OOM when allocating ImmediateMemory");
 
-			_physicalPages[i] = physical;
-		}
+		PageAccessor accessor{physical};
+		memset(accessor.get(), 0, kPageSize);
+
+		_physicalPages[i] = physical;
 	}
+}
 
-	receiver.set_value();
+PhysicalAddr ImmediateMemory::_pageAt(size_t index) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	assert(index < _physicalPages.size());
+	return _physicalPages[index];
 }
 
 frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
@@ -532,6 +697,9 @@ size_t ImmediateMemory::getLength() {
 
 coroutine<frg::expected<Error, PhysicalAddr>> ImmediateMemory::takeGlobalFutex(uintptr_t offset,
 		smarter::shared_ptr<WorkQueue>) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
 	auto index = offset >> kPageShift;
 	if(index >= _physicalPages.size())
 		co_return Error::fault;
@@ -575,6 +743,11 @@ frg::tuple<PhysicalAddr, CachingMode> HardwareMemory::peekRange(uintptr_t offset
 	return frg::tuple<PhysicalAddr, CachingMode>{_base + offset, _cacheMode};
 }
 
+size_t HardwareMemory::peekContiguousRange(uintptr_t offset) {
+	assert(offset % kPageSize == 0);
+	return _length - offset;
+}
+
 coroutine<frg::expected<Error, PhysicalRange>>
 HardwareMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<WorkQueue>) {
 	assert(offset % kPageSize == 0);
@@ -595,9 +768,9 @@ size_t HardwareMemory::getLength() {
 // --------------------------------------------------------
 
 AllocatedMemory::AllocatedMemory(size_t desiredLngth,
-		int addressBits, size_t desiredChunkSize, size_t chunkAlign)
+		int addressBits, size_t desiredChunkSize, size_t chunkAlign, int numaNode)
 : _physicalChunks{*kernelAlloc},
-		_addressBits{addressBits}, _chunkAlign{chunkAlign} {
+		_addressBits{addressBits}, _chunkAlign{chunkAlign}, _numaNode{numaNode} {
 	static_assert(sizeof(unsigned long) == sizeof(uint64_t), "Fix use of __builtin_clzl");
 	_chunkSize = size_t(1) << (64 - __builtin_clzl(desiredChunkSize - 1));
 	if(_chunkSize != desiredChunkSize)
@@ -675,6 +848,21 @@ frg::tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekRange(uintptr_t offse
 			CachingMode::null};
 }
 
+size_t AllocatedMemory::peekContiguousRange(uintptr_t offset) {
+	assert(offset % kPageSize == 0);
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	auto index = offset / _chunkSize;
+	auto disp = offset & (_chunkSize - 1);
+	assert(index < _physicalChunks.size());
+
+	if(_physicalChunks[index] == PhysicalAddr(-1))
+		return 0;
+	return _chunkSize - disp;
+}
+
 coroutine<frg::expected<Error, PhysicalRange>>
 AllocatedMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<WorkQueue>) {
 	auto irq_lock = frg::guard(&irqMutex());
@@ -685,14 +873,20 @@ AllocatedMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<Wo
 	assert(index < _physicalChunks.size());
 
 	if(_physicalChunks[index] == PhysicalAddr(-1)) {
-		auto physical = physicalAllocator->allocate(_chunkSize, _addressBits);
-		assert(physical != PhysicalAddr(-1) && "OOM");
-		assert(!(physical & (_chunkAlign - 1)));
+		PhysicalAddr physical;
+		if(_chunkSize == kPageSize) {
+			physical = physicalAllocator->allocateZeroed(_addressBits, _numaNode);
+			assert(physical != PhysicalAddr(-1) && "OOM");
+		}else{
+			physical = physicalAllocator->allocate(_chunkSize, _addressBits, _numaNode);
+			assert(physical != PhysicalAddr(-1) && "OOM");
 
-		for(size_t pg_progress = 0; pg_progress < _chunkSize; pg_progress += kPageSize) {
-			PageAccessor accessor{physical + pg_progress};
-			memset(accessor.get(), 0, kPageSize);
+			for(size_t pg_progress = 0; pg_progress < _chunkSize; pg_progress += kPageSize) {
+				PageAccessor accessor{physical + pg_progress};
+				memset(accessor.get(), 0, kPageSize);
+			}
 		}
+		assert(!(physical & (_chunkAlign - 1)));
 		_physicalChunks[index] = physical;
 	}
 
@@ -774,6 +968,7 @@ ManagedSpace::ManagedSpace(size_t length, bool readahead)
 			if(logUncaching)
 				warningLogger() << "Evicting physical page" << frg::endlog;
 			physicalAllocator->free(physical, kPageSize);
+			globalReclaimer->countEviction();
 		}
 	}(this);
 }
@@ -925,6 +1120,48 @@ void ManagedSpace::_progressManagement(ManageList &pending) {
 	}
 }
 
+void ManagedSpace::_queueInitialization(size_t index) {
+	auto [pit, wasInserted] = pages.find_or_insert(index, this, index);
+	assert(pit);
+	if(pit->loadState == kStateMissing) {
+		pit->loadState = kStateWantInitialization;
+		_initializationList.push_back(&pit->cachePage);
+	}
+}
+
+void ManagedSpace::_updateReadahead(size_t index, bool miss) {
+	bool sequential = _readaheadWindow
+			&& index >= _readaheadStart && index <= _readaheadEnd;
+
+	size_t start;
+	if(miss) {
+		// Random accesses shrink the window again.
+		if(sequential) {
+			_readaheadWindow = frg::min(_readaheadWindow * 2, maxReadahead);
+		}else{
+			_readaheadWindow = minReadahead;
+		}
+		start = index;
+	}else if(index == _readaheadTrigger) {
+		_readaheadWindow = frg::min(_readaheadWindow * 2, maxReadahead);
+		start = _readaheadEnd;
+	}else{
+		return;
+	}
+
+	auto end = frg::min(start + _readaheadWindow, numPages);
+	for(size_t i = start; i < end; ++i)
+		_queueInitialization(i);
+
+	_readaheadStart = start;
+	_readaheadEnd = end;
+	if(start < end) {
+		_readaheadTrigger = start + (end - start) / 2;
+	}else{
+		_readaheadTrigger = static_cast<size_t>(-1);
+	}
+}
+
 void ManagedSpace::_progressMonitors(MonitorList &pending) {
 	// TODO: Accelerate this by storing the monitors in a RB tree ordered by their progress.
 	auto progressNode = [&] (MonitorNode *node) -> bool {
@@ -1184,6 +1421,7 @@ FrontalMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_pt
 	ManageList pendingManagement;
 	MonitorList pendingMonitors;
 	MonitorNode fetchMonitor;
+	PhysicalAddr fastPhysical = PhysicalAddr(-1);
 	{
 		auto irq_lock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&_managed->mutex);
@@ -1210,44 +1448,38 @@ FrontalMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_pt
 				globalReclaimer->addPage(&pit->cachePage);
 			}
 
-			co_return PhysicalRange{physical + misalign, kPageSize - misalign, CachingMode::null};
+			// If the access hits the readahead trigger, we queue the next window.
+			if(!_managed->readahead || index != _managed->_readaheadTrigger)
+				co_return PhysicalRange{physical + misalign, kPageSize - misalign, CachingMode::null};
+
+			_managed->_updateReadahead(index, false);
+			_managed->_progressManagement(pendingManagement);
+			fastPhysical = physical;
 		}else{
 			assert(pit->loadState == ManagedSpace::kStateMissing
 					|| pit->loadState == ManagedSpace::kStateWantInitialization
 					|| pit->loadState == ManagedSpace::kStateInitialization);
-		}
 
-		if(flags & fetchDisallowBacking) {
-			urgentLogger() << "thor: Backing of page is disallowed" << frg::endlog;
-			co_return Error::fault;
-		}
+			if(flags & fetchDisallowBacking) {
+				urgentLogger() << "thor: Backing of page is disallowed" << frg::endlog;
+				co_return Error::fault;
+			}
 
-		// We have to take the slow-path, i.e., perform the fetch asynchronously.
-		if(pit->loadState == ManagedSpace::kStateMissing) {
-			pit->loadState = ManagedSpace::kStateWantInitialization;
-			_managed->_initializationList.push_back(&pit->cachePage);
-		}
+			// We have to take the slow-path, i.e., perform the fetch asynchronously.
+			bool miss = pit->loadState == ManagedSpace::kStateMissing;
+			_managed->_queueInitialization(index);
 
-		// Perform readahead.
-		if(_managed->readahead)
-			for(size_t i = 1; i < 4; ++i) {
-				if(!(index + i < _managed->numPages))
-					break;
-				auto [pit, wasInserted] = _managed->pages.find_or_insert(
-						index + i, _managed.get(), index + i);
-				assert(pit);
-				if(pit->loadState == ManagedSpace::kStateMissing) {
-					pit->loadState = ManagedSpace::kStateWantInitialization;
-					_managed->_initializationList.push_back(&pit->cachePage);
-				}
-			}
+			// Perform readahead.
+			if(_managed->readahead)
+				_managed->_updateReadahead(index, miss);
 
-		_managed->_progressManagement(pendingManagement);
+			_managed->_progressManagement(pendingManagement);
 
-		fetchMonitor.setup(ManageRequest::initialize, offset, kPageSize);
-		fetchMonitor.progress = 0;
-		_managed->_monitorQueue.push_back(&fetchMonitor);
-		_managed->_progressMonitors(pendingMonitors);
+			fetchMonitor.setup(ManageRequest::initialize, offset, kPageSize);
+			fetchMonitor.progress = 0;
+			_managed->_monitorQueue.push_back(&fetchMonitor);
+			_managed->_progressMonitors(pendingMonitors);
+		}
 	}
 
 	while(!pendingManagement.empty()) {
@@ -1259,6 +1491,9 @@ FrontalMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_pt
 		node->event.raise();
 	}
 
+	if(fastPhysical != PhysicalAddr(-1))
+		co_return PhysicalRange{fastPhysical + misalign, kPageSize - misalign, CachingMode::null};
+
 	co_await fetchMonitor.event.wait();
 	assert(fetchMonitor.error() == Error::success);
 
@@ -1340,69 +1575,71 @@ void FrontalMemory::retireGlobalFutex(uintptr_t offset) {
 IndirectMemory::IndirectMemory(size_t numSlots)
 : indirections_{*kernelAlloc} {
 	indirections_.resize(numSlots);
+	for(size_t i = 0; i < numSlots; i++)
+		indirections_[i] = nullptr;
 }
 
 IndirectMemory::~IndirectMemory() {
-	// For now we do nothing when deallocating hardware memory.
+	// No readers can exist anymore, hence there is no need to retire the slots.
+	for(auto indirection : indirections_) {
+		if(!indirection)
+			continue;
+		indirection->memory->removeObserver(&indirection->observer);
+		frg::destruct(*kernelAlloc, indirection);
+	}
 }
 
 frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
 IndirectMemory::resolveGlobalFutex(uintptr_t offset) {
-	auto irqLock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&mutex_);
+	EpochGuard epochGuard;
 
 	auto slot = offset >> 32;
 	auto inSlotOffset = offset & ((uintptr_t(1) << 32) - 1);
-	if(slot >= indirections_.size())
+	auto indirection = loadIndirection_(slot);
+	if(!indirection)
 		return Error::fault;
-	if(!indirections_[slot])
-		return Error::fault;
-	return indirections_[slot]->memory->resolveGlobalFutex(inSlotOffset);
+	return indirection->memory->resolveGlobalFutex(inSlotOffset);
 }
 
 Error IndirectMemory::lockRange(uintptr_t offset, size_t size) {
-	auto irqLock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&mutex_);
+	EpochGuard epochGuard;
 
 	auto slot = offset >> 32;
 	auto inSlotOffset = offset & ((uintptr_t(1) << 32) - 1);
-	if(slot >= indirections_.size())
-		return Error::fault;
-	if(!indirections_[slot])
+	auto indirection = loadIndirection_(slot);
+	if(!indirection)
 		return Error::fault;
-	if(inSlotOffset + size > indirections_[slot]->size)
+	if(inSlotOffset + size > indirection->size)
 		return Error::fault;
-	return indirections_[slot]->memory->lockRange(indirections_[slot]->offset
+	return indirection->memory->lockRange(indirection->offset
 			+ inSlotOffset, size);
 }
 
 void IndirectMemory::unlockRange(uintptr_t offset, size_t size) {
-	auto irqLock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&mutex_);
+	EpochGuard epochGuard;
 
 	auto slot = offset >> 32;
 	auto inSlotOffset = offset & ((uintptr_t(1) << 32) - 1);
-	assert(slot < indirections_.size()); // TODO: Return Error::fault.
-	assert(indirections_[slot]); // TODO: Return Error::fault.
-	assert(inSlotOffset + size <= indirections_[slot]->size); // TODO: Return Error::fault.
-	return indirections_[slot]->memory->unlockRange(indirections_[slot]->offset
+	auto indirection = loadIndirection_(slot);
+	assert(indirection); // TODO: Return Error::fault.
+	assert(inSlotOffset + size <= indirection->size); // TODO: Return Error::fault.
+	return indirection->memory->unlockRange(indirection->offset
 			+ inSlotOffset, size);
 }
 
 frg::tuple<PhysicalAddr, CachingMode> IndirectMemory::peekRange(uintptr_t offset) {
-	auto irqLock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&mutex_);
+	EpochGuard epochGuard;
 
 	auto slot = offset >> 32;
 	auto inSlotOffset = offset & ((uintptr_t(1) << 32) - 1);
-	assert(slot < indirections_.size()); // TODO: Return Error::fault.
-	assert(indirections_[slot]); // TODO: Return Error::fault.
+	auto indirection = loadIndirection_(slot);
+	assert(indirection); // TODO: Return Error::fault.
 
-	auto physicalRange = indirections_[slot]->memory->peekRange(indirections_[slot]->offset
+	auto physicalRange = indirection->memory->peekRange(indirection->offset
 		+ inSlotOffset);
 
 	CachingMode cachingMode = CachingMode::null;
-	if(indirections_[slot]->flags & cacheWriteCombine)
+	if(indirection->flags & cacheWriteCombine)
 		cachingMode = CachingMode::writeCombine;
 
 	return {physicalRange.get<0>(), determineCachingMode(
@@ -1412,22 +1649,32 @@ frg::tuple<PhysicalAddr, CachingMode> IndirectMemory::peekRange(uintptr_t offset
 
 coroutine<frg::expected<Error, PhysicalRange>>
 IndirectMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_ptr<WorkQueue> wq) {
-	auto irqLock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&mutex_);
-
 	auto slot = offset >> 32;
 	auto inSlotOffset = offset & ((uintptr_t(1) << 32) - 1);
-	assert(slot < indirections_.size()); // TODO: Return Error::fault.
-	assert(indirections_[slot]); // TODO: Return Error::fault.
 
-	auto physicalRange = co_await indirections_[slot]->memory->fetchRange(indirections_[slot]->offset
-		+ inSlotOffset, flags, std::move(wq));
+	// We cannot stay in the critical section while we wait for the fetch.
+	// Take a reference to the slot's memory instead.
+	smarter::shared_ptr<MemoryView> memory;
+	uintptr_t memoryOffset;
+	CachingFlags cachingFlags;
+	{
+		EpochGuard epochGuard;
+
+		auto indirection = loadIndirection_(slot);
+		assert(indirection); // TODO: Return Error::fault.
+		memory = indirection->memory;
+		memoryOffset = indirection->offset;
+		cachingFlags = indirection->flags;
+	}
+
+	auto physicalRange = co_await memory->fetchRange(memoryOffset + inSlotOffset,
+			flags, std::move(wq));
 
 	if(!physicalRange)
 		co_return physicalRange;
 
 	CachingMode cachingMode = CachingMode::null;
-	if(indirections_[slot]->flags & cacheWriteCombine)
+	if(cachingFlags & cacheWriteCombine)
 		cachingMode = CachingMode::writeCombine;
 
 	co_return frg::tuple{physicalRange.value().get<0>(), physicalRange.value().get<1>(),
@@ -1435,15 +1682,14 @@ IndirectMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_p
 }
 
 void IndirectMemory::markDirty(uintptr_t offset, size_t size) {
-	auto irqLock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&mutex_);
+	EpochGuard epochGuard;
 
 	auto slot = offset >> 32;
 	auto inSlotOffset = offset & ((uintptr_t(1) << 32) - 1);
-	assert(slot < indirections_.size()); // TODO: Return Error::fault.
-	assert(indirections_[slot]); // TODO: Return Error::fault.
-	assert(inSlotOffset + size <= indirections_[slot]->size); // TODO: Return Error::fault.
-	indirections_[slot]->memory->markDirty(indirections_[slot]->offset
+	auto indirection = loadIndirection_(slot);
+	assert(indirection); // TODO: Return Error::fault.
+	assert(inSlotOffset + size <= indirection->size); // TODO: Return Error::fault.
+	indirection->memory->markDirty(indirection->offset
 			+ inSlotOffset, size);
 }
 
@@ -1453,16 +1699,27 @@ size_t IndirectMemory::getLength() {
 
 Error IndirectMemory::setIndirection(size_t slot, smarter::shared_ptr<MemoryView> memory,
 		uintptr_t offset, size_t size, CachingFlags flags) {
-	auto irqLock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&mutex_);
-
 	if(slot >= indirections_.size())
 		return Error::outOfBounds;
-	auto indirection = smarter::allocate_shared<IndirectionSlot>(*kernelAlloc,
+	auto indirection = frg::construct<IndirectionSlot>(*kernelAlloc,
 			this, slot, memory, offset, size, flags);
 	// TODO: start a coroutine to observe evictions.
 	memory->addObserver(&indirection->observer);
-	indirections_[slot] = std::move(indirection);
+
+	IndirectionSlot *previous;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex_);
+
+		previous = __atomic_exchange_n(&indirections_[slot], indirection, __ATOMIC_ACQ_REL);
+	}
+
+	if(previous)
+		epochRetire(&previous->epochNode, [] (EpochNode *base) {
+			auto previous = frg::container_of(base, &IndirectionSlot::epochNode);
+			previous->memory->removeObserver(&previous->observer);
+			frg::destruct(*kernelAlloc, previous);
+		});
 	return Error::success;
 }
 
@@ -1471,6 +1728,15 @@ Error IndirectMemory::setIndirection(size_t slot, smarter::shared_ptr<MemoryView
 // --------------------------------------------------------
 
 CowPage::~CowPage() {
+	if(reclaimTracked)
+		globalReclaimer->removePage(&cachePage);
+
+	if(state == CowState::zero || state == CowState::discarded)
+		return;
+	if(state == CowState::compressed) {
+		freeCompressedPage(compressed);
+		return;
+	}
 	assert(state == CowState::hasCopy);
 	assert(physical != PhysicalAddr(-1));
 	physicalAllocator->free(physical, kPageSize);
@@ -1480,14 +1746,20 @@ CopyOnWriteMemory::CopyOnWriteMemory(smarter::shared_ptr<MemoryView> view,
 		uintptr_t offset, size_t length,
 		smarter::shared_ptr<CowChain> chain)
 : MemoryView{&_evictQueue}, _view{std::move(view)},
-		_viewOffset{offset}, _length{length}, _copyChain{std::move(chain)},
+		_viewOffset{offset}, _length{length},
+		_zeroBacked{_view.get() == getZeroMemory().get()}, _copyChain{std::move(chain)},
 		_ownedPages{*kernelAlloc} {
 	assert(length);
 	assert(!(offset & (kPageSize - 1)));
 	assert(!(length & (kPageSize - 1)));
+
+	if(_copyChain)
+		_copyChain->_numHolders.fetch_add(1, std::memory_order_relaxed);
 }
 
 CopyOnWriteMemory::~CopyOnWriteMemory() {
+	if(_copyChain)
+		_copyChain->_numHolders.fetch_sub(1, std::memory_order_release);
 }
 
 size_t CopyOnWriteMemory::getLength() {
@@ -1512,6 +1784,18 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 		smarter::shared_ptr<CowChain> newChain;
 		frg::vector<frg::tuple<size_t, smarter::shared_ptr<CowPage>>, KernelAlloc> inProgressPages{*kernelAlloc};
 
+		// Pages in CowChains must be present. Since fork() is rare,
+		// we simply decompress pages synchronously.
+		auto restoreCompressedPage = [] (smarter::borrowed_ptr<CowPage> page) {
+			auto physical = physicalAllocator->allocate(kPageSize);
+			assert(physical != PhysicalAddr(-1) && "OOM");
+			decompressPage(page->compressed, physical);
+			freeCompressedPage(page->compressed);
+			page->compressed = nullptr;
+			page->state = CowState::hasCopy;
+			page->physical = physical;
+		};
+
 		auto doCopyOnePage = [&] (size_t pg, smarter::borrowed_ptr<CowPage> page) {
 			// The page is locked. We *need* to keep it in the old address space.
 			if(page->lockCount /*|| disableCow */) {
@@ -1530,14 +1814,19 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 				copyPage->physical = copyPhysical;
 				auto copyIt = forked->_ownedPages.insert(pg >> kPageShift);
 				*copyIt = copyPage;
+				forked->_trackPage(pg, copyPage.get());
 			}else{
 				auto physical = page->physical;
 				assert(physical != PhysicalAddr(-1));
 
+				// Pages in CowChains are never evicted.
+				self->_untrackPage(page.get());
+
 				// Update the chains.
 				auto pageOffset = self->_viewOffset + pg;
 				auto newIt = newChain->_pages.insert(pageOffset >> kPageShift);
 				*newIt = page.lock();
+				page->chainRefs.fetch_add(1, std::memory_order_relaxed);
 				self->_ownedPages.erase(pg >> kPageShift);
 			}
 		};
@@ -1550,9 +1839,13 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 			// To correct handle locks pages, we move only non-locked pages from
 			// the original mapping to the new chain.
 			auto curChain = self->_copyChain;
-			newChain = smarter::allocate_shared<CowChain>(*kernelAlloc);
+			newChain = smarter::allocate_shared<CowChain>(*kernelAlloc,
+					self->_viewOffset, self->_length);
 
 			// Update the original mapping
+			if(curChain)
+				curChain->_numHolders.fetch_sub(1, std::memory_order_release);
+			newChain->_numHolders.fetch_add(1, std::memory_order_relaxed);
 			self->_copyChain = newChain;
 
 			// Create a new mapping in the forked space.
@@ -1575,12 +1868,19 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 							assert(page->state == CowState::hasCopy);
 							auto newIt = newChain->_pages.insert(pageOffset >> kPageShift);
 							*newIt = page;
+							page->chainRefs.fetch_add(1, std::memory_order_relaxed);
 						}
 					}
 					continue;
 				}
 
 				auto page = *it;
+				// The forked mapping can map the zero page by itself.
+				// Discarded pages are read from the root view, just as missing pages.
+				if(page->state == CowState::zero || page->state == CowState::discarded)
+					continue;
+				if(page->state == CowState::compressed)
+					restoreCompressedPage(page);
 				if(page->state == CowState::inProgress) {
 					// We wait for the in progress pages later, as we
 					// need to drop the locks we're holding before
@@ -1618,6 +1918,9 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 
 			// Copy all the previously in progress pages now that they're done copying.
 			for (auto [pg, page] : inProgressPages) {
+				// The page might have been evicted again in the meantime.
+				if(page->state == CowState::compressed)
+					restoreCompressedPage(page);
 				assert(page->state == CowState::hasCopy);
 				doCopyOnePage(pg, page);
 			}
@@ -1648,6 +1951,8 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 			smarter::shared_ptr<MemoryView> view;
 			uintptr_t viewOffset;
 			smarter::shared_ptr<CowPage> cowPage;
+			smarter::shared_ptr<CowPage> adoptedPage;
+			CompressedPage *compressed = nullptr;
 			bool waitForCopy = false;
 			{
 				// If the page is present in our private chain, we just return it.
@@ -1655,27 +1960,45 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 				auto lock = frg::guard(&self->_mutex);
 
 				auto cowIt = self->_ownedPages.find(offset >> kPageShift);
-				if(cowIt) {
+				if(cowIt && (*cowIt)->state == CowState::compressed) {
+					// Decompress the page; concurrent faults wait for us.
+					cowPage = *cowIt;
+					cowPage->state = CowState::inProgress;
+					compressed = std::exchange(cowPage->compressed, nullptr);
+				}else if(cowIt && (*cowIt)->state != CowState::zero
+						&& (*cowIt)->state != CowState::discarded) {
 					cowPage = *cowIt;
 					if(cowPage->state == CowState::hasCopy) {
 						assert(cowPage->physical != PhysicalAddr(-1));
 
 						cowPage->lockCount++;
+						self->_untrackPage(cowPage.get());
 						progress += kPageSize;
 						continue;
 					}else{
 						assert(cowPage->state == CowState::inProgress);
+						// Lock the page already to keep it from being evicted again
+						// before we observe the result of the copy.
+						cowPage->lockCount++;
 						waitForCopy = true;
 					}
+				}else if(!cowIt && (adoptedPage = self->_adoptChainPage(offset))) {
+					adoptedPage->lockCount++;
+					progress += kPageSize;
+					continue;
 				}else{
-					chain = self->_copyChain;
+					// Zero pages and discarded pages mask the chain.
+					if(!cowIt)
+						chain = self->_copyChain;
 					view = self->_view;
 					viewOffset = self->_viewOffset;
 
 					// Otherwise we need to copy from the chain or from the root view.
+					// Locked pages are writable, so this also replaces the zero page.
 					cowPage = smarter::allocate_shared<CowPage>(*kernelAlloc);
 					cowPage->state = CowState::inProgress;
-					cowIt = self->_ownedPages.insert(offset >> kPageShift);
+					if(!cowIt)
+						cowIt = self->_ownedPages.insert(offset >> kPageShift);
 					*cowIt = cowPage;
 				}
 			}
@@ -1696,52 +2019,42 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 					co_await wq->schedule();
 				} while(stillWaiting);
 
-				{
-					auto irqLock = frg::guard(&irqMutex());
-					auto lock = frg::guard(&self->_mutex);
-
-					assert(cowPage->state == CowState::hasCopy);
-					cowPage->lockCount++;
-				}
 				progress += kPageSize;
 				continue;
 			}
 
-			PhysicalAddr physical = physicalAllocator->allocate(kPageSize);
-			assert(physical != PhysicalAddr(-1) && "OOM");
-			PageAccessor accessor{physical};
-
-			// Try to copy from a descendant CoW chain.
-			auto pageOffset = viewOffset + offset;
-			bool chainHasCopy = false;
-			if(chain) {
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&chain->_mutex);
-
-				if(auto it = chain->_pages.find(pageOffset >> kPageShift); it) {
-					auto page = *it;
-					// We can just copy synchronously here -- the descendant is not evicted.
-					assert(page->state == CowState::hasCopy);
-					auto srcPhysical = page->physical;
-					assert(srcPhysical != PhysicalAddr(-1));
-					auto srcAccessor = PageAccessor{srcPhysical};
-					memcpy(accessor.get(), srcAccessor.get(), kPageSize);
-					chainHasCopy = true;
+			PhysicalAddr physical;
+			if(compressed) {
+				// Compressed pages are not mapped, hence there is nothing to evict.
+				physical = physicalAllocator->allocate(kPageSize);
+				assert(physical != PhysicalAddr(-1) && "OOM");
+				decompressPage(compressed, physical);
+				freeCompressedPage(compressed);
+			}else{
+				auto pageOffset = viewOffset + offset;
+				physical = self->_copyFromChain(chain.get(), pageOffset);
+
+				// Copy from the root view.
+				if(physical == PhysicalAddr(-1)) {
+					if(self->_zeroBacked) {
+						physical = physicalAllocator->allocateZeroed();
+						assert(physical != PhysicalAddr(-1) && "OOM");
+					}else{
+						physical = physicalAllocator->allocate(kPageSize);
+						assert(physical != PhysicalAddr(-1) && "OOM");
+						PageAccessor accessor{physical};
+						// TODO: Handle errors here -- we need to drop the lock again.
+						auto copyOutcome = co_await view->copyFrom(pageOffset & ~(kPageSize - 1),
+								accessor.get(), kPageSize, wq);
+						assert(copyOutcome);
+					}
 				}
-			}
 
-			// Copy from the root view.
-			if(!chainHasCopy) {
-				// TODO: Handle errors here -- we need to drop the lock again.
-				auto copyOutcome = co_await view->copyFrom(pageOffset & ~(kPageSize - 1),
-						accessor.get(), kPageSize, wq);
-				assert(copyOutcome);
+				// To make CoW unobservable, we first need to evict the page here.
+				// TODO: enable read-only eviction.
+				co_await self->_evictQueue.evictRange(offset & ~(kPageSize - 1), kPageSize);
 			}
 
-			// To make CoW unobservable, we first need to evict the page here.
-			// TODO: enable read-only eviction.
-			co_await self->_evictQueue.evictRange(offset & ~(kPageSize - 1), kPageSize);
-
 			{
 				auto irqLock = frg::guard(&irqMutex());
 				auto lock = frg::guard(&self->_mutex);
@@ -1772,6 +2085,8 @@ void CopyOnWriteMemory::unlockRange(uintptr_t offset, size_t size) {
 		assert(page->state == CowState::hasCopy);
 		assert(page->lockCount > 0);
 		page->lockCount--;
+		if(!page->lockCount)
+			_trackPage((offset + pg) & ~(kPageSize - 1), page.get());
 	}
 }
 
@@ -1781,7 +2096,13 @@ frg::tuple<PhysicalAddr, CachingMode> CopyOnWriteMemory::peekRange(uintptr_t off
 
 	if(auto it = _ownedPages.find(offset >> kPageShift); it) {
 		auto page = *it;
-		assert(page->state == CowState::hasCopy);
+		if(page->state == CowState::zero)
+			return frg::tuple<PhysicalAddr, CachingMode>{getZeroPage(), CachingMode::null};
+		if(page->state != CowState::hasCopy)
+			return frg::tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
+		// The caller might map the page; this cancels the eviction.
+		if(page->evicting)
+			_trackPage(offset & ~(kPageSize - 1), page.get());
 		return frg::tuple<PhysicalAddr, CachingMode>{page->physical, CachingMode::null};
 	}
 
@@ -1789,11 +2110,13 @@ frg::tuple<PhysicalAddr, CachingMode> CopyOnWriteMemory::peekRange(uintptr_t off
 }
 
 coroutine<frg::expected<Error, PhysicalRange>>
-CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<WorkQueue> wq) {
+CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_ptr<WorkQueue> wq) {
 	smarter::shared_ptr<CowChain> chain;
 	smarter::shared_ptr<MemoryView> view;
 	uintptr_t viewOffset;
 	smarter::shared_ptr<CowPage> cowPage;
+	smarter::shared_ptr<CowPage> adoptedPage;
+	CompressedPage *compressed = nullptr;
 	bool waitForCopy = false;
 	{
 		// If the page is present in our private chain, we just return it.
@@ -1801,25 +2124,57 @@ CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<
 		auto lock = frg::guard(&_mutex);
 
 		auto cowIt = _ownedPages.find(offset >> kPageShift);
-		if(cowIt) {
+		if(cowIt && (*cowIt)->state == CowState::zero && (flags & fetchReadOnly)) {
+			co_return PhysicalRange{getZeroPage(), kPageSize, CachingMode::null};
+		}else if(cowIt && (*cowIt)->state == CowState::compressed) {
+			// Decompress the page; concurrent faults wait for us.
+			cowPage = *cowIt;
+			cowPage->state = CowState::inProgress;
+			compressed = std::exchange(cowPage->compressed, nullptr);
+		}else if(cowIt && (*cowIt)->state != CowState::zero
+				&& (*cowIt)->state != CowState::discarded) {
 			cowPage = *cowIt;
 			if(cowPage->state == CowState::hasCopy) {
 				assert(cowPage->physical != PhysicalAddr(-1));
 
+				// The page is about to be mapped again.
+				if(cowPage->reclaimTracked) {
+					globalReclaimer->bumpPage(&cowPage->cachePage);
+				}else if(cowPage->evicting) {
+					_trackPage(offset, cowPage.get());
+				}
 				co_return PhysicalRange{cowPage->physical, kPageSize, CachingMode::null};
 			}else{
 				assert(cowPage->state == CowState::inProgress);
+				// Keep the page from being evicted again until we return it.
+				cowPage->lockCount++;
 				waitForCopy = true;
 			}
+		}else if(!cowIt && (adoptedPage = _adoptChainPage(offset))) {
+			// There is no need to evict anything: only owned pages are ever mapped.
+			_trackPage(offset, adoptedPage.get());
+			co_return PhysicalRange{adoptedPage->physical, kPageSize, CachingMode::null};
+		}else if(!cowIt && (flags & fetchReadOnly) && _zeroBacked
+				&& !_chainHasPage(offset)) {
+			// Defer the allocation until the page is written.
+			cowPage = smarter::allocate_shared<CowPage>(*kernelAlloc);
+			cowPage->state = CowState::zero;
+			cowIt = _ownedPages.insert(offset >> kPageShift);
+			*cowIt = cowPage;
+			co_return PhysicalRange{getZeroPage(), kPageSize, CachingMode::null};
 		}else{
-			chain = _copyChain;
+			// Zero pages and discarded pages mask the chain.
+			if(!cowIt)
+				chain = _copyChain;
 			view = _view;
 			viewOffset = _viewOffset;
 
 			// Otherwise we need to copy from the chain or from the root view.
+			// This also replaces the zero page on write faults.
 			cowPage = smarter::allocate_shared<CowPage>(*kernelAlloc);
 			cowPage->state = CowState::inProgress;
-			cowIt = _ownedPages.insert(offset >> kPageShift);
+			if(!cowIt)
+				cowIt = _ownedPages.insert(offset >> kPageShift);
 			*cowIt = cowPage;
 		}
 	}
@@ -1840,41 +2195,51 @@ CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<
 			co_await wq->schedule();
 		} while(stillWaiting);
 
-		co_return PhysicalRange{cowPage->physical, kPageSize, CachingMode::null};
-	}
-
-	PhysicalAddr physical = physicalAllocator->allocate(kPageSize);
-	assert(physical != PhysicalAddr(-1) && "OOM");
-	PageAccessor accessor{physical};
+		PhysicalAddr physical;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
 
-	// Try to copy from a descendant CoW chain.
-	auto pageOffset = viewOffset + offset;
-	bool chainHasCopy = false;
-	if(chain) {
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&chain->_mutex);
-
-		if(auto it = chain->_pages.find(pageOffset >> kPageShift); it) {
-			auto page = *it;
-			// We can just copy synchronously here -- the descendant is not evicted.
-			assert(page->state == CowState::hasCopy);
-			auto srcPhysical = page->physical;
-			assert(srcPhysical != PhysicalAddr(-1));
-			auto srcAccessor = PageAccessor{srcPhysical};
-			memcpy(accessor.get(), srcAccessor.get(), kPageSize);
-			chainHasCopy = true;
+			assert(cowPage->state == CowState::hasCopy);
+			assert(cowPage->lockCount > 0);
+			physical = cowPage->physical;
+			cowPage->lockCount--;
+			if(!cowPage->lockCount)
+				_trackPage(offset, cowPage.get());
 		}
+		co_return PhysicalRange{physical, kPageSize, CachingMode::null};
 	}
 
-	// Copy from the root view.
-	if(!chainHasCopy) {
-		FRG_CO_TRY(co_await view->copyFrom(pageOffset & ~(kPageSize - 1),
-				accessor.get(), kPageSize, wq));
-	}
+	PhysicalAddr physical;
+	if(compressed) {
+		// Compressed pages are not mapped, hence there is nothing to evict.
+		physical = physicalAllocator->allocate(kPageSize);
+		assert(physical != PhysicalAddr(-1) && "OOM");
+		decompressPage(compressed, physical);
+		freeCompressedPage(compressed);
+	}else{
+		auto pageOffset = viewOffset + offset;
+		physical = _copyFromChain(chain.get(), pageOffset);
+
+		// Copy from the root view.
+		if(physical == PhysicalAddr(-1)) {
+			if(_zeroBacked) {
+				physical = physicalAllocator->allocateZeroed();
+				assert(physical != PhysicalAddr(-1) && "OOM");
+			}else{
+				physical = physicalAllocator->allocate(kPageSize);
+				assert(physical != PhysicalAddr(-1) && "OOM");
+				PageAccessor accessor{physical};
+				FRG_CO_TRY(co_await view->copyFrom(pageOffset & ~(kPageSize - 1),
+						accessor.get(), kPageSize, wq));
+			}
+		}
 
-	// To make CoW unobservable, we first need to evict the page here.
-	// TODO: enable read-only eviction.
-	co_await _evictQueue.evictRange(offset, kPageSize);
+		// To make CoW unobservable, we first need to evict the page here.
+		// This also unmaps the zero page if it was mapped before.
+		// TODO: enable read-only eviction.
+		co_await _evictQueue.evictRange(offset, kPageSize);
+	}
 
 	{
 		auto irqLock = frg::guard(&irqMutex());
@@ -1883,6 +2248,7 @@ CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<
 		assert(cowPage->state == CowState::inProgress);
 		cowPage->state = CowState::hasCopy;
 		cowPage->physical = physical;
+		_trackPage(offset, cowPage.get());
 	}
 	_copyEvent.raise();
 	co_return PhysicalRange{cowPage->physical, kPageSize, CachingMode::null};
@@ -1892,6 +2258,58 @@ void CopyOnWriteMemory::markDirty(uintptr_t, size_t) {
 	// We do not need to track dirty pages.
 }
 
+coroutine<frg::expected<Error>>
+CopyOnWriteMemory::discardRange(uintptr_t offset, size_t size, smarter::shared_ptr<WorkQueue>) {
+	assert(!(offset & (kPageSize - 1)));
+	assert(!(size & (kPageSize - 1)));
+	if(offset + size > _length)
+		co_return Error::outOfBounds;
+
+	// The pages have to stay alive until they are evicted from all mappings.
+	frg::vector<smarter::shared_ptr<CowPage>, KernelAlloc> droppedPages{*kernelAlloc};
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		for(size_t pg = 0; pg < size; pg += kPageSize) {
+			auto cowIt = _ownedPages.find((offset + pg) >> kPageShift);
+			if(cowIt) {
+				auto page = *cowIt;
+				// Zero pages and discarded pages already reflect the root view.
+				if(page->state == CowState::zero || page->state == CowState::discarded)
+					continue;
+				// Locked pages are in use by the kernel and pages that are currently
+				// being copied will be written concurrently anyway; we keep both.
+				if(page->lockCount || page->state == CowState::inProgress)
+					continue;
+				_untrackPage(page.get());
+				droppedPages.push(std::move(page));
+			}else if(auto adoptedPage = _adoptChainPage(offset + pg); adoptedPage) {
+				// No other mapping can observe the page; hence, we can free it.
+				droppedPages.push(std::move(adoptedPage));
+				cowIt = _ownedPages.find((offset + pg) >> kPageShift);
+			}
+
+			if(!_chainHasPage(offset + pg)) {
+				if(cowIt)
+					_ownedPages.erase((offset + pg) >> kPageShift);
+				continue;
+			}
+
+			// The CowChain is shared with other mappings. Mask its page such that
+			// subsequent faults read from the root view.
+			auto maskPage = smarter::allocate_shared<CowPage>(*kernelAlloc);
+			maskPage->state = _zeroBacked ? CowState::zero : CowState::discarded;
+			if(!cowIt)
+				cowIt = _ownedPages.insert((offset + pg) >> kPageShift);
+			*cowIt = std::move(maskPage);
+		}
+	}
+
+	co_await _evictQueue.evictRange(offset, size);
+	co_return {};
+}
+
 coroutine<frg::expected<Error, PhysicalAddr>> CopyOnWriteMemory::takeGlobalFutex(uintptr_t offset,
 		smarter::shared_ptr<WorkQueue> wq) {
 	// For now, we pick the trival implementation here.
@@ -1907,6 +2325,173 @@ void CopyOnWriteMemory::retireGlobalFutex(uintptr_t offset) {
 	unlockRange(offset & ~(kPageSize - 1), kPageSize);
 }
 
+void CopyOnWriteMemory::runReclaim() {
+	[] (enable_detached_coroutine = {}) -> void {
+		// The compressor's scratch buffers live in the coroutine frame.
+		PageCompressor compressor;
+
+		while(true) {
+			co_await globalReclaimer->awaitReclaim(&anonymousBundle.get());
+
+			// The page itself is only safe to access while the reclaimer's lock is held.
+			// Afterwards, we only compare against it.
+			CowPage *page = nullptr;
+			uintptr_t offset;
+			smarter::shared_ptr<CopyOnWriteMemory> self;
+			auto found = globalReclaimer->reclaimPageWith(&anonymousBundle.get(),
+					[&] (CachePage *cachePage) {
+				page = frg::container_of(cachePage, &CowPage::cachePage);
+				offset = cachePage->identity << kPageShift;
+				self = page->owner.lock();
+			});
+			if(!found)
+				continue;
+			// If the owner is being destructed, ~CowPage() unregisters the page.
+			if(!self)
+				continue;
+
+			smarter::shared_ptr<CowPage> cowPage;
+			PhysicalAddr physical;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&self->_mutex);
+
+				// The page might have been locked or moved to a CowChain in the meantime.
+				auto it = self->_ownedPages.find(offset >> kPageShift);
+				if(!it || it->get() != page || !page->reclaimTracked)
+					continue;
+				cowPage = *it;
+				assert(cowPage->state == CowState::hasCopy);
+				assert(!cowPage->lockCount);
+
+				self->_untrackPage(cowPage.get());
+				cowPage->evicting = true;
+				physical = cowPage->physical;
+			}
+
+			co_await self->_evictQueue.evictRange(offset, kPageSize);
+
+			// Any access to the page after this point clears the evicting flag.
+			auto compressed = compressor.compress(physical);
+
+			bool success = false;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&self->_mutex);
+
+				// Pages that do not compress well stay resident and are not registered
+				// with the reclaimer again until they are accessed.
+				if(cowPage->evicting && compressed) {
+					assert(cowPage->state == CowState::hasCopy);
+					cowPage->state = CowState::compressed;
+					cowPage->compressed = compressed;
+					cowPage->physical = PhysicalAddr(-1);
+					success = true;
+				}
+				cowPage->evicting = false;
+			}
+
+			if(!success) {
+				if(compressed)
+					freeCompressedPage(compressed);
+				continue;
+			}
+
+			if(logUncaching)
+				warningLogger() << "Compressing physical page" << frg::endlog;
+			physicalAllocator->free(physical, kPageSize);
+			globalReclaimer->countEviction();
+		}
+	}();
+}
+
+void CopyOnWriteMemory::_trackPage(uintptr_t offset, CowPage *page) {
+	assert(page->state == CowState::hasCopy);
+	page->evicting = false;
+
+	if(disableCompression || page->reclaimTracked)
+		return;
+	if(page->lockCount || page->chainRefs.load(std::memory_order_relaxed))
+		return;
+
+	page->cachePage.bundle = &anonymousBundle.get();
+	page->cachePage.identity = offset >> kPageShift;
+	page->owner = smarter::weak_ptr<CopyOnWriteMemory>{selfPtr.lock()};
+	page->reclaimTracked = true;
+	globalReclaimer->addPage(&page->cachePage);
+}
+
+void CopyOnWriteMemory::_untrackPage(CowPage *page) {
+	page->evicting = false;
+
+	if(!page->reclaimTracked)
+		return;
+	globalReclaimer->removePage(&page->cachePage);
+	page->reclaimTracked = false;
+}
+
+smarter::shared_ptr<CowPage> CopyOnWriteMemory::_adoptChainPage(uintptr_t offset) {
+	if(!_copyChain)
+		return nullptr;
+	auto chainLock = frg::guard(&_copyChain->_mutex);
+
+	// Another holder of the chain could still fault on the page.
+	// Note that this cannot become false concurrently: only fork() adds
+	// holders and it requires our _mutex.
+	if(_copyChain->_numHolders.load(std::memory_order_acquire) != 1)
+		return nullptr;
+
+	auto pageOffset = _viewOffset + offset;
+	auto it = _copyChain->_pages.find(pageOffset >> kPageShift);
+	if(!it)
+		return nullptr;
+	auto page = *it;
+	assert(page->state == CowState::hasCopy);
+	assert(page->physical != PhysicalAddr(-1));
+
+	// The page is also referenced by the chains of other mappings.
+	if(page->chainRefs.load(std::memory_order_acquire) != 1)
+		return nullptr;
+
+	page->chainRefs.fetch_sub(1, std::memory_order_relaxed);
+	_copyChain->_pages.erase(pageOffset >> kPageShift);
+	auto ownedIt = _ownedPages.insert(offset >> kPageShift);
+	*ownedIt = page;
+	return page;
+}
+
+bool CopyOnWriteMemory::_chainHasPage(uintptr_t offset) {
+	if(!_copyChain)
+		return false;
+	auto chainLock = frg::guard(&_copyChain->_mutex);
+	if(_copyChain->_pages.find((_viewOffset + offset) >> kPageShift))
+		return true;
+	return false;
+}
+
+PhysicalAddr CopyOnWriteMemory::_copyFromChain(CowChain *chain, uintptr_t pageOffset) {
+	if(!chain)
+		return PhysicalAddr(-1);
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&chain->_mutex);
+
+	auto it = chain->_pages.find(pageOffset >> kPageShift);
+	if(!it)
+		return PhysicalAddr(-1);
+	auto page = *it;
+	// We can just copy synchronously here -- the descendant is not evicted.
+	assert(page->state == CowState::hasCopy);
+	auto srcPhysical = page->physical;
+	assert(srcPhysical != PhysicalAddr(-1));
+
+	auto physical = physicalAllocator->allocate(kPageSize);
+	assert(physical != PhysicalAddr(-1) && "OOM");
+	PageAccessor accessor{physical};
+	PageAccessor srcAccessor{srcPhysical};
+	memcpy(accessor.get(), srcAccessor.get(), kPageSize);
+	return physical;
+}
+
 // --------------------------------------------------------------------------------------
 
 namespace {
@@ -0,0 +1,94 @@
+#include <atomic>
+#include <frg/manual_box.hpp>
+#include <frg/vector.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/numa.hpp>
+
+namespace thor {
+
+namespace {
+
+struct CpuAffinity {
+	uint32_t hwId;
+	int node;
+};
+
+// Note: the topology is only registered during early boot (before APs are started)
+//       but it is read by the physical allocator, i.e., we cannot take locks
+//       (or allocate memory) while reading it.
+
+constinit uint32_t nodeDomains[maxNumaNodes]{};
+constinit std::atomic<int> numNodes{0};
+
+// Zero means that the distance is not known.
+constinit std::atomic<uint8_t> distances[maxNumaNodes][maxNumaNodes]{};
+
+constinit frg::manual_box<frg::vector<CpuAffinity, KernelAlloc>> cpuAffinities;
+
+} // anonymous namespace
+
+int numNumaNodes() {
+	auto n = numNodes.load(std::memory_order_relaxed);
+	return n ? n : 1;
+}
+
+int registerNumaDomain(uint32_t domain) {
+	auto n = numNodes.load(std::memory_order_relaxed);
+	for(int i = 0; i < n; i++) {
+		if(nodeDomains[i] == domain)
+			return i;
+	}
+	if(n == maxNumaNodes)
+		return -1;
+	nodeDomains[n] = domain;
+	numNodes.store(n + 1, std::memory_order_relaxed);
+	return n;
+}
+
+int findNumaDomain(uint32_t domain) {
+	auto n = numNodes.load(std::memory_order_relaxed);
+	for(int i = 0; i < n; i++) {
+		if(nodeDomains[i] == domain)
+			return i;
+	}
+	return -1;
+}
+
+void setNumaDistance(int from, int to, uint8_t distance) {
+	assert(from >= 0 && from < maxNumaNodes);
+	assert(to >= 0 && to < maxNumaNodes);
+	distances[from][to].store(distance, std::memory_order_relaxed);
+}
+
+uint8_t getNumaDistance(int from, int to) {
+	assert(from >= 0 && from < maxNumaNodes);
+	assert(to >= 0 && to < maxNumaNodes);
+	auto distance = distances[from][to].load(std::memory_order_relaxed);
+	if(distance)
+		return distance;
+	return (from == to) ? numaLocalDistance : numaRemoteDistance;
+}
+
+void registerCpuNumaNode(uint32_t hwId, int node) {
+	if(!cpuAffinities)
+		cpuAffinities.initialize(*kernelAlloc);
+	for(auto &affinity : *cpuAffinities) {
+		if(affinity.hwId == hwId) {
+			affinity.node = node;
+			return;
+		}
+	}
+	cpuAffinities->push_back({hwId, node});
+}
+
+int getCpuNumaNode(uint32_t hwId) {
+	if(!cpuAffinities)
+		return 0;
+	for(auto &affinity : *cpuAffinities) {
+		if(affinity.hwId == hwId)
+			return affinity.node;
+	}
+	return 0;
+}
+
+} // namespace thor
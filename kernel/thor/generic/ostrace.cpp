@@ -7,6 +7,7 @@
 #include <thor-internal/kernel-io.hpp>
 #include <thor-internal/main.hpp>
 #include <thor-internal/ostrace.hpp>
+#include <thor-internal/ring-mirror.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/timer.hpp>
 #include <thor-internal/mbus.hpp>
@@ -18,6 +19,7 @@
 namespace thor {
 
 bool wantOsTrace = false;
+bool wantTracepoints = false;
 
 constinit std::atomic<bool> osTraceInUse{false};
 
@@ -36,6 +38,7 @@ initgraph::Task initOsTraceCore{&globalInitEngine, "generic.init-ostrace-core",
 	[] {
 		frg::array args = {
 			frg::option{"ostrace", frg::store_true(wantOsTrace)},
+			frg::option{"ostrace.tracepoints", frg::store_true(wantTracepoints)},
 		};
 		frg::parse_arguments(getKernelCmdline(), args);
 
@@ -45,10 +48,16 @@ initgraph::Task initOsTraceCore{&globalInitEngine, "generic.init-ostrace-core",
 
 		void *osTraceMemory = kernelAlloc->allocate(1 << 20);
 		globalOsTraceRing.initialize(reinterpret_cast<uintptr_t>(osTraceMemory), 1 << 20);
+		createRingMirror(globalOsTraceRing.get());
 
 		osTraceInUse.store(true);
 
 		ostrace::setup();
+
+		if(wantTracepoints) {
+			infoLogger() << "thor: ostrace tracepoints are enabled" << frg::endlog;
+			ostrace::tracepointsEnabled.store(true, std::memory_order_relaxed);
+		}
 	}
 };
 
@@ -259,6 +268,22 @@ initgraph::Task initOsTraceMbus{&globalInitEngine, "generic.init-ostrace-sinks",
 	}
 };
 
+initgraph::Task initTracepointDrain{&globalInitEngine, "generic.init-ostrace-tracepoints",
+	initgraph::Requires{&initOsTraceCore,
+		getFibersAvailableStage()},
+	[] {
+		if(!wantOsTrace || !wantTracepoints)
+			return;
+
+		KernelFiber::run([=] {
+			while(true) {
+				if(!ostrace::drainTracepoints())
+					KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(1'000'000));
+			}
+		});
+	}
+};
+
 } // anonymous namespace
 
 // --------------------------------------------------------------------------------------
@@ -268,9 +293,134 @@ initgraph::Task initOsTraceMbus{&globalInitEngine, "generic.init-ostrace-sinks",
 namespace ostrace {
 
 std::atomic<bool> available{false};
+constinit std::atomic<bool> tracepointsEnabled{false};
 
 THOR_DEFINE_PERCPU(context);
 
+struct TracepointRing {
+	ReentrantRecordRing ring;
+	// Link in the list of all tracepoint rings.
+	TracepointRing *next{nullptr};
+	// Only accessed by drainTracepoints().
+	uint64_t deqPtr{0};
+};
+
+namespace {
+
+constinit std::atomic<TracepointRing *> tracepointRings{nullptr};
+
+Event ostEvtSyscallEnter{"thor.syscall-enter"};
+Event ostEvtSyscallExit{"thor.syscall-exit"};
+Event ostEvtScheduleIn{"thor.schedule-in"};
+Event ostEvtScheduleOut{"thor.schedule-out"};
+Event ostEvtPageFault{"thor.page-fault"};
+Event ostEvtIpcSubmit{"thor.ipc-submit"};
+Event ostEvtIpcComplete{"thor.ipc-complete"};
+Event ostEvtIrq{"thor.irq"};
+
+UintAttribute ostAttrCpu{"cpu"};
+UintAttribute ostAttrSyscall{"syscall"};
+UintAttribute ostAttrThread{"thread"};
+UintAttribute ostAttrEntity{"entity"};
+UintAttribute ostAttrAddress{"address"};
+UintAttribute ostAttrFlags{"flags"};
+UintAttribute ostAttrQueue{"queue"};
+UintAttribute ostAttrContext{"context"};
+UintAttribute ostAttrIrq{"irq"};
+
+// Describes how the arguments of each tracepoint are emitted. Indexed by Tracepoint.
+struct TracepointTerms {
+	Event *event;
+	UintAttribute *args[2];
+};
+
+constinit TracepointTerms tracepointTerms[] = {
+	{&ostEvtSyscallEnter, {&ostAttrSyscall, &ostAttrThread}},
+	{&ostEvtSyscallExit, {&ostAttrSyscall, &ostAttrThread}},
+	{&ostEvtScheduleIn, {&ostAttrEntity, nullptr}},
+	{&ostEvtScheduleOut, {&ostAttrEntity, nullptr}},
+	{&ostEvtPageFault, {&ostAttrAddress, &ostAttrFlags}},
+	{&ostEvtIpcSubmit, {&ostAttrQueue, &ostAttrContext}},
+	{&ostEvtIpcComplete, {&ostAttrQueue, &ostAttrContext}},
+	{&ostEvtIrq, {&ostAttrIrq, nullptr}},
+};
+static_assert(sizeof(tracepointTerms) / sizeof(TracepointTerms)
+		== static_cast<size_t>(Tracepoint::numTracepoints));
+
+void emitTracepointRecord(const TracepointRecord &record) {
+	auto terms = &tracepointTerms[static_cast<size_t>(record.tracepoint)];
+
+	frg::small_vector<char, 128, KernelAlloc> buffer{*kernelAlloc};
+	auto emitMsg = [&] (auto msg) {
+		auto offset = buffer.size();
+		auto ts = msg.size_of_tail();
+		buffer.resize(offset + 8 + ts);
+		bool encodeSuccess = bragi::write_head_tail(msg,
+				frg::span<char>(buffer.data() + offset, 8),
+				frg::span<char>(buffer.data() + offset + 8, ts));
+		assert(encodeSuccess);
+	};
+
+	managarm::ostrace::EventRecord<KernelAlloc> eventRecord{*kernelAlloc};
+	eventRecord.set_id(static_cast<uint64_t>(terms->event->id()));
+	eventRecord.set_ts(record.ts);
+	emitMsg(std::move(eventRecord));
+
+	emitMsg(ostAttrCpu(record.cpu));
+	for(int i = 0; i < 2; ++i) {
+		if(terms->args[i])
+			emitMsg((*terms->args[i])(record.args[i]));
+	}
+
+	emitMsg(managarm::ostrace::EndOfRecord<KernelAlloc>{*kernelAlloc});
+
+	emitBuffer({buffer.data(), buffer.size()});
+}
+
+} // anonymous namespace
+
+void recordTracepoint(Tracepoint tp, uint64_t arg0, uint64_t arg1) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto ctx = &context.get();
+
+	if(!ctx->tracepointRing) [[unlikely]] {
+		ctx->tracepointRing = frg::construct<TracepointRing>(*kernelAlloc);
+
+		auto head = tracepointRings.load(std::memory_order_relaxed);
+		do {
+			ctx->tracepointRing->next = head;
+		} while(!tracepointRings.compare_exchange_weak(head, ctx->tracepointRing,
+				std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	TracepointRecord record{
+		.ts = haveTimer() ? getClockNanos() : 0,
+		.tracepoint = tp,
+		.cpu = static_cast<uint32_t>(getCpuData()->cpuIndex),
+		.args = {arg0, arg1}
+	};
+	ctx->tracepointRing->ring.enqueue(&record, sizeof(TracepointRecord));
+}
+
+bool drainTracepoints() {
+	bool progress = false;
+	for(auto tr = tracepointRings.load(std::memory_order_acquire); tr; tr = tr->next) {
+		while(true) {
+			TracepointRecord record;
+			auto [success, recordPtr, nextPtr, size] = tr->ring.dequeueAt(
+					tr->deqPtr, &record, sizeof(TracepointRecord));
+			tr->deqPtr = nextPtr;
+			if(!success)
+				break;
+			assert(size == sizeof(TracepointRecord));
+
+			emitTracepointRecord(record);
+			progress = true;
+		}
+	}
+	return progress;
+}
+
 void setup() {
 	auto setupTerm = [] (ostrace::Term &term) {
 		assert(!term.id_);
@@ -284,6 +434,22 @@ void setup() {
 
 	setupTerm(ostEvtArmPreemption);
 	setupTerm(ostEvtArmCpuTimer);
+	setupTerm(ostEvtIrqOffSection);
+	setupTerm(ostAttrIrqOffCpu);
+	setupTerm(ostAttrIrqOffTicks);
+	setupTerm(ostAttrIrqOffSite);
+	setupTerm(ostAttrIrqOffStack);
+	for(auto &terms : tracepointTerms)
+		setupTerm(*terms.event);
+	setupTerm(ostAttrCpu);
+	setupTerm(ostAttrSyscall);
+	setupTerm(ostAttrThread);
+	setupTerm(ostAttrEntity);
+	setupTerm(ostAttrAddress);
+	setupTerm(ostAttrFlags);
+	setupTerm(ostAttrQueue);
+	setupTerm(ostAttrContext);
+	setupTerm(ostAttrIrq);
 	available.store(true, std::memory_order_relaxed);
 }
 
@@ -300,4 +466,10 @@ void emitBuffer(frg::span<char> payload) {
 ostrace::Event ostEvtArmPreemption{"thor.arm-preemption"};
 ostrace::Event ostEvtArmCpuTimer{"thor.arm-cpu-timer"};
 
+ostrace::Event ostEvtIrqOffSection{"thor.irq-off-section"};
+ostrace::UintAttribute ostAttrIrqOffCpu{"cpu"};
+ostrace::UintAttribute ostAttrIrqOffTicks{"ticks"};
+ostrace::UintAttribute ostAttrIrqOffSite{"site"};
+ostrace::BufferAttribute ostAttrIrqOffStack{"stack"};
+
 } // namespace thor
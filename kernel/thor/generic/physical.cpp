@@ -1,13 +1,19 @@
 #include <assert.h>
+#include <string.h>
+#include <thor-internal/arch-generic/ints.hpp>
 #include <thor-internal/arch-generic/paging.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
+#include <thor-internal/kernel-stats.hpp>
 #include <thor-internal/physical.hpp>
 
 namespace thor {
 
 static bool logPhysicalAllocs = false;
 
+extern PerCpu<PhysicalMagazine> physicalMagazine;
+THOR_DEFINE_PERCPU(physicalMagazine);
+
 THOR_DEFINE_ELF_NOTE(memoryLayoutNote){elf_note_type::memoryLayout, {}};
 
 void poisonPhysicalAccess(PhysicalAddr physical) {
@@ -50,15 +56,36 @@ void PhysicalChunkAllocator::bootstrapRegion(PhysicalAddr address,
 	_freePages.store(currentFree + (numRoots << order), std::memory_order_relaxed);
 }
 
-PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits) {
+void PhysicalChunkAllocator::setNumaNode(PhysicalAddr address, size_t size, int node) {
+	assert(node >= 0 && node < maxNumaNodes);
+
+	for(int i = 0; i < _numRegions; i++) {
+		auto base = _allRegions[i].physicalBase;
+		if(base < address || base - address >= size)
+			continue;
+		if(base + _allRegions[i].regionSize > address + size)
+			infoLogger() << "thor: Memory region at 0x" << frg::hex_fmt(base)
+					<< " spans multiple NUMA nodes" << frg::endlog;
+		_allRegions[i].node.store(node, std::memory_order_relaxed);
+	}
+}
+
+void PhysicalChunkAllocator::enableMagazines() {
+	_magazinesEnabled.store(true, std::memory_order_relaxed);
+}
+
+PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits, int node) {
 	auto irq_lock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&_mutex);
 
-	auto currentFree = _freePages.load(std::memory_order_relaxed);
-	auto currentUsed = _usedPages.load(std::memory_order_relaxed);
-	assert(currentFree > size / kPageSize);
-	_freePages.store(currentFree - size / kPageSize, std::memory_order_relaxed);
-	_usedPages.store(currentUsed + size / kPageSize, std::memory_order_relaxed);
+	auto localNode = getCpuData()->numaNode;
+	if(node == numaNodeAny)
+		node = localNode;
+
+	countKernelStat(KernelStat::physicalAllocations);
+
+	auto previousFree = _freePages.fetch_sub(size / kPageSize, std::memory_order_relaxed);
+	assert(previousFree > size / kPageSize);
+	_usedPages.fetch_add(size / kPageSize, std::memory_order_relaxed);
 
 	// TODO: This could be solved better.
 	int target = 0;
@@ -69,47 +96,205 @@ PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits) {
 	if(logPhysicalAllocs)
 		infoLogger() << "thor: Allocating physical memory of order "
 					<< (target + kPageShift) << frg::endlog;
-	for(int i = 0; i < _numRegions; i++) {
-		if(target > _allRegions[i].buddyAccessor.tableOrder())
-			continue;
 
-		auto physical = _allRegions[i].buddyAccessor.allocate(target, addressBits);
-		if(physical == BuddyAccessor::illegalAddress)
-			continue;
-	//	infoLogger() << "Allocate " << (void *)physical << frg::endlog;
-		assert(!(physical % (size_t(kPageSize) << target)));
+	// Magazines do not track the address of their chunks,
+	// hence we only use them for unconstrained allocations.
+	// Magazines only contain memory of the CPU's own node.
+	if(target < PhysicalMagazine::numOrders && addressBits == 64 && node == localNode
+			&& _magazinesEnabled.load(std::memory_order_relaxed)) {
+		auto magazine = &physicalMagazine.get();
+		auto stack = &magazine->stacks[target];
+		if(stack->count) {
+			magazine->hits.store(magazine->hits.load(std::memory_order_relaxed) + 1,
+					std::memory_order_relaxed);
+			return stack->chunks[--stack->count];
+		}
+		magazine->misses.store(magazine->misses.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+
+		// Refill the magazine, keeping one chunk for the current allocation.
+		auto lock = frg::guard(&_mutex);
+		auto physical = _allocateFromBuddy(target, addressBits, node);
+		if(physical == static_cast<PhysicalAddr>(-1))
+			return physical;
+		while(stack->count < PhysicalMagazine::batchSize(target)) {
+			// Do not fill the magazine with remote memory.
+			auto chunk = _allocateFromNode(target, addressBits, node);
+			if(chunk == static_cast<PhysicalAddr>(-1))
+				break;
+			stack->chunks[stack->count++] = chunk;
+		}
 		return physical;
 	}
 
-	return static_cast<PhysicalAddr>(-1);
+	auto lock = frg::guard(&_mutex);
+	return _allocateFromBuddy(target, addressBits, node);
 }
 
 void PhysicalChunkAllocator::free(PhysicalAddr address, size_t size) {
 	auto irq_lock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&_mutex);
-	
+
 	int target = 0;
 	while(size > (size_t(kPageSize) << target))
 		target++;
 
+	countKernelStat(KernelStat::physicalFrees);
+
+	auto previousUsed = _usedPages.fetch_sub(size / kPageSize, std::memory_order_relaxed);
+	assert(previousUsed > size / kPageSize);
+	_freePages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+
+	if(target < PhysicalMagazine::numOrders
+			&& _magazinesEnabled.load(std::memory_order_relaxed)
+			&& _nodeOf(address) == getCpuData()->numaNode) {
+		auto stack = &physicalMagazine.get().stacks[target];
+		if(stack->count < PhysicalMagazine::capacity(target)) {
+			stack->chunks[stack->count++] = address;
+			return;
+		}
+
+		// The magazine is full. Drain a batch of chunks back to the buddy allocator.
+		auto lock = frg::guard(&_mutex);
+		_freeToBuddy(address, target);
+		for(size_t i = 0; i < PhysicalMagazine::batchSize(target); i++)
+			_freeToBuddy(stack->chunks[--stack->count], target);
+		return;
+	}
+
+	auto lock = frg::guard(&_mutex);
+	_freeToBuddy(address, target);
+}
+
+PhysicalAddr PhysicalChunkAllocator::allocateZeroed(int addressBits, int node) {
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+
+		if(addressBits == 64 && (node == numaNodeAny || node == getCpuData()->numaNode)
+				&& _magazinesEnabled.load(std::memory_order_relaxed)) {
+			auto stack = &physicalMagazine.get().zeroed;
+			if(stack->count)
+				return stack->chunks[--stack->count];
+		}
+	}
+
+	auto physical = allocate(kPageSize, addressBits, node);
+	if(physical == static_cast<PhysicalAddr>(-1))
+		return physical;
+	PageAccessor accessor{physical};
+	memset(accessor.get(), 0, kPageSize);
+	return physical;
+}
+
+bool PhysicalChunkAllocator::prezeroPage() {
+	// The idle loop is abandoned on preemption, so we must not be preempted
+	// between allocating the page and pushing it to the magazine.
+	assert(!intsAreEnabled());
+
+	if(!_magazinesEnabled.load(std::memory_order_relaxed))
+		return false;
+	auto stack = &physicalMagazine.get().zeroed;
+	if(stack->count >= PhysicalMagazine::baseCapacity)
+		return false;
+	// Keep the last free pages for allocations that are actually needed.
+	if(_freePages.load(std::memory_order_relaxed) < 4 * PhysicalMagazine::baseCapacity)
+		return false;
+
+	auto physical = allocate(kPageSize);
+	if(physical == static_cast<PhysicalAddr>(-1))
+		return false;
+	PageAccessor accessor{physical};
+	memset(accessor.get(), 0, kPageSize);
+	stack->chunks[stack->count++] = physical;
+	return true;
+}
+
+uint64_t PhysicalChunkAllocator::numMagazineHits() {
+	uint64_t sum = 0;
+	for(size_t i = 0; i < getCpuCount(); i++)
+		sum += physicalMagazine.getFor(i).hits.load(std::memory_order_relaxed);
+	return sum;
+}
+
+uint64_t PhysicalChunkAllocator::numMagazineMisses() {
+	uint64_t sum = 0;
+	for(size_t i = 0; i < getCpuCount(); i++)
+		sum += physicalMagazine.getFor(i).misses.load(std::memory_order_relaxed);
+	return sum;
+}
+
+PhysicalAddr PhysicalChunkAllocator::_allocateFromBuddy(int order, int addressBits, int node) {
+	auto physical = _allocateFromNode(order, addressBits, node);
+	if(physical != static_cast<PhysicalAddr>(-1))
+		return physical;
+
+	// Fall back to the remaining nodes, ordered by their distance to the preferred node.
+	int fallbacks[maxNumaNodes];
+	int numFallbacks = 0;
+	for(int other = 0; other < numNumaNodes(); other++) {
+		if(other == node)
+			continue;
+		auto distance = getNumaDistance(node, other);
+		int k = numFallbacks++;
+		while(k > 0 && getNumaDistance(node, fallbacks[k - 1]) > distance) {
+			fallbacks[k] = fallbacks[k - 1];
+			k--;
+		}
+		fallbacks[k] = other;
+	}
+
+	for(int i = 0; i < numFallbacks; i++) {
+		physical = _allocateFromNode(order, addressBits, fallbacks[i]);
+		if(physical != static_cast<PhysicalAddr>(-1))
+			return physical;
+	}
+
+	return static_cast<PhysicalAddr>(-1);
+}
+
+PhysicalAddr PhysicalChunkAllocator::_allocateFromNode(int order, int addressBits, int node) {
+	for(int i = 0; i < _numRegions; i++) {
+		if(_allRegions[i].node.load(std::memory_order_relaxed) != node)
+			continue;
+		if(order > _allRegions[i].buddyAccessor.tableOrder())
+			continue;
+
+		auto physical = _allRegions[i].buddyAccessor.allocate(order, addressBits);
+		if(physical == BuddyAccessor::illegalAddress)
+			continue;
+	//	infoLogger() << "Allocate " << (void *)physical << frg::endlog;
+		assert(!(physical % (size_t(kPageSize) << order)));
+		return physical;
+	}
+
+	return static_cast<PhysicalAddr>(-1);
+}
+
+void PhysicalChunkAllocator::_freeToBuddy(PhysicalAddr address, int order) {
+	auto size = size_t(kPageSize) << order;
 	for(int i = 0; i < _numRegions; i++) {
 		if(address < _allRegions[i].physicalBase)
 			continue;
 		if(address + size - _allRegions[i].physicalBase > _allRegions[i].regionSize)
 			continue;
 
-		_allRegions[i].buddyAccessor.free(address, target);
-		auto currentFree = _freePages.load(std::memory_order_relaxed);
-		auto currentUsed = _usedPages.load(std::memory_order_relaxed);
-		assert(currentUsed > size / kPageSize);
-		_freePages.store(currentFree + size / kPageSize, std::memory_order_relaxed);
-		_usedPages.store(currentUsed - size / kPageSize, std::memory_order_relaxed);
+		_allRegions[i].buddyAccessor.free(address, order);
 		return;
 	}
 
 	assert(!"Physical page is not part of any region");
 }
 
+int PhysicalChunkAllocator::_nodeOf(PhysicalAddr address) {
+	for(int i = 0; i < _numRegions; i++) {
+		if(address < _allRegions[i].physicalBase)
+			continue;
+		if(address - _allRegions[i].physicalBase >= _allRegions[i].regionSize)
+			continue;
+		return _allRegions[i].node.load(std::memory_order_relaxed);
+	}
+	return 0;
+}
+
 PhysicalWindow::PhysicalWindow(PhysicalAddr physical, size_t size, CachingMode caching)
 : size_{size} {
 	uintptr_t lowAddr = physical & ~(kPageSize - 1);
@@ -6,6 +6,7 @@
 #include <thor-internal/kernel-io.hpp>
 #include <thor-internal/main.hpp>
 #include <thor-internal/profile.hpp>
+#include <thor-internal/ring-mirror.hpp>
 #include <thor-internal/timer.hpp>
 
 namespace thor {
@@ -13,7 +14,13 @@ namespace thor {
 bool wantKernelProfile = false;
 
 namespace {
+	// Samples contain call stacks and all CPUs drain into this ring, so it is larger
+	// than the other global rings.
+	constexpr size_t globalProfileRingSize = size_t{4} << 20;
+
 	frg::manual_box<LogRingBuffer> globalProfileRing;
+	// Set once globalProfileRing is initialized.
+	std::atomic<bool> profileAvailable{false};
 
 	initgraph::Task initProfilingSinks{&globalInitEngine, "generic.init-profiling-sinks",
 		initgraph::Requires{getFibersAvailableStage(),
@@ -44,11 +51,23 @@ void initializeProfile() {
 		return;
 	}
 
-	void *profileMemory = kernelAlloc->allocate(1 << 20);
-	globalProfileRing.initialize(reinterpret_cast<uintptr_t>(profileMemory), 1 << 20);
+	void *profileMemory = kernelAlloc->allocate(globalProfileRingSize);
+	globalProfileRing.initialize(reinterpret_cast<uintptr_t>(profileMemory), globalProfileRingSize);
+	// Collectors can map the mirror instead of copying samples through kerncfg.
+	createRingMirror(globalProfileRing.get());
+	profileAvailable.store(true, std::memory_order_release);
+
+	initializeProfileOnThisCpu();
+#endif
+}
+
+void initializeProfileOnThisCpu() {
+#ifdef __x86_64__
+	if(!profileAvailable.load(std::memory_order_acquire))
+		return;
 
-	// Dump the per-CPU profiling data to the global ring buffer.
-	// TODO: Start one such fiber per CPU.
+	// The fiber runs on the current CPU: it programs the CPU's PMCs
+	// and dumps the per-CPU profiling data to the global ring buffer.
 	KernelFiber::run([=] {
 		getCpuData()->localProfileRing = frg::construct<SingleContextRecordRing>(*kernelAlloc);
 
@@ -66,18 +85,18 @@ void initializeProfile() {
 
 		uint64_t deqPtr = 0;
 		while(true) {
-			char buffer[128];
+			ProfileSample sample;
 			auto [success, recordPtr, newPtr, size] = getCpuData()->localProfileRing->dequeueAt(
-					deqPtr, buffer, 128);
+					deqPtr, &sample, sizeof(ProfileSample));
 			deqPtr = newPtr;
 			if(!success) {
 				KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(1'000'000));
 				continue;
 			}
 			assert(size);
-			assert(size < 128);
+			assert(size <= sizeof(ProfileSample));
 
-			globalProfileRing->enqueue(buffer, size);
+			globalProfileRing->enqueue(&sample, size);
 		}
 	});
 #endif
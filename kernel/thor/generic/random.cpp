@@ -5,7 +5,9 @@
 #include <cralgo/sha2_32.hpp>
 #include <thor-internal/arch-generic/cpu.hpp>
 #include <thor-internal/arch-generic/timer.hpp>
+#include <thor-internal/cpu-data.hpp>
 #include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/kernel-locks.hpp>
 #include <thor-internal/random.hpp>
 #include <thor-internal/debug.hpp>
 
@@ -76,6 +78,13 @@ struct Fortuna {
 		cralgo::sha256_clear(&keyHash);
 		cralgo::sha256_update(&keyHash, tempDigest, keySize);
 		cralgo::sha256_finalize(&keyHash, keyBytes_);
+
+		keyGeneration_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Incremented whenever new entropy is mixed into the key.
+	uint64_t keyGeneration() {
+		return keyGeneration_.load(std::memory_order_relaxed);
 	}
 
 	size_t generate(void *buffer, size_t size) {
@@ -129,6 +138,7 @@ struct Fortuna {
 			//       the true amount of entropy in the pool.
 			++reseedNumber_;
 			injectedIntoPoolZero_.store(0, std::memory_order_relaxed);
+			keyGeneration_.fetch_add(1, std::memory_order_relaxed);
 		}
 
 		cralgo::aes_secret_key ek, dk;
@@ -183,6 +193,8 @@ private:
 	// This is protected by generatorMutex_;
 	uint32_t reseedNumber_ = 1;
 
+	std::atomic<uint64_t> keyGeneration_{0};
+
 	// The remaining fields form the entropy accumulator.
 	Pool pools_[numPools];
 	std::atomic<size_t> injectedIntoPoolZero_{0};
@@ -192,6 +204,130 @@ frg::manual_box<Fortuna> csprng;
 
 } // anonymous namespace
 
+// ChaCha20 generator that serves requests without touching the shared Fortuna state.
+// It is keyed from Fortuna and erases its key on each refill (i.e., after the key
+// is used, it is replaced by the first bytes of the output), similar to Linux' per-CPU
+// CRNGs. Both refills and consumed output are wiped to retain forward secrecy.
+struct ChaChaGenerator {
+	static constexpr size_t keySize = 32;
+	static constexpr size_t chachaBlockSize = 64;
+	static constexpr size_t bufferSize = 8 * chachaBlockSize;
+
+	// The generator is rekeyed from Fortuna after this number of bytes.
+	static constexpr size_t reseedInterval = 1 << 20;
+
+	size_t generate(void *buffer, size_t size) {
+		// Bounds the time that IRQs are disabled for large requests.
+		constexpr size_t maxRequest = 16 * bufferSize;
+
+		if(!keyed_ || generated_ >= reseedInterval
+				|| keyGeneration_ != csprng->keyGeneration())
+			reseed_();
+
+		auto p = reinterpret_cast<uint8_t *>(buffer);
+		size_t progress = 0;
+		while(progress < size && progress < maxRequest) {
+			if(offset_ == bufferSize)
+				refill_();
+			auto chunk = frg::min(size - progress, bufferSize - offset_);
+			memcpy(p + progress, buffer_ + offset_, chunk);
+			memset(buffer_ + offset_, 0, chunk);
+			offset_ += chunk;
+			progress += chunk;
+		}
+
+		generated_ += progress;
+		return progress;
+	}
+
+private:
+	void reseed_() {
+		// Read the generation first so that a concurrent reseed causes another rekey.
+		keyGeneration_ = csprng->keyGeneration();
+
+		uint8_t seed[keySize];
+		size_t progress = 0;
+		while(progress < keySize)
+			progress += csprng->generate(seed + progress, keySize - progress);
+
+		// Mix the seed into the current key such that the new key does not only
+		// depend on the seed.
+		for(size_t i = 0; i < keySize; i++)
+			key_[i] ^= seed[i];
+		memset(seed, 0, keySize);
+
+		// Drop output that was generated from the old key.
+		memset(buffer_, 0, bufferSize);
+		offset_ = bufferSize;
+		generated_ = 0;
+		keyed_ = true;
+	}
+
+	void refill_() {
+		for(size_t i = 0; i < bufferSize / chachaBlockSize; i++)
+			chachaBlock_(i, buffer_ + i * chachaBlockSize);
+
+		// Fast key erasure: the first bytes replace the key and are never handed out.
+		memcpy(key_, buffer_, keySize);
+		memset(buffer_, 0, keySize);
+		offset_ = keySize;
+	}
+
+	// Computes the ChaCha20 block for the given counter (with an all-zero nonce).
+	// Since the key changes on each refill, the counter never repeats under the same key.
+	void chachaBlock_(uint64_t counter, uint8_t *out) {
+		auto rotl = [] (uint32_t x, int n) -> uint32_t {
+			return (x << n) | (x >> (32 - n));
+		};
+
+		uint32_t input[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+		memcpy(&input[4], key_, keySize);
+		input[12] = static_cast<uint32_t>(counter);
+		input[13] = static_cast<uint32_t>(counter >> 32);
+
+		uint32_t x[16];
+		memcpy(x, input, sizeof(x));
+
+		auto quarterRound = [&] (int a, int b, int c, int d) {
+			x[a] += x[b]; x[d] ^= x[a]; x[d] = rotl(x[d], 16);
+			x[c] += x[d]; x[b] ^= x[c]; x[b] = rotl(x[b], 12);
+			x[a] += x[b]; x[d] ^= x[a]; x[d] = rotl(x[d], 8);
+			x[c] += x[d]; x[b] ^= x[c]; x[b] = rotl(x[b], 7);
+		};
+
+		for(int i = 0; i < 10; i++) {
+			quarterRound(0, 4, 8, 12);
+			quarterRound(1, 5, 9, 13);
+			quarterRound(2, 6, 10, 14);
+			quarterRound(3, 7, 11, 15);
+			quarterRound(0, 5, 10, 15);
+			quarterRound(1, 6, 11, 12);
+			quarterRound(2, 7, 8, 13);
+			quarterRound(3, 4, 9, 14);
+		}
+
+		// All supported architectures are little endian.
+		for(int i = 0; i < 16; i++)
+			x[i] += input[i];
+		memcpy(out, x, chachaBlockSize);
+
+		memset(x, 0, sizeof(x));
+		memset(input, 0, sizeof(input));
+	}
+
+	uint8_t key_[keySize]{};
+	uint8_t buffer_[bufferSize]{};
+	// Offset of the first byte of buffer_ that was not handed out yet.
+	size_t offset_ = bufferSize;
+	// Number of bytes that were generated since the last reseed.
+	size_t generated_ = 0;
+	uint64_t keyGeneration_ = 0;
+	bool keyed_ = false;
+};
+
+extern PerCpu<ChaChaGenerator> cpuGenerator;
+THOR_DEFINE_PERCPU(cpuGenerator);
+
 void initializeRandom() {
 	csprng.initialize();
 
@@ -218,7 +354,10 @@ void injectEntropy(unsigned int entropySource, unsigned int seqNum, void *buffer
 }
 
 size_t generateRandomBytes(void *buffer, size_t size) {
-	return csprng->generate(buffer, size);
+	// Disabling IRQs gives us exclusive access to this CPU's generator.
+	auto irqLock = frg::guard(&irqMutex());
+
+	return cpuGenerator.get().generate(buffer, size);
 }
 
 } // namespace thor
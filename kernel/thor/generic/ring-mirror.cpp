@@ -0,0 +1,32 @@
+#include <string.h>
+
+#include <thor-internal/physical.hpp>
+#include <thor-internal/ring-mirror.hpp>
+
+namespace thor {
+
+void createRingMirror(LogRingBuffer *ring) {
+	auto size = ring->size();
+	assert(!(size & (kPageSize - 1)));
+
+	// The mirror is accessed through the direct physical mapping, hence it needs to be
+	// physically contiguous.
+	auto headerPhysical = physicalAllocator->allocate(kPageSize);
+	auto dataPhysical = physicalAllocator->allocate(size);
+	assert(headerPhysical != PhysicalAddr(-1) && "OOM when allocating a ring mirror");
+	assert(dataPhysical != PhysicalAddr(-1) && "OOM when allocating a ring mirror");
+
+	auto header = reinterpret_cast<HelLogRingHeader *>(mapDirectPhysical(headerPhysical));
+	auto data = reinterpret_cast<char *>(mapDirectPhysical(dataPhysical));
+	memset(header, 0, kPageSize);
+
+	auto mirror = frg::construct<RingMirror>(*kernelAlloc);
+	mirror->headerMemory = smarter::allocate_shared<HardwareMemory>(*kernelAlloc,
+			headerPhysical, kPageSize, CachingMode::null);
+	mirror->dataMemory = smarter::allocate_shared<HardwareMemory>(*kernelAlloc,
+			dataPhysical, size, CachingMode::null);
+
+	ring->attachMirror(mirror, header, data);
+}
+
+} // namespace thor
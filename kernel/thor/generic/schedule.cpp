@@ -4,7 +4,12 @@
 #include <thor-internal/arch-generic/ints.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
+#include <thor-internal/epoch.hpp>
+#include <thor-internal/kernel-stats.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/load-balancing.hpp>
 #include <thor-internal/ostrace.hpp>
+#include <thor-internal/physical.hpp>
 #include <thor-internal/schedule.hpp>
 #include <thor-internal/thread.hpp>
 #include <thor-internal/timer.hpp>
@@ -22,6 +27,19 @@ namespace {
 	// Minimum length of a preemption time slice in ns.
 	constexpr int64_t sliceGranularity = 10'000'000;
 
+	// Priorities of latency class entities are offset by this value.
+	// This puts them above all regular priorities.
+	constexpr int latencyPriorityBase = 1 << 20;
+
+	// Bounds of the adaptive polling window of the idle loop in ns.
+	// Wakeups that arrive while polling avoid both the IPI and the exit from a halt state.
+	constexpr uint64_t minIdlePoll = 1'000;
+	constexpr uint64_t maxIdlePoll = 50'000;
+
+	// Maximal number of pages that are zeroed ahead of time each time a CPU goes idle.
+	// The pages are zeroed with IRQs disabled, hence this bounds the IRQ latency.
+	constexpr int maxPrezeroPages = 8;
+
 	struct IdleTask final : ScheduleEntity {
 		IdleTask()
 		: ScheduleEntity{ScheduleType::idle} { }
@@ -30,14 +48,19 @@ namespace {
 			runOnStack([] (Continuation) {
 				if(logIdle)
 					infoLogger() << "System is idle" << frg::endlog;
-				suspendSelf();
-				__builtin_trap();
+				// Try to pull work from busy CPUs before we halt.
+				// If we succeed, the stolen thread wakes up this CPU once it migrates.
+				LoadBalancer::singleton().stealOnIdle(getCpuData());
+				localScheduler.get().runIdleLoop();
 			}, getCpuData()->idleStack.base());
 			__builtin_trap();
 		}
 
 		void handlePreemption(IrqImageAccessor image) override {
 			auto *scheduler = &localScheduler.get();
+			// Wakeups that race with update() must send an IPI from now on.
+			scheduler->leaveIdle();
+			passEpochQuiescentState();
 			scheduler->update();
 			if(scheduler->maybeReschedule()) {
 				runOnStack([] (Continuation cont, IrqImageAccessor image) {
@@ -53,6 +76,84 @@ namespace {
 	frg::eternal<IdleTask> globalIdleTask;
 }
 
+ScheduleGroup::ScheduleGroup(smarter::shared_ptr<ScheduleGroup> parent)
+: _parent{std::move(parent)}, _numCpus{getCpuCount()} {
+	_cpuStates = static_cast<CpuState *>(kernelAlloc->allocate(sizeof(CpuState) * _numCpus));
+	for(size_t i = 0; i < _numCpus; i++)
+		new (&_cpuStates[i]) CpuState{};
+}
+
+ScheduleGroup::~ScheduleGroup() {
+	// Active entities keep their group alive.
+	for(size_t i = 0; i < _numCpus; i++)
+		assert(!_cpuStates[i].numActive);
+	kernelAlloc->deallocate(_cpuStates, sizeof(CpuState) * _numCpus);
+}
+
+void ScheduleGroup::setWeight(uint32_t weight) {
+	assert(weight >= minWeight && weight <= maxWeight);
+	_weight.store(weight, std::memory_order_relaxed);
+}
+
+void ScheduleGroup::setBandwidth(uint64_t quota, uint64_t period) {
+	assert(!quota || period);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_bandwidthMutex);
+
+	_quota = quota;
+	_period = period;
+	_periodStart = getClockNanos();
+	_periodUsage = 0;
+}
+
+void ScheduleGroup::_renewPeriod(uint64_t now) {
+	if(!_quota)
+		return;
+	// Note that now can lag behind _periodStart since it is taken from the scheduler's clock.
+	if(now < _periodStart || now - _periodStart < _period)
+		return;
+	_periodStart += (now - _periodStart) / _period * _period;
+	_periodUsage = 0;
+}
+
+void ScheduleGroup::_charge(uint64_t now, uint64_t delta) {
+	for(auto group = this; group; group = group->_parent.get()) {
+		auto lock = frg::guard(&group->_bandwidthMutex);
+		if(!group->_quota)
+			continue;
+		group->_renewPeriod(now);
+		group->_periodUsage += delta;
+	}
+}
+
+uint64_t ScheduleGroup::_throttledUntil(uint64_t now) {
+	uint64_t until = 0;
+	for(auto group = this; group; group = group->_parent.get()) {
+		auto lock = frg::guard(&group->_bandwidthMutex);
+		if(!group->_quota)
+			continue;
+		group->_renewPeriod(now);
+		if(group->_periodUsage >= group->_quota)
+			until = frg::max(until, group->_periodStart + group->_period);
+	}
+	return until;
+}
+
+uint64_t ScheduleGroup::_remainingQuota(uint64_t now) {
+	uint64_t remaining = UINT64_MAX;
+	for(auto group = this; group; group = group->_parent.get()) {
+		auto lock = frg::guard(&group->_bandwidthMutex);
+		if(!group->_quota)
+			continue;
+		group->_renewPeriod(now);
+		if(group->_periodUsage >= group->_quota)
+			return 0;
+		remaining = frg::min(remaining, group->_quota - group->_periodUsage);
+	}
+	return remaining;
+}
+
 int ScheduleEntity::orderPriority(const ScheduleEntity *a, const ScheduleEntity *b) {
 	assert(a->type() == ScheduleType::regular);
 	assert(b->type() == ScheduleType::regular);
@@ -67,18 +168,39 @@ bool ScheduleEntity::scheduleBefore(const ScheduleEntity *a, const ScheduleEntit
 }
 
 ScheduleEntity::ScheduleEntity(ScheduleType type)
-: type_{type}, state{ScheduleState::null}, priority{0}, _refClock{0}, _runTime{0},
+: type_{type}, state{ScheduleState::null}, priority{0}, basePriority{0},
+		_refClock{0}, _runTime{0},
 		refProgress{0}, baseUnfairness{0} { }
 
 ScheduleEntity::~ScheduleEntity() {
 	assert(state == ScheduleState::null);
 }
 
+void ScheduleEntity::setGroup(smarter::shared_ptr<ScheduleGroup> group) {
+	assert(type() == ScheduleType::regular);
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		{
+			auto lock = frg::guard(&_associationMutex);
+			std::swap(_group, group);
+		}
+
+		// Make sure that the local scheduler picks up the change on the next preemption point.
+		// Remote schedulers pick it up on their next update().
+		if(_scheduler == &localScheduler.get())
+			localScheduler.get().forcePreemptionCall();
+	}
+	// The previous group is released outside of the lock.
+}
+
 void Scheduler::associate(ScheduleEntity *entity, Scheduler *scheduler) {
 	assert(entity->type() == ScheduleType::regular);
 
 //	infoLogger() << "associate " << entity << frg::endlog;
 	assert(entity->state == ScheduleState::null);
+	if(entity->_lastScheduler && entity->_lastScheduler != scheduler)
+		entity->_migrations++;
 	entity->_scheduler = scheduler;
 	entity->state = ScheduleState::attached;
 }
@@ -94,6 +216,7 @@ void Scheduler::unassociate(ScheduleEntity *entity) {
 
 	assert(entity->state == ScheduleState::attached);
 	assert(entity != self->_current);
+	entity->_lastScheduler = self;
 	entity->_scheduler = nullptr;
 	entity->state = ScheduleState::null;
 }
@@ -109,9 +232,34 @@ void Scheduler::setPriority(ScheduleEntity *entity, int priority) {
 	// Otherwise, we would have to remove-reinsert into the queue.
 	assert(entity == self->_current);
 
+	entity->_latencyBudget = 0;
+	entity->_throttled = false;
+	entity->basePriority = priority;
 	entity->priority = priority;
 }
 
+void Scheduler::setLatencyClass(ScheduleEntity *entity, int priority,
+		uint64_t budget, uint64_t period) {
+	assert(entity->type() == ScheduleType::regular);
+	assert(budget && budget < period);
+
+	auto scheduleLock = frg::guard(&irqMutex());
+
+	auto self = entity->_scheduler;
+	assert(self);
+
+	// Otherwise, we would have to remove-reinsert into the queue.
+	assert(entity == self->_current);
+
+	entity->_latencyPriority = priority;
+	entity->_latencyBudget = budget;
+	entity->_latencyPeriod = period;
+	entity->_periodStart = self->_refClock;
+	entity->_periodRunTime = entity->_runTime + (self->_refClock - entity->_refClock);
+	entity->_throttled = false;
+	entity->priority = latencyPriorityBase + priority;
+}
+
 void Scheduler::resume(ScheduleEntity *entity) {
 	assert(entity->type() == ScheduleType::regular);
 
@@ -121,15 +269,21 @@ void Scheduler::resume(ScheduleEntity *entity) {
 	auto self = entity->_scheduler;
 	assert(self);
 	assert(entity != self->_current);
-	bool wasEmpty;
-	{
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&self->_mutex);
 
-		entity->state = ScheduleState::pending;
+	entity->state = ScheduleState::pending;
+
+	auto head = self->_pendingHead.load(std::memory_order_relaxed);
+	do {
+		entity->pendingNext = head;
+	} while(!self->_pendingHead.compare_exchange_weak(head, entity,
+			std::memory_order_release, std::memory_order_relaxed));
+	bool wasEmpty = !head;
 
-		wasEmpty = self->_pendingList.empty();
-		self->_pendingList.push_back(entity);
+	// If the running entity blocks next (e.g., since it waits for a reply to the message
+	// that woke up the entity), the entity is run directly. See _schedule().
+	if(self == &localScheduler.get() && self->_current->type() == ScheduleType::regular) {
+		self->_handoffSource = self->_current;
+		self->_handoffCandidate = entity;
 	}
 
 	if(wasEmpty) {
@@ -146,9 +300,16 @@ void Scheduler::resume(ScheduleEntity *entity) {
 			// TODO: In the case of kernel threads, it can be necessary to issue a self IPI
 			//       to ensure that a higher priority thread gets to run as soon as possible.
 			self->_mustCallPreemption = true;
-		}else{
+		}else if(!self->_wakeIdle()) {
+			self->_wakeupIpisSent.fetch_add(1, std::memory_order_relaxed);
 			sendPingIpi(self->_cpuContext);
+			countKernelStat(KernelStat::ipisSent);
+		}else{
+			self->_wakeupIpisSuppressed.fetch_add(1, std::memory_order_relaxed);
 		}
+	}else if(self != &localScheduler.get()) {
+		// The first resume() since the last updateQueue() already notified the CPU.
+		self->_wakeupIpisSuppressed.fetch_add(1, std::memory_order_relaxed);
 	}
 }
 
@@ -163,23 +324,39 @@ void Scheduler::suspendCurrent() {
 
 	// Update the unfairness on suspend.
 	self->_updateEntityStats(entity);
+	self->_deactivateEntity(entity);
 	entity->state = ScheduleState::attached;
+	entity->_voluntarySwitches++;
+	self->_handoffPending = (entity == self->_handoffSource);
 
+	ostrace::tracepoint(ostrace::Tracepoint::scheduleOut, reinterpret_cast<uintptr_t>(entity));
 	self->_current = nullptr;
 }
 
+uint64_t Scheduler::liveRunTime(ScheduleEntity *entity) {
+	assert(!intsAreEnabled());
+
+	auto self = &localScheduler.get();
+	if(entity != self->_current)
+		return entity->_runTime;
+	return entity->_runTime + (getClockNanos() - entity->_refClock);
+}
+
 Scheduler::Scheduler(CpuData *cpuContext)
-: _cpuContext{cpuContext}, _current{&globalIdleTask.get()} { }
+: _cpuContext{cpuContext}, _current{&globalIdleTask.get()},
+		_idlePollNanos{minIdlePoll} { }
 
 Progress Scheduler::_liveUnfairness(const ScheduleEntity *entity) {
 	assert(entity->type() == ScheduleType::regular);
 	assert(entity->state == ScheduleState::active);
 
 	auto delta_progress = _systemProgress - entity->refProgress;
+	auto weight = _effectiveWeight(entity);
 	if(entity == _current) {
-		return entity->baseUnfairness - _numWaiting * delta_progress;
+		return entity->baseUnfairness
+				- (((_totalWeight() - weight) * delta_progress) >> weightShift);
 	}else{
-		return entity->baseUnfairness + delta_progress;
+		return entity->baseUnfairness + ((weight * delta_progress) >> weightShift);
 	}
 }
 
@@ -205,56 +382,53 @@ void Scheduler::update() {
 }
 
 void Scheduler::updateState() {
-	// Returns the reciprocal in fixed point format.
-	auto fixedInverse = [] (int64_t x) -> int64_t {
-		return (INT64_C(1) << progressShift) / x;
-	};
-
 	assert(_current);
 
-	// Number of waiting/running threads.
-	auto n = _numWaiting;
-	if(_current->type() == ScheduleType::regular)
-		n++;
-
 	assert(haveTimer());
 	auto now = getClockNanos();
 	auto deltaTime = now - _refClock;
 	_refClock = now;
-	if(n)
-		_systemProgress += deltaTime * static_cast<Progress>(fixedInverse(n));
+	// Progress is measured per entity of default weight. Without groups,
+	// _activeWeight is defaultWeight times the number of waiting/running threads.
+	if(_activeWeight)
+		_systemProgress += deltaTime
+				* ((static_cast<Progress>(ScheduleGroup::defaultWeight) << progressShift)
+					/ _activeWeight);
 
 	_updateCurrentEntity();
 }
 
 // Move entities from the pending queue to the waiting queue.
 void Scheduler::updateQueue() {
-	frg::intrusive_list<
-		ScheduleEntity,
-		frg::locate_member<
-			ScheduleEntity,
-			frg::default_list_hook<ScheduleEntity>,
-			&ScheduleEntity::listHook
-		>
-	> pendingSnapshot;
-	{
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&_mutex);
-
-		pendingSnapshot.splice(pendingSnapshot.end(), _pendingList);
+	auto head = _pendingHead.exchange(nullptr, std::memory_order_acquire);
+
+	// Restore the order in which the entities were resumed.
+	ScheduleEntity *snapshot = nullptr;
+	while(head) {
+		auto next = head->pendingNext;
+		head->pendingNext = snapshot;
+		snapshot = head;
+		head = next;
 	}
-	while(!pendingSnapshot.empty()) {
-		auto entity = pendingSnapshot.pop_front();
+
+	while(snapshot) {
+		auto entity = snapshot;
+		snapshot = entity->pendingNext;
+		entity->pendingNext = nullptr;
 		assert(entity->state == ScheduleState::pending);
 
 		// Update the unfairness reference.
 		entity->refProgress = _systemProgress;
 		entity->_refClock = _refClock;
 		entity->state = ScheduleState::active;
+		_activateEntity(entity);
+		_updateLatencyClass(entity);
 
 		_waitQueue.push(entity);
 		_numWaiting++;
 	}
+
+	_unthrottleEntities();
 }
 
 bool Scheduler::maybeReschedule() {
@@ -262,6 +436,11 @@ bool Scheduler::maybeReschedule() {
 	assert(_current);
 
 	auto wantToSchedule = [this] () -> bool {
+		// Entities whose group exhausted its bandwidth quota are always switched out.
+		if(_current->type() == ScheduleType::regular && _current->_activeGroup
+				&& _current->_activeGroup->_throttledUntil(_refClock))
+			return true;
+
 		// If there are no waiters, we keep the current entity.
 		// Otherwise, if the current entity is not active anymore, we always switch.
 		if(_waitQueue.empty())
@@ -308,8 +487,17 @@ void Scheduler::forceReschedule() {
 
 	_current = _scheduled;
 	_scheduled = nullptr;
-	_sliceClock = _refClock;
+	// On handoff, the entity runs in the remainder of the time slice of the blocked entity.
+	// The preemption deadline (if any) stays armed for the same reason.
+	if(_handoffScheduled) {
+		_handoffScheduled = false;
+		countKernelStat(KernelStat::handoffSwitches);
+	}else{
+		_sliceClock = _refClock;
+	}
 	_mustCallPreemption = false;
+	countKernelStat(KernelStat::contextSwitches);
+	ostrace::tracepoint(ostrace::Tracepoint::scheduleIn, reinterpret_cast<uintptr_t>(_current));
 
 	if(!getPreemptionDeadline())
 		_updatePreemption();
@@ -324,6 +512,83 @@ void Scheduler::renewSchedule() {
 		_updatePreemption();
 }
 
+[[noreturn]] void Scheduler::runIdleLoop() {
+	assert(!intsAreEnabled());
+	assert(_current == &globalIdleTask.get());
+
+	enterIdleDomain();
+
+	while(true) {
+		// resume() pushes to _pendingHead before it inspects _idleState.
+		// Entities that were resumed before this store have sent a ping IPI instead.
+		_idleState.store(idlePolling, std::memory_order_seq_cst);
+
+		auto idleStart = getClockNanos();
+		bool wokenWhilePolling = false;
+
+		enableInts();
+		while(getClockNanos() - idleStart < _idlePollNanos) {
+			if(_idleState.load(std::memory_order_acquire) != idlePolling) {
+				wokenWhilePolling = true;
+				break;
+			}
+			pause();
+		}
+		disableInts();
+
+		if(!wokenWhilePolling) {
+			// Zero free pages such that page faults do not need to.
+			for(int i = 0; i < maxPrezeroPages; i++) {
+				if(_idleState.load(std::memory_order_acquire) != idlePolling)
+					break;
+				if(!physicalAllocator->prezeroPage())
+					break;
+			}
+
+			if(haveMonitorWait()) {
+				while(true) {
+					monitorAddress(&_idleState);
+					if(_idleState.load(std::memory_order_acquire) != idlePolling)
+						break;
+					waitForMonitorOrInterrupt();
+				}
+			}else{
+				// Without a monitor, wakeups from now on need to be delivered by IPI.
+				auto expected = idlePolling;
+				if(_idleState.compare_exchange_strong(expected, idleRunning,
+						std::memory_order_acq_rel))
+					waitForInterrupt();
+			}
+		}
+
+		_adaptIdlePoll(wokenWhilePolling, getClockNanos() - idleStart);
+
+		// If we did not go through handlePreemption(), we still need to leave the idle state.
+		leaveIdle();
+		passEpochQuiescentState();
+		update();
+		if(maybeReschedule())
+			commitReschedule();
+		renewSchedule();
+	}
+}
+
+bool Scheduler::_wakeIdle() {
+	auto expected = idlePolling;
+	return _idleState.compare_exchange_strong(expected, idleWoken,
+			std::memory_order_acq_rel, std::memory_order_relaxed);
+}
+
+void Scheduler::_adaptIdlePoll(bool wokenWhilePolling, uint64_t idleTime) {
+	// Grow the window if it caught the wakeup or if a slightly longer window
+	// would have caught it. Otherwise, polling only wastes power; shrink the window.
+	if(wokenWhilePolling || idleTime < maxIdlePoll) {
+		_idlePollNanos = frg::min(_idlePollNanos * 2, maxIdlePoll);
+	}else{
+		_idlePollNanos = frg::max(_idlePollNanos / 2, minIdlePoll);
+	}
+}
+
 ScheduleEntity *Scheduler::currentRunnable() {
 	assert(_current);
 	return _current;
@@ -339,8 +604,10 @@ void Scheduler::_unschedule() {
 			|| _current->state == ScheduleState::active) {
 		_waitQueue.push(_current);
 		_numWaiting++;
+		_current->_involuntarySwitches++;
 	}
 
+	ostrace::tracepoint(ostrace::Tracepoint::scheduleOut, reinterpret_cast<uintptr_t>(_current));
 	_current = nullptr;
 }
 
@@ -348,6 +615,26 @@ void Scheduler::_schedule() {
 	assert(!_current);
 	assert(!_scheduled);
 
+	auto handoff = _handoffPending ? _handoffCandidate : nullptr;
+	_handoffSource = nullptr;
+	_handoffCandidate = nullptr;
+	_handoffPending = false;
+
+	// Park entities whose group exhausted its bandwidth quota.
+	while(!_waitQueue.empty()) {
+		auto entity = _waitQueue.top();
+		if(!entity->_activeGroup || !entity->_activeGroup->_throttledUntil(_refClock))
+			break;
+		_waitQueue.pop();
+		_numWaiting--;
+
+		_updateWaitingEntity(entity);
+		_deactivateEntity(entity);
+		entity->_bandwidthThrottled = true;
+		entity->pendingNext = _throttledHead;
+		_throttledHead = entity;
+	}
+
 	if(_waitQueue.empty()) {
 		if(logScheduling)
 			infoLogger() << "No entities to schedule" << frg::endlog;
@@ -356,7 +643,21 @@ void Scheduler::_schedule() {
 	}
 
 	auto entity = _waitQueue.top();
-	_waitQueue.pop();
+
+	// Hand off the CPU to the entity that the blocked entity woke up, unless that would
+	// violate priorities. The candidate is only in _waitQueue if it is active and was not
+	// throttled; in particular, it cannot have been scheduled since it was resumed
+	// (as this would have cleared the candidate).
+	if(handoff && handoff != entity && handoff->state == ScheduleState::active
+			&& !handoff->_bandwidthThrottled
+			&& ScheduleEntity::orderPriority(handoff, entity) <= 0) {
+		_waitQueue.remove(handoff);
+		entity = handoff;
+		_handoffScheduled = true;
+	}else{
+		_waitQueue.pop();
+		_handoffScheduled = (entity == handoff);
+	}
 	_numWaiting--;
 
 	// Increase the unfairness at the start of the time slice.
@@ -386,9 +687,18 @@ void Scheduler::_updatePreemption() {
 	if(disablePreemption)
 		return;
 
+	// Bandwidth limits are enforced even if there are no other threads.
+	auto deadline = _bandwidthDeadline();
+	auto armPreemption = [&] {
+		if(deadline != UINT64_MAX)
+			setPreemptionDeadline(deadline);
+	};
+
 	// Disable preemption if there are no other threads.
-	if(_waitQueue.empty())
+	if(_waitQueue.empty()) {
+		armPreemption();
 		return;
+	}
 
 	// If there was no current entity, we would have rescheduled.
 	assert(_current);
@@ -397,14 +707,34 @@ void Scheduler::_updatePreemption() {
 
 	if(auto po = ScheduleEntity::orderPriority(_current, _waitQueue.top()); po < 0) {
 		// Disable preemption if we have higher priority.
+		// Latency class entities are still preempted once they exhaust their budget.
+		if(_current->_latencyBudget && !_current->_throttled)
+			deadline = frg::min(deadline, getClockNanos() + _remainingBudget(_current));
+		armPreemption();
 		return;
 	}else{
 		// If there was an entity with higher priority, we would have rescheduled.
 		assert(!po);
 	}
 
+	uint64_t slice = sliceGranularity;
+	if(_current->_latencyBudget && !_current->_throttled)
+		slice = frg::min(slice, _remainingBudget(_current));
+
 	ostrace::emit(ostEvtArmPreemption);
-	setPreemptionDeadline(getClockNanos() + sliceGranularity);
+	deadline = frg::min(deadline, getClockNanos() + slice);
+	armPreemption();
+}
+
+uint64_t Scheduler::_remainingBudget(ScheduleEntity *entity) {
+	auto runTime = entity->_runTime;
+	if(entity == _current)
+		runTime += _refClock - entity->_refClock;
+
+	auto used = runTime - entity->_periodRunTime;
+	if(used >= entity->_latencyBudget)
+		return 0;
+	return entity->_latencyBudget - used;
 }
 
 void Scheduler::_updateCurrentEntity() {
@@ -414,12 +744,16 @@ void Scheduler::_updateCurrentEntity() {
 	assert(_current->type() == ScheduleType::regular);
 
 	auto delta_progress = _systemProgress - _current->refProgress;
+	auto decrease = ((_totalWeight() - _effectiveWeight(_current)) * delta_progress) >> weightShift;
 	if(logUpdates)
 		infoLogger() << "Running thread unfairness decreases by: "
-				<< progressToNanos(_numWaiting * delta_progress) / 1000
+				<< progressToNanos(decrease) / 1000
 				<< " us (" << _numWaiting << " waiting threads)" << frg::endlog;
-	_current->baseUnfairness -= _numWaiting * delta_progress;
+	_current->baseUnfairness -= decrease;
 	_current->refProgress = _systemProgress;
+
+	_updateLatencyClass(_current);
+	_refreshGroup(_current);
 }
 
 void Scheduler::_updateWaitingEntity(ScheduleEntity *entity) {
@@ -427,11 +761,13 @@ void Scheduler::_updateWaitingEntity(ScheduleEntity *entity) {
 	assert(entity->state == ScheduleState::active);
 	assert(entity != _current);
 
+	auto increase = (_effectiveWeight(entity) * (_systemProgress - entity->refProgress))
+			>> weightShift;
 	if(logUpdates)
 		infoLogger() << "Waiting thread unfairness increases by: "
-				<< progressToNanos(_systemProgress - entity->refProgress) / 1000
+				<< progressToNanos(increase) / 1000
 				<< " us (" << _numWaiting << " waiting threads)" << frg::endlog;
-	entity->baseUnfairness += _systemProgress - entity->refProgress;
+	entity->baseUnfairness += increase;
 	entity->refProgress = _systemProgress;
 }
 
@@ -442,11 +778,155 @@ void Scheduler::_updateEntityStats(ScheduleEntity *entity) {
 	assert(entity->state == ScheduleState::active
 			|| entity == _current);
 
-	if(entity == _current)
-		entity->_runTime += _refClock - entity->_refClock;
+	if(entity == _current) {
+		auto delta = _refClock - entity->_refClock;
+		entity->_runTime += delta;
+		if(entity->_activeGroup && delta)
+			entity->_activeGroup->_charge(_refClock, delta);
+	}
 	entity->_refClock = _refClock;
 }
 
+void Scheduler::_activateEntity(ScheduleEntity *entity) {
+	assert(entity->type() == ScheduleType::regular);
+
+	{
+		auto lock = frg::guard(&entity->_associationMutex);
+		entity->_activeGroup = entity->_group;
+	}
+
+	auto cpu = _cpuContext->cpuIndex;
+	uint64_t weight = ScheduleGroup::defaultWeight;
+	for(auto group = entity->_activeGroup.get(); group; group = group->_parent.get()) {
+		assert(static_cast<size_t>(cpu) < group->_numCpus);
+		auto &state = group->_cpuStates[cpu];
+		state.activeWeight += weight;
+		if(state.numActive++)
+			return;
+		// The group just became active; it contributes its own weight to its parent.
+		weight = group->weight();
+		state.contributedWeight = weight;
+	}
+	_activeWeight += weight;
+}
+
+void Scheduler::_deactivateEntity(ScheduleEntity *entity) {
+	assert(entity->type() == ScheduleType::regular);
+
+	auto cpu = _cpuContext->cpuIndex;
+	uint64_t weight = ScheduleGroup::defaultWeight;
+	for(auto group = entity->_activeGroup.get(); group; group = group->_parent.get()) {
+		auto &state = group->_cpuStates[cpu];
+		assert(state.numActive);
+		assert(state.activeWeight >= weight);
+		state.activeWeight -= weight;
+		if(--state.numActive)
+			return;
+		weight = state.contributedWeight;
+	}
+	assert(_activeWeight >= weight);
+	_activeWeight -= weight;
+}
+
+void Scheduler::_refreshGroup(ScheduleEntity *entity) {
+	assert(entity->state == ScheduleState::active);
+
+	bool changed;
+	{
+		auto lock = frg::guard(&entity->_associationMutex);
+		changed = entity->_group.get() != entity->_activeGroup.get();
+	}
+	if(!changed)
+		return;
+
+	_deactivateEntity(entity);
+	_activateEntity(entity);
+}
+
+Progress Scheduler::_effectiveWeight(const ScheduleEntity *entity) {
+	auto cpu = _cpuContext->cpuIndex;
+	Progress share = static_cast<Progress>(1) << weightShift;
+	uint64_t weight = ScheduleGroup::defaultWeight;
+	for(auto group = entity->_activeGroup.get(); group; group = group->_parent.get()) {
+		auto &state = group->_cpuStates[cpu];
+		assert(state.activeWeight);
+		share = share * weight / state.activeWeight;
+		weight = state.contributedWeight;
+	}
+	return share * weight / ScheduleGroup::defaultWeight;
+}
+
+Progress Scheduler::_totalWeight() {
+	return (static_cast<Progress>(_activeWeight) << weightShift) / ScheduleGroup::defaultWeight;
+}
+
+void Scheduler::_unthrottleEntities() {
+	auto entity = _throttledHead;
+	_throttledHead = nullptr;
+	while(entity) {
+		auto next = entity->pendingNext;
+		assert(entity->_bandwidthThrottled);
+		if(entity->_activeGroup->_throttledUntil(_refClock)) {
+			entity->pendingNext = _throttledHead;
+			_throttledHead = entity;
+		}else{
+			entity->pendingNext = nullptr;
+			entity->_bandwidthThrottled = false;
+
+			// Do not account the throttled time as unfairness.
+			entity->refProgress = _systemProgress;
+			entity->_refClock = _refClock;
+			_activateEntity(entity);
+			_updateLatencyClass(entity);
+
+			_waitQueue.push(entity);
+			_numWaiting++;
+		}
+		entity = next;
+	}
+}
+
+uint64_t Scheduler::_bandwidthDeadline() {
+	auto now = getClockNanos();
+	uint64_t deadline = UINT64_MAX;
+
+	// Preempt the current entity once its group exhausts its quota.
+	if(_current->type() == ScheduleType::regular && _current->_activeGroup) {
+		auto remaining = _current->_activeGroup->_remainingQuota(_refClock);
+		if(remaining != UINT64_MAX)
+			deadline = now + remaining;
+	}
+
+	// Wake up once the quota of throttled entities is renewed.
+	for(auto entity = _throttledHead; entity; entity = entity->pendingNext) {
+		auto until = entity->_activeGroup->_throttledUntil(now);
+		deadline = frg::min(deadline, until ? until : now);
+	}
+
+	return deadline;
+}
+
+void Scheduler::_updateLatencyClass(ScheduleEntity *entity) {
+	if(!entity->_latencyBudget)
+		return;
+
+	if(_refClock - entity->_periodStart >= entity->_latencyPeriod) {
+		auto runTime = entity->_runTime;
+		if(entity == _current)
+			runTime += _refClock - entity->_refClock;
+
+		entity->_periodStart = _refClock;
+		entity->_periodRunTime = runTime;
+		entity->_throttled = false;
+	}else if(!_remainingBudget(entity)) {
+		entity->_throttled = true;
+	}
+
+	entity->priority = entity->_throttled
+			? entity->basePriority
+			: latencyPriorityBase + entity->_latencyPriority;
+}
+
 namespace {
 
 template<typename ImageAccessor>
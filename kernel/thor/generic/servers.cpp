@@ -7,6 +7,7 @@
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/debug.hpp>
 #include <thor-internal/load-balancing.hpp>
+#include <thor-internal/lz4.hpp>
 #include <thor-internal/universe.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/module.hpp>
@@ -22,7 +23,7 @@ static bool debugLaunch = true;
 frg::manual_box<LaneHandle> mbusClient;
 static frg::manual_box<LaneHandle> futureMbusServer;
 
-frg::ticket_spinlock globalMfsMutex;
+TicketSpinlock globalMfsMutex;
 
 extern MfsDirectory *mfsRoot;
 
@@ -43,16 +44,10 @@ void runService(frg::string<KernelAlloc> desc, LaneHandle control_lane,
 // File management.
 // ------------------------------------------------------------------------
 
-coroutine<bool> createMfsFile(frg::string_view path, const void *buffer, size_t size,
+// Links a file that is backed by the given memory into the MFS.
+// Returns false if the file already exists; in that case, *out is the existing file.
+bool linkMfsFile(frg::string_view path, smarter::shared_ptr<MemoryView> memory, size_t size,
 		MfsRegular **out) {
-	// Copy to the memory object before taking locks below.
-	auto memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc,
-			(size + (kPageSize - 1)) & ~size_t{kPageSize - 1});
-	memory->selfPtr = memory;
-	auto copyOutcome = co_await memory->copyTo(0, buffer, size,
-			WorkQueue::generalQueue()->take());
-	assert(copyOutcome);
-
 	auto irqLock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&globalMfsMutex);
 
@@ -100,13 +95,93 @@ coroutine<bool> createMfsFile(frg::string_view path, const void *buffer, size_t
 	if(auto file = directory->getTarget(name); file) {
 		assert(file->type == MfsType::regular);
 		*out = static_cast<MfsRegular *>(file);
-		co_return false;
+		return false;
 	}
 
 	auto file = frg::construct<MfsRegular>(*kernelAlloc, std::move(memory), size);
 	directory->link(frg::string<KernelAlloc>{*kernelAlloc, name}, file);
 	*out = file;
-	co_return true;
+	return true;
+}
+
+coroutine<bool> createMfsFile(frg::string_view path, const void *buffer, size_t size,
+		MfsRegular **out) {
+	// Copy to the memory object before taking locks in linkMfsFile().
+	auto memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc,
+			(size + (kPageSize - 1)) & ~size_t{kPageSize - 1});
+	memory->selfPtr = memory;
+	auto copyOutcome = co_await memory->copyTo(0, buffer, size,
+			WorkQueue::generalQueue()->take());
+	assert(copyOutcome);
+
+	co_return linkMfsFile(path, std::move(memory), size, out);
+}
+
+MfsRegular::MfsRegular(const void *compressed, size_t compressedSize)
+: MfsNode{MfsType::regular},
+		_compressed{static_cast<const char *>(compressed)}, _compressedSize{compressedSize} {
+	CompressedModuleHeader header;
+	assert(compressedSize >= sizeof(CompressedModuleHeader));
+	memcpy(&header, compressed, sizeof(CompressedModuleHeader));
+	assert(!memcmp(header.magic, compressedModuleMagic, sizeof(compressedModuleMagic)));
+	assert(header.chunkSize && !(header.chunkSize & (kPageSize - 1)));
+	_size = header.size;
+}
+
+coroutine<smarter::shared_ptr<MemoryView>> MfsRegular::accessMemory() {
+	co_await _mutex.async_lock();
+
+	if(_compressed) {
+		CompressedModuleHeader header;
+		memcpy(&header, _compressed, sizeof(CompressedModuleHeader));
+
+		auto memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc,
+				(_size + (kPageSize - 1)) & ~size_t{kPageSize - 1});
+		memory->selfPtr = memory;
+
+		// Decompress chunk by chunk such that we only need a small intermediate buffer.
+		frg::unique_memory<KernelAlloc> buffer{*kernelAlloc, header.chunkSize};
+		auto p = _compressed + sizeof(CompressedModuleHeader);
+		auto limit = _compressed + _compressedSize;
+		size_t progress = 0;
+		while(progress < _size) {
+			auto chunkSize = frg::min(_size - progress, size_t{header.chunkSize});
+
+			uint32_t word;
+			assert(p + sizeof(uint32_t) <= limit);
+			memcpy(&word, p, sizeof(uint32_t));
+			p += sizeof(uint32_t);
+			auto length = word & ~compressedChunkStored;
+			assert(p + length <= limit);
+
+			const void *data;
+			if(word & compressedChunkStored) {
+				assert(length == chunkSize);
+				data = p;
+			}else{
+				auto n = lz4DecompressBlock(p, length, buffer.data(), chunkSize);
+				if(!n || *n != chunkSize) {
+					panicLogger() << "thor: Corrupted LZ4 chunk at offset " << progress
+							<< " of compressed initrd file" << frg::endlog;
+					__builtin_unreachable();
+				}
+				data = buffer.data();
+			}
+
+			auto copyOutcome = co_await memory->copyTo(progress, data, chunkSize,
+					WorkQueue::generalQueue()->take());
+			assert(copyOutcome);
+			p += length;
+			progress += chunkSize;
+		}
+
+		_memory = std::move(memory);
+		_compressed = nullptr;
+	}
+
+	auto memory = _memory;
+	_mutex.unlock();
+	co_return memory;
 }
 
 MfsNode *resolveModule(frg::string_view path) {
@@ -267,13 +342,13 @@ coroutine<void> executeModule(frg::string_view name, MfsRegular *module,
 		Scheduler *scheduler) {
 	auto space = AddressSpace::create();
 
-	ImageInfo exec_info = co_await loadModuleImage(space, 0, module->getMemory());
+	ImageInfo exec_info = co_await loadModuleImage(space, 0, co_await module->accessMemory());
 
 	// FIXME: use actual interpreter name here
 	auto rtdl_module = resolveModule("usr/lib/ld-init.so");
 	assert(rtdl_module && rtdl_module->type == MfsType::regular);
 	ImageInfo interp_info = co_await loadModuleImage(space, 0x40000000,
-			static_cast<MfsRegular *>(rtdl_module)->getMemory());
+			co_await static_cast<MfsRegular *>(rtdl_module)->accessMemory());
 
 	// allocate and map memory for the user mode stack
 	size_t stack_size = 0x10000;
@@ -446,6 +521,20 @@ private:
 		if(acceptError != Error::success)
 			co_return acceptError;
 
+		// Handle each conversation concurrently. This allows runsvr to upload files
+		// and to start independent servers in parallel.
+		async::detach_with_allocator(*kernelAlloc, [] (SvrctlBusObject *self,
+				LaneHandle boundLane, LaneHandle lane) -> coroutine<void> {
+			auto result = co_await self->handleConversation(boundLane, std::move(lane));
+			if(!result)
+				infoLogger() << "thor: failed to handle svrctl request with error "
+						<< static_cast<int>(result.error()) << frg::endlog;
+		}(this, boundLane, std::move(lane)));
+
+		co_return frg::success;
+	}
+
+	coroutine<frg::expected<Error>> handleConversation(LaneHandle boundLane, LaneHandle lane) {
 		auto [reqError, reqBuffer] = co_await RecvBufferSender{lane};
 		if(reqError != Error::success)
 			co_return reqError;
@@ -472,6 +561,23 @@ private:
 					if(file->size() != dataBuffer.size())
 						resp.set_error(managarm::svrctl::Errors::DATA_MISMATCH);
 				}
+			}else if(req->with_memory()) {
+				// Adopt the memory object as-is. This avoids copying large files
+				// through the lane and again into a kernel-allocated memory object.
+				auto [memoryError, memoryDescriptor] = co_await PullDescriptorSender{lane};
+				if(memoryError != Error::success)
+					co_return memoryError;
+				if(!memoryDescriptor.is<MemoryViewDescriptor>())
+					co_return Error::protocolViolation;
+				auto memory = memoryDescriptor.get<MemoryViewDescriptor>().memory;
+				if(req->size() > memory->getLength())
+					co_return Error::protocolViolation;
+
+				MfsRegular *file;
+				if(!linkMfsFile(req->name(), std::move(memory), req->size(), &file)) {
+					if(file->size() != req->size())
+						resp.set_error(managarm::svrctl::Errors::DATA_MISMATCH);
+				}
 			}else{
 				auto file = resolveModule(req->name());
 				if(!file)
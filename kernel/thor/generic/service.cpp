@@ -166,7 +166,8 @@ namespace initrd {
 
 				frg::unique_memory<KernelAlloc> dataBuffer{*kernelAlloc,
 						frg::min(size_t(req.size()), file->module->size() - file->offset)};
-				auto copyOutcome = co_await file->module->getMemory()->copyFrom(file->offset,
+				auto memory = co_await file->module->accessMemory();
+				auto copyOutcome = co_await memory->copyFrom(file->offset,
 					dataBuffer.data(), dataBuffer.size(), WorkQueue::generalQueue()->take());
 				assert(copyOutcome);
 				file->offset += dataBuffer.size();
@@ -211,7 +212,7 @@ namespace initrd {
 				assert(respError == Error::success);
 
 				auto memoryError = co_await PushDescriptorSender{conversation,
-						MemoryViewDescriptor{file->module->getMemory()}};
+						MemoryViewDescriptor{co_await file->module->accessMemory()}};
 				// TODO: improve error handling here.
 				assert(memoryError == Error::success);
 			}else{
@@ -728,7 +729,7 @@ namespace posix {
 					assert((size_t)req->fd() < openFiles.size());
 					auto abstractFile = openFiles[req->fd()];
 					auto moduleFile = static_cast<initrd::OpenRegular *>(abstractFile);
-					fileMemory = moduleFile->module->getMemory();
+					fileMemory = co_await moduleFile->module->accessMemory();
 				}
 
 				smarter::shared_ptr<MemorySlice> slice;
@@ -853,6 +854,7 @@ namespace posix {
 					mbusHandle,
 					nullptr,
 					reinterpret_cast<HelHandle *>(clientFileTable),
+					nullptr,
 					nullptr
 				};
 
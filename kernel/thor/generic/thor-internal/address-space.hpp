@@ -3,8 +3,10 @@
 #include <async/basic.hpp>
 #include <async/mutex.hpp>
 #include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
 #include <frg/container_of.hpp>
 #include <frg/expected.hpp>
+#include <frg/list.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/memory-view.hpp>
 #include <thor-internal/mm-rc.hpp>
@@ -27,13 +29,103 @@ inline CachingMode determineCachingMode(CachingMode physicalRangeCaching,
 	return physicalRangeCaching;
 }
 
+// The shared zero page is always mapped read-only.
+// Writes to it fault and make the view replace it by a private page.
+inline PageFlags restrictPageFlags(PhysicalAddr physical, PageFlags flags) {
+	if(physical == getZeroPage())
+		return flags & ~page_access::write;
+	return flags;
+}
+
+struct FaultAroundStatistics {
+	// Number of pages that were mapped ahead by fault-around.
+	uint64_t mappedAhead;
+	// Number of pages mapped ahead that were (not) accessed before they were unmapped.
+	// Only available if the page tables report accessed bits (currently x86).
+	uint64_t usedAhead;
+	uint64_t unusedAhead;
+};
+
+FaultAroundStatistics getFaultAroundStatistics();
+
+void countFaultAround(size_t mappedAhead);
+void countPrefaultedUnmap(bool accessed);
+
+// Number of bytes that are mapped into a page space, split by the kind of memory.
+// Pages that are mapped more than once are also counted more than once.
+struct ResidentCounters {
+	// Also updates the system-wide counters (see globalResidentCounters()).
+	void account(MemoryView *view, ptrdiff_t delta);
+
+	size_t anonymousBytes() {
+		return anonymous_.load(std::memory_order_relaxed);
+	}
+
+	size_t fileBytes() {
+		return file_.load(std::memory_order_relaxed);
+	}
+
+private:
+	void add_(bool pageCache, ptrdiff_t delta) {
+		auto &counter = pageCache ? file_ : anonymous_;
+		counter.fetch_add(static_cast<size_t>(delta), std::memory_order_relaxed);
+	}
+
+	std::atomic<size_t> anonymous_{0};
+	std::atomic<size_t> file_{0};
+};
+
+// Sum of the counters of all address spaces.
+ResidentCounters &globalResidentCounters();
+
+// Called whenever a PTE is unmapped or replaced.
+inline void accountPrefaulted(PageStatus status) {
+	if(status & page_status::prefaulted)
+		countPrefaultedUnmap(status & page_status::accessed);
+}
+
+// Candidates for large page mappings, in order of preference.
+// Cursors only use the sizes that are actually supported by the page tables.
+inline constexpr size_t largePageSizes[] = {size_t{1} << 30, size_t{1} << 21};
+
+// Determines whether a large page can be used to map the view at the cursor's address
+// (without exceeding the given limit). Returns the size of the large page or zero.
+template<typename Cursor>
+size_t pickLargePageSize(Cursor &c, VirtualAddr limit,
+		MemoryView *view, uintptr_t offset, PhysicalAddr physical) {
+	if constexpr (Cursor::supportsLargePages) {
+		auto va = c.virtualAddress();
+		size_t contiguous = 0;
+		for(auto pageSize : largePageSizes) {
+			if(!Cursor::canMapLarge(pageSize))
+				continue;
+			if((va & (pageSize - 1)) || (physical & (pageSize - 1)))
+				continue;
+			if(limit - va < pageSize)
+				continue;
+			// Only query the view once we know that the alignment is suitable.
+			if(!contiguous)
+				contiguous = view->peekContiguousRange(offset);
+			if(contiguous < pageSize)
+				continue;
+			return pageSize;
+		}
+	}
+	return 0;
+}
+
+// The *ByCursor() functions update the given ResidentCounters (if any)
+// by the amount of memory that they map or unmap.
+
 template<typename Cursor, typename PageSpace>
 frg::expected<Error> mapPresentPagesByCursor(PageSpace *ps, VirtualAddr va,
-		MemoryView *view, uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) {
+		MemoryView *view, uintptr_t offset, size_t size, PageFlags flags, CachingMode mode,
+		ResidentCounters *resident = nullptr) {
 	assert(!(va & (kPageSize - 1)));
 	assert(!(offset & (kPageSize - 1)));
 	assert(!(size & (kPageSize - 1)));
 
+	ptrdiff_t residentDelta = 0;
 	Cursor c{ps, va};
 	while(c.virtualAddress() < va + size) {
 		auto progress = c.virtualAddress() - va;
@@ -44,50 +136,98 @@ frg::expected<Error> mapPresentPagesByCursor(PageSpace *ps, VirtualAddr va,
 		}
 		assert(!(physicalRange.template get<0>() & (kPageSize - 1)));
 
-		c.map4k(physicalRange.template get<0>(), flags,
-			determineCachingMode(physicalRange.template get<1>(), mode));
+		auto caching = determineCachingMode(physicalRange.template get<1>(), mode);
+		if constexpr (Cursor::supportsLargePages) {
+			auto largeSize = pickLargePageSize(c, va + size, view, offset + progress,
+					physicalRange.template get<0>());
+			if(largeSize && c.mapLarge(physicalRange.template get<0>(), largeSize,
+					flags, caching)) {
+				residentDelta += largeSize;
+				c.advance(largeSize);
+				continue;
+			}
+		}
+
+		c.map4k(physicalRange.template get<0>(),
+				restrictPageFlags(physicalRange.template get<0>(), flags), caching);
+		residentDelta += kPageSize;
 		c.advance4k();
 	}
+
+	if(resident)
+		resident->account(view, residentDelta);
 	return {};
 }
 
 template<typename Cursor, typename PageSpace>
 frg::expected<Error> remapPresentPagesByCursor(PageSpace *ps, VirtualAddr va,
-		MemoryView *view, uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) {
+		MemoryView *view, uintptr_t offset, size_t size, PageFlags flags, CachingMode mode,
+		ResidentCounters *resident = nullptr) {
 	assert(!(va & (kPageSize - 1)));
 	assert(!(offset & (kPageSize - 1)));
 	assert(!(size & (kPageSize - 1)));
 
+	ptrdiff_t residentDelta = 0;
 	Cursor c{ps, va};
 	while(c.virtualAddress() < va + size) {
 		auto progress = c.virtualAddress() - va;
 
 		auto physicalRange = view->peekRange(offset + progress);
+
+		// Large pages that are entirely contained in the range are remapped as a whole.
+		// Otherwise, the 4 KiB operations below split them.
+		if constexpr (Cursor::supportsLargePages) {
+			auto largeSize = c.largePageSize();
+			if(largeSize && physicalRange.template get<0>() != PhysicalAddr(-1)
+					&& pickLargePageSize(c, va + size, view, offset + progress,
+						physicalRange.template get<0>()) == largeSize) {
+				auto status = c.remapLarge(physicalRange.template get<0>(), flags,
+					determineCachingMode(physicalRange.template get<1>(), mode));
+				c.advance(largeSize);
+
+				if((status & page_status::present) && (status & page_status::dirty)) {
+					view->markDirty(offset + progress, largeSize);
+				}
+				continue;
+			}
+		}
+
 		if(physicalRange.template get<0>() == PhysicalAddr(-1)) {
 			auto [status, _] = c.unmap4k();
+			if(status & page_status::present)
+				residentDelta -= kPageSize;
 			if((status & page_status::present) && (status & page_status::dirty)) {
 				view->markDirty(offset + progress, kPageSize);
 			}
+			accountPrefaulted(status);
 
 			c.advance4k();
 			continue;
 		}
 		assert(!(physicalRange.template get<0>() & (kPageSize - 1)));
 
-		auto status = c.remap4k(physicalRange.template get<0>(), flags,
+		auto status = c.remap4k(physicalRange.template get<0>(),
+			restrictPageFlags(physicalRange.template get<0>(), flags),
 			determineCachingMode(physicalRange.template get<1>(), mode));
 		c.advance4k();
 
+		if(!(status & page_status::present))
+			residentDelta += kPageSize;
 		if((status & page_status::present) && (status & page_status::dirty)) {
 			view->markDirty(offset + progress, kPageSize);
 		}
+		accountPrefaulted(status);
 	}
+
+	if(resident)
+		resident->account(view, residentDelta);
 	return {};
 }
 
 template<typename Cursor, typename PageSpace>
 frg::expected<Error> faultPageByCursor(PageSpace *ps, VirtualAddr va,
-		MemoryView *view, uintptr_t offset, PageFlags flags, CachingMode mode) {
+		MemoryView *view, uintptr_t offset, PageFlags flags, CachingMode mode,
+		ResidentCounters *resident = nullptr) {
 	assert(!(va & (kPageSize - 1)));
 	assert(!(offset & (kPageSize - 1)));
 
@@ -97,16 +237,79 @@ frg::expected<Error> faultPageByCursor(PageSpace *ps, VirtualAddr va,
 	if(physicalRange.get<0>() == PhysicalAddr(-1))
 		return Error::fault;
 
-	auto status = c.remap4k(physicalRange.template get<0>(), flags,
+	auto status = c.remap4k(physicalRange.template get<0>(),
+		restrictPageFlags(physicalRange.template get<0>(), flags),
 		determineCachingMode(physicalRange.template get<1>(), mode));
 	if(status & page_status::present) {
 		if(status & page_status::dirty)
 			view->markDirty(offset, kPageSize);
+	}else if(resident) {
+		resident->account(view, kPageSize);
+	}
+	accountPrefaulted(status);
+
+	return {};
+}
+
+// Maps pages of the view that are already present into the given range
+// (skipping pages that are already mapped). Used to avoid faults on neighbouring pages.
+template<typename Cursor, typename PageSpace>
+frg::expected<Error> faultAroundByCursor(PageSpace *ps, VirtualAddr va,
+		MemoryView *view, uintptr_t offset, size_t size, PageFlags flags, CachingMode mode,
+		ResidentCounters *resident = nullptr) {
+	assert(!(va & (kPageSize - 1)));
+	assert(!(offset & (kPageSize - 1)));
+	assert(!(size & (kPageSize - 1)));
+
+	size_t mappedAhead = 0;
+	Cursor c{ps, va};
+	while(c.virtualAddress() < va + size) {
+		auto progress = c.virtualAddress() - va;
+		auto physicalRange = view->peekRange(offset + progress);
+		if(physicalRange.template get<0>() != PhysicalAddr(-1)
+				&& c.mapPrefaulted4k(physicalRange.template get<0>(),
+					restrictPageFlags(physicalRange.template get<0>(), flags),
+					determineCachingMode(physicalRange.template get<1>(), mode)))
+			mappedAhead++;
+		c.advance4k();
 	}
 
+	countFaultAround(mappedAhead);
+	if(resident)
+		resident->account(view, mappedAhead * kPageSize);
 	return {};
 }
 
+// Maps a large page of the given size. Fails with Error::fault if a large page cannot be used
+// (e.g., because the memory is not contiguous or the range is already covered by page tables).
+template<typename Cursor, typename PageSpace>
+frg::expected<Error> faultLargePageByCursor(PageSpace *ps, VirtualAddr va,
+		MemoryView *view, uintptr_t offset, size_t size, PageFlags flags, CachingMode mode,
+		ResidentCounters *resident = nullptr) {
+	assert(!(va & (size - 1)));
+	assert(!(offset & (kPageSize - 1)));
+
+	if constexpr (Cursor::supportsLargePages) {
+		Cursor c{ps, va};
+
+		auto physicalRange = view->peekRange(offset);
+		if(physicalRange.template get<0>() == PhysicalAddr(-1))
+			return Error::fault;
+		if(pickLargePageSize(c, va + size, view, offset,
+				physicalRange.template get<0>()) != size)
+			return Error::fault;
+
+		if(!c.mapLarge(physicalRange.template get<0>(), size, flags,
+				determineCachingMode(physicalRange.template get<1>(), mode)))
+			return Error::fault;
+		if(resident)
+			resident->account(view, size);
+		return {};
+	}
+
+	return Error::fault;
+}
+
 template<typename Cursor, typename PageSpace>
 frg::expected<Error> cleanPagesByCursor(PageSpace *ps, VirtualAddr va,
 		MemoryView *view, uintptr_t offset, size_t size) {
@@ -118,6 +321,20 @@ frg::expected<Error> cleanPagesByCursor(PageSpace *ps, VirtualAddr va,
 	while(c.findDirty(va + size)) {
 		auto progress = c.virtualAddress() - va;
 
+		if constexpr (Cursor::supportsLargePages) {
+			auto largeSize = c.largePageSize();
+			if(largeSize && !(c.virtualAddress() & (largeSize - 1))
+					&& va + size - c.virtualAddress() >= largeSize) {
+				auto status = c.cleanLarge();
+				assert(status & page_status::present);
+				assert(status & page_status::dirty);
+				view->markDirty(offset + progress, largeSize);
+
+				c.advance(largeSize);
+				continue;
+			}
+		}
+
 		auto status = c.clean4k();
 		assert(status & page_status::present);
 		assert(status & page_status::dirty);
@@ -130,22 +347,44 @@ frg::expected<Error> cleanPagesByCursor(PageSpace *ps, VirtualAddr va,
 
 template<typename Cursor, typename PageSpace>
 frg::expected<Error> unmapPagesByCursor(PageSpace *ps, VirtualAddr va,
-		MemoryView *view, uintptr_t offset, size_t size) {
+		MemoryView *view, uintptr_t offset, size_t size,
+		ResidentCounters *resident = nullptr) {
 	assert(!(va & (kPageSize - 1)));
 	assert(!(offset & (kPageSize - 1)));
 	assert(!(size & (kPageSize - 1)));
 
+	ptrdiff_t residentDelta = 0;
 	Cursor c{ps, va};
 	while(c.findPresent(va + size)) {
 		auto progress = c.virtualAddress() - va;
 
+		if constexpr (Cursor::supportsLargePages) {
+			auto largeSize = c.largePageSize();
+			if(largeSize && !(c.virtualAddress() & (largeSize - 1))
+					&& va + size - c.virtualAddress() >= largeSize) {
+				auto [status, _] = c.unmapLarge();
+				assert(status & page_status::present);
+				if(status & page_status::dirty)
+					view->markDirty(offset + progress, largeSize);
+				residentDelta -= largeSize;
+
+				c.advance(largeSize);
+				continue;
+			}
+		}
+
 		auto [status, _] = c.unmap4k();
 		assert(status & page_status::present);
 		if(status & page_status::dirty)
 			view->markDirty(offset + progress, kPageSize);
+		accountPrefaulted(status);
+		residentDelta -= kPageSize;
 
 		c.advance4k();
 	}
+
+	if(resident)
+		resident->account(view, residentDelta);
 	return {};
 }
 
@@ -193,6 +432,16 @@ struct VirtualOperations {
 	virtual frg::expected<Error> faultPage(VirtualAddr va, MemoryView *view,
 			uintptr_t offset, PageFlags flags, CachingMode mode);
 
+	// Maps the pages of the given range that are present in the view and not mapped yet.
+	// The default implementation does nothing (i.e., it disables fault-around).
+	virtual frg::expected<Error> faultAround(VirtualAddr va, MemoryView *view,
+			uintptr_t offset, size_t size, PageFlags flags, CachingMode mode);
+
+	// Tries to map a large page of the given size.
+	// Returns Error::fault if a large page cannot be used.
+	virtual frg::expected<Error> faultLargePage(VirtualAddr va, MemoryView *view,
+			uintptr_t offset, size_t size, PageFlags flags, CachingMode mode);
+
 	virtual frg::expected<Error> cleanPages(VirtualAddr va, MemoryView *view,
 			uintptr_t offset, size_t size);
 
@@ -469,7 +718,7 @@ public:
 	// This mutex is held whenever we modify parts of the page space that belong
 	// to this mapping (using VirtualOperation::mapSingle4k and similar). This is
 	// necessary since we sometimes need to read pages before writing them.
-	frg::ticket_spinlock pagingMutex;
+	TicketSpinlock pagingMutex;
 };
 
 struct HoleLess {
@@ -504,6 +753,60 @@ using MappingTree = frg::rbtree<
 	MappingLess
 >;
 
+// Readers-writer lock on ranges of virtual addresses.
+// Requests are processed in FIFO order: a request is granted once all
+// earlier requests that overlap it (and that conflict with it) are released.
+struct RangeLock {
+	struct Holder {
+		friend struct RangeLock;
+
+		Holder() = default;
+
+		Holder(const Holder &) = delete;
+
+		~Holder() {
+			if(lock_)
+				lock_->release(this);
+		}
+
+		Holder &operator= (const Holder &) = delete;
+
+	private:
+		RangeLock *lock_ = nullptr;
+		VirtualAddr address_ = 0;
+		size_t length_ = 0;
+		bool exclusive_ = false;
+		frg::default_list_hook<Holder> queueHook_;
+	};
+
+	// Queues a request. This never blocks, i.e., it can be called while holding spinlocks.
+	void enqueue(Holder *holder, VirtualAddr address, size_t length, bool exclusive);
+
+	// Waits until a queued request is granted.
+	coroutine<void> wait(Holder *holder);
+
+	// Releases a request (regardless of whether it was granted already).
+	// This is also done by ~Holder().
+	void release(Holder *holder);
+
+private:
+	// Must be called with _mutex held.
+	bool _isBlocked(Holder *holder);
+
+	TicketSpinlock _mutex;
+
+	frg::intrusive_list<
+		Holder,
+		frg::locate_member<
+			Holder,
+			frg::default_list_hook<Holder>,
+			&Holder::queueHook_
+		>
+	> _queue;
+
+	async::recurring_event _releaseEvent;
+};
+
 struct VirtualSpace {
 	friend struct Mapping;
 
@@ -547,12 +850,28 @@ public:
 	coroutine<frg::expected<Error>>
 	unmap(VirtualAddr address, size_t length);
 
+	// Drops private pages of the mappings in the given range (see MemoryView::discardRange()).
+	coroutine<frg::expected<Error>>
+	discard(VirtualAddr address, size_t length, smarter::shared_ptr<WorkQueue> wq);
+
+	// Prefaults all pages in the given range, as if they were accessed with the given FaultFlags.
+	// Write faults are only simulated for writable mappings.
+	coroutine<frg::expected<Error>>
+	populate(VirtualAddr address, size_t length, uint32_t flags,
+			smarter::shared_ptr<WorkQueue> wq);
+
 	coroutine<frg::expected<Error>>
 	handleFault(VirtualAddr address, uint32_t flags, smarter::shared_ptr<WorkQueue> wq);
 
 	coroutine<frg::expected<Error, PhysicalAddr>>
 	retrievePhysical(VirtualAddr address, smarter::shared_ptr<WorkQueue> wq);
 
+	// Like retrievePhysical() but for a whole range, see retrievePhysicalExtents().
+	coroutine<frg::expected<Error, size_t>>
+	retrievePhysicalExtents(VirtualAddr address, size_t size,
+			PhysicalExtent *extents, size_t &numExtents, size_t maxExtents,
+			smarter::shared_ptr<WorkQueue> wq);
+
 	size_t rss() {
 		return _ops->getRss();
 	}
@@ -580,6 +899,14 @@ public:
 		);
 	}
 
+	// Copies data from another VirtualSpace directly into this VirtualSpace,
+	// without going through an intermediate kernel buffer.
+	// Returns the number of bytes that were copied and whether copying stopped
+	// due to a fault in the source space (as opposed to this space).
+	coroutine<frg::tuple<size_t, bool>> copyFromSpace(uintptr_t address,
+			VirtualSpace *source, uintptr_t sourceAddress, size_t size,
+			smarter::shared_ptr<WorkQueue> wq);
+
 	auto writeSpace(uintptr_t address, const void *buffer, size_t size,
 			smarter::shared_ptr<WorkQueue> wq) {
 		return async::transform(
@@ -597,7 +924,7 @@ public:
 	// ----------------------------------------------------------------------------------
 
 	frg::expected<Error, FutexIdentity> resolveGlobalFutex(uintptr_t address) {
-		// We do not take _consistencyMutex here since we are only interested in a snapshot.
+		// We do not take _rangeLock here since we are only interested in a snapshot.
 
 		smarter::shared_ptr<Mapping> mapping;
 		{
@@ -617,7 +944,7 @@ public:
 
 	coroutine<frg::expected<Error, GlobalFutex>> grabGlobalFutex(uintptr_t address,
 			smarter::shared_ptr<WorkQueue> wq) {
-		// We do not take _consistencyMutex here since we are only interested in a snapshot.
+		// We do not take _rangeLock here since we are only interested in a snapshot.
 
 		smarter::shared_ptr<Mapping> mapping;
 		{
@@ -654,27 +981,45 @@ private:
 	// Splits some memory range from a hole mapping.
 	void _splitHole(Hole *hole, VirtualAddr offset, VirtualAddr length);
 
+	// Returns the mapping with the lowest address in [address, end), if any.
+	smarter::shared_ptr<Mapping> _findFirstMapping(VirtualAddr address, VirtualAddr end);
+
+	// Returns a hole to the hole tree, merging it with adjacent holes.
+	void _insertHole(VirtualAddr address, size_t length);
+
+	// Exclusively locks a range, extended to all mappings that intersect it
+	// (such that these mappings can be split).
+	coroutine<void> _lockRangeForUpdate(RangeLock::Holder *holder,
+			VirtualAddr address, size_t length);
+
 	// Potentially splits mappings into two parts at (address) and (address + size).
-	// Returns the start and end mappings that are within the specified range.
-	coroutine<frg::tuple<Mapping *, Mapping *>> _splitMappings(uintptr_t address, size_t size);
+	// Afterwards, all mappings that intersect the range are contained in it.
+	// The caller must hold a lock obtained from _lockRangeForUpdate().
+	coroutine<void> _splitMappings(uintptr_t address, size_t size);
 
 	// Used in conjunction with _splitMappings.
-	// Unmaps and removes all mappings between start and end that fall within the specified range.
+	// Unmaps and removes all mappings within the specified range.
+	// The address ranges of these mappings are *not* returned to the hole tree since
+	// that can only be done after shootdown; instead, they are appended to freedRanges.
 	// Returns whether shootdown needs to be performed (any of the mappings got unmapped).
-	coroutine<bool> _unmapMappings(VirtualAddr address, size_t length, Mapping *start, Mapping *end);
+	coroutine<bool> _unmapMappings(VirtualAddr address, size_t length,
+			frg::vector<frg::tuple<VirtualAddr, size_t>, KernelAlloc> &freedRanges);
 
 	VirtualOperations *_ops;
 
 	// Since changing memory mappings requires TLB shootdown, most mapping-related operations
-	// of VirtualSpace are async. Thus, we use an async mutex to serialize these operations.
-	async::shared_mutex _consistencyMutex;
+	// of VirtualSpace are async. Operations lock the address range that they work on.
+	// Page faults take shared locks on single pages, while map(), unmap() and protect()
+	// take exclusive locks on the affected mappings. Hence, faults only wait for
+	// operations that touch the same mapping.
+	RangeLock _rangeLock;
 
-	// To avoid taking _consistencyMutex for operations that only need to look at the current
+	// To avoid taking _rangeLock for operations that only need to look at the current
 	// state of the VirtualSpace (and that can run concurrently with mapping-related that
 	// perform TLB shootdown), we have another mutex that only protects _holes and _mappings.
 	// We make sure that we "commit" changes to _holes and _mappings before changing page
 	// tables and/or doing TLB shootdown.
-	frg::ticket_spinlock _snapshotMutex;
+	TicketSpinlock _snapshotMutex;
 
 	HoleTree _holes;
 	MappingTree _mappings;
@@ -701,19 +1046,31 @@ struct AddressSpace final : VirtualSpace, smarter::crtp_counter<AddressSpace, Bi
 		frg::expected<Error> mapPresentPages(VirtualAddr va, MemoryView *view,
 				uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) override {
 			return mapPresentPagesByCursor<ClientPageSpace::Cursor>(&space_->pageSpace_,
-					va, view, offset, size, flags, mode);
+					va, view, offset, size, flags, mode, &space_->resident_);
 		}
 
 		frg::expected<Error> remapPresentPages(VirtualAddr va, MemoryView *view,
 				uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) override {
 			return remapPresentPagesByCursor<ClientPageSpace::Cursor>(&space_->pageSpace_,
-					va, view, offset, size, flags, mode);
+					va, view, offset, size, flags, mode, &space_->resident_);
 		}
 
 		frg::expected<Error> faultPage(VirtualAddr va, MemoryView *view,
 				uintptr_t offset, PageFlags flags, CachingMode mode) override {
 			return faultPageByCursor<ClientPageSpace::Cursor>(&space_->pageSpace_,
-					va, view, offset, flags, mode);
+					va, view, offset, flags, mode, &space_->resident_);
+		}
+
+		frg::expected<Error> faultAround(VirtualAddr va, MemoryView *view,
+				uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) override {
+			return faultAroundByCursor<ClientPageSpace::Cursor>(&space_->pageSpace_,
+					va, view, offset, size, flags, mode, &space_->resident_);
+		}
+
+		frg::expected<Error> faultLargePage(VirtualAddr va, MemoryView *view,
+				uintptr_t offset, size_t size, PageFlags flags, CachingMode mode) override {
+			return faultLargePageByCursor<ClientPageSpace::Cursor>(&space_->pageSpace_,
+					va, view, offset, size, flags, mode, &space_->resident_);
 		}
 
 		frg::expected<Error> cleanPages(VirtualAddr va, MemoryView *view,
@@ -725,7 +1082,11 @@ struct AddressSpace final : VirtualSpace, smarter::crtp_counter<AddressSpace, Bi
 		frg::expected<Error> unmapPages(VirtualAddr va, MemoryView *view,
 				uintptr_t offset, size_t size) override {
 			return unmapPagesByCursor<ClientPageSpace::Cursor>(&space_->pageSpace_,
-					va, view, offset, size);
+					va, view, offset, size, &space_->resident_);
+		}
+
+		size_t getRss() override {
+			return space_->resident_.anonymousBytes() + space_->resident_.fileBytes();
 		}
 
 	private:
@@ -762,9 +1123,14 @@ public:
 		return pageSpace_.updatePageAccess(address, flags);
 	}
 
+	ResidentCounters &residentCounters() {
+		return resident_;
+	}
+
 private:
 	Operations ops_;
 	ClientPageSpace pageSpace_;
+	ResidentCounters resident_;
 };
 
 struct MemoryViewLockHandle {
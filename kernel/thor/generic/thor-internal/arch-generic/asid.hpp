@@ -6,7 +6,9 @@
 #include <thor-internal/kernel_heap.hpp>
 #include <thor-internal/types.hpp>
 #include <frg/list.hpp>
+#include <frg/span.hpp>
 #include <frg/vector.hpp>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 
@@ -22,6 +24,11 @@ protected:
 	virtual ~RetireNode() = default;
 };
 
+struct ShootRange {
+	VirtualAddr address;
+	size_t size;
+};
+
 struct ShootNode {
 	friend struct PageSpace;
 	friend struct PageBinding;
@@ -29,6 +36,10 @@ struct ShootNode {
 	VirtualAddr address;
 	size_t size;
 
+	// If non-empty, the node shoots down these ranges instead of [address, address + size).
+	// In that case, size must be the sum of the sizes of all ranges.
+	frg::span<const ShootRange> ranges;
+
 	virtual void complete() = 0;
 
 	frg::default_list_hook<ShootNode> queueNode;
@@ -195,8 +206,8 @@ private:
 	std::atomic<bool> wantToRetire_ = false;
 	RetireNode *retireNode_ = nullptr;
 
-	frg::ticket_spinlock mutex_;
-	frg::ticket_spinlock tableMutex_;
+	TicketSpinlock mutex_;
+	TicketSpinlock tableMutex_;
 
 	unsigned int numBindings_;
 
@@ -303,4 +314,30 @@ extern PerCpu<frg::manual_box<AsidCpuData>> asidData;
 // Initialize the ASID context on the given CPU.
 void initializeAsidContext(CpuData *cpuData);
 
+// Per-CPU state of the shootdown IPI protocol.
+struct ShootdownCpuState {
+	// Set by initiators of shootdowns, cleared by the CPU when it handles the IPI.
+	// If the flag is already set, the CPU will observe new shootdown requests anyway,
+	// hence initiators do not need to send another IPI. CPUs start with the flag set
+	// until they call enableShootdownIpis().
+	std::atomic<bool> ipiPending{true};
+
+	// Statistics. Only written by the owning CPU.
+	std::atomic<uint64_t> ipisSent{0};
+	std::atomic<uint64_t> ipisReceived{0};
+	std::atomic<uint64_t> pageInvalidations{0};
+	std::atomic<uint64_t> asidInvalidations{0};
+};
+
+extern PerCpu<ShootdownCpuState> shootdownCpuState;
+
+// Must be called by initializeAsidContext() before binding the global page space.
+void enableShootdownIpis(CpuData *cpuData);
+
+// Sends shootdown IPIs to all other CPUs, unless they have unhandled IPIs already.
+void requestShootdownIpis();
+
+// Called by the architecture-specific code when a shootdown IPI is received.
+void handleShootdownIpi();
+
 } // namespace thor
@@ -41,8 +41,28 @@ concept CursorPolicy = requires (uint64_t pte, uint64_t *ptePtr,
 	{ T::pteNewTable() } -> std::same_as<uint64_t>;
 };
 
+// Policies that additionally support large pages, i.e., leaf PTEs at levels other than the last.
+// ptePageStatus() and pteClean() must also work for large page PTEs.
+template <typename T>
+concept LargePageCursorPolicy = CursorPolicy<T> && requires (uint64_t pte,
+		PhysicalAddr pa, PageFlags flags, CachingMode cachingMode, size_t level) {
+	// Check whether PTEs of the given (non-last) level can map large pages.
+	{ T::levelHasLargePages(level) } -> std::same_as<bool>;
+	// Check whether the given PTE (of a non-last level) maps a large page.
+	{ T::pteLargePage(pte) } -> std::same_as<bool>;
+	// Get the page address from the given large page PTE.
+	{ T::pteLargePageAddress(pte) } -> std::same_as<PhysicalAddr>;
+	// Construct a new large page PTE from the given parameters.
+	{ T::pteBuildLarge(pa, flags, cachingMode) } -> std::same_as<uint64_t>;
+	// Convert a large page PTE into a PTE of the given level that has the same
+	// attributes and maps the first part of the large page.
+	{ T::pteSplitLarge(pte, level) } -> std::same_as<uint64_t>;
+};
+
 template <CursorPolicy Policy>
 struct PageCursor {
+	inline static constexpr bool supportsLargePages = LargePageCursorPolicy<Policy>;
+
 	inline static constexpr uintptr_t levelMask = (uintptr_t{1} << Policy::bitsPerLevel) - 1;
 	inline static constexpr size_t lastLevel = Policy::maxLevels - 1;
 
@@ -53,10 +73,15 @@ struct PageCursor {
 	}
 
 private:
-	constexpr size_t levelShift(size_t level) {
+	static constexpr size_t levelShift(size_t level) {
 		return Policy::bitsPerLevel * (Policy::maxLevels - 1 - level) + 12;
 	}
 
+	uint64_t *ptePtrAt_(size_t level) {
+		return reinterpret_cast<uint64_t *>(accessors_[level].get())
+			+ ((va_ >> levelShift(level)) & levelMask);
+	}
+
 	uint64_t *currentPtePtr_() {
 		return reinterpret_cast<uint64_t *>(accessors_[lastLevel].get())
 			+ ((va_ >> 12) & levelMask);
@@ -93,9 +118,15 @@ public:
 		moveTo(va_ + kPageSize);
 	}
 
+	void advance(size_t size) {
+		moveTo(va_ + size);
+	}
+
 	bool findPresent(uintptr_t limit) {
 		while(va_ < limit) {
 			if(!accessors_[lastLevel]) {
+				if(largePageSize())
+					return true;
 				advance4k();
 				continue;
 			}
@@ -113,6 +144,14 @@ public:
 	bool findDirty(uintptr_t limit) {
 		while(va_ < limit) {
 			if(!accessors_[lastLevel]) {
+				if constexpr (supportsLargePages) {
+					auto level = findLargeLevel_();
+					if(level != lastLevel) {
+						auto ptEnt = __atomic_load_n(ptePtrAt_(level), __ATOMIC_RELAXED);
+						if(Policy::ptePageStatus(ptEnt) & page_status::dirty)
+							return true;
+					}
+				}
 				advance4k();
 				continue;
 			}
@@ -139,6 +178,25 @@ public:
 		__atomic_store_n(currentPtePtr_(), ptEnt, __ATOMIC_RELAXED);
 	}
 
+	// Maps a page that was not requested by a fault (i.e., for fault-around).
+	// Fails (and returns false) if a page is already mapped at the cursor.
+	// If the policy supports it, the page reports page_status::prefaulted once it is unmapped.
+	bool mapPrefaulted4k(PhysicalAddr pa, PageFlags flags, CachingMode cachingMode) {
+		if(!accessors_[lastLevel]) {
+			if(largePageSize())
+				return false;
+			realizePts_();
+		}
+
+		auto ptEnt = Policy::pteBuild(pa, flags, cachingMode);
+		if constexpr (requires { Policy::pteMarkPrefaulted(ptEnt); })
+			ptEnt = Policy::pteMarkPrefaulted(ptEnt);
+
+		uint64_t expected = 0;
+		return __atomic_compare_exchange_n(currentPtePtr_(), &expected, ptEnt,
+				false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+
 	PageStatus remap4k(PhysicalAddr pa, PageFlags flags, CachingMode cachingMode) {
 		if(!accessors_[lastLevel])
 			realizePts_();
@@ -150,20 +208,91 @@ public:
 	}
 
 	PageStatus clean4k() {
-		if(!accessors_[lastLevel])
-			return 0;
+		if(!accessors_[lastLevel]) {
+			// Large pages are split such that only the current 4 KiB page is cleaned.
+			if(!largePageSize())
+				return 0;
+			realizePts_();
+		}
 
 		return Policy::pteClean(currentPtePtr_());
 	}
 
 	std::tuple<PageStatus, PhysicalAddr> unmap4k() {
-		if(!accessors_[lastLevel])
-			return {0, 0};
+		if(!accessors_[lastLevel]) {
+			// Large pages are split such that only the current 4 KiB page is unmapped.
+			if(!largePageSize())
+				return {0, 0};
+			realizePts_();
+		}
 
 		auto ptEnt = exchangeCurrentPte_(0);
 		return {Policy::ptePageStatus(ptEnt), Policy::ptePageAddress(ptEnt)};
 	}
 
+	// Large page API. The cursor must be aligned to the page size.
+	// These functions must only be called if supportsLargePages is true.
+
+	// Returns whether the page tables can hold pages of the given (large) size.
+	static bool canMapLarge(size_t size) {
+		return largeLevelFor_(size) != lastLevel;
+	}
+
+	// Returns the size of the large page that maps the cursor's address (or zero).
+	size_t largePageSize() {
+		if constexpr (supportsLargePages) {
+			auto level = findLargeLevel_();
+			if(level != lastLevel)
+				return size_t{1} << levelShift(level);
+		}
+		return 0;
+	}
+
+	// Maps a large page. Fails (and returns false) if the range
+	// is already covered by page tables or by another large page.
+	bool mapLarge(PhysicalAddr pa, size_t size, PageFlags flags, CachingMode cachingMode) {
+		auto level = largeLevelFor_(size);
+		assert(level != lastLevel);
+		assert(!(va_ & (size - 1)));
+		assert(!(pa & (size - 1)));
+
+		realizePtsUpTo_(level);
+
+		uint64_t expected = 0;
+		return __atomic_compare_exchange_n(ptePtrAt_(level), &expected,
+				Policy::pteBuildLarge(pa, flags, cachingMode),
+				false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	}
+
+	// Changes the large page that maps the cursor's address to the given page of the same size.
+	PageStatus remapLarge(PhysicalAddr pa, PageFlags flags, CachingMode cachingMode) {
+		auto level = findLargeLevel_();
+		assert(level != lastLevel);
+		assert(!(va_ & ((size_t{1} << levelShift(level)) - 1)));
+		assert(!(pa & ((size_t{1} << levelShift(level)) - 1)));
+
+		auto ptEnt = __atomic_exchange_n(ptePtrAt_(level),
+				Policy::pteBuildLarge(pa, flags, cachingMode), __ATOMIC_RELAXED);
+		return Policy::ptePageStatus(ptEnt);
+	}
+
+	PageStatus cleanLarge() {
+		auto level = findLargeLevel_();
+		assert(level != lastLevel);
+		assert(!(va_ & ((size_t{1} << levelShift(level)) - 1)));
+
+		return Policy::pteClean(ptePtrAt_(level));
+	}
+
+	std::tuple<PageStatus, PhysicalAddr> unmapLarge() {
+		auto level = findLargeLevel_();
+		assert(level != lastLevel);
+		assert(!(va_ & ((size_t{1} << levelShift(level)) - 1)));
+
+		auto ptEnt = __atomic_exchange_n(ptePtrAt_(level), 0, __ATOMIC_RELAXED);
+		return {Policy::ptePageStatus(ptEnt), Policy::pteLargePageAddress(ptEnt)};
+	}
+
 	// Low-level API for use by arch-specific code.
 public:
 	uint64_t *getPtePtr() {
@@ -207,6 +336,13 @@ private:
 			return;
 		}
 
+		if constexpr (supportsLargePages) {
+			if(Policy::pteLargePage(ptEnt)) {
+				splitLarge_(subPt, ptPtr, ptEnt, level);
+				return;
+			}
+		}
+
 		ptEnt = Policy::pteNewTable();
 		auto subPtPtr = Policy::pteTableAddress(ptEnt);
 		subPt = PageAccessor{subPtPtr};
@@ -214,6 +350,52 @@ private:
 		__atomic_store_n(ptPtr, ptEnt, __ATOMIC_RELEASE);
 	}
 
+	// Replaces a large page by a table of smaller pages that map the same memory.
+	// No TLB shootdown is necessary since the translation does not change.
+	void splitLarge_(PageAccessor &subPt, uint64_t *ptPtr, uint64_t ptEnt, size_t level) {
+		auto tblEnt = Policy::pteNewTable();
+		subPt = PageAccessor{Policy::pteTableAddress(tblEnt)};
+		auto subPtPtr = reinterpret_cast<uint64_t *>(subPt.get());
+
+		// The CPU may concurrently set the dirty bit; retry if that happens.
+		while(true) {
+			auto subEnt = Policy::pteSplitLarge(ptEnt, level + 1);
+			for(size_t i = 0; i <= levelMask; i++)
+				__atomic_store_n(&subPtPtr[i], subEnt + (uint64_t{i} << levelShift(level + 1)),
+						__ATOMIC_RELAXED);
+			if(__atomic_compare_exchange_n(ptPtr, &ptEnt, tblEnt,
+					false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+				break;
+		}
+	}
+
+	static constexpr size_t largeLevelFor_(size_t size) {
+		if constexpr (supportsLargePages) {
+			for(size_t level = 0; level < lastLevel; level++) {
+				if((size_t{1} << levelShift(level)) == size && Policy::levelHasLargePages(level))
+					return level;
+			}
+		}
+		return lastLevel;
+	}
+
+	// Returns the level of the large page PTE that maps va_ (or lastLevel if there is none).
+	size_t findLargeLevel_() {
+		if constexpr (supportsLargePages) {
+			for(size_t level = initialLevel_; level < lastLevel; level++) {
+				if(!reloadLevel_(level))
+					return lastLevel;
+				auto ptEnt = __atomic_load_n(ptePtrAt_(level), __ATOMIC_ACQUIRE);
+				if(Policy::pteTablePresent(ptEnt))
+					continue;
+				if(Policy::pteLargePage(ptEnt))
+					return level;
+				return lastLevel;
+			}
+		}
+		return lastLevel;
+	}
+
 	void realizeLevel_(size_t level) {
 		if(accessors_[level]) /*[[likely]]*/
 			return;
@@ -230,6 +412,14 @@ private:
 		}
 	}
 
+	void realizePtsUpTo_(size_t level) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&space_->tableMutex());
+		{
+			realizeLevel_(level);
+		}
+	}
+
 private:
 	PageSpace *space_;
 	uintptr_t va_;
@@ -247,7 +437,7 @@ void freePt(PhysicalAddr tblPa) {
 	for(int i = 0; i < (LowerHalfOnly ? 256 : 512); i++) { // TODO: Use bitsPerLevel.
 		assert(!Policy::ptePagePresent(tblPtr[i]));
 		if(!Policy::pteTablePresent(tblPtr[i]))
-			continue;
+			continue; // This also skips large pages.
 		auto subTblPa = Policy::pteTableAddress(tblPtr[i]);
 		if constexpr (N > 1) {
 			freePt<Policy, N - 1>(subTblPa);
@@ -10,4 +10,21 @@ void sendPingIpi(CpuData *dstData);
 void sendShootdownIpi();
 void sendSelfCallIpi();
 
+// Switches the current CPU into the idle domain.
+// IRQs that arrive afterwards are accounted to the idle task.
+void enterIdleDomain();
+
+// Enables IRQs, waits until an IRQ has been handled and disables IRQs again.
+void waitForInterrupt();
+
+// Returns true if monitorAddress() and waitForMonitorOrInterrupt() are supported.
+bool haveMonitorWait();
+
+// Arms the monitor for the cache line that contains the given address.
+void monitorAddress(const void *address);
+
+// Like waitForInterrupt() but also returns if the monitored cache line is written.
+// Spurious wakeups are possible; callers need to re-check the monitored word.
+void waitForMonitorOrInterrupt();
+
 } // namespace thor
@@ -28,6 +28,11 @@ using PageStatus = uint32_t;
 namespace page_status {
 	static constexpr PageStatus present = 1;
 	static constexpr PageStatus dirty = 2;
+	// The page was accessed since it was mapped.
+	// Only reported for pages with the prefaulted status.
+	static constexpr PageStatus accessed = 4;
+	// The page was mapped by fault-around (see PageCursor::mapPrefaulted4k()).
+	static constexpr PageStatus prefaulted = 8;
 };
 
 enum class CachingMode {
@@ -70,10 +70,10 @@ private:
 	// Protects the cancel operation.
 	// This is indexed by the asyncId of the operation.
 	// Taken *before* _mapMutex.
-	frg::ticket_spinlock _cancelMutex[lockGranularity];
+	TicketSpinlock _cancelMutex[lockGranularity];
 
 	// Protects the _nodeMap.
-	frg::ticket_spinlock _mapMutex;
+	TicketSpinlock _mapMutex;
 
 	frg::hash_map<
 		uint64_t,
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <smarter.hpp>
+#include <thor-internal/memory-view.hpp>
+
+namespace thor {
+
+// Returns the memory view that backs kHelClockMemory.
+smarter::shared_ptr<MemoryView> getClockMemory();
+
+// Called by architecture-specific code once the monotonic clock is a fixed
+// function of the TSC, i.e., nanos = (factor * tsc) >> shift.
+void publishClockTscParameters(uint64_t factor, int shift);
+
+// Updates the realtime offset (realtime minus monotonic time).
+void setClockRealtimeOffset(int64_t offset);
+
+} // namespace thor
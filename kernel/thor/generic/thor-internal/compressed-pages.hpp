@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <thor-internal/arch-generic/paging-consts.hpp>
+
+namespace thor {
+
+// In-memory store for compressed copies of pages (similar to Linux' zswap).
+// Pages are compressed using the LZ4 block format. The compressed data is kept
+// on the kernel heap in fixed-size chunks, see compressed-pages.cpp.
+struct CompressedPage;
+
+// Compresses pages. Owns scratch buffers, hence each PageCompressor must only
+// be used by one thread of execution at a time.
+struct PageCompressor {
+	static constexpr int hashLog = 12;
+
+	// Returns nullptr if the page does not compress well or if the store is full.
+	CompressedPage *compress(PhysicalAddr physical);
+
+private:
+	uint16_t hashTable_[size_t{1} << hashLog];
+	uint8_t buffer_[kPageSize];
+};
+
+// Restores the contents of a compressed page. Does not free the compressed page.
+void decompressPage(CompressedPage *page, PhysicalAddr physical);
+
+void freeCompressedPage(CompressedPage *page);
+
+struct CompressionStatistics {
+	// Number of pages in the store.
+	size_t storedPages;
+	// Memory used by the store (including its metadata).
+	size_t storedBytes;
+	// Total number of pages that were rejected since they did not compress well
+	// or since the store was full.
+	uint64_t rejectedPages;
+};
+
+CompressionStatistics getCompressionStatistics();
+
+} // namespace thor
@@ -39,6 +39,16 @@ struct CpuData : public PlatformCpuData {
 	bool haveVirtualization;
 
 	int cpuIndex;
+	// NUMA node that this CPU belongs to.
+	int numaNode{0};
+
+	// Position of this CPU in the topology. The IDs are only compared for equality:
+	// CPUs with equal coreId are SMT siblings, CPUs with equal llcId share their
+	// last level cache and CPUs with equal packageId are on the same socket.
+	// Architectures that cannot discover the topology leave all IDs at zero.
+	uint32_t coreId{0};
+	uint32_t llcId{0};
+	uint32_t packageId{0};
 
 	ExecutorContext *executorContext{nullptr};
 	smarter::borrowed_ptr<Thread> activeThread;
@@ -54,8 +64,9 @@ struct CpuData : public PlatformCpuData {
 	// This is reentrant, i.e., it allows non-maskable interrupts / exceptions to log data.
 	// The ring buffer is drained to the global logging sinks.
 	ReentrantRecordRing *localLogRing;
-	// Current dequeue sequence for localLogRing.
-	uint64_t localLogSeq{0};
+	// Current dequeue sequence for localLogRing. Protected by the global log mutex
+	// (but read without it by haveDeferredLogs()).
+	std::atomic<uint64_t> localLogSeq{0};
 	// Whether we should avoid emittings logs due to latency overhead (e.g., in IRQ/NMI context).
 	std::atomic<bool> avoidEmittingLogs{false};
 	// Bitmask of {RS_EMITTING, RS_PENDING} to determine whether we are currently emitting logs.
@@ -28,6 +28,9 @@ enum class Severity : uint8_t {
 // Metadata struct that preceeds each log record within kernel ring buffers.
 struct LogMetadata {
 	Severity severity;
+	// Value of getRawTimestampCounter() when the record was produced.
+	// Used to merge the per-CPU log rings.
+	uint64_t timestamp;
 };
 
 inline frg::tuple<LogMetadata, frg::string_view> destructureLogRecord(frg::string_view record) {
@@ -69,6 +72,10 @@ struct LogHandler {
 	// The default implementation calls emit().
 	virtual void emitUrgent(frg::string_view record);
 
+	// Called after a batch of records was passed to emit(), with the same mutex held.
+	// Handlers with slow output can defer their work until then.
+	virtual void flush() { }
+
 	frg::default_list_hook<LogHandler> hook;
 
 	bool takesUrgentLogs{false};
@@ -80,6 +87,18 @@ protected:
 void enableLogHandler(LogHandler *sink);
 void disableLogHandler(LogHandler *sink);
 
+// Log records are always posted to per-CPU rings first. Initially, they are
+// emitted to the LogHandlers synchronously (which requires a global lock).
+// After deferLogEmission() is called, only expedited records are emitted synchronously;
+// all other records are emitted by drainDeferredLogs(), which merges the per-CPU
+// rings in timestamp order.
+void deferLogEmission();
+// Returns true if some per-CPU ring contains records that were not emitted yet.
+bool haveDeferredLogs();
+void drainDeferredLogs();
+// Called when a record is deferred. Can be called from arbitrary contexts (including NMI).
+void wakeLogDrain();
+
 // --------------------------------------------------------
 // Loggers.
 // --------------------------------------------------------
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace thor {
+
+// Epoch-based reclamation (EBR) for data structures with lock-free readers.
+//
+// Readers access the data structure within an EpochGuard. Writers unlink objects
+// (using atomic stores) and then pass them to epochRetire(). A retired object is
+// only deleted once no CPU can be inside a critical section that started before
+// the object was unlinked. Deleters run on the general work queue of the CPU
+// that retired the object.
+//
+// Critical sections disable IRQs. They must not block and they should be short
+// since they hold back the reclamation of objects on all CPUs.
+
+struct EpochNode {
+	friend void epochRetire(EpochNode *node, void (*deleter)(EpochNode *));
+	friend struct EpochReclaimer;
+
+private:
+	void (*_deleter)(EpochNode *) = nullptr;
+	uint64_t _epoch = 0;
+	EpochNode *_next = nullptr;
+};
+
+struct EpochGuard {
+	EpochGuard();
+
+	EpochGuard(const EpochGuard &) = delete;
+
+	~EpochGuard();
+
+	EpochGuard &operator= (const EpochGuard &) = delete;
+};
+
+// Invokes deleter(node) once all critical sections that might observe node have ended.
+void epochRetire(EpochNode *node, void (*deleter)(EpochNode *));
+
+// Called at schedule points. Advances the global epoch if possible and
+// posts deleters of objects that became safe to reclaim.
+// Must be called with IRQs disabled.
+void passEpochQuiescentState();
+
+} // namespace thor
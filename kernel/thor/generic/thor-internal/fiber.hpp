@@ -139,7 +139,7 @@ public:
 	}
 
 private:
-	frg::ticket_spinlock _mutex;
+	TicketSpinlock _mutex;
 	bool _blocked;
 
 	smarter::shared_ptr<AssociatedWorkQueue> _associatedWorkQueue;
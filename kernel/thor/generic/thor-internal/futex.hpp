@@ -56,12 +56,14 @@ concept Futex = requires(F f) {
 
 struct FutexRealm {
 private:
+	struct Bucket;
+
 	// Represents a single waiter.
 	struct Node {
 		friend struct FutexRealm;
 
 		Node(FutexRealm *realm, FutexIdentity id)
-		: realm_{realm}, id_{id}, cobs_{this} { }
+		: id_{id}, bucket_{&realm->bucketFor_(id)}, cobs_{this} { }
 
 	protected:
 		virtual void complete() = 0;
@@ -70,33 +72,51 @@ private:
 
 	private:
 		void cancel_() {
-			{
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&realm_->_mutex);
-
-				if(!result_) {
-					auto sit = realm_->_slots.get(id_);
-					assert(sit);			
+			unlink_();
+			complete();
+		}
 
-					// Invariant: If the slot exists then its queue is not empty.
-					assert(!sit->queue.empty());
+		// Removes the node from its queue unless it is already completed.
+		// Returns true if the node was removed.
+		bool unlink_() {
+			auto irqLock = frg::guard(&irqMutex());
 
-					auto nit = sit->queue.iterator_to(this);
-					sit->queue.erase(nit);
-					result_ = Error::cancelled;
+			// requeue() can move this node to a different bucket while we do not hold
+			// the lock. Retry until we hold the lock of the bucket that owns the node.
+			Bucket *bucket;
+			while(true) {
+				bucket = bucket_.load(std::memory_order_acquire);
+				bucket->mutex.lock();
+				if(bucket_.load(std::memory_order_relaxed) == bucket)
+					break;
+				bucket->mutex.unlock();
+			}
+			frg::unique_lock<Mutex> lock{frg::adopt_lock, bucket->mutex};
 
-					if(sit->queue.empty())
-						realm_->_slots.remove(id_);
-				}else{
-					assert(!queueHook_.in_list);
-				}
+			if(result_) {
+				assert(!queueHook_.in_list);
+				return false;
 			}
 
-			complete();
+			auto sit = bucket->slots.get(id_);
+			assert(sit);
+
+			// Invariant: If the slot exists then its queue is not empty.
+			assert(!sit->queue.empty());
+
+			auto nit = sit->queue.iterator_to(this);
+			sit->queue.erase(nit);
+			result_ = Error::cancelled;
+
+			if(sit->queue.empty())
+				bucket->slots.remove(id_);
+			return true;
 		}
 
-		FutexRealm *realm_;
+		// Protected by the lock of the bucket that owns the node.
+		// Can only change while both the old and the new bucket's locks are held.
 		FutexIdentity id_;
+		std::atomic<Bucket *> bucket_;
 		frg::optional<Error> result_; // Set after completion.
 		async::cancellation_observer<frg::bound_mem_fn<&Node::cancel_>> cobs_;
 		frg::default_list_hook<Node> queueHook_;
@@ -113,12 +133,48 @@ private:
 		> queue;
 	};
 
+	using Mutex = TicketSpinlock;
+
+	// Each bucket owns the waiters of all futexes that hash to it.
+	// Buckets are aligned to cache lines to avoid false sharing between their locks.
+	struct alignas(64) Bucket {
+		Bucket()
+		: slots{FutexIdentity::Hash{}, *kernelAlloc} { }
+
+		Mutex mutex;
+
+		// Protected by mutex.
+		frg::hash_map<
+			FutexIdentity,
+			Slot,
+			FutexIdentity::Hash,
+			KernelAlloc
+		> slots;
+	};
+
+	using NodeList = frg::intrusive_list<
+		Node,
+		frg::locate_member<
+			Node,
+			frg::default_list_hook<Node>,
+			&Node::queueHook_
+		>
+	>;
+
 public:
-	FutexRealm()
-	: _slots{FutexIdentity::Hash{}, *kernelAlloc} { }
+	static constexpr size_t numBuckets = 32;
+
+	FutexRealm() = default;
 
 	bool empty() {
-		return _slots.empty();
+		for(auto &bucket : _buckets) {
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&bucket.mutex);
+
+			if(!bucket.slots.empty())
+				return false;
+		}
+		return true;
 	}
 
 	// ----------------------------------------------------------------------------------
@@ -143,8 +199,11 @@ public:
 			F f = std::move(f_);
 
 			auto fastPath = [&] {
+				// The node is not enqueued yet, hence bucket_ cannot change concurrently.
+				auto bucket = bucket_.load(std::memory_order_relaxed);
+
 				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&realm_->_mutex);
+				auto lock = frg::guard(&bucket->mutex);
 
 				if(f.read() != expected_) {
 					result_ = Error::futexRace;
@@ -156,14 +215,7 @@ public:
 					return true;
 				}
 
-				auto sit = realm_->_slots.get(id_);
-				if(!sit) {
-					realm_->_slots.insert(id_, Slot());
-					sit = realm_->_slots.get(id_);
-				}
-
-				assert(!queueHook_.in_list);
-				sit->queue.push_back(this);
+				enqueueLocked_(*bucket, this);
 				return false;
 			}(); // Immediately invoked.
 
@@ -212,62 +264,340 @@ public:
 		return {this, std::move(f), expected, ct};
 	}
 
+	// ----------------------------------------------------------------------------------
+	// waitVector().
 	// ----------------------------------------------------------------------------------
 
-	void wake(FutexIdentity id) {
-		frg::intrusive_list<
-			Node,
-			frg::locate_member<
-				Node,
-				frg::default_list_hook<Node>,
-				&Node::queueHook_
-			>
-		> pending;
+	// Maximal number of futexes that a single waitVector() can wait on.
+	static constexpr size_t maxWaitVector = 128;
+
+	template<Futex F>
+	struct WaitVectorEntry {
+		F f;
+		unsigned int expected;
+	};
+
+	// Similar to Linux' futex_waitv(): waits on multiple futexes until any of them
+	// is woken up. Each futex gets its own node in the bucket that it hashes to.
+	// Completes with the index of the futex that woke up the waiter (or that did not
+	// hold its expected value); completes with the number of futexes on cancellation.
+	template<Futex F, typename R>
+	struct WaitVectorOperation final {
+	private:
+		struct VectorNode final : Node {
+			VectorNode(FutexRealm *realm, FutexIdentity id, WaitVectorOperation *op)
+			: Node{realm, id}, op{op} { }
+
+			void complete() override {
+				op->nodeDone_(this);
+			}
+
+			WaitVectorOperation *op;
+			// Written before the starting thread releases gate_.
+			bool enqueued = false;
+		};
+
+	public:
+		WaitVectorOperation(FutexRealm *self, WaitVectorEntry<F> *entries, size_t count,
+				async::cancellation_token ct, R receiver)
+		: entries_{entries}, count_{count}, ct_{ct}, receiver_{std::move(receiver)},
+				pending_{count + 1}, index_{count} {
+			assert(count && count <= maxWaitVector);
+			nodes_ = static_cast<VectorNode *>(kernelAlloc->allocate(
+					sizeof(VectorNode) * count));
+			for(size_t i = 0; i < count; i++)
+				new (&nodes_[i]) VectorNode{self, entries[i].f.getIdentity(), this};
+		}
+
+		WaitVectorOperation(const WaitVectorOperation &) = delete;
+
+		~WaitVectorOperation() {
+			for(size_t i = 0; i < count_; i++)
+				nodes_[i].~VectorNode();
+			kernelAlloc->deallocate(nodes_, sizeof(VectorNode) * count_);
+		}
+
+		WaitVectorOperation &operator= (const WaitVectorOperation &) = delete;
+
+		bool start_inline() {
+			// The reference of the starting thread (included in pending_) keeps the
+			// operation and the entries alive until all nodes are processed.
+			for(size_t i = 0; i < count_; i++) {
+				auto node = &nodes_[i];
+				auto &entry = entries_[i];
+
+				if(done_.load(std::memory_order_acquire)) {
+					// Some node already completed; there is no need to enqueue the others.
+					node->result_ = Error::cancelled;
+					pending_.fetch_sub(1, std::memory_order_relaxed);
+				}else{
+					auto failed = [&] {
+						// The node is not enqueued yet, hence bucket_ cannot change concurrently.
+						auto bucket = node->bucket_.load(std::memory_order_relaxed);
+
+						auto irqLock = frg::guard(&irqMutex());
+						auto lock = frg::guard(&bucket->mutex);
+
+						if(entry.f.read() != entry.expected) {
+							node->result_ = Error::futexRace;
+							return true;
+						}
+
+						if(!node->cobs_.try_set(ct_)) {
+							node->result_ = Error::cancelled;
+							return true;
+						}
+
+						enqueueLocked_(*bucket, node);
+						node->enqueued = true;
+						return false;
+					}(); // Immediately invoked.
+
+					if(failed)
+						nodeDone_(node);
+				}
+
+				entry.f.retire();
+			}
+
+			if(gate_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				unlinkAll_();
+
+			if(pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				async::execution::set_value_inline(receiver_,
+						index_.load(std::memory_order_relaxed));
+				return true;
+			}
+			return false;
+		}
+
+	private:
+		// Called exactly once per node, after the node's result_ is determined.
+		void nodeDone_(VectorNode *node) {
+			if(*node->result_ != Error::cancelled) {
+				size_t none = count_;
+				index_.compare_exchange_strong(none, node - nodes_,
+						std::memory_order_relaxed);
+			}
+
+			// The first node that completes removes all other nodes from their queues,
+			// but only after the starting thread is done enqueueing them.
+			// On cancellation, each node is already cancelled individually.
+			if(!done_.exchange(true, std::memory_order_acq_rel)
+					&& *node->result_ != Error::cancelled
+					&& gate_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				unlinkAll_();
+
+			if(pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				async::execution::set_value_noinline(receiver_,
+						index_.load(std::memory_order_relaxed));
+		}
+
+		void unlinkAll_() {
+			for(size_t i = 0; i < count_; i++) {
+				auto node = &nodes_[i];
+				if(!node->enqueued)
+					continue;
+				// If the node is already completed, it calls nodeDone_() on its own.
+				if(!node->unlink_())
+					continue;
+				// Otherwise, cancel_() calls nodeDone_() if it is already running.
+				if(node->cobs_.try_reset())
+					pending_.fetch_sub(1, std::memory_order_relaxed);
+			}
+		}
+
+		WaitVectorEntry<F> *entries_;
+		size_t count_;
+		async::cancellation_token ct_;
+		R receiver_;
+		VectorNode *nodes_;
+		// Number of nodes that are not completed yet, plus one for the starting thread.
+		std::atomic<size_t> pending_;
+		std::atomic<size_t> index_;
+		std::atomic<bool> done_{false};
+		// Released by the starting thread and by the first node that completes.
+		std::atomic<unsigned int> gate_{2};
+	};
+
+	template<Futex F>
+	struct [[nodiscard]] WaitVectorSender {
+		using value_type = size_t;
+
+		template<typename R>
+		WaitVectorOperation<F, R> connect(R receiver) {
+			return {self, entries, count, ct, std::move(receiver)};
+		}
+
+		async::sender_awaiter<WaitVectorSender, size_t> operator co_await() {
+			return {std::move(*this)};
+		}
+
+		FutexRealm *self;
+		WaitVectorEntry<F> *entries;
+		size_t count;
+		async::cancellation_token ct;
+	};
+
+	// The entries must stay alive until the operation completes.
+	// The futexes are retired once the operation has enqueued its waiters.
+	template<Futex F>
+	WaitVectorSender<F> waitVector(WaitVectorEntry<F> *entries, size_t count,
+			async::cancellation_token ct = {}) {
+		return {this, entries, count, ct};
+	}
+
+	// ----------------------------------------------------------------------------------
+
+	// Wakes up to count waiters of the futex. Returns the number of woken waiters.
+	size_t wake(FutexIdentity id, size_t count = SIZE_MAX) {
+		NodeList pending;
+		size_t n;
 		{
+			auto &bucket = bucketFor_(id);
+
 			auto irqLock = frg::guard(&irqMutex());
-			auto lock = frg::guard(&_mutex);
+			auto lock = frg::guard(&bucket.mutex);
 
-			auto sit = _slots.get(id);
-			if(!sit)
-				return;
-			// Invariant: If the slot exists then its queue is not empty.
-			assert(!sit->queue.empty());
+			n = wakeLocked_(bucket, id, count, pending);
+		}
 
-			// TODO: Enable users to only wake a certain number of waiters.
-			while(!sit->queue.empty()) {
-				auto node = sit->queue.front();
-				assert(!node->result_);
-				sit->queue.pop_front();
+		completeAll_(pending);
+		return n;
+	}
 
-				node->result_ = Error::success;
-				if(node->cobs_.try_reset()) {
-					pending.push_back(node);
-				}
+	// ----------------------------------------------------------------------------------
+	// requeue().
+	// ----------------------------------------------------------------------------------
+
+	// Similar to Linux' FUTEX_CMP_REQUEUE: if the futex f holds the value expected,
+	// wakes up to wakeCount waiters of f and moves up to requeueCount of the remaining
+	// waiters to the futex identified by to. This avoids that all waiters are woken up
+	// at once (e.g., on a condition variable broadcast) only to contend on the same mutex.
+	// Returns Error::futexRace if the value of f does not match.
+	template<Futex F>
+	Error requeue(F f, FutexIdentity to, unsigned int expected,
+			size_t wakeCount, size_t requeueCount) {
+		auto from = f.getIdentity();
+		auto &srcBucket = bucketFor_(from);
+		auto &dstBucket = bucketFor_(to);
+
+		NodeList pending;
+		auto error = [&] {
+			auto irqLock = frg::guard(&irqMutex());
+
+			// Lock both buckets in a consistent order to avoid deadlocks.
+			Bucket *first = &srcBucket;
+			Bucket *second = &dstBucket;
+			if(second < first)
+				std::swap(first, second);
+			first->mutex.lock();
+			if(second != first)
+				second->mutex.lock();
+
+			Error error = Error::success;
+			if(f.read() == expected) {
+				wakeLocked_(srcBucket, from, wakeCount, pending);
+				if(from != to)
+					requeueLocked_(srcBucket, from, dstBucket, to, requeueCount);
+			}else{
+				error = Error::futexRace;
 			}
 
-			if(sit->queue.empty())
-				_slots.remove(id);
+			if(second != first)
+				second->mutex.unlock();
+			first->mutex.unlock();
+			return error;
+		}(); // Immediately invoked.
+
+		f.retire();
+
+		completeAll_(pending);
+		return error;
+	}
+
+private:
+	Bucket &bucketFor_(FutexIdentity id) {
+		return _buckets[FutexIdentity::Hash{}(id) % numBuckets];
+	}
+
+	// Precondition: bucket.mutex is held.
+	static void enqueueLocked_(Bucket &bucket, Node *node) {
+		auto sit = bucket.slots.get(node->id_);
+		if(!sit) {
+			bucket.slots.insert(node->id_, Slot());
+			sit = bucket.slots.get(node->id_);
 		}
 
+		assert(!node->queueHook_.in_list);
+		sit->queue.push_back(node);
+	}
+
+	// Precondition: bucket.mutex is held.
+	size_t wakeLocked_(Bucket &bucket, FutexIdentity id, size_t count, NodeList &pending) {
+		auto sit = bucket.slots.get(id);
+		if(!sit)
+			return 0;
+		// Invariant: If the slot exists then its queue is not empty.
+		assert(!sit->queue.empty());
+
+		size_t n = 0;
+		while(!sit->queue.empty() && n < count) {
+			auto node = sit->queue.front();
+			assert(!node->result_);
+			sit->queue.pop_front();
+
+			node->result_ = Error::success;
+			if(node->cobs_.try_reset()) {
+				pending.push_back(node);
+			}
+			n++;
+		}
+
+		if(sit->queue.empty())
+			bucket.slots.remove(id);
+		return n;
+	}
+
+	// Precondition: the mutexes of both srcBucket and dstBucket are held.
+	void requeueLocked_(Bucket &srcBucket, FutexIdentity from,
+			Bucket &dstBucket, FutexIdentity to, size_t count) {
+		if(!count || !srcBucket.slots.get(from))
+			return;
+
+		auto dit = dstBucket.slots.get(to);
+		if(!dit) {
+			dstBucket.slots.insert(to, Slot());
+			dit = dstBucket.slots.get(to);
+		}
+		// Look up the source slot only now since insertion can rehash the table.
+		auto sit = srcBucket.slots.get(from);
+		assert(sit);
+
+		size_t n = 0;
+		while(!sit->queue.empty() && n < count) {
+			auto node = sit->queue.front();
+			assert(!node->result_);
+			sit->queue.pop_front();
+
+			node->id_ = to;
+			node->bucket_.store(&dstBucket, std::memory_order_release);
+			dit->queue.push_back(node);
+			n++;
+		}
+
+		if(sit->queue.empty())
+			srcBucket.slots.remove(from);
+	}
+
+	void completeAll_(NodeList &pending) {
 		while(!pending.empty()) {
 			auto node = pending.pop_front();
 			node->complete();
 		}
 	}
 
-private:
-	using Mutex = frg::ticket_spinlock;
-
-	// TODO: use a scalable hash table with fine-grained locks to
-	// improve the scalability of the futex algorithm.
-	Mutex _mutex;
-
-	frg::hash_map<
-		FutexIdentity,
-		Slot,
-		FutexIdentity::Hash,
-		KernelAlloc
-	> _slots;
+	Bucket _buckets[numBuckets];
 };
 
 } // namespace thor
@@ -5,6 +5,7 @@
 #include <thor-internal/arch/ints.hpp>
 #include <thor-internal/cancel.hpp>
 #include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/kernel-locks.hpp>
 #include <thor-internal/memory-view.hpp>
 #include <thor-internal/mm-rc.hpp>
 
@@ -40,6 +41,13 @@ struct ElementStruct {
 	void *context;
 };
 
+// Mirrors the header of HelSubmissionRing. The entries are only accessed by hel.cpp.
+struct SubmissionRingStruct {
+	unsigned int tail;
+	unsigned int head;
+	char padding[56];
+};
+
 struct QueueSource {
 	void setup(void *pointer_, size_t size_) {
 		pointer = pointer_;
@@ -75,26 +83,18 @@ private:
 	const QueueSource *_source;
 
 	IpcQueue *_queue;
-	frg::default_list_hook<IpcNode> _queueNode;
+
+	// Link in IpcQueue's lock-free submission stack and in its pending list.
+	IpcNode *_next{nullptr};
 };
 
 struct IpcQueue : CancelRegistry {
 private:
 	using Address = uintptr_t;
 
-	using NodeList = frg::intrusive_list<
-		IpcNode,
-		frg::locate_member<
-			IpcNode,
-			frg::default_list_hook<IpcNode>,
-			&IpcNode::_queueNode
-		>
-	>;
-
-	using Mutex = frg::ticket_spinlock;
-
 public:
-	IpcQueue(unsigned int ringShift, unsigned int numChunks, size_t chunkSize);
+	IpcQueue(unsigned int ringShift, unsigned int numChunks, size_t chunkSize,
+			size_t submissionRingSize = 0);
 
 	IpcQueue(const IpcQueue &) = delete;
 
@@ -106,7 +106,17 @@ public:
 
 	bool validSize(size_t size);
 
-	void setupChunk(size_t index, smarter::shared_ptr<AddressSpace, BindableHandle> space, void *pointer);
+	bool hasSubmissionRing() {
+		return _submissionRingOffset;
+	}
+
+	// Copies the oldest unconsumed entry of the submission ring to entry
+	// and marks it as consumed. Returns false if the ring is empty.
+	bool popSubmission(void *entry, size_t entrySize);
+
+	// Appends numChunks chunks to the queue memory.
+	// Returns the offset of the first new chunk within the memory.
+	frg::expected<Error, uintptr_t> addChunks(unsigned int numChunks);
 
 	void submit(IpcNode *node);
 
@@ -167,35 +177,49 @@ public:
 private:
 	coroutine<void> _runQueue();
 
-private:
-	Mutex _mutex;
+	// Moves all nodes from _submitted to _pending (in submission order).
+	// Returns true if _pending is non-empty afterwards.
+	bool _fetchSubmitted();
 
+private:
 	smarter::shared_ptr<ImmediateMemory> _memory;
 
 	unsigned int _ringShift;
 	size_t _chunkSize;
+	// Size of a chunk including its header and alignment.
+	size_t _reservedPerChunk;
 
+	// Protects _chunkOffsets and the length of _memory.
+	TicketSpinlock _chunkMutex;
 	frg::vector<size_t, KernelAlloc> _chunkOffsets;
+	// Offset at which the next chunks are appended.
+	size_t _memoryEnd;
+
+	// Offset of the submission ring within _memory (zero if there is none).
+	size_t _submissionRingOffset = 0;
+	size_t _submissionRingSize = 0;
+
+	// Protects the kernel's side of the submission ring.
+	TicketSpinlock _submissionMutex;
+	// Number of entries that the kernel consumed so far.
+	unsigned int _submissionHead = 0;
 
 	// Index into the queue that we are currently processing.
 	int _currentIndex;
 	// Progress into the current chunk.
 	int _currentProgress;
 
+	// Raised by submit() when _submitted transitions from empty to non-empty.
 	async::recurring_event _doorbell;
 
-	frg::intrusive_list<
-		IpcNode,
-		frg::locate_member<
-			IpcNode,
-			frg::default_list_hook<IpcNode>,
-			&IpcNode::_queueNode
-		>
-	> _nodeQueue;
-
-	// Stores whether any nodes are in the queue.
-	// Written only when _mutex is held (but read outside of _mutex).
-	std::atomic<bool> _anyNodes;
+	// Lock-free stack of submitted nodes (in reverse submission order).
+	// Pushed to by submit() on any CPU, drained by _runQueue().
+	std::atomic<IpcNode *> _submitted{nullptr};
+
+	// Singly linked list of nodes that were drained from _submitted
+	// but not emitted yet (in submission order).
+	// Only accessed by _runQueue().
+	IpcNode *_pendingHead{nullptr};
 };
 
 } // namespace thor
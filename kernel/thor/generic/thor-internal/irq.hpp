@@ -115,7 +115,7 @@ struct IrqSink {
 	frg::default_list_hook<IrqSink> hook;
 
 protected:
-	frg::ticket_spinlock *sinkMutex() {
+	TicketSpinlock *sinkMutex() {
 		return &_mutex;
 	}
 
@@ -132,7 +132,7 @@ private:
 	IrqPin *_pin;
 
 	// Must be protected against IRQs.
-	frg::ticket_spinlock _mutex;
+	TicketSpinlock _mutex;
 
 	// The following fields are protected by pin->_mutex and _mutex.
 private:
@@ -184,6 +184,9 @@ public:
 
 	void configure(IrqConfiguration cfg);
 
+	// Returns TriggerMode::null if the pin is not configured yet.
+	TriggerMode triggerMode();
+
 	// This function is called from IrqSlot::raise().
 	void raise();
 
@@ -220,7 +223,7 @@ private:
 	uint32_t _hash;
 
 	// Must be protected against IRQs.
-	frg::ticket_spinlock _mutex;
+	TicketSpinlock _mutex;
 
 	IrqConfiguration _activeCfg;
 
@@ -265,6 +268,13 @@ struct MsiPin : IrqPin {
 	virtual uint64_t getMessageAddress() = 0;
 	virtual uint32_t getMessageData() = 0;
 
+	// Routes the MSI to the given CPU. Since this changes the message,
+	// the device needs to be reprogrammed afterwards.
+	virtual Error setAffinity(int cpu) {
+		(void)cpu;
+		return Error::noHardwareSupport;
+	}
+
 protected:
 	~MsiPin() = default;
 };
@@ -277,6 +287,15 @@ struct IrqObject : IrqSink {
 
 	void automate(smarter::shared_ptr<BoundKernlet> kernlet);
 
+	// Enables interrupt coalescing for edge-triggered IRQs: the kernel acknowledges
+	// the IRQ itself and wakes waiters only once maxEvents IRQs have been raised
+	// or delay nanoseconds after the first pending IRQ.
+	// maxEvents == 0 restores the default behavior.
+	static Error setModeration(smarter::shared_ptr<IrqObject> self,
+			unsigned int maxEvents, uint64_t delay);
+
+	bool isModerated();
+
 	IrqStatus raise() override;
 
 	void submitAwait(AwaitIrqNode *node, uint64_t sequence);
@@ -334,8 +353,20 @@ struct IrqObject : IrqSink {
 	}
 
 private:
+	// Completes all waiters. Called with the sinkMutex held.
+	void _deliver();
+
 	smarter::shared_ptr<BoundKernlet> _automationKernlet;
 
+	// The following fields are protected by the sinkMutex.
+	unsigned int _moderateEvents = 0;
+	uint64_t _moderateDelay = 0;
+	unsigned int _pendingEvents = 0;
+	bool _moderationRunning = false;
+	// Sequence number that was last reported to waiters.
+	uint64_t _deliveredSequence = 0;
+	async::recurring_event _moderationEvent;
+
 	// Protected by the sinkMutex.
 	frg::intrusive_list<
 		AwaitIrqNode,
@@ -4,9 +4,85 @@
 #include <atomic>
 #include <frg/mutex.hpp>
 #include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
 
 namespace thor {
 
+// Contention statistics of all TicketSpinlocks that are acquired from the same call site.
+// Only recorded if thor.lockstat is passed on the kernel command line.
+// Times are measured in units of getRawTimestampCounter().
+struct LockStatEntry {
+	std::atomic<uintptr_t> site{0};
+	// Address of the lock that was most recently acquired from this site.
+	std::atomic<uintptr_t> lockAddress{0};
+	std::atomic<uint64_t> acquisitions{0};
+	std::atomic<uint64_t> contended{0};
+	std::atomic<uint64_t> waitTicks{0};
+	std::atomic<uint64_t> maxHoldTicks{0};
+};
+
+inline constexpr size_t numLockStatSlots = 1024;
+
+extern constinit std::atomic<bool> lockStatEnabled;
+
+// Returns the entry in the given slot of the statistics table (site is zero for unused slots).
+LockStatEntry *getLockStatSlot(size_t slot);
+
+// Ticket lock that is used in place of TicketSpinlock throughout thor,
+// such that we can profile lock contention.
+struct TicketSpinlock {
+	constexpr TicketSpinlock() = default;
+
+	TicketSpinlock(const TicketSpinlock &) = delete;
+
+	TicketSpinlock &operator= (const TicketSpinlock &) = delete;
+
+	[[gnu::always_inline]] void lock() {
+		if(lockStatEnabled.load(std::memory_order_relaxed)) [[unlikely]] {
+			lockWithStats_();
+			return;
+		}
+
+		auto ticket = nextTicket_.fetch_add(1, std::memory_order_relaxed);
+		if(servingTicket_.load(std::memory_order_acquire) != ticket) [[unlikely]]
+			spinUntil_(ticket);
+	}
+
+	void unlock() {
+		if(holdEntry_) [[unlikely]]
+			unlockWithStats_();
+
+		servingTicket_.store(servingTicket_.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+	}
+
+	bool is_locked() {
+		return servingTicket_.load(std::memory_order_relaxed)
+				!= nextTicket_.load(std::memory_order_relaxed);
+	}
+
+private:
+	void spinUntil_(uint32_t ticket);
+	// Takes the call site from its return address, hence it must not be inlined.
+	[[gnu::noinline]] void lockWithStats_();
+	void unlockWithStats_();
+
+	std::atomic<uint32_t> nextTicket_{0};
+	std::atomic<uint32_t> servingTicket_{0};
+
+	// The following fields are only accessed by the holder of the lock.
+	LockStatEntry *holdEntry_{nullptr};
+	uint64_t holdStart_{0};
+};
+
+// Only set if thor.irqtrace is passed on the kernel command line.
+extern constinit std::atomic<bool> irqTraceEnabled;
+
+// Called when the outermost IrqMutex of this CPU is released after a traced section.
+// site is the return address of the lock() call that disabled IRQs.
+void recordIrqOffSection(uintptr_t site, uint64_t startTicks);
+
 struct IrqMutex {
 private:
 	static constexpr unsigned int enableBit = 0x8000'0000;
@@ -30,6 +106,9 @@ public:
 			if(e) {
 				disableInts();
 				_state.store(enableBit | 1, std::memory_order_relaxed);
+				// Only sections that actually disable IRQs are traced.
+				if(irqTraceEnabled.load(std::memory_order_relaxed)) [[unlikely]]
+					traceStart_();
 			}else{
 				_state.store(1, std::memory_order_relaxed);
 			}
@@ -44,6 +123,8 @@ public:
 		auto s = _state.load(std::memory_order_relaxed);
 		assert(s & ~enableBit);
 		if((s & ~enableBit) == 1) {
+			if(_traceSite) [[unlikely]]
+				traceEnd_();
 			_state.store(0, std::memory_order_release);
 			if(s & enableBit)
 				enableInts();
@@ -57,7 +138,15 @@ public:
 	}
 
 private:
+	// Takes the call site from its return address, hence it must not be inlined.
+	[[gnu::noinline]] void traceStart_();
+	void traceEnd_();
+
 	std::atomic<unsigned int> _state;
+
+	// The following fields are only accessed with IRQs disabled.
+	uintptr_t _traceSite{0};
+	uint64_t _traceStart{0};
 };
 
 struct StatelessIrqLock {
@@ -50,6 +50,10 @@ private:
 
 void initializeGlobalLog();
 
+// Starts a fiber that emits log records asynchronously, such that logging
+// does not need to take a global lock. Requires SelfIntCalls to be available.
+void initializeLogDrain();
+
 GlobalLogRing *getGlobalLogRing();
 
 LogRingBuffer *getGlobalKmsgRing();
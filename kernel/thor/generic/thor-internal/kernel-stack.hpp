@@ -15,6 +15,13 @@ struct UniqueKernelStack {
 
 	static UniqueKernelStack make();
 
+	// Enables the per-CPU caches of free stacks. Must be called after the per-CPU data
+	// of the boot CPU has been initialized.
+	static void enableCaches();
+
+	// Releases all cached stacks. Called when physical memory runs low.
+	static void trimCaches();
+
 	friend void swap(UniqueKernelStack &a, UniqueKernelStack &b) {
 		using std::swap;
 		swap(a._base, b._base);
@@ -60,6 +67,9 @@ private:
 	explicit UniqueKernelStack(char *base)
 	: _base(base) { }
 
+	// Unmaps the stack with the given top address and frees its memory.
+	static void _release(char *base);
+
 	char *_base;
 };
 
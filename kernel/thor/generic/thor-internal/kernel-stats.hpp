@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#include <thor-internal/cpu-data.hpp>
+
+namespace thor {
+
+// Event counters that are reported by helQueryKernelStats().
+enum class KernelStat {
+	contextSwitches,
+	ipisSent,
+	readFaults,
+	writeFaults,
+	executeFaults,
+	unresolvedFaults,
+	shootdowns,
+	ipcSubmits,
+	futexWaits,
+	futexWakes,
+	physicalAllocations,
+	physicalFrees,
+	ipcQueueStalls,
+	handoffSwitches,
+	numStats
+};
+
+// Each CPU only increments its own counters, hence the cache lines are never contended.
+// Readers sum the counters over all CPUs.
+struct KernelStatCounters {
+	std::atomic<uint64_t> counters[static_cast<int>(KernelStat::numStats)]{};
+};
+
+extern PerCpu<KernelStatCounters> kernelStatCounters;
+
+inline void countKernelStat(KernelStat stat, uint64_t n = 1) {
+	auto &counter = kernelStatCounters.get().counters[static_cast<int>(stat)];
+	counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+// Returns the sum of the given counter over all CPUs.
+uint64_t sumKernelStat(KernelStat stat);
+
+} // namespace thor
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <assert.h>
+#include <atomic>
 #include <frg/slab.hpp>
 #include <frg/spinlock.hpp>
 #include <frg/manual_box.hpp>
@@ -24,11 +25,11 @@ struct IrqSpinlock {
 	}
 
 private:
-	frg::ticket_spinlock _spinlock;
+	TicketSpinlock _spinlock;
 };
 
 struct KernelVirtualMemory {
-	using Mutex = frg::ticket_spinlock;
+	using Mutex = TicketSpinlock;
 public:
 	static KernelVirtualMemory &global();
 
@@ -39,11 +40,55 @@ public:
 	
 	KernelVirtualMemory &operator= (const KernelVirtualMemory &other) = delete;
 
+	// Enables the per-CPU caches of purged areas. Must be called after the per-CPU data
+	// of the boot CPU has been initialized.
+	static void enableCaches();
+
 	void *allocate(size_t length);
 	void deallocate(void *pointer, size_t length);
 
+	// Like deallocate() but for areas whose pages were unmapped and still need a shootdown.
+	// Areas are purged lazily: they are collected until maxLazyAreas areas or
+	// lazyPurgeThreshold bytes are pending and then shot down by a single ShootNode.
+	void deallocateLazily(void *pointer, size_t length);
+
+	// Submits a shootdown for all lazily deallocated areas that are currently pending.
+	void purgeLazyAreas();
+
+	static constexpr size_t maxLazyAreas = 64;
+	static constexpr size_t lazyPurgeThreshold = size_t{4} << 20;
+
 private:
+	struct LazyPurgeNode;
+
+	// Puts a purged area into the current CPU's cache or returns it to the tree.
+	void release_(uintptr_t address, size_t size);
+
+	// Takes the pending areas out of pending_ and submits their shootdown.
+	// Must be called without holding mutex_.
+	void submitPurge_(LazyPurgeNode *node);
+
+	static std::atomic<bool> cachesEnabled_;
+
 	Mutex mutex_;
+	// Protected by mutex_.
+	LazyPurgeNode *pending_ = nullptr;
+};
+
+// Per-CPU cache of kernel virtual areas that were purged by a lazy shootdown.
+// Allocations of the exact size of a cached area reuse it without taking
+// KernelVirtualMemory's lock.
+struct KernelVirtualCache {
+	static constexpr size_t capacity = 8;
+	static constexpr size_t maxAreaSize = size_t{128} << 10;
+
+	struct Area {
+		uintptr_t address;
+		size_t size;
+	};
+
+	Area areas[capacity];
+	size_t count = 0;
 };
 
 class KernelVirtualAlloc {
@@ -73,7 +118,85 @@ public:
 	void output_trace(void *buffer, size_t size);
 };
 
-using KernelAlloc = frg::slab_allocator<KernelVirtualAlloc, IrqSpinlock>;
+// Per-CPU cache of free kernel heap objects.
+// Objects of up to maxObjectSize bytes are grouped into power-of-two size classes.
+// Allocations and frees of these objects are served from the current CPU's cache
+// without taking the slab_pool's lock. Caches are refilled from (and drained to)
+// the slab_pool in batches.
+struct KernelHeapCache {
+	static constexpr int minClassShift = 4;
+	static constexpr int numClasses = 8;
+	static constexpr size_t maxObjectSize = size_t{1} << (minClassShift + numClasses - 1);
+
+	static constexpr size_t capacity = 32;
+	// Number of objects that are moved between the cache and the slab_pool at once.
+	static constexpr size_t batchSize = capacity / 2;
+
+	static constexpr size_t classSize(int sizeClass) {
+		return size_t{1} << (minClassShift + sizeClass);
+	}
+
+	static constexpr int sizeClassOf(size_t size) {
+		int sizeClass = 0;
+		while(size > classSize(sizeClass))
+			sizeClass++;
+		return sizeClass;
+	}
+
+	struct Stack {
+		void *objects[capacity];
+		size_t count = 0;
+	};
+
+	// Statistics. Only modified by the owning CPU but may be read by any CPU.
+	struct Statistics {
+		// Number of allocations of this size class.
+		std::atomic<uint64_t> allocations{0};
+		// Number of times that the slab_pool's lock had to be taken
+		// to refill or drain the cache.
+		std::atomic<uint64_t> refills{0};
+		std::atomic<uint64_t> drains{0};
+	};
+
+	Stack stacks[numClasses];
+	Statistics stats[numClasses];
+};
+
+struct KernelHeapStatistics {
+	uint64_t allocations;
+	uint64_t refills;
+	uint64_t drains;
+};
+
+// Sums the statistics of the given size class over all CPUs.
+KernelHeapStatistics getKernelHeapStatistics(int sizeClass);
+
+// Allocator that serves small objects from the per-CPU KernelHeapCache
+// and forwards all other requests to the kernelHeap.
+struct KernelAlloc {
+	using Backing = frg::slab_allocator<KernelVirtualAlloc, IrqSpinlock>;
+
+	KernelAlloc(frg::slab_pool<KernelVirtualAlloc, IrqSpinlock> *pool)
+	: _backing{pool} { }
+
+	// Enables the per-CPU caches. Must be called after the per-CPU data
+	// of the boot CPU has been initialized.
+	static void enableCaches();
+
+	void *allocate(size_t size);
+	void deallocate(void *pointer, size_t size);
+	void *reallocate(void *pointer, size_t size);
+
+	// Since free() does not know the size of the object, it bypasses the caches.
+	void free(void *pointer) {
+		_backing.free(pointer);
+	}
+
+private:
+	static std::atomic<bool> _cachesEnabled;
+
+	Backing _backing;
+};
 
 extern constinit frg::manual_box<KernelVirtualAlloc> kernelVirtualAlloc;
 
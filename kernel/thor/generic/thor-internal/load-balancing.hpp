@@ -10,6 +10,21 @@ namespace thor {
 
 struct LbNode;
 
+// Scheduling domains, ordered by increasing cost of migrating threads within them.
+// The domain of two CPUs is the smallest domain that contains both (see CpuData::coreId etc.).
+enum class LbDomain {
+	// SMT siblings.
+	core,
+	// CPUs that share the last level cache.
+	llc,
+	// CPUs on the same package (but with different LLCs).
+	package,
+	// All CPUs.
+	system
+};
+
+constexpr int numLbDomains = 4;
+
 // Per-thread control block that is allocated by the load balancer.
 struct LbControlBlock {
 	friend struct LbNode;
@@ -77,7 +92,7 @@ private:
 
 	// Protects members that can be written by public functions.
 	// Note that this mutex does not protect assigendCpu_, node_, hook_, load_ etc.
-	frg::ticket_spinlock mutex_;
+	TicketSpinlock mutex_;
 
 	// Protected by mutex_;
 	frg::vector<uint8_t, KernelAlloc> affinityMask_;
@@ -87,7 +102,7 @@ private:
 struct LbNode {
 	CpuData *cpu{nullptr};
 
-	frg::ticket_spinlock mutex;
+	TicketSpinlock mutex;
 
 	// Protected by mutex.
 	frg::intrusive_list<
@@ -104,7 +119,11 @@ struct LbNode {
 
 	// Equal to totalLoad before load balancing but updated during load balancing.
 	// Protected by mutex during main phase of load balancing.
+	// Also updated (under mutex) by idle-time stealing.
 	uint64_t currentLoad{0};
+
+	// Time of the last idle-time steal attempt. Only accessed by the node's own CPU.
+	uint64_t lastIdleSteal{0};
 };
 
 extern PerCpu<LbNode> lbNode;
@@ -125,12 +144,24 @@ struct LoadBalancer {
 	// The thread is detached from the load balancer when the weak reference goes out of scope.
 	void connect(Thread *thread, CpuData *cpu);
 
+	// Called by the scheduler when the given CPU is about to become idle.
+	// Tries to pull a thread from the busiest other CPU such that the CPU does not
+	// need to wait for the next (periodic) load balancing round.
+	// Must be called with IRQs disabled.
+	void stealOnIdle(CpuData *cpu);
+
 private:
 	coroutine<void> run_(CpuData *cpu);
 
+	// Move a single thread from srcNode to thisNode during idle-time stealing.
+	// Returns false if srcNode has no thread that can be moved.
+	bool stealFrom_(LbNode *srcNode, LbNode *thisNode, LbDomain domain);
+
 	// Move tasks from srcNode to dstNode to balance load.
 	// newLoad: newLoad at dstNode after balancing.
-	void balanceBetween_(LbNode *srcNode, LbNode *dstNode, uint64_t &newLoad, uint64_t idealLoad);
+	// domain: smallest scheduling domain that contains both nodes.
+	void balanceBetween_(LbNode *srcNode, LbNode *dstNode, uint64_t &newLoad, uint64_t idealLoad,
+			LbDomain domain);
 
 	async::barrier barrier_;
 };
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <frg/optional.hpp>
+
+namespace thor {
+
+// Decompresses a raw LZ4 block (i.e., without the LZ4 frame format) into dest.
+// Returns the number of bytes written or frg::null_opt if the input is malformed
+// or does not fit into destCapacity bytes.
+frg::optional<size_t> lz4DecompressBlock(const void *src, size_t srcSize,
+		void *dest, size_t destCapacity);
+
+} // namespace thor
@@ -1,15 +1,24 @@
 #pragma once
 
 #include <eir/interface.hpp>
+#include <frg/spinlock.hpp>
 #include <initgraph.hpp>
+#include <thor-internal/kernel-locks.hpp>
 
 namespace thor {
 
+struct FiberBlocker;
+
 EirInfo *getEirInfo();
 frg::string_view getKernelCmdline();
 
 struct GlobalInitEngine : public initgraph::Engine {
 	virtual ~GlobalInitEngine() = default;
+
+	// Allows concurrent tasks to run on their own fibers.
+	// Must be called from a fiber once tasking is available.
+	void enableConcurrency() { concurrencyEnabled_ = true; }
+
 protected:
 	void onRealizeNode(initgraph::Node *node) override;
 	void onRealizeEdge(initgraph::Edge *node) override;
@@ -17,6 +26,21 @@ protected:
 	void postActivate(initgraph::Node *node) override;
 	void reportUnreached(initgraph::Node *node) override;
 	void onUnreached() override;
+	bool startActivation(initgraph::Node *node) override;
+	initgraph::Node *awaitActivation() override;
+
+private:
+	struct Activation;
+
+	bool concurrencyEnabled_ = false;
+	// CPU that the next concurrent task is dispatched to.
+	size_t nextCpu_ = 0;
+
+	// Protects the following members.
+	TicketSpinlock completionMutex_;
+	// Singly linked list of completed activations.
+	Activation *completed_ = nullptr;
+	FiberBlocker *completionWaiter_ = nullptr;
 };
 
 extern GlobalInitEngine globalInitEngine;
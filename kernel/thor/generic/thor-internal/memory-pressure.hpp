@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <smarter.hpp>
+#include <thor-internal/event.hpp>
+
+namespace thor {
+
+enum class MemoryPressure {
+	none,
+	low,
+	critical
+};
+
+// Default watermarks in free pages. The critical watermark coincides with the point at
+// which MemoryReclaimer starts to evict cached pages, such that user space gets a chance
+// to shrink its caches before.
+size_t defaultLowPressureWatermark();
+size_t defaultCriticalPressureWatermark();
+
+// Pressure level with respect to the default watermarks.
+MemoryPressure currentMemoryPressure();
+
+// Raises bit (1 << level) of the event whenever the pressure level with respect to
+// the given watermarks (in free pages) changes. The event is unregistered once
+// all other references to it are dropped.
+void watchMemoryPressure(smarter::shared_ptr<BitsetEvent> event,
+		size_t lowPages, size_t criticalPages);
+
+} // namespace thor
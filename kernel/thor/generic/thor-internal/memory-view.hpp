@@ -10,8 +10,11 @@
 #include <frg/vector.hpp>
 #include <frg/expected.hpp>
 #include <thor-internal/arch-generic/paging.hpp>
+#include <thor-internal/compressed-pages.hpp>
+#include <thor-internal/epoch.hpp>
 #include <thor-internal/error.hpp>
 #include <thor-internal/futex.hpp>
+#include <thor-internal/numa.hpp>
 #include <thor-internal/types.hpp>
 #include <thor-internal/kernel-locks.hpp>
 
@@ -38,6 +41,10 @@ struct CachePage {
 	static constexpr uint32_t reclaimPosted = 0x02;
 	// Page has been evicted (neither in the LRU, nor in the bundle list).
 	static constexpr uint32_t reclaimInflight = 0x04;
+	// Page was accessed again after it was registered. Such pages are kept on the
+	// active LRU list and are only evicted after being demoted to the inactive list.
+	// This flag persists while the page is temporarily unregistered (e.g., while it is locked).
+	static constexpr uint32_t reclaimActive = 0x08;
 
 	// CacheBundle that owns this page.
 	CacheBundle *bundle = nullptr;
@@ -69,6 +76,22 @@ private:
 	async::recurring_event _reclaimEvent;
 };
 
+// Statistics of the page reclaim mechanism.
+struct ReclaimStatistics {
+	// Number of pages that are registered with the reclaimer.
+	size_t cachedPages;
+	// Number of pages on the active and inactive LRU lists.
+	size_t activePages;
+	size_t inactivePages;
+	// Total number of pages that were evicted so far.
+	uint64_t evictedPages;
+	// Number of pages in the compressed page store and memory used by the store.
+	size_t compressedPages;
+	size_t compressedBytes;
+};
+
+ReclaimStatistics getReclaimStatistics();
+
 struct GlobalFutexSpace {
 protected:
 	~GlobalFutexSpace() = default;
@@ -170,6 +193,9 @@ public:
 
 using FetchFlags = uint32_t;
 inline constexpr FetchFlags fetchDisallowBacking = 1;
+// The caller only reads from the range. The view may then make the shared zero page
+// (see getZeroPage()) available instead of allocating memory.
+inline constexpr FetchFlags fetchReadOnly = 2;
 
 using CachingFlags = uint32_t;
 inline constexpr CachingFlags cacheWriteCombine = 1;
@@ -239,7 +265,7 @@ struct EvictionQueue {
 	}
 
 private:
-	frg::ticket_spinlock mutex_;
+	TicketSpinlock mutex_;
 
 	frg::intrusive_list<
 		MemoryObserver,
@@ -276,6 +302,12 @@ public:
 
 	virtual size_t getLength() = 0;
 
+	// Whether the pages of the view belong to the page cache (i.e., to managed memory).
+	// Used to split resident memory into anonymous and file-backed memory.
+	virtual bool isPageCache() {
+		return false;
+	}
+
 	virtual void resize(size_t newLength, async::any_receiver<void> receiver);
 
 	// Returns a unique identity for each memory address.
@@ -306,6 +338,11 @@ public:
 	// Result stays valid until the range is evicted.
 	virtual frg::tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) = 0;
 
+	// Returns the number of bytes starting at offset that are backed by physically contiguous
+	// memory (that stays present for as long as the page at offset stays present).
+	// Used to decide whether large pages can be used to map the view.
+	virtual size_t peekContiguousRange(uintptr_t offset);
+
 	// Makes a range of memory available for peekRange().
 	virtual coroutine<frg::expected<Error>>
 	touchRange(uintptr_t offset, size_t size, FetchFlags flags, smarter::shared_ptr<WorkQueue> wq);
@@ -319,6 +356,12 @@ public:
 	// Marks a range of pages as dirty.
 	virtual void markDirty(uintptr_t offset, size_t size) = 0;
 
+	// Drops private copies of the pages in a range (e.g., for MADV_DONTNEED).
+	// Afterwards, the range reflects the contents of the underlying memory again.
+	// By default, this does nothing since the pages are shared with other users.
+	virtual coroutine<frg::expected<Error>>
+	discardRange(uintptr_t offset, size_t size, smarter::shared_ptr<WorkQueue> wq);
+
 	virtual void submitManage(ManageNode *handle);
 
 	// Called (e.g. by user space) to update a range after loading or writeback.
@@ -702,6 +745,25 @@ private:
 
 smarter::shared_ptr<MemoryView> getZeroMemory();
 
+// Returns a page that is filled with zeros. Views return this page from peekRange()
+// for ranges that were only fetched with fetchReadOnly. It must never be mapped writable.
+PhysicalAddr getZeroPage();
+
+// Physically contiguous run of memory, see retrievePhysicalExtents().
+struct PhysicalExtent {
+	PhysicalAddr physical;
+	size_t size;
+};
+
+// Retrieves the physical memory that backs [offset, offset + size) of a view.
+// Pages are fetched (e.g., allocated) as needed. Extents are appended to
+// extents[numExtents], merging physically contiguous runs; at most maxExtents extents
+// are filled. Returns the number of bytes that are covered by the appended extents.
+coroutine<frg::expected<Error, size_t>>
+retrievePhysicalExtents(MemoryView *view, uintptr_t offset, size_t size, FetchFlags flags,
+		PhysicalExtent *extents, size_t &numExtents, size_t maxExtents,
+		smarter::shared_ptr<WorkQueue> wq);
+
 // Memory that is allocated by the kernel and never swapped out.
 // In contrast to most other memory objects, it can be accessed synchronously.
 struct ImmediateMemory final : MemoryView, GlobalFutexSpace {
@@ -718,6 +780,7 @@ struct ImmediateMemory final : MemoryView, GlobalFutexSpace {
 	Error lockRange(uintptr_t offset, size_t size) override;
 	void unlockRange(uintptr_t offset, size_t size) override;
 	frg::tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) override;
+	size_t peekContiguousRange(uintptr_t offset) override;
 	coroutine<frg::expected<Error, PhysicalRange>>
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
@@ -732,9 +795,7 @@ struct ImmediateMemory final : MemoryView, GlobalFutexSpace {
 	}
 
 	ImmediateFutex getImmediateFutex(uintptr_t offset) {
-		auto index = offset >> kPageShift;
-		assert(index < _physicalPages.size());
-		return {this, offset, _physicalPages[index]};
+		return {this, offset, _pageAt(offset >> kPageShift)};
 	}
 
 	template<typename T>
@@ -743,33 +804,48 @@ struct ImmediateMemory final : MemoryView, GlobalFutexSpace {
 		auto misalign = offset & (kPageSize - 1);
 		assert(misalign + sizeof(T) <= kPageSize);
 
-		auto index = offset >> kPageShift;
-		assert(index < _physicalPages.size());
-		PageAccessor accessor{_physicalPages[index]};
+		PageAccessor accessor{_pageAt(offset >> kPageShift)};
 		return reinterpret_cast<T *>(
 				reinterpret_cast<std::byte *>(accessor.get()) + misalign);
 	}
 
+	void readImmediate(uintptr_t offset, void *pointer, size_t size) {
+		size_t progress = 0;
+		while(progress < size) {
+			auto misalign = (offset + progress) & (kPageSize - 1);
+			auto chunk = frg::min(size - progress, kPageSize - misalign);
+
+			PageAccessor accessor{_pageAt((offset + progress) >> kPageShift)};
+			memcpy(reinterpret_cast<std::byte *>(pointer) + progress,
+					reinterpret_cast<std::byte *>(accessor.get()) + misalign, chunk);
+			progress += chunk;
+		}
+	}
+
 	void writeImmediate(uintptr_t offset, void *pointer, size_t size) {
 		size_t progress = 0;
 		while(progress < size) {
 			auto misalign = (offset + progress) & (kPageSize - 1);
 			auto chunk = frg::min(size - progress, kPageSize - misalign);
 
-			auto index = (offset + progress) >> kPageShift;
-			assert(index < _physicalPages.size());
-			PageAccessor accessor{_physicalPages[index]};
+			PageAccessor accessor{_pageAt((offset + progress) >> kPageShift)};
 			memcpy(reinterpret_cast<std::byte *>(accessor.get()) + misalign,
 					reinterpret_cast<std::byte *>(pointer) + progress, chunk);
 			progress += chunk;
 		}
 	}
 
+	// Synchronous version of resize(). The memory can only grow.
+	void grow(size_t newLength);
+
 public:
 	// Contract: set by the code that constructs this object.
 	smarter::borrowed_ptr<ImmediateMemory> selfPtr;
 private:
-	frg::ticket_spinlock _mutex;
+	// grow() may reallocate _physicalPages, hence lookups take _mutex.
+	PhysicalAddr _pageAt(size_t index);
+
+	TicketSpinlock _mutex;
 
 	frg::vector<PhysicalAddr, KernelAlloc> _physicalPages;
 };
@@ -787,6 +863,7 @@ struct HardwareMemory final : MemoryView {
 	Error lockRange(uintptr_t offset, size_t size) override;
 	void unlockRange(uintptr_t offset, size_t size) override;
 	frg::tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) override;
+	size_t peekContiguousRange(uintptr_t offset) override;
 	coroutine<frg::expected<Error, PhysicalRange>>
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
@@ -800,7 +877,8 @@ private:
 
 struct AllocatedMemory final : MemoryView, GlobalFutexSpace {
 	AllocatedMemory(size_t length, int addressBits = 64,
-			size_t chunkSize = kPageSize, size_t chunkAlign = kPageSize);
+			size_t chunkSize = kPageSize, size_t chunkAlign = kPageSize,
+			int numaNode = numaNodeAny);
 	AllocatedMemory(const AllocatedMemory &) = delete;
 	~AllocatedMemory();
 
@@ -826,11 +904,12 @@ public:
 	// Contract: set by the code that constructs this object.
 	smarter::borrowed_ptr<AllocatedMemory> selfPtr;
 private:
-	frg::ticket_spinlock _mutex;
+	TicketSpinlock _mutex;
 
 	frg::vector<PhysicalAddr, KernelAlloc> _physicalChunks;
 	int _addressBits;
 	size_t _chunkSize, _chunkAlign;
+	int _numaNode;
 };
 
 struct ManagedSpace : CacheBundle {
@@ -898,15 +977,34 @@ struct ManagedSpace : CacheBundle {
 	void _progressManagement(ManageList &pending);
 	void _progressMonitors(MonitorList &pending);
 
+	// Puts the page into the initialization list if it is missing.
+	void _queueInitialization(size_t index);
+	// Called on each fetch if readahead is enabled. Adapts the readahead window
+	// and queues initialization of the pages in the window.
+	// miss is true if the page at index was not present (nor being initialized).
+	void _updateReadahead(size_t index, bool miss);
+
 	smarter::borrowed_ptr<ManagedSpace> selfPtr;
 
-	frg::ticket_spinlock mutex;
+	TicketSpinlock mutex;
 
 	frg::rcu_radixtree<ManagedPage, KernelAlloc> pages;
 
 	size_t numPages;
 	bool readahead;
 
+	// Readahead windows grow from minReadahead to maxReadahead pages on sequential access.
+	static constexpr size_t minReadahead = 4;
+	static constexpr size_t maxReadahead = 512;
+
+	// State of the adaptive readahead, protected by mutex.
+	// [_readaheadStart, _readaheadEnd) is the most recently queued window.
+	// Accessing _readaheadTrigger queues the next window before the current one is consumed.
+	size_t _readaheadWindow = 0;
+	size_t _readaheadStart = 0;
+	size_t _readaheadEnd = 0;
+	size_t _readaheadTrigger = static_cast<size_t>(-1);
+
 	EvictionQueue _evictQueue;
 
 	frg::intrusive_list<
@@ -930,7 +1028,7 @@ struct ManagedSpace : CacheBundle {
 	ManageList _managementQueue;
 	MonitorList _monitorQueue;
 
-	DeferredWork<DeferredManagement> _deferredManagement{{this}};
+	DeferredWork<DeferredManagement> _deferredManagement{{this}, WorkPriority::background};
 };
 
 struct BackingMemory final : MemoryView {
@@ -943,6 +1041,9 @@ public:
 	BackingMemory &operator= (const BackingMemory &) = delete;
 
 	size_t getLength() override;
+	bool isPageCache() override {
+		return true;
+	}
 	void resize(size_t newLength, async::any_receiver<void> receiver) override;
 	frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
 			resolveGlobalFutex(uintptr_t offset) override;
@@ -970,6 +1071,9 @@ public:
 	FrontalMemory &operator= (const FrontalMemory &) = delete;
 
 	size_t getLength() override;
+	bool isPageCache() override {
+		return true;
+	}
 	frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
 			resolveGlobalFutex(uintptr_t offset) override;
 	Error lockRange(uintptr_t offset, size_t size) override;
@@ -1013,6 +1117,8 @@ struct IndirectMemory final : MemoryView {
 			uintptr_t offset, size_t size, CachingFlags flags) override;
 
 private:
+	// Slots are read without taking mutex_ (within an EpochGuard).
+	// setIndirection() replaces slots and retires the old ones.
 	struct IndirectionSlot {
 		IndirectionSlot(IndirectMemory *owner, size_t slot,
 				smarter::shared_ptr<MemoryView> memory,
@@ -1027,33 +1133,70 @@ private:
 		size_t size;
 		CachingFlags flags;
 		MemoryObserver observer;
+		EpochNode epochNode;
 	};
 
-	frg::ticket_spinlock mutex_;
-	frg::vector<smarter::shared_ptr<IndirectionSlot>, KernelAlloc> indirections_;
+	// Must be called within an EpochGuard. Returns nullptr if the slot is not set.
+	IndirectionSlot *loadIndirection_(size_t slot) {
+		if(slot >= indirections_.size())
+			return nullptr;
+		return __atomic_load_n(&indirections_[slot], __ATOMIC_ACQUIRE);
+	}
+
+	// Protects writers against each other.
+	TicketSpinlock mutex_;
+	frg::vector<IndirectionSlot *, KernelAlloc> indirections_;
 };
 
 enum class CowState {
 	null,
 	inProgress,
-	hasCopy
+	hasCopy,
+	// The page was only read so far and is backed by the zero page.
+	zero,
+	// The page was evicted to the compressed page store.
+	compressed,
+	// The page was discarded. Unlike missing pages, it is not looked up in the CowChain.
+	discarded
 };
 
+struct CopyOnWriteMemory;
+
 struct CowPage {
 	~CowPage();
 
 	PhysicalAddr physical = -1;
 	CowState state = CowState::null;
 	unsigned int lockCount = 0;
+	// Number of CowChains that contain this page.
+	std::atomic<unsigned int> chainRefs{0};
+
+	// Only pages that are exclusively owned by a single CopyOnWriteMemory (i.e., pages
+	// that are neither locked nor part of a CowChain) are registered with the reclaimer.
+	// The following fields are protected by the owner's mutex.
+	CachePage cachePage;
+	smarter::weak_ptr<CopyOnWriteMemory> owner;
+	bool reclaimTracked = false;
+	// Set while the page is being compressed. Cleared when the page is accessed.
+	bool evicting = false;
+	CompressedPage *compressed = nullptr;
 };
 
 struct CowChain {
-	CowChain();
+	CowChain(uintptr_t viewOffset, size_t length);
 
 	~CowChain();
 
 // TODO: Either this private again or make this class POD-like.
-	frg::ticket_spinlock _mutex;
+	TicketSpinlock _mutex;
+
+	// Range of the root view that is covered by this chain.
+	uintptr_t _viewOffset;
+	size_t _length;
+	// Number of CopyOnWriteMemory objects that use this chain.
+	// If there is only a single holder, pages that are not part of any other chain
+	// can be taken over by the holder instead of being copied.
+	std::atomic<unsigned int> _numHolders{0};
 
 	frg::rcu_radixtree<smarter::shared_ptr<CowPage>, KernelAlloc> _pages;
 };
@@ -1082,20 +1225,43 @@ public:
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	coroutine<frg::expected<Error>>
+			discardRange(uintptr_t offset, size_t size,
+			smarter::shared_ptr<WorkQueue> wq) override;
 
 	coroutine<frg::expected<Error, PhysicalAddr>> takeGlobalFutex(uintptr_t offset,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void retireGlobalFutex(uintptr_t offset) override;
 
+	// Starts the coroutine that moves cold pages to the compressed page store.
+	static void runReclaim();
+
 public:
 	// Contract: set by the code that constructs this object.
 	smarter::borrowed_ptr<CopyOnWriteMemory> selfPtr;
 private:
-	frg::ticket_spinlock _mutex;
+	// Registers an exclusively owned page with the reclaimer (if it is eligible).
+	// Also cancels an ongoing eviction of the page. Must be called with _mutex held.
+	void _trackPage(uintptr_t offset, CowPage *page);
+	// Unregisters a page from the reclaimer and cancels an ongoing eviction.
+	// Must be called with _mutex held.
+	void _untrackPage(CowPage *page);
+	// Moves a page from _copyChain to _ownedPages if no other mapping can observe it.
+	// Must be called with _mutex held. Returns nullptr if the page needs to be copied.
+	smarter::shared_ptr<CowPage> _adoptChainPage(uintptr_t offset);
+	// Whether _copyChain contains the page. Must be called with _mutex held.
+	bool _chainHasPage(uintptr_t offset);
+	// Copies a page of the chain (if present) to a newly allocated page.
+	// Returns PhysicalAddr(-1) if the chain does not contain the page.
+	PhysicalAddr _copyFromChain(CowChain *chain, uintptr_t pageOffset);
+
+	TicketSpinlock _mutex;
 
 	smarter::shared_ptr<MemoryView> _view;
 	uintptr_t _viewOffset;
 	size_t _length;
+	// Whether _view is the ZeroMemory, i.e., whether read faults can use the zero page.
+	bool _zeroBacked;
 	smarter::shared_ptr<CowChain> _copyChain;
 	frg::rcu_radixtree<smarter::shared_ptr<CowPage>, KernelAlloc> _ownedPages;
 	async::recurring_event _copyEvent;
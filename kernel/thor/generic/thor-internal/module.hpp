@@ -1,8 +1,10 @@
 #pragma once
 
+#include <async/mutex.hpp>
 #include <frg/string.hpp>
 #include <frg/vector.hpp>
 #include <thor-internal/address-space.hpp>
+#include <thor-internal/coroutine.hpp>
 #include <thor-internal/kernel_heap.hpp>
 
 namespace thor {
@@ -54,23 +56,49 @@ private:
 	frg::vector<Link, KernelAlloc> _entries;
 };
 
+// Header of initrd files that are compressed by tools/gen-initrd.py.
+// The header is followed by the chunks of the file. Each chunk is introduced by
+// a 32-bit length word; bit 31 of that word indicates that the chunk is stored uncompressed.
+// Otherwise, the chunk is a raw LZ4 block that expands to chunkSize bytes
+// (except for the last chunk which may be shorter).
+struct CompressedModuleHeader {
+	char magic[4];
+	uint32_t chunkSize;
+	uint64_t size;
+};
+
+static_assert(sizeof(CompressedModuleHeader) == 16);
+
+inline constexpr char compressedModuleMagic[4] = {'T', 'L', 'Z', '4'};
+inline constexpr uint32_t compressedChunkStored = uint32_t(1) << 31;
+
 struct MfsRegular : MfsNode {
 	MfsRegular(smarter::shared_ptr<MemoryView> memory, size_t size)
 	: MfsNode{MfsType::regular}, _memory{std::move(memory)}, _size{size} {
 		assert(_size <= _memory->getLength());
 	}
 
-	smarter::shared_ptr<MemoryView> getMemory() {
-		return _memory;
-	}
+	// Constructs a file from compressed initrd data (starting at the CompressedModuleHeader).
+	// The data is only decompressed on the first call to accessMemory().
+	// The data must stay valid for the lifetime of this object.
+	MfsRegular(const void *compressed, size_t compressedSize);
+
+	// Returns the memory that backs this file.
+	// Decompresses the file if necessary.
+	coroutine<smarter::shared_ptr<MemoryView>> accessMemory();
 
 	size_t size() {
 		return _size;
 	}
 
 private:
+	async::mutex _mutex;
 	smarter::shared_ptr<MemoryView> _memory;
 	size_t _size;
+
+	// Compressed data that is not yet expanded into _memory.
+	const char *_compressed = nullptr;
+	size_t _compressedSize = 0;
 };
 
 extern MfsDirectory *mfsRoot;
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace thor {
+
+// Thor uses dense NUMA node IDs in [0, maxNumaNodes).
+// Without firmware information, all memory and all CPUs belong to node 0.
+inline constexpr int maxNumaNodes = 8;
+
+// Passed to allocation functions to request memory from the current CPU's node.
+inline constexpr int numaNodeAny = -1;
+
+// Distances as defined by ACPI's SLIT (i.e., relative to a local access cost of 10).
+inline constexpr uint8_t numaLocalDistance = 10;
+inline constexpr uint8_t numaRemoteDistance = 20;
+
+int numNumaNodes();
+
+// Returns the node ID for a firmware proximity domain, allocating a new ID if necessary.
+// Returns -1 if the maximal number of nodes is exceeded.
+int registerNumaDomain(uint32_t domain);
+
+// Returns the node ID for a firmware proximity domain or -1 if the domain is unknown.
+int findNumaDomain(uint32_t domain);
+
+void setNumaDistance(int from, int to, uint8_t distance);
+uint8_t getNumaDistance(int from, int to);
+
+// Maps a hardware CPU ID (e.g., the local APIC ID on x86) to a node.
+void registerCpuNumaNode(uint32_t hwId, int node);
+// Returns the node of a hardware CPU ID (or node 0 if the CPU is unknown).
+int getCpuNumaNode(uint32_t hwId);
+
+} // namespace thor
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <atomic>
+#include <string.h>
 
 #include <bragi/helpers-all.hpp>
 #include <bragi/helpers-frigg.hpp>
 #include <frg/span.hpp>
+#include <thor-internal/arch-generic/timer.hpp>
 #include <thor-internal/main.hpp>
 #include <thor-internal/ring-buffer.hpp>
 #include <ostrace.frigg_bragi.hpp>
@@ -22,8 +24,12 @@ namespace ostrace {
 // Set by the ostrace code one in-kernel ostrace is available.
 extern std::atomic<bool> available;
 
+struct TracepointRing;
+
 struct Context {
 	frg::vector<char, KernelAlloc> buffer{*kernelAlloc};
+	// Allocated by the first tracepoint that fires on this CPU.
+	TracepointRing *tracepointRing{nullptr};
 };
 
 extern PerCpu<Context> context;
@@ -78,6 +84,24 @@ struct UintAttribute : Term {
 	}
 };
 
+struct BufferAttribute : Term {
+	using Record = managarm::ostrace::BufferAttribute<KernelAlloc>;
+
+	constexpr BufferAttribute(const char *name)
+	: Term{name} { }
+
+	Record operator() (frg::span<const char> v) {
+		frg::vector<uint8_t, KernelAlloc> buffer{*kernelAlloc};
+		buffer.resize(v.size());
+		memcpy(buffer.data(), v.data(), v.size());
+
+		Record record{*kernelAlloc};
+		record.set_id(static_cast<uint64_t>(id()));
+		record.set_buffer(std::move(buffer));
+		return record;
+	}
+};
+
 template<typename... Args>
 void emit(const Event &event, Args... args) {
 	if (!available.load(std::memory_order_relaxed))
@@ -85,6 +109,7 @@ void emit(const Event &event, Args... args) {
 
 	managarm::ostrace::EventRecord<KernelAlloc> eventRecord{*kernelAlloc};
 	eventRecord.set_id(static_cast<uint64_t>(event.id()));
+	eventRecord.set_ts(haveTimer() ? getClockNanos() : 0);
 
 	managarm::ostrace::EndOfRecord<KernelAlloc> endOfRecord{*kernelAlloc};
 
@@ -122,9 +147,58 @@ void emit(const Event &event, Args... args) {
 	}
 }
 
+// Static tracepoints in kernel hot paths.
+// Unlike emit(), tracepoints do not serialize anything on the hot path: they only
+// append a fixed-size record to a per-CPU ring. A fiber converts these records
+// to ostrace events; since it drains the CPUs one after another, the records of
+// different CPUs are not ordered in the output (extract-ostrace can merge them).
+enum class Tracepoint : uint32_t {
+	syscallEnter,
+	syscallExit,
+	scheduleIn,
+	scheduleOut,
+	pageFault,
+	ipcSubmit,
+	ipcComplete,
+	irq,
+	numTracepoints
+};
+
+struct TracepointRecord {
+	uint64_t ts;
+	Tracepoint tracepoint;
+	uint32_t cpu;
+	uint64_t args[2];
+};
+
+// Only set if ostrace.tracepoints is passed on the command line.
+// This is never written after initialization, so the check in tracepoint() is a
+// predictable branch on a read-mostly cache line.
+extern constinit std::atomic<bool> tracepointsEnabled;
+
+void recordTracepoint(Tracepoint tp, uint64_t arg0, uint64_t arg1);
+
+// Converts pending tracepoint records of all CPUs to ostrace events.
+// Returns true if any records were drained.
+bool drainTracepoints();
+
+inline void tracepoint(Tracepoint tp, uint64_t arg0 = 0, uint64_t arg1 = 0) {
+	if(tracepointsEnabled.load(std::memory_order_relaxed)) [[unlikely]]
+		recordTracepoint(tp, arg0, arg1);
+}
+
 } // namespace ostrace
 
 extern ostrace::Event ostEvtArmPreemption;
 extern ostrace::Event ostEvtArmCpuTimer;
 
+// Emitted by the IRQ-off tracer (thor.irqtrace).
+extern ostrace::Event ostEvtIrqOffSection;
+extern ostrace::UintAttribute ostAttrIrqOffCpu;
+// Length of the section in units of getRawTimestampCounter().
+extern ostrace::UintAttribute ostAttrIrqOffTicks;
+extern ostrace::UintAttribute ostAttrIrqOffSite;
+// Return addresses (as an array of uint64_t) at the end of the section.
+extern ostrace::BufferAttribute ostAttrIrqOffStack;
+
 } // namespace thor
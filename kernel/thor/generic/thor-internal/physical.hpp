@@ -8,6 +8,8 @@
 #include <physical-buddy.hpp>
 #include <thor-internal/arch-generic/paging-consts.hpp>
 #include <thor-internal/elf-notes.hpp>
+#include <thor-internal/kernel-locks.hpp>
+#include <thor-internal/numa.hpp>
 #include <thor-internal/types.hpp>
 
 namespace thor {
@@ -114,17 +116,73 @@ void poisonPhysicalAccess(PhysicalAddr physical);
 void poisonPhysicalWriteAccess(PhysicalAddr physical);
 
 
+// Per-CPU cache of free chunks of small orders.
+// Allocations and frees of these orders are served from the current CPU's magazine
+// without taking the allocator's global lock. Magazines are refilled from
+// (and drained to) the buddy allocator in batches.
+struct PhysicalMagazine {
+	// Chunks of order [0, numOrders) are cached.
+	static constexpr int numOrders = 4;
+	// Capacity of the order 0 magazine. Higher orders hold proportionally fewer chunks,
+	// such that each order caches at most the same amount of memory.
+	static constexpr size_t baseCapacity = 64;
+
+	static constexpr size_t capacity(int order) {
+		return baseCapacity >> order;
+	}
+
+	// Number of chunks that are moved between the magazine and the buddy allocator at once.
+	static constexpr size_t batchSize(int order) {
+		return capacity(order) / 2;
+	}
+
+	struct Stack {
+		PhysicalAddr chunks[baseCapacity];
+		size_t count = 0;
+	};
+
+	Stack stacks[numOrders];
+	// Pages of order zero that were zeroed while the CPU was idle.
+	// At most baseCapacity pages are kept zeroed.
+	Stack zeroed;
+
+	// Statistics. Only modified by the owning CPU but may be read by any CPU.
+	std::atomic<uint64_t> hits{0};
+	std::atomic<uint64_t> misses{0};
+};
+
 class PhysicalChunkAllocator {
-	typedef frg::ticket_spinlock Mutex;
+	typedef TicketSpinlock Mutex;
 public:
 	PhysicalChunkAllocator();
 	
 	void bootstrapRegion(PhysicalAddr address,
 			int order, size_t numRoots, int8_t *buddyTree);
 
-	PhysicalAddr allocate(size_t size, int addressBits = 64);
+	// Enables the per-CPU magazines. Must be called after the per-CPU data
+	// of the boot CPU has been initialized.
+	void enableMagazines();
+
+	// Assigns all regions that start within the given range of physical memory to a NUMA node.
+	void setNumaNode(PhysicalAddr address, size_t size, int node);
+
+	// If node is numaNodeAny, memory is preferably taken from the current CPU's node.
+	// Otherwise, memory is preferably taken from the given node.
+	// In both cases, other nodes are tried in order of increasing distance.
+	PhysicalAddr allocate(size_t size, int addressBits = 64, int node = numaNodeAny);
 	void free(PhysicalAddr address, size_t size);
 
+	// Allocates a single page that is filled with zeros.
+	// Prefers pages that were zeroed ahead of time by prezeroPage().
+	PhysicalAddr allocateZeroed(int addressBits = 64, int node = numaNodeAny);
+	// Zeroes a page for later use by allocateZeroed() on the current CPU.
+	// Called by the idle loop. Returns false if no more pages need to be zeroed.
+	bool prezeroPage();
+
+	// Sums of the magazine hit/miss counters over all CPUs.
+	uint64_t numMagazineHits();
+	uint64_t numMagazineMisses();
+
 	size_t numTotalPages() {
 		return _totalPages.load(std::memory_order_relaxed);
 	}
@@ -136,12 +194,23 @@ public:
 	}
 
 private:
+	// The following functions must be called with _mutex held.
+	PhysicalAddr _allocateFromBuddy(int order, int addressBits, int node);
+	PhysicalAddr _allocateFromNode(int order, int addressBits, int node);
+	void _freeToBuddy(PhysicalAddr address, int order);
+
+	// Returns the NUMA node of a physical address (without taking _mutex).
+	int _nodeOf(PhysicalAddr address);
+
 	Mutex _mutex;
 
+	std::atomic<bool> _magazinesEnabled{false};
+
 	struct Region {
 		PhysicalAddr physicalBase;
 		PhysicalAddr regionSize;
 		BuddyAccessor buddyAccessor;
+		std::atomic<int> node{0};
 	};
 
 	Region _allRegions[8];
@@ -6,7 +6,27 @@ namespace thor {
 
 extern bool wantKernelProfile;
 
+inline constexpr size_t maxProfileFrames = 32;
+
+// Layout of the records in the profiling ring buffer.
+// Only the first 1 + numFrames words are part of the record.
+struct ProfileSample {
+	static constexpr uint64_t numFramesMask = 0xFFFF;
+	static constexpr uint64_t userBit = uint64_t{1} << 16;
+
+	// Bits 0-15 contain the number of frames.
+	// Bit 16 is set if the sample was taken in user mode.
+	// Bits 32-63 contain the index of the CPU that took the sample.
+	uint64_t header;
+	// The interrupted IP, followed by the return addresses of the enclosing frames.
+	uintptr_t frames[maxProfileFrames];
+};
+
+// Sets up the global profiling ring and starts profiling on the current CPU.
 void initializeProfile();
+// Starts profiling on the current CPU. Must be called by each AP
+// once its scheduler is available.
+void initializeProfileOnThisCpu();
 LogRingBuffer *getGlobalProfileRing();
 
 } // namespace thor
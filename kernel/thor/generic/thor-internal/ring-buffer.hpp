@@ -4,6 +4,7 @@
 #include <stddef.h>
 
 #include <async/recurring-event.hpp>
+#include <hel.h>
 #include <frg/tuple.hpp>
 #include <frg/utility.hpp>
 #include <thor-internal/cpu-data.hpp>
@@ -11,6 +12,8 @@
 
 namespace thor {
 
+struct RingMirror;
+
 struct LogRingBuffer {
 	LogRingBuffer(uintptr_t storage, size_t size)
 	: ringSize_{size}, buffer_{reinterpret_cast<char *>(storage)} {
@@ -23,6 +26,35 @@ struct LogRingBuffer {
 		});
 	}
 
+	size_t size() {
+		return ringSize_;
+	}
+
+	uint64_t head() {
+		return headPtr_.load(std::memory_order_acquire);
+	}
+
+	// Copies all future records into memory that user space can map (see ring-mirror.hpp).
+	// The kernel never reads from the mirror, hence user space cannot corrupt the ring.
+	void attachMirror(RingMirror *mirror, HelLogRingHeader *header, char *data) {
+		auto irqLock = frg::guard(&thor::irqMutex());
+		auto lock = frg::guard(&mutex_);
+
+		// Records before the current head are not mirrored.
+		auto enqPtr = headPtr_.load(std::memory_order_relaxed);
+		__atomic_store_n(&header->dataSize, ringSize_, __ATOMIC_RELAXED);
+		__atomic_store_n(&header->tail, enqPtr, __ATOMIC_RELAXED);
+		__atomic_store_n(&header->head, enqPtr, __ATOMIC_RELEASE);
+
+		mirrorHeader_ = header;
+		mirrorData_ = data;
+		mirror_ = mirror;
+	}
+
+	RingMirror *mirror() {
+		return mirror_;
+	}
+
 	void enqueue(const void *data, size_t recordSize, bool suppressWakeup = false) {
 		{
 			auto irqLock = frg::guard(&thor::irqMutex());
@@ -35,6 +67,7 @@ struct LogRingBuffer {
 
 			// Compute the invalidated part of the ring buffer.
 			auto invalPtr = tailPtr_.load(std::memory_order_relaxed);
+			uint64_t invalRecords = 0;
 			while(invalPtr + ringSize_ < enqPtr + headerSize + recordSize) {
 				assert(invalPtr < enqPtr);
 				auto tailOffset = invalPtr & (ringSize_ - 1);
@@ -46,25 +79,43 @@ struct LogRingBuffer {
 				assert(tailSize <= ringSize_);
 
 				invalPtr += effectiveSize(tailSize);
+				invalRecords++;
 			}
 
 			// Invalidate the ring *before* writing to it.
 			assert(!(invalPtr & (recordAlign - 1)));
 			tailPtr_.store(invalPtr, std::memory_order_release);
+			if(mirrorHeader_) {
+				// The mirror may lag behind since it does not contain older records.
+				if(invalPtr > __atomic_load_n(&mirrorHeader_->tail, __ATOMIC_RELAXED))
+					__atomic_store_n(&mirrorHeader_->tail, invalPtr, __ATOMIC_RELAXED);
+				if(invalRecords)
+					__atomic_store_n(&mirrorHeader_->overwrittenRecords,
+							__atomic_load_n(&mirrorHeader_->overwrittenRecords, __ATOMIC_RELAXED)
+							+ invalRecords, __ATOMIC_RELAXED);
+				__atomic_thread_fence(__ATOMIC_RELEASE);
+			}
 
 			// Copy to the ring.
 			auto recordOffset = enqPtr & (ringSize_ - 1);
 			// Alignment guarantees that the header fits contiguously.
 			assert(!(recordOffset > ringSize_ - headerSize));
 
-			memcpy(buffer_ + recordOffset, &recordSize, sizeof(size_t));
 			auto preWrapSize = frg::min(ringSize_ - (recordOffset + headerSize), recordSize);
-			memcpy(buffer_ + recordOffset + sizeof(size_t), p, preWrapSize);
-			memcpy(buffer_, p + preWrapSize, recordSize - preWrapSize);
+			auto copyRecord = [&] (char *ring) {
+				memcpy(ring + recordOffset, &recordSize, sizeof(size_t));
+				memcpy(ring + recordOffset + sizeof(size_t), p, preWrapSize);
+				memcpy(ring, p + preWrapSize, recordSize - preWrapSize);
+			};
+			copyRecord(buffer_);
+			if(mirrorData_)
+				copyRecord(mirrorData_);
 
 			// Commit the operation *after* writing to the ring.
 			auto commitPtr = enqPtr + effectiveSize(recordSize);
 			headPtr_.store(commitPtr, std::memory_order_release);
+			if(mirrorHeader_)
+				__atomic_store_n(&mirrorHeader_->head, commitPtr, __ATOMIC_RELEASE);
 		}
 
 		if(!suppressWakeup)
@@ -122,7 +173,7 @@ private:
 		return (headerSize + recordSize + recordAlign - 1) & ~(recordAlign - 1);
 	}
 
-	frg::ticket_spinlock mutex_;
+	TicketSpinlock mutex_;
 
 	// This allows consumers to wait until new records arrive.
 	async::recurring_event event_;
@@ -131,6 +182,11 @@ private:
 	char *buffer_;
 	std::atomic<uint64_t> tailPtr_{0};
 	std::atomic<uint64_t> headPtr_{0};
+
+	// Set by attachMirror().
+	RingMirror *mirror_{nullptr};
+	HelLogRingHeader *mirrorHeader_{nullptr};
+	char *mirrorData_{nullptr};
 };
 
 struct SingleContextRecordRing {
@@ -337,6 +393,10 @@ struct ReentrantRecordRing {
 		return {true, deqPtr, newPtr, chunkSize};
 	}
 
+	uint64_t peekHeadPtr() {
+		return std::atomic_ref{headPtr_}.load(std::memory_order_relaxed);
+	}
+
 private:
 	static constexpr size_t headerSize = sizeof(size_t);
 	static constexpr size_t recordAlign = sizeof(size_t);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <smarter.hpp>
+#include <thor-internal/memory-view.hpp>
+#include <thor-internal/ring-buffer.hpp>
+
+namespace thor {
+
+// Memory that mirrors a LogRingBuffer such that user space can map it read-only
+// instead of copying records through kerncfg requests (see HelLogRingHeader).
+struct RingMirror {
+	smarter::shared_ptr<MemoryView> headerMemory;
+	smarter::shared_ptr<MemoryView> dataMemory;
+};
+
+// Allocates a mirror and attaches it to the ring.
+// Records that were enqueued before this call are not visible in the mirror.
+void createRingMirror(LogRingBuffer *ring);
+
+} // namespace thor
@@ -2,10 +2,12 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <atomic>
 
 #include <frg/list.hpp>
 #include <frg/pairing_heap.hpp>
 #include <frg/spinlock.hpp>
+#include <smarter.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/arch-generic/cpu.hpp>
 
@@ -40,6 +42,84 @@ inline int64_t progressToNanos(Progress p) {
 	return static_cast<int64_t>(p >> progressShift);
 }
 
+// Number of fractional bits of effective weights (see Scheduler::_effectiveWeight()).
+constexpr int weightShift = 16;
+
+// Hierarchical group of entities (e.g., a cgroup).
+// On each CPU, a group receives a share of the CPU time that is proportional to its weight
+// (relative to the weights of the other active children of its parent).
+// The share of a group is divided among its active children in proportion to their weights.
+// Each entity has the weight ScheduleGroup::defaultWeight.
+//
+// Additionally, the run time of all entities within a group (across all CPUs) can be
+// limited to a quota per period. Entities of groups that exhaust their quota are not
+// scheduled until the next period starts.
+struct ScheduleGroup {
+	friend struct Scheduler;
+
+	static constexpr uint32_t defaultWeight = 100;
+	static constexpr uint32_t minWeight = 1;
+	static constexpr uint32_t maxWeight = 10'000;
+
+	ScheduleGroup(smarter::shared_ptr<ScheduleGroup> parent);
+
+	ScheduleGroup(const ScheduleGroup &) = delete;
+
+	~ScheduleGroup();
+
+	ScheduleGroup &operator= (const ScheduleGroup &) = delete;
+
+	ScheduleGroup *parent() {
+		return _parent.get();
+	}
+
+	uint32_t weight() {
+		return _weight.load(std::memory_order_relaxed);
+	}
+
+	// Changes to the weight apply when children of the group become active.
+	void setWeight(uint32_t weight);
+
+	// A quota of zero disables the bandwidth limit.
+	void setBandwidth(uint64_t quota, uint64_t period);
+
+private:
+	// Rolls over to the current period (if necessary). Must be called with _bandwidthMutex held.
+	void _renewPeriod(uint64_t now);
+
+	// Accounts run time against the quota of this group and all of its ancestors.
+	void _charge(uint64_t now, uint64_t delta);
+
+	// Returns the time at which the group (or one of its ancestors) is unthrottled again,
+	// or zero if the group is not throttled.
+	uint64_t _throttledUntil(uint64_t now);
+
+	// Returns the run time that is left in the current period of this group and its ancestors.
+	uint64_t _remainingQuota(uint64_t now);
+
+	// State of the group on one CPU. Only accessed by that CPU's scheduler with IRQs disabled.
+	struct CpuState {
+		// Sum of the weights of all active children.
+		uint64_t activeWeight{0};
+		// Number of active children. If this is non-zero, the group is active.
+		size_t numActive{0};
+		// Weight that the group contributes to its parent while it is active.
+		uint32_t contributedWeight{0};
+	};
+
+	smarter::shared_ptr<ScheduleGroup> _parent;
+	std::atomic<uint32_t> _weight{defaultWeight};
+
+	CpuState *_cpuStates;
+	size_t _numCpus;
+
+	TicketSpinlock _bandwidthMutex;
+	uint64_t _quota{0};
+	uint64_t _period{0};
+	uint64_t _periodStart{0};
+	uint64_t _periodUsage{0};
+};
+
 struct ScheduleEntity {
 	friend struct Scheduler;
 
@@ -68,21 +148,69 @@ public:
 		return _runTime;
 	}
 
+	// Number of times that the entity gave up its CPU by blocking.
+	uint64_t voluntarySwitches() {
+		return _voluntarySwitches;
+	}
+
+	// Number of times that the entity was preempted while it was still runnable.
+	uint64_t involuntarySwitches() {
+		return _involuntarySwitches;
+	}
+
+	// Number of times that the entity was associated with a different scheduler.
+	uint64_t migrations() {
+		return _migrations;
+	}
+
+	// Moves the entity into a group (or back to the top level if group is null).
+	// Takes effect the next time that the entity is scheduled or resumed.
+	void setGroup(smarter::shared_ptr<ScheduleGroup> group);
+
 private:
 	const ScheduleType type_;
 
-	frg::ticket_spinlock _associationMutex;
+	TicketSpinlock _associationMutex;
 	Scheduler *_scheduler;
+	// Scheduler that the entity was associated with before the last unassociate().
+	Scheduler *_lastScheduler{nullptr};
 
 	ScheduleState state;
+	// Effective priority that is used for scheduling decisions.
 	int priority;
-
-	frg::default_list_hook<ScheduleEntity> listHook;
+	// Priority that was set by setPriority(). Used while the latency class is throttled.
+	int basePriority;
+
+	// Latency class (see Scheduler::setLatencyClass()). Disabled if _latencyBudget is zero.
+	int _latencyPriority{0};
+	uint64_t _latencyBudget{0};
+	uint64_t _latencyPeriod{0};
+	// Start of the current period and _runTime at that point.
+	uint64_t _periodStart{0};
+	uint64_t _periodRunTime{0};
+	// Whether the entity exhausted its budget in the current period.
+	bool _throttled{false};
+
+	// Group set by setGroup(). Protected by _associationMutex.
+	smarter::shared_ptr<ScheduleGroup> _group;
+	// Group that the entity contributes its weight to while it is active.
+	// Only accessed by the entity's scheduler.
+	smarter::shared_ptr<ScheduleGroup> _activeGroup;
+	// Whether the entity is in Scheduler::_throttledHead
+	// (since its group exhausted its bandwidth quota).
+	bool _bandwidthThrottled{false};
+
+	// Link in Scheduler::_pendingHead.
+	ScheduleEntity *pendingNext = nullptr;
 	frg::pairing_heap_hook<ScheduleEntity> heapHook;
 
 	uint64_t _refClock;
 	uint64_t _runTime;
 
+	uint64_t _voluntarySwitches{0};
+	uint64_t _involuntarySwitches{0};
+	uint64_t _migrations{0};
+
 	// Scheduler::_systemProgress value at some slice T.
 	// Invariant: This entity's state did not change since T.
 	Progress refProgress;
@@ -99,6 +227,14 @@ struct ScheduleGreater {
 	}
 };
 
+struct WakeupStatistics {
+	// Number of ping IPIs that resume() sent to this scheduler.
+	uint64_t ipisSent;
+	// Number of remote resume() calls that did not need an IPI, either because
+	// a wakeup was already pending or because the CPU was polling for wakeups.
+	uint64_t ipisSuppressed;
+};
+
 struct Scheduler {
 	// Note: the scheduler's methods (e.g., associate, unassociate, resume, ...)
 	// may be called from any CPU, *however*, calling them on the same ScheduleEntity is
@@ -109,9 +245,21 @@ struct Scheduler {
 
 	static void setPriority(ScheduleEntity *entity, int priority);
 
+	// Moves the entity into the latency class. Entities in the latency class take precedence
+	// over all entities of the regular class (regardless of their priority) as long as they
+	// do not run for more than budget ns per period ns. Afterwards, they are scheduled with
+	// their regular priority until the next period starts.
+	// setPriority() moves the entity back to the regular class.
+	static void setLatencyClass(ScheduleEntity *entity, int priority,
+			uint64_t budget, uint64_t period);
+
 	static void resume(ScheduleEntity *entity);
 	static void suspendCurrent();
 
+	// Returns the run time of the entity, including the current time slice
+	// if the entity is running on the local CPU. Must be called with IRQs disabled.
+	static uint64_t liveRunTime(ScheduleEntity *entity);
+
 	Scheduler(CpuData *cpu_context);
 
 	Scheduler(const Scheduler &) = delete;
@@ -162,6 +310,25 @@ public:
 	[[noreturn]] void commitReschedule();
 	void renewSchedule();
 
+	// Runs the idle loop of the current CPU. Called by the idle task on the idle stack.
+	// The CPU first polls for wakeups for a short, adaptive window,
+	// then waits on the idle state word (if MONITOR/MWAIT-like functionality is available)
+	// and otherwise halts until the next IRQ.
+	[[noreturn]] void runIdleLoop();
+
+	// Called when the idle task enters the scheduler from an IRQ.
+	void leaveIdle() {
+		// Acquire pairs with _wakeIdle() to make the resumed entity visible to updateQueue().
+		_idleState.exchange(idleRunning, std::memory_order_acquire);
+	}
+
+	WakeupStatistics wakeupStatistics() {
+		return {
+			.ipisSent = _wakeupIpisSent.load(std::memory_order_relaxed),
+			.ipisSuppressed = _wakeupIpisSuppressed.load(std::memory_order_relaxed)
+		};
+	}
+
 	ScheduleEntity *currentRunnable();
 
 private:
@@ -176,6 +343,35 @@ private:
 
 	void _updateEntityStats(ScheduleEntity *entity);
 
+	// Adds (or removes) the weight of an entity when it becomes active (or inactive).
+	void _activateEntity(ScheduleEntity *entity);
+	void _deactivateEntity(ScheduleEntity *entity);
+	// Re-activates the entity if its group was changed by setGroup().
+	void _refreshGroup(ScheduleEntity *entity);
+
+	// Share of the CPU that the entity receives relative to an entity with the default
+	// weight at the top level. Fixed point number with weightShift fractional bits.
+	Progress _effectiveWeight(const ScheduleEntity *entity);
+	// Sum of _effectiveWeight() over all active entities.
+	Progress _totalWeight();
+
+	// Moves entities from _throttledHead back to _waitQueue once their quota is renewed.
+	void _unthrottleEntities();
+	// Returns the time at which bandwidth limits require a call into the scheduler,
+	// or UINT64_MAX if there is no such time.
+	uint64_t _bandwidthDeadline();
+
+	// Replenishes or throttles the budget of latency class entities.
+	// Must not be called on entities that are in _waitQueue.
+	void _updateLatencyClass(ScheduleEntity *entity);
+	uint64_t _remainingBudget(ScheduleEntity *entity);
+
+	// Wakes up an idle scheduler without sending an IPI.
+	// Returns false if the scheduler is not polling for wakeups.
+	bool _wakeIdle();
+
+	void _adaptIdlePoll(bool wokenWhilePolling, uint64_t idleTime);
+
 	CpuData *_cpuContext;
 
 	ScheduleEntity *_current;
@@ -193,6 +389,13 @@ private:
 
 	size_t _numWaiting = 0;
 
+	// Sum of the weights of the active top-level entities and groups.
+	uint64_t _activeWeight = 0;
+
+	// Entities that are active but cannot be scheduled since their group
+	// exhausted its bandwidth quota. Linked via pendingNext.
+	ScheduleEntity *_throttledHead = nullptr;
+
 	// See mustCallPreemption().
 	bool _mustCallPreemption{false};
 
@@ -203,6 +406,21 @@ private:
 	// Start of the current timeslice.
 	uint64_t _sliceClock;
 
+	// ----------------------------------------------------------------------------------
+	// Handoff scheduling.
+	// ----------------------------------------------------------------------------------
+
+	// Entity that was most recently resumed on this CPU by _handoffSource.
+	// If _handoffSource blocks before the next reschedule, _schedule() runs the candidate
+	// directly in the remainder of the time slice (e.g., the receiver of an IPC message
+	// or a client that waits for a reply). Both are cleared by each _schedule().
+	ScheduleEntity *_handoffSource = nullptr;
+	ScheduleEntity *_handoffCandidate = nullptr;
+	// Set by suspendCurrent() if the suspended entity was _handoffSource.
+	bool _handoffPending = false;
+	// Set by _schedule() if _scheduled is the handoff candidate.
+	bool _handoffScheduled = false;
+
 	// This variables stores sum{t = 0, ... T} w(t)/n(t).
 	// This allows us to easily track u_p(T) for all waiting processes.
 	Progress _systemProgress = 0;
@@ -211,17 +429,30 @@ private:
 	// Management of pending entities.
 	// ----------------------------------------------------------------------------------
 
-	// Note that _mutex *only* protects _pendingList and nothing more!
-	frg::ticket_spinlock _mutex;
+	// ----------------------------------------------------------------------------------
+	// Idle state.
+	// ----------------------------------------------------------------------------------
 
-	frg::intrusive_list<
-		ScheduleEntity,
-		frg::locate_member<
-			ScheduleEntity,
-			frg::default_list_hook<ScheduleEntity>,
-			&ScheduleEntity::listHook
-		>
-	> _pendingList;
+	// The CPU runs the scheduler (or a non-idle entity). Wakeups need an IPI.
+	static constexpr uint32_t idleRunning = 0;
+	// The CPU polls or waits on _idleState. Wakeups only need to write _idleState.
+	static constexpr uint32_t idlePolling = 1;
+	// A wakeup was delivered by writing _idleState.
+	static constexpr uint32_t idleWoken = 2;
+
+	std::atomic<uint32_t> _idleState{idleRunning};
+
+	// Length of the polling window of the idle loop in ns.
+	uint64_t _idlePollNanos;
+
+	// Lock-free LIFO of entities that were resumed but not yet moved to _waitQueue.
+	// resume() pushes from any CPU; updateQueue() takes the whole list at once.
+	// Only the resume() that finds the list empty needs to notify this CPU.
+	std::atomic<ScheduleEntity *> _pendingHead{nullptr};
+
+	// Written by remote CPUs in resume().
+	std::atomic<uint64_t> _wakeupIpisSent{0};
+	std::atomic<uint64_t> _wakeupIpisSuppressed{0};
 };
 
 // Similar to Scheduler::checkPreemption() but specialized for threads.
@@ -74,11 +74,20 @@ inline bool usesFlowProtocol(int tag) {
 	return tag == kTagSendFlow || tag == kTagRecvFlow;
 }
 
+struct VirtualSpace;
+
 struct FlowPacket {
 	void *data = nullptr;
 	size_t size = 0;
 	bool terminate = false;
 	bool fault = false;
+
+	// Direct transfers: instead of data, the sender passes its address space and the
+	// address of its buffer, such that the receiver can copy without a bounce buffer.
+	// In the ack, sourceFault indicates that the fault happened in the sender's space.
+	VirtualSpace *space = nullptr;
+	uintptr_t address = 0;
+	bool sourceFault = false;
 };
 
 struct StreamNode {
@@ -231,7 +240,7 @@ private:
 
 	frg::optional<Credentials> _creds;
 
-	frg::ticket_spinlock _mutex;
+	TicketSpinlock _mutex;
 
 	// protected by _mutex.
 	frg::intrusive_list<
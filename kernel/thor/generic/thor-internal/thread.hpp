@@ -294,7 +294,7 @@ public:
 	uint32_t flags;
 
 private:
-	typedef frg::ticket_spinlock Mutex;
+	typedef TicketSpinlock Mutex;
 
 	enum RunState {
 		kRunNone,
@@ -372,6 +372,21 @@ public:
 		return _loadLevel.load(std::memory_order_relaxed);
 	}
 
+	// Brackets syscalls and user page faults. The run time that the thread accumulates
+	// in between is accounted as kernel time. Must be called on the current thread.
+	// Note that kernel entries that do not return (e.g., because the thread is
+	// interrupted) are accounted as user time.
+	void enterKernelTime();
+	void leaveKernelTime();
+
+	uint64_t kernelTime() {
+		return _kernelTime.load(std::memory_order_relaxed);
+	}
+
+	// Run time at the last call to enterKernelTime().
+	uint64_t _kernelEntryRunTime{0};
+	std::atomic<uint64_t> _kernelTime{0};
+
 	LbControlBlock *_lbCb{nullptr};
 
 private:
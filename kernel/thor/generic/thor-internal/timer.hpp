@@ -6,6 +6,7 @@
 #include <async/cancellation.hpp>
 #include <frg/container_of.hpp>
 #include <frg/intrusive.hpp>
+#include <frg/list.hpp>
 #include <frg/pairing_heap.hpp>
 #include <frg/spinlock.hpp>
 #include <thor-internal/arch-generic/timer.hpp>
@@ -43,6 +44,7 @@ struct PrecisionTimerNode {
 	};
 
 	friend struct CompareTimer;
+	friend struct CompareTimerLatest;
 	friend struct PrecisionTimerEngine;
 
 	PrecisionTimerNode()
@@ -59,14 +61,32 @@ struct PrecisionTimerNode {
 		_elapsed = elapsed;
 	}
 
+	// Allows the timer to elapse up to slack nanoseconds after its deadline.
+	// This lets the engine fire multiple timers using a single interrupt.
+	void setSlack(uint64_t slack) {
+		_slack = slack;
+	}
+
 	bool wasCancelled() {
 		return _wasCancelled;
 	}
 
+	// Hooks for the engine's heaps (ordered by deadline and by latest expiration time).
 	frg::pairing_heap_hook<PrecisionTimerNode> hook;
+	frg::pairing_heap_hook<PrecisionTimerNode> latestHook;
+
+	// Hook for the timing wheel.
+	frg::default_list_hook<PrecisionTimerNode> wheelHook;
 
 private:
+	uint64_t _latest() const {
+		if(_deadline + _slack < _deadline)
+			return ~uint64_t{0};
+		return _deadline + _slack;
+	}
+
 	uint64_t _deadline;
+	uint64_t _slack = 0;
 	async::cancellation_token _cancelToken;
 	Worklet *_elapsed;
 
@@ -74,6 +94,10 @@ private:
 	PrecisionTimerEngine *_engine;
 
 	TimerState _state = TimerState::none;
+	// Level of the timing wheel that contains this timer (or -1 if the timer is in the heaps),
+	// and the absolute index of the timer's slot on that level.
+	int _wheelLevel = -1;
+	uint64_t _wheelIndex = 0;
 	bool _wasCancelled = false;
 	async::cancellation_observer<CancelFunctor> _cancelCb;
 };
@@ -84,11 +108,17 @@ struct CompareTimer {
 	}
 };
 
+struct CompareTimerLatest {
+	bool operator() (const PrecisionTimerNode *a, const PrecisionTimerNode *b) const {
+		return a->_latest() > b->_latest();
+	}
+};
+
 struct PrecisionTimerEngine final {
 	friend struct PrecisionTimerNode;
 
 private:
-	using Mutex = frg::ticket_spinlock;
+	using Mutex = TicketSpinlock;
 
 public:
 	PrecisionTimerEngine(CpuData *ourCpu)
@@ -164,12 +194,40 @@ public:
 	void firedAlarm();
 
 private:
+	// Timers that expire in the near future are kept in the heaps. Timers that expire
+	// further in the future are kept in a hierarchical timing wheel, which supports
+	// O(1) insertion and removal. Slots of the wheel are moved to the heaps
+	// (or to lower levels of the wheel) shortly before they expire.
+	// Level l of the wheel consists of wheelSlots slots of (1 << wheelShift(l)) ns each.
+	static constexpr int wheelLevels = 4;
+	static constexpr int wheelSlotShift = 6;
+	static constexpr size_t wheelSlots = size_t{1} << wheelSlotShift;
+	// Level 0 slots are ~4 ms, level 3 covers ~19 hours.
+	static constexpr int wheelBaseShift = 22;
+
+	static constexpr int wheelShift(int level) {
+		return wheelBaseShift + wheelSlotShift * level;
+	}
+
+	// Timers that expire before now + nearHorizon are always kept in the heaps.
+	static constexpr uint64_t nearHorizon = uint64_t{2} << wheelBaseShift;
+
+	void _insert(PrecisionTimerNode *timer, uint64_t current);
+	void _remove(PrecisionTimerNode *timer);
+	// Moves all wheel slots that are due to the heaps (or to lower levels).
+	void _cascade(uint64_t current);
+	// Returns the time at which the next wheel slot needs to be cascaded.
+	frg::optional<uint64_t> _nextCascade();
+	// Returns the time at which the timer interrupt needs to fire for the given timer.
+	uint64_t _fireTime(PrecisionTimerNode *timer);
+
 	void _progress();
 
 	CpuData *_ourCpu;
 
 	Mutex _mutex;
 
+	// Ordered by deadline; determines which timers are elapsed.
 	frg::pairing_heap<
 		PrecisionTimerNode,
 		frg::locate_member<
@@ -180,7 +238,43 @@ private:
 		CompareTimer
 	> _timerQueue;
 
-	size_t _activeTimers;
+	// Contains the same timers as _timerQueue but ordered by deadline + slack;
+	// determines when the timer interrupt needs to fire.
+	frg::pairing_heap<
+		PrecisionTimerNode,
+		frg::locate_member<
+			PrecisionTimerNode,
+			frg::pairing_heap_hook<PrecisionTimerNode>,
+			&PrecisionTimerNode::latestHook
+		>,
+		CompareTimerLatest
+	> _latestQueue;
+
+	using WheelList = frg::intrusive_list<
+		PrecisionTimerNode,
+		frg::locate_member<
+			PrecisionTimerNode,
+			frg::default_list_hook<PrecisionTimerNode>,
+			&PrecisionTimerNode::wheelHook
+		>
+	>;
+
+	struct WheelLevel {
+		WheelList slots[wheelSlots];
+		// Bitmask of non-empty slots.
+		uint64_t occupied = 0;
+		// Absolute index (i.e., time >> wheelShift(l)) of the next slot that is cascaded.
+		// All timers on this level are in slots [cursor, cursor + wheelSlots).
+		uint64_t cursor = 0;
+	};
+
+	bool _wheelInitialized = false;
+	WheelLevel _wheel[wheelLevels];
+
+	// Deadline that was last passed to setTimerEngineDeadline().
+	frg::optional<uint64_t> _programmedDeadline;
+
+	size_t _activeTimers = 0;
 };
 
 inline void PrecisionTimerNode::CancelFunctor::operator() () {
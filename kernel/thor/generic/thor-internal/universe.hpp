@@ -1,8 +1,10 @@
 #pragma once
 
 #include <frg/variant.hpp>
+#include <frg/vector.hpp>
 #include <assert.h>
 #include <smarter.hpp>
+#include <thor-internal/kernel-locks.hpp>
 #include <thor-internal/mm-rc.hpp>
 #include <thor-internal/virtualization.hpp>
 
@@ -14,6 +16,7 @@ struct MemoryView;
 struct AddressSpace;
 struct IoSpace;
 struct Thread;
+struct ScheduleGroup;
 struct Universe;
 struct IpcQueue;
 struct MemorySlice;
@@ -95,6 +98,13 @@ struct ThreadDescriptor {
 	smarter::shared_ptr<Thread, ActiveHandle> thread;
 };
 
+struct ScheduleGroupDescriptor {
+	ScheduleGroupDescriptor(smarter::shared_ptr<ScheduleGroup> group)
+	: group(std::move(group)) { }
+
+	smarter::shared_ptr<ScheduleGroup> group;
+};
+
 // --------------------------------------------------------
 // IPC related descriptors
 // --------------------------------------------------------
@@ -243,6 +253,7 @@ typedef frg::variant<
 	VirtualizedCpuDescriptor,
 	MemoryViewLockDescriptor,
 	ThreadDescriptor,
+	ScheduleGroupDescriptor,
 	LaneDescriptor,
 	IrqDescriptor,
 	OneshotEventDescriptor,
@@ -259,8 +270,8 @@ typedef frg::variant<
 
 struct Universe {
 public:
-	typedef frg::ticket_spinlock Lock;
-	typedef frg::unique_lock<frg::ticket_spinlock> Guard;
+	typedef TicketSpinlock Lock;
+	typedef frg::unique_lock<TicketSpinlock> Guard;
 
 	Universe();
 	~Universe();
@@ -274,12 +285,20 @@ public:
 	Lock lock;
 
 private:
-	frg::hash_map<
-		Handle,
-		AnyDescriptor,
-		frg::hash<Handle>,
-		KernelAlloc
-	> _descriptorMap;
+	// Descriptors are stored in a two-level table that is indexed by handle.
+	// Since handles are allocated sequentially, the table is dense; leaves are freed
+	// once all of their handles have been allocated and closed again.
+	static constexpr int leafShift = 6;
+	static constexpr size_t leafSize = size_t{1} << leafShift;
+
+	struct Leaf {
+		frg::optional<AnyDescriptor> slots[leafSize];
+		size_t numLive = 0;
+	};
+
+	frg::optional<AnyDescriptor> *_slotOf(Handle handle);
+
+	frg::vector<Leaf *, KernelAlloc> _directory;
 
 	Handle _nextHandle;
 };
@@ -4,6 +4,8 @@
 
 #include <thor-internal/address-space.hpp>
 #include <thor-internal/error.hpp>
+#include <thor-internal/event.hpp>
+#include <thor-internal/kernel_heap.hpp>
 
 namespace thor {
 	struct GuestState {
@@ -33,10 +35,37 @@ namespace thor {
 		~VirtualizedCpu() = default;
 	};
 
+	// Raises an event when the guest writes to an I/O port (see ::helAddVmIoTrigger).
+	struct VmIoTrigger {
+		uint16_t port;
+		// Access size in bytes. Zero matches all sizes.
+		uint8_t size;
+		bool matchValue;
+		uint32_t value;
+		smarter::shared_ptr<BitsetEvent> event;
+		uint32_t bits;
+	};
+
 	struct VirtualizedPageSpace : VirtualSpace {
+		// Limits the number of triggers since each PIO exit scans all of them.
+		static constexpr size_t maxIoTriggers = 64;
+
 		VirtualizedPageSpace(VirtualOperations *ops) : VirtualSpace{ops} {}
 
+		Error addIoTrigger(VmIoTrigger trigger);
+		Error removeIoTrigger(uint16_t port, uint8_t size, bool matchValue, uint32_t value);
+
+		// Called by the VM exit handlers on port writes.
+		// If this returns true, the write was consumed and the guest can be resumed
+		// without returning to user space.
+		bool handleIoWrite(uint16_t port, uint8_t size, uint32_t value);
+
 	protected:
 		~VirtualizedPageSpace() = default;
+
+	private:
+		IrqSpinlock _ioTriggerMutex;
+		VmIoTrigger _ioTriggers[maxIoTriggers];
+		size_t _numIoTriggers = 0;
 	};
 }
@@ -9,26 +9,70 @@
 #include <smarter.hpp>
 
 #include <thor-internal/executor-context.hpp>
+#include <thor-internal/kernel-locks.hpp>
 
 namespace thor {
 
 struct WorkQueue;
 
+enum class WorkPriority {
+	// Default class, e.g., for completions that user space or IRQs wait for.
+	normal,
+	// Bulk work such as reclamation; see WorkQueue::maxBackgroundPerRun.
+	background
+};
+
+inline constexpr int numWorkPriorities = 2;
+
 struct Worklet {
 	friend struct WorkQueue;
 
-	void setup(void (*run)(Worklet *), WorkQueue *wq);
+	void setup(void (*run)(Worklet *), WorkQueue *wq,
+			WorkPriority priority = WorkPriority::normal);
 
 private:
 	smarter::shared_ptr<WorkQueue> _workQueue;
 	void (*_run)(Worklet *);
+	WorkPriority _priority;
+	// Time of post(); used for WorkQueueStatistics::totalLatency.
+	uint64_t _postedAt;
 	frg::default_list_hook<Worklet> _hook;
 };
 
+// Statistics of one priority class of a WorkQueue.
+// Modified within post() and run() but may be read concurrently.
+struct WorkQueueStatistics {
+	// Number of worklets that are currently queued and the maximum of that number.
+	std::atomic<size_t> depth{0};
+	std::atomic<size_t> maxDepth{0};
+	// Number of worklets that were run.
+	std::atomic<uint64_t> executed{0};
+	// Sum and maximum of the time (in ns) between post() and the start of the worklet.
+	std::atomic<uint64_t> totalLatency{0};
+	std::atomic<uint64_t> maxLatency{0};
+};
+
 struct WorkQueue {
+	using WorkletList = frg::intrusive_list<
+		Worklet,
+		frg::locate_member<
+			Worklet,
+			frg::default_list_hook<Worklet>,
+			&Worklet::_hook
+		>
+	>;
+
+	// Limits the number of background worklets per run(). Remaining background worklets
+	// stay queued (i.e., check() returns true) such that normal worklets that are posted
+	// while run() drains bulk work do not wait for all of it.
+	static constexpr size_t maxBackgroundPerRun = 16;
+
 	static WorkQueue *generalQueue();
 
 	static void post(Worklet *worklet);
+	// Posts all worklets of the list at once, with a single wakeup().
+	// All worklets must be set up for the same WorkQueue and with the same priority.
+	static void post(WorkletList &list);
 	static bool enter(Worklet *worklet);
 
 	WorkQueue(ExecutorContext *executorContext = illegalExecutorContext())
@@ -36,8 +80,14 @@ struct WorkQueue {
 
 	bool check();
 
+	// Runs all normal worklets and up to maxBackgroundPerRun background worklets.
+	// Callers that need the WQ to be drained completely must loop while check() is true.
 	void run();
 
+	const WorkQueueStatistics &statistics(WorkPriority priority) {
+		return _stats[static_cast<int>(priority)];
+	}
+
 	auto take() {
 		return selfPtr.lock();
 	}
@@ -140,22 +190,18 @@ protected:
 	~WorkQueue() = default;
 
 private:
+	// Enqueues a list of count worklets of the given priority.
+	static void post_(WorkQueue *wq, WorkletList &list, size_t count, WorkPriority priority);
+
 	ExecutorContext *_executorContext;
 
-	frg::intrusive_list<
-		Worklet,
-		frg::locate_member<
-			Worklet,
-			frg::default_list_hook<Worklet>,
-			&Worklet::_hook
-		>
-	> _localQueue;
+	WorkletList _localQueue[numWorkPriorities];
 
 	std::atomic<bool> _localPosted;
 
 	std::atomic<bool> _inRun{false};
 
-	frg::ticket_spinlock _mutex;
+	TicketSpinlock _mutex;
 
 	// Writes to this flag are totally ordered since they only happen within _mutex.
 	// Each 0-1 transition of this flag causes wakeup() to be called.
@@ -164,20 +210,16 @@ private:
 	// (In the case of threads, this is guaranteed by the blocking mechanics.)
 	std::atomic<bool> _lockedPosted;
 
-	frg::intrusive_list<
-		Worklet,
-		frg::locate_member<
-			Worklet,
-			frg::default_list_hook<Worklet>,
-			&Worklet::_hook
-		>
-	> _lockedQueue;
+	WorkletList _lockedQueue[numWorkPriorities];
+
+	WorkQueueStatistics _stats[numWorkPriorities];
 };
 
-inline void Worklet::setup(void (*run)(Worklet *), WorkQueue *wq) {
+inline void Worklet::setup(void (*run)(Worklet *), WorkQueue *wq, WorkPriority priority) {
 	auto swq = wq->selfPtr.lock();
 	assert(swq);
 	_run = run;
+	_priority = priority;
 	_workQueue = std::move(swq);
 }
 
@@ -190,8 +232,8 @@ requires requires(P policy) {
 	{ policy.execute() };
 }
 struct DeferredWork {
-	DeferredWork(P policy = P{})
-	: policy_{std::move(policy)} { }
+	DeferredWork(P policy = P{}, WorkPriority priority = WorkPriority::normal)
+	: policy_{std::move(policy)}, priority_{priority} { }
 
 	bool invoke() {
 		// We need to guarantee that the Worklet is available again;
@@ -207,13 +249,14 @@ struct DeferredWork {
 			assert(self->posted_.load(std::memory_order_relaxed));
 			self->posted_.store(false, std::memory_order_release);
 			self->policy_.execute();
-		}, WorkQueue::generalQueue());
+		}, WorkQueue::generalQueue(), priority_);
 		WorkQueue::post(&worklet_);
 		return true;
 	}
 
 private:
 	P policy_;
+	WorkPriority priority_;
 	Worklet worklet_;
 	std::atomic<bool> posted_;
 };
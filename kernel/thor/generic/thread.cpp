@@ -5,6 +5,7 @@
 
 #include <thor-internal/credentials.hpp>
 #include <thor-internal/cpu-data.hpp>
+#include <thor-internal/epoch.hpp>
 #include <thor-internal/load-balancing.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/thread.hpp>
@@ -559,6 +560,9 @@ void Thread::doHandlePreemption(bool inManipulableDomain, ImageAccessor image) {
 
 	auto *scheduler = &localScheduler.get();
 
+	// Preemption points are quiescent states for epoch-based reclamation.
+	// This must happen before update() such that wakeups of the reclaim worklet are seen.
+	passEpochQuiescentState();
 	scheduler->update();
 	if(scheduler->maybeReschedule()) {
 		auto lock = frg::guard(&_mutex);
@@ -600,6 +604,19 @@ void Thread::_updateRunTime() {
 	_lastRunTimeUpdate = now;
 }
 
+void Thread::enterKernelTime() {
+	auto irqLock = frg::guard(&irqMutex());
+	_kernelEntryRunTime = Scheduler::liveRunTime(this);
+}
+
+void Thread::leaveKernelTime() {
+	auto irqLock = frg::guard(&irqMutex());
+	auto runTime = Scheduler::liveRunTime(this);
+	if(runTime > _kernelEntryRunTime)
+		_kernelTime.fetch_add(runTime - _kernelEntryRunTime, std::memory_order_relaxed);
+	_kernelEntryRunTime = runTime;
+}
+
 void Thread::_uninvoke() {
 	UserContext::deactivate();
 }
@@ -109,8 +109,8 @@ void PrecisionTimerEngine::installTimer(PrecisionTimerNode *timer) {
 	auto lock = frg::guard(&_mutex);
 	assert(timer->_state == TimerState::none);
 
+	auto current = getClockNanos();
 	if(logTimers) {
-		auto current = getClockNanos();
 		infoLogger() << "thor: Setting timer at " << timer->_deadline
 				<< " (counter is " << current << ")" << frg::endlog;
 	}
@@ -124,10 +124,13 @@ void PrecisionTimerEngine::installTimer(PrecisionTimerNode *timer) {
 		return;
 	}
 
-	_timerQueue.push(timer);
+	_insert(timer, current);
 	_activeTimers++;
 	timer->_state = TimerState::queued;
 
+	// There is no need to reprogram the timer if it fires early enough already.
+	if(_programmedDeadline && *_programmedDeadline <= _fireTime(timer))
+		return;
 	_progress();
 }
 
@@ -136,7 +139,7 @@ void PrecisionTimerEngine::cancelTimer(PrecisionTimerNode *timer) {
 	auto lock = frg::guard(&_mutex);
 
 	if(timer->_state == TimerState::queued) {
-		_timerQueue.remove(timer);
+		_remove(timer);
 		_activeTimers--;
 		timer->_wasCancelled = true;
 	}else{
@@ -156,6 +159,124 @@ void PrecisionTimerEngine::firedAlarm() {
 	_progress();
 }
 
+void PrecisionTimerEngine::_insert(PrecisionTimerNode *timer, uint64_t current) {
+	if(!_wheelInitialized) {
+		for(int l = 0; l < wheelLevels; l++)
+			_wheel[l].cursor = ((current + nearHorizon) >> wheelShift(l)) + 1;
+		_wheelInitialized = true;
+	}
+
+	if(timer->_deadline >= current + nearHorizon) {
+		for(int l = 0; l < wheelLevels; l++) {
+			auto &level = _wheel[l];
+			auto index = timer->_deadline >> wheelShift(l);
+			// The slot was already cascaded; this can happen close to slot boundaries.
+			if(index < level.cursor)
+				break;
+			if(index - level.cursor >= wheelSlots) {
+				if(l + 1 < wheelLevels)
+					continue;
+				// Put timers that are too far in the future into the last slot.
+				// They are re-inserted when that slot is cascaded.
+				index = level.cursor + wheelSlots - 1;
+			}
+
+			auto slot = index & (wheelSlots - 1);
+			level.slots[slot].push_back(timer);
+			level.occupied |= uint64_t{1} << slot;
+			timer->_wheelLevel = l;
+			timer->_wheelIndex = index;
+			return;
+		}
+	}
+
+	timer->_wheelLevel = -1;
+	_timerQueue.push(timer);
+	_latestQueue.push(timer);
+}
+
+void PrecisionTimerEngine::_remove(PrecisionTimerNode *timer) {
+	if(timer->_wheelLevel < 0) {
+		_timerQueue.remove(timer);
+		_latestQueue.remove(timer);
+		return;
+	}
+
+	auto &level = _wheel[timer->_wheelLevel];
+	auto slot = timer->_wheelIndex & (wheelSlots - 1);
+	level.slots[slot].erase(level.slots[slot].iterator_to(timer));
+	if(level.slots[slot].empty())
+		level.occupied &= ~(uint64_t{1} << slot);
+	timer->_wheelLevel = -1;
+}
+
+void PrecisionTimerEngine::_cascade(uint64_t current) {
+	if(!_wheelInitialized)
+		return;
+
+	// Note that lower levels must be processed first: this guarantees that
+	// timers from higher levels are never re-inserted into slots that are due.
+	auto limit = current + nearHorizon;
+	for(int l = 0; l < wheelLevels; l++) {
+		auto &level = _wheel[l];
+		auto target = limit >> wheelShift(l);
+		if(level.cursor > target)
+			continue;
+
+		// If more than wheelSlots slots are due, each slot is only processed once.
+		auto first = level.cursor;
+		auto numDue = frg::min(target - first + 1, uint64_t{wheelSlots});
+
+		// Advance the cursor before re-inserting, such that
+		// re-inserted timers end up in slots at or after the new cursor.
+		level.cursor = target + 1;
+
+		for(uint64_t i = 0; i < numDue; i++) {
+			auto slot = (first + i) & (wheelSlots - 1);
+			if(!(level.occupied & (uint64_t{1} << slot)))
+				continue;
+
+			WheelList due;
+			while(!level.slots[slot].empty())
+				due.push_back(level.slots[slot].pop_front());
+			level.occupied &= ~(uint64_t{1} << slot);
+
+			while(!due.empty())
+				_insert(due.pop_front(), current);
+		}
+	}
+}
+
+frg::optional<uint64_t> PrecisionTimerEngine::_nextCascade() {
+	frg::optional<uint64_t> result;
+	for(int l = 0; l < wheelLevels; l++) {
+		auto &level = _wheel[l];
+		if(!level.occupied)
+			continue;
+
+		// Find the first occupied slot at or after the cursor.
+		auto start = level.cursor & (wheelSlots - 1);
+		auto rotated = level.occupied;
+		if(start)
+			rotated = (level.occupied >> start) | (level.occupied << (wheelSlots - start));
+		auto index = level.cursor + __builtin_ctzll(rotated);
+
+		// The slot is cascaded once it is within nearHorizon of the current time.
+		uint64_t time = index << wheelShift(l);
+		time = (time > nearHorizon) ? time - nearHorizon : 0;
+		if(!result || time < *result)
+			result = time;
+	}
+	return result;
+}
+
+uint64_t PrecisionTimerEngine::_fireTime(PrecisionTimerNode *timer) {
+	if(timer->_wheelLevel < 0)
+		return timer->_latest();
+	uint64_t time = timer->_wheelIndex << wheelShift(timer->_wheelLevel);
+	return (time > nearHorizon) ? time - nearHorizon : 0;
+}
+
 // This function unconditionally calls into setTimerEngineDeadline().
 // This is necessary since we assume that timer IRQs are one shot
 // and not necessarily perfectly accurate.
@@ -163,22 +284,20 @@ void PrecisionTimerEngine::_progress() {
 	assert(getCpuData() == _ourCpu);
 
 	auto current = getClockNanos();
-	do {
+	while(true) {
+		_cascade(current);
+
 		// Process all timers that elapsed in the past.
 		if(logProgress)
 			infoLogger() << "thor: Processing timers until " << current << frg::endlog;
-		while(true) {
-			if(_timerQueue.empty()) {
-				setTimerEngineDeadline(frg::null_opt);
-				return;
-			}
-
+		while(!_timerQueue.empty()) {
 			if(_timerQueue.top()->_deadline > current)
 				break;
 
 			auto timer = _timerQueue.top();
 			assert(timer->_state == TimerState::queued);
 			_timerQueue.pop();
+			_latestQueue.remove(timer);
 			_activeTimers--;
 			if(logProgress)
 				infoLogger() << "thor: Timer completed" << frg::endlog;
@@ -191,14 +310,25 @@ void PrecisionTimerEngine::_progress() {
 			}
 		}
 
-		// Setup the interrupt.
-		assert(!_timerQueue.empty());
-		setTimerEngineDeadline(_timerQueue.top()->_deadline);
+		// Setup the interrupt. Timers may elapse as late as deadline + slack;
+		// all timers whose deadline has passed by then are processed together.
+		auto deadline = _nextCascade();
+		if(!_timerQueue.empty()) {
+			auto latest = _latestQueue.top()->_latest();
+			if(!deadline || latest < *deadline)
+				deadline = latest;
+		}
+		_programmedDeadline = deadline;
+		setTimerEngineDeadline(deadline);
+		if(!deadline)
+			return;
 
 		// We iterate if there was a race.
 		// Technically, this is optional but it may help to avoid unnecessary IRQs.
 		current = getClockNanos();
-	} while(_timerQueue.top()->_deadline <= current);
+		if(*deadline > current)
+			return;
+	}
 }
 
 PrecisionTimerEngine *generalTimerEngine() {
@@ -7,31 +7,76 @@ namespace {
 }
 
 Universe::Universe()
-: _descriptorMap{frg::hash<Handle>{}, *kernelAlloc}, _nextHandle{1} { }
+: _directory{*kernelAlloc}, _nextHandle{1} { }
 
 Universe::~Universe() {
 	if(logCleanup)
 		debugLogger() << "thor: Universe is deallocated" << frg::endlog;
+
+	for(auto leaf : _directory) {
+		if(leaf)
+			frg::destruct(*kernelAlloc, leaf);
+	}
+}
+
+frg::optional<AnyDescriptor> *Universe::_slotOf(Handle handle) {
+	if(handle <= 0 || handle >= _nextHandle)
+		return nullptr;
+
+	auto l = static_cast<size_t>(handle) >> leafShift;
+	if(l >= _directory.size() || !_directory[l])
+		return nullptr;
+	return &_directory[l]->slots[handle & (leafSize - 1)];
 }
 
 Handle Universe::attachDescriptor(Guard &guard, AnyDescriptor descriptor) {
 	assert(guard.protects(&lock));
 
 	Handle handle = _nextHandle++;
-	_descriptorMap.insert(handle, std::move(descriptor));
+	auto l = static_cast<size_t>(handle) >> leafShift;
+	while(_directory.size() <= l)
+		_directory.push_back(nullptr);
+	if(!_directory[l])
+		_directory[l] = frg::construct<Leaf>(*kernelAlloc);
+
+	auto leaf = _directory[l];
+	auto &slot = leaf->slots[handle & (leafSize - 1)];
+	assert(!slot);
+	slot.emplace(std::move(descriptor));
+	leaf->numLive++;
 	return handle;
 }
 
 AnyDescriptor *Universe::getDescriptor(Guard &guard, Handle handle) {
 	assert(guard.protects(&lock));
 
-	return _descriptorMap.get(handle);
+	auto slot = _slotOf(handle);
+	if(!slot || !*slot)
+		return nullptr;
+	return &slot->value();
 }
 
 frg::optional<AnyDescriptor> Universe::detachDescriptor(Guard &guard, Handle handle) {
 	assert(guard.protects(&lock));
 
-	return _descriptorMap.remove(handle);
+	auto slot = _slotOf(handle);
+	if(!slot || !*slot)
+		return frg::null_opt;
+
+	frg::optional<AnyDescriptor> descriptor{std::move(slot->value())};
+	*slot = frg::null_opt;
+
+	// Free the leaf if it is empty and no further handles will be allocated from it.
+	auto l = static_cast<size_t>(handle) >> leafShift;
+	auto leaf = _directory[l];
+	assert(leaf->numLive);
+	leaf->numLive--;
+	if(!leaf->numLive && l < (static_cast<size_t>(_nextHandle) >> leafShift)) {
+		frg::destruct(*kernelAlloc, leaf);
+		_directory[l] = nullptr;
+	}
+
+	return descriptor;
 }
 
 } // namespace thor
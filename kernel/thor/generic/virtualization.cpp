@@ -0,0 +1,78 @@
+#include <thor-internal/virtualization.hpp>
+
+namespace thor {
+
+namespace {
+	bool sameMatch(const VmIoTrigger &trigger, uint16_t port, uint8_t size,
+			bool matchValue, uint32_t value) {
+		return trigger.port == port && trigger.size == size
+				&& trigger.matchValue == matchValue
+				&& (!matchValue || trigger.value == value);
+	}
+}
+
+Error VirtualizedPageSpace::addIoTrigger(VmIoTrigger trigger) {
+	auto lock = frg::guard(&_ioTriggerMutex);
+
+	for(size_t i = 0; i < _numIoTriggers; i++) {
+		auto &existing = _ioTriggers[i];
+		if(sameMatch(existing, trigger.port, trigger.size, trigger.matchValue, trigger.value))
+			return Error::alreadyExists;
+	}
+	if(_numIoTriggers == maxIoTriggers)
+		return Error::outOfBounds;
+
+	_ioTriggers[_numIoTriggers++] = std::move(trigger);
+	return Error::success;
+}
+
+Error VirtualizedPageSpace::removeIoTrigger(uint16_t port, uint8_t size,
+		bool matchValue, uint32_t value) {
+	smarter::shared_ptr<BitsetEvent> event;
+	{
+		auto lock = frg::guard(&_ioTriggerMutex);
+
+		for(size_t i = 0; i < _numIoTriggers; i++) {
+			if(!sameMatch(_ioTriggers[i], port, size, matchValue, value))
+				continue;
+			// Drop the reference outside of the lock.
+			event = std::move(_ioTriggers[i].event);
+			_numIoTriggers--;
+			if(i != _numIoTriggers)
+				_ioTriggers[i] = std::move(_ioTriggers[_numIoTriggers]);
+			return Error::success;
+		}
+	}
+
+	return Error::illegalArgs;
+}
+
+bool VirtualizedPageSpace::handleIoWrite(uint16_t port, uint8_t size, uint32_t value) {
+	// Pointer to the event that is raised (if any). The trigger may be removed
+	// concurrently, hence we need to take a reference.
+	smarter::shared_ptr<BitsetEvent> event;
+	uint32_t bits = 0;
+	{
+		auto lock = frg::guard(&_ioTriggerMutex);
+
+		for(size_t i = 0; i < _numIoTriggers; i++) {
+			auto &trigger = _ioTriggers[i];
+			if(trigger.port != port)
+				continue;
+			if(trigger.size && trigger.size != size)
+				continue;
+			if(trigger.matchValue && trigger.value != value)
+				continue;
+			event = trigger.event;
+			bits = trigger.bits;
+			break;
+		}
+	}
+
+	if(!event)
+		return false;
+	event->trigger(bits);
+	return true;
+}
+
+} // namespace thor
@@ -1,5 +1,6 @@
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/work-queue.hpp>
+#include <thor-internal/arch-generic/timer.hpp>
 
 namespace thor {
 
@@ -9,22 +10,35 @@ WorkQueue *WorkQueue::generalQueue() {
 	return cpuData->generalWorkQueue.get();
 }
 
-void WorkQueue::post(Worklet *worklet) {
-	auto wq = worklet->_workQueue;
+namespace {
+
+void bumpMaximum(std::atomic<size_t> &maximum, size_t value) {
+	if(value > maximum.load(std::memory_order_relaxed))
+		maximum.store(value, std::memory_order_relaxed);
+}
+
+} // anonymous namespace
+
+void WorkQueue::post_(WorkQueue *wq, WorkletList &list, size_t count, WorkPriority priority) {
+	auto &stats = wq->_stats[static_cast<int>(priority)];
+	auto depth = stats.depth.fetch_add(count, std::memory_order_relaxed) + count;
+	bumpMaximum(stats.maxDepth, depth);
 
 	bool invokeWakeup;
 	if(wq->_executorContext == currentExecutorContext()) {
 		auto irqLock = frg::guard(&irqMutex());
 
-		invokeWakeup = wq->_localQueue.empty();
-		wq->_localQueue.push_back(worklet);
+		invokeWakeup = !wq->_localPosted.load(std::memory_order_relaxed);
+		auto &queue = wq->_localQueue[static_cast<int>(priority)];
+		queue.splice(queue.end(), list);
 		wq->_localPosted.store(true, std::memory_order_relaxed);
 	}else{
 		auto irqLock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&wq->_mutex);
 
-		invokeWakeup = wq->_lockedQueue.empty();
-		wq->_lockedQueue.push_back(worklet);
+		invokeWakeup = !wq->_lockedPosted.load(std::memory_order_relaxed);
+		auto &queue = wq->_lockedQueue[static_cast<int>(priority)];
+		queue.splice(queue.end(), list);
 		wq->_lockedPosted.store(true, std::memory_order_relaxed);
 	}
 
@@ -32,35 +46,48 @@ void WorkQueue::post(Worklet *worklet) {
 		wq->wakeup();
 }
 
-bool WorkQueue::enter(Worklet *worklet) {
+void WorkQueue::post(Worklet *worklet) {
+	// Keep a reference since the worklet might run (and be reused) as soon as it is queued.
 	auto wq = worklet->_workQueue;
 
-	bool invokeWakeup;
-	if(wq->_executorContext == currentExecutorContext()) {
-		// Fast-track if we are on the right executor and the WQ is being drained.
-		if(wq->_inRun.load(std::memory_order_relaxed)) {
-			std::atomic_signal_fence(std::memory_order_acquire);
-			return true;
-		}
+	worklet->_postedAt = haveTimer() ? getClockNanos() : 0;
+	WorkletList list;
+	list.push_back(worklet);
+	post_(wq.get(), list, 1, worklet->_priority);
+}
 
-		// Same logic as in post().
-		auto irqLock = frg::guard(&irqMutex());
+void WorkQueue::post(WorkletList &list) {
+	if(list.empty())
+		return;
+	auto wq = list.front()->_workQueue;
+	auto priority = list.front()->_priority;
+
+	auto now = haveTimer() ? getClockNanos() : 0;
+	size_t count = 0;
+	for(auto it = list.begin(); it != list.end(); ++it) {
+		auto worklet = *it;
+		assert(worklet->_workQueue == wq);
+		assert(worklet->_priority == priority);
+		worklet->_postedAt = now;
+		count++;
+	}
+	post_(wq.get(), list, count, priority);
+}
 
-		invokeWakeup = wq->_localQueue.empty();
-		wq->_localQueue.push_back(worklet);
-		wq->_localPosted.store(true, std::memory_order_relaxed);
-	}else{
-		// Same logic as in post().
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&wq->_mutex);
+bool WorkQueue::enter(Worklet *worklet) {
+	auto wq = worklet->_workQueue;
 
-		invokeWakeup = wq->_lockedQueue.empty();
-		wq->_lockedQueue.push_back(worklet);
-		wq->_lockedPosted.store(true, std::memory_order_relaxed);
+	// Fast-track if we are on the right executor and the WQ is being drained.
+	if(wq->_executorContext == currentExecutorContext()
+			&& wq->_inRun.load(std::memory_order_relaxed)) {
+		std::atomic_signal_fence(std::memory_order_acquire);
+		return true;
 	}
 
-	if(invokeWakeup)
-		wq->wakeup();
+	worklet->_postedAt = haveTimer() ? getClockNanos() : 0;
+	WorkletList list;
+	list.push_back(worklet);
+	post_(wq.get(), list, 1, worklet->_priority);
 	return false;
 }
 
@@ -78,34 +105,59 @@ void WorkQueue::run() {
 	std::atomic_signal_fence(std::memory_order_release);
 	_inRun.store(true, std::memory_order_relaxed);
 
-	frg::intrusive_list<
-		Worklet,
-		frg::locate_member<
-			Worklet,
-			frg::default_list_hook<Worklet>,
-			&Worklet::_hook
-		>
-	> pending;
+	WorkletList pending[numWorkPriorities];
 	{
 		auto irqLock = frg::guard(&irqMutex());
 
-		pending.splice(pending.end(), _localQueue);
+		for(int i = 0; i < numWorkPriorities; i++)
+			pending[i].splice(pending[i].end(), _localQueue[i]);
 		_localPosted.store(false, std::memory_order_relaxed);
 
 		if(_lockedPosted.load(std::memory_order_relaxed)) {
 			auto lock = frg::guard(&_mutex);
 
-			pending.splice(pending.end(), _lockedQueue);
+			for(int i = 0; i < numWorkPriorities; i++)
+				pending[i].splice(pending[i].end(), _lockedQueue[i]);
 			_lockedPosted.store(false, std::memory_order_relaxed);
 		}
 	}
 
 	// Keep this shared pointer to avoid destructing *this here.
 	smarter::shared_ptr<WorkQueue> self;
-	while(!pending.empty()) {
-		auto worklet = pending.pop_front();
+	auto runWorklet = [&] (Worklet *worklet) {
+		auto &stats = _stats[static_cast<int>(worklet->_priority)];
+		stats.depth.fetch_sub(1, std::memory_order_relaxed);
+		stats.executed.store(stats.executed.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+		if(worklet->_postedAt) {
+			auto latency = getClockNanos() - worklet->_postedAt;
+			stats.totalLatency.store(stats.totalLatency.load(std::memory_order_relaxed) + latency,
+					std::memory_order_relaxed);
+			if(latency > stats.maxLatency.load(std::memory_order_relaxed))
+				stats.maxLatency.store(latency, std::memory_order_relaxed);
+		}
+
 		self = std::move(worklet->_workQueue);
 		worklet->_run(worklet);
+	};
+
+	auto &normal = pending[static_cast<int>(WorkPriority::normal)];
+	while(!normal.empty())
+		runWorklet(normal.pop_front());
+
+	// Stop draining background work early if new work was posted in the meantime.
+	auto &background = pending[static_cast<int>(WorkPriority::background)];
+	for(size_t n = 0; !background.empty() && n < maxBackgroundPerRun && !check(); n++)
+		runWorklet(background.pop_front());
+
+	if(!background.empty()) {
+		auto irqLock = frg::guard(&irqMutex());
+
+		// Put the remaining worklets in front of those that were posted in the meantime.
+		auto &queue = _localQueue[static_cast<int>(WorkPriority::background)];
+		background.splice(background.end(), queue);
+		queue.splice(queue.end(), background);
+		_localPosted.store(true, std::memory_order_relaxed);
 	}
 
 	std::atomic_signal_fence(std::memory_order_release);
@@ -4,6 +4,7 @@
 #include <frg/vector.hpp>
 #include <eir/interface.hpp>
 #include <thor-internal/arch-generic/cpu.hpp>
+#include <thor-internal/arch-generic/timer.hpp>
 #include <thor-internal/arch/pic.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/kernel_heap.hpp>
@@ -146,6 +147,7 @@ void bootOtherProcessors() {
 
 	infoLogger() << "thor: Booting APs." << frg::endlog;
 
+	frg::vector<unsigned int, KernelAlloc> apicIds{*kernelAlloc};
 	size_t offset = sizeof(acpi_sdt_hdr) + sizeof(MadtHeader);
 	while(offset < madt->length) {
 		auto generic = (MadtGenericEntry *)(madtTbl.virt_addr + offset);
@@ -154,16 +156,18 @@ void bootOtherProcessors() {
 			// TODO: Support BSPs with APIC ID != 0.
 			if((entry->flags & local_flags::enabled)
 					&& entry->localApicId) // We ignore the BSP here.
-				bootSecondary(entry->localApicId);
+				apicIds.push_back(entry->localApicId);
 		}else if(generic->type == 9) { // local x2APIC
 			auto entry = (MadtLocalX2Entry *)generic;
 			// TODO: Support BSPs with APIC ID != 0.
 			if((entry->flags & local_flags::enabled)
 					&& entry->localX2ApicId) // We ignore the BSP here.
-				bootSecondary(entry->localX2ApicId);
+				apicIds.push_back(entry->localX2ApicId);
 		}
 		offset += generic->length;
 	}
+
+	bootSecondaries({apicIds.data(), apicIds.size()});
 }
 
 // --------------------------------------------------------
@@ -250,6 +254,19 @@ void dumpMadt() {
 	}
 }
 
+// Runs a phase of ACPI initialization and reports its duration.
+// Large DSDTs/SSDTs can make individual phases take a noticeable amount of boot time.
+template<typename F>
+void timeAcpiPhase(const char *name, F fn) {
+	// Table discovery happens before timers are available.
+	bool timed = haveTimer();
+	uint64_t start = timed ? getClockNanos() : 0;
+	fn();
+	if(timed)
+		infoLogger() << "thor: ACPI phase " << name << " took "
+				<< (getClockNanos() - start) / 1000 << " us" << frg::endlog;
+}
+
 initgraph::Stage *getTablesDiscoveredStage() {
 	static initgraph::Stage s{&globalInitEngine, "acpi.tables-discovered"};
 	return &s;
@@ -263,8 +280,10 @@ initgraph::Stage *getNsAvailableStage() {
 static initgraph::Task initTablesTask{&globalInitEngine, "acpi.initialize",
 	initgraph::Entails{getTablesDiscoveredStage()},
 	[] {
-		auto ret = uacpi_initialize(0);
-		assert(ret == UACPI_STATUS_OK);
+		timeAcpiPhase("initialize", [] {
+			auto ret = uacpi_initialize(0);
+			assert(ret == UACPI_STATUS_OK);
+		});
 	}
 };
 
@@ -358,16 +377,23 @@ static initgraph::Task loadAcpiNamespaceTask{&globalInitEngine, "acpi.load-names
 	[] {
 		initGlue();
 
-		auto ret = uacpi_namespace_load();
-		assert(ret == UACPI_STATUS_OK);
+		timeAcpiPhase("namespace-load", [] {
+			auto ret = uacpi_namespace_load();
+			assert(ret == UACPI_STATUS_OK);
+		});
 
-		ret = uacpi_set_interrupt_model(UACPI_INTERRUPT_MODEL_IOAPIC);
+		auto ret = uacpi_set_interrupt_model(UACPI_INTERRUPT_MODEL_IOAPIC);
 		assert(ret == UACPI_STATUS_OK);
 
-		initEc();
+		timeAcpiPhase("ec-init", [] {
+			initEc();
+		});
 
-		ret = uacpi_namespace_initialize();
-		assert(ret == UACPI_STATUS_OK);
+		// Evaluates _STA and _INI of all devices.
+		timeAcpiPhase("namespace-initialize", [] {
+			auto ret = uacpi_namespace_initialize();
+			assert(ret == UACPI_STATUS_OK);
+		});
 
 		// Configure the ISA IRQs.
 		// TODO: This is a hack. We assume that HPET will use legacy replacement.
@@ -378,12 +404,16 @@ static initgraph::Task loadAcpiNamespaceTask{&globalInitEngine, "acpi.load-names
 		configureIrq(resolveIsaIrq(12));
 		configureIrq(resolveIsaIrq(14));
 
-		initEvents();
+		timeAcpiPhase("events-init", [] {
+			initEvents();
+		});
 	}
 };
 
+// Booting APs only requires the MADT. Do not wait for the namespace, such that
+// work that is distributed to other CPUs does not have to wait for AML execution.
 static initgraph::Task bootApsTask{&globalInitEngine, "acpi.boot-aps",
-	initgraph::Requires{&loadAcpiNamespaceTask},
+	initgraph::Requires{getTaskingAvailableStage()},
 	[] {
 		bootOtherProcessors();
 	}
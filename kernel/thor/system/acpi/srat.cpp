@@ -0,0 +1,169 @@
+#include <thor-internal/cpu-data.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/numa.hpp>
+#include <thor-internal/physical.hpp>
+#include <thor-internal/acpi/acpi.hpp>
+
+#include <uacpi/acpi.h>
+#include <uacpi/tables.h>
+
+namespace thor {
+namespace acpi {
+
+// Note: as for the MADT, we mark all SRAT/SLIT structs as [[gnu::packed]].
+
+struct [[gnu::packed]] SratHeader {
+	uint32_t reserved1;
+	uint64_t reserved2;
+};
+
+struct [[gnu::packed]] SratGenericEntry {
+	uint8_t type;
+	uint8_t length;
+};
+
+struct [[gnu::packed]] SratLocalApicEntry {
+	SratGenericEntry generic;
+	uint8_t proximityDomainLow;
+	uint8_t localApicId;
+	uint32_t flags;
+	uint8_t localSapicEid;
+	uint8_t proximityDomainHigh[3];
+	uint32_t clockDomain;
+};
+
+struct [[gnu::packed]] SratMemoryEntry {
+	SratGenericEntry generic;
+	uint32_t proximityDomain;
+	uint16_t reserved1;
+	uint32_t baseLow;
+	uint32_t baseHigh;
+	uint32_t lengthLow;
+	uint32_t lengthHigh;
+	uint32_t reserved2;
+	uint32_t flags;
+	uint64_t reserved3;
+};
+
+struct [[gnu::packed]] SratLocalX2ApicEntry {
+	SratGenericEntry generic;
+	uint16_t reserved1;
+	uint32_t proximityDomain;
+	uint32_t localX2ApicId;
+	uint32_t flags;
+	uint32_t clockDomain;
+	uint32_t reserved2;
+};
+
+namespace srat_flags {
+	static constexpr uint32_t enabled = 1;
+};
+
+struct [[gnu::packed]] SlitHeader {
+	uint64_t numLocalities;
+};
+
+namespace {
+
+void parseSrat() {
+	uacpi_table sratTbl;
+
+	if(uacpi_table_find_by_signature("SRAT", &sratTbl) != UACPI_STATUS_OK) {
+		infoLogger() << "thor: No SRAT present, assuming a single NUMA node" << frg::endlog;
+		return;
+	}
+	auto *srat = sratTbl.hdr;
+
+	size_t offset = sizeof(acpi_sdt_hdr) + sizeof(SratHeader);
+	while(offset < srat->length) {
+		auto generic = (SratGenericEntry *)(sratTbl.virt_addr + offset);
+		if(!generic->length)
+			break;
+
+		if(generic->type == 0) { // local APIC affinity
+			auto entry = (SratLocalApicEntry *)generic;
+			if(entry->flags & srat_flags::enabled) {
+				uint32_t domain = entry->proximityDomainLow
+						| (uint32_t(entry->proximityDomainHigh[0]) << 8)
+						| (uint32_t(entry->proximityDomainHigh[1]) << 16)
+						| (uint32_t(entry->proximityDomainHigh[2]) << 24);
+				auto node = registerNumaDomain(domain);
+				if(node >= 0)
+					registerCpuNumaNode(entry->localApicId, node);
+			}
+		}else if(generic->type == 1) { // memory affinity
+			auto entry = (SratMemoryEntry *)generic;
+			if(entry->flags & srat_flags::enabled) {
+				auto base = (uint64_t(entry->baseHigh) << 32) | entry->baseLow;
+				auto length = (uint64_t(entry->lengthHigh) << 32) | entry->lengthLow;
+				auto node = registerNumaDomain(entry->proximityDomain);
+				if(node >= 0) {
+					infoLogger() << "thor: Memory at 0x" << frg::hex_fmt(base)
+							<< " - 0x" << frg::hex_fmt(base + length)
+							<< " belongs to NUMA node " << node << frg::endlog;
+					physicalAllocator->setNumaNode(base, length, node);
+				}
+			}
+		}else if(generic->type == 2) { // local x2APIC affinity
+			auto entry = (SratLocalX2ApicEntry *)generic;
+			if(entry->flags & srat_flags::enabled) {
+				auto node = registerNumaDomain(entry->proximityDomain);
+				if(node >= 0)
+					registerCpuNumaNode(entry->localX2ApicId, node);
+			}
+		}
+		offset += generic->length;
+	}
+}
+
+void parseSlit() {
+	uacpi_table slitTbl;
+
+	if(uacpi_table_find_by_signature("SLIT", &slitTbl) != UACPI_STATUS_OK)
+		return;
+	auto *slit = slitTbl.hdr;
+
+	auto header = (SlitHeader *)(slitTbl.virt_addr + sizeof(acpi_sdt_hdr));
+	auto matrix = (uint8_t *)(slitTbl.virt_addr + sizeof(acpi_sdt_hdr) + sizeof(SlitHeader));
+	auto n = header->numLocalities;
+	if(sizeof(acpi_sdt_hdr) + sizeof(SlitHeader) + n * n > slit->length) {
+		infoLogger() << "thor: SLIT is truncated, ignoring it" << frg::endlog;
+		return;
+	}
+
+	// SLIT is indexed by proximity domain.
+	for(uint64_t i = 0; i < n; i++) {
+		auto from = findNumaDomain(i);
+		if(from < 0)
+			continue;
+		for(uint64_t j = 0; j < n; j++) {
+			auto to = findNumaDomain(j);
+			if(to < 0)
+				continue;
+			setNumaDistance(from, to, matrix[i * n + j]);
+		}
+	}
+}
+
+} // anonymous namespace
+
+static initgraph::Task parseSratTask{&globalInitEngine, "acpi.parse-srat",
+	initgraph::Requires{getTablesDiscoveredStage(),
+		// We need to know the APIC ID of the boot CPU.
+		getFibersAvailableStage()},
+	initgraph::Entails{getTaskingAvailableStage()},
+	[] {
+		parseSrat();
+		parseSlit();
+
+#ifdef __x86_64__
+		getCpuData()->numaNode = getCpuNumaNode(getCpuData()->localApicId);
+#endif
+		infoLogger() << "thor: There are " << numNumaNodes() << " NUMA nodes, booting on node "
+				<< getCpuData()->numaNode << frg::endlog;
+	}
+};
+
+} } // namespace thor::acpi
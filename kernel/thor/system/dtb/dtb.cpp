@@ -30,6 +30,18 @@ namespace {
 
 	DeviceTreeNode *treeRoot;
 
+	// Built while the tree is parsed such that lookups do not need to walk the tree.
+	frg::manual_box<frg::vector<DeviceTreeNode *, KernelAlloc>> allNodes;
+
+	frg::manual_box<
+		frg::hash_map<
+			frg::string_view,
+			frg::vector<DeviceTreeNode *, KernelAlloc>,
+			frg::hash<frg::string_view>,
+			KernelAlloc
+		>
+	> compatibleIndex;
+
 	auto parseStringList(const ::DeviceTreeProperty &prop) {
 		frg::vector<frg::string_view, KernelAlloc> list{*kernelAlloc};
 
@@ -58,6 +70,11 @@ void DeviceTreeNode::initializeWith(::DeviceTreeNode dtNode) {
 	if (phandle_)
 		phandles->insert(phandle_, this);
 
+	if (parent_) {
+		index_ = allNodes->size();
+		allNodes->push_back(this);
+	}
+
 	for (auto prop : dtNode.properties()) {
 		frg::string_view pn{prop.name()};
 
@@ -65,6 +82,8 @@ void DeviceTreeNode::initializeWith(::DeviceTreeNode dtNode) {
 			model_ = reinterpret_cast<const char *>(prop.data());
 		} else if (pn == "compatible") {
 			compatible_ = parseStringList(prop);
+			if (parent_)
+				indexCompatible_();
 		} else if (pn == "#address-cells") {
 			addressCells_ = prop.asU32();
 			hasAddressCells_ = true;
@@ -251,6 +270,22 @@ void DeviceTreeNode::finalizeInit() {
 		child->finalizeInit();
 }
 
+void DeviceTreeNode::indexCompatible_() {
+	for (auto c : compatible_) {
+		auto it = compatibleIndex->find(c);
+		if (it == compatibleIndex->end()) {
+			compatibleIndex->insert(c, frg::vector<DeviceTreeNode *, KernelAlloc>{*kernelAlloc});
+			it = compatibleIndex->find(c);
+		}
+
+		// Skip strings that are listed more than once.
+		auto &nodes = it->get<1>();
+		if (nodes.size() && nodes.back() == this)
+			continue;
+		nodes.push_back(this);
+	}
+}
+
 void DeviceTreeNode::generatePath_() {
 	frg::vector<frg::string_view, KernelAlloc> components{*kernelAlloc};
 
@@ -326,6 +361,18 @@ DeviceTreeNode *getDeviceTreeRoot() {
 	return treeRoot;
 }
 
+frg::span<DeviceTreeNode *> getDeviceTreeNodes() {
+	return {allNodes->data(), allNodes->size()};
+}
+
+frg::span<DeviceTreeNode *> getDeviceTreeNodesByCompatible(frg::string_view compatible) {
+	auto it = compatibleIndex->find(compatible);
+	if (it == compatibleIndex->end())
+		return {};
+	auto &nodes = it->get<1>();
+	return {nodes.data(), nodes.size()};
+}
+
 static initgraph::Task initTablesTask{&globalInitEngine, "dtb.parse-dtb",
 	initgraph::Entails{getDeviceTreeParsedStage()},
 	[] {
@@ -348,6 +395,8 @@ static initgraph::Task initTablesTask{&globalInitEngine, "dtb.parse-dtb",
 
 		globalDt.initialize(ptr);
 		phandles.initialize(frg::hash<uint32_t>{}, *kernelAlloc);
+		allNodes.initialize(*kernelAlloc);
+		compatibleIndex.initialize(frg::hash<frg::string_view>{}, *kernelAlloc);
 
 		treeRoot = frg::construct<DeviceTreeNode>(*kernelAlloc, globalDt->rootNode(), nullptr);
 		treeRoot->initializeWith(globalDt->rootNode());
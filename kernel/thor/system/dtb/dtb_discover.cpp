@@ -252,10 +252,9 @@ static initgraph::Task discoverDtNodes{&globalInitEngine, "dt.discover-nodes",
 	[] {
 		allNodes.initialize(*kernelAlloc);
 
-		getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-			allNodes->emplace_back(smarter::allocate_shared<MbusNode>(*kernelAlloc, node));
-			return false;
-		});
+		auto nodes = getDeviceTreeNodes();
+		for (size_t i = 0; i < nodes.size(); i++)
+			allNodes->emplace_back(smarter::allocate_shared<MbusNode>(*kernelAlloc, nodes[i]));
 
 		infoLogger() << "thor: Found " << allNodes->size() << " DT nodes in total." << frg::endlog;
 	}
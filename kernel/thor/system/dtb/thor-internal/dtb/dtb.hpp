@@ -108,6 +108,11 @@ struct DeviceTreeNode {
 		return phandle_;
 	}
 
+	// Position of the node in document order (see getDeviceTreeNodes()).
+	size_t index() const {
+		return index_;
+	}
+
 	uint64_t translateAddress(uint64_t addr) const;
 
 	auto addressCells() const {
@@ -166,6 +171,7 @@ struct DeviceTreeNode {
 
 private:
 	void generatePath_();
+	void indexCompatible_();
 
 	::DeviceTreeNode dtNode_;
 
@@ -182,6 +188,7 @@ private:
 	frg::string<KernelAlloc> path_;
 	frg::string_view model_;
 	uint32_t phandle_;
+	size_t index_{0};
 	frg::vector<frg::string_view, KernelAlloc> compatible_;
 
 	int addressCells_;
@@ -210,6 +217,46 @@ DeviceTreeNode *getDeviceTreeNodeByPath(frg::string_view path);
 DeviceTreeNode *getDeviceTreeNodeByPhandle(uint32_t phandle);
 DeviceTreeNode *getDeviceTreeRoot();
 
+// All nodes except for the root, in document order.
+frg::span<DeviceTreeNode *> getDeviceTreeNodes();
+
+// Nodes (except for the root) that list the given compatible string, in document order.
+frg::span<DeviceTreeNode *> getDeviceTreeNodesByCompatible(frg::string_view compatible);
+
+// Calls func for each node that is compatible with one of the given strings,
+// in document order and at most once per node. Stops if func returns true.
+// This only looks at the compatible index, i.e., it does not walk the tree.
+template <size_t N, typename F>
+bool forEachCompatibleNode(frg::array<frg::string_view, N> with, F &&func) {
+	frg::array<frg::span<DeviceTreeNode *>, N> lists;
+	frg::array<size_t, N> progress{};
+	for (size_t i = 0; i < N; i++)
+		lists[i] = getDeviceTreeNodesByCompatible(with[i]);
+
+	while (true) {
+		// Merge the lists by document order.
+		DeviceTreeNode *next = nullptr;
+		for (size_t i = 0; i < N; i++) {
+			if (progress[i] == lists[i].size())
+				continue;
+			auto node = lists[i][progress[i]];
+			if (!next || node->index() < next->index())
+				next = node;
+		}
+
+		if (!next)
+			return false;
+
+		for (size_t i = 0; i < N; i++) {
+			if (progress[i] < lists[i].size() && lists[i][progress[i]] == next)
+				progress[i]++;
+		}
+
+		if (func(next))
+			return true;
+	}
+}
+
 initgraph::Stage *getDeviceTreeParsedStage();
 
 static inline frg::array<frg::string_view, 12> dtGicV2Compatible = {
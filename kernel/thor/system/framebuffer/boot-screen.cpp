@@ -29,7 +29,7 @@ void BootScreen::Formatter::print(const char *c, size_t n) {
 
 				int m = frg::min(_screen->_width - _x, n);
 				if(m) {
-					_screen->_display->setChars(_x, _y, spaces, m, _fg, _bg);
+					_screen->_setChars(_x, _y, spaces, m, _fg, _bg);
 					_x += m;
 				}
 
@@ -40,7 +40,7 @@ void BootScreen::Formatter::print(const char *c, size_t n) {
 					n++;
 				int m = frg::min(_screen->_width - _x, n);
 				if(m) {
-					_screen->_display->setChars(_x, _y, c, m, _fg, _bg);
+					_screen->_setChars(_x, _y, c, m, _fg, _bg);
 					_x += m;
 				}
 				c += n;
@@ -51,7 +51,7 @@ void BootScreen::Formatter::print(const char *c, size_t n) {
 				c++;
 			}else{
 				// TODO: ESC should never be emitted (?).
-				_screen->_display->setChars(_x, _y, c, 1, _fg, _bg);
+				_screen->_setChars(_x, _y, c, 1, _fg, _bg);
 				_csiState = 0;
 				c++;
 			}
@@ -87,13 +87,60 @@ void BootScreen::Formatter::print(const char *c, size_t n) {
 		}
 	}
 
-	_screen->_display->setBlanks(_x, _y, _screen->_width - _x, _bg);
+	_screen->_setBlanks(_x, _y, _screen->_width - _x, _bg);
 }
 
 BootScreen::BootScreen(TextDisplay *display)
 : _display{display} {
-	_width = _display->getWidth();
-	_height = _display->getHeight();
+	_width = frg::min(_display->getWidth(), maxWidth);
+	_height = frg::min(_display->getHeight(), maxHeight);
+}
+
+void BootScreen::_setChars(size_t x, size_t y, const char *c, size_t count, int fg, int bg) {
+	if(y >= _height || x >= _width)
+		return;
+	count = frg::min(count, _width - x);
+
+	auto row = _cells[y] + x;
+	size_t i = 0;
+	while(i < count) {
+		while(i < count && row[i] == Cell::make(c[i], fg, bg))
+			i++;
+
+		size_t n = 0;
+		while(i + n < count && row[i + n] != Cell::make(c[i + n], fg, bg)) {
+			row[i + n] = Cell::make(c[i + n], fg, bg);
+			n++;
+		}
+
+		if(n)
+			_display->setChars(x + i, y, c + i, n, fg, bg);
+		i += n;
+	}
+}
+
+void BootScreen::_setBlanks(size_t x, size_t y, size_t count, int bg) {
+	if(y >= _height || x >= _width)
+		return;
+	count = frg::min(count, _width - x);
+
+	auto row = _cells[y] + x;
+	auto blank = Cell::make(' ', 0, bg);
+	size_t i = 0;
+	while(i < count) {
+		while(i < count && row[i] == blank)
+			i++;
+
+		size_t n = 0;
+		while(i + n < count && row[i + n] != blank) {
+			row[i + n] = blank;
+			n++;
+		}
+
+		if(n)
+			_display->setBlanks(x + i, y, n, bg);
+		i += n;
+	}
 }
 
 void BootScreen::emit(frg::string_view record) {
@@ -105,11 +152,25 @@ void BootScreen::emit(frg::string_view record) {
 	line->length = msg.size();
 	memcpy(line->msg, msg.data(), msg.size());
 	++_displaySeq;
+}
 
-	redraw();
+void BootScreen::flush() {
+	if(_drawnSeq != _displaySeq)
+		redraw();
 }
 
 void BootScreen::redraw() {
+	// Each new line scrolls the screen by one row. If the display can move its contents,
+	// shift the cells along such that only the new lines are rendered below.
+	auto scrolled = _displaySeq - _drawnSeq;
+	if(scrolled && scrolled < _height && _display->scroll(scrolled)) {
+		memmove(_cells[0], _cells[scrolled], (_height - scrolled) * sizeof(_cells[0]));
+		for(size_t i = _height - scrolled; i < _height; i++)
+			for(size_t j = 0; j < _width; j++)
+				_cells[i][j] = Cell{};
+	}
+	_drawnSeq = _displaySeq;
+
 	// Redraw up to _height lines.
 	for(size_t i = 0; i < _height - 1; i++) {
 		if(i >= _displaySeq)
@@ -145,7 +206,9 @@ void BootScreen::redraw() {
 	}
 
 	// Clear the last line.
-	_display->setBlanks(0, _height - 1, frg::min(logLineLength, _width), -1);
+	_setBlanks(0, _height - 1, frg::min(logLineLength, _width), -1);
+
+	_display->flush();
 }
 
 } //namespace thor
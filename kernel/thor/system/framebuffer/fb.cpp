@@ -32,22 +32,53 @@ struct FbDisplay final : TextDisplay {
 		_window = reinterpret_cast<uint32_t *>(ptr);
 	}
 
+	// Renders into a copy of the framebuffer in normal RAM from now on; flush() then
+	// copies the rows that changed. This avoids reading back from write-combined VRAM
+	// when scrolling. Requires the kernel heap.
+	void setupShadow();
+
 	size_t getWidth() override;
 	size_t getHeight() override;
 
 	void setChars(unsigned int x, unsigned int y,
 			const char *c, int count, int fg, int bg) override;
 	void setBlanks(unsigned int x, unsigned int y, int count, int bg) override;
+	bool scroll(unsigned int lines) override;
+	void flush() override;
 
 private:
 	void _clearScreen(uint32_t rgb_color);
 
+	// Text rows [_dirtyBegin, _dirtyEnd) of the shadow buffer differ from the window.
+	void _markDirty(unsigned int begin, unsigned int end) {
+		_dirtyBegin = frg::min(_dirtyBegin, begin);
+		_dirtyEnd = frg::max(_dirtyEnd, end);
+	}
+
 	volatile uint32_t *_window;
 	unsigned int _width;
 	unsigned int _height;
 	size_t _pitch;
+
+	// The shadow buffer has a pitch of _width pixels.
+	uint32_t *_shadow{nullptr};
+	unsigned int _dirtyBegin{~0u};
+	unsigned int _dirtyEnd{0};
 };
 
+void FbDisplay::setupShadow() {
+	auto shadow = static_cast<uint32_t *>(kernelAlloc->allocate(_width * _height * sizeof(uint32_t)));
+	if(!shadow) {
+		infoLogger() << "thor: Could not allocate shadow buffer for boot framebuffer" << frg::endlog;
+		return;
+	}
+
+	// This is the only time that we read from the window.
+	for(size_t i = 0; i < _height; i++)
+		memcpy(shadow + i * _width, (const void *)(_window + i * _pitch), _width * sizeof(uint32_t));
+	_shadow = shadow;
+}
+
 size_t FbDisplay::getWidth() {
 	return _width / fontWidth;
 }
@@ -58,6 +89,14 @@ size_t FbDisplay::getHeight() {
 
 void FbDisplay::setChars(unsigned int x, unsigned int y,
 		const char *c, int count, int fg, int bg) {
+	if(_shadow) {
+		renderChars(_shadow, _width, x, y, c, count, fg, bg,
+				std::integral_constant<int, fontWidth>{},
+				std::integral_constant<int, fontHeight>{});
+		_markDirty(y, y + 1);
+		return;
+	}
+
 	renderChars((void *)_window, _pitch, x, y, c, count, fg, bg,
 			std::integral_constant<int, fontWidth>{},
 			std::integral_constant<int, fontHeight>{});
@@ -66,17 +105,55 @@ void FbDisplay::setChars(unsigned int x, unsigned int y,
 void FbDisplay::setBlanks(unsigned int x, unsigned int y, int count, int bg) {
 	auto bg_rgb = (bg < 0) ? defaultBg : rgbColor[bg];
 
-	auto dest_line = _window + y * fontHeight * _pitch + x * fontWidth;
-	for(size_t i = 0; i < fontHeight; i++) {
-		auto dest = dest_line;
-		for(int k = 0; k < count; k++) {
-			for(size_t j = 0; j < fontWidth; j++)
-				*dest++ = bg_rgb;
+	auto fill = [&] (auto dest_line, size_t pitch) {
+		dest_line += y * fontHeight * pitch + x * fontWidth;
+		for(size_t i = 0; i < fontHeight; i++) {
+			auto dest = dest_line;
+			for(int k = 0; k < count; k++) {
+				for(size_t j = 0; j < fontWidth; j++)
+					*dest++ = bg_rgb;
+			}
+			dest_line += pitch;
 		}
-		dest_line += _pitch;
+	};
+
+	if(_shadow) {
+		fill(_shadow, _width);
+		_markDirty(y, y + 1);
+	}else{
+		fill(_window, _pitch);
 	}
 }
 
+bool FbDisplay::scroll(unsigned int lines) {
+	if(!_shadow)
+		return false;
+
+	auto rows = getHeight();
+	auto rowSize = fontHeight * _width;
+	if(lines >= rows)
+		return false;
+
+	memmove(_shadow, _shadow + lines * rowSize, (rows - lines) * rowSize * sizeof(uint32_t));
+	for(size_t i = (rows - lines) * rowSize; i < rows * rowSize; i++)
+		_shadow[i] = defaultBg;
+	_markDirty(0, rows);
+	return true;
+}
+
+void FbDisplay::flush() {
+	if(!_shadow || _dirtyBegin >= _dirtyEnd)
+		return;
+
+	// Whole rows are copied such that the writes to VRAM are sequential.
+	for(size_t i = _dirtyBegin * fontHeight; i < _dirtyEnd * fontHeight; i++)
+		memcpy((void *)(_window + i * _pitch), _shadow + i * _width, _width * sizeof(uint32_t));
+	asm volatile("" : : : "memory");
+
+	_dirtyBegin = ~0u;
+	_dirtyEnd = 0;
+}
+
 void FbDisplay::_clearScreen(uint32_t rgb_color) {
 	auto dest_line = _window;
 	for(size_t i = 0; i < _height; i++) {
@@ -126,6 +203,7 @@ void transitionBootFb() {
 
 	// Transition to the kernel mapping window.
 	bootDisplay->setWindow(window);
+	bootDisplay->setupShadow();
 
 	assert(!(bootInfo->address & (kPageSize - 1)));
 	bootInfo->memory = smarter::allocate_shared<HardwareMemory>(*kernelAlloc,
@@ -10,8 +10,16 @@ struct TextDisplay {
 
 	virtual void setChars(unsigned int x, unsigned int y,
 			const char *c, int count, int fg, int bg) = 0;
+	// The display must be blank (filled with the default background) initially.
 	virtual void setBlanks(unsigned int x, unsigned int y, int count, int bg) = 0;
 
+	// Moves the contents up by the given number of rows; the rows at the bottom become blank.
+	// Returns false if the display cannot scroll; the caller then redraws the rows instead.
+	virtual bool scroll(unsigned int) { return false; }
+
+	// Makes preceding changes visible. Displays may defer rendering until then.
+	virtual void flush() { }
+
 protected:
 	~TextDisplay() = default;
 };
@@ -40,6 +48,7 @@ struct BootScreen final : public LogHandler {
 	BootScreen(TextDisplay *display);
 
 	void emit(frg::string_view record) override;
+	void flush() override;
 
 	void redraw();
 
@@ -50,6 +59,31 @@ private:
 		char msg[logLineLength]{};
 	};
 
+	// A character cell as it is shown on the display.
+	struct Cell {
+		// Blanks look the same regardless of their foreground color.
+		static Cell make(char c, int fg, int bg) {
+			if(c == ' ')
+				fg = 0;
+			return Cell{c, static_cast<int8_t>(fg), static_cast<int8_t>(bg)};
+		}
+
+		friend bool operator==(const Cell &, const Cell &) = default;
+
+		char c{' '};
+		int8_t fg{0};
+		int8_t bg{-1};
+	};
+
+	// Large enough for 8x16 glyphs on a 3840x2160 display.
+	static constexpr size_t maxWidth = 480;
+	static constexpr size_t maxHeight = 135;
+
+	// Redrawing scrolls all lines. These only pass on the cells whose contents
+	// changed, such that the display does not re-render the entire screen for each line.
+	void _setChars(size_t x, size_t y, const char *c, size_t count, int fg, int bg);
+	void _setBlanks(size_t x, size_t y, size_t count, int bg);
+
 	// Number of lines that are kept in memory. Must be power of 2.
 	static constexpr size_t NUM_LINES = 128;
 
@@ -58,6 +92,9 @@ private:
 	size_t _height;
 	Line _displayLines[NUM_LINES];
 	uint64_t _displaySeq{0};
+	// Value of _displaySeq at the last redraw().
+	uint64_t _drawnSeq{0};
+	Cell _cells[maxHeight][maxWidth];
 };
 
 } // namespace thor
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <atomic>
 #include <frg/algorithm.hpp>
 #include <hw.frigg_bragi.hpp>
 #include <thor-internal/fiber.hpp>
@@ -228,6 +229,7 @@ coroutine<frg::expected<Error>> PciEntity::handleRequest(LaneHandle lane) {
 
 		if (parentBus->msiController) {
 			resp.set_num_msis(numMsis);
+			resp.set_num_cpus(getCpuCount());
 			resp.set_msi_x(msixIndex >= 0);
 		}
 
@@ -412,7 +414,18 @@ coroutine<frg::expected<Error>> PciEntity::handleRequest(LaneHandle lane) {
 				+ frg::to_allocated_string(*kernelAlloc, req->index()));
 		IrqPin::attachSink(interrupt, object.get());
 
-		static_cast<PciDevice *>(this)->setupMsi(interrupt, req->index());
+		// The affinity is only a hint at this point; fall back to the default CPU.
+		if(req->cpu() >= 0) {
+			if(auto e = interrupt->setAffinity(req->cpu()); e != Error::success)
+				infoLogger() << "thor: Could not route " << interrupt->name()
+						<< " to CPU #" << req->cpu() << frg::endlog;
+		}
+
+		auto device = static_cast<PciDevice *>(this);
+		if(device->msiPins.size() < numMsis)
+			device->msiPins.resize(numMsis);
+		device->msiPins[req->index()] = interrupt;
+		device->setupMsi(interrupt, req->index());
 
 		managarm::hw::SvrResponse<KernelAlloc> resp{*kernelAlloc};
 		resp.set_error(managarm::hw::Errors::SUCCESS);
@@ -423,6 +436,35 @@ coroutine<frg::expected<Error>> PciEntity::handleRequest(LaneHandle lane) {
 
 		if (descError != Error::success)
 			co_return descError;
+	}else if(preamble.id() == bragi::message_id<managarm::hw::SetMsiAffinityRequest>) {
+		auto req = bragi::parse_head_only<managarm::hw::SetMsiAffinityRequest>(
+				reqBuffer, *kernelAlloc);
+		if (!req) {
+			infoLogger() << "thor: Closing lane due to illegal HW request." << frg::endlog;
+			co_return Error::protocolViolation;
+		}
+
+		if(type() != PciEntityType::Device) {
+			infoLogger() << "thor: Unsupported operation on PCI entity." << frg::endlog;
+			co_return Error::protocolViolation;
+		}
+
+		auto device = static_cast<PciDevice *>(this);
+		MsiPin *pin = nullptr;
+		if(req->index() < device->msiPins.size())
+			pin = device->msiPins[req->index()];
+
+		managarm::hw::SvrResponse<KernelAlloc> resp{*kernelAlloc};
+		if(!pin || req->cpu() < 0) {
+			resp.set_error(managarm::hw::Errors::ILLEGAL_ARGUMENTS);
+		}else if(auto e = pin->setAffinity(req->cpu()); e != Error::success) {
+			resp.set_error(managarm::hw::Errors::ILLEGAL_ARGUMENTS);
+		}else{
+			device->setupMsi(pin, req->index());
+			resp.set_error(managarm::hw::Errors::SUCCESS);
+		}
+
+		FRG_CO_TRY(co_await sendResponse(conversation, std::move(resp)));
 	}else if(preamble.id() == bragi::message_id<managarm::hw::ClaimDeviceRequest>) {
 		auto req = bragi::parse_head_only<managarm::hw::ClaimDeviceRequest>(reqBuffer, *kernelAlloc);
 
@@ -643,6 +685,50 @@ coroutine<frg::expected<Error>> PciEntity::handleRequest(LaneHandle lane) {
 			resp.set_error(managarm::hw::Errors::ILLEGAL_ARGUMENTS);
 		}
 
+		FRG_CO_TRY(co_await sendResponse(conversation, std::move(resp)));
+	}else if(preamble.id() == bragi::message_id<managarm::hw::LoadPciSpaceRangeRequest>) {
+		auto req = bragi::parse_head_only<managarm::hw::LoadPciSpaceRangeRequest>(reqBuffer, *kernelAlloc);
+
+		if (!req) {
+			infoLogger() << "thor: Closing lane due to illegal HW request." << frg::endlog;
+			co_return Error::protocolViolation;
+		}
+
+		managarm::hw::SvrResponse<KernelAlloc> resp{*kernelAlloc};
+
+		auto io = parentBus->io;
+
+		if(req->size() <= 0x1000 && req->offset() <= 0x1000 - req->size()) {
+			frg::vector<uint8_t, KernelAlloc> data{*kernelAlloc};
+			data.resize(req->size());
+
+			// Use the widest naturally aligned access that fits.
+			uint32_t progress = 0;
+			while(progress < req->size()) {
+				auto offset = req->offset() + progress;
+				auto remaining = req->size() - progress;
+				if(isValidConfigAccess(4, offset) && remaining >= 4) {
+					uint32_t word = io->readConfigWord(parentBus, slot, function, offset);
+					for(int i = 0; i < 4; i++)
+						data[progress + i] = word >> (i * 8);
+					progress += 4;
+				}else if(isValidConfigAccess(2, offset) && remaining >= 2) {
+					uint16_t half = io->readConfigHalf(parentBus, slot, function, offset);
+					for(int i = 0; i < 2; i++)
+						data[progress + i] = half >> (i * 8);
+					progress += 2;
+				}else{
+					data[progress] = io->readConfigByte(parentBus, slot, function, offset);
+					progress += 1;
+				}
+			}
+
+			resp.set_error(managarm::hw::Errors::SUCCESS);
+			resp.set_config_data(std::move(data));
+		}else{
+			resp.set_error(managarm::hw::Errors::ILLEGAL_ARGUMENTS);
+		}
+
 		FRG_CO_TRY(co_await sendResponse(conversation, std::move(resp)));
 	}else if(preamble.id() == bragi::message_id<managarm::hw::GetFbInfoRequest>) {
 		auto req = bragi::parse_head_only<managarm::hw::GetFbInfoRequest>(reqBuffer, *kernelAlloc);
@@ -789,7 +875,10 @@ void PciDevice::setupMsi(MsiPin *msi, size_t index) {
 
 	if (msixIndex >= 0) {
 		// Setup the MSI-X table.
+		// Mask the vector while the message is updated (e.g., to change its affinity).
 		auto space = arch::mem_space{msixMapping}.subspace(index * 16);
+		space.store(msixVectorControl,
+				space.load(msixVectorControl) | uint32_t{1});
 		space.store(msixMessageAddress, msi->getMessageAddress());
 		space.store(msixMessageData, msi->getMessageData());
 		space.store(msixVectorControl,
@@ -896,7 +985,8 @@ size_t computeBarLength(uintptr_t mask) {
 	return size_t(1) << length_bits;
 }
 
-frg::manual_box<frg::vector<PciBus *, KernelAlloc>> enumerationQueue;
+// Protects allDevices while root buses are enumerated concurrently.
+constinit IrqSpinlock allDevicesMutex;
 
 void readEntityBars(PciEntity *entity, int nBars) {
 	auto bars = entity->getBars();
@@ -1261,7 +1351,10 @@ void checkPciFunction(PciBus *bus, uint32_t slot, uint32_t function,
 			}
 		}
 
-		allDevices->push_back(device);
+		{
+			auto lock = frg::guard(&allDevicesMutex);
+			allDevices->push_back(device);
+		}
 		bus->childDevices.push_back(device.get());
 
 		applyPciDeviceQuirks(device);
@@ -1355,21 +1448,12 @@ void runAllDevices() {
 		dev->runDevice();
 }
 
-void addToEnumerationQueue(PciBus *bus) {
-	if (!enumerationQueue)
-		enumerationQueue.initialize(*kernelAlloc);
-
-	enumerationQueue->push_back(bus);
-}
-
 void addRootBus(PciBus *bus) {
 	if (!allRootBuses)
 		allRootBuses.initialize(*kernelAlloc);
 
-	allRootBuses->push_back(bus);
-
 	// This assumes we discover all root buses before enumeration
-	addToEnumerationQueue(bus);
+	allRootBuses->push_back(bus);
 }
 
 void checkForBridgeResources(PciBridge *bridge) {
@@ -1957,32 +2041,66 @@ void configureDevice(PciDevice *device) {
 	}
 }
 
-void enumerateAll() {
-	if (!enumerationQueue)
-		enumerationQueue.initialize(*kernelAlloc);
+void configureDevices(PciBus *bus) {
+	for (auto device : bus->childDevices)
+		configureDevice(device);
+
+	for (auto bridge : bus->childBridges) {
+		if (bridge->associatedBus)
+			configureDevices(bridge->associatedBus);
+	}
+}
+
+// Enumerates the hierarchy below a root bus and assigns resources to it.
+// Apart from allDevices, this does not touch state that is shared with other root buses.
+void enumerateRootBus(PciBus *rootBus) {
+	frg::vector<PciBus *, KernelAlloc> queue{*kernelAlloc};
+	queue.push_back(rootBus);
+
+	for(size_t i = 0; i < queue.size(); i++) {
+		checkPciBus(queue[i], [&] (PciBus *bus) {
+			queue.push_back(bus);
+		});
+	}
+
+	// Configure unconfigured bridges
+	infoLogger() << "thor: Looking for unconfigured PCI bridges on "
+			<< frg::hex_fmt{rootBus->segId} << ":" << frg::hex_fmt{rootBus->busId}
+			<< frg::endlog;
 
+	uint32_t i = findHighestId(rootBus);
+	configureBridges(rootBus, rootBus, i);
+	allocateBars(rootBus);
+
+	configureDevices(rootBus);
+}
+
+void enumerateAll() {
 	if (!allRootBuses)
 		allRootBuses.initialize(*kernelAlloc);
 
 	if (!allDevices)
 		allDevices.initialize(*kernelAlloc);
 
-	for(size_t i = 0; i < enumerationQueue->size(); i++) {
-		auto bus = (*enumerationQueue)[i];
-		checkPciBus(bus, addToEnumerationQueue);
-	}
-
-	// Configure unconfigured bridges
-	infoLogger() << "thor: Looking for unconfigured PCI bridges" << frg::endlog;
+	if (allRootBuses->empty())
+		return;
 
-	for (auto rootBus : *allRootBuses) {
-		uint32_t i = findHighestId(rootBus);
-		configureBridges(rootBus, rootBus, i);
-		allocateBars(rootBus);
+	// Config space accesses are slow, hence we enumerate root buses concurrently.
+	// Each root bus gets its own fiber; the fibers are spread over all CPUs.
+	FiberBlocker blocker;
+	blocker.setup();
+	std::atomic<size_t> pending{allRootBuses->size()};
+
+	for(size_t i = 0; i < allRootBuses->size(); i++) {
+		auto rootBus = (*allRootBuses)[i];
+		KernelFiber::run([rootBus, &pending, &blocker] {
+			enumerateRootBus(rootBus);
+			if(pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				KernelFiber::unblockOther(&blocker);
+		}, &localScheduler.getFor(i % getCpuCount()));
 	}
 
-	for (auto device : *allDevices)
-		configureDevice(device.get());
+	KernelFiber::blockCurrent(&blocker);
 }
 
 void addConfigSpaceIo(uint32_t seg, uint32_t bus, PciConfigIo *io) {
@@ -2044,6 +2162,8 @@ void writeConfigByte(uint32_t seg, uint32_t bus, uint32_t slot,
 static initgraph::Task enumerateRootBuses{&globalInitEngine, "pci.enumerate-buses",
 	initgraph::Requires{getTaskingAvailableStage(), getRootsDiscoveredStage()},
 	initgraph::Entails{getDevicesEnumeratedStage()},
+	// Slow config space accesses; this can overlap with AP bring-up and ACPI tasks.
+	initgraph::concurrent,
 	[] {
 		infoLogger() << "thor: Discovering PCI devices" << frg::endlog;
 		enumerateAll();
@@ -190,12 +190,9 @@ initgraph::Task discoverDtbNodes{&globalInitEngine, "pci.discover-dtb-nodes",
 	[] {
 		size_t i = 0;
 
-		getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-			if (node->isCompatible(dtPciCompatible)) {
-				initPciNode(node);
-				i++;
-			}
-
+		forEachCompatibleNode(dtPciCompatible, [&](DeviceTreeNode *node) -> bool {
+			initPciNode(node);
+			i++;
 			return false;
 		});
 
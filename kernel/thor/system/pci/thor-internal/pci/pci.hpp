@@ -382,6 +382,8 @@ struct PciDevice final : PciEntity {
 
 	IrqPin *interrupt;
 	Iommu *associatedIommu = nullptr;
+	// MSIs installed by mbus clients, indexed by MSI(-X) index.
+	frg::vector<MsiPin *, KernelAlloc> msiPins{*kernelAlloc};
 
 	// device configuration
 	PciBar bars[6];
@@ -456,7 +458,6 @@ extern frg::manual_box<
 void runAllBridges();
 void runAllDevices();
 
-void addToEnumerationQueue(PciBus *bus);
 void addRootBus(PciBus *bus);
 void enumerateAll();
 
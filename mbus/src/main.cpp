@@ -14,8 +14,6 @@
 #include <variant>
 #include <vector>
 
-#include <frg/rbtree.hpp>
-
 #include <async/oneshot-event.hpp>
 #include <async/sequenced-event.hpp>
 #include <async/result.hpp>
@@ -70,7 +68,6 @@ struct Entity {
 
 	async::result<helix::UniqueDescriptor> bind();
 
-	frg::rbtree_hook seqNode;
 private:
 	int64_t _id;
 	uint64_t _seq;
@@ -85,12 +82,6 @@ private:
 	async::queue<SubmittedLane *, frg::stl_allocator> _submittedLanes;
 };
 
-struct EntitySeqLess {
-	bool operator()(const Entity &a, const Entity &b) {
-		return a.seq() < b.seq();
-	}
-};
-
 async::result<helix::UniqueDescriptor> Entity::bind() {
 	auto pending = *(co_await _submittedLanes.async_get());
 	auto lane = std::move(pending->lane);
@@ -192,17 +183,214 @@ static bool matchesFilter(const Entity *entity, const AnyFilter &filter) {
 std::unordered_map<int64_t, std::shared_ptr<Entity>> allEntities;
 int64_t nextEntityId = 1;
 
-// Store the entities in an RB tree ordered by their sequence numbers to speed up lookup.
-// TODO(qookie): Once we add a way to change properties (which requires a sequence number update),
-//               we'll need to protect this tree with an async::mutex if we ever want to make mbus
-//               multithreaded (to prevent concurrent update & traversal).
 async::sequenced_event globalSeq;
-using EntitySeqTree = frg::rbtree<
-	Entity,
-	&Entity::seqNode,
-	EntitySeqLess
->;
-EntitySeqTree entitySeqTree;
+
+// --------------------------------------------------------
+// Property index
+// --------------------------------------------------------
+
+// Identifies a string-valued property. Only those are matched by EqualsFilter.
+struct PropertyKey {
+	std::string name;
+	std::string value;
+
+	bool operator==(const PropertyKey &) const = default;
+};
+
+struct PropertyKeyHash {
+	size_t operator()(const PropertyKey &key) const {
+		auto h = std::hash<std::string>{}(key.name);
+		return h ^ (std::hash<std::string>{}(key.value) + 0x9e3779b9 + (h << 6) + (h >> 2));
+	}
+};
+
+using EntitySet = std::unordered_set<Entity *>;
+
+// Maps each (property, value) pair to the entities that have it.
+// TODO(qookie): If we ever want to make mbus multithreaded, the index needs to be
+//               protected by an async::mutex (to prevent concurrent update & evaluation).
+std::unordered_map<PropertyKey, EntitySet, PropertyKeyHash> propertyIndex;
+
+template<typename F>
+static void forEachPropertyKey(const Entity *entity, F fn) {
+	for(auto &[name, item] : entity->getProperties()) {
+		if(auto string = std::get_if<mbus_ng::StringItem>(&item); string)
+			fn(PropertyKey{name, string->value});
+	}
+}
+
+static void indexEntity(Entity *entity) {
+	forEachPropertyKey(entity, [&] (PropertyKey key) {
+		propertyIndex[std::move(key)].insert(entity);
+	});
+}
+
+static void unindexEntity(Entity *entity) {
+	forEachPropertyKey(entity, [&] (PropertyKey key) {
+		auto it = propertyIndex.find(key);
+		assert(it != propertyIndex.end());
+		it->second.erase(entity);
+		if(it->second.empty())
+			propertyIndex.erase(it);
+	});
+}
+
+static PropertyKey keyOf(const EqualsFilter &filter) {
+	auto value = filter.getValue();
+	assert(std::holds_alternative<mbus_ng::StringItem>(value));
+	return {filter.getProperty(), std::get<mbus_ng::StringItem>(value).value};
+}
+
+// Upper bound on the number of entities that match the filter.
+static size_t estimateMatches(const AnyFilter &filter) {
+	if(auto real = std::get_if<EqualsFilter>(&filter); real) {
+		auto it = propertyIndex.find(keyOf(*real));
+		if(it == propertyIndex.end())
+			return 0;
+		return it->second.size();
+	}else if(auto real = std::get_if<Conjunction>(&filter); real) {
+		size_t n = allEntities.size();
+		for(auto &operand : real->getOperands())
+			n = std::min(n, estimateMatches(operand));
+		return n;
+	}else if(auto real = std::get_if<Disjunction>(&filter); real) {
+		size_t n = 0;
+		for(auto &operand : real->getOperands())
+			n += estimateMatches(operand);
+		return std::min(n, allEntities.size());
+	}else{
+		throw std::runtime_error("Unexpected filter");
+	}
+}
+
+// Returns exactly the entities that satisfy matchesFilter().
+static EntitySet evaluateFilter(const AnyFilter &filter) {
+	if(auto real = std::get_if<EqualsFilter>(&filter); real) {
+		auto it = propertyIndex.find(keyOf(*real));
+		if(it == propertyIndex.end())
+			return {};
+		return it->second;
+	}else if(auto real = std::get_if<Conjunction>(&filter); real) {
+		auto &operands = real->getOperands();
+		if(operands.empty()) {
+			EntitySet result;
+			for(auto &[id, entity] : allEntities)
+				result.insert(entity.get());
+			return result;
+		}
+
+		// Intersect by evaluating the most selective operand and
+		// checking the remaining operands on its (few) results.
+		auto best = std::min_element(operands.begin(), operands.end(),
+				[] (const AnyFilter &a, const AnyFilter &b) {
+			return estimateMatches(a) < estimateMatches(b);
+		});
+		auto result = evaluateFilter(*best);
+		std::erase_if(result, [&] (Entity *entity) {
+			for(auto it = operands.begin(); it != operands.end(); ++it) {
+				if(it != best && !matchesFilter(entity, *it))
+					return true;
+			}
+			return false;
+		});
+		return result;
+	}else if(auto real = std::get_if<Disjunction>(&filter); real) {
+		EntitySet result;
+		for(auto &operand : real->getOperands())
+			result.merge(evaluateFilter(operand));
+		return result;
+	}else{
+		throw std::runtime_error("Unexpected filter");
+	}
+}
+
+// --------------------------------------------------------
+// Subscribers
+// --------------------------------------------------------
+
+// An enumeration that waits for entities matching its filter.
+struct Subscriber {
+	async::oneshot_event event;
+	bool notified = false;
+	std::vector<PropertyKey> keys;
+	// Set if the filter can match entities that have none of the keys.
+	bool wildcard = false;
+};
+
+std::unordered_map<PropertyKey, std::unordered_set<Subscriber *>, PropertyKeyHash> subscribersByKey;
+std::unordered_set<Subscriber *> wildcardSubscribers;
+
+// Collects keys such that every matching entity has at least one of them.
+// Returns false if no such set of keys exists.
+static bool collectKeys(const AnyFilter &filter, std::vector<PropertyKey> &keys) {
+	if(auto real = std::get_if<EqualsFilter>(&filter); real) {
+		keys.push_back(keyOf(*real));
+		return true;
+	}else if(auto real = std::get_if<Conjunction>(&filter); real) {
+		// Matching entities match every operand, hence the keys of any operand suffice.
+		for(auto &operand : real->getOperands()) {
+			std::vector<PropertyKey> operandKeys;
+			if(collectKeys(operand, operandKeys)) {
+				keys.insert(keys.end(), operandKeys.begin(), operandKeys.end());
+				return true;
+			}
+		}
+		return false;
+	}else if(auto real = std::get_if<Disjunction>(&filter); real) {
+		for(auto &operand : real->getOperands()) {
+			if(!collectKeys(operand, keys))
+				return false;
+		}
+		return true;
+	}else{
+		throw std::runtime_error("Unexpected filter");
+	}
+}
+
+static void subscribe(Subscriber *subscriber, const AnyFilter &filter) {
+	subscriber->wildcard = !collectKeys(filter, subscriber->keys);
+	if(subscriber->wildcard) {
+		wildcardSubscribers.insert(subscriber);
+		return;
+	}
+	for(auto &key : subscriber->keys)
+		subscribersByKey[key].insert(subscriber);
+}
+
+static void unsubscribe(Subscriber *subscriber) {
+	if(subscriber->wildcard) {
+		wildcardSubscribers.erase(subscriber);
+		return;
+	}
+	for(auto &key : subscriber->keys) {
+		auto it = subscribersByKey.find(key);
+		if(it == subscribersByKey.end())
+			continue;
+		it->second.erase(subscriber);
+		if(it->second.empty())
+			subscribersByKey.erase(it);
+	}
+}
+
+// Wakes the subscribers whose filters could match the (new or updated) entity.
+static void notifySubscribers(const Entity *entity) {
+	std::vector<Subscriber *> affected{wildcardSubscribers.begin(), wildcardSubscribers.end()};
+	forEachPropertyKey(entity, [&] (PropertyKey key) {
+		auto it = subscribersByKey.find(key);
+		if(it != subscribersByKey.end())
+			affected.insert(affected.end(), it->second.begin(), it->second.end());
+	});
+
+	// Unsubscribe first: raising the event may resume the subscriber immediately.
+	for(auto subscriber : affected) {
+		if(subscriber->notified)
+			continue;
+		subscriber->notified = true;
+		unsubscribe(subscriber);
+	}
+	for(auto subscriber : affected)
+		subscriber->event.raise();
+}
 
 std::shared_ptr<Entity> getEntityById(int64_t id) {
 	auto it = allEntities.find(id);
@@ -236,39 +424,32 @@ static AnyFilter decodeFilter(managarm::mbus::AnyFilter &protoFilter) {
 	}
 }
 
-auto seqLowerBound(uint64_t inSeq) {
-	Entity *cur = entitySeqTree.get_root();
-	Entity *successor = nullptr;
-
-	while (cur) {
-		if (cur->seq() > inSeq) {
-			successor = cur;
-			cur = EntitySeqTree::get_left(cur);
-		} else if (cur->seq() < inSeq) {
-			cur = EntitySeqTree::get_right(cur);
-		} else {
-			return cur;
-		}
-	}
-
-	return successor;
-}
+// Page size if the client does not specify one.
+constexpr size_t defaultEntitiesPerMessage = 16;
+// Upper bound on the page size to bound the size of responses.
+constexpr size_t maxEntitiesPerMessage = 256;
 
-async::result<std::tuple<uint64_t, uint64_t>>
-tryEnumerate(managarm::mbus::EnumerateResponse &resp, uint64_t inSeq, const AnyFilter &filter) {
-	auto actualSeq = co_await globalSeq.async_wait(inSeq);
+std::tuple<uint64_t, uint64_t>
+tryEnumerate(managarm::mbus::EnumerateResponse &resp, uint64_t inSeq, uint64_t actualSeq,
+		const AnyFilter &filter, size_t entitiesPerMessage) {
 	auto outSeq = actualSeq;
 
-	// Find the first entity with an interesting seq number.
-	auto cur = seqLowerBound(inSeq);
+	// Only consider matching entities with an interesting seq number.
+	auto matches = evaluateFilter(filter);
+	std::vector<Entity *> candidates;
+	for(auto entity : matches) {
+		if(entity->seq() >= inSeq)
+			candidates.push_back(entity);
+	}
 
-	constexpr size_t maxEntitiesPerMessage = 16;
+	auto numEntities = std::min(candidates.size(), entitiesPerMessage);
+	std::partial_sort(candidates.begin(), candidates.begin() + numEntities, candidates.end(),
+			[] (const Entity *a, const Entity *b) {
+		return a->seq() < b->seq();
+	});
 
-	// At this point, cur and all successors should have ->seq() >= inSeq
-	for (; cur; cur = EntitySeqTree::successor(cur)) {
-		assert(cur->seq() >= inSeq);
-		// The client doesn't want to see this.
-		if (!matchesFilter(cur, filter)) continue;
+	for(size_t i = 0; i < numEntities; i++) {
+		auto cur = candidates[i];
 
 		managarm::mbus::Entity protoEntity;
 		protoEntity.set_id(cur->id());
@@ -287,34 +468,55 @@ tryEnumerate(managarm::mbus::EnumerateResponse &resp, uint64_t inSeq, const AnyF
 		// to the client, so it can pick back up where we left off.
 		// This is correct since in the non-paginated case, the returned
 		// seq number is the seq of the first new entity.
-		if (resp.entities().size() >= maxEntitiesPerMessage) {
+		if (resp.entities().size() >= entitiesPerMessage) {
 			outSeq = cur->seq() + 1;
 			break;
 		}
 	}
 
-	co_return {outSeq, actualSeq};
+	return {outSeq, actualSeq};
 }
 
-async::detached doEnumerate(helix::UniqueLane conversation, uint64_t inSeq, AnyFilter filter) {
+async::detached doEnumerate(helix::UniqueLane conversation, uint64_t inSeq, AnyFilter filter,
+		size_t entitiesPerMessage, bool noWait) {
 	managarm::mbus::EnumerateResponse resp;
 	resp.set_error(managarm::mbus::Error::SUCCESS);
 
+	if(!entitiesPerMessage)
+		entitiesPerMessage = defaultEntitiesPerMessage;
+	entitiesPerMessage = std::min(entitiesPerMessage, maxEntitiesPerMessage);
+
 	uint64_t curSeq = inSeq;
 
 	while(true) {
-		auto [outSeq, actualSeq] = co_await tryEnumerate(resp, curSeq, filter);
+		// TODO(qookie): Introduce async::sequenced_event::current_sequence?
+		auto actualSeq = globalSeq.next_sequence() - 1;
+		if(actualSeq > curSeq) {
+			auto [outSeq, _] = tryEnumerate(resp, curSeq, actualSeq, filter, entitiesPerMessage);
+
+			if(!resp.entities().empty()) {
+				// At least one entity was added into our response
+				resp.set_out_seq(outSeq);
+				resp.set_actual_seq(actualSeq);
+				break;
+			}
 
-		if(!resp.entities().empty()) {
-			// At least one entity was added into our response
-			resp.set_out_seq(outSeq);
-			resp.set_actual_seq(actualSeq);
-			break;
-		} else {
 			// Something changed, but nothing of interest was inserted
 			assert(outSeq == actualSeq);
 			curSeq = actualSeq;
 		}
+
+		// The client only wants to know about the current state.
+		if(noWait) {
+			resp.set_out_seq(std::max(curSeq, actualSeq));
+			resp.set_actual_seq(std::max(curSeq, actualSeq));
+			break;
+		}
+
+		// Wait until an entity that could match the filter is created or updated.
+		Subscriber subscriber;
+		subscribe(&subscriber, filter);
+		co_await subscriber.event.wait();
 	}
 
 	auto [sendResp, sendTail] =
@@ -462,7 +664,7 @@ async::detached serve(helix::UniqueLane lane) {
 			recvHead.reset();
 
 			doEnumerate(std::move(conversation), req->seq(),
-					decodeFilter(req->filter()));
+					decodeFilter(req->filter()), req->max_entities(), req->no_wait());
 		} else if(preamble.id() == bragi::message_id<managarm::mbus::CreateObjectRequest>) {
 			std::vector<std::byte> tail(preamble.tail_size());
 			auto [recvTail] = co_await helix_ng::exchangeMsgs(
@@ -488,10 +690,11 @@ async::detached serve(helix::UniqueLane lane) {
 					std::move(req->name()), std::move(properties));
 
 			allEntities.insert({ child->id(), child });
-			entitySeqTree.insert(child.get());
+			indexEntity(child.get());
 
-			// Wake up all pending enumeration operations.
+			// Wake up the pending enumeration operations that could be interested.
 			globalSeq.raise();
+			notifySubscribers(child.get());
 
 			// Set up the management lane
 			auto [localLane, remoteLane] = helix::createStream();
@@ -525,17 +728,18 @@ async::detached serve(helix::UniqueLane lane) {
 			if(!entity) {
 				resp.set_error(managarm::mbus::Error::NO_SUCH_ENTITY);
 			} else {
+				unindexEntity(entity.get());
 				for(auto p : req->properties()) {
 					entity->updateProperty(p.name(), mbus_ng::decodeItem(p.item()));
 				}
+				indexEntity(entity.get());
 
 				resp.set_error(managarm::mbus::Error::SUCCESS);
 
-				entitySeqTree.remove(entity.get());
 				auto seq = globalSeq.next_sequence() - 1;
 				entity->updateSeq(seq);
-				entitySeqTree.insert(entity.get());
 				globalSeq.raise();
+				notifySubscribers(entity.get());
 			}
 
 			auto [sendResp] =
@@ -1,5 +1,6 @@
 #include <linux/magic.h>
 #include <string.h>
+#include <charconv>
 #include <sstream>
 
 #include <core/clock.hpp>
@@ -13,6 +14,23 @@ namespace cgroupfs {
 
 SuperBlock cgroupfsSuperblock;
 
+namespace {
+
+// Parses a decimal integer. Surrounding whitespace (e.g., the newline written by echo) is ignored.
+template<typename T>
+bool parseInteger(std::string_view string, T &value) {
+	auto begin = string.find_first_not_of(" \t\n");
+	if(begin == std::string_view::npos)
+		return false;
+	auto end = string.find_last_not_of(" \t\n");
+	string = string.substr(begin, end - begin + 1);
+
+	auto [ptr, ec] = std::from_chars(string.data(), string.data() + string.size(), value);
+	return ec == std::errc{} && ptr == string.data() + string.size();
+}
+
+} // anonymous namespace
+
 // ----------------------------------------------------------------------------
 // LinkCompare implementation.
 // ----------------------------------------------------------------------------
@@ -346,40 +364,149 @@ std::shared_ptr<Link> DirectoryNode::createCgroupDirectory(std::string name) {
 	auto link = directMkdir(name);
 	auto cgroup_dir = static_cast<DirectoryNode*>(link->getTarget().get());
 
+	// Nested cgroups are backed by nested schedule groups.
+	HelHandle group;
+	HEL_CHECK(helCreateScheduleGroup(_scheduleGroup.getHandle(), &group));
+	cgroup_dir->_scheduleGroup = helix::UniqueDescriptor{group};
+
 	cgroup_dir->createCgroupFiles();
+	cgroup_dir->directMkregular("cpu.weight", std::make_shared<CpuWeightNode>(cgroup_dir));
+	cgroup_dir->directMkregular("cpu.max", std::make_shared<CpuMaxNode>(cgroup_dir));
 
 	return link;
 }
 
 void DirectoryNode::createCgroupFiles() {
-	this->directMkregular("cgroup.procs", std::make_shared<ProcsNode>());
+	this->directMkregular("cgroup.procs", std::make_shared<ProcsNode>(this));
 	this->directMkregular("cgroup.controllers", std::make_shared<ControllersNode>());
 }
 
+std::string DirectoryNode::cgroupPath() {
+	if(!_treeLink || !_treeLink->getOwner())
+		return "/";
+
+	std::string path;
+	for(auto link = _treeLink; link && link->getOwner(); ) {
+		path = "/" + link->getName() + path;
+		auto owner = static_cast<DirectoryNode *>(link->getOwner().get());
+		link = owner->_treeLink;
+	}
+	return path;
+}
+
+void DirectoryNode::setCpuWeight(uint32_t weight) {
+	_cpuWeight = weight;
+	_configureScheduleGroup();
+}
+
+void DirectoryNode::setCpuMax(uint64_t quota, uint64_t period) {
+	_cpuQuota = quota;
+	_cpuPeriod = period;
+	_configureScheduleGroup();
+}
+
+void DirectoryNode::_configureScheduleGroup() {
+	assert(_scheduleGroup);
+
+	HelScheduleGroupParams params{
+		.weight = _cpuWeight,
+		.quota = _cpuQuota * 1000,
+		.period = _cpuPeriod * 1000
+	};
+	HEL_CHECK(helConfigureScheduleGroup(_scheduleGroup.getHandle(), &params));
+}
+
 async::result<std::string> ProcsNode::show() {
-	// Everything that has a value of N/A is not implemented yet.
-	// See man 5 proc for more details.
-	// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
 	std::stringstream stream;
-	stream << "";
+	for(auto &process : Process::allProcesses()) {
+		if(process->cgroup().get() == _cgroup
+				|| (!process->cgroup() && _cgroup->isRootCgroup()))
+			stream << process->pid() << "\n";
+	}
 	co_return stream.str();
 }
 
 async::result<void> ProcsNode::store(std::string string) {
-	// TODO: proper error reporting.
-	std::cout << "posix: writing to cgroup.procs with: " << string << std::endl;
-	co_return;
+	int pid;
+	if(!parseInteger(string, pid)) {
+		// TODO: proper error reporting.
+		std::cout << "posix: invalid write to cgroup.procs: " << string << std::endl;
+		co_return;
+	}
+
+	auto process = Process::findProcess(pid);
+	if(!process) {
+		// TODO: proper error reporting.
+		std::cout << "posix: cgroup.procs: no process with pid " << pid << std::endl;
+		co_return;
+	}
+
+	// The root cgroup is represented by a null pointer.
+	std::shared_ptr<DirectoryNode> cgroup;
+	if(!_cgroup->isRootCgroup())
+		cgroup = _cgroup->shared_from_this();
+	process->setCgroup(std::move(cgroup));
 }
 
-async::result<std::string> ControllersNode::show() {
-	// Everything that has a value of N/A is not implemented yet.
-	// See man 5 proc for more details.
-	// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
+async::result<std::string> CpuWeightNode::show() {
+	co_return std::to_string(_cgroup->cpuWeight()) + "\n";
+}
+
+async::result<void> CpuWeightNode::store(std::string string) {
+	int weight;
+	if(!parseInteger(string, weight) || weight < 1 || weight > 10000) {
+		// TODO: proper error reporting.
+		std::cout << "posix: invalid write to cpu.weight: " << string << std::endl;
+		co_return;
+	}
+	_cgroup->setCpuWeight(weight);
+}
+
+async::result<std::string> CpuMaxNode::show() {
 	std::stringstream stream;
-	stream << "";
+	if(_cgroup->cpuQuota()) {
+		stream << _cgroup->cpuQuota();
+	}else{
+		stream << "max";
+	}
+	stream << " " << _cgroup->cpuPeriod() << "\n";
 	co_return stream.str();
 }
 
+async::result<void> CpuMaxNode::store(std::string string) {
+	// The format is "$MAX [$PERIOD]" where $MAX is either a number or "max".
+	std::istringstream stream{string};
+	std::string max;
+	uint64_t period = _cgroup->cpuPeriod();
+	if(!(stream >> max)) {
+		// TODO: proper error reporting.
+		std::cout << "posix: invalid write to cpu.max: " << string << std::endl;
+		co_return;
+	}
+	if(!(stream >> period))
+		period = _cgroup->cpuPeriod();
+
+	uint64_t quota = 0;
+	if(max != "max") {
+		int64_t value;
+		if(!parseInteger(max, value) || value <= 0) {
+			std::cout << "posix: invalid write to cpu.max: " << string << std::endl;
+			co_return;
+		}
+		quota = value;
+	}
+	// Linux enforces the same bounds on the period.
+	if(period < 1'000 || period > 1'000'000) {
+		std::cout << "posix: invalid period in cpu.max: " << string << std::endl;
+		co_return;
+	}
+	_cgroup->setCpuMax(quota, period);
+}
+
+async::result<std::string> ControllersNode::show() {
+	co_return "cpu\n";
+}
+
 async::result<void> ControllersNode::store(std::string string) {
 	// TODO: proper error reporting.
 	std::cout << "posix: writing to cgroup.procs with: " << string << std::endl;
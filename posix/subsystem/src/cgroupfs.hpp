@@ -163,18 +163,75 @@ struct DirectoryNode final : FsNode, std::enable_shared_from_this<DirectoryNode>
 	std::shared_ptr<Link> createCgroupDirectory(std::string name);
 	void createCgroupFiles();
 
+	// Path of the cgroup relative to the cgroupfs root.
+	std::string cgroupPath();
+
+	bool isRootCgroup() {
+		return !_scheduleGroup;
+	}
+
+	// Schedule group that enforces the cpu controller settings of this cgroup.
+	// This is a null handle for the root cgroup.
+	helix::BorrowedDescriptor scheduleGroup() {
+		return _scheduleGroup;
+	}
+
+	uint32_t cpuWeight() {
+		return _cpuWeight;
+	}
+
+	// Quota and period are in microseconds. A quota of zero means unlimited.
+	uint64_t cpuQuota() {
+		return _cpuQuota;
+	}
+
+	uint64_t cpuPeriod() {
+		return _cpuPeriod;
+	}
+
+	void setCpuWeight(uint32_t weight);
+	void setCpuMax(uint64_t quota, uint64_t period);
+
 private:
+	void _configureScheduleGroup();
+
 	Link *_treeLink;
 	std::set<std::shared_ptr<Link>, LinkCompare> _entries;
+
+	helix::UniqueDescriptor _scheduleGroup;
+	uint32_t _cpuWeight = 100;
+	uint64_t _cpuQuota = 0;
+	uint64_t _cpuPeriod = 100'000;
 };
 
 struct ProcsNode final : RegularNode {
-	ProcsNode() {}
+	ProcsNode(DirectoryNode *cgroup)
+	: _cgroup{cgroup} { }
 
 	async::result<std::string> show() override;
 	async::result<void> store(std::string) override;
 private:
-	// Process *_process;
+	DirectoryNode *_cgroup;
+};
+
+struct CpuWeightNode final : RegularNode {
+	CpuWeightNode(DirectoryNode *cgroup)
+	: _cgroup{cgroup} { }
+
+	async::result<std::string> show() override;
+	async::result<void> store(std::string) override;
+private:
+	DirectoryNode *_cgroup;
+};
+
+struct CpuMaxNode final : RegularNode {
+	CpuMaxNode(DirectoryNode *cgroup)
+	: _cgroup{cgroup} { }
+
+	async::result<std::string> show() override;
+	async::result<void> store(std::string) override;
+private:
+	DirectoryNode *_cgroup;
 };
 
 struct ControllersNode final : RegularNode {
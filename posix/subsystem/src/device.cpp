@@ -14,6 +14,7 @@
 #include <posix.bragi.hpp>
 
 #include <bitset>
+#include <map>
 
 UnixDeviceRegistry charRegistry;
 UnixDeviceRegistry blockRegistry;
@@ -197,13 +198,17 @@ private:
 		return _file.getLane();
 	}
 
+	frg::expected<Error, SharedMapping> prepareSharedMapping(bool) override {
+		return SharedMapping{.populate = _populateMappings};
+	}
+
 public:
 	DeviceFile(helix::UniqueLane control, helix::UniqueLane lane,
 			std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
-			helix::Mapping status_mapping)
+			helix::Mapping status_mapping, bool populate_mappings = false)
 	: File{FileKind::unknown,  StructName::get("devicefile"), std::move(mount), std::move(link)},
 			_control{std::move(control)}, _file{std::move(lane)},
-			_statusMapping{std::move(status_mapping)} { }
+			_statusMapping{std::move(status_mapping)}, _populateMappings{populate_mappings} { }
 
 	~DeviceFile() override {
 		// It's not necessary to do any cleanup here.
@@ -218,6 +223,7 @@ private:
 	helix::UniqueLane _control;
 	protocols::fs::File _file;
 	helix::Mapping _statusMapping;
+	bool _populateMappings;
 };
 
 } // anonymous namespace
@@ -230,10 +236,12 @@ async::result<frg::expected<Error, smarter::shared_ptr<File, FileHandle>>>
 openExternalDevice(helix::BorrowedLane lane,
 		std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 		SemanticFlags semantic_flags) {
-	if(semantic_flags & ~(semanticNonBlock | semanticRead | semanticWrite)){
+	if(semantic_flags & ~(semanticNonBlock | semanticRead | semanticWrite
+			| semanticDirect | semanticPolled)){
 		std::cout << "\e[31mposix: openExternalDevice() received illegal arguments:"
 			<< std::bitset<32>(semantic_flags)
-			<< "\nOnly semanticNonBlock (0x1), semanticRead (0x2) and semanticWrite(0x4) are allowed.\e[39m"
+			<< "\nOnly semanticNonBlock (0x1), semanticRead (0x2), semanticWrite(0x4),"
+				" semanticDirect (0x10) and semanticPolled (0x20) are allowed.\e[39m"
 			<< std::endl;
 		co_return Error::illegalArguments;
 	}
@@ -241,6 +249,10 @@ openExternalDevice(helix::BorrowedLane lane,
 	uint32_t open_flags = 0;
 	if(semantic_flags & semanticNonBlock)
 		open_flags |= managarm::fs::OpenFlags::OF_NONBLOCK;
+	if(semantic_flags & semanticDirect)
+		open_flags |= managarm::fs::OpenFlags::OF_DIRECT;
+	if(semantic_flags & semanticPolled)
+		open_flags |= managarm::fs::OpenFlags::OF_POLLED;
 
 	managarm::fs::CntRequest req;
 	req.set_req_type(managarm::fs::CntReqType::DEV_OPEN);
@@ -271,7 +283,8 @@ openExternalDevice(helix::BorrowedLane lane,
 	}
 
 	auto file = smarter::make_shared<DeviceFile>(helix::UniqueLane{},
-			pull_pt.descriptor(), std::move(mount), std::move(link), std::move(status_mapping));
+			pull_pt.descriptor(), std::move(mount), std::move(link), std::move(status_mapping),
+			resp.caps() & managarm::fs::FileCaps::FC_POPULATE_MAPPINGS);
 	file->setupWeakFile(file);
 	helix::UniqueDescriptor file_fd_lane;
 
@@ -299,6 +312,13 @@ openExternalDevice(helix::BorrowedLane lane,
 }
 
 
+namespace {
+
+// Files attached by FD_SERVE, keyed by the credentials of the lanes that serve them.
+std::map<helix_ng::Credentials, smarter::weak_ptr<File>> servedFiles;
+
+} // anonymous namespace
+
 async::result<void> serveServerLane(helix::UniqueDescriptor lane) {
 	while(true) {
 		auto [accept, recv_req] = co_await helix_ng::exchangeMsgs(
@@ -333,8 +353,17 @@ async::result<void> serveServerLane(helix::UniqueDescriptor lane) {
 			auto process = findProcessWithCredentials(creds);
 
 			auto handle = helix::UniqueLane(recv_handle.descriptor());
+
+			char lane_creds[16];
+			HEL_CHECK(helGetCredentials(handle.getHandle(), 0, lane_creds));
+
 			auto dev_file = smarter::make_shared<PassthroughFile>(std::move(handle));
 			dev_file->setupWeakFile(dev_file);
+
+			std::erase_if(servedFiles, [] (auto &entry) {
+				return !entry.second.lock();
+			});
+			servedFiles.insert({helix_ng::Credentials{{lane_creds}}, dev_file->weakFile()});
 			auto file = File::constructHandle(std::move(dev_file));
 
 			auto fd = process->fileContext()->attachFile(file);
@@ -346,6 +375,32 @@ async::result<void> serveServerLane(helix::UniqueDescriptor lane) {
 				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
 			);
 			HEL_CHECK(send_resp.error());
+		}else if(req.request_type() == managarm::posix::CntReqType::FD_ACCESS_MEMORY) {
+			managarm::posix::SvrResponse resp;
+
+			smarter::shared_ptr<File> file;
+			auto it = servedFiles.find(helix_ng::CredentialsView{req.passthrough_credentials()});
+			if(it != servedFiles.end())
+				file = it->second.lock();
+
+			if(!file) {
+				resp.set_error(managarm::posix::Errors::NO_SUCH_FD);
+			}else{
+				resp.set_error(managarm::posix::Errors::SUCCESS);
+			}
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(send_resp.error());
+
+			if(file) {
+				auto memory = co_await file->accessMemory();
+				auto [push_memory] = co_await helix_ng::exchangeMsgs(conversation,
+					helix_ng::pushDescriptor(memory)
+				);
+				HEL_CHECK(push_memory.error());
+			}
 		}
 	}
 }
@@ -49,18 +49,16 @@ struct UeventAttribute : sysfs::Attribute {
 
 private:
 	UeventAttribute()
-	: sysfs::Attribute("uevent", true) { }
+	: sysfs::Attribute("uevent", true) {
+		_cacheable = true;
+	}
 
 public:
 	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override {
 		auto device = static_cast<Device *>(object);
 
-		UeventProperties ue;
-		device->composeStandardUevent(ue);
-		device->composeUevent(ue);
-
 		std::stringstream ss;
-		for(const auto &[name, value] : ue)
+		for(const auto &[name, value] : device->ueventProperties())
 			ss << name << '=' << value << '\n';
 
 		co_return ss.str();
@@ -70,12 +68,7 @@ public:
 		(void) data;
 
 		auto device = static_cast<Device *>(object);
-
-		UeventProperties ue;
-		device->composeStandardUevent(ue);
-		device->composeUevent(ue);
-
-		udev::emitAddEvent(device->getSysfsPath(), ue);
+		udev::emitAddEvent(device->getSysfsPath(), device->ueventProperties());
 		co_return Error::success;
 	}
 };
@@ -120,6 +113,19 @@ void Device::linkToSubsystem() {
 	// Nothing to do for devices outside of a subsystem.
 }
 
+const UeventProperties &Device::ueventProperties() {
+	// During coldplug, the properties are needed for the add event, for each read of the
+	// uevent attribute and for each synthetic add event; compose them only once.
+	auto generation = attributeGeneration();
+	if(_ueventGeneration != generation) {
+		_ueventCache = {};
+		composeStandardUevent(_ueventCache);
+		composeUevent(_ueventCache);
+		_ueventGeneration = generation;
+	}
+	return _ueventCache;
+}
+
 //-----------------------------------------------------------------------------
 // BusSubsystem and BusDevice implementation.
 //-----------------------------------------------------------------------------
@@ -243,6 +249,11 @@ std::shared_ptr<Device> getMbusDevice(mbus_ng::EntityId id) {
 	return {};
 }
 
+void mbusPropertiesChanged(mbus_ng::EntityId id) {
+	if(auto device = getMbusDevice(id); device)
+		device->invalidateAttributes();
+}
+
 void installDevice(std::shared_ptr<Device> device) {
 	device->setupDevicePtr(device);
 	device->addObject();
@@ -262,11 +273,7 @@ void installDevice(std::shared_ptr<Device> device) {
 			assert(!"Unsupported unix device trying to be added!");
 	}
 
-	UeventProperties ue;
-	device->composeStandardUevent(ue);
-	device->composeUevent(ue);
-
-	udev::emitAddEvent(device->getSysfsPath(), ue);
+	udev::emitAddEvent(device->getSysfsPath(), device->ueventProperties());
 }
 
 namespace udev {
@@ -286,7 +293,7 @@ void emitEvent(std::string buffer) {
 
 } // namespace
 
-void emitAddEvent(std::string devpath, UeventProperties &ue) {
+void emitAddEvent(std::string devpath, const UeventProperties &ue) {
 	std::stringstream ss;
 	ss << "add@/" << devpath << '\0';
 	ss << "ACTION=add" << '\0';
@@ -297,7 +304,7 @@ void emitAddEvent(std::string devpath, UeventProperties &ue) {
 	udev::emitEvent(ss.str());
 }
 
-void emitChangeEvent(std::string devpath, UeventProperties &ue) {
+void emitChangeEvent(std::string devpath, const UeventProperties &ue) {
 	std::stringstream ss;
 	ss << "change@/" << devpath << '\0';
 	ss << "ACTION=change" << '\0';
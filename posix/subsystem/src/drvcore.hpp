@@ -21,6 +21,14 @@ struct UeventProperties {
 		return map.end();
 	}
 
+	auto begin() const {
+		return map.begin();
+	}
+
+	auto end() const {
+		return map.end();
+	}
+
 	void set(std::string name, std::string value) {
 		map[name] = value;
 	}
@@ -97,6 +105,10 @@ public:
 
 	virtual void composeUevent(UeventProperties &) = 0;
 
+	// Returns the standard and device-specific uevent properties. The properties are
+	// only composed again after invalidateAttributes() was called.
+	const UeventProperties &ueventProperties();
+
 private:
 	std::weak_ptr<Device> _devicePtr;
 	UnixDevice *_unixDevice;
@@ -106,6 +118,9 @@ private:
 
 	std::unordered_map<std::string, std::shared_ptr<sysfs::Object>> classDirectories_;
 	std::unordered_map<std::string, std::shared_ptr<ClassDevice>> _classDevices;
+
+	std::optional<uint64_t> _ueventGeneration;
+	UeventProperties _ueventCache;
 };
 
 struct BusSubsystem : Subsystem {
@@ -191,13 +206,16 @@ sysfs::Object *virtualDeviceParent();
 void registerMbusDevice(mbus_ng::EntityId, std::shared_ptr<Device>);
 extern async::recurring_event mbusMapUpdate;
 std::shared_ptr<Device> getMbusDevice(mbus_ng::EntityId);
+// Called when the properties of an mbus entity change; this invalidates the cached
+// attributes of the corresponding device.
+void mbusPropertiesChanged(mbus_ng::EntityId);
 
 void installDevice(std::shared_ptr<Device> device);
 
 namespace udev {
 
-void emitAddEvent(std::string devpath, UeventProperties &ue);
-void emitChangeEvent(std::string devpath, UeventProperties &ue);
+void emitAddEvent(std::string devpath, const UeventProperties &ue);
+void emitChangeEvent(std::string devpath, const UeventProperties &ue);
 
 } // namespace udev
 
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <iostream>
 #include <print>
+#include <unordered_map>
 
 #include <async/recurring-event.hpp>
 #include <boost/intrusive/list.hpp>
@@ -19,6 +20,19 @@ constexpr int epollFlags = EPOLLET | EPOLLONESHOT | EPOLLWAKEUP | EPOLLEXCLUSIVE
 
 bool logEpoll = false;
 
+// Items with EPOLLEXCLUSIVE that watch the same file (from different epoll instances)
+// form a group. Only the first item that observes an edge becomes pending; the other
+// items keep waiting. This avoids waking up all epoll instances on each edge.
+struct ExclusiveGroup {
+	size_t numItems = 0;
+	// Sequence number of the last edge that made an item of the group pending.
+	uint64_t claimedSeq = 0;
+};
+
+// Since each item stores a strong pointer to its File,
+// the keys stay valid as long as the group has items.
+std::unordered_map<File *, ExclusiveGroup> exclusiveGroups;
+
 struct OpenFile : File {
 	// ------------------------------------------------------------------------
 	// Internal API.
@@ -78,6 +92,32 @@ private:
 		smarter::borrowed_ptr<Item> self;
 	};
 
+	static void _joinExclusive(Item *item) {
+		if(!(item->eventMask & EPOLLEXCLUSIVE))
+			return;
+		exclusiveGroups[item->file.get()].numItems++;
+	}
+
+	static void _leaveExclusive(Item *item) {
+		if(!(item->eventMask & EPOLLEXCLUSIVE))
+			return;
+		auto it = exclusiveGroups.find(item->file.get());
+		assert(it != exclusiveGroups.end());
+		if(!--it->second.numItems)
+			exclusiveGroups.erase(it);
+	}
+
+	// Returns false if another item of the exclusive group already handles this edge.
+	static bool _claimEdge(Item *item, uint64_t seq) {
+		if(!(item->eventMask & EPOLLEXCLUSIVE))
+			return true;
+		auto &group = exclusiveGroups.at(item->file.get());
+		if(seq <= group.claimedSeq)
+			return false;
+		group.claimedSeq = seq;
+		return true;
+	}
+
 	static void _awaitPoll(Item *item) {
 	reRunImmediately:
 		// First, destruct the operation so that we can re-use it later.
@@ -86,8 +126,9 @@ private:
 		assert(item->state & statePolling);
 		auto self = item->epoll.get();
 
-		// Discard non-active and closed items.
-		if(!(item->state & stateAlive)) {
+		// Discard closed items and disabled EPOLLONESHOT items.
+		// The latter are watched again once they are modified.
+		if(!(item->state & stateAlive) || !(item->state & stateActive)) {
 			item->state &= ~statePolling;
 			return;
 		}
@@ -104,7 +145,8 @@ private:
 		// This is the correct behavior for edge-triggered items.
 		// Level-triggered items stay pending until the event disappears.
 		auto result = resultOrError.value();
-		if(std::get<1>(result) & (item->eventMask | EPOLLERR | EPOLLHUP)) {
+		if((std::get<1>(result) & (item->eventMask | EPOLLERR | EPOLLHUP))
+				&& _claimEdge(item, std::get<0>(result))) {
 			if(logEpoll)
 				std::cout << "posix.epoll \e[1;34m" << item->epoll->structName() << "\e[0m"
 						<< ": Item \e[1;34m" << item->file->structName()
@@ -116,6 +158,8 @@ private:
 			if(!(item->state & statePending)) {
 				item->state |= statePending;
 
+				// Only items that see edges are enqueued, hence waitForEvents()
+				// does not need to look at idle items.
 				item->self.lock().ctr()->increment();
 				self->_pendingQueue.push_back(*item);
 				self->_currentSeq++;
@@ -129,7 +173,8 @@ private:
 						<< ": Item \e[1;34m" << item->file->structName()
 						<< "\e[0m still not pending after pollWait()."
 						<< " Mask is " << item->eventMask << ", while edges are "
-						<< std::get<1>(result) << std::endl;
+						<< std::get<1>(result) << " (at sequence " << std::get<0>(result) << ")"
+						<< std::endl;
 			item->cancelPoll.reset();
 			item->pollOperation.construct_with([&] {
 				return async::execution::connect(
@@ -159,10 +204,15 @@ public:
 		if(_fileMap.find({file.get(), fd}) != _fileMap.end()) {
 			return Error::alreadyExists;
 		}
+		// Like Linux, reject EPOLLEXCLUSIVE together with EPOLLONESHOT or for epoll files.
+		if((mask & EPOLLEXCLUSIVE)
+				&& ((mask & EPOLLONESHOT) || dynamic_cast<OpenFile *>(file.get())))
+			return Error::illegalArguments;
 
 		auto item = smarter::make_shared<Item>(smarter::static_pointer_cast<OpenFile>(weakFile().lock()),
 				process, std::move(file), mask, cookie);
 		item->self = item;
+		_joinExclusive(item.get());
 
 		item->state |= statePending | stateActive;
 
@@ -192,9 +242,10 @@ public:
 		item->cookie = cookie;
 		item->cancelPoll.cancel();
 
-		// Mark the item as pending.
+		// Mark the item as pending. This also re-enables disabled EPOLLONESHOT items.
+		item->state |= stateActive;
 		if(!(item->state & statePending)) {
-			item->state |= statePending | stateActive;
+			item->state |= statePending;
 
 			item.ctr()->increment();
 			_pendingQueue.push_back(*item);
@@ -218,6 +269,7 @@ public:
 
 		_fileMap.erase(it);
 		item->state &= ~stateAlive;
+		_leaveExclusive(item.get());
 		return Error::success;
 	}
 
@@ -282,8 +334,8 @@ public:
 				// Return pending items to the caller.
 				auto status = std::get<1>(result) & (itemEvents | EPOLLERR | EPOLLHUP);
 				if(status) {
-					if(item->eventMask & (EPOLLWAKEUP | EPOLLEXCLUSIVE))
-						std::println("posix.epoll \e[1;34m{}\e[0m: unhandled epoll flag {:#x}", structName(), item->eventMask & (EPOLLWAKEUP | EPOLLEXCLUSIVE));
+					if(item->eventMask & EPOLLWAKEUP)
+						std::println("posix.epoll \e[1;34m{}\e[0m: unhandled epoll flag {:#x}", structName(), item->eventMask & EPOLLWAKEUP);
 
 					assert(k < max_events);
 					memset(events + k, 0, sizeof(struct epoll_event));
@@ -295,7 +347,10 @@ public:
 						item->state &= ~stateActive;
 				}
 
-				if(!status || (item->eventMask & EPOLLET)) {
+				if(!(item->state & stateActive)) {
+					// Disabled EPOLLONESHOT items are not watched until modifyItem() re-arms them.
+					item->state &= ~statePending;
+				}else if(!status || (item->eventMask & EPOLLET)) {
 					item->state &= ~statePending;
 					if(!(item->state & statePolling)) {
 						item->state |= statePolling;
@@ -358,6 +413,7 @@ public:
 
 			it = _fileMap.erase(it);
 			item->state &= ~stateAlive;
+			_leaveExclusive(item.get());
 
 			if(item->state & statePolling)
 				item->cancelPoll.cancel();
@@ -1,9 +1,11 @@
 
+#include <atomic>
 #include <string.h>
 #include <sys/epoll.h>
 
 #include <async/recurring-event.hpp>
 #include <helix/ipc.hpp>
+#include <helix/memory.hpp>
 #include "eventfd.hpp"
 #include "process.hpp"
 
@@ -11,10 +13,20 @@ namespace eventfd {
 
 namespace {
 
+// Largest value that the counter can hold.
+constexpr uint64_t maxCounter = 0xFFFFFFFFFFFFFFFE;
+
 struct OpenFile : File {
 	OpenFile(unsigned int initval, bool nonBlock, bool semaphore)
 	: File{FileKind::unknown,  StructName::get("eventfd")}, _currentSeq{1}, _readableSeq{0},
-		_writeableSeq{0}, _counter{initval}, _nonBlock{nonBlock}, _semaphore{semaphore} { }
+		_writeableSeq{0}, _observed{initval}, _nonBlock{nonBlock}, _semaphore{semaphore} {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &handle));
+		_memory = helix::UniqueDescriptor{handle};
+		_mapping = helix::Mapping{_memory, 0, 0x1000};
+		_shared()->counter = initval;
+		_shared()->waiters = 0;
+	}
 
 	~OpenFile() override {
 	}
@@ -36,16 +48,16 @@ struct OpenFile : File {
 		if (max_length < 8)
 			co_return Error::illegalArguments;
 
+		_sync();
+
 		while (1) {
-			if (_counter) {
-				if(_semaphore) {
-					auto ptr = reinterpret_cast<uint64_t *>(data);
-					*ptr = 1;
-					_counter--;
-				} else {
-					memcpy(data, &_counter, 8);
-					_counter = 0;
-				}
+			auto value = _counter().load();
+			while (value) {
+				uint64_t num = _semaphore ? 1 : value;
+				if (!_counter().compare_exchange_weak(value, value - num))
+					continue;
+				memcpy(data, &num, 8);
+				_observed = value - num;
 				_writeableSeq = ++_currentSeq;
 				_doorbell.raise();
 				co_return 8;
@@ -53,8 +65,12 @@ struct OpenFile : File {
 
 			if (_nonBlock)
 				co_return Error::wouldBlock;
-			else
+
+			// Writers that bypass us check the waiter count after updating the counter.
+			_waiters().fetch_add(1);
+			if (!_counter().load())
 				co_await _doorbell.async_wait();
+			_waiters().fetch_sub(1);
 		}
 	}
 
@@ -69,18 +85,28 @@ struct OpenFile : File {
 		if(num == 0xFFFFFFFFFFFFFFFF)
 			co_return Error::illegalArguments;
 
-		if (num && num + _counter <= _counter) {
+		// Writing zero is also used to notify us about updates through the shared page.
+		_sync();
+
+		while (1) {
+			auto value = _counter().load();
+			while (num <= maxCounter - value) {
+				if (!_counter().compare_exchange_weak(value, value + num))
+					continue;
+				_observed = value + num;
+				_readableSeq = ++_currentSeq;
+				_doorbell.raise();
+				co_return length;
+			}
+
 			if (_nonBlock)
 				co_return Error::wouldBlock;
-			else
+
+			_waiters().fetch_add(1);
+			if (num > maxCounter - _counter().load())
 				co_await _doorbell.async_wait(); // wait for read
+			_waiters().fetch_sub(1);
 		}
-
-		_counter += num;
-
-		_readableSeq = ++_currentSeq;
-		_doorbell.raise();
-		co_return length;
 	}
 
 	async::result<frg::expected<Error, PollWaitResult>>
@@ -89,9 +115,12 @@ struct OpenFile : File {
 		(void)mask; // TODO: utilize mask.
 
 		assert(sequence <= _currentSeq);
+		_waiters().fetch_add(1);
+		_sync();
 		while (_currentSeq == sequence &&
 				!cancellation.is_cancellation_requested())
 			co_await _doorbell.async_wait(cancellation);
+		_waiters().fetch_sub(1);
 
 		int edges = 0;
 		if (_readableSeq > sequence)
@@ -104,20 +133,51 @@ struct OpenFile : File {
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
+		_sync();
+
 		int events = 0;
-		if (_counter > 0)
+		if (_observed > 0)
 			events |= EPOLLIN;
-		if (_counter < 0xFFFFFFFFFFFFFFFF)
+		if (_observed < maxCounter)
 			events |= EPOLLOUT;
 
 		co_return PollStatusResult(_currentSeq, events);
 	}
 
+	FutureMaybe<helix::UniqueDescriptor> accessMemory() override {
+		co_return _memory.dup();
+	}
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _passthrough;
 	}
 
 private:
+	SharedCounter *_shared() {
+		return reinterpret_cast<SharedCounter *>(_mapping.get());
+	}
+
+	std::atomic_ref<uint64_t> _counter() {
+		return std::atomic_ref<uint64_t>{_shared()->counter};
+	}
+
+	std::atomic_ref<uint32_t> _waiters() {
+		return std::atomic_ref<uint32_t>{_shared()->waiters};
+	}
+
+	// Raises edges for updates that were done through the shared page.
+	void _sync() {
+		auto value = _counter().load();
+		if (value == _observed)
+			return;
+		if (value > _observed)
+			_readableSeq = ++_currentSeq;
+		else
+			_writeableSeq = ++_currentSeq;
+		_observed = value;
+		_doorbell.raise();
+	}
+
 	helix::UniqueLane _passthrough;
 	async::recurring_event _doorbell;
 	async::cancellation_event cancelServe_;
@@ -126,7 +186,10 @@ private:
 	uint64_t _readableSeq;
 	uint64_t _writeableSeq;
 
-	uint64_t _counter;
+	helix::UniqueDescriptor _memory;
+	helix::Mapping _mapping;
+	// Last value of the counter that edges were raised for.
+	uint64_t _observed;
 	bool _nonBlock;
 	bool _semaphore;
 };
@@ -3,6 +3,15 @@
 
 namespace eventfd {
 
+// Layout of the page that is returned by accessMemory() (i.e., that is mapped by mmap()).
+// Processes may update the counter with atomic operations without sending requests.
+// If waiters is non-zero after such an update, blocked threads must be woken up
+// by writing zero to the eventfd.
+struct SharedCounter {
+	uint64_t counter;
+	uint32_t waiters;
+};
+
 smarter::shared_ptr<File, FileHandle> createFile(unsigned int initval, bool nonBlock, bool semaphore);
 
 }
@@ -3,7 +3,9 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/auxv.h>
+#include <algorithm>
 #include <iostream>
+#include <map>
 
 #include "vfs.hpp"
 #include "exec.hpp"
@@ -11,12 +13,6 @@
 
 constexpr size_t kPageSize = 0x1000;
 
-// This struct is parsed before knowing the type of executable (PIE vs. non-PIE)
-// and also before knowing the ELF's base address.
-struct ImagePreamble {
-	bool isPie = false;
-};
-
 // This struct contains the image meta data with correct base address applied.
 struct ImageInfo {
 	ImageInfo()
@@ -28,12 +24,73 @@ struct ImageInfo {
 	size_t phdrCount;
 };
 
-async::result<frg::expected<Error, ImagePreamble>>
-parseElfPreamble(SharedFilePtr file) {
-	ImagePreamble preamble;
+namespace {
+
+// Maximal number of images in the image cache.
+constexpr size_t maxCachedImages = 64;
+
+// Parsed ELF headers and the initial contents of the writable segments of an image.
+// Executing hot binaries (and ld-init.so) reuses them instead of going through the
+// file protocol again.
+struct CachedImage {
+	// Used to detect modifications of the file.
+	uint64_t mtimeSecs, mtimeNanos;
+	uint64_t fileSize;
 
-	// Read the elf file header and verify the signature.
 	Elf64_Ehdr ehdr;
+	std::vector<char> phdrBuffer;
+	// Indexed by PHDR. Only valid for writable PT_LOAD segments; the data is mapped
+	// copy-on-write and thus never modified.
+	std::vector<helix::UniqueDescriptor> segmentMemory;
+
+	uint64_t lastUse = 0;
+};
+
+struct ImageIdentity {
+	// Null if the image cannot be cached.
+	FsSuperblock *superblock;
+	FileStats stats;
+};
+
+std::map<std::pair<FsSuperblock *, uint64_t>, std::shared_ptr<CachedImage>> imageCache;
+uint64_t imageUseCounter = 0;
+
+async::result<ImageIdentity> identifyImage(SharedFilePtr file) {
+	auto node = file->associatedLink()->getTarget();
+	auto stats = co_await node->getStats();
+	if(!stats)
+		co_return ImageIdentity{nullptr, {}};
+	co_return ImageIdentity{node->superblock(), stats.value()};
+}
+
+std::shared_ptr<CachedImage> findCachedImage(const ImageIdentity &identity) {
+	if(!identity.superblock)
+		return nullptr;
+	auto it = imageCache.find({identity.superblock, identity.stats.inodeNumber});
+	if(it == imageCache.end())
+		return nullptr;
+
+	auto image = it->second;
+	if(image->mtimeSecs != identity.stats.mtimeSecs
+			|| image->mtimeNanos != identity.stats.mtimeNanos
+			|| image->fileSize != identity.stats.fileSize) {
+		imageCache.erase(it);
+		return nullptr;
+	}
+	image->lastUse = ++imageUseCounter;
+	return image;
+}
+
+// Reads the headers and writable segments of an ELF file and inserts them into the cache.
+async::result<frg::expected<Error, std::shared_ptr<CachedImage>>>
+loadImage(SharedFilePtr file, const ImageIdentity &identity) {
+	auto image = std::make_shared<CachedImage>();
+	image->mtimeSecs = identity.stats.mtimeSecs;
+	image->mtimeNanos = identity.stats.mtimeNanos;
+	image->fileSize = identity.stats.fileSize;
+
+	// Read the elf file header and verify the signature.
+	auto &ehdr = image->ehdr;
 	FRG_CO_TRY(co_await file->seek(0, VfsSeek::absolute));
 	FRG_CO_TRY(co_await file->readExactly(nullptr, &ehdr, sizeof(Elf64_Ehdr)));
 
@@ -44,51 +101,92 @@ parseElfPreamble(SharedFilePtr file) {
 		co_return Error::badExecutable;
 	if(ehdr.e_type != ET_EXEC && ehdr.e_type != ET_DYN)
 		co_return Error::badExecutable;
+	if(ehdr.e_phentsize < sizeof(Elf64_Phdr))
+		co_return Error::badExecutable;
+
+	// Read the elf program headers.
+	image->phdrBuffer.resize(ehdr.e_phnum * size_t(ehdr.e_phentsize));
+	FRG_CO_TRY(co_await file->seek(ehdr.e_phoff, VfsSeek::absolute));
+	FRG_CO_TRY(co_await file->readExactly(nullptr,
+			image->phdrBuffer.data(), image->phdrBuffer.size()));
+
+	// Read the contents of writable segments.
+	image->segmentMemory.resize(ehdr.e_phnum);
+	for(int i = 0; i < ehdr.e_phnum; i++) {
+		auto phdr = (Elf64_Phdr *)(image->phdrBuffer.data() + i * ehdr.e_phentsize);
+		if(phdr->p_type != PT_LOAD || !phdr->p_memsz || !(phdr->p_flags & PF_W))
+			continue;
+		if(phdr->p_filesz > phdr->p_memsz)
+			co_return Error::badExecutable;
+
+		size_t misalign = phdr->p_vaddr & (kPageSize - 1);
+		size_t mapLength = (phdr->p_memsz + misalign + kPageSize - 1) & ~(kPageSize - 1);
+
+		HelHandle segmentHandle;
+		HEL_CHECK(helAllocateMemory(mapLength, 0, nullptr, &segmentHandle));
+		helix::UniqueDescriptor segmentMemory{segmentHandle};
+
+		void *window;
+		HEL_CHECK(helMapMemory(segmentHandle, kHelNullHandle, nullptr,
+				0, mapLength, kHelMapProtRead | kHelMapProtWrite, &window));
+
+		memset(window, 0, mapLength);
+		auto seekResult = co_await file->seek(phdr->p_offset, VfsSeek::absolute);
+		auto readResult = seekResult
+				? co_await file->readExactly(nullptr, (char *)window + misalign, phdr->p_filesz)
+				: frg::expected<Error>{seekResult.error()};
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, window, mapLength));
+		if(!readResult)
+			co_return readResult.error();
+
+		image->segmentMemory[i] = std::move(segmentMemory);
+	}
 
-	// Right now we treat every ET_DYN object as PIE and unconditionally apply
-	// a non-zero base address.
-	if(ehdr.e_type == ET_DYN)
-		preamble.isPie = true;
+	if(!identity.superblock)
+		co_return image;
 
-	co_return preamble;
+	if(imageCache.size() >= maxCachedImages) {
+		auto victim = std::min_element(imageCache.begin(), imageCache.end(),
+				[] (const auto &a, const auto &b) {
+			return a.second->lastUse < b.second->lastUse;
+		});
+		imageCache.erase(victim);
+	}
+	image->lastUse = ++imageUseCounter;
+	imageCache[{identity.superblock, identity.stats.inodeNumber}] = image;
+	co_return image;
+}
+
+async::result<frg::expected<Error, std::shared_ptr<CachedImage>>>
+accessImage(SharedFilePtr file) {
+	auto identity = co_await identifyImage(file);
+	if(auto image = findCachedImage(identity); image)
+		co_return image;
+	co_return co_await loadImage(std::move(file), identity);
+}
+
+// Right now we treat every ET_DYN object as PIE and unconditionally apply
+// a non-zero base address.
+bool isPie(const CachedImage &image) {
+	return image.ehdr.e_type == ET_DYN;
 }
 
 async::result<frg::expected<Error, ImageInfo>>
-loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
+loadElfImage(SharedFilePtr file, const CachedImage &image, VmContext *vmContext, uintptr_t base) {
 	assert(!(base & (kPageSize - 1))); // Callers need to ensure this.
 	ImageInfo info;
 
 	// Get a handle to the file's memory.
 	auto fileMemory = co_await file->accessMemory();
 
-	// Read the elf file header and verify the signature.
-	Elf64_Ehdr ehdr;
-	FRG_CO_TRY(co_await file->seek(0, VfsSeek::absolute));
-	FRG_CO_TRY(co_await file->readExactly(nullptr, &ehdr, sizeof(Elf64_Ehdr)));
-
-	// Verify the ELF file again, since loadElfPreamble() is not necessarily called
-	// on every object that we load.
-	if(!(ehdr.e_ident[0] == 0x7F
-			&& ehdr.e_ident[1] == 'E'
-			&& ehdr.e_ident[2] == 'L'
-			&& ehdr.e_ident[3] == 'F'))
-		co_return Error::badExecutable;
-	if(ehdr.e_type != ET_EXEC && ehdr.e_type != ET_DYN)
-		co_return Error::badExecutable;
-
+	auto &ehdr = image.ehdr;
 	info.entryIp = (char *)base + ehdr.e_entry;
 	info.phdrEntrySize = ehdr.e_phentsize;
 	info.phdrCount = ehdr.e_phnum;
 
-	// Read the elf program headers and load them into the address space.
-	std::vector<char> phdrBuffer;
-	phdrBuffer.resize(ehdr.e_phnum * ehdr.e_phentsize);
-	FRG_CO_TRY(co_await file->seek(ehdr.e_phoff, VfsSeek::absolute));
-	FRG_CO_TRY(co_await file->readExactly(nullptr,
-			phdrBuffer.data(), ehdr.e_phnum * size_t(ehdr.e_phentsize)));
-
+	// Load the elf program headers into the address space.
 	for(int i = 0; i < ehdr.e_phnum; i++) {
-		auto phdr = (Elf64_Phdr *)(phdrBuffer.data() + i * ehdr.e_phentsize);
+		auto phdr = (const Elf64_Phdr *)(image.phdrBuffer.data() + i * ehdr.e_phentsize);
 
 		if(phdr->p_type == PT_LOAD) {
 			if(!phdr->p_memsz) // Skip empty segments.
@@ -130,31 +228,16 @@ loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
 					co_return Error::badExecutable;
 				}
 			}else{
-				// Map the segment with write permission into this address space.
-				HelHandle segmentHandle;
-				HEL_CHECK(helAllocateMemory(mapLength, 0, nullptr, &segmentHandle));
-
-				void *window;
-				HEL_CHECK(helMapMemory(segmentHandle, kHelNullHandle, nullptr,
-						0, mapLength, kHelMapProtRead | kHelMapProtWrite, &window));
-
-				// Map the segment with correct permissions into the process.
+				// Map a copy-on-write view of the cached segment contents into the process.
 				if((phdr->p_flags & (PF_R | PF_W | PF_X)) == (PF_R | PF_W)) {
 					FRG_CO_TRY(co_await vmContext->mapFile(mapAddress,
-							helix::UniqueDescriptor{segmentHandle}, file,
+							image.segmentMemory[i].dup(), file,
 							0, mapLength, true,
 							kHelMapProtRead | kHelMapProtWrite));
 				}else{
 					std::cout << "posix: Illegal combination of segment permissions" << std::endl;
 					co_return Error::badExecutable;
 				}
-
-				// Read the segment contents from the file.
-				memset(window, 0, mapLength);
-				FRG_CO_TRY(co_await file->seek(phdr->p_offset, VfsSeek::absolute));
-				FRG_CO_TRY(co_await file->readExactly(nullptr,
-						(char *)window + misalign, phdr->p_filesz));
-				HEL_CHECK(helUnmapMemory(kHelNullHandle, window, mapLength));
 			}
 		}else if(phdr->p_type == PT_PHDR) {
 			info.phdrPtr = (char *)base + phdr->p_vaddr;
@@ -172,6 +255,8 @@ loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
 	co_return info;
 }
 
+} // anonymous namespace
+
 template<typename T, size_t N>
 void *copyArrayToStack(void *window, size_t &d, const T (&value)[N]) {
 	assert(d >= alignof(T) + sizeof(T) * N);
@@ -193,18 +278,25 @@ execute(ViewPath root, ViewPath workdir,
 	auto execFile = FRG_CO_TRY(co_await open(root, workdir, path, self));
 	assert(execFile); // If open() succeeds, it must return a non-null file.
 
+	std::shared_ptr<CachedImage> execImage;
 	int nRecursions = 0;
 	while(true) {
+		// Cached images are ELF files, hence there is no need to look for a shebang.
+		auto identity = co_await identifyImage(execFile);
+		if(execImage = findCachedImage(identity); execImage)
+			break;
+
 		if(nRecursions > 8) {
 			std::cout << "posix: More than 8 shebang recursions" << std::endl;
 			co_return Error::badExecutable;
 		}
 
 		char shebangPrefix[2];
-		if(!(co_await execFile->readExactly(nullptr, shebangPrefix, 2)))
-			break;
-		if(shebangPrefix[0] != '#' && shebangPrefix[1] != '!')
+		if(!(co_await execFile->readExactly(nullptr, shebangPrefix, 2))
+				|| (shebangPrefix[0] != '#' && shebangPrefix[1] != '!')) {
+			execImage = FRG_CO_TRY(co_await loadImage(execFile, identity));
 			break;
+		}
 
 		std::string shebangStr;
 		while(true) {
@@ -255,19 +347,22 @@ execute(ViewPath root, ViewPath workdir,
 		nRecursions++;
 	}
 
-	auto execPreamble = FRG_CO_TRY(co_await parseElfPreamble(execFile));
 	ImageInfo execInfo;
-	if(execPreamble.isPie) {
+	if(isPie(*execImage)) {
 		// Unconditionally apply a non-zero base address to PIE objects.
-		execInfo = FRG_CO_TRY(co_await loadElfImage(execFile, vmContext.get(), 0x200000));
+		execInfo = FRG_CO_TRY(co_await loadElfImage(execFile, *execImage,
+				vmContext.get(), 0x200000));
 	}else{
-		execInfo = FRG_CO_TRY(co_await loadElfImage(execFile, vmContext.get(), 0));
+		execInfo = FRG_CO_TRY(co_await loadElfImage(execFile, *execImage,
+				vmContext.get(), 0));
 	}
 
 	// TODO: Should we really look up the dynamic linker in the current working dir?
 	auto ldsoFile = FRG_CO_TRY(co_await open(root, workdir, "/usr/lib/ld-init.so", self));
 	assert(ldsoFile); // If open() succeeds, it must return a non-null file.
-	auto ldsoInfo = FRG_CO_TRY(co_await loadElfImage(ldsoFile, vmContext.get(), 0x40000000));
+	auto ldsoImage = FRG_CO_TRY(co_await accessImage(ldsoFile));
+	auto ldsoInfo = FRG_CO_TRY(co_await loadElfImage(ldsoFile, *ldsoImage,
+			vmContext.get(), 0x40000000));
 
 	constexpr size_t stackSize = 0x200000;
 
@@ -1,5 +1,9 @@
 #include <sys/epoll.h>
+#include <algorithm>
+#include <list>
 #include <map>
+#include <optional>
+#include <unordered_map>
 
 #include <frg/std_compat.hpp>
 #include <protocols/fs/client.hpp>
@@ -14,6 +18,17 @@ namespace extern_fs {
 
 namespace {
 
+// Maximal number of dentry cache entries per superblock.
+constexpr size_t maxDentries = 4096;
+
+// Maximal number of bytes that OpenFile::copyTo() reads from the page cache at once.
+constexpr size_t maxPageCacheChunk = 256 * 1024;
+
+// Maximal number of revoked attribute leases per WatchAttributesRequest.
+constexpr size_t maxRevokedLeases = 512;
+
+DentryCacheStats dentryCacheStats;
+
 struct Node;
 struct DirectoryNode;
 
@@ -43,17 +58,57 @@ struct Superblock final : FsSuperblock {
 	std::shared_ptr<FsLink> internalizePeripheralLink(Node *parent, std::string name,
 			std::shared_ptr<Node> target);
 
+	// The dentry cache maps (parent inode, name) to the link or to nullptr if no such link
+	// exists. ext2fs is only modified through this superblock, hence we keep the cache
+	// coherent by updating it whenever we modify a directory.
+	// Returns std::nullopt on cache misses.
+	std::optional<std::shared_ptr<FsLink>> lookupDentry(uint64_t parent, const std::string &name);
+	void insertDentry(uint64_t parent, const std::string &name, std::shared_ptr<FsLink> link);
+	void invalidateDentry(uint64_t parent, const std::string &name);
+	// Drops all entries of a directory.
+	void invalidateDirectory(uint64_t parent);
+
+	// Nodes cache their attributes while the server grants a lease on them.
+	// Modifications through this superblock invalidate all cached attributes since the
+	// server's revocation might only arrive after the modifying request completed.
+	uint64_t attributesEpoch() {
+		return _attributesEpoch;
+	}
+
+	void invalidateAttributes() {
+		_attributesEpoch++;
+	}
+
 private:
+	async::detached watchAttributes();
+
+	struct Dentry {
+		std::shared_ptr<FsLink> link;
+		std::list<std::pair<uint64_t, std::string>>::iterator lruIt;
+	};
+
 	helix::UniqueLane _lane;
 	std::map<uint64_t, std::weak_ptr<DirectoryNode>> _activeStructural;
 	std::map<uint64_t, std::weak_ptr<Node>> _activePeripheralNodes;
 	std::map<std::tuple<uint64_t, std::string, uint64_t>, std::weak_ptr<FsLink>> _activePeripheralLinks;
 
+	std::unordered_map<uint64_t, std::unordered_map<std::string, Dentry>> _dentries;
+	// Most recently used entries first.
+	std::list<std::pair<uint64_t, std::string>> _dentryLru;
+
+	uint64_t _attributesEpoch = 0;
+
 	std::shared_ptr<UnixDevice> device_;
 };
 
 struct Node : FsNode {
 	async::result<frg::expected<Error, FileStats>> getStats() override {
+		auto sb = static_cast<Superblock *>(superblock());
+		if(_cachedStats && _cachedEpoch == sb->attributesEpoch())
+			co_return *_cachedStats;
+		auto epoch = sb->attributesEpoch();
+		auto generation = _statsGeneration;
+
 		managarm::fs::CntRequest req;
 		req.set_req_type(managarm::fs::CntReqType::NODE_GET_STATS);
 
@@ -87,6 +142,12 @@ struct Node : FsNode {
 		stats.ctimeSecs = resp.ctime_secs();
 		stats.ctimeNanos = resp.ctime_nanos();
 
+		// Do not cache the attributes if they were modified while the request was in flight.
+		if(resp.lease() && epoch == sb->attributesEpoch() && generation == _statsGeneration) {
+			_cachedStats = stats;
+			_cachedEpoch = epoch;
+		}
+
 		co_return stats;
 	}
 
@@ -110,6 +171,7 @@ struct Node : FsNode {
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		static_cast<Superblock *>(superblock())->invalidateAttributes();
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 
 		co_return Error::success;
@@ -148,6 +210,7 @@ struct Node : FsNode {
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		static_cast<Superblock *>(superblock())->invalidateAttributes();
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 
 		co_return Error::success;
@@ -178,15 +241,27 @@ public:
 		return _self;
 	}
 
+	// Called when the server revokes the attribute lease.
+	void revokeStats() {
+		_cachedStats.reset();
+		_statsGeneration++;
+	}
+
 private:
 	std::weak_ptr<Node> _self;
 	uint64_t _inode;
 	helix::UniqueLane _lane;
+
+	std::optional<FileStats> _cachedStats;
+	uint64_t _cachedEpoch = 0;
+	uint64_t _statsGeneration = 0;
 };
 
 struct OpenFile final : File {
 private:
 	async::result<frg::expected<Error, off_t>> seek(off_t offset, VfsSeek whence) override {
+		if(whence == VfsSeek::relative)
+			co_return co_await _file.seekRelative(offset);
 		assert(whence == VfsSeek::absolute);
 		co_await _file.seekAbsolute(offset);
 		co_return offset;
@@ -199,6 +274,103 @@ private:
 		co_return length;
 	}
 
+	async::result<frg::expected<Error, size_t>>
+	writeAll(Process *, const void *data, size_t length) override {
+		size_t progress = 0;
+		while(progress < length)
+			progress += co_await _file.writeSome(static_cast<const char *>(data) + progress,
+					length - progress);
+		invalidateAttributes();
+		co_return length;
+	}
+
+	async::result<frg::expected<Error, size_t>>
+	pwrite(Process *, int64_t offset, const void *data, size_t length) override {
+		managarm::fs::CntRequest req;
+		req.set_req_type(managarm::fs::CntReqType::PT_PWRITE);
+		req.set_offset(offset);
+		req.set_size(length);
+
+		auto ser = req.SerializeAsString();
+		auto [offer, send_req, imbue_creds, send_data, recv_resp]
+				= co_await helix_ng::exchangeMsgs(getPassthroughLane(),
+			helix_ng::offer(
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::imbueCredentials(),
+				helix_ng::sendBuffer(data, length),
+				helix_ng::recvInline()
+			)
+		);
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send_req.error());
+		HEL_CHECK(imbue_creds.error());
+		HEL_CHECK(send_data.error());
+		HEL_CHECK(recv_resp.error());
+
+		managarm::fs::SvrResponse resp;
+		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+		recv_resp.reset();
+		invalidateAttributes();
+		if(resp.error() == managarm::fs::Errors::NO_SPACE_LEFT)
+			co_return Error::noSpaceLeft;
+		if(resp.error() != managarm::fs::Errors::SUCCESS)
+			co_return Error::ioError;
+		co_return resp.size();
+	}
+
+	async::result<frg::expected<Error, size_t>>
+	copyTo(Process *process, std::optional<int64_t> offset,
+			File *target, std::optional<int64_t> targetOffset, size_t length) override {
+		auto node = static_cast<Node *>(associatedLink()->getTarget().get());
+
+		// Files on the same file system are copied by the server.
+		if(auto other = dynamic_cast<OpenFile *>(target); other) {
+			auto otherNode = static_cast<Node *>(other->associatedLink()->getTarget().get());
+			if(otherNode->superblock() == node->superblock()) {
+				int64_t position = targetOffset ? *targetOffset
+						: co_await other->_file.seekRelative(0);
+				auto result = co_await _file.copyFileRange(offset,
+						otherNode->getInode(), position, length);
+				invalidateAttributes();
+				if(!result) {
+					if(result.error() == protocols::fs::Error::illegalArguments)
+						co_return Error::illegalArguments;
+					if(result.error() == protocols::fs::Error::noSpaceLeft)
+						co_return Error::noSpaceLeft;
+					co_return Error::ioError;
+				}
+				if(!targetOffset)
+					co_await other->_file.seekAbsolute(position + result.value());
+				co_return result.value();
+			}
+		}
+
+		// Otherwise (e.g., for sockets), read from the page cache directly
+		// instead of bouncing the data through the file protocol.
+		auto stats = FRG_CO_TRY(co_await node->getStats());
+		int64_t position = offset ? *offset : co_await _file.seekRelative(0);
+		if(position < 0)
+			co_return Error::illegalArguments;
+		if(static_cast<uint64_t>(position) >= stats.fileSize)
+			co_return 0;
+		auto chunk = std::min({length, static_cast<size_t>(stats.fileSize - position),
+				maxPageCacheChunk});
+
+		std::vector<char> buffer(chunk);
+		auto memory = co_await _file.accessMemory();
+		auto load = co_await helix_ng::readMemory(memory, position, chunk, buffer.data());
+		HEL_CHECK(load.error());
+
+		auto written = targetOffset
+			? co_await target->pwrite(process, *targetOffset, buffer.data(), chunk)
+			: co_await target->writeAll(process, buffer.data(), chunk);
+		if(!written)
+			co_return written.error();
+		if(!offset)
+			co_await _file.seekAbsolute(position + written.value());
+		co_return written.value();
+	}
+
 	async::result<frg::expected<Error, PollWaitResult>>
 	pollWait(Process *, uint64_t sequence, int mask,
 			async::cancellation_token cancellation) override {
@@ -261,11 +433,18 @@ public:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		invalidateAttributes();
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 		co_return {};
 	}
 
 private:
+	// Writes change the attributes of the node, see Superblock::invalidateAttributes().
+	void invalidateAttributes() {
+		auto node = associatedLink()->getTarget();
+		static_cast<Superblock *>(node->superblock())->invalidateAttributes();
+	}
+
 	helix::UniqueLane _control;
 	protocols::fs::File _file;
 	bool _append;
@@ -318,6 +497,7 @@ private:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		static_cast<Superblock *>(superblock())->invalidateAttributes();
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 
 		auto file = smarter::make_shared<OpenFile>(pull_ctrl.descriptor(),
@@ -397,6 +577,10 @@ public:
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
+
+		// ext2fs stops traversals at obstructed links.
+		auto owner = static_cast<Node *>(_owner.get());
+		static_cast<Superblock *>(owner->superblock())->invalidateDentry(owner->getInode(), _name);
 		co_return frg::success_tag{};
 	}
 
@@ -476,6 +660,17 @@ private:
 
 	async::result<frg::expected<Error, std::pair<std::shared_ptr<FsLink>, size_t>>>
 	traverseLinks(std::deque<std::string> path) override {
+		// On cache hits, resolve a single component; PathResolver calls us again for the rest.
+		assert(!path.empty());
+		if(auto cached = _sb->lookupDentry(getInode(), path.front()); cached) {
+			auto &link = *cached;
+			if(!link)
+				co_return Error::noSuchFile;
+			if(path.size() > 1 && link->getTarget()->getType() == VfsType::regular)
+				co_return Error::notDirectory;
+			co_return std::make_pair(std::move(link), size_t{1});
+		}
+
 		managarm::fs::NodeTraverseLinksRequest req;
 		for (auto &i : path)
 			req.add_path_segments(i);
@@ -501,6 +696,9 @@ private:
 		recv_resp.reset();
 
 		if (resp.error() == managarm::fs::Errors::FILE_NOT_FOUND) {
+			// We only know which component is missing if there is a single one.
+			if (path.size() == 1)
+				_sb->insertDentry(getInode(), path.front(), nullptr);
 			co_return Error::noSuchFile;
 		} else if (resp.error() == managarm::fs::Errors::NOT_DIRECTORY) {
 			co_return Error::notDirectory;
@@ -527,6 +725,7 @@ private:
 					|| resp.file_type() == managarm::fs::FileType::DIRECTORY) {
 				auto child = _sb->internalizeStructural(parentNode.get(), path[i],
 						resp.ids()[i], pull_node.descriptor());
+				_sb->insertDentry(parentNode->getInode(), path[i], child->treeLink());
 				if (i != resp.ids().size() - 1)
 					parentNode = child;
 				else
@@ -535,6 +734,7 @@ private:
 				auto child = _sb->internalizePeripheralNode(resp.file_type(), resp.ids()[i],
 						pull_node.descriptor());
 				link = _sb->internalizePeripheralLink(parentNode.get(), path[i], std::move(child));
+				_sb->insertDentry(parentNode->getInode(), path[i], link);
 			}
 		}
 
@@ -563,11 +763,15 @@ private:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recvResp.data(), recvResp.length());
 		recvResp.reset();
+		_sb->invalidateAttributes();
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
 			HEL_CHECK(pullNode.error());
 
+			// The inode might belong to a directory that was removed before; drop its entries.
+			_sb->invalidateDirectory(resp.id());
 			auto child = _sb->internalizeStructural(this, name,
 					resp.id(), pullNode.descriptor());
+			_sb->insertDentry(getInode(), name, child->treeLink());
 			co_return child->treeLink();
 		} else {
 			co_return Error::illegalOperationTarget; // TODO
@@ -601,6 +805,8 @@ private:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recvResp.data(), recvResp.length());
 		recvResp.reset();
+		_sb->invalidateAttributes();
+		_sb->invalidateDentry(getInode(), name);
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
 			HEL_CHECK(pullNode.error());
 
@@ -622,6 +828,9 @@ private:
 
 	async::result<frg::expected<Error, std::shared_ptr<FsLink>>>
 			getLink(std::string name) override {
+		if(auto cached = _sb->lookupDentry(getInode(), name); cached)
+			co_return std::move(*cached);
+
 		managarm::fs::CntRequest req;
 		req.set_req_type(managarm::fs::CntReqType::NODE_GET_LINK);
 		req.set_path(name);
@@ -644,16 +853,20 @@ private:
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
 			HEL_CHECK(pull_node.error());
 
+			std::shared_ptr<FsLink> link;
 			if(resp.file_type() == managarm::fs::FileType::DIRECTORY) {
 				auto child = _sb->internalizeStructural(this, name,
 						resp.id(), pull_node.descriptor());
-				co_return child->treeLink();
+				link = child->treeLink();
 			}else{
 				auto child = _sb->internalizePeripheralNode(resp.file_type(), resp.id(),
 						pull_node.descriptor());
-				co_return _sb->internalizePeripheralLink(this, name, std::move(child));
+				link = _sb->internalizePeripheralLink(this, name, std::move(child));
 			}
+			_sb->insertDentry(getInode(), name, link);
+			co_return link;
 		}else if(resp.error() == managarm::fs::Errors::FILE_NOT_FOUND) {
+			_sb->insertDentry(getInode(), name, nullptr);
 			co_return nullptr;
 		}else{
 			assert(resp.error() == managarm::fs::Errors::NOT_DIRECTORY);
@@ -683,6 +896,8 @@ private:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		_sb->invalidateAttributes();
+		_sb->invalidateDentry(getInode(), name);
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
 			HEL_CHECK(pull_node.error());
 
@@ -719,6 +934,8 @@ private:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		_sb->invalidateAttributes();
+		_sb->invalidateDentry(getInode(), name);
 		if(resp.error() == managarm::fs::Errors::FILE_NOT_FOUND)
 			co_return Error::noSuchFile;
 		else if(resp.error() == managarm::fs::Errors::DIRECTORY_NOT_EMPTY)
@@ -747,6 +964,9 @@ private:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		_sb->invalidateAttributes();
+		// Entries of the removed directory are dropped once its inode is reused (see mkdir()).
+		_sb->invalidateDentry(getInode(), name);
 
 		if(resp.error() == managarm::fs::Errors::DIRECTORY_NOT_EMPTY) {
 			co_return Error::directoryNotEmpty;
@@ -798,6 +1018,7 @@ private:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		_sb->invalidateAttributes();
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 
 		auto file = smarter::make_shared<OpenFile>(pull_ctrl.descriptor(),
@@ -826,7 +1047,52 @@ std::shared_ptr<FsNode> StructuralLink::getTarget() {
 }
 
 Superblock::Superblock(helix::UniqueLane lane, std::shared_ptr<UnixDevice> device)
-: _lane{std::move(lane)}, device_{device} { }
+: _lane{std::move(lane)}, device_{device} {
+	watchAttributes();
+}
+
+async::detached Superblock::watchAttributes() {
+	std::vector<int64_t> inodes(maxRevokedLeases);
+	while(true) {
+		managarm::fs::WatchAttributesRequest req;
+		req.set_max_inodes(inodes.size());
+
+		auto [offer, send_req, recv_resp, recv_inodes] = co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline(),
+				helix_ng::recvBuffer(inodes.data(), inodes.size() * sizeof(int64_t))
+			)
+		);
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send_req.error());
+		// Servers that do not support leases never grant them.
+		if(recv_resp.error())
+			co_return;
+
+		auto resp = bragi::parse_head_only<managarm::fs::WatchAttributesReply>(recv_resp);
+		recv_resp.reset();
+		if(!resp || resp->error() != managarm::fs::Errors::SUCCESS)
+			co_return;
+		HEL_CHECK(recv_inodes.error());
+		assert(resp->num_inodes() <= inodes.size());
+
+		for(size_t i = 0; i < resp->num_inodes(); i++) {
+			auto structural = _activeStructural.find(inodes[i]);
+			if(structural != _activeStructural.end()) {
+				if(auto node = structural->second.lock(); node)
+					node->revokeStats();
+			}
+
+			auto peripheral = _activePeripheralNodes.find(inodes[i]);
+			if(peripheral != _activePeripheralNodes.end()) {
+				if(auto node = peripheral->second.lock(); node)
+					node->revokeStats();
+			}
+		}
+	}
+}
 
 FutureMaybe<std::shared_ptr<FsNode>> Superblock::createRegular(Process *process) {
 	managarm::fs::CntRequest req;
@@ -849,6 +1115,7 @@ FutureMaybe<std::shared_ptr<FsNode>> Superblock::createRegular(Process *process)
 	managarm::fs::SvrResponse resp;
 	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 	recv_resp.reset();
+	invalidateAttributes();
 	if(resp.error() == managarm::fs::Errors::SUCCESS) {
 		HEL_CHECK(pull_node.error());
 
@@ -892,6 +1159,9 @@ async::result<frg::expected<Error, std::shared_ptr<FsLink>>>
 	managarm::fs::SvrResponse resp;
 	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 	recv_resp.reset();
+	invalidateAttributes();
+	invalidateDentry(source_node->getInode(), source->getName());
+	invalidateDentry(target_node->getInode(), name);
 	if(resp.error() == managarm::fs::Errors::SUCCESS) {
 		co_return internalizePeripheralLink(target_node, name, shared_node);
 	}else{
@@ -962,6 +1232,75 @@ std::shared_ptr<FsLink> Superblock::internalizePeripheralLink(Node *parent, std:
 	return link;
 }
 
+std::optional<std::shared_ptr<FsLink>> Superblock::lookupDentry(uint64_t parent,
+		const std::string &name) {
+	auto dirIt = _dentries.find(parent);
+	if(dirIt != _dentries.end()) {
+		auto it = dirIt->second.find(name);
+		if(it != dirIt->second.end()) {
+			auto &dentry = it->second;
+			_dentryLru.splice(_dentryLru.begin(), _dentryLru, dentry.lruIt);
+			if(dentry.link) {
+				dentryCacheStats.hits++;
+			}else{
+				dentryCacheStats.negativeHits++;
+			}
+			return dentry.link;
+		}
+	}
+	dentryCacheStats.misses++;
+	return std::nullopt;
+}
+
+void Superblock::insertDentry(uint64_t parent, const std::string &name,
+		std::shared_ptr<FsLink> link) {
+	if(auto dirIt = _dentries.find(parent); dirIt != _dentries.end()) {
+		auto it = dirIt->second.find(name);
+		if(it != dirIt->second.end()) {
+			it->second.link = std::move(link);
+			_dentryLru.splice(_dentryLru.begin(), _dentryLru, it->second.lruIt);
+			return;
+		}
+	}
+
+	// Evict before looking up the directory since eviction might erase it.
+	if(_dentryLru.size() >= maxDentries) {
+		auto [victimParent, victimName] = _dentryLru.back();
+		invalidateDentry(victimParent, victimName);
+	}
+
+	_dentryLru.emplace_front(parent, name);
+	_dentries[parent].emplace(name, Dentry{std::move(link), _dentryLru.begin()});
+	dentryCacheStats.entries++;
+}
+
+void Superblock::invalidateDentry(uint64_t parent, const std::string &name) {
+	auto dirIt = _dentries.find(parent);
+	if(dirIt == _dentries.end())
+		return;
+	auto it = dirIt->second.find(name);
+	if(it == dirIt->second.end())
+		return;
+
+	_dentryLru.erase(it->second.lruIt);
+	dirIt->second.erase(it);
+	if(dirIt->second.empty())
+		_dentries.erase(dirIt);
+	dentryCacheStats.entries--;
+}
+
+void Superblock::invalidateDirectory(uint64_t parent) {
+	auto dirIt = _dentries.find(parent);
+	if(dirIt == _dentries.end())
+		return;
+
+	for(auto &[name, dentry] : dirIt->second) {
+		_dentryLru.erase(dentry.lruIt);
+		dentryCacheStats.entries--;
+	}
+	_dentries.erase(dirIt);
+}
+
 async::result<frg::expected<Error, FsFileStats>> Superblock::getFsstats() {
 	std::cout << "posix: unimplemented getFsstats for extern_fs Superblock!" << std::endl;
 	co_return Error::illegalOperationTarget;
@@ -969,6 +1308,10 @@ async::result<frg::expected<Error, FsFileStats>> Superblock::getFsstats() {
 
 } // anonymous namespace
 
+DentryCacheStats getDentryCacheStats() {
+	return dentryCacheStats;
+}
+
 std::shared_ptr<FsLink> createRoot(helix::UniqueLane sb_lane, helix::UniqueLane lane, std::shared_ptr<UnixDevice> device) {
 	auto sb = new Superblock{std::move(sb_lane), device};
 	// FIXME: 2 is the ext2fs root inode.
@@ -5,6 +5,17 @@
 
 namespace extern_fs {
 
+struct DentryCacheStats {
+	// Number of cached entries (positive and negative) of all superblocks.
+	uint64_t entries;
+	uint64_t hits;
+	// Lookups of names that are known not to exist.
+	uint64_t negativeHits;
+	uint64_t misses;
+};
+
+DentryCacheStats getDentryCacheStats();
+
 std::shared_ptr<FsLink> createRoot(helix::UniqueLane sb_lane, helix::UniqueLane lane, std::shared_ptr<UnixDevice> device);
 
 smarter::shared_ptr<File, FileHandle>
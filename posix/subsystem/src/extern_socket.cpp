@@ -28,6 +28,21 @@ struct Socket : File {
 		return _file.getLane();
 	}
 
+	async::result<frg::expected<Error, AcceptResult>> accept(Process *) override {
+		auto fileOrError = co_await _file.accept();
+		if(!fileOrError) {
+			switch(fileOrError.error()) {
+				case protocols::fs::Error::wouldBlock: co_return Error::wouldBlock;
+				case protocols::fs::Error::illegalArguments: co_return Error::illegalArguments;
+				default: co_return Error::illegalOperationTarget;
+			}
+		}
+
+		auto file = smarter::make_shared<Socket>(fileOrError.value().getLane().dup());
+		file->setupWeakFile(file);
+		co_return File::constructHandle(file);
+	}
+
 private:
 	protocols::fs::File _file;
 };
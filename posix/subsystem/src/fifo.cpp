@@ -1,16 +1,17 @@
 
+#include <limits.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <iostream>
-#include <deque>
 #include <map>
-#include <numeric>
+#include <memory>
 
 #include <async/recurring-event.hpp>
 #include <bragi/helpers-std.hpp>
 #include <helix/ipc.hpp>
 #include "fifo.hpp"
 #include "fs.bragi.hpp"
+#include "process.hpp"
 
 #include <sys/ioctl.h>
 
@@ -20,12 +21,13 @@ namespace {
 
 constexpr bool logFifos = false;
 
-struct Packet {
-	// The actual octet data that the packet consists of.
-	std::vector<char> buffer;
+// Linux' defaults for the capacity of a pipe and for /proc/sys/fs/pipe-max-size.
+constexpr size_t pageSize = 0x1000;
+constexpr size_t defaultCapacity = 16 * pageSize;
+constexpr size_t maxCapacity = 256 * pageSize;
 
-	size_t offset = 0;
-};
+// Writes of at most this size are atomic.
+constexpr size_t pipeBuf = PIPE_BUF;
 
 struct Channel {
 	Channel()
@@ -38,14 +40,112 @@ struct Channel {
 	uint64_t noWriterSeq = 0;
 	uint64_t noReaderSeq = 0;
 	uint64_t inSeq = 0;
+	uint64_t outSeq = 1;
 	int writerCount;
 	int readerCount;
 
 	async::recurring_event readerPresent;
 	async::recurring_event writerPresent;
 
-	// The actual queue of this pipe.
-	std::deque<Packet> packetQueue;
+	// The pipe's contents are stored in a ring buffer of capacity bytes.
+	// The buffer is allocated on the first write.
+	std::unique_ptr<char[]> buffer;
+	size_t capacity = defaultCapacity;
+	size_t head = 0;
+	size_t used = 0;
+
+	// splice() accesses the buffer directly while it waits for the other file.
+	// While these flags are set, other readers (or writers) must not touch the buffer.
+	bool readerBusy = false;
+	bool writerBusy = false;
+
+	size_t space() {
+		return capacity - used;
+	}
+
+	// Returns the first contiguous chunk of data.
+	std::pair<char *, size_t> readableChunk() {
+		return {buffer.get() + head, std::min(used, capacity - head)};
+	}
+
+	// Returns the first contiguous chunk of free space.
+	std::pair<char *, size_t> writableChunk() {
+		if(!buffer)
+			buffer = std::make_unique<char[]>(capacity);
+		auto tail = (head + used) % capacity;
+		return {buffer.get() + tail, std::min(space(), capacity - tail)};
+	}
+
+	// Copies n bytes starting at the given offset into the data without consuming them.
+	void peek(size_t offset, void *data, size_t n) {
+		assert(offset + n <= used);
+		auto p = (head + offset) % capacity;
+		auto first = std::min(n, capacity - p);
+		memcpy(data, buffer.get() + p, first);
+		memcpy(static_cast<char *>(data) + first, buffer.get(), n - first);
+	}
+
+	void consume(size_t n) {
+		assert(n <= used);
+		head = (head + n) % capacity;
+		used -= n;
+		// Restart at the beginning such that future chunks are as large as possible.
+		// A splice() into the pipe relies on the position of the free space though.
+		if(!used && !writerBusy)
+			head = 0;
+		outSeq = ++currentSeq;
+		statusBell.raise();
+	}
+
+	void append(const void *data, size_t n) {
+		assert(n <= space());
+		while(n) {
+			auto [ptr, chunk] = writableChunk();
+			chunk = std::min(chunk, n);
+			memcpy(ptr, data, chunk);
+			data = static_cast<const char *>(data) + chunk;
+			used += chunk;
+			n -= chunk;
+		}
+	}
+
+	// Makes n bytes that were written to writableChunk() available to readers.
+	void commit(size_t n) {
+		assert(n <= space());
+		used += n;
+		inSeq = ++currentSeq;
+		statusBell.raise();
+	}
+
+	// Copies n bytes from another channel without consuming them there.
+	void copyFrom(Channel *other, size_t n) {
+		assert(n <= other->used && n <= space());
+		size_t offset = 0;
+		while(offset < n) {
+			auto [ptr, chunk] = writableChunk();
+			chunk = std::min(chunk, n - offset);
+			other->peek(offset, ptr, chunk);
+			used += chunk;
+			offset += chunk;
+		}
+		inSeq = ++currentSeq;
+		statusBell.raise();
+	}
+
+	Error resize(size_t newCapacity) {
+		if(readerBusy || writerBusy || used > newCapacity)
+			return Error::resourceInUse;
+		if(buffer) {
+			auto newBuffer = std::make_unique<char[]>(newCapacity);
+			peek(0, newBuffer.get(), used);
+			buffer = std::move(newBuffer);
+		}
+		capacity = newCapacity;
+		head = 0;
+		outSeq = ++currentSeq;
+		statusBell.raise();
+		return Error::success;
+	}
 };
 
 struct OpenFile : File {
@@ -61,7 +161,7 @@ public:
 
 	OpenFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 		bool isReader, bool isWriter, bool nonBlock = false)
-	: File{FileKind::unknown,  StructName::get("fifo"), mount, link, File::defaultPipeLikeSeek},
+	: File{FileKind::pipe,  StructName::get("fifo"), mount, link, File::defaultPipeLikeSeek},
 		isReader_{isReader}, isWriter_{isWriter}, nonBlock_{nonBlock} { }
 
 	void connectChannel(std::shared_ptr<Channel> channel) {
@@ -89,56 +189,206 @@ public:
 		_channel = nullptr;
 	}
 
-	async::result<frg::expected<Error, size_t>>
-	readSome(Process *, void *data, size_t maxLength) override {
-		if(logFifos)
-			std::cout << "posix: Read from pipe " << this << std::endl;
+	const std::shared_ptr<Channel> &channel() {
+		return _channel;
+	}
+
+	// Waits until there is data to read. Returns false on end-of-file.
+	async::result<frg::expected<Error, bool>> waitReadable(bool nonBlock) {
 		if (!isReader_)
 			co_return Error::insufficientPermissions;
-		if(!maxLength)
-			co_return 0;
 
-		while(_channel->packetQueue.empty() && _channel->writerCount) {
-			if(nonBlock_) {
+		auto channel = _channel;
+		while(channel->readerBusy || (!channel->used && channel->writerCount)) {
+			if(nonBlock) {
 				if(logFifos)
 					std::cout << "posix: FIFO pipe would block" << std::endl;
 				co_return Error::wouldBlock;
 			}
-			co_await _channel->statusBell.async_wait();
+			co_await channel->statusBell.async_wait();
+		}
+		co_return channel->used > 0;
+	}
+
+	// Waits until at least the given number of bytes can be written.
+	async::result<frg::expected<Error>> waitWritable(size_t needed, bool nonBlock) {
+		if (!isWriter_)
+			co_return Error::insufficientPermissions;
+
+		auto channel = _channel;
+		assert(needed <= channel->capacity);
+		while(true) {
+			if(!channel->readerCount)
+				co_return Error::brokenPipe;
+			if(!channel->writerBusy && channel->space() >= needed)
+				co_return {};
+			if(nonBlock)
+				co_return Error::wouldBlock;
+			co_await channel->statusBell.async_wait();
+		}
+	}
+
+	async::result<frg::expected<Error, size_t>>
+	readSome(Process *, void *data, size_t maxLength) override {
+		if(logFifos)
+			std::cout << "posix: Read from pipe " << this << std::endl;
+		if(!maxLength) {
+			if (!isReader_)
+				co_return Error::insufficientPermissions;
+			co_return 0;
 		}
 
-		if(_channel->packetQueue.empty()) {
+		auto readable = co_await waitReadable(nonBlock_);
+		if(!readable)
+			co_return readable.error();
+		if(!readable.value()) {
 			assert(!_channel->writerCount);
 			co_return 0;
 		}
 
 		// TODO: Truncate packets (for SOCK_DGRAM) here.
-		auto packet = &_channel->packetQueue.front();
-		size_t chunk = std::min(packet->buffer.size() - packet->offset, maxLength);
+		size_t chunk = std::min(_channel->used, maxLength);
 		assert(chunk); // Otherwise we return above since !maxLength.
-		memcpy(data, packet->buffer.data() + packet->offset, chunk);
-		packet->offset += chunk;
-		if(packet->offset == packet->buffer.size())
-			_channel->packetQueue.pop_front();
+		_channel->peek(0, data, chunk);
+		_channel->consume(chunk);
 		co_return chunk;
 	}
 
 	async::result<frg::expected<Error, size_t>>
 	writeAll(Process *, const void *data, size_t maxLength) override {
-		if (!isWriter_)
-			co_return Error::insufficientPermissions;
+		auto channel = _channel;
+		size_t written = 0;
+		while(written < maxLength) {
+			// Writes of up to PIPE_BUF bytes must not be interleaved with other writes.
+			auto needed = std::min(maxLength <= pipeBuf ? maxLength : 1, channel->capacity);
+			auto writable = co_await waitWritable(needed, nonBlock_);
+			if(!writable) {
+				if(written)
+					co_return written;
+				co_return writable.error();
+			}
+
+			auto chunk = std::min(channel->space(), maxLength - written);
+			channel->append(static_cast<const char *>(data) + written, chunk);
+			channel->inSeq = ++channel->currentSeq;
+			channel->statusBell.raise();
+			written += chunk;
+		}
+		co_return written;
+	}
+
+	// Moves data from this pipe to another file.
+	async::result<frg::expected<Error, size_t>>
+	spliceTo(Process *process, File *out, std::optional<int64_t> offset,
+			size_t length, bool nonBlock) {
+		auto channel = _channel;
+		auto readable = co_await waitReadable(nonBlock || nonBlock_);
+		if(!readable)
+			co_return readable.error();
+		if(!readable.value())
+			co_return 0;
+
+		auto [ptr, chunk] = channel->readableChunk();
+		chunk = std::min(chunk, length);
 
-		Packet packet;
-		packet.buffer.resize(maxLength);
-		memcpy(packet.buffer.data(), data, maxLength);
-		packet.offset = 0;
+		channel->readerBusy = true;
+		auto result = offset
+				? co_await out->pwrite(process, *offset, ptr, chunk)
+				: co_await out->writeAll(process, ptr, chunk);
+		channel->readerBusy = false;
 
-		_channel->packetQueue.push_back(std::move(packet));
-		_channel->inSeq = ++_channel->currentSeq;
-		_channel->statusBell.raise();
-		co_return maxLength;
+		if(!result) {
+			channel->statusBell.raise();
+			co_return result.error();
+		}
+		channel->consume(result.value());
+		co_return result.value();
+	}
+
+	// Moves data from another file into this pipe.
+	async::result<frg::expected<Error, size_t>>
+	spliceFrom(Process *process, File *in, std::optional<int64_t> offset,
+			size_t length, bool nonBlock) {
+		auto channel = _channel;
+		auto writable = co_await waitWritable(1, nonBlock || nonBlock_);
+		if(!writable)
+			co_return writable.error();
+
+		auto [ptr, chunk] = channel->writableChunk();
+		chunk = std::min(chunk, length);
+
+		channel->writerBusy = true;
+		auto result = offset
+				? co_await in->pread(process, *offset, ptr, chunk)
+				: co_await in->readSome(process, ptr, chunk);
+		channel->writerBusy = false;
+
+		if(!result) {
+			channel->statusBell.raise();
+			co_return result.error();
+		}
+		if(result.value()) {
+			channel->commit(result.value());
+		}else{
+			channel->statusBell.raise();
+		}
+		co_return result.value();
+	}
+
+	// Moves data from the address space of a process into this pipe.
+	async::result<frg::expected<Error, size_t>>
+	spliceFromMemory(Process *process, uintptr_t address, size_t length, bool nonBlock) {
+		auto channel = _channel;
+		auto writable = co_await waitWritable(1, nonBlock || nonBlock_);
+		if(!writable)
+			co_return writable.error();
+
+		auto [ptr, chunk] = channel->writableChunk();
+		chunk = std::min(chunk, length);
+
+		channel->writerBusy = true;
+		auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+				address, chunk, ptr);
+		channel->writerBusy = false;
+
+		if(load.error()) {
+			channel->statusBell.raise();
+			co_return Error::illegalArguments;
+		}
+		channel->commit(chunk);
+		co_return chunk;
 	}
 
+	// Copies (or moves) data from this pipe to another pipe.
+	async::result<frg::expected<Error, size_t>>
+	transferTo(OpenFile *out, size_t length, bool consume, bool nonBlock) {
+		auto channel = _channel;
+		auto outChannel = out->_channel;
+		if(channel == outChannel)
+			co_return Error::illegalArguments;
+
+		while(true) {
+			auto readable = co_await waitReadable(nonBlock || nonBlock_);
+			if(!readable)
+				co_return readable.error();
+			if(!readable.value())
+				co_return 0;
+
+			auto writable = co_await out->waitWritable(1, nonBlock || out->nonBlock_);
+			if(!writable)
+				co_return writable.error();
+
+			// Data might have been consumed while we waited for space.
+			if(channel->used && !channel->readerBusy)
+				break;
+		}
+
+		auto chunk = std::min({length, channel->used, outChannel->space()});
+		outChannel->copyFrom(channel.get(), chunk);
+		if(consume)
+			channel->consume(chunk);
+		co_return chunk;
+	}
 
 	async::result<frg::expected<Error, PollWaitResult>>
 	pollWait(Process *, uint64_t pastSeq, int mask,
@@ -165,7 +415,8 @@ public:
 				edges |= EPOLLIN;
 		}
 		if (isWriter_) {
-			edges |= EPOLLOUT;
+			if(_channel->outSeq > pastSeq)
+				edges |= EPOLLOUT;
 			if(_channel->noReaderSeq > pastSeq)
 				edges |= EPOLLERR;
 		}
@@ -179,11 +430,12 @@ public:
 		if (isReader_) {
 			if(!_channel->writerCount)
 				events |= EPOLLHUP;
-			if(!_channel->packetQueue.empty())
+			if(_channel->used)
 				events |= EPOLLIN;
 		}
 		if (isWriter_) {
-			events |= EPOLLOUT;
+			if(_channel->space() >= std::min(pipeBuf, _channel->capacity))
+				events |= EPOLLOUT;
 			if(!_channel->readerCount)
 				events |= EPOLLERR;
 		}
@@ -237,11 +489,7 @@ public:
 				case FIONREAD: {
 					size_t count = 0;
 					if (isReader_)
-						count = std::accumulate(_channel->packetQueue.cbegin(), _channel->packetQueue.cend(), 0,
-							[](size_t sum, const Packet &p) {
-								return sum + (p.buffer.size() - p.offset);
-							}
-						);
+						count = _channel->used;
 
 					resp.set_fionread_count(count);
 					resp.set_error(managarm::fs::Errors::SUCCESS);
@@ -367,5 +615,76 @@ std::array<smarter::shared_ptr<File, FileHandle>, 2> createPair(bool nonBlock) {
 			File::constructHandle(std::move(w_file))};
 }
 
+OpenFile *asPipe(File *file) {
+	if(file->kind() != FileKind::pipe)
+		return nullptr;
+	return static_cast<OpenFile *>(file);
+}
+
+frg::expected<Error, size_t> getPipeSize(File *file) {
+	auto pipe = asPipe(file);
+	if(!pipe)
+		return Error::illegalArguments;
+	return pipe->channel()->capacity;
+}
+
+frg::expected<Error, size_t> setPipeSize(File *file, size_t size) {
+	auto pipe = asPipe(file);
+	if(!pipe)
+		return Error::illegalArguments;
+	if(size > maxCapacity)
+		return Error::insufficientPermissions;
+
+	// Like Linux, round up to a power of two number of pages.
+	size_t capacity = pageSize;
+	while(capacity < size)
+		capacity *= 2;
+
+	if(auto e = pipe->channel()->resize(capacity); e != Error::success)
+		return e;
+	return capacity;
+}
+
+async::result<frg::expected<Error, size_t>>
+splice(Process *process, File *in, std::optional<int64_t> inOffset,
+		File *out, std::optional<int64_t> outOffset, size_t length, bool nonBlock) {
+	auto inPipe = asPipe(in);
+	auto outPipe = asPipe(out);
+	if(!inPipe && !outPipe)
+		co_return Error::illegalArguments;
+	// Linux returns ESPIPE here but that error is not part of the POSIX protocol.
+	if((inPipe && inOffset) || (outPipe && outOffset))
+		co_return Error::illegalArguments;
+	if(!length)
+		co_return 0;
+
+	if(inPipe && outPipe)
+		co_return co_await inPipe->transferTo(outPipe, length, true, nonBlock);
+	if(inPipe)
+		co_return co_await inPipe->spliceTo(process, out, outOffset, length, nonBlock);
+	co_return co_await outPipe->spliceFrom(process, in, inOffset, length, nonBlock);
+}
+
+async::result<frg::expected<Error, size_t>>
+tee(File *in, File *out, size_t length, bool nonBlock) {
+	auto inPipe = asPipe(in);
+	auto outPipe = asPipe(out);
+	if(!inPipe || !outPipe)
+		co_return Error::illegalArguments;
+	if(!length)
+		co_return 0;
+	co_return co_await inPipe->transferTo(outPipe, length, false, nonBlock);
+}
+
+async::result<frg::expected<Error, size_t>>
+vmsplice(Process *process, File *out, uintptr_t address, size_t length, bool nonBlock) {
+	auto outPipe = asPipe(out);
+	if(!outPipe)
+		co_return Error::illegalArguments;
+	if(!length)
+		co_return 0;
+	co_return co_await outPipe->spliceFromMemory(process, address, length, nonBlock);
+}
+
 } // namespace fifo
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <optional>
+
 #include "file.hpp"
 #include "fs.hpp"
 
@@ -12,5 +14,23 @@ openNamedChannel(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 
 std::array<smarter::shared_ptr<File, FileHandle>, 2> createPair(bool nonBlock);
 
+// F_GETPIPE_SZ and F_SETPIPE_SZ. Return Error::illegalArguments if the file is not a pipe.
+frg::expected<Error, size_t> getPipeSize(File *file);
+frg::expected<Error, size_t> setPipeSize(File *file, size_t size);
+
+// At least one of the files must be a pipe. Offsets can only be given for files that are
+// not pipes. Data is moved directly between the pipe's buffer and the other file.
+async::result<frg::expected<Error, size_t>>
+splice(Process *process, File *in, std::optional<int64_t> inOffset,
+		File *out, std::optional<int64_t> outOffset, size_t length, bool nonBlock);
+
+// Copies data between two pipes without consuming it.
+async::result<frg::expected<Error, size_t>>
+tee(File *in, File *out, size_t length, bool nonBlock);
+
+// Moves data from the address space of the process into a pipe.
+async::result<frg::expected<Error, size_t>>
+vmsplice(Process *process, File *out, uintptr_t address, size_t length, bool nonBlock);
+
 } // namespace fifo
 
@@ -1,5 +1,7 @@
 
+#include <algorithm>
 #include <string.h>
+#include <dirent.h>
 #include <fcntl.h>
 
 #include <sys/socket.h>
@@ -11,6 +13,9 @@ namespace {
 
 constexpr bool logDestruction = false;
 
+// Chunk size of transferFileData() if it has to copy through posix.
+constexpr size_t transferChunkSize = 64 * 1024;
+
 } // anonymous namespace
 
 // --------------------------------------------------------
@@ -62,6 +67,24 @@ File::ptSeekEof(void *object, int64_t offset) {
 	}
 }
 
+async::result<protocols::fs::SeekResult>
+File::ptSeekData(void *object, int64_t offset) {
+	auto self = static_cast<File *>(object);
+	auto result = co_await self->seekData(offset);
+	if(!result)
+		co_return result.error() | protocols::fs::toFsProtoError;
+	co_return result.value();
+}
+
+async::result<protocols::fs::SeekResult>
+File::ptSeekHole(void *object, int64_t offset) {
+	auto self = static_cast<File *>(object);
+	auto result = co_await self->seekHole(offset);
+	if(!result)
+		co_return result.error() | protocols::fs::toFsProtoError;
+	co_return result.value();
+}
+
 async::result<protocols::fs::ReadResult>
 File::ptRead(void *object, helix_ng::CredentialsView credentials,
 		void *buffer, size_t length) {
@@ -118,6 +141,10 @@ async::result<frg::expected<protocols::fs::Error, size_t>> File::ptWrite(void *o
 			co_return protocols::fs::Error::notConnected;
 		case Error::illegalOperationTarget:
 			co_return protocols::fs::Error::illegalOperationTarget;
+		case Error::wouldBlock:
+			co_return protocols::fs::Error::wouldBlock;
+		case Error::brokenPipe:
+			co_return protocols::fs::Error::brokenPipe;
 		default:
 			assert(!"Unexpected error from writeAll()");
 			__builtin_unreachable();
@@ -148,6 +175,15 @@ async::result<ReadEntriesResult> File::ptReadEntries(void *object) {
 	return self->readEntries();
 }
 
+async::result<frg::expected<protocols::fs::Error, size_t>>
+File::ptReadDirents(void *object, void *buffer, size_t size) {
+	auto self = static_cast<File *>(object);
+	auto result = co_await self->readDirents(buffer, size);
+	if(!result)
+		co_return result.error() | protocols::fs::toFsProtoError;
+	co_return result.value();
+}
+
 async::result<frg::expected<protocols::fs::Error>> File::ptTruncate(void *object, size_t size) {
 	auto self = static_cast<File *>(object);
 	return self->truncate(size);
@@ -160,6 +196,12 @@ async::result<frg::expected<protocols::fs::Error>> File::ptAllocate(void *object
 	co_return co_await self->allocate(offset, size);
 }
 
+async::result<frg::expected<protocols::fs::Error>> File::ptFsync(void *, bool) {
+	// Files that are served by posix itself are not backed by a disk.
+	// Files on disks are served by their file system, which implements fsync() itself.
+	co_return {};
+}
+
 async::result<protocols::fs::Error> File::ptBind(void *object,
 		helix_ng::CredentialsView credentials,
 		const void *addr_ptr, size_t addr_length) {
@@ -308,6 +350,29 @@ async::result<frg::expected<Error>> File::readExactly(Process *process,
 	co_return {};
 }
 
+async::result<frg::expected<Error, off_t>> File::seekData(off_t offset) {
+	if(!associatedLink())
+		co_return Error::seekOnPipe;
+	auto stats = FRG_CO_TRY(co_await associatedLink()->getTarget()->getStats());
+	if(offset < 0)
+		co_return Error::illegalArguments;
+	if(static_cast<uint64_t>(offset) >= stats.fileSize)
+		co_return Error::noBackingDevice;
+	co_return co_await seek(offset, VfsSeek::absolute);
+}
+
+async::result<frg::expected<Error, off_t>> File::seekHole(off_t offset) {
+	if(!associatedLink())
+		co_return Error::seekOnPipe;
+	auto stats = FRG_CO_TRY(co_await associatedLink()->getTarget()->getStats());
+	if(offset < 0)
+		co_return Error::illegalArguments;
+	if(static_cast<uint64_t>(offset) >= stats.fileSize)
+		co_return Error::noBackingDevice;
+	// The end of the file is an implicit hole.
+	co_return co_await seek(stats.fileSize, VfsSeek::absolute);
+}
+
 async::result<frg::expected<Error, size_t>> File::readSome(Process *, void *, size_t) {
 	std::cout << "\e[35mposix \e[1;34m" << structName()
 			<< "\e[0m\e[35m: File does not support read()\e[39m" << std::endl;
@@ -343,12 +408,62 @@ async::result<frg::expected<Error, size_t>> File::pwrite(Process *, int64_t, con
 	co_return Error::seekOnPipe;
 }
 
+async::result<frg::expected<Error, size_t>>
+File::copyTo(Process *, std::optional<int64_t>, File *, std::optional<int64_t>, size_t) {
+	co_return Error::illegalOperationTarget;
+}
+
 async::result<ReadEntriesResult> File::readEntries() {
 	std::cout << "posix \e[1;34m" << structName()
 			<< "\e[0m: Object does not implement readEntries()" << std::endl;
 	throw std::runtime_error("posix: Object has no File::readEntries()");
 }
 
+namespace {
+
+uint8_t direntType(VfsType type) {
+	switch(type) {
+	case VfsType::directory: return DT_DIR;
+	case VfsType::regular: return DT_REG;
+	case VfsType::symlink: return DT_LNK;
+	case VfsType::charDevice: return DT_CHR;
+	case VfsType::blockDevice: return DT_BLK;
+	case VfsType::socket: return DT_SOCK;
+	case VfsType::fifo: return DT_FIFO;
+	default: return DT_UNKNOWN;
+	}
+}
+
+} // anonymous namespace
+
+async::result<frg::expected<Error, size_t>> File::readDirents(void *buffer, size_t size) {
+	protocols::fs::DirentWriter writer{buffer, size};
+	auto directory = associatedLink()->getTarget();
+	while(true) {
+		if(!_pendingEntry) {
+			_pendingEntry = co_await readEntries();
+			if(!_pendingEntry)
+				break;
+		}
+
+		uint8_t type = DT_UNKNOWN;
+		auto link = co_await directory->getLink(*_pendingEntry);
+		if(link && link.value())
+			type = direntType(link.value()->getTarget()->getType());
+
+		// Not all file systems of posix have inode numbers. Report a non-zero placeholder
+		// since some clients skip entries with d_ino == 0.
+		if(!writer.append(1, _direntPosition + 1, type, *_pendingEntry)) {
+			if(!writer.size())
+				co_return Error::illegalArguments;
+			break;
+		}
+		_pendingEntry.reset();
+		_direntPosition++;
+	}
+	co_return writer.size();
+}
+
 async::result<protocols::fs::RecvResult>
 File::recvMsg(Process *, uint32_t, void *, size_t,
 		void *, size_t, size_t) {
@@ -460,6 +575,10 @@ FutureMaybe<helix::UniqueDescriptor> File::accessMemory() {
 	throw std::runtime_error("posix: Object has no File::accessMemory()");
 }
 
+frg::expected<Error, SharedMapping> File::prepareSharedMapping(bool) {
+	return SharedMapping{};
+}
+
 async::result<void> File::ioctl(Process *, uint32_t id, helix_ng::RecvInlineResult msg,
 		helix::UniqueLane conversation) {
 	(void) id;
@@ -541,3 +660,47 @@ async::result<frg::expected<protocols::fs::Error>> File::getSocketOption(Process
 async::result<std::string> File::getFdInfo() {
 	co_return {};
 }
+
+// --------------------------------------------------------
+// Free functions.
+// --------------------------------------------------------
+
+async::result<frg::expected<Error, size_t>>
+transferFileData(Process *process, File *in, std::optional<int64_t> inOffset,
+		File *out, std::optional<int64_t> outOffset, size_t length) {
+	auto result = co_await in->copyTo(process, inOffset, out, outOffset, length);
+	if(result || result.error() != Error::illegalOperationTarget)
+		co_return result;
+
+	// Fall back to copying through a buffer in posix.
+	std::vector<char> buffer(std::min(length, transferChunkSize));
+	size_t progress = 0;
+	while(progress < length) {
+		auto chunk = std::min(length - progress, buffer.size());
+		auto readResult = inOffset
+			? co_await in->pread(process, *inOffset + progress, buffer.data(), chunk)
+			: co_await in->readSome(process, buffer.data(), chunk);
+		if(!readResult) {
+			if(progress)
+				break;
+			co_return readResult.error();
+		}
+		if(!readResult.value())
+			break;
+
+		auto writeResult = outOffset
+			? co_await out->pwrite(process, *outOffset + progress, buffer.data(), readResult.value())
+			: co_await out->writeAll(process, buffer.data(), readResult.value());
+		if(!writeResult) {
+			if(progress)
+				break;
+			co_return writeResult.error();
+		}
+		progress += writeResult.value();
+
+		if(writeResult.value() < readResult.value() || readResult.value() < chunk)
+			break;
+	}
+
+	co_return progress;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory>
+#include <optional>
 #include <variant>
 #include <string.h> // for hel.h
 #include <vector>
@@ -77,6 +79,9 @@ enum class Error {
 	alreadyConnected,
 
 	unsupportedSocketType,
+
+	// Corresponds with EBUSY
+	resourceInUse,
 };
 
 inline protocols::fs::Error operator|(Error e, protocols::fs::ToFsProtoError) {
@@ -139,8 +144,9 @@ inline managarm::posix::Errors operator|(Error e, ToPosixProtoError) {
 		case Error::noChildProcesses: return managarm::posix::Errors::NO_CHILD_PROCESSES;
 		case Error::alreadyConnected: return managarm::posix::Errors::ALREADY_CONNECTED;
 		case Error::unsupportedSocketType: return managarm::posix::Errors::UNSUPPORTED_SOCKET_TYPE;
+		case Error::resourceInUse: return managarm::posix::Errors::RESOURCE_IN_USE;
+		case Error::badExecutable: return managarm::posix::Errors::NOT_EXECUTABLE;
 		case Error::fileClosed:
-		case Error::badExecutable:
 		case Error::seekOnPipe:
 		case Error::notConnected:
 		case Error::noSpaceLeft:
@@ -174,12 +180,25 @@ using PollStatusResult = std::tuple<uint64_t, int>;
 
 using AcceptResult = smarter::shared_ptr<File, FileHandle>;
 
+// Returned by File::prepareSharedMapping(); the VmContext stores it in the mapped area.
+struct SharedMapping {
+	// Whether the mapping may be made writable later on (via mprotect()).
+	bool mayWrite = true;
+	// Kept alive while the area exists; allows files to detect mappings.
+	std::shared_ptr<void> token;
+	// Whether the mapping is populated when it is created, as if MAP_POPULATE was passed.
+	// Writable mappings are populated for writing.
+	bool populate = false;
+};
+
 struct DisposeFileHandle { };
 
 enum class FileKind {
 	unknown,
 	pidfd,
 	timerfd,
+	pipe,
+	ioUring,
 };
 
 struct File : private smarter::crtp_counter<File, DisposeFileHandle> {
@@ -205,6 +224,12 @@ public:
 	static async::result<protocols::fs::SeekResult>
 	ptSeekEof(void *object, int64_t offset);
 
+	static async::result<protocols::fs::SeekResult>
+	ptSeekData(void *object, int64_t offset);
+
+	static async::result<protocols::fs::SeekResult>
+	ptSeekHole(void *object, int64_t offset);
+
 	static async::result<protocols::fs::ReadResult>
 	ptRead(void *object, helix_ng::CredentialsView credentials, void *buffer, size_t length);
 
@@ -220,12 +245,18 @@ public:
 	static async::result<protocols::fs::ReadEntriesResult>
 	ptReadEntries(void *object);
 
+	static async::result<frg::expected<protocols::fs::Error, size_t>>
+	ptReadDirents(void *object, void *buffer, size_t size);
+
 	static async::result<frg::expected<protocols::fs::Error>>
 	ptTruncate(void *object, size_t size);
 
 	static async::result<frg::expected<protocols::fs::Error>>
 	ptAllocate(void *object, int64_t offset, size_t size);
 
+	static async::result<frg::expected<protocols::fs::Error>>
+	ptFsync(void *object, bool dataOnly);
+
 	static async::result<protocols::fs::Error>
 	ptBind(void *object, helix_ng::CredentialsView credentials,
 			const void *addr_ptr, size_t addr_length);
@@ -279,14 +310,18 @@ public:
 		.seekAbs = &ptSeekAbs,
 		.seekRel = &ptSeekRel,
 		.seekEof = &ptSeekEof,
+		.seekData = &ptSeekData,
+		.seekHole = &ptSeekHole,
 		.read = &ptRead,
 		.pread = &ptPread,
 		.write = &ptWrite,
 		.pwrite = &ptPwrite,
 		.readEntries = &ptReadEntries,
+		.readDirents = &ptReadDirents,
 		.accessMemory = &ptAccessMemory,
 		.truncate = &ptTruncate,
 		.fallocate = &ptAllocate,
+		.fsync = &ptFsync,
 		.ioctl = &ptIoctl,
 		.bind = &ptBind,
 		.listen = &ptListen,
@@ -377,6 +412,11 @@ public:
 	virtual async::result<frg::expected<Error, off_t>>
 	seek(off_t offset, VfsSeek whence);
 
+	// lseek() with SEEK_DATA and SEEK_HOLE. Return Error::noBackingDevice (ENXIO)
+	// if offset is at or beyond the end of the file. By default, files have no holes.
+	virtual async::result<frg::expected<Error, off_t>> seekData(off_t offset);
+	virtual async::result<frg::expected<Error, off_t>> seekHole(off_t offset);
+
 	virtual async::result<frg::expected<Error, size_t>>
 	readSome(Process *process, void *data, size_t max_length);
 
@@ -392,8 +432,19 @@ public:
 	virtual async::result<frg::expected<Error, size_t>>
 	pwrite(Process *process, int64_t offset, const void *data, size_t length);
 
+	// Copies data to another file without going through a buffer of the caller.
+	// Files that cannot do better than read() + write() return Error::illegalOperationTarget;
+	// transferFileData() falls back to copying in posix in this case.
+	virtual async::result<frg::expected<Error, size_t>>
+	copyTo(Process *process, std::optional<int64_t> offset,
+			File *target, std::optional<int64_t> targetOffset, size_t length);
+
 	virtual FutureMaybe<ReadEntriesResult> readEntries();
 
+	// Fills the buffer with entries in the layout of struct dirent64.
+	// By default, this is implemented on top of readEntries().
+	virtual async::result<frg::expected<Error, size_t>> readDirents(void *buffer, size_t size);
+
 	virtual async::result<protocols::fs::RecvResult>
 		recvMsg(Process *process, uint32_t flags,
 			void *data, size_t max_length,
@@ -441,6 +492,9 @@ public:
 
 	virtual FutureMaybe<helix::UniqueDescriptor> accessMemory();
 
+	// Called before the file is mapped with MAP_SHARED.
+	virtual frg::expected<Error, SharedMapping> prepareSharedMapping(bool writable);
+
 	virtual async::result<void> ioctl(Process *process, uint32_t id, helix_ng::RecvInlineResult msg,
 			helix::UniqueLane conversation);
 
@@ -472,10 +526,21 @@ private:
 
 	DefaultOps _defaultOps;
 
+	// Entry returned by readEntries() that did not fit into the buffer of readDirents().
+	std::optional<std::string> _pendingEntry;
+	// Number of entries that readDirents() returned so far.
+	int64_t _direntPosition = 0;
+
 	bool _isOpen;
 	bool _append;
 };
 
+// Implements sendfile() and copy_file_range(). If an offset is given, the file position
+// of the respective file is not changed. May return less than length bytes.
+async::result<frg::expected<Error, size_t>>
+transferFileData(Process *process, File *in, std::optional<int64_t> inOffset,
+		File *out, std::optional<int64_t> outOffset, size_t length);
+
 struct DummyFile final : File {
 public:
 	static void serve(smarter::shared_ptr<DummyFile> file) {
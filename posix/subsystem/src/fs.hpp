@@ -115,6 +115,10 @@ inline constexpr SemanticFlags semanticNonBlock = 1;
 inline constexpr SemanticFlags semanticRead = 2;
 inline constexpr SemanticFlags semanticWrite = 4;
 inline constexpr SemanticFlags semanticAppend = 8;
+// Bypass the page cache of the underlying file (i.e., O_DIRECT).
+inline constexpr SemanticFlags semanticDirect = 16;
+// Complete direct transfers by polling instead of waiting for IRQs (like RWF_HIPRI).
+inline constexpr SemanticFlags semanticPolled = 32;
 
 // Represents an inode on an actual file system (i.e. not in the VFS).
 struct FsNode {
@@ -19,6 +19,10 @@ namespace {
 constexpr int supportedFlags = IN_DELETE | IN_CREATE | IN_ISDIR | IN_DELETE_SELF | IN_MODIFY | IN_ACCESS | IN_CLOSE;
 constexpr int alwaysReturnedFlags = IN_IGNORED | IN_ISDIR | IN_Q_OVERFLOW | IN_UNMOUNT;
 
+// Same default as Linux' /proc/sys/fs/inotify/max_queued_events.
+// The last slot is reserved for the IN_Q_OVERFLOW event.
+constexpr size_t maxQueuedEvents = 16384;
+
 struct OpenFile : File {
 public:
 	struct Packet {
@@ -56,21 +60,13 @@ public:
 			if(!f)
 				return;
 
-			auto preexists = std::ranges::find_if(f->_queue, [&name, inotifyEvents](auto a) {
-				return a.name == name && (a.events & inotifyEvents) == inotifyEvents;
-			}) != f->_queue.end();
-			if(preexists)
-				return;
-
 			if(isDir)
 				inotifyEvents |= IN_ISDIR;
 
 			if(!(inotifyEvents & (mask | alwaysReturnedFlags)))
 				return;
 
-			f->_queue.push_back(Packet{descriptor, inotifyEvents & (mask | alwaysReturnedFlags), name, cookie});
-			f->_inSeq = ++f->_currentSeq;
-			f->_statusBell.raise();
+			f->postEvent_(descriptor, inotifyEvents & (mask | alwaysReturnedFlags), name, cookie);
 		}
 
 		smarter::weak_ptr<File> file;
@@ -115,14 +111,14 @@ public:
 		size_t written = 0;
 
 		while(written < maxLength) {
-			size_t packetSize = sizeof(inotify_event) +
-				(_queue.front().name.empty() ? 0 : _queue.front().name.size() + 1);
+			size_t packetSize = eventSize_(_queue.front());
 
 			if(written + packetSize > maxLength)
 				break;
 
 			Packet packet = std::move(_queue.front());
 			_queue.pop_front();
+			_queuedBytes -= packetSize;
 
 			inotify_event e;
 			memset(&e, 0, sizeof(inotify_event));
@@ -224,15 +220,9 @@ public:
 
 			switch(req->command()) {
 				case FIONREAD: {
+					// Like Linux, report the size of all queued events.
 					resp.set_error(managarm::fs::Errors::SUCCESS);
-
-					if(_queue.empty()) {
-						resp.set_fionread_count(0);
-					} else {
-						auto packet = &_queue.front();
-						auto size = sizeof(Packet) + packet->name.size() + 1;
-						resp.set_fionread_count(size);
-					}
+					resp.set_fionread_count(_queuedBytes);
 					break;
 				}
 				default: {
@@ -253,9 +243,44 @@ public:
 	}
 
 private:
+	static size_t eventSize_(const Packet &packet) {
+		return sizeof(inotify_event) + (packet.name.empty() ? 0 : packet.name.size() + 1);
+	}
+
+	void postEvent_(int descriptor, uint32_t events, const std::string &name, uint32_t cookie) {
+		// Like Linux, only merge identical events that immediately follow each other.
+		// Comparing against the whole queue would make bursts of events quadratic.
+		if(!_queue.empty()) {
+			auto &last = _queue.back();
+			if(last.descriptor == descriptor && last.events == events
+					&& last.cookie == cookie && last.name == name)
+				return;
+		}
+
+		bool wasEmpty = _queue.empty();
+		if(_queue.size() >= maxQueuedEvents) {
+			return;
+		}else if(_queue.size() == maxQueuedEvents - 1) {
+			// Readers learn that events were lost; IN_Q_OVERFLOW is not tied to a watch.
+			_queue.push_back(Packet{-1, IN_Q_OVERFLOW, {}, 0});
+		}else{
+			_queue.push_back(Packet{descriptor, events, name, cookie});
+		}
+		_queuedBytes += eventSize_(_queue.back());
+
+		// Readers and pollers only wait while the queue is empty (or until the sequence
+		// changes), hence it suffices to wake them once per batch of events.
+		if(wasEmpty) {
+			_inSeq = ++_currentSeq;
+			_statusBell.raise();
+		}
+	}
+
 	helix::UniqueLane _passthrough;
 	async::cancellation_event cancelServe_;
 	std::deque<Packet> _queue;
+	// Size of all queued events in the format that readSome() returns.
+	size_t _queuedBytes = 0;
 
 	id_allocator<int> descriptorAllocator_{1};
 	std::unordered_map<int, std::shared_ptr<Watch>> watches_;
@@ -1,4 +1,5 @@
 #include "interval-timer.hpp"
+#include "timer-queue.hpp"
 
 namespace {
 
@@ -22,7 +23,7 @@ async::detached IntervalTimer::arm(std::shared_ptr<IntervalTimer> timer) {
 	timer->nextExpiration_ = timer->initial_;
 
 	if(timer->initial_) {
-		bool awaited = co_await helix::sleepUntil(timer->nextExpiration_, timer->cancelEvt_);
+		bool awaited = co_await posix::sleepUntil(timer->nextExpiration_, timer->cancelEvt_);
 
 		timer->raise(awaited);
 		if(!awaited)
@@ -34,7 +35,7 @@ async::detached IntervalTimer::arm(std::shared_ptr<IntervalTimer> timer) {
 
 	while(true) {
 		timer->nextExpiration_ = add_sat(timer->nextExpiration_, timer->interval_);
-		auto awaited = co_await helix::sleepUntil(timer->nextExpiration_, timer->cancelEvt_);
+		auto awaited = co_await posix::sleepUntil(timer->nextExpiration_, timer->cancelEvt_);
 
 		timer->raise(awaited);
 		if(!awaited)
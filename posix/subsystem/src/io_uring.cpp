@@ -0,0 +1,501 @@
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <bit>
+#include <print>
+
+#include <async/recurring-event.hpp>
+#include <helix/ipc.hpp>
+#include <helix/memory.hpp>
+
+#include "io_uring.hpp"
+#include "process.hpp"
+
+namespace io_uring {
+
+namespace {
+
+bool logIoUring = false;
+
+constexpr unsigned int maxEntries = 4096;
+constexpr unsigned int maxFixedFiles = 1024;
+constexpr size_t maxIovecs = 1024;
+// Transfers that are larger than this complete short.
+constexpr size_t maxTransferSize = size_t{1} << 20;
+
+int errnoForError(Error e) {
+	switch(e) {
+		case Error::success: return 0;
+		case Error::noSuchFile: return ENOENT;
+		case Error::wouldBlock: return EAGAIN;
+		case Error::brokenPipe: return EPIPE;
+		case Error::seekOnPipe: return ESPIPE;
+		case Error::illegalArguments: return EINVAL;
+		case Error::illegalOperationTarget: return EINVAL;
+		case Error::insufficientPermissions: return EPERM;
+		case Error::accessDenied: return EACCES;
+		case Error::notConnected: return ENOTCONN;
+		case Error::noBackingDevice: return ENXIO;
+		case Error::noSpaceLeft: return ENOSPC;
+		case Error::isDirectory: return EISDIR;
+		case Error::noMemory: return ENOMEM;
+		case Error::fileClosed: return EBADF;
+		default: return EIO;
+	}
+}
+
+// Layout of the ring area that is mapped at IORING_OFF_SQ_RING.
+// The SQ index array and the CQEs follow this header.
+struct RingHeader {
+	uint32_t sqHead;
+	uint32_t sqTail;
+	uint32_t sqRingMask;
+	uint32_t sqRingEntries;
+	uint32_t sqFlags;
+	uint32_t sqDropped;
+	uint32_t cqHead;
+	uint32_t cqTail;
+	uint32_t cqRingMask;
+	uint32_t cqRingEntries;
+	uint32_t cqOverflow;
+	uint32_t cqFlags;
+};
+
+struct OpenFile : File {
+	OpenFile(unsigned int sqEntries, unsigned int cqEntries)
+	: File{FileKind::ioUring, StructName::get("io_uring")},
+			_sqEntries{sqEntries}, _cqEntries{cqEntries} {
+		_arrayOffset = sizeof(RingHeader);
+		_cqesOffset = (_arrayOffset + _sqEntries * sizeof(uint32_t) + 63) & ~size_t(63);
+		size_t ringSize = (_cqesOffset + _cqEntries * sizeof(io_uring_cqe) + 0xFFF)
+				& ~size_t(0xFFF);
+		size_t sqesSize = (_sqEntries * sizeof(io_uring_sqe) + 0xFFF) & ~size_t(0xFFF);
+
+		// Memory is allocated on demand, hence the gap before IORING_OFF_SQES is free.
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(IORING_OFF_SQES + sqesSize, 0, nullptr, &handle));
+		_memory = helix::UniqueDescriptor{handle};
+		_ringMapping = helix::Mapping{_memory, IORING_OFF_SQ_RING, ringSize};
+		_sqeMapping = helix::Mapping{_memory, IORING_OFF_SQES, sqesSize};
+
+		auto header = _header();
+		header->sqRingMask = _sqEntries - 1;
+		header->sqRingEntries = _sqEntries;
+		header->cqRingMask = _cqEntries - 1;
+		header->cqRingEntries = _cqEntries;
+	}
+
+	static void serve(smarter::shared_ptr<OpenFile> file) {
+		helix::UniqueLane lane;
+		std::tie(lane, file->_passthrough) = helix::createStream();
+		async::detach(protocols::fs::servePassthrough(std::move(lane),
+				smarter::shared_ptr<File>{file}, &File::fileOperations, file->_cancelServe));
+	}
+
+	void handleClose() override {
+		_cancelServe.cancel();
+		_passthrough = {};
+		_fixedFiles.clear();
+		_eventFile = {};
+	}
+
+	void fillParams(io_uring_params &params) {
+		params.sq_entries = _sqEntries;
+		params.cq_entries = _cqEntries;
+		// SQEs are copied on submission, i.e., user space can reuse them immediately.
+		params.features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_SUBMIT_STABLE;
+
+		memset(&params.sq_off, 0, sizeof(params.sq_off));
+		params.sq_off.head = offsetof(RingHeader, sqHead);
+		params.sq_off.tail = offsetof(RingHeader, sqTail);
+		params.sq_off.ring_mask = offsetof(RingHeader, sqRingMask);
+		params.sq_off.ring_entries = offsetof(RingHeader, sqRingEntries);
+		params.sq_off.flags = offsetof(RingHeader, sqFlags);
+		params.sq_off.dropped = offsetof(RingHeader, sqDropped);
+		params.sq_off.array = _arrayOffset;
+
+		memset(&params.cq_off, 0, sizeof(params.cq_off));
+		params.cq_off.head = offsetof(RingHeader, cqHead);
+		params.cq_off.tail = offsetof(RingHeader, cqTail);
+		params.cq_off.ring_mask = offsetof(RingHeader, cqRingMask);
+		params.cq_off.ring_entries = offsetof(RingHeader, cqRingEntries);
+		params.cq_off.overflow = offsetof(RingHeader, cqOverflow);
+		params.cq_off.cqes = _cqesOffset;
+		params.cq_off.flags = offsetof(RingHeader, cqFlags);
+	}
+
+	async::result<frg::expected<Error, unsigned int>>
+	enter(std::shared_ptr<Process> process,
+			unsigned int toSubmit, unsigned int minComplete, unsigned int flags) {
+		if(flags & ~IORING_ENTER_GETEVENTS)
+			co_return Error::illegalArguments;
+
+		auto self = smarter::static_pointer_cast<OpenFile>(weakFile().lock());
+		auto header = _header();
+
+		// Consume all SQEs in one batch; each of them is executed concurrently.
+		auto tail = std::atomic_ref{header->sqTail}.load(std::memory_order_acquire);
+		unsigned int submitted = 0;
+		while(submitted < toSubmit && _sqHead != tail) {
+			auto index = _sqArray()[_sqHead & (_sqEntries - 1)];
+			++_sqHead;
+			if(index >= _sqEntries) {
+				std::atomic_ref{header->sqDropped}.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+
+			io_uring_sqe sqe;
+			memcpy(&sqe, &_sqes()[index], sizeof(io_uring_sqe));
+			async::detach(execute(self, process, sqe));
+			++submitted;
+		}
+		std::atomic_ref{header->sqHead}.store(_sqHead, std::memory_order_release);
+
+		if(flags & IORING_ENTER_GETEVENTS) {
+			while(true) {
+				auto head = std::atomic_ref{header->cqHead}.load(std::memory_order_acquire);
+				if(_cqTail - head >= minComplete)
+					break;
+				co_await _completionBell.async_wait();
+			}
+		}
+
+		co_return submitted;
+	}
+
+	async::result<frg::expected<Error, int>>
+	registerResource(Process *process, unsigned int opcode, uintptr_t arg, unsigned int numArgs) {
+		switch(opcode) {
+		case IORING_REGISTER_FILES: {
+			if(!_fixedFiles.empty())
+				co_return Error::resourceInUse;
+			if(!numArgs || numArgs > maxFixedFiles)
+				co_return Error::illegalArguments;
+
+			std::vector<int32_t> fds(numArgs);
+			auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+					arg, numArgs * sizeof(int32_t), fds.data());
+			if(load.error())
+				co_return Error::illegalArguments;
+
+			// Sparse entries (i.e., -1) are left empty.
+			std::vector<SharedFilePtr> files(numArgs);
+			for(size_t i = 0; i < numArgs; ++i) {
+				if(fds[i] == -1)
+					continue;
+				auto file = process->fileContext()->getFile(fds[i]);
+				// Registering an io_uring would create a reference cycle.
+				if(!file || file->kind() == FileKind::ioUring)
+					co_return Error::illegalArguments;
+				files[i] = std::move(file);
+			}
+			_fixedFiles = std::move(files);
+			co_return 0;
+		}
+		case IORING_UNREGISTER_FILES:
+			if(_fixedFiles.empty())
+				co_return Error::noBackingDevice;
+			_fixedFiles.clear();
+			co_return 0;
+		case IORING_REGISTER_EVENTFD: {
+			if(numArgs != 1)
+				co_return Error::illegalArguments;
+			if(_eventFile)
+				co_return Error::resourceInUse;
+
+			int32_t fd;
+			auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+					arg, sizeof(int32_t), &fd);
+			if(load.error())
+				co_return Error::illegalArguments;
+
+			auto file = process->fileContext()->getFile(fd);
+			if(!file || file->kind() == FileKind::ioUring)
+				co_return Error::illegalArguments;
+			_eventFile = std::move(file);
+			co_return 0;
+		}
+		case IORING_UNREGISTER_EVENTFD:
+			if(!_eventFile)
+				co_return Error::noBackingDevice;
+			_eventFile = {};
+			co_return 0;
+		default:
+			std::println("posix: Unsupported io_uring_register() opcode {}", opcode);
+			co_return Error::illegalArguments;
+		}
+	}
+
+	async::result<frg::expected<Error, PollWaitResult>>
+	pollWait(Process *, uint64_t sequence, int mask,
+			async::cancellation_token cancellation) override {
+		(void)mask; // TODO: utilize mask.
+
+		assert(sequence <= _currentSeq);
+		while(_currentSeq == sequence && !cancellation.is_cancellation_requested())
+			co_await _completionBell.async_wait(cancellation);
+
+		int edges = 0;
+		if(_currentSeq > sequence)
+			edges |= EPOLLIN;
+
+		co_return PollWaitResult(_currentSeq, edges);
+	}
+
+	async::result<frg::expected<Error, PollStatusResult>>
+	pollStatus(Process *) override {
+		int events = 0;
+		auto head = std::atomic_ref{_header()->cqHead}.load(std::memory_order_acquire);
+		if(_cqTail != head)
+			events |= EPOLLIN;
+
+		co_return PollStatusResult(_currentSeq, events);
+	}
+
+	FutureMaybe<helix::UniqueDescriptor> accessMemory() override {
+		co_return _memory.dup();
+	}
+
+	helix::BorrowedDescriptor getPassthroughLane() override {
+		return _passthrough;
+	}
+
+private:
+	// Keeps the file alive until the operation completes.
+	static async::result<void> execute(smarter::shared_ptr<OpenFile> self,
+			std::shared_ptr<Process> process, io_uring_sqe sqe) {
+		auto result = co_await self->_perform(process, sqe);
+		if(logIoUring)
+			std::println("posix: io_uring opcode {} completes with {}", sqe.opcode, result);
+		self->_complete(sqe.user_data, result);
+
+		if(auto eventFile = self->_eventFile; eventFile) {
+			uint64_t count = 1;
+			co_await eventFile->writeAll(process.get(), &count, sizeof(uint64_t));
+		}
+	}
+
+	// Returns the CQE result, i.e., a negative errno value on failure.
+	async::result<int32_t> _perform(std::shared_ptr<Process> process, const io_uring_sqe &sqe) {
+		if(sqe.flags & ~IOSQE_FIXED_FILE)
+			co_return -EINVAL;
+		if(sqe.opcode == IORING_OP_NOP)
+			co_return 0;
+
+		SharedFilePtr file;
+		if(sqe.flags & IOSQE_FIXED_FILE) {
+			if(sqe.fd < 0 || static_cast<size_t>(sqe.fd) >= _fixedFiles.size())
+				co_return -EBADF;
+			file = _fixedFiles[sqe.fd];
+		}else{
+			file = process->fileContext()->getFile(sqe.fd);
+		}
+		if(!file)
+			co_return -EBADF;
+
+		// An offset of -1 uses (and advances) the file position.
+		std::optional<int64_t> offset;
+		if(sqe.off != static_cast<uint64_t>(-1))
+			offset = sqe.off;
+
+		switch(sqe.opcode) {
+		case IORING_OP_READ:
+			co_return co_await _readInto(process.get(), file.get(), offset, sqe.addr, sqe.len);
+		case IORING_OP_WRITE:
+			co_return co_await _writeFrom(process.get(), file.get(), offset, sqe.addr, sqe.len);
+		case IORING_OP_READV:
+		case IORING_OP_WRITEV: {
+			if(sqe.len > maxIovecs)
+				co_return -EINVAL;
+
+			std::vector<iovec> iovecs(sqe.len);
+			auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+					sqe.addr, sqe.len * sizeof(iovec), iovecs.data());
+			if(load.error())
+				co_return -EFAULT;
+
+			int32_t progress = 0;
+			for(auto &iov : iovecs) {
+				auto address = reinterpret_cast<uintptr_t>(iov.iov_base);
+				int32_t chunk;
+				if(sqe.opcode == IORING_OP_READV) {
+					chunk = co_await _readInto(process.get(), file.get(), offset,
+							address, iov.iov_len);
+				}else{
+					chunk = co_await _writeFrom(process.get(), file.get(), offset,
+							address, iov.iov_len);
+				}
+				if(chunk < 0)
+					co_return progress ? progress : chunk;
+
+				progress += chunk;
+				if(offset)
+					*offset += chunk;
+				if(static_cast<size_t>(chunk) < iov.iov_len
+						|| static_cast<size_t>(progress) >= maxTransferSize)
+					break;
+			}
+			co_return progress;
+		}
+		default:
+			if(logIoUring)
+				std::println("posix: Unsupported io_uring opcode {}", sqe.opcode);
+			co_return -EINVAL;
+		}
+	}
+
+	async::result<int32_t> _readInto(Process *process, File *file,
+			std::optional<int64_t> offset, uintptr_t address, size_t length) {
+		length = std::min(length, maxTransferSize);
+		std::vector<char> buffer(length);
+
+		auto result = offset
+				? co_await file->pread(process, *offset, buffer.data(), length)
+				: co_await file->readSome(process, buffer.data(), length);
+		if(!result) {
+			if(result.error() == Error::eof)
+				co_return 0;
+			co_return -errnoForError(result.error());
+		}
+
+		auto store = co_await helix_ng::writeMemory(process->vmContext()->getSpace(),
+				address, result.value(), buffer.data());
+		if(store.error())
+			co_return -EFAULT;
+		co_return static_cast<int32_t>(result.value());
+	}
+
+	async::result<int32_t> _writeFrom(Process *process, File *file,
+			std::optional<int64_t> offset, uintptr_t address, size_t length) {
+		length = std::min(length, maxTransferSize);
+		std::vector<char> buffer(length);
+
+		auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+				address, length, buffer.data());
+		if(load.error())
+			co_return -EFAULT;
+
+		auto result = offset
+				? co_await file->pwrite(process, *offset, buffer.data(), length)
+				: co_await file->writeAll(process, buffer.data(), length);
+		if(!result)
+			co_return -errnoForError(result.error());
+		co_return static_cast<int32_t>(result.value());
+	}
+
+	void _complete(uint64_t userData, int32_t result) {
+		auto header = _header();
+		auto head = std::atomic_ref{header->cqHead}.load(std::memory_order_acquire);
+		if(_cqTail - head >= _cqEntries) {
+			// TODO: Keep a backlog of completions instead of dropping them.
+			std::atomic_ref{header->cqOverflow}.fetch_add(1, std::memory_order_relaxed);
+		}else{
+			auto cqe = &_cqes()[_cqTail & (_cqEntries - 1)];
+			cqe->user_data = userData;
+			cqe->res = result;
+			cqe->flags = 0;
+			++_cqTail;
+			std::atomic_ref{header->cqTail}.store(_cqTail, std::memory_order_release);
+		}
+
+		++_currentSeq;
+		_completionBell.raise();
+	}
+
+	RingHeader *_header() {
+		return reinterpret_cast<RingHeader *>(_ringMapping.get());
+	}
+
+	uint32_t *_sqArray() {
+		return reinterpret_cast<uint32_t *>(
+				reinterpret_cast<char *>(_ringMapping.get()) + _arrayOffset);
+	}
+
+	io_uring_cqe *_cqes() {
+		return reinterpret_cast<io_uring_cqe *>(
+				reinterpret_cast<char *>(_ringMapping.get()) + _cqesOffset);
+	}
+
+	io_uring_sqe *_sqes() {
+		return reinterpret_cast<io_uring_sqe *>(_sqeMapping.get());
+	}
+
+	helix::UniqueLane _passthrough;
+	async::cancellation_event _cancelServe;
+
+	unsigned int _sqEntries;
+	unsigned int _cqEntries;
+	size_t _arrayOffset;
+	size_t _cqesOffset;
+
+	helix::UniqueDescriptor _memory;
+	helix::Mapping _ringMapping;
+	helix::Mapping _sqeMapping;
+
+	// Private copies of the ring indices; user space only sees the published values.
+	uint32_t _sqHead = 0;
+	uint32_t _cqTail = 0;
+
+	std::vector<SharedFilePtr> _fixedFiles;
+	SharedFilePtr _eventFile;
+
+	uint64_t _currentSeq = 1;
+	async::recurring_event _completionBell;
+};
+
+} // anonymous namespace
+
+frg::expected<Error, smarter::shared_ptr<File, FileHandle>>
+createFile(unsigned int entries, io_uring_params &params) {
+	if(params.flags & ~(IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP))
+		return Error::illegalArguments;
+
+	if(!entries)
+		return Error::illegalArguments;
+	if(entries > maxEntries) {
+		if(!(params.flags & IORING_SETUP_CLAMP))
+			return Error::illegalArguments;
+		entries = maxEntries;
+	}
+	unsigned int sqEntries = std::bit_ceil(entries);
+
+	unsigned int cqEntries = 2 * sqEntries;
+	if(params.flags & IORING_SETUP_CQSIZE) {
+		auto requested = params.cq_entries;
+		if(!requested)
+			return Error::illegalArguments;
+		if(requested > 2 * maxEntries) {
+			if(!(params.flags & IORING_SETUP_CLAMP))
+				return Error::illegalArguments;
+			requested = 2 * maxEntries;
+		}
+		cqEntries = std::bit_ceil(requested);
+		if(cqEntries < sqEntries)
+			return Error::illegalArguments;
+	}
+
+	auto file = smarter::make_shared<OpenFile>(sqEntries, cqEntries);
+	file->setupWeakFile(file);
+	OpenFile::serve(file);
+	file->fillParams(params);
+	return File::constructHandle(std::move(file));
+}
+
+async::result<frg::expected<Error, unsigned int>>
+enter(File *file, std::shared_ptr<Process> process,
+		unsigned int toSubmit, unsigned int minComplete, unsigned int flags) {
+	assert(file->kind() == FileKind::ioUring);
+	auto ring = static_cast<OpenFile *>(file);
+	co_return co_await ring->enter(std::move(process), toSubmit, minComplete, flags);
+}
+
+async::result<frg::expected<Error, int>>
+registerResource(File *file, Process *process,
+		unsigned int opcode, uintptr_t arg, unsigned int numArgs) {
+	assert(file->kind() == FileKind::ioUring);
+	auto ring = static_cast<OpenFile *>(file);
+	co_return co_await ring->registerResource(process, opcode, arg, numArgs);
+}
+
+} // namespace io_uring
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include "file.hpp"
+
+namespace io_uring {
+
+// Implements io_uring_setup(). The SQ and CQ rings are obtained via mmap() on the
+// returned file (at IORING_OFF_SQ_RING and IORING_OFF_SQES). On success,
+// the ring sizes and offsets are stored into params.
+frg::expected<Error, smarter::shared_ptr<File, FileHandle>>
+createFile(unsigned int entries, io_uring_params &params);
+
+// Implements io_uring_enter(). SQEs are consumed in a batch and executed concurrently;
+// returns the number of consumed SQEs.
+async::result<frg::expected<Error, unsigned int>>
+enter(File *file, std::shared_ptr<Process> process,
+		unsigned int toSubmit, unsigned int minComplete, unsigned int flags);
+
+// Implements io_uring_register().
+async::result<frg::expected<Error, int>>
+registerResource(File *file, Process *process,
+		unsigned int opcode, uintptr_t arg, unsigned int numArgs);
+
+} // namespace io_uring
@@ -25,7 +25,7 @@ async::result<frg::expected<protocols::fs::Error>>
 MemoryFile::allocate(int64_t offset, size_t size) {
 	assert(!offset);
 
-	if(_seals & F_SEAL_WRITE)
+	if(_seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE))
 		co_return protocols::fs::Error::insufficientPermissions;
 	/* check if the file size is enough */
 	if(offset + size <= _fileSize)
@@ -39,6 +39,15 @@ MemoryFile::accessMemory() {
 	co_return _memory.dup();
 }
 
+frg::expected<Error, SharedMapping> MemoryFile::prepareSharedMapping(bool writable) {
+	if(_seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)) {
+		if(writable)
+			return Error::insufficientPermissions;
+		return SharedMapping{.mayWrite = false};
+	}
+	return SharedMapping{.mayWrite = true, .token = _writeToken};
+}
+
 frg::expected<Error> MemoryFile::_resizeFile(size_t new_size) {
 	if(new_size > _fileSize && _seals & F_SEAL_GROW)
 		return Error::insufficientPermissions;
@@ -48,7 +57,8 @@ frg::expected<Error> MemoryFile::_resizeFile(size_t new_size) {
 
 	_fileSize = new_size;
 
-	size_t aligned_size = (new_size + 0xFFF) & ~size_t(0xFFF);
+	size_t granularity = _huge ? (size_t{1} << 21) : 0x1000;
+	size_t aligned_size = (new_size + granularity - 1) & ~(granularity - 1);
 	if(aligned_size <= _areaSize)
 		return {};
 
@@ -56,7 +66,7 @@ frg::expected<Error> MemoryFile::_resizeFile(size_t new_size) {
 		HEL_CHECK(helResizeMemory(_memory.getHandle(), aligned_size));
 	}else{
 		HelHandle handle;
-		HEL_CHECK(helAllocateMemory(aligned_size, 0, nullptr, &handle));
+		HEL_CHECK(helAllocateMemory(aligned_size, _huge ? kHelAllocHuge : 0, nullptr, &handle));
 		_memory = helix::UniqueDescriptor{handle};
 	}
 
@@ -73,17 +83,25 @@ MemoryFile::getSeals() {
 
 async::result<frg::expected<protocols::fs::Error, int>>
 MemoryFile::addSeals(int seals) {
+	if(seals & ~(F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_FUTURE_WRITE))
+		co_return protocols::fs::Error::illegalArguments;
+
 	if(_seals & F_SEAL_SEAL) {
 		co_return protocols::fs::Error::insufficientPermissions;
 	}
 
+	// Linux fails with EBUSY if writable shared mappings exist.
+	// TODO: Report EBUSY once protocols::fs has an equivalent error.
+	if((seals & F_SEAL_WRITE) && !(_seals & F_SEAL_WRITE) && _writeToken.use_count() > 1)
+		co_return protocols::fs::Error::insufficientPermissions;
+
 	_seals |= seals;
 	co_return int{_seals};
 }
 
 async::result<frg::expected<Error, size_t>>
 MemoryFile::writeAll(Process *, const void *data, size_t length) {
-	if(_seals & F_SEAL_WRITE)
+	if(_seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE))
 		co_return Error::insufficientPermissions;
 
 	auto end_size = _offset + length;
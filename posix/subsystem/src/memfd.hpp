@@ -1,9 +1,24 @@
 #pragma once
 
 #include <fcntl.h>
+#include <sys/mman.h>
 
 #include "file.hpp"
 
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 4U
+#endif
+
+#ifndef MFD_HUGE_SHIFT
+#define MFD_HUGE_SHIFT 26
+#define MFD_HUGE_MASK 0x3FU
+#define MFD_HUGE_2MB (21U << MFD_HUGE_SHIFT)
+#endif
+
 struct MemoryFile final : File {
 public:
 	static void serve(smarter::shared_ptr<MemoryFile> file) {
@@ -13,8 +28,11 @@ public:
 				file, &fileOperations, file->_cancelServe));
 	}
 
-	MemoryFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link, bool allowSealing)
-	: File{FileKind::unknown,  StructName::get("memfd-file"), mount, link}, _offset{0} {
+	// Huge (MFD_HUGETLB) files are backed by 2 MiB pages; their size is rounded up accordingly.
+	MemoryFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link, bool allowSealing,
+			bool huge = false)
+	: File{FileKind::unknown,  StructName::get("memfd-file"), mount, link}, _offset{0},
+			_huge{huge} {
 		if(!allowSealing) {
 			_seals = F_SEAL_SEAL;
 		}
@@ -38,6 +56,8 @@ public:
 
 	FutureMaybe<helix::UniqueDescriptor> accessMemory() override;
 
+	frg::expected<Error, SharedMapping> prepareSharedMapping(bool writable) override;
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _passthrough;
 	}
@@ -49,10 +69,15 @@ private:
 	async::cancellation_event _cancelServe;
 
 	uint64_t _offset;
+	bool _huge;
 
 	helix::UniqueDescriptor _memory;
 	helix::Mapping _mapping;
 	size_t _areaSize = 0;
 	size_t _fileSize = 0;
 	int _seals = 0;
+
+	// Held by all shared mappings that may become writable; F_SEAL_WRITE requires
+	// that no such mapping exists.
+	std::shared_ptr<void> _writeToken = std::make_shared<char>();
 };
@@ -62,8 +62,7 @@ void OpenFile::handleClose() {
 
 void OpenFile::deliver(core::netlink::Packet packet) {
 	if(filter_) {
-		Bpf bpf{filter_.value()};
-		size_t accept_bytes = bpf.run(arch::dma_buffer_view{nullptr, packet.buffer.data(), packet.buffer.size()});
+		size_t accept_bytes = filter_->run(arch::dma_buffer_view{nullptr, packet.buffer.data(), packet.buffer.size()});
 
 		if(!accept_bytes)
 			return;
@@ -332,11 +331,11 @@ async::result<frg::expected<protocols::fs::Error>> OpenFile::setSocketOption(int
 	if(layer == SOL_SOCKET && number == SO_ATTACH_FILTER) {
 		assert(optbuf.size() % sizeof(struct sock_filter) == 0);
 
-		Bpf bpf{optbuf};
-		if(!bpf.validate())
+		auto bpf = Bpf::compile(optbuf);
+		if(!bpf)
 			co_return protocols::fs::Error::illegalArguments;
 
-		filter_ = optbuf;
+		filter_ = std::move(bpf);
 	} else if(layer == SOL_NETLINK && number == NETLINK_ADD_MEMBERSHIP) {
 		auto val = *reinterpret_cast<int *>(optbuf.data());
 		std::cout << "posix: Join netlink group "
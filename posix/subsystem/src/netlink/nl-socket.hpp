@@ -1,6 +1,7 @@
 #pragma once
 
 #include <async/recurring-event.hpp>
+#include <core/bpf.hpp>
 #include <linux/netlink.h>
 #include <map>
 
@@ -114,7 +115,7 @@ private:
 	bool pktinfo_;
 
 	// BPF filter
-	std::optional<std::vector<char>> filter_ = std::nullopt;
+	std::optional<Bpf> filter_ = std::nullopt;
 
 	// Group subscriptions
 	// TODO(no92): handle group IDs >= MAX_BITMAP_GROUP_ID
@@ -3,6 +3,7 @@
 #include "gdbserver.hpp"
 #include "observations.hpp"
 #include "ostrace.hpp"
+#include "timer-queue.hpp"
 
 #include <frg/scope_exit.hpp>
 #include <protocols/posix/data.hpp>
@@ -161,7 +162,8 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 				self->fileContext()->clientMbusLane(),
 				self->clientThreadPage(),
 				static_cast<HelHandle *>(self->clientFileTable()),
-				self->clientClkTrackerPage()
+				self->clientClkTrackerPage(),
+				self->clientClockPage()
 			};
 
 			if(logRequests)
@@ -551,7 +553,7 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 
 				auto raceWait = [](async::cancellation_token c, uint64_t timeout) -> async::result<void> {
 					if(timeout != UINT64_MAX) {
-						co_await helix_ng::sleepFor(timeout, c);
+						co_await posix::sleepFor(timeout, c);
 					} else {
 						co_await async::suspend_indefinitely(c);
 					}
@@ -4,6 +4,7 @@
 
 #include "common.hpp"
 #include <core/clock.hpp>
+#include "cgroupfs.hpp"
 #include "exec.hpp"
 #include "gdbserver.hpp"
 #include "process.hpp"
@@ -38,25 +39,36 @@ std::shared_ptr<VmContext> VmContext::clone(std::shared_ptr<VmContext> original)
 	HEL_CHECK(helCreateSpace(&space));
 	context->_space = helix::UniqueDescriptor(space);
 
+	// Areas that were split from the same mapping share their copy view.
+	// Each view is only forked once; all of its areas map the forked view.
+	std::unordered_map<
+		helix::UniqueDescriptor *,
+		std::shared_ptr<helix::UniqueDescriptor>
+	> forkedViews;
+
 	for(const auto &entry : original->_areaTree) {
 		const auto &[address, area] = entry;
 
-		helix::UniqueDescriptor copyView;
+		std::shared_ptr<helix::UniqueDescriptor> copyView;
 		if(area.copyOnWrite) {
-			HelHandle copyHandle;
-			HEL_CHECK(helForkMemory(area.copyView.getHandle(), &copyHandle));
-			copyView = helix::UniqueDescriptor{copyHandle};
+			auto &forkedView = forkedViews[area.copyView.get()];
+			if(!forkedView) {
+				HelHandle copyHandle;
+				HEL_CHECK(helForkMemory(area.copyView->getHandle(), &copyHandle));
+				forkedView = std::make_shared<helix::UniqueDescriptor>(copyHandle);
+			}
+			copyView = forkedView;
 
 			void *pointer;
-			HelError error = helMapMemory(copyView.getHandle(), context->_space.getHandle(),
+			HelError error = helMapMemory(copyView->getHandle(), context->_space.getHandle(),
 					reinterpret_cast<void *>(address),
-					0, area.areaSize, area.nativeFlags, &pointer);
+					area.copyViewOffset, area.areaSize, area.nativeFlags, &pointer);
 			if(error != kHelErrNone && error != kHelErrAlreadyExists) {
 				HEL_CHECK(error);
 			}
 		}else{
 			void *pointer;
-			HEL_CHECK(helMapMemory(area.fileView.getHandle(), context->_space.getHandle(),
+			HEL_CHECK(helMapMemory(area.fileView->getHandle(), context->_space.getHandle(),
 					reinterpret_cast<void *>(address),
 					area.offset, area.areaSize, area.nativeFlags, &pointer));
 		}
@@ -65,11 +77,14 @@ std::shared_ptr<VmContext> VmContext::clone(std::shared_ptr<VmContext> original)
 		copy.copyOnWrite = area.copyOnWrite;
 		copy.areaSize = area.areaSize;
 		copy.nativeFlags = area.nativeFlags;
-		copy.fileView = area.fileView.dup();
+		copy.fileView = area.fileView;
 		copy.copyView = std::move(copyView);
+		copy.copyViewOffset = area.copyViewOffset;
 		copy.file = area.file;
 		copy.offset = area.offset;
-		context->_areaTree.emplace(address, std::move(copy));
+		copy.shared = area.shared;
+		// Areas are visited in order, hence the hint makes each insertion O(1).
+		context->_areaTree.emplace_hint(context->_areaTree.end(), address, std::move(copy));
 	}
 
 	return context;
@@ -101,10 +116,12 @@ auto VmContext::splitAreaOn_(uintptr_t addr, size_t size) ->
 			right.copyOnWrite = area.copyOnWrite;
 			right.areaSize = area.areaSize - (addr - base);
 			right.nativeFlags = area.nativeFlags;
-			right.fileView = area.fileView.dup();
-			right.copyView = area.copyView.dup();
+			right.fileView = area.fileView;
+			right.copyView = area.copyView;
+			right.copyViewOffset = area.copyViewOffset + (addr - base);
 			right.file = area.file;
 			right.offset = area.offset + (addr - base);
+			right.shared = area.shared;
 
 			_areaTree.emplace(addr, std::move(right));
 
@@ -120,10 +137,44 @@ auto VmContext::splitAreaOn_(uintptr_t addr, size_t size) ->
 	};
 }
 
+void VmContext::mergeAreasAround_(uintptr_t addr, size_t size) {
+	auto isContinuation = [] (uintptr_t leftBase, const Area &left,
+			uintptr_t rightBase, const Area &right) {
+		return leftBase + left.areaSize == rightBase
+				&& left.copyOnWrite == right.copyOnWrite
+				&& left.nativeFlags == right.nativeFlags
+				&& left.fileView == right.fileView
+				&& left.copyView == right.copyView
+				&& left.copyViewOffset + left.areaSize == right.copyViewOffset
+				&& left.file.get() == right.file.get()
+				&& left.offset + static_cast<intptr_t>(left.areaSize) == right.offset
+				&& left.shared.mayWrite == right.shared.mayWrite
+				&& left.shared.token == right.shared.token;
+	};
+
+	// Start at the area before the range (if any) since it may touch the range.
+	auto it = _areaTree.upper_bound(addr);
+	if(it != _areaTree.begin())
+		it = std::prev(it);
+
+	while(it != _areaTree.end() && it->first <= addr + size) {
+		auto next = std::next(it);
+		if(next == _areaTree.end())
+			break;
+		if(!isContinuation(it->first, it->second, next->first, next->second)) {
+			it = next;
+			continue;
+		}
+		it->second.areaSize += next->second.areaSize;
+		_areaTree.erase(next);
+	}
+}
+
 async::result<frg::expected<Error, void *>>
 VmContext::mapFile(uintptr_t hint, helix::UniqueDescriptor memory,
 		smarter::shared_ptr<File, FileHandle> file,
-		intptr_t offset, size_t size, bool copyOnWrite, uint32_t nativeFlags) {
+		intptr_t offset, size_t size, bool copyOnWrite, uint32_t nativeFlags,
+		SharedMapping shared) {
 	size_t alignedSize = (size + 0xFFF) & ~size_t(0xFFF);
 
 	// Perform the actual mapping.
@@ -175,10 +226,12 @@ VmContext::mapFile(uintptr_t hint, helix::UniqueDescriptor memory,
 	area.copyOnWrite = copyOnWrite;
 	area.areaSize = alignedSize;
 	area.nativeFlags = nativeFlags;
-	area.fileView = std::move(memory);
-	area.copyView = std::move(copyView);
+	area.fileView = std::make_shared<helix::UniqueDescriptor>(std::move(memory));
+	area.copyView = std::make_shared<helix::UniqueDescriptor>(std::move(copyView));
+	area.copyViewOffset = 0;
 	area.file = std::move(file);
 	area.offset = offset;
+	area.shared = std::move(shared);
 	_areaTree.emplace(address, std::move(area));
 
 	co_return pointer;
@@ -216,8 +269,10 @@ async::result<void *> VmContext::remapFile(void *oldPointer,
 	area.nativeFlags = it->second.nativeFlags;
 	area.fileView = std::move(it->second.fileView);
 	area.copyView = std::move(it->second.copyView);
+	area.copyViewOffset = it->second.copyViewOffset;
 	area.file = std::move(it->second.file);
 	area.offset = it->second.offset;
+	area.shared = std::move(it->second.shared);
 	_areaTree.erase(it);
 
 	// Perform some sanity checking.
@@ -233,10 +288,24 @@ async::result<void *> VmContext::remapFile(void *oldPointer,
 	co_return pointer;
 }
 
-async::result<void> VmContext::protectFile(void *pointer, size_t size, uint32_t protectionFlags) {
+async::result<frg::expected<Error>> VmContext::protectFile(void *pointer, size_t size,
+		uint32_t protectionFlags) {
 	size_t alignedSize = (size + 0xFFF) & ~size_t(0xFFF);
 	auto address = reinterpret_cast<uintptr_t>(pointer);
 
+	if(protectionFlags & kHelMapProtWrite) {
+		auto it = _areaTree.upper_bound(address);
+		if(it != _areaTree.begin())
+			it = std::prev(it);
+		for(; it != _areaTree.end() && it->first < address + alignedSize; ++it) {
+			const auto &[addr, area] = *it;
+			if(addr + area.areaSize <= address)
+				continue;
+			if(!area.copyOnWrite && !area.shared.mayWrite)
+				co_return Error::accessDenied;
+		}
+	}
+
 	helix::ProtectMemory protect;
 	auto &&submit = helix::submitProtectMemory(_space, &protect,
 			pointer, alignedSize, protectionFlags, helix::Dispatcher::global());
@@ -252,6 +321,10 @@ async::result<void> VmContext::protectFile(void *pointer, size_t size, uint32_t
 			area.nativeFlags |= protectionFlags;
 		}
 	}
+
+	mergeAreasAround_(address, alignedSize);
+
+	co_return {};
 }
 
 void VmContext::unmapFile(void *pointer, size_t size) {
@@ -272,6 +345,31 @@ void VmContext::unmapFile(void *pointer, size_t size) {
 	}
 }
 
+frg::expected<Error> VmContext::decommitRange(void *pointer, size_t size) {
+	size_t alignedSize = (size + 0xFFF) & ~size_t(0xFFF);
+
+	HelError error = helDecommitMemory(_space.getHandle(), pointer, alignedSize);
+	if(error == kHelErrFault)
+		return Error::noMemory;
+	else if(error == kHelErrIllegalArgs || error == kHelErrOutOfBounds)
+		return Error::illegalArguments;
+	HEL_CHECK(error);
+	return {};
+}
+
+frg::expected<Error> VmContext::populateRange(void *pointer, size_t size, bool forWrite) {
+	size_t alignedSize = (size + 0xFFF) & ~size_t(0xFFF);
+
+	HelError error = helPopulateMemory(_space.getHandle(), pointer, alignedSize,
+			forWrite ? kHelPopulateWrite : 0);
+	if(error == kHelErrFault)
+		return Error::noMemory;
+	else if(error == kHelErrIllegalArgs)
+		return Error::illegalArguments;
+	HEL_CHECK(error);
+	return {};
+}
+
 // ----------------------------------------------------------------------------
 // FsContext.
 // ----------------------------------------------------------------------------
@@ -358,9 +456,20 @@ std::shared_ptr<FileContext> FileContext::clone(std::shared_ptr<FileContext> ori
 	context->_fileTableMemory = helix::UniqueDescriptor(memory);
 	context->_fileTableWindow = reinterpret_cast<HelHandle *>(window);
 
-	for(auto entry : original->_fileTable) {
-		//std::cout << "Clone FD " << entry.first << std::endl;
-		context->attachFile(entry.first, entry.second.file, entry.second.closeOnExec);
+	// Transfer all lanes at once; processes often inherit many file descriptors.
+	std::vector<smarter::shared_ptr<File, FileHandle>> files;
+	files.reserve(original->_fileTable.size());
+	for(auto &entry : original->_fileTable)
+		files.push_back(entry.second.file);
+	auto handles = context->transferLanes_(files);
+
+	size_t n = 0;
+	for(auto &entry : original->_fileTable) {
+		if(logFileAttach)
+			std::cout << "posix: Attaching fixed FD " << entry.first << std::endl;
+
+		context->_fileTable.insert({entry.first, entry.second});
+		context->_fileTableWindow[entry.first] = handles[n++];
 	}
 
 	HEL_CHECK(helTransferDescriptor(posixMbusClient,
@@ -411,6 +520,41 @@ void FileContext::attachFile(int fd, smarter::shared_ptr<File, FileHandle> file,
 	_fileTableWindow[fd] = handle;
 }
 
+std::vector<int> FileContext::attachFiles(
+		std::vector<smarter::shared_ptr<File, FileHandle>> files, bool closeOnExec) {
+	auto handles = transferLanes_(files);
+
+	std::vector<int> fds;
+	fds.reserve(files.size());
+	int fd = 0;
+	for(size_t i = 0; i < files.size(); i++) {
+		while(_fileTable.find(fd) != _fileTable.end())
+			fd++;
+
+		if(logFileAttach)
+			std::cout << "posix: Attaching FD " << fd << std::endl;
+
+		_fileTable.insert({fd, {std::move(files[i]), closeOnExec}});
+		_fileTableWindow[fd] = handles[i];
+		fds.push_back(fd);
+	}
+	return fds;
+}
+
+std::vector<HelHandle> FileContext::transferLanes_(
+		const std::vector<smarter::shared_ptr<File, FileHandle>> &files) {
+	std::vector<HelHandle> lanes;
+	lanes.reserve(files.size());
+	for(auto &file : files)
+		lanes.push_back(file->getPassthroughLane().getHandle());
+
+	std::vector<HelHandle> handles(files.size());
+	if(!files.empty())
+		HEL_CHECK(helTransferDescriptors(lanes.data(), lanes.size(),
+				_universe.getHandle(), handles.data()));
+	return handles;
+}
+
 std::optional<FileDescriptor> FileContext::getDescriptor(int fd) {
 	auto file = _fileTable.find(fd);
 	if(file == _fileTable.end())
@@ -450,10 +594,12 @@ Error FileContext::closeFile(int fd) {
 }
 
 void FileContext::closeOnExec() {
+	// Close all handles in a single syscall.
+	std::vector<HelHandle> handles;
 	auto it = _fileTable.begin();
 	while(it != _fileTable.end()) {
 		if(it->second.closeOnExec) {
-			HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[it->first]));
+			handles.push_back(_fileTableWindow[it->first]);
 
 			_fileTableWindow[it->first] = 0;
 			it = _fileTable.erase(it);
@@ -461,6 +607,9 @@ void FileContext::closeOnExec() {
 			it++;
 		}
 	}
+
+	if(!handles.empty())
+		HEL_CHECK(helCloseDescriptors(_universe.getHandle(), handles.data(), handles.size()));
 }
 
 // ----------------------------------------------------------------------------
@@ -604,14 +753,11 @@ struct SignalFrame {
 #endif
 
 #if defined(__x86_64__)
-constexpr size_t redZoneSize = 128;
 // Calls misalign the stack by 8 bytes
-// We later offset the stack by this amount because the ABI expects
+// The kernel offsets the frame by this amount because the ABI expects
 // (rsp + 8) % 16 == 0 at function entry
 constexpr size_t stackCallMisalign = 8;
 #else
-// The AAPCS64 ABI has no red zone
-constexpr size_t redZoneSize = 0;
 constexpr size_t stackCallMisalign = 0;
 #endif
 
@@ -673,107 +819,52 @@ async::result<void> SignalContext::raiseContext(SignalItem *item, Process *proce
 	SignalFrame sf;
 	memset(&sf, 0, sizeof(SignalFrame));
 
-#if defined (__x86_64__)
-	HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsSignal, &sf.ucontext.uc_mcontext.gregs));
-
-	sf.returnAddress = handler.restorerIp;
-#elif defined(__aarch64__)
-	HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsSignal, &sf.ucontext.uc_mcontext));
-#elif defined(__riscv) && __riscv_xlen == 64
-	std::cout << "posix: Signal support on RISC-V is missing" << std::endl;
-	__builtin_trap();
-#else
-#error Signal register loading code is missing for architecture
-#endif
-
 	memcpy(&sf.ucontext.uc_sigmask, &handler.mask, sizeof(handler.mask));
 
-	std::vector<std::byte> simdState(simdStateSize);
-	HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsSimd, simdState.data()));
-
 	// Once compile siginfo_t if that is neccessary (matches Linux behavior).
 	if(handler.flags & signalInfo) {
 		sf.info.si_signo = item->signalNumber;
 		std::visit(CompileSignalInfo{&sf.info}, item->info);
 	}
 
-	// Setup the stack frame.
+	// The kernel saves the register image and the SIMD state to the stack
+	// and enters the handler; this saves us the load/write/store round trips.
+	HelSignalFrame frameInfo{};
+	frameInfo.frame = &sf;
+	frameInfo.frameSize = sizeof(SignalFrame);
+	frameInfo.infoOffset = offsetof(SignalFrame, info);
+	frameInfo.contextOffset = offsetof(SignalFrame, ucontext);
+	frameInfo.signalNumber = item->signalNumber;
+	frameInfo.handlerIp = handler.handlerIp;
+	frameInfo.restorerIp = handler.restorerIp;
 #if defined(__x86_64__)
-	uintptr_t threadSp = sf.ucontext.uc_mcontext.gregs[REG_RSP];
+	frameInfo.registersOffset = offsetof(SignalFrame, ucontext.uc_mcontext.gregs);
+	frameInfo.simdPointerOffset = offsetof(SignalFrame, ucontext.uc_mcontext.fpregs);
+	frameInfo.flags = kHelSignalFrameSimdPointer;
 #elif defined(__aarch64__)
-	uintptr_t threadSp = sf.ucontext.uc_mcontext.sp;
+	frameInfo.registersOffset = offsetof(SignalFrame, ucontext.uc_mcontext);
+	// TODO: aarch64
 #elif defined(__riscv) && __riscv_xlen == 64
-	uintptr_t threadSp;
 	std::cout << "posix: Signal support on RISC-V is missing" << std::endl;
 	__builtin_trap();
 #else
-#error Code to get stack pointer is missing for architecture
+#error Signal frame setup code is missing for architecture
 #endif
 
-	if (handler.flags & signalOnStack && process->isAltStackEnabled()) {
-		if (!process->isOnAltStack(threadSp)) {
-			threadSp = process->altStackSp() + process->altStackSize();
-		}
+	if(handler.flags & signalOnStack && process->isAltStackEnabled()) {
+		frameInfo.altStackBase = process->altStackSp();
+		frameInfo.altStackSize = process->altStackSize();
 	}
 
-	uintptr_t nsp = threadSp - redZoneSize;
-
-	auto alignFrame = [&] (size_t size) -> uintptr_t {
-		nsp = ((nsp - size) & ~uintptr_t(15)) - stackCallMisalign;
-		return nsp;
-	};
-
-	size_t totalFrameSize = simdStateSize + sizeof(SignalFrame);
-
 	// Store the current register stack on the stack.
 	assert(alignof(SignalFrame) == 8);
-	auto frame = alignFrame(totalFrameSize);
-
-#if defined(__x86_64__)
-	sf.ucontext.uc_mcontext.fpregs = (struct _fpstate*)(frame + sizeof(SignalFrame));
-#endif
-	// TODO: aarch64
-
-	auto storeFrame = co_await helix_ng::writeMemory(thread, frame,
-			sizeof(SignalFrame), &sf);
-	auto storeSimd = co_await helix_ng::writeMemory(thread, frame + sizeof(SignalFrame),
-			simdStateSize, simdState.data());
-	HEL_CHECK(storeFrame.error());
-	HEL_CHECK(storeSimd.error());
+	uintptr_t frame;
+	HEL_CHECK(helPushSignalFrame(thread.getHandle(), &frameInfo, &frame));
 
 	if(logSignals) {
 		std::cout << "posix: Saving pre-signal stack to " << (void *)frame << std::endl;
 		std::cout << "posix: Calling signal handler at " << (void *)handler.handlerIp << std::endl;
 	}
-	// Setup the new register image and resume.
-#if defined(__x86_64__)
-	sf.ucontext.uc_mcontext.gregs[REG_RDI] = item->signalNumber;
-	sf.ucontext.uc_mcontext.gregs[REG_RSI] = frame + offsetof(SignalFrame, info);
-	sf.ucontext.uc_mcontext.gregs[REG_RDX] = frame + offsetof(SignalFrame, ucontext);
-	sf.ucontext.uc_mcontext.gregs[REG_RAX] = 0; // Number of variable arguments.
-
-	sf.ucontext.uc_mcontext.gregs[REG_RIP] = handler.handlerIp;
-	sf.ucontext.uc_mcontext.gregs[REG_RSP] = frame;
-
-	HEL_CHECK(helStoreRegisters(thread.getHandle(), kHelRegsSignal, &sf.ucontext.uc_mcontext.gregs));
-#elif defined(__aarch64__)
-	sf.ucontext.uc_mcontext.regs[0] = item->signalNumber;
-	sf.ucontext.uc_mcontext.regs[1] = frame + offsetof(SignalFrame, info);
-	sf.ucontext.uc_mcontext.regs[2] = frame + offsetof(SignalFrame, ucontext);
-
-	// Return address for the 'ret' instruction
-	sf.ucontext.uc_mcontext.regs[30] = handler.restorerIp;
-
-	sf.ucontext.uc_mcontext.pc = handler.handlerIp;
-	sf.ucontext.uc_mcontext.sp = frame;
-
-	HEL_CHECK(helStoreRegisters(thread.getHandle(), kHelRegsSignal, &sf.ucontext.uc_mcontext));
-#elif defined(__riscv) && __riscv_xlen == 64
-	std::cout << "posix: Signal support on RISC-V is missing" << std::endl;
-	__builtin_trap();
-#else
-#error Signal frame register setup code is missing for architecture
-#endif
 
 	delete item;
 }
@@ -873,6 +964,15 @@ std::shared_ptr<Process> Process::findProcess(ProcessId pid) {
 	return it->second->getProcess();
 }
 
+std::vector<std::shared_ptr<Process>> Process::allProcesses() {
+	std::vector<std::shared_ptr<Process>> processes;
+	for(auto [pid, hull] : globalPidMap) {
+		if(auto process = hull->getProcess(); process)
+			processes.push_back(std::move(process));
+	}
+	return processes;
+}
+
 Process::Process(std::shared_ptr<PidHull> hull, Process *parent)
 : _parent{parent}, _hull{std::move(hull)},
 		_clientPosixLane{kHelNullHandle}, _clientFileTable{nullptr},
@@ -944,6 +1044,10 @@ async::result<std::shared_ptr<Process>> Process::init(std::string path) {
 			process->_vmContext->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
 			&process->_clientClkTrackerPage));
+	HEL_CHECK(helMapMemory(kHelClockMemory,
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead,
+			&process->_clientClockPage));
 
 	process->_uid = 0;
 	process->_euid = 0;
@@ -1016,6 +1120,10 @@ std::shared_ptr<Process> Process::fork(std::shared_ptr<Process> original) {
 			process->_vmContext->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
 			&process->_clientClkTrackerPage));
+	HEL_CHECK(helMapMemory(kHelClockMemory,
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead,
+			&process->_clientClockPage));
 
 	process->_clientAuxBegin = original->_clientAuxBegin;
 	process->_clientAuxEnd = original->_clientAuxEnd;
@@ -1036,6 +1144,7 @@ std::shared_ptr<Process> Process::fork(std::shared_ptr<Process> original) {
 			nullptr, nullptr, kHelThreadStopped, &new_thread));
 	process->_threadDescriptor = helix::UniqueDescriptor{new_thread};
 	process->_posixLane = std::move(server_lane);
+	process->setCgroup(original->_cgroup);
 
 	auto generation = std::make_shared<Generation>();
 	process->_currentGeneration = generation;
@@ -1077,6 +1186,7 @@ std::shared_ptr<Process> Process::clone(std::shared_ptr<Process> original, void
 
 	process->_clientFileTable = original->_clientFileTable;
 	process->_clientClkTrackerPage = original->_clientClkTrackerPage;
+	process->_clientClockPage = original->_clientClockPage;
 
 	process->_clientAuxBegin = original->_clientAuxBegin;
 	process->_clientAuxEnd = original->_clientAuxEnd;
@@ -1097,6 +1207,7 @@ std::shared_ptr<Process> Process::clone(std::shared_ptr<Process> original, void
 			ip, sp, kHelThreadStopped, &new_thread));
 	process->_threadDescriptor = helix::UniqueDescriptor{new_thread};
 	process->_posixLane = std::move(server_lane);
+	process->setCgroup(original->_cgroup);
 
 	auto generation = std::make_shared<Generation>();
 	process->_currentGeneration = generation;
@@ -1126,6 +1237,7 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 
 	void *exec_thread_page;
 	void *exec_clk_tracker_page;
+	void *exec_clock_page;
 	void *exec_client_table;
 	HEL_CHECK(helMapMemory(process->_threadPageMemory.getHandle(),
 			exec_vm_context->getSpace().getHandle(),
@@ -1135,6 +1247,10 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 			exec_vm_context->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
 			&exec_clk_tracker_page));
+	HEL_CHECK(helMapMemory(kHelClockMemory,
+			exec_vm_context->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead,
+			&exec_clock_page));
 	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
 			exec_vm_context->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
@@ -1160,12 +1276,14 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 	process->_path = std::move(path);
 	process->_posixLane = std::move(server_lane);
 	process->_threadDescriptor = std::move(execResult.thread);
+	process->setCgroup(process->_cgroup);
 	process->_vmContext = std::move(exec_vm_context);
 	process->_signalContext->resetHandlers();
 	process->_clientThreadPage = exec_thread_page;
 	process->_clientPosixLane = exec_posix_lane;
 	process->_clientFileTable = exec_client_table;
 	process->_clientClkTrackerPage = exec_clk_tracker_page;
+	process->_clientClockPage = exec_clock_page;
 	process->_clientAuxBegin = execResult.auxBegin;
 	process->_clientAuxEnd = execResult.auxEnd;
 	process->_didExecute = true;
@@ -1178,9 +1296,110 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 	co_return Error::success;
 }
 
+async::result<frg::expected<Error, std::shared_ptr<Process>>>
+Process::spawn(std::shared_ptr<Process> parent, std::string path,
+		std::vector<std::string> args, std::vector<std::string> env,
+		std::shared_ptr<FileContext> fileContext, SpawnAttributes attributes) {
+	auto vmContext = VmContext::create();
+	auto fsContext = FsContext::clone(parent->_fsContext);
+	fileContext->closeOnExec();
+
+	// Load the image into the fresh VM context before the child becomes visible.
+	auto execResult = FRG_CO_TRY(co_await execute(fsContext->getRoot(),
+			fsContext->getWorkingDirectory(),
+			path, std::move(args), std::move(env), vmContext,
+			fileContext->getUniverse(),
+			fileContext->clientMbusLane(), parent.get()));
+
+	auto hull = std::make_shared<PidHull>(nextPid++);
+	auto process = std::make_shared<Process>(std::move(hull), parent.get());
+	size_t pos = path.rfind('/');
+	assert(pos != std::string::npos);
+	process->_name = path.substr(pos + 1);
+	process->_path = std::move(path);
+	process->_vmContext = std::move(vmContext);
+	process->_fsContext = std::move(fsContext);
+	process->_fileContext = std::move(fileContext);
+	process->_signalContext = SignalContext::clone(parent->_signalContext);
+	process->_signalContext->resetHandlers();
+
+	parent->_pgPointer->reassociateProcess(process.get());
+
+	HelHandle thread_memory;
+	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &thread_memory));
+	process->_threadPageMemory = helix::UniqueDescriptor{thread_memory};
+	process->_threadPageMapping = helix::Mapping{process->_threadPageMemory, 0, 0x1000};
+
+	process->_signalMask = attributes.signalMask.value_or(parent->_signalMask);
+
+	auto [server_lane, client_lane] = helix::createStream();
+	HEL_CHECK(helTransferDescriptor(client_lane.getHandle(),
+			process->_fileContext->getUniverse().getHandle(), &process->_clientPosixLane));
+	client_lane.release();
+
+	HEL_CHECK(helMapMemory(process->_threadPageMemory.getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead | kHelMapProtWrite,
+			&process->_clientThreadPage));
+	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead,
+			&process->_clientFileTable));
+	HEL_CHECK(helMapMemory(clk::trackerPageMemory().getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead,
+			&process->_clientClkTrackerPage));
+	HEL_CHECK(helMapMemory(kHelClockMemory,
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead,
+			&process->_clientClockPage));
+
+	process->_clientAuxBegin = execResult.auxBegin;
+	process->_clientAuxEnd = execResult.auxEnd;
+	process->_uid = parent->_uid;
+	process->_euid = attributes.resetIds ? parent->_uid : parent->_euid;
+	process->_gid = parent->_gid;
+	process->_egid = attributes.resetIds ? parent->_gid : parent->_egid;
+	parent->_children.push_back(process);
+	process->_hull->initializeProcess(process.get());
+	process->_didExecute = true;
+
+	auto procfs_root = std::static_pointer_cast<procfs::DirectoryNode>(getProcfs()->getTarget());
+	process->_procfs_dir = procfs_root->createProcDirectory(std::to_string(process->_hull->getPid()), process.get());
+
+	process->_threadDescriptor = std::move(execResult.thread);
+	process->_posixLane = std::move(server_lane);
+	process->setCgroup(parent->_cgroup);
+
+	auto generation = std::make_shared<Generation>();
+	process->_currentGeneration = generation;
+	helResume(process->_threadDescriptor.getHandle());
+	async::detach(serve(process, std::move(generation)));
+
+	co_return process;
+}
+
+void Process::setCgroup(std::shared_ptr<cgroupfs::DirectoryNode> cgroup) {
+	_cgroup = std::move(cgroup);
+	if(!_threadDescriptor)
+		return;
+	HelHandle group = _cgroup ? _cgroup->scheduleGroup().getHandle() : kHelNullHandle;
+	HEL_CHECK(helSetScheduleGroup(_threadDescriptor.getHandle(), group));
+}
+
+ResourceUsage Process::ownUsage() {
+	auto usage = _generationUsage;
+	if(_threadDescriptor) {
+		HelThreadStats stats;
+		HEL_CHECK(helQueryThreadStats(_threadDescriptor.getHandle(), &stats));
+		usage += ResourceUsage::fromThreadStats(stats);
+	}
+	return usage;
+}
+
 void Process::retire(Process *process) {
 	assert(process->_parent);
-	process->_parent->_childrenUsage.userTime += process->_generationUsage.userTime;
+	process->_parent->_childrenUsage += process->_generationUsage;
 
 	std::erase_if(process->_parent->_children, [process](auto e) {
 		return e.get() == process;
@@ -1202,7 +1421,7 @@ async::result<void> Process::terminate(TerminationState state) {
 	// TODO: Do the accumulation + _currentGeneration reset after the thread has really terminated?
 	HelThreadStats stats;
 	HEL_CHECK(helQueryThreadStats(_threadDescriptor.getHandle(), &stats));
-	_generationUsage.userTime += stats.userTime;
+	_generationUsage += ResourceUsage::fromThreadStats(stats);
 
 	if(realTimer)
 		realTimer->cancel();
@@ -1243,8 +1462,7 @@ async::result<void> Process::terminate(TerminationState state) {
 	notifyType_ = NotifyType::terminated;
 	_state = std::move(state);
 	notifyTypeChange_.raise();
-	parent->_notifyQueue.push_back(*this);
-	parent->_notifyBell.raise();
+	parent->postNotification_(this);
 
 	// Send SIGCHLD to the parent.
 	UserSignal info;
@@ -1253,51 +1471,101 @@ async::result<void> Process::terminate(TerminationState state) {
 }
 
 async::result<frg::expected<Error, Process::WaitResult>> Process::wait(int pid, WaitFlags flags) {
-	assert(pid == -1 || pid > 0);
 	assert(flags & waitExited);
 	assert(!(flags & ~(waitNonBlocking | waitExited | waitLeaveZombie)));
 
-	if(_children.empty() || (pid > 0 && !hasChild(pid)))
+	if(!pid)
+		pid = -_pgPointer->getHull()->getPid();
+
+	if(_children.empty() || (pid > 0 && !hasChild(pid)) || (pid < -1 && !hasChildInGroup(-pid)))
 		co_return Error::noChildProcesses;
 
-	std::optional<WaitResult> result{};
 	while(true) {
-		for(auto it = _notifyQueue.begin(); it != _notifyQueue.end(); ++it) {
-			if(pid > 0 && pid != it->pid())
-				continue;
-			if(std::holds_alternative<TerminationByExit>(it->_state) && !(flags & (waitExited)))
-				continue;
-			if(std::holds_alternative<TerminationBySignal>(it->_state) && !(flags & (waitExited)))
-				continue;
-
-			result = WaitResult{
-				.pid = it->pid(),
-				.uid = it->uid(),
-				.state = it->_state,
-				.stats = it->_generationUsage,
+		// Since waitExited is required, every notification matches the flags.
+		if(auto child = findNotification_(pid); child) {
+			WaitResult result{
+				.pid = child->pid(),
+				.uid = child->uid(),
+				.state = child->_state,
+				.stats = child->_generationUsage,
 			};
 
 			if(!(flags & waitLeaveZombie)) {
-				// erasing from the queue invalidates the iterator, so we take a pointer before
-				auto proc = &(*it);
-				_notifyQueue.erase(it);
-				Process::retire(proc);
+				dropNotification_(child);
+				Process::retire(child);
 			}
 
-			break;
+			co_return result;
 		}
 
-		if(result || (flags & waitNonBlocking))
-			co_return result.value_or(WaitResult{});
+		if(flags & waitNonBlocking)
+			co_return WaitResult{};
+
+		// postNotification_() removes the waiter before raising it.
+		NotifyWaiter waiter{.pid = pid};
+		_notifyWaiters.push_back(waiter);
+		co_await waiter.event.wait();
+	}
+}
+
+void Process::postNotification_(Process *child) {
+	child->_notifyPgid = child->_pgPointer ? child->_pgPointer->getHull()->getPid() : 0;
+
+	_notifyQueue.push_back(*child);
+	_notifyByPid.insert({child->pid(), child});
+	_notifyByPgid[child->_notifyPgid].push_back(*child);
+
+	for(auto it = _notifyWaiters.begin(); it != _notifyWaiters.end();) {
+		auto waiter = &(*it);
+		bool matches = waiter->pid == -1
+				|| waiter->pid == child->pid()
+				|| (waiter->pid < -1 && -waiter->pid == child->_notifyPgid);
+		if(!matches) {
+			++it;
+			continue;
+		}
+		it = _notifyWaiters.erase(it);
+		waiter->event.raise();
+	}
+}
 
-		co_await _notifyBell.async_wait();
+Process *Process::findNotification_(int pid) {
+	if(pid == -1) {
+		if(_notifyQueue.empty())
+			return nullptr;
+		return &_notifyQueue.front();
+	}else if(pid > 0) {
+		auto it = _notifyByPid.find(pid);
+		if(it == _notifyByPid.end())
+			return nullptr;
+		return it->second;
+	}else{
+		auto it = _notifyByPgid.find(-pid);
+		if(it == _notifyByPgid.end())
+			return nullptr;
+		return &it->second.front();
 	}
 }
 
+void Process::dropNotification_(Process *child) {
+	_notifyQueue.erase(_notifyQueue.iterator_to(*child));
+	_notifyByPid.erase(child->pid());
+
+	auto it = _notifyByPgid.find(child->_notifyPgid);
+	assert(it != _notifyByPgid.end());
+	it->second.erase(it->second.iterator_to(*child));
+	if(it->second.empty())
+		_notifyByPgid.erase(it);
+}
+
 bool Process::hasChild(int pid) {
-	return std::ranges::find_if(_children, [pid](auto e) {
-		return e->pid() == pid;
-	}) != _children.end();
+	auto child = findProcess(pid);
+	return child && child->getParent() == this;
+}
+
+bool Process::hasChildInGroup(ProcessId pgid) {
+	auto group = ProcessGroup::findProcessGroup(pgid);
+	return group && group->hasChildOf(this);
 }
 
 async::result<bool> Process::awaitNotifyTypeChange(async::cancellation_token token) {
@@ -1338,6 +1606,12 @@ void ProcessGroup::dropProcess(Process *process) {
 	process->_pgPointer = nullptr;
 }
 
+bool ProcessGroup::hasChildOf(Process *parent) {
+	return std::ranges::any_of(members_, [parent] (Process &member) {
+		return member.getParent() == parent;
+	});
+}
+
 void ProcessGroup::issueSignalToGroup(int sn, SignalInfo info) {
 	for(auto &processRef : members_)
 		processRef.signalContext()->issueSignal(sn, info);
@@ -2,6 +2,7 @@
 
 #include <map>
 #include <memory>
+#include <optional>
 #include <unordered_map>
 
 #include <async/result.hpp>
@@ -21,6 +22,10 @@ struct ProcessGroup;
 struct TerminalSession;
 struct ControllingTerminalState;
 
+namespace cgroupfs {
+	struct DirectoryNode;
+}
+
 typedef int ProcessId;
 
 // TODO: This struct should store the process' VMAs once we implement them.
@@ -38,23 +43,39 @@ struct VmContext {
 	// TODO: Pass abstract instead of hel flags to this function?
 	async::result<frg::expected<Error, void *>> mapFile(uintptr_t hint, helix::UniqueDescriptor memory,
 			smarter::shared_ptr<File, FileHandle> file,
-			intptr_t offset, size_t size, bool copyOnWrite, uint32_t nativeFlags);
+			intptr_t offset, size_t size, bool copyOnWrite, uint32_t nativeFlags,
+			SharedMapping shared = {});
 
 	async::result<void *> remapFile(void *old_pointer, size_t old_size, size_t new_size);
 
-	async::result<void> protectFile(void *pointer, size_t size, uint32_t protectionFlags);
+	// Fails with accessDenied if write access is requested for an area that may not be writable.
+	async::result<frg::expected<Error>> protectFile(void *pointer, size_t size,
+			uint32_t protectionFlags);
 
 	void unmapFile(void *pointer, size_t size);
 
+	// Drops the private pages of a range (for MADV_DONTNEED and MADV_FREE).
+	// Anonymous memory reads as zeros afterwards; shared mappings are not affected.
+	frg::expected<Error> decommitRange(void *pointer, size_t size);
+
+	// Prefaults a range (for MADV_WILLNEED and MAP_POPULATE).
+	// If forWrite is set, private copies of writable pages are allocated as well.
+	frg::expected<Error> populateRange(void *pointer, size_t size, bool forWrite);
+
 private:
 	struct Area {
 		bool copyOnWrite;
 		size_t areaSize;
 		uint32_t nativeFlags;
-		helix::UniqueDescriptor fileView;
-		helix::UniqueDescriptor copyView;
+		// Areas that result from splitting a mapping share the views of the mapping.
+		// This avoids duplicating descriptors on each split and on fork().
+		std::shared_ptr<helix::UniqueDescriptor> fileView;
+		std::shared_ptr<helix::UniqueDescriptor> copyView;
+		// Offset of the area within copyView.
+		size_t copyViewOffset;
 		smarter::shared_ptr<File, FileHandle> file;
 		intptr_t offset;
+		SharedMapping shared;
 	};
 
 	std::pair<
@@ -62,6 +83,11 @@ private:
 		std::map<uintptr_t, Area>::iterator
 	> splitAreaOn_(uintptr_t addr, size_t size);
 
+	// Merges adjacent areas that overlap or touch the given range if they are
+	// contiguous parts of the same mapping with the same protection.
+	// This undoes the splits of mprotect() once the protection is restored.
+	void mergeAreasAround_(uintptr_t addr, size_t size);
+
 	helix::UniqueDescriptor _space;
 
 	std::map<uintptr_t, Area> _areaTree;
@@ -175,6 +201,11 @@ public:
 
 	void attachFile(int fd, smarter::shared_ptr<File, FileHandle> file, bool close_on_exec = false);
 
+	// Like attachFile() but transfers the passthrough lanes of all files with a single syscall.
+	// Returns the file descriptors in the order of files.
+	std::vector<int> attachFiles(std::vector<smarter::shared_ptr<File, FileHandle>> files,
+			bool closeOnExec = false);
+
 	std::optional<FileDescriptor> getDescriptor(int fd);
 
 	Error setDescriptor(int fd, bool close_on_exec);
@@ -194,6 +225,10 @@ public:
 	}
 
 private:
+	// Transfers the passthrough lanes of the files into our universe.
+	std::vector<HelHandle> transferLanes_(
+			const std::vector<smarter::shared_ptr<File, FileHandle>> &files);
+
 	helix::UniqueDescriptor _universe;
 
 	// TODO: replace this by a tree that remembers gaps between keys.
@@ -336,7 +371,27 @@ inline constexpr WaitFlags waitLeaveZombie = 2;
 inline constexpr WaitFlags waitExited = 4;
 
 struct ResourceUsage {
-	uint64_t userTime;
+	static ResourceUsage fromThreadStats(const HelThreadStats &stats) {
+		return {
+			.userTime = stats.userTime,
+			.systemTime = stats.kernelTime,
+			.voluntarySwitches = stats.voluntarySwitches,
+			.involuntarySwitches = stats.involuntarySwitches
+		};
+	}
+
+	ResourceUsage &operator+= (const ResourceUsage &other) {
+		userTime += other.userTime;
+		systemTime += other.systemTime;
+		voluntarySwitches += other.voluntarySwitches;
+		involuntarySwitches += other.involuntarySwitches;
+		return *this;
+	}
+
+	uint64_t userTime = 0;
+	uint64_t systemTime = 0;
+	uint64_t voluntarySwitches = 0;
+	uint64_t involuntarySwitches = 0;
 };
 
 // This struct is mainly needed to coordinate the destruction of kernel threads
@@ -389,6 +444,14 @@ private:
 	std::weak_ptr<TerminalSession> terminalSession_;
 };
 
+// Attributes of Process::spawn(), see posix_spawnattr_t.
+struct SpawnAttributes {
+	// Signal mask of the child. By default, the mask of the parent is inherited.
+	std::optional<uint64_t> signalMask;
+	// Reset the effective IDs of the child to the real IDs.
+	bool resetIds = false;
+};
+
 struct Process : std::enable_shared_from_this<Process> {
 	friend struct ProcessGroup;
 	friend struct TerminalSession;
@@ -396,6 +459,9 @@ struct Process : std::enable_shared_from_this<Process> {
 
 	static std::shared_ptr<Process> findProcess(ProcessId pid);
 
+	// Returns all processes that are still alive (including zombies), ordered by PID.
+	static std::vector<std::shared_ptr<Process>> allProcesses();
+
 	static async::result<std::shared_ptr<Process>> init(std::string path);
 
 	static std::shared_ptr<Process> fork(std::shared_ptr<Process> parent);
@@ -404,6 +470,14 @@ struct Process : std::enable_shared_from_this<Process> {
 	static async::result<Error> exec(std::shared_ptr<Process> process,
 			std::string path, std::vector<std::string> args, std::vector<std::string> env);
 
+	// Like fork() followed by exec() in the child but without copying the address space.
+	// fileContext becomes the file table of the child (after closing O_CLOEXEC files).
+	// Errors of exec() are reported to the parent before the child is created.
+	static async::result<frg::expected<Error, std::shared_ptr<Process>>>
+	spawn(std::shared_ptr<Process> parent, std::string path,
+			std::vector<std::string> args, std::vector<std::string> env,
+			std::shared_ptr<FileContext> fileContext, SpawnAttributes attributes);
+
 	// Called when the PID is released (by waitpid()).
 	static void retire(Process *process);
 
@@ -528,6 +602,11 @@ public:
 	std::shared_ptr<FsContext> fsContext() { return _fsContext; }
 	std::shared_ptr<FileContext> fileContext() { return _fileContext; }
 	std::shared_ptr<ProcessGroup> pgPointer() { return _pgPointer; }
+
+	// The cgroup of the process. Null if the process is in the root cgroup.
+	std::shared_ptr<cgroupfs::DirectoryNode> cgroup() { return _cgroup; }
+	// Also moves the thread of the process into the schedule group of the cgroup.
+	void setCgroup(std::shared_ptr<cgroupfs::DirectoryNode> cgroup);
 	SignalContext *signalContext() { return _signalContext.get(); }
 
 	void setSignalMask(uint64_t mask) {
@@ -542,6 +621,7 @@ public:
 	void *clientThreadPage() { return _clientThreadPage; }
 	void *clientFileTable() { return _clientFileTable; }
 	void *clientClkTrackerPage() { return _clientClkTrackerPage; }
+	void *clientClockPage() { return _clientClockPage; }
 	void *clientAuxBegin() { return _clientAuxBegin; }
 	void *clientAuxEnd() { return _clientAuxEnd; }
 
@@ -566,14 +646,21 @@ public:
 		ResourceUsage stats = {};
 	};
 
+	// Like waitpid(): pid is -1 (any child), a PID, zero (our own process group)
+	// or the negated ID of a process group.
 	async::result<frg::expected<Error, WaitResult>> wait(int pid, WaitFlags flags);
 
 	bool hasChild(int pid);
 
+	bool hasChildInGroup(ProcessId pgid);
+
 	ResourceUsage accumulatedUsage() {
 		return _childrenUsage;
 	}
 
+	// Resource usage of the process itself, including its running thread.
+	ResourceUsage ownUsage();
+
 	bool isOnAltStack(uint64_t sp) {
 		return sp >= _altStackSp && sp <= (_altStackSp + _altStackSize);
 	}
@@ -702,6 +789,7 @@ private:
 	std::shared_ptr<FileContext> _fileContext;
 	std::shared_ptr<SignalContext> _signalContext;
 	std::shared_ptr<procfs::Link> _procfs_dir;
+	std::shared_ptr<cgroupfs::DirectoryNode> _cgroup;
 
 	std::shared_ptr<ProcessGroup> _pgPointer;
 	boost::intrusive::list_member_hook<> _pgHook;
@@ -713,6 +801,7 @@ private:
 	void *_clientThreadPage;
 	void *_clientFileTable;
 	void *_clientClkTrackerPage;
+	void *_clientClockPage;
 	// Pointers to the aux vector in the client.
 	void *_clientAuxBegin = nullptr;
 	void *_clientAuxEnd = nullptr;
@@ -720,13 +809,42 @@ private:
 	uint64_t _signalMask;
 	std::vector<std::shared_ptr<Process>> _children;
 
+	// A waiter blocked in wait(). Waiters are only woken by matching notifications.
+	struct NotifyWaiter {
+		// Same encoding as the pid argument of wait() (but never zero).
+		int pid;
+		async::oneshot_event event;
+		boost::intrusive::list_member_hook<> hook;
+	};
+
+	// Enqueues a notification of child and wakes up the waiters that it matches.
+	void postNotification_(Process *child);
+
+	// Returns the oldest notification that matches pid (see wait()).
+	Process *findNotification_(int pid);
+
+	void dropNotification_(Process *child);
+
 	// The following intrusive queue stores notifications for wait().
 	NotifyType notifyType_;
 	async::recurring_event notifyTypeChange_;
 	TerminationState _state;
 
 	boost::intrusive::list_member_hook<> _notifyHook;
+	boost::intrusive::list_member_hook<> _notifyGroupHook;
+	// Process group of the process when the notification was posted.
+	ProcessId _notifyPgid = 0;
 
+	using NotifyGroupQueue = boost::intrusive::list<
+		Process,
+		boost::intrusive::member_hook<
+			Process,
+			boost::intrusive::list_member_hook<>,
+			&Process::_notifyGroupHook
+		>
+	>;
+
+	// Notifications in the order in which they were posted.
 	boost::intrusive::list<
 		Process,
 		boost::intrusive::member_hook<
@@ -736,7 +854,18 @@ private:
 		>
 	> _notifyQueue;
 
-	async::recurring_event _notifyBell;
+	// Indices into _notifyQueue, such that wait() does not need to scan the queue.
+	std::unordered_map<ProcessId, Process *> _notifyByPid;
+	std::unordered_map<ProcessId, NotifyGroupQueue> _notifyByPgid;
+
+	boost::intrusive::list<
+		NotifyWaiter,
+		boost::intrusive::member_hook<
+			NotifyWaiter,
+			boost::intrusive::list_member_hook<>,
+			&NotifyWaiter::hook
+		>
+	> _notifyWaiters;
 
 	// Resource usage accumulated from previous generations.
 	ResourceUsage _generationUsage = {};
@@ -774,6 +903,9 @@ struct ProcessGroup : std::enable_shared_from_this<ProcessGroup> {
 
 	void dropProcess(Process *process);
 
+	// Returns true if the group contains a child of parent.
+	bool hasChildOf(Process *parent);
+
 	void issueSignalToGroup(int sn, SignalInfo info);
 
 	PidHull *getHull() {
@@ -1,4 +1,5 @@
 #include <functional>
+#include <iterator>
 #include <linux/magic.h>
 #include <print>
 #include <string.h>
@@ -6,9 +7,15 @@
 #include <iomanip>
 
 #include <core/clock.hpp>
+#include <kerncfg.bragi.hpp>
+#include "cgroupfs.hpp"
 #include "common.hpp"
+#include "extern_fs.hpp"
 #include "procfs.hpp"
 #include "process.hpp"
+#include "request-stats.hpp"
+#include "requests.hpp"
+#include "subsystem/block.hpp"
 
 #include <bitset>
 #include <sys/epoll.h>
@@ -17,6 +24,33 @@ namespace procfs {
 
 SuperBlock procfsSuperblock;
 
+namespace {
+
+struct MemoryUsage {
+	size_t virtualBytes = 0;
+	size_t anonymousBytes = 0;
+	size_t fileBytes = 0;
+};
+
+// Resident memory is tracked by the kernel; the virtual size is the sum of all areas.
+MemoryUsage queryMemoryUsage(Process *process) {
+	MemoryUsage usage;
+	auto vmContext = process->vmContext();
+	if(!vmContext)
+		return usage;
+
+	for(auto area : *vmContext)
+		usage.virtualBytes += area.size();
+
+	HelSpaceMemoryInfo info;
+	HEL_CHECK(helQuerySpaceMemory(vmContext->getSpace().getHandle(), &info));
+	usage.anonymousBytes = info.anonymousBytes;
+	usage.fileBytes = info.fileBytes;
+	return usage;
+}
+
+} // anonymous namespace
+
 // ----------------------------------------------------------------------------
 // LinkCompare implementation.
 // ----------------------------------------------------------------------------
@@ -283,6 +317,14 @@ std::shared_ptr<Link> DirectoryNode::createRootDirectory() {
 	the_node->_entries.insert(std::move(self_thread_link));
 
 	the_node->directMkregular("uptime", std::make_shared<UptimeNode>());
+	the_node->directMkregular("stat", std::make_shared<KernelStatNode>());
+	the_node->directMkregular("vmstat", std::make_shared<VmstatNode>());
+	the_node->directMkregular("meminfo", std::make_shared<MeminfoNode>());
+	the_node->directMkregular("diskstats", std::make_shared<DiskstatsNode>());
+	the_node->directMkregular("lock_stat", std::make_shared<LockStatNode>());
+	the_node->directMkregular("posix_requests", std::make_shared<PosixRequestsNode>());
+	the_node->directMkregular("posix_dentry_cache", std::make_shared<PosixDentryCacheNode>());
+	the_node->directMkregular("posix_taskstats", std::make_shared<PosixTaskstatsNode>());
 	the_node->directMknode("mounts", std::make_shared<MountsLink>());
 
 	auto sysLink = the_node->directMkdir("sys");
@@ -353,8 +395,10 @@ std::shared_ptr<Link> DirectoryNode::createProcDirectory(std::string name,
 	proc_dir->directMkregular("maps", std::make_shared<MapNode>(process));
 	proc_dir->directMkregular("comm", std::make_shared<CommNode>(process));
 	proc_dir->directMkregular("stat", std::make_shared<StatNode>(process));
+	proc_dir->directMkregular("schedstat", std::make_shared<SchedstatNode>(process));
 	proc_dir->directMkregular("statm", std::make_shared<StatmNode>(process));
 	proc_dir->directMkregular("status", std::make_shared<StatusNode>(process));
+	proc_dir->directMkregular("smaps_rollup", std::make_shared<SmapsRollupNode>(process));
 	proc_dir->directMkregular("cgroup", std::make_shared<CgroupNode>(process));
 	proc_dir->directMkregular("mounts", std::make_shared<MountsNode>(process));
 	proc_dir->directMkregular("mountinfo", std::make_shared<MountInfoNode>(process));
@@ -366,6 +410,8 @@ std::shared_ptr<Link> DirectoryNode::createProcDirectory(std::string name,
 	auto tid_dir = static_cast<DirectoryNode*>(tid_link->getTarget().get());
 
 	tid_dir->directMkregular("comm", std::make_shared<CommNode>(process));
+	tid_dir->directMkregular("stat", std::make_shared<StatNode>(process));
+	tid_dir->directMkregular("schedstat", std::make_shared<SchedstatNode>(process));
 
 	return link;
 }
@@ -548,6 +594,191 @@ async::result<void> BootIdNode::store(std::string) {
 	co_return;
 }
 
+async::result<std::string> KernelStatNode::show(Process *) {
+	HelKernelStats stats;
+	HEL_CHECK(helQueryKernelStats(&stats));
+
+	// See man 5 proc for more details.
+	// We only report the fields that thor keeps track of; the managarm_* fields
+	// are not present on Linux.
+	std::stringstream stream;
+	stream << "ctxt " << stats.contextSwitches << "\n";
+	stream << "managarm_ipis " << stats.ipisSent << "\n";
+	stream << "managarm_ipc_submits " << stats.ipcSubmits << "\n";
+	stream << "managarm_ipc_queue_stalls " << stats.ipcQueueStalls << "\n";
+	stream << "managarm_handoff_switches " << stats.handoffSwitches << "\n";
+	stream << "managarm_futex_waits " << stats.futexWaits << "\n";
+	stream << "managarm_futex_wakes " << stats.futexWakes << "\n";
+	co_return stream.str();
+}
+
+async::result<void> KernelStatNode::store(std::string) {
+	// TODO: proper error reporting.
+	std::cout << "posix: Can't store to a /proc/stat file" << std::endl;
+	co_return;
+}
+
+async::result<std::string> VmstatNode::show(Process *) {
+	HelKernelStats stats;
+	HEL_CHECK(helQueryKernelStats(&stats));
+
+	// The field names follow Linux. Note that thor does not distinguish
+	// between major and minor faults.
+	std::stringstream stream;
+	stream << "pgalloc_normal " << stats.physicalAllocations << "\n";
+	stream << "pgfree " << stats.physicalFrees << "\n";
+	stream << "pgfault "
+			<< (stats.readFaults + stats.writeFaults + stats.executeFaults) << "\n";
+	stream << "nr_tlb_remote_flush " << stats.shootdowns << "\n";
+	stream << "managarm_read_faults " << stats.readFaults << "\n";
+	stream << "managarm_write_faults " << stats.writeFaults << "\n";
+	stream << "managarm_execute_faults " << stats.executeFaults << "\n";
+	stream << "managarm_unresolved_faults " << stats.unresolvedFaults << "\n";
+	co_return stream.str();
+}
+
+async::result<void> VmstatNode::store(std::string) {
+	// TODO: proper error reporting.
+	std::cout << "posix: Can't store to a /proc/vmstat file" << std::endl;
+	co_return;
+}
+
+async::result<std::string> MeminfoNode::show(Process *) {
+	HelMemoryPressureInfo info;
+	HEL_CHECK(helQueryMemoryPressure(&info));
+
+	// See man 5 proc for more details. AnonPages and Mapped count pages
+	// once per mapping (while Linux counts shared anonymous pages only once).
+	std::stringstream stream;
+	auto field = [&] (const char *name, uint64_t bytes) {
+		stream << name << ": " << std::setw(16 - strlen(name)) << (bytes / 1024) << " kB\n";
+	};
+	field("MemTotal", info.totalBytes);
+	field("MemFree", info.freeBytes);
+	field("MemAvailable", info.freeBytes + info.cachedBytes);
+	field("Cached", info.cachedBytes);
+	field("AnonPages", info.mappedAnonymousBytes);
+	field("Mapped", info.mappedFileBytes);
+	field("SwapTotal", 0);
+	field("SwapFree", 0);
+	co_return stream.str();
+}
+
+async::result<void> MeminfoNode::store(std::string) {
+	// TODO: proper error reporting.
+	std::cout << "posix: Can't store to a /proc/meminfo file" << std::endl;
+	co_return;
+}
+
+async::result<std::string> DiskstatsNode::show(Process *) {
+	return block_subsystem::formatDiskstats();
+}
+
+async::result<void> DiskstatsNode::store(std::string) {
+	// TODO: proper error reporting.
+	std::cout << "posix: Can't store to a /proc/diskstats file" << std::endl;
+	co_return;
+}
+
+async::result<std::string> LockStatNode::show(Process *) {
+	// Unlike Linux, thor keys the statistics by call site. The sites can be
+	// symbolized using tools/analyze-lockstat.py.
+	std::stringstream stream;
+	stream << "site lock acquisitions contended wait-ticks max-hold-ticks\n";
+	for(uint64_t slot = 0; ; slot++) {
+		managarm::kerncfg::GetLockStatsRequest kerncfgRequest;
+		kerncfgRequest.set_slot(slot);
+		auto [offer, kerncfgSendResp, kerncfgResp] = co_await helix_ng::exchangeMsgs(
+			getKerncfgLane(),
+			helix_ng::offer(
+				helix_ng::sendBragiHeadOnly(kerncfgRequest, frg::stl_allocator{}),
+				helix_ng::recvInline()
+			)
+		);
+		HEL_CHECK(offer.error());
+		HEL_CHECK(kerncfgSendResp.error());
+		HEL_CHECK(kerncfgResp.error());
+
+		auto kernResp = bragi::parse_head_only<managarm::kerncfg::GetLockStatsResponse>(kerncfgResp);
+		kerncfgResp.reset();
+
+		// The kernel rejects the request after the last slot or if lock statistics are disabled.
+		if(kernResp->error() != managarm::kerncfg::Error::SUCCESS)
+			break;
+		if(!kernResp->site())
+			continue;
+
+		stream << std::hex << "0x" << kernResp->site()
+				<< " 0x" << kernResp->lock_address() << std::dec
+				<< " " << kernResp->acquisitions()
+				<< " " << kernResp->contended()
+				<< " " << kernResp->wait_ticks()
+				<< " " << kernResp->max_hold_ticks() << "\n";
+	}
+	co_return stream.str();
+}
+
+async::result<void> LockStatNode::store(std::string) {
+	// TODO: proper error reporting.
+	std::cout << "posix: Can't store to a /proc/lock_stat file" << std::endl;
+	co_return;
+}
+
+async::result<std::string> PosixRequestsNode::show(Process *) {
+	// Not present on Linux. Lists the requests that the POSIX subsystem served
+	// since boot (or since the last reset).
+	co_return posix::formatRequestStats();
+}
+
+async::result<void> PosixRequestsNode::store(std::string) {
+	// Any write resets the statistics.
+	posix::resetRequestStats();
+	co_return;
+}
+
+async::result<std::string> PosixDentryCacheNode::show(Process *) {
+	// Not present on Linux. Reports the hit rate of the dentry cache of disk file systems.
+	auto stats = extern_fs::getDentryCacheStats();
+	std::stringstream stream;
+	stream << "entries " << stats.entries << "\n";
+	stream << "hits " << stats.hits << "\n";
+	stream << "negative_hits " << stats.negativeHits << "\n";
+	stream << "misses " << stats.misses << "\n";
+	co_return stream.str();
+}
+
+async::result<void> PosixDentryCacheNode::store(std::string) {
+	// TODO: proper error reporting.
+	std::cout << "posix: Can't store to a /proc/posix_dentry_cache file" << std::endl;
+	co_return;
+}
+
+async::result<std::string> PosixTaskstatsNode::show(Process *) {
+	// One line per process, such that monitoring tools do not need to open
+	// (and parse) /proc/[pid]/stat and /proc/[pid]/status of every process.
+	_buffer.clear();
+	_buffer += "pid ppid pgid sid uid gid utime name\n";
+	for(auto &process : Process::allProcesses()) {
+		auto parent = process->getParent();
+		std::format_to(std::back_inserter(_buffer), "{} {} {} {} {} {} {} {}\n",
+				process->pid(),
+				parent ? parent->pid() : 0,
+				process->pgPointer()->getHull()->getPid(),
+				process->pgPointer()->getSession()->getSessionId(),
+				process->uid(),
+				process->gid(),
+				process->accumulatedUsage().userTime,
+				process->name());
+	}
+	co_return _buffer;
+}
+
+async::result<void> PosixTaskstatsNode::store(std::string) {
+	// TODO: proper error reporting.
+	std::cout << "posix: Can't store to a /proc/posix_taskstats file" << std::endl;
+	co_return;
+}
+
 expected<std::string> SelfLink::readSymlink(FsLink *, Process *process) {
 	co_return "/proc/" + std::to_string(process->pid());
 }
@@ -640,68 +871,80 @@ async::result<frg::expected<Error, FileStats>> RootLink::getStats() {
 }
 
 async::result<std::string> StatNode::show(Process *) {
-	// Everything that has a value of 0 is likely not implemented yet.
-	// See man 5 proc for more details.
-	// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
-	std::stringstream stream;
-	stream << _process->pid(); // Pid
-	stream << " (" << _process->name() << ") "; // Name
-	stream << "R "; // State
-	// This avoids a crash when asking for the parent of init.
-	if(_process->getParent()) {
-		stream << _process->getParent()->pid() << " ";
-	} else {
-		stream << "0 ";
-	}
-	stream << _process->pgPointer()->getHull()->getPid() << " "; // Pgrp
-	stream << _process->pgPointer()->getSession()->getSessionId() << " "; // SID
-	stream << "0 "; // tty_nr
-	stream << "0 "; // tpgid
-	stream << "0 "; // flags
-	stream << "0 "; // minflt
-	stream << "0 "; // cminflt
-	stream << "0 "; // majflt
-	stream << "0 "; // cmajflt
-	stream << _process->accumulatedUsage().userTime << " "; // utime
-	stream << "0 "; // stime
-	stream << "0 "; // cutime
-	stream << "0 "; // cstime
-	stream << "0 "; // priority
-	stream << "0 "; // nice
-	stream << "1 "; // num_threads
-	stream << "0 "; // itrealvalue
-	stream << "0 "; // starttime
-	stream << "0 "; // vsize
-	stream << "0 "; // rss
-	stream << "0 "; // rsslim
-	stream << "0 "; // startcode
-	stream << "0 "; // endcode
-	stream << "0 "; // startstack
-	stream << "0 "; // kstkesp
-	stream << "0 "; // kstkeip
-	stream << "0 "; // signal
-	stream << "0 "; // blocked
-	stream << "0 "; // sigignore
-	stream << "0 "; // sigcatch
-	stream << "0 "; // wchan
-	stream << "0 "; // nswap
-	stream << "0 "; // cnswap
-	stream << "0 "; // exit_signal
-	stream << "0 "; // processor
-	stream << "0 "; // rt_priority
-	stream << "0 "; // policy
-	stream << "0 "; // delayacct_blkio_ticks
-	stream << "0 "; // guest_time
-	stream << "0 "; // cguest_time
-	stream << "0 "; // start_data
-	stream << "0 "; // end_data
-	stream << "0 "; // start_brk
-	stream << "0 "; // arg_start
-	stream << "0 "; // arg_end
-	stream << "0 "; // env_start
-	stream << "0 "; // env_end
-	stream << "0\n"; // exitcode
-	co_return stream.str();
+	auto parent = _process->getParent();
+	auto usage = _process->ownUsage();
+	auto childrenUsage = _process->accumulatedUsage();
+	auto memoryUsage = queryMemoryUsage(_process);
+	State state{
+		.name = _process->name(),
+		// This avoids a crash when asking for the parent of init.
+		.ppid = parent ? parent->pid() : 0,
+		.pgid = _process->pgPointer()->getHull()->getPid(),
+		.sid = _process->pgPointer()->getSession()->getSessionId(),
+		.userTime = usage.userTime,
+		.systemTime = usage.systemTime,
+		.childrenUserTime = childrenUsage.userTime,
+		.childrenSystemTime = childrenUsage.systemTime,
+		.vsize = memoryUsage.virtualBytes,
+		.rss = memoryUsage.anonymousBytes + memoryUsage.fileBytes
+	};
+
+	co_return _contents.get(state, [&] (std::string &buffer) {
+		// Everything that has a value of 0 is likely not implemented yet.
+		// See man 5 proc for more details.
+		// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
+		std::format_to(std::back_inserter(buffer), "{} ({}) ", _process->pid(), state.name); // Pid, Name
+		buffer += "R "; // State
+		std::format_to(std::back_inserter(buffer), "{} ", state.ppid); // PPid
+		std::format_to(std::back_inserter(buffer), "{} ", state.pgid); // Pgrp
+		std::format_to(std::back_inserter(buffer), "{} ", state.sid); // SID
+		buffer += "0 "; // tty_nr
+		buffer += "0 "; // tpgid
+		buffer += "0 "; // flags
+		buffer += "0 "; // minflt
+		buffer += "0 "; // cminflt
+		buffer += "0 "; // majflt
+		buffer += "0 "; // cmajflt
+		std::format_to(std::back_inserter(buffer), "{} ", state.userTime); // utime
+		std::format_to(std::back_inserter(buffer), "{} ", state.systemTime); // stime
+		std::format_to(std::back_inserter(buffer), "{} ", state.childrenUserTime); // cutime
+		std::format_to(std::back_inserter(buffer), "{} ", state.childrenSystemTime); // cstime
+		buffer += "0 "; // priority
+		buffer += "0 "; // nice
+		buffer += "1 "; // num_threads
+		buffer += "0 "; // itrealvalue
+		buffer += "0 "; // starttime
+		std::format_to(std::back_inserter(buffer), "{} ", state.vsize); // vsize
+		std::format_to(std::back_inserter(buffer), "{} ", state.rss / 0x1000); // rss
+		buffer += "0 "; // rsslim
+		buffer += "0 "; // startcode
+		buffer += "0 "; // endcode
+		buffer += "0 "; // startstack
+		buffer += "0 "; // kstkesp
+		buffer += "0 "; // kstkeip
+		buffer += "0 "; // signal
+		buffer += "0 "; // blocked
+		buffer += "0 "; // sigignore
+		buffer += "0 "; // sigcatch
+		buffer += "0 "; // wchan
+		buffer += "0 "; // nswap
+		buffer += "0 "; // cnswap
+		buffer += "0 "; // exit_signal
+		buffer += "0 "; // processor
+		buffer += "0 "; // rt_priority
+		buffer += "0 "; // policy
+		buffer += "0 "; // delayacct_blkio_ticks
+		buffer += "0 "; // guest_time
+		buffer += "0 "; // cguest_time
+		buffer += "0 "; // start_data
+		buffer += "0 "; // end_data
+		buffer += "0 "; // start_brk
+		buffer += "0 "; // arg_start
+		buffer += "0 "; // arg_end
+		buffer += "0 "; // env_start
+		buffer += "0 "; // env_end
+		buffer += "0\n"; // exitcode
+	});
 }
 
 async::result<void> StatNode::store(std::string) {
@@ -713,20 +956,41 @@ async::result<frg::expected<Error, FileStats>> StatNode::getStats() {
 	co_return co_await getStatsInternal(_process);
 }
 
+async::result<std::string> SchedstatNode::show(Process *) {
+	// See Documentation/scheduler/sched-stats.rst in Linux for the format.
+	// We do not track the time spent waiting on a run queue.
+	auto usage = _process->ownUsage();
+	co_return std::format("{} 0 {}\n",
+			usage.userTime + usage.systemTime,
+			usage.voluntarySwitches + usage.involuntarySwitches);
+}
+
+async::result<void> SchedstatNode::store(std::string) {
+	// TODO: proper error reporting.
+	std::println("Can't store to a /proc/schedstat file!");
+	co_return;
+}
+
+async::result<frg::expected<Error, FileStats>> SchedstatNode::getStats() {
+	co_return co_await getStatsInternal(_process);
+}
+
 async::result<std::string> StatmNode::show(Process *) {
-	(void)_process;
-	// All hardcoded to 0.
-	// See man 5 proc for more details.
-	// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
-	std::stringstream stream;
-	stream << "0 "; // size
-	stream << "0 "; // resident
-	stream << "0 "; // shared
-	stream << "0 "; // text
-	stream << "0 "; // lib
-	stream << "0 "; // data
-	stream << "0\n"; // dt
-	co_return stream.str();
+	auto usage = queryMemoryUsage(_process);
+	auto key = std::make_tuple(usage.virtualBytes, usage.anonymousBytes, usage.fileBytes);
+	co_return _contents.get(key, [&] (std::string &buffer) {
+		// All values are in pages; the remaining fields are hardcoded to 0.
+		// See man 5 proc for more details.
+		// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
+		std::format_to(std::back_inserter(buffer), "{} ", usage.virtualBytes / 0x1000); // size
+		std::format_to(std::back_inserter(buffer), "{} ",
+				(usage.anonymousBytes + usage.fileBytes) / 0x1000); // resident
+		std::format_to(std::back_inserter(buffer), "{} ", usage.fileBytes / 0x1000); // shared
+		buffer += "0 "; // text
+		buffer += "0 "; // lib
+		buffer += "0 "; // data
+		buffer += "0\n"; // dt
+	});
 }
 
 async::result<void> StatmNode::store(std::string) {
@@ -738,87 +1002,120 @@ async::result<frg::expected<Error, FileStats>> StatmNode::getStats() {
 	co_return co_await getStatsInternal(_process);
 }
 
-async::result<std::string> StatusNode::show(Process *) {
-	// Everything that has a value of N/A is not implemented yet.
-	// See man 5 proc for more details.
-	// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
+async::result<std::string> SmapsRollupNode::show(Process *) {
+	auto usage = queryMemoryUsage(_process);
+
+	// Pss is not reported, since the kernel does not track how often a page is mapped.
 	std::stringstream stream;
-	stream << "Name: " << _process->name() << "\n"; // Name is hardcoded to be the last part of the path
-	stream << "Umask: 0022\n"; // Hardcoded to 0022, which is what we hardcode in the mlibc sysdeps.
-	stream << "State: R\n"; // Hardcoded to R, running.
-	stream << "Tgid: " << _process->pid() << "\n"; // Thread group id, same as gid for now
-	stream << "NGid: 0\n"; // NUMA Group ID, 0 if none.
-	stream << "Pid: " << _process->pid() << "\n";
-	// This avoids a crash when asking for the parent of init.
-	if(_process->getParent()) {
-		stream << "PPid: " << _process->getParent()->pid() << "\n";
-	} else {
-		stream << "PPid: 0\n";
-	}
-	stream << "TracerPid: 0\n"; // We're not being traced, so 0 is fine.
-	stream << "Uid: " << _process->uid() << "\n";
-	stream << "Gid: " << _process->gid() << "\n";
-	stream << "FDSize: 256\n"; // Pick a sane default, I don't believe we have a real maximum here.
-	stream << "Groups: 0\n"; // We don't implement groups yet, so 0 is fine.
-	// Namespace information, unimplemented.
-	stream << "NStgid: N/A\n";
-	stream << "NSpid: N/A\n";
-	stream << "NSpgid: N/A\n";
-	stream << "NSsid: N/A\n";
-	// End namespace information.
-	// VM information, not exposed yet.
-	stream << "VmPeak: N/A kB\n";
-	stream << "VmSize: N/A kB\n";
-	stream << "VmLck: 0 kB\n"; // We don't lock memory.
-	stream << "VmPin: 0 kB\n"; // We don't pin memory.
-	stream << "VmHWM: N/A kB\n";
-	stream << "VmRSS: N/A kB\n";
-	stream << "RssAnon: N/A kB\n";
-	stream << "RssFile: N/A kB\n";
-	stream << "RssShmem: N/A kB\n";
-	stream << "VmData: N/A kB\n";
-	stream << "VmStk: N/A kB\n";
-	stream << "VmExe: N/A kB\n";
-	stream << "VmLib: N/A kB\n";
-	stream << "VmPTE: N/A kB\n";
-	stream << "VmSwap: 0 kB\n"; // We don't have swap yet.
-	stream << "HugetlbPages: N/A kB\n";
-	// End of VM information.
-	stream << "CoreDumping: 0\n"; // We don't implement coredumps, so 0 is correct here.
-	// Documentation doesn't mention THP_enabled.
-	stream << "THP_enabled: N/A\n";
-	stream << "Threads: 1\n"; // Number of threads in this process, hardcode to 1 for now.
-	// Signal related information, we should fill this out properly eventually.
-	stream << "SigQ: N/A\n";
-	// Masks of pending, blocked, ignored and caught signals, zero them all.
-	stream << "SigPnd: 0000000000000000\n";
-	stream << "ShdPnd: 0000000000000000\n";
-	stream << "SigBlk: 0000000000000000\n";
-	stream << "SigIgn: 0000000000000000\n";
-	stream << "SigCgt: 0000000000000000\n";
-	// End of signal related information.
-	// We don't implement capabilities, so 0 is good for all of them.
-	stream << "CapInh: 0000000000000000\n";
-	stream << "CapPrm: 0000000000000000\n";
-	stream << "CapEff: 0000000000000000\n";
-	stream << "CapBnd: 0000000000000000\n";
-	stream << "CapAmb: 0000000000000000\n";
-	// We don't implement this bit, nor seccomp, nor spectre/meltdown mitigations.
-	stream << "NoNewPrivs: 0\n";
-	stream << "Seccomp: 0\n";
-	stream << "Seccomp_filters: 0\n";
-	stream << "Speculation_Store_Bypass: thread vulnerable\n";
-	stream << "SpeculationIndirectBranch: thread vulnerable\n";
-	// Other stuff we don't implement yet.
-	stream << "Cpus_allowed: N/A\n";
-	stream << "Cpus_allowed_list: N/A\n";
-	stream << "Mems_allowed: N/A\n";
-	stream << "Mems_allowed_list: N/A\n";
-	stream << "voluntary_ctxt_switches: N/A\n";
-	stream << "nonvoluntary_ctxt_switches: N/A\n";
+	stream << "00000000-ffffffffffffffff ---p 00000000 00:00 0 [rollup]\n";
+	auto field = [&] (const char *name, uint64_t bytes) {
+		stream << name << ": " << std::setw(14 - strlen(name)) << (bytes / 1024) << " kB\n";
+	};
+	field("Rss", usage.anonymousBytes + usage.fileBytes);
+	field("Anonymous", usage.anonymousBytes);
+	field("Swap", 0);
 	co_return stream.str();
 }
 
+async::result<void> SmapsRollupNode::store(std::string) {
+	// TODO: proper error reporting.
+	std::println("Can't store to a /proc/smaps_rollup file!");
+}
+
+async::result<frg::expected<Error, FileStats>> SmapsRollupNode::getStats() {
+	co_return co_await getStatsInternal(_process);
+}
+
+async::result<std::string> StatusNode::show(Process *) {
+	auto parent = _process->getParent();
+	auto usage = queryMemoryUsage(_process);
+	State state{
+		.name = _process->name(),
+		// This avoids a crash when asking for the parent of init.
+		.ppid = parent ? parent->pid() : 0,
+		.uid = _process->uid(),
+		.gid = _process->gid(),
+		.vmSize = usage.virtualBytes,
+		.rssAnon = usage.anonymousBytes,
+		.rssFile = usage.fileBytes
+	};
+
+	co_return _contents.get(state, [&] (std::string &buffer) {
+		// Everything that has a value of N/A is not implemented yet.
+		// See man 5 proc for more details.
+		// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
+		std::format_to(std::back_inserter(buffer), "Name: {}\n", state.name); // Name is hardcoded to be the last part of the path
+		buffer += "Umask: 0022\n"; // Hardcoded to 0022, which is what we hardcode in the mlibc sysdeps.
+		buffer += "State: R\n"; // Hardcoded to R, running.
+		std::format_to(std::back_inserter(buffer), "Tgid: {}\n", _process->pid()); // Thread group id, same as gid for now
+		buffer += "NGid: 0\n"; // NUMA Group ID, 0 if none.
+		std::format_to(std::back_inserter(buffer), "Pid: {}\n", _process->pid());
+		std::format_to(std::back_inserter(buffer), "PPid: {}\n", state.ppid);
+		buffer += "TracerPid: 0\n"; // We're not being traced, so 0 is fine.
+		std::format_to(std::back_inserter(buffer), "Uid: {}\n", state.uid);
+		std::format_to(std::back_inserter(buffer), "Gid: {}\n", state.gid);
+		buffer += "FDSize: 256\n"; // Pick a sane default, I don't believe we have a real maximum here.
+		buffer += "Groups: 0\n"; // We don't implement groups yet, so 0 is fine.
+		// Namespace information, unimplemented.
+		buffer += "NStgid: N/A\n";
+		buffer += "NSpid: N/A\n";
+		buffer += "NSpgid: N/A\n";
+		buffer += "NSsid: N/A\n";
+		// End namespace information.
+		// VM information, not exposed yet.
+		buffer += "VmPeak: N/A kB\n";
+		std::format_to(std::back_inserter(buffer), "VmSize: {} kB\n", state.vmSize / 1024);
+		buffer += "VmLck: 0 kB\n"; // We don't lock memory.
+		buffer += "VmPin: 0 kB\n"; // We don't pin memory.
+		buffer += "VmHWM: N/A kB\n";
+		std::format_to(std::back_inserter(buffer), "VmRSS: {} kB\n",
+				(state.rssAnon + state.rssFile) / 1024);
+		std::format_to(std::back_inserter(buffer), "RssAnon: {} kB\n", state.rssAnon / 1024);
+		std::format_to(std::back_inserter(buffer), "RssFile: {} kB\n", state.rssFile / 1024);
+		buffer += "RssShmem: N/A kB\n";
+		buffer += "VmData: N/A kB\n";
+		buffer += "VmStk: N/A kB\n";
+		buffer += "VmExe: N/A kB\n";
+		buffer += "VmLib: N/A kB\n";
+		buffer += "VmPTE: N/A kB\n";
+		buffer += "VmSwap: 0 kB\n"; // We don't have swap yet.
+		buffer += "HugetlbPages: N/A kB\n";
+		// End of VM information.
+		buffer += "CoreDumping: 0\n"; // We don't implement coredumps, so 0 is correct here.
+		// Documentation doesn't mention THP_enabled.
+		buffer += "THP_enabled: N/A\n";
+		buffer += "Threads: 1\n"; // Number of threads in this process, hardcode to 1 for now.
+		// Signal related information, we should fill this out properly eventually.
+		buffer += "SigQ: N/A\n";
+		// Masks of pending, blocked, ignored and caught signals, zero them all.
+		buffer += "SigPnd: 0000000000000000\n";
+		buffer += "ShdPnd: 0000000000000000\n";
+		buffer += "SigBlk: 0000000000000000\n";
+		buffer += "SigIgn: 0000000000000000\n";
+		buffer += "SigCgt: 0000000000000000\n";
+		// End of signal related information.
+		// We don't implement capabilities, so 0 is good for all of them.
+		buffer += "CapInh: 0000000000000000\n";
+		buffer += "CapPrm: 0000000000000000\n";
+		buffer += "CapEff: 0000000000000000\n";
+		buffer += "CapBnd: 0000000000000000\n";
+		buffer += "CapAmb: 0000000000000000\n";
+		// We don't implement this bit, nor seccomp, nor spectre/meltdown mitigations.
+		buffer += "NoNewPrivs: 0\n";
+		buffer += "Seccomp: 0\n";
+		buffer += "Seccomp_filters: 0\n";
+		buffer += "Speculation_Store_Bypass: thread vulnerable\n";
+		buffer += "SpeculationIndirectBranch: thread vulnerable\n";
+		// Other stuff we don't implement yet.
+		buffer += "Cpus_allowed: N/A\n";
+		buffer += "Cpus_allowed_list: N/A\n";
+		buffer += "Mems_allowed: N/A\n";
+		buffer += "Mems_allowed_list: N/A\n";
+		buffer += "voluntary_ctxt_switches: N/A\n";
+		buffer += "nonvoluntary_ctxt_switches: N/A\n";
+	});
+}
+
 async::result<void> StatusNode::store(std::string) {
 	// TODO: proper error reporting.
 	std::println("Can't store to a /proc/status file!");
@@ -845,7 +1142,11 @@ async::result<std::string> CgroupNode::show(Process *) {
 	// See man 7 cgroups for more details, I'm emulating cgroups2 here.
 	// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
 	std::stringstream stream;
-	stream << "0::/init.scope\n";
+	if(auto cgroup = _process->cgroup(); cgroup) {
+		stream << "0::" << cgroup->cgroupPath() << "\n";
+	}else{
+		stream << "0::/init.scope\n";
+	}
 	co_return stream.str();
 }
 
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <tuple>
+
 #include <protocols/fs/server.hpp>
 
 #include "vfs.hpp"
@@ -26,6 +31,26 @@ struct LinkCompare {
 	bool operator() (const std::string &name, const std::shared_ptr<Link> &link) const;
 };
 
+// Buffer for the contents of a file that is only regenerated if the state that the
+// contents are generated from changed since the last call. Key is a snapshot of that state.
+template<typename Key>
+struct CachedContents {
+	template<typename F>
+	const std::string &get(Key key, F generate) {
+		if(_key != key) {
+			_buffer.clear();
+			generate(_buffer);
+			_key = std::move(key);
+		}
+		return _buffer;
+	}
+
+private:
+	std::optional<Key> _key;
+	// Keeps its capacity across regenerations.
+	std::string _buffer;
+};
+
 struct RegularFile final : File {
 public:
 	static void serve(smarter::shared_ptr<RegularFile> file);
@@ -298,6 +323,65 @@ private:
 	std::string bootId_;
 };
 
+struct KernelStatNode final : RegularNode {
+	KernelStatNode() {}
+
+	async::result<std::string> show(Process *) override;
+	async::result<void> store(std::string) override;
+};
+
+struct VmstatNode final : RegularNode {
+	VmstatNode() {}
+
+	async::result<std::string> show(Process *) override;
+	async::result<void> store(std::string) override;
+};
+
+struct MeminfoNode final : RegularNode {
+	MeminfoNode() {}
+
+	async::result<std::string> show(Process *) override;
+	async::result<void> store(std::string) override;
+};
+
+struct DiskstatsNode final : RegularNode {
+	DiskstatsNode() {}
+
+	async::result<std::string> show(Process *) override;
+	async::result<void> store(std::string) override;
+};
+
+struct LockStatNode final : RegularNode {
+	LockStatNode() {}
+
+	async::result<std::string> show(Process *) override;
+	async::result<void> store(std::string) override;
+};
+
+struct PosixRequestsNode final : RegularNode {
+	PosixRequestsNode() {}
+
+	async::result<std::string> show(Process *) override;
+	async::result<void> store(std::string) override;
+};
+
+struct PosixDentryCacheNode final : RegularNode {
+	PosixDentryCacheNode() {}
+
+	async::result<std::string> show(Process *) override;
+	async::result<void> store(std::string) override;
+};
+
+// Statistics of all processes in a single file (similar to Linux' taskstats).
+struct PosixTaskstatsNode final : RegularNode {
+	PosixTaskstatsNode() {}
+
+	async::result<std::string> show(Process *) override;
+	async::result<void> store(std::string) override;
+private:
+	std::string _buffer;
+};
+
 struct CommNode final : RegularNode {
 	CommNode(Process *process)
 	: _process(process)
@@ -319,6 +403,35 @@ struct StatNode final : RegularNode {
 	async::result<std::string> show(Process *) override;
 	async::result<void> store(std::string) override;
 
+	async::result<frg::expected<Error, FileStats>> getStats() override;
+private:
+	struct State {
+		std::string name;
+		pid_t ppid;
+		pid_t pgid;
+		pid_t sid;
+		uint64_t userTime;
+		uint64_t systemTime;
+		uint64_t childrenUserTime;
+		uint64_t childrenSystemTime;
+		size_t vsize;
+		size_t rss;
+
+		bool operator== (const State &) const = default;
+	};
+
+	Process *_process;
+	CachedContents<State> _contents;
+};
+
+struct SchedstatNode final : RegularNode {
+	SchedstatNode(Process *process)
+	: _process(process)
+	{ }
+
+	async::result<std::string> show(Process *) override;
+	async::result<void> store(std::string) override;
+
 	async::result<frg::expected<Error, FileStats>> getStats() override;
 private:
 	Process *_process;
@@ -332,6 +445,21 @@ struct StatmNode final : RegularNode {
 	async::result<std::string> show(Process *) override;
 	async::result<void> store(std::string) override;
 
+	async::result<frg::expected<Error, FileStats>> getStats() override;
+private:
+	Process *_process;
+	// Virtual size, resident (anonymous) and resident (file) memory in bytes.
+	CachedContents<std::tuple<size_t, size_t, size_t>> _contents;
+};
+
+struct SmapsRollupNode final : RegularNode {
+	SmapsRollupNode(Process *process)
+	: _process(process)
+	{ }
+
+	async::result<std::string> show(Process *) override;
+	async::result<void> store(std::string) override;
+
 	async::result<frg::expected<Error, FileStats>> getStats() override;
 private:
 	Process *_process;
@@ -347,7 +475,20 @@ struct StatusNode final : RegularNode {
 
 	async::result<frg::expected<Error, FileStats>> getStats() override;
 private:
+	struct State {
+		std::string name;
+		pid_t ppid;
+		int uid;
+		int gid;
+		size_t vmSize;
+		size_t rssAnon;
+		size_t rssFile;
+
+		bool operator== (const State &) const = default;
+	};
+
 	Process *_process;
+	CachedContents<State> _contents;
 };
 
 struct FdDirectoryFile final : File {
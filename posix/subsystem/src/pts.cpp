@@ -1,6 +1,5 @@
 #include <asm/ioctls.h>
 #include <linux/magic.h>
-#include <numeric>
 #include <termios.h>
 #include <sys/epoll.h>
 #include <signal.h>
@@ -31,6 +30,10 @@ bool logAttrs = false;
 
 int nextPtsIndex = 0;
 
+// Linux limits the data that is pending on the master side of a pty to 64 KiB.
+// Writers to the slave block while the output buffer is full.
+constexpr size_t outputCapacity = 64 * 1024;
+
 extern std::shared_ptr<RootLink> globalRootLink;
 
 //-----------------------------------------------------------------------------
@@ -44,7 +47,7 @@ struct Packet {
 
 struct Channel {
 	Channel(int pts_index)
-	: ptsIndex{pts_index}, currentSeq{1}, masterInSeq{0}, slaveInSeq{0} {
+	: ptsIndex{pts_index}, currentSeq{1}, masterInSeq{0}, slaveInSeq{0}, slaveOutSeq{1} {
 		memset(&activeSettings, 0, sizeof(struct termios));
 		// cflag: Linux also stores a baud rate here.
 		// lflag: Linux additionally sets ECHOCTL, ECHOKE (which we do not have).
@@ -71,6 +74,67 @@ struct Channel {
 
 	async::result<void> commonIoctl(Process *process, uint32_t id, helix_ng::RecvInlineResult msg, helix::UniqueLane conversation);
 
+	size_t outputSpace() {
+		return outputCapacity - outputUsed;
+	}
+
+	// Performs output processing on the data and appends the result to the output buffer.
+	// Returns the number of bytes of data that fit into the buffer.
+	size_t postOutput(const char *data, size_t length) {
+		bool wasEmpty = !outputUsed;
+
+		size_t consumed;
+		if(!(activeSettings.c_oflag & OPOST) || !(activeSettings.c_oflag & ONLCR)) {
+			// Fast path: ONLCR is the only output processing that we implement.
+			consumed = std::min(length, outputSpace());
+			appendOutput_(data, consumed);
+		}else{
+			// Copy everything between newlines at once.
+			consumed = 0;
+			while(consumed < length) {
+				auto rest = data + consumed;
+				auto newline = static_cast<const char *>(memchr(rest, '\n', length - consumed));
+				size_t run = std::min(newline ? size_t(newline - rest) : length - consumed,
+						outputSpace());
+				appendOutput_(rest, run);
+				consumed += run;
+				if(rest + run != newline || outputSpace() < 2)
+					break;
+				appendOutput_("\r\n", 2);
+				consumed++;
+			}
+		}
+
+		// Readers only wait while the buffer is empty; wake them once per batch.
+		if(wasEmpty && outputUsed) {
+			masterInSeq = ++currentSeq;
+			statusBell.raise();
+		}
+		return consumed;
+	}
+
+	// Moves up to length bytes out of the output buffer.
+	size_t consumeOutput(void *data, size_t length) {
+		bool wasFull = outputSpace() < 2;
+
+		length = std::min(length, outputUsed);
+		auto first = std::min(length, outputCapacity - outputHead);
+		memcpy(data, outputBuffer.get() + outputHead, first);
+		memcpy(static_cast<char *>(data) + first, outputBuffer.get(), length - first);
+		outputHead = (outputHead + length) % outputCapacity;
+		outputUsed -= length;
+		// Restart at the beginning such that future copies are contiguous.
+		if(!outputUsed)
+			outputHead = 0;
+
+		// Writers only wait while the buffer is full (see SlaveFile::writeAll()).
+		if(wasFull && length) {
+			slaveOutSeq = ++currentSeq;
+			statusBell.raise();
+		}
+		return length;
+	}
+
 	int ptsIndex;
 	ControllingTerminalState cts;
 
@@ -86,30 +150,31 @@ struct Channel {
 	uint64_t currentSeq;
 	uint64_t masterInSeq;
 	uint64_t slaveInSeq;
+	uint64_t slaveOutSeq;
 
-	// The actual queue of this pipe.
-	std::deque<Packet> masterQueue;
-	std::deque<Packet> slaveQueue;
-};
-
-namespace {
+	// Output that is read from the master side. It is stored in a ring buffer of
+	// outputCapacity bytes that is allocated on the first write.
+	std::unique_ptr<char[]> outputBuffer;
+	size_t outputHead = 0;
+	size_t outputUsed = 0;
 
-void processOut(const char c, Packet &packet, std::shared_ptr<Channel> channel) {
-	if(!(channel->activeSettings.c_oflag & OPOST)) {
-		packet.buffer.push_back(c);
-		return;
-	}
+	// Input that is read from the slave side.
+	std::deque<Packet> slaveQueue;
 
-	if((channel->activeSettings.c_oflag & ONLCR) && c == '\n') {
-		packet.buffer.push_back('\r');
-		packet.buffer.push_back('\n');
-		return;
+private:
+	void appendOutput_(const char *data, size_t length) {
+		assert(length <= outputSpace());
+		if(!outputBuffer)
+			outputBuffer = std::make_unique<char[]>(outputCapacity);
+		auto tail = (outputHead + outputUsed) % outputCapacity;
+		auto first = std::min(length, outputCapacity - tail);
+		memcpy(outputBuffer.get() + tail, data, first);
+		memcpy(outputBuffer.get(), data + first, length - first);
+		outputUsed += length;
 	}
+};
 
-	packet.buffer.push_back(c);
-
-	return;
-}
+namespace {
 
 void processIn(const char character, Packet &packet, std::shared_ptr<Channel> channel) {
 	auto enqueuePacket = [&channel](Packet packet) {
@@ -118,16 +183,9 @@ void processIn(const char character, Packet &packet, std::shared_ptr<Channel> ch
 		channel->statusBell.raise();
 	};
 
+	// Like on Linux, echoes are dropped if the output buffer is full.
 	auto enqueueOut = [&channel](Packet packet) {
-		Packet parsed{};
-
-		for(auto c : packet.buffer) {
-			processOut(c, parsed, channel);
-		}
-
-		channel->masterQueue.push_back(std::move(parsed));
-		channel->masterInSeq = ++channel->currentSeq;
-		channel->statusBell.raise();
+		channel->postOutput(packet.buffer.data(), packet.buffer.size());
 	};
 
 	auto is_control_char = [](char c) -> bool {
@@ -471,7 +529,6 @@ private:
 	helix::UniqueLane _passthrough;
 
 	std::shared_ptr<Channel> _channel;
-	Packet _packet{};
 
 	bool nonBlock_;
 };
@@ -761,19 +818,14 @@ MasterFile::readSome(Process *, void *data, size_t maxLength) {
 	if(!maxLength)
 		co_return 0;
 
-	if (_channel->masterQueue.empty() && _nonBlocking)
+	if (!_channel->outputUsed && _nonBlocking)
 		co_return Error::wouldBlock;
 
-	while(_channel->masterQueue.empty())
+	while(!_channel->outputUsed)
 		co_await _channel->statusBell.async_wait();
 
-	auto packet = &_channel->masterQueue.front();
-	size_t chunk = std::min(packet->buffer.size() - packet->offset, maxLength);
+	auto chunk = _channel->consumeOutput(data, maxLength);
 	assert(chunk); // Otherwise, we return above due to !maxLength.
-	memcpy(data, packet->buffer.data() + packet->offset, chunk);
-	packet->offset += chunk;
-	if(packet->offset == packet->buffer.size())
-		_channel->masterQueue.pop_front();
 	co_return chunk;
 }
 
@@ -829,7 +881,7 @@ async::result<frg::expected<Error, PollStatusResult>>
 MasterFile::pollStatus(Process *) {
 	// For now making pts files always writable is sufficient.
 	int events = EPOLLOUT;
-	if(!_channel->masterQueue.empty())
+	if(_channel->outputUsed)
 		events |= EPOLLIN;
 
 	co_return PollStatusResult{_channel->currentSeq, events};
@@ -884,11 +936,7 @@ async::result<void> MasterFile::ioctl(Process *process, uint32_t id, helix_ng::R
 		}else if(req->command() == FIONREAD) {
 			managarm::fs::GenericIoctlReply resp;
 
-			size_t count = std::transform_reduce(_channel->masterQueue.begin(), _channel->masterQueue.end(), size_t{0}, std::plus<>(), [] (const Packet &p) {
-				return p.buffer.size() - p.offset;
-			});
-
-			resp.set_fionread_count(count);
+			resp.set_fionread_count(_channel->outputUsed);
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 
 			auto ser = resp.SerializeAsString();
@@ -1015,18 +1063,25 @@ SlaveFile::writeAll(Process *, const void *data, size_t length) {
 	if(!length)
 		co_return {};
 
-	// Perform output processing.
-	for(size_t i = 0; i < length; i++) {
-		char c;
-		memcpy(&c, reinterpret_cast<const char *>(data) + i, 1);
-		processOut(c, _packet, _channel);
+	auto s = reinterpret_cast<const char *>(data);
+	size_t written = 0;
+	while(true) {
+		written += _channel->postOutput(s + written, length - written);
+		if(written == length)
+			break;
+
+		// A newline can expand to two bytes, hence wait until there is room for both.
+		if(_channel->outputSpace() < 2) {
+			if(nonBlock_) {
+				if(written)
+					break;
+				co_return Error::wouldBlock;
+			}
+			while(_channel->outputSpace() < 2)
+				co_await _channel->statusBell.async_wait();
+		}
 	}
-
-	_channel->masterQueue.push_back(std::move(_packet));
-	_channel->masterInSeq = ++_channel->currentSeq;
-	_channel->statusBell.raise();
-	_packet = Packet{};
-	co_return length;
+	co_return written;
 }
 
 async::result<frg::expected<Error, ControllingTerminalState *>>
@@ -1043,20 +1098,22 @@ SlaveFile::pollWait(Process *, uint64_t past_seq, int mask,
 			&& !cancellation.is_cancellation_requested())
 		co_await _channel->statusBell.async_wait(cancellation);
 
-	// For now making pts files always writable is sufficient.
-	int edges = EPOLLOUT;
+	int edges = 0;
 	if(_channel->slaveInSeq > past_seq)
 		edges |= EPOLLIN;
+	if(_channel->slaveOutSeq > past_seq)
+		edges |= EPOLLOUT;
 
 	co_return PollWaitResult{_channel->currentSeq, edges};
 }
 
 async::result<frg::expected<Error, PollStatusResult>>
 SlaveFile::pollStatus(Process *) {
-	// For now making pts files always writable is sufficient.
-	int events = EPOLLOUT;
+	int events = 0;
 	if(!_channel->slaveQueue.empty())
 		events |= EPOLLIN;
+	if(_channel->outputSpace() >= 2)
+		events |= EPOLLOUT;
 
 	co_return PollStatusResult{_channel->currentSeq, events};
 }
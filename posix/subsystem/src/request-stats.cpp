@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <array>
+#include <format>
+#include <map>
+#include <unordered_map>
+
+#include <bragi/helpers-std.hpp>
+#include <posix.bragi.hpp>
+
+#include "request-stats.hpp"
+
+namespace posix {
+
+namespace {
+
+// Bucket i counts latencies in [2^i, 2^(i + 1)) ns; the last bucket also counts all larger ones.
+constexpr int numBuckets = 40;
+
+struct RequestStats {
+	uint64_t count = 0;
+	uint64_t totalNanos = 0;
+	uint64_t maxNanos = 0;
+	std::array<uint64_t, numBuckets> buckets{};
+
+	void record(uint64_t nanos) {
+		count++;
+		totalNanos += nanos;
+		maxNanos = std::max(maxNanos, nanos);
+		int b = nanos ? 63 - __builtin_clzll(nanos) : 0;
+		buckets[std::min(b, numBuckets - 1)]++;
+	}
+
+	// Upper bound on the q-quantile, derived from the histogram.
+	uint64_t quantile(double q) const {
+		auto rank = static_cast<uint64_t>(q * count);
+		uint64_t seen = 0;
+		for(int b = 0; b < numBuckets - 1; b++) {
+			seen += buckets[b];
+			if(seen > rank)
+				return std::min((uint64_t{1} << (b + 1)) - 1, maxNanos);
+		}
+		return maxNanos;
+	}
+};
+
+// serveRequests() runs on a single thread, hence no locking is needed.
+std::unordered_map<uint32_t, RequestStats> messageStats;
+std::unordered_map<uint32_t, RequestStats> legacyStats;
+
+const std::unordered_map<uint32_t, const char *> messageNames{
+	{bragi::message_id<managarm::posix::VmMapRequest>, "VmMapRequest"},
+	{bragi::message_id<managarm::posix::OpenAtRequest>, "OpenAtRequest"},
+	{bragi::message_id<managarm::posix::CloseRequest>, "CloseRequest"},
+	{bragi::message_id<managarm::posix::IsTtyRequest>, "IsTtyRequest"},
+	{bragi::message_id<managarm::posix::RenameAtRequest>, "RenameAtRequest"},
+	{bragi::message_id<managarm::posix::GetUidRequest>, "GetUidRequest"},
+	{bragi::message_id<managarm::posix::SetUidRequest>, "SetUidRequest"},
+	{bragi::message_id<managarm::posix::GetEuidRequest>, "GetEuidRequest"},
+	{bragi::message_id<managarm::posix::SetEuidRequest>, "SetEuidRequest"},
+	{bragi::message_id<managarm::posix::GetGidRequest>, "GetGidRequest"},
+	{bragi::message_id<managarm::posix::GetEgidRequest>, "GetEgidRequest"},
+	{bragi::message_id<managarm::posix::SetGidRequest>, "SetGidRequest"},
+	{bragi::message_id<managarm::posix::SetEgidRequest>, "SetEgidRequest"},
+	{bragi::message_id<managarm::posix::UnlinkAtRequest>, "UnlinkAtRequest"},
+	{bragi::message_id<managarm::posix::FstatAtRequest>, "FstatAtRequest"},
+	{bragi::message_id<managarm::posix::MkfifoAtRequest>, "MkfifoAtRequest"},
+	{bragi::message_id<managarm::posix::LinkAtRequest>, "LinkAtRequest"},
+	{bragi::message_id<managarm::posix::FchmodAtRequest>, "FchmodAtRequest"},
+	{bragi::message_id<managarm::posix::UtimensAtRequest>, "UtimensAtRequest"},
+	{bragi::message_id<managarm::posix::RmdirRequest>, "RmdirRequest"},
+	{bragi::message_id<managarm::posix::InotifyAddRequest>, "InotifyAddRequest"},
+	{bragi::message_id<managarm::posix::InotifyCreateRequest>, "InotifyCreateRequest"},
+	{bragi::message_id<managarm::posix::EventfdCreateRequest>, "EventfdCreateRequest"},
+	{bragi::message_id<managarm::posix::SocketRequest>, "SocketRequest"},
+	{bragi::message_id<managarm::posix::SockpairRequest>, "SockpairRequest"},
+	{bragi::message_id<managarm::posix::AcceptRequest>, "AcceptRequest"},
+	{bragi::message_id<managarm::posix::MountRequest>, "MountRequest"},
+	{bragi::message_id<managarm::posix::SymlinkAtRequest>, "SymlinkAtRequest"},
+	{bragi::message_id<managarm::posix::GetPpidRequest>, "GetPpidRequest"},
+	{bragi::message_id<managarm::posix::MknodAtRequest>, "MknodAtRequest"},
+	{bragi::message_id<managarm::posix::GetPgidRequest>, "GetPgidRequest"},
+	{bragi::message_id<managarm::posix::SetPgidRequest>, "SetPgidRequest"},
+	{bragi::message_id<managarm::posix::GetSidRequest>, "GetSidRequest"},
+	{bragi::message_id<managarm::posix::IoctlFioclexRequest>, "IoctlFioclexRequest"},
+	{bragi::message_id<managarm::posix::MemFdCreateRequest>, "MemFdCreateRequest"},
+	{bragi::message_id<managarm::posix::GetPidRequest>, "GetPidRequest"},
+	{bragi::message_id<managarm::posix::AccessAtRequest>, "AccessAtRequest"},
+	{bragi::message_id<managarm::posix::MkdirAtRequest>, "MkdirAtRequest"},
+	{bragi::message_id<managarm::posix::GetAffinityRequest>, "GetAffinityRequest"},
+	{bragi::message_id<managarm::posix::SetAffinityRequest>, "SetAffinityRequest"},
+	{bragi::message_id<managarm::posix::WaitIdRequest>, "WaitIdRequest"},
+	{bragi::message_id<managarm::posix::ReadlinkAtRequest>, "ReadlinkAtRequest"},
+	{bragi::message_id<managarm::posix::NetserverRequest>, "NetserverRequest"},
+	{bragi::message_id<managarm::posix::GetMemoryInformationRequest>, "GetMemoryInformationRequest"},
+	{bragi::message_id<managarm::posix::SysconfRequest>, "SysconfRequest"},
+	{bragi::message_id<managarm::posix::RebootRequest>, "RebootRequest"},
+	{bragi::message_id<managarm::posix::FstatfsRequest>, "FstatfsRequest"},
+	{bragi::message_id<managarm::posix::ParentDeathSignalRequest>, "ParentDeathSignalRequest"},
+	{bragi::message_id<managarm::posix::SetIntervalTimerRequest>, "SetIntervalTimerRequest"},
+	{bragi::message_id<managarm::posix::Dup2Request>, "Dup2Request"},
+	{bragi::message_id<managarm::posix::InotifyRmRequest>, "InotifyRmRequest"},
+	{bragi::message_id<managarm::posix::TimerFdCreateRequest>, "TimerFdCreateRequest"},
+	{bragi::message_id<managarm::posix::TimerFdSetRequest>, "TimerFdSetRequest"},
+	{bragi::message_id<managarm::posix::PidfdOpenRequest>, "PidfdOpenRequest"},
+	{bragi::message_id<managarm::posix::PidfdSendSignalRequest>, "PidfdSendSignalRequest"},
+	{bragi::message_id<managarm::posix::PidfdGetPidRequest>, "PidfdGetPidRequest"},
+	{bragi::message_id<managarm::posix::TimerFdGetRequest>, "TimerFdGetRequest"},
+	{bragi::message_id<managarm::posix::TimerCreateRequest>, "TimerCreateRequest"},
+	{bragi::message_id<managarm::posix::TimerSetRequest>, "TimerSetRequest"},
+	{bragi::message_id<managarm::posix::TimerGetRequest>, "TimerGetRequest"},
+	{bragi::message_id<managarm::posix::TimerDeleteRequest>, "TimerDeleteRequest"},
+	{bragi::message_id<managarm::posix::SetPipeSizeRequest>, "SetPipeSizeRequest"},
+	{bragi::message_id<managarm::posix::GetPipeSizeRequest>, "GetPipeSizeRequest"},
+	{bragi::message_id<managarm::posix::SpliceRequest>, "SpliceRequest"},
+	{bragi::message_id<managarm::posix::TeeRequest>, "TeeRequest"},
+	{bragi::message_id<managarm::posix::VmspliceRequest>, "VmspliceRequest"},
+	{bragi::message_id<managarm::posix::CopyFileRangeRequest>, "CopyFileRangeRequest"},
+	{bragi::message_id<managarm::posix::SendfileRequest>, "SendfileRequest"},
+	{bragi::message_id<managarm::posix::SpawnRequest>, "SpawnRequest"},
+	{bragi::message_id<managarm::posix::VmAdviseRequest>, "VmAdviseRequest"},
+};
+
+const std::unordered_map<uint32_t, const char *> legacyNames{
+	{managarm::posix::CntReqType::INIT, "INIT"},
+	{managarm::posix::CntReqType::FORK, "FORK"},
+	{managarm::posix::CntReqType::EXEC, "EXEC"},
+	{managarm::posix::CntReqType::WAIT, "WAIT"},
+	{managarm::posix::CntReqType::VM_REMAP, "VM_REMAP"},
+	{managarm::posix::CntReqType::VM_PROTECT, "VM_PROTECT"},
+	{managarm::posix::CntReqType::VM_UNMAP, "VM_UNMAP"},
+	{managarm::posix::CntReqType::MOUNT, "MOUNT"},
+	{managarm::posix::CntReqType::CHROOT, "CHROOT"},
+	{managarm::posix::CntReqType::CHDIR, "CHDIR"},
+	{managarm::posix::CntReqType::FCHDIR, "FCHDIR"},
+	{managarm::posix::CntReqType::SYMLINKAT, "SYMLINKAT"},
+	{managarm::posix::CntReqType::READLINK, "READLINK"},
+	{managarm::posix::CntReqType::READ, "READ"},
+	{managarm::posix::CntReqType::WRITE, "WRITE"},
+	{managarm::posix::CntReqType::SEEK_ABS, "SEEK_ABS"},
+	{managarm::posix::CntReqType::SEEK_REL, "SEEK_REL"},
+	{managarm::posix::CntReqType::SEEK_EOF, "SEEK_EOF"},
+	{managarm::posix::CntReqType::DUP, "DUP"},
+	{managarm::posix::CntReqType::DUP2, "DUP2"},
+	{managarm::posix::CntReqType::TTY_NAME, "TTY_NAME"},
+	{managarm::posix::CntReqType::GETCWD, "GETCWD"},
+	{managarm::posix::CntReqType::FD_GET_FLAGS, "FD_GET_FLAGS"},
+	{managarm::posix::CntReqType::FD_SET_FLAGS, "FD_SET_FLAGS"},
+	{managarm::posix::CntReqType::GET_RESOURCE_USAGE, "GET_RESOURCE_USAGE"},
+	{managarm::posix::CntReqType::SETSID, "SETSID"},
+	{managarm::posix::CntReqType::SIG_ACTION, "SIG_ACTION"},
+	{managarm::posix::CntReqType::PIPE_CREATE, "PIPE_CREATE"},
+	{managarm::posix::CntReqType::EPOLL_CALL, "EPOLL_CALL"},
+	{managarm::posix::CntReqType::EPOLL_CREATE, "EPOLL_CREATE"},
+	{managarm::posix::CntReqType::EPOLL_ADD, "EPOLL_ADD"},
+	{managarm::posix::CntReqType::EPOLL_MODIFY, "EPOLL_MODIFY"},
+	{managarm::posix::CntReqType::EPOLL_DELETE, "EPOLL_DELETE"},
+	{managarm::posix::CntReqType::EPOLL_WAIT, "EPOLL_WAIT"},
+	{managarm::posix::CntReqType::SIGNALFD_CREATE, "SIGNALFD_CREATE"},
+	{managarm::posix::CntReqType::HELFD_ATTACH, "HELFD_ATTACH"},
+	{managarm::posix::CntReqType::HELFD_CLONE, "HELFD_CLONE"},
+	{managarm::posix::CntReqType::FD_SERVE, "FD_SERVE"},
+	{managarm::posix::CntReqType::FD_ACCESS_MEMORY, "FD_ACCESS_MEMORY"},
+};
+
+} // anonymous namespace
+
+void recordRequest(uint32_t id, bool legacy, uint64_t nanos) {
+	auto &stats = legacy ? legacyStats : messageStats;
+	stats[id].record(nanos);
+}
+
+std::string formatRequestStats() {
+	// Sort by name to make the output stable.
+	std::map<std::string, const RequestStats *> sorted;
+	for(auto &[id, stats] : messageStats) {
+		auto it = messageNames.find(id);
+		sorted.emplace(it != messageNames.end() ? it->second
+				: std::format("message-{}", id), &stats);
+	}
+	for(auto &[type, stats] : legacyStats) {
+		auto it = legacyNames.find(type);
+		sorted.emplace(it != legacyNames.end() ? std::format("CntRequest/{}", it->second)
+				: std::format("CntRequest/{}", type), &stats);
+	}
+
+	std::string out = "request count total-ns max-ns p50-ns p99-ns p999-ns\n";
+	for(auto &[name, stats] : sorted)
+		out += std::format("{} {} {} {} {} {} {}\n", name, stats->count, stats->totalNanos,
+				stats->maxNanos, stats->quantile(0.5), stats->quantile(0.99),
+				stats->quantile(0.999));
+	return out;
+}
+
+void resetRequestStats() {
+	messageStats.clear();
+	legacyStats.clear();
+}
+
+} // namespace posix
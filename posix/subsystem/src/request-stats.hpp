@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include <protocols/ostrace/ostrace.hpp>
+
+namespace posix {
+
+// Records the number and latency of the requests that serveRequests() handles.
+// Latencies include the time that requests block (e.g., in WAIT or EPOLL_WAIT).
+void recordRequest(uint32_t id, bool legacy, uint64_t nanos);
+
+// Renders the statistics for /proc/posix_requests.
+std::string formatRequestStats();
+
+void resetRequestStats();
+
+// Records a request when it goes out of scope, i.e., also if serveRequests() bails out early.
+struct RequestScope {
+	RequestScope(protocols::ostrace::Timer &timer, uint32_t id)
+	: timer_{timer}, id_{id} { }
+
+	RequestScope(const RequestScope &) = delete;
+	RequestScope &operator= (const RequestScope &) = delete;
+
+	~RequestScope() {
+		recordRequest(id_, legacy_, timer_.elapsed());
+	}
+
+	// CntRequests are keyed by their request type instead of the message ID.
+	void setLegacyType(uint32_t type) {
+		legacy_ = true;
+		id_ = type;
+	}
+
+private:
+	protocols::ostrace::Timer &timer_;
+	uint32_t id_;
+	bool legacy_ = false;
+};
+
+} // namespace posix
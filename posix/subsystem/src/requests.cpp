@@ -1,5 +1,6 @@
 #include <format>
 #include <print>
+#include <fcntl.h>
 #include <linux/netlink.h>
 #include <sys/inotify.h>
 #include <sys/mman.h>
@@ -21,9 +22,11 @@
 #include "extern_socket.hpp"
 #include "fifo.hpp"
 #include "inotify.hpp"
+#include "io_uring.hpp"
 #include "memfd.hpp"
 #include "ostrace.hpp"
 #include "pts.hpp"
+#include "request-stats.hpp"
 #include "requests.hpp"
 #include "signalfd.hpp"
 #include "sysfs.hpp"
@@ -32,6 +35,7 @@
 #include "eventfd.hpp"
 #include "signalfd.hpp"
 #include "tmp_fs.hpp"
+#include "timer-queue.hpp"
 #include "cgroupfs.hpp"
 #include "pidfd.hpp"
 
@@ -44,6 +48,88 @@
 #include "clocks.hpp"
 #include "debug-options.hpp"
 
+namespace {
+
+// Opens the file of a posix_spawn() open action on behalf of process.
+async::result<frg::expected<Error, smarter::shared_ptr<File, FileHandle>>>
+openSpawnFile(Process *process, std::string path, uint32_t flags, int mode) {
+	SemanticFlags semanticFlags = 0;
+	if(flags & managarm::posix::OpenFlags::OF_NONBLOCK)
+		semanticFlags |= semanticNonBlock;
+
+	if(flags & managarm::posix::OpenFlags::OF_RDONLY)
+		semanticFlags |= semanticRead;
+	else if(flags & managarm::posix::OpenFlags::OF_WRONLY)
+		semanticFlags |= semanticWrite;
+	else if(flags & managarm::posix::OpenFlags::OF_RDWR)
+		semanticFlags |= semanticRead | semanticWrite;
+
+	if(flags & managarm::posix::OpenFlags::OF_APPEND)
+		semanticFlags |= semanticAppend;
+	if(flags & managarm::posix::OpenFlags::OF_DIRECT)
+		semanticFlags |= semanticDirect;
+	if(flags & managarm::posix::OpenFlags::OF_POLLED)
+		semanticFlags |= semanticPolled;
+
+	auto mapResolveError = [] (protocols::fs::Error e) -> Error {
+		if(e == protocols::fs::Error::isDirectory)
+			return Error::isDirectory;
+		if(e == protocols::fs::Error::notDirectory)
+			return Error::notDirectory;
+		return Error::noSuchFile;
+	};
+
+	PathResolver resolver;
+	resolver.setup(process->fsContext()->getRoot(),
+			process->fsContext()->getWorkingDirectory(), std::move(path), process);
+
+	smarter::shared_ptr<File, FileHandle> file;
+	if(flags & managarm::posix::OpenFlags::OF_CREATE) {
+		auto resolveResult = co_await resolver.resolve(resolvePrefix | resolveNoTrailingSlash);
+		if(!resolveResult)
+			co_return mapResolveError(resolveResult.error());
+
+		auto directory = resolver.currentLink()->getTarget();
+		auto tail = FRG_CO_TRY(co_await directory->getLink(resolver.nextComponent()));
+		if(tail) {
+			if(flags & managarm::posix::OpenFlags::OF_EXCLUSIVE)
+				co_return Error::alreadyExists;
+			auto target = tail->getTarget();
+			file = FRG_CO_TRY(co_await target->open(resolver.currentView(),
+					std::move(tail), semanticFlags));
+		}else{
+			assert(directory->superblock());
+			auto node = co_await directory->superblock()->createRegular(process);
+			if(!node)
+				co_return Error::noSuchFile;
+			if(auto e = co_await node->chmod(mode); e != Error::success)
+				co_return e;
+			auto link = FRG_CO_TRY(co_await directory->link(resolver.nextComponent(), node));
+			file = FRG_CO_TRY(co_await node->open(resolver.currentView(),
+					std::move(link), semanticFlags));
+		}
+	}else{
+		auto resolveResult = co_await resolver.resolve();
+		if(!resolveResult)
+			co_return mapResolveError(resolveResult.error());
+
+		auto target = resolver.currentLink()->getTarget();
+		if(target->getType() == VfsType::symlink)
+			co_return Error::illegalArguments;
+		file = FRG_CO_TRY(co_await target->open(resolver.currentView(),
+				resolver.currentLink(), semanticFlags));
+	}
+	assert(file);
+
+	if(flags & managarm::posix::OpenFlags::OF_TRUNC) {
+		auto result = co_await file->truncate(0);
+		assert(result || result.error() == protocols::fs::Error::illegalOperationTarget);
+	}
+	co_return std::move(file);
+}
+
+} // anonymous namespace
+
 async::result<void> serveRequests(std::shared_ptr<Process> self,
 		std::shared_ptr<Generation> generation) {
 	auto logRequest = [&self]<class... Args>(bool cond, std::string_view name,
@@ -85,6 +171,8 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 		assert(!preamble.error());
 		recv_head.reset();
 
+		posix::RequestScope requestScope{timer, preamble.id()};
+
 		timespec requestTimestamp = {};
 		auto logBragiRequest = [&self, &recv_head, &requestTimestamp](std::span<uint8_t> tail) {
 			if(!posix::ostContext.isActive())
@@ -150,6 +238,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			}
 
 			req = *o;
+			requestScope.setLegacyType(req.request_type());
 		}
 
 		if(preamble.id() == bragi::message_id<managarm::posix::GetPidRequest>) {
@@ -386,6 +475,9 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				wait_pid = req->id();
 			} else if(req->idtype() == P_ALL) {
 				wait_pid = -1;
+			} else if(req->idtype() == P_PGID) {
+				// Zero selects our own process group, just like for wait().
+				wait_pid = -req->id();
 			} else if(req->idtype() == P_PIDFD) {
 				auto fd = self->fileContext()->getFile(req->id());
 				if(!fd || fd->kind() != FileKind::pidfd) {
@@ -395,10 +487,16 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				}
 				auto pidfd = smarter::static_pointer_cast<pidfd::OpenFile>(fd);
 				wait_pid = pidfd->pid();
+				// The process was already reaped; do not fall back to waiting for any child.
+				if(wait_pid == -1) {
+					co_await sendErrorResponse.template operator()<managarm::posix::WaitIdResponse>
+						(managarm::posix::Errors::NO_CHILD_PROCESSES);
+					continue;
+				}
 				if(pidfd->nonBlock())
 					flags |= waitNonBlocking;
 			} else {
-				std::cout << "\e[31mposix: WAIT_ID idtype other than P_PID, P_PIDFD and P_ALL are not implemented\e[39m" << std::endl;
+				std::cout << "\e[31mposix: WAIT_ID idtype other than P_PID, P_PGID, P_PIDFD and P_ALL are not implemented\e[39m" << std::endl;
 				co_await sendErrorResponse.template operator()<managarm::posix::WaitIdResponse>
 					(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
 				continue;
@@ -466,6 +564,9 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				resp.set_error(managarm::posix::Errors::SUCCESS);
 				resp.set_pid(proc_state.pid);
 				resp.set_ru_user_time(proc_state.stats.userTime);
+				resp.set_ru_system_time(proc_state.stats.systemTime);
+				resp.set_ru_nvcsw(proc_state.stats.voluntarySwitches);
+				resp.set_ru_nivcsw(proc_state.stats.involuntarySwitches);
 
 				uint32_t mode = 0;
 				if(auto byExit = std::get_if<TerminationByExit>(&proc_state.state); byExit) {
@@ -527,25 +628,24 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 		}else if(req.request_type() == managarm::posix::CntReqType::GET_RESOURCE_USAGE) {
 			logRequest(logRequests, "GET_RESOURCE_USAGE");
 
-			HelThreadStats stats;
-			HEL_CHECK(helQueryThreadStats(self->threadDescriptor().getHandle(), &stats));
-
 			int32_t mode = static_cast<int32_t>(req.mode());
-			uint64_t user_time;
+			ResourceUsage usage;
 			if(mode == RUSAGE_SELF) {
-				user_time = stats.userTime;
+				usage = self->ownUsage();
 			}else if(mode == RUSAGE_CHILDREN) {
-				user_time = self->accumulatedUsage().userTime;
+				usage = self->accumulatedUsage();
 			}else{
 				std::cout << "\e[31mposix: GET_RESOURCE_USAGE mode is not supported\e[39m"
 						<< std::endl;
-				user_time = 0;
 				// TODO: Return an error response.
 			}
 
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_ru_user_time(user_time);
+			resp.set_ru_user_time(usage.userTime);
+			resp.set_ru_system_time(usage.systemTime);
+			resp.set_ru_nvcsw(usage.voluntarySwitches);
+			resp.set_ru_nivcsw(usage.involuntarySwitches);
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
 				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
@@ -596,6 +696,9 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				throw std::runtime_error("posix: Handle illegal flags in VM_MAP");
 			}
 
+			bool populate = req->flags() & MAP_POPULATE;
+			bool populateForWrite = copyOnWrite && (req->mode() & PROT_WRITE);
+
 			uintptr_t hint = req->address_hint();
 
 			frg::expected<Error, void *> result;
@@ -617,11 +720,26 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			}else{
 				auto file = self->fileContext()->getFile(req->fd());
 				assert(file && "Illegal FD for VM_MAP");
+				SharedMapping shared;
+				if(!copyOnWrite) {
+					auto prepared = file->prepareSharedMapping(req->mode() & PROT_WRITE);
+					if(!prepared) {
+						assert(prepared.error() == Error::insufficientPermissions);
+						co_await sendErrorResponse(managarm::posix::Errors::INSUFFICIENT_PERMISSION);
+						continue;
+					}
+					shared = std::move(prepared.value());
+				}
+				if(shared.populate) {
+					populate = true;
+					populateForWrite = req->mode() & PROT_WRITE;
+				}
 				auto memory = co_await file->accessMemory();
 				assert(memory);
 				result = co_await self->vmContext()->mapFile(hint,
 						std::move(memory), std::move(file),
-						req->rel_offset(), req->size(), copyOnWrite, nativeFlags);
+						req->rel_offset(), req->size(), copyOnWrite, nativeFlags,
+						std::move(shared));
 			}
 
 			if(!result) {
@@ -635,6 +753,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			void *address = result.unwrap();
 
+			// Like Linux, we ignore failures to populate the mapping.
+			if(populate)
+				(void)self->vmContext()->populateRange(address, req->size(), populateForWrite);
+
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_offset(reinterpret_cast<uintptr_t>(address));
@@ -681,8 +803,17 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(req.mode() & PROT_EXEC)
 				native_flags |= kHelMapProtExecute;
 
-			co_await self->vmContext()->protectFile(
+			auto result = co_await self->vmContext()->protectFile(
 					reinterpret_cast<void *>(req.address()), req.size(), native_flags);
+			if(!result) {
+				assert(result.error() == Error::accessDenied);
+				resp.set_error(managarm::posix::Errors::ACCESS_DENIED);
+				auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
+					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+				);
+				HEL_CHECK(send_resp.error());
+				continue;
+			}
 
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
@@ -690,6 +821,185 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			);
 			HEL_CHECK(send_resp.error());
 			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::VmAdviseRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::VmAdviseRequest>(recv_head);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "VM_ADVISE", "address={:#08x} size={:#x} advice={}",
+					req->address(), req->size(), req->advice());
+
+			if(req->address() & 0xFFF) {
+				co_await sendErrorResponse.template operator()<managarm::posix::VmAdviseResponse>
+					(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
+			}
+
+			auto pointer = reinterpret_cast<void *>(req->address());
+			frg::expected<Error> outcome;
+			switch(req->advice()) {
+			case MADV_NORMAL:
+			case MADV_RANDOM:
+			case MADV_SEQUENTIAL:
+				// We do not perform readahead, so these are no-ops.
+				break;
+			case MADV_WILLNEED:
+				outcome = self->vmContext()->populateRange(pointer, req->size(), false);
+				break;
+			case MADV_DONTNEED:
+			case MADV_FREE:
+				// Freeing the pages immediately is a valid implementation of MADV_FREE.
+				outcome = self->vmContext()->decommitRange(pointer, req->size());
+				break;
+			default:
+				outcome = Error::illegalArguments;
+			}
+
+			if(!outcome) {
+				co_await sendErrorResponse.template operator()<managarm::posix::VmAdviseResponse>
+					(outcome.error() | toPosixProtoError);
+				continue;
+			}
+
+			managarm::posix::VmAdviseResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(sendResp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::IoUringSetupRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::IoUringSetupRequest>(recv_head);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "IO_URING_SETUP", "entries={} flags={:#x}",
+					req->entries(), req->flags());
+
+			io_uring_params params{};
+			params.flags = req->flags();
+			params.cq_entries = req->cq_entries();
+			auto fileOrError = io_uring::createFile(req->entries(), params);
+			if(!fileOrError) {
+				co_await sendErrorResponse.template operator()<managarm::posix::IoUringSetupResponse>
+					(fileOrError.error() | toPosixProtoError);
+				continue;
+			}
+
+			// Like on Linux, io_uring fds are always close-on-exec.
+			auto fd = self->fileContext()->attachFile(fileOrError.value(), true);
+
+			managarm::posix::IoUringSetupResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_fd(fd);
+			resp.set_sq_entries(params.sq_entries);
+			resp.set_cq_entries(params.cq_entries);
+			resp.set_features(params.features);
+			resp.set_sq_off_head(params.sq_off.head);
+			resp.set_sq_off_tail(params.sq_off.tail);
+			resp.set_sq_off_ring_mask(params.sq_off.ring_mask);
+			resp.set_sq_off_ring_entries(params.sq_off.ring_entries);
+			resp.set_sq_off_flags(params.sq_off.flags);
+			resp.set_sq_off_dropped(params.sq_off.dropped);
+			resp.set_sq_off_array(params.sq_off.array);
+			resp.set_cq_off_head(params.cq_off.head);
+			resp.set_cq_off_tail(params.cq_off.tail);
+			resp.set_cq_off_ring_mask(params.cq_off.ring_mask);
+			resp.set_cq_off_ring_entries(params.cq_off.ring_entries);
+			resp.set_cq_off_overflow(params.cq_off.overflow);
+			resp.set_cq_off_cqes(params.cq_off.cqes);
+			resp.set_cq_off_flags(params.cq_off.flags);
+
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(sendResp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::IoUringEnterRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::IoUringEnterRequest>(recv_head);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "IO_URING_ENTER", "fd={} to_submit={} min_complete={}",
+					req->fd(), req->to_submit(), req->min_complete());
+
+			auto file = self->fileContext()->getFile(req->fd());
+			if(!file) {
+				co_await sendErrorResponse.template operator()<managarm::posix::IoUringEnterResponse>
+					(managarm::posix::Errors::NO_SUCH_FD);
+				continue;
+			}else if(file->kind() != FileKind::ioUring) {
+				co_await sendErrorResponse.template operator()<managarm::posix::IoUringEnterResponse>
+					(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
+			}
+
+			auto submitted = co_await io_uring::enter(file.get(), self,
+					req->to_submit(), req->min_complete(), req->flags());
+			if(!submitted) {
+				co_await sendErrorResponse.template operator()<managarm::posix::IoUringEnterResponse>
+					(submitted.error() | toPosixProtoError);
+				continue;
+			}
+
+			managarm::posix::IoUringEnterResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_submitted(submitted.value());
+
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(sendResp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::IoUringRegisterRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::IoUringRegisterRequest>(recv_head);
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			logRequest(logRequests, "IO_URING_REGISTER", "fd={} opcode={}",
+					req->fd(), req->opcode());
+
+			auto file = self->fileContext()->getFile(req->fd());
+			if(!file) {
+				co_await sendErrorResponse.template operator()<managarm::posix::IoUringRegisterResponse>
+					(managarm::posix::Errors::NO_SUCH_FD);
+				continue;
+			}else if(file->kind() != FileKind::ioUring) {
+				co_await sendErrorResponse.template operator()<managarm::posix::IoUringRegisterResponse>
+					(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
+			}
+
+			auto result = co_await io_uring::registerResource(file.get(), self.get(),
+					req->opcode(), req->arg(), req->nr_args());
+			if(!result) {
+				co_await sendErrorResponse.template operator()<managarm::posix::IoUringRegisterResponse>
+					(result.error() | toPosixProtoError);
+				continue;
+			}
+
+			managarm::posix::IoUringRegisterResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_result(result.value());
+
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(sendResp.error());
+			logBragiReply(resp);
 		}else if(req.request_type() == managarm::posix::CntReqType::VM_UNMAP) {
 			logRequest(logRequests, "VM_UNMAP", "address={:#08x} size={:#x}", req.address(), req.size());
 
@@ -1892,7 +2202,8 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					| managarm::posix::OpenFlags::OF_NOCTTY
 					| managarm::posix::OpenFlags::OF_APPEND
 					| managarm::posix::OpenFlags::OF_NOFOLLOW
-					| managarm::posix::OpenFlags::OF_DIRECTORY))) {
+					| managarm::posix::OpenFlags::OF_DIRECTORY
+					| managarm::posix::OpenFlags::OF_DIRECT))) {
 				std::cout << "posix: OPENAT flags not recognized: " << req->flags() << std::endl;
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
 				continue;
@@ -1911,6 +2222,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if(req->flags() & managarm::posix::OpenFlags::OF_APPEND)
 				semantic_flags |= semanticAppend;
+			if(req->flags() & managarm::posix::OpenFlags::OF_DIRECT)
+				semantic_flags |= semanticDirect;
+			if(req->flags() & managarm::posix::OpenFlags::OF_POLLED)
+				semantic_flags |= semanticPolled;
 
 			ViewPath relative_to;
 			smarter::shared_ptr<File, FileHandle> file;
@@ -2944,7 +3259,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			}else{
 				assert(req.timeout() > 0);
 				async::cancellation_event cancel_wait;
-				helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
+				posix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
 				k = co_await epoll::wait(epfile.get(), events, 16, cancel_wait);
 				co_await timer.retire();
 			}
@@ -3013,6 +3328,9 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(ret == Error::alreadyExists) {
 				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
 				continue;
+			}else if(ret == Error::illegalArguments) {
+				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
 			}
 			assert(ret == Error::success);
 
@@ -3037,6 +3355,9 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(ret == Error::noSuchFile) {
 				co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
 				continue;
+			}else if(ret == Error::illegalArguments) {
+				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
 			}
 			assert(ret == Error::success);
 
@@ -3102,7 +3423,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			}else{
 				assert(req.timeout() > 0);
 				async::cancellation_event cancel_wait;
-				helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
+				posix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
 				k = co_await epoll::wait(epfile.get(), events, 16, cancel_wait);
 				co_await timer.retire();
 			}
@@ -3714,13 +4035,22 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			logRequest(logRequests, "MEMFD_CREATE", "'{}'", req->name());
 
-			if(req->flags() & ~(MFD_CLOEXEC | MFD_ALLOW_SEALING)) {
+			if(req->flags() & ~(MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB
+					| (MFD_HUGE_MASK << MFD_HUGE_SHIFT))) {
+				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
+			}
+
+			// Only the default huge page size (2 MiB) is supported.
+			auto hugeSize = req->flags() & (MFD_HUGE_MASK << MFD_HUGE_SHIFT);
+			if(hugeSize && (!(req->flags() & MFD_HUGETLB) || hugeSize != MFD_HUGE_2MB)) {
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
 				continue;
 			}
 
 			auto link = SpecialLink::makeSpecialLink(VfsType::regular, 0777);
-			auto memFile = smarter::make_shared<MemoryFile>(nullptr, link, (req->flags() & MFD_ALLOW_SEALING) == true);
+			auto memFile = smarter::make_shared<MemoryFile>(nullptr, link,
+					req->flags() & MFD_ALLOW_SEALING, req->flags() & MFD_HUGETLB);
 			MemoryFile::serve(memFile);
 			auto file = File::constructHandle(std::move(memFile));
 
@@ -4251,6 +4581,393 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
 			);
 
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::SetPipeSizeRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::SetPipeSizeRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+			logRequest(logRequests, "SET_PIPE_SIZE", "fd={} size={}", req->fd(), req->size());
+
+			auto file = self->fileContext()->getFile(req->fd());
+			if(!file) {
+				co_await sendErrorResponse.template operator()<managarm::posix::SetPipeSizeResponse>
+					(managarm::posix::Errors::NO_SUCH_FD);
+				continue;
+			}
+
+			auto size = fifo::setPipeSize(file.get(), req->size());
+			if(!size) {
+				co_await sendErrorResponse.template operator()<managarm::posix::SetPipeSizeResponse>
+					(size.error() == Error::illegalArguments
+						? managarm::posix::Errors::BAD_FD
+						: size.error() | toPosixProtoError);
+				continue;
+			}
+
+			managarm::posix::SetPipeSizeResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_size(size.value());
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::GetPipeSizeRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::GetPipeSizeRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+			logRequest(logRequests, "GET_PIPE_SIZE", "fd={}", req->fd());
+
+			auto file = self->fileContext()->getFile(req->fd());
+			if(!file) {
+				co_await sendErrorResponse.template operator()<managarm::posix::GetPipeSizeResponse>
+					(managarm::posix::Errors::NO_SUCH_FD);
+				continue;
+			}
+
+			auto size = fifo::getPipeSize(file.get());
+			if(!size) {
+				co_await sendErrorResponse.template operator()<managarm::posix::GetPipeSizeResponse>
+					(managarm::posix::Errors::BAD_FD);
+				continue;
+			}
+
+			managarm::posix::GetPipeSizeResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_size(size.value());
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::SpliceRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::SpliceRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+			logRequest(logRequests, "SPLICE", "fd_in={} fd_out={} length={}",
+					req->fd_in(), req->fd_out(), req->length());
+
+			auto in = self->fileContext()->getFile(req->fd_in());
+			auto out = self->fileContext()->getFile(req->fd_out());
+			if(!in || !out) {
+				co_await sendErrorResponse.template operator()<managarm::posix::SpliceResponse>
+					(managarm::posix::Errors::NO_SUCH_FD);
+				continue;
+			}
+
+			std::optional<int64_t> inOffset, outOffset;
+			if(req->has_off_in())
+				inOffset = req->off_in();
+			if(req->has_off_out())
+				outOffset = req->off_out();
+
+			auto size = co_await fifo::splice(self.get(), in.get(), inOffset,
+					out.get(), outOffset, req->length(), req->flags() & SPLICE_F_NONBLOCK);
+			if(!size) {
+				co_await sendErrorResponse.template operator()<managarm::posix::SpliceResponse>
+					(size.error() | toPosixProtoError);
+				continue;
+			}
+
+			managarm::posix::SpliceResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_size(size.value());
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::TeeRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::TeeRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+			logRequest(logRequests, "TEE", "fd_in={} fd_out={} length={}",
+					req->fd_in(), req->fd_out(), req->length());
+
+			auto in = self->fileContext()->getFile(req->fd_in());
+			auto out = self->fileContext()->getFile(req->fd_out());
+			if(!in || !out) {
+				co_await sendErrorResponse.template operator()<managarm::posix::TeeResponse>
+					(managarm::posix::Errors::NO_SUCH_FD);
+				continue;
+			}
+
+			auto size = co_await fifo::tee(in.get(), out.get(), req->length(),
+					req->flags() & SPLICE_F_NONBLOCK);
+			if(!size) {
+				co_await sendErrorResponse.template operator()<managarm::posix::TeeResponse>
+					(size.error() | toPosixProtoError);
+				continue;
+			}
+
+			managarm::posix::TeeResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_size(size.value());
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::VmspliceRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::VmspliceRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+			logRequest(logRequests, "VMSPLICE", "fd={} length={}", req->fd(), req->length());
+
+			auto file = self->fileContext()->getFile(req->fd());
+			if(!file) {
+				co_await sendErrorResponse.template operator()<managarm::posix::VmspliceResponse>
+					(managarm::posix::Errors::NO_SUCH_FD);
+				continue;
+			}
+
+			auto size = co_await fifo::vmsplice(self.get(), file.get(), req->address(),
+					req->length(), req->flags() & SPLICE_F_NONBLOCK);
+			if(!size) {
+				co_await sendErrorResponse.template operator()<managarm::posix::VmspliceResponse>
+					(size.error() | toPosixProtoError);
+				continue;
+			}
+
+			managarm::posix::VmspliceResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_size(size.value());
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::CopyFileRangeRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::CopyFileRangeRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+			logRequest(logRequests, "COPY_FILE_RANGE", "fd_in={} fd_out={} length={}",
+					req->fd_in(), req->fd_out(), req->length());
+
+			auto in = self->fileContext()->getFile(req->fd_in());
+			auto out = self->fileContext()->getFile(req->fd_out());
+			if(!in || !out) {
+				co_await sendErrorResponse.template operator()<managarm::posix::CopyFileRangeResponse>
+					(managarm::posix::Errors::NO_SUCH_FD);
+				continue;
+			}
+
+			// copy_file_range() only operates on regular files.
+			auto typeOf = [] (File *file) -> std::optional<VfsType> {
+				if(!file->associatedLink())
+					return std::nullopt;
+				return file->associatedLink()->getTarget()->getType();
+			};
+			auto inType = typeOf(in.get());
+			auto outType = typeOf(out.get());
+			if(inType == VfsType::directory || outType == VfsType::directory) {
+				co_await sendErrorResponse.template operator()<managarm::posix::CopyFileRangeResponse>
+					(managarm::posix::Errors::IS_DIRECTORY);
+				continue;
+			}
+			if(req->flags() || inType != VfsType::regular || outType != VfsType::regular) {
+				co_await sendErrorResponse.template operator()<managarm::posix::CopyFileRangeResponse>
+					(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
+			}
+
+			std::optional<int64_t> inOffset, outOffset;
+			if(req->has_off_in())
+				inOffset = req->off_in();
+			if(req->has_off_out())
+				outOffset = req->off_out();
+
+			auto size = co_await transferFileData(self.get(), in.get(), inOffset,
+					out.get(), outOffset, req->length());
+			if(!size) {
+				co_await sendErrorResponse.template operator()<managarm::posix::CopyFileRangeResponse>
+					(size.error() | toPosixProtoError);
+				continue;
+			}
+
+			managarm::posix::CopyFileRangeResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_size(size.value());
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::SendfileRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::SendfileRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+			logRequest(logRequests, "SENDFILE", "fd_in={} fd_out={} length={}",
+					req->fd_in(), req->fd_out(), req->length());
+
+			auto in = self->fileContext()->getFile(req->fd_in());
+			auto out = self->fileContext()->getFile(req->fd_out());
+			if(!in || !out) {
+				co_await sendErrorResponse.template operator()<managarm::posix::SendfileResponse>
+					(managarm::posix::Errors::NO_SUCH_FD);
+				continue;
+			}
+
+			std::optional<int64_t> offset;
+			if(req->has_offset())
+				offset = req->offset();
+
+			auto size = co_await transferFileData(self.get(), in.get(), offset,
+					out.get(), std::nullopt, req->length());
+			if(!size) {
+				co_await sendErrorResponse.template operator()<managarm::posix::SendfileResponse>
+					(size.error() | toPosixProtoError);
+				continue;
+			}
+
+			managarm::posix::SendfileResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_size(size.value());
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+			HEL_CHECK(send_resp.error());
+			logBragiReply(resp);
+		}else if(preamble.id() == managarm::posix::SpawnRequest::message_id) {
+			std::vector<uint8_t> tail(preamble.tail_size());
+			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+					conversation,
+					helix_ng::recvBuffer(tail.data(), tail.size())
+				);
+			HEL_CHECK(recv_tail.error());
+
+			logBragiRequest(tail);
+			auto req = bragi::parse_head_tail<managarm::posix::SpawnRequest>(recv_head, tail);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+			logRequest(logRequests || logPaths, "SPAWN", "path='{}'", req->path());
+
+			if(req->flags() & ~(managarm::posix::SpawnFlags::SPAWN_SETSIGMASK
+					| managarm::posix::SpawnFlags::SPAWN_RESETIDS)) {
+				co_await sendErrorResponse.template operator()<managarm::posix::SpawnResponse>
+					(managarm::posix::Errors::NOT_SUPPORTED);
+				continue;
+			}
+
+			// Apply the file actions to a copy of our file table.
+			auto fileContext = FileContext::clone(self->fileContext());
+			std::optional<managarm::posix::Errors> actionError;
+			for(auto &action : req->file_actions()) {
+				if(action.type() == managarm::posix::SpawnActionType::SPAWN_ACTION_CLOSE) {
+					// Like glibc, ignore close actions on unused file descriptors.
+					fileContext->closeFile(action.fd());
+				}else if(action.type() == managarm::posix::SpawnActionType::SPAWN_ACTION_DUP2) {
+					auto file = fileContext->getFile(action.fd());
+					if(!file) {
+						actionError = managarm::posix::Errors::NO_SUCH_FD;
+						break;
+					}
+					// dup2() onto the same descriptor clears FD_CLOEXEC.
+					fileContext->attachFile(action.new_fd(), std::move(file), false);
+				}else if(action.type() == managarm::posix::SpawnActionType::SPAWN_ACTION_OPEN) {
+					if(action.flags() & ~(managarm::posix::OpenFlags::OF_CREATE
+							| managarm::posix::OpenFlags::OF_EXCLUSIVE
+							| managarm::posix::OpenFlags::OF_NONBLOCK
+							| managarm::posix::OpenFlags::OF_CLOEXEC
+							| managarm::posix::OpenFlags::OF_TRUNC
+							| managarm::posix::OpenFlags::OF_RDONLY
+							| managarm::posix::OpenFlags::OF_WRONLY
+							| managarm::posix::OpenFlags::OF_RDWR
+							| managarm::posix::OpenFlags::OF_NOCTTY
+							| managarm::posix::OpenFlags::OF_APPEND
+							| managarm::posix::OpenFlags::OF_DIRECT)) {
+						actionError = managarm::posix::Errors::NOT_SUPPORTED;
+						break;
+					}
+					auto file = co_await openSpawnFile(self.get(), action.path(),
+							action.flags(), action.mode());
+					if(!file) {
+						actionError = file.error() | toPosixProtoError;
+						break;
+					}
+					fileContext->attachFile(action.fd(), std::move(file.value()),
+							action.flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+				}else{
+					actionError = managarm::posix::Errors::NOT_SUPPORTED;
+					break;
+				}
+			}
+			if(actionError) {
+				co_await sendErrorResponse.template operator()<managarm::posix::SpawnResponse>
+					(*actionError);
+				continue;
+			}
+
+			SpawnAttributes attributes;
+			if(req->flags() & managarm::posix::SpawnFlags::SPAWN_SETSIGMASK)
+				attributes.signalMask = req->sigmask();
+			if(req->flags() & managarm::posix::SpawnFlags::SPAWN_RESETIDS)
+				attributes.resetIds = true;
+
+			auto child = co_await Process::spawn(self, req->path(), req->args(), req->env(),
+					std::move(fileContext), attributes);
+			if(!child) {
+				auto error = child.error() == Error::eof ? Error::badExecutable : child.error();
+				co_await sendErrorResponse.template operator()<managarm::posix::SpawnResponse>
+					(error | toPosixProtoError);
+				continue;
+			}
+
+			managarm::posix::SpawnResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_pid(child.value()->pid());
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
 			HEL_CHECK(send_resp.error());
 			logBragiReply(resp);
 		}else{
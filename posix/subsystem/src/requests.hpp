@@ -2,6 +2,11 @@
 
 #include "process.hpp"
 
+// Serves the requests of a single thread. Each thread (see Process::clone()) has its own
+// posix lane and its own instance of this loop, hence requests of sibling threads are served
+// concurrently: a thread that blocks in a request does not delay the requests of other
+// threads. A thread cannot issue another request before the current one completes,
+// so it is sufficient to keep a single accept in flight per lane.
 async::result<void> serveRequests(std::shared_ptr<Process> self,
 		std::shared_ptr<Generation> generation);
 
@@ -1,9 +1,11 @@
 
 #include <string.h>
+#include <format>
 #include <iostream>
 #include <string_view>
 #include <linux/fs.h>
 
+#include <bragi/helpers-std.hpp>
 #include <core/id-allocator.hpp>
 #include <protocols/mbus/client.hpp>
 
@@ -59,6 +61,48 @@ struct Device final : UnixDevice, drvcore::BlockDevice, std::enable_shared_from_
 		ue.set("MINOR", std::to_string(dev.second));
 	}
 
+	const std::string &name() {
+		return _name;
+	}
+
+	struct IoStats {
+		managarm::fs::DeviceStatsReply counters;
+		// Read latency histogram, followed by the write latency histogram.
+		std::vector<uint64_t> histograms;
+	};
+
+	// Returns std::nullopt if the server does not support DeviceStatsRequest.
+	async::result<std::optional<IoStats>> queryStats() {
+		// Upper bound for the number of histogram buckets that we accept.
+		constexpr size_t maxBuckets = 64;
+
+		managarm::fs::DeviceStatsRequest req;
+		std::vector<uint64_t> histograms(2 * maxBuckets);
+
+		auto [offer, send_req, recv_resp, recv_histograms] = co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline(),
+				helix_ng::recvBuffer(histograms.data(), histograms.size() * sizeof(uint64_t))
+			)
+		);
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send_req.error());
+		if(recv_resp.error())
+			co_return std::nullopt;
+
+		auto resp = bragi::parse_head_only<managarm::fs::DeviceStatsReply>(recv_resp);
+		recv_resp.reset();
+		if(!resp || resp->error() != managarm::fs::Errors::SUCCESS)
+			co_return std::nullopt;
+		HEL_CHECK(recv_histograms.error());
+		assert(resp->num_buckets() <= maxBuckets);
+		histograms.resize(2 * resp->num_buckets());
+
+		co_return IoStats{std::move(*resp), std::move(histograms)};
+	}
+
 private:
 	std::string _name;
 	helix::UniqueLane _lane;
@@ -66,6 +110,9 @@ private:
 	size_t _size;
 };
 
+// All disks and partitions in the order of their creation (for /proc/diskstats).
+std::vector<std::shared_ptr<Device>> allDevices;
+
 } // anonymous namepsace
 
 struct ReadOnlyAttribute : sysfs::Attribute {
@@ -89,6 +136,21 @@ struct SizeAttribute : sysfs::Attribute {
 	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
 };
 
+struct StatAttribute : sysfs::Attribute {
+	StatAttribute(std::string name)
+	: sysfs::Attribute{std::move(name), false} { }
+
+	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
+};
+
+// Not present on Linux. Shows the log2 latency histograms of reads and writes.
+struct LatencyAttribute : sysfs::Attribute {
+	LatencyAttribute(std::string name)
+	: sysfs::Attribute{std::move(name), false} { }
+
+	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
+};
+
 struct ManagarmRootAttribute : sysfs::Attribute {
 	ManagarmRootAttribute(std::string name)
 	: sysfs::Attribute{std::move(name), false} { }
@@ -99,6 +161,8 @@ struct ManagarmRootAttribute : sysfs::Attribute {
 ReadOnlyAttribute roAttr{"ro"};
 DevAttribute devAttr{"dev"};
 SizeAttribute sizeAttr{"size"};
+StatAttribute statAttr{"stat"};
+LatencyAttribute latencyAttr{"managarm-io-latency"};
 ManagarmRootAttribute managarmRootAttr{"managarm-root"};
 
 async::result<frg::expected<Error, std::string>> ReadOnlyAttribute::show(sysfs::Object *object) {
@@ -120,6 +184,74 @@ async::result<frg::expected<Error, std::string>> SizeAttribute::show(sysfs::Obje
 	co_return std::to_string(device->size() / 512) + "\n";
 }
 
+namespace {
+
+// Formats the fields of /sys/block/<dev>/stat; /proc/diskstats uses the same fields.
+// We do not track discards and flushes; their fields are always zero.
+std::string formatStatFields(const managarm::fs::DeviceStatsReply &stats, std::string_view sep) {
+	std::string out;
+	auto append = [&] (uint64_t value) {
+		if(!out.empty())
+			out += sep;
+		out += std::to_string(value);
+	};
+	append(stats.read_ios());
+	append(stats.read_merges());
+	append(stats.read_sectors());
+	append(stats.read_ticks());
+	append(stats.write_ios());
+	append(stats.write_merges());
+	append(stats.write_sectors());
+	append(stats.write_ticks());
+	append(stats.in_flight());
+	append(stats.io_ticks());
+	append(stats.time_in_queue());
+	for(int i = 0; i < 6; i++) // Discard and flush statistics.
+		append(0);
+	return out;
+}
+
+} // anonymous namespace
+
+async::result<frg::expected<Error, std::string>> StatAttribute::show(sysfs::Object *object) {
+	auto device = static_cast<Device *>(object);
+	auto stats = co_await device->queryStats();
+	if(!stats)
+		co_return Error::ioError;
+	co_return formatStatFields(stats->counters, " ") + "\n";
+}
+
+async::result<frg::expected<Error, std::string>> LatencyAttribute::show(sysfs::Object *object) {
+	auto device = static_cast<Device *>(object);
+	auto stats = co_await device->queryStats();
+	if(!stats)
+		co_return Error::ioError;
+
+	// One line per direction: bucket i counts requests that took [2^i, 2^(i+1)) us.
+	auto numBuckets = stats->histograms.size() / 2;
+	std::string out;
+	for(size_t d = 0; d < 2; d++) {
+		out += d ? "write" : "read";
+		for(size_t i = 0; i < numBuckets; i++)
+			out += " " + std::to_string(stats->histograms[d * numBuckets + i]);
+		out += "\n";
+	}
+	co_return out;
+}
+
+async::result<std::string> formatDiskstats() {
+	std::string out;
+	for(auto &device : allDevices) {
+		auto stats = co_await device->queryStats();
+		if(!stats)
+			continue;
+		auto dev = device->getId();
+		out += std::format("{:4} {:7} {} ", dev.first, dev.second, device->name())
+				+ formatStatFields(stats->counters, " ") + "\n";
+	}
+	co_return out;
+}
+
 async::result<frg::expected<Error, std::string>> ManagarmRootAttribute::show(sysfs::Object *) {
 	co_return "1\n";
 }
@@ -191,11 +323,14 @@ async::detached observePartitions() {
 			device->assignId({8, minorAllocator.allocate()});
 			blockRegistry.install(device);
 			drvcore::installDevice(device);
+			allDevices.push_back(device);
 
 			// TODO: Call realizeAttribute *before* installing the device.
 			device->realizeAttribute(&roAttr);
 			device->realizeAttribute(&devAttr);
 			device->realizeAttribute(&sizeAttr);
+			device->realizeAttribute(&statAttr);
+			device->realizeAttribute(&latencyAttr);
 			if (std::get<mbus_ng::StringItem>(properties.at("unix.is-managarm-root")).value == "1")
 				device->realizeAttribute(&managarmRootAttr);
 		}
@@ -277,6 +412,10 @@ async::detached run() {
 			device->assignId({8, minorAllocator.allocate()});
 			blockRegistry.install(device);
 			drvcore::installDevice(device);
+			allDevices.push_back(device);
+
+			device->realizeAttribute(&statAttr);
+			device->realizeAttribute(&latencyAttr);
 		}
 	}
 }
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <string>
+
 #include <async/result.hpp>
 
 namespace block_subsystem {
 
 async::detached run();
 
+// Returns the contents of /proc/diskstats.
+async::result<std::string> formatDiskstats();
+
 } // namespace block_subsystem
@@ -19,14 +19,18 @@ drvcore::BusSubsystem *sysfsSubsystem;
 
 struct VendorAttribute : sysfs::Attribute {
 	VendorAttribute(std::string name)
-	: sysfs::Attribute{std::move(name), false} { }
+	: sysfs::Attribute{std::move(name), false} {
+		_cacheable = true;
+	}
 
 	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
 };
 
 struct DeviceAttribute : sysfs::Attribute {
 	DeviceAttribute(std::string name)
-	: sysfs::Attribute{std::move(name), false} { }
+	: sysfs::Attribute{std::move(name), false} {
+		_cacheable = true;
+	}
 
 	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
 };
@@ -40,14 +44,18 @@ struct PlainfbAttribute : sysfs::Attribute {
 
 struct SubsystemVendorAttribute : sysfs::Attribute {
 	SubsystemVendorAttribute(std::string name)
-	: sysfs::Attribute{std::move(name), false} { }
+	: sysfs::Attribute{std::move(name), false} {
+		_cacheable = true;
+	}
 
 	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
 };
 
 struct SubsystemDeviceAttribute : sysfs::Attribute {
 	SubsystemDeviceAttribute(std::string name)
-	: sysfs::Attribute{std::move(name), false} { }
+	: sysfs::Attribute{std::move(name), false} {
+		_cacheable = true;
+	}
 
 	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
 };
@@ -79,7 +87,9 @@ struct ResourceNAttribute : sysfs::Attribute {
 
 struct ClassAttribute : sysfs::Attribute {
 	ClassAttribute(std::string name)
-	: sysfs::Attribute{std::move(name), false} { }
+	: sysfs::Attribute{std::move(name), false} {
+		_cacheable = true;
+	}
 
 	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
 };
@@ -329,6 +339,8 @@ async::detached run() {
 		auto [_, events] = (co_await enumerator.nextEvents()).unwrap();
 
 		for (auto &event : events) {
+			if (event.type == mbus_ng::EnumerationEvent::Type::propertiesChanged)
+				drvcore::mbusPropertiesChanged(event.id);
 			if (event.type != mbus_ng::EnumerationEvent::Type::created)
 				continue;
 
@@ -96,12 +96,9 @@ struct Device final : drvcore::ClassDevice {
 	async::detached run() {
 		while(true) {
 			co_await _hwDevice.getBatteryState(_state, true);
+			invalidateAttributes();
 
-			drvcore::UeventProperties ue;
-			composeStandardUevent(ue);
-			composeUevent(ue);
-
-			drvcore::udev::emitChangeEvent(getSysfsPath(), ue);
+			drvcore::udev::emitChangeEvent(getSysfsPath(), ueventProperties());
 		}
 	}
 
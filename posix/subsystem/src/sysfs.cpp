@@ -115,7 +115,7 @@ AttributeFile::pread(Process *, int64_t offset, void *buffer, size_t length) {
 
 	if(!_cached) {
 		auto node = static_cast<AttributeNode *>(associatedLink()->getTarget().get());
-		if(auto res = co_await node->_attr->show(node->_object); res) {
+		if(auto res = co_await node->render(); res) {
 			_buffer = res.value();
 			_cached = true;
 		} else
@@ -171,8 +171,11 @@ void DirectoryFile::serve(smarter::shared_ptr<DirectoryFile> file) {
 
 DirectoryFile::DirectoryFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link)
 : File{FileKind::unknown,  StructName::get("sysfs.dir"), std::move(mount), std::move(link)},
-		_node{static_cast<DirectoryNode *>(associatedLink()->getTarget().get())},
-		_iter{_node->_entries.begin()} { }
+		_node{static_cast<DirectoryNode *>(associatedLink()->getTarget().get())} {
+	// Listing the directory needs the nodes of all attributes.
+	_node->realizeAllAttributes_();
+	_iter = _node->_entries.begin();
+}
 
 void DirectoryFile::handleClose() {
 	_cancelServe.cancel();
@@ -275,6 +278,25 @@ AttributeNode::open(std::shared_ptr<MountView> mount,
 	co_return File::constructHandle(std::move(file));
 }
 
+async::result<frg::expected<Error, std::string>> AttributeNode::render() {
+	if(!_attr->cacheable())
+		co_return co_await _attr->show(_object);
+
+	auto generation = _object->attributeGeneration();
+	if(_renderedGeneration == generation)
+		co_return _rendered;
+
+	auto res = co_await _attr->show(_object);
+	if(!res)
+		co_return res.error();
+	// Do not cache the result if the object was invalidated while show() was running.
+	if(_object->attributeGeneration() == generation) {
+		_rendered = res.value();
+		_renderedGeneration = generation;
+	}
+	co_return std::move(res.value());
+}
+
 // ----------------------------------------------------------------------------
 // SymlinkNode implementation.
 // ----------------------------------------------------------------------------
@@ -342,16 +364,13 @@ DirectoryNode::DirectoryNode()
 	inode_ = static_cast<SysfsSuperblock *>(superblock())->inodeAllocator().allocate();
 }
 
-std::shared_ptr<Link> DirectoryNode::directMkattr(Object *object, Attribute *attr) {
-	assert(_entries.find(attr->name()) == _entries.end());
-	auto node = std::make_shared<AttributeNode>(object, attr);
-	auto link = std::make_shared<Link>(shared_from_this(), attr->name(), std::move(node));
-	_entries.insert(link);
-	return link;
+void DirectoryNode::directMkattr(Object *object, Attribute *attr) {
+	assert(!hasEntry_(attr->name()));
+	_pendingAttrs.insert({attr->name(), PendingAttribute{object, attr}});
 }
 
 std::shared_ptr<Link> DirectoryNode::directMklink(std::string name, std::weak_ptr<Object> target) {
-	assert(_entries.find(name) == _entries.end());
+	assert(!hasEntry_(name));
 	auto node = std::make_shared<SymlinkNode>(std::move(target));
 	auto link = std::make_shared<Link>(shared_from_this(), std::move(name), std::move(node));
 	_entries.insert(link);
@@ -363,6 +382,7 @@ std::shared_ptr<Link> DirectoryNode::directMkdir(std::string name) {
 	if(preexisting != _entries.end()) {
 		return *preexisting;
 	}
+	assert(!_pendingAttrs.contains(name));
 	auto node = std::make_shared<DirectoryNode>();
 	auto the_node = node.get();
 	auto link = std::make_shared<Link>(shared_from_this(), std::move(name), std::move(node));
@@ -414,9 +434,30 @@ async::result<frg::expected<Error, std::shared_ptr<FsLink>>> DirectoryNode::getL
 	auto it = _entries.find(name);
 	if(it != _entries.end())
 		co_return *it;
+	auto pending = _pendingAttrs.find(name);
+	if(pending != _pendingAttrs.end())
+		co_return realizeAttribute_(pending);
 	co_return nullptr; // TODO: Return an error code.
 }
 
+bool DirectoryNode::hasEntry_(const std::string &name) {
+	return _entries.find(name) != _entries.end() || _pendingAttrs.contains(name);
+}
+
+std::shared_ptr<Link> DirectoryNode::realizeAttribute_(
+		std::map<std::string, PendingAttribute>::iterator it) {
+	auto node = std::make_shared<AttributeNode>(it->second.object, it->second.attr);
+	auto link = std::make_shared<Link>(shared_from_this(), it->first, std::move(node));
+	_entries.insert(link);
+	_pendingAttrs.erase(it);
+	return link;
+}
+
+void DirectoryNode::realizeAllAttributes_() {
+	while(!_pendingAttrs.empty())
+		realizeAttribute_(_pendingAttrs.begin());
+}
+
 // ----------------------------------------------------------------------------
 // Attribute implementation
 // ----------------------------------------------------------------------------
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <map>
+#include <optional>
+
 #include <core/id-allocator.hpp>
 #include <protocols/fs/server.hpp>
 
@@ -144,10 +147,17 @@ struct AttributeNode final : FsNode, std::enable_shared_from_this<AttributeNode>
 	open(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 			SemanticFlags semantic_flags) override;
 
+	// Returns the contents of the attribute. For cacheable attributes, the contents are
+	// only rendered again after the object invalidated its attributes.
+	async::result<frg::expected<Error, std::string>> render();
+
 private:
 	Object *_object;
 	Attribute *_attr;
 	uint64_t inode_;
+
+	std::optional<uint64_t> _renderedGeneration;
+	std::string _rendered;
 };
 
 struct SymlinkNode final : FsNode, std::enable_shared_from_this<SymlinkNode> {
@@ -175,7 +185,9 @@ struct DirectoryNode final : FsNode, std::enable_shared_from_this<DirectoryNode>
 		static_cast<SysfsSuperblock *>(superblock())->inodeAllocator().free(inode_);
 	}
 
-	std::shared_ptr<Link> directMkattr(Object *object, Attribute *attr);
+	// The node of the attribute is only created once the attribute is looked up
+	// or the directory is listed.
+	void directMkattr(Object *object, Attribute *attr);
 	std::shared_ptr<Link> directMklink(std::string name, std::weak_ptr<Object> target);
 	std::shared_ptr<Link> directMkdir(std::string name);
 
@@ -189,8 +201,19 @@ struct DirectoryNode final : FsNode, std::enable_shared_from_this<DirectoryNode>
 	async::result<frg::expected<Error, std::shared_ptr<FsLink>>> getLink(std::string name) override;
 
 private:
+	struct PendingAttribute {
+		Object *object;
+		Attribute *attr;
+	};
+
+	bool hasEntry_(const std::string &name);
+	std::shared_ptr<Link> realizeAttribute_(std::map<std::string, PendingAttribute>::iterator it);
+	void realizeAllAttributes_();
+
 	Link *_treeLink;
 	std::set<std::shared_ptr<Link>, LinkCompare> _entries;
+	// Attributes that were added but that do not have a node yet.
+	std::map<std::string, PendingAttribute> _pendingAttrs;
 	uint64_t inode_;
 };
 
@@ -218,12 +241,18 @@ public:
 		return _size;
 	}
 
+	// Cacheable attributes only change when their object invalidates its attributes.
+	bool cacheable() {
+		return _cacheable;
+	}
+
 	virtual async::result<frg::expected<Error, std::string>> show(Object *object) = 0;
 	virtual async::result<Error> store(Object *object, std::string data);
 	virtual async::result<frg::expected<Error, helix::UniqueDescriptor>> accessMemory(Object *object);
 
 protected:
 	size_t _size = 4096;
+	bool _cacheable = false;
 private:
 	const std::string _name;
 	bool _writable;
@@ -240,6 +269,15 @@ struct Object {
 
 	std::shared_ptr<DirectoryNode> directoryNode();
 
+	uint64_t attributeGeneration() {
+		return _attributeGeneration;
+	}
+
+	// Discards the cached contents of all cacheable attributes of this object.
+	void invalidateAttributes() {
+		_attributeGeneration++;
+	}
+
 	void realizeAttribute(Attribute *attr);
 	void createSymlink(std::string name, std::shared_ptr<Object> target);
 
@@ -251,6 +289,7 @@ private:
 	std::string _name;
 
 	std::shared_ptr<Link> _dirLink;
+	uint64_t _attributeGeneration = 0;
 };
 
 // Hierarchy corresponds to Linux ksets.
@@ -0,0 +1,110 @@
+#include <map>
+
+#include <async/recurring-event.hpp>
+#include <helix/timer.hpp>
+
+#include "timer-queue.hpp"
+
+namespace posix {
+
+namespace {
+
+uint64_t add_sat(uint64_t x, uint64_t y) {
+	uint64_t r;
+	if (__builtin_add_overflow(x, y, &r))
+		return UINT64_MAX;
+	return r;
+}
+
+struct Waiter {
+	bool expired = false;
+	async::oneshot_event event;
+};
+
+// Ordered by deadline.
+std::multimap<uint64_t, Waiter *> waiters;
+
+// Raised when the first waiter is inserted into an empty queue.
+async::recurring_event queueChanged;
+
+// Deadline of the earliest waiter at the time that the kernel timer was armed.
+uint64_t armedDeadline = 0;
+// Set while the kernel timer is armed; cancelled to re-arm it for an earlier deadline.
+async::cancellation_event *cancelArmed = nullptr;
+
+bool runningTimers = false;
+
+async::detached runTimers() {
+	while(true) {
+		if(waiters.empty()) {
+			co_await queueChanged.async_wait();
+			continue;
+		}
+
+		// Like Linux' hrtimers, arm the kernel timer for the latest point in time at which
+		// the earliest waiter may expire. All waiters whose deadline passed expire together.
+		async::cancellation_event rearm;
+		armedDeadline = waiters.begin()->first;
+		cancelArmed = &rearm;
+		co_await helix::sleepUntil(add_sat(armedDeadline, timerSlack), rearm);
+		cancelArmed = nullptr;
+
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		while(!waiters.empty() && waiters.begin()->first <= now) {
+			auto waiter = waiters.begin()->second;
+			waiters.erase(waiters.begin());
+			waiter->expired = true;
+			waiter->event.raise();
+		}
+	}
+}
+
+} // anonymous namespace
+
+async::result<bool> sleepUntil(uint64_t deadline, async::cancellation_token cancellation) {
+	if(!runningTimers) {
+		runningTimers = true;
+		runTimers();
+	}
+
+	Waiter waiter;
+	auto it = waiters.emplace(deadline, &waiter);
+	if(!cancelArmed) {
+		queueChanged.raise();
+	}else if(deadline < armedDeadline) {
+		cancelArmed->cancel();
+	}
+
+	{
+		async::cancellation_callback cb{cancellation, [&] {
+			if(waiter.expired)
+				return;
+			// There is no need to re-arm the kernel timer. If this was the earliest waiter,
+			// the kernel timer fires early and is re-armed for the next waiter.
+			waiters.erase(it);
+			waiter.event.raise();
+		}};
+		co_await waiter.event.wait();
+	}
+
+	co_return waiter.expired;
+}
+
+async::result<bool> sleepFor(uint64_t duration, async::cancellation_token cancellation) {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	co_return co_await sleepUntil(add_sat(now, duration), cancellation);
+}
+
+TimeoutCancellation::TimeoutCancellation(uint64_t duration, async::cancellation_event &ev) {
+	_run(duration, ev);
+}
+
+async::detached TimeoutCancellation::_run(uint64_t duration, async::cancellation_event &ev) {
+	if(co_await sleepFor(duration, _cancelTimer))
+		ev.cancel();
+	_done.raise();
+}
+
+} // namespace posix
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <async/cancellation.hpp>
+#include <async/oneshot-event.hpp>
+#include <async/result.hpp>
+#include <stdint.h>
+
+namespace posix {
+
+// All timers of the POSIX subsystem (interval timers, timerfds, timeouts) share a
+// single queue. Only the earliest deadline is armed in the kernel. Timers may expire
+// up to timerSlack nanoseconds late, such that nearby deadlines expire together.
+// Timers never expire early.
+constexpr uint64_t timerSlack = 50'000;
+
+// Returns true if the deadline (in helGetClock() ticks) passed,
+// or false if the wait was cancelled.
+async::result<bool> sleepUntil(uint64_t deadline, async::cancellation_token cancellation = {});
+
+async::result<bool> sleepFor(uint64_t duration, async::cancellation_token cancellation = {});
+
+// Same as helix::TimeoutCancellation, but uses the timer queue.
+struct TimeoutCancellation {
+	TimeoutCancellation(uint64_t duration, async::cancellation_event &ev);
+
+	TimeoutCancellation(const TimeoutCancellation &) = delete;
+
+	TimeoutCancellation &operator= (const TimeoutCancellation &) = delete;
+
+	auto retire() {
+		_cancelTimer.cancel();
+		return _done.wait();
+	}
+
+private:
+	async::detached _run(uint64_t duration, async::cancellation_event &ev);
+
+	async::cancellation_event _cancelTimer;
+	async::oneshot_event _done;
+};
+
+} // namespace posix
@@ -1,7 +1,9 @@
 #include <fcntl.h>
 #include <linux/magic.h>
 #include <unistd.h>
+#include <algorithm>
 #include <set>
+#include <vector>
 
 #include <core/clock.hpp>
 #include <helix/memory.hpp>
@@ -25,6 +27,11 @@ namespace tmp_fs {
 
 namespace {
 
+constexpr size_t pageSize = 0x1000;
+
+// Regular files reserve at least this much memory once they are written to.
+constexpr size_t minCapacity = 64 * 1024;
+
 struct Superblock;
 
 struct Node : FsNode {
@@ -437,6 +444,9 @@ public:
 
 	async::result<frg::expected<Error, off_t>> seek(off_t delta, VfsSeek whence) override;
 
+	async::result<frg::expected<Error, off_t>> seekData(off_t offset) override;
+	async::result<frg::expected<Error, off_t>> seekHole(off_t offset) override;
+
 	async::result<frg::expected<Error, size_t>>
 	readSome(Process *, void *buffer, size_t max_length) override;
 
@@ -511,29 +521,29 @@ struct MemoryNode final : Node {
 	}
 
 private:
-	void _resizeFile(size_t new_size) {
-		_fileSize = new_size;
+	// Makes sure that the memory object can hold at least size bytes.
+	void _reserve(size_t size);
 
-		size_t aligned_size = (new_size + 0xFFF) & ~size_t(0xFFF);
-		if(aligned_size <= _areaSize)
-			return;
+	void _resizeFile(size_t new_size);
 
-		if(_memory) {
-			HEL_CHECK(helResizeMemory(_memory.getHandle(), aligned_size));
-		}else{
-			HelHandle handle;
-			HEL_CHECK(helAllocateMemory(aligned_size, 0, nullptr, &handle));
-			_memory = helix::UniqueDescriptor{handle};
-		}
+	// Hole pages read as zeros without faulting in memory.
+	void _readData(size_t offset, void *buffer, size_t length);
+	void _writeData(size_t offset, const void *buffer, size_t length);
 
-		_mapping = helix::Mapping{_memory, 0, aligned_size};
-		_areaSize = aligned_size;
+	bool _isDataPage(size_t page) {
+		return _memoryShared || (page < _dataPages.size() && _dataPages[page]);
 	}
 
 	helix::UniqueDescriptor _memory;
 	helix::Mapping _mapping;
 	size_t _areaSize;
 	size_t _fileSize;
+
+	// One bit per page that has been written to. All other pages are holes.
+	std::vector<bool> _dataPages;
+	// Set once the memory is handed out (e.g., for mmap()). Writes through such mappings
+	// are not tracked, hence all pages are treated as data from then on.
+	bool _memoryShared = false;
 };
 
 struct Superblock final : FsSuperblock {
@@ -613,6 +623,82 @@ MemoryNode::~MemoryNode() {
 	notifyObservers(FsObserver::deleteSelfEvent, {}, 0);
 }
 
+void MemoryNode::_reserve(size_t size) {
+	if(size <= _areaSize)
+		return;
+
+	// The memory is allocated on demand, hence reserving capacity is cheap. Growing the
+	// capacity geometrically avoids re-creating the mapping on every append.
+	size_t aligned_size = (size + pageSize - 1) & ~(pageSize - 1);
+	size_t capacity = std::max({aligned_size, 2 * _areaSize, minCapacity});
+
+	if(_memory) {
+		HEL_CHECK(helResizeMemory(_memory.getHandle(), capacity));
+	}else{
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(capacity, kHelAllocOnDemand, nullptr, &handle));
+		_memory = helix::UniqueDescriptor{handle};
+	}
+
+	_mapping = helix::Mapping{_memory, 0, capacity};
+	_areaSize = capacity;
+}
+
+void MemoryNode::_resizeFile(size_t new_size) {
+	if(new_size < _fileSize) {
+		// Clear the truncated part such that it reads as zeros if the file grows again.
+		auto window = reinterpret_cast<char *>(_mapping.get());
+		size_t page = new_size / pageSize;
+		size_t endPage = (_fileSize + pageSize - 1) / pageSize;
+		if(new_size % pageSize) {
+			if(_isDataPage(page))
+				memset(window + new_size, 0, pageSize - new_size % pageSize);
+			page++;
+		}
+		for(; page < endPage; page++) {
+			if(!_isDataPage(page))
+				continue;
+			memset(window + page * pageSize, 0, pageSize);
+			if(page < _dataPages.size())
+				_dataPages[page] = false;
+		}
+	}else{
+		_reserve(new_size);
+	}
+	_fileSize = new_size;
+}
+
+void MemoryNode::_readData(size_t offset, void *buffer, size_t length) {
+	auto window = reinterpret_cast<char *>(_mapping.get());
+	auto out = static_cast<char *>(buffer);
+	while(length) {
+		size_t chunk = std::min(length, pageSize - offset % pageSize);
+		if(_isDataPage(offset / pageSize)) {
+			memcpy(out, window + offset, chunk);
+		}else{
+			memset(out, 0, chunk);
+		}
+		offset += chunk;
+		out += chunk;
+		length -= chunk;
+	}
+}
+
+void MemoryNode::_writeData(size_t offset, const void *buffer, size_t length) {
+	if(!length)
+		return;
+	if(offset + length > _fileSize)
+		_resizeFile(offset + length);
+
+	size_t endPage = (offset + length + pageSize - 1) / pageSize;
+	if(_dataPages.size() < endPage)
+		_dataPages.resize(endPage, false);
+	for(size_t page = offset / pageSize; page < endPage; page++)
+		_dataPages[page] = true;
+
+	memcpy(reinterpret_cast<char *>(_mapping.get()) + offset, buffer, length);
+}
+
 void MemoryFile::handleClose() {
 	auto node = static_cast<MemoryNode *>(associatedLink()->getTarget().get());
 	if(flags_ & semanticWrite)
@@ -636,6 +722,39 @@ MemoryFile::seek(off_t delta, VfsSeek whence) {
 	co_return _offset;
 }
 
+async::result<frg::expected<Error, off_t>>
+MemoryFile::seekData(off_t offset) {
+	auto node = static_cast<MemoryNode *>(associatedLink()->getTarget().get());
+
+	if(offset < 0)
+		co_return Error::illegalArguments;
+	size_t position = offset;
+	while(position < node->_fileSize && !node->_isDataPage(position / pageSize))
+		position = (position / pageSize + 1) * pageSize;
+	if(position >= node->_fileSize)
+		co_return Error::noBackingDevice;
+
+	_offset = position;
+	co_return _offset;
+}
+
+async::result<frg::expected<Error, off_t>>
+MemoryFile::seekHole(off_t offset) {
+	auto node = static_cast<MemoryNode *>(associatedLink()->getTarget().get());
+
+	if(offset < 0)
+		co_return Error::illegalArguments;
+	size_t position = offset;
+	if(position >= node->_fileSize)
+		co_return Error::noBackingDevice;
+	while(position < node->_fileSize && node->_isDataPage(position / pageSize))
+		position = (position / pageSize + 1) * pageSize;
+
+	// The end of the file is an implicit hole.
+	_offset = std::min(position, node->_fileSize);
+	co_return _offset;
+}
+
 async::result<frg::expected<Error, size_t>>
 MemoryFile::readSome(Process *, void *buffer, size_t max_length) {
 	auto node = static_cast<MemoryNode *>(associatedLink()->getTarget().get());
@@ -644,7 +763,7 @@ MemoryFile::readSome(Process *, void *buffer, size_t max_length) {
 		co_return 0;
 	auto chunk = std::min(node->_fileSize - _offset, max_length);
 
-	memcpy(buffer, reinterpret_cast<char *>(node->_mapping.get()) + _offset, chunk);
+	node->_readData(_offset, buffer, chunk);
 	_offset += chunk;
 	node->notifyObservers(FsObserver::accessEvent, associatedLink()->getName(), 0);
 	co_return chunk;
@@ -654,10 +773,7 @@ async::result<frg::expected<Error, size_t>>
 MemoryFile::writeAll(Process *, const void *buffer, size_t length) {
 	auto node = static_cast<MemoryNode *>(associatedLink()->getTarget().get());
 
-	if(_offset + length > node->_fileSize)
-		node->_resizeFile(_offset + length);
-
-	memcpy(reinterpret_cast<char *>(node->_mapping.get()) + _offset, buffer, length);
+	node->_writeData(_offset, buffer, length);
 	_offset += length;
 	node->notifyObservers(FsObserver::modifyEvent, associatedLink()->getName(), 0);
 	co_return length;
@@ -671,7 +787,7 @@ MemoryFile::pread(Process *, int64_t offset, void *buffer, size_t length) {
 		co_return 0;
 	auto chunk = std::min(node->_fileSize - offset, length);
 
-	memcpy(buffer, reinterpret_cast<char *>(node->_mapping.get()) + offset, chunk);
+	node->_readData(offset, buffer, chunk);
 
 	co_return chunk;
 }
@@ -680,10 +796,7 @@ async::result<frg::expected<Error, size_t>>
 MemoryFile::pwrite(Process *, int64_t offset, const void *buffer, size_t length) {
 	auto node = static_cast<MemoryNode *>(associatedLink()->getTarget().get());
 
-	if(offset + length > node->_fileSize)
-		node->_resizeFile(offset + length);
-
-	memcpy(reinterpret_cast<char *>(node->_mapping.get()) + offset, buffer, length);
+	node->_writeData(offset, buffer, length);
 	co_return length;
 }
 
@@ -709,6 +822,9 @@ MemoryFile::allocate(int64_t offset, size_t size) {
 FutureMaybe<helix::UniqueDescriptor>
 MemoryFile::accessMemory() {
 	auto node = static_cast<MemoryNode *>(associatedLink()->getTarget().get());
+	// mmap() of an empty file still needs a memory object.
+	node->_reserve(1);
+	node->_memoryShared = true;
 	co_return node->_memory.dup();
 }
 
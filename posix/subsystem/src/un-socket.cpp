@@ -19,6 +19,7 @@
 #include "un-socket.hpp"
 #include "pidfd.hpp"
 #include "process.hpp"
+#include "timer-queue.hpp"
 #include "vfs.hpp"
 
 namespace un_socket {
@@ -73,16 +74,38 @@ struct OpenFile : File {
 	async::result<void> raceReceiveTimeout(async::cancellation_token c) {
 		if(receiveTimeout_) {
 			uint64_t ns = (receiveTimeout_->tv_usec * 1'000) + (receiveTimeout_->tv_sec * 1'000'000'000);
-			co_await helix::sleepFor(ns, c);
+			co_await posix::sleepFor(ns, c);
 		} else {
 			co_await async::suspend_indefinitely(c);
 		}
 	};
 
+	// A reader that blocks on an empty stream socket. Writers copy data directly into
+	// its buffer instead of queueing a packet (that is copied again by the reader).
+	struct DirectRead {
+		void *data;
+		size_t maxLength;
+		size_t length = 0;
+	};
+
+	// Returns the number of bytes that were handed to a waiting reader of remote.
+	static size_t transferDirectly(OpenFile *remote, const void *data, size_t length) {
+		auto direct = remote->_directRead;
+		if(!direct || !remote->_recvQueue.empty())
+			return 0;
+
+		auto chunk = std::min(length, direct->maxLength);
+		memcpy(direct->data, data, chunk);
+		direct->length = chunk;
+		remote->_directRead = nullptr;
+		remote->_statusBell.raise();
+		return chunk;
+	}
+
 	async::result<void> raceSendTimeout(async::cancellation_token c) {
 		if(sendTimeout_) {
 			uint64_t ns = (sendTimeout_->tv_usec * 1'000) + (sendTimeout_->tv_sec * 1'000'000'000);
-			co_await helix::sleepFor(ns, c);
+			co_await posix::sleepFor(ns, c);
 		} else {
 			co_await async::suspend_indefinitely(c);
 		}
@@ -159,14 +182,23 @@ public:
 			co_return Error::wouldBlock;
 		}
 
+		DirectRead direct{data, max_length};
+		if(socktype_ == SOCK_STREAM && _recvQueue.empty())
+			_directRead = &direct;
+
 		co_await async::race_and_cancel(
 			[&](async::cancellation_token c) { return raceReceiveTimeout(c); },
 			[&](async::cancellation_token c) -> async::result<void> {
-				while (_recvQueue.empty() && !c.is_cancellation_requested())
+				while (_recvQueue.empty() && !direct.length && !c.is_cancellation_requested())
 					co_await _statusBell.async_wait(c);
 			}
 		);
 
+		if(_directRead == &direct)
+			_directRead = nullptr;
+		if(direct.length)
+			co_return direct.length;
+
 		if(_recvQueue.empty())
 			co_return Error::wouldBlock;
 
@@ -199,10 +231,18 @@ public:
 		if(logSockets)
 			std::cout << "posix: Write to socket \e[1;34m" << structName() << "\e[0m" << std::endl;
 
+		size_t transferred = 0;
+		if(socktype_ == SOCK_STREAM) {
+			transferred = transferDirectly(_remote, data, length);
+			if(transferred == length)
+				co_return length;
+		}
+
 		Packet packet;
 		packet.senderPid = process->pid();
-		packet.buffer.resize(length);
-		memcpy(packet.buffer.data(), data, length);
+		packet.buffer.resize(length - transferred);
+		memcpy(packet.buffer.data(), static_cast<const char *>(data) + transferred,
+				length - transferred);
 		packet.offset = 0;
 		auto now = clk::getRealtime();
 		TIMESPEC_TO_TIMEVAL(&packet.recvTimestamp, &now);
@@ -235,14 +275,25 @@ public:
 			co_return protocols::fs::Error::wouldBlock;
 		}
 
+		// Direct transfers do not carry control messages.
+		DirectRead direct{data, max_length};
+		if(socktype_ == SOCK_STREAM && _recvQueue.empty()
+				&& !(flags & MSG_PEEK) && !_passCreds && !timestamp_)
+			_directRead = &direct;
+
 		co_await async::race_and_cancel(
 			[&](async::cancellation_token c) { return raceReceiveTimeout(c); },
 			[&](async::cancellation_token c) -> async::result<void> {
-				while (_recvQueue.empty() && !c.is_cancellation_requested())
+				while (_recvQueue.empty() && !direct.length && !c.is_cancellation_requested())
 					co_await _statusBell.async_wait(c);
 			}
 		);
 
+		if(_directRead == &direct)
+			_directRead = nullptr;
+		if(direct.length)
+			co_return protocols::fs::RecvData{{}, direct.length, 0, 0};
+
 		if(_recvQueue.empty())
 			co_return protocols::fs::Error::wouldBlock;
 
@@ -275,15 +326,18 @@ public:
 		if(!packet->files.empty()) {
 			auto [truncated, payload_len] = ctrl.message_truncated(SOL_SOCKET, SCM_RIGHTS, sizeof(int) * packet->files.size(), sizeof(int));
 			assert(!(payload_len % sizeof(int)));
-			for(auto &file : packet->files) {
-				if(truncated && payload_len < sizeof(int))
-					break;
-
-				ctrl.write<int>(process->fileContext()->attachFile(std::move(file), flags & MSG_CMSG_CLOEXEC));
 
-				if(truncated)
-					payload_len -= sizeof(int);
-			}
+			// Only attach the files that fit into the control message.
+			auto count = packet->files.size();
+			if(truncated)
+				count = std::min(count, payload_len / sizeof(int));
+			std::vector<smarter::shared_ptr<File, FileHandle>> files{
+					std::make_move_iterator(packet->files.begin()),
+					std::make_move_iterator(packet->files.begin() + count)};
+			auto fds = process->fileContext()->attachFiles(std::move(files),
+					flags & MSG_CMSG_CLOEXEC);
+			for(auto fd : fds)
+				ctrl.write<int>(fd);
 
 			if(truncated)
 				reply_flags |= MSG_CTRUNC;
@@ -382,13 +436,21 @@ public:
 
 		// We ignore MSG_DONTWAIT here as we never block anyway.
 
+		size_t transferred = 0;
+		if(socktype_ == SOCK_STREAM && files.empty()) {
+			transferred = transferDirectly(remote, data, max_length);
+			if(transferred == max_length)
+				co_return max_length;
+		}
+
 		// TODO: Add permission checking for ucred related items
 		Packet packet;
 		packet.senderPid = ucreds.pid;
 		packet.senderUid = ucreds.uid;
 		packet.senderGid = ucreds.gid;
-		packet.buffer.resize(max_length);
-		memcpy(packet.buffer.data(), data, max_length);
+		packet.buffer.resize(max_length - transferred);
+		memcpy(packet.buffer.data(), static_cast<const char *>(data) + transferred,
+				max_length - transferred);
 		packet.files = std::move(files);
 		packet.offset = 0;
 		auto now = clk::getRealtime();
@@ -854,6 +916,9 @@ private:
 	// The actual receive queue of the socket.
 	std::deque<Packet> _recvQueue;
 
+	// Reader that waits for data, if any.
+	DirectRead *_directRead = nullptr;
+
 	int _ownerPid;
 
 	// For connected sockets, this is the socket we are connected to.
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <optional>
+
 #include <async/result.hpp>
 #include <async/cancellation.hpp>
 #include <frg/expected.hpp>
@@ -23,6 +25,8 @@ struct File {
 	}
 
 	async::result<void> seekAbsolute(int64_t offset);
+	// Returns the new file position.
+	async::result<int64_t> seekRelative(int64_t offset);
 
 	async::result<size_t> readSome(void *data, size_t max_length);
 	async::result<size_t> writeSome(const void *data, size_t max_length);
@@ -35,11 +39,23 @@ struct File {
 
 	async::result<helix::UniqueDescriptor> accessMemory();
 
+	// Copies data to another file of the same server, see CopyFileRangeRequest.
+	async::result<frg::expected<Error, size_t>>
+	copyFileRange(std::optional<int64_t> offset, int64_t targetInode, int64_t targetOffset,
+			size_t length);
+
+	// Reads entries in the layout of struct dirent64, see ReadDirentsRequest.
+	// Returns zero at the end of the directory.
+	async::result<frg::expected<Error, size_t>> readDirents(void *buffer, size_t size);
+
 	static async::result<frg::expected<Error, File>> createSocket(helix::BorrowedLane lane,
 		int domain, int type, int proto, int flags);
 
 	async::result<Error> connect(const struct sockaddr *addr_ptr, socklen_t addr_length);
 
+	// Accepts a connection on a listening socket, see AcceptRequest.
+	async::result<frg::expected<Error, File>> accept();
+
 	async::result<frg::expected<Error, size_t>>
 	sendto(const void *buf, size_t len, int flags, const struct sockaddr *addr_ptr, socklen_t addr_length);
 
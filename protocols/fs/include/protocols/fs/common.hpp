@@ -3,6 +3,7 @@
 #include <optional>
 #include <string.h>
 #include <string>
+#include <string_view>
 #include <sys/socket.h>
 #include <variant>
 #include <vector>
@@ -129,6 +130,68 @@ using ReadResult = std::variant<Error, size_t>;
 
 using ReadEntriesResult = std::optional<std::string>;
 
+// fcntl() byte-range locks, see LockRangeRequest.
+enum class RangeLockType {
+	unlock,
+	shared,
+	exclusive
+};
+
+enum class RangeLockCommand {
+	test,
+	set,
+	setWait
+};
+
+// End offset of locks that extend to the end of the file.
+constexpr uint64_t rangeLockEof = UINT64_MAX;
+
+// Lock on the range [start, end).
+struct RangeLock {
+	RangeLockType type = RangeLockType::unlock;
+	uint64_t start = 0;
+	uint64_t end = rangeLockEof;
+	// Process that owns the lock or -1 for OFD locks.
+	int pid = -1;
+};
+
+// Serializes directory entries in the layout of Linux' struct dirent64,
+// i.e., the layout that getdents64() returns.
+struct DirentWriter {
+	DirentWriter(void *buffer, size_t size)
+	: _buffer{static_cast<char *>(buffer)}, _size{size} { }
+
+	// offset is the cookie that resumes the enumeration after this entry.
+	// Returns false if the entry does not fit into the buffer.
+	bool append(uint64_t inode, int64_t offset, uint8_t type, std::string_view name) {
+		// d_ino, d_off, d_reclen and d_type, followed by the null-terminated name.
+		constexpr size_t headerSize = 8 + 8 + 2 + 1;
+		size_t length = (headerSize + name.size() + 1 + 7) & ~size_t{7};
+		if(length > _size - _offset)
+			return false;
+
+		auto reclen = static_cast<uint16_t>(length);
+		auto p = _buffer + _offset;
+		memset(p, 0, length);
+		memcpy(p, &inode, 8);
+		memcpy(p + 8, &offset, 8);
+		memcpy(p + 16, &reclen, 2);
+		memcpy(p + 18, &type, 1);
+		memcpy(p + headerSize, name.data(), name.size());
+		_offset += length;
+		return true;
+	}
+
+	size_t size() {
+		return _offset;
+	}
+
+private:
+	char *_buffer;
+	size_t _size;
+	size_t _offset = 0;
+};
+
 using PollResult = std::tuple<uint64_t, int, int>;
 using PollWaitResult = std::tuple<uint64_t, int>;
 using PollStatusResult = std::tuple<uint64_t, int>;
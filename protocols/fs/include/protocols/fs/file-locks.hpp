@@ -2,7 +2,10 @@
 
 #include <protocols/fs/server.hpp>
 #include <boost/intrusive/list.hpp>
+#include <async/oneshot-event.hpp>
 #include <async/recurring-event.hpp>
+#include <frg/rbtree.hpp>
+#include <vector>
 
 namespace protocols::fs {
 
@@ -35,4 +38,104 @@ private:
 		static bool validateFlockFlags(int flags);
 	};
 
+	struct RangeLockManager;
+
+	// Open file description that takes fcntl() byte-range locks. OFD locks are owned by the
+	// description itself, POSIX locks by processes. All locks that were taken through the
+	// description are released on destruction. (POSIX wants locks of a process to be released
+	// once it closes any descriptor of the file but we only observe the description.)
+	struct RangeLockHandle {
+		RangeLockHandle() = default;
+
+		RangeLockHandle(const RangeLockHandle &) = delete;
+
+		RangeLockHandle &operator= (const RangeLockHandle &) = delete;
+
+		~RangeLockHandle();
+
+		// Returns the first lock that conflicts with the given one.
+		std::optional<RangeLock> test(RangeLockManager *m, bool ofd, RangeLock lock);
+
+		// Acquires (or releases if lock.type is unlock) the range. Locks of the same owner
+		// are replaced (and split if necessary).
+		async::result<Error> lock(RangeLockManager *m, bool ofd, RangeLock lock, bool wait);
+
+private:
+		RangeLockManager* manager = nullptr;
+		// Processes that took POSIX locks through this description.
+		std::vector<int> pids;
+	};
+
+	// Per-inode set of byte-range locks. Locks (and waiters) are kept in interval trees
+	// ordered by start offset and augmented by the maximal end offset in each subtree.
+	struct RangeLockManager {
+		friend struct RangeLockHandle;
+
+		RangeLockManager() = default;
+
+		RangeLockManager(const RangeLockManager &) = delete;
+
+		RangeLockManager &operator= (const RangeLockManager &) = delete;
+
+		~RangeLockManager();
+
+private:
+		struct Owner {
+			bool operator== (const Owner &) const = default;
+
+			// Non-null for OFD locks.
+			const RangeLockHandle *handle;
+			// Only relevant for POSIX locks.
+			int pid;
+		};
+
+		struct Range {
+			Owner owner;
+			RangeLockType type;
+			uint64_t start;
+			uint64_t end;
+			// Set for waiters.
+			async::oneshot_event *wakeup = nullptr;
+
+			frg::rbtree_hook treeNode;
+			// Maximal end offset within the subtree.
+			uint64_t maxEnd = 0;
+		};
+
+		struct RangeLess {
+			bool operator() (const Range &a, const Range &b) {
+				return a.start < b.start;
+			}
+		};
+
+		struct RangeAggregator;
+
+		using RangeTree = frg::rbtree<
+			Range,
+			&Range::treeNode,
+			RangeLess,
+			RangeAggregator
+		>;
+
+		struct RangeAggregator {
+			static bool aggregate(Range *range);
+			static bool check_invariant(RangeTree &tree, Range *range);
+		};
+
+		// Appends all ranges of the subtree that overlap [start, end).
+		static void findOverlapping(Range *range, uint64_t start, uint64_t end,
+				std::vector<Range *> &out);
+
+		Range *findConflict(Owner owner, RangeLockType type, uint64_t start, uint64_t end);
+		async::result<Error> lock(Owner owner, RangeLock lock, bool wait);
+		// Removes [start, end) from the locks of the owner.
+		// Returns true if the owner released an exclusive lock.
+		bool removeRange(Owner owner, uint64_t start, uint64_t end);
+		// Wakes up all waiters that overlap [start, end).
+		void wake(uint64_t start, uint64_t end);
+
+		RangeTree locks;
+		RangeTree waiters;
+	};
+
 }
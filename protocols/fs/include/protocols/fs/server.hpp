@@ -15,6 +15,7 @@
 #include <smarter.hpp>
 #include <deque>
 #include <memory>
+#include <optional>
 
 namespace managarm::fs {
 	struct CntRequest;
@@ -44,6 +45,9 @@ struct FileStats {
 	struct timespec accessTime;
 	struct timespec dataModifyTime;
 	struct timespec anyChangeTime;
+	// Set if the client may cache the attributes until the server revokes
+	// the lease (see WatchAttributesRequest).
+	bool lease = false;
 };
 
 using SeekResult = std::variant<Error, int64_t>;
@@ -73,6 +77,16 @@ struct FileOperations {
 		seekEof = f;
 		return *this;
 	}
+	constexpr FileOperations &withSeekData(async::result<SeekResult> (*f)(void *object,
+			int64_t offset)) {
+		seekData = f;
+		return *this;
+	}
+	constexpr FileOperations &withSeekHole(async::result<SeekResult> (*f)(void *object,
+			int64_t offset)) {
+		seekHole = f;
+		return *this;
+	}
 	constexpr FileOperations &withRead(async::result<ReadResult> (*f)(void *object,
 			helix_ng::CredentialsView , void *buffer, size_t length)) {
 		read = f;
@@ -92,6 +106,11 @@ struct FileOperations {
 		readEntries = f;
 		return *this;
 	}
+	constexpr FileOperations &withReadDirents(async::result<frg::expected<Error, size_t>> (*f)(void *object,
+			void *buffer, size_t size)) {
+		readDirents = f;
+		return *this;
+	}
 	constexpr FileOperations &withAccessMemory(async::result<helix::BorrowedDescriptor>(*f)(void *object)) {
 		accessMemory = f;
 		return *this;
@@ -106,6 +125,11 @@ struct FileOperations {
 		fallocate = f;
 		return *this;
 	}
+	constexpr FileOperations &withFsync(async::result<frg::expected<protocols::fs::Error>> (*f)(void *object,
+			bool dataOnly)) {
+		fsync = f;
+		return *this;
+	}
 	constexpr FileOperations &withIoctl(async::result<void> (*f)(void *object,
 			uint32_t id, helix_ng::RecvInlineResult msg, helix::UniqueLane conversation)) {
 		ioctl = f;
@@ -116,6 +140,11 @@ struct FileOperations {
 		flock = f;
 		return *this;
 	}
+	constexpr FileOperations &withLockRange(async::result<frg::expected<Error, RangeLock>>
+			(*f)(void *object, RangeLockCommand command, bool ofd, RangeLock lock)) {
+		lockRange = f;
+		return *this;
+	}
 	constexpr FileOperations &withBind(async::result<Error> (*f)(void *object,
 			helix_ng::CredentialsView , const void *addr_ptr, size_t addr_length)) {
 		bind = f;
@@ -135,6 +164,18 @@ struct FileOperations {
 		listen = f;
 		return *this;
 	}
+	constexpr FileOperations &withAccept(async::result<frg::expected<Error, helix::UniqueLane>>
+			(*f)(void *object)) {
+		accept = f;
+		return *this;
+	}
+
+	constexpr FileOperations &withCopyFileRange(async::result<frg::expected<Error, size_t>> (*f)(void *object,
+			std::optional<int64_t> offset, int64_t target_inode, int64_t target_offset,
+			size_t length)) {
+		copyFileRange = f;
+		return *this;
+	}
 
 	constexpr FileOperations &withPeername(async::result<frg::expected<Error, size_t>> (*f)(void *object,
 			void *addr_ptr, size_t max_addr_length)) {
@@ -145,6 +186,9 @@ struct FileOperations {
 	async::result<SeekResult> (*seekAbs)(void *object, int64_t offset) = nullptr;
 	async::result<SeekResult> (*seekRel)(void *object, int64_t offset) = nullptr;
 	async::result<SeekResult> (*seekEof)(void *object, int64_t offset) = nullptr;
+	// Return the next data or hole position at or after offset, respectively.
+	async::result<SeekResult> (*seekData)(void *object, int64_t offset) = nullptr;
+	async::result<SeekResult> (*seekHole)(void *object, int64_t offset) = nullptr;
 	async::result<ReadResult> (*read)(void *object, helix_ng::CredentialsView credentials,
 			void *buffer, size_t length) = nullptr;
 	async::result<ReadResult> (*pread)(void *object, int64_t offset, helix_ng::CredentialsView credentials,
@@ -154,12 +198,22 @@ struct FileOperations {
 	async::result<frg::expected<protocols::fs::Error, size_t>> (*pwrite)(void *object, int64_t offset, helix_ng::CredentialsView credentials,
 			const void *buffer, size_t length) = nullptr;
 	async::result<ReadEntriesResult> (*readEntries)(void *object) = nullptr;
+	// Fills the buffer with entries using a DirentWriter. Returns the number of bytes
+	// that were written (zero at the end of the directory).
+	async::result<frg::expected<Error, size_t>> (*readDirents)(void *object,
+			void *buffer, size_t size) = nullptr;
 	async::result<helix::BorrowedDescriptor>(*accessMemory)(void *object) = nullptr;
 	async::result<frg::expected<protocols::fs::Error>> (*truncate)(void *object, size_t size) = nullptr;
 	async::result<frg::expected<protocols::fs::Error>> (*fallocate)(void *object, int64_t offset, size_t size) = nullptr;
+	// Makes the data (and unless dataOnly is set, the metadata) of the file durable.
+	async::result<frg::expected<protocols::fs::Error>> (*fsync)(void *object, bool dataOnly) = nullptr;
 	async::result<void> (*ioctl)(void *object, uint32_t id, helix_ng::RecvInlineResult req,
 			helix::UniqueLane conversation) = nullptr;
 	async::result<protocols::fs::Error> (*flock)(void *object, int flags) = nullptr;
+	// For RangeLockCommand::test, returns the first conflicting lock (or a lock of type
+	// RangeLockType::unlock if there is none). Otherwise, returns the given lock.
+	async::result<frg::expected<Error, RangeLock>> (*lockRange)(void *object,
+			RangeLockCommand command, bool ofd, RangeLock lock) = nullptr;
 	async::result<frg::expected<Error, PollWaitResult>>
 	(*pollWait)(void *object, uint64_t sequence, int mask,
 			async::cancellation_token cancellation) = nullptr;
@@ -168,6 +222,8 @@ struct FileOperations {
 	async::result<Error> (*bind)(void *object, helix_ng::CredentialsView credentials,
 			const void *addr_ptr, size_t addr_length) = nullptr;
 	async::result<Error> (*listen)(void *object) = nullptr;
+	// Returns the passthrough lane of the accepted socket; the server serves the other end.
+	async::result<frg::expected<Error, helix::UniqueLane>> (*accept)(void *object) = nullptr;
 	async::result<Error> (*connect)(void *object, helix_ng::CredentialsView credentials,
 			const void *addr_ptr, size_t addr_length) = nullptr;
 	async::result<size_t> (*sockname)(void *object, void *addr_ptr, size_t max_addr_length) = nullptr;
@@ -186,6 +242,11 @@ struct FileOperations {
 	async::result<frg::expected<Error>> (*setSocketOption)(void *object, int layer, int number, std::vector<char> optbuf) = nullptr;
 	async::result<frg::expected<Error>> (*getSocketOption)(void *object, helix_ng::CredentialsView creds,
 			int layer, int number, std::vector<char> &optbuf) = nullptr;
+	// Copies data to another file (identified by its inode) that is served by the same server.
+	// If no offset is given, the file position is used and advanced.
+	async::result<frg::expected<Error, size_t>> (*copyFileRange)(void *object,
+			std::optional<int64_t> offset, int64_t target_inode, int64_t target_offset,
+			size_t length) = nullptr;
 
 	bool logRequests = false;
 };
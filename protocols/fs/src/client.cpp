@@ -36,6 +36,33 @@ async::result<void> File::seekAbsolute(int64_t offset) {
 	assert(resp.error() == managarm::fs::Errors::SUCCESS);
 }
 
+async::result<int64_t> File::seekRelative(int64_t offset) {
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::SEEK_REL);
+	req.set_rel_offset(offset);
+
+	auto ser = req.SerializeAsString();
+	uint8_t buffer[128];
+
+	auto [offer, send_req, recv_resp] =
+		co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::recvBuffer(buffer, 128)
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(buffer, recv_resp.actualLength());
+	assert(resp.error() == managarm::fs::Errors::SUCCESS);
+	co_return resp.offset();
+}
+
 async::result<size_t> File::readSome(void *data, size_t max_length) {
 	managarm::fs::CntRequest req;
 	req.set_req_type(managarm::fs::CntReqType::READ);
@@ -201,6 +228,66 @@ async::result<helix::UniqueDescriptor> File::accessMemory() {
 	co_return recv_memory.descriptor();
 }
 
+async::result<frg::expected<Error, size_t>>
+File::copyFileRange(std::optional<int64_t> offset, int64_t targetInode, int64_t targetOffset,
+		size_t length) {
+	managarm::fs::CopyFileRangeRequest req;
+	req.set_has_offset(offset.has_value());
+	req.set_offset(offset.value_or(0));
+	req.set_target_inode(targetInode);
+	req.set_target_offset(targetOffset);
+	req.set_size(length);
+
+	auto [offer, send_req, recv_resp] =
+		co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::CopyFileRangeReply resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	recv_resp.reset();
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return resp.error() | toFsProtoError;
+	co_return resp.size();
+}
+
+async::result<frg::expected<Error, size_t>>
+File::readDirents(void *buffer, size_t size) {
+	managarm::fs::ReadDirentsRequest req;
+	req.set_size(size);
+
+	auto [offer, send_req, recv_resp, recv_data] =
+		co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline(),
+				helix_ng::recvBuffer(buffer, size)
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+	HEL_CHECK(recv_data.error());
+
+	managarm::fs::ReadDirentsReply resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	recv_resp.reset();
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return resp.error() | toFsProtoError;
+	assert(resp.size() == recv_data.actualLength());
+	co_return resp.size();
+}
+
 async::result<frg::expected<Error, File>> File::createSocket(helix::BorrowedLane lane,
 		int domain, int type, int proto, int flags) {
 	managarm::fs::CntRequest req;
@@ -259,6 +346,32 @@ async::result<Error> File::connect(const struct sockaddr *addr_ptr, socklen_t ad
 	co_return static_cast<Error>(resp.error());
 }
 
+async::result<frg::expected<Error, File>> File::accept() {
+	managarm::fs::AcceptRequest req;
+
+	auto [offer, send_req, recv_resp, recv_lane] = co_await helix_ng::exchangeMsgs(
+		_lane,
+		helix_ng::offer(
+			helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+			helix_ng::recvInline(),
+			helix_ng::pullDescriptor()
+		)
+	);
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::AcceptReply resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	recv_resp.reset();
+	// The server only pushes the lane on success.
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return resp.error() | toFsProtoError;
+	HEL_CHECK(recv_lane.error());
+
+	co_return File{recv_lane.descriptor()};
+}
+
 async::result<frg::expected<Error, size_t>>
 File::sendto(const void *buf, size_t len, int flags, const struct sockaddr *addr_ptr, socklen_t addr_length) {
 	managarm::fs::SendMsgRequest req;
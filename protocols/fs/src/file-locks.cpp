@@ -1,5 +1,7 @@
 #include <protocols/fs/file-locks.hpp>
 #include <protocols/fs/server.hpp>
+#include <algorithm>
+#include <assert.h>
 #include <iostream>
 #include <fs.bragi.hpp>
 
@@ -82,4 +84,156 @@ namespace protocols::fs {
 
 		return true;
 	}
+
+	RangeLockHandle::~RangeLockHandle() {
+		if(!manager)
+			return;
+		if(manager->removeRange({this, -1}, 0, rangeLockEof))
+			manager->wake(0, rangeLockEof);
+		for(auto pid : pids) {
+			if(manager->removeRange({nullptr, pid}, 0, rangeLockEof))
+				manager->wake(0, rangeLockEof);
+		}
+	}
+
+	std::optional<RangeLock> RangeLockHandle::test(RangeLockManager *m, bool ofd, RangeLock lock) {
+		RangeLockManager::Owner owner{ofd ? this : nullptr, ofd ? -1 : lock.pid};
+		auto conflict = m->findConflict(owner, lock.type, lock.start, lock.end);
+		if(!conflict)
+			return std::nullopt;
+		return RangeLock{conflict->type, conflict->start, conflict->end,
+				conflict->owner.handle ? -1 : conflict->owner.pid};
+	}
+
+	async::result<Error> RangeLockHandle::lock(RangeLockManager *m, bool ofd,
+			RangeLock lock, bool wait) {
+		assert(!manager || manager == m);
+		manager = m;
+		if(!ofd && std::find(pids.begin(), pids.end(), lock.pid) == pids.end())
+			pids.push_back(lock.pid);
+
+		RangeLockManager::Owner owner{ofd ? this : nullptr, ofd ? -1 : lock.pid};
+		co_return co_await m->lock(owner, lock, wait);
+	}
+
+	RangeLockManager::~RangeLockManager() {
+		// Waiters keep the open file (and hence the inode) alive.
+		assert(!waiters.get_root());
+		while(locks.get_root()) {
+			auto range = locks.get_root();
+			locks.remove(range);
+			delete range;
+		}
+	}
+
+	bool RangeLockManager::RangeAggregator::aggregate(Range *range) {
+		uint64_t maxEnd = range->end;
+		if(RangeTree::get_left(range) && RangeTree::get_left(range)->maxEnd > maxEnd)
+			maxEnd = RangeTree::get_left(range)->maxEnd;
+		if(RangeTree::get_right(range) && RangeTree::get_right(range)->maxEnd > maxEnd)
+			maxEnd = RangeTree::get_right(range)->maxEnd;
+
+		if(range->maxEnd == maxEnd)
+			return false;
+		range->maxEnd = maxEnd;
+		return true;
+	}
+
+	bool RangeLockManager::RangeAggregator::check_invariant(RangeTree &tree, Range *range) {
+		uint64_t maxEnd = range->end;
+		if(tree.get_left(range) && tree.get_left(range)->maxEnd > maxEnd)
+			maxEnd = tree.get_left(range)->maxEnd;
+		if(tree.get_right(range) && tree.get_right(range)->maxEnd > maxEnd)
+			maxEnd = tree.get_right(range)->maxEnd;
+		return range->maxEnd == maxEnd;
+	}
+
+	void RangeLockManager::findOverlapping(Range *range, uint64_t start, uint64_t end,
+			std::vector<Range *> &out) {
+		// No range in this subtree ends after start.
+		if(!range || range->maxEnd <= start)
+			return;
+		findOverlapping(RangeTree::get_left(range), start, end, out);
+		// This range and all ranges in the right subtree begin at or after end.
+		if(range->start >= end)
+			return;
+		if(range->end > start)
+			out.push_back(range);
+		findOverlapping(RangeTree::get_right(range), start, end, out);
+	}
+
+	auto RangeLockManager::findConflict(Owner owner, RangeLockType type,
+			uint64_t start, uint64_t end) -> Range * {
+		std::vector<Range *> overlapping;
+		findOverlapping(locks.get_root(), start, end, overlapping);
+		for(auto range : overlapping) {
+			if(range->owner == owner)
+				continue;
+			if(type == RangeLockType::exclusive || range->type == RangeLockType::exclusive)
+				return range;
+		}
+		return nullptr;
+	}
+
+	async::result<Error> RangeLockManager::lock(Owner owner, RangeLock lock, bool wait) {
+		if(lock.start >= lock.end)
+			co_return Error::illegalArguments;
+
+		if(lock.type == RangeLockType::unlock) {
+			removeRange(owner, lock.start, lock.end);
+			wake(lock.start, lock.end);
+			co_return Error::none;
+		}
+
+		while(findConflict(owner, lock.type, lock.start, lock.end)) {
+			if(!wait)
+				co_return Error::wouldBlock;
+
+			// wake() removes the waiter from the tree.
+			async::oneshot_event wakeup;
+			Range waiter{owner, lock.type, lock.start, lock.end, &wakeup};
+			waiters.insert(&waiter);
+			co_await wakeup.wait();
+		}
+
+		// Downgrading an exclusive lock can unblock waiters.
+		bool released = removeRange(owner, lock.start, lock.end);
+		locks.insert(new Range{owner, lock.type, lock.start, lock.end});
+		if(released && lock.type == RangeLockType::shared)
+			wake(lock.start, lock.end);
+		co_return Error::none;
+	}
+
+	bool RangeLockManager::removeRange(Owner owner, uint64_t start, uint64_t end) {
+		std::vector<Range *> overlapping;
+		findOverlapping(locks.get_root(), start, end, overlapping);
+
+		bool releasedExclusive = false;
+		for(auto range : overlapping) {
+			if(range->owner != owner)
+				continue;
+			if(range->type == RangeLockType::exclusive)
+				releasedExclusive = true;
+
+			locks.remove(range);
+			if(range->start < start)
+				locks.insert(new Range{owner, range->type, range->start, start});
+			if(range->end > end)
+				locks.insert(new Range{owner, range->type, end, range->end});
+			delete range;
+		}
+		return releasedExclusive;
+	}
+
+	void RangeLockManager::wake(uint64_t start, uint64_t end) {
+		std::vector<Range *> overlapping;
+		findOverlapping(waiters.get_root(), start, end, overlapping);
+
+		// Remove all waiters before resuming any of them; they insert themselves again
+		// if they still conflict.
+		for(auto waiter : overlapping)
+			waiters.remove(waiter);
+		for(auto waiter : overlapping)
+			waiter->wakeup->raise();
+	}
 }
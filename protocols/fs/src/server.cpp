@@ -2,9 +2,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
+#include <async/oneshot-event.hpp>
 #include <helix/ipc.hpp>
 
 #include <core/clock.hpp>
@@ -35,6 +37,55 @@ bool handleSoPasscred(bool so_passcred, struct ucred &ucred, pid_t process_pid,
 
 namespace {
 
+// Upper bound for the buffer of a ReadDirentsRequest.
+constexpr uint64_t maxDirentsSize = 64 * 1024;
+
+// Upper bound for the total size of the segments of PreadvRequest and PwritevRequest.
+constexpr uint64_t maxVectoredSize = 16 * 1024 * 1024;
+
+// Sums up the sizes of the segments. Returns false if the total exceeds maxVectoredSize.
+bool totalSegmentSize(const std::vector<managarm::fs::IoSegment> &segments, size_t &total) {
+	total = 0;
+	for(auto &segment : segments) {
+		if(segment.size() > maxVectoredSize - total)
+			return false;
+		total += segment.size();
+	}
+	return true;
+}
+
+// Upper bound for the number of messages of RecvMmsgRequest and SendMmsgRequest.
+constexpr size_t maxMmsgCount = 1024;
+
+// Upper bound for the size of a single socket address in RecvMmsgRequest and SendMmsgRequest.
+constexpr uint64_t maxMmsgAddrSize = sizeof(struct sockaddr_storage);
+
+// Like totalSegmentSize() but for the message sizes of RecvMmsgRequest and SendMmsgRequest.
+bool totalMessageSize(const std::vector<uint64_t> &sizes, uint64_t limit, size_t &total) {
+	if(sizes.size() > maxMmsgCount)
+		return false;
+	total = 0;
+	for(auto size : sizes) {
+		if(size > limit - total)
+			return false;
+		total += size;
+	}
+	return true;
+}
+
+struct SegmentReads {
+	size_t pending;
+	async::oneshot_event done;
+};
+
+async::detached readSegment(smarter::shared_ptr<void> file, const FileOperations *file_ops,
+		int64_t offset, helix_ng::CredentialsView credentials, void *buffer, size_t size,
+		ReadResult *result, SegmentReads *reads) {
+	*result = co_await file_ops->pread(file.get(), offset, credentials, buffer, size);
+	if(!--reads->pending)
+		reads->done.raise();
+}
+
 constinit protocols::ostrace::Event ostEvtRequest{"fs.request"};
 constinit protocols::ostrace::UintAttribute ostAttrRequest{"request"};
 constinit protocols::ostrace::UintAttribute ostAttrTime{"time"};
@@ -166,6 +217,41 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			resp.set_offset(std::get<int64_t>(result));
 		}
 
+		auto ser = resp.SerializeAsString();
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBuffer(ser.data(), ser.size())
+		);
+		HEL_CHECK(send_resp.error());
+		logBragiSerializedReply(ser);
+	}else if(req.req_type() == managarm::fs::CntReqType::SEEK_DATA
+			|| req.req_type() == managarm::fs::CntReqType::SEEK_HOLE) {
+		auto seekOp = req.req_type() == managarm::fs::CntReqType::SEEK_DATA
+				? file_ops->seekData : file_ops->seekHole;
+		if(!seekOp) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size())
+			);
+			HEL_CHECK(send_resp.error());
+			logBragiSerializedReply(ser);
+			co_return;
+		}
+		auto result = co_await seekOp(file.get(), req.rel_offset());
+		auto error = std::get_if<Error>(&result);
+
+		managarm::fs::SvrResponse resp;
+		if(error) {
+			resp.set_error(*error | toFsError);
+		} else {
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_offset(std::get<int64_t>(result));
+		}
+
 		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
@@ -536,6 +622,28 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
 		}
 
+		auto ser = resp.SerializeAsString();
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBuffer(ser.data(), ser.size())
+		);
+		HEL_CHECK(send_resp.error());
+		logBragiSerializedReply(ser);
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_FSYNC) {
+		managarm::fs::SvrResponse resp;
+
+		if(!file_ops->fsync) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else{
+			auto result = co_await file_ops->fsync(file.get(),
+					req.flags() & managarm::fs::FsyncFlags::FSYNC_DATA_ONLY);
+			if(result) {
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+			}else{
+				resp.set_error(result.error() | toFsError);
+			}
+		}
+
 		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
@@ -1164,6 +1272,190 @@ async::detached handleMessages(smarter::shared_ptr<void> file,
 		);
 		HEL_CHECK(send_resp.error());
 		logBragiSerializedReply(ser);
+	} else if(preamble.id() == managarm::fs::RecvMmsgRequest::message_id) {
+		std::vector<uint8_t> tail(preamble.tail_size());
+		auto [recv_tail, extract_creds] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size()),
+			helix_ng::extractCredentials()
+		);
+		HEL_CHECK(recv_tail.error());
+		HEL_CHECK(extract_creds.error());
+		logBragiRequest(tail);
+
+		auto req = bragi::parse_head_tail<managarm::fs::RecvMmsgRequest>(recv_req, tail);
+		recv_req.reset();
+
+		if(!req) {
+			std::cout << "protocols/fs: Rejecting request due to decoding failure" << std::endl;
+			co_return;
+		}
+
+		managarm::fs::RecvMmsgReply resp;
+		std::vector<char> addrs;
+		std::vector<char> data;
+
+		auto &sizes = req->sizes();
+		size_t total;
+		if(!file_ops->recvMsg) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		} else if(req->addr_size() > maxMmsgAddrSize
+				|| !totalMessageSize(sizes, maxVectoredSize, total)) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+		} else {
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			addrs.resize(sizes.size() * req->addr_size());
+			data.resize(total);
+
+			// Messages are received in order; only data that was actually received is kept.
+			size_t count = 0;
+			size_t position = 0;
+			auto flags = req->flags() & ~MSG_WAITFORONE;
+			for(size_t i = 0; i < sizes.size(); i++) {
+				auto result = co_await file_ops->recvMsg(file.get(),
+					extract_creds.credentials(), flags,
+					data.data() + position, sizes[i],
+					addrs.data() + count * req->addr_size(), req->addr_size(), 0);
+
+				if(auto error = std::get_if<Error>(&result); error) {
+					// Like recvmmsg(), only report errors if nothing was received.
+					if(!count)
+						resp.set_error(*error | toFsError);
+					break;
+				}
+
+				auto &received = std::get<RecvData>(result);
+				resp.add_sizes(received.dataLength);
+				resp.add_addr_sizes(received.addressLength);
+				resp.add_flags(received.flags);
+				position += received.dataLength;
+				count++;
+
+				if(req->flags() & MSG_WAITFORONE)
+					flags |= MSG_DONTWAIT;
+			}
+			addrs.resize(count * req->addr_size());
+			data.resize(position);
+		}
+
+		auto [send_resp, send_addrs, send_data] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadTail(resp, frg::stl_allocator{}),
+			helix_ng::sendBuffer(addrs.data(), addrs.size()),
+			helix_ng::sendBuffer(data.data(), data.size())
+		);
+		HEL_CHECK(send_resp.error());
+		HEL_CHECK(send_addrs.error());
+		HEL_CHECK(send_data.error());
+		logBragiReply(resp);
+	} else if(preamble.id() == managarm::fs::SendMmsgRequest::message_id) {
+		std::vector<uint8_t> tail(preamble.tail_size());
+		auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+		HEL_CHECK(recv_tail.error());
+		logBragiRequest(tail);
+
+		auto req = bragi::parse_head_tail<managarm::fs::SendMmsgRequest>(recv_req, tail);
+		recv_req.reset();
+
+		if(!req) {
+			std::cout << "protocols/fs: Rejecting request due to decoding failure" << std::endl;
+			co_return;
+		}
+
+		// The client always sends both buffers, hence we need to receive them
+		// even if the request is rejected.
+		auto &sizes = req->sizes();
+		auto &addrSizes = req->addr_sizes();
+		size_t total;
+		size_t addrTotal;
+		bool validSize = sizes.size() == addrSizes.size()
+				&& totalMessageSize(sizes, maxVectoredSize, total)
+				&& totalMessageSize(addrSizes, sizes.size() * maxMmsgAddrSize, addrTotal);
+		std::vector<char> data(validSize ? total : 0);
+		std::vector<char> addrs(validSize ? addrTotal : 0);
+
+		auto [extract_creds, recv_data, recv_addrs] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::extractCredentials(),
+			helix_ng::recvBuffer(data.data(), data.size()),
+			helix_ng::recvBuffer(addrs.data(), addrs.size())
+		);
+		HEL_CHECK(extract_creds.error());
+
+		managarm::fs::SendMmsgReply resp;
+
+		if(!file_ops->sendMsg) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		} else if(!validSize || recv_data.error() || recv_data.actualLength() != total
+				|| recv_addrs.error() || recv_addrs.actualLength() != addrTotal) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+		} else {
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			size_t position = 0;
+			size_t addrPosition = 0;
+			for(size_t i = 0; i < sizes.size(); i++) {
+				auto ret = co_await file_ops->sendMsg(file.get(),
+					extract_creds.credentials(), req->flags(),
+					data.data() + position, sizes[i],
+					addrs.data() + addrPosition, addrSizes[i],
+					{}, {});
+				if(!ret) {
+					// Like sendmmsg(), only report errors if nothing was sent.
+					if(!i)
+						resp.set_error(ret.error() | toFsError);
+					break;
+				}
+				resp.add_sizes(ret.value());
+				position += sizes[i];
+				addrPosition += addrSizes[i];
+			}
+		}
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadTail(resp, frg::stl_allocator{})
+		);
+		HEL_CHECK(send_resp.error());
+		logBragiReply(resp);
+	} else if(preamble.id() == managarm::fs::AcceptRequest::message_id) {
+		auto req = bragi::parse_head_only<managarm::fs::AcceptRequest>(recv_req);
+		recv_req.reset();
+
+		if(!req) {
+			std::cout << "protocols/fs: Rejecting request due to decoding failure" << std::endl;
+			co_return;
+		}
+
+		managarm::fs::AcceptReply resp;
+		if(!file_ops->accept) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		} else {
+			auto result = co_await file_ops->accept(file.get());
+			if(result) {
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+
+				auto [send_resp, push_lane] = co_await helix_ng::exchangeMsgs(
+					conversation,
+					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
+					helix_ng::pushDescriptor(result.value())
+				);
+				HEL_CHECK(send_resp.error());
+				HEL_CHECK(push_lane.error());
+				logBragiReply(resp);
+				co_return;
+			}
+			resp.set_error(result.error() | toFsError);
+		}
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
+		HEL_CHECK(send_resp.error());
+		logBragiReply(resp);
 	} else if(preamble.id() == managarm::fs::IoctlRequest::message_id) {
 		auto req = bragi::parse_head_only<managarm::fs::IoctlRequest>(recv_req);
 		recv_req.reset();
@@ -1291,6 +1583,263 @@ async::detached handleMessages(smarter::shared_ptr<void> file,
 		HEL_CHECK(send_resp.error());
 		HEL_CHECK(send_buf.error());
 		logBragiReply(resp);
+	} else if(preamble.id() == managarm::fs::CopyFileRangeRequest::message_id) {
+		auto req = bragi::parse_head_only<managarm::fs::CopyFileRangeRequest>(recv_req);
+		recv_req.reset();
+
+		if(!req) {
+			std::cout << "protocols/fs: Rejecting request due to decoding failure" << std::endl;
+			co_return;
+		}
+
+		managarm::fs::CopyFileRangeReply resp;
+
+		if(!file_ops->copyFileRange) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		} else {
+			std::optional<int64_t> offset;
+			if(req->has_offset())
+				offset = req->offset();
+
+			auto ret = co_await file_ops->copyFileRange(file.get(), offset,
+					req->target_inode(), req->target_offset(), req->size());
+			if(!ret) {
+				resp.set_error(ret.error() | toFsError);
+			} else {
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+				resp.set_size(ret.value());
+			}
+		}
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
+		HEL_CHECK(send_resp.error());
+		logBragiReply(resp);
+	} else if(preamble.id() == managarm::fs::PreadvRequest::message_id) {
+		std::vector<uint8_t> tail(preamble.tail_size());
+		auto [recv_tail, extract_creds] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size()),
+			helix_ng::extractCredentials()
+		);
+		HEL_CHECK(recv_tail.error());
+		HEL_CHECK(extract_creds.error());
+		logBragiRequest(tail);
+
+		auto req = bragi::parse_head_tail<managarm::fs::PreadvRequest>(recv_req, tail);
+		recv_req.reset();
+
+		if(!req) {
+			std::cout << "protocols/fs: Rejecting request due to decoding failure" << std::endl;
+			co_return;
+		}
+
+		managarm::fs::PreadvReply resp;
+		std::vector<char> data;
+
+		auto &segments = req->segments();
+		size_t total;
+		if(!file_ops->pread) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		} else if(!totalSegmentSize(segments, total)) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+		} else {
+			data.resize(total);
+			std::vector<ReadResult> results(segments.size());
+
+			SegmentReads reads{.pending = segments.size()};
+			size_t position = 0;
+			for(size_t i = 0; i < segments.size(); i++) {
+				readSegment(file, file_ops, segments[i].offset(), extract_creds.credentials(),
+						data.data() + position, segments[i].size(), &results[i], &reads);
+				position += segments[i].size();
+			}
+			if(reads.pending)
+				co_await reads.done.wait();
+
+			// Compact the data of short reads.
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			size_t in = 0;
+			size_t out = 0;
+			for(size_t i = 0; i < segments.size(); i++) {
+				size_t size = 0;
+				if(auto error = std::get_if<Error>(&results[i]); error) {
+					if(resp.error() == managarm::fs::Errors::SUCCESS)
+						resp.set_error(*error | toFsError);
+				} else {
+					size = std::get<size_t>(results[i]);
+					memmove(data.data() + out, data.data() + in, size);
+				}
+				resp.add_sizes(size);
+				in += segments[i].size();
+				out += size;
+			}
+			data.resize(out);
+		}
+
+		auto [send_resp, send_data] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadTail(resp, frg::stl_allocator{}),
+			helix_ng::sendBuffer(data.data(), data.size())
+		);
+		HEL_CHECK(send_resp.error());
+		HEL_CHECK(send_data.error());
+		logBragiReply(resp);
+	} else if(preamble.id() == managarm::fs::PwritevRequest::message_id) {
+		std::vector<uint8_t> tail(preamble.tail_size());
+		auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+		HEL_CHECK(recv_tail.error());
+		logBragiRequest(tail);
+
+		auto req = bragi::parse_head_tail<managarm::fs::PwritevRequest>(recv_req, tail);
+		recv_req.reset();
+
+		if(!req) {
+			std::cout << "protocols/fs: Rejecting request due to decoding failure" << std::endl;
+			co_return;
+		}
+
+		// The client always sends the data buffer, hence we need to receive it
+		// even if the request is rejected.
+		auto &segments = req->segments();
+		size_t total;
+		bool validSize = totalSegmentSize(segments, total);
+		std::vector<char> data(validSize ? total : 0);
+
+		auto [extract_creds, recv_data] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::extractCredentials(),
+			helix_ng::recvBuffer(data.data(), data.size())
+		);
+		HEL_CHECK(extract_creds.error());
+
+		managarm::fs::PwritevReply resp;
+
+		if(!file_ops->pwrite) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		} else if(!validSize || recv_data.error() || recv_data.actualLength() != total) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+		} else {
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			size_t written = 0;
+			for(auto &segment : segments) {
+				auto ret = co_await file_ops->pwrite(file.get(), segment.offset(),
+						extract_creds.credentials(), data.data() + written, segment.size());
+				if(!ret) {
+					// Like pwritev(), only report errors if nothing was written.
+					if(!written)
+						resp.set_error(ret.error() | toFsError);
+					break;
+				}
+				written += ret.value();
+				if(ret.value() < segment.size())
+					break;
+			}
+			resp.set_size(written);
+		}
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
+		HEL_CHECK(send_resp.error());
+		logBragiReply(resp);
+	} else if(preamble.id() == managarm::fs::ReadDirentsRequest::message_id) {
+		auto req = bragi::parse_head_only<managarm::fs::ReadDirentsRequest>(recv_req);
+		recv_req.reset();
+
+		if(!req) {
+			std::cout << "protocols/fs: Rejecting request due to decoding failure" << std::endl;
+			co_return;
+		}
+
+		managarm::fs::ReadDirentsReply resp;
+		std::vector<char> buffer;
+
+		if(!file_ops->readDirents) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		} else {
+			buffer.resize(std::min(req->size(), maxDirentsSize));
+			auto ret = co_await file_ops->readDirents(file.get(), buffer.data(), buffer.size());
+			if(!ret) {
+				resp.set_error(ret.error() | toFsError);
+				buffer.clear();
+			} else {
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+				resp.set_size(ret.value());
+				buffer.resize(ret.value());
+			}
+		}
+
+		auto [send_resp, send_buf] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
+			helix_ng::sendBuffer(buffer.data(), buffer.size())
+		);
+		HEL_CHECK(send_resp.error());
+		HEL_CHECK(send_buf.error());
+		logBragiReply(resp);
+	} else if(preamble.id() == managarm::fs::LockRangeRequest::message_id) {
+		auto req = bragi::parse_head_only<managarm::fs::LockRangeRequest>(recv_req);
+		recv_req.reset();
+
+		if(!req) {
+			std::cout << "protocols/fs: Rejecting request due to decoding failure" << std::endl;
+			co_return;
+		}
+
+		managarm::fs::LockRangeReply resp;
+
+		RangeLock lock;
+		if(req->type() == managarm::fs::RangeLockType::SHARED) {
+			lock.type = RangeLockType::shared;
+		} else if(req->type() == managarm::fs::RangeLockType::EXCLUSIVE) {
+			lock.type = RangeLockType::exclusive;
+		}
+		lock.start = req->start();
+		if(req->length() && req->length() <= rangeLockEof - lock.start)
+			lock.end = lock.start + req->length();
+		lock.pid = req->pid();
+
+		RangeLockCommand command = RangeLockCommand::test;
+		if(req->command() == managarm::fs::RangeLockCommand::SET) {
+			command = RangeLockCommand::set;
+		} else if(req->command() == managarm::fs::RangeLockCommand::SET_WAIT) {
+			command = RangeLockCommand::setWait;
+		}
+
+		if(!file_ops->lockRange) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		} else {
+			auto ret = co_await file_ops->lockRange(file.get(), command, req->ofd(), lock);
+			if(!ret) {
+				resp.set_error(ret.error() | toFsError);
+			} else {
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+				if(ret->type == RangeLockType::shared) {
+					resp.set_type(managarm::fs::RangeLockType::SHARED);
+				} else if(ret->type == RangeLockType::exclusive) {
+					resp.set_type(managarm::fs::RangeLockType::EXCLUSIVE);
+				} else {
+					resp.set_type(managarm::fs::RangeLockType::UNLOCK);
+				}
+				resp.set_start(ret->start);
+				resp.set_length(ret->end == rangeLockEof ? 0 : ret->end - ret->start);
+				resp.set_pid(ret->pid);
+			}
+		}
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
+		HEL_CHECK(send_resp.error());
+		logBragiReply(resp);
 	} else {
 		std::cout << "unhandled request " << preamble.id() << std::endl;
 		throw std::runtime_error("Unknown request");
@@ -1542,6 +2091,8 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 			resp.set_mtime_nanos(result.dataModifyTime.tv_nsec);
 			resp.set_ctime_secs(result.anyChangeTime.tv_sec);
 			resp.set_ctime_nanos(result.anyChangeTime.tv_nsec);
+			if(result.lease)
+				resp.set_lease(1);
 
 			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
@@ -41,6 +41,9 @@ struct ExpansionRomInfo {
 
 struct Capability {
 	unsigned int type;
+	// Location of the capability in the configuration space.
+	size_t offset;
+	size_t length;
 };
 
 struct PciInfo {
@@ -49,6 +52,8 @@ struct PciInfo {
 	std::vector<Capability> caps;
 	unsigned int numMsis;
 	bool msiX = false;
+	// Number of CPUs that MSIs can be routed to.
+	unsigned int numCpus = 1;
 };
 
 struct FbInfo {
@@ -94,7 +99,12 @@ struct Device {
 	async::result<helix::UniqueDescriptor> accessBar(int index);
 	async::result<helix::UniqueDescriptor> accessExpansionRom();
 	async::result<helix::UniqueDescriptor> accessIrq(size_t index = 0);
-	async::result<helix::UniqueDescriptor> installMsi(int index);
+	// If cpu is non-negative, the MSI is routed to that CPU (if possible).
+	async::result<helix::UniqueDescriptor> installMsi(int index, int cpu = -1);
+	async::result<void> setMsiAffinity(int index, int cpu);
+	// Installs one MSI per CPU (up to the number of available MSIs);
+	// the i-th MSI is routed to CPU i.
+	async::result<std::vector<helix::UniqueDescriptor>> installMsiPerCpu();
 
 	async::result<DtInfo> getDtInfo();
 	async::result<helix::UniqueDescriptor> accessDtRegister(uint32_t index);
@@ -109,6 +119,9 @@ struct Device {
 	async::result<uint32_t> loadPciSpace(size_t offset, unsigned int size);
 	async::result<void> storePciSpace(size_t offset, unsigned int size, uint32_t word);
 	async::result<uint32_t> loadPciCapability(unsigned int index, size_t offset, unsigned int size);
+	// Reads size bytes starting at offset with a single request, e.g., the whole header
+	// or a capability (using the offset and length from PciInfo::caps).
+	async::result<std::vector<uint8_t>> loadPciSpaceRange(size_t offset, size_t size);
 
 	async::result<FbInfo> getFbInfo();
 	async::result<helix::UniqueDescriptor> accessFbMemory();
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <vector>
 
 #include <string.h>
@@ -48,9 +49,15 @@ async::result<PciInfo> Device::getPciInfo() {
 	PciInfo info{};
 	info.numMsis = resp.num_msis();
 	info.msiX = resp.msi_x();
+	if(resp.num_cpus())
+		info.numCpus = resp.num_cpus();
 
 	for(size_t i = 0; i < resp.capabilities_size(); i++)
-		info.caps.push_back({resp.capabilities(i).type()});
+		info.caps.push_back({
+			resp.capabilities(i).type(),
+			resp.capabilities(i).offset(),
+			resp.capabilities(i).length()
+		});
 
 	for(size_t i = 0; i < 6; i++) {
 		if(i >= resp.bars_size()) {
@@ -207,9 +214,10 @@ async::result<helix::UniqueDescriptor> Device::accessIrq(size_t index) {
 	co_return pull_irq.descriptor();
 }
 
-async::result<helix::UniqueDescriptor> Device::installMsi(int index) {
+async::result<helix::UniqueDescriptor> Device::installMsi(int index, int cpu) {
 	managarm::hw::InstallMsiRequest req;
 	req.set_index(index);
+	req.set_cpu(cpu);
 
 	auto [offer, send_req, recv_head] = co_await helix_ng::exchangeMsgs(
 			_lane,
@@ -245,6 +253,51 @@ async::result<helix::UniqueDescriptor> Device::installMsi(int index) {
 	co_return pull_msi.descriptor();
 }
 
+async::result<void> Device::setMsiAffinity(int index, int cpu) {
+	managarm::hw::SetMsiAffinityRequest req;
+	req.set_index(index);
+	req.set_cpu(cpu);
+
+	auto [offer, send_req, recv_head] = co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::want_lane,
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_head.error());
+
+	auto preamble = bragi::read_preamble(recv_head);
+	assert(!preamble.error());
+	recv_head.reset();
+
+	std::vector<std::byte> tailBuffer(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			offer.descriptor(),
+			helix_ng::recvBuffer(tailBuffer.data(), tailBuffer.size())
+		);
+
+	HEL_CHECK(recv_tail.error());
+
+	auto resp = *bragi::parse_head_tail<managarm::hw::SvrResponse>(recv_head, tailBuffer);
+	if(resp.error() != managarm::hw::Errors::SUCCESS)
+		throw std::runtime_error("Failed to set MSI affinity");
+}
+
+async::result<std::vector<helix::UniqueDescriptor>> Device::installMsiPerCpu() {
+	auto info = co_await getPciInfo();
+
+	std::vector<helix::UniqueDescriptor> msis;
+	auto count = std::min(info.numMsis, info.numCpus);
+	for(unsigned int i = 0; i < count; i++)
+		msis.push_back(co_await installMsi(i, i));
+	co_return msis;
+}
+
 async::result<void> Device::claimDevice() {
 	managarm::hw::ClaimDeviceRequest req;
 
@@ -488,6 +541,44 @@ async::result<uint32_t> Device::loadPciCapability(unsigned int index, size_t off
 	co_return resp.word();
 }
 
+async::result<std::vector<uint8_t>> Device::loadPciSpaceRange(size_t offset, size_t size) {
+	managarm::hw::LoadPciSpaceRangeRequest req;
+	req.set_offset(offset);
+	req.set_size(size);
+
+	auto [offer, send_req, recv_head] = co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::want_lane,
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_head.error());
+
+	auto preamble = bragi::read_preamble(recv_head);
+	assert(!preamble.error());
+
+	std::vector<std::byte> tailBuffer(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			offer.descriptor(),
+			helix_ng::recvBuffer(tailBuffer.data(), tailBuffer.size())
+		);
+
+	HEL_CHECK(recv_tail.error());
+
+	auto resp = *bragi::parse_head_tail<managarm::hw::SvrResponse>(recv_head, tailBuffer);
+	recv_head.reset();
+
+	assert(resp.error() == managarm::hw::Errors::SUCCESS);
+	assert(resp.config_data().size() == size);
+
+	co_return resp.config_data();
+}
+
 async::result<FbInfo> Device::getFbInfo() {
 	managarm::hw::GetFbInfoRequest req;
 
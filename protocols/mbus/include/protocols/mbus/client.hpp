@@ -140,18 +140,40 @@ struct EnumerationResult {
 	std::vector<EnumerationEvent> events;
 };
 
+struct EnumerateOptions {
+	// Maximal number of entities per response. Zero selects the server's default.
+	size_t pageSize = 0;
+	// Sequence number to resume from, as returned by Enumerator::seq(). Entities that
+	// are reported after resuming are always reported as created.
+	uint64_t seq = 0;
+};
+
 struct Enumerator {
-	Enumerator(std::shared_ptr<Connection> connection, AnyFilter &&filter)
-	: connection_{connection}, filter_{std::move(filter)} { }
+	Enumerator(std::shared_ptr<Connection> connection, AnyFilter &&filter,
+			EnumerateOptions options = {})
+	: connection_{connection}, filter_{std::move(filter)},
+		pageSize_{options.pageSize}, curSeq_{options.seq} { }
 
 	// Get changes since last enumeration
 	async::result<Result<EnumerationResult>> nextEvents();
 
+	// Get all changes since last enumeration without waiting for new ones.
+	// Fetches all pages, hence the result is never paginated.
+	async::result<Result<std::vector<EnumerationEvent>>> currentEvents();
+
+	// Cursor that allows resuming the enumeration (see EnumerateOptions::seq).
+	uint64_t seq() const {
+		return curSeq_;
+	}
+
 private:
+	async::result<Result<EnumerationResult>> enumerate_(bool noWait);
+
 	std::shared_ptr<Connection> connection_;
 	AnyFilter filter_;
+	size_t pageSize_;
 
-	uint64_t curSeq_ = 0;
+	uint64_t curSeq_;
 	std::unordered_set<EntityId> seenIds_{};
 };
 
@@ -172,8 +194,8 @@ struct Instance {
 
 	async::result<Result<EntityManager>> createEntity(std::string_view name, const Properties &properties);
 
-	Enumerator enumerate(AnyFilter filter) {
-		return {connection_, std::move(filter)};
+	Enumerator enumerate(AnyFilter filter, EnumerateOptions options = {}) {
+		return {connection_, std::move(filter), options};
 	}
 
 private:
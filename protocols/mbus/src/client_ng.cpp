@@ -328,9 +328,34 @@ static const managarm::mbus::AnyFilter encodeFilter(const AnyFilter &filter) {
 }
 
 async::result<Result<EnumerationResult>> Enumerator::nextEvents() {
+	return enumerate_(false);
+}
+
+async::result<Result<std::vector<EnumerationEvent>>> Enumerator::currentEvents() {
+	std::vector<EnumerationEvent> events;
+	while(true) {
+		auto result = co_await enumerate_(true);
+		if(!result)
+			co_return result.error();
+
+		auto &[paginated, page] = result.value();
+		events.insert(events.end(),
+				std::make_move_iterator(page.begin()), std::make_move_iterator(page.end()));
+		if(!paginated)
+			break;
+	}
+
+	co_return events;
+}
+
+async::result<Result<EnumerationResult>> Enumerator::enumerate_(bool noWait) {
 	managarm::mbus::EnumerateRequest req;
 	req.set_seq(curSeq_);
 	req.set_filter(encodeFilter(filter_));
+	if(pageSize_)
+		req.set_max_entities(pageSize_);
+	if(noWait)
+		req.set_no_wait(1);
 
 	auto [offer, sendHead, sendTail, recvRespHead] =
 		co_await helix_ng::exchangeMsgs(
@@ -10,6 +10,8 @@ struct ManagarmProcessData {
 	void *threadPage;
 	HelHandle *fileTable;
 	void *clockTrackerPage;
+	// Read-only HelClockPage mapped through kHelClockMemory.
+	void *clockPage;
 };
 
 struct ManagarmServerData {
@@ -55,12 +55,15 @@ struct InterruptTransfer {
 struct BulkTransfer {
 	BulkTransfer(XferFlags flags, arch::dma_buffer_view buffer)
 	: flags{flags}, buffer{buffer},
-			allowShortPackets{false}, lazyNotification{false} { }
+			allowShortPackets{false}, lazyNotification{false}, streamId{0} { }
 
 	XferFlags flags;
 	arch::dma_buffer_view buffer;
 	bool allowShortPackets;
 	bool lazyNotification;
+	// Stream allocated by Endpoint::allocateStreams(), or zero if streams are not used.
+	// Transfers on different streams may complete in any order.
+	uint16_t streamId;
 };
 
 enum class PipeType {
@@ -79,6 +82,9 @@ public:
 	virtual async::result<frg::expected<UsbError, size_t>> transfer(ControlTransfer info) = 0;
 	virtual async::result<frg::expected<UsbError, size_t>> transfer(InterruptTransfer info) = 0;
 	virtual async::result<frg::expected<UsbError, size_t>> transfer(BulkTransfer info) = 0;
+
+	// Fails with UsbError::unsupported by default.
+	virtual async::result<frg::expected<UsbError, size_t>> allocateStreams(size_t count);
 };
 
 
@@ -89,6 +95,10 @@ struct Endpoint {
 	async::result<frg::expected<UsbError, size_t>> transfer(InterruptTransfer info) const;
 	async::result<frg::expected<UsbError, size_t>> transfer(BulkTransfer info) const;
 
+	// Enables USB 3 bulk streams with IDs 1 to count on this endpoint.
+	// Returns the number of streams that were actually allocated, which can be lower.
+	async::result<frg::expected<UsbError, size_t>> allocateStreams(size_t count) const;
+
 private:
 	std::shared_ptr<EndpointData> _state;
 };
@@ -74,6 +74,7 @@ namespace descriptor_type {
 		string = 0x03,
 		interface = 0x04,
 		endpoint = 0x05,
+		ss_endpoint_companion = 0x30,
 
 		// TODO: Put non-standard descriptors somewhere else.
 		hid = 0x21,
@@ -260,6 +261,14 @@ struct [[ gnu::packed ]] EndpointDescriptor : public DescriptorBase {
 	uint8_t interval;
 };
 
+// Follows each endpoint descriptor of SuperSpeed devices.
+struct [[ gnu::packed ]] SsEndpointCompanionDescriptor : public DescriptorBase {
+	uint8_t maxBurst;
+	// For bulk endpoints, bits 0-4 are the log2 of the number of supported streams.
+	uint8_t attributes;
+	uint16_t bytesPerInterval;
+};
+
 enum class EndpointType {
 	control = 0,
 	isochronous,
@@ -105,6 +105,10 @@ Interface::getEndpoint(PipeType type, int number) const {
 // Endpoint.
 // ----------------------------------------------------------------------------
 
+async::result<frg::expected<UsbError, size_t>> EndpointData::allocateStreams(size_t) {
+	co_return UsbError::unsupported;
+}
+
 Endpoint::Endpoint(std::shared_ptr<EndpointData> state)
 : _state(std::move(state)) { }
 
@@ -116,4 +120,8 @@ async::result<frg::expected<UsbError, size_t>> Endpoint::transfer(BulkTransfer i
 	return _state->transfer(info);
 }
 
+async::result<frg::expected<UsbError, size_t>> Endpoint::allocateStreams(size_t count) const {
+	return _state->allocateStreams(count);
+}
+
 } // namespace protocols::usb
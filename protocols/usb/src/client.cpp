@@ -1,5 +1,6 @@
 
 #include <memory>
+#include <type_traits>
 #include <iostream>
 
 #include <string.h>
@@ -61,6 +62,7 @@ struct EndpointState final : EndpointData {
 	async::result<frg::expected<UsbError, size_t>> transfer(ControlTransfer info) override;
 	async::result<frg::expected<UsbError, size_t>> transfer(InterruptTransfer info) override;
 	async::result<frg::expected<UsbError, size_t>> transfer(BulkTransfer info) override;
+	async::result<frg::expected<UsbError, size_t>> allocateStreams(size_t count) override;
 
 private:
 	helix::UniqueLane _lane;
@@ -323,6 +325,8 @@ doTransferOfType(auto &lane, managarm::usb::XferType type, XferInfo info) {
 	req.set_allow_short_packets(info.allowShortPackets);
 	req.set_lazy_notification(info.lazyNotification);
 	req.set_length(info.buffer.size());
+	if constexpr (std::is_same_v<XferInfo, BulkTransfer>)
+		req.set_stream_id(info.streamId);
 
 	if(info.flags == kXferToDevice) {
 		auto [offer, sendReq, sendData, recvResp] =
@@ -383,6 +387,30 @@ async::result<frg::expected<UsbError, size_t>> EndpointState::transfer(BulkTrans
 	co_return co_await doTransferOfType(_lane, managarm::usb::XferType::BULK, info);
 }
 
+async::result<frg::expected<UsbError, size_t>> EndpointState::allocateStreams(size_t count) {
+	managarm::usb::AllocateStreamsRequest req;
+	req.set_count(count);
+
+	auto [offer, sendReq, recvResp] = co_await helix_ng::exchangeMsgs(
+		_lane,
+		helix_ng::offer(
+			helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+			helix_ng::recvInline()
+		)
+	);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(recvResp.error());
+
+	auto resp = bragi::parse_head_only<managarm::usb::SvrResponse>(recvResp);
+	recvResp.reset();
+
+	FRG_CO_TRY(transformProtocolError(resp->error()));
+
+	co_return resp->size();
+}
+
 } // anonymous namespace
 
 Device connect(helix::UniqueLane lane) {
@@ -1,6 +1,8 @@
 
 #include <string.h>
 #include <iostream>
+#include <type_traits>
+#include <async/recurring-event.hpp>
 #include <bragi/helpers-std.hpp>
 
 #include "protocols/usb/server.hpp"
@@ -48,13 +50,107 @@ auto handleXferReq(auto req, auto &endpoint, auto &&...xferArgs) {
 	if (req->dir() == managarm::usb::XferDirection::TO_DEVICE)
 		xfer.allowShortPackets = req->allow_short_packets();
 	xfer.lazyNotification = req->lazy_notification();
+	if constexpr (std::is_same_v<XferType, BulkTransfer>)
+		xfer.streamId = req->stream_id();
 
 	return endpoint.transfer(xfer);
 };
 
+// Number of bulk transfers (without streams) that may be queued on an endpoint at the same time.
+constexpr size_t maxQueuedTransfers = 8;
+
+struct TransferQueue {
+	size_t numQueued = 0;
+	async::recurring_event doneEvent;
+};
+
+// Allocates the transfer buffer and receives its contents for transfers to the device.
+async::result<arch::dma_buffer> receiveTransferBuffer(helix::UniqueDescriptor &conversation,
+		std::optional<managarm::usb::TransferRequest> &req) {
+	// TODO(qookie): Use proper pool:
+	//		 something like ep.device.bufferPool()
+	arch::dma_buffer buffer{nullptr, static_cast<size_t>(req->length())};
+
+	if (req->dir() == managarm::usb::XferDirection::TO_DEVICE) {
+		auto [recvBuffer] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(buffer.data(), buffer.size())
+		);
+
+		HEL_CHECK(recvBuffer.error());
+	}
+
+	co_return buffer;
+}
+
+// Performs the transfer and sends the response. Returns false if the lane should be closed.
+async::result<bool> submitTransfer(Endpoint endpoint, helix::UniqueDescriptor conversation,
+		std::optional<managarm::usb::TransferRequest> req, arch::dma_buffer buffer) {
+	frg::expected<UsbError, uint64_t> outcome;
+
+	switch (req->type()) {
+		using enum managarm::usb::XferType;
+		case INTERRUPT:
+			outcome = co_await handleXferReq<InterruptTransfer>(req, endpoint, buffer);
+			break;
+		case BULK:
+			outcome = co_await handleXferReq<BulkTransfer>(req, endpoint, buffer);
+			break;
+			// TODO(qookie): Support control EPs
+			//case CONTROL:
+			//	outcome = co_await handleXferReq<ControlTransfer>(req, endpoint, buffer);
+			//	break;
+		default:
+			std::cout << "Unexpected endpoint type\n";
+			co_return false;
+	}
+
+	if (!outcome) {
+		co_await respondWithError(conversation, outcome.error());
+		co_return true;
+	}
+
+	auto length = outcome.value();
+
+	managarm::usb::SvrResponse resp;
+	resp.set_error(managarm::usb::Errors::SUCCESS);
+
+	if (req->dir() == managarm::usb::XferDirection::TO_HOST) {
+		auto [sendResp, sendData] =
+			co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
+				helix_ng::sendBuffer(buffer.data(), length)
+			);
+
+		HEL_CHECK(sendResp.error());
+		HEL_CHECK(sendData.error());
+	} else {
+		auto [sendResp] =
+			co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+		HEL_CHECK(sendResp.error());
+	}
+
+	co_return true;
+}
+
+// Returns false if the lane should be closed.
+async::result<bool> handleTransferRequest(Endpoint endpoint, helix::UniqueDescriptor conversation,
+		std::optional<managarm::usb::TransferRequest> req) {
+	auto buffer = co_await receiveTransferBuffer(conversation, req);
+	co_return co_await submitTransfer(std::move(endpoint), std::move(conversation),
+			std::move(req), std::move(buffer));
+}
+
 } // namespace anonymous
 
 async::detached serveEndpoint(Endpoint endpoint, helix::UniqueLane lane) {
+	auto queue = std::make_shared<TransferQueue>();
+
 	while(true) {
 		auto [accept, recvReq] = co_await helix_ng::exchangeMsgs(
 			lane,
@@ -82,67 +178,58 @@ async::detached serveEndpoint(Endpoint endpoint, helix::UniqueLane lane) {
 				co_return;
 			}
 
-			// TODO(qookie): Use proper pool:
-			//		 something like ep.device.bufferPool()
-			arch::dma_buffer buffer{nullptr, static_cast<size_t>(req->length())};
-
-			if (req->dir() == managarm::usb::XferDirection::TO_DEVICE) {
-				auto [recvBuffer] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(buffer.data(), buffer.size())
-				);
-
-				HEL_CHECK(recvBuffer.error());
+			if (req->stream_id()) {
+				// Transfers on different streams are independent, do not serialize them.
+				[] (Endpoint endpoint, helix::UniqueDescriptor conversation,
+						std::optional<managarm::usb::TransferRequest> req) -> async::detached {
+					co_await handleTransferRequest(std::move(endpoint),
+							std::move(conversation), std::move(req));
+				}(endpoint, std::move(conversation), std::move(req));
+			} else if (req->type() == managarm::usb::XferType::BULK) {
+				// Queue bulk transfers ahead, such that the controller does not idle in between.
+				// The buffer is received here and submitTransfer() passes the transfer to the
+				// HCD before it first suspends, hence the transfers are submitted in order.
+				while (queue->numQueued >= maxQueuedTransfers)
+					co_await queue->doneEvent.async_wait();
+
+				auto buffer = co_await receiveTransferBuffer(conversation, req);
+				queue->numQueued++;
+				[] (Endpoint endpoint, helix::UniqueDescriptor conversation,
+						std::optional<managarm::usb::TransferRequest> req,
+						arch::dma_buffer buffer, std::shared_ptr<TransferQueue> queue)
+						-> async::detached {
+					co_await submitTransfer(std::move(endpoint), std::move(conversation),
+							std::move(req), std::move(buffer));
+					queue->numQueued--;
+					queue->doneEvent.raise();
+				}(endpoint, std::move(conversation), std::move(req), std::move(buffer), queue);
+			} else if (!(co_await handleTransferRequest(endpoint,
+					std::move(conversation), std::move(req)))) {
+				co_return;
 			}
-
-			frg::expected<UsbError, uint64_t> outcome;
-
-			switch (req->type()) {
-				using enum managarm::usb::XferType;
-				case INTERRUPT:
-					outcome = co_await handleXferReq<InterruptTransfer>(req, endpoint, buffer);
-					break;
-				case BULK:
-					outcome = co_await handleXferReq<BulkTransfer>(req, endpoint, buffer);
-					break;
-					// TODO(qookie): Support control EPs
-					//case CONTROL:
-					//	outcome = co_await handleXferReq<ControlTransfer>(req, endpoint, buffer);
-					//	break;
-				default:
-					std::cout << "Unexpected endpoint type\n";
-					co_return;
+		} else if (preamble.id() == bragi::message_id<managarm::usb::AllocateStreamsRequest>) {
+			auto req = bragi::parse_head_only<managarm::usb::AllocateStreamsRequest>(recvReq);
+			recvReq.reset();
+			if (!req) {
+				co_return;
 			}
 
+			auto outcome = co_await endpoint.allocateStreams(req->count());
 			if (!outcome) {
 				co_await respondWithError(conversation, outcome.error());
 				continue;
 			}
 
-			auto length = outcome.value();
-
 			managarm::usb::SvrResponse resp;
 			resp.set_error(managarm::usb::Errors::SUCCESS);
+			resp.set_size(outcome.value());
 
-			if (req->dir() == managarm::usb::XferDirection::TO_HOST) {
-				auto [sendResp, sendData] =
-					co_await helix_ng::exchangeMsgs(
-						conversation,
-						helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
-						helix_ng::sendBuffer(buffer.data(), length)
-					);
-
-				HEL_CHECK(sendResp.error());
-				HEL_CHECK(sendData.error());
-			} else {
-				auto [sendResp] =
-					co_await helix_ng::exchangeMsgs(
-						conversation,
-						helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-					);
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
 
-				HEL_CHECK(sendResp.error());
-			}
+			HEL_CHECK(sendResp.error());
 		}else{
 			recvReq.reset();
 			managarm::usb::SvrResponse resp;
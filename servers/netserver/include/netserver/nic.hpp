@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <arch/dma_pool.hpp>
 #include <async/result.hpp>
@@ -10,7 +11,9 @@
 #include <optional>
 #include <ostream>
 #include <protocols/mbus/client.hpp>
+#include <span>
 #include <unordered_map>
+#include <vector>
 
 namespace nic {
 struct MacAddress {
@@ -44,12 +47,65 @@ private:
 	std::array<uint8_t, 6> mac_ = {};
 };
 
+struct FramePool;
+
+// Receive buffer that is returned to its FramePool once it is destroyed.
+struct FrameBuffer {
+	FrameBuffer() = default;
+	FrameBuffer(std::shared_ptr<FramePool> pool, arch::dma_buffer buffer)
+	: pool_{std::move(pool)}, buffer_{std::move(buffer)} { }
+
+	FrameBuffer(const FrameBuffer &) = delete;
+	FrameBuffer(FrameBuffer &&other) = default;
+	FrameBuffer &operator=(FrameBuffer other) {
+		std::swap(pool_, other.pool_);
+		std::swap(buffer_, other.buffer_);
+		return *this;
+	}
+
+	~FrameBuffer();
+
+	explicit operator bool() const {
+		return buffer_.data();
+	}
+
+	arch::dma_buffer_view view() {
+		return buffer_;
+	}
+
+	size_t size() const {
+		return buffer_.size();
+	}
+
+private:
+	std::shared_ptr<FramePool> pool_;
+	arch::dma_buffer buffer_;
+};
+
+// Recycles receive buffers such that frames can be received without allocating memory.
+struct FramePool : std::enable_shared_from_this<FramePool> {
+	explicit FramePool(arch::dma_pool *dmaPool)
+	: dmaPool_{dmaPool} { }
+
+	// Returns a buffer of at least the given size.
+	FrameBuffer allocate(size_t size);
+
+private:
+	friend struct FrameBuffer;
+
+	// Bounds the memory that is kept around after bursts of traffic.
+	static constexpr size_t maxFreeBuffers = 256;
+
+	arch::dma_pool *dmaPool_;
+	std::vector<arch::dma_buffer> free_;
+};
+
 enum EtherType : uint16_t {
 	ETHER_TYPE_IP4 = 0x0800,
 	ETHER_TYPE_ARP = 0x0806,
 };
 
-// TODO(arsen): Expose interface for csum offloading, constructing frames, and
+// TODO(arsen): Expose interface for constructing frames, and
 // other features of NICs
 struct Link {
 	struct AllocatedBuffer {
@@ -57,12 +113,75 @@ struct Link {
 		arch::dma_buffer_view payload;
 	};
 
+	// Offloads and queues of a link. Drivers fill this in before the link is used.
+	struct Capabilities {
+		// The link computes TCP and UDP checksums of outgoing frames (see SendOffload).
+		bool txChecksum = false;
+		// The link verifies TCP and UDP checksums of incoming frames (see ReceiveInfo).
+		bool rxChecksum = false;
+		// The link segments outgoing TCP/IPv4 frames that exceed the MTU (see SendOffload).
+		bool tso4 = false;
+		// The link may deliver coalesced TCP/IPv4 frames that exceed the MTU.
+		bool lro4 = false;
+		// Number of independent RX/TX queue pairs.
+		unsigned int numQueues = 1;
+		// Size of the largest frame that receive() can return.
+		size_t maxReceiveSize = 1514;
+	};
+
+	// Offloads that are requested for a single outgoing frame.
+	struct SendOffload {
+		// If set, the link computes the checksum over all bytes starting at csumStart
+		// and stores it at csumStart + csumOffset. Requires Capabilities::txChecksum.
+		bool needsChecksum = false;
+		uint16_t csumStart = 0;
+		uint16_t csumOffset = 0;
+		// If non-zero, the link splits the TCP payload into segments of this size.
+		// Requires Capabilities::tso4 and needsChecksum.
+		uint16_t segmentSize = 0;
+		// Length of the Ethernet, IP and TCP headers; used for segmentation.
+		uint16_t headerLength = 0;
+		// Hash of the flow that the frame belongs to (or zero if unknown). Links with
+		// multiple queues send all frames of a flow through the same queue, which
+		// avoids reordering and keeps the flow's TX completions on one queue.
+		uint32_t flowHash = 0;
+	};
+
+	// Per-frame metadata that is reported by receive().
+	struct ReceiveInfo {
+		// The link verified the TCP or UDP checksum of the frame.
+		// Requires Capabilities::rxChecksum.
+		bool checksumVerified = false;
+	};
+
+	// Slot for receiveBatch(). The caller supplies the buffer, the link fills in the rest.
+	struct ReceivedFrame {
+		arch::dma_buffer_view buffer;
+		size_t length = 0;
+		ReceiveInfo info;
+	};
+
 	Link(unsigned int mtu, arch::dma_pool *dmaPool);
 	virtual ~Link() = default;
 	//! Receives an entire frame from the network
 	virtual async::result<size_t> receive(arch::dma_buffer_view) = 0;
+	//! Receives an entire frame and reports the offloads that were applied to it
+	virtual async::result<size_t> receive(arch::dma_buffer_view, ReceiveInfo &info);
+	//! Waits for at least one frame and receives up to frames.size() frames.
+	//! Returns the number of received frames
+	virtual async::result<size_t> receiveBatch(std::span<ReceivedFrame> frames);
+	//! Size of the buffers that are passed to receiveBatch()
+	size_t receiveBufferSize() {
+		// Drivers that configure a jumbo MTU do not necessarily raise maxReceiveSize.
+		return std::max(capabilities_.maxReceiveSize, size_t{mtu} + 14);
+	}
 	//! Sends an entire ethernet frame
 	virtual async::result<void> send(const arch::dma_buffer_view) = 0;
+	//! Sends an ethernet frame using the offloads announced in capabilities()
+	virtual async::result<void> send(const arch::dma_buffer_view, const SendOffload &offload);
+	const Capabilities &capabilities() {
+		return capabilities_;
+	}
 	arch::dma_pool *dmaPool();
 	AllocatedBuffer allocateFrame(size_t payloadSize);
 	AllocatedBuffer allocateFrame(MacAddress to, EtherType type,
@@ -81,6 +200,10 @@ struct Link {
 		return raw_ip_;
 	}
 
+	bool loopback() {
+		return loopback_;
+	}
+
 	mbus_ng::Properties mbusNetworkProperties() {
 		return {
 			{"net.ifname", mbus_ng::StringItem{name()}},
@@ -106,6 +229,9 @@ protected:
 	bool l1_up_ = false;
 
 	bool raw_ip_ = false;
+	bool loopback_ = false;
+
+	Capabilities capabilities_;
 };
 
 async::detached runDevice(std::shared_ptr<Link> dev);
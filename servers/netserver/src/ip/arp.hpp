@@ -3,8 +3,8 @@
 #include <async/recurring-event.hpp>
 #include <memory>
 #include <netserver/nic.hpp>
-#include <map>
 #include <optional>
+#include <unordered_map>
 
 struct Neighbours {
 	static constexpr uint64_t staleTimeMs = 30'000;
@@ -26,10 +26,10 @@ struct Neighbours {
 		uint32_t sender);
 	void feedArp(nic::MacAddress destination, arch::dma_buffer_view arpData, std::weak_ptr<nic::Link> link);
 	void updateTable(uint32_t proto, nic::MacAddress hardware, std::weak_ptr<nic::Link> link);
-	std::map<uint32_t, Neighbours::Entry> &getTable();
+	std::unordered_map<uint32_t, Neighbours::Entry> &getTable();
 private:
 	Entry &getEntry(uint32_t addr);
-	std::map<uint32_t, Entry> table_;
+	std::unordered_map<uint32_t, Entry> table_;
 };
 
 Neighbours &neigh4();
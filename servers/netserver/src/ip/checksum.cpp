@@ -1,25 +1,161 @@
 #include "checksum.hpp"
 
-#include <arch/bit.hpp>
+#include <algorithm>
+#include <bit>
+#include <cstring>
 
-void Checksum::update(uint16_t word)  {
-	state_ += word;
-	while (state_ >> 16 != 0) {
-		state_ = (state_ >> 16) + (state_ & 0xffff);
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// The one's complement sum is independent of the byte order (RFC 1071, 2.(B)).
+// Hence, the kernels below sum up native-endian words and update() swaps the
+// result into network byte order once.
+
+// Addition with end-around carry.
+uint64_t addCarry(uint64_t a, uint64_t b) {
+	a += b;
+	return a + (a < b);
+}
+
+uint16_t fold(uint64_t sum) {
+	sum = (sum >> 32) + (sum & 0xFFFF'FFFF);
+	sum = (sum >> 32) + (sum & 0xFFFF'FFFF);
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	return sum;
+}
+
+uint64_t sumScalar(const unsigned char *p, size_t size) {
+	uint64_t sum = 0;
+	for (; size >= 8; p += 8, size -= 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		sum = addCarry(sum, v);
+	}
+	if (size >= 4) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		sum = addCarry(sum, v);
+		p += 4;
+		size -= 4;
+	}
+	if (size >= 2) {
+		uint16_t v;
+		memcpy(&v, p, sizeof(v));
+		sum = addCarry(sum, v);
+		p += 2;
+		size -= 2;
 	}
+	if (size) {
+		// Pad the trailing byte with zero.
+		if constexpr (std::endian::native == std::endian::little)
+			sum = addCarry(sum, p[0]);
+		else
+			sum = addCarry(sum, uint64_t{p[0]} << 8);
+	}
+	return sum;
 }
 
-void Checksum::update(const void *data, size_t size) {
-	using namespace arch;
-	auto iter = static_cast<const unsigned char*>(data);
-	if (size % 2 != 0) {
-		size--;
-		update(iter[size] << 8);
+// The vector kernels accumulate pairs of 16-bit words in 32-bit lanes.
+// This cannot overflow for up to 2^15 iterations.
+constexpr size_t maxVectorIterations = size_t{1} << 15;
+
+#if defined(__x86_64__)
+
+uint64_t sumSse2(const unsigned char *p, size_t size) {
+	uint64_t sum = 0;
+	auto zero = _mm_setzero_si128();
+	while (size >= 16) {
+		size_t n = std::min(size / 16, maxVectorIterations);
+		auto acc = zero;
+		for (size_t i = 0; i < n; i++, p += 16) {
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+			acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+			acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+		}
+		size -= n * 16;
+
+		alignas(16) uint32_t lanes[4];
+		_mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+		for (auto lane : lanes)
+			sum = addCarry(sum, lane);
 	}
-	auto end = iter + size;
-	for (; iter < end; iter += 2) {
-		update(iter[0] << 8 | iter[1]);
+	return addCarry(sum, sumScalar(p, size));
+}
+
+[[gnu::target("avx2")]]
+uint64_t sumAvx2(const unsigned char *p, size_t size) {
+	uint64_t sum = 0;
+	auto zero = _mm256_setzero_si256();
+	while (size >= 32) {
+		size_t n = std::min(size / 32, maxVectorIterations);
+		auto acc = zero;
+		for (size_t i = 0; i < n; i++, p += 32) {
+			auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+			acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+			acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+		}
+		size -= n * 32;
+
+		alignas(32) uint32_t lanes[8];
+		_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+		for (auto lane : lanes)
+			sum = addCarry(sum, lane);
 	}
+	return addCarry(sum, sumSse2(p, size));
+}
+
+#elif defined(__aarch64__)
+
+uint64_t sumNeon(const unsigned char *p, size_t size) {
+	uint64_t sum = 0;
+	while (size >= 16) {
+		size_t n = std::min(size / 16, maxVectorIterations);
+		auto acc = vdupq_n_u32(0);
+		for (size_t i = 0; i < n; i++, p += 16)
+			acc = vpadalq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(p)));
+		size -= n * 16;
+
+		sum = addCarry(sum, vaddlvq_u32(acc));
+	}
+	return addCarry(sum, sumScalar(p, size));
+}
+
+#endif
+
+using SumFunction = uint64_t (*)(const unsigned char *, size_t);
+
+SumFunction selectSum() {
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &sumAvx2;
+	return &sumSse2;
+#elif defined(__aarch64__)
+	return &sumNeon;
+#else
+	return &sumScalar;
+#endif
+}
+
+const SumFunction sumWords = selectSum();
+
+} // anonymous namespace
+
+void Checksum::update(uint16_t word)  {
+	state_ += word;
+}
+
+void Checksum::update(const void *data, size_t size) {
+	uint16_t sum = fold(sumWords(static_cast<const unsigned char *>(data), size));
+	if constexpr (std::endian::native == std::endian::little)
+		sum = std::byteswap(sum);
+	state_ += sum;
 }
 
 void Checksum::update(arch::dma_buffer_view view) {
@@ -27,6 +163,18 @@ void Checksum::update(arch::dma_buffer_view view) {
 }
 
 uint16_t Checksum::finalize() {
-	auto state_ = this->state_;
-	return ~state_;
+	return ~fold(state_);
+}
+
+uint16_t Checksum::adjust16(uint16_t checksum, uint16_t oldValue, uint16_t newValue) {
+	// HC' = ~(~HC + ~m + m'), see RFC 1624, section 3.
+	uint64_t sum = static_cast<uint16_t>(~checksum);
+	sum += static_cast<uint16_t>(~oldValue);
+	sum += newValue;
+	return ~fold(sum);
+}
+
+uint16_t Checksum::adjust32(uint16_t checksum, uint32_t oldValue, uint32_t newValue) {
+	checksum = adjust16(checksum, oldValue >> 16, newValue >> 16);
+	return adjust16(checksum, oldValue & 0xFFFF, newValue & 0xFFFF);
 }
@@ -5,10 +5,16 @@
 // 16-bit one's compliment sum checksum, as described in RFC791, amongst others
 struct Checksum {
 	void update(uint16_t word);
+	// Odd-sized areas are padded with a zero byte.
 	void update(const void *mem, size_t size);
 	void update(arch::dma_buffer_view area);
 	uint16_t finalize();
 
+	// Update a finalized checksum after a 16-bit (or 32-bit) field of the
+	// checksummed data changed from oldValue to newValue (RFC 1624).
+	static uint16_t adjust16(uint16_t checksum, uint16_t oldValue, uint16_t newValue);
+	static uint16_t adjust32(uint16_t checksum, uint32_t oldValue, uint32_t newValue);
+
 private:
-	uint32_t state_ = 0;
+	uint64_t state_ = 0;
 };
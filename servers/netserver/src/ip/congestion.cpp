@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cmath>
+
+#include "congestion.hpp"
+
+CongestionControl::CongestionControl(size_t mss)
+// Initial window as in RFC 5681.
+: mss_{mss}, cwnd_{std::min(4 * mss, std::max(2 * mss, size_t{4380}))},
+		ssthresh_{SIZE_MAX} { }
+
+void CongestionControl::onTimeout(size_t flightSize, uint64_t) {
+	ssthresh_ = std::max(flightSize / 2, 2 * mss_);
+	cwnd_ = mss_; // Loss window.
+}
+
+void CongestionControl::setCwnd(size_t cwnd) {
+	cwnd_ = std::max(cwnd, mss_);
+}
+
+namespace {
+
+// RFC 5681 with appropriate byte counting (RFC 3465) in congestion avoidance.
+struct NewReno final : CongestionControl {
+	using CongestionControl::CongestionControl;
+
+	std::string_view name() const override {
+		return "reno";
+	}
+
+	void onAck(size_t ackedBytes, uint64_t, uint64_t) override {
+		if(inSlowStart()) {
+			cwnd_ += std::min(ackedBytes, mss_);
+			return;
+		}
+
+		// Grow by one MSS per window of acknowledged data.
+		bytesAcked_ += ackedBytes;
+		if(bytesAcked_ >= cwnd_) {
+			bytesAcked_ -= cwnd_;
+			cwnd_ += mss_;
+		}
+	}
+
+	void onCongestion(size_t flightSize, uint64_t) override {
+		ssthresh_ = std::max(flightSize / 2, 2 * mss_);
+		bytesAcked_ = 0;
+	}
+
+	void onTimeout(size_t flightSize, uint64_t now) override {
+		CongestionControl::onTimeout(flightSize, now);
+		bytesAcked_ = 0;
+	}
+
+private:
+	size_t bytesAcked_ = 0;
+};
+
+// RFC 9438. Window sizes within the cubic function are in segments.
+struct Cubic final : CongestionControl {
+	static constexpr double c = 0.4;
+	static constexpr double beta = 0.7;
+	// Additive increase of the Reno-friendly estimate.
+	static constexpr double alpha = 3 * (1 - beta) / (1 + beta);
+
+	using CongestionControl::CongestionControl;
+
+	std::string_view name() const override {
+		return "cubic";
+	}
+
+	void onAck(size_t ackedBytes, uint64_t now, uint64_t srtt) override {
+		if(inSlowStart()) {
+			cwnd_ += std::min(ackedBytes, mss_);
+			return;
+		}
+
+		double segments = static_cast<double>(cwnd_) / mss_;
+		if(!epochStart_) {
+			epochStart_ = now;
+			if(wMax_ <= segments) {
+				k_ = 0;
+				wMax_ = segments;
+			}else{
+				k_ = std::cbrt((wMax_ - segments) / c);
+			}
+			wEst_ = segments;
+		}
+
+		double t = static_cast<double>(now - epochStart_) / 1e9;
+		double rtt = static_cast<double>(srtt) / 1e9;
+		double target = c * std::pow(t + rtt - k_, 3) + wMax_;
+		wEst_ += alpha * static_cast<double>(ackedBytes) / cwnd_;
+
+		if(wEst_ > target) {
+			// Reno-friendly region.
+			cwnd_ = std::max(cwnd_, static_cast<size_t>(wEst_ * mss_));
+			return;
+		}
+
+		// Concave and convex regions.
+		target = std::clamp(target, segments, 1.5 * segments);
+		auto increase = (target - segments) / segments * ackedBytes;
+		cwnd_ += static_cast<size_t>(increase);
+	}
+
+	void onCongestion(size_t, uint64_t) override {
+		reduce_();
+		ssthresh_ = std::max(static_cast<size_t>(cwnd_ * beta), 2 * mss_);
+	}
+
+	void onTimeout(size_t, uint64_t) override {
+		reduce_();
+		ssthresh_ = std::max(static_cast<size_t>(cwnd_ * beta), 2 * mss_);
+		cwnd_ = mss_; // Loss window.
+	}
+
+private:
+	void reduce_() {
+		double segments = static_cast<double>(cwnd_) / mss_;
+		// Fast convergence: release bandwidth if the window did not recover.
+		if(segments < wMax_) {
+			wMax_ = segments * (1 + beta) / 2;
+		}else{
+			wMax_ = segments;
+		}
+		epochStart_ = 0;
+	}
+
+	double wMax_ = 0;
+	double wEst_ = 0;
+	double k_ = 0;
+	uint64_t epochStart_ = 0;
+};
+
+} // anonymous namespace
+
+std::unique_ptr<CongestionControl> makeCongestionControl(std::string_view name, size_t mss) {
+	if(name == "reno")
+		return std::make_unique<NewReno>(mss);
+	if(name == "cubic")
+		return std::make_unique<Cubic>(mss);
+	return nullptr;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+// Congestion control for TCP (RFC 5681). The socket implements loss detection,
+// retransmission and fast recovery; the controller only decides how the congestion
+// window evolves. All window sizes are in bytes.
+struct CongestionControl {
+	CongestionControl(size_t mss);
+
+	virtual ~CongestionControl() = default;
+
+	virtual std::string_view name() const = 0;
+
+	// Called for ACKs that acknowledge new data outside of fast recovery.
+	// srttNs is the smoothed round-trip time (or zero if it is not known yet).
+	virtual void onAck(size_t ackedBytes, uint64_t nowNs, uint64_t srttNs) = 0;
+
+	// Called when fast retransmit is triggered. Sets ssthresh;
+	// the socket inflates the window while it is in fast recovery.
+	virtual void onCongestion(size_t flightSize, uint64_t nowNs) = 0;
+
+	// Called when the retransmission timer expires.
+	virtual void onTimeout(size_t flightSize, uint64_t nowNs);
+
+	size_t cwnd() const {
+		return cwnd_;
+	}
+
+	size_t ssthresh() const {
+		return ssthresh_;
+	}
+
+	size_t mss() const {
+		return mss_;
+	}
+
+	// Fast recovery (RFC 6582) adjusts the window directly.
+	void setCwnd(size_t cwnd);
+
+protected:
+	bool inSlowStart() const {
+		return cwnd_ < ssthresh_;
+	}
+
+	size_t mss_;
+	size_t cwnd_;
+	size_t ssthresh_;
+};
+
+// Returns nullptr if no controller of the given name exists.
+// Supported names are "reno" and "cubic".
+std::unique_ptr<CongestionControl> makeCongestionControl(std::string_view name, size_t mss);
+
+inline constexpr std::string_view defaultCongestionControl = "cubic";
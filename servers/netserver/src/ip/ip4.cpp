@@ -2,20 +2,48 @@
 
 #include "arp.hpp"
 #include "checksum.hpp"
+#include "netlink/netlink.hpp"
 #include <async/recurring-event.hpp>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <algorithm>
+#include <cassert>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
 #include <protocols/fs/server.hpp>
 #include <queue>
+#include <vector>
 
 using namespace protocols::fs;
 
 using Route = Ip4Router::Route;
 
+namespace {
+
+// Software hash of the 4-tuple of TCP and UDP packets (or of the addresses otherwise).
+// Links use it to spread flows across their queues.
+uint32_t flowHash(uint32_t source, uint32_t destination, uint16_t proto,
+		const void *data, size_t len) {
+	uint64_t x = (uint64_t{source} << 32) | destination;
+	if ((proto == static_cast<uint16_t>(IpProto::tcp)
+			|| proto == static_cast<uint16_t>(IpProto::udp)) && len >= 4) {
+		uint32_t ports;
+		std::memcpy(&ports, data, sizeof(ports));
+		x ^= uint64_t{ports} * 0x9E37'79B9'7F4A'7C15;
+	}
+	// Finalizer of MurmurHash3.
+	x ^= x >> 33;
+	x *= 0xFF51'AFD7'ED55'8CCD;
+	x ^= x >> 33;
+	x *= 0xC4CE'B9FE'1A85'EC53;
+	x ^= x >> 33;
+	// Zero means "unknown flow".
+	return static_cast<uint32_t>(x) | 1;
+}
+
+} // anonymous namespace
+
 Ip4Router &ip4Router() {
 	static Ip4Router inst;
 	return inst;
@@ -27,28 +55,97 @@ Ip4 &ip4() {
 }
 
 bool Ip4Router::addRoute(Route r) {
-	return routes.emplace(std::move(r)).second;
+	if (r.network.prefix > 32)
+		return false;
+	auto [it, inserted] = routes.emplace(std::move(r));
+	if (!inserted)
+		return false;
+	rebuild_();
+	nl::notifyRoute(RTM_NEWROUTE, *it);
+	return true;
 }
 
 std::optional<Route> Ip4Router::resolveRoute(uint32_t ip, std::shared_ptr<nic::Link> link) {
-	for (auto i = routes.begin(); i != routes.end(); i++) {
-		const auto &r = *i;
-		if (r.network.sameNet(ip)) {
-			if(link && r.link.lock()->index() != link->index())
+	if (link) {
+		// Routes are sorted by ascending prefix length, the best route of each prefix first.
+		const Route *best = nullptr;
+		for (const auto &r : routes) {
+			if (!r.network.sameNet(ip))
 				continue;
-
-			if (r.link.expired()) {
-				i = routes.erase(i);
+			auto routeLink = r.link.lock();
+			if (!routeLink || routeLink->index() != link->index())
 				continue;
-			}
-			return { r };
+			if (!best || r.network.prefix > best->network.prefix)
+				best = &r;
 		}
+		if (!best)
+			return {};
+		return { *best };
 	}
-	return {};
+
+	auto r = lookup_(ip);
+	if (r && r->link.expired()) {
+		std::erase_if(routes, [] (const Route &route) {
+			return route.link.expired();
+		});
+		rebuild_();
+		r = lookup_(ip);
+	}
+	if (!r)
+		return {};
+	return { *r };
+}
+
+void Ip4Router::rebuild_() {
+	root_ = {};
+	// The set is sorted by ascending prefix length, hence longer prefixes overwrite
+	// the slots of shorter ones.
+	for (const auto &r : routes)
+		insert_(r);
+	invalidate();
+}
+
+void Ip4Router::insert_(const Route &r) {
+	auto prefix = r.network.prefix;
+	auto network = r.network.ip & r.network.mask();
+	int level = prefix ? (prefix - 1) / trieStride : 0;
+
+	auto node = &root_;
+	for (int i = 0; i < level; i++) {
+		auto index = (network >> (32 - (i + 1) * trieStride)) & ((1 << trieStride) - 1);
+		auto &slot = node->slots[index];
+		if (!slot.child)
+			slot.child = std::make_unique<TrieNode>();
+		node = slot.child.get();
+	}
+
+	// Expand the prefix to all slots of the node that it covers.
+	int bits = prefix - level * trieStride;
+	auto base = (network >> (32 - (level + 1) * trieStride)) & ((1 << trieStride) - 1);
+	for (uint32_t i = 0; i < (uint32_t{1} << (trieStride - bits)); i++) {
+		auto &slot = node->slots[base + i];
+		// For equal prefixes, the first (i.e., best) route wins.
+		if (slot.route && slot.prefix == prefix)
+			continue;
+		slot.route = &r;
+		slot.prefix = prefix;
+	}
+}
+
+const Route *Ip4Router::lookup_(uint32_t ip) const {
+	const Route *best = nullptr;
+	auto node = &root_;
+	for (int i = 0; node && i < 32 / trieStride; i++) {
+		auto &slot = node->slots[(ip >> (32 - (i + 1) * trieStride)) & ((1 << trieStride) - 1)];
+		if (slot.route)
+			best = slot.route;
+		node = slot.child.get();
+	}
+	return best;
 }
 
-bool operator<(const CidrAddress &lhs, const CidrAddress &) {
-	return std::tie(lhs.prefix, lhs.ip) < std::tie(lhs.prefix, lhs.ip);
+bool operator<(const CidrAddress &lhs, const CidrAddress &rhs) {
+	return std::tie(lhs.prefix, lhs.ip) < std::tie(rhs.prefix, rhs.ip);
 }
 
 auto operator<=>(const Route &lhs, const Route &rhs) {
@@ -71,7 +168,7 @@ bool operator==(const Route &lhs, const Route &rhs) {
 	return operator<=>(lhs, rhs) == 0;
 }
 
-bool Ip4Packet::parse(arch::dma_buffer owner, arch::dma_buffer_view frame) {
+bool Ip4Packet::parse(nic::FrameBuffer owner, arch::dma_buffer_view frame) {
 	buffer_ = std::move(owner);
 	data = frame;
 	if (data.size() < sizeof(header)) {
@@ -234,6 +331,14 @@ async::result<frg::expected<protocols::fs::Error, size_t>> Ip4Socket::sendmsg(vo
 
 async::result<std::optional<Ip4TargetInfo>>
 Ip4::targetByRemote(uint32_t remote, std::shared_ptr<nic::Link> link) {
+	// Like Linux' local routing table: packets to our own addresses never leave the host.
+	if (!link && hasIp(remote)) {
+		if (auto lo = loopback_.lock(); lo) {
+			Ip4Router::Route route{ {remote, 32}, lo };
+			co_return Ip4TargetInfo { remote, remote, std::move(route), std::move(lo) };
+		}
+	}
+
 	auto oroute = ip4Router().resolveRoute(remote, link);
 	if (!oroute) {
 		std::cout << "netserver: net unreachable" << std::endl;
@@ -262,6 +367,19 @@ Ip4::targetByRemote(uint32_t remote, std::shared_ptr<nic::Link> link) {
 	co_return Ip4TargetInfo { remote, source, *oroute, std::move(target) };
 }
 
+async::result<std::optional<Ip4TargetInfo>>
+Ip4::targetByRemote(uint32_t remote, Ip4RouteCache &cache, std::shared_ptr<nic::Link> link) {
+	if (cache.target && cache.target->remote == remote && cache.boundLink == link
+			&& cache.generation == ip4Router().generation())
+		co_return cache.target;
+
+	auto generation = ip4Router().generation();
+	cache.target = co_await targetByRemote(remote, link);
+	cache.boundLink = std::move(link);
+	cache.generation = generation;
+	co_return cache.target;
+}
+
 bool Ip4::hasIp(uint32_t addr) {
 	return std::any_of(ips.cbegin(), ips.cend(),
 		[addr] (auto &x) {
@@ -270,22 +388,37 @@ bool Ip4::hasIp(uint32_t addr) {
 }
 
 async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
-		void *data, size_t len, uint16_t proto) {
+		void *data, size_t len, uint16_t proto, nic::Link::SendOffload offload) {
 	using arch::convert_endian;
 	using arch::endian;
 
+	auto &target = ti.link;
+	auto &caps = target->capabilities();
+	bool segment = offload.segmentSize
+			&& len > size_t{offload.headerLength} + offload.segmentSize;
+	bool hwSegment = segment && caps.tso4 && caps.txChecksum;
+	if (segment && !hwSegment)
+		co_return co_await sendSegments_(std::move(ti),
+				static_cast<const char *>(data), len, proto, offload);
+
 	// TODO(arsen): fragmentation
 	// calculate header size
 	size_t header_size = sizeof(Ip4Packet::Header);
 	size_t packet_size = len + header_size;
+	// Segments that the link produces must fit into the MTU.
+	size_t wire_size = packet_size;
+	if (hwSegment) {
+		if (packet_size > 0xFFFF)
+			co_return protocols::fs::Error::messageSize;
+		wire_size = header_size + offload.headerLength + offload.segmentSize;
+	}
 	// TODO(arsen): options
-	if (ti.route.mtu != 0 && ti.route.mtu < packet_size) {
+	if (ti.route.mtu != 0 && ti.route.mtu < wire_size) {
 		std::cout << "netserver: cant fragment 1" << std::endl;
 		co_return protocols::fs::Error::messageSize;
 	}
 
-	auto &target = ti.link;
-	if (target->mtu < packet_size) {
+	if (target->mtu < wire_size) {
 		std::cout << "netserver: cant fragment 2" << std::endl;
 		co_return protocols::fs::Error::messageSize;
 	}
@@ -295,6 +428,7 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	hdr.ihl = 0x45;
 	hdr.tos = 0;
 	hdr.length = packet_size;
+	hdr.ident = 0;
 	// TODO(arsen): fragmentation
 	hdr.flags_offset = 0;
 	hdr.ttl = 64;
@@ -330,16 +464,105 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	}
 
 	std::memcpy(fb.payload.data(), &hdr, sizeof(hdr));
-	std::memcpy(fb.payload.subview(header_size).byte_data(), data, len);
+	auto transport = fb.payload.subview(header_size);
+	std::memcpy(transport.byte_data(), data, len);
+
+	uint32_t hash = 0;
+	if (caps.numQueues > 1)
+		hash = flowHash(ti.source, ti.remote, proto, data, len);
+
+	if (!offload.needsChecksum) {
+		co_await target->send(std::move(fb.frame), nic::Link::SendOffload{.flowHash = hash});
+		co_return protocols::fs::Error::none;
+	}
+
+	Checksum csum;
+	csum.update(ti.source >> 16);
+	csum.update(ti.source & 0xFFFF);
+	csum.update(ti.remote >> 16);
+	csum.update(ti.remote & 0xFFFF);
+	csum.update(proto);
+	csum.update(len);
+
+	uint16_t result;
+	if (caps.txChecksum) {
+		// The link expects the (uncomplemented) sum of the pseudo header.
+		result = ~csum.finalize();
+	} else {
+		csum.update(transport.subview(offload.csumStart));
+		result = csum.finalize();
+		// Zero means "no checksum" for UDP; both encodings are equivalent otherwise.
+		if (!result)
+			result = 0xFFFF;
+	}
+	result = convert_endian<endian::big>(result);
+	std::memcpy(transport.subview(offload.csumStart + offload.csumOffset).data(),
+			&result, sizeof(result));
+
+	if (!caps.txChecksum) {
+		co_await target->send(std::move(fb.frame), nic::Link::SendOffload{.flowHash = hash});
+		co_return protocols::fs::Error::none;
+	}
+
+	// Translate the offsets such that they are relative to the start of the frame.
+	uint16_t transportStart = fb.frame.size() - len;
+	nic::Link::SendOffload linkOffload{
+		.needsChecksum = true,
+		.csumStart = static_cast<uint16_t>(transportStart + offload.csumStart),
+		.csumOffset = offload.csumOffset,
+		.segmentSize = hwSegment ? offload.segmentSize : uint16_t{0},
+		.headerLength = static_cast<uint16_t>(transportStart + offload.headerLength),
+		.flowHash = hash,
+	};
+	co_await target->send(std::move(fb.frame), linkOffload);
+	co_return protocols::fs::Error::none;
+}
 
-	co_await target->send(std::move(fb.frame));
+// Software fallback for TCP segmentation offload: sends each segment as a separate frame.
+async::result<protocols::fs::Error> Ip4::sendSegments_(Ip4TargetInfo ti,
+		const char *data, size_t len, uint16_t proto, nic::Link::SendOffload offload) {
+	constexpr uint8_t finFlag = 0x01;
+	constexpr uint8_t pshFlag = 0x08;
+
+	size_t headerLength = offload.headerLength;
+	size_t segmentSize = offload.segmentSize;
+	assert(proto == static_cast<uint16_t>(IpProto::tcp));
+	assert(len > headerLength && segmentSize);
+	offload.segmentSize = 0;
+
+	uint32_t seqNumber;
+	std::memcpy(&seqNumber, data + 4, sizeof(uint32_t));
+	seqNumber = arch::convert_endian<arch::endian::native, arch::endian::big>(seqNumber);
+
+	std::vector<char> buf;
+	for (size_t offset = headerLength; offset < len; ) {
+		size_t chunk = std::min(len - offset, segmentSize);
+		bool last = (offset + chunk == len);
+
+		buf.resize(headerLength + chunk);
+		std::memcpy(buf.data(), data, headerLength);
+		std::memcpy(buf.data() + headerLength, data + offset, chunk);
+
+		auto sn = arch::convert_endian<arch::endian::big>(
+				static_cast<uint32_t>(seqNumber + offset - headerLength));
+		std::memcpy(buf.data() + 4, &sn, sizeof(uint32_t));
+		if (!last)
+			buf[13] &= ~(finFlag | pshFlag);
+
+		auto error = co_await sendFrame(ti, buf.data(), buf.size(), proto, offload);
+		if (error != protocols::fs::Error::none)
+			co_return error;
+		offset += chunk;
+	}
 	co_return protocols::fs::Error::none;
 }
 
 void Ip4::feedPacket(nic::MacAddress, nic::MacAddress,
-		arch::dma_buffer owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link) {
+		nic::FrameBuffer owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link,
+		const nic::Link::ReceiveInfo &info) {
 	Ip4Packet hdr{};
 	hdr.link = link;
+	hdr.checksumVerified = info.checksumVerified;
 
 	if (!hdr.parse(std::move(owner), frame)) {
 		std::cout << "netserver: runt, or otherwise invalid, ip4 frame received"
@@ -371,7 +594,17 @@ void Ip4::feedPacket(nic::MacAddress, nic::MacAddress,
 }
 
 void Ip4::setLink(CidrAddress addr, std::weak_ptr<nic::Link> l) {
-	ips.emplace(addr, std::move(l));
+	auto link = l.lock();
+	if (!ips.emplace(addr, std::move(l)).second)
+		return;
+	ip4Router().invalidate();
+	if (link)
+		nl::notifyAddr(RTM_NEWADDR, addr, *link);
+}
+
+void Ip4::setLoopback(std::weak_ptr<nic::Link> l) {
+	loopback_ = std::move(l);
+	ip4Router().invalidate();
 }
 
 std::shared_ptr<nic::Link> Ip4::getLink(uint32_t addr) {
@@ -383,6 +616,7 @@ std::shared_ptr<nic::Link> Ip4::getLink(uint32_t addr) {
 	auto ptr = iter->second.lock();
 	if (!ptr) {
 		ips.erase(iter);
+		ip4Router().invalidate();
 		return {};
 	}
 	return ptr;
@@ -405,7 +639,15 @@ std::optional<CidrAddress> Ip4::getCidrByIndex(int index) {
 }
 
 bool Ip4::deleteLink(CidrAddress addr) {
-	return ips.erase(addr) > 0;
+	auto it = ips.find(addr);
+	if (it == ips.end())
+		return false;
+	auto link = it->second.lock();
+	ips.erase(it);
+	ip4Router().invalidate();
+	if (link)
+		nl::notifyAddr(RTM_DELADDR, addr, *link);
+	return true;
 }
 
 std::optional<uint32_t> Ip4::findLinkIp(uint32_t ipOnNet, nic::Link *link) {
@@ -8,6 +8,7 @@
 #include <netserver/nic.hpp>
 #include <protocols/fs/common.hpp>
 #include <set>
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <optional>
@@ -41,6 +42,10 @@ struct CidrAddress {
 	friend bool operator<(const CidrAddress &, const CidrAddress &);
 };
 
+// Routes are stored in a std::set (for dumps) and indexed by a multibit trie with a stride
+// of 8 bits: each slot stores the longest prefix of its level that covers the slot (controlled
+// prefix expansion), hence lookups take at most four steps. The trie is rebuilt whenever
+// the set changes, which is rare compared to lookups.
 struct Ip4Router {
 	struct Route {
 		inline Route(CidrAddress net, std::weak_ptr<nic::Link> link)
@@ -69,12 +74,40 @@ struct Ip4Router {
 	inline const std::set<Route> &getRoutes() const {
 		return routes;
 	}
+
+	// Incremented whenever the result of a route lookup may change (i.e., if routes or
+	// local addresses change). Used to invalidate cached routes.
+	inline uint64_t generation() const {
+		return generation_;
+	}
+
+	inline void invalidate() {
+		generation_++;
+	}
 private:
+	static constexpr int trieStride = 8;
+
+	struct TrieNode {
+		struct Slot {
+			const Route *route = nullptr;
+			uint8_t prefix = 0;
+			std::unique_ptr<TrieNode> child;
+		};
+
+		std::array<Slot, 1 << trieStride> slots;
+	};
+
+	void rebuild_();
+	void insert_(const Route &r);
+	const Route *lookup_(uint32_t ip) const;
+
 	std::set<Route> routes;
+	TrieNode root_;
+	uint64_t generation_ = 0;
 };
 
 class Ip4Packet {
-	arch::dma_buffer buffer_;
+	nic::FrameBuffer buffer_;
 public:
 	struct Header {
 		uint8_t ihl;
@@ -108,6 +141,8 @@ public:
 	static_assert(sizeof(header) == 20, "bad header size");
 	arch::dma_buffer_view data;
 	std::weak_ptr<nic::Link> link;
+	// The link already verified the checksum of the transport protocol.
+	bool checksumVerified = false;
 
 	inline arch::dma_buffer_view payload() const {
 		return data.subview(header.ihl * 4);
@@ -118,7 +153,7 @@ public:
 	}
 
 	// assumes frame is a valid view into owner
-	bool parse(arch::dma_buffer owner, arch::dma_buffer_view frame);
+	bool parse(nic::FrameBuffer owner, arch::dma_buffer_view frame);
 };
 
 struct Ip4TargetInfo {
@@ -128,12 +163,21 @@ struct Ip4TargetInfo {
 	std::shared_ptr<nic::Link> link;
 };
 
+// Caches the result of Ip4::targetByRemote() for sockets that send to the same
+// destination repeatedly (e.g., connected sockets).
+struct Ip4RouteCache {
+	std::optional<Ip4TargetInfo> target;
+	std::shared_ptr<nic::Link> boundLink;
+	uint64_t generation = 0;
+};
+
 struct Ip4Socket;
 struct Ip4 {
 	managarm::fs::Errors serveSocket(helix::UniqueLane lane, int type, int proto, int flags);
 	// frame is a view into the owner buffer, stripping away eth bits
 	void feedPacket(nic::MacAddress dest, nic::MacAddress src,
-		arch::dma_buffer owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link);
+		nic::FrameBuffer owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link,
+		const nic::Link::ReceiveInfo &info = {});
 
 	bool hasIp(uint32_t ip);
 	std::shared_ptr<nic::Link> getLink(uint32_t ip);
@@ -141,14 +185,27 @@ struct Ip4 {
 	bool deleteLink(CidrAddress addr);
 	void setLink(CidrAddress addr, std::weak_ptr<nic::Link> link);
 	std::optional<uint32_t> findLinkIp(uint32_t ipOnNet, nic::Link *link);
+	// Packets to local addresses are routed through this link.
+	void setLoopback(std::weak_ptr<nic::Link> link);
 
 	async::result<std::optional<Ip4TargetInfo>> targetByRemote(uint32_t, std::shared_ptr<nic::Link> link = {});
+	// Like targetByRemote() but skips the route lookup if the cache is still valid.
+	async::result<std::optional<Ip4TargetInfo>> targetByRemote(uint32_t, Ip4RouteCache &cache,
+		std::shared_ptr<nic::Link> link = {});
+	// The offload describes the transport header at the start of the data: if needsChecksum
+	// is set, the checksum field must be zero and csumStart is relative to the transport
+	// header. If segmentSize is set, TCP data is split into segments of that size.
+	// Offloads that the link does not support are performed in software.
 	async::result<protocols::fs::Error> sendFrame(Ip4TargetInfo,
 		void*, size_t,
-		uint16_t);
+		uint16_t, nic::Link::SendOffload offload = {});
 private:
+	async::result<protocols::fs::Error> sendSegments_(Ip4TargetInfo ti,
+		const char *data, size_t len, uint16_t proto, nic::Link::SendOffload offload);
+
 	std::multimap<int, smarter::shared_ptr<Ip4Socket>> sockets;
 	std::map<CidrAddress, std::weak_ptr<nic::Link>> ips;
+	std::weak_ptr<nic::Link> loopback_;
 
 	Udp4 udp;
 	Icmp icmp;
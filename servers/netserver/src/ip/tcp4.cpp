@@ -4,20 +4,29 @@
 #include <arch/bit.hpp>
 #include <arch/variable.hpp>
 #include <protocols/fs/server.hpp>
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstring>
+#include <deque>
 #include <format>
 #include <iomanip>
+#include <optional>
 #include <random>
+#include <span>
 #include <fcntl.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
 
 #include <bragi/helpers-std.hpp>
+#include <helix/timer.hpp>
 
 #include "checksum.hpp"
+#include "congestion.hpp"
 #include "ip4.hpp"
 #include "tcp4.hpp"
 
@@ -25,6 +34,64 @@ namespace {
 
 constexpr bool debugTcp = false;
 
+// TODO: Perform path MTU discovery.
+constexpr size_t maxSegmentSize = 1280;
+
+// Largest TCP packet (header and data) that is passed to the IP layer at once;
+// the link or the IP layer splits it into segments (TSO).
+constexpr size_t maxSendSize = 0xFFFF - sizeof(Ip4Packet::Header);
+
+// Let the link (or the IP layer) compute the checksum.
+constexpr nic::Link::SendOffload checksumOffload{
+	.needsChecksum = true,
+	.csumOffset = 16,
+};
+
+// Bounds of the retransmission timeout (RFC 6298), in nanoseconds.
+constexpr uint64_t initialRto = 1'000'000'000;
+constexpr uint64_t minRto = 1'000'000'000;
+constexpr uint64_t maxRto = 60'000'000'000;
+constexpr uint64_t clockGranularity = 1'000'000;
+
+// Send and receive buffers are 2^n bytes large. Unless SO_SNDBUF or SO_RCVBUF is set,
+// they are grown up to maxBufferShift when they limit the throughput.
+constexpr int defaultBufferShift = 14;
+constexpr int minBufferShift = 12;
+constexpr int maxBufferShift = 22;
+
+// Maximal number of out-of-order ranges that we keep in the receive buffer.
+constexpr size_t maxReceivedBlocks = 16;
+
+// Maximal number of in-order segments whose receive buffers are kept until the user
+// reads them. Each segment pins an entire frame buffer, even if it carries little data.
+constexpr size_t maxParkedSegments = 64;
+
+// Length of the SYN and accept queues of listening sockets. PT_LISTEN does not carry
+// the backlog argument of listen(), hence all listeners use the same limit.
+constexpr size_t defaultBacklog = 128;
+
+// Number of SYN-ACK retransmissions before a half-open connection is dropped.
+constexpr unsigned int maxSynAckRetries = 5;
+
+// SYN cookies encode a counter that advances with this period (in nanoseconds).
+constexpr uint64_t cookiePeriod = 64'000'000'000;
+
+uint64_t currentTime() {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	return now;
+}
+
+// Clock of the timestamp option (RFC 7323), ticks once per millisecond.
+uint32_t timestampClock(uint64_t now) {
+	return now / 1'000'000;
+}
+
+// Compares sequence numbers modulo 2^32.
+bool snBefore(uint32_t a, uint32_t b) {
+	return static_cast<int32_t>(a - b) < 0;
+}
+
 struct stl_allocator {
 	void *allocate(size_t size) {
 		return operator new(size);
@@ -65,14 +132,53 @@ struct RingBuffer {
 		return enqPtr_ - deqPtr_;
 	}
 
-	void enqueue(void *data, size_t size) {
-		assert(size <= spaceForEnqueue());
+	int shift() {
+		return shift_;
+	}
+
+	size_t capacity() {
+		return size_t{1} << shift_;
+	}
+
+	// Reallocates the buffer with a size of 2^shift bytes. The contents of the buffer
+	// (including data that was stored by enqueueAt() but not yet advanced over) are preserved
+	// as long as they fit into the new buffer.
+	void resize(int shift) {
+		assert((size_t{1} << shift) >= availableToDequeue());
+		auto storage = reinterpret_cast<char *>(operator new (size_t{1} << shift));
+		auto size = availableToDequeue();
+		auto ringSize = size_t{1} << shift_;
+		auto wrappedPtr = deqPtr_ & (ringSize - 1);
+		size_t bytesToCopy = std::min(ringSize, size_t{1} << shift);
+		size_t bytesUntilEnd = std::min(bytesToCopy, ringSize - wrappedPtr);
+		memcpy(storage, storage_ + wrappedPtr, bytesUntilEnd);
+		memcpy(storage + bytesUntilEnd, storage_, bytesToCopy - bytesUntilEnd);
+		operator delete(storage_);
+
+		storage_ = storage;
+		shift_ = shift;
+		deqPtr_ = 0;
+		enqPtr_ = size;
+	}
+
+	void enqueue(const void *data, size_t size) {
+		enqueueAt(0, data, size);
+		enqueueAdvance(size);
+	}
+
+	// Stores data at the given offset behind the end of the buffer without enqueueing it.
+	void enqueueAt(size_t offset, const void *data, size_t size) {
+		assert(offset + size <= spaceForEnqueue());
 		size_t ringSize = size_t{1} << shift_;
-		auto wrappedPtr = enqPtr_ & (ringSize - 1);
-		auto p = reinterpret_cast<char *>(data);
+		auto wrappedPtr = (enqPtr_ + offset) & (ringSize - 1);
+		auto p = reinterpret_cast<const char *>(data);
 		size_t bytesUntilEnd = std::min(size, ringSize - wrappedPtr);
 		memcpy(storage_ + wrappedPtr, p, bytesUntilEnd);
 		memcpy(storage_, p + bytesUntilEnd, size - bytesUntilEnd);
+	}
+
+	void enqueueAdvance(size_t size) {
+		assert(size <= spaceForEnqueue());
 		enqPtr_ += size;
 	}
 
@@ -105,11 +211,42 @@ private:
 // TODO: Use a CSPRNG, see also UDP.
 static std::mt19937 globalPrng;
 
+// SipHash-2-4 of a sequence of 64-bit words.
+uint64_t sipHash(const std::array<uint64_t, 2> &key, std::span<const uint64_t> words) {
+	uint64_t v0 = key[0] ^ 0x736f6d6570736575;
+	uint64_t v1 = key[1] ^ 0x646f72616e646f6d;
+	uint64_t v2 = key[0] ^ 0x6c7967656e657261;
+	uint64_t v3 = key[1] ^ 0x7465646279746573;
+	auto round = [&] {
+		v0 += v1; v1 = std::rotl(v1, 13); v1 ^= v0; v0 = std::rotl(v0, 32);
+		v2 += v3; v3 = std::rotl(v3, 16); v3 ^= v2;
+		v0 += v3; v3 = std::rotl(v3, 21); v3 ^= v0;
+		v2 += v1; v1 = std::rotl(v1, 17); v1 ^= v2; v2 = std::rotl(v2, 32);
+	};
+
+	for(auto m : words) {
+		v3 ^= m;
+		round();
+		round();
+		v0 ^= m;
+	}
+	uint64_t b = uint64_t{words.size() * 8} << 56;
+	v3 ^= b;
+	round();
+	round();
+	v0 ^= b;
+	v2 ^= 0xFF;
+	for(int i = 0; i < 4; i++)
+		round();
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
 } // namespace
 
 struct TcpHeader {
 	static constexpr arch::field<uint16_t, bool> finFlag{0, 1};
 	static constexpr arch::field<uint16_t, bool> synFlag{1, 1};
+	static constexpr arch::field<uint16_t, bool> rstFlag{2, 1};
 	static constexpr arch::field<uint16_t, bool> ackFlag{4, 1};
 	static constexpr arch::field<uint16_t, unsigned int> headerWords{12, 4};
 
@@ -125,6 +262,33 @@ struct TcpHeader {
 
 static_assert(sizeof(TcpHeader) == 20);
 
+enum class TcpOption : uint8_t {
+	end = 0,
+	nop = 1,
+	maxSegmentSize = 2,
+	windowScale = 3,
+	sackPermitted = 4,
+	sack = 5,
+	timestamp = 8,
+};
+
+// Half-open range [left, right) of sequence numbers.
+struct SackBlock {
+	uint32_t left;
+	uint32_t right;
+};
+
+struct TcpOptions {
+	std::optional<uint16_t> maxSegmentSize;
+	std::optional<uint8_t> windowScale;
+	bool sackPermitted = false;
+	bool hasTimestamp = false;
+	uint32_t tsVal = 0;
+	uint32_t tsEcr = 0;
+	size_t numSackBlocks = 0;
+	std::array<SackBlock, 4> sackBlocks;
+};
+
 struct TcpPacket {
 	arch::dma_buffer_view payload() {
 		auto words = header.flags.load() & TcpHeader::headerWords;
@@ -142,8 +306,11 @@ struct TcpPacket {
 			return false;
 		if (ipPayload.size() < words * 4)
 			return false;
+		if (!parseOptions_(reinterpret_cast<const char *>(ipPayload.data()) + sizeof(TcpHeader),
+				words * 4 - sizeof(TcpHeader)))
+			return false;
 
-		if (header.checksum.load()) {
+		if (header.checksum.load() && !packet->checksumVerified) {
 			PseudoHeader pseudo {
 				.src = packet->header.source,
 				.dst = packet->header.destination,
@@ -163,7 +330,58 @@ struct TcpPacket {
 	}
 
 	TcpHeader header;
+	TcpOptions options;
 	smarter::shared_ptr<const Ip4Packet> packet;
+
+private:
+	bool parseOptions_(const char *p, size_t size) {
+		auto load16 = [] (const char *q) {
+			uint16_t v;
+			memcpy(&v, q, sizeof(uint16_t));
+			return arch::from_endian<arch::big_endian, uint16_t>(v);
+		};
+		auto load32 = [] (const char *q) {
+			uint32_t v;
+			memcpy(&v, q, sizeof(uint32_t));
+			return arch::from_endian<arch::big_endian, uint32_t>(v);
+		};
+
+		size_t i = 0;
+		while (i < size) {
+			auto kind = static_cast<TcpOption>(p[i]);
+			if (kind == TcpOption::end)
+				break;
+			if (kind == TcpOption::nop) {
+				i++;
+				continue;
+			}
+
+			if (i + 2 > size)
+				return false;
+			size_t length = static_cast<uint8_t>(p[i + 1]);
+			if (length < 2 || i + length > size)
+				return false;
+			auto data = p + i + 2;
+
+			if (kind == TcpOption::maxSegmentSize && length == 4) {
+				options.maxSegmentSize = load16(data);
+			} else if (kind == TcpOption::windowScale && length == 3) {
+				options.windowScale = static_cast<uint8_t>(data[0]);
+			} else if (kind == TcpOption::sackPermitted && length == 2) {
+				options.sackPermitted = true;
+			} else if (kind == TcpOption::sack && !((length - 2) % 8)) {
+				options.numSackBlocks = std::min((length - 2) / 8, options.sackBlocks.size());
+				for (size_t j = 0; j < options.numSackBlocks; j++)
+					options.sackBlocks[j] = {load32(data + j * 8), load32(data + j * 8 + 4)};
+			} else if (kind == TcpOption::timestamp && length == 10) {
+				options.hasTimestamp = true;
+				options.tsVal = load32(data);
+				options.tsEcr = load32(data + 4);
+			}
+			i += length;
+		}
+		return true;
+	}
 };
 
 namespace {
@@ -186,10 +404,12 @@ protocols::fs::Error checkAddress(const void *addrPtr, size_t addrLength, TcpEnd
 
 struct Tcp4Socket {
 	Tcp4Socket(Tcp4 *parent, bool nonBlock)
-	: parent_(parent), nonBlock_{nonBlock}, recvRing_{14}, sendRing_{14} {}
+	: parent_(parent), nonBlock_{nonBlock},
+		recvRing_{defaultBufferShift}, sendRing_{defaultBufferShift},
+		cc_{makeCongestionControl(defaultCongestionControl, maxSegmentSize)} {}
 
 	~Tcp4Socket() {
-		parent_->unbind(localEp_);
+		parent_->unbind(localEp_, this);
 	}
 
 	static auto makeSocket(Tcp4 *parent, bool nonBlock) {
@@ -237,6 +457,47 @@ struct Tcp4Socket {
 		co_return protocols::fs::Error::none;
 	}
 
+	static async::result<protocols::fs::Error> listen(void *object) {
+		auto self = static_cast<Tcp4Socket *>(object);
+
+		if (self->connectState_ == ConnectState::listen)
+			co_return protocols::fs::Error::none;
+		if (self->connectState_ != ConnectState::none)
+			co_return protocols::fs::Error::illegalArguments;
+
+		// Like on Linux, unbound sockets listen on an ephemeral port.
+		if (!self->localEp_.port && !self->bindAvailable()) {
+			std::cout << "netserver: No source port" << std::endl;
+			co_return protocols::fs::Error::addressInUse;
+		}
+
+		self->connectState_ = ConnectState::listen;
+		self->flushEvent_.raise();
+		co_return protocols::fs::Error::none;
+	}
+
+	static async::result<frg::expected<protocols::fs::Error, helix::UniqueLane>>
+	accept(void *object) {
+		auto self = static_cast<Tcp4Socket *>(object);
+
+		if (self->connectState_ != ConnectState::listen)
+			co_return protocols::fs::Error::illegalArguments;
+
+		while (self->acceptQueue_.empty()) {
+			if (self->nonBlock_)
+				co_return protocols::fs::Error::wouldBlock;
+			co_await self->inEvent_.async_wait();
+		}
+
+		auto socket = std::move(self->acceptQueue_.front());
+		self->acceptQueue_.pop_front();
+
+		auto [localLane, remoteLane] = helix::createStream();
+		async::detach(protocols::fs::servePassthrough(std::move(localLane), std::move(socket),
+				&ops));
+		co_return std::move(remoteLane);
+	}
+
 	static async::result<size_t> sockname(void *object, void *addr_ptr, size_t max_addr_length) {
 		auto self = static_cast<Tcp4Socket *>(object);
 		sockaddr_in sa{};
@@ -278,7 +539,7 @@ struct Tcp4Socket {
 					if(self->connectState_ != ConnectState::connected) {
 						resp.set_error(managarm::fs::Errors::NOT_CONNECTED);
 					}else {
-						resp.set_fionread_count(self->recvRing_.availableToDequeue());
+						resp.set_fionread_count(self->availableToRead_());
 					}
 					break;
 				}
@@ -373,7 +634,7 @@ struct Tcp4Socket {
 
 		size_t progress = 0;
 		while(progress < size) {
-			size_t available = self->recvRing_.availableToDequeue();
+			size_t available = self->availableToRead_();
 			if(!available) {
 				if(progress)
 					break;
@@ -383,11 +644,11 @@ struct Tcp4Socket {
 				continue;
 			}
 			size_t chunk = std::min(available, size - progress);
-			self->recvRing_.dequeueLookahead(0, p + progress, chunk);
+			self->readLookahead_(p + progress, chunk);
 			progress += chunk;
 			if(flags & MSG_PEEK)
 				break;
-			self->recvRing_.dequeueAdvance(chunk);
+			self->readAdvance_(chunk);
 			self->flushEvent_.raise();
 		}
 
@@ -465,7 +726,7 @@ struct Tcp4Socket {
 		auto self = static_cast<Tcp4Socket *>(object);
 
 		int active = 0;
-		if(self->recvRing_.availableToDequeue())
+		if(self->availableToRead_() || !self->acceptQueue_.empty())
 			active |= EPOLLIN;
 		if(self->sendRing_.spaceForEnqueue())
 			active |= EPOLLOUT;
@@ -514,6 +775,51 @@ struct Tcp4Socket {
 				self->boundInterface_ = nic;
 				co_return {};
 			}
+		}else if(layer == IPPROTO_TCP && number == TCP_CONGESTION) {
+			std::string name{optbuf.data(), strnlen(optbuf.data(), optbuf.size())};
+			auto cc = makeCongestionControl(name, maxSegmentSize);
+			if(!cc)
+				co_return protocols::fs::Error::illegalArguments;
+			self->cc_ = std::move(cc);
+			co_return {};
+		}else if(layer == SOL_SOCKET && (number == SO_REUSEPORT || number == SO_REUSEADDR)) {
+			int value;
+			if(optbuf.size() < sizeof(int))
+				co_return protocols::fs::Error::illegalArguments;
+			memcpy(&value, optbuf.data(), sizeof(int));
+
+			// There is no TIME-WAIT state, hence SO_REUSEADDR has no effect.
+			// SO_REUSEPORT applies to subsequent binds.
+			if(number == SO_REUSEPORT)
+				self->reusePort_ = value;
+			co_return {};
+		}else if(layer == SOL_SOCKET && (number == SO_RCVBUF || number == SO_SNDBUF)) {
+			int value;
+			if(optbuf.size() < sizeof(int))
+				co_return protocols::fs::Error::illegalArguments;
+			memcpy(&value, optbuf.data(), sizeof(int));
+			if(value < 0)
+				co_return protocols::fs::Error::illegalArguments;
+
+			int shift = minBufferShift;
+			while(shift < maxBufferShift && (size_t{1} << shift) < static_cast<size_t>(value))
+				shift++;
+
+			if(number == SO_RCVBUF) {
+				// Never shrink a window that we may have announced already.
+				if(self->connectState_ != ConnectState::none)
+					shift = std::max(shift, self->recvRing_.shift());
+				self->recvRing_.resize(shift);
+				self->userRcvBuf_ = true;
+				self->flushEvent_.raise();
+			}else{
+				while((size_t{1} << shift) < self->sendRing_.availableToDequeue())
+					shift++;
+				self->sendRing_.resize(shift);
+				self->userSndBuf_ = true;
+				self->settleEvent_.raise();
+			}
+			co_return {};
 		}
 
 		std::cout << std::format("netserver: unhandled TCP socket setsockopt layer {} number {}\n",
@@ -522,6 +828,30 @@ struct Tcp4Socket {
 		co_return protocols::fs::Error::invalidProtocolOption;
 	}
 
+	static async::result<frg::expected<protocols::fs::Error>> getSocketOption(void *object,
+			helix_ng::CredentialsView, int layer, int number, std::vector<char> &optbuf) {
+		auto self = static_cast<Tcp4Socket *>(object);
+
+		if(layer == SOL_SOCKET && (number == SO_RCVBUF || number == SO_SNDBUF)) {
+			int value = (number == SO_RCVBUF) ? self->recvRing_.capacity()
+					: self->sendRing_.capacity();
+			memcpy(optbuf.data(), &value, std::min(optbuf.size(), sizeof(value)));
+		}else if(layer == SOL_SOCKET && number == SO_REUSEPORT) {
+			int value = self->reusePort_;
+			memcpy(optbuf.data(), &value, std::min(optbuf.size(), sizeof(value)));
+		}else if(layer == IPPROTO_TCP && number == TCP_CONGESTION) {
+			auto name = self->cc_->name();
+			std::fill(optbuf.begin(), optbuf.end(), 0);
+			memcpy(optbuf.data(), name.data(), std::min(optbuf.size(), name.size()));
+		}else{
+			std::cout << std::format("netserver: unhandled TCP socket getsockopt layer {} number {}\n",
+				layer, number);
+			co_return protocols::fs::Error::invalidProtocolOption;
+		}
+
+		co_return {};
+	}
+
 	constexpr static protocols::fs::FileOperations ops {
 		.read = &read,
 		.write = &write,
@@ -529,6 +859,8 @@ struct Tcp4Socket {
 		.pollWait = &pollWait,
 		.pollStatus = &pollStatus,
 		.bind = &bind,
+		.listen = &listen,
+		.accept = &accept,
 		.connect = &connect,
 		.sockname = &sockname,
 		.getFileFlags = &getFileFlags,
@@ -537,6 +869,7 @@ struct Tcp4Socket {
 		.sendMsg = &sendMsg,
 		.peername = &peername,
 		.setSocketOption = &setSocketOption,
+		.getSocketOption = &getSocketOption,
 	};
 
 	bool bindAvailable(uint32_t ipAddress = INADDR_ANY) {
@@ -557,18 +890,117 @@ struct Tcp4Socket {
 private:
 	async::result<void> flushOutPackets_();
 
+	// Waits until flushEvent_ is raised or the deadline (if non-zero) passes.
+	async::result<void> waitForFlush_(uint64_t deadline);
+
+	bool retransmissionTimerExpired_(uint64_t now) {
+		return rtoDeadline_ && now >= rtoDeadline_;
+	}
+
+	void handleRetransmissionTimeout_(uint64_t now);
+
 	void handleInPacket_(TcpPacket packet);
 
+	// Listening sockets only.
+	struct SynRequest;
+	async::result<void> serveSynQueue_();
+	async::result<void> sendSynAck_(TcpConnection connection, SynRequest request, uint32_t tsVal);
+	void handleListenPacket_(TcpPacket packet);
+	// Creates the socket of a connection whose handshake completed and queues it for accept().
+	void establish_(const TcpConnection &connection, const SynRequest &request, TcpPacket packet);
+
+	// Window scale that we announce in SYN segments; it covers the largest buffer that we may use.
+	int announcedWscale_() {
+		int bufferShift = userRcvBuf_ ? recvRing_.shift() : maxBufferShift;
+		return std::clamp(bufferShift - 15, 0, 14);
+	}
+
+	void handleAck_(uint32_t ackNumber, size_t window, bool isPureAck,
+			const TcpOptions &options);
+
+	void handleDuplicateAck_(uint64_t now);
+
+	void sampleRtt_(uint64_t rtt);
+
+	// Returns the TCP options of outgoing segments, padded to a multiple of 4 bytes.
+	std::vector<char> buildOptions_(bool isSyn, uint64_t now);
+
+	// Options of SYN and SYN-ACK segments. The timestamp option holds TSval and TSecr.
+	static std::vector<char> buildSynOptions_(std::optional<int> wscale, bool sackPermitted,
+			std::optional<std::pair<uint32_t, uint32_t>> timestamp);
+
+	// Window that we can announce to the remote side (a multiple of 2^rcvWscale_).
+	size_t receiveWindow_() {
+		auto window = std::min(receiveSpace_(), size_t{0xFFFF} << rcvWscale_);
+		return window & ~((size_t{1} << rcvWscale_) - 1);
+	}
+
+	// Parked segments occupy space in recvRing_ that is filled by unparkSegments_().
+	size_t receiveSpace_() {
+		return recvRing_.spaceForEnqueue() - parkedBytes_;
+	}
+
+	size_t availableToRead_() {
+		return recvRing_.availableToDequeue() + parkedBytes_;
+	}
+
+	// Reads data from recvRing_, followed by the parked segments.
+	void readLookahead_(char *p, size_t size);
+	void readAdvance_(size_t size);
+
+	// Copies the parked segments into recvRing_.
+	void unparkSegments_();
+
+	// Records out-of-order data. Returns false if too many ranges are outstanding.
+	bool addReceivedBlock_(uint32_t left, uint32_t right);
+
+	// Advances over out-of-order data that became contiguous. Returns the number of bytes.
+	size_t mergeReceivedBlocks_();
+
+	// Merges the SACK blocks of an incoming ACK into sackedBlocks_.
+	void updateScoreboard_(const TcpOptions &options);
+
+	// Returns the first Out-SN at or after sn that was not SACKed.
+	uint32_t skipSacked_(uint32_t sn);
+
+	// Returns the next Out-SN that fast recovery should retransmit.
+	uint32_t nextHole_() {
+		return skipSacked_(snBefore(holeSn_, localSettledSn_) ? localSettledSn_ : holeSn_);
+	}
+
+	// Returns the end of the hole that starts at sn.
+	uint32_t holeEnd_(uint32_t sn);
+
+	void tuneReceiveBuffer_(uint64_t now, size_t bytes);
+
+	void tuneSendBuffer_();
+
 private:
 	friend struct Tcp4;
 
 	enum class ConnectState {
 		none,
 		sendSyn, // Client-side only.
-		sendSynAck, // Server-side only.
+		listen, // Server-side only.
 		connected,
 	};
 
+	// State of a half-open connection of a listening socket. Such connections are not
+	// represented by sockets until the handshake completes.
+	struct SynRequest {
+		uint32_t localIsn;
+		uint32_t remoteIsn;
+		// Window scale of the remote side, if it sent the option.
+		std::optional<uint8_t> sndWscale;
+		bool sackEnabled;
+		bool tsEnabled;
+		uint32_t tsRecent;
+		// Time at which the first SYN-ACK was sent (or zero for SYN cookies).
+		uint64_t sentAt;
+		uint64_t deadline;
+		unsigned int retries;
+	};
+
 	Tcp4 *parent_;
 	bool nonBlock_;
 	TcpEndpoint remoteEp_;
@@ -577,11 +1009,20 @@ private:
 
 	ConnectState connectState_ = ConnectState::none;
 	bool remoteClosed_ = false;
+	bool reusePort_ = false;
+
+	// SYN queue and accept queue of listening sockets. Once the SYN queue is full,
+	// we answer with SYN cookies instead of queueing more connections.
+	std::unordered_map<TcpConnection, SynRequest, TcpConnection::Hash> synQueue_;
+	std::deque<smarter::shared_ptr<Tcp4Socket>> acceptQueue_;
 
 	// Out-SN corresponding to the front of sendRing_.
 	uint32_t localSettledSn_ = 0;
 	// Out-SN that has already been flushed to the IP layer (>= localSettledSn_).
+	// Moves back to localSettledSn_ when the retransmission timer expires.
 	uint32_t localFlushedSn_ = 0;
+	// Highest Out-SN that was ever flushed (>= localFlushedSn_).
+	uint32_t localMaxSn_ = 0;
 	// Out-SN of the end of the remote window (>= localSettledSn_).
 	uint32_t localWindowSn_ = 0;
 	// In-SN that we already acknowledged.
@@ -590,6 +1031,62 @@ private:
 	uint32_t remoteKnownSn_ = 0;
 	// Size of received window that we announced to the remote side.
 	uint32_t announcedWindow_ = 0;
+	// Out-of-order data that is stored in recvRing_ behind remoteKnownSn_.
+	// The most recently received range comes first (RFC 2018, section 4).
+	std::vector<SackBlock> receivedBlocks_;
+
+	// In-order data that follows the data in recvRing_. Instead of copying it into
+	// recvRing_, the segments keep their receive buffers until the user reads them.
+	// Only used while there is no out-of-order data.
+	struct ParkedSegment {
+		smarter::shared_ptr<const Ip4Packet> packet;
+		arch::dma_buffer_view data;
+	};
+	std::deque<ParkedSegment> parkedSegments_;
+	size_t parkedBytes_ = 0;
+	// Set if we need to acknowledge an out-of-order segment (RFC 5681, 4.2).
+	bool forceAck_ = false;
+
+	// Retransmission timer (RFC 6298); all times are in nanoseconds.
+	uint64_t srtt_ = 0;
+	uint64_t rttvar_ = 0;
+	uint64_t rto_ = initialRto;
+	// Zero if the timer is not armed.
+	uint64_t rtoDeadline_ = 0;
+	// Out-SN whose acknowledgement completes the current RTT measurement.
+	// Only data that was not retransmitted is timed (Karn's algorithm).
+	std::optional<uint32_t> timedSn_;
+	uint64_t timedAt_ = 0;
+
+	// Fast retransmit and fast recovery (RFC 5681 and RFC 6582).
+	std::unique_ptr<CongestionControl> cc_;
+	unsigned int dupAcks_ = 0;
+	bool inRecovery_ = false;
+	// localMaxSn_ when fast recovery started.
+	uint32_t recoverSn_ = 0;
+	// Set if the segment at nextHole_() needs to be retransmitted.
+	bool retransmitPending_ = false;
+	// Out-SN up to which fast recovery already retransmitted data.
+	uint32_t holeSn_ = 0;
+
+	// TCP options that were negotiated during the handshake.
+	// Window scale factors (RFC 7323) of the windows that we send and receive.
+	int sndWscale_ = 0;
+	int rcvWscale_ = 0;
+	bool sackEnabled_ = false;
+	bool tsEnabled_ = false;
+	// TSval that we echo to the remote side.
+	uint32_t tsRecent_ = 0;
+
+	// Out-of-order data that the remote side SACKed, sorted by sequence number.
+	std::vector<SackBlock> sackedBlocks_;
+
+	// Set if the user configured the buffer sizes; disables auto-tuning.
+	bool userRcvBuf_ = false;
+	bool userSndBuf_ = false;
+	// Bytes received within the current RTT, for receive buffer auto-tuning.
+	size_t rcvTuneBytes_ = 0;
+	uint64_t rcvTuneStart_ = 0;
 
 	RingBuffer recvRing_;
 	RingBuffer sendRing_;
@@ -607,6 +1104,7 @@ private:
 	async::recurring_event pollEvent_;
 
 	std::shared_ptr<nic::Link> boundInterface_ = {};
+	Ip4RouteCache routeCache_;
 };
 
 async::result<void> Tcp4Socket::flushOutPackets_() {
@@ -616,65 +1114,83 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 			continue;
 		}
 
+		if(connectState_ == ConnectState::listen) {
+			co_await serveSynQueue_();
+			continue;
+		}
+
 		if(connectState_ == ConnectState::sendSyn) {
+			auto now = currentTime();
 			if(localSettledSn_ != localFlushedSn_) {
-				co_await flushEvent_.async_wait();
-				continue;
-			}
+				if(!retransmissionTimerExpired_(now)) {
+					co_await waitForFlush_(rtoDeadline_);
+					continue;
+				}
 
-			// Obtain a new random sequence number.
-			auto randomSn = globalPrng();
-			localSettledSn_ = randomSn;
-			localFlushedSn_ = randomSn;
+				// Retransmit the SYN with the same sequence number.
+				if(debugTcp)
+					std::cout << "netserver: TCP SYN timed out" << std::endl;
+				rto_ = std::min(2 * rto_, maxRto);
+				timedSn_.reset();
+				--localFlushedSn_;
+			}else{
+				// Obtain a new random sequence number.
+				auto randomSn = globalPrng();
+				localSettledSn_ = randomSn;
+				localFlushedSn_ = randomSn;
+				timedSn_ = randomSn + 1;
+				timedAt_ = now;
+				rcvWscale_ = announcedWscale_();
+			}
 
 			// Construct and transmit the initial SYN packet.
-			auto targetInfo = co_await ip4().targetByRemote(remoteEp_.ipAddress, boundInterface_);
+			auto targetInfo = co_await ip4().targetByRemote(remoteEp_.ipAddress, routeCache_,
+					boundInterface_);
 			if (!targetInfo) {
 				// TODO: Return an error to users.
 				std::cout << "netserver: Destination unreachable" << std::endl;
 				co_return;
 			}
 
+			auto options = buildOptions_(true, now);
+
 			std::vector<char> buf;
-			buf.resize(sizeof(TcpHeader));
+			buf.resize(sizeof(TcpHeader) + options.size());
 
+			// The window of SYN segments is never scaled.
+			auto window = std::min(receiveSpace_(), size_t{0xFFFF});
 			auto header = new (buf.data()) TcpHeader {
 				.srcPort = localEp_.port,
 				.destPort = remoteEp_.port,
 				.seqNumber = localFlushedSn_,
 				.ackNumber = 0,
 				.flags = {},
-				.window = 0,
+				.window = window,
 				.checksum = 0,
 				.urgentPointer = 0,
 			};
-			header->flags.store(TcpHeader::headerWords(sizeof(TcpHeader) / 4)
+			header->flags.store(TcpHeader::headerWords(buf.size() / 4)
 					| TcpHeader::synFlag(true));
-
-			// Fill in the checksum.
-			PseudoHeader pseudo {
-				.src = targetInfo->source,
-				.dst = remoteEp_.ipAddress,
-				.len = buf.size()
-			};
-			Checksum csum;
-			csum.update(&pseudo, sizeof(PseudoHeader));
-			csum.update(buf.data(), buf.size());
-			header->checksum = csum.finalize();
+			memcpy(buf.data() + sizeof(TcpHeader), options.data(), options.size());
+			announcedWindow_ = window;
 
 			++localFlushedSn_;
+			localMaxSn_ = localFlushedSn_;
+			rtoDeadline_ = now + rto_;
 
 			if(debugTcp)
 				std::cout << "netserver: Sending TCP SYN" << std::endl;
 			auto error = co_await ip4().sendFrame(std::move(*targetInfo),
-				buf.data(), buf.size(), static_cast<uint16_t>(IpProto::tcp));
+				buf.data(), buf.size(), static_cast<uint16_t>(IpProto::tcp),
+				checksumOffload);
 			if (error != protocols::fs::Error::none) {
 				// TODO: Return an error to users.
 				std::cout << "netserver: Could not send TCP packet" << std::endl;
 				co_return;
 			}
 		}else{
-			auto targetInfo = co_await ip4().targetByRemote(remoteEp_.ipAddress);
+			auto targetInfo = co_await ip4().targetByRemote(remoteEp_.ipAddress, routeCache_,
+					boundInterface_);
 			if (!targetInfo) {
 				// TODO: Return an error to users.
 				std::cout << "netserver: Destination unreachable" << std::endl;
@@ -682,68 +1198,112 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 			}
 
 			assert(connectState_ == ConnectState::connected);
+			auto now = currentTime();
+			if(retransmissionTimerExpired_(now))
+				handleRetransmissionTimeout_(now);
+
 			size_t flushPointer = localFlushedSn_ - localSettledSn_;
+			size_t maxPointer = localMaxSn_ - localSettledSn_;
 			size_t windowPointer = localWindowSn_ - localSettledSn_;
+			// We may neither exceed the remote window nor the congestion window.
+			size_t limitPointer = std::min(windowPointer, cc_->cwnd());
 
 			size_t bytesAvailable = sendRing_.availableToDequeue();
-			assert(bytesAvailable >= flushPointer);
+			assert(bytesAvailable >= maxPointer);
 
 			// Check whether we need to send a packet.
-			// TODO: Add retransmission here.
-			bool wantData = (bytesAvailable > flushPointer && windowPointer > flushPointer);
-			bool wantAck = (remoteAckedSn_ != remoteKnownSn_);
-			bool wantWindowUpdate = (announcedWindow_ < recvRing_.spaceForEnqueue());
-
-			if(!wantData && !wantAck && !wantWindowUpdate) {
-				co_await flushEvent_.async_wait();
+			bool wantRetransmit = (retransmitPending_ && maxPointer);
+			bool wantData = (bytesAvailable > flushPointer && limitPointer > flushPointer);
+			bool wantAck = (remoteAckedSn_ != remoteKnownSn_ || forceAck_);
+			// Avoid the silly window syndrome (RFC 1122, 4.2.3.3).
+			bool wantWindowUpdate = (receiveWindow_() >= announcedWindow_
+					+ std::min(recvRing_.capacity() / 2, maxSegmentSize));
+
+			if(!wantRetransmit && !wantData && !wantAck && !wantWindowUpdate) {
+				co_await waitForFlush_(rtoDeadline_);
 				continue;
 			}
 
-			// Construct and transmit the TCP packet.
-			auto chunk = std::min({
-				bytesAvailable - flushPointer,
-				windowPointer - flushPointer,
-				size_t{1280} // TODO: Perform path MTU discovery.
-			});
+			auto options = buildOptions_(false, now);
+			size_t headerSize = sizeof(TcpHeader) + options.size();
+			size_t segmentSize = maxSegmentSize - options.size();
+
+			// Fast recovery resends the next hole that was not SACKed
+			// (or the first unacknowledged segment if SACK is not used).
+			// Otherwise, we continue at the flush pointer.
+			size_t offset = 0;
+			size_t chunk = 0;
+			if(wantRetransmit) {
+				auto sn = nextHole_();
+				offset = sn - localSettledSn_;
+				chunk = std::min(size_t{holeEnd_(sn) - sn}, segmentSize);
+				holeSn_ = sn + chunk;
+				retransmitPending_ = false;
+			}else{
+				offset = flushPointer;
+				if(wantData)
+					chunk = std::min({
+						bytesAvailable - flushPointer,
+						limitPointer - flushPointer,
+						std::max(segmentSize, maxSendSize - headerSize)
+					});
+			}
+			uint32_t seqNumber = localSettledSn_ + offset;
 
+			// Construct and transmit the TCP packet.
 			std::vector<char> buf;
-			buf.resize(sizeof(TcpHeader) + chunk);
+			buf.resize(headerSize + chunk);
 
+			auto window = receiveWindow_();
 			auto header = new (buf.data()) TcpHeader {
 				.srcPort = localEp_.port,
 				.destPort = remoteEp_.port,
-				.seqNumber = localFlushedSn_,
+				.seqNumber = seqNumber,
 				.ackNumber = remoteKnownSn_,
 				.flags = {},
-				.window = std::min(recvRing_.spaceForEnqueue(), size_t{0xFFFF}),
+				.window = window >> rcvWscale_,
 				.checksum = 0,
 				.urgentPointer = 0,
 			};
-			header->flags.store(TcpHeader::headerWords(sizeof(TcpHeader) / 4)
+			header->flags.store(TcpHeader::headerWords(headerSize / 4)
 					| TcpHeader::ackFlag(true));
+			memcpy(buf.data() + sizeof(TcpHeader), options.data(), options.size());
 
-			sendRing_.dequeueLookahead(flushPointer, buf.data() + sizeof(TcpHeader), chunk);
+			sendRing_.dequeueLookahead(offset, buf.data() + headerSize, chunk);
 
-			// Fill in the checksum.
-			PseudoHeader pseudo {
-				.src = targetInfo->source,
-				.dst = remoteEp_.ipAddress,
-				.len = buf.size()
-			};
-			Checksum csum;
-			csum.update(&pseudo, sizeof(PseudoHeader));
-			csum.update(buf.data(), buf.size());
-			header->checksum = csum.finalize();
+			if(chunk) {
+				// Karn's algorithm: never take RTT samples from retransmitted data.
+				if(wantRetransmit || snBefore(seqNumber, localMaxSn_)) {
+					timedSn_.reset();
+				}else if(!timedSn_) {
+					timedSn_ = seqNumber + chunk;
+					timedAt_ = now;
+				}
+
+				if(!rtoDeadline_)
+					rtoDeadline_ = now + rto_;
+			}
 
-			localFlushedSn_ += chunk;
+			if(!wantRetransmit) {
+				localFlushedSn_ += chunk;
+				if(snBefore(localMaxSn_, localFlushedSn_))
+					localMaxSn_ = localFlushedSn_;
+			}
 			remoteAckedSn_ = remoteKnownSn_;
-			announcedWindow_ = recvRing_.spaceForEnqueue();
+			announcedWindow_ = window;
+			forceAck_ = false;
 
 			if(debugTcp)
-				std::cout << "netserver: Sending TCP data (" << chunk << " bytes)" << std::endl;
+				std::cout << "netserver: Sending TCP data (" << chunk << " bytes"
+						<< (wantRetransmit ? ", retransmission" : "") << ")" << std::endl;
+			auto offload = checksumOffload;
+			if(chunk > segmentSize) {
+				offload.segmentSize = segmentSize;
+				offload.headerLength = headerSize;
+			}
 			auto error = co_await ip4().sendFrame(std::move(*targetInfo),
 				buf.data(), buf.size(),
-				static_cast<uint16_t>(IpProto::tcp));
+				static_cast<uint16_t>(IpProto::tcp), offload);
 			if (error != protocols::fs::Error::none) {
 				// TODO: Return an error to users.
 				std::cout << "netserver: Could not send TCP packet" << std::endl;
@@ -753,10 +1313,426 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 	}
 }
 
+async::result<void> Tcp4Socket::waitForFlush_(uint64_t deadline) {
+	if(!deadline) {
+		co_await flushEvent_.async_wait();
+		co_return;
+	}
+
+	auto now = currentTime();
+	if(now >= deadline)
+		co_return;
+
+	async::cancellation_event ev;
+	helix::TimeoutCancellation timer{deadline - now, ev};
+	co_await flushEvent_.async_wait(ev);
+	co_await timer.retire();
+}
+
+void Tcp4Socket::handleRetransmissionTimeout_(uint64_t now) {
+	if(debugTcp)
+		std::cout << "netserver: TCP retransmission timeout (RTO " << rto_ / 1'000'000
+				<< " ms)" << std::endl;
+
+	cc_->onTimeout(localMaxSn_ - localSettledSn_, now);
+
+	// Back off the timer (RFC 6298, 5.5) and resend everything starting from the
+	// first unacknowledged byte. The timer is re-armed once data is sent again.
+	rto_ = std::min(2 * rto_, maxRto);
+	rtoDeadline_ = 0;
+	localFlushedSn_ = localSettledSn_;
+	timedSn_.reset();
+	dupAcks_ = 0;
+	inRecovery_ = false;
+	retransmitPending_ = false;
+	// The remote side may discard SACKed data (RFC 2018, section 8).
+	sackedBlocks_.clear();
+}
+
+void Tcp4Socket::sampleRtt_(uint64_t rtt) {
+	// RFC 6298, 2.2 and 2.3.
+	if(!srtt_) {
+		srtt_ = rtt;
+		rttvar_ = rtt / 2;
+	}else{
+		uint64_t delta = (srtt_ > rtt) ? srtt_ - rtt : rtt - srtt_;
+		rttvar_ = (3 * rttvar_ + delta) / 4;
+		srtt_ = (7 * srtt_ + rtt) / 8;
+	}
+	rto_ = std::clamp(srtt_ + std::max(clockGranularity, 4 * rttvar_), minRto, maxRto);
+}
+
+void Tcp4Socket::handleAck_(uint32_t ackNumber, size_t window, bool isPureAck,
+		const TcpOptions &options) {
+	auto now = currentTime();
+
+	size_t validWindow = localMaxSn_ - localSettledSn_;
+	size_t ackPointer = ackNumber - localSettledSn_;
+	if(ackPointer > validWindow) {
+		std::cout << "netserver: Rejecting ack-number outside of valid window"
+				<< std::endl;
+		return;
+	}
+
+	if(!ackPointer) {
+		if(sackEnabled_)
+			updateScoreboard_(options);
+
+		if(localWindowSn_ != localSettledSn_ + window) {
+			localWindowSn_ = localSettledSn_ + window;
+			flushEvent_.raise();
+		}else if(isPureAck && validWindow) {
+			// Duplicate ACK as defined by RFC 5681, section 2.
+			handleDuplicateAck_(now);
+		}
+		return;
+	}
+
+	if(tsEnabled_ && options.hasTimestamp && options.tsEcr) {
+		// Timestamps allow us to measure the RTT even for retransmitted data (RFC 7323, 4).
+		uint64_t rtt = static_cast<uint32_t>(timestampClock(now) - options.tsEcr);
+		sampleRtt_(rtt * 1'000'000);
+		timedSn_.reset();
+	}else if(timedSn_ && !snBefore(ackNumber, *timedSn_)) {
+		sampleRtt_(now - timedAt_);
+		timedSn_.reset();
+	}
+
+	localSettledSn_ += ackPointer;
+	localWindowSn_ = localSettledSn_ + window;
+	// After a timeout, the ACK may cover data that we did not resend yet.
+	if(snBefore(localFlushedSn_, localSettledSn_))
+		localFlushedSn_ = localSettledSn_;
+	sendRing_.dequeueAdvance(ackPointer);
+
+	// Drop SACK information that is covered by the cumulative ACK.
+	while(!sackedBlocks_.empty() && !snBefore(localSettledSn_, sackedBlocks_.front().right))
+		sackedBlocks_.erase(sackedBlocks_.begin());
+	if(!sackedBlocks_.empty() && snBefore(sackedBlocks_.front().left, localSettledSn_))
+		sackedBlocks_.front().left = localSettledSn_;
+	if(sackEnabled_)
+		updateScoreboard_(options);
+
+	size_t flightSize = localMaxSn_ - localSettledSn_;
+	if(inRecovery_) {
+		auto mss = cc_->mss();
+		if(!snBefore(localSettledSn_, recoverSn_)) {
+			// Full acknowledgement (RFC 6582, 3.2, step 3).
+			cc_->setCwnd(std::min(cc_->ssthresh(), std::max(flightSize, mss) + mss));
+			inRecovery_ = false;
+		}else{
+			// Partial acknowledgement: the next segment was lost, too.
+			// Deflate the window by the amount of acknowledged data.
+			auto cwnd = cc_->cwnd();
+			cwnd = (cwnd > ackPointer) ? cwnd - ackPointer : 0;
+			if(ackPointer >= mss)
+				cwnd += mss;
+			cc_->setCwnd(cwnd);
+			retransmitPending_ = true;
+		}
+	}else{
+		cc_->onAck(ackPointer, now, srtt_);
+	}
+	dupAcks_ = 0;
+	tuneSendBuffer_();
+
+	// Restart the timer if data is still outstanding (RFC 6298, 5.2 and 5.3).
+	rtoDeadline_ = flightSize ? now + rto_ : 0;
+
+	outSeq_ = ++currentSeq_;
+	settleEvent_.raise();
+	pollEvent_.raise();
+	flushEvent_.raise();
+}
+
+void Tcp4Socket::handleDuplicateAck_(uint64_t now) {
+	if(inRecovery_) {
+		// Each duplicate ACK signals that a segment has left the network.
+		cc_->setCwnd(cc_->cwnd() + cc_->mss());
+		// With SACK, we also know which holes remain to be filled.
+		auto sn = nextHole_();
+		if(sackEnabled_ && holeEnd_(sn) != localMaxSn_)
+			retransmitPending_ = true;
+		flushEvent_.raise();
+		return;
+	}
+
+	if(++dupAcks_ < 3)
+		return;
+
+	// Fast retransmit and enter fast recovery (RFC 5681, 3.2).
+	if(debugTcp)
+		std::cout << "netserver: TCP fast retransmit" << std::endl;
+	cc_->onCongestion(localMaxSn_ - localSettledSn_, now);
+	cc_->setCwnd(cc_->ssthresh() + 3 * cc_->mss());
+	inRecovery_ = true;
+	recoverSn_ = localMaxSn_;
+	retransmitPending_ = true;
+	holeSn_ = localSettledSn_;
+	flushEvent_.raise();
+}
+
+std::vector<char> Tcp4Socket::buildOptions_(bool isSyn, uint64_t now) {
+	std::vector<char> options;
+	auto push8 = [&] (uint8_t v) {
+		options.push_back(static_cast<char>(v));
+	};
+	auto pushOption = [&] (TcpOption kind, uint8_t length) {
+		push8(static_cast<uint8_t>(kind));
+		push8(length);
+	};
+	auto push16 = [&] (uint16_t v) {
+		push8(v >> 8);
+		push8(v);
+	};
+	auto push32 = [&] (uint32_t v) {
+		push16(v >> 16);
+		push16(v);
+	};
+
+	if(isSyn) {
+		// We always offer all options; the SYN-ACK determines which ones are used.
+		return buildSynOptions_(rcvWscale_, true, {{timestampClock(now), 0}});
+	}
+
+	size_t maxBlocks = 4;
+	if(tsEnabled_) {
+		push8(static_cast<uint8_t>(TcpOption::nop));
+		push8(static_cast<uint8_t>(TcpOption::nop));
+		pushOption(TcpOption::timestamp, 10);
+		push32(timestampClock(now));
+		push32(tsRecent_);
+		maxBlocks = 3;
+	}
+
+	if(sackEnabled_ && !receivedBlocks_.empty()) {
+		auto n = std::min(receivedBlocks_.size(), maxBlocks);
+		push8(static_cast<uint8_t>(TcpOption::nop));
+		push8(static_cast<uint8_t>(TcpOption::nop));
+		pushOption(TcpOption::sack, 2 + 8 * n);
+		for(size_t i = 0; i < n; i++) {
+			push32(receivedBlocks_[i].left);
+			push32(receivedBlocks_[i].right);
+		}
+	}
+	return options;
+}
+
+std::vector<char> Tcp4Socket::buildSynOptions_(std::optional<int> wscale, bool sackPermitted,
+		std::optional<std::pair<uint32_t, uint32_t>> timestamp) {
+	std::vector<char> options;
+	auto push8 = [&] (uint8_t v) {
+		options.push_back(static_cast<char>(v));
+	};
+	auto pushOption = [&] (TcpOption kind, uint8_t length) {
+		push8(static_cast<uint8_t>(kind));
+		push8(length);
+	};
+	auto push16 = [&] (uint16_t v) {
+		push8(v >> 8);
+		push8(v);
+	};
+	auto push32 = [&] (uint32_t v) {
+		push16(v >> 16);
+		push16(v);
+	};
+
+	pushOption(TcpOption::maxSegmentSize, 4);
+	push16(maxSegmentSize);
+	if(sackPermitted) {
+		if(!timestamp) {
+			push8(static_cast<uint8_t>(TcpOption::nop));
+			push8(static_cast<uint8_t>(TcpOption::nop));
+		}
+		pushOption(TcpOption::sackPermitted, 2);
+	}
+	if(timestamp) {
+		if(!sackPermitted) {
+			push8(static_cast<uint8_t>(TcpOption::nop));
+			push8(static_cast<uint8_t>(TcpOption::nop));
+		}
+		pushOption(TcpOption::timestamp, 10);
+		push32(timestamp->first);
+		push32(timestamp->second);
+	}
+	if(wscale) {
+		push8(static_cast<uint8_t>(TcpOption::nop));
+		pushOption(TcpOption::windowScale, 3);
+		push8(*wscale);
+	}
+	return options;
+}
+
+bool Tcp4Socket::addReceivedBlock_(uint32_t left, uint32_t right) {
+	// Merge with overlapping or adjacent ranges.
+	for(auto it = receivedBlocks_.begin(); it != receivedBlocks_.end(); ) {
+		if(snBefore(right, it->left) || snBefore(it->right, left)) {
+			++it;
+			continue;
+		}
+		if(snBefore(it->left, left))
+			left = it->left;
+		if(snBefore(right, it->right))
+			right = it->right;
+		it = receivedBlocks_.erase(it);
+	}
+
+	if(receivedBlocks_.size() == maxReceivedBlocks)
+		return false;
+	receivedBlocks_.insert(receivedBlocks_.begin(), {left, right});
+	return true;
+}
+
+size_t Tcp4Socket::mergeReceivedBlocks_() {
+	size_t progress = 0;
+	auto it = receivedBlocks_.begin();
+	while(it != receivedBlocks_.end()) {
+		if(snBefore(remoteKnownSn_, it->left)) {
+			++it;
+			continue;
+		}
+
+		if(snBefore(remoteKnownSn_, it->right)) {
+			size_t chunk = it->right - remoteKnownSn_;
+			recvRing_.enqueueAdvance(chunk);
+			remoteKnownSn_ = it->right;
+			progress += chunk;
+		}
+		receivedBlocks_.erase(it);
+		// Advancing may have made other ranges contiguous.
+		it = receivedBlocks_.begin();
+	}
+	return progress;
+}
+
+void Tcp4Socket::updateScoreboard_(const TcpOptions &options) {
+	for(size_t i = 0; i < options.numSackBlocks; i++) {
+		auto [left, right] = options.sackBlocks[i];
+		// Ignore blocks outside of the data in flight (this includes D-SACKs, RFC 2883).
+		if(!snBefore(localSettledSn_, left) || snBefore(localMaxSn_, right)
+				|| !snBefore(left, right))
+			continue;
+
+		auto it = sackedBlocks_.begin();
+		while(it != sackedBlocks_.end() && snBefore(it->right, left))
+			++it;
+		while(it != sackedBlocks_.end() && !snBefore(right, it->left)) {
+			if(snBefore(it->left, left))
+				left = it->left;
+			if(snBefore(right, it->right))
+				right = it->right;
+			it = sackedBlocks_.erase(it);
+		}
+		sackedBlocks_.insert(it, {left, right});
+	}
+}
+
+uint32_t Tcp4Socket::skipSacked_(uint32_t sn) {
+	for(auto &block : sackedBlocks_) {
+		if(snBefore(sn, block.left))
+			break;
+		if(snBefore(sn, block.right))
+			sn = block.right;
+	}
+	return sn;
+}
+
+uint32_t Tcp4Socket::holeEnd_(uint32_t sn) {
+	for(auto &block : sackedBlocks_) {
+		if(snBefore(sn, block.left))
+			return block.left;
+	}
+	return localMaxSn_;
+}
+
+void Tcp4Socket::readLookahead_(char *p, size_t size) {
+	size_t chunk = std::min(size, recvRing_.availableToDequeue());
+	recvRing_.dequeueLookahead(0, p, chunk);
+	p += chunk;
+	size -= chunk;
+
+	for(auto it = parkedSegments_.begin(); size; ++it) {
+		assert(it != parkedSegments_.end());
+		chunk = std::min(size, it->data.size());
+		memcpy(p, it->data.data(), chunk);
+		p += chunk;
+		size -= chunk;
+	}
+}
+
+void Tcp4Socket::readAdvance_(size_t size) {
+	size_t chunk = std::min(size, recvRing_.availableToDequeue());
+	recvRing_.dequeueAdvance(chunk);
+	size -= chunk;
+
+	// Dropping the packet returns its buffer to the link's frame pool.
+	while(size) {
+		assert(!parkedSegments_.empty());
+		auto &front = parkedSegments_.front();
+		chunk = std::min(size, front.data.size());
+		front.data = front.data.subview(chunk);
+		parkedBytes_ -= chunk;
+		size -= chunk;
+		if(!front.data.size())
+			parkedSegments_.pop_front();
+	}
+}
+
+void Tcp4Socket::unparkSegments_() {
+	for(auto &segment : parkedSegments_)
+		recvRing_.enqueue(segment.data.data(), segment.data.size());
+	parkedSegments_.clear();
+	parkedBytes_ = 0;
+}
+
+void Tcp4Socket::tuneReceiveBuffer_(uint64_t now, size_t bytes) {
+	if(userRcvBuf_ || !srtt_)
+		return;
+
+	rcvTuneBytes_ += bytes;
+	if(now - rcvTuneStart_ < srtt_)
+		return;
+
+	// If the remote side filled more than half of the buffer within one RTT,
+	// the window is likely to limit the throughput.
+	if(2 * rcvTuneBytes_ > recvRing_.capacity() && recvRing_.shift() < maxBufferShift) {
+		recvRing_.resize(recvRing_.shift() + 1);
+		if(debugTcp)
+			std::cout << "netserver: Growing TCP receive buffer to "
+					<< recvRing_.capacity() << " bytes" << std::endl;
+	}
+	rcvTuneBytes_ = 0;
+	rcvTuneStart_ = now;
+}
+
+void Tcp4Socket::tuneSendBuffer_() {
+	if(userSndBuf_)
+		return;
+
+	// Buffer enough data to keep the pipe full while ACKs are in flight.
+	size_t target = 2 * std::min(cc_->cwnd(), size_t{localWindowSn_ - localSettledSn_});
+	int shift = sendRing_.shift();
+	while(shift < maxBufferShift && (size_t{1} << shift) < target)
+		shift++;
+	if(shift != sendRing_.shift()) {
+		sendRing_.resize(shift);
+		if(debugTcp)
+			std::cout << "netserver: Growing TCP send buffer to "
+					<< sendRing_.capacity() << " bytes" << std::endl;
+	}
+}
+
 void Tcp4Socket::handleInPacket_(TcpPacket packet) {
 	if(boundInterface_ && boundInterface_->index() != packet.packet->link.lock()->index())
 		return;
 
+	if(connectState_ == ConnectState::listen) {
+		handleListenPacket_(std::move(packet));
+		return;
+	}
+
+	auto &options = packet.options;
+
 	if(connectState_ == ConnectState::sendSyn) {
 		if(localSettledSn_ == localFlushedSn_) {
 			std::cout << "netserver: Rejecting packet before SYN is sent [sendSyn]"
@@ -780,6 +1756,26 @@ void Tcp4Socket::handleInPacket_(TcpPacket packet) {
 			return;
 		}
 
+		auto now = currentTime();
+		if(timedSn_) {
+			sampleRtt_(now - timedAt_);
+			timedSn_.reset();
+		}
+		rtoDeadline_ = 0;
+
+		// Window scaling is only used if both sides send the option (RFC 7323, 2.2).
+		if(options.windowScale) {
+			sndWscale_ = std::min(int{*options.windowScale}, 14);
+		}else{
+			sndWscale_ = 0;
+			rcvWscale_ = 0;
+		}
+		sackEnabled_ = options.sackPermitted;
+		tsEnabled_ = options.hasTimestamp;
+		if(tsEnabled_)
+			tsRecent_ = options.tsVal;
+		rcvTuneStart_ = now;
+
 		++localSettledSn_;
 		localWindowSn_ = localSettledSn_ + packet.header.window.load();
 		remoteAckedSn_ = packet.header.seqNumber.load();
@@ -788,25 +1784,60 @@ void Tcp4Socket::handleInPacket_(TcpPacket packet) {
 		flushEvent_.raise();
 		settleEvent_.raise();
 	}else if(connectState_ == ConnectState::connected) {
-		if(packet.header.seqNumber.load() == remoteKnownSn_) {
+		auto payload = packet.payload();
+		bool isFin = packet.header.flags.load() & TcpHeader::finFlag;
+		uint32_t seqNumber = packet.header.seqNumber.load();
+
+		if(tsEnabled_ && options.hasTimestamp) {
+			// Protection against wrapped sequence numbers (RFC 7323, 5.3).
+			if(static_cast<int32_t>(options.tsVal - tsRecent_) < 0) {
+				if(payload.size() || isFin) {
+					forceAck_ = true;
+					flushEvent_.raise();
+				}
+				return;
+			}
+			if(!snBefore(remoteAckedSn_, seqNumber))
+				tsRecent_ = options.tsVal;
+		}
+
+		if(!snBefore(remoteKnownSn_, seqNumber)
+				&& size_t{remoteKnownSn_ - seqNumber} <= payload.size()) {
+			// The segment continues the data that we received so far.
+			// Skip the part that we already have (e.g., after a go-back-N retransmission).
+			auto data = payload.subview(remoteKnownSn_ - seqNumber);
 			bool gotUpdate = false;
 
-			auto payload = packet.payload();
-			size_t chunk = std::min(payload.size(), recvRing_.spaceForEnqueue());
+			size_t chunk = std::min(data.size(), receiveSpace_());
 			if(chunk) {
-				recvRing_.enqueue(payload.data(), chunk);
+				if(receivedBlocks_.empty() && parkedSegments_.size() < maxParkedSegments) {
+					parkedSegments_.push_back({packet.packet, data.subview(0, chunk)});
+					parkedBytes_ += chunk;
+				}else{
+					unparkSegments_();
+					recvRing_.enqueue(data.data(), chunk);
+				}
 				remoteKnownSn_ += chunk;
-				if(announcedWindow_ < chunk) {
+
+				size_t progress = chunk;
+				if(isFin && chunk == data.size()) {
+					// Data behind the FIN cannot be valid.
+					receivedBlocks_.clear();
+				}else{
+					progress += mergeReceivedBlocks_();
+				}
+				if(announcedWindow_ < progress) {
 					announcedWindow_ = 0;
 				}else{
-					announcedWindow_ -= chunk;
+					announcedWindow_ -= progress;
 				}
+				tuneReceiveBuffer_(currentTime(), progress);
 
 				inSeq_ = ++currentSeq_;
 				gotUpdate = true;
 			}
 
-			if(packet.header.flags.load() & TcpHeader::finFlag) {
+			if(isFin && chunk == data.size()) {
 				++remoteKnownSn_; // FIN counts as one byte.
 				remoteClosed_ = true;
 
@@ -819,24 +1850,265 @@ void Tcp4Socket::handleInPacket_(TcpPacket packet) {
 				flushEvent_.raise();
 				pollEvent_.raise();
 			}
+		}else if(payload.size() || isFin) {
+			// Keep out-of-order data in the receive buffer. It is reported via SACK
+			// and becomes readable once the hole before it is filled.
+			if(snBefore(remoteKnownSn_, seqNumber)) {
+				unparkSegments_();
+				size_t offset = seqNumber - remoteKnownSn_;
+				size_t space = recvRing_.spaceForEnqueue();
+				if(offset < space) {
+					size_t chunk = std::min(payload.size(), space - offset);
+					if(chunk && addReceivedBlock_(seqNumber, seqNumber + chunk))
+						recvRing_.enqueueAt(offset, payload.data(), chunk);
+				}
+			}
+
+			// Acknowledge out-of-order segments immediately such that the remote side
+			// can detect the loss via duplicate ACKs (RFC 5681, 4.2).
+			forceAck_ = true;
+			flushEvent_.raise();
 		}
 
 		if(packet.header.flags.load() & TcpHeader::ackFlag) {
-			size_t validWindow = localFlushedSn_ - localSettledSn_;
-			size_t ackPointer = packet.header.ackNumber.load() - localSettledSn_;
-			if(ackPointer <= validWindow) {
-				localSettledSn_ += ackPointer;
-				localWindowSn_ = localSettledSn_ + packet.header.window.load();
-				sendRing_.dequeueAdvance(ackPointer);
-				outSeq_ = ++currentSeq_;
-				settleEvent_.raise();
-				pollEvent_.raise();
+			bool isPureAck = !payload.size() && !isFin
+					&& !(packet.header.flags.load() & TcpHeader::synFlag);
+			handleAck_(packet.header.ackNumber.load(),
+					size_t{packet.header.window.load()} << sndWscale_, isPureAck, options);
+		}
+	}
+}
+
+async::result<void> Tcp4Socket::serveSynQueue_() {
+	auto now = currentTime();
+	uint64_t deadline = 0;
+	std::vector<std::pair<TcpConnection, SynRequest>> expired;
+	for(auto it = synQueue_.begin(); it != synQueue_.end(); ) {
+		auto &request = it->second;
+		if(now >= request.deadline) {
+			if(request.retries == maxSynAckRetries) {
+				it = synQueue_.erase(it);
+				continue;
+			}
+			// Back off like the retransmission timer of established connections.
+			request.retries++;
+			request.deadline = now + std::min(initialRto << request.retries, maxRto);
+			expired.push_back(*it);
+		}
+		if(!deadline || request.deadline < deadline)
+			deadline = request.deadline;
+		++it;
+	}
+
+	for(auto &[connection, request] : expired)
+		co_await sendSynAck_(connection, request, timestampClock(now));
+
+	co_await waitForFlush_(deadline);
+}
+
+async::result<void> Tcp4Socket::sendSynAck_(TcpConnection connection, SynRequest request,
+		uint32_t tsVal) {
+	auto targetInfo = co_await ip4().targetByRemote(connection.remote.ipAddress, boundInterface_);
+	if(!targetInfo) {
+		std::cout << "netserver: Destination unreachable" << std::endl;
+		co_return;
+	}
+	// Listeners may be bound to INADDR_ANY; answer from the address that the SYN was sent to.
+	targetInfo->source = connection.local.ipAddress;
+
+	std::optional<int> wscale;
+	if(request.sndWscale)
+		wscale = announcedWscale_();
+	std::optional<std::pair<uint32_t, uint32_t>> timestamp;
+	if(request.tsEnabled)
+		timestamp = {tsVal, request.tsRecent};
+	auto options = buildSynOptions_(wscale, request.sackEnabled, timestamp);
+
+	std::vector<char> buf;
+	buf.resize(sizeof(TcpHeader) + options.size());
+
+	// The window of SYN segments is never scaled.
+	auto window = std::min(receiveSpace_(), size_t{0xFFFF});
+	auto header = new (buf.data()) TcpHeader {
+		.srcPort = connection.local.port,
+		.destPort = connection.remote.port,
+		.seqNumber = request.localIsn,
+		.ackNumber = request.remoteIsn + 1, // SYN counts as one byte.
+		.flags = {},
+		.window = window,
+		.checksum = 0,
+		.urgentPointer = 0,
+	};
+	header->flags.store(TcpHeader::headerWords(buf.size() / 4)
+			| TcpHeader::synFlag(true) | TcpHeader::ackFlag(true));
+	memcpy(buf.data() + sizeof(TcpHeader), options.data(), options.size());
+
+	if(debugTcp)
+		std::cout << "netserver: Sending TCP SYN-ACK" << std::endl;
+	auto error = co_await ip4().sendFrame(std::move(*targetInfo),
+		buf.data(), buf.size(), static_cast<uint16_t>(IpProto::tcp),
+		checksumOffload);
+	if (error != protocols::fs::Error::none)
+		std::cout << "netserver: Could not send TCP packet" << std::endl;
+}
+
+void Tcp4Socket::handleListenPacket_(TcpPacket packet) {
+	auto flags = packet.header.flags.load();
+	auto &options = packet.options;
+	auto now = currentTime();
+	TcpConnection connection{
+		{packet.packet->header.destination, packet.header.destPort.load()},
+		{packet.packet->header.source, packet.header.srcPort.load()}
+	};
+
+	if(flags & TcpHeader::rstFlag) {
+		synQueue_.erase(connection);
+		return;
+	}
+
+	if(flags & TcpHeader::synFlag) {
+		if(flags & TcpHeader::ackFlag)
+			return;
+		// While the accept queue is full, SYNs are dropped and retransmitted by the remote side.
+		if(acceptQueue_.size() >= defaultBacklog)
+			return;
+
+		uint32_t remoteIsn = packet.header.seqNumber.load();
+		if(auto it = synQueue_.find(connection); it != synQueue_.end()) {
+			// Our SYN-ACK was lost; repeat it.
+			if(it->second.remoteIsn == remoteIsn)
+				async::detach(sendSynAck_(connection, it->second, timestampClock(now)));
+			return;
+		}
+
+		SynRequest request{
+			.localIsn = 0,
+			.remoteIsn = remoteIsn,
+			.sndWscale = std::nullopt,
+			.sackEnabled = options.sackPermitted,
+			.tsEnabled = options.hasTimestamp,
+			.tsRecent = options.tsVal,
+			.sentAt = now,
+			.deadline = now + initialRto,
+			.retries = 0,
+		};
+		// Window scaling is only used if both sides send the option (RFC 7323, 2.2).
+		if(options.windowScale)
+			request.sndWscale = std::min(*options.windowScale, uint8_t{14});
+		auto tsVal = timestampClock(now);
+
+		if(synQueue_.size() < defaultBacklog) {
+			request.localIsn = globalPrng();
+			synQueue_.emplace(connection, request);
+			flushEvent_.raise();
+		}else{
+			// The SYN queue overflowed (e.g., due to a SYN flood); do not keep any state.
+			// The remote side echoes our TSval, hence its low bits can carry the options.
+			if(debugTcp)
+				std::cout << "netserver: Sending TCP SYN cookie" << std::endl;
+			request.localIsn = parent_->synCookie(connection, remoteIsn, now);
+			request.sentAt = 0;
+			if(request.tsEnabled) {
+				tsVal = (tsVal & ~uint32_t{0x1F}) | (request.sackEnabled << 4)
+						| request.sndWscale.value_or(0xF);
 			}else{
-				std::cout << "netserver: Rejecting ack-number outside of valid window"
-						<< std::endl;
+				request.sndWscale.reset();
+				request.sackEnabled = false;
 			}
 		}
+		async::detach(sendSynAck_(connection, request, tsVal));
+		return;
 	}
+
+	if(!(flags & TcpHeader::ackFlag))
+		return;
+	// Keep the half-open connection; the remote side retransmits the ACK (or its data).
+	if(acceptQueue_.size() >= defaultBacklog)
+		return;
+
+	uint32_t remoteIsn = packet.header.seqNumber.load() - 1;
+	uint32_t localIsn = packet.header.ackNumber.load() - 1;
+	if(auto it = synQueue_.find(connection); it != synQueue_.end()) {
+		if(it->second.localIsn != localIsn || it->second.remoteIsn != remoteIsn)
+			return;
+		auto request = it->second;
+		synQueue_.erase(it);
+		establish_(connection, request, std::move(packet));
+		return;
+	}
+
+	if(!parent_->checkSynCookie(connection, remoteIsn, localIsn, now))
+		return;
+
+	SynRequest request{
+		.localIsn = localIsn,
+		.remoteIsn = remoteIsn,
+		.sndWscale = std::nullopt,
+		.sackEnabled = false,
+		.tsEnabled = options.hasTimestamp,
+		.tsRecent = options.tsVal,
+		.sentAt = 0,
+		.deadline = 0,
+		.retries = 0,
+	};
+	if(request.tsEnabled) {
+		auto bits = options.tsEcr & 0x1F;
+		if((bits & 0xF) <= 14)
+			request.sndWscale = bits & 0xF;
+		request.sackEnabled = bits & 0x10;
+	}
+	establish_(connection, request, std::move(packet));
+}
+
+void Tcp4Socket::establish_(const TcpConnection &connection, const SynRequest &request,
+		TcpPacket packet) {
+	auto now = currentTime();
+
+	auto child = makeSocket(parent_, false);
+	child->localEp_ = connection.local;
+	child->remoteEp_ = connection.remote;
+	child->boundInterface_ = boundInterface_;
+	child->cc_ = makeCongestionControl(cc_->name(), maxSegmentSize);
+	if(userRcvBuf_) {
+		child->recvRing_.resize(recvRing_.shift());
+		child->userRcvBuf_ = true;
+	}
+	if(userSndBuf_) {
+		child->sendRing_.resize(sendRing_.shift());
+		child->userSndBuf_ = true;
+	}
+
+	child->sndWscale_ = request.sndWscale.value_or(0);
+	child->rcvWscale_ = request.sndWscale ? announcedWscale_() : 0;
+	child->sackEnabled_ = request.sackEnabled;
+	child->tsEnabled_ = request.tsEnabled;
+	child->tsRecent_ = request.tsRecent;
+	// Karn's algorithm: only time SYN-ACKs that were not retransmitted.
+	if(request.sentAt && !request.retries)
+		child->sampleRtt_(now - request.sentAt);
+	child->rcvTuneStart_ = now;
+
+	child->localSettledSn_ = request.localIsn + 1; // SYN counts as one byte.
+	child->localFlushedSn_ = child->localSettledSn_;
+	child->localMaxSn_ = child->localSettledSn_;
+	child->localWindowSn_ = child->localSettledSn_
+			+ (size_t{packet.header.window.load()} << child->sndWscale_);
+	child->remoteAckedSn_ = request.remoteIsn + 1;
+	child->remoteKnownSn_ = request.remoteIsn + 1;
+	child->announcedWindow_ = std::min(receiveSpace_(), size_t{0xFFFF});
+	child->connectState_ = ConnectState::connected;
+
+	if(debugTcp)
+		std::cout << "netserver: Accepted TCP connection from port "
+				<< connection.remote.port << std::endl;
+	parent_->connections_.emplace(connection, child);
+	acceptQueue_.push_back(child);
+	inSeq_ = ++currentSeq_;
+	inEvent_.raise();
+	pollEvent_.raise();
+
+	// The ACK that completes the handshake may already carry data.
+	child->handleInPacket_(std::move(packet));
 }
 
 void Tcp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet) {
@@ -850,33 +2122,84 @@ void Tcp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet) {
 		std::cout << "netserver: Received TCP packet at port " << tcp.header.destPort.load()
 				<< " (" << tcp.payload().size() << " bytes)" << std::endl;
 
-	auto it = binds.lower_bound({ 0, tcp.header.destPort.load() });
-	for (; it != binds.end() && it->first.port == tcp.header.destPort.load(); it++) {
-		auto existingEp = it->first;
-		if (existingEp.ipAddress == tcp.packet->header.destination
-				|| existingEp.ipAddress == INADDR_ANY) {
-			it->second->handleInPacket_(std::move(tcp));
-			break;
-		}
+	auto port = tcp.header.destPort.load();
+	TcpConnection connection{
+		{ tcp.packet->header.destination, port },
+		{ tcp.packet->header.source, tcp.header.srcPort.load() }
+	};
+	if (auto conn = connections_.find(connection); conn != connections_.end()) {
+		conn->second->handleInPacket_(std::move(tcp));
+		return;
 	}
+
+	auto it = binds.find(connection.local);
+	if (it == binds.end())
+		it = binds.find({ INADDR_ANY, port });
+	if (it == binds.end())
+		return;
+
+	selectSocket_(it->second, connection)->handleInPacket_(std::move(tcp));
+}
+
+Tcp4Socket *Tcp4::selectSocket_(std::vector<smarter::shared_ptr<Tcp4Socket>> &group,
+		const TcpConnection &connection) {
+	if (group.size() == 1)
+		return group.front().get();
+
+	// Connecting sockets only receive packets from their remote endpoint.
+	size_t listeners = 0;
+	for (auto &socket : group) {
+		if (socket->connectState_ == Tcp4Socket::ConnectState::listen)
+			listeners++;
+		else if (socket->connectState_ != Tcp4Socket::ConnectState::none
+				&& socket->remoteEp_ == connection.remote)
+			return socket.get();
+	}
+	if (!listeners)
+		return group.front().get();
+
+	// Spread connections across the listeners of the SO_REUSEPORT group. The choice only
+	// depends on the connection, such that the handshake completes at the same listener.
+	auto n = TcpConnection::Hash{}(connection) % listeners;
+	for (auto &socket : group) {
+		if (socket->connectState_ == Tcp4Socket::ConnectState::listen && !n--)
+			return socket.get();
+	}
+	return group.front().get();
 }
 
 bool Tcp4::tryBind(smarter::shared_ptr<Tcp4Socket> socket, TcpEndpoint wantedEp) {
-	auto it = binds.lower_bound(wantedEp);
-	for (; it != binds.end() && it->first.port == wantedEp.port; it++) {
-		auto existingEp = it->first;
-		if (existingEp.ipAddress == INADDR_ANY || wantedEp.ipAddress == INADDR_ANY
-				|| existingEp.ipAddress == wantedEp.ipAddress) {
+	auto group = binds.find(wantedEp);
+	if (portBinds_.contains(wantedEp.port)) {
+		// Sockets may share an endpoint if all of them set SO_REUSEPORT.
+		bool shared = socket->reusePort_ && group != binds.end()
+				&& std::ranges::all_of(group->second, [] (auto &s) { return s->reusePort_; });
+		if (!shared && (wantedEp.ipAddress == INADDR_ANY
+				|| binds.contains({ INADDR_ANY, wantedEp.port })
+				|| group != binds.end()))
 			return false;
-		}
 	}
 	socket->localEp_ = wantedEp;
-	binds.emplace(wantedEp, std::move(socket));
+	binds[wantedEp].push_back(std::move(socket));
+	portBinds_[wantedEp.port]++;
 	return true;
 }
 
-bool Tcp4::unbind(TcpEndpoint e) {
-	return binds.erase(e) != 0;
+bool Tcp4::unbind(TcpEndpoint e, Tcp4Socket *socket) {
+	auto group = binds.find(e);
+	if (group == binds.end())
+		return false;
+	auto it = std::ranges::find_if(group->second, [&] (auto &s) { return s.get() == socket; });
+	if (it == group->second.end())
+		return false;
+	group->second.erase(it);
+	if (group->second.empty())
+		binds.erase(group);
+
+	auto users = portBinds_.find(e.port);
+	if (!--users->second)
+		portBinds_.erase(users);
+	return true;
 }
 
 void Tcp4::serveSocket(int flags, helix::UniqueLane lane) {
@@ -885,3 +2208,38 @@ void Tcp4::serveSocket(int flags, helix::UniqueLane lane) {
 	async::detach(servePassthrough(std::move(lane), std::move(sock),
 			&Tcp4Socket::ops));
 }
+
+uint32_t Tcp4::hashCookie_(const TcpConnection &connection, uint32_t remoteIsn, uint32_t count) {
+	if (!cookieSecret_) {
+		std::array<uint64_t, 2> secret;
+		size_t actualSize;
+		HEL_CHECK(helGetRandomBytes(secret.data(), sizeof(secret), &actualSize));
+		assert(actualSize == sizeof(secret));
+		cookieSecret_ = secret;
+	}
+
+	std::array<uint64_t, 3> words{
+		(uint64_t{connection.local.ipAddress} << 32) | connection.remote.ipAddress,
+		(uint64_t{count} << 32) | (uint64_t{connection.local.port} << 16) | connection.remote.port,
+		remoteIsn
+	};
+	return sipHash(*cookieSecret_, words);
+}
+
+// The top 5 bits of the cookie hold a counter that advances once per cookiePeriod,
+// the remaining bits authenticate the connection, the remote ISN and the counter.
+uint32_t Tcp4::synCookie(const TcpConnection &connection, uint32_t remoteIsn, uint64_t now) {
+	uint32_t count = (now / cookiePeriod) & 0x1F;
+	return (count << 27) | (hashCookie_(connection, remoteIsn, count) & 0x07FF'FFFF);
+}
+
+bool Tcp4::checkSynCookie(const TcpConnection &connection, uint32_t remoteIsn, uint32_t cookie,
+		uint64_t now) {
+	uint64_t current = now / cookiePeriod;
+	for (uint64_t age = 0; age < 2 && age <= current; age++) {
+		uint32_t count = (current - age) & 0x1F;
+		if (cookie == ((count << 27) | (hashCookie_(connection, remoteIsn, count) & 0x07FF'FFFF)))
+			return true;
+	}
+	return false;
+}
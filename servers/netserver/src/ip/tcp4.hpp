@@ -1,28 +1,75 @@
 #pragma once
 
+#include <array>
 #include <helix/ipc.hpp>
+#include <optional>
 #include <smarter.hpp>
-#include <map>
+#include <unordered_map>
+#include <vector>
 
 class Ip4Packet;
 
 struct TcpEndpoint {
-	friend bool operator<(const TcpEndpoint &l, const TcpEndpoint &r) {
-		return std::tie(l.port, l.ipAddress) < std::tie(r.port, r.ipAddress);
-	}
+	friend bool operator==(const TcpEndpoint &, const TcpEndpoint &) = default;
+
+	struct Hash {
+		size_t operator()(const TcpEndpoint &e) const {
+			return std::hash<uint64_t>{}((uint64_t{e.ipAddress} << 16) | e.port);
+		}
+	};
 
 	uint32_t ipAddress = 0;
 	uint16_t port = 0;
 };
 
+// Identifies a connection by its local and remote endpoints.
+struct TcpConnection {
+	friend bool operator==(const TcpConnection &, const TcpConnection &) = default;
+
+	struct Hash {
+		size_t operator()(const TcpConnection &c) const {
+			TcpEndpoint::Hash hash;
+			return hash(c.local) * 31 + hash(c.remote);
+		}
+	};
+
+	TcpEndpoint local;
+	TcpEndpoint remote;
+};
+
 struct Tcp4Socket;
 
 struct Tcp4 {
 	void feedDatagram(smarter::shared_ptr<const Ip4Packet>);
 	bool tryBind(smarter::shared_ptr<Tcp4Socket> socket, TcpEndpoint ipAddress);
-	bool unbind(TcpEndpoint remote);
+	bool unbind(TcpEndpoint local, Tcp4Socket *socket);
 	void serveSocket(int flags, helix::UniqueLane lane);
 
+	// SYN cookies (RFC 4987) are initial sequence numbers that authenticate the
+	// connection and the remote ISN; they expire after one to two minutes.
+	uint32_t synCookie(const TcpConnection &connection, uint32_t remoteIsn, uint64_t now);
+	bool checkSynCookie(const TcpConnection &connection, uint32_t remoteIsn, uint32_t cookie,
+			uint64_t now);
+
 private:
-	std::map<TcpEndpoint, smarter::shared_ptr<Tcp4Socket>> binds;
+	friend struct Tcp4Socket;
+
+	// Picks the socket of a bind group that receives a packet of the given connection.
+	Tcp4Socket *selectSocket_(std::vector<smarter::shared_ptr<Tcp4Socket>> &group,
+			const TcpConnection &connection);
+
+	uint32_t hashCookie_(const TcpConnection &connection, uint32_t remoteIsn, uint32_t count);
+
+	// Demultiplexing looks up the exact local address first, then INADDR_ANY.
+	// More than one socket only shares an endpoint if all of them set SO_REUSEPORT.
+	std::unordered_map<TcpEndpoint, std::vector<smarter::shared_ptr<Tcp4Socket>>,
+			TcpEndpoint::Hash> binds;
+	// Number of binds per port; a wildcard bind conflicts with all of them.
+	std::unordered_map<uint16_t, size_t> portBinds_;
+	// Connections that were accepted by a listening socket; they share its local endpoint
+	// and take precedence over binds.
+	std::unordered_map<TcpConnection, smarter::shared_ptr<Tcp4Socket>,
+			TcpConnection::Hash> connections_;
+
+	std::optional<std::array<uint64_t, 2>> cookieSecret_;
 };
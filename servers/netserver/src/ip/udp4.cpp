@@ -6,28 +6,19 @@
 #include <async/basic.hpp>
 #include <async/recurring-event.hpp>
 #include <async/result.hpp>
-#include <async/queue.hpp>
 #include <arch/bit.hpp>
 #include <protocols/fs/server.hpp>
 #include <cstring>
+#include <deque>
 #include <iomanip>
 #include <random>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
+#include <netinet/udp.h>
 
 namespace {
-struct stl_allocator {
-	void *allocate(size_t size) {
-		return operator new(size);
-	}
-
-	void deallocate(void *p, size_t) {
-		return operator delete(p);
-	}
-};
-
 template<typename T>
 void maybeFlip(T &x) {
 	x = arch::convert_endian<arch::endian::big, arch::endian::native>(x);
@@ -81,7 +72,7 @@ struct Udp {
 		if (payload.size() < header.len) {
 			return false;
 		}
-		if (header.chk != 0) {
+		if (header.chk != 0 && !packet->checksumVerified) {
 			PseudoHeader phdr;
 			phdr.src = packet->header.source;
 			phdr.dst = packet->header.destination;
@@ -120,11 +111,11 @@ void Endpoint::ensureEndian() {
 }
 
 
-bool operator<(const Endpoint &l, const Endpoint &r) {
-	return std::tie(l.port, l.addr) < std::tie(r.port, r.addr);
-}
-
 namespace {
+// Upper bound for the number of datagrams that are sent or received by a single
+// UDP_SEGMENT send or UDP_GRO receive (like Linux' UDP_MAX_SEGMENTS).
+constexpr size_t maxSegments = 64;
+
 auto checkAddress(const void *addr_ptr, size_t addr_len, Endpoint &e) {
 	struct sockaddr_in addr;
 	if (addr_len < sizeof(addr)) {
@@ -239,23 +230,56 @@ struct Udp4Socket {
 			uint32_t flags, void *data, size_t len,
 			void *addr_buf, size_t addr_size, size_t max_ctrl_len) {
 		(void) creds;
-		(void) flags;
 
 		using arch::convert_endian;
 		using arch::endian;
 
 		auto self = static_cast<Udp4Socket *>(obj);
 
-		auto element = co_await self->queue_.async_get();
-		auto packet = element->payload();
+		while(self->queue_.empty()) {
+			if(flags & MSG_DONTWAIT)
+				co_return Error::wouldBlock;
+			co_await self->_statusBell.async_wait();
+		}
+
+		auto element = std::move(self->queue_.front());
+		self->queue_.pop_front();
+		auto packet = element.payload();
 		auto copy_size = std::min(packet.size(), len);
 		std::memcpy(data, packet.data(), copy_size);
 
+		// With UDP_GRO, append queued datagrams of the same flow and size. Only the last
+		// datagram may be shorter; the reader splits the data using the segment size.
+		size_t segmentSize = packet.size();
+		size_t segments = 1;
+		if(self->gro_ && copy_size == segmentSize && segmentSize) {
+			while(!self->queue_.empty() && segments < maxSegments) {
+				auto &next = self->queue_.front();
+				auto nextPayload = next.payload();
+				if(next.header.src != element.header.src
+						|| next.packet->header.source != element.packet->header.source
+						|| next.packet->header.destination != element.packet->header.destination
+						|| !nextPayload.size() || nextPayload.size() > segmentSize
+						|| nextPayload.size() > len - copy_size)
+					break;
+
+				std::memcpy(static_cast<char *>(data) + copy_size,
+						nextPayload.data(), nextPayload.size());
+				copy_size += nextPayload.size();
+				segments++;
+
+				bool last = nextPayload.size() < segmentSize;
+				self->queue_.pop_front();
+				if(last)
+					break;
+			}
+		}
+
 		sockaddr_in addr {};
 		addr.sin_family = AF_INET;
-		addr.sin_port = convert_endian<endian::big>(element->header.src);
+		addr.sin_port = convert_endian<endian::big>(element.header.src);
 		addr.sin_addr = {
-			convert_endian<endian::big>(element->packet->header.source)
+			convert_endian<endian::big>(element.packet->header.source)
 		};
 
 		std::memset(addr_buf, 0, addr_size);
@@ -267,12 +291,18 @@ struct Udp4Socket {
 			auto truncated = ctrl.message(IPPROTO_IP, IP_PKTINFO, sizeof(struct in_pktinfo));
 			if(!truncated)
 				ctrl.write<struct in_pktinfo>({
-					.ipi_ifindex = element->link.lock()->index(),
-					.ipi_spec_dst = { .s_addr = convert_endian<endian::big>(element->packet->header.destination) },
-					.ipi_addr = { .s_addr = convert_endian<endian::big>(element->packet->header.source) },
+					.ipi_ifindex = element.link.lock()->index(),
+					.ipi_spec_dst = { .s_addr = convert_endian<endian::big>(element.packet->header.destination) },
+					.ipi_addr = { .s_addr = convert_endian<endian::big>(element.packet->header.source) },
 				});
 		}
 
+		if(segments > 1) {
+			auto truncated = ctrl.message(IPPROTO_UDP, UDP_GRO, sizeof(int));
+			if(!truncated)
+				ctrl.write<int>(segmentSize);
+		}
+
 		co_return RecvData{ctrl.buffer(), copy_size, sizeof(addr), 0};
 	}
 
@@ -285,8 +315,6 @@ struct Udp4Socket {
 		(void) flags;
 		(void) fds;
 
-		using arch::convert_endian;
-		using arch::endian;
 		auto self = static_cast<Udp4Socket *>(obj);
 		Endpoint target;
 		auto source = self->local_;
@@ -317,60 +345,47 @@ struct Udp4Socket {
 			co_return protocols::fs::Error::accessDenied;
 		}
 
-		std::vector<char> buf;
-		buf.resize(sizeof(Udp::Header) + len);
-		Udp::Header header {
-			.src = source.port,
-			.dst = target.port,
-			.len = static_cast<uint16_t>(len + sizeof(Udp::Header)),
-			.chk = 0,
-		};
-		header.ensureEndian();
-
-		// native endian target IP
-		auto targetIpNe = target.addr;
-		source.ensureEndian();
-		target.ensureEndian();
+		// With UDP_SEGMENT, the payload is split into datagrams of gsoSize_ bytes.
+		size_t segmentSize = len;
+		if (self->gsoSize_ && len > self->gsoSize_) {
+			segmentSize = self->gsoSize_;
+			if ((len + segmentSize - 1) / segmentSize > maxSegments)
+				co_return protocols::fs::Error::illegalArguments;
+		}
+		if (segmentSize > 0xFFFF - sizeof(Udp::Header))
+			co_return protocols::fs::Error::messageSize;
 
-		auto ti = co_await ip4().targetByRemote(targetIpNe);
+		auto ti = co_await ip4().targetByRemote(target.addr, self->routeCache_);
 		if (!ti) {
 			co_return protocols::fs::Error::netUnreachable;
 		}
 
-		Checksum chk;
-		PseudoHeader psh {
-			.src = convert_endian<endian::big>(ti->source),
-			.dst = target.addr,
-			.len = header.len
-		};
-		chk.update(&psh, sizeof(psh));
-		chk.update(&header, sizeof(header));
-		chk.update(data, len);
-		header.chk = convert_endian<endian::big>(chk.finalize());
-
-		std::cout << "netserver:" << std::endl << std::hex
-			<< std::setw(8) << psh.src << std::endl
-			<< std::setw(8) << psh.dst << std::endl
-			<< std::setw(8) << psh.len << std::endl
-
-			<< std::setw(8) << header.src << std::endl
-			<< std::setw(8) << header.dst << std::endl
-			<< std::setw(8) << header.len << std::endl
-			<< std::setw(8) << header.chk << std::endl << std::dec;
-
-		if (header.chk == 0) {
-			header.chk = ~header.chk;
-		}
-
-		std::memcpy(buf.data(), &header, sizeof(header));
-		std::memcpy(buf.data() + sizeof(header), data, len);
-
-		auto error = co_await ip4().sendFrame(std::move(*ti),
-			buf.data(), buf.size(),
-			static_cast<uint16_t>(IpProto::udp));
-		if (error != protocols::fs::Error::none) {
-			co_return error;
-		}
+		std::vector<char> buf;
+		size_t offset = 0;
+		do {
+			auto chunk = std::min(segmentSize, len - offset);
+			buf.resize(sizeof(Udp::Header) + chunk);
+			Udp::Header header {
+				.src = source.port,
+				.dst = target.port,
+				.len = static_cast<uint16_t>(chunk + sizeof(Udp::Header)),
+				.chk = 0,
+			};
+			header.ensureEndian();
+
+			std::memcpy(buf.data(), &header, sizeof(header));
+			std::memcpy(buf.data() + sizeof(header),
+					static_cast<char *>(data) + offset, chunk);
+
+			auto error = co_await ip4().sendFrame(*ti,
+				buf.data(), buf.size(),
+				static_cast<uint16_t>(IpProto::udp),
+				nic::Link::SendOffload{.needsChecksum = true, .csumOffset = 6});
+			if (error != protocols::fs::Error::none) {
+				co_return error;
+			}
+			offset += chunk;
+		} while (offset < len);
 		co_return len;
 	}
 
@@ -412,6 +427,22 @@ struct Udp4Socket {
 			int val = *reinterpret_cast<int *>(optbuf.data());
 
 			self->ipPacketInfo_ = (val != 0);
+		} else if(layer == IPPROTO_UDP && number == UDP_SEGMENT) {
+			if(optbuf.size() != sizeof(int))
+				co_return Error::illegalArguments;
+
+			int val = *reinterpret_cast<int *>(optbuf.data());
+			if(val < 0 || val > 0xFFFF - static_cast<int>(sizeof(Udp::Header)))
+				co_return Error::illegalArguments;
+
+			self->gsoSize_ = val;
+		} else if(layer == IPPROTO_UDP && number == UDP_GRO) {
+			if(optbuf.size() != sizeof(int))
+				co_return Error::illegalArguments;
+
+			int val = *reinterpret_cast<int *>(optbuf.data());
+
+			self->gro_ = (val != 0);
 		} else {
 			printf("netserver: unhandled setsockopt layer %d number %d\n", layer, number);
 			co_return protocols::fs::Error::invalidProtocolOption;
@@ -459,17 +490,21 @@ struct Udp4Socket {
 private:
 	friend struct Udp4;
 
-	async::queue<Udp, stl_allocator> queue_;
+	std::deque<Udp> queue_;
 	Endpoint remote_;
 	Endpoint local_;
 	Udp4 *parent_;
 	smarter::weak_ptr<Udp4Socket> holder_;
+	Ip4RouteCache routeCache_;
 
 	async::recurring_event _statusBell;
 	uint64_t _currentSeq;
 	uint64_t _inSeq;
 
 	bool ipPacketInfo_ = false;
+	// Segment size for UDP_SEGMENT; zero disables segmentation.
+	size_t gsoSize_ = 0;
+	bool gro_ = false;
 };
 
 void Udp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet, std::weak_ptr<nic::Link> link) {
@@ -481,35 +516,38 @@ void Udp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet, std::weak_p
 
 	std::cout << "received udp datagram to port " << udp.header.dst << std::endl;
 
-	auto i = binds.lower_bound({ 0, udp.header.dst });
-	for (; i != binds.end() && i->first.port == udp.header.dst; i++) {
-		auto ep = i->first;
-		if (ep.addr == udp.packet->header.destination
-			|| ep.addr == INADDR_ANY) {
-			i->second->queue_.emplace(std::move(udp));
-			i->second->_inSeq = ++i->second->_currentSeq;
-			i->second->_statusBell.raise();
-			break;
-		}
-	}
+	auto i = binds.find({ udp.packet->header.destination, udp.header.dst });
+	if (i == binds.end())
+		i = binds.find({ INADDR_ANY, udp.header.dst });
+	if (i == binds.end())
+		return;
+
+	i->second->queue_.push_back(std::move(udp));
+	i->second->_inSeq = ++i->second->_currentSeq;
+	i->second->_statusBell.raise();
 }
 
 bool Udp4::tryBind(smarter::shared_ptr<Udp4Socket> socket, Endpoint addr) {
-	auto i = binds.lower_bound(addr);
-	for (; i != binds.end() && i->first.port == addr.port; i++) {
-		auto ep = i->first;
-		if (ep.addr == INADDR_ANY || addr.addr == INADDR_ANY
-			|| ep.addr == addr.addr) {
+	auto users = portBinds_.find(addr.port);
+	if (users != portBinds_.end()) {
+		if (addr.addr == INADDR_ANY
+				|| binds.contains({ INADDR_ANY, addr.port })
+				|| binds.contains(addr))
 			return false;
-		}
 	}
 	socket->local_ = addr;
 	binds.emplace(addr, std::move(socket));
+	portBinds_[addr.port]++;
 	return true;
 }
 
 bool Udp4::unbind(Endpoint e) {
-	return binds.erase(e) != 0;
+	if (!binds.erase(e))
+		return false;
+	auto users = portBinds_.find(e.port);
+	if (!--users->second)
+		portBinds_.erase(users);
+	return true;
 }
 
 void Udp4::serveSocket(helix::UniqueLane lane) {
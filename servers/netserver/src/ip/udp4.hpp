@@ -2,8 +2,8 @@
 
 #include <helix/ipc.hpp>
 #include <smarter.hpp>
-#include <map>
 #include <netserver/nic.hpp>
+#include <unordered_map>
 
 class Ip4Packet;
 
@@ -13,9 +13,15 @@ struct Endpoint {
 
 	Endpoint &operator=(struct sockaddr_in sa);
 	void ensureEndian();
-};
 
-bool operator<(const Endpoint &l, const Endpoint &r);
+	friend bool operator==(const Endpoint &, const Endpoint &) = default;
+
+	struct Hash {
+		size_t operator()(const Endpoint &e) const {
+			return std::hash<uint64_t>{}((uint64_t{e.addr} << 16) | e.port);
+		}
+	};
+};
 
 struct Udp4Socket;
 struct Udp4 {
@@ -24,5 +30,8 @@ struct Udp4 {
 	bool unbind(Endpoint remote);
 	void serveSocket(helix::UniqueLane lane);
 private:
-	std::map<Endpoint, smarter::shared_ptr<Udp4Socket>> binds;
+	// Demultiplexing looks up the exact local address first, then INADDR_ANY.
+	std::unordered_map<Endpoint, smarter::shared_ptr<Udp4Socket>, Endpoint::Hash> binds;
+	// Number of binds per port; a wildcard bind conflicts with all of them.
+	std::unordered_map<uint16_t, size_t> portBinds_;
 };
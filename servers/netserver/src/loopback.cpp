@@ -0,0 +1,96 @@
+#include <async/recurring-event.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <helix/memory.hpp>
+
+#include "loopback.hpp"
+
+namespace nic {
+
+namespace {
+
+// The length field of IPv4 headers limits packets to 64 KiB.
+constexpr unsigned int loopbackMtu = 0xFFFF;
+
+// Bounds the memory of packets that were sent but not received yet.
+// Further packets are dropped, like on Linux once the backlog overflows.
+constexpr size_t maxQueuedPackets = 1024;
+
+struct LoopbackLink final : Link {
+	LoopbackLink()
+	: Link{loopbackMtu, &pool_}, framePool_{std::make_shared<FramePool>(&pool_)} {
+		raw_ip_ = true;
+		loopback_ = true;
+		l1_up_ = true;
+		// Packets never leave memory, hence checksums are neither computed nor verified.
+		capabilities_.txChecksum = true;
+		capabilities_.rxChecksum = true;
+		// TCP segments are passed on as a whole instead of being split into MSS-sized segments.
+		capabilities_.tso4 = true;
+		capabilities_.lro4 = true;
+		capabilities_.maxReceiveSize = loopbackMtu;
+	}
+
+	async::result<size_t> receive(arch::dma_buffer_view frame) override {
+		ReceiveInfo info;
+		co_return co_await receive(frame, info);
+	}
+
+	async::result<size_t> receive(arch::dma_buffer_view frame, ReceiveInfo &info) override {
+		ReceivedFrame slot{.buffer = frame};
+		co_await receiveBatch({&slot, 1});
+		info = slot.info;
+		co_return slot.length;
+	}
+
+	async::result<size_t> receiveBatch(std::span<ReceivedFrame> frames) override {
+		assert(!frames.empty());
+		while(queue_.empty())
+			co_await doorbell_.async_wait();
+
+		size_t count = std::min(frames.size(), queue_.size());
+		for(size_t i = 0; i < count; i++) {
+			auto &[buffer, length] = queue_.front();
+			assert(length <= frames[i].buffer.size());
+			memcpy(frames[i].buffer.data(), buffer.view().data(), length);
+			frames[i].length = length;
+			frames[i].info = {.checksumVerified = true};
+			queue_.pop_front();
+		}
+		co_return count;
+	}
+
+	// Packets are queued instead of being processed right away: the sender might hold
+	// state (e.g., of a TCP socket) that the receive path modifies.
+	async::result<void> send(const arch::dma_buffer_view frame) override {
+		if(queue_.size() >= maxQueuedPackets)
+			co_return;
+
+		auto buffer = framePool_->allocate(frame.size());
+		memcpy(buffer.view().data(), frame.data(), frame.size());
+		queue_.push_back({std::move(buffer), frame.size()});
+		doorbell_.raise();
+		co_return;
+	}
+
+	async::result<void> send(const arch::dma_buffer_view frame, const SendOffload &) override {
+		// Nothing to do for checksums and segmentation; see the capabilities above.
+		co_await send(frame);
+	}
+
+private:
+	helix::HugeDmaPool pool_;
+	std::shared_ptr<FramePool> framePool_;
+	std::deque<std::pair<FrameBuffer, size_t>> queue_;
+	async::recurring_event doorbell_;
+};
+
+} // anonymous namespace
+
+std::shared_ptr<Link> makeLoopback() {
+	return std::make_shared<LoopbackLink>();
+}
+
+} // namespace nic
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <memory>
+#include <netserver/nic.hpp>
+
+namespace nic {
+
+// Creates the loopback link "lo". Packets that are sent through it are received again
+// without framing, ARP or checksum computation.
+std::shared_ptr<Link> makeLoopback();
+
+} // namespace nic
@@ -24,6 +24,7 @@
 #include "fs.bragi.hpp"
 
 #include "ip/ip4.hpp"
+#include "loopback.hpp"
 #include "netlink/netlink.hpp"
 #include "raw.hpp"
 
@@ -196,6 +197,7 @@ async::result<protocols::svrctl::Error> doBindPci(mbus_ng::Entity baseEntity) {
 	}
 
 	baseDeviceMap.insert({baseEntity.id(), device});
+	nl::notifyLink(RTM_NEWLINK, *device);
 	nic::runDevice(device);
 
 	co_return protocols::svrctl::Error::success;
@@ -353,6 +355,7 @@ async::result<protocols::svrctl::Error> doBindUsb(mbus_ng::Entity baseEntity) {
 	auto device = co_await nic::usb_net::makeShared(baseEntity.id(), std::move(dev), mac, *matched_usb_info);
 
 	baseDeviceMap.insert({baseEntity.id(), device});
+	nl::notifyLink(RTM_NEWLINK, *device);
 	nic::runDevice(device);
 
 	co_return protocols::svrctl::Error::success;
@@ -783,6 +786,19 @@ async::detached serve(helix::UniqueLane lane) {
 	}
 }
 
+// The loopback link is not backed by an mbus entity; use an ID that mbus never assigns.
+constexpr int64_t loopbackId = -1;
+
+void setupLoopback() {
+	auto lo = nic::makeLoopback();
+	baseDeviceMap.insert({loopbackId, lo});
+	nl::notifyLink(RTM_NEWLINK, *lo);
+	ip4().setLink({INADDR_LOOPBACK, 8}, lo);
+	ip4().setLoopback(lo);
+	ip4Router().addRoute({ {0x7F00'0000, 8}, lo });
+	nic::runDevice(lo);
+}
+
 async::detached advertise() {
 	mbus_ng::Properties descriptor {
 		{"class", mbus_ng::StringItem{"netserver"}}
@@ -814,8 +830,12 @@ static constexpr protocols::svrctl::ControlOperations controlOps = {
 int main() {
 	printf("netserver: Starting driver\n");
 
+	// Each socket can have outstanding receives; allow the queue to grow accordingly.
+	helix::Dispatcher::global().configure({.maxChunks = 256});
+
 	async::run(clk::enumerateTracker(), helix::currentDispatcher);
 	nl::initialize();
+	setupLoopback();
 
 //	HEL_CHECK(helSetPriority(kHelThisThread, 3));
 
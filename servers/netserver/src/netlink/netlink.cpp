@@ -43,6 +43,8 @@ async::result<protocols::fs::RecvResult> NetlinkSocket::recvMsg(void *obj,
 	if(logSocket)
 		std::cout << "netserver: Recv from netlink socket" << std::endl;
 
+	self->maxRecvLen_ = std::max(self->maxRecvLen_, len);
+
 	if(self->_recvQueue.empty() && self->_nonBlock)
 		co_return protocols::fs::Error::wouldBlock;
 
@@ -320,7 +322,7 @@ helix_ng::CredentialsView, int layer, int number, std::vector<char> &optbuf) {
 	co_return {};
 }
 
-void NetlinkSocket::broadcast(core::netlink::Packet packet) {
+void multicast(core::netlink::Packet packet) {
 	if(!packet.group)
 		return;
 
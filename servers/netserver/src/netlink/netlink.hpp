@@ -12,12 +12,21 @@
 #include "ip/arp.hpp"
 
 #include <deque>
+#include <optional>
 #include <vector>
 
 namespace nl {
 
 void initialize();
 
+// Sends a copy of the packet to all members of its multicast group.
+void multicast(core::netlink::Packet packet);
+
+// Notify the rtnetlink multicast groups about changes of links, addresses and routes.
+void notifyLink(uint16_t type, nic::Link &nic);
+void notifyAddr(uint16_t type, CidrAddress addr, nic::Link &nic);
+void notifyRoute(uint16_t type, const Ip4Router::Route &route);
+
 class NetlinkSocket final : core::netlink::NetlinkFile {
 public:
 	NetlinkSocket(int flags, int protocol);
@@ -68,8 +77,6 @@ public:
 
 	const int protocol;
 private:
-	void broadcast(core::netlink::Packet packet);
-
 	void getRoute(struct nlmsghdr *hdr);
 	void newRoute(struct nlmsghdr *hdr);
 
@@ -147,7 +154,15 @@ private:
 
 	GroupBitmap groupMemberships_;
 
+	// Parts of a dump are coalesced into the last queued packet (see deliver()), up to the
+	// largest buffer that was passed to recvmsg() so far, but at least one page (as on Linux).
+	static constexpr size_t minBatchSize = 4096;
+	static constexpr size_t maxBatchSize = 32768;
+
 	std::deque<core::netlink::Packet> _recvQueue;
+	// Sequence number of the dump that the last queued packet belongs to, if it is not done yet.
+	std::optional<uint32_t> batchSeq_;
+	size_t maxRecvLen_ = 0;
 };
 
 } // namespace nl
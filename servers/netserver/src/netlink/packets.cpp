@@ -3,6 +3,7 @@
 #include "src/ip/arp.hpp"
 
 #include <abi-bits/socket.h>
+#include <algorithm>
 #include <arpa/inet.h>
 #include <linux/if.h>
 #include <linux/if_arp.h>
@@ -31,75 +32,65 @@ namespace nl {
 
 using core::netlink::NetlinkBuilder;
 
-void NetlinkSocket::deliver(core::netlink::Packet packet) {
-	_recvQueue.push_back(std::move(packet));
-	_inSeq = ++_currentSeq;
-	_statusBell.raise();
-}
-
-void NetlinkSocket::sendLinkPacket(std::shared_ptr<nic::Link> nic, void *h, uint16_t flags) {
-	struct nlmsghdr *hdr = reinterpret_cast<struct nlmsghdr *>(h);
+namespace {
 
+core::netlink::Packet buildLinkPacket(uint16_t type, uint16_t flags, uint32_t seq, uint32_t pid,
+		nic::Link &nic) {
 	NetlinkBuilder b;
 
-	b.header(RTM_NEWLINK, flags, hdr->nlmsg_seq, hdr->nlmsg_pid);
+	b.header(type, flags, seq, pid);
 
 	b.message<struct ifinfomsg>({
 		.ifi_family = AF_UNSPEC,
-		.ifi_type = ARPHRD_ETHER,
-		.ifi_index = nic->index(),
-		.ifi_flags = IFF_UP | IFF_RUNNING | nic->iff_flags(),
+		.ifi_type = static_cast<unsigned short>(nic.loopback() ? ARPHRD_LOOPBACK : ARPHRD_ETHER),
+		.ifi_index = nic.index(),
+		.ifi_flags = IFF_UP | IFF_RUNNING | nic.iff_flags(),
 	});
 
 	constexpr struct ether_addr broadcast_addr = { {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF} };
 
-	if(!nic->name().empty())
-		b.rtattr(IFLA_IFNAME, nic->name());
-	if(nic->mtu) {
-		b.rtattr(IFLA_MTU, nic->mtu);
-		b.rtattr(IFLA_MIN_MTU, nic->min_mtu);
-		b.rtattr(IFLA_MAX_MTU, nic->max_mtu);
+	if(!nic.name().empty())
+		b.rtattr(IFLA_IFNAME, nic.name());
+	if(nic.mtu) {
+		b.rtattr(IFLA_MTU, nic.mtu);
+		b.rtattr(IFLA_MIN_MTU, nic.min_mtu);
+		b.rtattr(IFLA_MAX_MTU, nic.max_mtu);
 	}
 	b.rtattr(IFLA_TXQLEN, 1000);
 	b.rtattr(IFLA_BROADCAST, broadcast_addr);
 	//TODO(no92): separate out the concept of permanent MAC addresses from userspace-configurable ones
-	b.rtattr(IFLA_ADDRESS, nic->deviceMac());
-	b.rtattr(IFLA_PERM_ADDRESS, nic->deviceMac());
+	b.rtattr(IFLA_ADDRESS, nic.deviceMac());
+	b.rtattr(IFLA_PERM_ADDRESS, nic.deviceMac());
 	b.rtattr(IFLA_OPERSTATE, (uint8_t) IF_OPER_UP);
 	b.rtattr(IFLA_NUM_TX_QUEUES, 1);
 
-	deliver(b.packet());
+	return b.packet();
 }
 
-void NetlinkSocket::sendAddrPacket(const struct nlmsghdr *hdr, const struct ifaddrmsg *msg, std::shared_ptr<nic::Link> nic) {
-	auto addr_check = ip4().getCidrByIndex(nic->index());
-
-	if(!addr_check)
-		return;
-
-	auto addr = addr_check.value();
-
+core::netlink::Packet buildAddrPacket(uint16_t type, uint16_t flags, uint32_t seq,
+		CidrAddress addr, uint8_t ifaFlags, nic::Link &nic) {
 	NetlinkBuilder b;
-	b.header(RTM_NEWADDR, NLM_F_MULTI | NLM_F_DUMP_FILTERED, hdr->nlmsg_seq, 0);
+	b.header(type, flags, seq, 0);
 	b.message<struct ifaddrmsg>({
 		.ifa_family = AF_INET,
 		.ifa_prefixlen = addr.prefix,
-		.ifa_flags = msg->ifa_flags,
+		.ifa_flags = ifaFlags,
 		.ifa_scope = RT_SCOPE_UNIVERSE,
-		.ifa_index = static_cast<uint32_t>(nic->index()),
+		.ifa_index = static_cast<uint32_t>(nic.index()),
 	});
 
 	b.rtattr(IFA_ADDRESS, htonl(addr.ip));
 	b.rtattr(IFA_LOCAL, htonl(addr.ip));
-	b.rtattr(IFA_LABEL, nic->name());
+	b.rtattr(IFA_LABEL, nic.name());
 
-	deliver(b.packet());
+	return b.packet();
 }
 
-void NetlinkSocket::sendRoutePacket(const struct nlmsghdr *hdr, Ip4Router::Route &route) {
+core::netlink::Packet buildRoutePacket(uint16_t type, uint16_t flags, uint32_t seq,
+		const Ip4Router::Route &route) {
 	NetlinkBuilder b;
 
-	b.header(RTM_NEWROUTE, NLM_F_MULTI, hdr->nlmsg_seq, 0);
+	b.header(type, flags, seq, 0);
 	b.message<struct rtmsg>({
 		.rtm_family = AF_INET,
 		.rtm_dst_len = route.network.prefix,
@@ -123,7 +114,60 @@ void NetlinkSocket::sendRoutePacket(const struct nlmsghdr *hdr, Ip4Router::Route
 		b.rtattr(RTA_PREFSRC, htonl(route.source));
 	b.rtattr(RTA_OIF, (route.link.expired()) ? 0 : route.link.lock()->index());
 
-	deliver(b.packet());
+	return b.packet();
+}
+
+} // anonymous namespace
+
+void NetlinkSocket::deliver(core::netlink::Packet packet) {
+	auto hdr = reinterpret_cast<const struct nlmsghdr *>(packet.buffer.data());
+	bool multipart = !packet.group
+		&& ((hdr->nlmsg_flags & NLM_F_MULTI) || hdr->nlmsg_type == NLMSG_DONE);
+
+	// Append parts of a dump to the previous part if it is still queued, such that
+	// a single recvmsg() returns as many messages as fit into the reader's buffer.
+	if(multipart && batchSeq_ == hdr->nlmsg_seq && !_recvQueue.empty()) {
+		auto &tail = _recvQueue.back();
+		size_t offset = NLMSG_ALIGN(tail.buffer.size());
+		size_t limit = std::clamp(maxRecvLen_, minBatchSize, maxBatchSize);
+
+		if(offset + packet.buffer.size() <= limit) {
+			tail.buffer.resize(offset + packet.buffer.size());
+			memcpy(tail.buffer.data() + offset, packet.buffer.data(), packet.buffer.size());
+			if(hdr->nlmsg_type == NLMSG_DONE)
+				batchSeq_ = std::nullopt;
+			return;
+		}
+	}
+
+	if(multipart && hdr->nlmsg_type != NLMSG_DONE)
+		batchSeq_ = hdr->nlmsg_seq;
+	else
+		batchSeq_ = std::nullopt;
+
+	_recvQueue.push_back(std::move(packet));
+	_inSeq = ++_currentSeq;
+	_statusBell.raise();
+}
+
+void NetlinkSocket::sendLinkPacket(std::shared_ptr<nic::Link> nic, void *h, uint16_t flags) {
+	struct nlmsghdr *hdr = reinterpret_cast<struct nlmsghdr *>(h);
+
+	deliver(buildLinkPacket(RTM_NEWLINK, flags, hdr->nlmsg_seq, hdr->nlmsg_pid, *nic));
+}
+
+void NetlinkSocket::sendAddrPacket(const struct nlmsghdr *hdr, const struct ifaddrmsg *msg, std::shared_ptr<nic::Link> nic) {
+	auto addr_check = ip4().getCidrByIndex(nic->index());
+
+	if(!addr_check)
+		return;
+
+	deliver(buildAddrPacket(RTM_NEWADDR, NLM_F_MULTI | NLM_F_DUMP_FILTERED, hdr->nlmsg_seq,
+			addr_check.value(), msg->ifa_flags, *nic));
+}
+
+void NetlinkSocket::sendRoutePacket(const struct nlmsghdr *hdr, Ip4Router::Route &route) {
+	deliver(buildRoutePacket(RTM_NEWROUTE, NLM_F_MULTI, hdr->nlmsg_seq, route));
 }
 
 void NetlinkSocket::sendNeighPacket(const struct nlmsghdr *hdr, uint32_t addr, Neighbours::Entry &entry) {
@@ -151,4 +195,22 @@ void NetlinkSocket::sendNeighPacket(const struct nlmsghdr *hdr, uint32_t addr, N
 	deliver(b.packet());
 }
 
+void notifyLink(uint16_t type, nic::Link &nic) {
+	auto packet = buildLinkPacket(type, 0, 0, 0, nic);
+	packet.group = RTNLGRP_LINK;
+	multicast(std::move(packet));
+}
+
+void notifyAddr(uint16_t type, CidrAddress addr, nic::Link &nic) {
+	auto packet = buildAddrPacket(type, 0, 0, addr, 0, nic);
+	packet.group = RTNLGRP_IPV4_IFADDR;
+	multicast(std::move(packet));
+}
+
+void notifyRoute(uint16_t type, const Ip4Router::Route &route) {
+	auto packet = buildRoutePacket(type, 0, 0, route);
+	packet.group = RTNLGRP_IPV4_ROUTE;
+	multicast(std::move(packet));
+}
+
 } // namespace nl
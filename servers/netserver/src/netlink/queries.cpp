@@ -193,7 +193,7 @@ void NetlinkSocket::getRoute(struct nlmsghdr *hdr) {
 
 	// Loop over all ipv4 and ipv6 routes, and return them.
 	// TODO: also return ipv6 routes.
-	auto ipv4_router = ip4Router();
+	auto &ipv4_router = ip4Router();
 
 	for(auto route : ipv4_router.getRoutes()) {
 		sendRoutePacket(hdr, route);
@@ -256,14 +256,6 @@ void NetlinkSocket::newAddr(struct nlmsghdr *hdr) {
 	if(hdr->nlmsg_flags & NLM_F_ACK)
 		sendAck(this, hdr);
 
-	core::netlink::NetlinkBuilder b;
-	b.group(RTNLGRP_IPV4_IFADDR);
-	b.header(RTM_NEWADDR, 0, _currentSeq, 0);
-	b.message<struct ifaddrmsg>(*msg);
-	b.nlattr(IFA_ADDRESS, htonl(addr));
-
-	broadcast(b.packet());
-
 	return;
 }
 
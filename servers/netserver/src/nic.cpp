@@ -3,7 +3,9 @@
 #include <netserver/nic.hpp>
 
 #include <algorithm>
+#include <cassert>
 #include <cstring>
+#include <stdexcept>
 #include <arch/bit.hpp>
 #include <frg/formatting.hpp>
 #include <frg/logging.hpp>
@@ -81,6 +83,9 @@ void Link::configureName(std::string prefix) {
 }
 
 std::string Link::name() {
+	if(loopback_)
+		return "lo";
+
 	/* if our fallback option of naming using the MAC fails, and no prefix is set, use `ethX` */
 	if(namePrefix_.empty() && !mac_)
 		configureName("eth");
@@ -99,6 +104,24 @@ std::string Link::name() {
 	return std::format("enx{:02x}{:02x}{:02x}{:02x}{:02x}{:02x}", mac_[0], mac_[1], mac_[2], mac_[3], mac_[4], mac_[5]);
 }
 
+async::result<size_t> Link::receive(arch::dma_buffer_view frame, ReceiveInfo &info) {
+	info = {};
+	co_return co_await receive(frame);
+}
+
+async::result<size_t> Link::receiveBatch(std::span<ReceivedFrame> frames) {
+	assert(!frames.empty());
+	frames[0].length = co_await receive(frames[0].buffer, frames[0].info);
+	co_return 1;
+}
+
+async::result<void> Link::send(const arch::dma_buffer_view frame, const SendOffload &offload) {
+	// The flow hash is only a hint; links without multiple queues ignore it.
+	if(offload.needsChecksum || offload.segmentSize)
+		throw std::runtime_error("netserver: Link does not support send offloads");
+	co_await send(frame);
+}
+
 Link::AllocatedBuffer Link::allocateFrame(size_t size) {
 	using namespace arch;
 	Link::AllocatedBuffer buf {
@@ -139,40 +162,90 @@ unsigned int Link::iff_flags() {
 		flags |= IFF_BROADCAST;
 	if(l1_up_)
 		flags |= IFF_LOWER_UP;
+	if(loopback_)
+		flags |= IFF_LOOPBACK;
 
 	return flags;
 }
 
+FrameBuffer::~FrameBuffer() {
+	if(!pool_ || !buffer_.data())
+		return;
+	if(pool_->free_.size() < FramePool::maxFreeBuffers)
+		pool_->free_.push_back(std::move(buffer_));
+}
+
+FrameBuffer FramePool::allocate(size_t size) {
+	while(!free_.empty()) {
+		auto buffer = std::move(free_.back());
+		free_.pop_back();
+		// Buffers become too small if the MTU is raised.
+		if(buffer.size() >= size)
+			return FrameBuffer{shared_from_this(), std::move(buffer)};
+	}
+	return FrameBuffer{shared_from_this(), arch::dma_buffer{dmaPool_, size}};
+}
+
+namespace {
+
+constexpr size_t receiveBatchSize = 32;
+
+// Buffers of IPv4 frames are owned by the IP layer until it drops the packet;
+// all other buffers are reused as soon as the frame has been dispatched.
+void dispatchFrame(std::shared_ptr<Link> &dev, FrameBuffer &buffer,
+		const Link::ReceivedFrame &frame) {
+	auto view = buffer.view();
+	auto len = frame.length;
+
+	if(!dev->rawIp()) {
+		if(len < 14)
+			return;
+
+		auto capsule = view.subview(14, len - 14);
+		auto data = reinterpret_cast<uint8_t*>(view.data());
+		uint16_t ethertype = data[12] << 8 | data[13];
+		nic::MacAddress dstsrc[2];
+		std::memcpy(dstsrc, data, sizeof(dstsrc));
+
+		raw().feedPacket(view.subview(0, len));
+
+		switch (ethertype) {
+		case ETHER_TYPE_IP4:
+			ip4().feedPacket(dstsrc[0], dstsrc[1],
+				std::move(buffer), capsule, dev, frame.info);
+			break;
+		case ETHER_TYPE_ARP:
+			neigh4().feedArp(dstsrc[0], capsule, dev);
+			break;
+		default:
+			break;
+		}
+	} else {
+		ip4().feedPacket({}, {}, std::move(buffer), view.subview(0, len), dev, frame.info);
+	}
+}
+
+} // anonymous namespace
+
 async::detached runDevice(std::shared_ptr<nic::Link> dev) {
-	using namespace arch;
+	auto pool = std::make_shared<FramePool>(dev->dmaPool());
+	std::vector<FrameBuffer> buffers(receiveBatchSize);
+	std::vector<Link::ReceivedFrame> frames(receiveBatchSize);
+
 	while(true) {
-		dma_buffer frameBuffer { dev->dmaPool(), 1514 };
-		auto len = co_await dev->receive(frameBuffer);
-
-		if(!dev->rawIp()) {
-			auto capsule = frameBuffer.subview(14, len - 14);
-			auto data = reinterpret_cast<uint8_t*>(frameBuffer.data());
-			uint16_t ethertype = data[12] << 8 | data[13];
-			nic::MacAddress dstsrc[2];
-			std::memcpy(dstsrc, data, sizeof(dstsrc));
-
-			raw().feedPacket(frameBuffer.subview(0, len));
-
-			switch (ethertype) {
-			case ETHER_TYPE_IP4:
-				ip4().feedPacket(dstsrc[0], dstsrc[1],
-					std::move(frameBuffer), capsule, dev);
-				break;
-			case ETHER_TYPE_ARP:
-				neigh4().feedArp(dstsrc[0], capsule, dev);
-				break;
-			default:
-				break;
-			}
-		} else {
-			dma_buffer_view capsule = frameBuffer;
-			ip4().feedPacket({}, {}, std::move(frameBuffer), capsule, dev);
+		// Replace the buffers that were handed to the IP layer.
+		auto size = dev->receiveBufferSize();
+		for(size_t i = 0; i < receiveBatchSize; i++) {
+			if(!buffers[i] || buffers[i].size() < size)
+				buffers[i] = pool->allocate(size);
+			frames[i] = {.buffer = buffers[i].view().subview(0, size)};
 		}
+
+		auto count = co_await dev->receiveBatch(frames);
+		assert(count && count <= receiveBatchSize);
+
+		for(size_t i = 0; i < count; i++)
+			dispatchFrame(dev, buffers[i], frames[i]);
 	}
 }
 } // namespace nic
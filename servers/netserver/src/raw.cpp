@@ -30,16 +30,17 @@ void Raw::feedPacket(arch::dma_buffer_view frame) {
 		size_t accept_bytes = SIZE_MAX;
 
 		if((*s)->filter_) {
-			Bpf bpf{(*s)->filter_.value()};
-			accept_bytes = bpf.run(frame);
+			accept_bytes = (*s)->filter_->run(frame);
 
 			if(!accept_bytes)
 				continue;
 		}
 
-		RawSocket::PacketInfo info{frame.size(), frame.subview(0, std::min(frame.size(), accept_bytes))};
+		auto captured = reinterpret_cast<const char *>(frame.data());
+		RawSocket::PacketInfo info{frame.size(),
+			{captured, captured + std::min(frame.size(), accept_bytes)}};
 
-		(*s)->queue_.emplace(info);
+		(*s)->queue_.emplace(std::move(info));
 		(*s)->_inSeq = ++(*s)->_currentSeq;
 		(*s)->_statusBell.raise();
 	}
@@ -101,8 +102,8 @@ async::result<protocols::fs::RecvResult> RawSocket::recvmsg(void *obj,
 	auto element = co_await self->queue_.async_get();
 	assert(element);
 
-	size_t data_len = std::min(len, element->view.size());
-	memcpy(data, element->view.byte_data(), data_len);
+	size_t data_len = std::min(len, element->data.size());
+	memcpy(data, element->data.data(), data_len);
 
 	protocols::fs::CtrlBuilder ctrl{max_ctrl_len};
 
@@ -112,7 +113,7 @@ async::result<protocols::fs::RecvResult> RawSocket::recvmsg(void *obj,
 			ctrl.write<struct tpacket_auxdata>({
 				.tp_status = (TP_STATUS_USER | TP_STATUS_CSUM_VALID),
 				.tp_len = static_cast<uint32_t>(element->len),
-				.tp_snaplen = static_cast<uint32_t>(element->view.size()),
+				.tp_snaplen = static_cast<uint32_t>(element->data.size()),
 			});
 	}
 
@@ -129,11 +130,11 @@ async::result<frg::expected<protocols::fs::Error>> RawSocket::setSocketOption(vo
 		if(self->filterLocked_)
 			co_return protocols::fs::Error::insufficientPermissions;
 
-		Bpf bpf{optbuf};
-		if(!bpf.validate())
+		auto bpf = Bpf::compile(optbuf);
+		if(!bpf)
 			co_return protocols::fs::Error::illegalArguments;
 
-		self->filter_ = optbuf;
+		self->filter_ = std::move(bpf);
 	} else if(layer == SOL_SOCKET && number == SO_DETACH_FILTER) {
 		if(self->filterLocked_)
 			co_return protocols::fs::Error::insufficientPermissions;
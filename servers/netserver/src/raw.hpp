@@ -1,6 +1,7 @@
 #pragma once
 
 #include <arch/dma_pool.hpp>
+#include <core/bpf.hpp>
 #include <async/recurring-event.hpp>
 #include <async/queue.hpp>
 #include <helix/ipc.hpp>
@@ -60,13 +61,14 @@ private:
 	int proto [[maybe_unused]];
 	bool filterLocked_ = false;
 	bool packetAuxData_ = false;
-	std::optional<std::vector<char>> filter_ = std::nullopt;
+	std::optional<Bpf> filter_ = std::nullopt;
 
 	std::shared_ptr<nic::Link> link = {};
 
+	// Receive buffers are recycled once a frame is dispatched, hence the data is copied.
 	struct PacketInfo {
 		size_t len;
-		arch::dma_buffer_view view;
+		std::vector<char> data;
 	};
 
 	async::queue<PacketInfo, frg::stl_allocator> queue_;
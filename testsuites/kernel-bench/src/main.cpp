@@ -1,32 +1,168 @@
 #include <math.h>
+#include <string.h>
 
 #include <async/result.hpp>
 #include <async/algorithm.hpp>
 #include <helix/ipc.hpp>
-
+#ifdef KERNEL_BENCH_DRM_CORE
+#include <core/drm/core.hpp>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
 #include <vector>
 
 namespace {
 
+using clock = std::chrono::high_resolution_clock;
+
+// If set, results are printed as JSON to stdout while progress goes to stderr.
+bool jsonOutput = false;
+
+std::ostream &output() {
+	return jsonOutput ? std::cerr : std::cout;
+}
+
+std::string formatSize(size_t size) {
+	if(size < 1024)
+		return std::to_string(size);
+	if(size < 1024 * 1024)
+		return std::to_string(size / 1024) + " KiB";
+	return std::to_string(size / (1024 * 1024)) + " MiB";
+}
+
+// Time that it takes to read the clock; subtracted from latency samples.
+std::chrono::nanoseconds clockOverhead{0};
+
+void calibrateClock() {
+	auto best = std::chrono::nanoseconds::max();
+	for(int i = 0; i < 1000; ++i) {
+		auto before = clock::now();
+		auto after = clock::now();
+		best = std::min(best, duration_cast<std::chrono::nanoseconds>(after - before));
+	}
+	clockOverhead = best;
+}
+
+// Measures the latency of every samplingInterval-th iteration. Keeps a uniformly
+// random subset of at most maxSamples samples (i.e., uses reservoir sampling).
+struct LatencyRecorder {
+	static constexpr uint64_t samplingInterval = 16;
+	static constexpr size_t maxSamples = size_t{1} << 16;
+
+	struct Sample {
+		bool active;
+		clock::time_point start;
+	};
+
+	Sample begin() {
+		if(counter_++ % samplingInterval)
+			return {false, {}};
+		return {true, clock::now()};
+	}
+
+	void end(Sample sample) {
+		if(!sample.active)
+			return;
+		auto elapsed = duration_cast<std::chrono::nanoseconds>(clock::now() - sample.start);
+		record(std::max(elapsed - clockOverhead, std::chrono::nanoseconds{0}).count());
+	}
+
+	void merge(const LatencyRecorder &other) {
+		for(auto ns : other.samples_)
+			record(ns);
+	}
+
+	bool empty() {
+		return samples_.empty();
+	}
+
+	// Returns the q-quantile (using the nearest-rank method).
+	uint64_t percentile(double q) {
+		assert(!samples_.empty());
+		std::sort(samples_.begin(), samples_.end());
+		auto rank = static_cast<size_t>(ceil(q * samples_.size()));
+		return samples_[std::clamp<size_t>(rank, 1, samples_.size()) - 1];
+	}
+
+private:
+	void record(uint64_t ns) {
+		numSeen_++;
+		if(samples_.size() < maxSamples) {
+			samples_.push_back(ns);
+			return;
+		}
+		// xorshift64.
+		random_ ^= random_ << 13;
+		random_ ^= random_ >> 7;
+		random_ ^= random_ << 17;
+		auto i = random_ % numSeen_;
+		if(i < maxSamples)
+			samples_[i] = ns;
+	}
+
+	uint64_t counter_ = 0;
+	uint64_t numSeen_ = 0;
+	uint64_t random_ = 0x9e3779b97f4a7c15;
+	std::vector<uint64_t> samples_;
+};
+
+struct BenchmarkResult {
+	std::string name;
+	unsigned int numThreads;
+	size_t bytesPerIteration;
+	double avg;
+	double std;
+	bool hasLatencies;
+	// Latencies in ns.
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+};
+
+std::vector<BenchmarkResult> allResults;
+
 struct IterationsPerSecondBenchmark {
-	using clock = std::chrono::high_resolution_clock;
+	IterationsPerSecondBenchmark(std::string name, unsigned int numThreads = 1)
+	: name_{std::move(name)}, numThreads_{numThreads} {
+		output() << name_;
+		if(numThreads_ > 1)
+			output() << ", threads = " << numThreads_;
+		output() << std::endl;
+	}
 
 	void launchRepetition() {
 		ref_ = clock::now();
 	}
 
+	// Safe to call from multiple threads.
 	bool isRepetitionDone() {
-		auto elapsed = duration_cast<std::chrono::nanoseconds>(
-					std::chrono::high_resolution_clock::now() - ref_);
+		auto elapsed = duration_cast<std::chrono::nanoseconds>(clock::now() - ref_);
 		return elapsed.count() > 1'000'000'000;
 	}
 
+	LatencyRecorder::Sample beginSample() {
+		return latencies_.begin();
+	}
+
+	void endSample(LatencyRecorder::Sample sample) {
+		latencies_.end(sample);
+	}
+
+	void mergeLatencies(const LatencyRecorder &other) {
+		latencies_.merge(other);
+	}
+
 	void announceIterations(uint64_t iters) {
-		std::cout << "    " << iters << " iterations per second" << std::endl;
+		output() << "    " << iters << " iterations per second" << std::endl;
 		results_.push_back(iters);
 	}
 
-	void finalizeStatistics() {
+	// If bytesPerIteration is non-zero, also prints the average throughput.
+	void finalizeStatistics(size_t bytesPerIteration = 0) {
 		double avg = 0;
 		for(uint64_t n : results_)
 			avg += n;
@@ -37,114 +173,244 @@ struct IterationsPerSecondBenchmark {
 			var += (n - avg) * (n - avg);
 		var /= results_.size();
 
-		std::cout << "    avg: " << static_cast<uint64_t>(avg)
+		output() << "    avg: " << static_cast<uint64_t>(avg)
 				<< ", std: " << static_cast<uint64_t>(sqrt(var)) << std::endl;
+		if(bytesPerIteration)
+			output() << "    throughput: "
+					<< static_cast<uint64_t>(avg * bytesPerIteration / (1024 * 1024))
+					<< " MiB/s" << std::endl;
+
+		BenchmarkResult result{name_, numThreads_, bytesPerIteration, avg, sqrt(var),
+				!latencies_.empty(), 0, 0, 0};
+		if(result.hasLatencies) {
+			result.p50 = latencies_.percentile(0.5);
+			result.p99 = latencies_.percentile(0.99);
+			result.p999 = latencies_.percentile(0.999);
+			output() << "    latency p50: " << result.p50 << " ns, p99: " << result.p99
+					<< " ns, p999: " << result.p999 << " ns" << std::endl;
+		}
+		allResults.push_back(std::move(result));
 	}
 
 private:
+	std::string name_;
+	unsigned int numThreads_;
 	std::vector<double> results_;
 	std::chrono::time_point<clock> ref_;
+	LatencyRecorder latencies_;
 };
 
-void doNopBenchmark() {
-	std::cout << "syscall ops" << std::endl;
-
-	IterationsPerSecondBenchmark bench;
+// Runs op, which performs a single iteration, for five repetitions.
+template<typename Op>
+void runIterations(IterationsPerSecondBenchmark &bench, Op op) {
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
 		while(!bench.isRepetitionDone()) {
 			for(int i = 0; i < 100; ++i) {
-				HEL_CHECK(helNop());
+				auto sample = bench.beginSample();
+				op();
+				bench.endSample(sample);
 				++n;
 			}
 		}
 		bench.announceIterations(n);
 	}
-	bench.finalizeStatistics();
 }
 
-async::result<void> doAsyncNopBenchmark() {
-	std::cout << "ipc ops" << std::endl;
-
-	IterationsPerSecondBenchmark bench;
+// Same as runIterations() but op returns an awaitable.
+template<typename Op>
+async::result<void> runAsyncIterations(IterationsPerSecondBenchmark &bench, Op op) {
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
 		while(!bench.isRepetitionDone()) {
 			for(int i = 0; i < 100; ++i) {
-				auto result = co_await helix_ng::asyncNop();
-				HEL_CHECK(result.error());
+				auto sample = bench.beginSample();
+				co_await op();
+				bench.endSample(sample);
 				++n;
 			}
 		}
 		bench.announceIterations(n);
 	}
-	bench.finalizeStatistics();
 }
 
-void doFutexBenchmark() {
-	std::cout << "futex waits" << std::endl;
+unsigned int numCpus() {
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
 
-	IterationsPerSecondBenchmark bench;
+void pinToCpu(unsigned int cpu) {
+	std::vector<uint8_t> mask(cpu / 8 + 1);
+	mask[cpu / 8] = 1 << (cpu % 8);
+	HEL_CHECK(helSetAffinity(kHelThisThread, mask.data(), mask.size()));
+}
+
+// Runs op on numThreads threads that are pinned to distinct CPUs.
+// Reports the total number of iterations of all threads.
+template<typename Op>
+void runPinnedIterations(IterationsPerSecondBenchmark &bench, unsigned int numThreads, Op op) {
 	for(int k = 0; k < 5; ++k) {
-		uint64_t n = 0;
+		std::atomic<unsigned int> numReady{0};
+		std::atomic<bool> start{false};
+		std::vector<uint64_t> counts(numThreads);
+		std::vector<LatencyRecorder> recorders(numThreads);
+
+		std::vector<std::thread> threads;
+		for(unsigned int t = 0; t < numThreads; ++t) {
+			threads.emplace_back([&, t] {
+				pinToCpu(t);
+				numReady.fetch_add(1, std::memory_order_relaxed);
+				while(!start.load(std::memory_order_acquire))
+					std::this_thread::yield();
+
+				uint64_t n = 0;
+				while(!bench.isRepetitionDone()) {
+					for(int i = 0; i < 100; ++i) {
+						auto sample = recorders[t].begin();
+						op();
+						recorders[t].end(sample);
+						++n;
+					}
+				}
+				counts[t] = n;
+			});
+		}
+
+		while(numReady.load(std::memory_order_relaxed) < numThreads)
+			std::this_thread::yield();
 		bench.launchRepetition();
-		while(!bench.isRepetitionDone()) {
-			for(int i = 0; i < 100; ++i) {
-				int futex = 1;
-				HEL_CHECK(helFutexWait(&futex, 0, -1));
-				++n;
-			}
+		start.store(true, std::memory_order_release);
+
+		uint64_t n = 0;
+		for(unsigned int t = 0; t < numThreads; ++t) {
+			threads[t].join();
+			n += counts[t];
+			bench.mergeLatencies(recorders[t]);
 		}
 		bench.announceIterations(n);
 	}
-	bench.finalizeStatistics();
 }
 
-void doAllocateBenchmark(size_t size) {
-	std::cout << "allocate memory, size = " << (size / (1024 * 1024)) << " MiB" << std::endl;
+// Thread counts for scaling benchmarks: powers of two up to (and including) the number of CPUs.
+std::vector<unsigned int> scalingThreadCounts() {
+	std::vector<unsigned int> counts;
+	for(unsigned int n = 1; n < numCpus(); n *= 2)
+		counts.push_back(n);
+	counts.push_back(numCpus());
+	return counts;
+}
 
-	IterationsPerSecondBenchmark bench;
-	for(int k = 0; k < 5; ++k) {
-		uint64_t n = 0;
-		bench.launchRepetition();
-		while(!bench.isRepetitionDone()) {
-			HelHandle handle;
-			HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
-			HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
-			++n;
-		}
-		bench.announceIterations(n);
+void printJsonString(const std::string &str) {
+	std::cout << '"';
+	for(char c : str) {
+		if(c == '"' || c == '\\')
+			std::cout << '\\';
+		std::cout << c;
+	}
+	std::cout << '"';
+}
+
+void printJsonResults() {
+	std::cout << "{\"benchmarks\": [";
+	for(size_t i = 0; i < allResults.size(); ++i) {
+		auto &result = allResults[i];
+		if(i)
+			std::cout << ",";
+		std::cout << "\n  {\"name\": ";
+		printJsonString(result.name);
+		std::cout << ", \"threads\": " << result.numThreads
+				<< ", \"iterations_per_second\": {\"avg\": " << static_cast<uint64_t>(result.avg)
+				<< ", \"std\": " << static_cast<uint64_t>(result.std) << "}";
+		if(result.bytesPerIteration)
+			std::cout << ", \"bytes_per_iteration\": " << result.bytesPerIteration
+					<< ", \"throughput_mib_per_second\": "
+					<< static_cast<uint64_t>(result.avg * result.bytesPerIteration / (1024 * 1024));
+		if(result.hasLatencies)
+			std::cout << ", \"latency_ns\": {\"p50\": " << result.p50
+					<< ", \"p99\": " << result.p99 << ", \"p999\": " << result.p999 << "}";
+		std::cout << "}";
 	}
+	std::cout << "\n]}" << std::endl;
+}
+
+void doNopBenchmark() {
+	IterationsPerSecondBenchmark bench{"syscall ops"};
+	runIterations(bench, [] {
+		HEL_CHECK(helNop());
+	});
 	bench.finalizeStatistics();
 }
 
-void doMapBenchmark(size_t size) {
-	std::cout << "memory mapping, size = " << (size / (1024 * 1024)) << " MiB" << std::endl;
+void doScalingNopBenchmark(unsigned int numThreads) {
+	IterationsPerSecondBenchmark bench{"syscall ops", numThreads};
+	runPinnedIterations(bench, numThreads, [] {
+		HEL_CHECK(helNop());
+	});
+	bench.finalizeStatistics();
+}
 
-	IterationsPerSecondBenchmark bench;
-	for(int k = 0; k < 5; ++k) {
-		uint64_t n = 0;
-		bench.launchRepetition();
-		while(!bench.isRepetitionDone()) {
-			HelHandle handle;
-			HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
-			void *window;
-			HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
-					kHelMapProtRead | kHelMapProtWrite, &window));
-			HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
-			HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
-			++n;
-		}
-		bench.announceIterations(n);
+async::result<void> doAsyncNopBenchmark() {
+	IterationsPerSecondBenchmark bench{"ipc ops"};
+	co_await runAsyncIterations(bench, [] () -> async::result<void> {
+		auto result = co_await helix_ng::asyncNop();
+		HEL_CHECK(result.error());
+	});
+	bench.finalizeStatistics();
+}
+
+void doFutexBenchmark() {
+	IterationsPerSecondBenchmark bench{"futex waits"};
+	runIterations(bench, [] {
+		int futex = 1;
+		HEL_CHECK(helFutexWait(&futex, 0, -1));
+	});
+	bench.finalizeStatistics();
+}
+
+void doThreadBenchmark() {
+	IterationsPerSecondBenchmark bench{"thread creation"};
+	runIterations(bench, [] {
+		// The thread never runs; this measures creation and destruction only.
+		HelHandle handle;
+		HEL_CHECK(helCreateThread(kHelNullHandle, kHelNullHandle, kHelAbiSystemV,
+				nullptr, nullptr, kHelThreadStopped, &handle));
+		HEL_CHECK(helKillThread(handle));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+	});
+	bench.finalizeStatistics();
+}
+
+void doAllocateBenchmark(size_t size, unsigned int numThreads = 1) {
+	IterationsPerSecondBenchmark bench{"allocate memory, size = " + formatSize(size), numThreads};
+	auto op = [&] {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+	};
+	if(numThreads > 1) {
+		runPinnedIterations(bench, numThreads, op);
+	}else{
+		runIterations(bench, op);
 	}
 	bench.finalizeStatistics();
 }
 
-void doMapPopulatedBenchmark(size_t size) {
-	std::cout << "populated mapping, size = " << (size / (1024 * 1024)) << " MiB" << std::endl;
+void doMapBenchmark(size_t size) {
+	IterationsPerSecondBenchmark bench{"memory mapping, size = " + formatSize(size)};
+	runIterations(bench, [&] {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+		void *window;
+		HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
+				kHelMapProtRead | kHelMapProtWrite, &window));
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+	});
+	bench.finalizeStatistics();
+}
 
+void doMapPopulatedBenchmark(size_t size) {
 	HelHandle handle;
 	HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
 	void *window;
@@ -158,110 +424,343 @@ void doMapPopulatedBenchmark(size_t size) {
 
 	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
 
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"populated mapping, size = " + formatSize(size)};
+	runIterations(bench, [&] {
+		void *window;
+		HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
+				kHelMapProtRead | kHelMapProtWrite, &window));
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+	});
+	bench.finalizeStatistics();
+
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+}
+
+void doPageFaultBenchmark(size_t size) {
+	IterationsPerSecondBenchmark bench{"page faults (mapping size = " + formatSize(size) + ")"};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
 		while(!bench.isRepetitionDone()) {
+			HelHandle handle;
+			HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
 			void *window;
 			HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
 					kHelMapProtRead | kHelMapProtWrite, &window));
+
+			// Touch all mapped pages.
+			auto p = reinterpret_cast<volatile std::byte *>(window);
+			for(size_t progress = 0; progress < size; progress += 0x1000) {
+				auto sample = bench.beginSample();
+				p[progress] = static_cast<std::byte>(0);
+				bench.endSample(sample);
+				++n;
+			}
+
 			HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
-			++n;
+			HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
 		}
 		bench.announceIterations(n);
 	}
 	bench.finalizeStatistics();
+}
 
-	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+// All threads fault in the same address space. Each iteration faults in 16 pages.
+void doScalingPageFaultBenchmark(unsigned int numThreads) {
+	constexpr size_t size = 16 * 0x1000;
+
+	IterationsPerSecondBenchmark bench{"page faults, 16 per iteration", numThreads};
+	runPinnedIterations(bench, numThreads, [] {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+		void *window;
+		HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
+				kHelMapProtRead | kHelMapProtWrite, &window));
+
+		auto p = reinterpret_cast<volatile std::byte *>(window);
+		for(size_t progress = 0; progress < size; progress += 0x1000)
+			p[progress] = static_cast<std::byte>(0);
+
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+	});
+	bench.finalizeStatistics();
 }
 
-void doPageFaultBenchmark(size_t size) {
-	std::cout << "page faults (mapping size = " << (size / (1024 * 1024)) << " MiB)" << std::endl;
+// Faults on indirect memory look up the indirection slot without taking a lock.
+void doIndirectPageFaultBenchmark(size_t size) {
+	HelHandle memory;
+	HEL_CHECK(helAllocateMemory(size, 0, nullptr, &memory));
+	HelHandle indirect;
+	HEL_CHECK(helCreateIndirectMemory(1, &indirect));
+	HEL_CHECK(helAlterMemoryIndirection(indirect, 0, memory, 0, size));
 
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"indirect page faults (mapping size = "
+			+ formatSize(size) + ")"};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
 		while(!bench.isRepetitionDone()) {
-			HelHandle handle;
-			HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
 			void *window;
-			HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
+			HEL_CHECK(helMapMemory(indirect, kHelNullHandle, nullptr, 0, size,
 					kHelMapProtRead | kHelMapProtWrite, &window));
 
 			// Touch all mapped pages.
 			auto p = reinterpret_cast<volatile std::byte *>(window);
 			for(size_t progress = 0; progress < size; progress += 0x1000) {
+				auto sample = bench.beginSample();
 				p[progress] = static_cast<std::byte>(0);
+				bench.endSample(sample);
 				++n;
 			}
 
 			HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
-			HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
 		}
 		bench.announceIterations(n);
 	}
 	bench.finalizeStatistics();
+
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, indirect));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, memory));
 }
 
-async::result<void> doSendRecvBufferBenchmark(size_t size) {
-	auto [lane1, lane2] = helix::createStream();
-	std::vector<std::byte> sBuf(size);
-	std::vector<std::byte> rBuf(size);
+// Forks a populated copy-on-write memory object (as done by fork()) and
+// breaks the sharing of all pages by writing to the fork.
+void doForkMemoryBenchmark(size_t size) {
+	HelHandle memory;
+	HEL_CHECK(helAllocateMemory(size, 0, nullptr, &memory));
+	HelHandle cow;
+	HEL_CHECK(helCopyOnWrite(memory, 0, size, &cow));
 
-	if(size < 1024) {
-		std::cout << "size = " << size << std::endl;
-	}else if(size < 1024 * 1024) {
-		std::cout << "size = " << (size / 1024) << " KiB" << std::endl;
-	}else{
-		std::cout << "size = " << (size / (1024 * 1024)) << " MiB" << std::endl;
+	void *window;
+	HEL_CHECK(helMapMemory(cow, kHelNullHandle, nullptr, 0, size,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+	auto p = reinterpret_cast<volatile std::byte *>(window);
+	for(size_t progress = 0; progress < size; progress += 0x1000)
+		p[progress] = static_cast<std::byte>(1);
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+
+	{
+		IterationsPerSecondBenchmark bench{"fork memory, size = " + formatSize(size)};
+		runIterations(bench, [&] {
+			HelHandle forked;
+			HEL_CHECK(helForkMemory(cow, &forked));
+			HEL_CHECK(helCloseDescriptor(kHelThisUniverse, forked));
+		});
+		bench.finalizeStatistics();
 	}
 
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"copy-on-write faults (mapping size = "
+			+ formatSize(size) + ")"};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
 		while(!bench.isRepetitionDone()) {
-			for(int i = 0; i < 100; ++i) {
-				co_await async::when_all(
-					async::transform(
-						helix_ng::exchangeMsgs(lane1, helix_ng::sendBuffer(sBuf.data(), size)
-					), [&] (auto result) {
-						auto [send] = std::move(result);
-						HEL_CHECK(send.error());
-					}),
-					async::transform(
-						helix_ng::exchangeMsgs(lane2, helix_ng::recvBuffer(rBuf.data(), size)
-					), [&] (auto result) {
-						auto [recv] = std::move(result);
-						HEL_CHECK(recv.error());
-						assert(recv.actualLength() == size);
-					})
-				);
+			HelHandle forked;
+			HEL_CHECK(helForkMemory(cow, &forked));
+			void *window;
+			HEL_CHECK(helMapMemory(forked, kHelNullHandle, nullptr, 0, size,
+					kHelMapProtRead | kHelMapProtWrite, &window));
+
+			auto p = reinterpret_cast<volatile std::byte *>(window);
+			for(size_t progress = 0; progress < size; progress += 0x1000) {
+				auto sample = bench.beginSample();
+				p[progress] = static_cast<std::byte>(0);
+				bench.endSample(sample);
 				++n;
 			}
+
+			HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+			HEL_CHECK(helCloseDescriptor(kHelThisUniverse, forked));
 		}
 		bench.announceIterations(n);
 	}
 	bench.finalizeStatistics();
+
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, cow));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, memory));
+}
+
+// Note that the kernel copies buffers of at least 64 KiB directly between address spaces
+// while smaller buffers are copied through kernel bounce buffers.
+async::result<void> doSendRecvBufferBenchmark(size_t size) {
+	auto [lane1, lane2] = helix::createStream();
+	std::vector<std::byte> sBuf(size);
+	std::vector<std::byte> rBuf(size);
+
+	IterationsPerSecondBenchmark bench{"send/recv buffer, size = " + formatSize(size)};
+	co_await runAsyncIterations(bench, [&] () -> async::result<void> {
+		co_await async::when_all(
+			async::transform(
+				helix_ng::exchangeMsgs(lane1, helix_ng::sendBuffer(sBuf.data(), size)
+			), [&] (auto result) {
+				auto [send] = std::move(result);
+				HEL_CHECK(send.error());
+			}),
+			async::transform(
+				helix_ng::exchangeMsgs(lane2, helix_ng::recvBuffer(rBuf.data(), size)
+			), [&] (auto result) {
+				auto [recv] = std::move(result);
+				HEL_CHECK(recv.error());
+				assert(recv.actualLength() == size);
+			})
+		);
+	});
+	bench.finalizeStatistics(size);
+}
+
+// Sends size bytes gathered from numItems buffers and scatters them into numItems buffers.
+async::result<void> doSendRecvBufferSgBenchmark(size_t size, size_t numItems) {
+	auto [lane1, lane2] = helix::createStream();
+	std::vector<std::byte> sBuf(size);
+	std::vector<std::byte> rBuf(size);
+
+	std::vector<HelSgItem> sItems;
+	std::vector<HelSgItem> rItems;
+	for(size_t j = 0; j < numItems; j++) {
+		auto offset = j * size / numItems;
+		auto length = (j + 1) * size / numItems - offset;
+		sItems.push_back({sBuf.data() + offset, length});
+		rItems.push_back({rBuf.data() + offset, length});
+	}
+
+	IterationsPerSecondBenchmark bench{"send/recv sg buffer, size = " + formatSize(size)
+			+ ", items = " + std::to_string(numItems)};
+	co_await runAsyncIterations(bench, [&] () -> async::result<void> {
+		co_await async::when_all(
+			async::transform(
+				helix_ng::exchangeMsgs(lane1, helix_ng::sendBufferV(sItems)
+			), [&] (auto result) {
+				auto [send] = std::move(result);
+				HEL_CHECK(send.error());
+			}),
+			async::transform(
+				helix_ng::exchangeMsgs(lane2, helix_ng::recvBufferV(rItems)
+			), [&] (auto result) {
+				auto [recv] = std::move(result);
+				HEL_CHECK(recv.error());
+				assert(recv.actualLength() == size);
+			})
+		);
+	});
+	bench.finalizeStatistics(size);
+}
+
+// Passes a memory descriptor over a stream.
+async::result<void> doDescriptorTransferBenchmark() {
+	auto [lane1, lane2] = helix::createStream();
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &handle));
+	helix::UniqueDescriptor memory{handle};
+
+	IterationsPerSecondBenchmark bench{"descriptor transfer"};
+	co_await runAsyncIterations(bench, [&] () -> async::result<void> {
+		co_await async::when_all(
+			async::transform(
+				helix_ng::exchangeMsgs(lane1, helix_ng::pushDescriptor(memory)
+			), [&] (auto result) {
+				auto [push] = std::move(result);
+				HEL_CHECK(push.error());
+			}),
+			async::transform(
+				helix_ng::exchangeMsgs(lane2, helix_ng::pullDescriptor()
+			), [&] (auto result) {
+				auto [pull] = std::move(result);
+				HEL_CHECK(pull.error());
+				// Closes the received descriptor.
+				pull.descriptor();
+			})
+		);
+	});
+	bench.finalizeStatistics();
+}
+
+#ifdef KERNEL_BENCH_DRM_CORE
+// Copies a full screen into write-combining memory, as done by drivers that blit
+// into a linear framebuffer. At 60 Hz, an iteration needs to take less than 16.6 ms.
+void doFramebufferCopyBenchmark(unsigned int width, unsigned int height) {
+	size_t size = size_t{width} * height * 4;
+
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+	helix::UniqueDescriptor memory{handle};
+	auto view = drm_core::createWriteCombiningView(memory, size);
+	helix::Mapping fb{view, 0, size};
+
+	void *window;
+	HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+	HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+	helix::UniqueDescriptor backing{handle};
+	memset(window, 0x55, size);
+
+	auto suffix = ", " + std::to_string(width) + "x" + std::to_string(height);
+	{
+		IterationsPerSecondBenchmark bench{"framebuffer memcpy" + suffix};
+		runIterations(bench, [&] {
+			memcpy(fb.get(), window, size);
+		});
+		bench.finalizeStatistics(size);
+	}
+	{
+		IterationsPerSecondBenchmark bench{"framebuffer fastCopy16" + suffix};
+		runIterations(bench, [&] {
+			drm_core::fastCopy16(fb.get(), window, size);
+		});
+		bench.finalizeStatistics(size);
+	}
+
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
 }
+#endif
 
 } // anonymous namespace
 
-int main() {
+int main(int argc, char **argv) {
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--json")) {
+			jsonOutput = true;
+		}else{
+			std::cerr << "usage: kernel-bench [--json]" << std::endl;
+			return 1;
+		}
+	}
+
+	calibrateClock();
+
 	doNopBenchmark();
 	doFutexBenchmark();
 	async::run(doAsyncNopBenchmark(), helix::currentDispatcher);
+	doThreadBenchmark();
 	doAllocateBenchmark(1 << 20);
 	doMapBenchmark(1 << 20);
 	doMapPopulatedBenchmark(1 << 20);
 	doPageFaultBenchmark(1 << 20);
-	async::run(doSendRecvBufferBenchmark(1), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(32), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(128), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(4096), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(16 * 1024), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(64 * 1024), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(1024 * 1024), helix::currentDispatcher);
+	doIndirectPageFaultBenchmark(1 << 20);
+	doForkMemoryBenchmark(1 << 20);
+	for(size_t size : {1, 32, 128, 4096, 16 * 1024, 60 * 1024, 64 * 1024, 1024 * 1024})
+		async::run(doSendRecvBufferBenchmark(size), helix::currentDispatcher);
+	async::run(doSendRecvBufferSgBenchmark(16 * 1024, 4), helix::currentDispatcher);
+	async::run(doSendRecvBufferSgBenchmark(1024 * 1024, 16), helix::currentDispatcher);
+	async::run(doDescriptorTransferBenchmark(), helix::currentDispatcher);
+#ifdef KERNEL_BENCH_DRM_CORE
+	doFramebufferCopyBenchmark(1920, 1080);
+	doFramebufferCopyBenchmark(3840, 2160);
+#endif
+
+	// Repeat an IPC benchmark on a thread that defers submissions to a submission ring.
+	std::thread{[] {
+		helix::Dispatcher::global().enableSubmissionRing();
+		output() << "with submission ring:" << std::endl;
+		async::run(doSendRecvBufferBenchmark(128), helix::currentDispatcher);
+	}}.join();
+
+	for(auto numThreads : scalingThreadCounts()) {
+		doScalingNopBenchmark(numThreads);
+		doAllocateBenchmark(1 << 20, numThreads);
+		doScalingPageFaultBenchmark(numThreads);
+	}
+
+	if(jsonOutput)
+		printJsonResults();
 }
@@ -0,0 +1,29 @@
+#include <cassert>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "testsuite.hpp"
+
+DEFINE_TEST(clockPageMonotonic, ([] {
+	void *window;
+	HEL_CHECK(helMapMemory(kHelClockMemory, kHelNullHandle, nullptr,
+			0, 0x1000, kHelMapProtRead, &window));
+	auto page = reinterpret_cast<const HelClockPage *>(window);
+
+	// The page-based clock must agree with the syscall.
+	uint64_t before, fromPage, after;
+	HEL_CHECK(helGetClock(&before));
+	HEL_CHECK(helGetClockFromPage(page, &fromPage));
+	HEL_CHECK(helGetClock(&after));
+	assert(before <= fromPage);
+	assert(fromPage <= after);
+
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, 0x1000));
+}))
+
+DEFINE_TEST(clockPageReadOnly, ([] {
+	void *window;
+	assert(helMapMemory(kHelClockMemory, kHelNullHandle, nullptr,
+			0, 0x1000, kHelMapProtRead | kHelMapProtWrite, &window) == kHelErrIllegalArgs);
+}))
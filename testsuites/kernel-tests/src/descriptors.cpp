@@ -0,0 +1,63 @@
+#include <cassert>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "testsuite.hpp"
+
+DEFINE_TEST(closeDescriptorsBatch, ([] {
+	HelHandle handles[100];
+	for(auto &handle : handles)
+		HEL_CHECK(helCreateOneshotEvent(&handle));
+
+	HEL_CHECK(helCloseDescriptors(kHelThisUniverse, handles, 100));
+
+	// All handles must be gone now.
+	for(auto handle : handles)
+		assert(helCloseDescriptor(kHelThisUniverse, handle) == kHelErrNoDescriptor);
+}))
+
+DEFINE_TEST(closeDescriptorsMissing, ([] {
+	HelHandle handles[2];
+	HEL_CHECK(helCreateOneshotEvent(&handles[0]));
+	HEL_CHECK(helCreateOneshotEvent(&handles[1]));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handles[0]));
+
+	// The missing handle is reported but the other handle is still closed.
+	assert(helCloseDescriptors(kHelThisUniverse, handles, 2) == kHelErrNoDescriptor);
+	assert(helCloseDescriptor(kHelThisUniverse, handles[1]) == kHelErrNoDescriptor);
+}))
+
+DEFINE_TEST(transferDescriptorsBatch, ([] {
+	HelHandle universe;
+	HEL_CHECK(helCreateUniverse(&universe));
+
+	HelHandle handles[50];
+	for(auto &handle : handles)
+		HEL_CHECK(helCreateOneshotEvent(&handle));
+
+	HelHandle copies[50];
+	HEL_CHECK(helTransferDescriptors(handles, 50, universe, copies));
+
+	// The copies are valid in the target universe.
+	HEL_CHECK(helCloseDescriptors(universe, copies, 50));
+	HEL_CHECK(helCloseDescriptors(kHelThisUniverse, handles, 50));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, universe));
+}))
+
+DEFINE_TEST(transferDescriptorsMissing, ([] {
+	HelHandle universe;
+	HEL_CHECK(helCreateUniverse(&universe));
+
+	HelHandle handles[2];
+	HEL_CHECK(helCreateOneshotEvent(&handles[0]));
+	HEL_CHECK(helCreateOneshotEvent(&handles[1]));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handles[1]));
+
+	// Nothing is transferred if a handle is missing.
+	HelHandle copies[2];
+	assert(helTransferDescriptors(handles, 2, universe, copies) == kHelErrNoDescriptor);
+
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handles[0]));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, universe));
+}))
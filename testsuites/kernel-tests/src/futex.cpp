@@ -0,0 +1,58 @@
+#include <cassert>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "testsuite.hpp"
+
+DEFINE_TEST(futexRequeueRace, ([] {
+	int futex = 1;
+	int target = 0;
+
+	// The futex value does not match; the requeue must be rejected.
+	auto error = helFutexRequeue(&futex, 0, &target, 1, 1);
+	assert(error == kHelErrCancelled);
+}))
+
+DEFINE_TEST(futexRequeueNoWaiters, ([] {
+	int futex = 0;
+	int target = 0;
+
+	// Requeuing a futex without waiters is a no-op.
+	HEL_CHECK(helFutexRequeue(&futex, 0, &target, 1, 1));
+	HEL_CHECK(helFutexRequeue(&futex, 0, &futex, 1, 1));
+}))
+
+DEFINE_TEST(futexWaitVectorRace, ([] {
+	int first = 0;
+	int second = 1;
+
+	// The second futex does not match; the wait must return immediately.
+	HelFutexWaitEntry entries[] = {{&first, 0}, {&second, 0}};
+	size_t index;
+	HEL_CHECK(helFutexWaitVector(entries, 2, -1, &index));
+	assert(index == 1);
+}))
+
+DEFINE_TEST(futexWaitVectorTimeout, ([] {
+	int first = 0;
+	int second = 0;
+
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+
+	HelFutexWaitEntry entries[] = {{&first, 0}, {&second, 0}};
+	size_t index;
+	HEL_CHECK(helFutexWaitVector(entries, 2, now + 1'000'000, &index));
+	assert(index == 2);
+
+	assert(helFutexWaitVector(entries, 0, -1, &index) == kHelErrIllegalArgs);
+}))
+
+DEFINE_TEST(futexWakeCountNoWaiters, ([] {
+	int futex = 0;
+
+	unsigned int woken;
+	HEL_CHECK(helFutexWakeCount(&futex, 1, &woken));
+	assert(!woken);
+}))
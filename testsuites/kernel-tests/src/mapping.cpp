@@ -49,3 +49,139 @@ DEFINE_TEST(unmapPartialPreserve, ([] {
 	HEL_CHECK(helUnmapMemory(kHelNullHandle, p, 0x1000));
 	HEL_CHECK(helUnmapMemory(kHelNullHandle, p + 0x2000, 0x1000));
 }))
+
+DEFINE_TEST(zeroCowReadThenWrite, ([] {
+	HelHandle handle;
+	HEL_CHECK(helCopyOnWrite(kHelZeroMemory, 0, 0x2000, &handle));
+	void *window;
+	HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, 0x2000,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+
+	// Read faults map the shared zero page.
+	auto p = reinterpret_cast<volatile std::byte *>(window);
+	assert(p[0] == static_cast<std::byte>(0));
+	assert(p[0x1000] == static_cast<std::byte>(0));
+
+	// Writing must replace the zero page by a private copy.
+	p[0] = static_cast<std::byte>(42);
+	assert(p[0] == static_cast<std::byte>(42));
+	assert(p[0x1000] == static_cast<std::byte>(0));
+
+	// Clean up.
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, 0x2000));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+}))
+
+DEFINE_TEST(indirectReplaceSlot, ([] {
+	HelHandle first, second;
+	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &first));
+	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &second));
+
+	void *window;
+	HEL_CHECK(helMapMemory(second, kHelNullHandle, nullptr, 0, 0x1000,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+	*reinterpret_cast<volatile int *>(window) = 42;
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, 0x1000));
+
+	HelHandle indirect;
+	HEL_CHECK(helCreateIndirectMemory(1, &indirect));
+	HEL_CHECK(helAlterMemoryIndirection(indirect, 0, first, 0, 0x1000));
+	// Replacing the slot retires the previous indirection.
+	HEL_CHECK(helAlterMemoryIndirection(indirect, 0, second, 0, 0x1000));
+
+	HEL_CHECK(helMapMemory(indirect, kHelNullHandle, nullptr, 0, 0x1000,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+	assert(*reinterpret_cast<volatile int *>(window) == 42);
+
+	// Clean up.
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, 0x1000));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, indirect));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, first));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, second));
+}))
+
+DEFINE_TEST(decommitCowZeroes, ([] {
+	HelHandle handle;
+	HEL_CHECK(helCopyOnWrite(kHelZeroMemory, 0, 0x3000, &handle));
+	void *window;
+	HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, 0x3000,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+
+	auto p = reinterpret_cast<volatile std::byte *>(window);
+	p[0] = static_cast<std::byte>(42);
+	p[0x1000] = static_cast<std::byte>(21);
+	p[0x2000] = static_cast<std::byte>(7);
+
+	// Decommitting the middle page must not affect its neighbours.
+	HEL_CHECK(helDecommitMemory(kHelNullHandle, const_cast<std::byte *>(p) + 0x1000, 0x1000));
+	assert(p[0] == static_cast<std::byte>(42));
+	assert(p[0x1000] == static_cast<std::byte>(0));
+	assert(p[0x2000] == static_cast<std::byte>(7));
+
+	// The range stays mapped and can be written again.
+	p[0x1000] = static_cast<std::byte>(1);
+	assert(p[0x1000] == static_cast<std::byte>(1));
+
+	// Clean up.
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, 0x3000));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+}))
+
+DEFINE_TEST(populateCow, ([] {
+	HelHandle handle;
+	HEL_CHECK(helCopyOnWrite(kHelZeroMemory, 0, 0x2000, &handle));
+	void *window;
+	HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, 0x2000,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+
+	HEL_CHECK(helPopulateMemory(kHelNullHandle, window, 0x2000, kHelPopulateWrite));
+
+	auto p = reinterpret_cast<volatile std::byte *>(window);
+	assert(p[0] == static_cast<std::byte>(0));
+	p[0x1000] = static_cast<std::byte>(42);
+	assert(p[0x1000] == static_cast<std::byte>(42));
+
+	// Populating unmapped memory fails.
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, 0x2000));
+	assert(helPopulateMemory(kHelNullHandle, window, 0x2000, 0) == kHelErrFault);
+
+	// Clean up.
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+}))
+
+DEFINE_TEST(queryPhysicalRanges, ([] {
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory(0x4000, kHelAllocContinuous, nullptr, &handle));
+	void *window;
+	HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, 0x4000,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+
+	// Contiguous memory is reported as a single range, both through the mapping
+	// and through the memory object.
+	HelPhysicalRange ranges[4];
+	size_t count;
+	HEL_CHECK(helQueryPhysicalRanges(kHelNullHandle, reinterpret_cast<uintptr_t>(window) + 0x10,
+			0x3000, ranges, 4, &count));
+	assert(count == 1);
+	assert(ranges[0].length == 0x3000);
+
+	uintptr_t physical;
+	HEL_CHECK(helPointerPhysical(reinterpret_cast<std::byte *>(window) + 0x10, &physical));
+	assert(ranges[0].physical == physical);
+
+	HEL_CHECK(helQueryPhysicalRanges(handle, 0x10, 0x3000, ranges, 4, &count));
+	assert(count == 1);
+	assert(ranges[0].physical == physical);
+	assert(ranges[0].length == 0x3000);
+
+	// Ranges beyond the memory object are rejected.
+	assert(helQueryPhysicalRanges(handle, 0, 0x5000, ranges, 4, &count) == kHelErrOutOfBounds);
+
+	// Querying unmapped memory fails.
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, 0x4000));
+	assert(helQueryPhysicalRanges(kHelNullHandle, reinterpret_cast<uintptr_t>(window),
+			0x1000, ranges, 4, &count) == kHelErrFault);
+
+	// Clean up.
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+}))
@@ -0,0 +1,30 @@
+#include <cassert>
+#include <cstring>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "testsuite.hpp"
+
+DEFINE_TEST(randomBytesDiffer, ([] {
+	unsigned char first[32];
+	unsigned char second[32];
+
+	size_t size;
+	HEL_CHECK(helGetRandomBytes(first, sizeof(first), &size));
+	assert(size == sizeof(first));
+	HEL_CHECK(helGetRandomBytes(second, sizeof(second), &size));
+	assert(size == sizeof(second));
+
+	// Consecutive requests must not return the same bytes.
+	assert(memcmp(first, second, sizeof(first)));
+}))
+
+DEFINE_TEST(randomBytesLarge, ([] {
+	unsigned char buffer[1024];
+
+	// Large requests may be truncated but always make progress.
+	size_t size;
+	HEL_CHECK(helGetRandomBytes(buffer, sizeof(buffer), &size));
+	assert(size && size <= sizeof(buffer));
+}))
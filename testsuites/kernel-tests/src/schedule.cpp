@@ -0,0 +1,42 @@
+#include <cassert>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "testsuite.hpp"
+
+DEFINE_TEST(scheduleGroupConfigure, ([] {
+	HelHandle parent;
+	HEL_CHECK(helCreateScheduleGroup(kHelNullHandle, &parent));
+	HelHandle child;
+	HEL_CHECK(helCreateScheduleGroup(parent, &child));
+
+	// Weights and periods are validated.
+	HelScheduleGroupParams invalidWeight{.weight = 0, .quota = 0, .period = 0};
+	assert(helConfigureScheduleGroup(child, &invalidWeight) == kHelErrIllegalArgs);
+	HelScheduleGroupParams invalidPeriod{.weight = 100, .quota = 1'000'000, .period = 0};
+	assert(helConfigureScheduleGroup(child, &invalidPeriod) == kHelErrIllegalArgs);
+
+	HelScheduleGroupParams params{.weight = 50, .quota = 5'000'000, .period = 10'000'000};
+	HEL_CHECK(helConfigureScheduleGroup(child, &params));
+
+	// Threads in a throttled group still make progress.
+	HEL_CHECK(helSetScheduleGroup(kHelThisThread, child));
+	HelThreadStats before;
+	HEL_CHECK(helQueryThreadStats(kHelThisThread, &before));
+	uint64_t start;
+	HEL_CHECK(helGetClock(&start));
+	while(true) {
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		if(now - start > 30'000'000)
+			break;
+	}
+	HelThreadStats after;
+	HEL_CHECK(helQueryThreadStats(kHelThisThread, &after));
+	assert(after.userTime + after.kernelTime > before.userTime + before.kernelTime);
+	HEL_CHECK(helSetScheduleGroup(kHelThisThread, kHelNullHandle));
+
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, child));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, parent));
+}))
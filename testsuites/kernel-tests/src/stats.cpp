@@ -0,0 +1,87 @@
+#include <cassert>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "testsuite.hpp"
+
+DEFINE_TEST(kernelStatsFutex, ([] {
+	HelKernelStats before;
+	HEL_CHECK(helQueryKernelStats(&before));
+
+	int futex = 0;
+	HEL_CHECK(helFutexWake(&futex));
+
+	HelKernelStats after;
+	HEL_CHECK(helQueryKernelStats(&after));
+
+	// The counters are system-wide, hence other threads may also increment them.
+	assert(after.futexWakes > before.futexWakes);
+	assert(after.contextSwitches >= before.contextSwitches);
+	assert(after.handoffSwitches >= before.handoffSwitches);
+	assert(after.physicalAllocations >= before.physicalAllocations);
+}))
+
+DEFINE_TEST(memoryPressureQuery, ([] {
+	HelMemoryPressureInfo info;
+	HEL_CHECK(helQueryMemoryPressure(&info));
+	assert(info.freeBytes <= info.totalBytes);
+	assert(info.defaultCriticalFreeBytes <= info.defaultLowFreeBytes);
+	assert(info.level <= kHelMemoryPressureCritical);
+
+	// Watermarks are validated.
+	HelMemoryPressureWatermarks invalid{.lowFreeBytes = 4096, .criticalFreeBytes = 8192};
+	HelHandle handle;
+	assert(helCreateMemoryPressureEvent(&invalid, &handle) == kHelErrIllegalArgs);
+
+	HEL_CHECK(helCreateMemoryPressureEvent(nullptr, &handle));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+}))
+
+DEFINE_TEST(threadStatsCpuTime, ([] {
+	HelThreadStats before;
+	HEL_CHECK(helQueryThreadStats(kHelThisThread, &before));
+
+	// Spend some time in the kernel.
+	for(int i = 0; i < 1000; i++)
+		HEL_CHECK(helNop());
+
+	HelThreadStats after;
+	HEL_CHECK(helQueryThreadStats(kHelThisThread, &after));
+
+	assert(after.userTime + after.kernelTime > before.userTime + before.kernelTime);
+	assert(after.kernelTime > before.kernelTime);
+	assert(after.voluntarySwitches >= before.voluntarySwitches);
+	assert(after.involuntarySwitches >= before.involuntarySwitches);
+	assert(after.migrations >= before.migrations);
+}))
+
+DEFINE_TEST(spaceMemoryQuery, ([] {
+	HelHandle space;
+	HEL_CHECK(helCreateSpace(&space));
+
+	HelSpaceMemoryInfo info;
+	HEL_CHECK(helQuerySpaceMemory(space, &info));
+	assert(!info.anonymousBytes);
+	assert(!info.fileBytes);
+
+	HelHandle memory;
+	HEL_CHECK(helAllocateMemory(0x4000, 0, nullptr, &memory));
+	void *window;
+	HEL_CHECK(helMapMemory(memory, space, nullptr, 0, 0x4000,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+	HEL_CHECK(helPopulateMemory(space, window, 0x4000, kHelPopulateWrite));
+
+	HEL_CHECK(helQuerySpaceMemory(space, &info));
+	assert(info.anonymousBytes == 0x4000);
+	assert(!info.fileBytes);
+
+	// Unmapping releases the pages from the counters.
+	HEL_CHECK(helUnmapMemory(space, window, 0x4000));
+	HEL_CHECK(helQuerySpaceMemory(space, &info));
+	assert(!info.anonymousBytes);
+
+	// Clean up.
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, memory));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, space));
+}))
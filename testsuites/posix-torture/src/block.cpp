@@ -0,0 +1,59 @@
+#include <atomic>
+#include <cassert>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "testsuite.hpp"
+
+// Sequential reads from a block device, e.g., a USB mass storage device.
+// The device is taken from POSIX_TORTURE_BLOCK_DEVICE and defaults to /dev/sda.
+// All threads share one stream of offsets, so the device sees a sequential access pattern.
+// Multiply the reported ops/s by blockSize to obtain the throughput.
+struct BlockRead {
+	static constexpr size_t blockSize = 256 * 1024;
+
+	BlockRead(std::atomic<off_t> *nextOffset)
+	: nextOffset{nextOffset} {
+		const char *path = getenv("POSIX_TORTURE_BLOCK_DEVICE");
+		if(!path)
+			path = "/dev/sda";
+		fd = open(path, O_RDONLY);
+		if(fd < 0) {
+			std::cout << "posix-torture: Cannot open " << path
+					<< ", block_sequential_read does nothing" << std::endl;
+			return;
+		}
+		deviceSize = lseek(fd, 0, SEEK_END);
+		assert(deviceSize >= static_cast<off_t>(blockSize));
+		buffer = std::make_unique<char[]>(blockSize);
+	}
+
+	~BlockRead() {
+		if(fd >= 0)
+			close(fd);
+	}
+
+	void run() {
+		if(fd < 0)
+			return;
+		auto offset = nextOffset->fetch_add(blockSize, std::memory_order_relaxed)
+				% (deviceSize - deviceSize % blockSize);
+		auto res = pread(fd, buffer.get(), blockSize, offset);
+		assert(res == static_cast<ssize_t>(blockSize));
+	}
+
+	std::atomic<off_t> *nextOffset;
+	int fd;
+	off_t deviceSize = 0;
+	std::unique_ptr<char[]> buffer;
+};
+
+DEFINE_BENCH(block_sequential_read, ([] {
+	static std::atomic<off_t> nextOffset{0};
+	return [state = std::make_shared<BlockRead>(&nextOffset)] {
+		state->run();
+	};
+}))
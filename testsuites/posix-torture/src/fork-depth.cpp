@@ -0,0 +1,89 @@
+#include <cassert>
+#include <iostream>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "testsuite.hpp"
+
+namespace {
+
+constexpr int maxForkDepth = 8;
+constexpr size_t numBufferPages = 16;
+
+// Lives in a shared mapping such that the forked leaves can report their timings.
+struct ForkFaultStats {
+	uint64_t nanos[maxForkDepth + 1];
+	uint64_t samples[maxForkDepth + 1];
+};
+
+uint64_t nowNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * uint64_t{1'000'000'000} + ts.tv_nsec;
+}
+
+void touchBuffer(char *buffer, char value) {
+	for(size_t i = 0; i < numBufferPages; i++)
+		buffer[i * 0x1000] = value;
+}
+
+// Forks depth times, writing to the buffer before each fork such that all pages are
+// part of a CoW chain. The last child measures the latency of its write faults.
+void forkAndFault(char *buffer, ForkFaultStats *stats, int depth, int level) {
+	if(level == depth) {
+		auto before = nowNanos();
+		touchBuffer(buffer, level);
+		auto elapsed = nowNanos() - before;
+		stats->nanos[depth] += elapsed;
+		stats->samples[depth]++;
+		_exit(0);
+	}
+
+	touchBuffer(buffer, level);
+
+	int pid = fork();
+	assert(pid >= 0);
+	if(!pid)
+		forkAndFault(buffer, stats, depth, level + 1);
+
+	int status;
+	auto res = waitpid(pid, &status, 0);
+	assert(res > 0);
+	if(level)
+		_exit(0);
+}
+
+} // namespace
+
+DEFINE_TEST(fork_fault_depth, ([] {
+	static char *buffer = nullptr;
+	static ForkFaultStats *stats = nullptr;
+	static int iteration = 0;
+
+	if(!buffer) {
+		buffer = static_cast<char *>(mmap(nullptr, numBufferPages * 0x1000,
+				PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		assert(buffer != MAP_FAILED);
+		auto window = mmap(nullptr, sizeof(ForkFaultStats),
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		assert(window != MAP_FAILED);
+		stats = new (window) ForkFaultStats{};
+	}
+
+	int depth = iteration++ % maxForkDepth + 1;
+	forkAndFault(buffer, stats, depth, 0);
+
+	// Report the average latency whenever the number of samples reaches a power of two.
+	auto samples = stats->samples[maxForkDepth];
+	if(depth == maxForkDepth && samples >= 64 && !(samples & (samples - 1))) {
+		for(int d = 1; d <= maxForkDepth; d++)
+			std::cout << "posix-torture: fork_fault_depth: depth " << d << ": "
+					<< stats->nanos[d] / (stats->samples[d] * numBufferPages)
+					<< " ns per fault" << std::endl;
+	}
+}))
@@ -1,4 +1,13 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
 #include <vector>
 
 #include "testsuite.hpp"
@@ -12,7 +21,27 @@ void abstract_test_case::register_case(abstract_test_case *tcp) {
 	test_case_ptrs().push_back(tcp);
 }
 
-int main() {
+std::vector<abstract_bench_case *> &bench_case_ptrs() {
+	static std::vector<abstract_bench_case *> singleton;
+	return singleton;
+}
+
+void abstract_bench_case::register_case(abstract_bench_case *bcp) {
+	bench_case_ptrs().push_back(bcp);
+}
+
+namespace {
+
+// Each thread keeps at most this many latency samples.
+constexpr size_t maxSamplesPerThread = size_t{1} << 20;
+
+uint64_t nowNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * uint64_t{1'000'000'000} + ts.tv_nsec;
+}
+
+void runTorture() {
 	for(int s = 10; s < 24; s++) {
 		int n = 1 << s;
 		for(abstract_test_case *tcp : test_case_ptrs()) {
@@ -23,3 +52,117 @@ int main() {
 		}
 	}
 }
+
+// Runs the benchmark on numThreads threads for the given duration and prints
+// the total throughput and the latency distribution of all threads.
+void runBench(abstract_bench_case *bcp, unsigned int numThreads, uint64_t durationMs) {
+	std::atomic<unsigned int> numReady{0};
+	std::atomic<bool> start{false};
+	std::atomic<bool> stop{false};
+	std::vector<uint64_t> counts(numThreads);
+	std::vector<std::vector<uint64_t>> samples(numThreads);
+
+	std::vector<std::thread> threads;
+	for(unsigned int t = 0; t < numThreads; t++) {
+		threads.emplace_back([&, t] {
+			auto op = bcp->make_worker();
+			samples[t].reserve(maxSamplesPerThread);
+			numReady.fetch_add(1, std::memory_order_relaxed);
+			while(!start.load(std::memory_order_acquire))
+				std::this_thread::yield();
+
+			uint64_t n = 0;
+			while(!stop.load(std::memory_order_relaxed)) {
+				auto before = nowNanos();
+				op();
+				auto elapsed = nowNanos() - before;
+				if(samples[t].size() < maxSamplesPerThread)
+					samples[t].push_back(elapsed);
+				n++;
+			}
+			counts[t] = n;
+		});
+	}
+
+	while(numReady.load(std::memory_order_relaxed) < numThreads)
+		std::this_thread::yield();
+	auto before = nowNanos();
+	start.store(true, std::memory_order_release);
+	std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+	stop.store(true, std::memory_order_relaxed);
+
+	uint64_t n = 0;
+	std::vector<uint64_t> all;
+	for(unsigned int t = 0; t < numThreads; t++) {
+		threads[t].join();
+		n += counts[t];
+		all.insert(all.end(), samples[t].begin(), samples[t].end());
+	}
+	auto elapsed = nowNanos() - before;
+
+	// Nearest-rank percentiles.
+	std::sort(all.begin(), all.end());
+	auto percentile = [&] (double q) -> uint64_t {
+		if(all.empty())
+			return 0;
+		auto rank = std::clamp<size_t>(q * all.size() + 0.999, 1, all.size());
+		return all[rank - 1];
+	};
+
+	std::cout << "posix-torture: " << bcp->name() << ": threads " << numThreads
+			<< ": " << n * 1'000'000'000 / elapsed << " ops/s"
+			<< ", p50 " << percentile(0.5) << " ns"
+			<< ", p99 " << percentile(0.99) << " ns"
+			<< ", p999 " << percentile(0.999) << " ns" << std::endl;
+}
+
+void usage() {
+	std::cerr << "usage: posix-torture [--bench [--threads N] [--duration-ms MS] [BENCH...]]"
+			<< std::endl;
+	exit(1);
+}
+
+} // namespace
+
+// Without arguments, runs the torture tests with an increasing number of iterations.
+// With --bench, runs the benchmarks at 1, 2, 4, ... concurrent threads up to the
+// number of CPUs (or the --threads argument).
+int main(int argc, char **argv) {
+	if(argc == 1) {
+		runTorture();
+		return 0;
+	}
+
+	if(strcmp(argv[1], "--bench"))
+		usage();
+
+	long maxThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t durationMs = 1000;
+	std::vector<const char *> selected;
+	for(int i = 2; i < argc; i++) {
+		if(!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			maxThreads = atol(argv[++i]);
+		}else if(!strcmp(argv[i], "--duration-ms") && i + 1 < argc) {
+			durationMs = strtoull(argv[++i], nullptr, 10);
+		}else if(argv[i][0] == '-') {
+			usage();
+		}else{
+			selected.push_back(argv[i]);
+		}
+	}
+	if(maxThreads < 1)
+		maxThreads = 1;
+
+	std::vector<unsigned int> threadCounts;
+	for(unsigned int n = 1; n < maxThreads; n *= 2)
+		threadCounts.push_back(n);
+	threadCounts.push_back(maxThreads);
+
+	for(abstract_bench_case *bcp : bench_case_ptrs()) {
+		if(!selected.empty() && std::none_of(selected.begin(), selected.end(),
+				[&] (const char *name) { return !strcmp(name, bcp->name()); }))
+			continue;
+		for(auto numThreads : threadCounts)
+			runBench(bcp, numThreads, durationMs);
+	}
+}
@@ -9,3 +9,13 @@ DEFINE_TEST(map_unmap_anonymous, ([] {
 	assert(window != MAP_FAILED);
 	munmap(window, 0x1000);
 }))
+
+DEFINE_BENCH(mmap_munmap, ([] {
+	return [] {
+		void *window = mmap(nullptr, 0x1000, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		assert(window != MAP_FAILED);
+		*static_cast<volatile char *>(window) = 1;
+		munmap(window, 0x1000);
+	};
+}))
@@ -1,7 +1,11 @@
 #include <cassert>
+#include <fcntl.h>
 #include <linux/netlink.h>
+#include <memory>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/timerfd.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "testsuite.hpp"
@@ -23,3 +27,149 @@ DEFINE_TEST(open_close_unix, ([] {
 	assert(fd > 0);
 	close(fd);
 }))
+
+DEFINE_BENCH(open_close, ([] {
+	return [] {
+		int fd = open("/dev/null", O_RDONLY);
+		assert(fd >= 0);
+		close(fd);
+	};
+}))
+
+DEFINE_BENCH(stat, ([] {
+	return [] {
+		struct stat st;
+		int res = stat("/dev/null", &st);
+		assert(!res);
+	};
+}))
+
+// Each thread bounces a byte off a child process that echoes it back.
+DEFINE_BENCH(pipe_ping_pong, ([] {
+	struct PingPong {
+		PingPong() {
+			int res = pipe(ping);
+			assert(!res);
+			res = pipe(pong);
+			assert(!res);
+
+			pid = fork();
+			assert(pid >= 0);
+			if(!pid) {
+				close(ping[1]);
+				close(pong[0]);
+				char c;
+				while(read(ping[0], &c, 1) == 1)
+					write(pong[1], &c, 1);
+				_exit(0);
+			}
+			close(ping[0]);
+			close(pong[1]);
+		}
+
+		~PingPong() {
+			close(ping[1]);
+			close(pong[0]);
+			int status;
+			waitpid(pid, &status, 0);
+		}
+
+		void run() {
+			char c = 1;
+			auto res = write(ping[1], &c, 1);
+			assert(res == 1);
+			res = read(pong[0], &c, 1);
+			assert(res == 1);
+		}
+
+		int ping[2];
+		int pong[2];
+		int pid;
+	};
+
+	return [state = std::make_shared<PingPong>()] {
+		state->run();
+	};
+}))
+
+// Each thread streams blocks to a child process that acknowledges every complete block.
+// For sockets, data and acknowledgements use the two directions of the same socket pair.
+struct StreamThroughput {
+	static constexpr size_t blockSize = 64 * 1024;
+
+	StreamThroughput(bool useSocket) {
+		if(useSocket) {
+			int sv[2];
+			int res = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+			assert(!res);
+			data[0] = sv[1];
+			data[1] = sv[0];
+			ack[0] = dup(sv[0]);
+			ack[1] = dup(sv[1]);
+			assert(ack[0] >= 0 && ack[1] >= 0);
+		}else{
+			int res = pipe(data);
+			assert(!res);
+			res = pipe(ack);
+			assert(!res);
+		}
+
+		pid = fork();
+		assert(pid >= 0);
+		if(!pid) {
+			close(data[1]);
+			close(ack[0]);
+			auto buffer = std::make_unique<char[]>(blockSize);
+			while(true) {
+				size_t n = 0;
+				while(n < blockSize) {
+					auto res = read(data[0], buffer.get() + n, blockSize - n);
+					if(res <= 0)
+						_exit(0);
+					n += res;
+				}
+				char c = 1;
+				write(ack[1], &c, 1);
+			}
+		}
+		close(data[0]);
+		close(ack[1]);
+		buffer = std::make_unique<char[]>(blockSize);
+	}
+
+	~StreamThroughput() {
+		close(data[1]);
+		close(ack[0]);
+		int status;
+		waitpid(pid, &status, 0);
+	}
+
+	void run() {
+		size_t n = 0;
+		while(n < blockSize) {
+			auto res = write(data[1], buffer.get() + n, blockSize - n);
+			assert(res > 0);
+			n += res;
+		}
+		char c;
+		auto res = read(ack[0], &c, 1);
+		assert(res == 1);
+	}
+
+	int data[2];
+	int ack[2];
+	int pid;
+	std::unique_ptr<char[]> buffer;
+};
+
+DEFINE_BENCH(pipe_throughput, ([] {
+	return [state = std::make_shared<StreamThroughput>(false)] {
+		state->run();
+	};
+}))
+
+DEFINE_BENCH(unix_stream_throughput, ([] {
+	return [state = std::make_shared<StreamThroughput>(true)] {
+		state->run();
+	};
+}))
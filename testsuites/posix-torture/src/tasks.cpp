@@ -1,4 +1,6 @@
 #include <cassert>
+#include <mutex>
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -16,3 +18,30 @@ DEFINE_TEST(fork_exit_waitpid, ([] {
 		assert(res > 0);
 	}
 }))
+
+DEFINE_BENCH(fork_exec_wait, ([] {
+	return [] {
+		int pid = fork();
+		assert(pid >= 0);
+		if(!pid) {
+			execl("/usr/bin/true", "true", nullptr);
+			_exit(127);
+		}else{
+			int status;
+			auto res = waitpid(pid, &status, 0);
+			assert(res > 0);
+			assert(WIFEXITED(status) && !WEXITSTATUS(status));
+		}
+	};
+}))
+
+// All threads contend on the same mutex, which sleeps on a futex if it is taken.
+DEFINE_BENCH(futex_contention, ([] {
+	static std::mutex mutex;
+	static volatile uint64_t counter = 0;
+
+	return [] {
+		std::lock_guard lock{mutex};
+		counter = counter + 1;
+	};
+}))
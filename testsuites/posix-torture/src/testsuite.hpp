@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <utility>
 
 #define DEFINE_TEST(s, f) \
@@ -43,3 +44,49 @@ struct test_case : abstract_test_case {
 private:
 	F functor_;
 };
+
+// Benchmarks are only run in benchmark mode (see main.cpp). The functor is called once per
+// thread and returns another functor that performs a single operation. The latter is called
+// repeatedly while the benchmark runs; it is destructed afterwards (on the same thread).
+
+#define DEFINE_BENCH(s, f) \
+	static bench_case bench_ ## s{#s, f};
+
+struct abstract_bench_case {
+private:
+	static void register_case(abstract_bench_case *bcp);
+
+public:
+	abstract_bench_case(const char *name)
+	: name_{name} {
+		register_case(this);
+	}
+
+	abstract_bench_case(const abstract_bench_case &) = delete;
+
+	virtual ~abstract_bench_case() = default;
+
+	abstract_bench_case &operator= (const abstract_bench_case &) = delete;
+
+	const char *name() {
+		return name_;
+	}
+
+	virtual std::function<void()> make_worker() = 0;
+
+private:
+	const char *name_;
+};
+
+template<typename F>
+struct bench_case : abstract_bench_case {
+	bench_case(const char *name, F functor)
+	: abstract_bench_case{name}, functor_{std::move(functor)} { }
+
+	std::function<void()> make_worker() override {
+		return functor_();
+	}
+
+private:
+	F functor_;
+};
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+
+# Symbolizes a copy of /proc/lock_stat (recorded with thor.lockstat on the kernel command line).
+
+import argparse
+import bisect
+import subprocess
+
+parser = argparse.ArgumentParser()
+parser.add_argument('lockstat_path', type=str)
+parser.add_argument('--kernel', type=str,
+	default='pkg-builds/managarm-kernel/kernel/thor/thor',
+	help="path to the kernel ELF file")
+parser.add_argument('--sort-by',
+	choices=['wait', 'contended', 'acquisitions', 'hold'], default='wait')
+
+args = parser.parse_args()
+
+nm = subprocess.check_output(['nm', '-nC', args.kernel], encoding='ascii')
+
+sym_table = []
+for line in nm.splitlines():
+	start, attr, symbol = line.split(' ', 2)
+	sym_table.append((int(start, 16), symbol))
+sym_index = [e[0] for e in sym_table]
+
+def symbolize(address):
+	idx = bisect.bisect_right(sym_index, address)
+	if idx == 0:
+		return hex(address)
+	start, symbol = sym_table[idx - 1]
+	# Locks that are allocated on the heap are not covered by the symbol table.
+	if address - start >= 0x10000:
+		return hex(address)
+	return '{}+{}'.format(symbol, hex(address - start))
+
+# Aggregate all sites within the same function.
+stats = dict()
+with open(args.lockstat_path, 'r') as f:
+	f.readline() # Skip the header.
+	for line in f:
+		site, lock, acquisitions, contended, wait, hold = line.split()
+		site = int(site, 16)
+		idx = bisect.bisect_right(sym_index, site)
+		func = sym_table[idx - 1][1] if idx else hex(site)
+
+		if func not in stats:
+			stats[func] = {'acquisitions': 0, 'contended': 0, 'wait': 0, 'hold': 0,
+					'locks': set()}
+		s = stats[func]
+		s['acquisitions'] += int(acquisitions)
+		s['contended'] += int(contended)
+		s['wait'] += int(wait)
+		s['hold'] = max(s['hold'], int(hold))
+		s['locks'].add(symbolize(int(lock, 16)))
+
+out = sorted(stats.keys(), key=lambda func: stats[func][args.sort_by], reverse=True)
+for func in out:
+	s = stats[func]
+	print("{} acquisitions, {} contended ({:.2f}%), {} wait ticks, {} max hold ticks in:".format(
+		s['acquisitions'], s['contended'], s['contended'] / max(s['acquisitions'], 1) * 100,
+		s['wait'], s['hold']))
+	print("    {}".format(func))
+	print("    (lock: {})".format(', '.join(sorted(s['locks']))))
@@ -2,68 +2,128 @@
 
 import argparse
 import bisect
+import os
 import struct
 import subprocess
 
 parser = argparse.ArgumentParser()
 parser.add_argument('profile_path', type=str)
+parser.add_argument('--kernel', type=str,
+	default='pkg-builds/managarm-kernel/kernel/thor/thor',
+	help="path to the kernel ELF file")
+parser.add_argument('--user-binary', type=str, action='append', default=[],
+	metavar='PATH[@BASE]',
+	help="symbolize user space samples using this binary, loaded at BASE (default: 0)")
 parser.add_argument('--aggregate-by',
 	choices=['symbol', 'source'], default='symbol',
 	help="aggregate samples by source line of code or by symbol inside the binary")
 parser.add_argument('--line', action='store_true')
 parser.add_argument('--isn', action='store_true')
+parser.add_argument('--folded', action='store_true',
+	help="print folded stacks (e.g., for flamegraph.pl) instead of a flat profile")
 
 args = parser.parse_args()
 
-profile = dict()
+class SymbolTable:
+	def __init__(self, path, base=0):
+		self.name = os.path.basename(path)
+		nm = subprocess.check_output(['nm', '-nC', path], encoding='ascii')
+		self.table = []
+		for line in nm.splitlines():
+			parts = line.split(' ', 2)
+			if len(parts) != 3 or not parts[0]:
+				continue
+			start, attr, symbol = parts
+			self.table.append((int(start, 16) + base, symbol))
+		self.index = [e[0] for e in self.table]
 
-if args.aggregate_by == 'symbol':
-	nm = subprocess.check_output(
-		[
-			'nm', '-nC',
-			'pkg-builds/managarm-kernel/kernel/thor/thor'
-		],
-		encoding='ascii');
+	def covers(self, ip):
+		return self.index and self.index[0] <= ip <= self.index[-1]
 
-	sym_table = []
-	for line in nm.splitlines():
-		start, attr, symbol = line.split(' ', 2)
-		sym_table.append((int(start, 16), symbol))
-	sym_index = [e[0] for e in sym_table]
-else:
+	def lookup(self, ip):
+		idx = bisect.bisect_right(self.index, ip)
+		if idx == 0:
+			return None
+		start, symbol = self.table[idx - 1]
+		assert ip >= start
+		return symbol
+
+kernel_syms = SymbolTable(args.kernel)
+
+user_syms = []
+for spec in args.user_binary:
+	path, _, base = spec.partition('@')
+	user_syms.append(SymbolTable(path, int(base, 0) if base else 0))
+
+def symbolize_user(ip):
+	for syms in user_syms:
+		if syms.covers(ip):
+			symbol = syms.lookup(ip)
+			if symbol is not None:
+				return '{}`{}'.format(syms.name, symbol)
+	return None
+
+if args.aggregate_by == 'source' and not args.folded:
 	addr2line = subprocess.Popen(
 		[
 			'addr2line', '-sfC',
-			'-e', 'pkg-builds/managarm-kernel/kernel/thor/thor'
+			'-e', args.kernel
 		],
 		encoding='ascii',
 		stdin=subprocess.PIPE, stdout=subprocess.PIPE)
 
+# Records written by thor (see ProfileSample): a header word, followed by the frames.
+def read_samples(f):
+	while True:
+		rec = f.read(8)
+		if len(rec) < 8:
+			return
+		header = struct.unpack('Q', rec)[0]
+		n_frames = header & 0xFFFF
+		is_user = bool(header & (1 << 16))
+		cpu = header >> 32
+		frames = struct.unpack('{}Q'.format(n_frames), f.read(8 * n_frames))
+		yield cpu, is_user, frames
+
+profile = dict()
 n_user = 0
 n_kernel = 0
 n_resolved = 0
 
 with open(args.profile_path, 'rb') as f:
-	while True:
-		rec = f.read(8)
-		if not rec:
-			break
-		ip = struct.unpack('Q', rec)[0]
-		if ip < (1 << 63):
+	for cpu, is_user, frames in read_samples(f):
+		if is_user:
 			n_user += 1
-			continue
 		else:
 			n_kernel += 1
 
-		if args.aggregate_by == 'symbol':
-			idx = bisect.bisect_right(sym_index, ip)
-			if idx == 0:
+		if args.folded:
+			# Print the outermost frame first.
+			names = []
+			for i, ip in enumerate(reversed(frames)):
+				if is_user:
+					symbol = symbolize_user(ip)
+				else:
+					symbol = kernel_syms.lookup(ip)
+					if symbol is not None:
+						symbol = 'thor`' + symbol
+				names.append(symbol if symbol is not None else hex(ip))
+			loc = ('[user]' if is_user else '[kernel]',) + tuple(names)
+			n_resolved += 1
+		elif is_user:
+			symbol = symbolize_user(frames[0])
+			if symbol is None:
+				continue
+			loc = symbol, 0
+			n_resolved += 1
+		elif args.aggregate_by == 'symbol':
+			symbol = kernel_syms.lookup(frames[0])
+			if symbol is None:
 				continue
-			start, symbol = sym_table[idx - 1];
-			assert ip >= start
-
 			loc = symbol, 0
+			n_resolved += 1
 		else:
+			ip = frames[0]
 			addr2line.stdin.write(hex(ip) + '\n')
 			addr2line.stdin.flush()
 			func = addr2line.stdout.readline().rstrip()
@@ -74,20 +134,24 @@ with open(args.profile_path, 'rb') as f:
 				loc = (func, line.split(':')[0] + ':' + hex(ip))
 			else:
 				loc = (func, line.split(':')[0])
+			n_resolved += 1
 
 		if loc in profile:
 			profile[loc] += 1
 		else:
 			profile[loc] = 1
-		n_resolved += 1
 
 n_all = n_user + n_kernel
 
-cumulative = 0
-out = sorted(profile.keys(), key=lambda loc: profile[loc])
-for loc in out:
-	print("{:.2f}% (cumulative: {:.2f}%) ({} samples) in:".format(profile[loc]/n_kernel*100, 100-cumulative/n_kernel*100, profile[loc]))
-	print("    {} in {}".format(loc[0], loc[1]))
-	cumulative += profile[loc]
-print("{} (= {:.2f}% of all samples) in the kernel".format(n_kernel, n_kernel/(n_user + n_kernel)*100))
-print("{:.2f}% of all kernel samples could be resolved".format(n_resolved/n_kernel*100))
+if args.folded:
+	for loc, count in sorted(profile.items()):
+		print('{} {}'.format(';'.join(loc), count))
+else:
+	cumulative = 0
+	out = sorted(profile.keys(), key=lambda loc: profile[loc])
+	for loc in out:
+		print("{:.2f}% (cumulative: {:.2f}%) ({} samples) in:".format(profile[loc]/n_all*100, 100-cumulative/n_all*100, profile[loc]))
+		print("    {} in {}".format(loc[0], loc[1]))
+		cumulative += profile[loc]
+	print("{} (= {:.2f}% of all samples) in the kernel".format(n_kernel, n_kernel/n_all*100))
+	print("{:.2f}% of all samples could be resolved".format(n_resolved/n_all*100))
@@ -25,6 +25,10 @@ int main(int argc, char **argv) {
 		f.set_path(config["files"][i].as<std::string>());
 		data.add_files(f);
 	}
+	if(config["after"]) {
+		for(size_t i = 0; i < config["after"].size(); i++)
+			data.add_after(config["after"][i].as<std::string>());
+	}
 
 	std::vector<char> buf(data.size_of_body());
 	bragi::limited_writer wr{buf.data(), data.size_of_body()};
@@ -2,6 +2,7 @@
 
 import os
 import shutil
+import struct
 import subprocess
 import tempfile
 import sys
@@ -11,6 +12,8 @@ parser = argparse.ArgumentParser(description = 'Generate a managarm initrd')
 parser.add_argument('-t', '--triple', dest = 'arch',
 		choices = ['x86_64-managarm', 'aarch64-managarm', 'riscv64-managarm'], default = 'x86_64-managarm',
 		help = 'Target system triple (default: x86_64-managarm)')
+parser.add_argument('--compress', choices = ['none', 'lz4'], default = 'none',
+		help = 'Compress individual files; thor expands them on first access (default: none)')
 
 args = parser.parse_args()
 
@@ -99,6 +102,35 @@ for fname in os.listdir('system-root/usr/lib/managarm/server'):
 		continue
 	add_file('system-root/usr/lib/managarm/server', 'usr/lib/managarm/server', fname)
 
+# Compressed files use the format that thor expects (see CompressedModuleHeader):
+# a 16 byte header followed by chunks that are compressed independently.
+# Each chunk is introduced by its length; bit 31 marks chunks that are stored as-is.
+chunk_size = 0x10000
+
+def compress_file(path):
+	import lz4.block
+
+	with open(path, 'rb') as f:
+		data = f.read()
+
+	out = bytearray(struct.pack('<4sIQ', b'TLZ4', chunk_size, len(data)))
+	for offset in range(0, len(data), chunk_size):
+		chunk = data[offset:offset + chunk_size]
+		compressed = lz4.block.compress(chunk, mode='high_compression', store_size=False)
+		if len(compressed) < len(chunk):
+			out += struct.pack('<I', len(compressed))
+			out += compressed
+		else:
+			out += struct.pack('<I', len(chunk) | (1 << 31))
+			out += chunk
+
+	# Keep files that do not benefit from compression (e.g., server descriptions) as-is.
+	if len(out) >= len(data):
+		return
+	os.unlink(path) # Do not modify the hard link's source.
+	with open(path, 'wb') as f:
+		f.write(out)
+
 # Copy (= hard link) the files to a temporary directory, run GNU cpio.
 
 tree_path = tempfile.mkdtemp(prefix='initrd-', dir='.')
@@ -115,6 +147,9 @@ for rel_path in file_list:
 	else:
 		os.link(entry.source, dest_path)
 
+	if not entry.is_dir and args.compress == 'lz4':
+		compress_file(dest_path)
+
 proc = subprocess.Popen(['cpio', '--create', '--format=newc',
 			'-D', tree_path,
 			'--file', 'initrd.cpio',
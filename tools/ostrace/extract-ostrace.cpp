@@ -4,6 +4,19 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
 #include <bragi/helpers-std.hpp>
 #include <CLI/App.hpp>
 #include <CLI/Formatter.hpp>
@@ -34,8 +47,15 @@ concept Policy = requires(T &a, managarm::ostrace::EventRecord &event, managarm:
 };
 
 struct JsonPolicy {
+	// If merge is set, events are sorted by their timestamps before they are printed.
+	// This is needed to interleave the events of different sources (e.g., the kernel's
+	// per-CPU tracepoint buffers) that are written to the log in batches.
+	JsonPolicy(bool merge)
+	: merge_{merge} { }
+
 	bool onEvent(managarm::ostrace::EventRecord &record, size_t) {
-		std::cout << "{\"_event\":\"" << terms.at(record.id()) << "\",\"_ts\":" << record.ts();
+		ts_ = record.ts();
+		line_ << "{\"_event\":\"" << terms.at(record.id()) << "\",\"_ts\":" << record.ts();
 		return true;
 	}
 
@@ -44,20 +64,35 @@ struct JsonPolicy {
 	}
 
 	bool onEndOfRecord(size_t) {
-		std::cout << "}\n";
+		line_ << "}\n";
+		if(merge_) {
+			events_.push_back({ts_, line_.str()});
+		}else{
+			std::cout << line_.str();
+		}
+		line_.str({});
 		return true;
 	}
 
 	bool onUintAttribute(managarm::ostrace::UintAttribute &record, size_t) {
-		std::cout << ",\"" << terms.at(record.id()) << "\":" << record.v();
+		line_ << ",\"" << terms.at(record.id()) << "\":" << record.v();
 		return true;
 	}
 
 	bool onBufferAttribute(managarm::ostrace::BufferAttribute &record, size_t) {
-		std::cout << ",\"" << terms.at(record.id()) << "\": \"<buffer of size " << record.buffer().size() << ">\"";
+		line_ << ",\"" << terms.at(record.id()) << "\": \"<buffer of size " << record.buffer().size() << ">\"";
 		return true;
 	}
 
+	void flush() {
+		std::stable_sort(events_.begin(), events_.end(), [] (const auto &a, const auto &b) {
+			return a.first < b.first;
+		});
+		for(auto &[ts, line] : events_)
+			std::cout << line;
+		events_.clear();
+	}
+
 	size_t passes() {
 		return 1;
 	}
@@ -68,6 +103,200 @@ struct JsonPolicy {
 
 	std::unordered_map<uint64_t, std::string> terms;
 	size_t parsedRecords;
+
+private:
+	bool merge_;
+	uint64_t ts_ = 0;
+	std::ostringstream line_;
+	std::vector<std::pair<uint64_t, std::string>> events_;
+};
+
+// Writes the Chrome trace event format (JSON array format), which is understood by
+// chrome://tracing and by the Perfetto UI. Each event prefix (i.e., "posix", "thor",
+// "libblockfs") becomes a process; posix requests are placed on one thread per client PID.
+// Since viewers sort the events, records are written as soon as they are complete;
+// the trailing ']' is optional in this format, hence partial traces are still valid.
+struct ChromePolicy {
+	ChromePolicy(std::ostream &out)
+	: out_{out} {
+		out_ << "[\n";
+	}
+
+	bool onEvent(managarm::ostrace::EventRecord &record, size_t) {
+		event_ = terms.at(record.id());
+		ts_ = record.ts();
+		attrs_.clear();
+		return true;
+	}
+
+	bool onDefinition(managarm::ostrace::Definition &, size_t) {
+		return true;
+	}
+
+	bool onEndOfRecord(size_t) {
+		if(event_ == "posix.request") {
+			onPosixRequest_();
+		}else if(event_ == "thor.syscall-enter") {
+			if(auto thread = attr_("thread"))
+				syscalls_[*thread] = ts_;
+		}else if(event_ == "thor.syscall-exit") {
+			auto thread = attr_("thread");
+			auto it = thread ? syscalls_.find(*thread) : syscalls_.end();
+			if(it != syscalls_.end()) {
+				std::ostringstream name;
+				name << "syscall " << attr_("syscall").value_or(0);
+				emitSlice_(name.str(), "thor", *thread, it->second, ts_);
+				syscalls_.erase(it);
+			}
+		}else if(auto time = attr_("time")) {
+			// Apart from posix.request, the time attribute is the duration of the operation
+			// that ends at the event's timestamp.
+			auto start = (*time <= ts_) ? ts_ - *time : ts_;
+			emitSlice_(event_, process_(event_), attr_("pid").value_or(0), start, ts_);
+		}else{
+			std::ostringstream line;
+			line << "{\"name\":\"" << escape_(event_) << "\",\"ph\":\"i\",\"s\":\"t\","
+					<< "\"pid\":" << processId_(process_(event_)) << ",\"tid\":" << attr_("cpu").value_or(0)
+					<< ",\"ts\":" << micros_(ts_) << args_() << "}";
+			emitLine_(line.str());
+		}
+		return true;
+	}
+
+	bool onUintAttribute(managarm::ostrace::UintAttribute &record, size_t) {
+		attrs_.push_back({terms.at(record.id()), record.v()});
+		return true;
+	}
+
+	bool onBufferAttribute(managarm::ostrace::BufferAttribute &, size_t) {
+		return true;
+	}
+
+	void flush() {
+		if(!posixRequests_.empty())
+			std::cerr << posixRequests_.size() << " posix requests did not receive a reply"
+					<< std::endl;
+		out_ << "\n]\n";
+		out_.flush();
+	}
+
+	size_t passes() {
+		return 1;
+	}
+
+	void reset() {
+
+	}
+
+	std::unordered_map<uint64_t, std::string> terms;
+	size_t parsedRecords;
+
+private:
+	// posix-subsystem emits one record when it receives a request and one when it replies.
+	// Both carry the PID and the timestamp of the request; only the reply carries
+	// the "request" attribute.
+	void onPosixRequest_() {
+		auto pid = attr_("pid").value_or(0);
+		auto time = attr_("time").value_or(ts_);
+		auto request = attr_("request");
+		if(!request) {
+			posixRequests_.insert({pid, time});
+			return;
+		}
+
+		posixRequests_.erase({pid, time});
+		std::ostringstream name;
+		name << "posix request " << *request;
+		emitSlice_(name.str(), "posix", pid, time, ts_);
+	}
+
+	std::optional<uint64_t> attr_(std::string_view name) {
+		for(auto &[n, v] : attrs_) {
+			if(n == name)
+				return v;
+		}
+		return std::nullopt;
+	}
+
+	static std::string process_(std::string_view event) {
+		return std::string{event.substr(0, event.find('.'))};
+	}
+
+	uint64_t processId_(const std::string &process) {
+		auto it = processes_.find(process);
+		if(it != processes_.end())
+			return it->second;
+
+		auto id = processes_.size() + 1;
+		processes_.insert({process, id});
+		std::ostringstream line;
+		line << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << id
+				<< ",\"args\":{\"name\":\"" << escape_(process) << "\"}}";
+		emitLine_(line.str());
+		return id;
+	}
+
+	void emitSlice_(std::string_view name, const std::string &process, uint64_t tid,
+			uint64_t start, uint64_t end) {
+		std::ostringstream line;
+		line << "{\"name\":\"" << escape_(name) << "\",\"ph\":\"X\",\"pid\":" << processId_(process)
+				<< ",\"tid\":" << tid << ",\"ts\":" << micros_(start)
+				<< ",\"dur\":" << micros_(end >= start ? end - start : 0) << args_() << "}";
+		emitLine_(line.str());
+	}
+
+	std::string args_() {
+		if(attrs_.empty())
+			return {};
+		std::ostringstream args;
+		args << ",\"args\":{";
+		for(size_t i = 0; i < attrs_.size(); i++) {
+			if(i)
+				args << ",";
+			args << "\"" << escape_(attrs_[i].first) << "\":" << attrs_[i].second;
+		}
+		args << "}";
+		return args.str();
+	}
+
+	void emitLine_(const std::string &line) {
+		if(!first_)
+			out_ << ",\n";
+		out_ << line;
+		first_ = false;
+	}
+
+	// Chrome traces use microseconds.
+	static std::string micros_(uint64_t ns) {
+		std::ostringstream s;
+		s << ns / 1000 << "." << std::setw(3) << std::setfill('0') << ns % 1000;
+		return s.str();
+	}
+
+	static std::string escape_(std::string_view str) {
+		std::string out;
+		for(auto c : str) {
+			if(c == '"' || c == '\\')
+				out += '\\';
+			if(static_cast<unsigned char>(c) < 0x20)
+				continue;
+			out += c;
+		}
+		return out;
+	}
+
+	std::ostream &out_;
+	bool first_ = true;
+
+	std::string event_;
+	uint64_t ts_ = 0;
+	std::vector<std::pair<std::string, uint64_t>> attrs_;
+
+	std::unordered_map<std::string, uint64_t> processes_;
+	// (PID, request timestamp) of posix requests that were not replied to yet.
+	std::set<std::pair<uint64_t, uint64_t>> posixRequests_;
+	// Maps kernel threads to the timestamp of their last syscall entry.
+	std::unordered_map<uint64_t, uint64_t> syscalls_;
 };
 
 struct WiresharkPolicy {
@@ -231,35 +460,32 @@ private:
 
 int main(int argc, char **argv) {
 	std::string path{"virtio-trace.bin"};
+	std::string outputPath;
 	bool pcap = false;
+	bool chrome = false;
+	bool merge = false;
+	bool follow = false;
 
 	CLI::App app{"extract-ostrace: extract records from ostrace logs"};
 	app.add_flag("--pcap", pcap, "Produce a bragi.pcap");
+	app.add_flag("--chrome", chrome, "Produce a Chrome JSON trace (can be opened in Perfetto)");
+	app.add_flag("--merge", merge, "Order events by timestamp (merges per-CPU kernel tracepoints)");
+	app.add_flag("--follow", follow, "Keep reading as the input grows (e.g., a live virtio-trace.bin or a FIFO)");
+	app.add_option("-o,--output", outputPath, "Write the Chrome trace to this file instead of stdout");
 	app.add_option("path", path, "Path to the input file");
 	CLI11_PARSE(app, argc, argv);
 
+	if(pcap && chrome)
+		errx(1, "--pcap and --chrome are mutually exclusive");
+	if(follow && pcap)
+		errx(1, "--follow is not supported with --pcap since it needs two passes");
+	if(follow && merge)
+		errx(1, "--follow is not supported with --merge since it needs all events");
+
 	int fd = open(path.c_str(), O_RDONLY);
 	if(fd < 0)
 		err(1, "failed to open input file %s", path.c_str());
 
-	struct stat st;
-	if(fstat(fd, &st) < 0) {
-		err(1, "failed to stat file");
-	}
-	if(!st.st_size)
-		err(1, "input file is empty");
-
-	auto ptr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
-	if(ptr == MAP_FAILED) {
-		ptr = nullptr;
-		err(1, "failed to mmap file");
-	}
-
-	close(fd);
-
-	frg::span<const char> fileBuffer{reinterpret_cast<const char *>(ptr),
-			static_cast<size_t>(st.st_size)};
-
 	auto handleMessage = []<Policy T>(T &policy, frg::span<const char> &buffer, size_t pass) -> bool {
 		auto preamble = bragi::read_preamble(buffer);
 		if(preamble.error()) {
@@ -386,11 +612,99 @@ int main(int argc, char **argv) {
 			<< " (" << fileBuffer.size() << " bytes remain)" << std::endl;
 	};
 
-	if(pcap) {
+	// Processes whole chunks of the input as they become available.
+	// At the end of a regular file, we wait for the writer to append more data;
+	// pipes and FIFOs are read until the writer closes them.
+	auto followWithPolicy = [&extractRecords]<Policy T>(T &policy, int fd, std::ostream &out) {
+		struct Header {
+			uint32_t size;
+		};
+
+		struct stat st;
+		if(fstat(fd, &st) < 0)
+			err(1, "failed to stat file");
+
+		std::vector<char> pending;
+		char chunk[0x10000];
+		policy.parsedRecords = 0;
+		policy.reset();
+
+		while(true) {
+			auto n = read(fd, chunk, sizeof(chunk));
+			if(n < 0)
+				err(1, "failed to read input file");
+			if(!n) {
+				if(S_ISFIFO(st.st_mode))
+					break;
+				std::this_thread::sleep_for(std::chrono::milliseconds{100});
+				continue;
+			}
+			pending.insert(pending.end(), chunk, chunk + n);
+
+			frg::span<const char> bufferView{pending.data(), pending.size()};
+			while(bufferView.size() >= sizeof(Header)) {
+				Header hdr;
+				memcpy(&hdr, bufferView.data(), sizeof(Header));
+				if(bufferView.size() < sizeof(Header) + hdr.size)
+					break;
+				if(!extractRecords(policy, bufferView, 0))
+					errx(1, "failed to parse input after %zu records", policy.parsedRecords);
+			}
+			pending.erase(pending.begin(), pending.end() - bufferView.size());
+			out.flush();
+		}
+
+		std::cerr << "extracted " << policy.parsedRecords << " records"
+			<< " (" << pending.size() << " bytes remain)" << std::endl;
+	};
+
+	auto mapFile = [&] () -> frg::span<const char> {
+		struct stat st;
+		if(fstat(fd, &st) < 0) {
+			err(1, "failed to stat file");
+		}
+		if(!st.st_size)
+			err(1, "input file is empty");
+
+		auto ptr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if(ptr == MAP_FAILED) {
+			ptr = nullptr;
+			err(1, "failed to mmap file");
+		}
+
+		close(fd);
+
+		return {reinterpret_cast<const char *>(ptr), static_cast<size_t>(st.st_size)};
+	};
+
+	if(chrome) {
+		std::ofstream outputFile;
+		if(!outputPath.empty()) {
+			outputFile.open(outputPath, std::ios::out | std::ios::trunc);
+			if(!outputFile)
+				err(1, "failed to open output file %s", outputPath.c_str());
+		}
+
+		auto &out = outputPath.empty() ? std::cout : outputFile;
+		auto policy = ChromePolicy{out};
+		if(follow) {
+			followWithPolicy(policy, fd, out);
+		} else {
+			auto fileBuffer = mapFile();
+			parseWithPolicy(policy, fileBuffer);
+		}
+		policy.flush();
+	} else if(follow) {
+		auto policy = JsonPolicy{false};
+		followWithPolicy(policy, fd, std::cout);
+	} else if(pcap) {
+		auto fileBuffer = mapFile();
 		auto policy = WiresharkPolicy{};
 		parseWithPolicy(policy, fileBuffer);
 	} else {
-		auto policy = JsonPolicy{};
+		auto fileBuffer = mapFile();
+		auto policy = JsonPolicy{merge};
 		parseWithPolicy(policy, fileBuffer);
+		policy.flush();
 	}
 }
@@ -27,26 +27,20 @@ struct PrintVisitor {
 
 async::result<void> enumerateBus() {
 	auto filter = mbus_ng::Conjunction({});
-	auto enumerator = mbus_ng::Instance::global().enumerate(filter);
-
-	while(true) {
-		auto [paginated, events] = (co_await enumerator.nextEvents()).unwrap();
-
-		for(auto &event : events) {
-			if(event.type != mbus_ng::EnumerationEvent::Type::created)
-				continue;
-
-			std::cout << "Entity \"" << event.name << "\" (ID " << event.id << "):\n";
-			for(auto &[name, value] : event.properties) {
-				std::cout << "\t" << name << ": ";
-				std::visit(PrintVisitor {}, value);
-				std::cout << std::endl;
-			}
-			std::cout << "\n";
+	auto enumerator = mbus_ng::Instance::global().enumerate(filter, {.pageSize = 256});
+	auto events = (co_await enumerator.currentEvents()).unwrap();
+
+	for(auto &event : events) {
+		if(event.type != mbus_ng::EnumerationEvent::Type::created)
+			continue;
+
+		std::cout << "Entity \"" << event.name << "\" (ID " << event.id << "):\n";
+		for(auto &[name, value] : event.properties) {
+			std::cout << "\t" << name << ": ";
+			std::visit(PrintVisitor {}, value);
+			std::cout << std::endl;
 		}
-
-		if (!paginated)
-			break;
+		std::cout << "\n";
 	}
 }
 }
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <fcntl.h>
 #include <format>
+#include <functional>
+#include <map>
 #include <stdarg.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -74,6 +77,56 @@ static std::vector<std::byte> readEntireFile(const char *path) {
 	return buffer;
 }
 
+struct FileMemory {
+	helix::UniqueDescriptor memory;
+	size_t size;
+};
+
+// Reads a file directly into a memory object that can be passed to the kernel.
+static FileMemory readFileToMemory(const char *path) {
+	auto fd = open(path, O_RDONLY);
+	if(fd < 0)
+		throw std::runtime_error(std::format("Could not open file '{}'", path));
+
+	struct stat st;
+	if(fstat(fd, &st))
+		throw std::runtime_error(std::format("Could not stat file '{}'", path));
+
+	size_t size = st.st_size;
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory((std::max(size, size_t{1}) + 0xFFF) & ~size_t{0xFFF},
+			0, nullptr, &handle));
+	helix::UniqueDescriptor memory{handle};
+
+	size_t progress = 0;
+	{
+		helix::Mapping mapping{memory, 0, size};
+		while(progress < size) {
+			auto chunk = read(fd, reinterpret_cast<char *>(mapping.get()) + progress,
+					size - progress);
+			if(!chunk)
+				break;
+			if(chunk < 0)
+				throw std::runtime_error("Error while reading file");
+			progress += chunk;
+		}
+	}
+
+	close(fd);
+
+	return {std::move(memory), progress};
+}
+
+static managarm::svrctl::Description readDescription(const char *path) {
+	auto buffer = readEntireFile(path);
+
+	managarm::svrctl::Description desc;
+	bragi::limited_reader rd{buffer.data(), buffer.size()};
+	auto deser = bragi::deserializer{};
+	desc.decode_body(rd, deser);
+	return desc;
+}
+
 // ----------------------------------------------------------------------------
 // svrctl handling.
 // ----------------------------------------------------------------------------
@@ -139,19 +192,22 @@ async::result<void> uploadFile(const char *name) {
 
 	if(resp->error() == managarm::svrctl::Errors::DATA_REQUIRED) {
 		// The kernel does not know the file, we have to read its contents.
-		req.set_with_data(true);
+		// Pass them as a memory object that the kernel adopts; this avoids
+		// copying the entire file through the lane.
+		auto file = readFileToMemory(name);
+		req.set_with_memory(true);
+		req.set_size(file.size);
 
-		auto buffer = readEntireFile(name);
-		auto [offer, send_req, send_data, recv_resp] = co_await helix_ng::exchangeMsgs(
+		auto [offer, send_req, push_memory, recv_resp] = co_await helix_ng::exchangeMsgs(
 			svrctlLane,
 			helix_ng::offer(
 				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
-				helix_ng::sendBuffer(buffer.data(), buffer.size()),
+				helix_ng::pushDescriptor(file.memory),
 				helix_ng::recvInline())
 		);
 		HEL_CHECK(offer.error());
 		HEL_CHECK(send_req.error());
-		HEL_CHECK(send_data.error());
+		HEL_CHECK(push_memory.error());
 		HEL_CHECK(recv_resp.error());
 
 		resp = bragi::parse_head_only<managarm::svrctl::FileUploadResponse>(recv_resp);
@@ -162,6 +218,31 @@ async::result<void> uploadFile(const char *name) {
 	assert(resp->error() == managarm::svrctl::Errors::SUCCESS);
 }
 
+// Awaits a set of coroutines that run concurrently.
+async::result<void> awaitAll(std::vector<async::result<void>> tasks) {
+	size_t pending = tasks.size();
+	async::oneshot_event done;
+	if(!pending)
+		co_return;
+
+	for(auto &task : tasks)
+		async::detach([] (async::result<void> task, size_t &pending,
+				async::oneshot_event &done) -> async::result<void> {
+			co_await std::move(task);
+			if(!--pending)
+				done.raise();
+		}(std::move(task), pending, done));
+
+	co_await done.wait();
+}
+
+async::result<void> uploadFiles(const managarm::svrctl::Description &desc) {
+	std::vector<async::result<void>> uploads;
+	for(auto &file : desc.files())
+		uploads.push_back(uploadFile(file.path().c_str()));
+	co_await awaitAll(std::move(uploads));
+}
+
 async::result<int> bindServer(helix::UniqueLane &lane, int mbusId) {
 	managarm::svrctl::DeviceBindRequest req;
 	req.set_mbus_id(mbusId);
@@ -186,6 +267,59 @@ async::result<int> bindServer(helix::UniqueLane &lane, int mbusId) {
 		co_return 1;
 }
 
+// ----------------------------------------------------------------
+// Dependency handling.
+// ----------------------------------------------------------------
+
+struct Server {
+	managarm::svrctl::Description desc;
+	async::oneshot_event running;
+};
+
+// Servers are identified by the name of their description.
+using ServerMap = std::map<std::string, Server>;
+
+// Returns true if the "after" dependencies of the servers form a cycle.
+static bool hasCycle(ServerMap &servers) {
+	enum class Mark { visiting, done };
+	std::map<std::string, Mark> marks;
+
+	std::function<bool(const std::string &)> visit = [&] (const std::string &name) {
+		auto it = servers.find(name);
+		if(it == servers.end())
+			return false;
+		if(auto mark = marks.find(name); mark != marks.end())
+			return mark->second == Mark::visiting;
+
+		marks[name] = Mark::visiting;
+		for(auto &dep : it->second.desc.after())
+			if(visit(dep))
+				return true;
+		marks[name] = Mark::done;
+		return false;
+	};
+
+	for(auto &[name, _] : servers)
+		if(visit(name))
+			return true;
+	return false;
+}
+
+async::result<void> startServer(Server &server, ServerMap &servers) {
+	// Dependencies that are not part of this invocation are assumed to be running already.
+	for(auto &dep : server.desc.after()) {
+		auto it = servers.find(dep);
+		if(it != servers.end())
+			co_await it->second.running.wait();
+	}
+
+	log("runsvr: Running %s\n", server.desc.name().c_str());
+
+	co_await uploadFiles(server.desc);
+	co_await runServer(server.desc.exec().c_str());
+	server.running.raise();
+}
+
 // ----------------------------------------------------------------
 // Freestanding mbus functions.
 // ----------------------------------------------------------------
@@ -194,7 +328,7 @@ enum class action {
 	runsvr, run, bind, upload
 };
 
-async::result<int> asyncMain(action act, std::string path) {
+async::result<int> asyncMain(action act, std::string path, std::vector<std::string> paths) {
 	co_await enumerateSvrctl();
 
 	switch (act) {
@@ -206,36 +340,40 @@ async::result<int> asyncMain(action act, std::string path) {
 		}
 
 		case action::run: {
-			auto buffer = readEntireFile(path.c_str());
-
-			managarm::svrctl::Description desc;
-			bragi::limited_reader rd{buffer.data(), buffer.size()};
-			auto deser = bragi::deserializer{};
-			desc.decode_body(rd, deser);
-
-			log("runsvr: Running %s\n", desc.name().c_str());
-
-			for(auto &file : desc.files())
-				co_await uploadFile(file.path().c_str());
-
-			co_await runServer(desc.exec().c_str());
+			// Independent servers are started concurrently;
+			// each server waits for the servers that it is declared to run after.
+			ServerMap servers;
+			for(auto &p : paths) {
+				auto desc = readDescription(p.c_str());
+				auto name = desc.name();
+				auto [it, inserted] = servers.try_emplace(std::move(name));
+				if(!inserted) {
+					err("runsvr: Duplicate description %s\n", it->first.c_str());
+					co_return 1;
+				}
+				it->second.desc = std::move(desc);
+			}
+
+			if(hasCycle(servers)) {
+				err("runsvr: Cyclic dependencies between servers\n");
+				co_return 1;
+			}
+
+			std::vector<async::result<void>> starts;
+			for(auto &[name, server] : servers)
+				starts.push_back(startServer(server, servers));
+			co_await awaitAll(std::move(starts));
 
 			break;
 		}
 
 		case action::bind: {
-			auto buffer = readEntireFile(path.c_str());
-
-			managarm::svrctl::Description desc;
-			bragi::limited_reader rd{buffer.data(), buffer.size()};
-			auto deser = bragi::deserializer{};
-			desc.decode_body(rd, deser);
+			auto desc = readDescription(path.c_str());
 
 			auto id_str = getenv("MBUS_ID");
 			log("runsvr: Binding driver %s to mbus ID %s\n", desc.name().c_str(), id_str);
 
-			for(auto &file : desc.files())
-				co_await uploadFile(file.path().c_str());
+			co_await uploadFiles(desc);
 
 			auto lane = co_await runServer(desc.exec().c_str());
 			co_await bindServer(lane, std::stoi(id_str));
@@ -264,6 +402,7 @@ int main(int argc, const char **argv) {
 
 	bool do_fork = false;
 	std::string path;
+	std::vector<std::string> paths;
 	action act;
 
 	CLI::App app{"runsvr"};
@@ -273,7 +412,7 @@ int main(int argc, const char **argv) {
 	sub_runsvr->add_option("path", path, "Path to executable")->required();
 
 	CLI::App *sub_run = app.add_subcommand("run", "Run a server (used in conjunction with bind)");
-	sub_run->add_option("path", path, "Path to description")->required();
+	sub_run->add_option("paths", paths, "Paths to descriptions")->required();
 
 	CLI::App *sub_bind = app.add_subcommand("bind", "Bind an mbus ID to a server");
 	sub_bind->add_option("path", path, "Path to description")->required();
@@ -310,5 +449,5 @@ int main(int argc, const char **argv) {
 		mbus_ng::recreateInstance();
 	}
 
-	return async::run(asyncMain(act, std::move(path)), helix::currentDispatcher);
+	return async::run(asyncMain(act, std::move(path), std::move(paths)), helix::currentDispatcher);
 }
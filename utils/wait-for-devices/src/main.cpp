@@ -1,30 +1,93 @@
+#include <chrono>
 #include <functional>
 #include <iostream>
 #include <print>
 #include <vector>
 
 #include <CLI/CLI.hpp>
+#include <async/oneshot-event.hpp>
 #include <fcntl.h>
+#include <helix/ipc.hpp>
 #include <libudev.h>
 #include <poll.h>
+#include <protocols/mbus/client.hpp>
 #include <string.h>
 
 struct Predicate {
 	const char *name{nullptr};
 	std::function<bool(udev_device *)> detect;
+	// Filter that matches the device's mbus entity.
+	std::function<mbus_ng::AnyFilter()> mbusFilter;
 };
 
 std::vector<Predicate> pending;
 
 bool debug = false;
 
+auto startTime = std::chrono::steady_clock::now();
+
+// Time since startup, to find drivers that are slow to bring up their devices.
+long long elapsedMs() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - startTime).count();
+}
+
+async::result<void> waitForEntity(const Predicate &predicate) {
+	auto enumerator = mbus_ng::Instance::global().enumerate(predicate.mbusFilter());
+
+	auto report = [&] (const std::vector<mbus_ng::EnumerationEvent> &events,
+			const char *source) {
+		for (auto &event : events) {
+			if (debug)
+				std::println(std::cerr, "{} probes mbus entity {} ({})",
+						source, event.id, event.name);
+			if (event.type != mbus_ng::EnumerationEvent::Type::created)
+				continue;
+			std::println("{} found {} at mbus entity {} ({}) after {} ms",
+					source, predicate.name, event.id, event.name, elapsedMs());
+			return true;
+		}
+		return false;
+	};
+
+	// Check existing entities first; this fetches all pages without waiting.
+	auto existing = (co_await enumerator.currentEvents()).unwrap();
+	if (report(existing, "Enumeration"))
+		co_return;
+
+	std::println("    Missing: {}", predicate.name);
+	while (true) {
+		auto [_, events] = (co_await enumerator.nextEvents()).unwrap();
+		if (report(events, "Subscription"))
+			co_return;
+	}
+}
+
+// Waits for all predicates concurrently.
+async::result<void> waitForEntities() {
+	size_t remaining = pending.size();
+	async::oneshot_event done;
+
+	for (auto &predicate : pending)
+		async::detach([] (const Predicate &predicate, size_t &remaining,
+				async::oneshot_event &done) -> async::result<void> {
+			co_await waitForEntity(predicate);
+			if (!--remaining)
+				done.raise();
+		}(predicate, remaining, done));
+
+	co_await done.wait();
+}
+
 int main(int argc, char **argv) {
 	bool wantGraphics{false};
 	bool wantMouse{false};
 	bool wantKeyboard{false};
+	bool useMbus{false};
 
 	CLI::App app{"wait-for-devices"};
 	app.add_flag("--debug", debug);
+	app.add_flag("--mbus", useMbus, "Subscribe to mbus instead of waiting for udev");
 	app.add_flag("--want-graphics", wantGraphics);
 	app.add_flag("--want-keyboard", wantKeyboard);
 	app.add_flag("--want-mouse", wantMouse);
@@ -36,6 +99,9 @@ int main(int argc, char **argv) {
 			.name = "graphics",
 			.detect = [] (udev_device *udevDevice) {
 				return udev_device_get_subsystem(udevDevice) == std::string_view{"drm"};
+			},
+			.mbusFilter = [] () -> mbus_ng::AnyFilter {
+				return mbus_ng::EqualsFilter{"unix.subsystem", "drm"};
 			}
 		});
 	if (wantKeyboard)
@@ -43,6 +109,12 @@ int main(int argc, char **argv) {
 			.name = "keyboard",
 			.detect = [] (udev_device *udevDevice) {
 				return udev_device_get_property_value(udevDevice, "ID_INPUT_KEYBOARD") != nullptr;
+			},
+			.mbusFilter = [] () -> mbus_ng::AnyFilter {
+				return mbus_ng::Conjunction{{
+					mbus_ng::EqualsFilter{"unix.subsystem", "input"},
+					mbus_ng::EqualsFilter{"input.keyboard", "1"}
+				}};
 			}
 		});
 	if (wantMouse)
@@ -50,12 +122,24 @@ int main(int argc, char **argv) {
 			.name = "mouse",
 			.detect = [] (udev_device *udevDevice) {
 				return udev_device_get_property_value(udevDevice, "ID_INPUT_MOUSE") != nullptr;
+			},
+			.mbusFilter = [] () -> mbus_ng::AnyFilter {
+				return mbus_ng::Conjunction{{
+					mbus_ng::EqualsFilter{"unix.subsystem", "input"},
+					mbus_ng::EqualsFilter{"input.mouse", "1"}
+				}};
 			}
 		});
 
 	if (pending.empty())
 		return 0;
 
+	// The mbus mode does not need to wait for posix to generate sysfs and udev events.
+	if (useMbus) {
+		async::run(waitForEntities(), helix::currentDispatcher);
+		return 0;
+	}
+
 	auto udevInstance = udev_new();
 	if (!udevInstance) {
 		std::println(std::cerr, "udev_new() failed");
@@ -104,7 +188,8 @@ int main(int argc, char **argv) {
 
 		std::erase_if(pending, [&] (auto &predicate) {
 			if (predicate.detect(udevDevice)) {
-				std::println("Enumeration found {} at {}", predicate.name, syspath);
+				std::println("Enumeration found {} at {} after {} ms",
+						predicate.name, syspath, elapsedMs());
 				return true;
 			}
 			return false;
@@ -144,7 +229,8 @@ int main(int argc, char **argv) {
 
 		std::erase_if(pending, [&] (auto &predicate) {
 			if (predicate.detect(udevDevice)) {
-				std::println("Monitor found {} at {}", predicate.name, syspath);
+				std::println("Monitor found {} at {} after {} ms",
+						predicate.name, syspath, elapsedMs());
 				return true;
 			}
 			return false;